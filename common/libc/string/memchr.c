@@ -0,0 +1,53 @@
+/*
+ * This file is shared between libc and the kernel, so don't put anything
+ * in here that won't work in both contexts.
+ */
+
+#ifdef _KERNEL
+#include <types.h>
+#include <lib.h>
+#else
+#include <stdint.h>
+#include <string.h>
+#endif
+
+#include "strword.h"
+
+/*
+ * C standard function - find the first byte CH in a block of memory.
+ */
+
+void *
+memchr(const void *ptr, int ch, size_t len)
+{
+	const unsigned char *p = ptr;
+	const unsigned long *w;
+	unsigned long pat;
+
+	/*
+	 * Once aligned, XOR each word with CH in every byte, which
+	 * makes the bytes that matched zero, and look for a zero byte.
+	 * Then find which one it was.
+	 */
+
+	for (; len > 0 && (uintptr_t)p % sizeof(long) != 0; p++, len--) {
+		if (*p == (unsigned char)ch) {
+			return (void *)p;
+		}
+	}
+
+	pat = STR_BCAST(ch);
+	for (w = (const unsigned long *)p; len >= sizeof(long); w++) {
+		if (STR_HASZERO(*w ^ pat)) {
+			break;
+		}
+		len -= sizeof(long);
+	}
+
+	for (p = (const unsigned char *)w; len > 0; p++, len--) {
+		if (*p == (unsigned char)ch) {
+			return (void *)p;
+		}
+	}
+	return NULL;
+}
@@ -47,40 +47,71 @@
 void *
 memcpy(void *dst, const void *src, size_t len)
 {
-	size_t i;
+	char *d = dst;
+	const char *s = src;
+	long *dw;
+	const long *sw;
 
 	/*
 	 * memcpy does not support overlapping buffers, so always do it
 	 * forwards. (Don't change this without adjusting memmove.)
 	 *
-	 * For speedy copying, optimize the common case where both pointers
-	 * and the length are word-aligned, and copy word-at-a-time instead
-	 * of byte-at-a-time. Otherwise, copy by bytes.
+	 * If the two pointers are equally far off word alignment, copy
+	 * bytes up to a word boundary, then words, eight at a time while
+	 * there are that many, then the leftover bytes. MIPS can't load
+	 * or store a misaligned word, so if they are misaligned
+	 * differently it has to be bytes all the way, four to a trip.
 	 *
-	 * The alignment logic below should be portable. We rely on
-	 * the compiler to be reasonably intelligent about optimizing
-	 * the divides and modulos out. Fortunately, it is.
+	 * Every store is to an address below the loads still to come,
+	 * so memmove can rely on this when the destination is below the
+	 * source.
 	 */
 
-	if ((uintptr_t)dst % sizeof(long) == 0 &&
-	    (uintptr_t)src % sizeof(long) == 0 &&
-	    len % sizeof(long) == 0) {
-
-		long *d = dst;
-		const long *s = src;
+	if (len >= sizeof(long) &&
+	    ((uintptr_t)d - (uintptr_t)s) % sizeof(long) == 0) {
+		while ((uintptr_t)d % sizeof(long) != 0) {
+			*d++ = *s++;
+			len--;
+		}
 
-		for (i=0; i<len/sizeof(long); i++) {
-			d[i] = s[i];
+		dw = (long *)d;
+		sw = (const long *)s;
+		while (len >= 8 * sizeof(long)) {
+			dw[0] = sw[0];
+			dw[1] = sw[1];
+			dw[2] = sw[2];
+			dw[3] = sw[3];
+			dw[4] = sw[4];
+			dw[5] = sw[5];
+			dw[6] = sw[6];
+			dw[7] = sw[7];
+			dw += 8;
+			sw += 8;
+			len -= 8 * sizeof(long);
+		}
+		while (len >= sizeof(long)) {
+			*dw++ = *sw++;
+			len -= sizeof(long);
 		}
+		d = (char *)dw;
+		s = (const char *)sw;
 	}
 	else {
-		char *d = dst;
-		const char *s = src;
-
-		for (i=0; i<len; i++) {
-			d[i] = s[i];
+		while (len >= 4) {
+			d[0] = s[0];
+			d[1] = s[1];
+			d[2] = s[2];
+			d[3] = s[3];
+			d += 4;
+			s += 4;
+			len -= 4;
 		}
 	}
 
+	while (len > 0) {
+		*d++ = *s++;
+		len--;
+	}
+
 	return dst;
 }
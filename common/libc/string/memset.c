@@ -31,9 +31,12 @@
 #include <types.h>
 #include <lib.h>
 #else
+#include <stdint.h>
 #include <string.h>
 #endif
 
+#include "strword.h"
+
 /*
  * C standard function - initialize a block of memory
  */
@@ -41,11 +44,45 @@
 void *
 memset(void *ptr, int ch, size_t len)
 {
-	char *p = ptr;
-	size_t i;
+	unsigned char *p = ptr;
+	unsigned long w, *pw;
+
+	/*
+	 * Bytes up to a word boundary, then words of CH (eight at a
+	 * time while there are that many), then the leftover bytes.
+	 * Short fills aren't worth setting up for.
+	 */
+
+	if (len >= 2 * sizeof(long)) {
+		while ((uintptr_t)p % sizeof(long) != 0) {
+			*p++ = ch;
+			len--;
+		}
+
+		w = STR_BCAST(ch);
+		pw = (unsigned long *)p;
+		while (len >= 8 * sizeof(long)) {
+			pw[0] = w;
+			pw[1] = w;
+			pw[2] = w;
+			pw[3] = w;
+			pw[4] = w;
+			pw[5] = w;
+			pw[6] = w;
+			pw[7] = w;
+			pw += 8;
+			len -= 8 * sizeof(long);
+		}
+		while (len >= sizeof(long)) {
+			*pw++ = w;
+			len -= sizeof(long);
+		}
+		p = (unsigned char *)pw;
+	}
 
-	for (i=0; i<len; i++) {
-		p[i] = ch;
+	while (len > 0) {
+		*p++ = ch;
+		len--;
 	}
 
 	return ptr;
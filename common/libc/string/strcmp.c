@@ -36,9 +36,12 @@
 #include <types.h>
 #include <lib.h>
 #else
+#include <stdint.h>
 #include <string.h>
 #endif
 
+#include "strword.h"
+
 /*
  * Standard C string function: compare two strings and return their
  * sort order.
@@ -47,8 +50,34 @@
 int
 strcmp(const char *a, const char *b)
 {
+	const unsigned long *wa, *wb;
 	size_t i;
 
+	/*
+	 * If A and B are equally far off word alignment, go a byte at
+	 * a time to a word boundary and then a word at a time, for as
+	 * long as the words match and A's has no terminator in it.
+	 * Then finish off byte by byte from the first word that
+	 * differs (or ends the string), below.
+	 */
+
+	i = 0;
+	if (((uintptr_t)a - (uintptr_t)b) % sizeof(long) == 0) {
+		for (; (uintptr_t)(a+i) % sizeof(long) != 0; i++) {
+			if (a[i] == 0 || a[i] != b[i]) {
+				goto bytes;
+			}
+		}
+		wa = (const unsigned long *)(a+i);
+		wb = (const unsigned long *)(b+i);
+		while (*wa == *wb && !STR_HASZERO(*wa)) {
+			wa++;
+			wb++;
+		}
+		i = (const char *)wa - a;
+	}
+ bytes:
+
 	/*
 	 * Walk down both strings until either they're different
 	 * or we hit the end of A.
@@ -63,7 +92,7 @@ strcmp(const char *a, const char *b)
 	 * B.
 	 */
 
-	for (i=0; a[i]!=0 && a[i]==b[i]; i++) {
+	for (; a[i]!=0 && a[i]==b[i]; i++) {
 		/* nothing */
 	}
 
@@ -36,9 +36,12 @@
 #include <types.h>
 #include <lib.h>
 #else
+#include <stdint.h>
 #include <string.h>
 #endif
 
+#include "strword.h"
+
 /*
  * C standard string function: get length of a string
  */
@@ -46,10 +49,25 @@
 size_t
 strlen(const char *str)
 {
-	size_t ret = 0;
+	const char *p;
+	const unsigned long *w;
+
+	/*
+	 * Look at a word at a time once aligned. An aligned word never
+	 * straddles a page, so reading all of the one that holds the
+	 * terminator can't fault even if the string ends early in it.
+	 */
 
-	while (str[ret]) {
-		ret++;
+	for (p = str; (uintptr_t)p % sizeof(long) != 0; p++) {
+		if (*p == 0) {
+			return p - str;
+		}
+	}
+	for (w = (const unsigned long *)p; !STR_HASZERO(*w); w++) {
+		/* nothing */
+	}
+	for (p = (const char *)w; *p != 0; p++) {
+		/* nothing */
 	}
-	return ret;
+	return p - str;
 }
@@ -0,0 +1,22 @@
+/*
+ * Word-at-a-time helpers for the string functions here. Shared
+ * between libc and the kernel.
+ *
+ * STR_BCAST(c) is an unsigned long with every byte C.
+ *
+ * STR_HASZERO(w) is nonzero if and only if some byte of the unsigned
+ * long W is zero. Subtracting 1 from every byte sets the high bit of
+ * each byte that was zero (and of bytes above it, through the
+ * borrow, but only when there is a zero byte anyway); masking with ~W
+ * drops bytes whose high bit was already set.
+ */
+
+#ifndef _STRWORD_H_
+#define _STRWORD_H_
+
+#define STR_ONES	((unsigned long)-1 / 0xff)
+#define STR_HIGHS	(STR_ONES * 0x80)
+#define STR_BCAST(c)	(STR_ONES * (unsigned char)(c))
+#define STR_HASZERO(w)	(((w) - STR_ONES) & ~(w) & STR_HIGHS)
+
+#endif /* _STRWORD_H_ */
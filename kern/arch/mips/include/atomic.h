@@ -0,0 +1,82 @@
+#ifndef _MIPS_ATOMIC_H_
+#define _MIPS_ATOMIC_H_
+
+/*
+ * Atomic operations with LL/SC; see include/atomic.h, and
+ * spinlock_data_testandset in spinlock.h for how LL/SC works. No
+ * memory accesses may come between the LL and the SC, but a branch
+ * or an add may.
+ */
+
+ATOMIC_INLINE
+unsigned
+atomic_cas(volatile unsigned *p, unsigned old, unsigned new)
+{
+	unsigned x;
+	unsigned y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"move %1, %4;"		/*   y = new */
+			"bne %0, %3, 1f;"	/*   if (x != old) give up */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			"1:"
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (p), "r" (old), "r" (new)
+			: "memory");
+	} while (x == old && y == 0);
+	return x;
+}
+
+ATOMIC_INLINE
+unsigned
+atomic_fetchadd(volatile unsigned *p, int delta)
+{
+	unsigned x;
+	unsigned y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"addu %1, %0, %3;"	/*   y = x + delta */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (p), "r" (delta)
+			: "memory");
+	} while (y == 0);
+	return x;
+}
+
+ATOMIC_INLINE
+unsigned
+atomic_swap(volatile unsigned *p, unsigned new)
+{
+	unsigned x;
+	unsigned y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"move %1, %3;"		/*   y = new */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (p), "r" (new)
+			: "memory");
+	} while (y == 0);
+	return x;
+}
+
+#endif /* _MIPS_ATOMIC_H_ */
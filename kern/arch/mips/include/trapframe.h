@@ -104,5 +104,8 @@ __DEAD void mips_usermode(struct trapframe *tf);
 extern vaddr_t cpustacks[];
 extern vaddr_t cputhreads[];
 
+/* Array used by the TLB refill handler to find the page table. */
+extern vaddr_t cpupagetables[];
+
 
 #endif /* _MIPS_TRAPFRAME_H_ */
@@ -43,4 +43,11 @@
 typedef __u32 paddr_t;
 typedef __u32 vaddr_t;
 
+/*
+ * Data cache line size, for laying out per-cpu data (see
+ * __cacheline_aligned in cdefs.h). MIPS32 cores use 16 to 64 bytes;
+ * the largest covers them all. System/161 doesn't model a cache.
+ */
+#define CACHELINE_SIZE	64
+
 #endif /* _MIPS_TYPES_H_ */
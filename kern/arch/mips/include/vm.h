@@ -66,6 +66,7 @@
  * a valid address, and will make a *huge* mess if you scribble on it.
  */
 #define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
+#define KVADDR_TO_PADDR(vaddr) ((vaddr)-MIPS_KSEG0)
 
 /*
  * The top of user space. (Actually, the address immediately above the
@@ -83,6 +84,13 @@
  */
 #define USERSTACK     USERSPACETOP
 
+/*
+ * Kernel addresses mapped a page at a time through the TLB, for
+ * vmalloc: the first 16M of kseg2.
+ */
+#define KVMAP_BASE    MIPS_KSEG2
+#define KVMAP_PAGES   4096
+
 /*
  * Interface to the low-level module that looks after the amount of
  * physical memory we have.
@@ -117,10 +125,7 @@ paddr_t ram_getfirstfree(void);
  */
 
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	uint32_t ts_entryhi;	/* page and ASID to invalidate */
 };
 
 #define TLBSHOOTDOWN_MAX 16
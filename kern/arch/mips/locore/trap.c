@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/wait.h>
 #include <signal.h>
 #include <lib.h>
 #include <mips/specialreg.h>
@@ -39,6 +40,8 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <syscall.h>
+#include <proc.h>
+#include "opt-shell.h"
 
 
 /* in exception-*.S */
@@ -46,6 +49,7 @@ extern __DEAD void asm_usermode(struct trapframe *tf);
 
 /* called only from assembler, so not declared in a header */
 void mips_trap(struct trapframe *tf);
+void mips_syscall(struct trapframe *tf);
 
 
 /* Names for trap codes */
@@ -108,13 +112,18 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 		break;
 	}
 
-	/*
-	 * You will probably want to change this.
-	 */
-
 	kprintf("Fatal user mode trap %u sig %d (%s, epc 0x%x, vaddr 0x%x)\n",
 		code, sig, trapcodenames[code], epc, vaddr);
+
+#if OPT_SHELL
+	/* A fault that failed because the OOM killer chose us */
+	if (curproc->p_killsig != 0) {
+		sig = curproc->p_killsig;
+	}
+	uproc_exit(_MKWAIT_SIG(sig));
+#else
 	panic("I don't know how to handle this\n");
+#endif
 }
 
 /*
@@ -195,6 +204,28 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+#if OPT_SHELL
+		/*
+		 * If another thread is taking our process down, go
+		 * now rather than at the next system call, which a
+		 * thread in a loop might never make. This needs
+		 * interrupts back on, as for the cases below.
+		 */
+		if (!iskern && curproc != NULL && curproc->p_exiting) {
+			spl = splhigh();
+			splx(spl);
+			uthread_checkexit();
+		}
+
+		/* Add any profil() tick to the user's histogram */
+		if (!iskern && curthread->t_profticks > 0) {
+			spl = splhigh();
+			splx(spl);
+			profil_flush();
+			cpu_irqoff();
+		}
+#endif
 		goto done2;
 	}
 
@@ -315,6 +346,17 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+#if OPT_SHELL
+	/* Threads of an exiting process stop on the way out */
+	if (!iskern) {
+		uthread_checkexit();
+	}
+#endif
+	/* Give way to a real-time thread the system call woke up */
+	if (!iskern) {
+		thread_preemptcheck();
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -347,6 +389,46 @@ mips_trap(struct trapframe *tf)
 	KASSERT(SAME_STACK(cpustacks[curcpu->c_number]-1, (vaddr_t)tf));
 }
 
+/*
+ * System call handling function for mips: the short path for system
+ * calls from user mode, which the assembly-language exception handler
+ * takes instead of mips_trap. It saves only part of the trapframe;
+ * see exception-*.S. This does what mips_trap would for EX_SYS,
+ * without the decoding.
+ */
+void
+mips_syscall(struct trapframe *tf)
+{
+	int spl;
+
+	KASSERT(curthread != NULL && curthread->t_stack != NULL);
+	KASSERT((vaddr_t)tf > (vaddr_t)curthread->t_stack);
+	KASSERT((vaddr_t)tf < (vaddr_t)(curthread->t_stack + STACK_SIZE));
+
+	/* Interrupts were on in user mode; put them back on */
+	spl = splhigh();
+	splx(spl);
+	KASSERT(curthread->t_curspl == 0);
+	KASSERT(curthread->t_iplhigh_count == 0);
+
+	DEBUG(DB_SYSCALL, "syscall: #%d, args %x %x %x %x\n",
+	      tf->tf_v0, tf->tf_a0, tf->tf_a1, tf->tf_a2, tf->tf_a3);
+
+	syscall(tf);
+
+#if OPT_SHELL
+	uthread_checkexit();
+#endif
+	thread_preemptcheck();
+
+	cpu_irqoff();
+
+	/* We may have moved to another cpu; see the end of mips_trap */
+	cputhreads[curcpu->c_number] = (vaddr_t)curthread;
+	cpustacks[curcpu->c_number] = (vaddr_t)curthread->t_stack + STACK_SIZE;
+	KASSERT(SAME_STACK(cpustacks[curcpu->c_number]-1, (vaddr_t)tf));
+}
+
 /*
  * Function for entering user mode.
  *
@@ -0,0 +1,179 @@
+#!/bin/sh
+#
+# gensystab.sh
+# Usage: ./gensystab.sh kern/syscall.h syscall.h > systab.h
+#
+# Generates the system call table for syscall.c from the call numbers
+# in kern/syscall.h and the prototypes of the sys_* functions in
+# syscall.h. Each call with both gets an entry in systab[] and a
+# small function that unpacks its arguments and calls it:
+#
+#    - arguments are 32-bit words, except off_t, which takes an
+#      aligned pair of words (see syscall.c);
+#    - a "struct trapframe *" argument gets the trapframe, and the
+#      entry is marked as needing it (such calls can't be batched);
+#    - trailing arguments named retval* get the return value words,
+#      v0 first and then v1;
+#    - a function returning int or ssize_t returns the error code; one
+#      returning void doesn't return at all; one returning anything
+#      else can't fail, and its value is the return value.
+#
+# Prototypes inside "#if OPT_FOO" ... "#endif" get their entries
+# inside the same conditional.
+#
+
+awk '
+    function trim(s) {
+	sub("^ +", "", s);
+	sub(" +$", "", s);
+	return s;
+    }
+
+    # Emit the entry for the prototype P, under condition COND.
+    function doproto(p, cond,    head, args, name, ret, n, i, a, type,
+		     pname, call, nw, nrv) {
+	gsub(" +", " ", p);
+	head = trim(substr(p, 1, index(p, "(") - 1));
+	args = substr(p, index(p, "(") + 1);
+	args = trim(substr(args, 1, index(args, ")") - 1));
+
+	match(head, "sys_[A-Za-z0-9_]+$");
+	name = substr(head, RSTART + 4);
+	ret = trim(substr(head, 1, RSTART - 1));
+	if (!(name in num) || (name in body)) {
+		return;
+	}
+
+	n = split(args, a, ",");
+	call = "";
+	nw = 0;
+	nrv = 0;
+	for (i=1; i<=n; i++) {
+	    a[i] = trim(a[i]);
+	    if (a[i] == "void") {
+		continue;
+	    }
+	    match(a[i], "[A-Za-z_][A-Za-z0-9_]*$");
+	    pname = substr(a[i], RSTART);
+	    type = trim(substr(a[i], 1, RSTART - 1));
+	    if (call != "") {
+		call = call ", ";
+	    }
+	    if (type == "struct trapframe *") {
+		call = call "tf";
+		usestf[name] = 1;
+	    }
+	    else if (pname ~ "^retval") {
+		call = call "(" type ")&rv[" nrv "]";
+		nrv++;
+	    }
+	    else if (type == "off_t") {
+		nw += nw % 2;
+		call = call "(off_t)SYSARG_DWORD(a, " nw ")";
+		nw += 2;
+	    }
+	    else {
+		call = call "(" type ")a[" nw "]";
+		nw++;
+	    }
+	}
+
+	call = "sys_" name "(" call ")";
+	if (ret == "void") {
+	    call = "\t" call ";\n\tpanic(\"sys_" name " returned\\n\");\n";
+	}
+	else if (ret == "int" || ret == "ssize_t") {
+	    call = "\treturn " call ";\n";
+	}
+	else {
+	    call = "\trv[0] = (int32_t)" call ";\n\treturn 0;\n";
+	}
+	body[name] = call;
+	nwords[name] = nw;
+	cnd[name] = cond;
+    }
+
+    FNR == 1 { file++; }
+
+    # tabs to spaces, just in case
+    { gsub("\t", " "); $0 = $0; }
+
+    # kern/syscall.h: the call numbers, between the markers.
+    file == 1 && /^\/\*CALLBEGIN\*\// { look = 1; }
+    file == 1 && /^\/\*CALLEND\*\// { look = 0; }
+    file == 1 && look && /^#define SYS_/ && NF == 3 {
+	name = $2;
+	sub("^SYS_", "", name);
+	num[name] = $3;
+	order[ncalls++] = name;
+	if ($3 + 0 > max) {
+	    max = $3 + 0;
+	}
+    }
+
+    # syscall.h: the prototypes, which may go on for several lines.
+    file == 2 && /^#if / { cond = trim($0); next; }
+    file == 2 && /^#endif/ { cond = ""; next; }
+    file == 2 && proto == "" && /(^| |\*)sys_[A-Za-z0-9_]+\(/ { proto = " "; }
+    file == 2 && proto != "" {
+	proto = proto " " $0;
+	if (proto ~ ";") {
+	    doproto(proto, cond);
+	    proto = "";
+	}
+    }
+
+    function setcond(c) {
+	if (c != curcond) {
+	    if (curcond != "") {
+		print "#endif";
+	    }
+	    if (c != "") {
+		print c;
+	    }
+	    curcond = c;
+	}
+    }
+
+    END {
+	print "/*";
+	print " * System call table. Automatically generated by gensystab.sh";
+	print " * from kern/syscall.h and syscall.h; do not edit.";
+	print " */";
+	print "";
+	printf "#define SYSTAB_SIZE %d\n", max + 1;
+	print "";
+
+	curcond = "";
+	for (i=0; i<ncalls; i++) {
+	    name = order[i];
+	    if (!(name in body)) {
+		continue;
+	    }
+	    setcond(cnd[name]);
+	    print "static";
+	    print "int";
+	    print "sysent_" name "(struct trapframe *tf, const uint32_t *a, int32_t *rv)";
+	    print "{";
+	    print "\t(void)tf; (void)a; (void)rv;";
+	    printf "%s", body[name];
+	    print "}";
+	    print "";
+	}
+	setcond("");
+
+	print "static const struct sysent systab[SYSTAB_SIZE] = {";
+	for (i=0; i<ncalls; i++) {
+	    name = order[i];
+	    if (!(name in body)) {
+		continue;
+	    }
+	    setcond(cnd[name]);
+	    printf "\t[SYS_%s] = { \"%s\", %d, %s, sysent_%s },\n", \
+		name, name, nwords[name], \
+		(name in usestf) ? "true" : "false", name;
+	}
+	setcond("");
+	print "};";
+    }
+' "$1" "$2"
@@ -31,12 +31,19 @@
 #include <kern/errno.h>
 #include <kern/syscall.h>
 #include <lib.h>
+#include <spl.h>
+#include <clock.h>
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
+#include <cpu.h>
 #include <syscall.h>
 #include <copyinout.h>
+#include <kern/sysbatch.h>
+#include <kern/systrace.h>
 #include <addrspace.h>
+#include <percpu.h>
+#include <platform/maxcpus.h>
 
 /*
  * System call dispatcher.
@@ -71,23 +78,177 @@
  * return code will restart the "syscall" instruction and the system
  * call will repeat forever.
  *
+ * System calls from user mode come here by a short path (see
+ * exception-*.S and mips_syscall) that saves and restores only part
+ * of the trapframe. So a call may change only tf_v0, tf_v1, tf_a3
+ * and tf_epc; and of the registers it may look at, the caller-saved
+ * ones (AT, t0-t9, hi, lo) aren't saved.
+ *
  * If you run out of registers (which happens quickly with 64-bit
  * values) further arguments must be fetched from the user-level
  * stack, starting at sp+16 to skip over the slots for the
  * registerized values, with copyin().
+ *
+ * All of that is done the same way for every call, from a table
+ * (systab.h) generated by gensystab.sh from the call numbers and the
+ * sys_* prototypes. Each entry gives the number of argument words,
+ * counting the registers and then the stack, so they can all be
+ * fetched up front into an array; the entry's function takes them
+ * from there, a 64-bit value from an aligned pair of words with the
+ * high word first (MIPS is big-endian). So adding a system call is
+ * just a matter of giving it a number and a prototype.
+ *
+ * syscall_batch makes several calls through the same table in one
+ * trip, with the argument words supplied in memory instead.
+ */
+
+/* Most argument words any call has: mmap's 4 + fd + pad + off_t */
+#define SYSARG_MAX	8
+
+/* The 64-bit argument in words I and I+1 */
+#define SYSARG_DWORD(a, i) \
+	(((uint64_t)(a)[i] << 32) | (uint64_t)(a)[(i) + 1])
+
+struct sysent {
+	const char *se_name;
+	unsigned se_nargs;		/* argument words */
+	bool se_usestf;			/* uses the trapframe itself */
+	int (*se_call)(struct trapframe *tf, const uint32_t *a, int32_t *rv);
+};
+
+#include "systab.h"
+
+/*
+ * Per-call statistics, one array per cpu, made the first time the
+ * cpu takes a system call. Only that cpu writes its array, with
+ * interrupts off; calls that don't return (_exit) aren't counted.
+ * Times are in nanoseconds, from entry to the dispatcher until the
+ * result is stored, including any time spent asleep. ss_hist counts
+ * the calls by log2 of their time in microseconds: bucket 0 is under
+ * 2us, bucket N is [2^N, 2^(N+1)) us, and the last bucket also takes
+ * everything longer. ss_bytesin and ss_bytesout count what the calls
+ * moved through copyin/copyout and friends.
+ */
+#define SYSHIST_NBUCKETS	20
+
+struct syscallstat {
+	unsigned ss_calls;
+	unsigned ss_errors;
+	uint64_t ss_nsecs;
+	uint32_t ss_maxnsecs;
+	unsigned ss_hist[SYSHIST_NBUCKETS];
+	uint64_t ss_bytesin;
+	uint64_t ss_bytesout;
+};
+
+static struct syscallstat *syscallstats[MAXCPUS];
+
+/*
+ * Fetch the NARGS argument words of the call in TF.
+ */
+static
+int
+syscall_getargs(struct trapframe *tf, unsigned nargs, uint32_t *args)
+{
+	KASSERT(nargs <= SYSARG_MAX);
+
+	args[0] = tf->tf_a0;
+	args[1] = tf->tf_a1;
+	args[2] = tf->tf_a2;
+	args[3] = tf->tf_a3;
+	if (nargs <= 4) {
+		return 0;
+	}
+	return copyin((const_userptr_t)(tf->tf_sp + 16), &args[4],
+		      (nargs - 4) * sizeof(uint32_t));
+}
+
+/*
+ * Count a call to CALLNO that ran from BEFORE to AFTER and copied
+ * BYTESIN and BYTESOUT bytes.
  */
+static
 void
-syscall(struct trapframe *tf)
+syscall_account(int callno, int err, const struct timespec *before,
+		const struct timespec *after, size_t bytesin, size_t bytesout)
 {
-	int callno;
-	int32_t retval;
-	int err;
+	struct syscallstat *ss;
+	struct timespec diff;
+	uint64_t nsecs;
+	uint32_t usecs;
+	unsigned me, b;
+	int spl;
+
+	timespec_sub(after, before, &diff);
+	if (diff.tv_sec < 0) {
+		/* The clock was set back */
+		nsecs = 0;
+	}
+	else {
+		nsecs = (uint64_t)diff.tv_sec * 1000000000 + diff.tv_nsec;
+	}
+	usecs = nsecs > 0xffffffffULL * 1000 ? 0xffffffff : nsecs / 1000;
+	for (b=0; usecs > 1 && b < SYSHIST_NBUCKETS - 1; b++) {
+		usecs >>= 1;
+	}
 
-	KASSERT(curthread != NULL);
-	KASSERT(curthread->t_curspl == 0);
-	KASSERT(curthread->t_iplhigh_count == 0);
+	me = curcpu->c_number;
+	if (syscallstats[me] == NULL) {
+		/* Only this cpu sets its slot */
+		ss = kmalloc(SYSTAB_SIZE * sizeof(*ss));
+		if (ss == NULL) {
+			return;
+		}
+		bzero(ss, SYSTAB_SIZE * sizeof(*ss));
+		spl = splhigh();
+		if (syscallstats[curcpu->c_number] == NULL) {
+			syscallstats[curcpu->c_number] = ss;
+			ss = NULL;
+		}
+		splx(spl);
+		if (ss != NULL) {
+			/* We moved to a cpu with one already */
+			kfree(ss);
+		}
+	}
+
+	spl = splhigh();
+	ss = &syscallstats[curcpu->c_number][callno];
+	ss->ss_calls++;
+	if (err) {
+		ss->ss_errors++;
+	}
+	ss->ss_nsecs += nsecs;
+	if (nsecs > ss->ss_maxnsecs) {
+		ss->ss_maxnsecs = nsecs > 0xffffffff ? 0xffffffff : nsecs;
+	}
+	ss->ss_hist[b]++;
+	ss->ss_bytesin += bytesin;
+	ss->ss_bytesout += bytesout;
+	splx(spl);
+}
 
-	callno = tf->tf_v0;
+/*
+ * Make call CALLNO, with the argument words ARGS, or those in TF if
+ * ARGS is NULL, and count it. Returns the error, and the return value
+ * in RETVAL.
+ */
+static
+int
+syscall_dispatch(struct trapframe *tf, int callno, const uint32_t *args,
+		 int32_t *retval)
+{
+	const struct sysent *se;
+	uint32_t tfargs[SYSARG_MAX];
+	char path[SYSTRACE_PATHLEN];
+	struct timespec before, after;
+	size_t copiedin, copiedout;
+	int err;
+
+	gettime(&before);
+	path[0] = '\0';
+	copiedin = curthread->t_copiedin;
+	copiedout = curthread->t_copiedout;
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -98,113 +259,51 @@ syscall(struct trapframe *tf)
 	 * like write.
 	 */
 
-	retval = 0;
-
-	#if OPT_SHELL
-	int32_t retval_high = 0;
-	off_t pos;
-	#endif
+	retval[0] = retval[1] = 0;
 
-	switch (callno) {
-	    case SYS_reboot:
-		err = sys_reboot(tf->tf_a0);
-		break;
-
-	    case SYS___time:
-		err = sys___time((userptr_t)tf->tf_a0,
-				 (userptr_t)tf->tf_a1);
-		break;
-
-#if OPT_SHELL
-        case SYS_read:
-			err = sys_read(
-				(int)tf->tf_a0,
-				(void *)tf->tf_a1,
-				(size_t)tf->tf_a2,
-				&retval);
-			break;
-
-		case SYS_write:
-			err = sys_write((int)tf->tf_a0,
-							(userptr_t)tf->tf_a1,
-							(size_t)tf->tf_a2,
-							&retval);
-			break;
-
-        case SYS_open:
-			err = sys_open((userptr_t)tf->tf_a0,
-					(int)tf->tf_a1,
-					(mode_t)tf->tf_a2,
-					&retval);
-			break;
-
-        case SYS_close:
-			err = sys_close((int)tf->tf_a0);
-			break;
-		
-		case SYS_lseek: {
-            pos = tf->tf_a2;
-			pos <<= 32;
-			pos |= tf->tf_a3;
-            
-			err = sys_lseek(
-				(int)tf->tf_a0,
-				pos,
-				*(int32_t *)(tf->tf_sp + 16),
-				(int32_t *) &retval,
-				(int32_t *) &retval_high
-			);
-			break;
-        }
+	if (callno < 0 || callno >= SYSTAB_SIZE ||
+	    systab[callno].se_call == NULL) {
+		kprintf("Unknown syscall %d\n", callno);
+		return ENOSYS;
+	}
+	se = &systab[callno];
 
+	err = 0;
+	if (args == NULL) {
+		err = syscall_getargs(tf, se->se_nargs, tfargs);
+		args = tfargs;
+	}
+	if (!err && systrace_paths) {
+		/* Before the call, as execv will have replaced it after */
+		systrace_getpath(callno, args, path);
+	}
+	if (!err) {
+		err = se->se_call(tf, args, retval);
+	}
 
-		case SYS_dup2:
-			err = sys_dup2((int)tf->tf_a0, (int)tf->tf_a1, &retval);
-			break;
+	gettime(&after);
+	syscall_account(callno, err, &before, &after,
+			curthread->t_copiedin - copiedin,
+			curthread->t_copiedout - copiedout);
+	systrace_record(callno, err, retval[0], args, se->se_nargs,
+			path, &before, &after);
 
-		case SYS_chdir:
-			err = sys_chdir((const char *)tf->tf_a0);
-			break;
+	return err;
+}
 
-		case SYS___getcwd:
-			err = sys___getcwd((char *)tf->tf_a0, 
-							(size_t)tf->tf_a1, 
-							&retval);
-			break;
+void
+syscall(struct trapframe *tf)
+{
+	int32_t retval[2];
+	int err;
 
-		case SYS_getpid:
-			err = 0;
-			retval = sys_getpid();
-			break;
-		case SYS_fork:
-			err = sys_fork(tf, &retval);
-			break;
-		case SYS_execv:
-			err = sys_execv((const char *)tf->tf_a0,
-							(char **)tf->tf_a1);
-			break;
-		case SYS_waitpid:
-    		err = sys_waitpid((pid_t)tf->tf_a0,
-                      (int *)tf->tf_a1,
-                      (int)tf->tf_a2,
-                      &retval);
-    		break;
-        case SYS__exit:
-			sys__exit((int)tf->tf_a0);
-			/* sys__exit does not return */
-			panic("sys__exit returned\n");
-			break;
-		case SYS_remove:
-			err = sys_remove((const char *)tf->tf_a0);
-			break;
-#endif
+	KASSERT(curthread != NULL);
+	KASSERT(curthread->t_curspl == 0);
+	KASSERT(curthread->t_iplhigh_count == 0);
 
-	    default:
-		kprintf("Unknown syscall %d\n", callno);
-		err = ENOSYS;
-		break;
-	}
+	percpu_inc(PCPU_SYSCALLS);
 
+	err = syscall_dispatch(tf, tf->tf_v0, NULL, retval);
 
 	if (err) {
 		/*
@@ -217,10 +316,8 @@ syscall(struct trapframe *tf)
 	}
 	else {
 		/* Success. */
-		tf->tf_v0 = retval;
-		#if OPT_SHELL		
-		tf->tf_v1 = retval_high;
-		#endif
+		tf->tf_v0 = retval[0];
+		tf->tf_v1 = retval[1];
 		tf->tf_a3 = 0;      /* signal no error */
 	}
 
@@ -237,6 +334,173 @@ syscall(struct trapframe *tf)
 	KASSERT(curthread->t_iplhigh_count == 0);
 }
 
+/*
+ * sys_syscall_batch - make several system calls in one go.
+ *
+ * Each struct sysbatch in CALLS (see <kern/sysbatch.h>) is read in,
+ * run through the table as if it had come from a trap, and written
+ * back with its result, in order. The first call to fail stops the
+ * batch. Calls that need the trapframe itself (fork, and
+ * syscall_batch) are refused with EINVAL.
+ *
+ * Returns the number of calls made, counting the one that failed,
+ * if any; or an error if none was made because NCALLS or CALLS was
+ * no good.
+ */
+int
+sys_syscall_batch(struct trapframe *tf, userptr_t calls, unsigned ncalls,
+		  int *retval)
+{
+	struct sysbatch sbc;
+	int32_t results[SYSBATCH_MAX];
+	unsigned i, j;
+	int err, result;
+
+	COMPILE_ASSERT(sizeof(sbc.sbc_args) == SYSARG_MAX * sizeof(uint32_t));
+
+	if (ncalls == 0 || ncalls > SYSBATCH_MAX) {
+		return EINVAL;
+	}
+
+	for (i=0; i<ncalls; i++) {
+		result = copyin((const_userptr_t)calls + i * sizeof(sbc),
+				&sbc, sizeof(sbc));
+		if (result) {
+			if (i == 0) {
+				return result;
+			}
+			break;
+		}
+
+		if (sbc.sbc_useret >= (1U << SYSARG_MAX) ||
+		    (sbc.sbc_useret != 0 && sbc.sbc_retfrom >= i)) {
+			err = EINVAL;
+		}
+		else if (sbc.sbc_callno >= 0 &&
+			 sbc.sbc_callno < SYSTAB_SIZE &&
+			 systab[sbc.sbc_callno].se_usestf) {
+			err = EINVAL;
+		}
+		else {
+			for (j=0; j<SYSARG_MAX; j++) {
+				if (sbc.sbc_useret & (1U << j)) {
+					sbc.sbc_args[j] =
+						results[sbc.sbc_retfrom];
+				}
+			}
+			err = syscall_dispatch(tf, sbc.sbc_callno,
+					       sbc.sbc_args, sbc.sbc_retval);
+		}
+		sbc.sbc_error = err;
+		results[i] = err ? 0 : sbc.sbc_retval[0];
+
+		result = copyout(&sbc, calls + i * sizeof(sbc), sizeof(sbc));
+		if (result || err) {
+			i++;
+			break;
+		}
+	}
+	*retval = i;
+	return 0;
+}
+
+/*
+ * Return the name of call CALLNO, or NULL if there is no such call.
+ */
+const char *
+syscall_name(int callno)
+{
+	if (callno < 0 || callno >= SYSTAB_SIZE ||
+	    systab[callno].se_call == NULL) {
+		return NULL;
+	}
+	return systab[callno].se_name;
+}
+
+/*
+ * Print the per-call statistics, summed over the cpus.
+ */
+void
+syscall_printstats(void)
+{
+	struct syscallstat sum;
+	unsigned i, c;
+
+	kprintf("%-16s %9s %7s %12s %10s %10s %10s %10s\n", "call", "calls",
+		"errors", "total ms", "avg us", "max us", "in KB", "out KB");
+	for (i=0; i<SYSTAB_SIZE; i++) {
+		if (systab[i].se_call == NULL) {
+			continue;
+		}
+		bzero(&sum, sizeof(sum));
+		for (c=0; c<MAXCPUS; c++) {
+			if (syscallstats[c] == NULL) {
+				continue;
+			}
+			sum.ss_calls += syscallstats[c][i].ss_calls;
+			sum.ss_errors += syscallstats[c][i].ss_errors;
+			sum.ss_nsecs += syscallstats[c][i].ss_nsecs;
+			if (syscallstats[c][i].ss_maxnsecs > sum.ss_maxnsecs) {
+				sum.ss_maxnsecs = syscallstats[c][i].ss_maxnsecs;
+			}
+			sum.ss_bytesin += syscallstats[c][i].ss_bytesin;
+			sum.ss_bytesout += syscallstats[c][i].ss_bytesout;
+		}
+		if (sum.ss_calls == 0) {
+			continue;
+		}
+		kprintf("%-16s %9u %7u %12llu %10llu %10u %10llu %10llu\n",
+			systab[i].se_name, sum.ss_calls, sum.ss_errors,
+			(unsigned long long)(sum.ss_nsecs / 1000000),
+			(unsigned long long)(sum.ss_nsecs / sum.ss_calls / 1000),
+			sum.ss_maxnsecs / 1000,
+			(unsigned long long)(sum.ss_bytesin / 1024),
+			(unsigned long long)(sum.ss_bytesout / 1024));
+	}
+}
+
+/*
+ * Print the latency histogram of each call made, summed over the
+ * cpus.
+ */
+void
+syscall_printhist(void)
+{
+	unsigned hist[SYSHIST_NBUCKETS];
+	unsigned i, c, b, calls;
+	char upper[16];
+
+	for (i=0; i<SYSTAB_SIZE; i++) {
+		if (systab[i].se_call == NULL) {
+			continue;
+		}
+		bzero(hist, sizeof(hist));
+		calls = 0;
+		for (c=0; c<MAXCPUS; c++) {
+			if (syscallstats[c] == NULL) {
+				continue;
+			}
+			for (b=0; b<SYSHIST_NBUCKETS; b++) {
+				hist[b] += syscallstats[c][i].ss_hist[b];
+			}
+			calls += syscallstats[c][i].ss_calls;
+		}
+		if (calls == 0) {
+			continue;
+		}
+		kprintf("%s: %u calls\n", systab[i].se_name, calls);
+		for (b=0; b<SYSHIST_NBUCKETS; b++) {
+			if (hist[b] == 0) {
+				continue;
+			}
+			snprintf(upper, sizeof(upper), "%u", 1U << (b + 1));
+			kprintf("    %8u - %-8s us %9u\n", b == 0 ? 0 : 1U << b,
+				b == SYSHIST_NBUCKETS - 1 ? "" : upper,
+				hist[b]);
+		}
+	}
+}
+
 /*
  * Enter user mode for a newly forked process.
  *
@@ -272,6 +536,15 @@ void enter_forked_process(void *data, unsigned long unused)
     /* Activate the new address space */
     as_activate();
 
+    /*
+     * The syscall short path (exception-*.S) doesn't save the
+     * registers a call may clobber; don't give the child whatever
+     * was on the kernel stack in their place.
+     */
+    kernel_tf.tf_at = kernel_tf.tf_hi = kernel_tf.tf_lo = 0;
+    bzero(&kernel_tf.tf_t0, 8 * sizeof(uint32_t));
+    kernel_tf.tf_t8 = kernel_tf.tf_t9 = 0;
+
     /* Modify the trapframe for the child */
     kernel_tf.tf_v0 = 0;	/* Return value for the child */
     kernel_tf.tf_a3 = 0;	/* Signal no error */
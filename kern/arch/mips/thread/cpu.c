@@ -67,6 +67,12 @@
 vaddr_t cpustacks[MAXCPUS];
 vaddr_t cputhreads[MAXCPUS];
 
+/*
+ * Each CPU's current page table, for the TLB refill handler; 0 sends
+ * every miss to vm_fault. Set by vmtlb_activate; dumbvm leaves it 0.
+ */
+vaddr_t cpupagetables[MAXCPUS];
+
 /*
  * Do machine-dependent initialization of the cpu structure or things
  * associated with a new cpu. Note that we're not running on the new
@@ -120,6 +126,15 @@ cpu_getprid(void)
 	return prid;
 }
 
+uint32_t
+cpu_getcycles(void)
+{
+	uint32_t count;
+
+	__asm volatile("mfc0 %0,$9" : "=r" (count));
+	return count;
+}
+
 static inline
 uint32_t
 cpu_getfeatures(void)
@@ -32,12 +32,15 @@
 #include <lib.h>
 #include <spl.h>
 #include <cpu.h>
+#include <percpu.h>
 #include <spinlock.h>
 #include <proc.h>
 #include <current.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <coremap.h>
+#include <timepage.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -59,15 +62,10 @@
 /* (this must be > 64K so argument blocks of size ARG_MAX will fit) */
 #define DUMBVM_STACKPAGES    18
 
-/*
- * Wrap ram_stealmem in a spinlock.
- */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
-
 void
 vm_bootstrap(void)
 {
-	/* Do nothing. */
+	/* Nothing; boot() has already set up the coremap. */
 }
 
 /*
@@ -90,18 +88,15 @@ dumbvm_can_sleep(void)
 	}
 }
 
+/*
+ * Physical pages come from the coremap, which falls back to
+ * ram_stealmem until coremap_bootstrap has run.
+ */
 static
 paddr_t
 getppages(unsigned long npages)
 {
-	paddr_t addr;
-
-	spinlock_acquire(&stealmem_lock);
-
-	addr = ram_stealmem(npages);
-
-	spinlock_release(&stealmem_lock);
-	return addr;
+	return coremap_getpages(npages);
 }
 
 /* Allocate/free some kernel-space virtual pages */
@@ -121,9 +116,7 @@ alloc_kpages(unsigned npages)
 void
 free_kpages(vaddr_t addr)
 {
-	/* nothing - leak the memory. */
-
-	(void)addr;
+	coremap_freepages(KVADDR_TO_PADDR(addr));
 }
 
 void
@@ -133,23 +126,33 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
 	panic("dumbvm tried to do tlb shootdown?!\n");
 }
 
+void
+vm_tlbshootdown_all(void)
+{
+	panic("dumbvm tried to do tlb shootdown?!\n");
+}
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
 	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
 	paddr_t paddr;
 	int i;
-	uint32_t ehi, elo;
+	uint32_t ehi, elo, dirty;
 	struct addrspace *as;
 	int spl;
 
 	faultaddress &= PAGE_FRAME;
 
 	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
+	percpu_inc(PCPU_FAULTS);
 
 	switch (faulttype) {
 	    case VM_FAULT_READONLY:
-		/* We always create pages read-write, so we can't get this */
+		/* Everything but the time page is read-write */
+		if (faultaddress == TIMEPAGE_VADDR) {
+			return EFAULT;
+		}
 		panic("dumbvm: got VM_FAULT_READONLY\n");
 	    case VM_FAULT_READ:
 	    case VM_FAULT_WRITE:
@@ -206,9 +209,15 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	else if (faultaddress >= stackbase && faultaddress < stacktop) {
 		paddr = (faultaddress - stackbase) + as->as_stackpbase;
 	}
+	else if (faultaddress == TIMEPAGE_VADDR &&
+		 faulttype == VM_FAULT_READ) {
+		paddr = timepage_paddr();
+	}
 	else {
 		return EFAULT;
 	}
+	/* Everything is writable except the time page */
+	dirty = faultaddress == TIMEPAGE_VADDR ? 0 : TLBLO_DIRTY;
 
 	/* make sure it's page-aligned */
 	KASSERT((paddr & PAGE_FRAME) == paddr);
@@ -222,16 +231,20 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 			continue;
 		}
 		ehi = faultaddress;
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
+		elo = paddr | dirty | TLBLO_VALID;
 		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
 		tlb_write(ehi, elo, i);
 		splx(spl);
 		return 0;
 	}
 
-	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
+	/* No free slot; replace one at random. */
+	ehi = faultaddress;
+	elo = paddr | dirty | TLBLO_VALID;
+	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x (replacing)\n", faultaddress, paddr);
+	tlb_random(ehi, elo);
 	splx(spl);
-	return EFAULT;
+	return 0;
 }
 
 struct addrspace *
@@ -257,6 +270,16 @@ void
 as_destroy(struct addrspace *as)
 {
 	dumbvm_can_sleep();
+
+	if (as->as_pbase1 != 0) {
+		coremap_freepages(as->as_pbase1);
+	}
+	if (as->as_pbase2 != 0) {
+		coremap_freepages(as->as_pbase2);
+	}
+	if (as->as_stackpbase != 0) {
+		coremap_freepages(as->as_stackpbase);
+	}
 	kfree(as);
 }
 
@@ -383,6 +406,17 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_define_threadstack(struct addrspace *as, unsigned slot,
+		      vaddr_t *stackptr)
+{
+	/* There's only the one stack. */
+	(void)as;
+	(void)slot;
+	(void)stackptr;
+	return ENOSYS;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
@@ -0,0 +1,302 @@
+/*
+ * MIPS TLB management for the paging VM system.
+ *
+ * The TLB is a software-loaded cache of the page tables: vm_fault
+ * resolves the page and then calls vmtlb_load to enter it. Entries
+ * are replaced at random when the TLB is full.
+ *
+ * Each address space gets an ASID, which goes in the PID field of
+ * every TLB entry it loads and in the EntryHi register while it is
+ * running, so entries belonging to other address spaces stay in the
+ * TLB across context switches. There are only NUM_ASID of them
+ * (ASID 0 is never handed out), so they are assigned in generations:
+ * when they run out, the generation number is bumped and every
+ * address space gets a fresh ASID the next time it is activated. A
+ * CPU flushes its TLB the first time it activates something from a
+ * new generation, which gets rid of entries tagged with recycled
+ * ASIDs.
+ *
+ * Changes that other CPUs must see are sent as shootdowns naming the
+ * page and ASID to drop. Dropping all of an address space's entries
+ * is instead done by giving it a new ASID; the old one's entries are
+ * then dead, and disappear at the next generation's flush.
+ *
+ * Kernel mappings in kseg2 (see vmalloc.c) are loaded global, so they
+ * match under every ASID and survive address space switches. They
+ * are dropped page by page, with shootdowns that name no ASID.
+ *
+ * Most misses never get here: the refill handler in exception-mips1.S
+ * looks the page up in cpupagetables[] for the CPU, and loads the PTE
+ * itself if vm_fault has marked it PTE_REFILL (see pagetable.h). It
+ * works in registers k0 and k1 only, and touches nothing that could
+ * miss in the TLB, so page tables must be in kseg0 (kmalloc's are).
+ *
+ * The tlb_* primitives clobber EntryHi, so everything here puts the
+ * current ASID back when it is done.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <mips/trapframe.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <vm.h>
+
+#define GET_ENTRYHI(x) __asm volatile("mfc0 %0,$10" : "=r" (x))
+#define SET_ENTRYHI(x) __asm volatile("mtc0 %0,$10" :: "r" (x))
+
+/* What the refill handler takes for granted */
+#define PT_L2OFFSET	16
+
+static struct spinlock asid_lock = SPINLOCK_INITIALIZER;
+static unsigned asid_generation = 1;
+static unsigned asid_next = 1;
+
+/*
+ * Return the PID field currently in EntryHi.
+ */
+static
+uint32_t
+vmtlb_curpid(void)
+{
+	uint32_t ehi;
+
+	GET_ENTRYHI(ehi);
+	return ehi & TLBHI_PID;
+}
+
+static
+void
+vmtlb_flush(void)
+{
+	int i;
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+}
+
+void
+vmtlb_activate(struct addrspace *as)
+{
+	unsigned gen;
+	int spl;
+
+	COMPILE_ASSERT(PTE_REFILL == TLBLO_VALID);
+	COMPILE_ASSERT(PTE_WRITABLE == TLBLO_DIRTY);
+	COMPILE_ASSERT(__builtin_offsetof(struct pagetable, pt_l2) ==
+		       PT_L2OFFSET);
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	spinlock_acquire(&asid_lock);
+	if (as->as_asidgen != asid_generation) {
+		if (asid_next == NUM_ASID) {
+			asid_generation++;
+			asid_next = 1;
+		}
+		as->as_asid = asid_next++;
+		as->as_asidgen = asid_generation;
+	}
+	gen = asid_generation;
+	spinlock_release(&asid_lock);
+
+	if (curcpu->c_asidgen != gen) {
+		vmtlb_flush();
+		curcpu->c_asidgen = gen;
+	}
+	SET_ENTRYHI(as->as_asid << TLBHI_PIDSHIFT);
+	cpupagetables[curcpu->c_number] = (vaddr_t)as->as_pt;
+
+	splx(spl);
+}
+
+void
+vmtlb_deactivate(void)
+{
+	int spl;
+
+	spl = splhigh();
+	cpupagetables[curcpu->c_number] = 0;
+	splx(spl);
+}
+
+void
+vmtlb_load(vaddr_t vaddr, paddr_t paddr, bool writeable)
+{
+	uint32_t ehi, elo, pid;
+	int i, spl;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	spl = splhigh();
+
+	pid = vmtlb_curpid();
+	ehi = vaddr | pid;
+	elo = paddr | TLBLO_VALID;
+	if (writeable) {
+		elo |= TLBLO_DIRTY;
+	}
+
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		tlb_write(ehi, elo, i);
+	}
+	else {
+		tlb_random(ehi, elo);
+	}
+	SET_ENTRYHI(pid);
+
+	splx(spl);
+}
+
+void
+vmtlb_loadkernel(vaddr_t vaddr, paddr_t paddr)
+{
+	uint32_t ehi, elo, pid;
+	int i, spl;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+	KASSERT(vaddr >= MIPS_KSEG2);
+
+	spl = splhigh();
+
+	pid = vmtlb_curpid();
+	ehi = vaddr;
+	elo = paddr | TLBLO_VALID | TLBLO_DIRTY | TLBLO_GLOBAL;
+
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		tlb_write(ehi, elo, i);
+	}
+	else {
+		tlb_random(ehi, elo);
+	}
+	SET_ENTRYHI(pid);
+
+	splx(spl);
+}
+
+void
+vmtlb_invalidate(struct addrspace *as, vaddr_t vaddr)
+{
+	uint32_t pid;
+	int i, spl;
+
+	spl = splhigh();
+
+	pid = vmtlb_curpid();
+	i = tlb_probe((vaddr & PAGE_FRAME) | (as->as_asid << TLBHI_PIDSHIFT),
+		      0);
+	if (i >= 0) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	SET_ENTRYHI(pid);
+
+	splx(spl);
+}
+
+void
+vmtlb_flushall(void)
+{
+	uint32_t pid;
+	int spl;
+
+	spl = splhigh();
+
+	pid = vmtlb_curpid();
+	vmtlb_flush();
+	SET_ENTRYHI(pid);
+
+	splx(spl);
+}
+
+void
+vmtlb_shootdown(struct addrspace *as, vaddr_t vaddr)
+{
+	struct tlbshootdown ts;
+
+	vmtlb_invalidate(as, vaddr);
+
+	ts.ts_entryhi = (vaddr & PAGE_FRAME) | (as->as_asid << TLBHI_PIDSHIFT);
+	ipi_tlbshootdown_broadcast(&ts, 1);
+}
+
+void
+vmtlb_kernshootdown(vaddr_t vaddr, unsigned npages)
+{
+	struct tlbshootdown ts[TLBSHOOTDOWN_MAX];
+	uint32_t pid;
+	unsigned i, n;
+	int ix, spl;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+	KASSERT(vaddr >= MIPS_KSEG2);
+
+	spl = splhigh();
+	pid = vmtlb_curpid();
+	for (i=0; i<npages; i++) {
+		/* Global entries match whatever the ASID */
+		ix = tlb_probe(vaddr + i * PAGE_SIZE, 0);
+		if (ix >= 0) {
+			tlb_write(TLBHI_INVALID(ix), TLBLO_INVALID(), ix);
+		}
+	}
+	SET_ENTRYHI(pid);
+	splx(spl);
+
+	while (npages > 0) {
+		n = npages < TLBSHOOTDOWN_MAX ? npages : TLBSHOOTDOWN_MAX;
+		for (i=0; i<n; i++) {
+			ts[i].ts_entryhi = vaddr + i * PAGE_SIZE;
+		}
+		ipi_tlbshootdown_broadcast(ts, n);
+		vaddr += n * PAGE_SIZE;
+		npages -= n;
+	}
+}
+
+void
+vmtlb_newasid(struct addrspace *as)
+{
+	spinlock_acquire(&asid_lock);
+	as->as_asidgen = 0;
+	spinlock_release(&asid_lock);
+
+	if (as == proc_getas()) {
+		vmtlb_activate(as);
+	}
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	uint32_t pid;
+	int i, spl;
+
+	spl = splhigh();
+
+	pid = vmtlb_curpid();
+	i = tlb_probe(ts->ts_entryhi, 0);
+	if (i >= 0) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	SET_ENTRYHI(pid);
+
+	splx(spl);
+}
+
+void
+vm_tlbshootdown_all(void)
+{
+	vmtlb_flushall();
+}
@@ -40,10 +40,15 @@
 #include <membar.h>
 #include <synch.h>
 #include <mainbus.h>
+#include <percpu.h>
+#include <kprof.h>
+#include <syscall.h>
+#include <platform/maxcpus.h>
 #include <sys161/bus.h>
 #include <lamebus/lamebus.h>
 #include <lamebus/ltrace.h>
 #include "autoconf.h"
+#include "opt-kprof.h"
 
 /*
  * CPU frequency used by the on-chip timer.
@@ -53,17 +58,43 @@
  */
 #define CPU_FREQUENCY 25000000 /* 25 MHz */
 
+/*
+ * Timer state, by cpu number, each cpu's on a cache line of its own.
+ * Only the cpu itself touches its entry, with interrupts off.
+ *
+ * tc_cycles is the cycles the cpu counted before c0_count was last
+ * zeroed (see mips_timer_set), so that mainbus_cycles can count on
+ * past it.
+ *
+ * tc_stretched is set while the timer is stretched (see
+ * mainbus_timer_stop). Writing c0_compare also zeroes c0_count on
+ * System/161, so while stretched tc_base holds how far into the
+ * hardclock period the cpu was when the count was restarted.
+ */
+struct timer_cpu {
+	uint64_t tc_cycles;
+	uint32_t tc_base;
+	bool tc_stretched;
+} __cacheline_aligned;
+
+static struct timer_cpu timer_cpus[MAXCPUS];
+
 /*
  * Access to the on-chip timer.
  *
  * The c0_count register increments on every cycle; when the value
  * matches the c0_compare register, the timer interrupt line is
- * asserted. Writing to c0_compare again clears the interrupt.
+ * asserted. Writing to c0_compare again clears the interrupt, and on
+ * System/161 zeroes c0_count, so the count so far is banked first.
  */
 static
 void
 mips_timer_set(uint32_t count)
 {
+	int spl;
+
+	spl = splhigh();
+	timer_cpus[curcpu->c_number].tc_cycles += cpu_getcycles();
 	/*
 	 * $11 == c0_compare; we can't use the symbolic name inside
 	 * the asm string.
@@ -74,6 +105,75 @@ mips_timer_set(uint32_t count)
 		"mtc0 %0, $11;"		/* do it */
 		".set pop"		/* restore assembler mode */
 		:: "r" (count));
+	splx(spl);
+}
+
+uint64_t
+mainbus_cycles(void)
+{
+	uint64_t cycles;
+	int spl;
+
+	spl = splhigh();
+	cycles = timer_cpus[curcpu->c_number].tc_cycles + cpu_getcycles();
+	splx(spl);
+	return cycles;
+}
+
+/* Cycles per hardclock */
+#define TIMER_PERIOD (CPU_FREQUENCY / HZ)
+
+/*
+ * Restart the periodic timer, in phase with the hardclocks so far,
+ * and return how many hardclocks have come due since the last one.
+ */
+static
+unsigned
+timer_reset(void)
+{
+	unsigned me = curcpu->c_number;
+	uint32_t elapsed;
+
+	elapsed = cpu_getcycles();
+	if (timer_cpus[me].tc_stretched) {
+		elapsed += timer_cpus[me].tc_base;
+		timer_cpus[me].tc_stretched = false;
+	}
+	mips_timer_set(TIMER_PERIOD - elapsed % TIMER_PERIOD);
+	return elapsed / TIMER_PERIOD;
+}
+
+void
+mainbus_timer_stop(unsigned ticks)
+{
+	unsigned me = curcpu->c_number;
+	uint32_t base;
+
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(ticks > 0 && ticks <= 0xffffffffU / TIMER_PERIOD);
+	KASSERT(!timer_cpus[me].tc_stretched);
+
+	base = cpu_getcycles();
+	timer_cpus[me].tc_base = base;
+	timer_cpus[me].tc_stretched = true;
+	if (base >= ticks * TIMER_PERIOD) {
+		/* Already due; go off straight away */
+		mips_timer_set(1);
+	}
+	else {
+		mips_timer_set(ticks * TIMER_PERIOD - base);
+	}
+}
+
+unsigned
+mainbus_timer_restart(void)
+{
+	KASSERT(curthread->t_curspl > 0);
+
+	if (!timer_cpus[curcpu->c_number].tc_stretched) {
+		return 0;
+	}
+	return timer_reset();
 }
 
 /*
@@ -108,15 +208,26 @@ mainbus_bootstrap(void)
 	spl0();
 
 	/*
-	 * Now probe all the devices attached to the bus.
-	 * (This amounts to all devices.)
+	 * Configure the MIPS on-chip timer to interrupt HZ times a second.
 	 */
+	mips_timer_set(TIMER_PERIOD);
+}
+
+/*
+ * Probe all the devices attached to the bus. (This amounts to all
+ * devices.) The autoconf code probes different kinds of device in
+ * parallel threads.
+ */
+void
+mainbus_probe(void)
+{
 	autoconf_lamebus(lamebus, 0);
+}
 
-	/*
-	 * Configure the MIPS on-chip timer to interrupt HZ times a second.
-	 */
-	mips_timer_set(CPU_FREQUENCY / HZ);
+uint32_t
+mainbus_cyclerate(void)
+{
+	return CPU_FREQUENCY;
 }
 
 /*
@@ -128,6 +239,12 @@ mainbus_start_cpus(void)
 	lamebus_start_cpus(lamebus);
 }
 
+void
+mainbus_printintrstats(void)
+{
+	lamebus_printintrstats(lamebus);
+}
+
 /*
  * Function to generate the memory address (in the uncached segment)
  * for the specified offset into the specified slot's region of the
@@ -298,10 +415,12 @@ void
 mainbus_interrupt(struct trapframe *tf)
 {
 	uint32_t cause;
+	unsigned ticks;
 	bool seen = false;
 
 	/* interrupts should be off */
 	KASSERT(curthread->t_curspl > 0);
+	percpu_inc(PCPU_INTERRUPTS);
 
 	cause = tf->tf_cause;
 	if (cause & LAMEBUS_IRQ_BIT) {
@@ -315,8 +434,25 @@ mainbus_interrupt(struct trapframe *tf)
 	}
 	if (cause & MIPS_TIMER_BIT) {
 		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
-		/* and call hardclock */
+		ticks = timer_reset();
+#if OPT_KPROF
+		/* Only here do we know where the cpu was */
+		kprof_sample(tf);
+#endif
+		/* Likewise whether this tick is user or system time */
+		if (tf->tf_status & CST_KUp) {
+			curthread->t_stats.ss_userticks++;
+		}
+#if OPT_SHELL
+		/* Likewise the user pc, for profil() */
+		if (tf->tf_status & CST_KUp) {
+			profil_tick(tf->tf_epc, ticks);
+		}
+#endif
+		/* and call hardclock, after any we slept through */
+		if (ticks > 1) {
+			hardclock_catchup(ticks - 1);
+		}
 		hardclock();
 		seen = true;
 	}
@@ -341,4 +477,7 @@ mainbus_interrupt(struct trapframe *tf)
 			      cause);
 		}
 	}
+
+	/* Let a real-time thread woken by any of that take over */
+	thread_preemptcheck();
 }
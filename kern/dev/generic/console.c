@@ -55,6 +55,7 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <wchan.h>
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
@@ -79,7 +80,7 @@ static struct lock *con_userlock_write = NULL;
  * console is set up. Upon console setup they are dumped
  * to the actual console; thenceforth this space is unused.
  */
-#define DELAYBUFSIZE  1024
+#define DELAYBUFSIZE  4096
 static char delayed_outbuf[DELAYBUFSIZE];
 static size_t delayed_outbuf_pos=0;
 
@@ -117,11 +118,95 @@ static
 void
 putch_polled(struct con_softc *cs, int ch)
 {
+	bool locked;
+
+	/*
+	 * Send anything still buffered first, so it isn't overtaken
+	 * (or lost, if interrupts stay off from here on, as they do
+	 * in shutdown and panic). Unless we're panicking with cs_lock
+	 * held, somewhere in the middle of changing the buffer.
+	 */
+	locked = !spinlock_do_i_hold(&cs->cs_lock);
+	if (locked) {
+		spinlock_acquire(&cs->cs_lock);
+		while (cs->cs_sendchars_tail != cs->cs_sendchars_head) {
+			cs->cs_sendpolled(cs->cs_devdata,
+				cs->cs_sendchars[cs->cs_sendchars_tail]);
+			cs->cs_sendchars_tail = (cs->cs_sendchars_tail + 1)
+				% CONSOLE_OUTPUT_BUFFER_SIZE;
+		}
+	}
 	cs->cs_sendpolled(cs->cs_devdata, ch);
+	if (locked) {
+		spinlock_release(&cs->cs_lock);
+	}
 }
 
 //////////////////////////////////////////////////
 
+/*
+ * Send the next buffered character, if the device is idle. Caller
+ * holds cs_lock.
+ */
+static
+void
+con_kick(struct con_softc *cs)
+{
+	unsigned char ch;
+
+	KASSERT(spinlock_do_i_hold(&cs->cs_lock));
+
+	if (cs->cs_sending ||
+	    cs->cs_sendchars_tail == cs->cs_sendchars_head) {
+		return;
+	}
+	ch = cs->cs_sendchars[cs->cs_sendchars_tail];
+	cs->cs_sendchars_tail =
+		(cs->cs_sendchars_tail + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+	cs->cs_sending = true;
+	cs->cs_send(cs->cs_devdata, ch);
+}
+
+/*
+ * Queue LEN characters for output, turning newlines into CR-LF if
+ * CRLF is set. Waits only while the buffer is full.
+ *
+ * Note: as with cs_gotchars, head == tail means the buffer is empty,
+ * so it holds one less than its size.
+ */
+static
+void
+con_queue(struct con_softc *cs, const char *buf, size_t len, bool crlf)
+{
+	unsigned nexthead;
+	size_t i;
+	bool cr;
+
+	spinlock_acquire(&cs->cs_lock);
+	cr = false;
+	for (i=0; i<len; ) {
+		nexthead = (cs->cs_sendchars_head + 1) %
+			CONSOLE_OUTPUT_BUFFER_SIZE;
+		if (nexthead == cs->cs_sendchars_tail) {
+			/* Full, so it's sending; con_start wakes us */
+			wchan_sleep(cs->cs_wwchan, &cs->cs_lock);
+			continue;
+		}
+		if (crlf && buf[i] == '\n' && !cr) {
+			cs->cs_sendchars[cs->cs_sendchars_head] = '\r';
+			cr = true;
+		}
+		else {
+			cs->cs_sendchars[cs->cs_sendchars_head] = buf[i];
+			cr = false;
+			i++;
+		}
+		cs->cs_sendchars_head = nexthead;
+		con_kick(cs);
+	}
+	spinlock_release(&cs->cs_lock);
+}
+
 /*
  * Print a character, using interrupts to wait for I/O completion.
  */
@@ -129,8 +214,48 @@ static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
-	P(cs->cs_wsem);
-	cs->cs_send(cs->cs_devdata, ch);
+	char c = ch;
+
+	con_queue(cs, &c, 1, false);
+}
+
+/*
+ * Take up to LEN characters of input, stopping after a newline (or
+ * CR, which is turned into one), into BUF. Waits for the first one.
+ * If CRTONL is not set, return exactly one character as read.
+ */
+static
+size_t
+con_take(struct con_softc *cs, char *buf, size_t len, bool crtonl)
+{
+	size_t n;
+	char ch;
+
+	KASSERT(len > 0);
+
+	spinlock_acquire(&cs->cs_lock);
+	while (cs->cs_gotchars_head == cs->cs_gotchars_tail) {
+		wchan_sleep(cs->cs_rwchan, &cs->cs_lock);
+	}
+	n = 0;
+	while (n < len && cs->cs_gotchars_head != cs->cs_gotchars_tail) {
+		ch = cs->cs_gotchars[cs->cs_gotchars_tail];
+		cs->cs_gotchars_tail =
+			(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
+		if (!crtonl) {
+			buf[n++] = ch;
+			break;
+		}
+		if (ch == '\r') {
+			ch = '\n';
+		}
+		buf[n++] = ch;
+		if (ch == '\n') {
+			break;
+		}
+	}
+	spinlock_release(&cs->cs_lock);
+	return n;
 }
 
 /*
@@ -140,23 +265,17 @@ static
 int
 getch_intr(struct con_softc *cs)
 {
-	unsigned char ret;
+	char ret;
 
-	P(cs->cs_rsem);
-	ret = cs->cs_gotchars[cs->cs_gotchars_tail];
-	cs->cs_gotchars_tail =
-		(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
-	return ret;
+	con_take(cs, &ret, 1, false);
+	return (unsigned char)ret;
 }
 
 /*
  * Called from underlying device when a read-ready interrupt occurs.
  *
  * Note: if gotchars_head == gotchars_tail, the buffer is empty. Thus
- * if gotchars_head+1 == gotchars_tail, the buffer is full. A slightly
- * tidier way to implement this check (that avoids wasting a slot,
- * too) would be with a second semaphore used with a nonblocking P,
- * but we don't have that in OS/161.
+ * if gotchars_head+1 == gotchars_tail, the buffer is full.
  */
 void
 con_input(void *vcs, int ch)
@@ -164,27 +283,39 @@ con_input(void *vcs, int ch)
 	struct con_softc *cs = vcs;
 	unsigned nexthead;
 
+	spinlock_acquire(&cs->cs_lock);
 	nexthead = (cs->cs_gotchars_head + 1) % CONSOLE_INPUT_BUFFER_SIZE;
 	if (nexthead == cs->cs_gotchars_tail) {
 		/* overflow; drop character */
+		spinlock_release(&cs->cs_lock);
 		return;
 	}
 
 	cs->cs_gotchars[cs->cs_gotchars_head] = ch;
 	cs->cs_gotchars_head = nexthead;
 
-	V(cs->cs_rsem);
+	wchan_wakeall(cs->cs_rwchan, &cs->cs_lock);
+	spinlock_release(&cs->cs_lock);
+
+	pollhead_wakeup(&cs->cs_rpoll);
 }
 
 /*
  * Called from underlying device when a write-done interrupt occurs.
+ * Send the next character, and let writers waiting for space in.
  */
 void
 con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
 
-	V(cs->cs_wsem);
+	spinlock_acquire(&cs->cs_lock);
+	cs->cs_sending = false;
+	con_kick(cs);
+	wchan_wakeall(cs->cs_wwchan, &cs->cs_lock);
+	spinlock_release(&cs->cs_lock);
+
+	pollhead_wakeup(&cs->cs_wpoll);
 }
 
 //////////////////////////////////////////////////
@@ -240,12 +371,17 @@ con_eachopen(struct device *dev, int openflags)
 	return 0;
 }
 
+/* Characters con_io moves at a time */
+#define CON_IOCHUNK	128
+
 static
 int
 con_io(struct device *dev, struct uio *uio)
 {
+	struct con_softc *cs = the_console;
+	char buf[CON_IOCHUNK];
+	size_t len;
 	int result;
-	char ch;
 	struct lock *lk;
 
 	(void)dev;  // unused
@@ -258,33 +394,38 @@ con_io(struct device *dev, struct uio *uio)
 	}
 
 	KASSERT(lk != NULL);
+	if (uio->uio_rw == UIO_WRITE) {
+		/* Keep kernel messages logged so far ahead of this */
+		kprintf_flush();
+	}
 	lock_acquire(lk);
 
+	/*
+	 * Reads return at the end of a line, as before, but take what
+	 * input there is a chunk at a time; writes go out a chunk at a
+	 * time.
+	 */
 	while (uio->uio_resid > 0) {
+		len = uio->uio_resid < CON_IOCHUNK ? uio->uio_resid
+			: CON_IOCHUNK;
 		if (uio->uio_rw==UIO_READ) {
-			ch = getch();
-			if (ch=='\r') {
-				ch = '\n';
-			}
-			result = uiomove(&ch, 1, uio);
+			len = con_take(cs, buf, len, true);
+			result = uiomove(buf, len, uio);
 			if (result) {
 				lock_release(lk);
 				return result;
 			}
-			if (ch=='\n') {
+			if (buf[len-1] == '\n') {
 				break;
 			}
 		}
 		else {
-			result = uiomove(&ch, 1, uio);
+			result = uiomove(buf, len, uio);
 			if (result) {
 				lock_release(lk);
 				return result;
 			}
-			if (ch=='\n') {
-				putch('\r');
-			}
-			putch(ch);
+			con_queue(cs, buf, len, true);
 		}
 	}
 	lock_release(lk);
@@ -302,10 +443,64 @@ con_ioctl(struct device *dev, int op, userptr_t data)
 	return EINVAL;
 }
 
+/*
+ * Reads wait for a whole line, so input is only ready once there's a
+ * newline in the buffer (or it's full, and can't get one).
+ */
+static
+bool
+con_lineready(struct con_softc *cs)
+{
+	unsigned i, next;
+	unsigned char ch;
+
+	KASSERT(spinlock_do_i_hold(&cs->cs_lock));
+
+	for (i = cs->cs_gotchars_tail; i != cs->cs_gotchars_head; i = next) {
+		ch = cs->cs_gotchars[i];
+		if (ch == '\r' || ch == '\n') {
+			return true;
+		}
+		next = (i + 1) % CONSOLE_INPUT_BUFFER_SIZE;
+	}
+	return (cs->cs_gotchars_head + 1) % CONSOLE_INPUT_BUFFER_SIZE
+		== cs->cs_gotchars_tail;
+}
+
+static
+int
+con_poll(struct device *dev, int events, struct pollset *ps)
+{
+	struct con_softc *cs = the_console;
+	int ret = 0;
+
+	(void)dev;
+
+	if (events & POLLIN) {
+		pollset_register(ps, &cs->cs_rpoll);
+	}
+	if (events & POLLOUT) {
+		pollset_register(ps, &cs->cs_wpoll);
+	}
+
+	spinlock_acquire(&cs->cs_lock);
+	if ((events & POLLIN) && con_lineready(cs)) {
+		ret |= POLLIN;
+	}
+	if ((events & POLLOUT) &&
+	    (cs->cs_sendchars_head + 1) % CONSOLE_OUTPUT_BUFFER_SIZE
+	    != cs->cs_sendchars_tail) {
+		ret |= POLLOUT;
+	}
+	spinlock_release(&cs->cs_lock);
+	return ret;
+}
+
 static const struct device_ops console_devops = {
 	.devop_eachopen = con_eachopen,
 	.devop_io = con_io,
 	.devop_ioctl = con_ioctl,
+	.devop_poll = con_poll,
 };
 
 static
@@ -343,7 +538,7 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
+	struct wchan *rwc, *wwc;
 	struct lock *rlk, *wlk;
 
 	/*
@@ -359,33 +554,39 @@ config_con(struct con_softc *cs, int unit)
 	}
 	KASSERT(the_console==NULL);
 
-	rsem = sem_create("console read", 0);
-	if (rsem == NULL) {
+	rwc = wchan_create("console read");
+	if (rwc == NULL) {
 		return ENOMEM;
 	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
-		sem_destroy(rsem);
+	wwc = wchan_create("console write");
+	if (wwc == NULL) {
+		wchan_destroy(rwc);
 		return ENOMEM;
 	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
-		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(rwc);
+		wchan_destroy(wwc);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
-		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(rwc);
+		wchan_destroy(wwc);
 		return ENOMEM;
 	}
 
-	cs->cs_rsem = rsem;
-	cs->cs_wsem = wsem;
+	spinlock_init(&cs->cs_lock);
+	cs->cs_rwchan = rwc;
+	cs->cs_wwchan = wwc;
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	cs->cs_sendchars_head = 0;
+	cs->cs_sendchars_tail = 0;
+	cs->cs_sending = false;
+	pollhead_init(&cs->cs_rpoll);
+	pollhead_init(&cs->cs_wpoll);
 
 	the_console = cs;
 	con_userlock_read = rlk;
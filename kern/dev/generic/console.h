@@ -35,9 +35,22 @@
  *
  * devdata, send, and sendpolled are provided by the underlying
  * device, and are to be initialized by the attach routine.
+ *
+ * Output goes through cs_sendchars: writers add to it and the
+ * write-done interrupt sends the next character, so a writer only
+ * waits when it is full. Input arrives in cs_gotchars. Both are
+ * protected by cs_lock, which is taken in interrupt handlers and
+ * before the underlying device's own lock. Pollers wait on cs_rpoll
+ * for a line of input and on cs_wpoll for output space.
  */
 
-#define CONSOLE_INPUT_BUFFER_SIZE 32
+#include <spinlock.h>
+#include <poll.h>
+
+#define CONSOLE_INPUT_BUFFER_SIZE 256
+#define CONSOLE_OUTPUT_BUFFER_SIZE 1024
+
+struct wchan;
 
 struct con_softc {
 	/* initialized by attach routine */
@@ -46,11 +59,18 @@ struct con_softc {
 	void (*cs_sendpolled)(void *devdata, int ch);
 
 	/* initialized by config routine */
-	struct semaphore *cs_rsem;
-	struct semaphore *cs_wsem;
+	struct spinlock cs_lock;
+	struct wchan *cs_rwchan;	/* readers wait for input */
+	struct wchan *cs_wwchan;	/* writers wait for space */
 	unsigned char cs_gotchars[CONSOLE_INPUT_BUFFER_SIZE];
 	unsigned cs_gotchars_head;	/* next slot to put a char in */
 	unsigned cs_gotchars_tail;	/* next slot to take a char out */
+	unsigned char cs_sendchars[CONSOLE_OUTPUT_BUFFER_SIZE];
+	unsigned cs_sendchars_head;	/* next slot to put a char in */
+	unsigned cs_sendchars_tail;	/* next slot to send from */
+	bool cs_sending;		/* device busy with one of ours */
+	struct pollhead cs_rpoll;	/* pollers waiting for input */
+	struct pollhead cs_wpoll;	/* pollers waiting for space */
 };
 
 /*
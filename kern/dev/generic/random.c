@@ -31,7 +31,11 @@
 #include <kern/errno.h>
 #include <kern/fcntl.h>
 #include <lib.h>
+#include <spl.h>
 #include <uio.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
 #include <vfs.h>
 #include <generic/random.h>
 #include "autoconf.h"
@@ -45,9 +49,85 @@
  * The kernel config mechanism can be used to explicitly choose which
  * of the available random sources to use, if more than one is
  * available.
+ *
+ * Reads of random: don't go to the source a word at a time, since
+ * that's a device access per word. Instead each cpu has a pool: a
+ * xorshift128+ generator seeded from the source, which makes
+ * RANDOM_CHUNK bytes at a time to be copied out whole, and is mixed
+ * with a fresh word from the source every RANDOM_RESEED bytes. This
+ * is plenty for keys and seeds, but is not cryptographic. If there's
+ * no memory for the pools, reads go to the source as before.
  */
 
+#define RANDOM_CHUNK	256		/* bytes made per copyout */
+#define RANDOM_RESEED	65536		/* bytes between reseeds */
+
+struct random_pool {
+	uint64_t rp_s[2];		/* xorshift128+ state */
+	uint32_t rp_left;		/* bytes until the next reseed */
+};
+
 static struct random_softc *the_random = NULL;
+static struct random_pool *random_pools;	/* one per cpu */
+static unsigned random_npools;
+
+/*
+ * Mix fresh words from the source into POOL.
+ */
+static
+void
+random_reseed(struct random_softc *rs, struct random_pool *pool)
+{
+	pool->rp_s[0] ^= ((uint64_t)rs->rs_random(rs->rs_devdata) << 32) |
+		rs->rs_random(rs->rs_devdata);
+	pool->rp_s[1] ^= ((uint64_t)rs->rs_random(rs->rs_devdata) << 32) |
+		rs->rs_random(rs->rs_devdata);
+	if (pool->rp_s[0] == 0 && pool->rp_s[1] == 0) {
+		/* The one state the generator can't leave */
+		pool->rp_s[1] = 1;
+	}
+	pool->rp_left = RANDOM_RESEED;
+}
+
+static
+uint64_t
+random_next(struct random_pool *pool)
+{
+	uint64_t s1 = pool->rp_s[0];
+	uint64_t s0 = pool->rp_s[1];
+
+	pool->rp_s[0] = s0;
+	s1 ^= s1 << 23;
+	pool->rp_s[1] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26);
+	return pool->rp_s[1] + s0;
+}
+
+/*
+ * Fill BUF (LEN bytes, a multiple of 8) from this cpu's pool. The spl
+ * keeps us on the cpu and keeps anyone else out of the pool.
+ */
+static
+void
+random_fill(struct random_softc *rs, uint64_t *buf, size_t len)
+{
+	struct random_pool *pool;
+	unsigned i;
+	int spl;
+
+	KASSERT(len % sizeof(buf[0]) == 0);
+
+	spl = splhigh();
+	KASSERT(curcpu->c_number < random_npools);
+	pool = &random_pools[curcpu->c_number];
+	if (pool->rp_left < len) {
+		random_reseed(rs, pool);
+	}
+	pool->rp_left -= len;
+	for (i=0; i<len / sizeof(buf[0]); i++) {
+		buf[i] = random_next(pool);
+	}
+	splx(spl);
+}
 
 /*
  * VFS device functions.
@@ -67,19 +147,37 @@ randeachopen(struct device *dev, int openflags)
 }
 
 /*
- * VFS I/O function. Hand off to implementation.
+ * VFS I/O function. Copy out from the pool a chunk at a time.
  */
 static
 int
 randio(struct device *dev, struct uio *uio)
 {
 	struct random_softc *rs = dev->d_data;
+	uint64_t buf[RANDOM_CHUNK / sizeof(uint64_t)];
+	size_t len;
+	int result;
 
 	if (uio->uio_rw != UIO_READ) {
 		return EIO;
 	}
 
-	return rs->rs_read(rs->rs_devdata, uio);
+	if (random_pools == NULL) {
+		return rs->rs_read(rs->rs_devdata, uio);
+	}
+
+	while (uio->uio_resid > 0) {
+		len = uio->uio_resid;
+		if (len > sizeof(buf)) {
+			len = sizeof(buf);
+		}
+		random_fill(rs, buf, (len + 7) & ~(size_t)7);
+		result = uiomove(buf, len, uio);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
 }
 
 /*
@@ -110,6 +208,7 @@ static const struct device_ops random_devops = {
 int
 config_random(struct random_softc *rs, int unit)
 {
+	unsigned i;
 	int result;
 
 	/* We use only the first random device. */
@@ -120,6 +219,17 @@ config_random(struct random_softc *rs, int unit)
 	KASSERT(the_random==NULL);
 	the_random = rs;
 
+	/* The cpus are all up by the time devices attach */
+	random_npools = thread_numcpus();
+	random_pools = kmalloc(random_npools * sizeof(random_pools[0]));
+	if (random_pools != NULL) {
+		for (i=0; i<random_npools; i++) {
+			random_pools[i].rp_s[0] = 0;
+			random_pools[i].rp_s[1] = 0;
+			random_reseed(rs, &random_pools[i]);
+		}
+	}
+
 	rs->rs_dev.d_ops = &random_devops;
 	rs->rs_dev.d_blocks = 0;
 	rs->rs_dev.d_blocksize = 1;
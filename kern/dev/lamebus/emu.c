@@ -49,6 +49,8 @@
 #include <uio.h>
 #include <membar.h>
 #include <synch.h>
+#include <vm.h>
+#include <iostat.h>
 #include <lamebus/emu.h>
 #include <platform/bus.h>
 #include <vfs.h>
@@ -269,6 +271,8 @@ int
 emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	   uint32_t op, struct uio *uio)
 {
+	uint64_t started;
+	uint32_t got = 0;
 	int result;
 
 	KASSERT(uio->uio_rw == UIO_READ);
@@ -278,6 +282,7 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 		return 0;
 	}
 
+	started = iostat_start(sc->e_stats);
 	lock_acquire(sc->e_lock);
 
 	emu_wreg(sc, REG_HANDLE, handle);
@@ -290,12 +295,14 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	}
 
 	membar_load_load();
-	result = uiomove(sc->e_iobuf, emu_rreg(sc, REG_IOLEN), uio);
+	got = emu_rreg(sc, REG_IOLEN);
+	result = uiomove(sc->e_iobuf, got, uio);
 
 	uio->uio_offset = emu_rreg(sc, REG_OFFSET);
 
  out:
 	lock_release(sc->e_lock);
+	iostat_done(sc->e_stats, false, got, started);
 	return result;
 }
 
@@ -329,6 +336,7 @@ int
 emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	  struct uio *uio)
 {
+	uint64_t started;
 	int result;
 
 	KASSERT(uio->uio_rw == UIO_WRITE);
@@ -337,6 +345,7 @@ emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 		return EFBIG;
 	}
 
+	started = iostat_start(sc->e_stats);
 	lock_acquire(sc->e_lock);
 
 	emu_wreg(sc, REG_HANDLE, handle);
@@ -354,6 +363,7 @@ emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 
  out:
 	lock_release(sc->e_lock);
+	iostat_done(sc->e_stats, true, len, started);
 	return result;
 }
 
@@ -404,6 +414,469 @@ emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 //
 ////////////////////////////////////////////////////////////
 
+////////////////////////////////////////////////////////////
+//
+// Page cache
+//
+
+/*
+ * Every trip to the "hardware" is slow: it goes through the one I/O
+ * buffer under the device lock and waits for an interrupt. So file
+ * data read through emufs is cached a page at a time, along with file
+ * sizes, and reads that hit don't touch the device at all. This is
+ * mostly for loading programs off the host.
+ *
+ * The device can only do one thing at a time, so the locks are held
+ * only as long as it's busy: a page being read from the host is
+ * marked ep_filling, and anyone else wanting it waits on ec_cv
+ * rather than holding ec_lock; a page being copied out to the reader
+ * is pinned (ep_busy) and ec_lock is dropped for the copy, which may
+ * fault. A miss reads up to EMUFS_CLUSTER pages in one trip, as many
+ * as the read still wants, so a big read streams EMU_MAXIO at a time.
+ *
+ * Writes and truncates go straight through to the host. Two vnodes
+ * (two host handles) can refer to the same host file without our
+ * being able to tell, so each write or truncate throws away all the
+ * cached data and sizes for the whole filesystem, not just for one
+ * vnode. This is done after the host has it, and a fill that was
+ * under way meanwhile (seen by ec_gen changing) isn't kept. Changes
+ * made on the host behind our back aren't noticed.
+ *
+ * The cache lock may be held across host I/O (getsize), so it comes
+ * before e_lock.
+ */
+
+#define EMUFS_NPAGES	32	/* pages in the cache */
+#define EMUFS_NHASH	16	/* hash buckets; power of 2 */
+#define EMUFS_CLUSTER	(EMU_MAXIO / PAGE_SIZE)	/* pages per host read */
+
+struct emufs_page {
+	struct emufs_vnode *ep_vn;	/* owner; NULL if unused */
+	uint32_t ep_pageno;		/* page of the file */
+	uint32_t ep_len;		/* bytes valid; short only at EOF */
+	uint32_t ep_lastuse;		/* for LRU replacement */
+	unsigned ep_busy;		/* pins: being filled or copied */
+	bool ep_filling;		/* being read from the host */
+	char *ep_data;			/* PAGE_SIZE bytes, or NULL */
+	struct emufs_page *ep_next;	/* hash chain */
+};
+
+struct emufs_cache {
+	struct lock *ec_lock;
+	struct cv *ec_cv;		/* fills done, pages unpinned */
+	struct emufs_page ec_pages[EMUFS_NPAGES];
+	struct emufs_page *ec_hash[EMUFS_NHASH];
+	uint32_t ec_clock;		/* counts page uses */
+	uint32_t ec_gen;		/* counts invalidations */
+};
+
+#define EMUFS_HASH(ev, pageno) \
+	((((uintptr_t)(ev) >> 4) + (pageno)) & (EMUFS_NHASH - 1))
+
+/*
+ * Set up an empty cache. Page memory is allocated as it's used.
+ */
+static
+struct emufs_cache *
+emufs_cache_create(void)
+{
+	struct emufs_cache *ec;
+	unsigned i;
+
+	ec = kmalloc(sizeof(*ec));
+	if (ec == NULL) {
+		return NULL;
+	}
+	ec->ec_lock = lock_create("emufs-cache");
+	if (ec->ec_lock == NULL) {
+		kfree(ec);
+		return NULL;
+	}
+	ec->ec_cv = cv_create("emufs-cache");
+	if (ec->ec_cv == NULL) {
+		lock_destroy(ec->ec_lock);
+		kfree(ec);
+		return NULL;
+	}
+	for (i=0; i<EMUFS_NPAGES; i++) {
+		ec->ec_pages[i].ep_vn = NULL;
+		ec->ec_pages[i].ep_busy = 0;
+		ec->ec_pages[i].ep_filling = false;
+		ec->ec_pages[i].ep_data = NULL;
+		ec->ec_pages[i].ep_next = NULL;
+	}
+	for (i=0; i<EMUFS_NHASH; i++) {
+		ec->ec_hash[i] = NULL;
+	}
+	ec->ec_clock = 0;
+	ec->ec_gen = 0;
+	return ec;
+}
+
+/*
+ * Take a page out of the cache. If it's pinned, the pins keep its
+ * memory until they're let go.
+ */
+static
+void
+emufs_cache_drop(struct emufs_cache *ec, struct emufs_page *pg)
+{
+	struct emufs_page **pp;
+
+	KASSERT(pg->ep_vn != NULL);
+
+	pp = &ec->ec_hash[EMUFS_HASH(pg->ep_vn, pg->ep_pageno)];
+	while (*pp != pg) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->ep_next;
+	}
+	*pp = pg->ep_next;
+	pg->ep_next = NULL;
+	pg->ep_vn = NULL;
+}
+
+/*
+ * Let go of a pin.
+ */
+static
+void
+emufs_cache_unpin(struct emufs_cache *ec, struct emufs_page *pg)
+{
+	KASSERT(lock_do_i_hold(ec->ec_lock));
+	KASSERT(pg->ep_busy > 0);
+
+	pg->ep_busy--;
+	if (pg->ep_busy == 0) {
+		cv_broadcast(ec->ec_cv, ec->ec_lock);
+	}
+}
+
+/*
+ * Forget everything: all pages, and (by changing the generation) all
+ * file sizes and any fills under way. Called after writing or
+ * truncating any file.
+ */
+static
+void
+emufs_cache_invalidate(struct emufs_cache *ec)
+{
+	unsigned i;
+
+	lock_acquire(ec->ec_lock);
+	for (i=0; i<EMUFS_NPAGES; i++) {
+		ec->ec_pages[i].ep_vn = NULL;
+		ec->ec_pages[i].ep_next = NULL;
+	}
+	for (i=0; i<EMUFS_NHASH; i++) {
+		ec->ec_hash[i] = NULL;
+	}
+	ec->ec_gen++;
+	/* Anyone waiting for a fill has to look again */
+	cv_broadcast(ec->ec_cv, ec->ec_lock);
+	lock_release(ec->ec_lock);
+}
+
+/*
+ * Drop the pages of a vnode that's going away. Nobody can be using
+ * them, since nobody has a reference to it.
+ */
+static
+void
+emufs_cache_purge(struct emufs_cache *ec, struct emufs_vnode *ev)
+{
+	unsigned i;
+
+	lock_acquire(ec->ec_lock);
+	for (i=0; i<EMUFS_NPAGES; i++) {
+		if (ec->ec_pages[i].ep_vn == ev) {
+			KASSERT(ec->ec_pages[i].ep_busy == 0);
+			emufs_cache_drop(ec, &ec->ec_pages[i]);
+		}
+	}
+	lock_release(ec->ec_lock);
+}
+
+/*
+ * Choose a page to (re)use: an unused one that already has memory,
+ * failing that an unused one we can get memory for, and failing that
+ * the least recently used one. Pinned pages are left alone; returns
+ * NULL if every page is pinned, or there's no memory for any.
+ */
+static
+struct emufs_page *
+emufs_cache_victim(struct emufs_cache *ec)
+{
+	struct emufs_page *pg, *lru, *nomem;
+	unsigned i;
+
+	lru = nomem = NULL;
+	for (i=0; i<EMUFS_NPAGES; i++) {
+		pg = &ec->ec_pages[i];
+		if (pg->ep_busy > 0) {
+			continue;
+		}
+		if (pg->ep_vn == NULL) {
+			if (pg->ep_data != NULL) {
+				return pg;
+			}
+			if (nomem == NULL) {
+				nomem = pg;
+			}
+		}
+		else if (lru == NULL || pg->ep_lastuse < lru->ep_lastuse) {
+			lru = pg;
+		}
+	}
+	if (nomem != NULL) {
+		nomem->ep_data = kmalloc(PAGE_SIZE);
+		if (nomem->ep_data != NULL) {
+			return nomem;
+		}
+	}
+	if (lru != NULL) {
+		emufs_cache_drop(ec, lru);
+	}
+	return lru;
+}
+
+/*
+ * Look for page PAGENO of file EV in the cache.
+ */
+static
+struct emufs_page *
+emufs_cache_find(struct emufs_cache *ec, struct emufs_vnode *ev,
+		 uint32_t pageno)
+{
+	struct emufs_page *pg;
+
+	for (pg = ec->ec_hash[EMUFS_HASH(ev, pageno)]; pg != NULL;
+	     pg = pg->ep_next) {
+		if (pg->ep_vn == ev && pg->ep_pageno == pageno) {
+			return pg;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Read pages PAGENO onward of file EV from the host, as many as
+ * WANT (at most EMUFS_CLUSTER) up to the first that's already
+ * cached, in one go. Hands back the first, pinned, or NULL if it has
+ * to be looked for again: the fill was overtaken by a write, or
+ * there was no page to put it in and we waited for one.
+ */
+static
+int
+emufs_cache_fill(struct emufs_cache *ec, struct emufs_vnode *ev,
+		 uint32_t pageno, unsigned want, struct emufs_page **ret)
+{
+	struct emufs_page *pgs[EMUFS_CLUSTER];
+	struct iovec iov[EMUFS_CLUSTER];
+	struct uio ku;
+	size_t oldresid, got;
+	uint32_t gen;
+	unsigned n, i;
+	int result;
+
+	KASSERT(lock_do_i_hold(ec->ec_lock));
+	KASSERT(want >= 1 && want <= EMUFS_CLUSTER);
+
+	for (n = 0; n < want; n++) {
+		if (n > 0 && emufs_cache_find(ec, ev, pageno + n) != NULL) {
+			break;
+		}
+		pgs[n] = emufs_cache_victim(ec);
+		if (pgs[n] == NULL) {
+			break;
+		}
+		pgs[n]->ep_vn = ev;
+		pgs[n]->ep_pageno = pageno + n;
+		pgs[n]->ep_busy = 1;
+		pgs[n]->ep_filling = true;
+		pgs[n]->ep_next = ec->ec_hash[EMUFS_HASH(ev, pageno + n)];
+		ec->ec_hash[EMUFS_HASH(ev, pageno + n)] = pgs[n];
+	}
+	if (n == 0) {
+		/* Everything's pinned; wait for something to come free */
+		cv_wait(ec->ec_cv, ec->ec_lock);
+		*ret = NULL;
+		return 0;
+	}
+	gen = ec->ec_gen;
+	lock_release(ec->ec_lock);
+
+	for (i=0; i<n; i++) {
+		iov[i].iov_kbase = pgs[i]->ep_data;
+		iov[i].iov_len = PAGE_SIZE;
+	}
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = n;
+	ku.uio_offset = (off_t)pageno * PAGE_SIZE;
+	ku.uio_resid = n * PAGE_SIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_READ;
+	ku.uio_space = NULL;
+	ku.uio_nocache = false;
+	ku.uio_append = false;
+	ku.uio_direct = false;
+
+	/* The host may hand back less than we ask for; keep going */
+	result = 0;
+	while (ku.uio_resid > 0) {
+		oldresid = ku.uio_resid;
+		result = emu_read(ev->ev_emu, ev->ev_handle, ku.uio_resid,
+				  &ku);
+		if (result) {
+			break;
+		}
+		if (ku.uio_resid == oldresid) {
+			/* EOF */
+			break;
+		}
+	}
+	got = n * PAGE_SIZE - ku.uio_resid;
+
+	lock_acquire(ec->ec_lock);
+	for (i=0; i<n; i++) {
+		pgs[i]->ep_filling = false;
+		if (result || gen != ec->ec_gen) {
+			/* Still hashed unless invalidated */
+			if (gen == ec->ec_gen) {
+				emufs_cache_drop(ec, pgs[i]);
+			}
+			emufs_cache_unpin(ec, pgs[i]);
+			continue;
+		}
+		pgs[i]->ep_len = got < PAGE_SIZE ? got : PAGE_SIZE;
+		got -= pgs[i]->ep_len;
+		pgs[i]->ep_lastuse = ++ec->ec_clock;
+		if (i > 0) {
+			emufs_cache_unpin(ec, pgs[i]);
+		}
+	}
+	cv_broadcast(ec->ec_cv, ec->ec_lock);
+
+	*ret = (result || gen != ec->ec_gen) ? NULL : pgs[0];
+	return result;
+}
+
+/*
+ * Find page PAGENO of file EV in the cache, reading it (and up to
+ * WANT pages in all) from the host if it isn't there. Hands it back
+ * pinned.
+ */
+static
+int
+emufs_cache_getpage(struct emufs_cache *ec, struct emufs_vnode *ev,
+		    uint32_t pageno, unsigned want, struct emufs_page **ret)
+{
+	struct emufs_page *pg;
+	int result;
+
+	KASSERT(lock_do_i_hold(ec->ec_lock));
+
+	while (1) {
+		pg = emufs_cache_find(ec, ev, pageno);
+		if (pg != NULL && pg->ep_filling) {
+			cv_wait(ec->ec_cv, ec->ec_lock);
+			continue;
+		}
+		if (pg != NULL) {
+			pg->ep_lastuse = ++ec->ec_clock;
+			pg->ep_busy++;
+			break;
+		}
+		result = emufs_cache_fill(ec, ev, pageno, want, &pg);
+		if (result) {
+			return result;
+		}
+		if (pg != NULL) {
+			break;
+		}
+	}
+	*ret = pg;
+	return 0;
+}
+
+/*
+ * Read from a file through the cache.
+ */
+static
+int
+emufs_cache_read(struct emufs_cache *ec, struct emufs_vnode *ev,
+		 struct uio *uio)
+{
+	struct emufs_page *pg;
+	uint32_t pgoff, len;
+	unsigned want;
+	bool eof;
+	int result = 0;
+
+	lock_acquire(ec->ec_lock);
+	while (uio->uio_resid > 0 && uio->uio_offset <= (off_t)0xffffffff) {
+		pgoff = uio->uio_offset % PAGE_SIZE;
+		want = (pgoff + uio->uio_resid + PAGE_SIZE - 1) / PAGE_SIZE;
+		if (want > EMUFS_CLUSTER) {
+			want = EMUFS_CLUSTER;
+		}
+		result = emufs_cache_getpage(ec, ev,
+					     uio->uio_offset / PAGE_SIZE, want,
+					     &pg);
+		if (result) {
+			break;
+		}
+		if (pgoff >= pg->ep_len) {
+			/* EOF */
+			emufs_cache_unpin(ec, pg);
+			break;
+		}
+		len = pg->ep_len - pgoff;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		eof = pg->ep_len < PAGE_SIZE;
+
+		/* The copy may fault; don't hold everyone else up */
+		lock_release(ec->ec_lock);
+		result = uiomove(pg->ep_data + pgoff, len, uio);
+		lock_acquire(ec->ec_lock);
+
+		emufs_cache_unpin(ec, pg);
+		if (result || eof) {
+			/* Failed, or read up to EOF */
+			break;
+		}
+	}
+	lock_release(ec->ec_lock);
+	return result;
+}
+
+/*
+ * Get the size of a file, asking the host only if we don't know it.
+ */
+static
+int
+emufs_cache_getsize(struct emufs_cache *ec, struct emufs_vnode *ev,
+		    off_t *ret)
+{
+	int result = 0;
+
+	lock_acquire(ec->ec_lock);
+	if (!ev->ev_sizevalid || ev->ev_sizegen != ec->ec_gen) {
+		result = emu_getsize(ev->ev_emu, ev->ev_handle, &ev->ev_size);
+		ev->ev_sizevalid = (result == 0);
+		ev->ev_sizegen = ec->ec_gen;
+	}
+	if (result == 0) {
+		*ret = ev->ev_size;
+	}
+	lock_release(ec->ec_lock);
+	return result;
+}
+
+//
+////////////////////////////////////////////////////////////
+
 ////////////////////////////////////////////////////////////
 //
 // vnode functions
@@ -523,12 +996,15 @@ emufs_reclaim(struct vnode *v)
 		      ef->ef_emu->e_unit, ev->ev_handle);
 	}
 
-	vnodearray_remove(ef->ef_vnodes, ix);
+	vnodearray_remove_unordered(ef->ef_vnodes, ix);
 	vnode_cleanup(&ev->ev_v);
 
 	lock_release(ef->ef_emu->e_lock);
 	vfs_biglock_release();
 
+	/* Nobody can find it now; throw out its pages before it's reused */
+	emufs_cache_purge(ef->ef_cache, ev);
+
 	kfree(ev);
 	return 0;
 }
@@ -541,32 +1017,11 @@ int
 emufs_read(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	uint32_t amt;
-	size_t oldresid;
-	int result;
+	struct emufs_fs *ef = v->vn_fs->fs_data;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
-	while (uio->uio_resid > 0) {
-		amt = uio->uio_resid;
-		if (amt > EMU_MAXIO) {
-			amt = EMU_MAXIO;
-		}
-
-		oldresid = uio->uio_resid;
-
-		result = emu_read(ev->ev_emu, ev->ev_handle, amt, uio);
-		if (result) {
-			return result;
-		}
-
-		if (uio->uio_resid == oldresid) {
-			/* nothing read - EOF */
-			break;
-		}
-	}
-
-	return 0;
+	return emufs_cache_read(ef->ef_cache, ev, uio);
 }
 
 /*
@@ -597,32 +1052,63 @@ int
 emufs_write(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
+	struct emufs_fs *ef = v->vn_fs->fs_data;
+	struct iovec iov;
+	struct uio ku;
 	uint32_t amt;
-	size_t oldresid;
-	int result;
+	char *buf;
+	int result = 0;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
+	/*
+	 * Copy the data in before going near the device, so that a
+	 * fault on the user buffer doesn't hold it up.
+	 */
+	buf = kmalloc(EMU_MAXIO);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	/*
+	 * An append starts at the current end of file and keeps other
+	 * appends out until it's done. The host only writes at an
+	 * offset, so this is only atomic against our own appends.
+	 */
+	if (uio->uio_append) {
+		lock_acquire(ef->ef_appendlock);
+		result = emufs_cache_getsize(ef->ef_cache, ev,
+					     &uio->uio_offset);
+		if (result) {
+			goto out;
+		}
+	}
+
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
 			amt = EMU_MAXIO;
 		}
 
-		oldresid = uio->uio_resid;
-
-		result = emu_write(ev->ev_emu, ev->ev_handle, amt, uio);
+		uio_kinit(&iov, &ku, buf, amt, uio->uio_offset, UIO_WRITE);
+		result = uiomove(buf, amt, uio);
 		if (result) {
-			return result;
+			break;
 		}
 
-		if (uio->uio_resid == oldresid) {
-			/* nothing written...? */
+		result = emu_write(ev->ev_emu, ev->ev_handle, amt, &ku);
+		emufs_cache_invalidate(ef->ef_cache);
+		if (result) {
 			break;
 		}
 	}
 
-	return 0;
+ out:
+	if (uio->uio_append) {
+		lock_release(ef->ef_appendlock);
+	}
+	kfree(buf);
+	return result;
 }
 
 /*
@@ -651,11 +1137,12 @@ int
 emufs_stat(struct vnode *v, struct stat *statbuf)
 {
 	struct emufs_vnode *ev = v->vn_data;
+	struct emufs_fs *ef = v->vn_fs->fs_data;
 	int result;
 
 	bzero(statbuf, sizeof(struct stat));
 
-	result = emu_getsize(ev->ev_emu, ev->ev_handle, &statbuf->st_size);
+	result = emufs_cache_getsize(ef->ef_cache, ev, &statbuf->st_size);
 	if (result) {
 		return result;
 	}
@@ -725,7 +1212,13 @@ int
 emufs_truncate(struct vnode *v, off_t len)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	return emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	struct emufs_fs *ef = v->vn_fs->fs_data;
+	int result;
+
+	result = emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	emufs_cache_invalidate(ef->ef_cache);
+
+	return result;
 }
 
 /*
@@ -845,13 +1338,17 @@ emufs_namefile(struct vnode *v, struct uio *uio)
 
 /*
  * VOP_MMAP
+ *
+ * Files can be mapped; the VM system reads and writes the pages
+ * with emufs_read and emufs_write.
  */
 static
 int
-emufs_mmap(struct vnode *v)
+emufs_mmap(struct vnode *v, bool *anon)
 {
 	(void)v;
-	return ENOSYS;
+	(void)anon;
+	return 0;
 }
 
 //////////////////////////////
@@ -1081,11 +1578,14 @@ static const struct vnode_ops emufs_fileops = {
 	.vop_read = emufs_read,
 	.vop_readlink = emufs_readlink_notlink,
 	.vop_getdirentry = emufs_uio_op_notdir,
+	.vop_getdirplus = emufs_uio_op_notdir,
+	.vop_getdents = emufs_uio_op_notdir,
 	.vop_write = emufs_write,
 	.vop_ioctl = emufs_ioctl,
 	.vop_stat = emufs_stat,
 	.vop_gettype = emufs_file_gettype,
 	.vop_isseekable = emufs_isseekable,
+	.vop_poll = vop_poll_ready,
 	.vop_fsync = emufs_fsync,
 	.vop_mmap = emufs_mmap,
 	.vop_truncate = emufs_truncate,
@@ -1115,13 +1615,16 @@ static const struct vnode_ops emufs_dirops = {
 	.vop_read = emufs_uio_op_isdir,
 	.vop_readlink = emufs_uio_op_isdir,
 	.vop_getdirentry = emufs_getdirentry,
+	.vop_getdirplus = vopfail_uio_nosys,
+	.vop_getdents = vop_getdents_byentry,
 	.vop_write = emufs_uio_op_isdir,
 	.vop_ioctl = emufs_ioctl,
 	.vop_stat = emufs_stat,
 	.vop_gettype = emufs_dir_gettype,
 	.vop_isseekable = emufs_isseekable,
+	.vop_poll = vop_poll_ready,
 	.vop_fsync = emufs_void_op_isdir,
-	.vop_mmap = emufs_void_op_isdir,
+	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = emufs_truncate_isdir,
 	.vop_namefile = emufs_namefile,
 
@@ -1179,6 +1682,9 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 	ev->ev_emu = ef->ef_emu;
 	ev->ev_handle = handle;
+	ev->ev_size = 0;
+	ev->ev_sizegen = 0;
+	ev->ev_sizevalid = false;
 
 	result = vnode_init(&ev->ev_v, isdir ? &emufs_dirops : &emufs_fileops,
 			    &ef->ef_fs, ev);
@@ -1309,6 +1815,19 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 		kfree(ef);
 		return ENOMEM;
 	}
+	ef->ef_appendlock = lock_create("emufs-append");
+	if (ef->ef_appendlock == NULL) {
+		vnodearray_destroy(ef->ef_vnodes);
+		kfree(ef);
+		return ENOMEM;
+	}
+	ef->ef_cache = emufs_cache_create();
+	if (ef->ef_cache == NULL) {
+		lock_destroy(ef->ef_appendlock);
+		vnodearray_destroy(ef->ef_vnodes);
+		kfree(ef);
+		return ENOMEM;
+	}
 
 	result = emufs_loadvnode(ef, EMU_ROOTHANDLE, 1, &ef->ef_root);
 	if (result) {
@@ -1353,5 +1872,13 @@ config_emu(struct emu_softc *sc, int emuno)
 
 	snprintf(name, sizeof(name), "emu%d", emuno);
 
+	sc->e_stats = iostat_create(name);
+	if (sc->e_stats == NULL) {
+		sem_destroy(sc->e_sem);
+		lock_destroy(sc->e_lock);
+		sc->e_lock = NULL;
+		return ENOMEM;
+	}
+
 	return emufs_addtovfs(sc, name);
 }
@@ -50,6 +50,7 @@ struct emu_softc {
 	struct lock *e_lock;
 	struct semaphore *e_sem;
 	void *e_iobuf;
+	struct iostat *e_stats;
 
 	/* Written by the interrupt handler */
 	uint32_t e_result;
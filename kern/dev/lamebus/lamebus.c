@@ -37,6 +37,9 @@
 #include <membar.h>
 #include <spinlock.h>
 #include <current.h>
+#include <clock.h>
+#include <thread.h>
+#include <platform/maxcpus.h>
 #include <lamebus/lamebus.h>
 
 /* Register offsets within each config region */
@@ -425,6 +428,121 @@ lamebus_unmask_interrupt(struct lamebus_softc *lamebus, int slot)
 	spinlock_release(&lamebus->ls_lock);
 }
 
+/*
+ * Interrupt statistics, for each cpu and slot. Only the cpu itself
+ * writes its own, with interrupts off, so no lock is needed; the
+ * totals are read without one and may be a little stale.
+ *
+ * Times are in cycles of the cpu that took the interrupt. Handler
+ * time runs from the call to its return. Latency runs from entry to
+ * lamebus_interrupt to the call, so it includes the handlers of lower
+ * slots that went first; when the device actually raised the line
+ * isn't visible to us. If the handler switched threads and we came
+ * back on another cpu, the times are meaningless and only the count
+ * is kept.
+ */
+struct lamebus_intrstat {
+	uint64_t li_count;		/* handler calls */
+	uint64_t li_cycles;		/* total time in the handler */
+	uint32_t li_maxcycles;		/* longest handler call */
+	uint32_t li_maxlatency;		/* longest wait for the call */
+};
+
+static struct lamebus_intrstat lamebus_intrstats[MAXCPUS][LB_NSLOTS]
+	__cacheline_aligned;
+
+static
+void
+lamebus_intrstat_add(struct cpu *c, int slot, uint64_t latency,
+		     uint64_t cycles)
+{
+	struct lamebus_intrstat *li;
+
+	li = &lamebus_intrstats[curcpu->c_number][slot];
+	li->li_count++;
+	if (c != curcpu->c_self) {
+		return;
+	}
+	li->li_cycles += cycles;
+	if (cycles > li->li_maxcycles) {
+		li->li_maxcycles = cycles;
+	}
+	if (latency > li->li_maxlatency) {
+		li->li_maxlatency = latency;
+	}
+}
+
+/* Names of the CS161 devices, by device id, for the statistics */
+static const char *const lamebus_devnames[] = {
+	[LBCS161_UPBUSCTL] = "busctl",
+	[LBCS161_TIMER] = "ltimer",
+	[LBCS161_DISK] = "lhd",
+	[LBCS161_SERIAL] = "lser",
+	[LBCS161_SCREEN] = "lscreen",
+	[LBCS161_NET] = "lnet",
+	[LBCS161_EMUFS] = "emu",
+	[LBCS161_TRACE] = "ltrace",
+	[LBCS161_RANDOM] = "lrandom",
+	[LBCS161_MPBUSCTL] = "busctl",
+};
+
+/*
+ * Print the interrupt statistics of every slot that has interrupted,
+ * with the calls taken by each cpu.
+ */
+void
+lamebus_printintrstats(struct lamebus_softc *lamebus)
+{
+	struct lamebus_intrstat *li;
+	uint64_t count, cycles;
+	uint32_t maxcycles, maxlatency, did;
+	const char *name;
+	unsigned ncpus, c;
+	int slot;
+
+	ncpus = thread_numcpus();
+	kprintf("%4s %-8s %10s %10s %8s %8s %10s  %s\n", "slot", "device",
+		"count", "total us", "avg ns", "max ns", "max lat ns",
+		"per cpu");
+	for (slot=0; slot<LB_NSLOTS; slot++) {
+		count = cycles = 0;
+		maxcycles = maxlatency = 0;
+		for (c=0; c<ncpus; c++) {
+			li = &lamebus_intrstats[c][slot];
+			count += li->li_count;
+			cycles += li->li_cycles;
+			if (li->li_maxcycles > maxcycles) {
+				maxcycles = li->li_maxcycles;
+			}
+			if (li->li_maxlatency > maxlatency) {
+				maxlatency = li->li_maxlatency;
+			}
+		}
+		if (count == 0) {
+			continue;
+		}
+
+		did = read_cfg_register(lamebus, slot, CFGREG_DID);
+		name = "?";
+		if (read_cfg_register(lamebus, slot, CFGREG_VID) ==
+		    LB_VENDOR_CS161 && did < ARRAYCOUNT(lamebus_devnames) &&
+		    lamebus_devnames[did] != NULL) {
+			name = lamebus_devnames[did];
+		}
+
+		kprintf("%4d %-8s %10llu %10llu %8llu %8llu %10llu ", slot,
+			name, (unsigned long long)count,
+			(unsigned long long)(clock_cycles_to_ns(cycles) / 1000),
+			(unsigned long long)clock_cycles_to_ns(cycles / count),
+			(unsigned long long)clock_cycles_to_ns(maxcycles),
+			(unsigned long long)clock_cycles_to_ns(maxlatency));
+		for (c=0; c<ncpus; c++) {
+			kprintf(" %llu", (unsigned long long)
+				lamebus_intrstats[c][slot].li_count);
+		}
+		kprintf("\n");
+	}
+}
 
 /*
  * LAMEbus interrupt handling function. (Machine-independent!)
@@ -448,6 +566,8 @@ lamebus_interrupt(struct lamebus_softc *lamebus)
 	uint32_t irqs;
 	void (*handler)(void *);
 	void *data;
+	struct cpu *c;
+	uint64_t entry, start;
 
 	/* For keeping track of how many bogus things happen in a row. */
 	static int duds = 0;
@@ -456,6 +576,8 @@ lamebus_interrupt(struct lamebus_softc *lamebus)
 	/* and we better have a valid bus instance. */
 	KASSERT(lamebus != NULL);
 
+	entry = clock_cycles();
+
 	/* Lock the softc */
 	spinlock_acquire(&lamebus->ls_lock);
 
@@ -530,7 +652,11 @@ lamebus_interrupt(struct lamebus_softc *lamebus)
 		data = lamebus->ls_devdata[slot];
 		spinlock_release(&lamebus->ls_lock);
 
+		c = curcpu->c_self;
+		start = clock_cycles();
 		handler(data);
+		lamebus_intrstat_add(c, slot, start - entry,
+				     clock_cycles() - start);
 
 		spinlock_acquire(&lamebus->ls_lock);
 
@@ -147,6 +147,11 @@ void lamebus_unmask_interrupt(struct lamebus_softc *, int slot);
  */
 void lamebus_interrupt(struct lamebus_softc *);
 
+/*
+ * Print per-slot interrupt counts and handler times.
+ */
+void lamebus_printintrstats(struct lamebus_softc *);
+
 /*
  * Have the LAMEbus controller power the system off.
  */
@@ -36,7 +36,10 @@
 #include <lib.h>
 #include <uio.h>
 #include <membar.h>
-#include <synch.h>
+#include <wchan.h>
+#include <iosched.h>
+#include <iostat.h>
+#include <percpu.h>
 #include <platform/bus.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -96,28 +99,144 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Start the next sector of the current request, if there is one.
+ * Called with lh_lock held.
  */
 static
 void
-lhd_iodone(struct lhd_softc *lh, int err)
+lhd_start(struct lhd_softc *lh)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct devreq *req = lh->lh_cur;
+	uint32_t statval = LHD_WORKING;
+	char *data;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	if (req == NULL) {
+		return;
+	}
+	data = (char *)req->dr_data + lh->lh_cursect * LHD_SECTSIZE;
+
+	/*
+	 * Are we writing? If so, transfer the data to the
+	 * on-card buffer.
+	 */
+	if (req->dr_write) {
+		memcpy(lh->lh_buf, data, LHD_SECTSIZE);
+		membar_store_store();
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want... */
+	lhd_wreg(lh, LHD_REG_SECT, req->dr_block + lh->lh_cursect);
+
+	/* and start the operation. */
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * Move on to whichever request the scheduler picks next, and start
+ * it. A request with no blocks (a flush) needs no I/O, so it's
+ * finished here and put on *DONE, for the caller to hand back once
+ * it has let go of lh_lock.
+ */
+static
+void
+lhd_next(struct lhd_softc *lh, struct devreq **done)
+{
+	struct devreq *req;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	while ((req = iosched_next(lh->lh_sched)) != NULL &&
+	       req->dr_nblocks == 0) {
+		req->dr_result = 0;
+		iosched_done(lh->lh_sched, req);
+		req->dr_next = *done;
+		*done = req;
+	}
+	lh->lh_cur = req;
+	lh->lh_cursect = 0;
+	lhd_start(lh);
+}
+
+/*
+ * Call dr_done for the requests on list DONE.
+ */
+static
+void
+lhd_finish(struct devreq *done)
+{
+	struct devreq *req;
+
+	while (done != NULL) {
+		req = done;
+		/* REQ may be freed as soon as it's been handed back */
+		done = req->dr_next;
+		req->dr_done(req);
+	}
+}
+
+/*
+ * A sector has finished with result ERR. Collect the data if it was
+ * a read; then if the request is done (or failed), put it on *DONE
+ * and move on to the next one, and start the next sector either way.
+ */
+static
+void
+lhd_sectdone(struct lhd_softc *lh, int err, struct devreq **done)
+{
+	struct devreq *req = lh->lh_cur;
+	char *data;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	if (req == NULL) {
+		/* Nothing was running; spurious */
+		return;
+	}
+
+	/*
+	 * Are we reading? If so, and if we succeeded,
+	 * transfer the data out of the on-card buffer.
+	 */
+	if (err == 0 && !req->dr_write) {
+		data = (char *)req->dr_data + lh->lh_cursect * LHD_SECTSIZE;
+		membar_load_load();
+		memcpy(data, lh->lh_buf, LHD_SECTSIZE);
+	}
+
+	lh->lh_cursect++;
+	if (err == 0 && lh->lh_cursect < req->dr_nblocks) {
+		/* More of this request to go */
+		lhd_start(lh);
+		return;
+	}
+
+	req->dr_result = err;
+	iostat_done(lh->lh_stats, req->dr_write,
+		    req->dr_nblocks * LHD_SECTSIZE, req->dr_started);
+	iosched_done(lh->lh_sched, req);
+	req->dr_next = *done;
+	*done = req;
+	lhd_next(lh, done);
 }
 
 /*
  * Interrupt handler for lhd.
  * Read the status register; if an operation finished, clear the status
- * register and report completion.
+ * register, report completion, and start the next queued sector right
+ * away so the disk doesn't sit idle.
  */
 void
 lhd_irq(void *vlh)
 {
 	struct lhd_softc *lh = vlh;
+	struct devreq *done = NULL;
 	uint32_t val;
 
+	spinlock_acquire(&lh->lh_lock);
+
 	val = lhd_rdreg(lh, LHD_REG_STAT);
 
 	switch (val & LHD_STATEMASK) {
@@ -128,9 +247,13 @@ lhd_irq(void *vlh)
 	    case LHD_INVSECT:
 	    case LHD_MEDIA:
 		lhd_wreg(lh, LHD_REG_STAT, 0);
-		lhd_iodone(lh, lhd_code_to_errno(lh, val));
+		lhd_sectdone(lh, lhd_code_to_errno(lh, val), &done);
 		break;
 	}
+
+	spinlock_release(&lh->lh_lock);
+
+	lhd_finish(done);
 }
 
 /*
@@ -179,9 +302,112 @@ lhd_reset(struct lhd_softc *lh)
 }
 #endif
 
+/*
+ * Queue a request.
+ */
+static
+int
+lhd_strategy(struct device *d, struct devreq *req)
+{
+	struct lhd_softc *lh = d->d_data;
+	struct devreq *done = NULL;
+
+	/* Don't allow I/O past the end of the disk. */
+	if (req->dr_block > lh->lh_dev.d_blocks ||
+	    req->dr_nblocks > lh->lh_dev.d_blocks - req->dr_block) {
+		return EINVAL;
+	}
+
+	if (req->dr_nblocks == 0) {
+		if (req->dr_flags == 0) {
+			req->dr_result = 0;
+			req->dr_done(req);
+			return 0;
+		}
+		/* A flush; it has to wait its turn */
+	}
+	else {
+		percpu_inc(PCPU_BLKREQS);
+		percpu_add(PCPU_BLKSECTS, req->dr_nblocks);
+		req->dr_started = iostat_start(lh->lh_stats);
+	}
+
+	spinlock_acquire(&lh->lh_lock);
+	iosched_add(lh->lh_sched, req);
+	if (lh->lh_cur == NULL) {
+		/* Disk is idle; get it going */
+		lhd_next(lh, &done);
+	}
+	spinlock_release(&lh->lh_lock);
+
+	lhd_finish(done);
+	return 0;
+}
+
+/*
+ * Synchronous I/O, on top of lhd_strategy.
+ */
+struct lhd_syncreq {
+	struct devreq sr_req;
+	struct lhd_softc *sr_lh;
+	bool sr_done;
+};
+
+static
+void
+lhd_syncdone(struct devreq *req)
+{
+	struct lhd_syncreq *sr = req->dr_donedata;
+	struct lhd_softc *lh = sr->sr_lh;
+
+	spinlock_acquire(&lh->lh_lock);
+	sr->sr_done = true;
+	wchan_wakeall(lh->lh_wchan, &lh->lh_lock);
+	spinlock_release(&lh->lh_lock);
+}
+
+static
+int
+lhd_syncio(struct lhd_softc *lh, uint32_t sector, uint32_t nsect,
+	   void *data, bool write)
+{
+	struct lhd_syncreq sr;
+	int result;
+
+	sr.sr_req.dr_block = sector;
+	sr.sr_req.dr_nblocks = nsect;
+	sr.sr_req.dr_data = data;
+	sr.sr_req.dr_write = write;
+	sr.sr_req.dr_flags = 0;
+	sr.sr_req.dr_tag = 0;
+	sr.sr_req.dr_done = lhd_syncdone;
+	sr.sr_req.dr_donedata = &sr;
+	sr.sr_lh = lh;
+	sr.sr_done = false;
+
+	result = lhd_strategy(&lh->lh_dev, &sr.sr_req);
+	if (result) {
+		return result;
+	}
+
+	spinlock_acquire(&lh->lh_lock);
+	while (!sr.sr_done) {
+		wchan_sleep(lh->lh_wchan, &lh->lh_lock);
+	}
+	spinlock_release(&lh->lh_lock);
+
+	return sr.sr_req.dr_result;
+}
+
 /*
  * I/O function (for both reads and writes)
+ *
+ * A kernel buffer is handed to the disk directly; anything else goes
+ * through a bounce buffer, as one request and one uiomove for up to
+ * LHD_BOUNCESIZE bytes at a time.
  */
+#define LHD_BOUNCESIZE	16384
+
 static
 int
 lhd_io(struct device *d, struct uio *uio)
@@ -190,10 +416,11 @@ lhd_io(struct device *d, struct uio *uio)
 
 	uint32_t sector = uio->uio_offset / LHD_SECTSIZE;
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
-	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
+	bool write = uio->uio_rw == UIO_WRITE;
+	struct iovec *iov;
+	size_t len, buflen;
+	char *buf;
 	int result;
 
 	/* Don't allow I/O that isn't sector-aligned. */
@@ -201,73 +428,66 @@ lhd_io(struct device *d, struct uio *uio)
 		return EINVAL;
 	}
 
-	/* Don't allow I/O past the end of the disk. */
-	/* XXX this check can overflow */
-	if (sector+len > lh->lh_dev.d_blocks) {
-		return EINVAL;
+	if (uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1 &&
+	    uio->uio_iov->iov_len == uio->uio_resid) {
+		iov = uio->uio_iov;
+		len = uio->uio_resid;
+		result = lhd_syncio(lh, sector, len / LHD_SECTSIZE,
+				    iov->iov_kbase, write);
+		if (result) {
+			return result;
+		}
+		iov->iov_kbase = (char *)iov->iov_kbase + len;
+		iov->iov_len = 0;
+		uio->uio_offset += len;
+		uio->uio_resid = 0;
+		return 0;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	buflen = uio->uio_resid;
+	if (buflen > LHD_BOUNCESIZE) {
+		buflen = LHD_BOUNCESIZE;
+	}
+	buf = kmalloc(buflen);
+	if (buf == NULL) {
+		return ENOMEM;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
-
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
-
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			membar_store_store();
+	result = 0;
+	while (uio->uio_resid > 0) {
+		len = uio->uio_resid;
+		if (len > buflen) {
+			len = buflen;
+		}
+		if (write) {
+			result = uiomove(buf, len, uio);
 			if (result) {
-				V(lh->lh_clear);
-				return result;
+				break;
 			}
 		}
-
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
-
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			membar_load_load();
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-		}
-
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
+		result = lhd_syncio(lh, sector, len / LHD_SECTSIZE, buf,
+				    write);
 		if (result) {
-			return result;
+			break;
+		}
+		if (!write) {
+			result = uiomove(buf, len, uio);
+			if (result) {
+				break;
+			}
 		}
+		sector += len / LHD_SECTSIZE;
 	}
 
-	return 0;
+	kfree(buf);
+	return result;
 }
 
 static const struct device_ops lhd_devops = {
 	.devop_eachopen = lhd_eachopen,
 	.devop_io = lhd_io,
 	.devop_ioctl = lhd_ioctl,
+	.devop_strategy = lhd_strategy,
 };
 
 /*
@@ -284,15 +504,26 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
+	/* Set up the request queue. */
+	spinlock_init(&lh->lh_lock);
+	lh->lh_cur = NULL;
+	lh->lh_cursect = 0;
+	lh->lh_wchan = wchan_create(name);
+	if (lh->lh_wchan == NULL) {
+		spinlock_cleanup(&lh->lh_lock);
+		return ENOMEM;
+	}
+	lh->lh_sched = iosched_create(name);
+	if (lh->lh_sched == NULL) {
+		wchan_destroy(lh->lh_wchan);
+		spinlock_cleanup(&lh->lh_lock);
 		return ENOMEM;
 	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
+	lh->lh_stats = iostat_create(name);
+	if (lh->lh_stats == NULL) {
+		iosched_destroy(lh->lh_sched);
+		wchan_destroy(lh->lh_wchan);
+		spinlock_cleanup(&lh->lh_lock);
 		return ENOMEM;
 	}
 
@@ -30,6 +30,7 @@
 #ifndef _LAMEBUS_LHD_H_
 #define _LAMEBUS_LHD_H_
 
+#include <spinlock.h>
 #include <device.h>
 
 /*
@@ -51,9 +52,12 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	struct spinlock lh_lock;	/* Protects the card and lh_cur */
+	struct iosched *lh_sched;	/* Queue of pending requests */
+	struct iostat *lh_stats;	/* I/O statistics */
+	struct devreq *lh_cur;		/* Request in progress, if any */
+	uint32_t lh_cursect;		/* Sectors of lh_cur done so far */
+	struct wchan *lh_wchan;		/* Waiters for synchronous I/O */
 
 	struct device lh_dev;		/* VFS device structure */
 };
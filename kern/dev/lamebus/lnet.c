@@ -27,20 +27,284 @@
  * SUCH DAMAGE.
  */
 
+/*
+ * Driver for the LAMEbus network card.
+ *
+ * The card has one buffer for a frame coming in and one for a frame
+ * going out, and interrupts when either is done with. The driver
+ * keeps a ring of pbufs on each side so that neither the card nor
+ * the stack has to wait for the other:
+ *
+ *  - The interrupt handler copies each received frame straight into
+ *    a pbuf on the receive ring and hands the buffer back to the card
+ *    at once, then queues ln_rxwork. That runs on sysworkq and feeds
+ *    everything on the ring to the stack. Queueing work that is
+ *    already queued does nothing, so a burst of frames costs one
+ *    wakeup and one run, however many interrupts it took: the
+ *    interrupts are coalesced in software.
+ *
+ *  - Output goes on the transmit ring; when the card is idle the
+ *    frame at the head is copied onto it and started, and the
+ *    transmit-done interrupt frees it and starts the next one. A full
+ *    ring drops the frame, as a full wire would.
+ *
+ * If the stack can't keep up, frames are dropped when the receive
+ * ring or the pbuf pool is empty, never waited for.
+ */
+
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
-/*#include <lamebus/lnet.h>*/ /* not yet */
+#include <membar.h>
+#include <platform/bus.h>
+#include <lamebus/lnet.h>
 #include "autoconf.h"
 
+/* Registers (offsets within slot) */
+#define LNET_REG_RINTR	0	/* Receive interrupt */
+#define LNET_REG_WINTR	4	/* Transmit interrupt */
+#define LNET_REG_CTL	8	/* Control */
+#define LNET_REG_STAT	12	/* Status: our link address */
+
+/* Interrupt register bits */
+#define LNET_INTR_DONE	0x1	/* Buffer holds a frame / was sent */
+
+/* Control register bits */
+#define LNET_CTL_PROMISC 0x1	/* Receive all frames */
+#define LNET_CTL_START	0x2	/* Send the transmit buffer */
+
+/* Buffers (offsets within slot) */
+#define LNET_RXBUF	32768
+#define LNET_TXBUF	(32768 + 4096)
+#define LNET_BUFSIZE	4096
+
+/* Link-level header, in front of every frame */
+struct lnet_linkhdr {
+	uint16_t lh_frame;	/* LNET_FRAME */
+	uint16_t lh_from;	/* sender's link address */
+	uint16_t lh_packetlen;	/* including this header */
+	uint16_t lh_to;		/* receiver's, or LNET_BROADCAST */
+};
+
+#define LNET_FRAME	0xa4b3
+#define LNET_BROADCAST	0xffff
+
+/*
+ * Shortcut for reading a register.
+ */
+static
+inline
+uint32_t lnet_rdreg(struct lnet_softc *ln, uint32_t reg)
+{
+	return bus_read_register(ln->ln_busdata, ln->ln_buspos, reg);
+}
+
+/*
+ * Shortcut for writing a register.
+ */
+static
+inline
+void lnet_wreg(struct lnet_softc *ln, uint32_t reg, uint32_t val)
+{
+	bus_write_register(ln->ln_busdata, ln->ln_buspos, reg, val);
+}
+
+////////////////////////////////////////////////////////////
+// receive
+
+/*
+ * Take the frame in the receive buffer onto the receive ring. Called
+ * with ln_lock held, before the buffer is given back to the card.
+ */
+static
+void
+lnet_rxframe(struct lnet_softc *ln)
+{
+	struct lnet_linkhdr lh;
+	struct pbuf *pb;
+	unsigned len;
+
+	KASSERT(spinlock_do_i_hold(&ln->ln_lock));
+
+	membar_load_load();
+	memcpy(&lh, ln->ln_rxbuf, sizeof(lh));
+	len = lh.lh_packetlen;
+	if (lh.lh_frame != LNET_FRAME || len < sizeof(lh) ||
+	    len - sizeof(lh) > NET_MTU) {
+		ln->ln_if.ni_idrops++;
+		return;
+	}
+	len -= sizeof(lh);
+
+	if (ln->ln_rxtail - ln->ln_rxhead == LNET_RXRING) {
+		ln->ln_if.ni_idrops++;
+		return;
+	}
+	pb = pbuf_get();
+	if (pb == NULL) {
+		ln->ln_if.ni_idrops++;
+		return;
+	}
+	memcpy(pbuf_data(pb), (char *)ln->ln_rxbuf + sizeof(lh), len);
+	pb->pb_len = len;
+
+	ln->ln_rx[ln->ln_rxtail % LNET_RXRING] = pb;
+	ln->ln_rxtail++;
+}
+
+/*
+ * Hand everything on the receive ring to the stack. Runs on sysworkq.
+ */
+static
+void
+lnet_rxwork(void *arg)
+{
+	struct lnet_softc *ln = arg;
+	struct pbuf *pb;
+
+	spinlock_acquire(&ln->ln_lock);
+	ln->ln_rxworks++;
+	while (ln->ln_rxhead != ln->ln_rxtail) {
+		pb = ln->ln_rx[ln->ln_rxhead % LNET_RXRING];
+		ln->ln_rxhead++;
+		spinlock_release(&ln->ln_lock);
+
+		net_input(&ln->ln_if, pb);
+
+		spinlock_acquire(&ln->ln_lock);
+	}
+	spinlock_release(&ln->ln_lock);
+}
+
+////////////////////////////////////////////////////////////
+// transmit
+
+/*
+ * Put the frame at the head of the transmit ring on the card and
+ * send it, if the card is free. Called with ln_lock held.
+ */
+static
+void
+lnet_txstart(struct lnet_softc *ln)
+{
+	struct pbuf *pb;
+
+	KASSERT(spinlock_do_i_hold(&ln->ln_lock));
+
+	if (ln->ln_txbusy || ln->ln_txhead == ln->ln_txtail) {
+		return;
+	}
+	pb = ln->ln_tx[ln->ln_txhead % LNET_TXRING];
+	memcpy(ln->ln_txbuf, pbuf_data(pb), pb->pb_len);
+	membar_store_store();
+	lnet_wreg(ln, LNET_REG_CTL, LNET_CTL_START);
+	ln->ln_txbusy = true;
+}
+
+/*
+ * ni_output: frame the IP packet in PB and queue it.
+ */
+static
 int
-config_lnet(struct lnet_softc *sc, int lnetno)
+lnet_output(struct netif *ni, struct pbuf *pb, uint32_t dst)
 {
-	(void)sc;
+	struct lnet_softc *ln = ni->ni_data;
+	struct lnet_linkhdr *lh;
 
-	kprintf("lnet%d: No network support in system\n", lnetno);
+	lh = pbuf_push(pb, sizeof(*lh));
+	lh->lh_frame = LNET_FRAME;
+	lh->lh_from = ln->ln_linkaddr;
+	lh->lh_packetlen = pb->pb_len;
+	lh->lh_to = dst == INADDR_BROADCAST ? LNET_BROADCAST
+		: NET_IPTOLINK(dst);
 
-	return ENODEV;
+	spinlock_acquire(&ln->ln_lock);
+	if (ln->ln_txtail - ln->ln_txhead == LNET_TXRING) {
+		ni->ni_odrops++;
+		spinlock_release(&ln->ln_lock);
+		pbuf_put(pb);
+		return 0;
+	}
+	ln->ln_tx[ln->ln_txtail % LNET_TXRING] = pb;
+	ln->ln_txtail++;
+	ni->ni_opackets++;
+	lnet_txstart(ln);
+	spinlock_release(&ln->ln_lock);
+	return 0;
 }
 
+////////////////////////////////////////////////////////////
+// interrupts and setup
 
+/*
+ * Interrupt handler for lnet. Either side or both may be done.
+ */
+void
+lnet_irq(void *vln)
+{
+	struct lnet_softc *ln = vln;
+	struct pbuf *sent = NULL;
+	bool received = false;
+
+	spinlock_acquire(&ln->ln_lock);
+
+	if (lnet_rdreg(ln, LNET_REG_RINTR) & LNET_INTR_DONE) {
+		lnet_rxframe(ln);
+		/* The buffer is the card's again */
+		lnet_wreg(ln, LNET_REG_RINTR, 0);
+		ln->ln_rxintrs++;
+		received = true;
+	}
+
+	if (lnet_rdreg(ln, LNET_REG_WINTR) & LNET_INTR_DONE) {
+		lnet_wreg(ln, LNET_REG_WINTR, 0);
+		if (ln->ln_txbusy) {
+			sent = ln->ln_tx[ln->ln_txhead % LNET_TXRING];
+			ln->ln_txhead++;
+			ln->ln_txbusy = false;
+			lnet_txstart(ln);
+		}
+	}
+
+	spinlock_release(&ln->ln_lock);
+
+	/* Before boot gets that far, frames wait on the ring */
+	if (received && sysworkq != NULL) {
+		workqueue_queue(sysworkq, &ln->ln_rxwork);
+	}
+	if (sent != NULL) {
+		pbuf_put(sent);
+	}
+}
+
+int
+config_lnet(struct lnet_softc *ln, int lnetno)
+{
+	ln->ln_rxbuf = bus_map_area(ln->ln_busdata, ln->ln_buspos,
+				    LNET_RXBUF);
+	ln->ln_txbuf = bus_map_area(ln->ln_busdata, ln->ln_buspos,
+				    LNET_TXBUF);
+	ln->ln_linkaddr = lnet_rdreg(ln, LNET_REG_STAT) & 0xffff;
+	snprintf(ln->ln_name, sizeof(ln->ln_name), "lnet%d", lnetno);
+
+	spinlock_init(&ln->ln_lock);
+	ln->ln_rxhead = ln->ln_rxtail = 0;
+	work_init(&ln->ln_rxwork, lnet_rxwork, ln);
+	ln->ln_txhead = ln->ln_txtail = 0;
+	ln->ln_txbusy = false;
+	ln->ln_rxintrs = 0;
+	ln->ln_rxworks = 0;
+
+	ln->ln_if.ni_name = ln->ln_name;
+	ln->ln_if.ni_addr = NET_LINKTOIP(ln->ln_linkaddr);
+	ln->ln_if.ni_output = lnet_output;
+	ln->ln_if.ni_data = ln;
+
+	/* Start clean: not promiscuous, nothing pending */
+	lnet_wreg(ln, LNET_REG_CTL, 0);
+	lnet_wreg(ln, LNET_REG_WINTR, 0);
+	lnet_wreg(ln, LNET_REG_RINTR, 0);
+
+	netif_register(&ln->ln_if);
+	return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef _LAMEBUS_LNET_H_
+#define _LAMEBUS_LNET_H_
+
+#include <spinlock.h>
+#include <workqueue.h>
+#include <net.h>
+
+/*
+ * Ring sizes. The card itself holds one frame each way; these are the
+ * driver's queues in front of it, in pbufs.
+ */
+#define LNET_RXRING	16
+#define LNET_TXRING	16
+
+/*
+ * Hardware device data associated with lnet (LAMEbus network card)
+ */
+struct lnet_softc {
+	/* Initialized by lower-level attach code */
+	void *ln_busdata;		/* The bus we're on */
+	uint32_t ln_buspos;		/* Our slot on that bus */
+	int ln_unit;			/* What number lnet we are */
+
+	/*
+	 * Initialized by config_lnet
+	 */
+
+	void *ln_rxbuf;			/* On-card receive buffer */
+	void *ln_txbuf;			/* On-card transmit buffer */
+	uint16_t ln_linkaddr;		/* Our hardware address */
+	char ln_name[16];		/* "lnetN" */
+
+	struct spinlock ln_lock;	/* Protects the card and the rings */
+
+	/* Received frames, filled by the interrupt handler */
+	struct pbuf *ln_rx[LNET_RXRING];
+	unsigned ln_rxhead, ln_rxtail;	/* taken, put; count up forever */
+	struct work ln_rxwork;		/* hands them to the stack */
+
+	/* Frames to send; the one at ln_txhead is on the card if busy */
+	struct pbuf *ln_tx[LNET_TXRING];
+	unsigned ln_txhead, ln_txtail;
+	bool ln_txbusy;
+
+	/* Counters */
+	unsigned ln_rxintrs;		/* receive interrupts */
+	unsigned ln_rxworks;		/* runs of ln_rxwork */
+
+	struct netif ln_if;		/* What the stack sees */
+};
+
+/* Functions called by lower-level drivers */
+void lnet_irq(/*struct lnet_softc*/ void *);	/* Interrupt handler */
+
+#endif /* _LAMEBUS_LNET_H_ */
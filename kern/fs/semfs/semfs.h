@@ -55,6 +55,7 @@ struct semfs_sem {
 	struct lock *sems_lock;			/* Lock to protect count */
 	struct cv *sems_cv;			/* CV to wait */
 	unsigned sems_count;			/* Semaphore count */
+	unsigned sems_batchwaiters;		/* semop() callers waiting */
 	bool sems_hasvnode;			/* The vnode exists */
 	bool sems_linked;			/* In the directory */
 };
@@ -75,11 +76,15 @@ DECLARRAY(semfs_direntry, SEMFS_INLINE);
  * ignore VOP_RECLAIM and destroy vnodes only when the underlying
  * objects are removed; but it ends up being more complicated in
  * practice. XXX: review after finishing)
+ *
+ * A semaphore isn't destroyed while it has a vnode, so the vnode
+ * keeps a pointer to it and P and V needn't look in the table.
  */
 struct semfs_vnode {
 	struct vnode semv_absvn;		/* Abstract vnode */
 	struct semfs *semv_semfs;		/* Back-pointer to fs */
 	unsigned semv_semnum;			/* Which semaphore */
+	struct semfs_sem *semv_sem;		/* It (NULL for root dir) */
 };
 
 /*
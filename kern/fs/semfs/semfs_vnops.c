@@ -30,6 +30,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/semop.h>
 #include <stat.h>
 #include <uio.h>
 #include <synch.h>
@@ -106,10 +107,6 @@ semfs_fsync(struct vnode *vn)
 ////////////////////////////////////////////////////////////
 // semaphore ops
 
-/*
- * XXX fold these two together
- */
-
 static
 struct semfs_sem *
 semfs_getsembynum(struct semfs *semfs, unsigned semnum)
@@ -123,25 +120,34 @@ semfs_getsembynum(struct semfs *semfs, unsigned semnum)
 	return sem;
 }
 
+/*
+ * The semaphore behind a vnode. This is the P and V path, so it
+ * doesn't touch the table: the vnode holds the semaphore in place.
+ */
 static
 struct semfs_sem *
 semfs_getsem(struct semfs_vnode *semv)
 {
-	struct semfs *semfs = semv->semv_semfs;
-
-	return semfs_getsembynum(semfs, semv->semv_semnum);
+	KASSERT(semv->semv_sem != NULL);
+	return semv->semv_sem;
 }
 
 /*
- * Wakeup helper. We only need to wake up if there are sleepers, which
+ * Wakeup helper. Readers take what they can as soon as the count is
+ * nonzero, so we only need to wake up if there are sleepers, which
  * should only be the case if the old count is 0; and we only
  * potentially need to wake more than one sleeper if the new count
- * will be more than 1.
+ * will be more than 1. semop() callers wait for the whole amount,
+ * though, so while there are any every increase wakes everyone.
  */
 static
 void
 semfs_wakeup(struct semfs_sem *sem, unsigned newcount)
 {
+	if (sem->sems_batchwaiters > 0 && newcount > sem->sems_count) {
+		cv_broadcast(sem->sems_cv, sem->sems_lock);
+		return;
+	}
 	if (sem->sems_count > 0 || newcount == 0) {
 		return;
 	}
@@ -621,7 +627,7 @@ semfs_reclaim(struct vnode *vn)
 	for (i=0; i<num; i++) {
 		vn2 = vnodearray_get(semfs->semfs_vnodes, i);
 		if (vn2 == vn) {
-			vnodearray_remove(semfs->semfs_vnodes, i);
+			vnodearray_remove_unordered(semfs->semfs_vnodes, i);
 			break;
 		}
 	}
@@ -657,11 +663,14 @@ static const struct vnode_ops semfs_dirops = {
 	.vop_read = vopfail_uio_isdir,
 	.vop_readlink = vopfail_uio_isdir,
 	.vop_getdirentry = semfs_getdirentry,
+	.vop_getdirplus = vopfail_uio_nosys,
+	.vop_getdents = vop_getdents_byentry,
 	.vop_write = vopfail_uio_isdir,
 	.vop_ioctl = semfs_ioctl,
 	.vop_stat = semfs_dirstat,
 	.vop_gettype = semfs_gettype,
 	.vop_isseekable = semfs_isseekable,
+	.vop_poll = vop_poll_ready,
 	.vop_fsync = semfs_fsync,
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
@@ -690,11 +699,14 @@ static const struct vnode_ops semfs_semops = {
 	.vop_read = semfs_read,
 	.vop_readlink = vopfail_uio_inval,
 	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirplus = vopfail_uio_notdir,
+	.vop_getdents = vopfail_uio_notdir,
 	.vop_write = semfs_write,
 	.vop_ioctl = semfs_ioctl,
 	.vop_stat = semfs_semstat,
 	.vop_gettype = semfs_gettype,
 	.vop_isseekable = semfs_isseekable,
+	.vop_poll = vop_poll_ready,
 	.vop_fsync = semfs_fsync,
 	.vop_mmap = vopfail_mmap_perm,
 	.vop_truncate = semfs_truncate,
@@ -736,6 +748,7 @@ semfs_vnode_create(struct semfs *semfs, unsigned semnum)
 
 	semv->semv_semfs = semfs;
 	semv->semv_semnum = semnum;
+	semv->semv_sem = NULL;
 
 	result = vnode_init(&semv->semv_absvn, optable,
 			    &semfs->semfs_absfs, semv);
@@ -791,9 +804,113 @@ semfs_getvnode(struct semfs *semfs, unsigned semnum, struct vnode **ret)
 		KASSERT(sem != NULL);
 		KASSERT(sem->sems_hasvnode == false);
 		sem->sems_hasvnode = true;
+		semv->semv_sem = sem;
 	}
 	lock_release(semfs->semfs_tablelock);
 
 	*ret = &semv->semv_absvn;
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// semop
+
+/*
+ * Apply a batch of P and V operations atomically: nothing is done
+ * until every P can be satisfied, then everything is done at once.
+ * Operations on the same semaphore are added together first.
+ *
+ * The semaphores' locks are taken in semnum order. If one of them
+ * is short we drop the rest, wait on that one, and start over.
+ * Nothing here touches the semaphore table or the directory, so a V
+ * nobody is waiting for costs one lock on the semaphore itself.
+ */
+int
+semfs_semop(struct vnode **vns, const int *deltas, unsigned n)
+{
+	/* We should just use UINT_MAX but we don't have it in the kernel */
+	const int64_t max = (unsigned)-1;
+
+	struct semfs_vnode *semv;
+	struct semfs_sem *sems[SEMOP_MAX];
+	unsigned semnums[SEMOP_MAX];
+	int64_t net[SEMOP_MAX];
+	struct semfs_sem *blocked;
+	unsigned i, j, num;
+
+	KASSERT(n <= SEMOP_MAX);
+
+	/* Collect the semaphores, sorted by semnum, and what each gets */
+	num = 0;
+	for (i=0; i<n; i++) {
+		if (vns[i]->vn_ops != &semfs_semops) {
+			return EINVAL;
+		}
+		semv = vns[i]->vn_data;
+		for (j=0; j<num; j++) {
+			if (sems[j] == semv->semv_sem) {
+				break;
+			}
+		}
+		if (j == num) {
+			for (j=num; j>0 && semnums[j-1] > semv->semv_semnum;
+			     j--) {
+				sems[j] = sems[j-1];
+				semnums[j] = semnums[j-1];
+				net[j] = net[j-1];
+			}
+			sems[j] = semv->semv_sem;
+			semnums[j] = semv->semv_semnum;
+			net[j] = 0;
+			num++;
+		}
+		net[j] += deltas[i];
+	}
+
+	while (1) {
+		for (i=0; i<num; i++) {
+			lock_acquire(sems[i]->sems_lock);
+		}
+
+		blocked = NULL;
+		for (i=0; i<num; i++) {
+			if (net[i] < 0 && sems[i]->sems_count < -net[i]) {
+				blocked = sems[i];
+				break;
+			}
+			if (sems[i]->sems_count + net[i] > max) {
+				/* overflow */
+				for (j=0; j<num; j++) {
+					lock_release(sems[j]->sems_lock);
+				}
+				return EFBIG;
+			}
+		}
+		if (blocked == NULL) {
+			break;
+		}
+
+		for (i=0; i<num; i++) {
+			if (sems[i] != blocked) {
+				lock_release(sems[i]->sems_lock);
+			}
+		}
+		DEBUG(DB_SEMFS, "semfs: semop blocking\n");
+		blocked->sems_batchwaiters++;
+		cv_wait(blocked->sems_cv, blocked->sems_lock);
+		blocked->sems_batchwaiters--;
+		lock_release(blocked->sems_lock);
+	}
+
+	for (i=0; i<num; i++) {
+		if (net[i] > 0) {
+			semfs_wakeup(sems[i], sems[i]->sems_count + net[i]);
+		}
+		DEBUG(DB_SEMFS, "semfs: sem%u: semop, count %u -> %u\n",
+		      semnums[i], sems[i]->sems_count,
+		      (unsigned)(sems[i]->sems_count + net[i]));
+		sems[i]->sems_count += net[i];
+		lock_release(sems[i]->sems_lock);
+	}
+	return 0;
+}
@@ -33,8 +33,11 @@
  * Block allocation.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <bitmap.h>
+#include <parallel.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -45,47 +48,517 @@ static
 int
 sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
+	struct sfs_buf *b;
+	int result;
+
+	result = sfs_buf_get(sfs, block, &b);
+	if (result) {
+		return result;
+	}
+	bzero(b->b_data, SFS_BLOCKSIZE);
+	sfs_buf_dirty(b);
+	sfs_buf_release(b);
+	return 0;
+}
+
+/* Sizes of the index units, in bytes of freemap */
+#define SFS_CHUNKBYTES	(SFS_CHUNKBLOCKS / CHAR_BIT)
+#define SFS_GROUPBYTES	(SFS_CHUNKBYTES * SFS_GROUPCHUNKS)
+
+/*
+ * parallel_for function for sfs_freemap_index: count the free blocks
+ * of groups START to END-1.
+ */
+static
+void
+sfs_freemap_indexgroups(void *arg, unsigned start, unsigned end)
+{
+	struct sfs_fs *sfs = arg;
+	unsigned block, lastblock;
 
-	return sfs_writeblock(sfs, block, zeros, SFS_BLOCKSIZE);
+	block = start * SFS_GROUPCHUNKS * SFS_CHUNKBLOCKS;
+	lastblock = end * SFS_GROUPCHUNKS * SFS_CHUNKBLOCKS;
+	if (lastblock > sfs->sfs_sb.sb_nblocks) {
+		lastblock = sfs->sfs_sb.sb_nblocks;
+	}
+	for (; block < lastblock; block++) {
+		if (!bitmap_isset(sfs->sfs_freemap, block)) {
+			sfs->sfs_chunkfree[block / SFS_CHUNKBLOCKS]++;
+			sfs->sfs_groupfree[block / SFS_CHUNKBLOCKS /
+					   SFS_GROUPCHUNKS]++;
+		}
+	}
 }
 
 /*
- * Allocate a block.
+ * Build the free space index from the freemap. Called at mount time,
+ * once the freemap has been loaded. Each group's counts are only
+ * touched by whoever does that group, so the groups are counted in
+ * parallel.
  */
 int
-sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
+sfs_freemap_index(struct sfs_fs *sfs)
+{
+	unsigned nblocks, nchunks, ngroups, i;
+
+	nblocks = sfs->sfs_sb.sb_nblocks;
+	nchunks = DIVROUNDUP(nblocks, SFS_CHUNKBLOCKS);
+	ngroups = DIVROUNDUP(nchunks, SFS_GROUPCHUNKS);
+
+	sfs->sfs_chunkfree = kmalloc(nchunks * sizeof(unsigned));
+	sfs->sfs_groupfree = kmalloc(ngroups * sizeof(unsigned));
+	if (sfs->sfs_chunkfree == NULL || sfs->sfs_groupfree == NULL) {
+		return ENOMEM;
+	}
+	bzero(sfs->sfs_chunkfree, nchunks * sizeof(unsigned));
+	bzero(sfs->sfs_groupfree, ngroups * sizeof(unsigned));
+
+	/* A group is 8192 blocks, plenty for one chunk */
+	parallel_for(ngroups, 1, sfs_freemap_indexgroups, sfs);
+
+	sfs->sfs_nfree = 0;
+	for (i = 0; i < ngroups; i++) {
+		sfs->sfs_nfree += sfs->sfs_groupfree[i];
+	}
+	return 0;
+}
+
+/*
+ * Note that the freemap block holding BLOCK's bit has changed, so
+ * that sync writes only the blocks that did.
+ */
+static
+void
+sfs_fdirty(struct sfs_fs *sfs, daddr_t block)
+{
+	unsigned fmblock = block / SFS_BITSPERBLOCK;
+
+	if (!bitmap_isset(sfs->sfs_fmdirty, fmblock)) {
+		bitmap_mark(sfs->sfs_fmdirty, fmblock);
+	}
+	sfs->sfs_freemapdirty = true;
+}
+
+/*
+ * Mark or unmark a block in the freemap, keeping the index up to
+ * date. The freemap lock must be held.
+ */
+static
+void
+sfs_fmark(struct sfs_fs *sfs, daddr_t block)
+{
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+	bitmap_mark(sfs->sfs_freemap, block);
+	sfs_fdirty(sfs, block);
+	KASSERT(sfs->sfs_chunkfree[block / SFS_CHUNKBLOCKS] > 0);
+	sfs->sfs_chunkfree[block / SFS_CHUNKBLOCKS]--;
+	sfs->sfs_groupfree[block / SFS_CHUNKBLOCKS / SFS_GROUPCHUNKS]--;
+	sfs->sfs_nfree--;
+}
+
+static
+void
+sfs_funmark(struct sfs_fs *sfs, daddr_t block)
 {
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+	bitmap_unmark(sfs->sfs_freemap, block);
+	sfs_fdirty(sfs, block);
+	sfs->sfs_chunkfree[block / SFS_CHUNKBLOCKS]++;
+	sfs->sfs_groupfree[block / SFS_CHUNKBLOCKS / SFS_GROUPCHUNKS]++;
+	sfs->sfs_nfree++;
+}
+
+/*
+ * Free blocks not promised to anyone. While a file is placing its
+ * delayed blocks the blocks it takes are still counted as reserved,
+ * so this can briefly come out negative.
+ */
+static
+unsigned
+sfs_unreserved(struct sfs_fs *sfs)
+{
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+	if (sfs->sfs_nfree < sfs->sfs_nreserved) {
+		return 0;
+	}
+	return sfs->sfs_nfree - sfs->sfs_nreserved;
+}
+
+/*
+ * Promise NBLOCKS free blocks to a file that has written data it
+ * hasn't placed on disk yet (see sfs_da_get), so that placing it
+ * later can't run out of space. Only sfs_balloc_file, while placing,
+ * may allocate reserved blocks.
+ */
+int
+sfs_breserve(struct sfs_fs *sfs, unsigned nblocks)
+{
+	int result = 0;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	if (sfs_unreserved(sfs) < nblocks) {
+		result = ENOSPC;
+	}
+	else {
+		sfs->sfs_nreserved += nblocks;
+	}
+	lock_release(sfs->sfs_freemaplock);
+	return result;
+}
+
+void
+sfs_bunreserve(struct sfs_fs *sfs, unsigned nblocks)
+{
+	lock_acquire(sfs->sfs_freemaplock);
+	KASSERT(sfs->sfs_nreserved >= nblocks);
+	sfs->sfs_nreserved -= nblocks;
+	lock_release(sfs->sfs_freemaplock);
+}
+
+/*
+ * Find the first byte of the freemap, from byte START on (wrapping
+ * around), that is wholly free if WHOLE is set, or else that has any
+ * free block in it. Groups and chunks with too few free blocks to
+ * have such a byte are skipped without looking at them, so the cost
+ * doesn't grow as the volume fills up.
+ */
+static
+bool
+sfs_findbyte(struct sfs_fs *sfs, unsigned start, bool whole, unsigned *ret)
+{
+	const unsigned char *map;
+	unsigned nblocks, nbytes, minfree, i, ix, skip;
+
+	map = bitmap_getdata(sfs->sfs_freemap);
+	nblocks = sfs->sfs_sb.sb_nblocks;
+	nbytes = DIVROUNDUP(nblocks, CHAR_BIT);
+	minfree = whole ? CHAR_BIT : 1;
+
+	i = 0;
+	while (i < nbytes) {
+		ix = (start + i) % nbytes;
+		if (sfs->sfs_groupfree[ix / SFS_GROUPBYTES] < minfree) {
+			skip = SFS_GROUPBYTES - ix % SFS_GROUPBYTES;
+		}
+		else if (sfs->sfs_chunkfree[ix / SFS_CHUNKBYTES] < minfree) {
+			skip = SFS_CHUNKBYTES - ix % SFS_CHUNKBYTES;
+		}
+		else {
+			if (whole ? (map[ix] == 0 &&
+				     (ix + 1) * CHAR_BIT <= nblocks)
+			    : map[ix] != 0xff) {
+				*ret = ix;
+				return true;
+			}
+			skip = 1;
+		}
+		/* Don't skip past the end into the start */
+		if (skip > nbytes - ix) {
+			skip = nbytes - ix;
+		}
+		i += skip;
+	}
+	return false;
+}
+
+/*
+ * Find and mark a run of free blocks, as close after GOAL as possible
+ * (wrapping around at the end of the volume), of at most MAXRUN
+ * blocks. With no goal (0), the search starts where the last such
+ * allocation ended instead. If GOAL itself is free the run starts
+ * there; otherwise it starts at the first wholly free byte of the
+ * bitmap, so as not to chop up the small holes, and only failing that
+ * at the first free block. Returns the first block and the run
+ * length. Reserved blocks are only touched if USERESERVE is set.
+ */
+static
+int
+sfs_findrun(struct sfs_fs *sfs, daddr_t goal, unsigned maxrun,
+	    bool usereserve, daddr_t *start, unsigned *len)
+{
+	unsigned nblocks, ix, block, avail;
+	bool nogoal;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+	KASSERT(maxrun > 0);
+
+	avail = usereserve ? sfs->sfs_nfree : sfs_unreserved(sfs);
+	if (avail == 0) {
+		return ENOSPC;
+	}
+	if (maxrun > avail) {
+		maxrun = avail;
+	}
+
+	nblocks = sfs->sfs_sb.sb_nblocks;
+	nogoal = (goal == 0);
+	if (nogoal) {
+		goal = sfs->sfs_alloccursor;
+	}
+	if (goal >= nblocks) {
+		goal = 0;
+	}
+
+	if (!bitmap_isset(sfs->sfs_freemap, goal)) {
+		block = goal;
+	}
+	else if (sfs_findbyte(sfs, goal / CHAR_BIT + 1, true, &ix)) {
+		block = ix * CHAR_BIT;
+	}
+	else if (sfs_findbyte(sfs, goal / CHAR_BIT, false, &ix)) {
+		for (block = ix * CHAR_BIT;
+		     bitmap_isset(sfs->sfs_freemap, block); block++) {
+			/* nothing */
+		}
+		/* bitmap_create marked the bits past the end */
+		KASSERT(block < nblocks);
+	}
+	else {
+		return ENOSPC;
+	}
+
+	*start = block;
+	for (*len = 0; *len < maxrun && block < nblocks &&
+		     !bitmap_isset(sfs->sfs_freemap, block); (*len)++) {
+		sfs_fmark(sfs, block);
+		block++;
+	}
+	KASSERT(*len > 0);
+
+	if (nogoal) {
+		sfs->sfs_alloccursor = block;
+	}
+	return 0;
+}
+
+/*
+ * Allocate a block, preferably GOAL or soon after it.
+ */
+int
+sfs_balloc(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock)
+{
+	unsigned len;
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	lock_acquire(sfs->sfs_freemaplock);
+	result = sfs_findrun(sfs, goal, 1, false, diskblock, &len);
+	lock_release(sfs->sfs_freemaplock);
 	if (result) {
 		return result;
 	}
-	sfs->sfs_freemapdirty = true;
 
 	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: balloc: invalid block %u\n",
 		      sfs->sfs_sb.sb_volname, *diskblock);
 	}
 
-	/* Clear block before returning it */
+	/*
+	 * Clear block before returning it. Nobody else can get at it
+	 * meanwhile, so the freemap lock needn't be held for this.
+	 */
+	result = sfs_clearblock(sfs, *diskblock);
+	if (result) {
+		lock_acquire(sfs->sfs_freemaplock);
+		sfs_funmark(sfs, *diskblock);
+		lock_release(sfs->sfs_freemaplock);
+	}
+	return result;
+}
+
+/*
+ * Pick the goal for a new inode in directory DIR: the directory's
+ * own inode, so that the files in one directory, and the first data
+ * blocks that sfs_bmap puts right after each inode, end up near it
+ * and near each other. The chunk groups of the freemap index stand
+ * in for cylinder groups. If the directory's group is down to its
+ * last SFS_INOGROUPMIN free blocks, which are better left for the
+ * files already there to grow into, start instead at the next group
+ * that has more, so new files move on together.
+ */
+daddr_t
+sfs_inogoal(struct sfs_fs *sfs, struct sfs_vnode *dir)
+{
+	const unsigned groupblocks = SFS_CHUNKBLOCKS * SFS_GROUPCHUNKS;
+	unsigned ngroups, home, g, i;
+	daddr_t goal;
+
+	ngroups = DIVROUNDUP(sfs->sfs_sb.sb_nblocks, groupblocks);
+	home = dir->sv_ino / groupblocks;
+	goal = dir->sv_ino;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	if (sfs->sfs_groupfree[home] < SFS_INOGROUPMIN) {
+		for (i=1; i<ngroups; i++) {
+			g = (home + i) % ngroups;
+			if (sfs->sfs_groupfree[g] >= SFS_INOGROUPMIN) {
+				/* Block 0 would mean no goal */
+				goal = g == 0 ? SFS_ROOTDIR_INO :
+					g * groupblocks;
+				break;
+			}
+		}
+	}
+	lock_release(sfs->sfs_freemaplock);
+	return goal;
+}
+
+/*
+ * Allocate a block for file SV, which must be locked, preferably at
+ * GOAL (normally the block after the file's previous one; 0 for no
+ * preference).
+ *
+ * To keep files contiguous when several grow at once, blocks are
+ * taken SFS_PREALLOC at a time, and the ones not yet used are kept
+ * in reserve for the file in sv_prealloc. They are marked in use in
+ * the freemap, so nobody else gets them, until the file is
+ * reclaimed or truncated, or asks for a block somewhere else.
+ *
+ * While the file is placing delayed blocks, the run is sized to what
+ * is being placed instead, and comes out of the file's reservation.
+ * Likewise for fallocate (sv_fallocleft), whose run is what is left
+ * to allocate plus the indirect blocks for it; and as fallocate knows
+ * where it's going, a run that didn't start at the goal is kept.
+ */
+int
+sfs_balloc_file(struct sfs_vnode *sv, daddr_t goal, daddr_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	unsigned len, maxrun;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (sv->sv_npreall > 0 && goal != 0 && goal != sv->sv_prealloc &&
+	    sv->sv_fallocleft == 0) {
+		/* Not going the way we guessed */
+		sfs_prealloc_release(sv);
+	}
+	if (sv->sv_npreall == 0) {
+		if (sv->sv_daplacing) {
+			maxrun = sv->sv_dacount + SFS_DASLACK;
+		}
+		else if (sv->sv_fallocleft > 0) {
+			maxrun = sv->sv_fallocleft +
+				sv->sv_fallocleft / SFS_DBPERIDB + SFS_DASLACK;
+		}
+		else {
+			maxrun = SFS_PREALLOC;
+		}
+		lock_acquire(sfs->sfs_freemaplock);
+		result = sfs_findrun(sfs, goal, maxrun, sv->sv_daplacing,
+				     &sv->sv_prealloc, &len);
+		lock_release(sfs->sfs_freemaplock);
+		if (result) {
+			return result;
+		}
+		sv->sv_npreall = len;
+	}
+
+	*diskblock = sv->sv_prealloc;
+	sv->sv_prealloc++;
+	sv->sv_npreall--;
+
 	result = sfs_clearblock(sfs, *diskblock);
 	if (result) {
-		bitmap_unmark(sfs->sfs_freemap, *diskblock);
+		/* Put it back at the front of the reserve */
+		sv->sv_prealloc--;
+		sv->sv_npreall++;
 	}
 	return result;
 }
 
+/*
+ * Give back the blocks reserved for SV by sfs_balloc_file.
+ */
+void
+sfs_prealloc_release(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (sv->sv_npreall == 0) {
+		return;
+	}
+	/* Never used, so there's nothing of theirs in the cache */
+	lock_acquire(sfs->sfs_freemaplock);
+	for (i=0; i<sv->sv_npreall; i++) {
+		sfs_funmark(sfs, sv->sv_prealloc + i);
+	}
+	lock_release(sfs->sfs_freemaplock);
+	sv->sv_npreall = 0;
+}
+
 /*
  * Free a block.
  */
 void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 {
-	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = true;
+	/*
+	 * Whatever was in the block no longer needs writing. This
+	 * must happen before the block is up for grabs again.
+	 */
+	sfs_buf_forget(sfs, diskblock);
+	/* Nor must any image of it still in the journal */
+	sfs_journal_revoke(sfs, diskblock);
+
+	lock_acquire(sfs->sfs_freemaplock);
+	sfs_funmark(sfs, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+}
+
+/*
+ * Start an empty batch of blocks to free.
+ */
+void
+sfs_freebatch_init(struct sfs_freebatch *fb)
+{
+	fb->fb_n = 0;
+}
+
+/*
+ * Free a block as part of batch FB. It stays marked in use until the
+ * batch is flushed, which happens when it fills up and must be done
+ * by the caller at the end; until then nobody else can have it, so
+ * the block can be forgotten by the cache now or later alike.
+ */
+void
+sfs_bfree_batch(struct sfs_fs *sfs, struct sfs_freebatch *fb,
+		daddr_t diskblock)
+{
+	if (fb->fb_n == SFS_FREEBATCH) {
+		sfs_freebatch_flush(sfs, fb);
+	}
+	fb->fb_blocks[fb->fb_n++] = diskblock;
+}
+
+/*
+ * Free all the blocks in batch FB, taking the freemap lock once.
+ */
+void
+sfs_freebatch_flush(struct sfs_fs *sfs, struct sfs_freebatch *fb)
+{
+	unsigned i;
+
+	if (fb->fb_n == 0) {
+		return;
+	}
+
+	/* As in sfs_bfree, before any of them can be reallocated */
+	for (i=0; i<fb->fb_n; i++) {
+		sfs_buf_forget(sfs, fb->fb_blocks[i]);
+		sfs_journal_revoke(sfs, fb->fb_blocks[i]);
+	}
+
+	lock_acquire(sfs->sfs_freemaplock);
+	for (i=0; i<fb->fb_n; i++) {
+		sfs_funmark(sfs, fb->fb_blocks[i]);
+	}
+	lock_release(sfs->sfs_freemaplock);
+
+	fb->fb_n = 0;
 }
 
 /*
@@ -94,10 +567,15 @@ sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 int
 sfs_bused(struct sfs_fs *sfs, daddr_t diskblock)
 {
+	int ret;
+
 	if (diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: sfs_bused called on out of range block %u\n",
 		      sfs->sfs_sb.sb_volname, diskblock);
 	}
-	return bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_acquire(sfs->sfs_freemaplock);
+	ret = bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+	return ret;
 }
 
@@ -35,39 +35,148 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/*
+ * Allocation goal for the block after disk block B: the next one, or
+ * no preference (0) if B is a hole.
+ */
+#define SFS_NEXTBLOCK(b)	((b) == 0 ? 0 : (daddr_t)(b) + 1)
+
+/*
+ * Number of file blocks mapped by an indirect block of each level
+ * (1 = singly indirect), and so by one entry of the level above.
+ */
+#define SFS_IBRANGE(level) \
+	((level) == 1 ? SFS_DBPERIDB : \
+	 (level) == 2 ? SFS_DBPERIDB * SFS_DBPERIDB : \
+	 SFS_DBPERIDB * SFS_DBPERIDB * SFS_DBPERIDB)
+
+/*
+ * The inode's pointer to its indirect block of level LEVEL.
+ */
+static
+uint32_t *
+sfs_ibroot(struct sfs_vnode *sv, unsigned level)
+{
+	COMPILE_ASSERT(SFS_NINDIRECT == 1);
+	COMPILE_ASSERT(SFS_NDINDIRECT == 1);
+	COMPILE_ASSERT(SFS_NTINDIRECT == 1);
+
+	switch (level) {
+	    case 1: return &sv->sv_i.sfi_indirect;
+	    case 2: return &sv->sv_i.sfi_dindirect;
+	    case 3: return &sv->sv_i.sfi_tindirect;
+	}
+	panic("sfs: Invalid indirection level %u\n", level);
+	return NULL;
+}
+
+/*
+ * Allocation goal for an indirect block that will map FILEBLOCK: the
+ * block after the one holding the file block before it, so that the
+ * indirect block sits between the runs of data on either side of it
+ * and a file written in order stays in one run on disk.
+ */
+static
+daddr_t
+sfs_ibgoal(struct sfs_vnode *sv, uint32_t fileblock)
+{
+	daddr_t prev;
+
+	if (sfs_bmap(sv, fileblock - 1, false, &prev)) {
+		return 0;
+	}
+	return SFS_NEXTBLOCK(prev);
+}
+
+/*
+ * Look up entry INDEX of indirect block IDBLOCK, allocating a block
+ * for it if it's empty and DOALLOC is set. If IBFOR is nonzero, the
+ * new block is an indirect block on the way to file block IBFOR and
+ * is placed by sfs_ibgoal; otherwise it follows the previous entry,
+ * or for the first one the indirect block itself.
+ */
+static
+int
+sfs_ibentry(struct sfs_vnode *sv, daddr_t idblock, uint32_t index,
+	    bool doalloc, uint32_t ibfor, daddr_t *ret)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *idb;
+	uint32_t *idbuf;
+	daddr_t block, goal;
+	int result;
+
+	/*
+	 * Get the indirect block from the buffer cache.
+	 */
+	result = sfs_buf_read(sfs, idblock, &idb);
+	if (result) {
+		return result;
+	}
+	idbuf = (uint32_t *)idb->b_data;
+
+	/* Get the block out of the indirect block buffer */
+	block = idbuf[index];
+
+	/* If there's no block there, allocate one */
+	if (block==0 && doalloc) {
+		if (ibfor != 0) {
+			goal = sfs_ibgoal(sv, ibfor);
+		}
+		else {
+			goal = SFS_NEXTBLOCK(index > 0 ?
+					     idbuf[index-1] : idblock);
+		}
+		result = sfs_balloc_file(sv, goal, &block);
+		if (result) {
+			sfs_buf_release(idb);
+			return result;
+		}
+
+		/* Remember the block we allocated */
+		idbuf[index] = block;
+
+		/* The indirect block is now dirty */
+		sfs_jfdirty(idb, sv);
+	}
+	sfs_buf_release(idb);
+
+	*ret = block;
+	return 0;
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
  * allocated.
+ *
+ * Blocks past the direct ones are found through the singly, doubly,
+ * or triply indirect block. The last indirect block that mapped a
+ * data block is remembered in the vnode, so that sequential access
+ * goes straight to it instead of down the chain from the inode each
+ * time.
  */
 int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	 daddr_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t *rootp;
 	daddr_t block;
 	daddr_t idblock;
-	uint32_t idnum, idoff;
+	uint32_t origblock, baseblock, offset, range;
+	unsigned level;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	COMPILE_ASSERT(SFS_DBPERIDB * sizeof(uint32_t) == SFS_BLOCKSIZE);
 
-	/* Since we're using a static buffer, we'd better be locked. */
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -82,7 +191,10 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			result = sfs_balloc_file(sv, fileblock == 0 ?
+					sv->sv_ino + 1 :
+					SFS_NEXTBLOCK(sv->sv_i.sfi_direct[fileblock-1]),
+					&block);
 			if (result) {
 				return result;
 			}
@@ -104,28 +216,44 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		return 0;
 	}
 
+	origblock = fileblock;
+
 	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
+	 * If the last indirect block we went through maps this block
+	 * too, use it directly.
 	 */
-
-	fileblock -= SFS_NDIRECT;
-
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
+	if (sv->sv_ibblock != 0 && fileblock >= sv->sv_ibfirst &&
+	    fileblock - sv->sv_ibfirst < SFS_DBPERIDB) {
+		result = sfs_ibentry(sv, sv->sv_ibblock,
+				     fileblock - sv->sv_ibfirst, doalloc, 0,
+				     &block);
+		if (result) {
+			return result;
+		}
+		goto found;
+	}
 
 	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
+	 * Find which indirect block in the inode maps it, and the
+	 * offset of the block in the range that one maps.
 	 */
-	if (idnum >= SFS_NINDIRECT) {
+	baseblock = SFS_NDIRECT;
+	for (level = 1; level <= 3; level++) {
+		range = SFS_IBRANGE(level);
+		if (fileblock - baseblock < range) {
+			break;
+		}
+		baseblock += range;
+	}
+	if (level > 3) {
+		/* Past what the triple indirect block can map */
 		return EFBIG;
 	}
+	offset = fileblock - baseblock;
+	rootp = sfs_ibroot(sv, level);
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
+	/* Get the disk block number of the top indirect block. */
+	idblock = *rootp;
 
 	if (idblock==0 && !doalloc) {
 		/*
@@ -143,89 +271,358 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * the indirect block. Thus, we need to allocate an
 		 * indirect block.
 		 */
-		result = sfs_balloc(sfs, &idblock);
+		result = sfs_balloc_file(sv, sfs_ibgoal(sv, fileblock),
+					 &idblock);
 		if (result) {
 			return result;
 		}
 
 		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
+		*rootp = idblock;
 
 		/* Mark the inode dirty */
 		sv->sv_dirty = true;
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+		/* (sfs_balloc has left a zeroed copy in the cache) */
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+
+	/*
+	 * Go down through the doubly and singly indirect blocks under
+	 * it, if any, allocating them as needed.
+	 */
+	for (; level > 1; level--) {
+		range = SFS_IBRANGE(level - 1);
+		result = sfs_ibentry(sv, idblock, offset / range, doalloc,
+				     fileblock, &idblock);
 		if (result) {
 			return result;
 		}
+		if (idblock == 0) {
+			/* Not allocating, and nothing there */
+			*diskblock = 0;
+			return 0;
+		}
+		offset %= range;
 	}
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+	/* Remember the singly indirect block for next time */
+	sv->sv_ibblock = idblock;
+	sv->sv_ibfirst = fileblock - offset;
 
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
+	/*
+	 * Follow the previous block, or for the first one, the
+	 * indirect block (which will itself have followed the data
+	 * before it).
+	 */
+	result = sfs_ibentry(sv, idblock, offset, doalloc, 0, &block);
+	if (result) {
+		return result;
+	}
+
+ found:
+	/* Hand back the result and return. */
+	if (block != 0 && !sfs_bused(sfs, block)) {
+		panic("sfs: %s: Data block %u (block %u of file %u) "
+		      "marked free\n", sfs->sfs_sb.sb_volname,
+		      block, origblock, sv->sv_ino);
+	}
+	*diskblock = block;
+	return 0;
+}
+
+/*
+ * Like sfs_bmap without allocating, but if FILEBLOCK is a hole also
+ * report in *SKIP how many blocks from it on are known to be holes:
+ * the rest of the range of a missing indirect block, so that looking
+ * for data in a sparse file doesn't go through its empty parts a
+ * block at a time. (*SKIP is 1 for data, or if all that's known is
+ * that FILEBLOCK itself is a hole.) Blocks past what the inode can
+ * map are one big hole.
+ */
+static
+int
+sfs_bmap_hole(struct sfs_vnode *sv, uint32_t fileblock, daddr_t *diskblock,
+	      uint32_t *skip)
+{
+	daddr_t idblock;
+	uint32_t baseblock, offset, range;
+	unsigned level;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	*skip = 1;
+	if (fileblock < SFS_NDIRECT) {
+		*diskblock = sv->sv_i.sfi_direct[fileblock];
+		return 0;
+	}
+
+	baseblock = SFS_NDIRECT;
+	for (level = 1; level <= 3; level++) {
+		range = SFS_IBRANGE(level);
+		if (fileblock - baseblock < range) {
+			break;
+		}
+		baseblock += range;
+	}
+	*diskblock = 0;
+	if (level > 3) {
+		*skip = (uint32_t)-1 - fileblock;
+		return 0;
+	}
+	offset = fileblock - baseblock;
+	idblock = *sfs_ibroot(sv, level);
+	if (idblock == 0) {
+		*skip = range - offset;
+		return 0;
+	}
+	for (; level > 1; level--) {
+		range = SFS_IBRANGE(level - 1);
+		result = sfs_ibentry(sv, idblock, offset / range, false, 0,
+				     &idblock);
 		if (result) {
 			return result;
 		}
+		if (idblock == 0) {
+			*skip = range - offset % range;
+			return 0;
+		}
+		offset %= range;
+	}
+	return sfs_ibentry(sv, idblock, offset, false, 0, diskblock);
+}
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+/*
+ * lseek SEEK_DATA or (if HOLE) SEEK_HOLE: find the first byte at or
+ * after *POS that is in a block with data, or in a hole. Blocks still
+ * waiting for a place on disk count as data, and the end of the file
+ * as a hole. ENXIO if *POS is at or past the end, or there is no data
+ * after it. Called with the vnode locked.
+ */
+int
+sfs_seekdata(struct sfs_vnode *sv, bool hole, off_t *pos)
+{
+	off_t size = sv->sv_i.sfi_size;
+	uint32_t fileblock, lastblock, skip;
+	daddr_t diskblock;
+	bool isdata;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (*pos >= size) {
+		return ENXIO;
+	}
+	if (sv->sv_i.sfi_flags & SFS_IFLAG_INLINE) {
+		/* All data, all in the inode */
+		if (hole) {
+			*pos = size;
+		}
+		return 0;
+	}
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
+	fileblock = *pos / SFS_BLOCKSIZE;
+	lastblock = (size - 1) / SFS_BLOCKSIZE;
+	while (fileblock <= lastblock) {
+		if (fileblock >= sv->sv_dafirst &&
+		    fileblock - sv->sv_dafirst < sv->sv_dacount) {
+			isdata = true;
+			skip = 1;
+		}
+		else {
+			result = sfs_bmap_hole(sv, fileblock, &diskblock,
+					       &skip);
+			if (result) {
+				return result;
+			}
+			isdata = diskblock != 0;
+			/* Don't skip over delayed blocks */
+			if (sv->sv_dacount > 0 &&
+			    fileblock < sv->sv_dafirst &&
+			    skip > sv->sv_dafirst - fileblock) {
+				skip = sv->sv_dafirst - fileblock;
+			}
+		}
+		if (isdata != hole) {
+			if ((off_t)fileblock * SFS_BLOCKSIZE > *pos) {
+				*pos = (off_t)fileblock * SFS_BLOCKSIZE;
+			}
+			return 0;
+		}
+		if (skip > lastblock - fileblock) {
+			break;
+		}
+		fileblock += skip;
+	}
+
+	if (!hole) {
+		return ENXIO;
+	}
+	*pos = size;
+	return 0;
+}
+
+/*
+ * fallocate: give each of the NBLOCKS file blocks from FIRST that is
+ * a hole a block on disk. LEFT is how many blocks the whole request
+ * still covers from FIRST on (the caller does it a chunk at a time),
+ * which sizes the runs sfs_balloc_file takes, so the blocks come out
+ * contiguous if there is room. Leftover reserve is given back with
+ * the last chunk. Called with the vnode locked, in a transaction,
+ * and with no delayed blocks in the way (see sfs_da_place).
+ */
+int
+sfs_falloc(struct sfs_vnode *sv, uint32_t first, uint32_t nblocks,
+	   uint32_t left)
+{
+	uint32_t i;
+	daddr_t diskblock;
+	int result = 0;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+	KASSERT(nblocks <= left);
+	KASSERT(sv->sv_dacount == 0);
+
+	for (i=0; i<nblocks; i++) {
+		sv->sv_fallocleft = left - i;
+		result = sfs_bmap(sv, first + i, true, &diskblock);
 		if (result) {
-			return result;
+			break;
 		}
 	}
+	sv->sv_fallocleft = 0;
+	if (result || nblocks == left) {
+		sfs_prealloc_release(sv);
+	}
+	return result;
+}
 
-	/* Hand back the result and return. */
-	if (block != 0 && !sfs_bused(sfs, block)) {
-		panic("sfs: %s: Data block %u (block %u of file %u) "
-		      "marked free\n", sfs->sfs_sb.sb_volname,
-		      block, fileblock, sv->sv_ino);
+/*
+ * Truncate the part of the tree under indirect block IDBLOCK, of
+ * indirection level LEVEL, that maps file blocks from BLOCKLEN on.
+ * BASEBLOCK is the first file block IDBLOCK maps. The blocks dropped
+ * go into FB. Sets *EMPTY if nothing is left in it, in which case
+ * the caller frees it.
+ */
+static
+int
+sfs_itrunc_ib(struct sfs_vnode *sv, daddr_t idblock, unsigned level,
+	      uint32_t baseblock, uint32_t blocklen,
+	      struct sfs_freebatch *fb, bool *empty)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *idb;
+	uint32_t *idbuf;
+	uint32_t j, first, range;
+	bool hasnonzero, iddirty, subempty;
+	int result;
+
+	/* Read the indirect block */
+	result = sfs_buf_read(sfs, idblock, &idb);
+	if (result) {
+		return result;
 	}
-	*diskblock = block;
+	idbuf = (uint32_t *)idb->b_data;
+
+	range = level > 1 ? SFS_IBRANGE(level - 1) : 1;
+	hasnonzero = false;
+	iddirty = false;
+	for (j=0; j<SFS_DBPERIDB; j++) {
+		first = baseblock + j * range;
+		if (idbuf[j] == 0 || first + range <= blocklen) {
+			/* Empty, or entirely before the new EOF */
+		}
+		else if (level == 1) {
+			/* A data block past the new EOF; discard it */
+			sfs_bfree_batch(sfs, fb, idbuf[j]);
+			idbuf[j] = 0;
+			iddirty = true;
+		}
+		else {
+			/* Truncate the indirect block under it */
+			result = sfs_itrunc_ib(sv, idbuf[j], level - 1,
+					       first, blocklen, fb, &subempty);
+			if (result) {
+				if (iddirty) {
+					sfs_jfdirty(idb, sv);
+				}
+				sfs_buf_release(idb);
+				return result;
+			}
+			if (subempty) {
+				sfs_bfree_batch(sfs, fb, idbuf[j]);
+				idbuf[j] = 0;
+				iddirty = true;
+			}
+		}
+		/* Remember if we see any nonzero blocks in here */
+		if (idbuf[j] != 0) {
+			hasnonzero = true;
+		}
+	}
+
+	if (iddirty) {
+		/* The indirect block is dirty */
+		sfs_jfdirty(idb, sv);
+	}
+	sfs_buf_release(idb);
+
+	*empty = !hasnonzero;
 	return 0;
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Called for ftruncate() and from sfs_reclaim, with the vnode locked.
+ *
+ * Only this file's lock is held throughout; the freemap is locked
+ * once per batch of freed blocks rather than once per block.
  */
 int
 sfs_itrunc(struct sfs_vnode *sv, off_t len)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	uint32_t i, j;
-	daddr_t block, idblock;
-	uint32_t baseblock, highblock;
+	uint32_t i;
+	uint32_t *rootp;
+	daddr_t block;
+	uint32_t baseblock, range;
+	unsigned level;
+	struct sfs_freebatch fb;
+	bool empty;
 	int result;
-	int hasnonzero, iddirty;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	/* An inline file stays inline if the new size fits */
+	if (sv->sv_i.sfi_flags & SFS_IFLAG_INLINE) {
+		if (len <= SFS_INLINESIZE) {
+			if (len < sv->sv_i.sfi_size) {
+				bzero(sv->sv_i.sfi_inline + len,
+				      sv->sv_i.sfi_size - len);
+			}
+			sv->sv_i.sfi_size = len;
+			sv->sv_dirty = true;
+			return 0;
+		}
+		result = sfs_inline_evict(sv);
+		if (result) {
+			return result;
+		}
+	}
+
+	sfs_freebatch_init(&fb);
 
-	vfs_biglock_acquire();
+	/* Whatever was reserved past the old end is no use now */
+	sfs_prealloc_release(sv);
+
+	/* Nor is data past the new end that never got to the disk */
+	sfs_da_discard(sv, blocklen);
+
+	/* The indirect block remembered by sfs_bmap may be freed */
+	sv->sv_ibblock = 0;
 
 	/*
 	 * Go through the direct blocks. Discard any that are
@@ -234,62 +631,40 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	for (i=0; i<SFS_NDIRECT; i++) {
 		block = sv->sv_i.sfi_direct[i];
 		if (i >= blocklen && block != 0) {
-			sfs_bfree(sfs, block);
+			sfs_bfree_batch(sfs, &fb, block);
 			sv->sv_i.sfi_direct[i] = 0;
 			sv->sv_dirty = true;
 		}
 	}
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
-
-	/* The lowest block in the indirect block */
+	/*
+	 * Then the singly, doubly, and triply indirect blocks, each
+	 * of which maps the range of file blocks after the last.
+	 */
 	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
-
-		/* Read the indirect block */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			vfs_biglock_release();
-			return result;
-		}
-
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
-
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
-			sv->sv_dirty = true;
-		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
+	for (level = 1; level <= 3; level++) {
+		rootp = sfs_ibroot(sv, level);
+		range = SFS_IBRANGE(level);
+
+		if (*rootp != 0 && blocklen < baseblock + range) {
+			/* We're past the proposed EOF; may need to free stuff */
+			result = sfs_itrunc_ib(sv, *rootp, level, baseblock,
+					       blocklen, &fb, &empty);
 			if (result) {
-				vfs_biglock_release();
+				/* What was dropped so far is still freed */
+				sfs_freebatch_flush(sfs, &fb);
 				return result;
 			}
+			if (empty) {
+				/* It's empty now; free it */
+				sfs_bfree_batch(sfs, &fb, *rootp);
+				*rootp = 0;
+				sv->sv_dirty = true;
+			}
 		}
+		baseblock += range;
 	}
+	sfs_freebatch_flush(sfs, &fb);
 
 	/* Set the file size */
 	sv->sv_i.sfi_size = len;
@@ -297,7 +672,5 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	/* Mark the inode dirty */
 	sv->sv_dirty = true;
 
-	vfs_biglock_release();
 	return 0;
 }
-
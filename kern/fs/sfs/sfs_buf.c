@@ -0,0 +1,1223 @@
+/*
+ * SFS buffer cache.
+ *
+ * A fixed pool of block buffers shared by every mounted SFS volume,
+ * holding both metadata (inodes, indirect blocks, directories, the
+ * freemap) and file data. Buffers are found through a hash table
+ * keyed by (volume, block number); each volume corresponds to exactly
+ * one device, so this is the same as keying by device.
+ *
+ * A buffer in use by someone is pinned and stays put. Unpinned valid
+ * buffers are kept on an LRU list, most recently used at the head;
+ * when a new block needs a buffer, a never-used one is taken if there
+ * is one, and otherwise the least recently used unpinned one is
+ * recycled, being written out first if it is dirty.
+ *
+ * Writes only dirty the cached copy. Dirty buffers reach the disk
+ * when recycled, when sfs_buf_sync is called for their volume (which
+ * sfs_sync does after writing back inodes, the freemap, and the
+ * superblock), or in the background: a syncer thread wakes up every
+ * second and writes out blocks that have been dirty for longer than
+ * sfs_syncer_maxage seconds, or every dirty block if more than
+ * sfs_syncer_dirtypct percent of the cache is dirty. This keeps clean
+ * buffers around for recycling, so writers rarely wait for the disk,
+ * and bounds how much work sync and unmount have to do. Blocks are
+ * always written in block number order, to keep the disk head moving
+ * in one direction.
+ *
+ * Blocks can also be read ahead. sfs_buf_readahead queues a read for
+ * a readahead thread, which reads the block into a private buffer and
+ * then puts it in the cache. Since the disk could have been written
+ * behind its back meanwhile, a generation number is bumped on every
+ * write-out or discard of a buffer, and the block is dropped if the
+ * number has changed, or if someone else has already brought the
+ * block in.
+ *
+ * Data that is only going to be used once (FADV_NOREUSE) is released
+ * with sfs_buf_release_cold, which puts it at the old end of the LRU
+ * instead of the new, and data said to be done with (FADV_DONTNEED)
+ * is moved there by sfs_buf_cool. Either way it is recycled before
+ * anything else, so a big one-off read or write passes through a
+ * few buffers instead of flushing the whole cache. O_DIRECT I/O (see
+ * sfs_directio in sfs_io.c) goes further and doesn't come here at
+ * all, except to ask with sfs_buf_cached whether a block is here, and
+ * to sfs_buf_forget blocks it is about to overwrite on disk.
+ *
+ * The cache has a lock of its own, sfs_buflock, which covers all of
+ * the above but is never held across disk I/O. A buffer being read
+ * in is hashed but marked b_reading, and anyone else looking for it
+ * waits on sfs_bufcv until it arrives. A buffer being written out is
+ * marked b_writing so it can't be recycled under the write; it is
+ * marked clean when the write starts, so that anyone changing it
+ * meanwhile dirties it again and it will be written once more. The
+ * same cv is signalled whenever a buffer stops being pinned, read, or
+ * written, for anyone waiting for one to be free.
+ *
+ * On a journaled volume, a metadata buffer changed by a transaction
+ * that hasn't committed yet (b_jseq set) must not reach its home
+ * location before the journal does, so it is neither written out nor
+ * recycled until the journal has logged it and calls sfs_buf_junpin.
+ * The journal commits often enough that only a fraction of the cache
+ * is ever held this way.
+ *
+ * Each file keeps a list of its own dirty buffers (sv_dirtybufs):
+ * blocks of its data, and on an unjournaled volume also its inode and
+ * indirect blocks, put there by sfs_buf_fdirty. A buffer stays on the
+ * list until it has been written and is clean, or is dropped, so
+ * sfs_buf_fsync can write out one file, and wait for any writes of
+ * it already under way, without looking at anyone else's. Buffers
+ * outlive vnodes; when a vnode is reclaimed, sfs_buf_disown turns its
+ * buffers into ordinary dirty ones.
+ *
+ * Finally, a buffer can be lent out anonymously, belonging to no
+ * volume and no block, to hold file data that has been written but
+ * not yet given a place on disk (see sfs_da_get in sfs_io.c). Such a
+ * buffer is off every list and stays pinned until it is handed back.
+ * At most a quarter of the pool is lent out at once, so that delayed
+ * data can't starve the cache.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <synch.h>
+#include <thread.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <iostat.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+#define SFS_NBUCKETS	64	/* hash chains; a power of 2 */
+#define SFS_SYNCER_INTERVAL 1	/* seconds between syncer runs */
+#define SFS_RA_QUEUE	32	/* pending read-ahead requests */
+
+unsigned sfs_syncer_maxage = 5;
+unsigned sfs_syncer_dirtypct = 50;
+
+static struct sfs_buf *sfs_bufs;		/* all the buffers */
+static struct sfs_buf *sfs_buckets[SFS_NBUCKETS];	/* hash chains */
+static struct sfs_buf *sfs_unused;		/* never-used buffers */
+static struct sfs_buf *sfs_lruhead, *sfs_lrutail;	/* unpinned buffers */
+static unsigned sfs_ndirty;			/* buffers with b_dirty set */
+static unsigned sfs_nanon;			/* buffers lent out anonymously */
+static struct lock *sfs_buflock;		/* see above */
+static struct cv *sfs_bufcv;
+static struct lock *sfs_flushlock;		/* one sfs_buf_flush at a time */
+
+/* A dirty buffer chosen for writing; see sfs_buf_flush. */
+struct sfs_flushent {
+	struct sfs_buf *fe_buf;
+	struct sfs_fs *fe_fs;
+	daddr_t fe_block;
+};
+
+/* static to keep it off the stack; sfs_flushlock covers it */
+static struct sfs_flushent sfs_flushents[SFS_NBUFS];
+
+/* A pending read-ahead. RA_FS is NULL if cancelled. */
+struct sfs_rareq {
+	struct sfs_fs *ra_fs;
+	struct device *ra_dev;
+	daddr_t ra_block;
+};
+
+static struct sfs_rareq sfs_raqueue[SFS_RA_QUEUE];
+static unsigned sfs_rahead, sfs_ranum;
+static struct semaphore *sfs_rasem;	/* counts queued requests */
+static unsigned sfs_bufgen;		/* see above */
+
+static void sfs_syncer(void *, unsigned long);
+static void sfs_readahead_thread(void *, unsigned long);
+
+static
+unsigned
+sfs_buf_hash(struct sfs_fs *sfs, daddr_t block)
+{
+	return (((uintptr_t)sfs >> 4) + block) & (SFS_NBUCKETS - 1);
+}
+
+/*
+ * Set up the pool and start the syncer. Called from sfs_domount, which
+ * vfs_mount serializes; only does anything the first time.
+ */
+int
+sfs_buf_bootstrap(void)
+{
+	char *data;
+	unsigned i;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs_bufs != NULL) {
+		return 0;
+	}
+
+	sfs_buflock = lock_create("sfs_buflock");
+	if (sfs_buflock == NULL) {
+		return ENOMEM;
+	}
+	sfs_bufcv = cv_create("sfs_bufcv");
+	if (sfs_bufcv == NULL) {
+		goto fail_buflock;
+	}
+	sfs_flushlock = lock_create("sfs_flushlock");
+	if (sfs_flushlock == NULL) {
+		goto fail_bufcv;
+	}
+	data = kmalloc(SFS_NBUFS * SFS_BLOCKSIZE);
+	if (data == NULL) {
+		goto fail_flushlock;
+	}
+	sfs_bufs = kmalloc(SFS_NBUFS * sizeof(struct sfs_buf));
+	if (sfs_bufs == NULL) {
+		kfree(data);
+		goto fail_flushlock;
+	}
+
+	for (i=0; i<SFS_NBUFS; i++) {
+		sfs_bufs[i].b_fs = NULL;
+		sfs_bufs[i].b_block = 0;
+		sfs_bufs[i].b_data = data + i * SFS_BLOCKSIZE;
+		sfs_bufs[i].b_pincount = 0;
+		sfs_bufs[i].b_valid = false;
+		sfs_bufs[i].b_dirty = false;
+		sfs_bufs[i].b_reading = false;
+		sfs_bufs[i].b_writing = false;
+		sfs_bufs[i].b_jseq = 0;
+		sfs_bufs[i].b_owner = NULL;
+		sfs_bufs[i].b_ownprev = NULL;
+		sfs_bufs[i].b_ownnext = NULL;
+		sfs_bufs[i].b_lruprev = NULL;
+		sfs_bufs[i].b_lrunext = NULL;
+		sfs_bufs[i].b_hashnext = sfs_unused;
+		sfs_unused = &sfs_bufs[i];
+	}
+	for (i=0; i<SFS_NBUCKETS; i++) {
+		sfs_buckets[i] = NULL;
+	}
+
+	result = thread_fork("sfs_syncer", NULL, sfs_syncer, NULL, 0);
+	if (result) {
+		/* Not fatal; dirty blocks still go out on sync. */
+		kprintf("sfs: cannot start syncer: %s\n", strerror(result));
+	}
+
+	/* Likewise, without read-ahead sfs_buf_readahead does nothing. */
+	sfs_rasem = sem_create("sfs_readahead", 0);
+	if (sfs_rasem == NULL) {
+		kprintf("sfs: cannot start readahead: out of memory\n");
+		return 0;
+	}
+	result = thread_fork("sfs_readahead", NULL, sfs_readahead_thread,
+			     NULL, 0);
+	if (result) {
+		kprintf("sfs: cannot start readahead: %s\n",
+			strerror(result));
+		sem_destroy(sfs_rasem);
+		sfs_rasem = NULL;
+	}
+	return 0;
+
+ fail_flushlock:
+	lock_destroy(sfs_flushlock);
+ fail_bufcv:
+	cv_destroy(sfs_bufcv);
+ fail_buflock:
+	lock_destroy(sfs_buflock);
+	sfs_buflock = NULL;
+	return ENOMEM;
+}
+
+/*
+ * LRU list manipulation.
+ */
+static
+void
+sfs_lru_remove(struct sfs_buf *b)
+{
+	if (b->b_lruprev != NULL) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	}
+	else {
+		KASSERT(sfs_lruhead == b);
+		sfs_lruhead = b->b_lrunext;
+	}
+	if (b->b_lrunext != NULL) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	}
+	else {
+		KASSERT(sfs_lrutail == b);
+		sfs_lrutail = b->b_lruprev;
+	}
+	b->b_lruprev = b->b_lrunext = NULL;
+}
+
+static
+void
+sfs_lru_addhead(struct sfs_buf *b)
+{
+	b->b_lruprev = NULL;
+	b->b_lrunext = sfs_lruhead;
+	if (sfs_lruhead != NULL) {
+		sfs_lruhead->b_lruprev = b;
+	}
+	else {
+		sfs_lrutail = b;
+	}
+	sfs_lruhead = b;
+}
+
+static
+void
+sfs_lru_addtail(struct sfs_buf *b)
+{
+	b->b_lrunext = NULL;
+	b->b_lruprev = sfs_lrutail;
+	if (sfs_lrutail != NULL) {
+		sfs_lrutail->b_lrunext = b;
+	}
+	else {
+		sfs_lruhead = b;
+	}
+	sfs_lrutail = b;
+}
+
+/*
+ * Owner list manipulation.
+ */
+static
+void
+sfs_owner_remove(struct sfs_buf *b)
+{
+	struct sfs_vnode *sv = b->b_owner;
+
+	if (sv == NULL) {
+		return;
+	}
+	if (b->b_ownprev != NULL) {
+		b->b_ownprev->b_ownnext = b->b_ownnext;
+	}
+	else {
+		KASSERT(sv->sv_dirtybufs == b);
+		sv->sv_dirtybufs = b->b_ownnext;
+	}
+	if (b->b_ownnext != NULL) {
+		b->b_ownnext->b_ownprev = b->b_ownprev;
+	}
+	b->b_owner = NULL;
+	b->b_ownprev = b->b_ownnext = NULL;
+}
+
+static
+void
+sfs_owner_add(struct sfs_buf *b, struct sfs_vnode *sv)
+{
+	if (b->b_owner == sv) {
+		return;
+	}
+	sfs_owner_remove(b);
+	b->b_owner = sv;
+	b->b_ownprev = NULL;
+	b->b_ownnext = sv->sv_dirtybufs;
+	if (sv->sv_dirtybufs != NULL) {
+		sv->sv_dirtybufs->b_ownprev = b;
+	}
+	sv->sv_dirtybufs = b;
+}
+
+/*
+ * Hash chain manipulation.
+ */
+static
+struct sfs_buf *
+sfs_hash_find(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_buf *b;
+
+	for (b = sfs_buckets[sfs_buf_hash(sfs, block)];
+	     b != NULL; b = b->b_hashnext) {
+		if (b->b_fs == sfs && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+sfs_hash_remove(struct sfs_buf *b)
+{
+	struct sfs_buf **bp;
+
+	bp = &sfs_buckets[sfs_buf_hash(b->b_fs, b->b_block)];
+	while (*bp != b) {
+		KASSERT(*bp != NULL);
+		bp = &(*bp)->b_hashnext;
+	}
+	*bp = b->b_hashnext;
+	b->b_hashnext = NULL;
+}
+
+static
+void
+sfs_hash_insert(struct sfs_buf *b, struct sfs_fs *sfs, daddr_t block)
+{
+	unsigned h = sfs_buf_hash(sfs, block);
+
+	b->b_fs = sfs;
+	b->b_block = block;
+	b->b_hashnext = sfs_buckets[h];
+	sfs_buckets[h] = b;
+}
+
+/*
+ * Write a dirty buffer to disk. Called with sfs_buflock held, which is
+ * dropped during the write.
+ */
+static
+int
+sfs_buf_writeout(struct sfs_buf *b)
+{
+	int result;
+
+	KASSERT(lock_do_i_hold(sfs_buflock));
+	KASSERT(b->b_valid && b->b_dirty && !b->b_writing);
+	KASSERT(b->b_jseq == 0);
+
+	b->b_dirty = false;
+	sfs_ndirty--;
+	b->b_writing = true;
+	sfs_bufgen++;
+
+	lock_release(sfs_buflock);
+	result = sfs_rawblock(b->b_fs, b->b_block, b->b_data, UIO_WRITE);
+	lock_acquire(sfs_buflock);
+
+	b->b_writing = false;
+	if (result && !b->b_dirty) {
+		/* still needs writing */
+		b->b_dirty = true;
+		sfs_ndirty++;
+	}
+	if (!b->b_dirty) {
+		/* On disk now; its file has no more to do for it */
+		sfs_owner_remove(b);
+	}
+	cv_broadcast(sfs_bufcv, sfs_buflock);
+	return result;
+}
+
+/*
+ * Put a buffer on the unused list. It must be on no other list.
+ */
+static
+void
+sfs_buf_putunused(struct sfs_buf *b)
+{
+	sfs_owner_remove(b);
+	b->b_fs = NULL;
+	b->b_valid = false;
+	b->b_dirty = false;
+	b->b_jseq = 0;
+	b->b_hashnext = sfs_unused;
+	sfs_unused = b;
+}
+
+/*
+ * Take a buffer off the cache's hands entirely and put it back on
+ * the unused list. Its contents are discarded, even if dirty.
+ */
+static
+void
+sfs_buf_drop(struct sfs_buf *b)
+{
+	KASSERT(b->b_pincount == 0 && !b->b_writing);
+	sfs_lru_remove(b);
+	sfs_hash_remove(b);
+	sfs_bufgen++;
+	if (b->b_dirty) {
+		sfs_ndirty--;
+	}
+	sfs_buf_putunused(b);
+}
+
+/*
+ * Wait until nobody is using or writing B, and drop it, unless by
+ * then it holds some other block. Called with sfs_buflock held.
+ */
+static
+void
+sfs_buf_waitdrop(struct sfs_buf *b, struct sfs_fs *sfs, daddr_t block)
+{
+	while (b->b_fs == sfs && b->b_block == block &&
+	       (b->b_pincount > 0 || b->b_writing)) {
+		cv_wait(sfs_bufcv, sfs_buflock);
+	}
+	if (b->b_fs == sfs && b->b_block == block) {
+		sfs_buf_drop(b);
+	}
+}
+
+/*
+ * Find a buffer to hold a new block, recycling the least recently
+ * used one if need be. The buffer returned is on no list.
+ *
+ * This may drop sfs_buflock to write out a dirty buffer, or to wait
+ * for one to become free, so the caller must check again afterwards
+ * that nobody has brought in the block it wanted meanwhile.
+ */
+static
+int
+sfs_buf_getfree(struct sfs_buf **ret)
+{
+	struct sfs_buf *b;
+	int result;
+
+	KASSERT(lock_do_i_hold(sfs_buflock));
+
+	while (1) {
+		if (sfs_unused != NULL) {
+			b = sfs_unused;
+			sfs_unused = b->b_hashnext;
+			b->b_hashnext = NULL;
+			*ret = b;
+			return 0;
+		}
+
+		/*
+		 * Oldest buffer that isn't already being written, or
+		 * waiting for the journal
+		 */
+		for (b = sfs_lrutail;
+		     b != NULL && (b->b_writing || b->b_jseq != 0);
+		     b = b->b_lruprev) {
+			/* nothing */
+		}
+		if (b == NULL) {
+			/* Everything is pinned; wait for something */
+			cv_wait(sfs_bufcv, sfs_buflock);
+			continue;
+		}
+		if (b->b_dirty) {
+			/* Write it, then see what's oldest now */
+			result = sfs_buf_writeout(b);
+			if (result) {
+				return result;
+			}
+			continue;
+		}
+		KASSERT(b->b_owner == NULL);
+		sfs_lru_remove(b);
+		sfs_hash_remove(b);
+		b->b_fs = NULL;
+		b->b_valid = false;
+		*ret = b;
+		return 0;
+	}
+}
+
+/*
+ * Common code for sfs_buf_read and sfs_buf_get: find or make the
+ * buffer for BLOCK and pin it. If it wasn't cached and DOREAD is set,
+ * read it in; otherwise the contents are left invalid.
+ */
+static
+int
+sfs_buf_lookup(struct sfs_fs *sfs, daddr_t block, bool doread,
+	       struct sfs_buf **ret)
+{
+	struct sfs_buf *b, *newb;
+	int result;
+
+	KASSERT(sfs_bufs != NULL);
+
+	lock_acquire(sfs_buflock);
+	while (1) {
+		b = sfs_hash_find(sfs, block);
+		if (b != NULL && !b->b_valid) {
+			/* Someone else is reading or filling it in */
+			cv_wait(sfs_bufcv, sfs_buflock);
+			continue;
+		}
+		if (b != NULL) {
+			if (b->b_pincount == 0) {
+				sfs_lru_remove(b);
+			}
+			b->b_pincount++;
+			lock_release(sfs_buflock);
+			*ret = b;
+			return 0;
+		}
+
+		result = sfs_buf_getfree(&newb);
+		if (result) {
+			lock_release(sfs_buflock);
+			return result;
+		}
+		if (sfs_hash_find(sfs, block) == NULL) {
+			break;
+		}
+		/* It turned up while we waited for a buffer */
+		sfs_buf_putunused(newb);
+	}
+
+	b = newb;
+	sfs_hash_insert(b, sfs, block);
+	b->b_pincount = 1;
+	b->b_valid = false;
+	b->b_dirty = false;
+
+	if (doread) {
+		b->b_reading = true;
+		lock_release(sfs_buflock);
+		ioacct_count(false);
+		result = sfs_rawblock(sfs, block, b->b_data, UIO_READ);
+		lock_acquire(sfs_buflock);
+		b->b_reading = false;
+		if (result) {
+			b->b_pincount = 0;
+			sfs_hash_remove(b);
+			sfs_buf_putunused(b);
+			cv_broadcast(sfs_bufcv, sfs_buflock);
+			lock_release(sfs_buflock);
+			return result;
+		}
+		b->b_valid = true;
+		cv_broadcast(sfs_bufcv, sfs_buflock);
+	}
+	lock_release(sfs_buflock);
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Get BLOCK of SFS into the cache and pin it.
+ */
+int
+sfs_buf_read(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret)
+{
+	return sfs_buf_lookup(sfs, block, true, ret);
+}
+
+/*
+ * Pin a buffer for BLOCK of SFS without reading it from disk, for a
+ * caller about to overwrite the whole block. If the block wasn't
+ * cached, the buffer's contents are garbage and b_valid is false
+ * until the caller fills it in and calls sfs_buf_dirty.
+ */
+int
+sfs_buf_get(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret)
+{
+	return sfs_buf_lookup(sfs, block, false, ret);
+}
+
+/*
+ * Lend out a zeroed buffer that belongs to no block. It is pinned and
+ * valid, and must be given back with sfs_buf_putanon, never released.
+ * Fails with EAGAIN if too many are lent out already.
+ */
+int
+sfs_buf_getanon(struct sfs_buf **ret)
+{
+	struct sfs_buf *b;
+	int result;
+
+	KASSERT(sfs_bufs != NULL);
+
+	lock_acquire(sfs_buflock);
+	if (sfs_nanon >= SFS_NBUFS / 4) {
+		lock_release(sfs_buflock);
+		return EAGAIN;
+	}
+	result = sfs_buf_getfree(&b);
+	if (result) {
+		lock_release(sfs_buflock);
+		return result;
+	}
+	sfs_nanon++;
+	b->b_fs = NULL;
+	b->b_block = 0;
+	b->b_pincount = 1;
+	b->b_valid = true;
+	b->b_dirty = false;
+	lock_release(sfs_buflock);
+
+	bzero(b->b_data, SFS_BLOCKSIZE);
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Give back a buffer from sfs_buf_getanon. Its contents are discarded.
+ */
+void
+sfs_buf_putanon(struct sfs_buf *b)
+{
+	lock_acquire(sfs_buflock);
+	KASSERT(b->b_fs == NULL && b->b_pincount == 1);
+	KASSERT(sfs_nanon > 0);
+	sfs_nanon--;
+	b->b_pincount = 0;
+	sfs_buf_putunused(b);
+	cv_broadcast(sfs_bufcv, sfs_buflock);
+	lock_release(sfs_buflock);
+}
+
+/*
+ * Mark a pinned buffer modified (and, therefore, valid). Called with
+ * sfs_buflock held.
+ */
+static
+void
+sfs_buf_setdirty(struct sfs_buf *b)
+{
+	struct timespec now;
+
+	KASSERT(lock_do_i_hold(sfs_buflock));
+	KASSERT(b->b_pincount > 0);
+
+	if (!b->b_valid) {
+		/* sfs_buf_get's caller has filled it in */
+		b->b_valid = true;
+		cv_broadcast(sfs_bufcv, sfs_buflock);
+	}
+	if (!b->b_dirty) {
+		/* Whoever makes it dirty is charged for the write */
+		ioacct_count(true);
+		gettime(&now);
+		b->b_dirtysince = now.tv_sec;
+		b->b_dirty = true;
+		sfs_ndirty++;
+	}
+}
+
+/*
+ * Mark a pinned buffer modified.
+ */
+void
+sfs_buf_dirty(struct sfs_buf *b)
+{
+	lock_acquire(sfs_buflock);
+	sfs_buf_setdirty(b);
+	lock_release(sfs_buflock);
+}
+
+/*
+ * Mark a pinned buffer holding part of file SV modified, and put it
+ * on the file's dirty list for sfs_buf_fsync.
+ */
+void
+sfs_buf_fdirty(struct sfs_buf *b, struct sfs_vnode *sv)
+{
+	lock_acquire(sfs_buflock);
+	sfs_buf_setdirty(b);
+	sfs_owner_add(b, sv);
+	lock_release(sfs_buflock);
+}
+
+/*
+ * Mark a pinned metadata buffer modified by journal transaction SEQ.
+ * It stays in the cache until the journal is done with it.
+ */
+void
+sfs_buf_jdirty(struct sfs_buf *b, uint32_t seq)
+{
+	KASSERT(seq != 0);
+
+	/* Both at once, so sfs_buf_flush can't slip in between */
+	lock_acquire(sfs_buflock);
+	sfs_buf_setdirty(b);
+	b->b_jseq = seq;
+	lock_release(sfs_buflock);
+}
+
+/*
+ * Pin every buffer of SFS held for journal transaction SEQ, and put
+ * them in BUFS (which has room for SFS_NBUFS) in block order. Returns
+ * how many there were. The journal calls this to commit the
+ * transaction, when nobody can be changing them.
+ */
+unsigned
+sfs_buf_jpin(struct sfs_fs *sfs, uint32_t seq, struct sfs_buf **bufs)
+{
+	struct sfs_buf *b;
+	unsigned i, j, n;
+
+	if (sfs_bufs == NULL) {
+		return 0;
+	}
+
+	lock_acquire(sfs_buflock);
+	n = 0;
+	for (i=0; i<SFS_NBUFS; i++) {
+		b = &sfs_bufs[i];
+		if (b->b_fs != sfs || b->b_jseq != seq) {
+			continue;
+		}
+		KASSERT(b->b_valid && b->b_dirty);
+		if (b->b_pincount == 0) {
+			sfs_lru_remove(b);
+		}
+		b->b_pincount++;
+		for (j = n; j > 0 && bufs[j-1]->b_block > b->b_block; j--) {
+			bufs[j] = bufs[j-1];
+		}
+		bufs[j] = b;
+		n++;
+	}
+	lock_release(sfs_buflock);
+	return n;
+}
+
+/*
+ * The journal has logged a buffer pinned by sfs_buf_jpin; it's now
+ * an ordinary dirty buffer and may go home.
+ */
+void
+sfs_buf_junpin(struct sfs_buf *b)
+{
+	lock_acquire(sfs_buflock);
+	b->b_jseq = 0;
+	lock_release(sfs_buflock);
+	sfs_buf_release(b);
+}
+
+/*
+ * Unpin a buffer. A buffer that never became valid is thrown away.
+ * With COLD set, the buffer goes on the LRU as the oldest rather than
+ * the newest, to be recycled ahead of everything else.
+ */
+static
+void
+sfs_buf_unpin(struct sfs_buf *b, bool cold)
+{
+	lock_acquire(sfs_buflock);
+	KASSERT(b->b_pincount > 0);
+
+	b->b_pincount--;
+	if (b->b_pincount > 0) {
+		lock_release(sfs_buflock);
+		return;
+	}
+	if (!b->b_valid) {
+		KASSERT(!b->b_dirty);
+		sfs_hash_remove(b);
+		sfs_buf_putunused(b);
+	}
+	else if (cold) {
+		sfs_lru_addtail(b);
+	}
+	else {
+		sfs_lru_addhead(b);
+	}
+	cv_broadcast(sfs_bufcv, sfs_buflock);
+	lock_release(sfs_buflock);
+}
+
+void
+sfs_buf_release(struct sfs_buf *b)
+{
+	sfs_buf_unpin(b, false);
+}
+
+/*
+ * Unpin a buffer whose contents won't be wanted again soon, such as
+ * data read for FADV_NOREUSE, so that it doesn't push out buffers
+ * that will be.
+ */
+void
+sfs_buf_release_cold(struct sfs_buf *b)
+{
+	sfs_buf_unpin(b, true);
+}
+
+/*
+ * BLOCK of SFS is done with (FADV_DONTNEED); if it is cached and
+ * nobody is using it, make it the next to be recycled. It isn't
+ * dropped outright, so a dirty one still gets written first.
+ */
+void
+sfs_buf_cool(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_buf *b;
+
+	if (sfs_bufs == NULL) {
+		return;
+	}
+	lock_acquire(sfs_buflock);
+	b = sfs_hash_find(sfs, block);
+	if (b != NULL && b->b_valid && b->b_pincount == 0) {
+		sfs_lru_remove(b);
+		sfs_lru_addtail(b);
+	}
+	lock_release(sfs_buflock);
+}
+
+/*
+ * Add B to the first N entries of sfs_flushents, keeping them in
+ * (volume, block) order.
+ */
+static
+void
+sfs_flush_add(unsigned n, struct sfs_buf *b)
+{
+	struct sfs_flushent *ents = sfs_flushents;
+	struct sfs_flushent tmp;
+	unsigned j;
+
+	tmp.fe_buf = b;
+	tmp.fe_fs = b->b_fs;
+	tmp.fe_block = b->b_block;
+	/* insertion sort; there aren't many */
+	for (j = n; j > 0; j--) {
+		if ((uintptr_t)ents[j-1].fe_fs < (uintptr_t)tmp.fe_fs ||
+		    (ents[j-1].fe_fs == tmp.fe_fs &&
+		     ents[j-1].fe_block < tmp.fe_block)) {
+			break;
+		}
+		ents[j] = ents[j-1];
+	}
+	ents[j] = tmp;
+}
+
+/*
+ * Write out the first N entries of sfs_flushents. Called with both
+ * sfs_flushlock and sfs_buflock held.
+ *
+ * The lock is dropped for each write, so buffers are rechecked first
+ * and skipped if they have been cleaned or recycled meanwhile. If one
+ * is being written by someone else, we wait for that to finish, so
+ * that on return everything chosen has reached the disk. If
+ * BESTEFFORT is set, write errors are not reported; the buffer stays
+ * dirty and will be tried again.
+ */
+static
+int
+sfs_flush_write(unsigned n, bool besteffort)
+{
+	struct sfs_flushent *fe;
+	struct sfs_buf *b;
+	unsigned i;
+	int result;
+
+	for (i=0; i<n; i++) {
+		fe = &sfs_flushents[i];
+		b = fe->fe_buf;
+		/* If someone else is writing it, let them finish first */
+		while (b->b_writing && b->b_fs == fe->fe_fs &&
+		       b->b_block == fe->fe_block) {
+			cv_wait(sfs_bufcv, sfs_buflock);
+		}
+		if (b->b_fs != fe->fe_fs ||
+		    b->b_block != fe->fe_block || !b->b_dirty ||
+		    b->b_jseq != 0) {
+			continue;
+		}
+		result = sfs_buf_writeout(b);
+		if (result && !besteffort) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Write out dirty buffers, in (volume, block) order: those of SFS, or
+ * of every volume if SFS is NULL, and only those dirty since OLDEST or
+ * before unless ALL is set. BESTEFFORT is as for sfs_flush_write.
+ */
+static
+int
+sfs_buf_flush(struct sfs_fs *sfs, bool all, time_t oldest, bool besteffort)
+{
+	struct sfs_buf *b;
+	unsigned i, n;
+	int result;
+
+	if (sfs_bufs == NULL) {
+		return 0;
+	}
+
+	lock_acquire(sfs_flushlock);
+	lock_acquire(sfs_buflock);
+
+	n = 0;
+	for (i=0; i<SFS_NBUFS; i++) {
+		b = &sfs_bufs[i];
+		if (!b->b_dirty || (sfs != NULL && b->b_fs != sfs)) {
+			continue;
+		}
+		if (b->b_jseq != 0) {
+			/* Not logged yet; the journal will release it */
+			continue;
+		}
+		if (!all && b->b_dirtysince > oldest) {
+			continue;
+		}
+		sfs_flush_add(n, b);
+		n++;
+	}
+
+	result = sfs_flush_write(n, besteffort);
+	lock_release(sfs_buflock);
+	lock_release(sfs_flushlock);
+	return result;
+}
+
+/*
+ * Write back every dirty buffer belonging to SFS.
+ */
+int
+sfs_buf_sync(struct sfs_fs *sfs)
+{
+	KASSERT(sfs != NULL);
+	return sfs_buf_flush(sfs, true, 0, false);
+}
+
+/*
+ * Write back the dirty buffers on file SV's list, and wait for any of
+ * them that are being written already. Buffers still waiting for the
+ * journal are left alone; the caller commits the journal for them.
+ */
+int
+sfs_buf_fsync(struct sfs_vnode *sv)
+{
+	struct sfs_buf *b;
+	unsigned n;
+	int result;
+
+	if (sfs_bufs == NULL) {
+		return 0;
+	}
+
+	lock_acquire(sfs_flushlock);
+	lock_acquire(sfs_buflock);
+
+	n = 0;
+	for (b = sv->sv_dirtybufs; b != NULL; b = b->b_ownnext) {
+		if (b->b_jseq != 0) {
+			continue;
+		}
+		sfs_flush_add(n, b);
+		n++;
+	}
+
+	result = sfs_flush_write(n, false);
+	lock_release(sfs_buflock);
+	lock_release(sfs_flushlock);
+	return result;
+}
+
+/*
+ * Vnode SV is being reclaimed. Its dirty buffers stay in the cache,
+ * to be written by the syncer like any others, but belong to no file.
+ */
+void
+sfs_buf_disown(struct sfs_vnode *sv)
+{
+	if (sfs_bufs == NULL) {
+		return;
+	}
+
+	lock_acquire(sfs_buflock);
+	while (sv->sv_dirtybufs != NULL) {
+		sfs_owner_remove(sv->sv_dirtybufs);
+	}
+	lock_release(sfs_buflock);
+}
+
+/*
+ * The syncer thread.
+ */
+static
+void
+sfs_syncer(void *unused1, unsigned long unused2)
+{
+	struct timespec now;
+	bool all;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		clocksleep(SFS_SYNCER_INTERVAL);
+
+		/* An unlocked peek is good enough to decide */
+		if (sfs_ndirty > 0) {
+			gettime(&now);
+			all = sfs_ndirty * 100 > sfs_syncer_dirtypct * SFS_NBUFS;
+			sfs_buf_flush(NULL, all,
+				      now.tv_sec - (time_t)sfs_syncer_maxage,
+				      true);
+		}
+	}
+}
+
+/*
+ * BLOCK of SFS has been freed, or is about to be written to disk
+ * directly; forget any cached copy rather than writing it back.
+ */
+void
+sfs_buf_forget(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_buf *b;
+
+	if (sfs_bufs == NULL) {
+		return;
+	}
+	lock_acquire(sfs_buflock);
+	b = sfs_hash_find(sfs, block);
+	if (b != NULL) {
+		sfs_buf_waitdrop(b, sfs, block);
+	}
+	/* A read-ahead of it may be in progress even if it isn't cached */
+	sfs_bufgen++;
+	lock_release(sfs_buflock);
+}
+
+/*
+ * Check if BLOCK of SFS is in the cache, perhaps newer than on disk.
+ */
+bool
+sfs_buf_cached(struct sfs_fs *sfs, daddr_t block)
+{
+	bool ret;
+
+	if (sfs_bufs == NULL) {
+		return false;
+	}
+	lock_acquire(sfs_buflock);
+	ret = sfs_hash_find(sfs, block) != NULL;
+	lock_release(sfs_buflock);
+	return ret;
+}
+
+/*
+ * Discard every buffer belonging to SFS, which is going away. Dirty
+ * buffers are lost; on unmount they have already been synced.
+ */
+void
+sfs_buf_invalidate(struct sfs_fs *sfs)
+{
+	unsigned i;
+
+	if (sfs_bufs == NULL) {
+		return;
+	}
+	lock_acquire(sfs_buflock);
+	for (i=0; i<SFS_NBUFS; i++) {
+		if (sfs_bufs[i].b_fs == sfs) {
+			sfs_buf_waitdrop(&sfs_bufs[i], sfs,
+					 sfs_bufs[i].b_block);
+		}
+	}
+	sfs_bufgen++;
+	for (i=0; i<SFS_RA_QUEUE; i++) {
+		if (sfs_raqueue[i].ra_fs == sfs) {
+			sfs_raqueue[i].ra_fs = NULL;
+		}
+	}
+	lock_release(sfs_buflock);
+}
+
+/*
+ * Ask for BLOCK of SFS to be brought into the cache in the
+ * background. This is only a hint: it's ignored if the block is
+ * already cached or queued, or there's no room in the queue.
+ */
+void
+sfs_buf_readahead(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_rareq *ra;
+	unsigned i;
+
+	if (sfs_rasem == NULL) {
+		return;
+	}
+	lock_acquire(sfs_buflock);
+	if (sfs_ranum == SFS_RA_QUEUE || sfs_hash_find(sfs, block) != NULL) {
+		lock_release(sfs_buflock);
+		return;
+	}
+	for (i=0; i<sfs_ranum; i++) {
+		ra = &sfs_raqueue[(sfs_rahead + i) % SFS_RA_QUEUE];
+		if (ra->ra_fs == sfs && ra->ra_block == block) {
+			lock_release(sfs_buflock);
+			return;
+		}
+	}
+	ra = &sfs_raqueue[(sfs_rahead + sfs_ranum) % SFS_RA_QUEUE];
+	ra->ra_fs = sfs;
+	ra->ra_dev = sfs->sfs_device;
+	ra->ra_block = block;
+	sfs_ranum++;
+	lock_release(sfs_buflock);
+	V(sfs_rasem);
+}
+
+/*
+ * The readahead thread.
+ */
+static
+void
+sfs_readahead_thread(void *unused1, unsigned long unused2)
+{
+	/* only this thread uses it */
+	static char rabuf[SFS_BLOCKSIZE];
+
+	struct sfs_rareq ra;
+	struct sfs_buf *b;
+	struct iovec iov;
+	struct uio ku;
+	unsigned gen;
+	int result;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		P(sfs_rasem);
+
+		lock_acquire(sfs_buflock);
+		KASSERT(sfs_ranum > 0);
+		ra = sfs_raqueue[sfs_rahead];
+		sfs_rahead = (sfs_rahead + 1) % SFS_RA_QUEUE;
+		sfs_ranum--;
+		if (ra.ra_fs == NULL ||
+		    sfs_hash_find(ra.ra_fs, ra.ra_block) != NULL) {
+			lock_release(sfs_buflock);
+			continue;
+		}
+		gen = sfs_bufgen;
+		lock_release(sfs_buflock);
+
+		/* Errors will be seen (and retried) by the real read. */
+		SFSUIO(&iov, &ku, rabuf, ra.ra_block, UIO_READ);
+		result = DEVOP_IO(ra.ra_dev, &ku);
+		if (result) {
+			continue;
+		}
+
+		lock_acquire(sfs_buflock);
+		if (gen == sfs_bufgen &&
+		    sfs_hash_find(ra.ra_fs, ra.ra_block) == NULL &&
+		    sfs_buf_getfree(&b) == 0) {
+			/* getfree may have slept; check again */
+			if (gen == sfs_bufgen &&
+			    sfs_hash_find(ra.ra_fs, ra.ra_block) == NULL) {
+				sfs_hash_insert(b, ra.ra_fs, ra.ra_block);
+				memcpy(b->b_data, rabuf, SFS_BLOCKSIZE);
+				b->b_valid = true;
+				sfs_lru_addhead(b);
+			}
+			else {
+				sfs_buf_putunused(b);
+			}
+		}
+		lock_release(sfs_buflock);
+	}
+}
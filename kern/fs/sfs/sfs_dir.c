@@ -35,10 +35,47 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/*
+ * In-memory name index for a directory.
+ *
+ * The first lookup in a directory reads all of its entries once and
+ * builds a hash table from name to slot, so later lookups, creates
+ * and unlinks don't read the whole directory again. There is also a
+ * table from slot to entry (NULL for an empty slot), which is how an
+ * unlink by slot finds the name to drop, and which is searched from
+ * DI_FREEHINT (below which no slots are free) for an empty slot for
+ * a new name.
+ *
+ * All directory writes go through sfs_writedir, which updates the
+ * index to match. If memory for that runs out, the index is simply
+ * thrown away, and rebuilt on the next lookup; if there is no memory
+ * to build it, lookups fall back to scanning the directory.
+ */
+struct sfs_dirname {
+	struct sfs_dirname *dn_next;	/* hash chain */
+	int dn_slot;
+	uint32_t dn_ino;
+	char dn_name[];
+};
+
+struct sfs_dirindex {
+	struct sfs_dirname **di_buckets;
+	unsigned di_nbuckets;		/* power of 2 */
+	unsigned di_nnames;		/* names in the table */
+	struct sfs_dirname **di_slots;	/* by slot; NULL if empty */
+	unsigned di_maxslots;		/* size of di_slots */
+	unsigned di_nslots;		/* slots in the directory */
+	unsigned di_freehint;		/* no empty slot below this */
+};
+
+#define SFS_DIRINDEX_BUCKETS	16
+#define SFS_DIRINDEX_SLOTS	16
+
 /*
  * Read the directory entry out of slot SLOT of a directory vnode.
  * The "slot" is the index of the directory entry, starting at 0.
@@ -55,6 +92,9 @@ sfs_readdir(struct sfs_vnode *sv, int slot, struct sfs_direntry *sd)
 	return sfs_metaio(sv, actualpos, sd, sizeof(*sd), UIO_READ);
 }
 
+static void sfs_dirindex_update(struct sfs_vnode *sv, int slot,
+				struct sfs_direntry *sd);
+
 /*
  * Write (overwrite) the directory entry in slot SLOT of a directory
  * vnode.
@@ -64,12 +104,18 @@ int
 sfs_writedir(struct sfs_vnode *sv, int slot, struct sfs_direntry *sd)
 {
 	off_t actualpos;
+	int result;
 
 	/* Compute the actual position in the directory. */
 	KASSERT(slot>=0);
 	actualpos = slot * sizeof(struct sfs_direntry);
 
-	return sfs_metaio(sv, actualpos, sd, sizeof(*sd), UIO_WRITE);
+	result = sfs_metaio(sv, actualpos, sd, sizeof(*sd), UIO_WRITE);
+	if (result) {
+		return result;
+	}
+	sfs_dirindex_update(sv, slot, sd);
+	return 0;
 }
 
 /*
@@ -95,6 +141,321 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_direntry);
 }
 
+////////////////////////////////////////////////////////////
+// Name index
+
+static
+unsigned
+sfs_dirindex_hash(struct sfs_dirindex *di, const char *name)
+{
+	unsigned h = 0;
+
+	/* FNV-1 */
+	while (*name) {
+		h = (h * 16777619) ^ (unsigned char)*name++;
+	}
+	return h & (di->di_nbuckets - 1);
+}
+
+/*
+ * Throw away a directory's index.
+ */
+void
+sfs_dir_dropindex(struct sfs_vnode *sv)
+{
+	struct sfs_dirindex *di = sv->sv_dirindex;
+	unsigned i;
+
+	if (di == NULL) {
+		return;
+	}
+	for (i=0; i<di->di_maxslots; i++) {
+		if (di->di_slots[i] != NULL) {
+			kfree(di->di_slots[i]);
+		}
+	}
+	kfree(di->di_slots);
+	kfree(di->di_buckets);
+	kfree(di);
+	sv->sv_dirindex = NULL;
+}
+
+/*
+ * Make sure the slot table covers slot SLOT.
+ */
+static
+int
+sfs_dirindex_growslots(struct sfs_dirindex *di, unsigned slot)
+{
+	struct sfs_dirname **newslots;
+	unsigned newmax, i;
+
+	if (slot < di->di_maxslots) {
+		return 0;
+	}
+	newmax = di->di_maxslots;
+	while (slot >= newmax) {
+		newmax *= 2;
+	}
+	newslots = kmalloc(newmax * sizeof(*newslots));
+	if (newslots == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<newmax; i++) {
+		newslots[i] = i < di->di_maxslots ? di->di_slots[i] : NULL;
+	}
+	kfree(di->di_slots);
+	di->di_slots = newslots;
+	di->di_maxslots = newmax;
+	return 0;
+}
+
+/*
+ * Double the hash table once it averages two names per bucket. Not
+ * being able to is harmless.
+ */
+static
+void
+sfs_dirindex_growhash(struct sfs_dirindex *di)
+{
+	struct sfs_dirname **oldbuckets;
+	struct sfs_dirname *dn;
+	unsigned oldn, i, h;
+
+	oldbuckets = di->di_buckets;
+	oldn = di->di_nbuckets;
+	di->di_buckets = kmalloc(2 * oldn * sizeof(*di->di_buckets));
+	if (di->di_buckets == NULL) {
+		di->di_buckets = oldbuckets;
+		return;
+	}
+	di->di_nbuckets = 2 * oldn;
+	for (i=0; i<di->di_nbuckets; i++) {
+		di->di_buckets[i] = NULL;
+	}
+	for (i=0; i<oldn; i++) {
+		while ((dn = oldbuckets[i]) != NULL) {
+			oldbuckets[i] = dn->dn_next;
+			h = sfs_dirindex_hash(di, dn->dn_name);
+			dn->dn_next = di->di_buckets[h];
+			di->di_buckets[h] = dn;
+		}
+	}
+	kfree(oldbuckets);
+}
+
+/*
+ * Whether the index has a name at SLOT.
+ */
+static
+bool
+sfs_dirindex_used(struct sfs_dirindex *di, unsigned slot)
+{
+	return slot < di->di_maxslots && di->di_slots[slot] != NULL;
+}
+
+/*
+ * Remove whatever name is indexed at SLOT.
+ */
+static
+void
+sfs_dirindex_remove(struct sfs_dirindex *di, unsigned slot)
+{
+	struct sfs_dirname *dn, **dnp;
+
+	if (slot >= di->di_maxslots || di->di_slots[slot] == NULL) {
+		return;
+	}
+	dn = di->di_slots[slot];
+	dnp = &di->di_buckets[sfs_dirindex_hash(di, dn->dn_name)];
+	while (*dnp != dn) {
+		KASSERT(*dnp != NULL);
+		dnp = &(*dnp)->dn_next;
+	}
+	*dnp = dn->dn_next;
+	di->di_slots[slot] = NULL;
+	di->di_nnames--;
+	if (slot < di->di_freehint) {
+		di->di_freehint = slot;
+	}
+	kfree(dn);
+}
+
+/*
+ * Index NAME -> INO at SLOT, which must be empty in the index.
+ */
+static
+int
+sfs_dirindex_add(struct sfs_dirindex *di, unsigned slot,
+		 const char *name, uint32_t ino)
+{
+	struct sfs_dirname *dn;
+	size_t len;
+	unsigned h;
+	int result;
+
+	result = sfs_dirindex_growslots(di, slot);
+	if (result) {
+		return result;
+	}
+	KASSERT(di->di_slots[slot] == NULL);
+
+	len = strlen(name);
+	dn = kmalloc(sizeof(*dn) + len + 1);
+	if (dn == NULL) {
+		return ENOMEM;
+	}
+	dn->dn_slot = slot;
+	dn->dn_ino = ino;
+	strcpy(dn->dn_name, name);
+
+	if (di->di_nnames >= 2 * di->di_nbuckets) {
+		sfs_dirindex_growhash(di);
+	}
+	h = sfs_dirindex_hash(di, name);
+	dn->dn_next = di->di_buckets[h];
+	di->di_buckets[h] = dn;
+	di->di_slots[slot] = dn;
+	di->di_nnames++;
+	return 0;
+}
+
+/*
+ * Build the index for directory SV by reading all its entries.
+ */
+static
+int
+sfs_dirindex_build(struct sfs_vnode *sv)
+{
+	struct sfs_dirindex *di;
+	struct sfs_direntry tsd;
+	int nentries, i, result;
+	bool sawfree = false;
+
+	KASSERT(sv->sv_dirindex == NULL);
+
+	di = kmalloc(sizeof(*di));
+	if (di == NULL) {
+		return ENOMEM;
+	}
+	di->di_nbuckets = SFS_DIRINDEX_BUCKETS;
+	di->di_buckets = kmalloc(di->di_nbuckets * sizeof(*di->di_buckets));
+	di->di_maxslots = SFS_DIRINDEX_SLOTS;
+	di->di_slots = kmalloc(di->di_maxslots * sizeof(*di->di_slots));
+	if (di->di_buckets == NULL || di->di_slots == NULL) {
+		kfree(di->di_buckets);
+		kfree(di->di_slots);
+		kfree(di);
+		return ENOMEM;
+	}
+	for (i=0; i<(int)di->di_nbuckets; i++) {
+		di->di_buckets[i] = NULL;
+	}
+	for (i=0; i<(int)di->di_maxslots; i++) {
+		di->di_slots[i] = NULL;
+	}
+	di->di_nnames = 0;
+	sv->sv_dirindex = di;
+
+	nentries = sfs_dir_nentries(sv);
+	di->di_nslots = nentries;
+	di->di_freehint = nentries;
+	for (i=0; i<nentries; i++) {
+		result = sfs_readdir(sv, i, &tsd);
+		if (result) {
+			sfs_dir_dropindex(sv);
+			return result;
+		}
+		if (tsd.sfd_ino == SFS_NOINO) {
+			if (!sawfree) {
+				di->di_freehint = i;
+				sawfree = true;
+			}
+			continue;
+		}
+		/* Ensure null termination, just in case */
+		tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+		result = sfs_dirindex_add(di, i, tsd.sfd_name, tsd.sfd_ino);
+		if (result) {
+			sfs_dir_dropindex(sv);
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Slot SLOT of SV has just been written with SD; update the index.
+ */
+static
+void
+sfs_dirindex_update(struct sfs_vnode *sv, int slot, struct sfs_direntry *sd)
+{
+	struct sfs_dirindex *di = sv->sv_dirindex;
+	unsigned i;
+
+	if (di == NULL) {
+		return;
+	}
+
+	sfs_dirindex_remove(di, slot);
+	if ((unsigned)slot >= di->di_nslots) {
+		/*
+		 * Directory grew. The free hint can stay where it is:
+		 * if it was at the old end, that's now either a hole
+		 * or SLOT, which is skipped over below.
+		 */
+		di->di_nslots = slot + 1;
+	}
+	if (sd->sfd_ino == SFS_NOINO) {
+		return;
+	}
+
+	if (sfs_dirindex_add(di, slot, sd->sfd_name, sd->sfd_ino)) {
+		sfs_dir_dropindex(sv);
+		return;
+	}
+
+	/* Move the free hint past slots now known to be in use */
+	i = di->di_freehint;
+	while (i < di->di_nslots && sfs_dirindex_used(di, i)) {
+		i++;
+	}
+	di->di_freehint = i;
+}
+
+/*
+ * Look NAME up in the index.
+ */
+static
+int
+sfs_dirindex_find(struct sfs_vnode *sv, const char *name,
+		  uint32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_dirindex *di = sv->sv_dirindex;
+	struct sfs_dirname *dn;
+
+	if (emptyslot != NULL && di->di_freehint < di->di_nslots) {
+		*emptyslot = di->di_freehint;
+	}
+
+	for (dn = di->di_buckets[sfs_dirindex_hash(di, name)];
+	     dn != NULL; dn = dn->dn_next) {
+		if (!strcmp(dn->dn_name, name)) {
+			if (slot != NULL) {
+				*slot = dn->dn_slot;
+			}
+			if (ino != NULL) {
+				*ino = dn->dn_ino;
+			}
+			return 0;
+		}
+	}
+	return ENOENT;
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
@@ -107,6 +468,17 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	struct sfs_direntry tsd;
 	int found, nentries, i, result;
 
+	if (sv->sv_dirindex == NULL) {
+		result = sfs_dirindex_build(sv);
+		if (result && result != ENOMEM) {
+			return result;
+		}
+	}
+	if (sv->sv_dirindex != NULL) {
+		return sfs_dirindex_find(sv, name, ino, slot, emptyslot);
+	}
+
+	/* No memory for the index; do it the slow way. */
 	nentries = sfs_dir_nentries(sv);
 
 	/* For each slot... */
@@ -146,6 +518,64 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	return found ? 0 : ENOENT;
 }
 
+/*
+ * Read up to MAX in-use entries from a directory, starting at slot
+ * SLOT, for listing it. Hands back the entries in SDS, the slot each
+ * came from in SLOTS, and how many there were in *NRET (0 at the end
+ * of the directory). Empty slots are skipped. The caller holds the
+ * vnode lock.
+ *
+ * Entries are read straight into SDS the rest of a block at a time,
+ * rather than a slot at a time, and the empty ones squeezed out
+ * after.
+ */
+int
+sfs_dir_readmany(struct sfs_vnode *sv, int slot, struct sfs_direntry *sds,
+		 int *slots, unsigned max, unsigned *nret)
+{
+	const unsigned perblock = SFS_BLOCKSIZE / sizeof(struct sfs_direntry);
+	int nentries, result;
+	unsigned n, first, count, i;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	nentries = sfs_dir_nentries(sv);
+	n = 0;
+	while (slot < nentries && n < max) {
+		/* To the end of this block, as far as there's room */
+		count = perblock - slot % perblock;
+		if (count > (unsigned)(nentries - slot)) {
+			count = nentries - slot;
+		}
+		if (count > max - n) {
+			count = max - n;
+		}
+		first = n;
+		result = sfs_metaio(sv, slot * sizeof(struct sfs_direntry),
+				    &sds[first],
+				    count * sizeof(struct sfs_direntry),
+				    UIO_READ);
+		if (result) {
+			return result;
+		}
+		for (i=0; i<count; i++) {
+			if (sds[first + i].sfd_ino == SFS_NOINO) {
+				continue;
+			}
+			if (n != first + i) {
+				sds[n] = sds[first + i];
+			}
+			/* Ensure null termination, just in case */
+			sds[n].sfd_name[sizeof(sds[n].sfd_name)-1] = 0;
+			slots[n] = slot + i;
+			n++;
+		}
+		slot += count;
+	}
+	*nret = n;
+	return 0;
+}
+
 /*
  * Create a link in a directory to the specified inode by number, with
  * the specified name, and optionally hand back the slot.
@@ -190,19 +620,118 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 }
 
 /*
- * Unlink a name in a directory, by slot number.
+ * Shrink a directory after an unlink.
+ *
+ * If there are enough empty slots below the directory's last block
+ * to hold the names still in it, those names are moved down into
+ * them; then any empty slots at the end are cut off, freeing the
+ * last block if it's now empty. Doing at most one block per unlink
+ * keeps the transaction small, and is enough that a directory never
+ * has a block's worth of empty slots for long, so its size, and
+ * what a lookup without the index or a listing has to read, follows
+ * the number of names in it rather than the most it ever had.
+ *
+ * Each move writes the name into its new slot before clearing the
+ * old one. A listing going on at the same time can miss a name that
+ * is moved past it, as it can one that is renamed.
+ *
+ * This uses the name index to find the names and holes; without one
+ * nothing is done. Failing is harmless, so errors aren't returned.
+ */
+static
+void
+sfs_dir_compact(struct sfs_vnode *sv)
+{
+	const unsigned perblock = SFS_BLOCKSIZE / sizeof(struct sfs_direntry);
+	struct sfs_dirindex *di = sv->sv_dirindex;
+	struct sfs_direntry sd, empty;
+	unsigned nslots, start, live, hole, i;
+
+	if (di == NULL || di->di_nslots == 0) {
+		return;
+	}
+	nslots = di->di_nslots;
+	start = (nslots - 1) / perblock * perblock;
+
+	live = 0;
+	for (i=start; i<nslots; i++) {
+		if (sfs_dirindex_used(di, i)) {
+			live++;
+		}
+	}
+	KASSERT(di->di_nnames >= live);
+
+	/* Move the last block's names down, if there's room for all of them */
+	bzero(&empty, sizeof(empty));
+	empty.sfd_ino = SFS_NOINO;
+	if (live > 0 && start - (di->di_nnames - live) >= live) {
+		hole = di->di_freehint;
+		for (i=start; i<nslots; i++) {
+			if (!sfs_dirindex_used(di, i)) {
+				continue;
+			}
+			while (sfs_dirindex_used(di, hole)) {
+				hole++;
+			}
+			KASSERT(hole < start);
+
+			if (sfs_readdir(sv, i, &sd)) {
+				return;
+			}
+			if (sfs_writedir(sv, hole, &sd)) {
+				return;
+			}
+			if (sfs_writedir(sv, i, &empty)) {
+				/* Don't leave the name in twice */
+				(void)sfs_writedir(sv, hole, &empty);
+				return;
+			}
+			/* A failed write may have dropped the index */
+			if (sv->sv_dirindex == NULL) {
+				return;
+			}
+		}
+	}
+
+	/* Cut off the empty slots at the end */
+	i = nslots;
+	while (i > 0 && !sfs_dirindex_used(di, i-1)) {
+		i--;
+	}
+	if (i == nslots) {
+		return;
+	}
+	if (sfs_itrunc(sv, i * sizeof(struct sfs_direntry))) {
+		return;
+	}
+	di->di_nslots = i;
+	if (di->di_freehint > i) {
+		di->di_freehint = i;
+	}
+}
+
+/*
+ * Unlink a name in a directory, by slot number. This may move other
+ * names to different slots; see sfs_dir_compact.
  */
 int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
 	struct sfs_direntry sd;
+	int result;
 
 	/* Initialize a suitable directory entry... */
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
 
 	/* ... and write it */
-	return sfs_writedir(sv, slot, &sd);
+	result = sfs_writedir(sv, slot, &sd);
+	if (result) {
+		return result;
+	}
+
+	sfs_dir_compact(sv);
+	return 0;
 }
 
 /*
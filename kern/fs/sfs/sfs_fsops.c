@@ -38,6 +38,7 @@
 #include <lib.h>
 #include <array.h>
 #include <bitmap.h>
+#include <synch.h>
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
@@ -52,13 +53,15 @@
 
 /*
  * Routine for doing I/O (reads or writes) on the free block bitmap.
- * We always do the whole bitmap at once; writing individual sectors
- * might or might not be a worthwhile optimization.
+ * Reading, at mount time, does the whole bitmap at once. Writing
+ * does only the blocks marked in sfs_fmdirty; like other metadata
+ * they go to the buffer cache, and to disk with the rest of what
+ * sync flushes.
  *
- * The free block bitmap consists of SFS_FREEMAPBLOCKS 512-byte
- * sectors of bits, one bit for each sector on the filesystem. The
- * number of blocks in the bitmap is thus rounded up to the nearest
- * multiple of 512*8 = 4096. (This rounded number is SFS_FREEMAPBITS.)
+ * The free block bitmap consists of SFS_FREEMAPBLOCKS blocks of bits,
+ * one bit for each block on the filesystem. The number of blocks in
+ * the bitmap is thus rounded up to the nearest multiple of
+ * SFS_BLOCKSIZE*8. (This rounded number is SFS_FREEMAPBITS.)
  * This means that the bitmap will (in general) contain space for some
  * number of invalid sectors that are actually beyond the end of the
  * disk device. This is ok. These sectors are supposed to be marked
@@ -91,40 +94,88 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 		if (rw == UIO_READ) {
 			result = sfs_readblock(sfs, SFS_FREEMAP_START+j, ptr,
 					       SFS_BLOCKSIZE);
-		}
-		else {
-			result = sfs_writeblock(sfs, SFS_FREEMAP_START+j, ptr,
-						SFS_BLOCKSIZE);
+			if (result) {
+				return result;
+			}
+			continue;
 		}
 
-		/* If we failed, stop. */
+		if (!bitmap_isset(sfs->sfs_fmdirty, j)) {
+			continue;
+		}
+		result = sfs_writeblock(sfs, SFS_FREEMAP_START+j, ptr,
+					SFS_BLOCKSIZE);
 		if (result) {
 			return result;
 		}
+		bitmap_unmark(sfs->sfs_fmdirty, j);
 	}
 	return 0;
 }
 
 /*
  * Sync routine for the vnode table.
+ *
+ * The inodes can't be written while holding sfs_vnlock, because the
+ * vnode locks come first, so take a reference to each loaded vnode
+ * under the lock and then go through them with it released. Data
+ * still waiting for disk blocks is placed first, but the data blocks
+ * are left for the caller to flush.
+ *
+ * The inode writes are one journal transaction, so the references
+ * are dropped only after it ends.
  */
 static
 int
 sfs_sync_vnodes(struct sfs_fs *sfs)
 {
-	unsigned i, num;
+	struct sfs_vnode **svs, *sv;
+	unsigned i, n;
+	int result;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+	sfs_txn_begin(sfs);
+	lock_acquire(sfs->sfs_vnlock);
+	n = 0;
+	svs = kmalloc(sfs->sfs_nvnodes * sizeof(*svs) + 1);
+	if (svs == NULL) {
+		lock_release(sfs->sfs_vnlock);
+		sfs_txn_end(sfs);
+		return ENOMEM;
 	}
-	return 0;
+	for (i=0; i<sfs->sfs_vnhashsize; i++) {
+		for (sv = sfs->sfs_vnhash[i]; sv != NULL;
+		     sv = sv->sv_hashnext) {
+			VOP_INCREF(&sv->sv_absvn);
+			svs[n++] = sv;
+		}
+	}
+	KASSERT(n == sfs->sfs_nvnodes);
+	lock_release(sfs->sfs_vnlock);
+
+	/* Write them all even if some fail; report the first error */
+	result = 0;
+	for (i=0; i<n; i++) {
+		lock_acquire(svs[i]->sv_lock);
+		if (sfs_da_place(svs[i]) && result == 0) {
+			result = EIO;
+		}
+		if (sfs_sync_inode(svs[i]) && result == 0) {
+			result = EIO;
+		}
+		lock_release(svs[i]->sv_lock);
+	}
+	sfs_txn_end(sfs);
+
+	for (i=0; i<n; i++) {
+		VOP_DECREF(&svs[i]->sv_absvn);
+	}
+	kfree(svs);
+	return result;
 }
 
 /*
- * Sync routine for the freemap.
+ * Sync routine for the freemap. On a journaled volume the freemap is
+ * written by the journal at each commit instead.
  */
 static
 int
@@ -132,6 +183,8 @@ sfs_sync_freemap(struct sfs_fs *sfs)
 {
 	int result;
 
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
 	if (sfs->sfs_freemapdirty) {
 		result = sfs_freemapio(sfs, UIO_WRITE);
 		if (result) {
@@ -152,6 +205,8 @@ sfs_sync_superblock(struct sfs_fs *sfs)
 {
 	int result;
 
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
 	if (sfs->sfs_superdirty) {
 		result = sfs_writeblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
 					sizeof(sfs->sfs_sb));
@@ -174,8 +229,6 @@ sfs_sync(struct fs *fs)
 	struct sfs_fs *sfs;
 	int result;
 
-	vfs_biglock_acquire();
-
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
 	 *
@@ -211,25 +264,45 @@ sfs_sync(struct fs *fs)
 	/* If any vnodes need to be written, write them. */
 	result = sfs_sync_vnodes(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
+	sfs_txn_begin(sfs);
+	lock_acquire(sfs->sfs_freemaplock);
+
 	/* If the free block map needs to be written, write it. */
-	result = sfs_sync_freemap(sfs);
-	if (result) {
-		vfs_biglock_release();
-		return result;
+	if (sfs->sfs_journal == NULL) {
+		result = sfs_sync_freemap(sfs);
+		if (result) {
+			lock_release(sfs->sfs_freemaplock);
+			sfs_txn_end(sfs);
+			return result;
+		}
 	}
 
 	/* If the superblock needs to be written, write it. */
 	result = sfs_sync_superblock(sfs);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sfs->sfs_freemaplock);
+		sfs_txn_end(sfs);
+		return result;
+	}
+
+	lock_release(sfs->sfs_freemaplock);
+	sfs_txn_end(sfs);
+
+	/* Commit all that to the journal (and the freemap with it). */
+	result = sfs_journal_commit(sfs);
+	if (result) {
+		return result;
+	}
+
+	/* All of the above only went to the buffer cache; flush it. */
+	result = sfs_buf_sync(sfs);
+	if (result) {
 		return result;
 	}
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -243,13 +316,9 @@ const char *
 sfs_getvolname(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	const char *ret;
-
-	vfs_biglock_acquire();
-	ret = sfs->sfs_sb.sb_volname;
-	vfs_biglock_release();
 
-	return ret;
+	/* The volume name doesn't change while mounted */
+	return sfs->sfs_sb.sb_volname;
 }
 
 /*
@@ -259,10 +328,24 @@ static
 void
 sfs_fs_destroy(struct sfs_fs *sfs)
 {
+	sfs_journal_destroy(sfs);
+	sfs_buf_invalidate(sfs);
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
-	vnodearray_destroy(sfs->sfs_vnodes);
+	if (sfs->sfs_fmdirty != NULL) {
+		bitmap_destroy(sfs->sfs_fmdirty);
+	}
+	kfree(sfs->sfs_chunkfree);
+	kfree(sfs->sfs_groupfree);
+	KASSERT(sfs->sfs_nvnodes == 0);
+	kfree(sfs->sfs_vnhash);
+	if (sfs->sfs_vnlock != NULL) {
+		lock_destroy(sfs->sfs_vnlock);
+	}
+	if (sfs->sfs_freemaplock != NULL) {
+		lock_destroy(sfs->sfs_freemaplock);
+	}
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
 }
@@ -277,19 +360,38 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
+	int result;
 
-	vfs_biglock_acquire();
-
-	/* Do we have any files open? If so, can't unmount. */
-	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
-		vfs_biglock_release();
+	/*
+	 * Do we have any files open? If so, can't unmount. The VFS
+	 * layer holds the mount table locked, so no new ones can be
+	 * opened once we've checked. Files that are only cached don't
+	 * count; let them go first.
+	 */
+	sfs_vncache_purge(sfs);
+	lock_acquire(sfs->sfs_vnlock);
+	if (sfs->sfs_nvnodes > 0) {
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
+	lock_release(sfs->sfs_vnlock);
 
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* Checkpoint the journal and stop its thread. */
+	result = sfs_journal_unmount(sfs);
+	if (result) {
+		return result;
+	}
+
+	/* Make sure nothing is left in the buffer cache. */
+	result = sfs_buf_sync(sfs);
+	if (result) {
+		return result;
+	}
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -297,7 +399,6 @@ sfs_unmount(struct fs *fs)
 	sfs_fs_destroy(sfs);
 
 	/* nothing else to do */
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -321,6 +422,7 @@ struct sfs_fs *
 sfs_fs_create(void)
 {
 	struct sfs_fs *sfs;
+	unsigned i;
 
 	/*
 	 * Make sure our on-disk structures aren't messed up
@@ -351,17 +453,45 @@ sfs_fs_create(void)
 	sfs->sfs_device = NULL;
 
 	/* vnode table */
-	sfs->sfs_vnodes = vnodearray_create();
-	if (sfs->sfs_vnodes == NULL) {
+	sfs->sfs_vnhashsize = SFS_VNHASH_INIT;
+	sfs->sfs_nvnodes = 0;
+	sfs->sfs_vnhash = kmalloc(SFS_VNHASH_INIT * sizeof(*sfs->sfs_vnhash));
+	if (sfs->sfs_vnhash == NULL) {
 		goto cleanup_object;
 	}
+	for (i=0; i<SFS_VNHASH_INIT; i++) {
+		sfs->sfs_vnhash[i] = NULL;
+	}
 
 	/* freemap */
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
+	sfs->sfs_fmdirty = NULL;
+	sfs->sfs_chunkfree = NULL;
+	sfs->sfs_groupfree = NULL;
+	sfs->sfs_alloccursor = 0;
+	sfs->sfs_nfree = 0;
+	sfs->sfs_nreserved = 0;
+
+	/* journal (set up at mount time) */
+	sfs->sfs_journal = NULL;
+
+	/* locks */
+	sfs->sfs_vnlock = lock_create("sfs_vnlock");
+	if (sfs->sfs_vnlock == NULL) {
+		goto cleanup_vnhash;
+	}
+	sfs->sfs_freemaplock = lock_create("sfs_freemaplock");
+	if (sfs->sfs_freemaplock == NULL) {
+		goto cleanup_vnlock;
+	}
 
 	return sfs;
 
+cleanup_vnlock:
+	lock_destroy(sfs->sfs_vnlock);
+cleanup_vnhash:
+	kfree(sfs->sfs_vnhash);
 cleanup_object:
 	kfree(sfs);
 fail:
@@ -387,30 +517,35 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 {
 	int result;
 	struct sfs_fs *sfs;
+	uint32_t blocksize;
+	blkcnt_t devblocks;
 
-	vfs_biglock_acquire();
+	/* vfs_mount holds the big lock, which serializes mounts */
+	KASSERT(vfs_biglock_do_i_hold());
 
 	/* We don't pass any options through mount */
 	(void)options;
 
 	/*
-	 * We can't mount on devices with the wrong sector size.
-	 *
-	 * (Note: for all intents and purposes here, "sector" and
-	 * "block" are interchangeable terms. Technically a filesystem
-	 * block may be composed of several hardware sectors, but we
-	 * don't do that in sfs.)
+	 * We can't mount on devices whose sectors don't fit evenly
+	 * into our blocks. (With the default 512-byte block a block
+	 * is one sector; with bigger ones it is several.)
 	 */
-	if (dev->d_blocksize != SFS_BLOCKSIZE) {
-		vfs_biglock_release();
+	if (dev->d_blocksize == 0 || dev->d_blocksize > SFS_BLOCKSIZE ||
+	    SFS_BLOCKSIZE % dev->d_blocksize != 0) {
 		kprintf("sfs: Cannot mount on device with blocksize %zu\n",
 			dev->d_blocksize);
 		return ENXIO;
 	}
 
+	/* Set up the buffer cache, if this is the first mount */
+	result = sfs_buf_bootstrap();
+	if (result) {
+		return result;
+	}
+
 	sfs = sfs_fs_create();
 	if (sfs == NULL) {
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 
@@ -423,7 +558,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -436,38 +570,69 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			SFS_MAGIC);
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return EINVAL;
 	}
 
-	if (sfs->sfs_sb.sb_nblocks > dev->d_blocks) {
+	blocksize = sfs->sfs_sb.sb_blocksize;
+	if (blocksize == 0) {
+		blocksize = SFS_OLDBLOCKSIZE;
+	}
+	if (blocksize != SFS_BLOCKSIZE) {
+		kprintf("sfs: %u-byte blocks; this kernel uses %u\n",
+			blocksize, SFS_BLOCKSIZE);
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		return EINVAL;
+	}
+
+	devblocks = dev->d_blocks / (SFS_BLOCKSIZE / dev->d_blocksize);
+	if (sfs->sfs_sb.sb_nblocks > devblocks) {
 		kprintf("sfs: warning - fs has %u blocks, device has %u\n",
-			sfs->sfs_sb.sb_nblocks, dev->d_blocks);
+			sfs->sfs_sb.sb_nblocks, devblocks);
 	}
 
 	/* Ensure null termination of the volume name */
 	sfs->sfs_sb.sb_volname[sizeof(sfs->sfs_sb.sb_volname)-1] = 0;
 
+	/* Recover from the journal before reading anything else */
+	result = sfs_journal_mount(sfs);
+	if (result) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		return result;
+	}
+
 	/* Load free block bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_FREEMAPBITS(sfs));
-	if (sfs->sfs_freemap == NULL) {
+	sfs->sfs_fmdirty = bitmap_create(SFS_FS_FREEMAPBLOCKS(sfs));
+	if (sfs->sfs_freemap == NULL || sfs->sfs_fmdirty == NULL) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 	result = sfs_freemapio(sfs, UIO_READ);
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
+		return result;
+	}
+	result = sfs_freemap_index(sfs);
+	if (result) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		return result;
+	}
+
+	result = sfs_journal_start(sfs);
+	if (result) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
 		return result;
 	}
 
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -34,51 +34,370 @@
  */
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stat.h>
 #include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 
 /*
- * Write an on-disk inode structure back out to disk.
+ * Write an on-disk inode structure back out to disk. The vnode must
+ * be locked, and on a journaled volume we must be in a transaction;
+ * every operation that changes an inode calls this before ending its
+ * transaction, so that the inode is committed along with the rest.
  */
 int
 sfs_sync_inode(struct sfs_vnode *sv)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *b;
 	int result;
 
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+	KASSERT(sizeof(sv->sv_i) == SFS_BLOCKSIZE);
+
 	if (sv->sv_dirty) {
-		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
-					sizeof(sv->sv_i));
+		result = sfs_buf_get(sfs, sv->sv_ino, &b);
 		if (result) {
 			return result;
 		}
+		memcpy(b->b_data, &sv->sv_i, sizeof(sv->sv_i));
+		sfs_jfdirty(b, sv);
+		sfs_buf_release(b);
 		sv->sv_dirty = false;
 	}
 	return 0;
 }
 
+/*
+ * Double the size of the vnode hash table. This is only done to keep
+ * the chains short, so if there's no memory, just don't.
+ */
+static
+void
+sfs_vnhash_grow(struct sfs_fs *sfs)
+{
+	struct sfs_vnode **newhash;
+	struct sfs_vnode *sv;
+	unsigned oldsize, i, h;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	oldsize = sfs->sfs_vnhashsize;
+	newhash = kmalloc(2 * oldsize * sizeof(*newhash));
+	if (newhash == NULL) {
+		return;
+	}
+	for (i=0; i<2*oldsize; i++) {
+		newhash[i] = NULL;
+	}
+
+	sfs->sfs_vnhashsize = 2 * oldsize;
+	for (i=0; i<oldsize; i++) {
+		while ((sv = sfs->sfs_vnhash[i]) != NULL) {
+			sfs->sfs_vnhash[i] = sv->sv_hashnext;
+			h = SFS_VNHASH(sfs, sv->sv_ino);
+			sv->sv_hashnext = newhash[h];
+			newhash[h] = sv;
+		}
+	}
+	kfree(sfs->sfs_vnhash);
+	sfs->sfs_vnhash = newhash;
+}
+
+/*
+ * Remove SV from its volume's vnode table. Called with sfs_vnlock.
+ */
+static
+void
+sfs_vnhash_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **svp;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	svp = &sfs->sfs_vnhash[SFS_VNHASH(sfs, sv->sv_ino)];
+	while (*svp != sv) {
+		if (*svp == NULL) {
+			panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
+			      sfs->sfs_sb.sb_volname, sv->sv_ino);
+		}
+		svp = &(*svp)->sv_hashnext;
+	}
+	*svp = sv->sv_hashnext;
+	sfs->sfs_nvnodes--;
+}
+
+/*
+ * Free the memory of a vnode that has been taken out of the table.
+ */
+static
+void
+sfs_vnode_free(struct sfs_vnode *sv)
+{
+	sfs_dir_dropindex(sv);
+	sfs_buf_disown(sv);
+	lock_destroy(sv->sv_appendlock);
+	lock_destroy(sv->sv_lock);
+	vnode_cleanup(&sv->sv_absvn);
+	kfree(sv);
+}
+
+/*
+ * The vnode cache.
+ *
+ * When the last reference to a vnode goes, sfs_reclaim does all the
+ * writing back it would do anyway, and then, if the file still has
+ * links, leaves the vnode in its volume's table with the reference
+ * passed on to the cache instead of freeing it. sfs_loadvnode finds
+ * it there and takes the cache's reference over, so the next open
+ * costs no disk read. Everything cached is clean: nobody else has a
+ * reference to write through.
+ *
+ * Cached vnodes, of every volume, are on one LRU list, most recently
+ * closed at the tail, under sfs_vncache_lock. sv_lrucached says
+ * whether a vnode is on it; it's only set or cleared with the
+ * volume's sfs_vnlock held as well, so that sfs_loadvnode and
+ * sfs_reclaim see it settled.
+ *
+ * Evicting takes a vnode off the head, marked sv_lruevict, and then,
+ * with sfs_vnlock, frees it the way sfs_reclaim would have. Sync and
+ * stat may take a reference for a moment meanwhile, which just means
+ * the cache's is dropped instead and the vnode comes back when theirs
+ * goes. If sfs_loadvnode got the vnode in between, it clears
+ * sv_lruevict, and since it might have been changed the cache's
+ * reference goes with an ordinary VOP_DECREF. Otherwise nothing is
+ * written, so the pageout thread can evict under memory pressure.
+ */
+unsigned sfs_vncache_max = SFS_VNCACHE_MAX;
+
+static struct spinlock sfs_vncache_lock = SPINLOCK_INITIALIZER;
+static struct sfs_vnode *sfs_vncache_head;	/* least recently closed */
+static struct sfs_vnode *sfs_vncache_tail;
+static unsigned sfs_vncache_count;
+
+static unsigned sfs_vncache_hits;		/* opens it saved a read */
+static unsigned sfs_vncache_evicted;
+
+/*
+ * Take SV off the LRU list. Called with sfs_vncache_lock.
+ */
+static
+void
+sfs_vncache_unlink(struct sfs_vnode *sv)
+{
+	KASSERT(sv->sv_lrucached);
+
+	if (sv->sv_lruprev != NULL) {
+		sv->sv_lruprev->sv_lrunext = sv->sv_lrunext;
+	}
+	else {
+		sfs_vncache_head = sv->sv_lrunext;
+	}
+	if (sv->sv_lrunext != NULL) {
+		sv->sv_lrunext->sv_lruprev = sv->sv_lruprev;
+	}
+	else {
+		sfs_vncache_tail = sv->sv_lruprev;
+	}
+	sv->sv_lruprev = sv->sv_lrunext = NULL;
+	sv->sv_lrucached = false;
+	sfs_vncache_count--;
+}
+
+/*
+ * Keep SV, whose last reference is going, in the cache. Returns
+ * false if the cache is turned off. Called with sfs_vnlock.
+ */
+static
+bool
+sfs_vncache_park(struct sfs_vnode *sv)
+{
+	if (sfs_vncache_max == 0) {
+		return false;
+	}
+	spinlock_acquire(&sfs_vncache_lock);
+	KASSERT(!sv->sv_lrucached);
+	sv->sv_lruprev = sfs_vncache_tail;
+	sv->sv_lrunext = NULL;
+	if (sfs_vncache_tail != NULL) {
+		sfs_vncache_tail->sv_lrunext = sv;
+	}
+	else {
+		sfs_vncache_head = sv;
+	}
+	sfs_vncache_tail = sv;
+	sv->sv_lrucached = true;
+	sfs_vncache_count++;
+	spinlock_release(&sfs_vncache_lock);
+	return true;
+}
+
+/*
+ * If SV is cached, take it out of the cache along with its reference
+ * and return true. If it's on its way out, stop that. Called with
+ * sfs_vnlock.
+ */
+static
+bool
+sfs_vncache_take(struct sfs_vnode *sv)
+{
+	bool cached;
+
+	spinlock_acquire(&sfs_vncache_lock);
+	cached = sv->sv_lrucached;
+	if (cached) {
+		sfs_vncache_unlink(sv);
+		sfs_vncache_hits++;
+	}
+	sv->sv_lruevict = false;
+	spinlock_release(&sfs_vncache_lock);
+	return cached;
+}
+
+/*
+ * Drop the cache's reference to SV, which has been taken off the
+ * list, freeing it unless somebody else has one now.
+ */
+static
+void
+sfs_vncache_evict(struct sfs_vnode *sv)
+{
+	struct vnode *v = &sv->sv_absvn;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	bool evict;
+
+	lock_acquire(sfs->sfs_vnlock);
+	spinlock_acquire(&sfs_vncache_lock);
+	evict = sv->sv_lruevict;
+	sv->sv_lruevict = false;
+	spinlock_release(&sfs_vncache_lock);
+	if (!evict) {
+		/* Opened again meanwhile */
+		lock_release(sfs->sfs_vnlock);
+		VOP_DECREF(v);
+		return;
+	}
+
+	spinlock_acquire(&v->vn_countlock);
+	if (v->vn_refcount > 1) {
+		v->vn_refcount--;
+		spinlock_release(&v->vn_countlock);
+		lock_release(sfs->sfs_vnlock);
+		return;
+	}
+	spinlock_release(&v->vn_countlock);
+
+	KASSERT(!sv->sv_dirty);
+	sfs_vnhash_remove(sfs, sv);
+	lock_release(sfs->sfs_vnlock);
+
+	sfs_vnode_free(sv);
+}
+
+/*
+ * Evict from the head until no more than KEEP are left.
+ */
+static
+void
+sfs_vncache_trim(unsigned keep)
+{
+	struct sfs_vnode *sv;
+
+	while (1) {
+		spinlock_acquire(&sfs_vncache_lock);
+		sv = sfs_vncache_head;
+		if (sfs_vncache_count <= keep || sv == NULL) {
+			spinlock_release(&sfs_vncache_lock);
+			break;
+		}
+		sfs_vncache_unlink(sv);
+		sv->sv_lruevict = true;
+		sfs_vncache_evicted++;
+		spinlock_release(&sfs_vncache_lock);
+		sfs_vncache_evict(sv);
+	}
+}
+
+void
+sfs_vncache_shrink(void)
+{
+	sfs_vncache_trim(sfs_vncache_count / 2);
+}
+
+/*
+ * Evict every cached vnode of SFS, for unmount.
+ */
+void
+sfs_vncache_purge(struct sfs_fs *sfs)
+{
+	struct sfs_vnode *sv, *next, *victims;
+
+	victims = NULL;
+	spinlock_acquire(&sfs_vncache_lock);
+	for (sv = sfs_vncache_head; sv != NULL; sv = next) {
+		next = sv->sv_lrunext;
+		if (sv->sv_absvn.vn_fs == &sfs->sfs_absfs) {
+			sfs_vncache_unlink(sv);
+			sv->sv_lruevict = true;
+			sfs_vncache_evicted++;
+			sv->sv_lrunext = victims;
+			victims = sv;
+		}
+	}
+	spinlock_release(&sfs_vncache_lock);
+
+	for (sv = victims; sv != NULL; sv = next) {
+		next = sv->sv_lrunext;
+		sv->sv_lrunext = NULL;
+		sfs_vncache_evict(sv);
+	}
+}
+
+void
+sfs_vncache_printstats(void)
+{
+	kprintf("sfs vnode cache: %u of %u cached, %u hits, %u evicted\n",
+		sfs_vncache_count, sfs_vncache_max, sfs_vncache_hits,
+		sfs_vncache_evicted);
+}
+
 /*
  * Called when the vnode refcount (in-memory usage count) hits zero.
  *
  * This function should try to avoid returning errors other than EBUSY.
+ *
+ * The whole thing is done holding sfs_vnlock, so that sfs_loadvnode
+ * can neither hand out the vnode again nor load a second copy of the
+ * inode from disk before this one has been written back. That puts
+ * sfs_vnlock before the vnode's own lock, against the usual order;
+ * this is safe because once the refcount is seen to be 1 under
+ * sfs_vnlock, nobody else has the vnode or can get it, so nobody can
+ * be holding or waiting for its lock.
+ *
+ * The truncation and the inode write are a journal transaction, which
+ * has to be begun before taking sfs_vnlock.
+ *
+ * A file that still has links is written back and then kept in the
+ * vnode cache rather than freed; see above.
  */
 int
 sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
 	int result;
 
-	vfs_biglock_acquire();
+	sfs_txn_begin(sfs);
+	lock_acquire(sfs->sfs_vnlock);
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * decision was made to reclaim it.
 	 */
 	spinlock_acquire(&v->vn_countlock);
 	if (v->vn_refcount != 1) {
@@ -88,16 +407,36 @@ sfs_reclaim(struct vnode *v)
 		v->vn_refcount--;
 
 		spinlock_release(&v->vn_countlock);
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
+		sfs_txn_end(sfs);
 		return EBUSY;
 	}
 	spinlock_release(&v->vn_countlock);
 
+	/* Uncontended; see above */
+	lock_acquire(sv->sv_lock);
+
+	/* Data the file still needs goes to disk before the vnode goes */
+	if (sv->sv_i.sfi_linkcount > 0) {
+		result = sfs_da_place(sv);
+		if (result) {
+			lock_release(sv->sv_lock);
+			lock_release(sfs->sfs_vnlock);
+			sfs_txn_end(sfs);
+			return result;
+		}
+	}
+
+	/* Nobody is going to write any more, so give back our reserve */
+	sfs_prealloc_release(sv);
+
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount == 0) {
 		result = sfs_itrunc(sv, 0);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sv->sv_lock);
+			lock_release(sfs->sfs_vnlock);
+			sfs_txn_end(sfs);
 			return result;
 		}
 	}
@@ -105,9 +444,20 @@ sfs_reclaim(struct vnode *v)
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		lock_release(sfs->sfs_vnlock);
+		sfs_txn_end(sfs);
 		return result;
 	}
+	lock_release(sv->sv_lock);
+
+	/* Still linked: keep it for the next open */
+	if (sv->sv_i.sfi_linkcount > 0 && sfs_vncache_park(sv)) {
+		lock_release(sfs->sfs_vnlock);
+		sfs_txn_end(sfs);
+		sfs_vncache_trim(sfs_vncache_max);
+		return 0;
+	}
 
 	/* If there are no on-disk references, discard the inode */
 	if (sv->sv_i.sfi_linkcount==0) {
@@ -115,28 +465,13 @@ sfs_reclaim(struct vnode *v)
 	}
 
 	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix == num) {
-		panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
-		      sfs->sfs_sb.sb_volname, sv->sv_ino);
-	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
-
-	vnode_cleanup(&sv->sv_absvn);
+	sfs_vnhash_remove(sfs, sv);
 
-	vfs_biglock_release();
+	lock_release(sfs->sfs_vnlock);
+	sfs_txn_end(sfs);
 
 	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	sfs_vnode_free(sv);
 
 	/* Done */
 	return 0;
@@ -150,33 +485,34 @@ int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops;
-	unsigned i, num;
+	unsigned h;
 	int result;
 
-	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
-
-		/* Every inode in memory must be in an allocated block */
-		if (!sfs_bused(sfs, sv->sv_ino)) {
-			panic("sfs: %s: Found inode %u in unallocated block\n",
-			      sfs->sfs_sb.sb_volname, sv->sv_ino);
-		}
+	lock_acquire(sfs->sfs_vnlock);
 
+	/* Look in the vnodes table */
+	h = SFS_VNHASH(sfs, ino);
+	for (sv = sfs->sfs_vnhash[h]; sv != NULL; sv = sv->sv_hashnext) {
 		if (sv->sv_ino==ino) {
 			/* Found */
 
+			/* Every inode in memory must be in an allocated block */
+			if (!sfs_bused(sfs, ino)) {
+				panic("sfs: %s: Found inode %u in "
+				      "unallocated block\n",
+				      sfs->sfs_sb.sb_volname, ino);
+			}
+
 			/* forcetype is only allowed when creating objects */
 			KASSERT(forcetype==SFS_TYPE_INVAL);
 
-			VOP_INCREF(&sv->sv_absvn);
+			/* If it's cached, the cache's reference is ours */
+			if (!sfs_vncache_take(sv)) {
+				VOP_INCREF(&sv->sv_absvn);
+			}
+			lock_release(sfs->sfs_vnlock);
 			*ret = sv;
 			return 0;
 		}
@@ -186,6 +522,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 
 	sv = kmalloc(sizeof(struct sfs_vnode));
 	if (sv==NULL) {
+		lock_release(sfs->sfs_vnlock);
 		return ENOMEM;
 	}
 
@@ -199,12 +536,53 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
 	if (result) {
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
+	sv->sv_lock = lock_create("sfs_vnode");
+	if (sv->sv_lock == NULL) {
+		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+	sv->sv_appendlock = lock_create("sfs_append");
+	if (sv->sv_appendlock == NULL) {
+		lock_destroy(sv->sv_lock);
+		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+
 	/* Not dirty yet */
 	sv->sv_dirty = false;
 
+	/* No reads yet; reading from the start counts as sequential */
+	sv->sv_ralast = (uint32_t)-1;
+	sv->sv_ranext = 0;
+	sv->sv_rawindow = 0;
+	sv->sv_raadvice = FADV_NORMAL;
+	sv->sv_noreuse = false;
+
+	/* Directories get their name index on first lookup */
+	sv->sv_dirindex = NULL;
+
+	/* No blocks set aside yet */
+	sv->sv_prealloc = 0;
+	sv->sv_npreall = 0;
+
+	/* No indirect block looked up yet */
+	sv->sv_ibblock = 0;
+	sv->sv_ibfirst = 0;
+	sv->sv_dafirst = 0;
+	sv->sv_dacount = 0;
+	sv->sv_daplacing = false;
+	sv->sv_fallocleft = 0;
+	sv->sv_dirtybufs = NULL;
+	sv->sv_lruprev = sv->sv_lrunext = NULL;
+	sv->sv_lrucached = false;
+	sv->sv_lruevict = false;
+
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
 	 * block on disk will have been zeroed out by sfs_balloc and
@@ -235,7 +613,10 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+		lock_destroy(sv->sv_appendlock);
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
@@ -243,12 +624,15 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	sv->sv_ino = ino;
 
 	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
-	if (result) {
-		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
-		return result;
+	if (sfs->sfs_nvnodes >= 2 * sfs->sfs_vnhashsize) {
+		sfs_vnhash_grow(sfs);
+		h = SFS_VNHASH(sfs, ino);
 	}
+	sv->sv_hashnext = sfs->sfs_vnhash[h];
+	sfs->sfs_vnhash[h] = sv;
+	sfs->sfs_nvnodes++;
+
+	lock_release(sfs->sfs_vnlock);
 
 	/* Hand it back */
 	*ret = sv;
@@ -256,20 +640,86 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 }
 
 /*
- * Create a new filesystem object and hand back its vnode.
+ * Get stat information for an inode by number, without loading a
+ * vnode for it, for listing directories. If the inode is in memory
+ * its copy there is the current one; otherwise the copy in the
+ * buffer cache is. Returns ENOENT if the inode has gone away since
+ * the caller found its number in a directory.
+ */
+int
+sfs_statino(struct sfs_fs *sfs, uint32_t ino, struct stat *st)
+{
+	struct sfs_vnode *sv;
+	struct sfs_dinode di;
+	struct sfs_buf *b;
+	int result;
+
+	lock_acquire(sfs->sfs_vnlock);
+	for (sv = sfs->sfs_vnhash[SFS_VNHASH(sfs, ino)]; sv != NULL;
+	     sv = sv->sv_hashnext) {
+		if (sv->sv_ino == ino) {
+			break;
+		}
+	}
+	if (sv != NULL) {
+		VOP_INCREF(&sv->sv_absvn);
+		lock_release(sfs->sfs_vnlock);
+
+		lock_acquire(sv->sv_lock);
+		di = sv->sv_i;
+		lock_release(sv->sv_lock);
+		VOP_DECREF(&sv->sv_absvn);
+	}
+	else {
+		lock_release(sfs->sfs_vnlock);
+
+		if (!sfs_bused(sfs, ino)) {
+			return ENOENT;
+		}
+		result = sfs_buf_read(sfs, ino, &b);
+		if (result) {
+			return result;
+		}
+		memcpy(&di, b->b_data, sizeof(di));
+		sfs_buf_release(b);
+	}
+
+	bzero(st, sizeof(*st));
+	switch (di.sfi_type) {
+	    case SFS_TYPE_FILE:
+		st->st_mode = S_IFREG;
+		break;
+	    case SFS_TYPE_DIR:
+		st->st_mode = S_IFDIR;
+		break;
+	    default:
+		/* Freed (and maybe reused) under us */
+		return ENOENT;
+	}
+	st->st_size = di.sfi_size;
+	st->st_nlink = di.sfi_linkcount;
+	st->st_ino = ino;
+	return 0;
+}
+
+/*
+ * Create a new filesystem object in directory DIR and hand back its
+ * vnode.
  */
 int
-sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
+sfs_makeobj(struct sfs_fs *sfs, struct sfs_vnode *dir, int type,
+	    struct sfs_vnode **ret)
 {
 	uint32_t ino;
 	int result;
 
 	/*
 	 * First, get an inode. (Each inode is a block, and the inode
-	 * number is the block number, so just get a block.)
+	 * number is the block number, so just get a block.) Put it
+	 * near the directory; see sfs_inogoal.
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, sfs_inogoal(sfs, dir), &ino);
 	if (result) {
 		return result;
 	}
@@ -296,25 +746,21 @@ sfs_getroot(struct fs *fs, struct vnode **ret)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOTDIR_INO, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		kprintf("sfs: %s: getroot: Cannot load root vnode\n",
 			sfs->sfs_sb.sb_volname);
-		vfs_biglock_release();
 		return result;
 	}
 
+	/* The type never changes, so this needs no lock */
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
 		kprintf("sfs: %s: getroot: not directory (type %u)\n",
 			sfs->sfs_sb.sb_volname, sv->sv_i.sfi_type);
-		vfs_biglock_release();
+		VOP_DECREF(&sv->sv_absvn);
 		return EINVAL;
 	}
 
-	vfs_biglock_release();
-
 	*ret = &sv->sv_absvn;
 	return 0;
 }
@@ -34,10 +34,13 @@
  */
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/fcntl.h>
 #include <lib.h>
+#include <synch.h>
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <filecache.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -49,7 +52,8 @@
  * Note: sfs_readblock is used to read the superblock
  * early in mount, before sfs is fully (or even mostly)
  * initialized, and so may not use anything from sfs
- * except sfs_device.
+ * except sfs_device. (The buffer cache only uses the
+ * pointer as a key.)
  */
 
 /*
@@ -62,8 +66,6 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 	int result;
 	int tries=0;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	DEBUG(DB_SFS, "sfs: %s %llu\n",
 	      uio->uio_rw == UIO_READ ? "read" : "write",
 	      uio->uio_offset / SFS_BLOCKSIZE);
@@ -102,39 +104,272 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 }
 
 /*
- * Read a block.
+ * Read or write a block directly on the disk, bypassing the buffer
+ * cache. Only the cache itself should use this.
  */
 int
-sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+sfs_rawblock(struct sfs_fs *sfs, daddr_t block, void *data, enum uio_rw rw)
 {
 	struct iovec iov;
 	struct uio ku;
 
+	SFSUIO(&iov, &ku, data, block, rw);
+	return sfs_rwblock(sfs, &ku);
+}
+
+/*
+ * Read a block, through the buffer cache.
+ */
+int
+sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+{
+	struct sfs_buf *b;
+	int result;
+
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_READ);
-	return sfs_rwblock(sfs, &ku);
+	result = sfs_buf_read(sfs, block, &b);
+	if (result) {
+		return result;
+	}
+	memcpy(data, b->b_data, SFS_BLOCKSIZE);
+	sfs_buf_release(b);
+	return 0;
 }
 
 /*
- * Write a block.
+ * Write a metadata block. This only updates the buffer cache; the
+ * block goes to disk later, through the journal if there is one.
  */
 int
 sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct sfs_buf *b;
+	int result;
 
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
-	return sfs_rwblock(sfs, &ku);
+	result = sfs_buf_get(sfs, block, &b);
+	if (result) {
+		return result;
+	}
+	memcpy(b->b_data, data, SFS_BLOCKSIZE);
+	sfs_jdirty(b);
+	sfs_buf_release(b);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Delayed allocation
+
+/*
+ * A file being written sequentially doesn't get disk blocks for the
+ * new data right away. Instead the data goes into anonymous buffers
+ * (see sfs_buf_getanon) kept in sv_dabufs, which hold a run of up to
+ * SFS_DAMAX consecutive file blocks starting at sv_dafirst, and the
+ * free blocks they will need are reserved so placing them can't fail
+ * for lack of space. The run is placed on disk all at once, in one
+ * contiguous allocation where possible, when it fills up, when the
+ * file is written somewhere else, and when the file is synced or
+ * reclaimed. A file that is truncated or removed before then never
+ * touches the disk at all.
+ *
+ * Only blocks with nothing on disk yet (appends and holes) are
+ * delayed; overwrites of existing blocks go through the cache as
+ * usual. The file must be locked for all of this.
+ */
+
+/*
+ * Return the delayed buffer for file block FILEBLOCK, or NULL.
+ */
+static
+struct sfs_buf *
+sfs_da_find(struct sfs_vnode *sv, uint32_t fileblock)
+{
+	if (fileblock >= sv->sv_dafirst &&
+	    fileblock - sv->sv_dafirst < sv->sv_dacount) {
+		return sv->sv_dabufs[fileblock - sv->sv_dafirst];
+	}
+	return NULL;
+}
+
+/*
+ * Get a delayed buffer to write file block FILEBLOCK into, adding it
+ * to the run if it isn't there yet. Hands back NULL if the block
+ * should be written through the cache normally instead: because it
+ * is already on disk, or there is no room to delay it.
+ */
+static
+int
+sfs_da_get(struct sfs_vnode *sv, uint32_t fileblock, struct sfs_buf **ret)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *b;
+	daddr_t diskblock;
+	unsigned nreserve;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	*ret = sfs_da_find(sv, fileblock);
+	if (*ret != NULL) {
+		return 0;
+	}
+
+	result = sfs_bmap(sv, fileblock, false, &diskblock);
+	if (result) {
+		return result;
+	}
+	if (diskblock != 0) {
+		return 0;
+	}
+
+	/* Only a run of consecutive blocks is kept */
+	if (sv->sv_dacount > 0 &&
+	    (fileblock != sv->sv_dafirst + sv->sv_dacount ||
+	     sv->sv_dacount == SFS_DAMAX)) {
+		result = sfs_da_place(sv);
+		if (result) {
+			return result;
+		}
+		if (sv->sv_dacount > 0) {
+			return 0;
+		}
+	}
+
+	nreserve = sv->sv_dacount == 0 ? 1 + SFS_DASLACK : 1;
+	if (sfs_breserve(sfs, nreserve)) {
+		/* Let the normal path allocate or fail */
+		return 0;
+	}
+	if (sfs_buf_getanon(&b)) {
+		sfs_bunreserve(sfs, nreserve);
+		return 0;
+	}
+
+	if (sv->sv_dacount == 0) {
+		sv->sv_dafirst = fileblock;
+	}
+	sv->sv_dabufs[sv->sv_dacount++] = b;
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Give the delayed blocks of SV places on disk and move their data
+ * into the cache. Must be called inside a transaction. Blocks that
+ * can't be placed because of an error stay delayed.
+ */
+int
+sfs_da_place(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *b;
+	daddr_t diskblock;
+	unsigned i, j, placed;
+	int result = 0;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (sv->sv_dacount == 0) {
+		return 0;
+	}
+
+	sv->sv_daplacing = true;
+	for (i=0; i<sv->sv_dacount; i++) {
+		result = sfs_bmap(sv, sv->sv_dafirst + i, true, &diskblock);
+		if (result) {
+			break;
+		}
+		result = sfs_buf_get(sfs, diskblock, &b);
+		if (result) {
+			break;
+		}
+		memcpy(b->b_data, sv->sv_dabufs[i]->b_data, SFS_BLOCKSIZE);
+		sfs_buf_fdirty(b, sv);
+		sfs_buf_release(b);
+		sfs_buf_putanon(sv->sv_dabufs[i]);
+	}
+	sv->sv_daplacing = false;
+
+	/* Keep whatever is left */
+	placed = i;
+	for (j=0; placed + j < sv->sv_dacount; j++) {
+		sv->sv_dabufs[j] = sv->sv_dabufs[placed + j];
+	}
+	sv->sv_dafirst += placed;
+	sv->sv_dacount -= placed;
+
+	sfs_bunreserve(sfs, placed + (sv->sv_dacount == 0 ? SFS_DASLACK : 0));
+	return result;
+}
+
+/*
+ * Throw away the delayed blocks of SV from file block BLOCKLEN on,
+ * for truncation.
+ */
+void
+sfs_da_discard(struct sfs_vnode *sv, uint32_t blocklen)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	unsigned keep, i;
+
+	if (sv->sv_dacount == 0 ||
+	    blocklen >= sv->sv_dafirst + sv->sv_dacount) {
+		return;
+	}
+	keep = blocklen > sv->sv_dafirst ? blocklen - sv->sv_dafirst : 0;
+	for (i=keep; i<sv->sv_dacount; i++) {
+		sfs_buf_putanon(sv->sv_dabufs[i]);
+	}
+	sfs_bunreserve(sfs, (sv->sv_dacount - keep) +
+		       (keep == 0 ? SFS_DASLACK : 0));
+	sv->sv_dacount = keep;
 }
 
 ////////////////////////////////////////////////////////////
 //
 // File-level I/O
 
+/*
+ * Move LEN bytes between UIO and DATA, which holds those bytes of the
+ * file. What's written also goes to any pages of the file the VM
+ * system has cached (see filecache.h), so that mappings of it see it
+ * at once; except for the cache's own writebacks, which come from
+ * those pages in the first place.
+ */
+static
+int
+sfs_uiomove(struct sfs_vnode *sv, void *data, size_t len, struct uio *uio)
+{
+	off_t pos = uio->uio_offset;
+	int result;
+
+	result = uiomove(data, len, uio);
+	if (uio->uio_rw == UIO_WRITE && !uio->uio_nocache &&
+	    uio->uio_offset > pos) {
+		filecache_write(&sv->sv_absvn, pos, data,
+				uio->uio_offset - pos);
+	}
+	return result;
+}
+
+/*
+ * Read LEN bytes (within one block) from the VM system's pages of the
+ * file if it has them, so a mapped file isn't also cached in buffers.
+ * Returns ENOENT if it doesn't. Not for the cache's own reads.
+ */
+static
+int
+sfs_cacheread(struct sfs_vnode *sv, struct uio *uio, uint32_t len)
+{
+	if (uio->uio_rw != UIO_READ || uio->uio_nocache) {
+		return ENOENT;
+	}
+	return filecache_read(&sv->sv_absvn, uio, len);
+}
+
 /*
  * Do I/O to a block of a file that doesn't cover the whole block.  We
  * need to read in the original block first, even if we're writing, so
@@ -150,16 +385,8 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *b;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -169,12 +396,28 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
+	result = sfs_cacheread(sv, uio, len);
+	if (result != ENOENT) {
+		return result;
+	}
+
+	/* A block waiting for a place on disk is used as it is */
+	if (doalloc) {
+		result = sfs_da_get(sv, fileblock, &b);
+		if (result) {
+			return result;
+		}
+	}
+	else {
+		b = sfs_da_find(sv, fileblock);
+	}
+	if (b != NULL) {
+		return sfs_uiomove(sv, b->b_data + skipstart, len, uio);
+	}
+
 	/* Get the disk block number */
 	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
 	if (result) {
@@ -184,40 +427,39 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		return uiomovezeros(len, uio);
 	}
 
 	/*
-	 * Now perform the requested operation into/out of the buffer.
+	 * Get the block from the buffer cache and do the requested
+	 * operation into/out of it.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = sfs_buf_read(sfs, diskblock, &b);
 	if (result) {
 		return result;
 	}
+	result = sfs_uiomove(sv, b->b_data + skipstart, len, uio);
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * If it was a write, the buffer is now dirty, even if only
+	 * part of the data made it.
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		sfs_buf_fdirty(b, sv);
+	}
+	if ((sv->sv_noreuse || uio->uio_nocache) &&
+	    skipstart + len == SFS_BLOCKSIZE) {
+		/* Done with the block */
+		sfs_buf_release_cold(b);
+	}
+	else {
+		sfs_buf_release(b);
 	}
 
-	return 0;
+	return result;
 }
 
 /*
@@ -228,18 +470,33 @@ int
 sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *b;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
 	bool doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
 
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
+	/* As in sfs_partialio */
+	result = sfs_cacheread(sv, uio, SFS_BLOCKSIZE);
+	if (result != ENOENT) {
+		return result;
+	}
+	if (doalloc) {
+		result = sfs_da_get(sv, fileblock, &b);
+		if (result) {
+			return result;
+		}
+	}
+	else {
+		b = sfs_da_find(sv, fileblock);
+	}
+	if (b != NULL) {
+		return sfs_uiomove(sv, b->b_data, SFS_BLOCKSIZE, uio);
+	}
+
 	/* Look up the disk block number */
 	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
 	if (result) {
@@ -258,33 +515,466 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	}
 
 	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
+	 * Go through the buffer cache. If we're overwriting the
+	 * whole block, there's no need to read the old contents.
 	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
+	if (uio->uio_rw == UIO_READ) {
+		result = sfs_buf_read(sfs, diskblock, &b);
+	}
+	else {
+		result = sfs_buf_get(sfs, diskblock, &b);
+	}
+	if (result) {
+		return result;
+	}
+
+	result = sfs_uiomove(sv, b->b_data, SFS_BLOCKSIZE, uio);
 
 	/*
-	 * Temporarily set the residue to be one block size.
+	 * A failed write leaves a buffer that was already valid
+	 * partially updated, which is as good as a short write; a
+	 * fresh buffer with only part of the data in it is junk and
+	 * gets thrown away by sfs_buf_release.
 	 */
-	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
+	if (uio->uio_rw == UIO_WRITE && (result == 0 || b->b_valid)) {
+		sfs_buf_fdirty(b, sv);
+	}
+	if (sv->sv_noreuse || uio->uio_nocache) {
+		sfs_buf_release_cold(b);
+	}
+	else {
+		sfs_buf_release(b);
+	}
 
-	result = sfs_rwblock(sfs, uio);
+	return result;
+}
 
-	/*
-	 * Now, restore the original uio_offset and uio_resid and update
-	 * them by the amount of I/O done.
-	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+/*
+ * O_DIRECT. The whole blocks of an O_DIRECT read or write go straight
+ * between the caller's buffer and the disk, each run of blocks that
+ * are consecutive on disk in one device request, so that a bulk copy
+ * gets the disk's bandwidth without pushing everyone else's blocks
+ * out of the buffer cache.
+ *
+ * A block the cache already has is read or written there instead, as
+ * the cache's copy may be newer than the disk's; so are holes being
+ * read and blocks waiting for a place on disk (see sfs_da_get). Once
+ * the file is locked nothing else can bring one of its blocks into
+ * the cache, except read-ahead, and sfs_buf_forget throws away any
+ * of that under way before a block is written.
+ *
+ * A block allocated for the write starts out as zeros in the cache
+ * (see sfs_balloc), which is forgotten before the write like anything
+ * else. If the write then fails, the block is zeroed again, so that
+ * what was on the disk before doesn't show through.
+ *
+ * A file the VM system has pages of (see filecache.h) does no direct
+ * I/O at all, so that the pages and the disk can't disagree.
+ */
+#define SFS_DIRECTMAX	128	/* most blocks in one device request */
 
+/*
+ * Find the run of file blocks from FILEBLOCK, at most NBLOCKS of them,
+ * that can be done in one direct device request, and where it starts
+ * on disk. If writing, holes are allocated, and the run is either
+ * all new blocks or all old ones, as *FRESH says. A *RUN of 0 means
+ * FILEBLOCK is to go through the cache.
+ */
+static
+int
+sfs_directrun(struct sfs_vnode *sv, uint32_t fileblock, uint32_t nblocks,
+	      bool write, daddr_t *diskblock, uint32_t *run, bool *fresh)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t block;
+	uint32_t i;
+	bool isnew;
+	int result;
+
+	if (nblocks > SFS_DIRECTMAX) {
+		nblocks = SFS_DIRECTMAX;
+	}
+
+	*run = 0;
+	for (i=0; i<nblocks; i++) {
+		if (sfs_da_find(sv, fileblock + i) != NULL) {
+			break;
+		}
+		result = sfs_bmap(sv, fileblock + i, false, &block);
+		isnew = false;
+		if (result == 0 && block == 0 && write) {
+			result = sfs_bmap(sv, fileblock + i, true, &block);
+			isnew = true;
+		}
+		if (result) {
+			/* Do what there is; the error comes back next time */
+			return i > 0 ? 0 : result;
+		}
+		if (block == 0) {
+			/* Hole, being read */
+			break;
+		}
+		if (i == 0) {
+			*diskblock = block;
+			*fresh = isnew;
+		}
+		else if (block != *diskblock + i || isnew != *fresh) {
+			break;
+		}
+		if (!isnew && sfs_buf_cached(sfs, block)) {
+			break;
+		}
+		*run = i + 1;
+	}
+	return 0;
+}
+
+/*
+ * Do NBLOCKS whole blocks of O_DIRECT I/O at UIO's offset.
+ */
+static
+int
+sfs_directio(struct sfs_vnode *sv, struct uio *uio, uint32_t nblocks)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	bool write = (uio->uio_rw == UIO_WRITE);
+	struct sfs_buf *b;
+	struct uio du;
+	daddr_t diskblock;
+	uint32_t run, i;
+	size_t len, done;
+	bool fresh;
+	int result;
+
+	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
+
+	while (nblocks > 0) {
+		result = sfs_directrun(sv, uio->uio_offset / SFS_BLOCKSIZE,
+				       nblocks, write, &diskblock, &run,
+				       &fresh);
+		if (result) {
+			return result;
+		}
+		if (run == 0) {
+			result = sfs_blockio(sv, uio);
+			if (result) {
+				return result;
+			}
+			nblocks--;
+			continue;
+		}
+
+		if (write) {
+			for (i=0; i<run; i++) {
+				sfs_buf_forget(sfs, diskblock + i);
+			}
+		}
+
+		/* The same buffers, but the disk's offset */
+		len = run * SFS_BLOCKSIZE;
+		du = *uio;
+		du.uio_offset = (off_t)diskblock * SFS_BLOCKSIZE;
+		du.uio_resid = len;
+		result = sfs_rwblock(sfs, &du);
+		done = len - du.uio_resid;
+		uio->uio_iov = du.uio_iov;
+		uio->uio_iovcnt = du.uio_iovcnt;
+		uio->uio_offset += done;
+		uio->uio_resid -= done;
+
+		if (result) {
+			for (i=0; write && fresh && i<run; i++) {
+				if (sfs_buf_get(sfs, diskblock + i, &b)) {
+					continue;
+				}
+				bzero(b->b_data, SFS_BLOCKSIZE);
+				sfs_buf_fdirty(b, sv);
+				sfs_buf_release(b);
+			}
+			return result;
+		}
+		nblocks -= run;
+	}
+	return 0;
+}
+
+/*
+ * Read-ahead. A file being read sequentially (each read starting in
+ * the last block of the previous read, or the one after it) has the
+ * blocks past its current read queued for the cache, with a window
+ * that starts at SFS_RA_MINWINDOW blocks and doubles up to
+ * SFS_RA_MAXWINDOW for as long as the pattern holds. Any other read
+ * drops the window back to nothing.
+ *
+ * SV_RANEXT remembers how far has already been asked for, so each
+ * read only queues the blocks the window has newly grown over.
+ *
+ * fadvise() can override the guessing (see sfs_advise below): after
+ * FADV_SEQUENTIAL every read counts as sequential and the window
+ * opens at its largest; after FADV_RANDOM nothing is read ahead,
+ * which saves a reader that goes backwards through the file (tac,
+ * tail) from pulling in blocks past the ones it's already done with.
+ */
+#define SFS_RA_MINWINDOW	4
+#define SFS_RA_MAXWINDOW	32
+
+static
+void
+sfs_readahead(struct sfs_vnode *sv, uint32_t startblk, uint32_t endblk)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t fileblks, fileblock, lastblk;
+	daddr_t diskblock;
+	int result;
+
+	if (sv->sv_raadvice == FADV_RANDOM) {
+		sv->sv_ralast = endblk;
+		return;
+	}
+	if (sv->sv_raadvice == FADV_SEQUENTIAL) {
+		sv->sv_rawindow = SFS_RA_MAXWINDOW;
+	}
+	else if (startblk != sv->sv_ralast && startblk != sv->sv_ralast + 1) {
+		/* Not sequential */
+		sv->sv_ralast = endblk;
+		sv->sv_ranext = 0;
+		sv->sv_rawindow = 0;
+		return;
+	}
+	sv->sv_ralast = endblk;
+
+	if (sv->sv_rawindow == 0) {
+		sv->sv_rawindow = SFS_RA_MINWINDOW;
+	}
+	else if (sv->sv_rawindow < SFS_RA_MAXWINDOW) {
+		sv->sv_rawindow *= 2;
+	}
+
+	fileblks = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+	lastblk = endblk + sv->sv_rawindow;
+	if (lastblk >= fileblks) {
+		lastblk = fileblks - 1;
+	}
+	fileblock = endblk + 1;
+	if (fileblock < sv->sv_ranext) {
+		fileblock = sv->sv_ranext;
+	}
+	for (; fileblock <= lastblk; fileblock++) {
+		result = sfs_bmap(sv, fileblock, false, &diskblock);
+		if (result) {
+			break;
+		}
+		if (diskblock != 0) {
+			/* Not a hole */
+			sfs_buf_readahead(sfs, diskblock);
+		}
+	}
+	sv->sv_ranext = fileblock;
+}
+
+/*
+ * Take advice from fadvise() (via sfs_ioctl). The access pattern and
+ * FADV_NOREUSE are kept in the vnode for sfs_readahead and the data
+ * I/O functions above; FADV_WILLNEED queues read-ahead for the start
+ * of the range, as much as one full window; and FADV_DONTNEED makes
+ * the range's cached blocks the next to be recycled. Blocks not yet
+ * given a place on disk, or kept in the inode, are left alone.
+ */
+int
+sfs_advise(struct sfs_vnode *sv, const struct vnode_advice *va)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t fileblks, fileblock, lastblk;
+	daddr_t diskblock;
+	off_t end;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	switch (va->va_advice) {
+	    case FADV_NORMAL:
+		sv->sv_noreuse = false;
+		/* fall through */
+	    case FADV_SEQUENTIAL:
+	    case FADV_RANDOM:
+		sv->sv_raadvice = va->va_advice;
+		sv->sv_ranext = 0;
+		sv->sv_rawindow = 0;
+		return 0;
+	    case FADV_NOREUSE:
+		sv->sv_noreuse = true;
+		return 0;
+	    case FADV_WILLNEED:
+	    case FADV_DONTNEED:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (sv->sv_i.sfi_flags & SFS_IFLAG_INLINE) {
+		return 0;
+	}
+	fileblks = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+	end = va->va_offset + va->va_len;
+	if (va->va_len == 0 || end > (off_t)sv->sv_i.sfi_size) {
+		end = sv->sv_i.sfi_size;
+	}
+	if (va->va_offset >= end) {
+		return 0;
+	}
+	fileblock = va->va_offset / SFS_BLOCKSIZE;
+	lastblk = (end - 1) / SFS_BLOCKSIZE;
+	KASSERT(lastblk < fileblks);
+	if (va->va_advice == FADV_WILLNEED &&
+	    lastblk - fileblock >= SFS_RA_MAXWINDOW) {
+		lastblk = fileblock + SFS_RA_MAXWINDOW - 1;
+	}
+
+	for (; fileblock <= lastblk; fileblock++) {
+		result = sfs_bmap(sv, fileblock, false, &diskblock);
+		if (result) {
+			return result;
+		}
+		if (diskblock == 0) {
+			continue;
+		}
+		if (va->va_advice == FADV_WILLNEED) {
+			sfs_buf_readahead(sfs, diskblock);
+		}
+		else {
+			sfs_buf_cool(sfs, diskblock);
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Inline data
+
+/*
+ * A regular file of up to SFS_INLINESIZE bytes keeps its data in the
+ * inode (see kern/sfs.h), so it takes no data block and reading it
+ * needs nothing past the inode block. A file goes inline when a write
+ * that fits is made to it while it's empty, and is moved out to an
+ * ordinary block by sfs_inline_evict once it outgrows the inode.
+ * Inline data is written with the inode, so it goes through the
+ * journal with it.
+ */
+
+/*
+ * Check if an empty file can start keeping its data inline: it must
+ * not have any blocks, which it might if a write failed partway.
+ */
+static
+bool
+sfs_inline_ok(struct sfs_vnode *sv)
+{
+	unsigned i;
+
+	if (sv->sv_i.sfi_type != SFS_TYPE_FILE || sv->sv_i.sfi_size != 0 ||
+	    sv->sv_dacount != 0) {
+		return false;
+	}
+	for (i=0; i<SFS_NDIRECT; i++) {
+		if (sv->sv_i.sfi_direct[i] != 0) {
+			return false;
+		}
+	}
+	return sv->sv_i.sfi_indirect == 0 && sv->sv_i.sfi_dindirect == 0 &&
+		sv->sv_i.sfi_tindirect == 0;
+}
+
+/*
+ * Read or write an inline file. A write must fit in the inode.
+ */
+static
+int
+sfs_inline_io(struct sfs_vnode *sv, struct uio *uio)
+{
+	off_t size = sv->sv_i.sfi_size;
+	size_t len, extraresid;
+	int result;
+
+	KASSERT(sv->sv_i.sfi_flags & SFS_IFLAG_INLINE);
+
+	if (uio->uio_rw == UIO_READ) {
+		if (uio->uio_offset >= size) {
+			return 0;
+		}
+		len = uio->uio_resid;
+		if (uio->uio_offset + len > size) {
+			len = size - uio->uio_offset;
+		}
+	}
+	else {
+		KASSERT(uio->uio_offset + uio->uio_resid <= SFS_INLINESIZE);
+		len = uio->uio_resid;
+	}
+
+	extraresid = uio->uio_resid - len;
+	uio->uio_resid = len;
+	result = sfs_uiomove(sv, sv->sv_i.sfi_inline + uio->uio_offset, len,
+			     uio);
+
+	if (uio->uio_rw == UIO_WRITE && uio->uio_resid != len) {
+		if (uio->uio_offset > size) {
+			sv->sv_i.sfi_size = uio->uio_offset;
+		}
+		sv->sv_dirty = true;
+	}
+
+	uio->uio_resid += extraresid;
 	return result;
 }
 
+/*
+ * Move the data of an inline file out of the inode into a block,
+ * making it an ordinary file. The vnode must be locked.
+ */
+int
+sfs_inline_evict(struct sfs_vnode *sv)
+{
+	struct iovec iov;
+	struct uio ku;
+	uint32_t size = sv->sv_i.sfi_size;
+	char *data;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+	KASSERT(sv->sv_i.sfi_flags & SFS_IFLAG_INLINE);
+
+	data = kmalloc(SFS_INLINESIZE);
+	if (data == NULL) {
+		return ENOMEM;
+	}
+	memcpy(data, sv->sv_i.sfi_inline, SFS_INLINESIZE);
+
+	sv->sv_i.sfi_flags &= ~SFS_IFLAG_INLINE;
+	bzero(sv->sv_i.sfi_inline, SFS_INLINESIZE);
+	sv->sv_dirty = true;
+
+	if (size > 0) {
+		uio_kinit(&iov, &ku, data, size, 0, UIO_WRITE);
+		result = sfs_io(sv, &ku);
+		if (result == 0 && ku.uio_resid > 0) {
+			result = ENOSPC;
+		}
+		if (result) {
+			/* Put it back the way it was */
+			sfs_itrunc(sv, 0);
+			sv->sv_i.sfi_flags |= SFS_IFLAG_INLINE;
+			memcpy(sv->sv_i.sfi_inline, data, SFS_INLINESIZE);
+			sv->sv_i.sfi_size = size;
+			kfree(data);
+			return result;
+		}
+	}
+
+	kfree(data);
+	return 0;
+}
+
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
  */
@@ -295,8 +985,32 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	uint32_t nblocks, i;
 	int result = 0;
 	uint32_t origresid, extraresid = 0;
+	uint32_t startblk = 0, endblk = 0;
+	bool direct;
+
+	/* Small files are kept in the inode */
+	if (uio->uio_rw == UIO_WRITE && uio->uio_resid > 0) {
+		off_t endpos = uio->uio_offset + uio->uio_resid;
+
+		if (sv->sv_i.sfi_flags & SFS_IFLAG_INLINE) {
+			if (endpos > SFS_INLINESIZE) {
+				result = sfs_inline_evict(sv);
+				if (result) {
+					return result;
+				}
+			}
+		}
+		else if (endpos <= SFS_INLINESIZE && sfs_inline_ok(sv)) {
+			sv->sv_i.sfi_flags |= SFS_IFLAG_INLINE;
+			sv->sv_dirty = true;
+		}
+	}
+	if (sv->sv_i.sfi_flags & SFS_IFLAG_INLINE) {
+		return sfs_inline_io(sv, uio);
+	}
 
 	origresid = uio->uio_resid;
+	direct = uio->uio_direct && sv->sv_absvn.vn_filecache == NULL;
 
 	/*
 	 * If reading, check for EOF. If we can read a partial area,
@@ -317,6 +1031,9 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 			KASSERT(uio->uio_resid > extraresid);
 			uio->uio_resid -= extraresid;
 		}
+
+		startblk = uio->uio_offset / SFS_BLOCKSIZE;
+		endblk = (uio->uio_offset + uio->uio_resid - 1) / SFS_BLOCKSIZE;
 	}
 
 	/*
@@ -352,7 +1069,13 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	 */
 	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
 	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
-	for (i=0; i<nblocks; i++) {
+	if (direct) {
+		result = sfs_directio(sv, uio, nblocks);
+		if (result) {
+			goto out;
+		}
+	}
+	for (i=0; !direct && i<nblocks; i++) {
 		result = sfs_blockio(sv, uio);
 		if (result) {
 			goto out;
@@ -381,6 +1104,12 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 		sv->sv_dirty = true;
 	}
 
+	/* Queue the blocks a sequential reader will want next */
+	if (result == 0 && uio->uio_rw == UIO_READ && origresid > 0 &&
+	    !direct) {
+		sfs_readahead(sv, startblk, endblk);
+	}
+
 	/* Add in any extra amount we couldn't read because of EOF */
 	uio->uio_resid += extraresid;
 
@@ -397,16 +1126,16 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
  * handled are smaller than whole blocks, do not cross block
  * boundaries, and originate in the kernel.
  *
- * It is separate from sfs_partialio because, although there is no
- * such code in this version of SFS, it is often desirable when doing
- * more advanced things to handle metadata and user data I/O
- * differently.
+ * It is separate from sfs_partialio because metadata and user data
+ * I/O are handled differently: metadata writes go through the
+ * journal.
  */
 int
 sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	   enum uio_rw rw)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *b;
 	off_t endpos;
 	uint32_t vnblock;
 	uint32_t blockoffset;
@@ -414,18 +1143,6 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	bool doalloc;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
-
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Figure out which block of the vnode (directory, whatever) this is */
 	vnblock = actualpos / SFS_BLOCKSIZE;
 	blockoffset = actualpos % SFS_BLOCKSIZE;
@@ -446,26 +1163,22 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		return 0;
 	}
 
-	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	/* Get the block */
+	result = sfs_buf_read(sfs, diskblock, &b);
 	if (result) {
 		return result;
 	}
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
-		memcpy(data, metaiobuf + blockoffset, len);
+		memcpy(data, b->b_data + blockoffset, len);
+		sfs_buf_release(b);
 	}
 	else {
 		/* Update the selected region */
-		memcpy(metaiobuf + blockoffset, data, len);
-
-		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
-		if (result) {
-			return result;
-		}
+		memcpy(b->b_data + blockoffset, data, len);
+		sfs_jfdirty(b, sv);
+		sfs_buf_release(b);
 
 		/* Update the vnode size if needed */
 		endpos = actualpos + len;
@@ -0,0 +1,1110 @@
+/*
+ * SFS metadata journal.
+ *
+ * Volumes made by mksfs have a journal region (see kern/sfs.h), and
+ * every change to metadata (inodes, indirect blocks, directory
+ * blocks, the freemap, the superblock) is made inside a transaction,
+ * between sfs_txn_begin and sfs_txn_end. Metadata buffers are marked
+ * dirty with sfs_jdirty, which ties them to the running transaction;
+ * the buffer cache then won't write them home until the journal has
+ * logged them. File data is not journaled, and can reach the disk
+ * before or after the metadata that points to it.
+ *
+ * Transactions are not committed one by one. All of those begun
+ * since the last commit make up a single compound transaction, which
+ * is committed (group commit) every sfs_journal_interval seconds by a
+ * thread of the volume's own, on sync and fsync, on unmount, and when
+ * it has got big enough that it is taking up too much of the buffer
+ * cache. A commit waits for the transactions in progress to end and
+ * holds off new ones, so that what it logs is consistent; it then
+ * copies the in-memory freemap into the freemap buffers (which are
+ * kept pinned for this), and writes the images of all the buffers the
+ * compound transaction changed to the journal in one sequential run,
+ * followed by a commit record. After that the buffers are ordinary
+ * dirty buffers and are written home in the usual way.
+ *
+ * If the disk can queue requests, the whole run is queued at once,
+ * with the commit record as a DR_ORDERED request tagged for this
+ * volume, so the disk writes the log blocks back to back and the
+ * commit record right after them, and the commit waits for one
+ * dependent write rather than a round trip per block. Other I/O to
+ * the disk is not held up. If any of it fails, the run is written
+ * again one block at a time; a commit record that got to the disk
+ * after a failed log block doesn't match its checksum, so recovery
+ * ignores it.
+ *
+ * When the journal is full, it is checkpointed: every dirty buffer of
+ * the volume is written home, and the header is updated to say the
+ * log is empty. (This is also done on unmount, so a clean volume has
+ * an empty journal.) A block that was logged since the last
+ * checkpoint and is then freed is recorded in a revoke record, so
+ * that after a crash its old image isn't replayed over whatever it
+ * has been reused for since.
+ *
+ * On mount, the committed transactions in the log are replayed by
+ * writing their images to their home locations, in order, before
+ * anything else is read from the volume. What's left is the volume
+ * as of the last commit, save that blocks reserved ahead for growing
+ * files (see sfs_balloc_file) may stay marked in use without being
+ * used; sfsck can reclaim those, but there is no need to run it.
+ *
+ * Because a commit waits for the transactions in progress, a thread
+ * must begin its transaction before it takes any vnode lock or
+ * sfs_vnlock, must not begin a second one inside the first, and must
+ * not drop a vnode reference (which may reclaim it, which begins a
+ * transaction) before ending it. Otherwise it could wait for a lock
+ * held by a thread that is waiting for the commit that is waiting
+ * for it.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <wchan.h>
+#include <thread.h>
+#include <uio.h>
+#include <device.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/* Commit early once a transaction is holding this many buffers */
+#define SFS_JCOMMIT_BUFS	(SFS_NBUFS / 4)
+
+/*
+ * Smallest journal we'll use: the header, plus the largest possible
+ * commit (every buffer in the cache, with its descriptors, a revoke
+ * record, and the commit record).
+ */
+#define SFS_JMIN_BLOCKS \
+	(1 + SFS_NBUFS + DIVROUNDUP(SFS_NBUFS, SFS_JDESC_NENT) + 2)
+
+/* Most blocks one commit writes, and how many of them aren't images */
+#define SFS_JMAXWRITE	(SFS_JMIN_BLOCKS - 1)
+#define SFS_JMAXDESC	(DIVROUNDUP(SFS_NBUFS, SFS_JDESC_NENT) + 2)
+
+unsigned sfs_journal_interval = 1;
+
+/* Device request tags for commits; see sfs_journal_mount */
+static unsigned sfs_jlasttag;
+
+/* A revoke record found during recovery */
+struct sfs_jrevoke {
+	daddr_t jr_block;
+	uint32_t jr_seq;
+};
+
+struct sfs_journal {
+	daddr_t j_start;		/* first block (the header) */
+	unsigned j_nblocks;		/* size, header included */
+	unsigned j_tail;		/* next free block, from j_start */
+	uint32_t j_seq;			/* running transaction */
+
+	struct lock *j_lock;		/* covers the rest */
+	struct cv *j_cv;		/* active or committing changed */
+	unsigned j_active;		/* transactions in progress */
+	bool j_committing;		/* a commit is in progress */
+	unsigned j_nbufs;		/* buffers held; may overcount */
+	unsigned j_nrevoke;		/* entries in j_revoke */
+	daddr_t j_revoke[SFS_JDESC_NENT]; /* freed by j_seq */
+	bool j_needckpt;		/* j_revoke overflowed */
+	struct bitmap *j_logged;	/* blocks logged since checkpoint */
+	bool j_exiting;			/* commit thread should stop */
+	bool j_threadrunning;		/* commit thread is running */
+
+	/* Used only by whoever is committing (or mounting) */
+	struct sfs_buf *j_bufs[SFS_NBUFS];	/* buffers being logged */
+	struct sfs_buf **j_fmbufs;	/* freemap buffers, kept pinned */
+	unsigned j_nfmbufs;
+	void *j_block;			/* scratch block */
+	void *j_image;			/* another, for recovery */
+	void *j_descs;			/* SFS_JMAXDESC blocks, for commit */
+	void *j_wdata[SFS_JMAXWRITE];	/* what a commit writes, in order */
+
+	/* Queued commit writes; j_reqs is NULL if the disk can't */
+	struct devreq *j_reqs;		/* SFS_JMAXWRITE of them */
+	unsigned j_tag;			/* dr_tag for this volume */
+	uint32_t j_devper;		/* device blocks per block */
+	struct spinlock j_iolock;	/* for the next three */
+	struct wchan *j_iowchan;	/* waiting for j_ioleft to drain */
+	unsigned j_ioleft;		/* requests not yet done */
+	int j_ioerr;			/* first error from one */
+};
+
+static void sfs_journal_thread(void *, unsigned long);
+
+/*
+ * Checksum a block into SUM.
+ */
+static
+uint32_t
+sfs_jsum(uint32_t sum, const void *block)
+{
+	const uint32_t *words = block;
+	unsigned i;
+
+	for (i=0; i<SFS_BLOCKSIZE / sizeof(uint32_t); i++) {
+		sum = SFS_JSUM(sum, words[i]);
+	}
+	return sum;
+}
+
+/*
+ * Read or write block POS of the journal.
+ */
+static
+int
+sfs_jio(struct sfs_fs *sfs, unsigned pos, void *data, enum uio_rw rw)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+
+	KASSERT(pos < j->j_nblocks);
+	return sfs_rawblock(sfs, j->j_start + pos, data, rw);
+}
+
+/*
+ * Write the journal header, saying the log starts with SEQ.
+ */
+static
+int
+sfs_jwriteheader(struct sfs_fs *sfs, uint32_t seq)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jheader *jh = j->j_block;
+
+	COMPILE_ASSERT(sizeof(struct sfs_jheader) == SFS_BLOCKSIZE);
+
+	bzero(jh, sizeof(*jh));
+	jh->jh_magic = SFS_JMAGIC;
+	jh->jh_seq = seq;
+	return sfs_jio(sfs, 0, jh, UIO_WRITE);
+}
+
+/*
+ * Next transaction number. 0 means "none" in b_jseq, so skip it.
+ */
+static
+uint32_t
+sfs_jnextseq(uint32_t seq)
+{
+	seq++;
+	return seq == 0 ? 1 : seq;
+}
+
+////////////////////////////////////////////////////////////
+// Recovery
+
+/*
+ * Walk the transaction starting at block *POS of the log, which
+ * should be number SEQ, and check that it is complete. If it is, move
+ * *POS past it and return true. If REPLAY is set, also write its
+ * images home, except those revoked by later transactions; otherwise
+ * add its revoke records to *REVOKES.
+ */
+static
+bool
+sfs_jwalk(struct sfs_fs *sfs, unsigned *pos, uint32_t seq, bool replay,
+	  struct sfs_jrevoke **revokes, unsigned *nrevokes,
+	  unsigned *maxrevokes, int *err)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jdesc *jd = j->j_block;
+	struct sfs_jrevoke *newrevokes;
+	unsigned p, k, r;
+	uint32_t sum;
+	bool revoked;
+
+	*err = 0;
+	p = *pos;
+	sum = 0;
+	while (p < j->j_nblocks) {
+		*err = sfs_jio(sfs, p, jd, UIO_READ);
+		if (*err) {
+			return false;
+		}
+		if (jd->jd_magic != SFS_JMAGIC || jd->jd_seq != seq) {
+			return false;
+		}
+		if (jd->jd_type == SFS_JDESC_COMMIT) {
+			if (jd->jd_count != p - *pos || jd->jd_sum != sum) {
+				return false;
+			}
+			*pos = p + 1;
+			return true;
+		}
+		if (jd->jd_count > SFS_JDESC_NENT) {
+			return false;
+		}
+		sum = sfs_jsum(sum, jd);
+		p++;
+
+		if (jd->jd_type == SFS_JDESC_REVOKE) {
+			if (replay) {
+				continue;
+			}
+			for (k=0; k<jd->jd_count; k++) {
+				if (*nrevokes == *maxrevokes) {
+					*maxrevokes = *maxrevokes ?
+						*maxrevokes * 2 : 64;
+					newrevokes = kmalloc(*maxrevokes *
+							     sizeof(**revokes));
+					if (newrevokes == NULL) {
+						*err = ENOMEM;
+						return false;
+					}
+					if (*nrevokes > 0) {
+						memcpy(newrevokes, *revokes,
+						       *nrevokes *
+						       sizeof(**revokes));
+					}
+					kfree(*revokes);
+					*revokes = newrevokes;
+				}
+				(*revokes)[*nrevokes].jr_block =
+					jd->jd_blocks[k];
+				(*revokes)[*nrevokes].jr_seq = seq;
+				(*nrevokes)++;
+			}
+			continue;
+		}
+		if (jd->jd_type != SFS_JDESC_BLOCKS) {
+			return false;
+		}
+
+		for (k=0; k<jd->jd_count; k++) {
+			if (p >= j->j_nblocks ||
+			    jd->jd_blocks[k] >= sfs->sfs_sb.sb_nblocks) {
+				return false;
+			}
+			*err = sfs_jio(sfs, p, j->j_image, UIO_READ);
+			if (*err) {
+				return false;
+			}
+			sum = sfs_jsum(sum, j->j_image);
+			p++;
+			if (!replay) {
+				continue;
+			}
+			revoked = false;
+			for (r=0; r<*nrevokes; r++) {
+				if ((*revokes)[r].jr_block == jd->jd_blocks[k]
+				    && (*revokes)[r].jr_seq > seq) {
+					revoked = true;
+					break;
+				}
+			}
+			if (!revoked) {
+				*err = sfs_rawblock(sfs, jd->jd_blocks[k],
+						    j->j_image, UIO_WRITE);
+				if (*err) {
+					return false;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+/*
+ * Replay the log. The first pass finds how many transactions are
+ * complete and collects their revoke records; the second writes them
+ * home.
+ */
+static
+int
+sfs_jreplay(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jheader *jh = j->j_block;
+	struct sfs_jrevoke *revokes = NULL;
+	unsigned nrevokes = 0, maxrevokes = 0, txnrevokes;
+	unsigned pos, ntxns, i;
+	uint32_t firstseq, seq;
+	int result;
+
+	result = sfs_jio(sfs, 0, jh, UIO_READ);
+	if (result) {
+		return result;
+	}
+	if (jh->jh_magic != SFS_JMAGIC) {
+		kprintf("sfs: %s: bad journal header; ignoring the journal\n",
+			sfs->sfs_sb.sb_volname);
+		j->j_seq = 1;
+		return sfs_jwriteheader(sfs, j->j_seq);
+	}
+	firstseq = jh->jh_seq == 0 ? 1 : jh->jh_seq;
+
+	pos = 1;
+	ntxns = 0;
+	for (seq = firstseq; ; seq = sfs_jnextseq(seq)) {
+		txnrevokes = nrevokes;
+		if (!sfs_jwalk(sfs, &pos, seq, false, &revokes, &nrevokes,
+			       &maxrevokes, &result)) {
+			/* Drop whatever the incomplete one added */
+			nrevokes = txnrevokes;
+			break;
+		}
+		ntxns++;
+	}
+	if (result) {
+		kfree(revokes);
+		return result;
+	}
+
+	pos = 1;
+	seq = firstseq;
+	for (i=0; i<ntxns; i++) {
+		if (!sfs_jwalk(sfs, &pos, seq, true, &revokes, &nrevokes,
+			       &maxrevokes, &result)) {
+			kfree(revokes);
+			return result ? result : EIO;
+		}
+		seq = sfs_jnextseq(seq);
+	}
+	kfree(revokes);
+
+	if (ntxns > 0) {
+		kprintf("sfs: %s: replayed %u journal transaction%s\n",
+			sfs->sfs_sb.sb_volname, ntxns, ntxns == 1 ? "" : "s");
+	}
+
+	/* Everything replayed is home now; empty the log */
+	j->j_seq = seq;
+	return sfs_jwriteheader(sfs, j->j_seq);
+}
+
+/*
+ * Set up the journal of a volume being mounted and replay it. Called
+ * after the superblock has been read and before anything else is.
+ * If anything was replayed, the superblock is read again.
+ */
+int
+sfs_journal_mount(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j;
+	uint32_t start, nblocks;
+	int result;
+
+	start = sfs->sfs_sb.sb_journalstart;
+	nblocks = sfs->sfs_sb.sb_journalblocks;
+	if (nblocks == 0) {
+		/* Made before there were journals */
+		return 0;
+	}
+	if (start <= SFS_FREEMAP_START || start >= sfs->sfs_sb.sb_nblocks ||
+	    nblocks > sfs->sfs_sb.sb_nblocks - start) {
+		kprintf("sfs: %s: journal (%u blocks at %u) is not "
+			"within the volume\n", sfs->sfs_sb.sb_volname,
+			nblocks, start);
+		return EINVAL;
+	}
+	if (nblocks < SFS_JMIN_BLOCKS) {
+		kprintf("sfs: %s: journal has %u blocks; need at least %u\n",
+			sfs->sfs_sb.sb_volname, nblocks, SFS_JMIN_BLOCKS);
+		return EINVAL;
+	}
+
+	j = kmalloc(sizeof(*j));
+	if (j == NULL) {
+		return ENOMEM;
+	}
+	j->j_start = start;
+	j->j_nblocks = nblocks;
+	j->j_tail = 1;
+	j->j_seq = 1;
+	j->j_active = 0;
+	j->j_committing = false;
+	j->j_nbufs = 0;
+	j->j_nrevoke = 0;
+	j->j_needckpt = false;
+	j->j_exiting = false;
+	j->j_threadrunning = false;
+	j->j_fmbufs = NULL;
+	j->j_nfmbufs = 0;
+	j->j_lock = NULL;
+	j->j_cv = NULL;
+	j->j_logged = NULL;
+	j->j_block = NULL;
+	j->j_image = NULL;
+	j->j_descs = NULL;
+	j->j_reqs = NULL;
+	j->j_iowchan = NULL;
+	spinlock_init(&j->j_iolock);
+	j->j_ioleft = 0;
+	j->j_ioerr = 0;
+	sfs->sfs_journal = j;
+
+	/*
+	 * Commits are queued if the disk can, each volume with its own
+	 * tag so that they're only ordered against their own writes.
+	 * (Mounting is done holding vfs_biglock, so sfs_jlasttag is
+	 * safe.)
+	 */
+	if (sfs->sfs_device->d_ops->devop_strategy != NULL &&
+	    SFS_BLOCKSIZE % sfs->sfs_device->d_blocksize == 0) {
+		j->j_reqs = kmalloc(SFS_JMAXWRITE * sizeof(*j->j_reqs));
+		j->j_iowchan = wchan_create("sfs_jio");
+		if (j->j_reqs == NULL || j->j_iowchan == NULL) {
+			sfs_journal_destroy(sfs);
+			return ENOMEM;
+		}
+		j->j_devper = SFS_BLOCKSIZE / sfs->sfs_device->d_blocksize;
+		sfs_jlasttag++;
+		if (sfs_jlasttag == 0) {
+			sfs_jlasttag++;
+		}
+		j->j_tag = sfs_jlasttag;
+	}
+
+	j->j_block = kmalloc(SFS_BLOCKSIZE);
+	j->j_image = kmalloc(SFS_BLOCKSIZE);
+	j->j_descs = kmalloc(SFS_JMAXDESC * SFS_BLOCKSIZE);
+	j->j_lock = lock_create("sfs_journal");
+	j->j_cv = cv_create("sfs_journal");
+	j->j_logged = bitmap_create(sfs->sfs_sb.sb_nblocks);
+	if (j->j_block == NULL || j->j_image == NULL || j->j_descs == NULL ||
+	    j->j_lock == NULL || j->j_cv == NULL || j->j_logged == NULL) {
+		sfs_journal_destroy(sfs);
+		return ENOMEM;
+	}
+
+	result = sfs_jreplay(sfs);
+	if (result) {
+		kprintf("sfs: %s: journal recovery failed: %s\n",
+			sfs->sfs_sb.sb_volname, strerror(result));
+		sfs_journal_destroy(sfs);
+		return result;
+	}
+
+	/* The cache may have old copies of replayed blocks */
+	sfs_buf_invalidate(sfs);
+	result = sfs_readblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
+			       sizeof(sfs->sfs_sb));
+	if (result) {
+		sfs_journal_destroy(sfs);
+		return result;
+	}
+	sfs->sfs_sb.sb_volname[sizeof(sfs->sfs_sb.sb_volname)-1] = 0;
+	return 0;
+}
+
+/*
+ * Start journaling on a volume that has finished mounting: pin the
+ * freemap buffers and start the commit thread.
+ */
+int
+sfs_journal_start(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	unsigned i, n;
+	int result;
+
+	if (j == NULL) {
+		return 0;
+	}
+
+	n = SFS_FREEMAPBLOCKS(sfs->sfs_sb.sb_nblocks);
+	j->j_fmbufs = kmalloc(n * sizeof(*j->j_fmbufs));
+	if (j->j_fmbufs == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<n; i++) {
+		result = sfs_buf_read(sfs, SFS_FREEMAP_START + i,
+				      &j->j_fmbufs[i]);
+		if (result) {
+			return result;
+		}
+		j->j_nfmbufs++;
+	}
+
+	j->j_threadrunning = true;
+	result = thread_fork("sfs_journal", NULL, sfs_journal_thread, sfs, 0);
+	if (result) {
+		/* Not fatal; it still commits on sync and when full. */
+		kprintf("sfs: %s: cannot start journal thread: %s\n",
+			sfs->sfs_sb.sb_volname, strerror(result));
+		j->j_threadrunning = false;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Transactions
+
+/*
+ * Begin a transaction. See the top of the file for the rules.
+ */
+void
+sfs_txn_begin(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+
+	if (j == NULL) {
+		return;
+	}
+
+	lock_acquire(j->j_lock);
+	if (!j->j_committing && j->j_nbufs >= SFS_JCOMMIT_BUFS) {
+		/* Big enough; commit it before adding to it */
+		lock_release(j->j_lock);
+		/* An error leaves it to be retried; sync will report it */
+		(void)sfs_journal_commit(sfs);
+		lock_acquire(j->j_lock);
+	}
+	while (j->j_committing) {
+		cv_wait(j->j_cv, j->j_lock);
+	}
+	j->j_active++;
+	lock_release(j->j_lock);
+}
+
+/*
+ * End a transaction. Its changes are committed with the rest of the
+ * compound transaction.
+ */
+void
+sfs_txn_end(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+
+	if (j == NULL) {
+		return;
+	}
+
+	lock_acquire(j->j_lock);
+	KASSERT(j->j_active > 0);
+	j->j_active--;
+	if (j->j_active == 0) {
+		cv_broadcast(j->j_cv, j->j_lock);
+	}
+	lock_release(j->j_lock);
+}
+
+/*
+ * Mark a pinned metadata buffer modified by the current transaction.
+ */
+void
+sfs_jdirty(struct sfs_buf *b)
+{
+	struct sfs_journal *j = b->b_fs->sfs_journal;
+	bool first;
+
+	if (j == NULL) {
+		sfs_buf_dirty(b);
+		return;
+	}
+
+	/* j_seq can't change while we're in a transaction */
+	KASSERT(j->j_active > 0);
+	first = (b->b_jseq != j->j_seq);
+	sfs_buf_jdirty(b, j->j_seq);
+	if (first) {
+		lock_acquire(j->j_lock);
+		j->j_nbufs++;
+		lock_release(j->j_lock);
+	}
+}
+
+/*
+ * Likewise, for a block belonging to file SV: its inode, an indirect
+ * block, or a directory block. Without a journal there is no commit
+ * to get it to disk on fsync, so it goes on the file's dirty list
+ * with the file's data instead.
+ */
+void
+sfs_jfdirty(struct sfs_buf *b, struct sfs_vnode *sv)
+{
+	if (b->b_fs->sfs_journal == NULL) {
+		sfs_buf_fdirty(b, sv);
+		return;
+	}
+	sfs_jdirty(b);
+}
+
+/*
+ * BLOCK has been freed by the current transaction. If an image of it
+ * is in the log, make sure it won't be replayed.
+ */
+void
+sfs_journal_revoke(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+
+	if (j == NULL) {
+		return;
+	}
+
+	lock_acquire(j->j_lock);
+	if (bitmap_isset(j->j_logged, block)) {
+		if (j->j_nrevoke < SFS_JDESC_NENT) {
+			j->j_revoke[j->j_nrevoke++] = block;
+		}
+		else {
+			/* Checkpoint instead, which empties the log */
+			j->j_needckpt = true;
+		}
+	}
+	lock_release(j->j_lock);
+}
+
+////////////////////////////////////////////////////////////
+// Commit
+
+/*
+ * Write every dirty buffer home and empty the log.
+ */
+static
+int
+sfs_jcheckpoint(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	int result;
+
+	/* (This skips buffers of the running transaction.) */
+	result = sfs_buf_sync(sfs);
+	if (result) {
+		return result;
+	}
+	result = sfs_jwriteheader(sfs, j->j_seq);
+	if (result) {
+		return result;
+	}
+
+	j->j_tail = 1;
+	lock_acquire(j->j_lock);
+	bzero(bitmap_getdata(j->j_logged),
+	      DIVROUNDUP(sfs->sfs_sb.sb_nblocks, CHAR_BIT));
+	j->j_nrevoke = 0;
+	j->j_needckpt = false;
+	lock_release(j->j_lock);
+	return 0;
+}
+
+/*
+ * Check if two blocks are the same. (The kernel has no memcmp.)
+ */
+static
+bool
+sfs_jsameblock(const void *a, const void *b)
+{
+	const uint32_t *wa = a, *wb = b;
+	unsigned i;
+
+	for (i=0; i<SFS_BLOCKSIZE / sizeof(uint32_t); i++) {
+		if (wa[i] != wb[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Put the freemap's changes into the freemap buffers, as part of the
+ * transaction being committed. Only the blocks marked in sfs_fmdirty
+ * can have changed; a block whose bits were flipped and flipped back
+ * is still left out.
+ */
+static
+void
+sfs_jaddfreemap(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_buf *b;
+	char *data;
+	unsigned i;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	if (sfs->sfs_freemapdirty) {
+		data = bitmap_getdata(sfs->sfs_freemap);
+		for (i=0; i<j->j_nfmbufs; i++) {
+			if (!bitmap_isset(sfs->sfs_fmdirty, i)) {
+				continue;
+			}
+			bitmap_unmark(sfs->sfs_fmdirty, i);
+			b = j->j_fmbufs[i];
+			if (!sfs_jsameblock(b->b_data,
+					    data + i * SFS_BLOCKSIZE)) {
+				memcpy(b->b_data, data + i * SFS_BLOCKSIZE,
+				       SFS_BLOCKSIZE);
+				sfs_buf_jdirty(b, j->j_seq);
+			}
+		}
+		sfs->sfs_freemapdirty = false;
+	}
+	lock_release(sfs->sfs_freemaplock);
+}
+
+/*
+ * A queued commit write is done. Probably in an interrupt handler.
+ */
+static
+void
+sfs_jiodone(struct devreq *req)
+{
+	struct sfs_journal *j = req->dr_donedata;
+
+	spinlock_acquire(&j->j_iolock);
+	if (req->dr_result != 0 && j->j_ioerr == 0) {
+		j->j_ioerr = req->dr_result;
+	}
+	KASSERT(j->j_ioleft > 0);
+	j->j_ioleft--;
+	if (j->j_ioleft == 0) {
+		wchan_wakeall(j->j_iowchan, &j->j_iolock);
+	}
+	spinlock_release(&j->j_iolock);
+}
+
+/*
+ * Queue the first NW blocks of j_wdata for the log at j_tail, the
+ * last (the commit record) ordered after the others, and wait for
+ * them all. The commit record isn't sent if something already failed.
+ */
+static
+int
+sfs_jqueue(struct sfs_fs *sfs, unsigned nw)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct devreq *req;
+	unsigned i;
+	bool failed;
+	int result;
+
+	spinlock_acquire(&j->j_iolock);
+	j->j_ioleft = nw;
+	j->j_ioerr = 0;
+	spinlock_release(&j->j_iolock);
+
+	for (i=0; i<nw; i++) {
+		req = &j->j_reqs[i];
+		req->dr_block = (j->j_start + j->j_tail + i) * j->j_devper;
+		req->dr_nblocks = j->j_devper;
+		req->dr_data = j->j_wdata[i];
+		req->dr_write = true;
+		req->dr_flags = i == nw - 1 ? DR_ORDERED : 0;
+		req->dr_tag = j->j_tag;
+		req->dr_done = sfs_jiodone;
+		req->dr_donedata = j;
+
+		if (i == nw - 1) {
+			spinlock_acquire(&j->j_iolock);
+			failed = j->j_ioerr != 0;
+			spinlock_release(&j->j_iolock);
+			if (failed) {
+				req->dr_result = EIO;
+				sfs_jiodone(req);
+				continue;
+			}
+		}
+		result = DEVOP_STRATEGY(sfs->sfs_device, req);
+		if (result) {
+			req->dr_result = result;
+			sfs_jiodone(req);
+		}
+	}
+
+	spinlock_acquire(&j->j_iolock);
+	while (j->j_ioleft > 0) {
+		wchan_sleep(j->j_iowchan, &j->j_iolock);
+	}
+	result = j->j_ioerr;
+	spinlock_release(&j->j_iolock);
+	return result;
+}
+
+/*
+ * Write the first NW blocks of j_wdata to the log at j_tail. The last
+ * is the commit record, which must not reach the disk before the
+ * others.
+ */
+static
+int
+sfs_jwritelog(struct sfs_fs *sfs, unsigned nw)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	unsigned i;
+	int result;
+
+	if (j->j_reqs != NULL) {
+		result = sfs_jqueue(sfs, nw);
+		if (result == 0) {
+			return 0;
+		}
+		kprintf("sfs: %s: queued commit failed (%s), rewriting\n",
+			sfs->sfs_sb.sb_volname, strerror(result));
+	}
+
+	/* One at a time, in order; sfs_rawblock retries errors */
+	for (i=0; i<nw; i++) {
+		result = sfs_jio(sfs, j->j_tail + i, j->j_wdata[i],
+				 UIO_WRITE);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Start the next descriptor block of a commit, as block NW of
+ * j_wdata.
+ */
+static
+struct sfs_jdesc *
+sfs_jnewdesc(struct sfs_fs *sfs, unsigned nw, unsigned *ndesc,
+	     uint32_t type)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jdesc *jd;
+
+	KASSERT(*ndesc < SFS_JMAXDESC);
+	jd = (struct sfs_jdesc *)((char *)j->j_descs +
+				  (*ndesc)++ * SFS_BLOCKSIZE);
+	bzero(jd, sizeof(*jd));
+	jd->jd_magic = SFS_JMAGIC;
+	jd->jd_type = type;
+	jd->jd_seq = j->j_seq;
+	j->j_wdata[nw] = jd;
+	return jd;
+}
+
+/*
+ * Log the running transaction. Called with the journal to ourselves.
+ */
+static
+int
+sfs_jcommit(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jdesc *jd;
+	unsigned n, need, nw, ndesc, i, k;
+	uint32_t sum;
+	int result;
+
+	COMPILE_ASSERT(sizeof(struct sfs_jdesc) == SFS_BLOCKSIZE);
+
+	sfs_jaddfreemap(sfs);
+
+	n = sfs_buf_jpin(sfs, j->j_seq, j->j_bufs);
+	if (n == 0 && j->j_nrevoke == 0 && !j->j_needckpt) {
+		return 0;
+	}
+
+	need = n + DIVROUNDUP(n, SFS_JDESC_NENT) +
+		(j->j_nrevoke > 0 ? 1 : 0) + 1;
+	KASSERT(1 + need <= j->j_nblocks);
+	KASSERT(need <= SFS_JMAXWRITE);
+	if (j->j_needckpt || j->j_tail + need > j->j_nblocks) {
+		result = sfs_jcheckpoint(sfs);
+		if (result) {
+			goto fail;
+		}
+	}
+
+	/* Lay out the run: descriptors and images, revokes, commit */
+	nw = 0;
+	ndesc = 0;
+	for (i=0; i<n; i += SFS_JDESC_NENT) {
+		jd = sfs_jnewdesc(sfs, nw++, &ndesc, SFS_JDESC_BLOCKS);
+		jd->jd_count = n - i < SFS_JDESC_NENT ? n - i : SFS_JDESC_NENT;
+		for (k=0; k<jd->jd_count; k++) {
+			jd->jd_blocks[k] = j->j_bufs[i + k]->b_block;
+			j->j_wdata[nw++] = j->j_bufs[i + k]->b_data;
+		}
+	}
+
+	if (j->j_nrevoke > 0) {
+		jd = sfs_jnewdesc(sfs, nw++, &ndesc, SFS_JDESC_REVOKE);
+		jd->jd_count = j->j_nrevoke;
+		for (k=0; k<j->j_nrevoke; k++) {
+			jd->jd_blocks[k] = j->j_revoke[k];
+		}
+	}
+
+	sum = 0;
+	for (i=0; i<nw; i++) {
+		sum = sfs_jsum(sum, j->j_wdata[i]);
+	}
+	jd = sfs_jnewdesc(sfs, nw, &ndesc, SFS_JDESC_COMMIT);
+	jd->jd_count = nw;
+	jd->jd_sum = sum;
+	nw++;
+	KASSERT(nw == need);
+
+	result = sfs_jwritelog(sfs, nw);
+	if (result) {
+		goto fail;
+	}
+
+	/* It's committed */
+	lock_acquire(j->j_lock);
+	for (i=0; i<n; i++) {
+		bitmap_mark(j->j_logged, j->j_bufs[i]->b_block);
+	}
+	j->j_nrevoke = 0;
+	j->j_nbufs = 0;
+	lock_release(j->j_lock);
+	j->j_tail += nw;
+	j->j_seq = sfs_jnextseq(j->j_seq);
+	for (i=0; i<n; i++) {
+		sfs_buf_junpin(j->j_bufs[i]);
+	}
+	return 0;
+
+ fail:
+	/* Keep them for the next try */
+	for (i=0; i<n; i++) {
+		sfs_buf_release(j->j_bufs[i]);
+	}
+	return result;
+}
+
+/*
+ * Wait for the transactions in progress to end, keeping new ones
+ * out, and commit; then checkpoint too if CHECKPOINT is set.
+ */
+static
+int
+sfs_jflush(struct sfs_fs *sfs, bool checkpoint)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	int result;
+
+	lock_acquire(j->j_lock);
+	while (j->j_committing) {
+		cv_wait(j->j_cv, j->j_lock);
+	}
+	j->j_committing = true;
+	while (j->j_active > 0) {
+		cv_wait(j->j_cv, j->j_lock);
+	}
+	lock_release(j->j_lock);
+
+	result = sfs_jcommit(sfs);
+	if (result == 0 && checkpoint) {
+		result = sfs_jcheckpoint(sfs);
+	}
+
+	lock_acquire(j->j_lock);
+	j->j_committing = false;
+	cv_broadcast(j->j_cv, j->j_lock);
+	lock_release(j->j_lock);
+	return result;
+}
+
+/*
+ * Commit the running transaction. Must not be called from inside a
+ * transaction.
+ */
+int
+sfs_journal_commit(struct sfs_fs *sfs)
+{
+	if (sfs->sfs_journal == NULL) {
+		return 0;
+	}
+	return sfs_jflush(sfs, false);
+}
+
+/*
+ * The commit thread.
+ */
+static
+void
+sfs_journal_thread(void *data1, unsigned long unused)
+{
+	struct sfs_fs *sfs = data1;
+	struct sfs_journal *j = sfs->sfs_journal;
+
+	(void)unused;
+
+	while (1) {
+		clocksleep(sfs_journal_interval > 0 ?
+			   sfs_journal_interval : 1);
+
+		lock_acquire(j->j_lock);
+		if (j->j_exiting) {
+			j->j_threadrunning = false;
+			cv_broadcast(j->j_cv, j->j_lock);
+			lock_release(j->j_lock);
+			thread_exit();
+		}
+		lock_release(j->j_lock);
+
+		/* Errors leave it to be retried; sync will report them */
+		(void)sfs_journal_commit(sfs);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Unmount
+
+/*
+ * Commit, checkpoint, and stop the commit thread, leaving an empty
+ * log behind. Called on unmount, when nothing else is using the
+ * volume.
+ */
+int
+sfs_journal_unmount(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	int result;
+
+	if (j == NULL) {
+		return 0;
+	}
+
+	result = sfs_jflush(sfs, true);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(j->j_lock);
+	j->j_exiting = true;
+	while (j->j_threadrunning) {
+		cv_wait(j->j_cv, j->j_lock);
+	}
+	lock_release(j->j_lock);
+	return 0;
+}
+
+/*
+ * Free the journal state. The commit thread must not be running.
+ */
+void
+sfs_journal_destroy(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	unsigned i;
+
+	if (j == NULL) {
+		return;
+	}
+	KASSERT(!j->j_threadrunning);
+
+	for (i=0; i<j->j_nfmbufs; i++) {
+		sfs_buf_release(j->j_fmbufs[i]);
+	}
+	kfree(j->j_fmbufs);
+	if (j->j_logged != NULL) {
+		bitmap_destroy(j->j_logged);
+	}
+	if (j->j_cv != NULL) {
+		cv_destroy(j->j_cv);
+	}
+	if (j->j_lock != NULL) {
+		lock_destroy(j->j_lock);
+	}
+	if (j->j_iowchan != NULL) {
+		wchan_destroy(j->j_iowchan);
+	}
+	spinlock_cleanup(&j->j_iolock);
+	kfree(j->j_reqs);
+	kfree(j->j_descs);
+	kfree(j->j_image);
+	kfree(j->j_block);
+	kfree(j);
+	sfs->sfs_journal = NULL;
+}
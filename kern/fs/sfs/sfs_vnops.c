@@ -35,13 +35,19 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/ioctl.h>
 #include <stat.h>
+#include <kern/dirent.h>
 #include <lib.h>
+#include <synch.h>
 #include <uio.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/* Most bytes written in one transaction */
+#define SFS_WRITECHUNK	(64 * 1024)
+
 ////////////////////////////////////////////////////////////
 // Vnode operations.
 
@@ -90,6 +96,24 @@ sfs_eachopendir(struct vnode *v, int openflags)
 	return 0;
 }
 
+/*
+ * Write a changed inode into the running transaction, so that it is
+ * committed together with the block, directory, and freemap changes
+ * that go with it. Without a journal inodes are written lazily, as
+ * before. If this fails the inode stays dirty and is written by the
+ * next sync. The vnode must be locked.
+ */
+static
+void
+sfs_txn_inode(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	if (sfs->sfs_journal != NULL) {
+		(void)sfs_sync_inode(sv);
+	}
+}
+
 /*
  * Called for read(). sfs_io() does the work.
  */
@@ -102,29 +126,136 @@ sfs_read(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 
 	return result;
 }
 
 /*
  * Called for write(). sfs_io() does the work.
+ *
+ * Large writes are done SFS_WRITECHUNK bytes at a time, each piece in
+ * a transaction of its own, so that no one transaction dirties more
+ * indirect blocks than the buffer cache can hold for the journal.
+ *
+ * An append holds sv_appendlock across all the chunks, so that
+ * another append can't land in the middle of it, and each chunk goes
+ * at the end of file as it is once sv_lock is held.
  */
 static
 int
 sfs_write(struct vnode *v, struct uio *uio)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	size_t extraresid;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
-	vfs_biglock_acquire();
-	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	if (uio->uio_append) {
+		lock_acquire(sv->sv_appendlock);
+	}
+
+	do {
+		extraresid = 0;
+		if (uio->uio_resid > SFS_WRITECHUNK) {
+			extraresid = uio->uio_resid - SFS_WRITECHUNK;
+			uio->uio_resid -= extraresid;
+		}
+
+		sfs_txn_begin(sfs);
+		lock_acquire(sv->sv_lock);
+		if (uio->uio_append) {
+			uio->uio_offset = sv->sv_i.sfi_size;
+		}
+		result = sfs_io(sv, uio);
+		sfs_txn_inode(sv);
+		lock_release(sv->sv_lock);
+		sfs_txn_end(sfs);
+
+		if (result || uio->uio_resid > 0) {
+			/* Failed, or stopped short (e.g. out of space) */
+			uio->uio_resid += extraresid;
+			break;
+		}
+		uio->uio_resid = extraresid;
+	} while (extraresid > 0);
+
+	if (uio->uio_append) {
+		lock_release(sv->sv_appendlock);
+	}
+
+	return result;
+}
+
+/*
+ * fallocate: make sure the VR_LEN bytes from VR_OFFSET have blocks
+ * on disk, contiguous where possible, and grow the file to cover
+ * them. Done a chunk at a time, in a transaction each, like
+ * sfs_write. Blocks already there stay as they are; so does the size
+ * if the file is already long enough.
+ */
+static
+int
+sfs_allocate(struct sfs_vnode *sv, const struct vnode_range *vr)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	const uint32_t chunk = SFS_WRITECHUNK / SFS_BLOCKSIZE;
+	off_t end = vr->vr_offset + vr->vr_len;
+	uint32_t first, left, n;
+	int result = 0;
+
+	if (sv->sv_i.sfi_type != SFS_TYPE_FILE) {
+		return EINVAL;
+	}
+	/* Far past anything sfs_bmap can map, which says EFBIG itself */
+	if (end / SFS_BLOCKSIZE >= (off_t)0x80000000) {
+		return EFBIG;
+	}
 
+	first = vr->vr_offset / SFS_BLOCKSIZE;
+	left = DIVROUNDUP(end, SFS_BLOCKSIZE) - first;
+
+	sfs_txn_begin(sfs);
+	lock_acquire(sv->sv_lock);
+	if (sv->sv_i.sfi_flags & SFS_IFLAG_INLINE) {
+		if (end <= SFS_INLINESIZE) {
+			/* The inode is all the space it needs */
+			left = 0;
+		}
+		else {
+			result = sfs_inline_evict(sv);
+		}
+	}
+	while (result == 0 && left > 0) {
+		/* Delayed blocks mustn't be given a second place */
+		result = sfs_da_place(sv);
+		if (result) {
+			break;
+		}
+		n = left < chunk ? left : chunk;
+		result = sfs_falloc(sv, first, n, left);
+		first += n;
+		left -= n;
+		if (result == 0 && left > 0) {
+			/* Next chunk in the next transaction */
+			sfs_txn_inode(sv);
+			lock_release(sv->sv_lock);
+			sfs_txn_end(sfs);
+			sfs_txn_begin(sfs);
+			lock_acquire(sv->sv_lock);
+		}
+	}
+	if (result == 0 && end > (off_t)sv->sv_i.sfi_size) {
+		sv->sv_i.sfi_size = end;
+		sv->sv_dirty = true;
+	}
+	sfs_txn_inode(sv);
+	lock_release(sv->sv_lock);
+	sfs_txn_end(sfs);
 	return result;
 }
 
@@ -135,13 +266,28 @@ static
 int
 sfs_ioctl(struct vnode *v, int op, userptr_t data)
 {
-	/*
-	 * No ioctls.
-	 */
+	struct sfs_vnode *sv = v->vn_data;
 
-	(void)v;
-	(void)op;
-	(void)data;
+	int result;
+
+	switch (op) {
+	    case FIOADVISE:
+		/* From fadvise(); DATA is in the kernel */
+		lock_acquire(sv->sv_lock);
+		result = sfs_advise(sv, (const struct vnode_advice *)data);
+		lock_release(sv->sv_lock);
+		return result;
+	    case FIOSEEKDATA:
+	    case FIOSEEKHOLE:
+		/* From lseek(); DATA is in the kernel */
+		lock_acquire(sv->sv_lock);
+		result = sfs_seekdata(sv, op == FIOSEEKHOLE, (off_t *)data);
+		lock_release(sv->sv_lock);
+		return result;
+	    case FIOALLOCATE:
+		/* From fallocate(); likewise */
+		return sfs_allocate(sv, (const struct vnode_range *)data);
+	}
 
 	return EINVAL;
 }
@@ -164,8 +310,10 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 		return result;
 	}
 
+	lock_acquire(sv->sv_lock);
 	statbuf->st_size = sv->sv_i.sfi_size;
 	statbuf->st_nlink = sv->sv_i.sfi_linkcount;
+	lock_release(sv->sv_lock);
 
 	/* We don't support this yet */
 	statbuf->st_blocks = 0;
@@ -175,6 +323,185 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 	return 0;
 }
 
+/*
+ * Directory entries handled at once by sfs_getdirplus and
+ * sfs_getdents.
+ */
+#define SFS_DIRPLUS_BATCH	32
+
+struct sfs_dirplus_batch {
+	struct sfs_direntry db_sds[SFS_DIRPLUS_BATCH];
+	int db_slots[SFS_DIRPLUS_BATCH];
+	daddr_t db_inos[SFS_DIRPLUS_BATCH];
+};
+
+/*
+ * List a directory with stat information (the offset is the slot to
+ * start at). Entries are read a batch at a time with the directory
+ * locked; then, with it unlocked, read-ahead is queued for all their
+ * inode blocks in disk order, and each inode is stat'd without
+ * loading a vnode for it. Names whose inode goes away in between
+ * are skipped.
+ */
+static
+int
+sfs_getdirplus(struct vnode *v, struct uio *uio)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	struct sfs_dirplus_batch *db;
+	union {
+		struct dirent_plus dp;
+		char buf[DIRENT_PLUS_RECLEN(SFS_NAMELEN)];
+	} rec;
+	unsigned n, i, j;
+	size_t namelen, reclen;
+	daddr_t t;
+	bool any;
+	int slot, result;
+
+	slot = uio->uio_offset;
+	if (uio->uio_offset < 0 || slot != uio->uio_offset) {
+		return EINVAL;
+	}
+
+	db = kmalloc(sizeof(*db));
+	if (db == NULL) {
+		return ENOMEM;
+	}
+
+	any = false;
+	result = 0;
+	while (1) {
+		lock_acquire(sv->sv_lock);
+		result = sfs_dir_readmany(sv, slot, db->db_sds, db->db_slots,
+					  SFS_DIRPLUS_BATCH, &n);
+		lock_release(sv->sv_lock);
+		if (result || n == 0) {
+			break;
+		}
+
+		/* Queue the inode blocks in sorted order */
+		for (i=0; i<n; i++) {
+			t = db->db_sds[i].sfd_ino;
+			for (j=i; j>0 && db->db_inos[j-1] > t; j--) {
+				db->db_inos[j] = db->db_inos[j-1];
+			}
+			db->db_inos[j] = t;
+		}
+		for (i=0; i<n; i++) {
+			sfs_buf_readahead(sfs, db->db_inos[i]);
+		}
+
+		for (i=0; i<n; i++) {
+			namelen = strlen(db->db_sds[i].sfd_name);
+			reclen = DIRENT_PLUS_RECLEN(namelen);
+			if (reclen > uio->uio_resid) {
+				if (!any) {
+					result = EINVAL;
+				}
+				goto done;
+			}
+
+			bzero(&rec, reclen);
+			result = sfs_statino(sfs, db->db_sds[i].sfd_ino,
+					     &rec.dp.dp_stat);
+			if (result == 0) {
+				rec.dp.dp_reclen = reclen;
+				rec.dp.dp_namelen = namelen;
+				strcpy(rec.dp.dp_name, db->db_sds[i].sfd_name);
+				result = uiomove(&rec, reclen, uio);
+				if (result) {
+					goto done;
+				}
+				any = true;
+			}
+			else if (result != ENOENT) {
+				goto done;
+			}
+			result = 0;
+			slot = db->db_slots[i] + 1;
+			uio->uio_offset = slot;
+		}
+	}
+
+ done:
+	kfree(db);
+	return result;
+}
+
+/*
+ * List a directory's names (the offset is the slot to start at). The
+ * entries are read a batch at a time with the directory locked, a
+ * whole block's worth per read, and copied out as they fit.
+ */
+static
+int
+sfs_getdents(struct vnode *v, struct uio *uio)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_dirplus_batch *db;
+	union {
+		struct dirent d;
+		char buf[DIRENT_RECLEN(SFS_NAMELEN)];
+	} rec;
+	unsigned n, i;
+	size_t namelen, reclen;
+	bool any;
+	int slot, result;
+
+	slot = uio->uio_offset;
+	if (uio->uio_offset < 0 || slot != uio->uio_offset) {
+		return EINVAL;
+	}
+
+	db = kmalloc(sizeof(*db));
+	if (db == NULL) {
+		return ENOMEM;
+	}
+
+	any = false;
+	result = 0;
+	while (1) {
+		lock_acquire(sv->sv_lock);
+		result = sfs_dir_readmany(sv, slot, db->db_sds, db->db_slots,
+					  SFS_DIRPLUS_BATCH, &n);
+		lock_release(sv->sv_lock);
+		if (result || n == 0) {
+			break;
+		}
+
+		for (i=0; i<n; i++) {
+			namelen = strlen(db->db_sds[i].sfd_name);
+			reclen = DIRENT_RECLEN(namelen);
+			if (reclen > uio->uio_resid) {
+				if (!any) {
+					result = EINVAL;
+				}
+				goto done;
+			}
+
+			bzero(&rec, reclen);
+			slot = db->db_slots[i] + 1;
+			rec.d.d_off = slot;
+			rec.d.d_ino = db->db_sds[i].sfd_ino;
+			rec.d.d_reclen = reclen;
+			rec.d.d_namelen = namelen;
+			strcpy(rec.d.d_name, db->db_sds[i].sfd_name);
+			result = uiomove(&rec, reclen, uio);
+			if (result) {
+				goto done;
+			}
+			uio->uio_offset = slot;
+			any = true;
+		}
+	}
+
+ done:
+	kfree(db);
+	return result;
+}
+
 /*
  * Return the type of the file (types as per kern/stat.h)
  */
@@ -185,16 +512,13 @@ sfs_gettype(struct vnode *v, uint32_t *ret)
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
 
-	vfs_biglock_acquire();
-
+	/* The type is fixed when the vnode is loaded; no lock needed */
 	switch (sv->sv_i.sfi_type) {
 	case SFS_TYPE_FILE:
 		*ret = S_IFREG;
-		vfs_biglock_release();
 		return 0;
 	case SFS_TYPE_DIR:
 		*ret = S_IFDIR;
-		vfs_biglock_release();
 		return 0;
 	}
 	panic("sfs: %s: gettype: Invalid inode type (inode %u, type %u)\n",
@@ -214,32 +538,55 @@ sfs_isseekable(struct vnode *v)
 }
 
 /*
- * Called for fsync(), and also on filesystem unmount, global sync(),
- * and some other cases.
+ * Called for fsync() and fdatasync(), and also on filesystem unmount,
+ * global sync(), and some other cases.
+ *
+ * Only this file's blocks are written (see sfs_buf_fsync): its data,
+ * and without a journal its inode and indirect blocks as well; the
+ * freemap waits for the next sync, and sfsck can put it right after a
+ * crash. With a journal, the data goes first and then the journal is
+ * committed, which covers the rest. Other files' dirty buffers are
+ * left to the syncer.
  */
 static
 int
 sfs_fsync(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	int result;
 
-	vfs_biglock_acquire();
-	result = sfs_sync_inode(sv);
-	vfs_biglock_release();
+	sfs_txn_begin(sfs);
+	lock_acquire(sv->sv_lock);
+	/* Delayed blocks get their places first, changing the inode */
+	result = sfs_da_place(sv);
+	if (result == 0) {
+		result = sfs_sync_inode(sv);
+	}
+	lock_release(sv->sv_lock);
+	sfs_txn_end(sfs);
+	if (result == 0) {
+		/* Data before the metadata that points at it */
+		result = sfs_buf_fsync(sv);
+	}
+	if (result == 0) {
+		result = sfs_journal_commit(sfs);
+	}
 
 	return result;
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). Regular files can always be mapped; the VM
+ * system does the rest with sfs_read and sfs_write.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v, bool *anon)
 {
 	(void)v;
-	return ENOSYS;
+	(void)anon;
+	return 0;
 }
 
 /*
@@ -250,8 +597,17 @@ int
 sfs_truncate(struct vnode *v, off_t len)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
+
+	sfs_txn_begin(sfs);
+	lock_acquire(sv->sv_lock);
+	result = sfs_itrunc(sv, len);
+	sfs_txn_inode(sv);
+	lock_release(sv->sv_lock);
+	sfs_txn_end(sfs);
 
-	return sfs_itrunc(sv, len);
+	return result;
 }
 
 /*
@@ -289,18 +645,21 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	uint32_t ino;
 	int result;
 
-	vfs_biglock_acquire();
+	sfs_txn_begin(sfs);
+	lock_acquire(sv->sv_lock);
 
 	/* Look up the name */
 	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
 	if (result!=0 && result!=ENOENT) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_txn_end(sfs);
 		return result;
 	}
 
 	/* If it exists and we didn't want it to, fail */
 	if (result==0 && excl) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_txn_end(sfs);
 		return EEXIST;
 	}
 
@@ -308,18 +667,21 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 		/* We got something; load its vnode and return */
 		result = sfs_loadvnode(sfs, ino, SFS_TYPE_INVAL, &newguy);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sv->sv_lock);
+			sfs_txn_end(sfs);
 			return result;
 		}
 		*ret = &newguy->sv_absvn;
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_txn_end(sfs);
 		return 0;
 	}
 
 	/* Didn't exist - create it */
-	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
+	result = sfs_makeobj(sfs, sv, SFS_TYPE_FILE, &newguy);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_txn_end(sfs);
 		return result;
 	}
 
@@ -329,20 +691,27 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	/* Link it into the directory */
 	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
 	if (result) {
+		lock_release(sv->sv_lock);
+		sfs_txn_end(sfs);
+		/* This reclaims it, which must be outside the transaction */
 		VOP_DECREF(&newguy->sv_absvn);
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* Update the linkcount of the new file */
+	lock_acquire(newguy->sv_lock);
 	newguy->sv_i.sfi_linkcount++;
 
 	/* and consequently mark it dirty. */
 	newguy->sv_dirty = true;
+	sfs_txn_inode(newguy);
+	lock_release(newguy->sv_lock);
 
 	*ret = &newguy->sv_absvn;
 
-	vfs_biglock_release();
+	sfs_txn_inode(sv);
+	lock_release(sv->sv_lock);
+	sfs_txn_end(sfs);
 	return 0;
 }
 
@@ -357,30 +726,40 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 {
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *f = file->vn_data;
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
 	int result;
 
 	KASSERT(file->vn_fs == dir->vn_fs);
+	KASSERT(f != sv);
 
-	vfs_biglock_acquire();
+	sfs_txn_begin(sfs);
+	lock_acquire(sv->sv_lock);
 
-	/* Hard links to directories aren't allowed. */
+	/* Hard links to directories aren't allowed. (No lock needed.) */
 	if (f->sv_i.sfi_type == SFS_TYPE_DIR) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_txn_end(sfs);
 		return EINVAL;
 	}
 
 	/* Create the link */
 	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_txn_end(sfs);
 		return result;
 	}
 
 	/* and update the link count, marking the inode dirty */
+	lock_acquire(f->sv_lock);
 	f->sv_i.sfi_linkcount++;
 	f->sv_dirty = true;
+	sfs_txn_inode(f);
+	lock_release(f->sv_lock);
 
-	vfs_biglock_release();
+	sfs_txn_inode(sv);
+	lock_release(sv->sv_lock);
+	sfs_txn_end(sfs);
 	return 0;
 }
 
@@ -393,15 +772,18 @@ sfs_remove(struct vnode *dir, const char *name)
 {
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *victim;
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
 	int slot;
 	int result;
 
-	vfs_biglock_acquire();
+	sfs_txn_begin(sfs);
+	lock_acquire(sv->sv_lock);
 
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_txn_end(sfs);
 		return result;
 	}
 
@@ -409,15 +791,25 @@ sfs_remove(struct vnode *dir, const char *name)
 	result = sfs_dir_unlink(sv, slot);
 	if (result==0) {
 		/* If we succeeded, decrement the link count. */
+		lock_acquire(victim->sv_lock);
 		KASSERT(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
 		victim->sv_dirty = true;
+		sfs_txn_inode(victim);
+		lock_release(victim->sv_lock);
+		sfs_txn_inode(sv);
 	}
 
-	/* Discard the reference that sfs_lookonce got us */
+	lock_release(sv->sv_lock);
+	sfs_txn_end(sfs);
+
+	/*
+	 * Discard the reference that sfs_lookonce got us. This may
+	 * reclaim the vnode, so its lock must not be held, and neither
+	 * may the transaction still be open.
+	 */
 	VOP_DECREF(&victim->sv_absvn);
 
-	vfs_biglock_release();
 	return result;
 }
 
@@ -438,7 +830,8 @@ sfs_rename(struct vnode *d1, const char *n1,
 	int slot1, slot2;
 	int result, result2;
 
-	vfs_biglock_acquire();
+	sfs_txn_begin(sfs);
+	lock_acquire(sv->sv_lock);
 
 	KASSERT(d1==d2);
 	KASSERT(sv->sv_ino == SFS_ROOTDIR_INO);
@@ -446,7 +839,8 @@ sfs_rename(struct vnode *d1, const char *n1,
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
+		sfs_txn_end(sfs);
 		return result;
 	}
 
@@ -467,8 +861,10 @@ sfs_rename(struct vnode *d1, const char *n1,
 	}
 
 	/* Increment the link count, and mark inode dirty */
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount++;
 	g1->sv_dirty = true;
+	lock_release(g1->sv_lock);
 
 	/* Unlink the old slot */
 	result = sfs_dir_unlink(sv, slot1);
@@ -480,14 +876,19 @@ sfs_rename(struct vnode *d1, const char *n1,
 	 * Decrement the link count again, and mark the inode dirty again,
 	 * in case it's been synced behind our back.
 	 */
+	lock_acquire(g1->sv_lock);
 	KASSERT(g1->sv_i.sfi_linkcount>0);
 	g1->sv_i.sfi_linkcount--;
 	g1->sv_dirty = true;
+	sfs_txn_inode(g1);
+	lock_release(g1->sv_lock);
+
+	sfs_txn_inode(sv);
+	lock_release(sv->sv_lock);
+	sfs_txn_end(sfs);
 
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
-
-	vfs_biglock_release();
 	return 0;
 
  puke_harder:
@@ -503,11 +904,17 @@ sfs_rename(struct vnode *d1, const char *n1,
 		panic("sfs: %s: rename: Cannot recover\n",
 		      sfs->sfs_sb.sb_volname);
 	}
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount--;
+	sfs_txn_inode(g1);
+	lock_release(g1->sv_lock);
+	sfs_txn_inode(sv);
  puke:
+	lock_release(sv->sv_lock);
+	sfs_txn_end(sfs);
+
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
-	vfs_biglock_release();
 	return result;
 }
 
@@ -525,15 +932,12 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 {
 	struct sfs_vnode *sv = v->vn_data;
 
-	vfs_biglock_acquire();
-
+	/* Nothing here needs the vnode locked */
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
 	if (strlen(path)+1 > buflen) {
-		vfs_biglock_release();
 		return ENAMETOOLONG;
 	}
 	strcpy(buf, path);
@@ -541,7 +945,6 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 	VOP_INCREF(&sv->sv_absvn);
 	*ret = &sv->sv_absvn;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -559,22 +962,22 @@ sfs_lookup(struct vnode *v, char *path, struct vnode **ret)
 	struct sfs_vnode *final;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return ENOTDIR;
 	}
 
 	result = sfs_lookonce(sv, path, &final, NULL);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	*ret = &final->sv_absvn;
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 }
 
@@ -593,11 +996,14 @@ const struct vnode_ops sfs_fileops = {
 	.vop_read = sfs_read,
 	.vop_readlink = vopfail_uio_notdir,
 	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirplus = vopfail_uio_notdir,
+	.vop_getdents = vopfail_uio_notdir,
 	.vop_write = sfs_write,
 	.vop_ioctl = sfs_ioctl,
 	.vop_stat = sfs_stat,
 	.vop_gettype = sfs_gettype,
 	.vop_isseekable = sfs_isseekable,
+	.vop_poll = vop_poll_ready,
 	.vop_fsync = sfs_fsync,
 	.vop_mmap = sfs_mmap,
 	.vop_truncate = sfs_truncate,
@@ -627,11 +1033,14 @@ const struct vnode_ops sfs_dirops = {
 	.vop_read = vopfail_uio_isdir,
 	.vop_readlink = vopfail_uio_inval,
 	.vop_getdirentry = vopfail_uio_nosys,
+	.vop_getdirplus = sfs_getdirplus,
+	.vop_getdents = sfs_getdents,
 	.vop_write = vopfail_uio_isdir,
 	.vop_ioctl = sfs_ioctl,
 	.vop_stat = sfs_stat,
 	.vop_gettype = sfs_gettype,
 	.vop_isseekable = sfs_isseekable,
+	.vop_poll = vop_poll_ready,
 	.vop_fsync = sfs_fsync,
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
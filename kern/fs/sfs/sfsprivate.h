@@ -32,6 +32,9 @@
 
 #include <uio.h> /* for uio_rw */
 
+struct stat;
+struct vnode_advice;
+
 
 /* ops tables (in sfs_vnops.c) */
 extern const struct vnode_ops sfs_fileops;
@@ -42,15 +45,134 @@ extern const struct vnode_ops sfs_dirops;
     uio_kinit(iov, uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
 
 
+/*
+ * A block in the buffer cache (sfs_buf.c). B_DATA may be used while
+ * the buffer is pinned, that is, between sfs_buf_read or sfs_buf_get
+ * and sfs_buf_release. Several threads may pin the same buffer; the
+ * cache doesn't stop them from changing the data at the same time,
+ * which is up to the lock on whatever the block belongs to (the
+ * file's vnode, or the freemap). Call sfs_buf_dirty after, not
+ * before, changing the contents, or sfs_buf_fdirty for file data so
+ * that fsync can find it; or for metadata, sfs_jdirty or (for a
+ * file's own) sfs_jfdirty, which also tie the change to the running
+ * journal transaction. B_JSEQ
+ * is that transaction's number until it commits, and the buffer is
+ * not written home meanwhile.
+ */
+struct sfs_buf {
+	struct sfs_fs *b_fs;		/* volume, or NULL if unused */
+	daddr_t b_block;		/* block number on the volume */
+	char *b_data;			/* SFS_BLOCKSIZE bytes */
+	unsigned b_pincount;		/* users; >0 means not evictable */
+	bool b_valid;			/* b_data holds the block */
+	bool b_dirty;			/* b_data newer than the disk */
+	bool b_reading;			/* being read in; wait for it */
+	bool b_writing;			/* being written out; keep it */
+	uint32_t b_jseq;		/* uncommitted transaction, or 0 */
+	time_t b_dirtysince;		/* when b_dirty was last set */
+	struct sfs_vnode *b_owner;	/* file whose dirty list it's on */
+	struct sfs_buf *b_ownprev;	/* that list */
+	struct sfs_buf *b_ownnext;
+	struct sfs_buf *b_hashnext;	/* hash chain, or unused list */
+	struct sfs_buf *b_lruprev;	/* LRU list (unpinned only) */
+	struct sfs_buf *b_lrunext;
+};
+
+/* Buffers in the cache (64k of data; 256k with 4k blocks) */
+#define SFS_NBUFS	(SFS_BLOCKSIZE <= 512 ? 128 : 64)
+
+/* Blocks reserved at a time for a growing file */
+#define SFS_PREALLOC	8
+
+/*
+ * Blocks being freed together, so that the freemap is locked and
+ * updated once for the lot rather than once per block (see
+ * sfs_bfree_batch). Lives on the stack of whoever is freeing.
+ */
+#define SFS_FREEBATCH	32
+struct sfs_freebatch {
+	unsigned fb_n;
+	daddr_t fb_blocks[SFS_FREEBATCH];
+};
+
+/*
+ * Free space index over the freemap: free block counts for each chunk
+ * of SFS_CHUNKBLOCKS blocks, and for each group of SFS_GROUPCHUNKS
+ * chunks, so that allocation can skip full regions without looking
+ * at their bits.
+ */
+#define SFS_CHUNKBLOCKS	256
+#define SFS_GROUPCHUNKS	32
+
+/*
+ * Blocks reserved when a file starts a run of delayed blocks, beyond
+ * one per block, for the indirect blocks placing them may need.
+ */
+#define SFS_DASLACK	3
+
+/*
+ * Free blocks below which a chunk group no longer takes new inodes
+ * for the directories in it (see sfs_inogoal).
+ */
+#define SFS_INOGROUPMIN	(SFS_CHUNKBLOCKS * SFS_GROUPCHUNKS / 16)
+
 /* Functions in sfs_balloc.c */
-int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock);
+int sfs_freemap_index(struct sfs_fs *sfs);
+int sfs_breserve(struct sfs_fs *sfs, unsigned nblocks);
+void sfs_bunreserve(struct sfs_fs *sfs, unsigned nblocks);
+int sfs_balloc(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock);
+int sfs_balloc_file(struct sfs_vnode *sv, daddr_t goal, daddr_t *diskblock);
+daddr_t sfs_inogoal(struct sfs_fs *sfs, struct sfs_vnode *dir);
+void sfs_prealloc_release(struct sfs_vnode *sv);
 void sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock);
+void sfs_freebatch_init(struct sfs_freebatch *fb);
+void sfs_bfree_batch(struct sfs_fs *sfs, struct sfs_freebatch *fb,
+		     daddr_t diskblock);
+void sfs_freebatch_flush(struct sfs_fs *sfs, struct sfs_freebatch *fb);
 int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
 
+/* Functions in sfs_buf.c */
+int sfs_buf_bootstrap(void);
+int sfs_buf_read(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret);
+int sfs_buf_get(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret);
+void sfs_buf_dirty(struct sfs_buf *b);
+void sfs_buf_fdirty(struct sfs_buf *b, struct sfs_vnode *sv);
+void sfs_buf_release(struct sfs_buf *b);
+void sfs_buf_release_cold(struct sfs_buf *b);
+void sfs_buf_cool(struct sfs_fs *sfs, daddr_t block);
+int sfs_buf_sync(struct sfs_fs *sfs);
+int sfs_buf_fsync(struct sfs_vnode *sv);
+void sfs_buf_disown(struct sfs_vnode *sv);
+void sfs_buf_forget(struct sfs_fs *sfs, daddr_t block);
+bool sfs_buf_cached(struct sfs_fs *sfs, daddr_t block);
+void sfs_buf_readahead(struct sfs_fs *sfs, daddr_t block);
+void sfs_buf_invalidate(struct sfs_fs *sfs);
+int sfs_buf_getanon(struct sfs_buf **ret);
+void sfs_buf_putanon(struct sfs_buf *b);
+void sfs_buf_jdirty(struct sfs_buf *b, uint32_t seq);
+unsigned sfs_buf_jpin(struct sfs_fs *sfs, uint32_t seq,
+		      struct sfs_buf **bufs);
+void sfs_buf_junpin(struct sfs_buf *b);
+
+/* Functions in sfs_journal.c */
+int sfs_journal_mount(struct sfs_fs *sfs);
+int sfs_journal_start(struct sfs_fs *sfs);
+int sfs_journal_unmount(struct sfs_fs *sfs);
+void sfs_journal_destroy(struct sfs_fs *sfs);
+void sfs_txn_begin(struct sfs_fs *sfs);
+void sfs_txn_end(struct sfs_fs *sfs);
+void sfs_jdirty(struct sfs_buf *b);
+void sfs_jfdirty(struct sfs_buf *b, struct sfs_vnode *sv);
+void sfs_journal_revoke(struct sfs_fs *sfs, daddr_t block);
+int sfs_journal_commit(struct sfs_fs *sfs);
+
 /* Functions in sfs_bmap.c */
 int sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		daddr_t *diskblock);
 int sfs_itrunc(struct sfs_vnode *sv, off_t len);
+int sfs_seekdata(struct sfs_vnode *sv, bool hole, off_t *pos);
+int sfs_falloc(struct sfs_vnode *sv, uint32_t first, uint32_t nblocks,
+		uint32_t left);
 
 /* Functions in sfs_dir.c */
 int sfs_dir_findname(struct sfs_vnode *sv, const char *name,
@@ -58,22 +180,45 @@ int sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 int sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino,
 		int *slot);
 int sfs_dir_unlink(struct sfs_vnode *sv, int slot);
+void sfs_dir_dropindex(struct sfs_vnode *sv);
+int sfs_dir_readmany(struct sfs_vnode *sv, int slot, struct sfs_direntry *sds,
+		int *slots, unsigned max, unsigned *nret);
 int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		struct sfs_vnode **ret,
 		int *slot);
 
+/*
+ * Loaded vnodes are hashed by inode number; the table starts with
+ * SFS_VNHASH_INIT buckets and doubles whenever there are more than
+ * two vnodes per bucket.
+ */
+#define SFS_VNHASH_INIT		64
+#define SFS_VNHASH(sfs, ino)	((ino) & ((sfs)->sfs_vnhashsize - 1))
+
+/* Unreferenced vnodes kept in memory by default (see sfs_inode.c) */
+#define SFS_VNCACHE_MAX		128
+
 /* Functions in sfs_inode.c */
 int sfs_sync_inode(struct sfs_vnode *sv);
 int sfs_reclaim(struct vnode *v);
 int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		struct sfs_vnode **ret);
-int sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret);
+int sfs_makeobj(struct sfs_fs *sfs, struct sfs_vnode *dir, int type,
+		struct sfs_vnode **ret);
+int sfs_statino(struct sfs_fs *sfs, uint32_t ino, struct stat *st);
 int sfs_getroot(struct fs *fs, struct vnode **ret);
+void sfs_vncache_purge(struct sfs_fs *sfs);
 
 /* Functions in sfs_io.c */
+int sfs_rawblock(struct sfs_fs *sfs, daddr_t block, void *data,
+		 enum uio_rw rw);
 int sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
+int sfs_inline_evict(struct sfs_vnode *sv);
 int sfs_io(struct sfs_vnode *sv, struct uio *uio);
+int sfs_advise(struct sfs_vnode *sv, const struct vnode_advice *va);
+int sfs_da_place(struct sfs_vnode *sv);
+void sfs_da_discard(struct sfs_vnode *sv, uint32_t blocklen);
 int sfs_metaio(struct sfs_vnode *sv, off_t pos, void *data, size_t len,
 	       enum uio_rw rw);
 
@@ -36,9 +36,13 @@
 
 
 #include <vm.h>
+#include <kern/timepage.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct pagetable;
+struct filecache_file;
+struct shm_segment;
 
 
 /*
@@ -58,10 +62,117 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
+        struct vm_region *as_regions;	/* defined segments, unsorted */
+        struct pagetable *as_pt;	/* pages; protected by vm_lock */
+        bool as_loading;		/* between prepare and complete_load */
+        unsigned as_asid;		/* TLB address space ID... */
+        unsigned as_asidgen;		/* ...valid in this generation */
+        uint32_t as_threadstacks;	/* slots with a stack region */
+        struct lock *as_maplock;	/* for mmap, munmap and msync */
+        struct vm_region *as_heap;	/* sbrk region, or NULL */
+        struct vm_region *as_stack;	/* main stack region, or NULL */
+        bool as_lockfuture;		/* mlockall(MCL_FUTURE) */
+        bool as_lockonexec;		/* mlockall(MCL_ONEXEC) */
 #endif
 };
 
+/*
+ * The main user stack has VM_STACKPAGES of address space, the top
+ * VM_STACKMAX bytes of which it may grow into; the page below that is
+ * never mapped, as a guard. This is also the largest RLIMIT_STACK.
+ */
+#define VM_STACKPAGES    512
+#define VM_STACKMAX      ((VM_STACKPAGES - 1) * PAGE_SIZE)
+
+#if !OPT_DUMBVM
+/*
+ * A region is a page-aligned range of virtual addresses that may be
+ * touched. Nothing is allocated for a region when it is defined; its
+ * pages are zero-filled by vm_fault on first reference.
+ *
+ * A read-only region may instead be mapped from a file, with
+ * as_map_file. Then the part of it from vr_filestart to vr_fileend
+ * holds the file's contents from vr_fileoff + (vr_filestart -
+ * vr_base) onward, and vm_fault maps those pages from the file cache.
+ *
+ * Regions made by mmap (VR_MMAP) are mapped from a file the same
+ * way, but may be writable. Writes to a private one (the default) go
+ * to copies of the pages, as after fork; writes to a VR_SHARED one go
+ * to the file cache's pages, and are written back to the file by
+ * msync, munmap or exit.
+ *
+ * Anonymous mmap regions have no file. A private one is zero-filled
+ * like any other region; a shared one (VR_SHARED) has a shared
+ * memory segment instead, vr_shm, whose frames every process mapping
+ * it shares, with no file behind them to write back to.
+ *
+ * The heap is a region like any other, made empty just past the end
+ * of the program by as_complete_load; sbrk changes its size. Its
+ * pages are zero-filled on first touch like the rest, and freed
+ * again when the heap shrinks.
+ *
+ * madvise sets a region's vr_advice. MADV_SEQUENTIAL makes vm_fault
+ * map file pages ahead of the one faulted on, and hand the pages
+ * well behind it to the clock first; the other values don't change
+ * anything yet.
+ *
+ * The region list may only be changed with vm_lock held once the
+ * process is running, since other threads may be faulting.
+ */
+struct vm_region {
+        vaddr_t vr_base;		/* page-aligned start */
+        size_t vr_npages;
+        int vr_perm;			/* VR_* below */
+        struct filecache_file *vr_file;	/* or NULL */
+        off_t vr_fileoff;		/* file offset of vr_base */
+        vaddr_t vr_filestart;
+        vaddr_t vr_fileend;
+        struct shm_segment *vr_shm;	/* or NULL */
+        int vr_advice;			/* MADV_NORMAL/SEQUENTIAL/RANDOM */
+        struct vm_region *vr_next;
+};
+
+#define VR_READ    0x4
+#define VR_WRITE   0x2
+#define VR_EXEC    0x1
+#define VR_SHARED  0x8			/* writes go to the file */
+#define VR_MMAP    0x10			/* made by mmap */
+
+/*
+ * The main stack region starts out VM_STACKINITPAGES long; vm_fault
+ * grows it down (as_growstack) when something touches the space
+ * below it, as far as the process's RLIMIT_STACK allows.
+ */
+#define VM_STACKINITPAGES  2
+
+/*
+ * Stacks for the other threads of a multithreaded process go below
+ * the main stack, in VM_THREADSTACKS slots of VM_THREADSTACKPAGES
+ * each plus an unmapped guard page underneath. A slot's region is
+ * made the first time it is used and kept for later threads.
+ */
+#define VM_THREADSTACKS       31
+#define VM_THREADSTACKPAGES   64
+#define VM_STACKAREAPAGES \
+	(VM_STACKPAGES + VM_THREADSTACKS * (VM_THREADSTACKPAGES + 1))
+
+/*
+ * The heap may grow up to VM_MMAPBASE. mmap puts mappings as high as
+ * they fit below the time page (kern/timepage.h), which is just
+ * below the stacks, down to VM_MMAPBASE.
+ */
+#define VM_MMAPTOP   TIMEPAGE_VADDR
+#define VM_MMAPBASE  0x40000000
+
+/*
+ * Pages vm_fault maps ahead in an MADV_SEQUENTIAL file region (and
+ * how far behind it lets them go), and the most pages one
+ * MADV_WILLNEED reads in.
+ */
+#define VM_FAULTAHEAD     8
+#define AS_WILLNEEDPAGES  64
+#endif
+
 /*
  * Functions in addrspace.c:
  *
@@ -95,10 +206,93 @@ struct addrspace {
  *    as_complete_load - this is called when loading from an executable
  *                is complete.
  *
+ *    as_complete_load also sets up the (empty) heap, just above the
+ *                highest region defined so far, without dumbvm.
+ *
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_define_threadstack - likewise for the stack in slot SLOT for
+ *                another thread of a multithreaded process. The same
+ *                slot may be defined again once its thread is gone.
+ *                (Not supported with dumbvm.)
+ *
+ *    as_findregion - return the region containing VADDR, or NULL.
+ *                (Not available with dumbvm.)
+ *
+ *    as_growstack - grow the main stack region down to cover VADDR,
+ *                if that is within LIMIT bytes of the top of the
+ *                stack, and return it; otherwise return NULL. Call
+ *                with vm_lock held. (Not available with dumbvm.)
+ *
+ *    as_map_file - make the FILESIZE bytes at VADDR, in a read-only
+ *                region already defined, come from the file V at
+ *                OFFSET, instead of loading them. Fails with EINVAL
+ *                if the region can't be mapped (another region
+ *                shares one of its pages, or VADDR and OFFSET are
+ *                not the same distance into a page); the caller can
+ *                load it instead. (Not available with dumbvm.)
+ *
+ *    as_mmap   - map LEN bytes of the file V from OFFSET, which must be
+ *                page-aligned, at a free place chosen by the kernel,
+ *                with permissions PERM (VR_* including VR_SHARED).
+ *                With V NULL, map anonymous memory instead, shared
+ *                with children if VR_SHARED is set. Hands back the
+ *                address. Fails with ENOMEM if there is no room.
+ *                (Not available with dumbvm.)
+ *
+ *    as_munmap - remove the mmap regions in the LEN bytes from VADDR,
+ *                writing back shared pages that were written. Fails
+ *                with EINVAL if the range would split a region or
+ *                includes one not made by mmap. (Not available with
+ *                dumbvm.)
+ *
+ *    as_msync  - write back the written pages of the shared mmap
+ *                regions in the LEN bytes from VADDR. (Not available
+ *                with dumbvm.)
+ *
+ *    as_madvise - take madvise advice (MADV_*) about the LEN bytes at
+ *                VADDR. NORMAL, SEQUENTIAL and RANDOM are recorded in
+ *                every region the range touches; WILLNEED reads in
+ *                the range's file pages (up to AS_WILLNEEDPAGES of
+ *                them); DONTNEED drops the range's pages, writing
+ *                back shared ones first, so they come back from the
+ *                file or as zeros. Fails with EINVAL for a bad range.
+ *                (Not available with dumbvm.)
+ *
+ *    as_sbrk   - move the end of the heap by AMOUNT bytes, a multiple
+ *                of the page size, and hand back the old end. Fails
+ *                with EINVAL if the heap would end up smaller than
+ *                empty or AMOUNT isn't page-aligned, and ENOMEM if
+ *                there is no room for it. (Not available with
+ *                dumbvm.)
+ *
+ *    as_mlock  - lock (LOCK true) or unlock the pages in the LEN
+ *                bytes from VADDR in memory; locking faults them in
+ *                and pins them. Fails with ENOMEM if part of the
+ *                range isn't mapped or locking it would pass
+ *                curproc's RLIMIT_MEMLOCK, and EAGAIN if it would
+ *                lock more than half of memory. (Not available with
+ *                dumbvm.)
+ *
+ *    as_mlockall - MCL_* flags: lock everything mapped now, have
+ *                new pages locked as they arrive, and/or have execv
+ *                lock the next program. Fails as as_mlock does.
+ *                (Not available with dumbvm.)
+ *
+ *    as_munlockall - unlock everything and clear the MCL_* flags.
+ *                (Not available with dumbvm.)
+ *
+ *    as_populate - fault in the pages in the LEN bytes from VADDR
+ *                ahead of use, as far as memory allows, for
+ *                MAP_POPULATE. (Not available with dumbvm.)
+ *
+ * Without dumbvm, the functions that make the address space bigger
+ * (all but as_copy) fail with ENOMEM, or as_growstack with NULL, if
+ * that would take it past curproc's RLIMIT_AS; as_sbrk also fails
+ * past RLIMIT_DATA.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -117,6 +311,31 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_define_threadstack(struct addrspace *as, unsigned slot,
+                                        vaddr_t *initstackptr);
+#if !OPT_DUMBVM
+struct vm_region *as_findregion(struct addrspace *as, vaddr_t vaddr);
+struct vm_region *as_growstack(struct addrspace *as, vaddr_t vaddr,
+                               size_t limit);
+int               as_map_file(struct addrspace *as, vaddr_t vaddr,
+                              size_t filesize, struct vnode *v,
+                              off_t offset);
+int               as_mmap(struct addrspace *as, size_t len, int perm,
+                          struct vnode *v, off_t offset, vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr,
+                            size_t len);
+int               as_msync(struct addrspace *as, vaddr_t vaddr, size_t len);
+int               as_madvise(struct addrspace *as, vaddr_t vaddr,
+                             size_t len, int advice);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *ret);
+int               as_mlock(struct addrspace *as, vaddr_t vaddr, size_t len,
+                           bool lock);
+int               as_mlockall(struct addrspace *as, int flags);
+void              as_munlockall(struct addrspace *as);
+void              as_populate(struct addrspace *as, vaddr_t vaddr,
+                              size_t len);
+#endif
 
 
 /*
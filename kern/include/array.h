@@ -60,11 +60,19 @@
  * setsize - change size to NUM elements; may fail and return error.
  * add - append VAL to end of array; return its index in INDEX_RET if
  *       INDEX_RET isn't null; may fail and return error.
+ * addmany - append the N values in VALS; may fail and return error,
+ *       in which case nothing is added.
  * remove - excise entry INDEX and slide following entries down to
  *       close the resulting gap.
+ * remove_unordered - excise entry INDEX by moving the last entry into
+ *       its place. Constant time, but doesn't keep the order.
+ * shrink - give back the space beyond the current size.
  *
  * Note that expanding an array with setsize doesn't initialize the new
  * elements. (Usually the caller is about to store into them anyway.)
+ *
+ * Space grows by at least doubling, so N adds cost O(N) in all; it
+ * never shrinks except by shrink (or cleanup).
  */
 
 struct array {
@@ -82,7 +90,10 @@ ARRAYINLINE void array_set(const struct array *, unsigned index, void *val);
 int array_preallocate(struct array *, unsigned num);
 int array_setsize(struct array *, unsigned num);
 ARRAYINLINE int array_add(struct array *, void *val, unsigned *index_ret);
+int array_addmany(struct array *, void *const *vals, unsigned n);
 void array_remove(struct array *, unsigned index);
+ARRAYINLINE void array_remove_unordered(struct array *, unsigned index);
+void array_shrink(struct array *);
 
 /*
  * Inlining for base operations
@@ -126,6 +137,14 @@ array_add(struct array *a, void *val, unsigned *index_ret)
 	return 0;
 }
 
+ARRAYINLINE void
+array_remove_unordered(struct array *a, unsigned index)
+{
+	ARRAYASSERT(index < a->num);
+	a->num--;
+	a->v[index] = a->v[a->num];
+}
+
 /*
  * Bits for declaring and defining typed arrays.
  *
@@ -180,7 +199,10 @@ array_add(struct array *a, void *val, unsigned *index_ret)
 	INLINE int ARRAY##_preallocate(struct ARRAY *a, unsigned num);	\
 	INLINE int ARRAY##_setsize(struct ARRAY *a, unsigned num);	\
 	INLINE int ARRAY##_add(struct ARRAY *a, T *val, unsigned *index_ret); \
-	INLINE void ARRAY##_remove(struct ARRAY *a, unsigned index)
+	INLINE int ARRAY##_addmany(struct ARRAY *a, T *const *vals, unsigned n); \
+	INLINE void ARRAY##_remove(struct ARRAY *a, unsigned index);	\
+	INLINE void ARRAY##_remove_unordered(struct ARRAY *a, unsigned index); \
+	INLINE void ARRAY##_shrink(struct ARRAY *a)
 
 #define DEFARRAY_BYTYPE(ARRAY, T, INLINE) \
 	INLINE struct ARRAY *					\
@@ -249,10 +271,28 @@ array_add(struct array *a, void *val, unsigned *index_ret)
 		return array_add(&a->arr, (void *)val, index_ret); \
 	}							\
 								\
+	INLINE int						\
+	ARRAY##_addmany(struct ARRAY *a, T *const *vals, unsigned n) \
+	{							\
+		return array_addmany(&a->arr, (void *const *)vals, n); \
+	}							\
+								\
 	INLINE void						\
 	ARRAY##_remove(struct ARRAY *a, unsigned index)		\
 	{							\
 		array_remove(&a->arr, index);			\
+	}							\
+								\
+	INLINE void						\
+	ARRAY##_remove_unordered(struct ARRAY *a, unsigned index) \
+	{							\
+		array_remove_unordered(&a->arr, index);		\
+	}							\
+								\
+	INLINE void						\
+	ARRAY##_shrink(struct ARRAY *a)				\
+	{							\
+		array_shrink(&a->arr);				\
 	}
 
 #define DECLARRAY(T, INLINE) DECLARRAY_BYTYPE(T##array, struct T, INLINE)
@@ -0,0 +1,30 @@
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*
+ * Atomic operations on machine words, for lock-free fast paths.
+ *
+ *    atomic_cas      - if *P is OLD, set it to NEW. Returns what *P
+ *                      was, so it succeeded if that is OLD.
+ *    atomic_fetchadd - add DELTA to *P. Returns the old value.
+ *    atomic_swap     - set *P to NEW. Returns the old value.
+ *
+ * These are atomic but are not memory barriers; pair them with
+ * membar_store_any after taking something and membar_any_store
+ * before giving it back, as the spinlock code does.
+ */
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef ATOMIC_INLINE
+#define ATOMIC_INLINE INLINE
+#endif
+
+ATOMIC_INLINE unsigned atomic_cas(volatile unsigned *p,
+				  unsigned old, unsigned new);
+ATOMIC_INLINE unsigned atomic_fetchadd(volatile unsigned *p, int delta);
+ATOMIC_INLINE unsigned atomic_swap(volatile unsigned *p, unsigned new);
+
+/* Get the implementation. */
+#include <machine/atomic.h>
+
+#endif /* _ATOMIC_H_ */
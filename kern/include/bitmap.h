@@ -38,9 +38,17 @@
  *                      Returns NULL on error.
  *     bitmap_getdata - return pointer to raw bit data (for I/O).
  *     bitmap_alloc   - locate a cleared bit, set it, and return its index.
+ *                      The search starts after the last bit this
+ *                      handed out, wrapping around.
+ *     bitmap_alloc_from - same, but search from a given index onward,
+ *                      wrapping around.
+ *     bitmap_alloc_range - locate NUM cleared bits in a row, set them,
+ *                      and return the first one's index.
  *     bitmap_mark    - set a clear bit by its index.
  *     bitmap_unmark  - clear a set bit by its index.
+ *     bitmap_unmark_range - clear NUM set bits from INDEX on.
  *     bitmap_isset   - return whether a particular bit is set or not.
+ *     bitmap_count   - return how many bits are set.
  *     bitmap_destroy - destroy bitmap.
  */
 
@@ -50,9 +58,16 @@ struct bitmap;  /* Opaque. */
 struct bitmap *bitmap_create(unsigned nbits);
 void          *bitmap_getdata(struct bitmap *);
 int            bitmap_alloc(struct bitmap *, unsigned *index);
+int            bitmap_alloc_from(struct bitmap *, unsigned start,
+                                 unsigned *index);
+int            bitmap_alloc_range(struct bitmap *, unsigned num,
+                                  unsigned *index);
 void           bitmap_mark(struct bitmap *, unsigned index);
 void           bitmap_unmark(struct bitmap *, unsigned index);
+void           bitmap_unmark_range(struct bitmap *, unsigned index,
+                                   unsigned num);
 int            bitmap_isset(struct bitmap *, unsigned index);
+unsigned       bitmap_count(struct bitmap *);
 void           bitmap_destroy(struct bitmap *);
 
 
@@ -0,0 +1,26 @@
+#ifndef _BOOTPROF_H_
+#define _BOOTPROF_H_
+
+/*
+ * Boot profile: how long each step of boot() took.
+ *
+ * boot() calls bootprof_stamp as each bootstrap function returns,
+ * which records the time in a small ring, stamped with both the
+ * hardclock count and the cpu cycle counter. The cycle counter gives
+ * sub-tick times for short steps; a step that spans a hardclock is
+ * timed in whole hardclocks instead, as the counter restarts at each
+ * one. Before the timer is started in mainbus_bootstrap everything
+ * is timed by cycles.
+ *
+ *    bootprof_stamp   - record that WHAT has just finished. WHAT must
+ *                       be a string constant.
+ *    bootprof_elapsed - microseconds from the first stamp to the last.
+ *    bootprof_print   - print the steps as a table (for the bootprof
+ *                       menu command).
+ */
+
+void bootprof_stamp(const char *what);
+unsigned bootprof_elapsed(void);
+void bootprof_print(void);
+
+#endif /* _BOOTPROF_H_ */
@@ -57,12 +57,21 @@
 #define __PF(a,b) __attribute__((__format__(__printf__, a, b)))
 #define __DEAD    __attribute__((__noreturn__))
 #define __UNUSED  __attribute__((__unused__))
+#define __aligned(n) __attribute__((__aligned__(n)))
 #else
 #define __PF(a,b)
 #define __DEAD
 #define __UNUSED
+#define __aligned(n)
 #endif
 
+/*
+ * Start a field or variable on a cache line of its own, so that
+ * writes to what comes before it don't take the line away from cpus
+ * reading it (false sharing). CACHELINE_SIZE is in <machine/types.h>.
+ */
+#define __cacheline_aligned __aligned(CACHELINE_SIZE)
+
 
 /*
  * Material for supporting inline functions.
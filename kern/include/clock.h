@@ -38,8 +38,8 @@
 
 
 /*
- * hardclock() is called on every CPU HZ times a second, possibly only
- * when the CPU is not idle, for scheduling.
+ * hardclock() is called on every CPU HZ times a second, except while
+ * the CPU is idle, for scheduling.
  */
 
 /* hardclocks per second */
@@ -48,6 +48,16 @@
 void hardclock_bootstrap(void);
 void hardclock(void);
 
+/*
+ * Tickless idle (see clock.c). hardclock_idle and hardclock_unidle
+ * bracket cpu_idle() in the idle loop; hardclock_catchup is called
+ * by the timer code in place of hardclock() for hardclocks that were
+ * skipped, and by hardclock_unidle.
+ */
+void hardclock_idle(void);
+void hardclock_unidle(void);
+void hardclock_catchup(unsigned nticks);
+
 /*
  * timerclock() is called on one CPU once a second to allow simple
  * timed operations. (This is a fairly simpleminded interface.)
@@ -64,6 +74,7 @@ void gettime(struct timespec *ret);
  *
  * add: ret = t1 + t2
  * sub: ret = t1 - t2
+ * to_ticks: t in hardclocks, rounded up
  */
 
 void timespec_add(const struct timespec *t1,
@@ -72,12 +83,87 @@ void timespec_add(const struct timespec *t1,
 void timespec_sub(const struct timespec *t1,
 		  const struct timespec *t2,
 		  struct timespec *ret);
+uint64_t timespec_to_ticks(const struct timespec *t);
 
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ * clocksleep_ticks() is the same in hardclocks.
  */
 void clocksleep(int seconds);
+void clocksleep_ticks(unsigned ticks);
+
+/*
+ * Timeouts: call a function once, a given number of hardclocks from
+ * now. The function runs in interrupt context on one CPU, so it may
+ * not sleep; it is called without any locks held.
+ *
+ * Pending timeouts live on a hierarchical timer wheel (see clock.c),
+ * so arming and cancelling are constant-time and each tick only
+ * looks at the timeouts that are actually due.
+ *
+ *    timeout_init   - set up TO to call FUNC(ARG). TO must stay valid
+ *                     until it has fired or been cancelled.
+ *    timeout_arm    - schedule TO to fire in TICKS hardclocks (at
+ *                     least 1). TO must not already be pending.
+ *    timeout_cancel - stop TO if it is pending. If it is firing right
+ *                     now, waits for FUNC to return, so once this
+ *                     returns FUNC is not running and won't be. May
+ *                     not be called holding anything FUNC needs, or
+ *                     from interrupt context. Returns true if TO was
+ *                     stopped before it fired.
+ */
+struct timeout {
+	struct timeout *to_next;	/* wheel slot list */
+	struct timeout **to_pprev;
+	unsigned to_expires;		/* tick at which to fire */
+	void (*to_func)(void *);
+	void *to_arg;
+	volatile unsigned to_state;	/* TO_IDLE etc., in clock.c */
+};
+
+void timeout_init(struct timeout *to, void (*func)(void *), void *arg);
+void timeout_arm(struct timeout *to, unsigned ticks);
+bool timeout_cancel(struct timeout *to);
+
+/*
+ * High-resolution monotonic clock, from the cpu cycle counter.
+ *
+ * This is what to time things with. gettime reads the clock device,
+ * which is slower and coarser. The raw counter (cpu_getcycles) starts
+ * again from zero every hardclock; mainbus_cycles keeps the count
+ * across those restarts, so this clock runs on across ticks.
+ *
+ *    clock_calibrate    - measure the cycle counter against the
+ *                         time-of-day clock, and start the clock at
+ *                         0. Call once, when the clock device has
+ *                         attached; it spins for CLOCK_CALNS.
+ *    clock_monotonic_ns - nanoseconds since clock_calibrate (0
+ *                         before). Any context; never sleeps.
+ *                         Never goes back on one cpu; between cpus,
+ *                         each of which syncs with the time-of-day
+ *                         clock the first time it is asked, it may
+ *                         disagree by about that clock's resolution.
+ *    clock_cycles       - the current cpu's cycle count, for timing
+ *                         short stretches without converting; only
+ *                         differences on one cpu mean anything.
+ *    clock_cycles_to_ns - convert a difference of clock_cycles.
+ *    clock_boottime     - the time of day at monotonic 0.
+ */
+#define CLOCK_CALNS	20000000	/* 20ms */
+
+void clock_calibrate(void);
+uint64_t clock_monotonic_ns(void);
+uint64_t clock_cycles(void);
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+void clock_boottime(struct timespec *ret);
+
+/*
+ * Hardclocks since the timer was started, by the timeout clock. Wraps;
+ * only differences are meaningful. While cpu 0 is idle it may lag by
+ * the ticks it has yet to catch up on.
+ */
+unsigned clock_ticks(void);
 
 
 #endif /* _CLOCK_H_ */
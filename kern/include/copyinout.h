@@ -69,5 +69,24 @@ int copyout(const void *src, userptr_t userdest, size_t len);
 int copyinstr(const_userptr_t usersrc, char *dest, size_t len, size_t *got);
 int copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *got);
 
+/*
+ * copyin_bulk and copyout_bulk copy several separate blocks, each
+ * like one copyin or copyout, for the cost of setting up one: every
+ * block is checked first, and nothing is copied if any is bad. On a
+ * fault partway through, some blocks may have been copied.
+ *
+ * Each thread counts the bytes it moves through all of these in
+ * t_copiedin and t_copiedout, which the system call dispatcher
+ * charges to the call.
+ */
+struct copyvec {
+	userptr_t cv_user;
+	void *cv_kern;
+	size_t cv_len;
+};
+
+int copyin_bulk(const struct copyvec *vec, unsigned n);
+int copyout_bulk(const struct copyvec *vec, unsigned n);
+
 
 #endif /* _COPYINOUT_H_ */
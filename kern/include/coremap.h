@@ -0,0 +1,125 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Coremap: the physical page allocator.
+ *
+ * There is one entry per physical page of RAM. Pages are handed out
+ * in contiguous blocks by a buddy allocator; the entry at the head of
+ * each block records its length, so freeing only needs the block's
+ * starting address.
+ *
+ * Before coremap_bootstrap() runs, allocations are passed straight
+ * through to ram_stealmem(). Memory obtained that way (and the
+ * kernel image itself) is marked fixed and is never reclaimed;
+ * freeing it is silently ignored.
+ *
+ *    coremap_bootstrap - take over physical memory from ram.c. Call
+ *                        once, from boot(), before the devices are
+ *                        probed and before the other CPUs start.
+ *
+ *    coremap_getpages  - allocate NPAGES physically contiguous pages.
+ *                        Returns 0 if no such run is available.
+ *
+ *    coremap_freepages - drop a reference to a block previously
+ *                        returned by coremap_getpages; the block is
+ *                        freed when the last reference goes away.
+ *
+ *    coremap_getzeroed - allocate one page, cleared to zero, from the
+ *                        pool the zeroer thread keeps ready if it can.
+ *                        Returns 0 if no page is available.
+ *
+ *    coremap_zero_bootstrap - start the zeroer thread. Call once the
+ *                        thread system is up.
+ *
+ *    coremap_incref    - add a reference to an allocated block (used
+ *                        to share pages copy-on-write).
+ *
+ *    coremap_refcount  - return the number of references to a block.
+ *
+ *    coremap_numfree   - pages free (including zeroed ones), and
+ *    coremap_numpages  - pages managed; for the pageout thread's
+ *                        watermarks.
+ *
+ * For the paging VM system, user pages carry an owner so they can be
+ * evicted:
+ *
+ *    coremap_setowner  - record the page table and address mapping a
+ *                        user page (NULL PT: not evictable).
+ *
+ *    coremap_disown    - clear the owner if it is PT.
+ *
+ *    coremap_touch     - mark a page recently used.
+ *
+ *    coremap_untouch   - mark a page not recently used, so the clock
+ *                        takes it the next time round. Returns
+ *                        whether it had been used.
+ *
+ *    coremap_clockvictim - choose a page to evict with the back hand
+ *                        of the clock; see coremap.c.
+ *
+ *    coremap_clockage  - move the front hand of the clock along
+ *                        without evicting anything.
+ *
+ *    coremap_pin       - pin a user page in memory, for mlock; a
+ *    coremap_unpin       pinned page is never evicted. Pins count.
+ *
+ *    coremap_numpinned - pages pinned.
+ *
+ *    coremap_clusterable - true if a page can be paged out along with
+ *                        its neighbour in PT: unshared, PT's, and
+ *                        not referenced.
+ *
+ *    coremap_sethandspread, coremap_gethandspread - the least distance
+ *                        between the hands, in pages.
+ *
+ * Both hands hand back the pages whose references they took, as
+ * struct coremap_refs; the caller must shoot down their TLB entries
+ * (holding vm_lock throughout) so that the next use is seen.
+ *
+ *    coremap_printstats - print page usage (for the kh menu command).
+ *
+ *    coremap_printfrag  - print the free block size distribution (for
+ *                         the khdump menu command).
+ */
+
+#include <types.h>
+
+struct pagetable;
+
+/* A page whose reference the clock took */
+struct coremap_ref {
+	struct pagetable *cr_pt;
+	vaddr_t cr_vaddr;
+};
+
+/* Most references coremap_clockvictim takes in one call */
+#define CM_MAXREFS	16
+
+void coremap_bootstrap(void);
+paddr_t coremap_getpages(unsigned long npages);
+paddr_t coremap_getzeroed(void);
+void coremap_zero_bootstrap(void);
+void coremap_freepages(paddr_t paddr);
+void coremap_incref(paddr_t paddr);
+unsigned coremap_refcount(paddr_t paddr);
+unsigned coremap_numfree(void);
+unsigned coremap_numpages(void);
+void coremap_setowner(paddr_t paddr, struct pagetable *pt, vaddr_t vaddr);
+void coremap_disown(paddr_t paddr, struct pagetable *pt);
+void coremap_touch(paddr_t paddr);
+bool coremap_untouch(paddr_t paddr);
+paddr_t coremap_clockvictim(struct pagetable **pt, vaddr_t *vaddr,
+			    struct coremap_ref *refs, unsigned *nrefs);
+unsigned coremap_clockage(unsigned *npages, struct coremap_ref *refs,
+			  unsigned max);
+void coremap_pin(paddr_t paddr);
+void coremap_unpin(paddr_t paddr);
+unsigned coremap_numpinned(void);
+bool coremap_clusterable(paddr_t paddr, struct pagetable *pt);
+void coremap_sethandspread(unsigned npages);
+unsigned coremap_gethandspread(void);
+void coremap_printstats(void);
+void coremap_printfrag(void);
+
+#endif /* _COREMAP_H_ */
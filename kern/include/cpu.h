@@ -33,7 +33,9 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
-#include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include <percpu.h>
+#include <kern/sched.h>
+#include <machine/vm.h>  /* for struct tlbshootdown */
 
 
 /*
@@ -46,6 +48,30 @@
  * a pointer with a fixed address and a per-cpu mapping in the MMU.
  */
 
+/* Size of the per-cpu free page cache. */
+#define PAGECACHE_MAX	32
+
+/* Spare thread stacks kept per cpu; see thread_stack_get in thread.c. */
+#define THREAD_STACKCACHE	4
+
+/* Spare pathname buffers kept per cpu; see pathbuf_get in helpers.c. */
+#define PATHBUF_CACHE		4
+
+/* Number of run queue priority levels; see schedule() in thread.c. */
+#define RUNQUEUE_LEVELS	4
+
+/* Cross-cpu calls that can be waiting for one cpu; see smp_call. */
+#define SMP_CALL_MAX		16
+
+struct smp_call;
+
+/*
+ * Each group of fields below that other cpus write, or that this cpu
+ * writes and others poll, starts on a cache line of its own, so that
+ * a remote cpu queueing a thread or posting an IPI doesn't steal the
+ * line holding what this cpu reads on every switch and trap (and the
+ * other way round). cpu_create checks the struct itself is aligned.
+ */
 struct cpu {
 	/*
 	 * Fixed after allocation.
@@ -61,33 +87,95 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	unsigned c_asidgen;		/* ASID generation of our TLB */
+	unsigned c_lastboost;		/* c_hardclocks at last priority boost */
+	uint64_t c_runticks;		/* hardclocks with a thread running */
+	uint64_t c_idleticks;		/* hardclocks spent idle */
+	uint64_t c_skippedticks;	/* of those, with the timer off */
+	unsigned c_nsteals;		/* threads stolen from other cpus */
+	void *c_argbuf;			/* spare exec argument arena */
+	void *c_stacks[THREAD_STACKCACHE]; /* spare thread stacks */
+	unsigned c_nstacks;
+	void *c_pathbufs[PATHBUF_CACHE]; /* spare PATH_MAX buffers */
+	unsigned c_npathbufs;
+	bool c_clocksynced;		/* c_clockbase_* set (see clock.c) */
+	uint64_t c_clockbase_ns;	/* monotonic ns at... */
+	uint64_t c_clockbase_cyc;	/* ...this mainbus_cycles() */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
+	 *
+	 * There is one run queue per priority level, highest (0)
+	 * first, and above them one per real-time priority, highest
+	 * (SCHED_PRIO_MAX) first. c_runcount is the total across all
+	 * of them; other cpus read it without the lock to decide whom
+	 * to steal from. c_preempt asks the cpu to give way to a
+	 * real-time thread just queued, or to whatever the timer
+	 * wanted to switch to while it couldn't (thread_preemptcheck).
 	 */
-	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	bool c_isidle __cacheline_aligned; /* True if this cpu is idle */
+	struct threadlist c_runqueue[RUNQUEUE_LEVELS]; /* Run queues */
+	struct threadlist c_rtqueue[SCHED_PRIO_MAX]; /* Real-time ones */
+	unsigned c_runcount;		/* Threads on all of them */
+	volatile bool c_preempt;	/* Switch at the next chance */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Threads woken by other cpus, pushed without any lock and
+	 * moved onto the run queues by this cpu (thread_inbox_drain).
+	 * Newest first, linked through t_inboxnext.
+	 */
+	struct thread *volatile c_inbox __cacheline_aligned;
+
+	/*
+	 * Written only by this cpu; read by other cpus without a lock
+	 * (see rcu.c and percpu.c).
+	 */
+	volatile unsigned c_rcu_qs __cacheline_aligned; /* QSs passed */
+	volatile uint64_t c_counters[PCPU_NCOUNTERS]; /* event counters */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
 	 *
-	 * TLB shootdown requests made to this CPU are queued in
-	 * c_shootdown[], with c_numshootdown holding the number of
-	 * requests. TLBSHOOTDOWN_MAX is the maximum number that can
-	 * be queued at once, which is machine-dependent.
-	 *
-	 * The contents of struct tlbshootdown are also machine-
-	 * dependent and might reasonably be either an address space
-	 * and vaddr pair, or a paddr, or something else.
+	 * c_ipi_pending has a bit for each IPI number posted since
+	 * this cpu last looked. The interrupt itself is only sent when
+	 * it goes from none to some, so requests that pile up before
+	 * the cpu gets to them share one interrupt. Cross-cpu calls
+	 * queued for this cpu (smp_call) wait in c_calls[], c_ncalls
+	 * of them, room for SMP_CALL_MAX.
 	 */
-	uint32_t c_ipi_pending;		/* One bit for each IPI number */
-	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
-	unsigned c_numshootdown;
+	uint32_t c_ipi_pending __cacheline_aligned; /* Bit per IPI number */
+	struct smp_call *c_calls[SMP_CALL_MAX];
+	unsigned c_ncalls;
 	struct spinlock c_ipi_lock;
 
+	/*
+	 * Cache of free physical pages in front of the coremap (see
+	 * coremap.c). Protected by c_pagecache_lock, which other cpus
+	 * only take when reclaiming pages from it.
+	 */
+	struct spinlock c_pagecache_lock __cacheline_aligned;
+	paddr_t c_pagecache[PAGECACHE_MAX];
+	unsigned c_pagecache_num;
+	bool c_pagecache_registered;	/* known to coremap.c */
+	unsigned c_pagecache_hits;	/* allocs served from the cache */
+	unsigned c_pagecache_misses;	/* allocs that had to refill */
+
+#if OPT_SPINLOCKPROF
+	/*
+	 * Spinlock profile ("options spinlockprof"). Only this cpu
+	 * writes these. Hold times are in cycles.
+	 */
+	unsigned c_splk_acquires __cacheline_aligned; /* acquire calls */
+	unsigned c_splk_contended;	/* ... that had to wait */
+	uint64_t c_splk_spins;		/* total wait loop iterations */
+	unsigned c_splk_maxspins;	/* longest single wait */
+	uint32_t c_splk_maxhold;	/* longest hold */
+	const struct spinlock *c_splk_maxholder; /* lock held that long */
+#endif
+
 	/*
 	 * Accessed by other cpus. Protected inside hangman.c.
 	 */
@@ -125,6 +213,12 @@ void cpu_identify(char *buf, size_t max);
 void cpu_irqoff(void);
 void cpu_irqon(void);
 
+/*
+ * Read the current CPU's free-running cycle counter. Wraps; only
+ * differences of nearby readings are meaningful.
+ */
+uint32_t cpu_getcycles(void);
+
 /*
  * Idle or shut down (respectively) the processor.
  *
@@ -154,21 +248,53 @@ void cpu_halt(void);
  *
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
- * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown carries out one TLB shootdown on another CPU, and
+ * ipi_tlbshootdown_broadcast a batch of N on all CPUs except the
+ * current one; both wait until it has been done.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
+ *
+ * Cross-CPU function calls: smp_call queues CALL to be made on
+ * TARGET, from its IPI handler, so with interrupts off; the function
+ * must not sleep. It doesn't wait; the caller must keep CALL around
+ * until smp_call_done says it's been made everywhere it was queued
+ * (one call may be queued on several CPUs at once), or wait for that
+ * with smp_call_wait. Queueing on the current CPU makes the call at
+ * once. smp_call_function calls FUNC(ARG) on TARGET and waits for it;
+ * smp_call_function_others does the same on every other CPU, one IPI
+ * each at most. Waiting needs interrupts on, so no spinlocks held,
+ * and not to be in an interrupt handler.
+ *
+ * Every kind of request to a CPU shares its IPI: whatever has piled
+ * up since the last one is handled by the next.
  */
 
 /* IPI types */
 #define IPI_PANIC		0	/* System has called panic() */
 #define IPI_OFFLINE		1	/* CPU is requested to go offline */
 #define IPI_UNIDLE		2	/* Runnable threads are available */
-#define IPI_TLBSHOOTDOWN	3	/* MMU mapping(s) need invalidation */
+#define IPI_CALL		3	/* Cross-CPU calls are queued */
+#define IPI_RESCHED		4	/* A real-time thread is waiting */
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_broadcast(const struct tlbshootdown *mappings,
+				unsigned n);
+
+struct smp_call {
+	void (*sc_func)(void *arg);
+	void *sc_arg;
+	volatile unsigned sc_left;	/* CPUs still to make the call */
+};
+
+void smp_call_init(struct smp_call *call, void (*func)(void *), void *arg);
+void smp_call(struct cpu *target, struct smp_call *call);
+bool smp_call_done(const struct smp_call *call);
+void smp_call_wait(struct smp_call *call);
+void smp_call_function(struct cpu *target, void (*func)(void *), void *arg);
+void smp_call_function_others(void (*func)(void *), void *arg);
 
 void interprocessor_interrupt(void);
 
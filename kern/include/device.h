@@ -36,6 +36,7 @@
 
 
 struct uio;  /* in <uio.h> */
+struct pollset;  /* in <poll.h> */
 
 /*
  * Filesystem-namespace-accessible device.
@@ -51,16 +52,70 @@ struct device {
 	void *d_data;		/* device-specific data */
 };
 
+/*
+ * Block I/O request, for devices that can queue them.
+ *
+ * The caller fills in everything but DR_RESULT and DR_NEXT and hands
+ * the request to devop_strategy, which returns at once. When the
+ * transfer is finished the device sets DR_RESULT and calls DR_DONE.
+ * This may happen in an interrupt handler, so DR_DONE must not sleep;
+ * the request may be reused or freed as soon as it's been called.
+ *
+ * Queued requests are otherwise done in whatever order the device
+ * likes. DR_FLAGS can ask for ordering:
+ *
+ *    DR_ORDERED - don't start until every request queued earlier
+ *                 with the same nonzero DR_TAG is done, and don't let
+ *                 later ones with that tag start until this one is.
+ *                 Requests with other tags are not held up.
+ *    DR_BARRIER - the same, against every request on the device.
+ *
+ * A barrier with no blocks is a flush: it does no I/O, and finishes
+ * once everything queued before it has. (Our disks have no write
+ * cache, so a finished write is on the disk.) A tag is any number
+ * the caller likes, such as one per volume; different tags may share
+ * a slot in the device's bookkeeping, which only orders them more
+ * than asked.
+ */
+struct devreq {
+	uint32_t dr_block;		/* first device block */
+	uint32_t dr_nblocks;		/* number of blocks */
+	void *dr_data;			/* kernel buffer */
+	bool dr_write;			/* true to write, false to read */
+	unsigned dr_flags;		/* DR_ORDERED, DR_BARRIER */
+	unsigned dr_tag;		/* for DR_ORDERED; 0 for none */
+	int dr_result;			/* 0 or error code */
+	void (*dr_done)(struct devreq *);
+	void *dr_donedata;		/* for DR_DONE's use */
+	struct devreq *dr_next;		/* for the device's use */
+	uint64_t dr_started;		/* for the device's use */
+};
+
+/* Flags for dr_flags */
+#define DR_ORDERED	0x1	/* ordered against others with dr_tag */
+#define DR_BARRIER	0x2	/* ordered against everything */
+
 /*
  * Device operations.
  *      devop_eachopen - called on each open call to allow denying the open
  *      devop_io - for both reads and writes (the uio indicates the direction)
  *      devop_ioctl - miscellaneous control operations
+ *      devop_strategy - queue a devreq; NULL if the device can't. Returns
+ *                       an error (and does not call dr_done) if the
+ *                       request is invalid.
+ *      devop_poll - as vop_poll (see vnode.h and poll.h), returning
+ *                   the events; NULL if I/O on the device never
+ *                   waits, so it's always ready.
+ *      devop_mmap - as vop_mmap (see vnode.h); NULL if the device
+ *                   can't be mapped.
  */
 struct device_ops {
 	int (*devop_eachopen)(struct device *, int flags_from_open);
 	int (*devop_io)(struct device *, struct uio *);
 	int (*devop_ioctl)(struct device *, int op, userptr_t data);
+	int (*devop_strategy)(struct device *, struct devreq *);
+	int (*devop_poll)(struct device *, int events, struct pollset *ps);
+	int (*devop_mmap)(struct device *, bool *anon);
 };
 
 /*
@@ -69,6 +124,9 @@ struct device_ops {
 #define DEVOP_EACHOPEN(d, f)	((d)->d_ops->devop_eachopen(d, f))
 #define DEVOP_IO(d, u)		((d)->d_ops->devop_io(d, u))
 #define DEVOP_IOCTL(d, op, p)	((d)->d_ops->devop_ioctl(d, op, p))
+#define DEVOP_STRATEGY(d, r)	((d)->d_ops->devop_strategy(d, r))
+#define DEVOP_POLL(d, ev, ps)	((d)->d_ops->devop_poll(d, ev, ps))
+#define DEVOP_MMAP(d, a)	((d)->d_ops->devop_mmap(d, a))
 
 
 /* Create vnode for a vfs-level device. */
@@ -79,6 +137,12 @@ void dev_uncreate_vnode(struct vnode *vn);
 
 /* Initialization functions for builtin vfs-level devices. */
 void devnull_create(void);
+void devstats_create(void);
+void deviostat_create(void);
+void devzero_create(void);
+
+/* Make a striped volume of several disks (see devstripe.c). */
+int devstripe_create(unsigned ndevs, char **devnames, uint32_t chunk);
 
 /* Function that kicks off device probe and attach. */
 void dev_bootstrap(void);
@@ -45,13 +45,20 @@ struct emufs_vnode {
 	struct vnode ev_v;		/* abstract vnode structure */
 	struct emu_softc *ev_emu;	/* device */
 	uint32_t ev_handle;		/* file handle */
+	off_t ev_size;			/* cached file size... */
+	uint32_t ev_sizegen;		/* ...if this is the cache's gen */
+	bool ev_sizevalid;
 };
 
+struct emufs_cache;			/* in emu.c */
+
 struct emufs_fs {
 	struct fs ef_fs;		/* abstract filesystem structure */
 	struct emu_softc *ef_emu;	/* device */
 	struct emufs_vnode *ef_root;	/* root vnode */
 	struct vnodearray *ef_vnodes;	/* table of loaded vnodes */
+	struct emufs_cache *ef_cache;	/* file data and sizes */
+	struct lock *ef_appendlock;	/* held by an O_APPEND write */
 };
 
 
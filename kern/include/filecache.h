@@ -0,0 +1,102 @@
+#ifndef _FILECACHE_H_
+#define _FILECACHE_H_
+
+/*
+ * File page cache for the paging VM system.
+ *
+ * Read-only segments of an executable are not loaded at exec time;
+ * their regions point at a filecache_file for the executable's vnode
+ * and vm_fault maps each page from here on first touch. All the
+ * address spaces running the same file share the same frames, mapped
+ * PTE_COW in each page table. The cache holds one coremap reference
+ * to each of its frames and each page table mapping it another.
+ *
+ * A filecache_file (and the vnode, which it holds a reference to)
+ * lasts as long as some region maps it. Its pages go with it, or
+ * earlier if memory runs short and nobody has them mapped. Once the
+ * file is written to, new opens get a fresh filecache_file.
+ *
+ * Shared file mappings (mmap MAP_SHARED) map the cache's frames
+ * writable, so the cache pages are where their writes go. Whoever
+ * wrote to a page writes it back with filecache_putpage before
+ * unmapping it, so a page nobody maps is always clean.
+ *
+ * The file system reads and writes through the same pages where they
+ * exist, so a mapped file's data is only cached once, in frames that
+ * the pageout thread reclaims alongside anonymous memory.
+ *
+ *    filecache_bootstrap - set up. Call once, from vm_bootstrap().
+ *    filecache_open      - return the cache for V, with a reference.
+ *                          NULL if out of memory.
+ *    filecache_incref    - add a reference.
+ *    filecache_close     - drop a reference.
+ *    filecache_getpage   - return the frame holding the file page
+ *                          at OFFSET, which must be page-aligned,
+ *                          reading it in if need be. Bytes [START,
+ *                          END) of the page come from the file, the
+ *                          rest are zero. The caller gets a coremap
+ *                          reference to the frame. Must not be
+ *                          called with vm_lock held.
+ *    filecache_putpage   - write bytes [START, END) of the page at
+ *                          OFFSET, held in frame PA, back to the file.
+ *                          Must not be called with vm_lock held.
+ *    filecache_read      - for the file system's read: copy LEN
+ *                          bytes at UIO's offset (not crossing a
+ *                          page) to UIO from V's current cache.
+ *                          ENOENT, having copied nothing, if it
+ *                          doesn't have them.
+ *    filecache_write     - for the file system's write: LEN bytes at
+ *                          POS of V are now DATA; update whatever
+ *                          pages of them V's cache has.
+ *    filecache_reclaim   - free one cached page that no page table
+ *                          maps and that hasn't been used since the
+ *                          last time round. Returns false if there
+ *                          isn't one. Caller holds vm_lock, so the
+ *                          number of mappings can't change.
+ *
+ * dumbvm has no file cache, so there the file system's read finds
+ * nothing cached and its write has nothing to update.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include "opt-dumbvm.h"
+
+struct vnode;
+struct uio;
+struct filecache_file;
+
+#if OPT_DUMBVM
+static inline int
+filecache_read(struct vnode *v, struct uio *uio, size_t len)
+{
+	(void)v;
+	(void)uio;
+	(void)len;
+	return ENOENT;
+}
+
+static inline void
+filecache_write(struct vnode *v, off_t pos, const void *data, size_t len)
+{
+	(void)v;
+	(void)pos;
+	(void)data;
+	(void)len;
+}
+#else
+void filecache_bootstrap(void);
+struct filecache_file *filecache_open(struct vnode *v);
+void filecache_incref(struct filecache_file *f);
+void filecache_close(struct filecache_file *f);
+int filecache_getpage(struct filecache_file *f, off_t offset,
+		      unsigned start, unsigned end, paddr_t *ret);
+int filecache_putpage(struct filecache_file *f, off_t offset,
+		      unsigned start, unsigned end, paddr_t pa);
+int filecache_read(struct vnode *v, struct uio *uio, size_t len);
+void filecache_write(struct vnode *v, off_t pos, const void *data,
+		     size_t len);
+bool filecache_reclaim(void);
+#endif
+
+#endif /* _FILECACHE_H_ */
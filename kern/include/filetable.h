@@ -0,0 +1,54 @@
+#ifndef _FILETABLE_H_
+#define _FILETABLE_H_
+
+/*
+ * Per-process file descriptor tables.
+ *
+ * A process has no table until it first opens something. The table
+ * starts with FT_MINSIZE slots and doubles as needed, up to OPEN_MAX;
+ * a bitmap of used slots finds the lowest free descriptor a word at a
+ * time.
+ *
+ * Fork doesn't copy the table: parent and child share it, and
+ * whichever first changes its descriptors (open, close, dup2) gets
+ * its own copy then. So fork and exit cost nothing per descriptor
+ * unless the table is really copied or freed, and then only per open
+ * file. A table that is shared is never changed.
+ *
+ * Each slot that holds an openfile, in any table, holds a reference
+ * to it.
+ *
+ * Changes are made with the process's p_locklock held, to keep the
+ * threads of a multithreaded process out of each other's way, and
+ * published under p_lock, which is all filetable_get takes. Lookups
+ * return the openfile with a reference of its own.
+ */
+
+#include <types.h>
+#include <spinlock.h>
+#include <limits.h>
+
+struct proc;
+struct openfile;
+
+#define FT_MINSIZE	32
+#define FT_MAPWORDS	(OPEN_MAX / 32)
+
+struct filetable {
+    struct spinlock ft_reflock;     /* For ft_refcount */
+    unsigned ft_refcount;           /* Processes sharing the table */
+    unsigned ft_size;               /* Slots in ft_files */
+    unsigned ft_nopen;              /* Slots in use */
+    struct openfile **ft_files;
+    uint32_t ft_used[FT_MAPWORDS];  /* Bit set for each slot in use */
+};
+
+struct openfile *filetable_get(struct proc *p, int fd);
+int filetable_add(struct proc *p, struct openfile *of, int minfd, int *retfd);
+int filetable_set(struct proc *p, int fd, struct openfile *of,
+                  struct openfile **oldof);
+void filetable_fork(struct proc *parent, struct proc *child);
+void filetable_drop(struct proc *p);
+void filetable_unlockall(struct proc *p);
+
+#endif /* _FILETABLE_H_ */
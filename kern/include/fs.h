@@ -87,5 +87,11 @@ struct fs_ops {
 /* Initialization functions for builtin fake file systems. */
 void semfs_bootstrap(void);
 
+/*
+ * Apply DELTAS[i] to the semfs semaphore VNS[i], for i < N, all at
+ * once, for semop(). Fails with EINVAL if a vnode isn't a semaphore.
+ */
+int semfs_semop(struct vnode **vns, const int *deltas, unsigned n);
+
 
 #endif /* _FS_H_ */
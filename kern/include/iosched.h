@@ -0,0 +1,59 @@
+#ifndef _IOSCHED_H_
+#define _IOSCHED_H_
+
+/*
+ * I/O scheduler for block devices.
+ *
+ * A driver that queues struct devreqs (see device.h) keeps them in an
+ * iosched instead of a plain list, and asks it which request to start
+ * next whenever the disk goes idle. The order is up to the policy:
+ *
+ *    cscan - circular elevator: sweep upward through the disk from
+ *            the last position serviced, then jump back to the lowest
+ *            pending block and sweep up again. The queue is kept
+ *            sorted by block, so requests for adjacent blocks are
+ *            merged into one run with no seek between them.
+ *    fifo  - arrival order.
+ *
+ * Requests that ask for ordering (DR_ORDERED, DR_BARRIER; see
+ * device.h) are held back from the policy until what they depend on
+ * is done, so the driver must report each request it finishes with
+ * iosched_done. Only the requests that have to wait are held; others
+ * carry on past them.
+ *
+ * The scheduler also keeps statistics: requests, how many were merged
+ * with a neighbour, how many were held for ordering, the queue depth seen by each new request, and the
+ * total seek distance (in device blocks) between dispatched requests.
+ *
+ *    iosched_create    - make a scheduler (with the default policy,
+ *                        cscan) named NAME, normally the device name.
+ *                        Returns NULL on out-of-memory.
+ *    iosched_destroy   - free one. Its queue must be empty.
+ *    iosched_add       - queue a request.
+ *    iosched_next      - remove and return the next request to start,
+ *                        or NULL if the queue is empty (or everything
+ *                        on it is held).
+ *    iosched_done      - a request from iosched_next has finished.
+ *                        This may let held requests go, so check
+ *                        iosched_next again afterwards.
+ *    iosched_setpolicy - switch the scheduler for device DEVNAME to
+ *                        POLICY. Returns ENODEV or EINVAL on unknown
+ *                        names.
+ *    iosched_printstats - print statistics for all schedulers.
+ *
+ * Each scheduler has its own spinlock, so these may be called from
+ * interrupt handlers and with the driver's spinlock held.
+ */
+
+struct devreq;
+struct iosched;
+
+struct iosched *iosched_create(const char *name);
+void iosched_destroy(struct iosched *ios);
+void iosched_add(struct iosched *ios, struct devreq *req);
+struct devreq *iosched_next(struct iosched *ios);
+void iosched_done(struct iosched *ios, struct devreq *req);
+int iosched_setpolicy(const char *devname, const char *policy);
+void iosched_printstats(void);
+
+#endif /* _IOSCHED_H_ */
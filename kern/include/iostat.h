@@ -0,0 +1,73 @@
+#ifndef _IOSTAT_H_
+#define _IOSTAT_H_
+
+/*
+ * Per-device I/O statistics.
+ *
+ * A driver keeps a struct iostat for each device and reports every
+ * transfer to it twice: when it's started, and when it's done. The
+ * counts are kept per cpu, like the counters in percpu.h, so the
+ * I/O path takes no lock for them and the start and finish of a
+ * request may be on different cpus; readers add up the copies. For
+ * each device there are
+ *
+ *    reads, writes     - transfers finished
+ *    rsects, wsects    - 512-byte sectors transferred (rounded up
+ *                        per transfer)
+ *    inflight          - transfers started and not yet finished
+ *    totalns, maxns    - total and longest time from start to finish,
+ *                        including any time spent queued
+ *
+ * totalns over an interval, divided by the length of the interval,
+ * is the average number of requests in flight; much over 1 and the
+ * device is saturated.
+ *
+ *    iostat_create     - make one named NAME, normally the device
+ *                        name. Returns NULL on out-of-memory. The
+ *                        cpus must all be up.
+ *    iostat_destroy    - free one. Nothing may be in flight.
+ *    iostat_start      - count a transfer starting. Returns the
+ *                        time, to hand back to iostat_done.
+ *    iostat_done       - count a transfer of NBYTES finishing.
+ *    iostat_printstats - print statistics for all devices.
+ *
+ * iostat_start and iostat_done may be called from interrupt
+ * handlers and with the driver's spinlock held. The statistics can
+ * also be read from user level through the iostat: device, one line
+ * per device:
+ *
+ *    name reads writes rsects wsects inflight totalns maxns
+ */
+
+struct iostat;
+
+struct iostat *iostat_create(const char *name);
+void iostat_destroy(struct iostat *is);
+uint64_t iostat_start(struct iostat *is);
+void iostat_done(struct iostat *is, bool write, size_t nbytes,
+		 uint64_t started);
+void iostat_printstats(void);
+
+/*
+ * Per-process block I/O, for getrusage's ru_inblock and ru_oublock.
+ * These are file system blocks, counted by the buffer cache: a block
+ * is read for a process when the process has to wait for it to come
+ * in from disk, and written for it when it dirties a clean block, as
+ * the write itself usually happens later from the syncer. Like the
+ * fault counts in vmstat.h, a process's counts go to its parent's
+ * p_childio when it is waited for.
+ *
+ *    ioacct_count - count a block read or written by the current
+ *                   process.
+ *    ioacct_add   - add the counts in FROM to TO.
+ */
+
+struct ioacct {
+	unsigned ia_inblock;		/* blocks read */
+	unsigned ia_oublock;		/* blocks written */
+};
+
+void ioacct_count(bool write);
+void ioacct_add(struct ioacct *to, const struct ioacct *from);
+
+#endif /* _IOSTAT_H_ */
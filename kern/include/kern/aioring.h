@@ -0,0 +1,63 @@
+/*
+ * Definitions for aio_setup() and aio_enter(): asynchronous I/O
+ * through submission and completion rings in the process's memory.
+ *
+ * The process allocates both rings, each with room for ap_entries
+ * entries (a power of 2, at most AIO_MAXENTRIES), and registers them
+ * with aio_setup. To submit, it fills in sq_entries[sq_tail & mask]
+ * and then advances sq_tail; aio_enter takes entries from sq_head up
+ * to sq_tail and advances sq_head. Completions go the other way:
+ * aio_enter fills in cq_entries[cq_tail & mask] and advances cq_tail,
+ * and the process consumes them and advances cq_head. The indices
+ * count entries ever queued and wrap around freely.
+ *
+ * The kernel only looks at the rings inside aio_enter, so nothing
+ * needs to be mapped or locked: aio_enter(n, 0) submits and collects
+ * whatever has finished, aio_enter(0, k) waits for k completions.
+ */
+
+#ifndef _KERN_AIORING_H_
+#define _KERN_AIORING_H_
+
+/* Operations */
+#define AIO_OP_NOP	0	/* completes with 0 */
+#define AIO_OP_READ	1
+#define AIO_OP_WRITE	2
+
+/* Limits */
+#define AIO_MAXENTRIES	64		/* ring size */
+#define AIO_MAXLEN	16384		/* bytes in one request */
+
+struct aio_sqe {
+	int sqe_op;		/* AIO_OP_* */
+	int sqe_fd;		/* file handle */
+	void *sqe_buf;		/* user buffer */
+	__size_t sqe_len;	/* bytes, at most AIO_MAXLEN */
+	__off_t sqe_offset;	/* position, or -1 for the file's offset */
+	void *sqe_data;		/* passed back in the completion */
+};
+
+struct aio_cqe {
+	void *cqe_data;		/* sqe_data of the request */
+	int cqe_res;		/* bytes transferred, or -errno */
+};
+
+struct aio_sqring {
+	volatile unsigned sq_head;	/* advanced by the kernel */
+	volatile unsigned sq_tail;	/* advanced by the process */
+	struct aio_sqe sq_entries[];
+};
+
+struct aio_cqring {
+	volatile unsigned cq_head;	/* advanced by the process */
+	volatile unsigned cq_tail;	/* advanced by the kernel */
+	struct aio_cqe cq_entries[];
+};
+
+struct aio_params {
+	unsigned ap_entries;
+	struct aio_sqring *ap_sq;
+	struct aio_cqring *ap_cq;
+};
+
+#endif /* _KERN_AIORING_H_ */
@@ -0,0 +1,46 @@
+/*
+ * Definitions for getdents() and getdirentries_plus(). Needs
+ * kern/stat.h first.
+ */
+
+#ifndef _KERN_DIRENT_H_
+#define _KERN_DIRENT_H_
+
+/*
+ * getdirentries_plus() fills the buffer with as many of these as fit:
+ * each directory entry's name together with what stat() would say
+ * about the object it names. Records are packed one after another;
+ * each is dp_reclen bytes long, which is a multiple of 8, with the
+ * null-terminated name at the end.
+ */
+struct dirent_plus {
+	struct stat dp_stat;
+	__u16 dp_reclen;	/* bytes in this record */
+	__u16 dp_namelen;	/* length of dp_name, not counting the null */
+	char dp_name[4];	/* actually dp_namelen+1 */
+};
+
+/* Size of the record for a name of NAMELEN characters */
+#define DIRENT_PLUS_RECLEN(namelen) \
+	((sizeof(struct stat) + 2 * sizeof(__u16) + (namelen) + 1 + 7) & ~7)
+
+/*
+ * getdents() fills the buffer with as many of these as fit, packed
+ * the same way: just the names, for listing and walking directories
+ * without a system call per name. d_off is the directory offset just
+ * past the entry, to lseek to to carry on from after it.
+ */
+struct dirent {
+	off_t d_off;		/* offset of the next entry */
+	ino_t d_ino;		/* inode number, or 0 if not known */
+	__u16 d_reclen;		/* bytes in this record */
+	__u16 d_namelen;	/* length of d_name, not counting the null */
+	char d_name[4];		/* actually d_namelen+1 */
+};
+
+/* Size of the record for a name of NAMELEN characters */
+#define DIRENT_RECLEN(namelen) \
+	((sizeof(off_t) + sizeof(ino_t) + 2 * sizeof(__u16) + \
+	  (namelen) + 1 + 7) & ~7)
+
+#endif /* _KERN_DIRENT_H_ */
@@ -49,6 +49,7 @@
 #define O_TRUNC      16      /* Truncate file upon open */
 #define O_APPEND     32      /* All writes happen at EOF (optional feature) */
 #define O_NOCTTY     64      /* Required by POSIX, != 0, but does nothing */
+#define O_DIRECT    128      /* Don't cache the data (may be ignored) */
 
 /* Additional related definition */
 #define O_ACCMODE     3      /* mask for O_RDONLY/O_WRONLY/O_RDWR */
@@ -63,6 +64,14 @@
 #define LOCK_UN         3       /* release the lock */
 #define LOCK_NB         4       /* flag: don't block */
 
+/* advice for fadvise(): how the file is going to be used */
+#define FADV_NORMAL     0       /* no particular pattern */
+#define FADV_SEQUENTIAL 1       /* front to back: read ahead hard */
+#define FADV_RANDOM     2       /* scattered: don't read ahead */
+#define FADV_WILLNEED   3       /* range wanted soon: read it now */
+#define FADV_DONTNEED   4       /* range done with: cache it last */
+#define FADV_NOREUSE    5       /* used once: don't let it crowd cache */
+
 /*
  * Mostly pretty useless
  */
@@ -0,0 +1,32 @@
+/*
+ * Internet address definitions, for <netinet/in.h>.
+ *
+ * Addresses and ports in struct sockaddr_in are in network byte
+ * order, as everywhere else.
+ */
+
+#ifndef _KERN_IN_H_
+#define _KERN_IN_H_
+
+/* Protocol numbers, for socket() */
+#define IPPROTO_IP	0	/* default for the socket type */
+#define IPPROTO_UDP	17
+
+/* Special addresses (host byte order) */
+#define INADDR_ANY		0x00000000
+#define INADDR_LOOPBACK		0x7f000001	/* 127.0.0.1 */
+#define INADDR_BROADCAST	0xffffffff
+
+struct in_addr {
+	__in_addr_t s_addr;
+};
+
+struct sockaddr_in {
+	__u8 sin_len;		/* sizeof(struct sockaddr_in) */
+	__u8 sin_family;	/* AF_INET */
+	__u16 sin_port;
+	struct in_addr sin_addr;
+	char sin_zero[8];
+};
+
+#endif /* _KERN_IN_H_ */
@@ -34,6 +34,27 @@
  * ioctl operation codes
  */
 
-/* (none yet) */
+/*
+ * Advice about how a file will be used, from fadvise(). Issued by the
+ * kernel itself; DATA is a struct vnode_advice (see vnode.h) in
+ * kernel memory.
+ */
+#define FIOADVISE       1
+
+/*
+ * Where the data and holes of a sparse file are, for lseek SEEK_DATA
+ * and SEEK_HOLE. Issued by the kernel; DATA is an off_t in kernel
+ * memory, the position to start from, which is replaced with the
+ * answer. ENXIO if there is none.
+ */
+#define FIOSEEKDATA     2
+#define FIOSEEKHOLE     3
+
+/*
+ * Allocate space for a range of a file, from fallocate(). Issued by
+ * the kernel; DATA is a struct vnode_range (see vnode.h) in kernel
+ * memory.
+ */
+#define FIOALLOCATE     4
 
 #endif /* _KERN_IOCTL_H_*/
@@ -0,0 +1,39 @@
+/*
+ * Definitions for mmap(), munmap(), msync(), madvise() and the
+ * mlock() family.
+ */
+
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/* Protection (mmap's third argument); only PROT_WRITE is enforced */
+#define PROT_NONE	0
+#define PROT_READ	1
+#define PROT_WRITE	2
+#define PROT_EXEC	4
+
+/* Flags (mmap's fourth argument); exactly one of the first two */
+#define MAP_SHARED	1	/* writes go to the file */
+#define MAP_PRIVATE	2	/* writes make private copies */
+#define MAP_ANON	4	/* no file: zero-filled memory */
+#define MAP_ANONYMOUS	MAP_ANON
+#define MAP_POPULATE	8	/* fault the whole mapping in now */
+
+/* Flags for msync; the write is always synchronous */
+#define MS_ASYNC	1
+#define MS_SYNC		2
+#define MS_INVALIDATE	4
+
+/* Advice for madvise */
+#define MADV_NORMAL	0	/* no particular pattern */
+#define MADV_SEQUENTIAL	1	/* front to back: fault ahead */
+#define MADV_RANDOM	2	/* scattered: just the page touched */
+#define MADV_WILLNEED	3	/* range wanted soon: read it now */
+#define MADV_DONTNEED	4	/* range done with: drop the pages */
+
+/* Flags for mlockall */
+#define MCL_CURRENT	1	/* lock what is mapped now */
+#define MCL_FUTURE	2	/* and whatever gets mapped later */
+#define MCL_ONEXEC	4	/* lock the next program execv runs */
+
+#endif /* _KERN_MMAN_H_ */
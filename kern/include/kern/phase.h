@@ -0,0 +1,45 @@
+/*
+ * Definitions for phase(), which marks the phases of a workload in
+ * System/161's output and turns trace161's profiler on and off around
+ * them.
+ *
+ * phase(op, name) does one of:
+ *
+ *    PHASE_MARK      - note that NAME has been reached.
+ *    PHASE_BEGIN     - note the start of phase NAME.
+ *    PHASE_END       - note the end of phase NAME, which must have
+ *                      been begun and not yet ended.
+ *    PHASE_ERASEPROF - discard the profile collected so far. NAME is
+ *                      ignored and may be NULL.
+ *
+ * PHASE_PROF or'd into PHASE_BEGIN or PHASE_END also profiles the
+ * phase: profiling is on while any such phase is open, in any process.
+ * Profiling only happens if sys161 is trace161 run with a profile
+ * (-P); otherwise only the markers appear.
+ *
+ * The kernel numbers each distinct name from 0 the first time it's
+ * used and prints "phase N: NAME" on the console, then passes each
+ * operation to the ltrace device as the debug code PHASE_CODE(op, N),
+ * which sys161 prints as it happens. Names are at most PHASE_NAMELEN
+ * bytes with the terminating null, and there can be PHASE_MAX of them
+ * before phase fails with ENOSPC.
+ */
+
+#ifndef _KERN_PHASE_H_
+#define _KERN_PHASE_H_
+
+#define PHASE_MARK	0
+#define PHASE_BEGIN	1
+#define PHASE_END	2
+#define PHASE_ERASEPROF	3
+#define PHASE_OPMASK	0xf
+
+#define PHASE_PROF	0x10	/* flag: profile while the phase is open */
+
+#define PHASE_NAMELEN	32
+#define PHASE_MAX	64
+
+/* The debug code sent for OP (with any flags) on phase number ID */
+#define PHASE_CODE(op, id)	(0x70000000 | ((op) << 16) | (id))
+
+#endif /* _KERN_PHASE_H_ */
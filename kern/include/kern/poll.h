@@ -0,0 +1,22 @@
+/*
+ * Definitions for poll().
+ */
+
+#ifndef _KERN_POLL_H_
+#define _KERN_POLL_H_
+
+struct pollfd {
+	int fd;			/* file handle; ignored if negative */
+	short events;		/* events wanted */
+	short revents;		/* events that happened */
+};
+
+/* Events */
+#define POLLIN		0x0001	/* can read without blocking */
+#define POLLPRI		0x0002	/* urgent data (never happens) */
+#define POLLOUT		0x0004	/* can write without blocking */
+#define POLLERR		0x0008	/* error (always reported) */
+#define POLLHUP		0x0010	/* other end gone (always reported) */
+#define POLLNVAL	0x0020	/* fd not open (always reported) */
+
+#endif /* _KERN_POLL_H_ */
@@ -80,7 +80,9 @@ struct rusage {
 #define RLIMIT_RSS		6	/* max RSS (bytes) */
 #define RLIMIT_CORE		7	/* core file size (bytes) */
 #define RLIMIT_FSIZE		8	/* max file size (bytes) */
-#define __RLIMIT_NUM		9	/* number of limits */
+#define RLIMIT_AS		9	/* max address space size (bytes) */
+#define RLIMIT_RTPRIO		10	/* max real-time priority */
+#define __RLIMIT_NUM		11	/* number of limits */
 
 struct rlimit {
 	__rlim_t rlim_cur;	/* soft limit */
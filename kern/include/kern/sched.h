@@ -0,0 +1,27 @@
+/*
+ * Definitions for sched_setscheduler() and the scheduling groups of
+ * sched_setgroup() and sched_settickets().
+ */
+
+#ifndef _KERN_SCHED_H_
+#define _KERN_SCHED_H_
+
+/* Policies */
+#define SCHED_OTHER	0	/* time-sharing (priority must be 0) */
+#define SCHED_FIFO	1	/* real-time: runs until it blocks or yields */
+#define SCHED_RR	2	/* real-time: round robin within a priority */
+
+/* Real-time priorities; higher runs first */
+#define SCHED_PRIO_MIN	1
+#define SCHED_PRIO_MAX	8
+
+struct sched_param {
+	int sched_priority;
+};
+
+/* Scheduling groups; everything starts in group 0 */
+#define SCHED_NGROUPS		16
+#define SCHED_TICKETS_DEFAULT	100
+#define SCHED_TICKETS_MAX	10000
+
+#endif /* _KERN_SCHED_H_ */
@@ -42,6 +42,8 @@
 #define SEEK_SET      0      /* Seek relative to beginning of file */
 #define SEEK_CUR      1      /* Seek relative to current position in file */
 #define SEEK_END      2      /* Seek relative to end of file */
+#define SEEK_DATA     3      /* Seek to next data at or after offset */
+#define SEEK_HOLE     4      /* Seek to next hole at or after offset */
 
 
 #endif /* _KERN_SEEK_H_ */
@@ -0,0 +1,22 @@
+/*
+ * Definitions for semop(), on semaphores in semfs (sem:).
+ */
+
+#ifndef _KERN_SEMOP_H_
+#define _KERN_SEMOP_H_
+
+/*
+ * One operation: add sem_op to the count of the semaphore open on
+ * sem_fd. Less than zero is P, and waits until the count is big
+ * enough; more than zero is V. P needs the file open for reading and
+ * V for writing, as with read() and write().
+ */
+struct sembuf {
+	int sem_fd;
+	int sem_op;
+};
+
+/* Most operations in one call */
+#define SEMOP_MAX	16
+
+#endif /* _KERN_SEMOP_H_ */
@@ -36,14 +36,24 @@
  * and is used by tools that work on SFS volumes, such as mksfs.
  */
 
-#define SFS_MAGIC         0xabadf001    /* magic number identifying us */
+/*
+ * The block size is fixed when the kernel and the tools are built:
+ * 512 by default, or 4096 (one VM page) with -DSFS_BLOCKSIZE=4096,
+ * which must then be used for both. mksfs records it in sb_blocksize,
+ * and volumes of another block size are refused. Any power of 2 from
+ * 512 to 4096 works, but the disk sector size must divide it.
+ */
+#ifndef SFS_BLOCKSIZE
 #define SFS_BLOCKSIZE     512           /* size of our blocks */
+#endif
+
+#define SFS_MAGIC         0xabadf001    /* magic number identifying us */
 #define SFS_VOLNAME_SIZE  32            /* max length of volume name */
 #define SFS_NDIRECT       15            /* # of direct blocks in inode */
 #define SFS_NINDIRECT     1             /* # of indirect blocks in inode */
-#define SFS_NDINDIRECT    0             /* # of 2x indirect blocks in inode */
-#define SFS_NTINDIRECT    0             /* # of 3x indirect blocks in inode */
-#define SFS_DBPERIDB      128           /* # direct blks per indirect blk */
+#define SFS_NDINDIRECT    1             /* # of 2x indirect blocks in inode */
+#define SFS_NTINDIRECT    1             /* # of 3x indirect blocks in inode */
+#define SFS_DBPERIDB      (SFS_BLOCKSIZE/4) /* # direct blks per indirect blk */
 #define SFS_NAMELEN       60            /* max length of filename */
 #define SFS_SUPER_BLOCK   0             /* block the superblock lives in */
 #define SFS_FREEMAP_START 2             /* 1st block of the freemap */
@@ -67,6 +77,15 @@
 #define SFS_TYPE_FILE     1
 #define SFS_TYPE_DIR      2
 
+/* Flags for sfi_flags */
+#define SFS_IFLAG_INLINE  0x1     /* Data is in sfi_inline, not blocks */
+
+/* Largest file that can be kept in the inode (the rest of its block) */
+#define SFS_INLINESIZE    (SFS_BLOCKSIZE - 4 * (6+SFS_NDIRECT))
+
+/* Block size recorded by volumes made before sb_blocksize existed */
+#define SFS_OLDBLOCKSIZE  512
+
 /*
  * On-disk superblock
  */
@@ -74,11 +93,20 @@ struct sfs_superblock {
 	uint32_t sb_magic;		/* Magic number; should be SFS_MAGIC */
 	uint32_t sb_nblocks;			/* Number of blocks in fs */
 	char sb_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];			/* unused, set to 0 */
+	uint32_t sb_journalstart;		/* First block of journal */
+	uint32_t sb_journalblocks;		/* Size of journal; 0 if none */
+	uint32_t sb_blocksize;			/* SFS_BLOCKSIZE; 0 means 512 */
+	uint32_t reserved[SFS_BLOCKSIZE/4 - 13];	/* unused, set to 0 */
 };
 
 /*
  * On-disk inode
+ *
+ * A regular file of up to SFS_INLINESIZE bytes may have its data in
+ * sfi_inline instead of in data blocks, flagged by SFS_IFLAG_INLINE;
+ * its block pointers are then all 0, and the bytes of sfi_inline past
+ * the end of the file are 0. Without the flag, sfi_inline is unused
+ * and set to 0.
  */
 struct sfs_dinode {
 	uint32_t sfi_size;			/* Size of this file (bytes) */
@@ -86,7 +114,10 @@ struct sfs_dinode {
 	uint16_t sfi_linkcount;			/* # hard links to this file */
 	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_dindirect;			/* Double indirect block */
+	uint32_t sfi_tindirect;			/* Triple indirect block */
+	uint32_t sfi_flags;			/* SFS_IFLAG_* above */
+	char sfi_inline[SFS_INLINESIZE];	/* Data of an inline file */
 };
 
 /*
@@ -97,5 +128,52 @@ struct sfs_direntry {
 	char sfd_name[SFS_NAMELEN];		/* Filename */
 };
 
+/*
+ * Metadata journal
+ *
+ * The journal is a region of sb_journalblocks blocks starting at
+ * sb_journalstart (right after the freemap, as made by mksfs). Its
+ * first block holds a struct sfs_jheader; the rest is a log of
+ * transactions written in order from the block after it. Each
+ * transaction has the same sequence number in all its records and
+ * consists of one or more groups of a SFS_JDESC_BLOCKS descriptor
+ * followed by the jd_count block images it lists, optionally a
+ * SFS_JDESC_REVOKE descriptor listing blocks freed by the transaction
+ * (whose images in earlier transactions must not be replayed), and
+ * finally a SFS_JDESC_COMMIT record. A transaction without a valid
+ * commit record never happened.
+ *
+ * jh_seq is the sequence number of the transaction at the start of
+ * the log; everything before it has been written to its home
+ * location already.
+ */
+#define SFS_JMAGIC        0x5f4a524e    /* journal records */
+#define SFS_JDESC_BLOCKS  1             /* descriptor for block images */
+#define SFS_JDESC_REVOKE  2             /* list of freed blocks */
+#define SFS_JDESC_COMMIT  3             /* end of transaction */
+#define SFS_JDESC_NENT    (SFS_BLOCKSIZE/4 - 5) /* entries per descriptor */
+
+struct sfs_jheader {
+	uint32_t jh_magic;			/* SFS_JMAGIC */
+	uint32_t jh_seq;			/* first transaction in log */
+	uint32_t reserved[SFS_BLOCKSIZE/4 - 2];	/* unused, set to 0 */
+};
+
+struct sfs_jdesc {
+	uint32_t jd_magic;			/* SFS_JMAGIC */
+	uint32_t jd_type;			/* SFS_JDESC_* */
+	uint32_t jd_seq;			/* transaction number */
+	uint32_t jd_count;			/* entries; see below */
+	uint32_t jd_sum;			/* checksum, in commit only */
+	uint32_t jd_blocks[SFS_JDESC_NENT];	/* home block numbers */
+};
+
+/*
+ * In a commit record, jd_count is the number of journal blocks the
+ * transaction occupies before the commit record, and jd_sum is
+ * SFS_JSUM run over all of them, word by word from a sum of 0.
+ */
+#define SFS_JSUM(sum, word)    ((((sum) << 1) | ((sum) >> 31)) + (word))
+
 
 #endif /* _KERN_SFS_H_ */
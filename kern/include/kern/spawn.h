@@ -0,0 +1,26 @@
+/*
+ * Definitions for the __spawn() system call, which posix_spawn() in
+ * libc is built on.
+ */
+
+#ifndef _KERN_SPAWN_H_
+#define _KERN_SPAWN_H_
+
+/* File actions, done in order in the child before the program loads */
+#define SPAWN_OPEN	0	/* open sa_path with sa_flags, sa_mode as sa_fd */
+#define SPAWN_CLOSE	1	/* close sa_fd */
+#define SPAWN_DUP2	2	/* dup2(sa_fd, sa_newfd) */
+
+/* Most file actions one call can take */
+#define SPAWN_MAXACTIONS	16
+
+struct spawn_action {
+	int sa_op;
+	int sa_fd;
+	int sa_newfd;
+	int sa_flags;
+	int sa_mode;
+	const char *sa_path;
+};
+
+#endif /* _KERN_SPAWN_H_ */
@@ -0,0 +1,34 @@
+/*
+ * Definitions for syscall_batch(), which makes several system calls
+ * in one trip into the kernel.
+ */
+
+#ifndef _KERN_SYSBATCH_H_
+#define _KERN_SYSBATCH_H_
+
+/*
+ * One call. sbc_args are the argument words as the call would take
+ * them in a0-a3 and then on the stack: 32-bit values one to a word,
+ * and a 64-bit value in an aligned pair of words, high word first.
+ *
+ * Each bit N set in sbc_useret replaces sbc_args[N] with the return
+ * value (sbc_retval[0]) of the earlier call sbc_retfrom in the same
+ * batch, so that, say, an open can be followed by reads and a close
+ * of the file it opens.
+ *
+ * On return sbc_error is 0 or the error code, and sbc_retval is what
+ * the call returned, in v0 and v1, if it succeeded.
+ */
+struct sysbatch {
+	int sbc_callno;			/* SYS_* */
+	unsigned sbc_useret;		/* args to take from sbc_retfrom */
+	unsigned sbc_retfrom;		/* index of an earlier call */
+	__u32 sbc_args[8];
+	int sbc_error;			/* result */
+	__i32 sbc_retval[2];
+};
+
+/* Most calls in one batch */
+#define SYSBATCH_MAX	32
+
+#endif /* _KERN_SYSBATCH_H_ */
@@ -59,11 +59,11 @@
 #define SYS_mmap         8
 #define SYS_munmap       9
 #define SYS_mprotect     10
-//#define SYS_madvise    11
+#define SYS_madvise      11
 //#define SYS_mincore    12
-//#define SYS_mlock      13
-//#define SYS_munlock    14
-//#define SYS_munlockall 15
+#define SYS_mlock        13
+#define SYS_munlock      14
+#define SYS_munlockall   15
 //#define SYS_minherit   16
 //                              (security/credentials)
 #define SYS_umask        17
@@ -86,10 +86,10 @@
 //#define SYS_sigaltstack 33
 //                              (resource tracking and usage)
 //#define SYS_wait4      34
-//#define SYS_getrusage  35
+#define SYS_getrusage  35
 //                              (resource limits)
-//#define SYS_getrlimit  36
-//#define SYS_setrlimit  37
+#define SYS_getrlimit  36
+#define SYS_setrlimit  37
 //                              (process priority control)
 //#define SYS_getpriority 38
 //#define SYS_setpriority 39
@@ -109,12 +109,12 @@
 #define SYS_close        49
 #define SYS_read         50
 #define SYS_pread        51
-//#define SYS_readv      52
+#define SYS_readv        52
 //#define SYS_preadv     53
 #define SYS_getdirentry  54
 #define SYS_write        55
 #define SYS_pwrite       56
-//#define SYS_writev     57
+#define SYS_writev       57
 //#define SYS_pwritev    58
 #define SYS_lseek        59
 #define SYS_flock        60
@@ -180,8 +180,8 @@
 #define SYS_getpeername  106
 #define SYS_getsockopt   107
 #define SYS_setsockopt   108
-//#define SYS_recvfrom   109
-//#define SYS_sendto     110
+#define SYS_recvfrom     109
+#define SYS_sendto       110
 //#define SYS_recvmsg    111
 //#define SYS_sendmsg    112
 
@@ -196,6 +196,36 @@
 #define SYS_sync         118
 #define SYS_reboot       119
 //#define SYS___sysctl   120
+#define SYS_futex        121
+#define SYS___thread_create 122
+#define SYS_thread_join  123
+#define SYS_thread_exit  124
+#define SYS___spawn      125
+#define SYS_msync        126
+#define SYS_getdirentries_plus 127
+#define SYS_aio_setup    128
+#define SYS_aio_enter    129
+#define SYS_copyfile     130
+#define SYS_sendfile     131
+#define SYS_fadvise      132
+#define SYS_fdatasync    133
+#define SYS_getdents     134
+#define SYS_mlockall     135
+#define SYS___clock_gettime 136
+#define SYS_profil       137
+#define SYS_sched_setaffinity 138
+#define SYS_sched_getaffinity 139
+#define SYS_sched_setscheduler 140
+#define SYS_sched_getscheduler 141
+#define SYS_sched_getparam 142
+#define SYS_sched_setgroup 143
+#define SYS_sched_getgroup 144
+#define SYS_sched_settickets 145
+#define SYS_sched_gettickets 146
+#define SYS_semop        147
+#define SYS_syscall_batch 148
+#define SYS_phase        149
+#define SYS_fallocate    150
 
 /*CALLEND*/
 
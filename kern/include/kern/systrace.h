@@ -0,0 +1,39 @@
+/*
+ * Definitions for the system call trace device, "systrace:".
+ *
+ * While tracing is on, every system call that returns is logged, in
+ * a ring per cpu that drops its oldest records when full. Reading the
+ * device drains the log in whole struct systrace_recs, each cpu's
+ * oldest first; a read too short for one returns nothing.
+ * Writing "on" or "off" to it turns tracing on or off, and writing
+ * "full" turns it on with pathnames too: the calls that take one
+ * (open, execv, remove, mkdir, rmdir, chdir, stat, lstat) also log the
+ * first SYSTRACE_PATHLEN - 1 bytes of it, as it was on the way in.
+ * That's enough to replay a trace (see /sbin/replay).
+ *
+ * Times are in nanoseconds of the time of day clock. The argument
+ * words are as the call was made: a 64-bit argument takes an aligned
+ * pair, high word first, so lseek's offset is in sr_args[2] and [3]
+ * and its whence in sr_args[4].
+ */
+
+#ifndef _KERN_SYSTRACE_H_
+#define _KERN_SYSTRACE_H_
+
+#define SYSTRACE_NARGS		6	/* argument words logged */
+#define SYSTRACE_PATHLEN	64	/* pathname bytes logged, with the 0 */
+
+struct systrace_rec {
+	__u64 sr_enter;		/* time the call was made */
+	__u64 sr_exit;		/* time the result was stored */
+	__i32 sr_callno;	/* SYS_ number */
+	__i32 sr_pid;		/* caller's pid, or 0 */
+	__i32 sr_err;		/* error code, or 0 */
+	__i32 sr_result;	/* return value (v0), if no error */
+	__u32 sr_cpu;		/* cpu the call returned on */
+	__u32 sr_lost;		/* records dropped on that cpu before this */
+	__u32 sr_args[SYSTRACE_NARGS];	/* argument words */
+	char sr_path[SYSTRACE_PATHLEN];	/* pathname argument, or "" */
+};
+
+#endif /* _KERN_SYSTRACE_H_ */
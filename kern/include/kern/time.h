@@ -50,6 +50,16 @@ struct timespec {
         __i32 tv_nsec;          /* nanoseconds */
 };
 
+/*
+ * Clocks for clock_gettime. The _COARSE ones are read from the time
+ * page (kern/timepage.h) with no system call, and are only good to
+ * a hardclock; the others ask the kernel and are good to about a
+ * microsecond.
+ */
+#define CLOCK_REALTIME		0	/* time of day */
+#define CLOCK_MONOTONIC		1	/* time since boot; never goes back */
+#define CLOCK_REALTIME_COARSE	2
+#define CLOCK_MONOTONIC_COARSE	3
 
 /*
  * Bits for interval timers. Obscure and not really that important.
@@ -0,0 +1,31 @@
+/*
+ * The time page: a read-only page the kernel maps at TIMEPAGE_VADDR
+ * in every user address space, holding the time as of the latest
+ * hardclock, so that time() and the coarse clocks of clock_gettime()
+ * can read it without a system call.
+ *
+ * tp_seq is a sequence count: odd while the kernel is updating the
+ * page, and bumped again when it is done. A reader reads tp_seq,
+ * then the times, then tp_seq again, and goes round again if the
+ * two differ or are odd.
+ *
+ * The times are only as fine as the hardclock (HZ); there is no
+ * cycle counter user code can read to interpolate with. Callers that
+ * want better use __clock_gettime.
+ */
+
+#ifndef _KERN_TIMEPAGE_H_
+#define _KERN_TIMEPAGE_H_
+
+/* Below the stacks, and above every mmap mapping */
+#define TIMEPAGE_VADDR	0x7f600000
+
+struct timepage {
+	volatile __u32 tp_seq;
+	__time_t tp_realsec;	/* time of day */
+	__u32 tp_realnsec;
+	__time_t tp_monosec;	/* time since boot */
+	__u32 tp_mononsec;
+};
+
+#endif /* _KERN_TIMEPAGE_H_ */
@@ -0,0 +1,41 @@
+#ifndef _KMEM_CACHE_H_
+#define _KMEM_CACHE_H_
+
+/*
+ * Object caches for frequently allocated fixed-size kernel structures.
+ *
+ * A cache hands out objects of one size carved from page-sized slabs.
+ * Objects are kept in their constructed state while free: the
+ * constructor runs once when a slab is created and the destructor
+ * once when the slab is given back, not on every alloc/free. Things
+ * like embedded locks and CVs can therefore be set up once and then
+ * reused warm.
+ *
+ * Each CPU has a small magazine of free objects in front of the
+ * slabs, so the common alloc/free path only disables interrupts and
+ * does not touch the cache's lock.
+ *
+ *    kmem_cache_create  - make a cache for objects of SIZE bytes (at
+ *                         most a quarter page). CTOR, if not NULL,
+ *                         returns 0 or an error code; DTOR undoes it.
+ *                         Returns NULL on out-of-memory.
+ *    kmem_cache_destroy - release a cache. All its objects must have
+ *                         been freed and nothing may still be using it.
+ *    kmem_cache_alloc   - get a constructed object, or NULL.
+ *    kmem_cache_free    - return an object, in constructed state.
+ *    kmem_cache_printstats - print usage of all caches (for kh).
+ */
+
+#include <types.h>
+
+struct kmem_cache;
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+void kmem_cache_printstats(void);
+
+#endif /* _KMEM_CACHE_H_ */
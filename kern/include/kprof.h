@@ -0,0 +1,37 @@
+#ifndef _KPROF_H_
+#define _KPROF_H_
+
+/*
+ * Sampling CPU profiler ("options kprof").
+ *
+ * While the profiler is running, every timer interrupt records where
+ * the cpu it lands on was: the interrupted pc and return address from
+ * the trapframe, whether that was user or kernel code, and the current
+ * thread and process. Samples go into a ring per cpu that drops its
+ * oldest samples when full, so the profile covers the most recent
+ * KPROF_NRECS ticks of each cpu.
+ *
+ *    kprof_sample - record one sample; called from the timer interrupt.
+ *    kprof_start  - start sampling, clearing any old samples.
+ *    kprof_stop   - stop sampling; the samples are kept.
+ *    kprof_print  - print the samples as folded stacks, one line per
+ *                   distinct stack with its count:
+ *
+ *        pid:thread;0xRA;0xPC count       (kernel)
+ *        pid:thread;user;0xPC count       (user)
+ *
+ * which is the input format of flamegraph.pl once the addresses are
+ * put through addr2line -f against the kernel (or program) binary.
+ * There is no unwinder, so a kernel stack is only two deep, and in a
+ * function that has made a call of its own the return address is
+ * whatever that call left behind.
+ */
+
+struct trapframe;
+
+void kprof_sample(const struct trapframe *tf);
+int kprof_start(void);
+void kprof_stop(void);
+void kprof_print(void);
+
+#endif /* _KPROF_H_ */
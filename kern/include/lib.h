@@ -123,8 +123,9 @@ uint32_t random(void);
  * Kernel heap memory allocation. Like malloc/free.
  * If out of memory, kmalloc returns NULL.
  *
- * kheap_nextgeneration, dump, and dumpall do nothing unless heap
- * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ * kheap_nextgeneration, dump, dumpall, and profile do nothing unless
+ * heap labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ * kheap_profile prints what each allocation site has outstanding.
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
@@ -132,6 +133,7 @@ void kheap_printstats(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
+void kheap_profile(bool reset);
 
 /*
  * C string functions.
@@ -148,6 +150,7 @@ char *strchr(const char *searched, int searchfor);
 char *strrchr(const char *searched, int searchfor);
 char *strtok_r(char *buf, const char *seps, char **context);
 
+void *memchr(const void *block, int ch, size_t len);
 void *memcpy(void *dest, const void *src, size_t len);
 void *memmove(void *dest, const void *src, size_t len);
 void *memset(void *block, int ch, size_t len);
@@ -187,6 +190,25 @@ void kgets(char *buf, size_t maxbuflen);
 
 void kprintf_bootstrap(void);
 
+/*
+ * Once kprintf_bootstrap has run, kprintf doesn't wait for the
+ * console: it logs the message to a per-cpu ring and a thread prints
+ * it. See kprintf.c.
+ *
+ * kprintf_cpuinit makes the ring for a cpu; called from cpu_create.
+ * kprintf_flush prints everything logged so far; it does nothing
+ * unless called from a thread with interrupts on.
+ * kprintf_shutdown flushes the log and switches back to printing
+ * directly; called during shutdown.
+ * kprintf_dmesg reprints the most recent output.
+ * kprintf_tick is called by hardclock.
+ */
+void kprintf_cpuinit(unsigned cpunum);
+void kprintf_flush(void);
+void kprintf_shutdown(void);
+void kprintf_dmesg(void);
+void kprintf_tick(void);
+
 /*
  * Other miscellaneous stuff
  */
@@ -0,0 +1,71 @@
+#ifndef _LOCKFREE_H_
+#define _LOCKFREE_H_
+
+/*
+ * Lock-free stack and queue, for free lists and hand-offs where a
+ * spinlock would only ever protect one pointer.
+ *
+ * lfstack is a LIFO of small integers (array indices: coremap page
+ * numbers, slots in a table of objects) rather than pointers. The
+ * caller supplies the link array, one word per index, so the stack
+ * never allocates. The head packs the top index with a tag that
+ * changes on every push and pop, and pop makes its one compare-and-
+ * swap with interrupts off, so between reading the top and swapping
+ * it out there is no time for the tag to wrap: the ABA problem (the
+ * top popped and pushed back meanwhile, with a different next) can't
+ * happen. Indices go up to LFSTACK_MAXINDEX.
+ *
+ *    lfstack_init  - set up S, empty, with the link array NEXT.
+ *    lfstack_push  - push INDEX, which must not already be on S.
+ *    lfstack_pop   - pop the top index, or LFSTACK_NONE if empty.
+ *
+ * mpscq is a FIFO of intrusive nodes with any number of producers
+ * and one consumer. Producers push onto a list newest-first with one
+ * compare-and-swap each; the consumer takes the whole list at once
+ * with an atomic swap and reverses it. Neither side ever looks at a
+ * node another cpu might be taking, so there is no ABA problem and no
+ * tag. Items from one producer come out in the order pushed.
+ *
+ *    mpscq_init    - set up Q, empty.
+ *    mpscq_push    - add N. May be called from interrupt handlers.
+ *                    Returns true if there was nothing else pushed
+ *                    since the consumer last took things, which is
+ *                    when a sleeping consumer needs waking.
+ *    mpscq_pop     - take the oldest node, or NULL. Consumer only.
+ *    mpscq_popall  - take everything, as a list oldest first linked
+ *                    through mn_next. Consumer only.
+ *
+ * Both give the usual acquire and release ordering: whatever was
+ * written to an item before it was pushed is visible to whoever pops
+ * it.
+ */
+
+#define LFSTACK_INDEXBITS	20
+#define LFSTACK_INDEXMASK	((1U << LFSTACK_INDEXBITS) - 1)
+#define LFSTACK_NONE		LFSTACK_INDEXMASK
+#define LFSTACK_MAXINDEX	(LFSTACK_NONE - 1)
+
+struct lfstack {
+	volatile unsigned lf_head;	/* tag, then top index */
+	volatile unsigned *lf_next;	/* next index down, by index */
+};
+
+void lfstack_init(struct lfstack *s, volatile unsigned *next);
+void lfstack_push(struct lfstack *s, unsigned index);
+unsigned lfstack_pop(struct lfstack *s);
+
+struct mpscq_node {
+	struct mpscq_node *mn_next;
+};
+
+struct mpscq {
+	struct mpscq_node *volatile mq_in;	/* pushed, newest first */
+	struct mpscq_node *mq_out;		/* taken, oldest first */
+};
+
+void mpscq_init(struct mpscq *q);
+bool mpscq_push(struct mpscq *q, struct mpscq_node *n);
+struct mpscq_node *mpscq_pop(struct mpscq *q);
+struct mpscq_node *mpscq_popall(struct mpscq *q);
+
+#endif /* _LOCKFREE_H_ */
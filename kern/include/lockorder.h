@@ -0,0 +1,63 @@
+#ifndef _LOCKORDER_H_
+#define _LOCKORDER_H_
+
+/*
+ * Lock order checking for sleep locks. Enable with "options
+ * lockorder" in the kernel config (needs "options shell").
+ *
+ * Unlike hangman, which looks for a cycle of threads actually waiting
+ * on each other, this learns the order locks get taken in and
+ * complains the first time two classes of lock are taken in both
+ * orders, whether or not anything deadlocked that time. A lock's
+ * class is its name, so all the vnode locks (say) count as one.
+ *
+ * The order graph is a bit matrix with a bit per pair of classes,
+ * set once one has been held while the other was taken. Taking a
+ * lock looks up one bit: the one from the class of the lock the
+ * thread took most recently, and still holds, to the new one. Only
+ * when that bit is clear, which happens once per pair, is the graph
+ * searched for a path the other way, under a spinlock. Checking the
+ * most recent lock is enough, as the locks held were themselves
+ * taken in order, each one recorded after the one before.
+ *
+ * Two locks of the same class may be held at once, so taking one
+ * while holding another of its class is not checked.
+ *
+ *    lockorder_class   - class number for a lock named NAME. Call at
+ *                        lock creation.
+ *    lockorder_acquire - check and note that curthread is about to
+ *                        take LOCK.
+ *    lockorder_release - note that curthread has let LOCK go.
+ */
+
+#include "opt-lockorder.h"
+
+#if OPT_LOCKORDER
+
+struct lock;
+
+/* How many held locks a thread's record has room for */
+#define LOCKORDER_DEPTH		8
+
+/* Per-thread record of the locks held, oldest first */
+struct lockorder_held {
+	const struct lock *lh_locks[LOCKORDER_DEPTH];
+	unsigned lh_num;
+	unsigned lh_untracked;		/* taken with lh_locks[] full */
+};
+
+unsigned lockorder_class(const char *name);
+void lockorder_acquire(const struct lock *lock);
+void lockorder_release(const struct lock *lock);
+
+#define LOCKORDER_HELD(sym)	struct lockorder_held sym
+#define LOCKORDER_HELDINIT(h)	((h)->lh_num = 0, (h)->lh_untracked = 0)
+
+#else
+
+#define LOCKORDER_HELD(sym)
+#define LOCKORDER_HELDINIT(h)
+
+#endif
+
+#endif /* _LOCKORDER_H_ */
@@ -39,8 +39,13 @@ struct cpu;       /* from <cpu.h> */
 struct trapframe; /* from <machine/trapframe.h> */
 
 
-/* Initialize the system bus and probe and attach hardware devices. */
+/*
+ * Initialize the system bus, find the CPUs, and turn interrupts on.
+ * mainbus_probe then probes and attaches the hardware devices; call
+ * it once the other CPUs are running, as it uses threads.
+ */
 void mainbus_bootstrap(void);
+void mainbus_probe(void);
 
 /* Start up secondary CPUs, once their cpu structures are set up */
 void mainbus_start_cpus(void);
@@ -48,10 +53,34 @@ void mainbus_start_cpus(void);
 /* Bus-level interrupt handler, called from cpu-level trap/interrupt code */
 void mainbus_interrupt(struct trapframe *);
 
+/* Print per-device interrupt counts and times (the intrstat command) */
+void mainbus_printintrstats(void);
+
+/* Rate of the cpu cycle counter (cpu_getcycles), in cycles per second. */
+uint32_t mainbus_cyclerate(void);
+
+/*
+ * Cycles the current cpu has counted since it started, in 64 bits;
+ * unlike cpu_getcycles, this doesn't go back to zero when the timer
+ * is reset. Each cpu counts from its own start, so only differences
+ * taken on one cpu mean anything. (See clock_monotonic_ns.)
+ */
+uint64_t mainbus_cycles(void);
+
 /* Find the size of main memory. */
 /* XXX this interface is not adequately MI */
 size_t mainbus_ramsize(void);
 
+/*
+ * The current cpu's hardclock timer, for idling (see clock.c). Call
+ * with interrupts off. mainbus_timer_stop stops the periodic timer
+ * and asks for a single interrupt TICKS hardclocks after the last
+ * one instead. mainbus_timer_restart starts the periodic timer again
+ * and returns how many hardclocks went by that weren't delivered.
+ */
+void mainbus_timer_stop(unsigned ticks);
+unsigned mainbus_timer_restart(void);
+
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
@@ -0,0 +1,143 @@
+#ifndef _NET_H_
+#define _NET_H_
+
+/*
+ * The network stack: packet buffers, interfaces, IPv4 and UDP.
+ *
+ * Packet buffers come from a fixed pool set aside at boot, so the
+ * receive path never calls kmalloc and can run in an interrupt
+ * handler; when the pool is empty, packets are dropped rather than
+ * waited for. Each pbuf holds one whole packet, with room in front
+ * for the headers added on the way out.
+ *
+ *    pbuf_get      - take a pbuf from the pool, with PBUF_HEADROOM
+ *                    bytes of headroom and no data, or NULL if the
+ *                    pool is empty. Never sleeps.
+ *    pbuf_put      - give one back. Never sleeps.
+ *    pbuf_push     - make room for LEN more bytes in front of the
+ *                    data (a header) and return a pointer to them.
+ *    pbuf_pull     - drop LEN bytes from the front (a header that has
+ *                    been dealt with).
+ *
+ * A network interface is a struct netif, which the driver fills in
+ * and registers. The driver passes each packet it receives to
+ * net_input, in thread context, and the stack hands it packets to
+ * send through ni_output, which takes over the pbuf whether or not
+ * it succeeds. Addresses are 10.0.X.Y, where X.Y is the interface's
+ * link address; since the mapping goes both ways there is no ARP.
+ * Packets to the interface's own address or to 127.0.0.1 never get
+ * to a driver.
+ *
+ * All addresses and ports passed to and from the functions here are
+ * in host byte order.
+ */
+
+#include <kern/in.h>
+
+struct uio;
+struct vnode;
+struct pollset;
+
+/* Largest IP packet, and largest UDP payload that fits in one */
+#define NET_MTU		1500
+#define UDP_MAXDATA	(NET_MTU - 20 - 8)
+
+/* Packet buffers */
+#define PBUF_HEADROOM	64		/* link + IP + UDP headers, rounded up */
+#define PBUF_SIZE	(PBUF_HEADROOM + NET_MTU)
+#define PBUF_COUNT	64
+
+struct pbuf {
+	struct pbuf *pb_next;		/* on a queue */
+	unsigned pb_off;		/* where the data starts in pb_buf */
+	unsigned pb_len;		/* bytes of data */
+	uint32_t pb_srcaddr;		/* sender, for received datagrams */
+	uint16_t pb_srcport;
+	uint16_t pb_unused;		/* keeps pb_buf word-aligned */
+	char pb_buf[PBUF_SIZE];
+};
+
+#define pbuf_data(pb)	((void *)((pb)->pb_buf + (pb)->pb_off))
+
+void pbuf_bootstrap(void);
+struct pbuf *pbuf_get(void);
+void pbuf_put(struct pbuf *pb);
+void *pbuf_push(struct pbuf *pb, unsigned len);
+void pbuf_pull(struct pbuf *pb, unsigned len);
+
+/* Interfaces */
+struct netif {
+	const char *ni_name;
+	uint32_t ni_addr;		/* our IP address */
+	int (*ni_output)(struct netif *ni, struct pbuf *pb, uint32_t dst);
+	void *ni_data;			/* the driver's */
+	struct netif *ni_next;		/* all interfaces */
+
+	/* Counters */
+	unsigned ni_ipackets;		/* packets received */
+	unsigned ni_opackets;		/* packets sent */
+	unsigned ni_idrops;		/* received but dropped */
+	unsigned ni_odrops;		/* not sent for want of room */
+};
+
+/* Convert between link addresses and IP addresses on an interface */
+#define NET_LINKTOIP(la)	(0x0a000000 | ((la) & 0xffff))
+#define NET_IPTOLINK(ip)	((ip) & 0xffff)
+#define NET_ONLINK(ip)		(((ip) & 0xffff0000) == 0x0a000000)
+
+void netif_register(struct netif *ni);
+struct netif *netif_first(void);
+void net_input(struct netif *ni, struct pbuf *pb);
+
+/* IP (ip.c) */
+uint16_t in_cksum(const void *data, unsigned len, uint32_t sum);
+int ip_output(struct pbuf *pb, uint32_t src, uint32_t dst, uint8_t proto);
+uint32_t ip_srcaddr(uint32_t dst);
+bool ip_islocal(uint32_t addr);
+
+/*
+ * UDP (udp.c).
+ *
+ *    udp_create  - make an unbound socket.
+ *    udp_destroy - close it, dropping anything queued.
+ *    udp_bind    - give it a local address (INADDR_ANY for all of
+ *                  ours) and port (0 for any free one). Sending from
+ *                  an unbound socket binds it to INADDR_ANY, port 0.
+ *    udp_send    - send the rest of UIO as one datagram.
+ *    udp_recv    - receive one datagram into UIO, dropping whatever
+ *                  doesn't fit, and say who sent it. Waits for one
+ *                  for at most TIMEOUT hardclocks, or forever if
+ *                  TIMEOUT is 0; returns ETIMEDOUT if none came.
+ *    udp_poll    - vop_poll for a socket.
+ *
+ * Each socket queues at most UDP_QLEN datagrams; more are dropped,
+ * so that a socket nobody reads can't empty the pbuf pool.
+ */
+#define UDP_QLEN	16
+
+struct udpsock;
+
+void udp_input(struct pbuf *pb, uint32_t src, uint32_t dst);
+int udp_create(struct udpsock **ret);
+void udp_destroy(struct udpsock *us);
+int udp_bind(struct udpsock *us, uint32_t addr, uint16_t port);
+int udp_send(struct udpsock *us, struct uio *uio,
+	     uint32_t dstaddr, uint16_t dstport);
+int udp_recv(struct udpsock *us, struct uio *uio, unsigned timeout,
+	     uint32_t *srcaddr, uint16_t *srcport);
+int udp_poll(struct udpsock *us, int events, struct pollset *ps,
+	     int *result);
+
+/*
+ * Sockets (socket.c). A socket is a vnode, so it can go in the file
+ * table; socket_create makes one with one reference, and
+ * socket_get returns the udpsock behind a vnode, or NULL if the
+ * vnode isn't a socket.
+ */
+int socket_create(int domain, int type, int protocol, struct vnode **ret);
+struct udpsock *socket_get(struct vnode *v);
+
+/* Set everything up. Called from boot() before devices attach. */
+void net_bootstrap(void);
+
+#endif /* _NET_H_ */
@@ -3,6 +3,7 @@
 
 #include <vnode.h>
 #include <types.h>
+#include <spinlock.h>
 
 /**
  * @struct openfile
@@ -11,17 +12,37 @@
  * 
  * This structure contains information about an open file, including:
  * - A pointer to the vnode representing the file.
- * - A lock to ensure thread-safe access to the file.
- * - A reference count indicating how many times the file is open.
- * - The mode in which the file was opened.
+ * - A lock serializing I/O that uses or moves the offset; positional
+ *   I/O doesn't take it.
+ * - A reference count indicating how many times the file is open,
+ *   under a spinlock of its own.
+ * - The mode in which the file was opened: the access mode, and
+ *   O_APPEND if every write goes at the end of file, and O_DIRECT if
+ *   the file system should not cache the data.
  * - The current offset within the file.
  */
 struct openfile {
     struct vnode *vn;   
     struct lock *lock;  
+    struct spinlock reflock;
     int count;          
     int mode;          
     off_t offset;      
 };
 
+/*
+ * Each file descriptor referring to an open file holds a reference,
+ * and so does each system call using it, for the duration. Neither
+ * sleeps. openfile_incref adds one; openfile_decref drops one, and
+ * closes the file when the last goes. (In filetable.c.)
+ */
+void openfile_incref(struct openfile *of);
+void openfile_decref(struct openfile *of);
+
+/*
+ * Make an openfile, with one reference, for a vnode that wasn't
+ * opened by name (a pipe end or a socket). (In file_syscalls.c.)
+ */
+int openfile_create(struct vnode *vn, int mode, struct openfile **ret);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef _PAGEOUT_H_
+#define _PAGEOUT_H_
+
+/*
+ * The pageout thread, which keeps some memory free ahead of demand so
+ * that page faults don't have to stop and page something out first.
+ *
+ * When the number of free pages drops below pageout_lowater, the next
+ * frame allocation wakes the thread, which drops unused file cache
+ * pages and then pages out user pages with the clock until there are
+ * pageout_hiwater pages free again, or until it can find nothing
+ * more to free. Allocations that find memory empty regardless still
+ * reclaim for themselves (see pt_allocframe).
+ *
+ * Below pageout_scanwater, the thread also runs the clock's front
+ * hand every tick, so the clock knows which pages are in use by the
+ * time it has to evict; the shorter memory is, the faster it goes,
+ * up to pageout_fastscan pages a tick.
+ *
+ * The watermarks are in pages and can be changed from the kernel
+ * menu (the pageout command), as can the scan rate and the clock's
+ * hand spread. Setting pageout_lowater to 0 turns the thread off.
+ *
+ *    pageout_bootstrap  - start the thread and set the default
+ *                         watermarks. Call after swap_bootstrap.
+ *    pageout_kick       - wake the thread if memory is low. Cheap;
+ *                         may be called with vm_lock held.
+ *    pageout_printstats - print what it has done (for the kh menu
+ *                         command).
+ */
+
+extern unsigned pageout_lowater;
+extern unsigned pageout_hiwater;
+extern unsigned pageout_scanwater;
+extern unsigned pageout_fastscan;
+
+void pageout_bootstrap(void);
+void pageout_kick(void);
+void pageout_printstats(void);
+
+#endif /* _PAGEOUT_H_ */
@@ -0,0 +1,126 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Two-level page table for the paging VM system.
+ *
+ * A virtual address splits into a 10-bit first-level index, a 10-bit
+ * second-level index, and the 12-bit page offset. The first level is
+ * a page of pointers to second-level tables; each second-level table
+ * is a page of PTEs and is only allocated once something in the 4M
+ * of address space it covers has been touched. Sparse address spaces
+ * therefore cost one page plus one page per 4M actually in use.
+ *
+ * A PTE holds the physical frame in its top 20 bits and flags in the
+ * low bits. A zero PTE means "never touched": the page is supplied
+ * zero-filled on first fault.
+ *
+ * After fork, parent and child share every resident frame with
+ * PTE_COW set in both tables; the coremap reference count says how
+ * many tables still point at the frame. The first write through a
+ * COW entry gets a private copy (or, if no one else still shares the
+ * frame, simply clears the bit).
+ *
+ * A page that has been paged out has PTE_SWAPPED set instead of
+ * PTE_PRESENT, and its swap slot in place of the frame number.
+ *
+ * A page of a shared file mapping (mmap MAP_SHARED) is a file cache
+ * frame, mapped with PTE_SHARED: writes go to the frame itself, and
+ * fork copies the entry as is instead of making it PTE_COW. Such a
+ * page is only mapped writable once a write has faulted on it and
+ * set PTE_DIRTY, which says this page table owes the file a write.
+ * Pages of anonymous shared memory (shm.h) are mapped the same way,
+ * with no file to owe.
+ *
+ * A page locked in memory (mlock) has PTE_LOCKED set, and its frame
+ * is pinned in the coremap for as long as it stays set, so the clock
+ * leaves it alone. A locked page is never shared copy-on-write: fork
+ * gives the child its own copy at once (pt_copy), so the locking
+ * process's writes never fault. pt_nlocked counts them.
+ *
+ * The TLB refill handler (exception-mips1.S) walks the table itself,
+ * without vm_lock, and loads any entry with PTE_REFILL set straight
+ * into the TLB, writable if PTE_WRITABLE is also set; anything else
+ * goes to vm_fault. vm_fault sets the two bits to say what it just
+ * gave the TLB, so they are the same bits as TLBLO_VALID and
+ * TLBLO_DIRTY. Whoever takes a mapping away, or makes it read-only,
+ * clears them in the PTE before shooting down the TLB entry, or the
+ * next miss would put it straight back; a PTE written afresh has
+ * them clear. The clock (swap.c) clears PTE_REFILL to make the next
+ * use of a page fault and count as a reference.
+ *
+ * pt_nresident counts the PTE_PRESENT entries, shared or not, so the
+ * OOM killer can see who is using the memory without walking every
+ * table. Whoever sets or clears PTE_PRESENT keeps it up to date.
+ */
+
+#include <types.h>
+
+typedef uint32_t pte_t;
+
+#define PTE_FRAME	0xfffff000	/* physical frame number */
+#define PTE_PRESENT	0x00000001	/* frame is valid */
+#define PTE_COW		0x00000002	/* frame is shared; copy on write */
+#define PTE_SWAPPED	0x00000004	/* page is in swap slot PTE_SLOT */
+#define PTE_SHARED	0x00000008	/* frame is a shared file or shm page */
+#define PTE_DIRTY	0x00000010	/* shared page written, not saved */
+#define PTE_LOCKED	0x00000020	/* frame pinned by mlock */
+#define PTE_REFILL	0x00000200	/* refill may load it (TLBLO_VALID) */
+#define PTE_WRITABLE	0x00000400	/* ...writable (TLBLO_DIRTY) */
+
+#define PTE_SLOT(pte)	((unsigned)((pte) >> 12))
+
+#define PT_NENTRIES	1024
+#define PT_L1INDEX(va)	(((va) >> 22) & (PT_NENTRIES - 1))
+#define PT_L2INDEX(va)	(((va) >> 12) & (PT_NENTRIES - 1))
+
+struct addrspace;
+
+/* The refill handler knows where pt_l2 is; see vmtlb.c */
+struct pagetable {
+	struct addrspace *pt_as;	/* owner, for the evictor */
+	unsigned pt_nresident;		/* PTE_PRESENT entries */
+	unsigned pt_npages;		/* pages of page table */
+	unsigned pt_nlocked;		/* PTE_LOCKED entries */
+	pte_t *pt_l2[PT_NENTRIES];
+	uint16_t pt_l2count[PT_NENTRIES];	/* nonzero PTEs in each */
+};
+
+/* Note that the zero PTE for VA in PT has been filled in */
+#define PT_FILLED(pt, va)	((pt)->pt_l2count[PT_L1INDEX(va)]++)
+
+/*
+ * Functions in pagetable.c. These do no locking of their own; vm_lock
+ * must be held.
+ *
+ *    pt_create   - make an empty page table for AS.
+ *    pt_destroy  - free the table and every frame it maps.
+ *    pt_lookup   - return a pointer to the PTE for VADDR, allocating
+ *                  the second-level table if CREATE is set. Returns
+ *                  NULL if there is no such table (or no memory).
+ *    pt_getpage  - return the PTE for VADDR, allocating a zeroed
+ *                  frame on first touch or reading the page back
+ *                  from swap. If WRITE is set, first break
+ *                  any copy-on-write sharing, so that the result does
+ *                  not have PTE_COW set.
+ *    pt_copy     - share every resident page of OLD with NEW,
+ *                  marking both copies PTE_COW (except PTE_SHARED
+ *                  pages, which stay shared, and locked pages, which
+ *                  NEW gets a copy of).
+ *    pt_unmap    - forget the NPAGES pages from VADDR, freeing their
+ *                  frames and swap slots, and any second-level table
+ *                  left empty. The caller deals with the TLB.
+ *    pt_lock     - lock the resident page at VADDR in memory, pinning
+ *                  its frame. Does nothing if it isn't resident.
+ *    pt_unlock   - unlock the NPAGES pages from VADDR.
+ */
+struct pagetable *pt_create(struct addrspace *as);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+int pt_getpage(struct pagetable *pt, vaddr_t vaddr, bool write, pte_t *ret);
+int pt_copy(struct pagetable *old, struct pagetable *new);
+void pt_unmap(struct pagetable *pt, vaddr_t vaddr, unsigned npages);
+void pt_lock(struct pagetable *pt, vaddr_t vaddr);
+void pt_unlock(struct pagetable *pt, vaddr_t vaddr, unsigned npages);
+
+#endif /* _PAGETABLE_H_ */
@@ -0,0 +1,35 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+/*
+ * Spreading bulk kernel work over the cpus.
+ *
+ *    parallel_for       - call FUNC(ARG, START, END) for consecutive
+ *                         ranges [START, END) that together cover 0 to
+ *                         N-1, each CHUNK long except perhaps the last,
+ *                         and return once they have all been done.
+ *    parallel_bootstrap - start the helpers. Called from boot() after
+ *                         workqueue_bootstrap.
+ *
+ * The calling thread works through the chunks itself, and up to
+ * PARALLEL_MAXHELPERS worker threads on other cpus take chunks too.
+ * Which chunk runs where, and in what order, is unspecified, so FUNC
+ * must only write what belongs to its own range; anything it adds up
+ * is best kept per range and totalled after. FUNC may not sleep on
+ * anything the caller holds, since it may run in another thread; locks
+ * the caller holds protect FUNC's work as if the caller were doing it.
+ *
+ * It all runs in the caller if there's only one chunk or one cpu,
+ * before parallel_bootstrap, or if the caller holds a spinlock or is
+ * in an interrupt handler, where waiting for the helpers isn't
+ * allowed. So FUNC should be written to be correct either way.
+ */
+
+#define PARALLEL_MAXHELPERS	7
+
+void parallel_for(unsigned n, unsigned chunk,
+		  void (*func)(void *arg, unsigned start, unsigned end),
+		  void *arg);
+void parallel_bootstrap(void);
+
+#endif /* _PARALLEL_H_ */
@@ -0,0 +1,54 @@
+#ifndef _PERCPU_H_
+#define _PERCPU_H_
+
+/*
+ * Per-cpu event counters.
+ *
+ * Each cpu keeps its own copy of every counter in struct cpu and only
+ * ever writes its own, so counting an event takes neither a lock nor
+ * a shared cache line; the increment only has to be safe against
+ * interrupts and against migrating to another cpu partway through,
+ * which raising the spl covers. Readers add up the copies of all the
+ * cpus without a lock, so a total may be a little stale.
+ *
+ * To add a counter, add it to the enum below (before PCPU_NCOUNTERS)
+ * and give it a name in percpu_names in percpu.c.
+ *
+ *    percpu_inc   - count one event.
+ *    percpu_add   - count N events.
+ *    percpu_read  - total of a counter over all cpus.
+ *    percpu_readcpu - one cpu's copy of a counter.
+ *    percpu_name  - a counter's name, as shown by stats:.
+ *
+ * All the counters can be read from user level through the stats:
+ * device (see devstats.c), one per line.
+ */
+
+enum percpu_counter {
+	PCPU_SYSCALLS,		/* system calls */
+	PCPU_FAULTS,		/* vm_fault calls */
+	PCPU_SWITCHES,		/* context switches */
+	PCPU_INTERRUPTS,	/* hardware interrupts */
+	PCPU_BLKREQS,		/* disk requests */
+	PCPU_BLKSECTS,		/* disk sectors transferred */
+	/* VM events, in the order of enum vmstat_event (vmstat.h) */
+	PCPU_VMTLBMISS,		/* faults on a missing TLB entry */
+	PCPU_VMREADONLY,	/* faults writing a read-only entry */
+	PCPU_VMZEROFILL,	/* pages zero-filled on first touch */
+	PCPU_VMFILE,		/* file pages mapped on a fault */
+	PCPU_VMCOW,		/* copy-on-write copies made */
+	PCPU_VMPAGEIN,		/* pages read back from swap */
+	PCPU_VMPAGEOUT,		/* pages written to swap */
+	PCPU_VMEVICT,		/* frames taken back from their users */
+	PCPU_NCOUNTERS
+};
+
+struct cpu;
+
+void percpu_inc(enum percpu_counter which);
+void percpu_add(enum percpu_counter which, uint64_t n);
+uint64_t percpu_read(enum percpu_counter which);
+uint64_t percpu_readcpu(struct cpu *c, enum percpu_counter which);
+const char *percpu_name(enum percpu_counter which);
+
+#endif /* _PERCPU_H_ */
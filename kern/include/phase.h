@@ -0,0 +1,19 @@
+#ifndef _PHASE_H_
+#define _PHASE_H_
+
+/*
+ * Phase markers for System/161's output and trace161's profiler, for
+ * the kernel's own use as well as through the phase() system call.
+ * See <kern/phase.h> for the operations and what they send.
+ *
+ *    phase_op - do OP on the phase called NAME. Returns 0 or an error:
+ *               EINVAL for a bad OP or an END with no matching BEGIN,
+ *               ENOSPC if there are already PHASE_MAX names.
+ *
+ * Without an ltrace device this still keeps track of the phases, so
+ * the errors are the same, but sends nothing.
+ */
+
+int phase_op(int op, const char *name);
+
+#endif /* _PHASE_H_ */
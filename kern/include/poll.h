@@ -0,0 +1,57 @@
+/*
+ * Kernel side of poll(). See vfs/vfspoll.c.
+ */
+
+#ifndef _POLL_H_
+#define _POLL_H_
+
+#include <spinlock.h>
+#include <kern/poll.h>
+
+struct pollentry;
+struct pollset;
+
+/*
+ * Wait queue for pollers, embedded in anything that can be polled;
+ * typically one for readers and one for writers.
+ *
+ * Its vop_poll (or devop_poll) calls pollset_register on the pollhead
+ * for each event it was asked about, then reports which are ready.
+ * It must register *before* checking, so a wakeup in between isn't
+ * lost. Then, after any change that might make something ready, the
+ * object calls pollhead_wakeup, which is cheap if no one is polling.
+ *
+ *    pollhead_init/cleanup - set up and tear down.
+ *    pollhead_wakeup       - wake all pollsets registered here. Can be
+ *                            called from interrupt handlers, but not
+ *                            with any spinlock held.
+ *    pollset_register      - put PS on PH's queue until the poll is
+ *                            over. PS may be NULL, meaning the caller
+ *                            isn't going to wait, so do nothing.
+ */
+struct pollhead {
+	struct spinlock ph_lock;
+	struct pollentry *ph_entries;	/* registered pollsets */
+};
+
+void pollhead_init(struct pollhead *ph);
+void pollhead_cleanup(struct pollhead *ph);
+void pollhead_wakeup(struct pollhead *ph);
+void pollset_register(struct pollset *ps, struct pollhead *ph);
+
+/*
+ * One poll in progress (used by sys_poll).
+ *
+ *    pollset_create  - for up to MAXREG registrations.
+ *    pollset_destroy - unregister everywhere and free.
+ *    pollset_wait    - sleep until woken by a pollhead PS is on, or
+ *                      for at most TICKS hardclocks unless TICKS is 0.
+ *                      Returns 0 or ETIMEDOUT. A wakeup that came
+ *                      since registering (or the last wait) counts.
+ */
+struct pollset *pollset_create(unsigned maxreg);
+void pollset_destroy(struct pollset *ps);
+int pollset_wait(struct pollset *ps, unsigned ticks);
+
+
+#endif /* _POLL_H_ */
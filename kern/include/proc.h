@@ -36,44 +36,136 @@
  * Note: curproc is defined by <current.h>.
  */
 
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <spinlock.h>
+#include <thread.h>		/* for struct schedstats */
 #include <openfile.h>
 #include <limits.h>
+#include <rcu.h>
+#include <vmstat.h>
+#include <iostat.h>		/* for struct ioacct */
 #include <opt-shell.h>
 
 struct addrspace;
+struct bitmap;
+struct filetable;
+struct rwlock;
 struct thread;
 struct vnode;
 
 #if OPT_SHELL
 
-/* Maximum number of processes in the system */
-#define PROC_MAX 100
+/*
+ * The process table maps pids to procs. It is a two-level radix
+ * table: pids are looked up in chunks of PROC_CHUNKSIZE slots, and a
+ * chunk is only allocated once the table has filled up the ones
+ * before it, so its size follows the most processes there have been
+ * at once. A bitmap of pids in use, searched onward from the last pid
+ * handed out, finds a free one.
+ *
+ * Lookups are RCU readers (see rcu.h): chunks are never freed, a
+ * slot is only set once its proc is ready, and a reaped proc is only
+ * freed after a grace period. So proc_search takes no lock and writes
+ * nothing shared; call it inside rcu_read_lock, and the proc it
+ * returns stays valid (if maybe exited) until rcu_read_unlock.
+ * Everything else holds the table lock.
+ */
+#define PROC_CHUNKSHIFT 8
+#define PROC_CHUNKSIZE  (1 << PROC_CHUNKSHIFT)
+#define PROC_NCHUNKS    ((PID_MAX + PROC_CHUNKSIZE) / PROC_CHUNKSIZE)
 
 /* Process table structure */
 struct process_table {
-    struct proc *proc[PROC_MAX + 1]; 	/* Process table */
-    pid_t last_pid;                  	/* Last PID assigned */
-    struct spinlock lock;            	/* Lock for the process table */
-    bool active;                     	/* Process table active */
+    struct proc **chunks[PROC_NCHUNKS]; /* Slots, by pid */
+    unsigned nchunks;                   /* Chunks allocated so far */
+    unsigned nprocs;                    /* Processes in the table */
+    struct bitmap *pids;                /* Pids in use, or not yet available */
+    pid_t last_pid;                     /* Last PID assigned */
+    struct rwlock *lock;                /* Lock for the process table */
+    bool active;                        /* Process table active */
 };
 
 void process_table_init(void);
 int proc_add(pid_t pid, struct proc *proc);
 void proc_remove(pid_t pid);
 struct proc *proc_search(pid_t pid);
+void proc_printstats(void);
+
+/*
+ * Call FUNC(P, DATA) for every process in the table, with the table
+ * locked for reading; FUNC must not create or reap processes.
+ */
+void proc_foreach(void (*func)(struct proc *p, void *data), void *data);
+
+/* Number of processes in the table, for RLIMIT_NPROC */
+unsigned proc_count(void);
+
+/*
+ * Charge a hardclock to P, which was running, and kill it if that
+ * takes it past RLIMIT_CPU: SIGXCPU at the soft limit, SIGKILL at the
+ * hard one. Called from hardclock, so it only sets p_killsig.
+ */
+void proc_cputick(struct proc *p);
+
+/*
+ * Parents and children. A child is on its parent's p_children list
+ * until it exits and then on p_zombies, so waiting for any child
+ * just takes the first zombie. The family lock covers the lists,
+ * p_parent, p_exited and p_exitcode; a parent sleeps on its own p_cv
+ * for its children to exit.
+ *
+ *    proc_addchild  - make CHILD a child of PARENT; do it before
+ *                     the child can run.
+ *    proc_remchild  - undo proc_addchild, if the child never ran.
+ *    proc_waitchild - find an exited child of the current process,
+ *                     PID or any if PID is -1, and unlink it. Waits
+ *                     unless NOHANG, in which case *RET may be NULL.
+ *    proc_exit      - record the exit status and detach the current
+ *                     thread, the last one in the process. Children
+ *                     are orphaned (and reaped when they exit), and
+ *                     the parent is woken. Orphans reap themselves.
+ *                     The address space, files and cwd are left for
+ *                     the reaper thread to free.
+ *    proc_reap      - free an exited process and its pid.
+ *    proc_reaping   - true while the reaper has exited processes
+ *                     whose memory isn't freed yet.
+ *    proc_reaper_bootstrap - start the reaper. Call after
+ *                     workqueue_bootstrap; exits before then free
+ *                     everything themselves.
+ */
+void proc_addchild(struct proc *parent, struct proc *child);
+void proc_remchild(struct proc *parent, struct proc *child);
+int proc_waitchild(pid_t pid, bool nohang, struct proc **ret);
+void proc_exit(int waitcode);
+void proc_reap(struct proc *p);
+bool proc_reaping(void);
+void proc_reaper_bootstrap(void);
 #endif /* OPT_SHELL */
 
 #if OPT_SHELL
 struct proc *proc_create_fork(const char *name);
+
+/* Maximum number of user threads in a process, counting the first */
+#define PROC_UTHREAD_MAX 32
+
+/*
+ * A user thread, by thread id (see thread_syscalls.c). The first
+ * thread of a process is 0.
+ */
+struct uthread {
+    bool ut_inuse;			/* running, or exited and not joined */
+    bool ut_exited;
+    int ut_exitval;
+};
 #endif
 
 /*
  * Process structure.
  *
- * Note that we only count the number of threads in each process.
- * (And, unless you implement multithreaded user processes, this
- * number will not exceed 1 except in kproc.) If you want to know
+ * Note that we only count the number of threads in each process,
+ * plus the p_uthreads table that thread_join works from, which is
+ * protected by p_locklock. If you want to know
  * exactly which threads are in the process, e.g. for debugging, add
  * an array and a sleeplock to protect it. (You can't use a spinlock
  * to protect an array because arrays need to be able to call
@@ -89,21 +181,49 @@ struct proc {
 	char *p_name;			/* Name of this process */
 	struct spinlock p_lock;		/* Lock for this structure */
 	unsigned p_numthreads;		/* Number of threads in this process */
+	struct schedstats p_stats;	/* Totals of exited threads */
+	struct schedstats p_childstats;	/* Totals of reaped children */
+	struct vmstats p_vmstats;	/* Faults taken; p_lock */
+	struct vmstats p_childvm;	/* Totals of reaped children */
+	struct ioacct p_io;		/* Blocks read and written; p_lock */
+	struct ioacct p_childio;	/* Totals of reaped children */
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
+	struct rlimit p_rlimits[__RLIMIT_NUM];	/* setrlimit; p_lock */
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
 
 	#if OPT_SHELL
-	struct openfile *fileTable[OPEN_MAX];	/* File table */
+	struct filetable *p_files;				/* Descriptors; see filetable.h */
 	pid_t p_pid;							/* Process ID */
 	int p_exitcode;							/* Exit code */
 	bool p_exited;							/* Process exited */
-	struct cv *p_cv;						/* Condition variable */
-	pid_t parent_pid;						/* Parent process ID */
+	struct cv *p_cv;						/* A child exited */
+	struct proc *p_parent;					/* NULL if orphaned */
+	struct proc *p_children;				/* Running children */
+	struct proc *p_zombies;					/* Exited children, newest first */
+	struct proc *p_sibling;					/* Next on the parent's list */
 	struct lock *p_locklock;				/* Lock for this structure */	
+	struct uthread p_uthreads[PROC_UTHREAD_MAX];	/* User threads */
+	struct cv *p_threadcv;					/* Thread exits */
+	bool p_exiting;							/* Other threads must exit */
+	int p_killsig;							/* Killed by this signal */
+	unsigned p_cputicks;					/* Hardclocks run, for RLIMIT_CPU */
+	userptr_t p_profbuf;					/* profil() histogram; p_lock */
+	size_t p_profsize;						/* its size in bytes */
+	vaddr_t p_profoffset;					/* pc of its first counter */
+	unsigned p_profscale;					/* 0 when not profiling */
+	struct aioctx *p_aio;					/* I/O rings; see aio_syscalls.c */
+	bool p_flocks;							/* Has taken fcntl locks */
+	struct rcu_head p_rcu;					/* Freeing, after proc_reap */
+	char *p_cwdpath;						/* getcwd, cached; p_locklock */
+	size_t p_cwdlen;						/* its length */
+	unsigned p_cwdgen;						/* vfs_namegen it was got at */
+	struct addrspace *p_deadas;				/* For the reaper, after exit */
+	struct proc *p_reapnext;				/* On the reaper's list */
+	volatile unsigned p_holds;				/* Reaper and table; see proc_exit */
 	#endif
 };
 
@@ -119,6 +239,9 @@ struct proc *proc_create_runprogram(const char *name);
 /* Destroy a process. */
 void proc_destroy(struct proc *proc);
 
+/* Free a torn-down proc structure; see proc.c. */
+void proc_free(struct proc *proc);
+
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
@@ -131,6 +254,9 @@ struct addrspace *proc_getas(void);
 /* Change the address space of the current process, and return the old one. */
 struct addrspace *proc_setas(struct addrspace *);
 
+/* Get P's soft limit on RESOURCE (an RLIMIT_* code). */
+rlim_t proc_getrlimit(struct proc *p, int resource);
+
 #if OPT_SHELL
 
 int proc_init_std_fds(struct proc *proc);
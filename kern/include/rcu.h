@@ -0,0 +1,49 @@
+#ifndef _RCU_H_
+#define _RCU_H_
+
+/*
+ * Read-copy-update, quiescent-state based.
+ *
+ * Readers of an RCU-protected structure bracket their look with
+ * rcu_read_lock and rcu_read_unlock, which only count in the current
+ * thread and so write nothing any other cpu looks at. Inside, the
+ * thread can't be preempted and must not sleep, which makes every
+ * context switch a point where the cpu holds no RCU references - a
+ * quiescent state. An idle cpu is quiescent too.
+ *
+ * Writers update under their own lock, publishing new pointers with
+ * rcu_assign (after a store barrier), and readers load them with
+ * rcu_deref. Once an object is unlinked, it can only be freed after
+ * a grace period, by when every cpu has passed a quiescent state and
+ * so no reader can still have it:
+ *
+ *    synchronize_rcu - wait for a grace period. Sleeps.
+ *    call_rcu        - call FUNC(ARG) after a grace period, from a
+ *                      worker thread; doesn't sleep. HEAD is space
+ *                      for the request, normally in the object.
+ *    rcu_bootstrap   - start the worker. Call after
+ *                      workqueue_bootstrap.
+ */
+
+#include <membar.h>
+
+struct rcu_head {
+	struct rcu_head *rh_next;
+	void (*rh_func)(void *);
+	void *rh_arg;
+};
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+bool rcu_read_held(void);
+
+#define rcu_assign(p, v)	(membar_store_store(), (p) = (v))
+#define rcu_deref(p)		({ __typeof__(p) _p = (p); \
+				   membar_load_load(); _p; })
+
+void synchronize_rcu(void);
+void call_rcu(struct rcu_head *head, void (*func)(void *), void *arg);
+
+void rcu_bootstrap(void);
+
+#endif /* _RCU_H_ */
@@ -48,27 +48,81 @@
  */
 #include <kern/sfs.h>
 
+struct sfs_dirindex;	/* private to sfs_dir.c */
+struct sfs_journal;	/* private to sfs_journal.c */
+struct sfs_buf;		/* private to sfs_buf.c */
+
+/* Most blocks of a file that can be awaiting a disk block at once */
+#define SFS_DAMAX	32
+
 /*
  * In-memory inode
+ *
+ * Everything past sv_ino is protected by sv_lock, which is held
+ * across each vnode operation. sv_hashnext belongs to the volume's
+ * sfs_vnlock instead, and the sv_lru fields to the vnode cache's
+ * lock (see sfs_inode.c).
  */
 struct sfs_vnode {
 	struct vnode sv_absvn;          /* abstract vnode structure */
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
+	struct lock *sv_lock;           /* per-file lock */
+	struct lock *sv_appendlock;     /* held by an O_APPEND write */
 	bool sv_dirty;                  /* true if sv_i modified */
+	uint32_t sv_ralast;             /* last file block read */
+	uint32_t sv_ranext;             /* first block not yet read ahead */
+	uint32_t sv_rawindow;           /* read-ahead window, in blocks */
+	int sv_raadvice;                /* FADV_NORMAL/SEQUENTIAL/RANDOM */
+	bool sv_noreuse;                /* FADV_NOREUSE: cache data briefly */
+	struct sfs_vnode *sv_hashnext;  /* next in sfs_vnhash bucket */
+	struct sfs_dirindex *sv_dirindex; /* name index, if a directory */
+	daddr_t sv_prealloc;            /* next block reserved for us */
+	unsigned sv_npreall;            /* blocks reserved from there on */
+	daddr_t sv_ibblock;             /* last indirect block mapped, or 0 */
+	uint32_t sv_ibfirst;            /* first file block it maps */
+	struct sfs_buf *sv_dabufs[SFS_DAMAX]; /* written, not yet placed */
+	uint32_t sv_dafirst;            /* file block of sv_dabufs[0] */
+	unsigned sv_dacount;            /* entries in use in sv_dabufs */
+	bool sv_daplacing;              /* sfs_da_place is running */
+	uint32_t sv_fallocleft;         /* blocks fallocate has to go */
+	struct sfs_buf *sv_dirtybufs;   /* our dirty buffers, for fsync */
+	struct sfs_vnode *sv_lruprev;   /* vnode cache, while unreferenced */
+	struct sfs_vnode *sv_lrunext;
+	bool sv_lrucached;              /* on the vnode cache's LRU list */
+	bool sv_lruevict;               /* taken off it to be evicted */
 };
 
 /*
  * In-memory info for a whole fs volume
+ *
+ * The vnode table is protected by sfs_vnlock, and the freemap and
+ * superblock by sfs_freemaplock. When several locks are needed, they
+ * are taken in the order: the directory's sv_lock, sfs_vnlock, a
+ * file's sv_lock, sfs_freemaplock, and finally the buffer cache's own
+ * lock. On a journaled volume, a transaction is begun before any of
+ * them is taken (see sfs_journal.c); a file's sv_appendlock, which
+ * an append holds across all of its transactions, comes before that.
  */
 struct sfs_fs {
 	struct fs sfs_absfs;            /* abstract filesystem structure */
 	struct sfs_superblock sfs_sb;	/* copy of on-disk superblock */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
-	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct sfs_vnode **sfs_vnhash;  /* vnodes loaded into memory */
+	unsigned sfs_vnhashsize;        /* buckets in sfs_vnhash (2^n) */
+	unsigned sfs_nvnodes;           /* vnodes in sfs_vnhash */
+	struct lock *sfs_vnlock;        /* protects the vnode table */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct bitmap *sfs_fmdirty;     /* which freemap blocks were */
+	unsigned *sfs_chunkfree;        /* free blocks per freemap chunk */
+	unsigned *sfs_groupfree;        /* free blocks per chunk group */
+	daddr_t sfs_alloccursor;        /* where to allocate with no goal */
+	unsigned sfs_nfree;             /* free blocks in the freemap */
+	unsigned sfs_nreserved;         /* of those, promised to files */
+	struct lock *sfs_freemaplock;   /* protects freemap and superblock */
+	struct sfs_journal *sfs_journal; /* metadata journal, or NULL */
 };
 
 /*
@@ -76,5 +130,34 @@ struct sfs_fs {
  */
 int sfs_mount(const char *device);
 
+/*
+ * Write-back tunables for the buffer cache syncer thread: dirty
+ * blocks are written once they are SFS_SYNCER_MAXAGE seconds old, or
+ * all at once when more than SFS_SYNCER_DIRTYPCT percent of the cache
+ * is dirty.
+ */
+extern unsigned sfs_syncer_maxage;
+extern unsigned sfs_syncer_dirtypct;
+
+/*
+ * Journal tunable: the running transaction is committed at least
+ * every SFS_JOURNAL_INTERVAL seconds.
+ */
+extern unsigned sfs_journal_interval;
+
+/*
+ * Vnode cache: inodes nobody has open are kept in memory, up to
+ * sfs_vncache_max of them across all volumes (0 turns it off), so
+ * that opening them again doesn't read the disk. The least recently
+ * closed go first, and all of them can go when memory is short:
+ *
+ *    sfs_vncache_shrink     - drop the older half. Call with no SFS
+ *                             locks held; the pageout thread does.
+ *    sfs_vncache_printstats - print the cache's size and hit rate.
+ */
+extern unsigned sfs_vncache_max;
+void sfs_vncache_shrink(void);
+void sfs_vncache_printstats(void);
+
 
 #endif /* _SFS_H_ */
@@ -0,0 +1,38 @@
+#ifndef _SHM_H_
+#define _SHM_H_
+
+/*
+ * Anonymous shared memory segments for the paging VM system.
+ *
+ * mmap(MAP_SHARED | MAP_ANON) makes a region backed by a segment: a
+ * fixed number of pages, each a frame that is allocated zero-filled
+ * the first time any process touches it and then mapped PTE_SHARED
+ * by everyone, so a write by one process is seen by all the others
+ * at once. Fork copies the region and the PTEs, so parent and child
+ * share the segment.
+ *
+ * The segment holds one coremap reference to each frame it has, and
+ * each page table mapping it another; the frames are never evicted.
+ * The segment itself lasts as long as some region refers to it, and
+ * its frames go with it.
+ *
+ *    shm_create   - make a segment of NPAGES pages, with one
+ *                   reference. NULL if out of memory.
+ *    shm_incref   - add a reference.
+ *    shm_close    - drop one. Must not be called with vm_lock held.
+ *    shm_getpage  - return the frame for page PAGENO, allocating it
+ *                   if need be, with a coremap reference for the
+ *                   caller. Caller holds vm_lock, which also covers
+ *                   the segment's frames.
+ */
+
+#include <types.h>
+
+struct shm_segment;
+
+struct shm_segment *shm_create(unsigned npages);
+void shm_incref(struct shm_segment *seg);
+void shm_close(struct shm_segment *seg);
+int shm_getpage(struct shm_segment *seg, unsigned pageno, paddr_t *ret);
+
+#endif /* _SHM_H_ */
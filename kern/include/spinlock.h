@@ -37,6 +37,7 @@
 
 #include <cdefs.h>
 #include <hangman.h>
+#include "opt-spinlockprof.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -51,24 +52,45 @@
  *
  * Note that spinlocks are held by CPUs, not by threads.
  *
+ * This is a ticket lock: each acquirer atomically takes the next
+ * number from splk_next and waits until splk_serving reaches it, so
+ * CPUs get the lock in the order they asked for it. While waiting
+ * they only read splk_serving, which changes once per release, so
+ * waiters don't fight over the cache line the way test-and-set
+ * spinning does. The lock is free when the two are equal.
+ *
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
  */
 struct spinlock {
-	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
+	volatile spinlock_data_t splk_next; /* Next ticket to hand out. */
+	volatile spinlock_data_t splk_serving; /* Ticket holding the lock. */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
+#if OPT_SPINLOCKPROF
+	uint32_t splk_acquiredat;	    /* Cycle count when acquired. */
+#endif
 	HANGMAN_LOCKABLE(splk_hangman);     /* Deadlock detector hook. */
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
+#if OPT_SPINLOCKPROF
+#define SPINLOCK_PROF_INITIALIZER	0,
+#else
+#define SPINLOCK_PROF_INITIALIZER
+#endif
+
 #ifdef OPT_HANGMAN
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL, \
+				  SPINLOCK_PROF_INITIALIZER \
 				  HANGMAN_LOCKABLE_INITIALIZER }
 #else
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL, \
+				  SPINLOCK_PROF_INITIALIZER }
 #endif
 
 /*
@@ -81,6 +103,9 @@ struct spinlock {
  * release	Release the lock. May re-enable interrupts.
  *
  * do_i_hold	Check if the current CPU holds the lock.
+ * in_use	Check if any CPU holds the lock or is waiting for it. A
+ *		release is complete, lock word and all, once this
+ *		reads false.
  */
 
 void spinlock_init(struct spinlock *lk);
@@ -90,6 +115,7 @@ void spinlock_acquire(struct spinlock *lk);
 void spinlock_release(struct spinlock *lk);
 
 bool spinlock_do_i_hold(struct spinlock *lk);
+bool spinlock_in_use(struct spinlock *lk);
 
 
 #endif /* _SPINLOCK_H_ */
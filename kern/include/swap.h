@@ -0,0 +1,50 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space for the paging VM system.
+ *
+ * Swap lives on the raw disk SWAP_DEVICE, one page per slot; a bitmap
+ * records which slots are in use. A page that has been evicted has
+ * PTE_SWAPPED set in its PTE, with the slot number where the frame
+ * number would be. All of this is protected by vm_lock.
+ *
+ *    swap_bootstrap - attach the swap device. If there isn't one,
+ *                     paging out is disabled and running out of
+ *                     memory fails allocations as before.
+ *    swap_evict     - pick a user page with the clock, write it to
+ *                     swap, and hand back the now-unowned frame.
+ *                     Returns 0 if nothing could be evicted.
+ *    swap_evictcluster - page out up to SWAP_CLUSTER pages in one
+ *                     write, freeing their frames; the write goes on
+ *                     after it returns. Returns the number of pages
+ *                     freed, 0 if none could be (or no cluster
+ *                     buffer is free).
+ *    swap_waitcluster - wait until swap_evictcluster has a buffer to
+ *                     use. Call without vm_lock.
+ *    swap_age       - move the clock's front hand over NPAGES pages
+ *                     without evicting anything (for the pageout
+ *                     thread).
+ *    swap_pagein    - read the NPAGES pages in the slots from SLOT
+ *                     on into the frames PADDRS, in one read, and
+ *                     release the slots. NPAGES is at most
+ *                     SWAP_CLUSTER.
+ *    swap_free      - release SLOT without reading it.
+ */
+
+#include <types.h>
+
+#define SWAP_DEVICE	"lhd0:"
+
+/* Most pages written or read back in one request */
+#define SWAP_CLUSTER	8
+
+void swap_bootstrap(void);
+paddr_t swap_evict(void);
+unsigned swap_evictcluster(void);
+void swap_waitcluster(void);
+void swap_age(unsigned npages);
+int swap_pagein(unsigned slot, const paddr_t *paddrs, unsigned npages);
+void swap_free(unsigned slot);
+
+#endif /* _SWAP_H_ */
@@ -42,10 +42,13 @@
 /* G.Cabodi - 2019 - implementing locks and CVs */
 /* option "shell" needed in conf.kern (and enabled!) */
 #include "opt-shell.h" 
+#include "opt-lockprof.h"
+#include <lockorder.h>
 /* 1: implement lock as a binary semaphore (+ pointer to thread) 
- * 0: lock implemented by wait channel
+ * 0: lock implemented by wait channel (adaptive: spins while the
+ *    owner is running on another cpu, then sleeps)
  */
-#define USE_SEMAPHORE_FOR_LOCK 1
+#define USE_SEMAPHORE_FOR_LOCK 0
 /* ------------------------------------------------------------- */
 
 /*
@@ -53,12 +56,17 @@
  *
  * The name field is for easier debugging. A copy of the name is made
  * internally.
+ *
+ * sem_count is updated with atomic operations, so P and V take
+ * sem_lock only when the count is zero (see synch.c); sem_waiters
+ * counts the threads waiting in P.
  */
 struct semaphore {
         char *sem_name;
 	struct wchan *sem_wchan;
 	struct spinlock sem_lock;
         volatile unsigned sem_count;
+	volatile unsigned sem_waiters;	/* protected by sem_lock */
 };
 
 struct semaphore *sem_create(const char *name, unsigned initial_count);
@@ -94,7 +102,21 @@ struct lock {
 	struct wchan *lk_wchan;
 #endif
 	struct spinlock lk_lock;
-        volatile struct thread *lk_owner;
+	/*
+	 * The owning thread (0 if none), or'd with LK_WAITERS if
+	 * there may be threads asleep on lk_wchan. Taken and given
+	 * back with atomic_cas while LK_WAITERS is clear; otherwise
+	 * only changed under lk_lock.
+	 */
+	volatile unsigned lk_word;
+	bool lk_donated;		/* owner was lent a level through us */
+	struct lockstat *lk_stat;	/* shared by all locks of this name */
+#if OPT_LOCKORDER
+	unsigned lk_class;		/* lockorder.h */
+#endif
+#if OPT_LOCKPROF
+	uint64_t lk_acquiredat;		/* ns; 0 if not known */
+#endif
 #endif
 };
 
@@ -116,6 +138,15 @@ void lock_acquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 
+/*
+ * Print contention statistics for every lock name that has seen any
+ * contention, summed over all locks with that name. With the lockprof
+ * option this includes time spent waiting for and holding the locks,
+ * and waiting on CVs, by CV name. Nothing is timed before the clock
+ * is calibrated.
+ */
+void lockstat_print(void);
+
 
 /*
  * Condition variable.
@@ -138,6 +169,9 @@ struct cv {
 #if OPT_SHELL
 	struct wchan *cv_wchan;
 	struct spinlock cv_lock;
+#if OPT_LOCKPROF
+	struct lockstat *cv_stat;	/* shared by all CVs of this name */
+#endif
 #endif
 };
 
@@ -161,5 +195,47 @@ void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, new readers wait
+ * behind it, so a steady stream of readers cannot starve writers.
+ * (The flip side is that the lock is not recursive for readers
+ * either: a reader that tries to reacquire while a writer waits will
+ * deadlock.)
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct rwlock {
+        char *rwlock_name;
+	struct spinlock rw_lock;
+	struct wchan *rw_readwchan;	/* readers waiting */
+	struct wchan *rw_writewchan;	/* writers waiting */
+	volatile unsigned rw_readers;	/* readers holding the lock */
+	volatile unsigned rw_writerswaiting;
+	volatile struct thread *rw_writer; /* writer holding the lock */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading, sharing it with
+ *                           other readers.
+ *    rwlock_release_read  - Free the lock after reading.
+ *    rwlock_acquire_write - Get the lock for writing, alone.
+ *    rwlock_release_write - Free the lock after writing.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                           the lock for writing.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
 
 #endif /* _SYNCH_H_ */
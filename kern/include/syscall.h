@@ -33,14 +33,52 @@
 
 #include <cdefs.h> /* for __DEAD */
 #include "opt-shell.h"
+#include "opt-net.h"
 struct trapframe; /* from <machine/trapframe.h> */
 struct addrspace;
+struct proc;
 
 /*
  * The system call dispatcher.
  */
 
 void syscall(struct trapframe *tf);
+int sys_syscall_batch(struct trapframe *tf, userptr_t calls,
+		      unsigned ncalls, int *retval);
+
+/* Print per-call counts and times, for the sysstat menu command. */
+void syscall_printstats(void);
+/* Print per-call latency histograms, for "sysstat -h". */
+void syscall_printhist(void);
+/* Name of call CALLNO, or NULL if none. */
+const char *syscall_name(int callno);
+
+/*
+ * System call tracing; see <kern/systrace.h> and syscall/systrace.c.
+ *
+ *    systrace_bootstrap  - create the systrace: device. Call once,
+ *                          after vfs_bootstrap().
+ *    systrace_getpath    - copy in call CALLNO's pathname argument,
+ *                          if it has one, into PATH (SYSTRACE_PATHLEN
+ *                          bytes); otherwise leave it alone. Only
+ *                          worth calling if systrace_paths is set.
+ *    systrace_record     - log a call, if tracing is on, with its
+ *                          NARGS argument words ARGS and the PATH from
+ *                          systrace_getpath.
+ *    systrace_setenabled - turn tracing on or off, and logging paths
+ *                          with it.
+ *    systrace_print      - drain the log to the console.
+ */
+struct timespec;
+extern volatile bool systrace_paths;
+void systrace_bootstrap(void);
+void systrace_getpath(int callno, const uint32_t *args, char *path);
+void systrace_record(int callno, int err, int32_t result,
+		     const uint32_t *args, unsigned nargs, const char *path,
+		     const struct timespec *before,
+		     const struct timespec *after);
+void systrace_setenabled(bool on, bool paths);
+void systrace_print(void);
 
 /*
  * Support functions.
@@ -57,30 +95,125 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(userptr_t user_req, userptr_t user_rem);
+int sys___clock_gettime(int clock, userptr_t user_ts);
+int sys_phase(int op, const_userptr_t name);
+int sys_futex(userptr_t uaddr, int op, int val, userptr_t timeout,
+	      int *retval);
+
+/* Set up the futex wait queues. */
+void futex_bootstrap(void);
+/* Wake all futex waiters in an address space. */
+void futex_exit(struct addrspace *as);
+#if OPT_NET
+int sys_socket(int domain, int type, int protocol, int *retval);
+int sys_bind(int fd, const_userptr_t addr, socklen_t addrlen);
+int sys_sendto(int fd, const_userptr_t buf, size_t len, int flags,
+               const_userptr_t addr, socklen_t addrlen, int32_t *retval);
+int sys_recvfrom(int fd, userptr_t buf, size_t len, int flags,
+                 userptr_t addr, userptr_t addrlen, int32_t *retval);
+#endif
 #if OPT_SHELL 
 ssize_t sys_read(int fd, const void *buf, size_t buflen, int32_t *retval);
 ssize_t sys_write(int fd, const void *buf, size_t buflen, int32_t *retval);
+int sys_pread(int fd, userptr_t buf, size_t buflen, off_t pos,
+              int32_t *retval);
+int sys_pwrite(int fd, userptr_t buf, size_t buflen, off_t pos,
+               int32_t *retval);
+int sys_readv(int fd, userptr_t iov, int iovcnt, int32_t *retval);
+int sys_writev(int fd, userptr_t iov, int iovcnt, int32_t *retval);
+int sys_getdirentries_plus(int fd, userptr_t buf, size_t buflen,
+                           int32_t *retval);
+int sys_getdents(int fd, userptr_t buf, size_t buflen, int32_t *retval);
+int sys_copyfile(int fromfd, int tofd, size_t len, int32_t *retval);
+int sys_sendfile(int outfd, int infd, userptr_t offset, size_t len,
+                 int32_t *retval);
+int sys_fadvise(int fd, off_t offset, off_t len, int advice);
+int sys_fallocate(int fd, off_t offset, off_t len);
+int sys_fcntl(int fd, int cmd, userptr_t arg, int32_t *retval);
+int sys_fsync(int fd);
+int sys_fdatasync(int fd);
+int sys_semop(const_userptr_t ops, unsigned nops);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+             off_t offset, int32_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_msync(userptr_t addr, size_t len, int flags);
+int sys_madvise(userptr_t addr, size_t len, int advice);
+int sys_mlock(userptr_t addr, size_t len);
+int sys_munlock(userptr_t addr, size_t len);
+int sys_mlockall(int flags);
+int sys_munlockall(void);
+int sys_sbrk(intptr_t amount, int32_t *retval);
 int sys_open(userptr_t filename, int flags, mode_t mode, int *retval);
+int file_open(char *path, int flags, mode_t mode, int *retval);
 int sys_close(int fd);
 int sys_lseek(int fd, off_t pos, int whence, int32_t *retval_low, int32_t *retval_high);
 int sys_dup2(int oldfd, int newfd, int *retval);
+int sys_pipe(userptr_t fds);
+int sys_poll(userptr_t fds, unsigned nfds, int timeout, int *retval);
+int sys_aio_setup(userptr_t params);
+int sys_aio_enter(unsigned to_submit, unsigned min_complete, int *retval);
 int sys_chdir(const char *path);
 int sys___getcwd(char *buf, size_t buflen, int *retval);
 pid_t sys_getpid(void);
 int sys_fork(struct trapframe *tf, pid_t *retval);
 int sys_execv(const char *program, char **args);
+int sys___spawn(const char *program, char **args, userptr_t actions,
+                int nactions, pid_t *retval);
 int sys_waitpid(pid_t pid, int *status, int options, int *retval);
 int sys_remove(const char *path);
 void sys__exit(int exitcode);
+__DEAD void uproc_exit(int waitcode);
+int sys_getrusage(int who, userptr_t usage);
+int sys_profil(userptr_t samples, size_t size, vaddr_t offset,
+               unsigned scale);
+int sys_getrlimit(int resource, userptr_t rlp);
+int sys_setrlimit(int resource, const_userptr_t rlp);
+int sys___thread_create(userptr_t entry, userptr_t func, userptr_t arg, int *retval);
+int sys_thread_join(int tid, userptr_t status);
+void sys_thread_exit(int exitval);
+int sys_sched_setaffinity(pid_t pid, size_t size, const_userptr_t mask);
+int sys_sched_getaffinity(pid_t pid, size_t size, userptr_t mask);
+int sys_sched_setscheduler(pid_t pid, int policy, const_userptr_t param);
+int sys_sched_getscheduler(pid_t pid, int *retval);
+int sys_sched_getparam(pid_t pid, userptr_t param);
+int sys_sched_setgroup(int group);
+int sys_sched_getgroup(int *retval);
+int sys_sched_settickets(int group, unsigned tickets);
+int sys_sched_gettickets(int group, int *retval);
+
+/* Multithreaded process support (thread_syscalls.c) */
+void uthread_checkexit(void);
+void uthread_single(bool resume);
+
+/* User pc sampling (profil_syscalls.c) */
+void profil_tick(vaddr_t pc, unsigned ticks);
+void profil_flush(void);
+
+/* Asynchronous I/O rings (aio_syscalls.c) */
+void aio_bootstrap(void);
+void aio_exit(struct proc *p);
 
 
 void enter_forked_process(void *data, unsigned long unused);
 
+/* execv/spawn arguments, packed as they go on the stack; see helpers.c */
+struct argbuf {
+    char *ab_buf;       /* ARG_MAX arena: argv[], then the strings */
+    size_t ab_len;      /* Bytes used */
+    int ab_argc;
+};
+
+/* PATH_MAX buffers for pathnames copied in; see helpers.c */
+char *pathbuf_get(void);
+void pathbuf_put(char *buf);
+int copyin_path(const_userptr_t upath, char **kpath);
+
 int copy_program_name(const char *program, char **kernel_progname);
-int copy_arguments(char **args, char ***kernel_args, int *argc);
-void cleanup_arguments(char **kernel_args, int argc);
+int copy_arguments(char **args, struct argbuf *ab);
+void cleanup_arguments(struct argbuf *ab);
 void restore_old_address_space(struct addrspace *old_as, struct addrspace *new_as);
-int copy_args_to_stack(char **kernel_args, int argc, vaddr_t *stackptr);
+int copy_args_to_stack(struct argbuf *ab, vaddr_t *stackptr);
 
 #endif
 
@@ -43,7 +43,10 @@
 /* data structure tests */
 int arraytest(int, char **);
 int arraytest2(int, char **);
+int arraytest3(int, char **);
 int bitmaptest(int, char **);
+int bitmaptest2(int, char **);
+int ioschedtest(int, char **);
 int threadlisttest(int, char **);
 
 /* thread tests */
@@ -54,6 +57,13 @@ int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int rwlocktest(int, char **);
+int semdestroytest(int, char **);
+int timeouttest(int, char **);
+int smpcalltest(int, char **);
+int parallelfortest(int, char **);
+int lockfreetest(int, char **);
+int falsesharetest(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
@@ -93,7 +103,9 @@ int kmalloctest(int, char **);
 int kmallocstress(int, char **);
 int kmalloctest3(int, char **);
 int kmalloctest4(int, char **);
+int kmalloctest5(int, char **);
 int nettest(int, char **);
+int benchmark(int, char **);
 
 /* Routine for running a user-level program. */
 int runprogram(char *progname);
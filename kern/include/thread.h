@@ -39,8 +39,11 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include <clock.h>		/* for struct timeout */
+#include <lockorder.h>
 
 struct cpu;
+struct lock;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -55,6 +58,23 @@ struct cpu;
 /* Macro to test if two addresses are on the same kernel stack */
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
+/*
+ * Scheduling statistics, kept per thread and summed per process.
+ * Times are in hardclocks (1/HZ seconds). A switch is involuntary if
+ * the thread was preempted from the timer interrupt, and voluntary if
+ * it slept or yielded on its own. A running tick is a user tick if the
+ * timer interrupt caught the thread in user mode, so the split between
+ * user and system time is a sample, as on other Unixes.
+ */
+struct schedstats {
+	uint64_t ss_runticks;		/* time spent running */
+	uint64_t ss_userticks;		/* ...of which in user mode */
+	uint64_t ss_waitticks;		/* time spent on a run queue */
+	uint64_t ss_sleepticks;		/* time spent asleep */
+	unsigned ss_nvcsw;		/* voluntary switches */
+	unsigned ss_nivcsw;		/* involuntary switches */
+};
+
 
 /* States a thread can be in. */
 typedef enum {
@@ -79,11 +99,58 @@ struct thread {
 	 */
 	struct thread_machdep t_machdep; /* Any machine-dependent goo */
 	struct threadlistnode t_listnode; /* Link for run/sleep/zombie lists */
+	struct thread *t_inboxnext;	/* Link for a cpu's c_inbox */
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	int t_tid;			/* User thread id within t_proc */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
+	LOCKORDER_HELD(t_lockorder);	/* Locks held, for lockorder.c */
+
+	/*
+	 * Scheduling state; see schedule() in thread.c. Changed only
+	 * by the thread itself, or under its cpu's runqueue lock while
+	 * it is on a run queue.
+	 */
+	unsigned t_prio;		/* Run queue level; 0 is highest */
+	unsigned t_ticks;		/* Hardclocks used of this quantum */
+	unsigned t_lastrun;		/* t_cpu's c_hardclocks when last run */
+	unsigned t_statesince;		/* c_hardclocks when t_state was set */
+	bool t_bound;			/* Never moved off t_cpu */
+	uint32_t t_affinity;		/* Bit N set: may run on cpu N */
+
+	/*
+	 * Priority inheritance; see lock_acquire. Protected by the
+	 * priority inheritance spinlock in synch.c.
+	 */
+	unsigned t_inherit;		/* Level lent by lock waiters */
+	unsigned t_pilocks;		/* Held locks it was lent through */
+	struct lock *t_waitlock;	/* Lock we're asleep on, if any */
+
+	/*
+	 * Scheduling class (kern/sched.h). Real-time threads run ahead
+	 * of all time-sharing ones, by t_rtprio; t_prio doesn't apply.
+	 */
+	int t_policy;			/* SCHED_OTHER, _FIFO or _RR */
+	unsigned t_rtprio;		/* 1 to SCHED_PRIO_MAX, or 0 */
+
+	/*
+	 * Scheduling group: time-sharing threads share the cpus among
+	 * groups in proportion to their tickets (thread_timeslice).
+	 */
+	unsigned t_group;		/* 0 to SCHED_NGROUPS - 1 */
+
+	/*
+	 * Timed sleep (wchan_sleep_timeout). t_timedwc is the wchan
+	 * while we're on it with a timeout armed; it is protected by
+	 * that wchan's spinlock, t_timedlk, and cleared by whoever
+	 * takes us off the wchan.
+	 */
+	struct timeout t_timeout;
+	struct wchan *t_timedwc;
+	struct spinlock *t_timedlk;
+	bool t_timedout;
 
 	/*
 	 * Interrupt state fields.
@@ -101,12 +168,17 @@ struct thread {
 	bool t_in_interrupt;		/* Are we in an interrupt? */
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
+	unsigned t_rcu_nesting;		/* rcu_read_lock depth (rcu.h) */
 
 	/*
 	 * Public fields
 	 */
 
-	/* add more here as needed */
+	struct schedstats t_stats;	/* Only changed by the thread system */
+	size_t t_copiedin;		/* Bytes through copyin*, ever */
+	size_t t_copiedout;		/* Bytes through copyout*, ever */
+	vaddr_t t_profpc;		/* User pc of pending profil ticks */
+	unsigned t_profticks;		/* Ticks not yet in the histogram */
 };
 
 /*
@@ -145,6 +217,29 @@ int thread_fork(const char *name, struct proc *proc,
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2);
 
+/*
+ * Like thread_fork, but the new thread belongs to the kernel process
+ * and always runs on cpu number CPUNUM (0 to thread_numcpus()-1); the
+ * scheduler never moves it to balance load. For per-cpu daemons.
+ */
+int thread_fork_bound(const char *name, unsigned cpunum,
+                      void (*func)(void *, unsigned long),
+                      void *data1, unsigned long data2);
+
+/* Number of cpus; final once thread_start_cpus has returned. */
+unsigned thread_numcpus(void);
+struct cpu *thread_getcpu(unsigned n);
+
+/*
+ * CPU affinity of the current thread: a mask with bit N set for each
+ * cpu number N it may run on. Threads start with the mask of the
+ * thread that forked them (all cpus for kernel threads). Setting a
+ * mask with no cpus that exist in it fails with EINVAL; otherwise it
+ * takes effect before thread_setaffinity returns.
+ */
+uint32_t thread_getaffinity(void);
+int thread_setaffinity(uint32_t mask);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -158,16 +253,73 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Charge the current thread for a clock tick, and yield if it has
+ * used up its quantum or something more important is waiting. Called
+ * from the timer interrupt.
+ */
+void thread_timeslice(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Priority inheritance. thread_level is the run queue level T is
+ * scheduled at: its own t_prio, or the level it was lent if that's
+ * higher; real-time threads count as the highest level, 0. thread_inherit raises T to LEVEL, moving it up its run queue
+ * if it's waiting on one; thread_uninherit drops the current thread
+ * back to its own level. For lock_acquire and lock_release.
+ */
+unsigned thread_level(const struct thread *t);
+void thread_inherit(struct thread *t, unsigned level);
+void thread_uninherit(void);
+
+/*
+ * Scheduling class of the current thread: SCHED_OTHER with RTPRIO 0,
+ * or SCHED_FIFO or SCHED_RR with RTPRIO from SCHED_PRIO_MIN to
+ * SCHED_PRIO_MAX. The caller checks the arguments and privilege.
+ */
+void thread_setsched(int policy, unsigned rtprio);
+
+/*
+ * Give way now if a real-time thread has been queued for this cpu
+ * that should run instead of the current one. Called on the way out
+ * of interrupts and system calls, where switching is safe.
+ */
+void thread_preemptcheck(void);
+
+/*
+ * A kernel preemption point: thread_preemptcheck, if it's safe to
+ * switch here, which is whenever interrupts are on (so no spinlocks
+ * are held) and we're not in an interrupt handler. May be called from
+ * anywhere; spllower and rcu_read_unlock do.
+ */
+void thread_preemptpoint(void);
+
+/*
+ * Scheduling groups. thread_setgroup moves the current thread into
+ * GROUP; threads it creates start there too. thread_settickets sets
+ * GROUP's share of the cpus relative to the other groups with
+ * time-sharing threads to run. The caller checks the arguments and
+ * privilege.
+ */
+unsigned thread_getgroup(void);
+void thread_setgroup(unsigned group);
+unsigned thread_gettickets(unsigned group);
+void thread_settickets(unsigned group, unsigned tickets);
+
+/*
+ * Add the scheduling statistics FROM into TO.
+ */
+void schedstats_add(struct schedstats *to, const struct schedstats *from);
+
+/*
+ * Print per-cpu scheduling statistics, and the spinlock profile if
+ * the kernel was built with "options spinlockprof".
  */
-void thread_consider_migration(void);
+void thread_printstats(void);
 
 
 #endif /* _THREAD_H_ */
@@ -0,0 +1,23 @@
+#ifndef _TIMEPAGE_H_
+#define _TIMEPAGE_H_
+
+/*
+ * The kernel side of the time page (see kern/timepage.h).
+ *
+ *    timepage_bootstrap - allocate the page and fill it in. Call
+ *                         after clock_calibrate.
+ *    timepage_update    - bring the page up to date; called from
+ *                         hardclock on every cpu that is ticking, so
+ *                         it is never more than a tick stale while
+ *                         anything is running.
+ *    timepage_paddr     - the page's physical address, for vm_fault
+ *                         to map at TIMEPAGE_VADDR (read-only).
+ */
+
+#include <kern/timepage.h>
+
+void timepage_bootstrap(void);
+void timepage_update(void);
+paddr_t timepage_paddr(void);
+
+#endif /* _TIMEPAGE_H_ */
@@ -78,6 +78,9 @@ struct uio {
 	enum uio_seg      uio_segflg;	/* What kind of pointer we have */
 	enum uio_rw       uio_rw;	/* Whether op is a read or write */
 	struct addrspace *uio_space;	/* Address space for user pointer */
+	bool              uio_nocache;	/* Caller keeps the data; fs needn't */
+	bool              uio_append;	/* Write at EOF, whatever uio_offset */
+	bool              uio_direct;	/* O_DIRECT: bypass the fs's cache */
 };
 
 
@@ -95,14 +98,26 @@ struct uio {
  *   (4) set up uio_seg and uio_rw correctly;
  *   (5) if uio_seg is UIO_SYSSPACE, set uio_space to NULL; otherwise,
  *       initialize uio_space to the address space in which the buffer
- *       should be found.
+ *       should be found;
+ *   (6) set uio_nocache if the data is being cached elsewhere (by the
+ *       VM system's file cache), so the file system should not hold
+ *       on to its own copy; otherwise false;
+ *   (7) set uio_append for an O_APPEND write, which the file system
+ *       does at the end of the file as it is when the write gets
+ *       there, setting uio_offset to that first, so that appends
+ *       from different opens of the file don't overwrite each other;
+ *       otherwise false;
+ *   (8) set uio_direct for I/O on an O_DIRECT open, which the file
+ *       system may do straight to and from the device without
+ *       keeping the data in its cache; otherwise false.
  *
  * After calling,
  *   (1) the contents of uio_iov and uio_iovcnt may be altered and
  *       should not be interpreted;
  *   (2) uio_offset will have been incremented by the amount transferred;
  *   (3) uio_resid will have been decremented by the amount transferred;
- *   (4) uio_segflg, uio_rw, and uio_space will be unchanged.
+ *   (4) uio_segflg, uio_rw, uio_space, uio_nocache, uio_append, and
+ *       uio_direct will be unchanged.
  *
  * uiomove() may be called repeatedly on the same uio to transfer
  * additional data until the available buffer space the uio refers to
@@ -138,5 +153,23 @@ int uiomovezeros(size_t len, struct uio *uio);
 void uio_kinit(struct iovec *, struct uio *,
 	       void *kbuf, size_t len, off_t pos, enum uio_rw rw);
 
+/*
+ * Initialize a uio suitable for I/O directly to or from a buffer in
+ * the current process's address space, so that uiomove copies the
+ * data once with copyin/copyout and no kernel bounce buffer is
+ * needed. Invalid user addresses turn up as EFAULT from uiomove.
+ */
+void uio_uinit(struct iovec *, struct uio *,
+	       userptr_t ubuf, size_t len, off_t pos, enum uio_rw rw);
+
+/*
+ * Likewise for a vector of IOVCNT user buffers, as for readv/writev.
+ * The iovecs must already be filled in (and are consumed by uiomove);
+ * uio_resid is set to their total length, which the caller must have
+ * checked doesn't overflow.
+ */
+void uio_uinitv(struct iovec *iov, unsigned iovcnt, struct uio *u,
+		off_t pos, enum uio_rw rw);
+
 
 #endif /* _UIO_H_ */
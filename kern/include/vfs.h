@@ -81,6 +81,30 @@ int vfs_lookup(char *path, struct vnode **result);
 int vfs_lookparent(char *path, struct vnode **result,
 		   char *buf, size_t buflen);
 
+/*
+ * Name cache (vfsncache.c), used by vfs_lookup and vfs_lookparent.
+ * Callers must hold vfs_biglock, except for vfs_ncache_purgename,
+ * which the pathname operations below call after changing a name.
+ *
+ *    vfs_ncache_lookup    - Look up NAME in DIR. Returns false if there
+ *                           is no entry; otherwise hands back the named
+ *                           vnode, incref'd, or NULL if the name is
+ *                           known not to exist.
+ *    vfs_ncache_enter     - Record that NAME in DIR is VN (NULL for
+ *                           "doesn't exist").
+ *    vfs_ncache_purgename - Forget NAME in DIR, after it has been
+ *                           created, removed, or renamed.
+ *    vfs_ncache_purgefs   - Forget everything on FS (or, if NULL,
+ *                           everywhere).
+ */
+
+void vfs_ncache_bootstrap(void);
+bool vfs_ncache_lookup(struct vnode *dir, const char *name,
+		       struct vnode **result);
+void vfs_ncache_enter(struct vnode *dir, const char *name, struct vnode *vn);
+void vfs_ncache_purgename(struct vnode *dir, const char *name);
+void vfs_ncache_purgefs(struct fs *fs);
+
 /*
  * VFS layer high-level operations on pathnames
  * Because lookup may destroy pathnames, these all may too.
@@ -114,6 +138,13 @@ int vfs_rename(char *oldpath, char *newpath);
 int vfs_chdir(char *path);
 int vfs_getcwd(struct uio *buf);
 
+/*
+ * Bumped after every rename or rmdir, either of which can change the
+ * name of somebody's current directory; a name from vfs_getcwd can be
+ * cached for as long as this stays the same.
+ */
+extern volatile unsigned vfs_namegen;
+
 /*
  * Misc
  *
@@ -157,13 +188,26 @@ int vfs_getcwd(struct uio *buf);
  *                    specified device.
  *
  *    vfs_swapon    - Look up DEVNAME and mark it as a swap device,
- *                    returning a vnode. Similar to vfs_mount.
+ *                    returning a vnode, and the device itself for
+ *                    queued I/O (devop_strategy). Similar to
+ *                    vfs_mount.
  *
  *    vfs_swapoff   - Unmark DEVNAME as a swap device. The vnode
  *                    previously returned by vfs_swapon should be
  *                    decref'd first. Similar to vfs_unmount.
  *
+ *    vfs_claimdev  - Look up DEVNAME and mark it as part of another
+ *                    device (a stripe, say), returning the device.
+ *                    It can't then be mounted or used as swap.
+ *
+ *    vfs_releasedev - Undo vfs_claimdev.
+ *
  *    vfs_unmountall - Unmount all mounted filesystems.
+ *
+ *    pipe_create   - Make an anonymous pipe, returning a vnode for
+ *                    the read end and one for the write end. The ends
+ *                    have no name; closing the last reference to one
+ *                    gives EOF or EPIPE on the other.
  */
 
 void vfs_bootstrap(void);
@@ -179,10 +223,15 @@ int vfs_mount(const char *devname, void *data,
 			       struct device *dev,
 			       struct fs **result));
 int vfs_unmount(const char *devname);
-int vfs_swapon(const char *devname, struct vnode **result);
+int vfs_swapon(const char *devname, struct vnode **result,
+	       struct device **resultdev);
 int vfs_swapoff(const char *devname);
+int vfs_claimdev(const char *devname, struct device **resultdev);
+int vfs_releasedev(const char *devname);
 int vfs_unmountall(void);
 
+int pipe_create(struct vnode **rdret, struct vnode **wrret);
+
 /*
  * Array of vnodes.
  */
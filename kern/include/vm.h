@@ -51,12 +51,64 @@ void vm_bootstrap(void);
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
 
+/*
+ * Fault in (and maybe lock) the pages of AS from START to END ahead
+ * of use, for mlock and MAP_POPULATE. Not available with dumbvm.
+ */
+struct addrspace;
+int vm_populate(struct addrspace *as, vaddr_t start, vaddr_t end, bool lock);
+
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
+void vm_tlbshootdown_all(void);
+
+/*
+ * Machine-dependent TLB management for the paging VM (not dumbvm).
+ * TLB entries are tagged with an address space ID, so switching
+ * address spaces does not require a flush.
+ *
+ *    vmtlb_activate   - make AS's ASID and page table current,
+ *                       assigning an ASID if needed.
+ *    vmtlb_deactivate - leave no page table current, so the refill
+ *                       handler sends every miss to vm_fault.
+ *    vmtlb_load       - enter VADDR -> PADDR for the current address
+ *                       space, replacing any existing entry for VADDR.
+ *    vmtlb_invalidate - drop AS's entry for VADDR, if any.
+ *    vmtlb_flushall   - drop every entry.
+ *    vmtlb_loadkernel - enter the kernel mapping VADDR -> PADDR,
+ *                       writeable, for every address space.
+ *
+ * These act on the current CPU's TLB only. The following act on
+ * every CPU:
+ *
+ *    vmtlb_shootdown  - drop AS's entry for VADDR everywhere, and
+ *                       wait until that is done.
+ *    vmtlb_newasid    - drop all of AS's entries everywhere, by
+ *                       retiring its ASID. AS must be current.
+ *    vmtlb_kernshootdown - drop the kernel mappings of the NPAGES
+ *                       pages from VADDR everywhere, and wait.
+ */
+struct addrspace;
+void vmtlb_activate(struct addrspace *as);
+void vmtlb_deactivate(void);
+void vmtlb_load(vaddr_t vaddr, paddr_t paddr, bool writeable);
+void vmtlb_invalidate(struct addrspace *as, vaddr_t vaddr);
+void vmtlb_flushall(void);
+void vmtlb_loadkernel(vaddr_t vaddr, paddr_t paddr);
+void vmtlb_shootdown(struct addrspace *as, vaddr_t vaddr);
+void vmtlb_newasid(struct addrspace *as);
+void vmtlb_kernshootdown(vaddr_t vaddr, unsigned npages);
+
+/*
+ * Paging VM lock. Serializes all page table updates, page-in and
+ * page-out; see vm.c.
+ */
+struct lock;
+extern struct lock *vm_lock;
 
 
 #endif /* _VM_H_ */
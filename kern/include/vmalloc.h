@@ -0,0 +1,40 @@
+#ifndef _VMALLOC_H_
+#define _VMALLOC_H_
+
+/*
+ * Kernel memory that is virtually but not physically contiguous.
+ *
+ * kmalloc of more than a page, like alloc_kpages, needs a physically
+ * contiguous run of pages, which gets hard to find once memory has
+ * been fragmented by a long uptime. vmalloc builds big buffers out of
+ * single pages from anywhere instead, mapped at consecutive kernel
+ * addresses through the TLB. The memory must not be used for kernel
+ * stacks or touched where a TLB miss can't be taken (see vmalloc.c).
+ *
+ *    vmalloc       - allocate SIZE bytes, page-aligned. Returns NULL
+ *                    if out of memory or out of vmalloc addresses.
+ *                    May sleep.
+ *    vfree         - free memory from vmalloc. NULL is ignored.
+ *    vmalloc_fault - load the TLB for a miss at VADDR, an address in
+ *                    the vmalloc area; called by vm_fault. Returns
+ *                    EFAULT if nothing is mapped there.
+ *    vmalloc_bootstrap - set up. Called from vm_bootstrap.
+ *    vmalloc_printstats - print usage (for the kh menu command).
+ *
+ * dumbvm can't take kernel TLB misses, so there vmalloc is kmalloc.
+ */
+
+#include "opt-dumbvm.h"
+
+#if OPT_DUMBVM
+#define vmalloc(size)	kmalloc(size)
+#define vfree(ptr)	kfree(ptr)
+#else
+void *vmalloc(size_t size);
+void vfree(void *ptr);
+int vmalloc_fault(vaddr_t vaddr);
+void vmalloc_bootstrap(void);
+void vmalloc_printstats(void);
+#endif
+
+#endif /* _VMALLOC_H_ */
@@ -0,0 +1,49 @@
+#ifndef _VMSTAT_H_
+#define _VMSTAT_H_
+
+/*
+ * VM fault and paging statistics.
+ *
+ * Every event is counted system-wide in a per-cpu counter (percpu.h),
+ * so the totals can be read from user level in stats: as the vm_*
+ * lines. The fault events, the ones before VMS_NPROC, are also
+ * counted in the process that took the fault (p_vmstats), and a
+ * process's totals are added to its parent's p_childvm when it is
+ * waited for; getrusage reports them as minor and major faults.
+ * Page-outs and evictions are done to whoever the clock picks, on
+ * nobody's behalf in particular, so they are only counted globally.
+ *
+ *    vmstat_count      - count one WHICH event for the current
+ *                        process.
+ *    vmstats_add       - add the counts in FROM to TO.
+ *    vmstats_majflt    - the faults in VS that had to wait for a read
+ *                        (page-ins and file pages).
+ *    vmstats_minflt    - ...and the ones that didn't.
+ *    vmstat_printstats - print the totals and a line per process (for
+ *                        the vmstat menu command).
+ */
+
+enum vmstat_event {
+	VMS_TLBMISS,		/* fault on a missing TLB entry */
+	VMS_READONLY,		/* fault writing a read-only entry */
+	VMS_ZEROFILL,		/* page zero-filled on first touch */
+	VMS_FILE,		/* file page mapped */
+	VMS_COW,		/* copy-on-write copy made */
+	VMS_PAGEIN,		/* page read back from swap */
+	VMS_NPROC,		/* (events counted per process) */
+	VMS_PAGEOUT = VMS_NPROC, /* page written to swap */
+	VMS_EVICT,		/* frame taken back from its user */
+	VMS_NEVENTS
+};
+
+struct vmstats {
+	unsigned vs_count[VMS_NPROC];
+};
+
+void vmstat_count(enum vmstat_event which);
+void vmstats_add(struct vmstats *to, const struct vmstats *from);
+unsigned vmstats_majflt(const struct vmstats *vs);
+unsigned vmstats_minflt(const struct vmstats *vs);
+void vmstat_printstats(void);
+
+#endif /* _VMSTAT_H_ */
@@ -33,6 +33,10 @@
 #include <spinlock.h>
 struct uio;
 struct stat;
+struct pollset;
+struct filecache_file;
+struct vnode_locks;
+struct flock;
 
 
 /*
@@ -51,6 +55,9 @@ struct stat;
 struct vnode {
 	int vn_refcount;                /* Reference count */
 	struct spinlock vn_countlock;   /* Lock for vn_refcount */
+	unsigned vn_version;            /* Changes on write or truncate */
+	struct filecache_file *vn_filecache; /* VM's pages of it, or NULL */
+	struct vnode_locks *vn_locks;   /* fcntl locks on it, or NULL */
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
@@ -98,6 +105,22 @@ struct vnode {
  *                      handled in the normal fashion.
  *                      On non-directory objects, return ENOTDIR.
  *
+ *    vop_getdirplus  - Read as many directory entries as fit into a
+ *                      uio, each as a struct dirent_plus (see
+ *                      kern/dirent.h) that includes the stat
+ *                      information of the object named, starting at
+ *                      the offset field in the uio and updating it,
+ *                      which is interpreted as for vop_getdirentry.
+ *                      Fails with EINVAL if not even one entry fits.
+ *                      On non-directory objects, return ENOTDIR.
+ *
+ *    vop_getdents    - Like vop_getdirplus, but each entry is a
+ *                      struct dirent with only the name, so a file
+ *                      system can hand back a whole directory block's
+ *                      worth at a time. File systems that can only
+ *                      go a name at a time can use
+ *                      vop_getdents_byentry.
+ *
  *    vop_write       - Write data from uio to file at offset specified
  *                      in the uio, updating uio_resid to reflect the
  *                      amount written, and updating uio_offset to match.
@@ -105,7 +128,14 @@ struct vnode {
  *
  *    vop_ioctl       - Perform ioctl operation OP on file using data
  *                      DATA. The interpretation of the data is specific
- *                      to each ioctl.
+ *                      to each ioctl. The kernel itself issues
+ *                      FIOADVISE (kern/ioctl.h) on regular files, with
+ *                      a struct vnode_advice; file systems that have
+ *                      nothing to do with the advice return EINVAL.
+ *                      Likewise FIOSEEKDATA and FIOSEEKHOLE with an
+ *                      off_t, and FIOALLOCATE with a struct
+ *                      vnode_range; a file system without holes or
+ *                      allocation to speak of returns EINVAL.
  *
  *    vop_stat        - Return info about a file. The pointer is a
  *                      pointer to struct stat; see kern/stat.h.
@@ -117,12 +147,27 @@ struct vnode {
  *                      and directories are seekable, but some devices are
  *                      not.
  *
- *    vop_fsync       - Force any dirty buffers associated with this file
- *                      to stable storage.
+ *    vop_poll        - Report in *RESULT which of the poll events
+ *                      (see kern/poll.h) in EVENTS are ready, plus
+ *                      POLLERR and POLLHUP if they apply, having
+ *                      first registered PS on the wait queue for
+ *                      each event asked about; see poll.h. Objects
+ *                      that never block use vop_poll_ready.
  *
- *    vop_mmap        - Map file into memory. If you implement this
- *                      feature, you're responsible for choosing the
- *                      arguments for this operation.
+ *    vop_fsync       - Force any dirty buffers associated with this file
+ *                      to stable storage: the file's data, and whatever
+ *                      metadata is needed to find it again. Other
+ *                      files' dirty buffers should be left alone, so
+ *                      that syncing one file costs in proportion to
+ *                      that file.
+ *
+ *    vop_mmap        - Check whether the file can be mapped into
+ *                      memory with mmap; return 0 if so. The pages
+ *                      come from the VM system's file cache, which
+ *                      uses vop_read and vop_write, unless *ANON is
+ *                      set to true, in which case the mapping is
+ *                      plain zero-filled memory like MAP_ANON (for
+ *                      zero:). *ANON is false on entry.
  *
  *    vop_truncate    - Forcibly set size of file to the length passed
  *                      in, discarding any excess blocks.
@@ -187,13 +232,17 @@ struct vnode_ops {
 	int (*vop_read)(struct vnode *file, struct uio *uio);
 	int (*vop_readlink)(struct vnode *link, struct uio *uio);
 	int (*vop_getdirentry)(struct vnode *dir, struct uio *uio);
+	int (*vop_getdirplus)(struct vnode *dir, struct uio *uio);
+	int (*vop_getdents)(struct vnode *dir, struct uio *uio);
 	int (*vop_write)(struct vnode *file, struct uio *uio);
 	int (*vop_ioctl)(struct vnode *object, int op, userptr_t data);
 	int (*vop_stat)(struct vnode *object, struct stat *statbuf);
 	int (*vop_gettype)(struct vnode *object, mode_t *result);
 	bool (*vop_isseekable)(struct vnode *object);
+	int (*vop_poll)(struct vnode *object, int events,
+			struct pollset *ps, int *result);
 	int (*vop_fsync)(struct vnode *object);
-	int (*vop_mmap)(struct vnode *file /* add stuff */);
+	int (*vop_mmap)(struct vnode *file, bool *anon);
 	int (*vop_truncate)(struct vnode *file, off_t len);
 	int (*vop_namefile)(struct vnode *file, struct uio *uio);
 
@@ -231,14 +280,17 @@ struct vnode_ops {
 #define VOP_READ(vn, uio)               (__VOP(vn, read)(vn, uio))
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
-#define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
+#define VOP_GETDIRPLUS(vn, uio)         (__VOP(vn, getdirplus)(vn, uio))
+#define VOP_GETDENTS(vn, uio)           (__VOP(vn, getdents)(vn, uio))
+#define VOP_WRITE(vn, uio)              vnode_write(vn, uio)
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_ISSEEKABLE(vn)              (__VOP(vn, isseekable)(vn))
+#define VOP_POLL(vn, ev, ps, res)       (__VOP(vn, poll)(vn, ev, ps, res))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
-#define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
-#define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
+#define VOP_MMAP(vn, anon)              (__VOP(vn, mmap)(vn, anon))
+#define VOP_TRUNCATE(vn, pos)           vnode_truncate(vn, pos)
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
@@ -252,6 +304,25 @@ struct vnode_ops {
 #define VOP_LOOKUP(vn, name, res)       (__VOP(vn, lookup)(vn, name, res))
 #define VOP_LOOKPARENT(vn,nm,res,bf,ln) (__VOP(vn,lookparent)(vn,nm,res,bf,ln))
 
+/*
+ * Argument to FIOADVISE: fadvise() advice (FADV_* from kern/fcntl.h)
+ * about the VA_LEN bytes from VA_OFFSET, or to the end of the file
+ * if VA_LEN is 0.
+ */
+struct vnode_advice {
+	off_t va_offset;
+	off_t va_len;
+	int va_advice;
+};
+
+/*
+ * Argument to FIOALLOCATE: the VR_LEN bytes from VR_OFFSET.
+ */
+struct vnode_range {
+	off_t vr_offset;
+	off_t vr_len;
+};
+
 /*
  * Consistency check
  */
@@ -266,6 +337,48 @@ void vnode_decref(struct vnode *);
 #define VOP_INCREF(vn) 			vnode_incref(vn)
 #define VOP_DECREF(vn) 			vnode_decref(vn)
 
+/*
+ * Version of the file's contents, for caches of things derived from
+ * them (see loadelf.c). Every write or truncate gives the vnode a new
+ * version, after the operation; so does vnode_init. Versions come
+ * from one counter, so no two vnodes ever share one, even if a vnode
+ * is freed and another is later made at the same address.
+ *
+ * VOP_WRITE and VOP_TRUNCATE go through vnode_write and
+ * vnode_truncate to do this. vnode_writeback is VOP_WRITE for a
+ * cache writing its own pages back (see filecache.c), which stays
+ * current if nothing else wrote meanwhile.
+ */
+unsigned vnode_version(struct vnode *);
+int vnode_write(struct vnode *, struct uio *);
+int vnode_writeback(struct vnode *, struct uio *, unsigned *version);
+int vnode_truncate(struct vnode *, off_t len);
+
+/*
+ * Byte-range advisory locks, for fcntl (see vfsflock.c). A lock
+ * belongs to an OWNER, a pid. Ranges are given in a struct flock
+ * with l_whence SEEK_SET, l_start not negative, and l_len not
+ * negative, 0 meaning from l_start on for ever.
+ *
+ *    vnode_getlk     - find the first lock on V that would stop OWNER
+ *                      taking a lock of FL's type on FL's range, and
+ *                      describe it in FL; or set FL's l_type to
+ *                      F_UNLCK if there isn't one.
+ *    vnode_setlk     - set OWNER's locks on FL's range to FL's type
+ *                      (F_RDLCK, F_WRLCK, or F_UNLCK for none). If
+ *                      another owner's lock conflicts, fails with
+ *                      EAGAIN, or with WAIT sleeps until none does.
+ *                      ENOMEM if out of memory.
+ *    vnode_unlockall - drop all of OWNER's locks on V.
+ *
+ * vnode_cleanup frees whatever is left.
+ */
+int vnode_getlk(struct vnode *v, pid_t owner, struct flock *fl);
+int vnode_setlk(struct vnode *v, pid_t owner, const struct flock *fl,
+		bool wait);
+void vnode_unlockall(struct vnode *v, pid_t owner);
+void vnode_locks_destroy(struct vnode *v);
+
 /*
  * Vnode initialization (intended for use by filesystem code)
  * The reference count is initialized to 1.
@@ -286,9 +399,9 @@ int vopfail_uio_notdir(struct vnode *vn, struct uio *uio);
 int vopfail_uio_isdir(struct vnode *vn, struct uio *uio);
 int vopfail_uio_inval(struct vnode *vn, struct uio *uio);
 int vopfail_uio_nosys(struct vnode *vn, struct uio *uio);
-int vopfail_mmap_isdir(struct vnode *vn /* add stuff */);
-int vopfail_mmap_perm(struct vnode *vn /* add stuff */);
-int vopfail_mmap_nosys(struct vnode *vn /* add stuff */);
+int vopfail_mmap_isdir(struct vnode *vn, bool *anon);
+int vopfail_mmap_perm(struct vnode *vn, bool *anon);
+int vopfail_mmap_nosys(struct vnode *vn, bool *anon);
 int vopfail_truncate_isdir(struct vnode *vn, off_t pos);
 int vopfail_creat_notdir(struct vnode *vn, const char *name, bool excl,
 			 mode_t mode, struct vnode **result);
@@ -312,5 +425,17 @@ int vopfail_lookup_notdir(struct vnode *vn, char *path, struct vnode **result);
 int vopfail_lookparent_notdir(struct vnode *vn, char *path,
 			      struct vnode **result, char *buf, size_t len);
 
+/*
+ * Common stub for vop_poll on objects that are always ready, like
+ * regular files.
+ */
+int vop_poll_ready(struct vnode *vn, int events, struct pollset *ps,
+		   int *result);
+
+/*
+ * Common vop_getdents for directories read with vop_getdirentry.
+ */
+int vop_getdents_byentry(struct vnode *dir, struct uio *uio);
+
 
 #endif /* _VNODE_H_ */
@@ -50,6 +50,13 @@ struct wchan *wchan_create(const char *name);
  */
 void wchan_destroy(struct wchan *wc);
 
+/*
+ * Keep the threads sleeping on WC in priority order (thread_level,
+ * then first come first served), so wchan_wakeone wakes the most
+ * important one. Call before anyone sleeps on it. For locks.
+ */
+void wchan_setordered(struct wchan *wc);
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -66,15 +73,36 @@ bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
  */
 void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Like wchan_sleep, but give up after TICKS hardclocks (at least 1).
+ * Returns 0 if woken and ETIMEDOUT if the time ran out. The lock is
+ * also dropped briefly after waking, to stop the timeout, so the
+ * caller must recheck its condition either way (as it should anyway).
+ */
+int wchan_sleep_timeout(struct wchan *wc, struct spinlock *lk,
+			unsigned ticks);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The associated spinlock should be locked.
  *
- * The current implementation is FIFO but this is not promised by the
- * interface.
+ * The current implementation is FIFO, or priority order for ordered
+ * wchans, but this is not promised by the interface.
  */
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Move all the threads sleeping on WC to TOWC, still asleep; they
+ * will be woken by whoever wakes TOWC, and return from wchan_sleep
+ * relocking WC's spinlock LK as usual. Both spinlocks should be
+ * locked, LK first.
+ *
+ * This is for wait morphing: waking threads that would only go
+ * straight back to sleep on something else, such as a lock.
+ */
+void wchan_requeue(struct wchan *wc, struct spinlock *lk,
+		   struct wchan *towc, struct spinlock *tolk);
+
 
 #endif /* _WCHAN_H_ */
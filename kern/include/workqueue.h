@@ -0,0 +1,70 @@
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Work queues: running functions later, in a thread.
+ *
+ * Code that can't or shouldn't do something where it is (an
+ * interrupt handler, or a path someone is waiting on) can put a
+ * struct work on a work queue, and a worker thread calls it soon
+ * after. Each queue has one worker per cpu, bound to that cpu, and
+ * work runs on the cpu that queued it, in the order queued. A worker
+ * is only woken when its queue goes from empty to not, and runs
+ * through everything there before sleeping again, so a burst of work
+ * costs one wakeup.
+ *
+ * A struct work is owned by its user, normally embedded in whatever
+ * the work is about, so queueing never allocates and never fails.
+ *
+ *    work_init          - set up W to call FUNC(ARG).
+ *    workqueue_create   - make a queue, with workers named NAME. Call
+ *                         after thread_start_cpus. Returns NULL on
+ *                         failure.
+ *    workqueue_destroy  - run everything still queued and free WQ.
+ *    workqueue_queue    - queue W, unless it's already queued. Returns
+ *                         true if it was queued by this call. W may be
+ *                         queued again as soon as it starts running,
+ *                         and so may run again, possibly on another
+ *                         cpu, before that run is over.
+ *    workqueue_queueon  - the same, but on cpu CPU's worker, or the
+ *                         first cpu with a worker if CPU hasn't one.
+ *    workqueue_cancel   - take W off the queue if it hasn't started.
+ *                         Returns true if it was taken off. Doesn't
+ *                         wait if it's running.
+ *    workqueue_flush    - wait until everything queued before the call
+ *                         has finished running.
+ *
+ * queue and cancel take only a spinlock, so may be called from
+ * interrupt handlers; flush and destroy sleep, and must not be called
+ * by a work function on the same queue.
+ *
+ * sysworkq is a general-purpose queue for short jobs, created at boot.
+ * Anything that sleeps for long (on disk I/O, say) holds up everything
+ * behind it on that cpu, and should have a queue of its own.
+ */
+
+struct workqueue;
+
+struct work {
+	struct work *w_next;		/* on the queue */
+	void (*w_func)(void *arg);
+	void *w_arg;
+	bool w_queued;			/* on a queue now */
+	unsigned w_cpu;			/* which cpu's queue */
+};
+
+void work_init(struct work *w, void (*func)(void *), void *arg);
+
+struct workqueue *workqueue_create(const char *name);
+void workqueue_destroy(struct workqueue *wq);
+bool workqueue_queue(struct workqueue *wq, struct work *w);
+bool workqueue_queueon(struct workqueue *wq, struct work *w, unsigned cpu);
+bool workqueue_cancel(struct workqueue *wq, struct work *w);
+void workqueue_flush(struct workqueue *wq);
+
+extern struct workqueue *sysworkq;
+
+/* Create sysworkq. Called from boot() after thread_start_cpus. */
+void workqueue_bootstrap(void);
+
+#endif /* _WORKQUEUE_H_ */
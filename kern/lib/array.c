@@ -85,6 +85,9 @@ array_preallocate(struct array *a, unsigned num)
 		/* Don't touch A until the allocation succeeds. */
 		newmax = a->max;
 		while (num > newmax) {
+			if (newmax > (unsigned)-1 / (2 * sizeof(*a->v))) {
+				return ENOMEM;
+			}
 			newmax = newmax ? newmax*2 : 4;
 		}
 
@@ -121,6 +124,24 @@ array_setsize(struct array *a, unsigned num)
 	return 0;
 }
 
+int
+array_addmany(struct array *a, void *const *vals, unsigned n)
+{
+	unsigned oldnum;
+	int result;
+
+	oldnum = a->num;
+	if (n > (unsigned)-1 - oldnum) {
+		return ENOMEM;
+	}
+	result = array_setsize(a, oldnum + n);
+	if (result) {
+		return result;
+	}
+	memcpy(a->v + oldnum, vals, n*sizeof(*a->v));
+	return 0;
+}
+
 void
 array_remove(struct array *a, unsigned index)
 {
@@ -133,3 +154,30 @@ array_remove(struct array *a, unsigned index)
         memmove(a->v + index, a->v + index+1, num_to_move*sizeof(void *));
         a->num--;
 }
+
+void
+array_shrink(struct array *a)
+{
+	void **newptr;
+
+	ARRAYASSERT(a->num <= a->max);
+
+	if (a->num == a->max) {
+		return;
+	}
+	if (a->num == 0) {
+		kfree(a->v);
+		a->v = NULL;
+		a->max = 0;
+		return;
+	}
+	/* If there's no memory, just keep what we have */
+	newptr = kmalloc(a->num*sizeof(*a->v));
+	if (newptr == NULL) {
+		return;
+	}
+	memcpy(newptr, a->v, a->num*sizeof(*a->v));
+	kfree(a->v);
+	a->v = newptr;
+	a->max = a->num;
+}
@@ -42,14 +42,25 @@
  * because if one uses any data type more than a single byte wide,
  * bitmap data saved on disk becomes endian-dependent, which is a
  * severe nuisance.
+ *
+ * Searching still goes a 32-bit word at a time where it can, since
+ * telling whether a word is all ones or all zeros doesn't depend on
+ * the byte order; only the word that has what we want is looked at
+ * byte by byte. The bits are allocated with kmalloc, which aligns
+ * them well enough for that.
  */
 #define BITS_PER_WORD   (CHAR_BIT)
 #define WORD_TYPE       unsigned char
 #define WORD_ALLBITS    (0xff)
 
+/* For scanning; may alias the bytes */
+typedef uint32_t __attribute__((__may_alias__)) SCAN_TYPE;
+#define BITS_PER_SCAN	32
+
 struct bitmap {
         unsigned nbits;
         WORD_TYPE *v;
+        unsigned hint;		/* where bitmap_alloc looks first */
 };
 
 
@@ -69,9 +80,11 @@ bitmap_create(unsigned nbits)
                 kfree(b);
                 return NULL;
         }
+        KASSERT((uintptr_t)b->v % sizeof(SCAN_TYPE) == 0);
 
         bzero(b->v, words*sizeof(WORD_TYPE));
         b->nbits = nbits;
+        b->hint = 0;
 
         /* Mark any leftover bits at the end in use */
         if (words > nbits / BITS_PER_WORD) {
@@ -95,29 +108,215 @@ bitmap_getdata(struct bitmap *b)
         return b->v;
 }
 
+/*
+ * Index of the lowest set bit of X, which isn't 0. (The mips has no
+ * find-first-set instruction, so halve the range each step.)
+ */
+static
+inline
+unsigned
+bitmap_ffs(uint32_t x)
+{
+        unsigned n = 0;
+
+        KASSERT(x != 0);
+        if ((x & 0xffff) == 0) {
+                n += 16;
+                x >>= 16;
+        }
+        if ((x & 0xff) == 0) {
+                n += 8;
+                x >>= 8;
+        }
+        if ((x & 0xf) == 0) {
+                n += 4;
+                x >>= 4;
+        }
+        if ((x & 0x3) == 0) {
+                n += 2;
+                x >>= 2;
+        }
+        if ((x & 0x1) == 0) {
+                n += 1;
+        }
+        return n;
+}
+
+/*
+ * Number of set bits in X.
+ */
+static
+inline
+unsigned
+bitmap_popcount(uint32_t x)
+{
+        x = x - ((x >> 1) & 0x55555555);
+        x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+        x = (x + (x >> 4)) & 0x0f0f0f0f;
+        return (x * 0x01010101) >> 24;
+}
+
+/*
+ * Find the first bit in [FROM, TO) that is set if SET is true, or
+ * clear if not. Whole scan words without one are skipped in one go.
+ */
+static
+bool
+bitmap_find(const struct bitmap *b, unsigned from, unsigned to, bool set,
+            unsigned *ret)
+{
+        WORD_TYPE flip = set ? 0 : WORD_ALLBITS;
+        SCAN_TYPE scanflip = set ? 0 : 0xffffffff;
+        unsigned i, ix, bits;
+
+        KASSERT(to <= b->nbits);
+
+        i = from;
+        while (i < to) {
+                ix = i / BITS_PER_WORD;
+                if (i % BITS_PER_SCAN == 0 && i + BITS_PER_SCAN <= to &&
+                    (*(const SCAN_TYPE *)&b->v[ix] ^ scanflip) == 0) {
+                        i += BITS_PER_SCAN;
+                        continue;
+                }
+                /* Flip so what we're after is a 1 */
+                bits = (WORD_TYPE)(b->v[ix] ^ flip) >> (i % BITS_PER_WORD);
+                if (bits != 0) {
+                        i += bitmap_ffs(bits);
+                        if (i >= to) {
+                                return false;
+                        }
+                        *ret = i;
+                        return true;
+                }
+                i += BITS_PER_WORD - i % BITS_PER_WORD;
+        }
+        return false;
+}
+
+/*
+ * Take the first clear bit at or after START, wrapping around.
+ */
+static
 int
-bitmap_alloc(struct bitmap *b, unsigned *index)
+bitmap_take(struct bitmap *b, unsigned start, unsigned *index)
 {
         unsigned ix;
-        unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-        unsigned offset;
 
-        for (ix=0; ix<maxix; ix++) {
-                if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
-
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        KASSERT(*index < b->nbits);
-                                        return 0;
-                                }
-                        }
-                        KASSERT(0);
+        if (start >= b->nbits) {
+                start = 0;
+        }
+        if (!bitmap_find(b, start, b->nbits, false, &ix) &&
+            !bitmap_find(b, 0, start, false, &ix)) {
+                return ENOSPC;
+        }
+        bitmap_mark(b, ix);
+        *index = ix;
+        return 0;
+}
+
+/*
+ * Hand out the first clear bit after the last one handed out, so
+ * that a mostly full bitmap isn't rescanned from the start each time.
+ */
+int
+bitmap_alloc(struct bitmap *b, unsigned *index)
+{
+        int result;
+
+        result = bitmap_take(b, b->hint, index);
+        if (result == 0) {
+                b->hint = *index + 1;
+        }
+        return result;
+}
+
+/*
+ * Like bitmap_alloc, but take the first clear bit at or after START,
+ * wrapping around to the beginning if need be. Called with each
+ * allocation's index + 1, this hands out indexes in rotation.
+ */
+int
+bitmap_alloc_from(struct bitmap *b, unsigned start, unsigned *index)
+{
+        return bitmap_take(b, start, index);
+}
+
+/*
+ * Find NUM clear bits in a row in [FROM, nbits).
+ */
+static
+bool
+bitmap_findrun(const struct bitmap *b, unsigned from, unsigned num,
+               unsigned *ret)
+{
+        unsigned first, set;
+
+        while (bitmap_find(b, from, b->nbits, false, &first)) {
+                if (num > b->nbits - first) {
+                        return false;
+                }
+                if (!bitmap_find(b, first, first + num, true, &set)) {
+                        *ret = first;
+                        return true;
                 }
+                from = set + 1;
+        }
+        return false;
+}
+
+int
+bitmap_alloc_range(struct bitmap *b, unsigned num, unsigned *index)
+{
+        unsigned first, i;
+
+        KASSERT(num > 0);
+
+        if (!bitmap_findrun(b, b->hint < b->nbits ? b->hint : 0, num,
+                            &first) &&
+            !bitmap_findrun(b, 0, num, &first)) {
+                return ENOSPC;
+        }
+        for (i=0; i<num; i++) {
+                bitmap_mark(b, first + i);
+        }
+        b->hint = first + num;
+        *index = first;
+        return 0;
+}
+
+void
+bitmap_unmark_range(struct bitmap *b, unsigned index, unsigned num)
+{
+        unsigned i;
+
+        KASSERT(index + num <= b->nbits);
+        for (i=0; i<num; i++) {
+                bitmap_unmark(b, index + i);
+        }
+}
+
+unsigned
+bitmap_count(struct bitmap *b)
+{
+        unsigned i, ix, count;
+        WORD_TYPE last;
+
+        count = 0;
+        for (i=0; i + BITS_PER_SCAN <= b->nbits; i += BITS_PER_SCAN) {
+                count += bitmap_popcount(
+                        *(const SCAN_TYPE *)&b->v[i / BITS_PER_WORD]);
+        }
+        for (; i + BITS_PER_WORD <= b->nbits; i += BITS_PER_WORD) {
+                count += bitmap_popcount(b->v[i / BITS_PER_WORD]);
+        }
+        if (i < b->nbits) {
+                /* Leave out the leftover bits bitmap_create marked */
+                ix = i / BITS_PER_WORD;
+                last = b->v[ix] & ((1U << (b->nbits - i)) - 1);
+                count += bitmap_popcount(last);
         }
-        return ENOSPC;
+        return count;
 }
 
 static
@@ -36,9 +36,11 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <membar.h>
 #include <mainbus.h>
 #include <vfs.h>          // for vfs_sync()
 #include <lamebus/ltrace.h> // for ltrace_stop()
+#include <platform/maxcpus.h>
 
 
 /* Flags word for DEBUG() macro. */
@@ -58,12 +60,148 @@ static struct spinlock kprintf_spinlock;
 
 
 /*
- * Create the kprintf lock. Must be called before creating a second
- * thread or enabling a second CPU.
+ * The log.
+ *
+ * Once the drain thread is running, kprintf doesn't print anything
+ * itself: it formats the message into its cpu's ring, with
+ * interrupts off, and returns. Each ring has one writer (its cpu, with
+ * interrupts off) and one reader (whoever holds klog_drainlock), so
+ * no lock is needed between them; the writer only moves kl_head and
+ * the reader only kl_tail. A message is made visible all at once when
+ * kl_head is moved past it, so messages are never split, and one that
+ * doesn't fit is dropped and counted rather than waited for.
+ *
+ * The drain thread prints what's in the rings, interrupt-driven,
+ * and keeps a copy of the last KLOG_HISTSIZE characters for dmesg.
+ * Waking it up takes spinlocks, so a kprintf made while holding one
+ * leaves that to the next hardclock.
+ *
+ * Output from kprintf may thus come out later than output sent
+ * straight to the console, so kgets and console writes flush the
+ * log first. Panic and shutdown flush it and go back to printing
+ * directly.
+ */
+#define KLOG_SIZE	2048	/* per cpu */
+#define KLOG_HISTSIZE	8192
+
+struct klog {
+	char kl_buf[KLOG_SIZE];
+	volatile unsigned kl_head;	/* end of complete messages */
+	volatile unsigned kl_tail;	/* end of what's been drained */
+	unsigned kl_pos;		/* end of message being written */
+	bool kl_overflow;		/* message being written won't fit */
+	volatile unsigned kl_lost;	/* messages dropped */
+	unsigned kl_lostseen;		/* kl_lost as of the last drain */
+};
+
+static struct klog *klogs[MAXCPUS];
+static volatile bool klog_running;	/* kprintf goes to the rings */
+static volatile bool klog_woken;	/* drain thread has been poked */
+static volatile bool klog_deferred;	/* hardclock should poke it */
+static struct semaphore *klog_sem;	/* drain thread sleeps here */
+static struct lock *klog_drainlock;	/* the reader's side; klog_hist */
+static char klog_hist[KLOG_HISTSIZE];
+static unsigned klog_histpos;
+
+/*
+ * Make the ring for cpu CPUNUM. Called from cpu_create. Without one,
+ * the cpu prints directly.
+ */
+void
+kprintf_cpuinit(unsigned cpunum)
+{
+	struct klog *kl;
+
+	KASSERT(cpunum < MAXCPUS);
+	kl = kmalloc(sizeof(*kl));
+	if (kl == NULL) {
+		return;
+	}
+	kl->kl_head = kl->kl_tail = kl->kl_pos = 0;
+	kl->kl_overflow = false;
+	kl->kl_lost = kl->kl_lostseen = 0;
+	klogs[cpunum] = kl;
+}
+
+/*
+ * Print a string straight to the console.
+ */
+static
+void
+klog_puts(const char *s)
+{
+	for (; *s; s++) {
+		putch(*s);
+	}
+}
+
+/*
+ * Print everything in the rings. The caller holds klog_drainlock, or
+ * is panicking.
+ */
+static
+void
+klog_drain(void)
+{
+	struct klog *kl;
+	unsigned c, head, pos, lost;
+	char msg[64];
+	char ch;
+
+	for (c=0; c<MAXCPUS; c++) {
+		kl = klogs[c];
+		if (kl == NULL) {
+			continue;
+		}
+		head = kl->kl_head;
+		membar_load_load();
+		for (pos = kl->kl_tail; pos != head; pos++) {
+			ch = kl->kl_buf[pos % KLOG_SIZE];
+			putch(ch);
+			klog_hist[klog_histpos++ % KLOG_HISTSIZE] = ch;
+		}
+		/* Done reading the space before giving it back */
+		membar_any_store();
+		kl->kl_tail = head;
+
+		lost = kl->kl_lost;
+		if (lost != kl->kl_lostseen) {
+			snprintf(msg, sizeof(msg),
+				 "[kprintf: %u messages lost on cpu %u]\n",
+				 lost - kl->kl_lostseen, c);
+			klog_puts(msg);
+			kl->kl_lostseen = lost;
+		}
+	}
+}
+
+static
+void
+klog_thread(void *junk1, unsigned long junk2)
+{
+	(void)junk1;
+	(void)junk2;
+
+	while (1) {
+		P(klog_sem);
+		klog_woken = false;
+		/* Clear the flag before looking at the rings */
+		membar_store_any();
+		lock_acquire(klog_drainlock);
+		klog_drain();
+		lock_release(klog_drainlock);
+	}
+}
+
+/*
+ * Create the kprintf lock and start the log. Must be called before
+ * creating a second thread or enabling a second CPU.
  */
 void
 kprintf_bootstrap(void)
 {
+	int result;
+
 	KASSERT(kprintf_lock == NULL);
 
 	kprintf_lock = lock_create("kprintf_lock");
@@ -71,6 +209,152 @@ kprintf_bootstrap(void)
 		panic("Could not create kprintf_lock\n");
 	}
 	spinlock_init(&kprintf_spinlock);
+
+	klog_sem = sem_create("kprintf", 0);
+	klog_drainlock = lock_create("kprintf_drain");
+	if (klog_sem == NULL || klog_drainlock == NULL) {
+		panic("Could not create kprintf log\n");
+	}
+	result = thread_fork("kprintf", NULL, klog_thread, NULL, 0);
+	if (result) {
+		/* Not fatal; kprintf just goes on printing directly */
+		kprintf("kprintf: cannot start log thread: %s\n",
+			strerror(result));
+		return;
+	}
+	klog_running = true;
+}
+
+/*
+ * Print everything logged so far before returning. Thread context
+ * only.
+ */
+void
+kprintf_flush(void)
+{
+	if (!klog_running || curthread->t_in_interrupt ||
+	    curthread->t_curspl > 0 || curcpu->c_spinlocks > 0) {
+		return;
+	}
+	lock_acquire(klog_drainlock);
+	klog_drain();
+	lock_release(klog_drainlock);
+}
+
+/*
+ * Flush the log and go back to printing directly. Called once, late
+ * in shutdown, so that the last messages don't wait on a thread.
+ */
+void
+kprintf_shutdown(void)
+{
+	if (!klog_running) {
+		return;
+	}
+	lock_acquire(klog_drainlock);
+	klog_running = false;
+	/* Anyone still writing to a ring finishes before this */
+	membar_any_any();
+	klog_drain();
+	lock_release(klog_drainlock);
+}
+
+/*
+ * Print the last KLOG_HISTSIZE characters of kprintf output.
+ */
+void
+kprintf_dmesg(void)
+{
+	unsigned pos;
+
+	if (!klog_running) {
+		kprintf("dmesg: No log\n");
+		return;
+	}
+	lock_acquire(klog_drainlock);
+	klog_drain();
+	pos = klog_histpos > KLOG_HISTSIZE ? klog_histpos - KLOG_HISTSIZE : 0;
+	for (; pos != klog_histpos; pos++) {
+		putch(klog_hist[pos % KLOG_HISTSIZE]);
+	}
+	lock_release(klog_drainlock);
+}
+
+/*
+ * Called from hardclock: wake the drain thread for anything logged
+ * while the writer couldn't.
+ */
+void
+kprintf_tick(void)
+{
+	if (klog_deferred) {
+		klog_deferred = false;
+		V(klog_sem);
+	}
+}
+
+/*
+ * Append to the message being written. Backend for __printf.
+ */
+static
+void
+klog_send(void *vkl, const char *data, size_t len)
+{
+	struct klog *kl = vkl;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		if (kl->kl_pos - kl->kl_tail >= KLOG_SIZE) {
+			kl->kl_overflow = true;
+			return;
+		}
+		kl->kl_buf[kl->kl_pos++ % KLOG_SIZE] = data[i];
+	}
+}
+
+/*
+ * Log a message to the current cpu's ring. Returns the length, or -1
+ * if there's no ring to log to.
+ */
+static
+int
+klog_vprintf(const char *fmt, va_list ap)
+{
+	struct klog *kl;
+	int chars, spl;
+
+	spl = splhigh();
+	kl = klogs[curcpu->c_number];
+	if (kl == NULL) {
+		splx(spl);
+		return -1;
+	}
+
+	kl->kl_pos = kl->kl_head;
+	kl->kl_overflow = false;
+	chars = __vprintf(klog_send, kl, fmt, ap);
+	if (kl->kl_overflow) {
+		kl->kl_lost++;
+	}
+	else {
+		/* Write the message before publishing it */
+		membar_store_store();
+		kl->kl_head = kl->kl_pos;
+	}
+
+	/* Publish before checking whether the drain thread will see it */
+	membar_any_any();
+	if (!klog_woken) {
+		klog_woken = true;
+		if (curcpu->c_spinlocks == 0) {
+			V(klog_sem);
+		}
+		else {
+			klog_deferred = true;
+		}
+	}
+	splx(spl);
+	return chars;
 }
 
 /*
@@ -99,6 +383,15 @@ kprintf(const char *fmt, ...)
 	va_list ap;
 	bool dolock;
 
+	if (klog_running) {
+		va_start(ap, fmt);
+		chars = klog_vprintf(fmt, ap);
+		va_end(ap);
+		if (chars >= 0) {
+			return chars;
+		}
+	}
+
 	dolock = kprintf_lock != NULL
 		&& curthread->t_in_interrupt == false
 		&& curthread->t_curspl == 0
@@ -167,6 +460,12 @@ panic(const char *fmt, ...)
 		thread_panic();
 	}
 
+	if (evil == 2 && klog_running) {
+		/* Print what's logged, and print directly from now on. */
+		klog_running = false;
+		klog_drain();
+	}
+
 	if (evil == 2) {
 		evil = 3;
 
@@ -0,0 +1,142 @@
+/*
+ * Lock-free stack and queue. See lockfree.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <membar.h>
+#include <atomic.h>
+#include <lockfree.h>
+
+/* One tick of the tag in lf_head */
+#define LFSTACK_TAGONE	(1U << LFSTACK_INDEXBITS)
+
+void
+lfstack_init(struct lfstack *s, volatile unsigned *next)
+{
+	s->lf_head = LFSTACK_NONE;
+	s->lf_next = next;
+}
+
+void
+lfstack_push(struct lfstack *s, unsigned index)
+{
+	unsigned old, new;
+
+	KASSERT(index <= LFSTACK_MAXINDEX);
+
+	do {
+		old = s->lf_head;
+		s->lf_next[index] = old & LFSTACK_INDEXMASK;
+		/* The link, and whatever the caller wrote, go first */
+		membar_any_store();
+		new = ((old & ~LFSTACK_INDEXMASK) + LFSTACK_TAGONE) | index;
+	} while (atomic_cas(&s->lf_head, old, new) != old);
+}
+
+unsigned
+lfstack_pop(struct lfstack *s)
+{
+	unsigned old, new, index;
+	int spl;
+
+	spl = splhigh();
+	do {
+		old = s->lf_head;
+		index = old & LFSTACK_INDEXMASK;
+		if (index == LFSTACK_NONE) {
+			splx(spl);
+			return LFSTACK_NONE;
+		}
+		/*
+		 * If INDEX has been popped since we read the head this
+		 * may be garbage, but then the tag has moved on too
+		 * and the swap fails.
+		 */
+		new = ((old & ~LFSTACK_INDEXMASK) + LFSTACK_TAGONE) |
+			s->lf_next[index];
+	} while (atomic_cas(&s->lf_head, old, new) != old);
+	splx(spl);
+
+	membar_store_any();
+	return index;
+}
+
+void
+mpscq_init(struct mpscq *q)
+{
+	q->mq_in = NULL;
+	q->mq_out = NULL;
+}
+
+bool
+mpscq_push(struct mpscq *q, struct mpscq_node *n)
+{
+	struct mpscq_node *old;
+
+	do {
+		old = q->mq_in;
+		n->mn_next = old;
+		membar_any_store();
+	} while ((struct mpscq_node *)atomic_cas(
+			 (volatile unsigned *)&q->mq_in,
+			 (unsigned)old, (unsigned)n) != old);
+	return old == NULL;
+}
+
+/*
+ * Move everything pushed onto the consumer's list, after what's
+ * already there.
+ */
+static
+void
+mpscq_take(struct mpscq *q)
+{
+	struct mpscq_node *n, *next, *rev, **tail;
+
+	if (q->mq_in == NULL) {
+		return;
+	}
+	n = (struct mpscq_node *)atomic_swap((volatile unsigned *)&q->mq_in,
+					     (unsigned)NULL);
+	membar_store_any();
+
+	rev = NULL;
+	for (; n != NULL; n = next) {
+		next = n->mn_next;
+		n->mn_next = rev;
+		rev = n;
+	}
+	for (tail = &q->mq_out; *tail != NULL; tail = &(*tail)->mn_next) {
+		/* find the end */
+	}
+	*tail = rev;
+}
+
+struct mpscq_node *
+mpscq_pop(struct mpscq *q)
+{
+	struct mpscq_node *n;
+
+	if (q->mq_out == NULL) {
+		mpscq_take(q);
+	}
+	n = q->mq_out;
+	if (n != NULL) {
+		q->mq_out = n->mn_next;
+		n->mn_next = NULL;
+	}
+	return n;
+}
+
+struct mpscq_node *
+mpscq_popall(struct mpscq *q)
+{
+	struct mpscq_node *n;
+
+	mpscq_take(q);
+	n = q->mq_out;
+	q->mq_out = NULL;
+	return n;
+}
@@ -67,3 +67,13 @@ timespec_sub(const struct timespec *ts1,
 	r.tv_sec -= ts2->tv_sec;
 	*ret = r;
 }
+
+/*
+ * ts as a number of hardclocks, rounded up.
+ */
+uint64_t
+timespec_to_ticks(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * HZ +
+		(ts->tv_nsec + (1000000000 / HZ) - 1) / (1000000000 / HZ);
+}
@@ -48,6 +48,32 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 	if (uio->uio_rw != UIO_READ && uio->uio_rw != UIO_WRITE) {
 		panic("uiomove: Invalid uio_rw %d\n", (int) uio->uio_rw);
 	}
+
+	/*
+	 * Fast path: a kernel buffer whose current iovec holds all of
+	 * it. That's what block device I/O and the file system's own
+	 * reads and writes nearly always are, so make it one memcpy
+	 * with no iovec walking. Kernel buffers handed to uiomove are
+	 * separate from PTR, so there's no need for memmove.
+	 */
+	if (uio->uio_segflg == UIO_SYSSPACE && n > 0 &&
+	    uio->uio_iovcnt > 0 && n <= uio->uio_resid &&
+	    n <= uio->uio_iov->iov_len) {
+		KASSERT(uio->uio_space == NULL);
+		iov = uio->uio_iov;
+		if (uio->uio_rw == UIO_READ) {
+			memcpy(iov->iov_kbase, ptr, n);
+		}
+		else {
+			memcpy(ptr, iov->iov_kbase, n);
+		}
+		iov->iov_kbase = ((char *)iov->iov_kbase + n);
+		iov->iov_len -= n;
+		uio->uio_resid -= n;
+		uio->uio_offset += n;
+		return 0;
+	}
+
 	if (uio->uio_segflg==UIO_SYSSPACE) {
 		KASSERT(uio->uio_space == NULL);
 	}
@@ -121,8 +147,12 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 int
 uiomovezeros(size_t n, struct uio *uio)
 {
-	/* static, so initialized as zero */
-	static char zeros[16];
+	/*
+	 * static, so initialized as zero. A good-sized chunk, so that
+	 * zeroing a large read (of zero:, or a hole) is a few copies
+	 * rather than one per 16 bytes.
+	 */
+	static char zeros[1024];
 	size_t amt;
 	int result;
 
@@ -161,4 +191,53 @@ uio_kinit(struct iovec *iov, struct uio *u,
 	u->uio_segflg = UIO_SYSSPACE;
 	u->uio_rw = rw;
 	u->uio_space = NULL;
+	u->uio_nocache = false;
+	u->uio_append = false;
+	u->uio_direct = false;
+}
+
+/*
+ * Convenience function to initialize an iovec and uio for user I/O.
+ */
+void
+uio_uinit(struct iovec *iov, struct uio *u,
+	  userptr_t ubuf, size_t len, off_t pos, enum uio_rw rw)
+{
+	iov->iov_ubase = ubuf;
+	iov->iov_len = len;
+	u->uio_iov = iov;
+	u->uio_iovcnt = 1;
+	u->uio_offset = pos;
+	u->uio_resid = len;
+	u->uio_segflg = UIO_USERSPACE;
+	u->uio_rw = rw;
+	u->uio_space = proc_getas();
+	u->uio_nocache = false;
+	u->uio_append = false;
+	u->uio_direct = false;
+}
+
+/*
+ * Convenience function to initialize a uio for user I/O on a vector
+ * of buffers.
+ */
+void
+uio_uinitv(struct iovec *iov, unsigned iovcnt, struct uio *u,
+	   off_t pos, enum uio_rw rw)
+{
+	unsigned i;
+
+	u->uio_iov = iov;
+	u->uio_iovcnt = iovcnt;
+	u->uio_offset = pos;
+	u->uio_resid = 0;
+	for (i=0; i<iovcnt; i++) {
+		u->uio_resid += iov[i].iov_len;
+	}
+	u->uio_segflg = UIO_USERSPACE;
+	u->uio_rw = rw;
+	u->uio_space = proc_getas();
+	u->uio_nocache = false;
+	u->uio_append = false;
+	u->uio_direct = false;
 }
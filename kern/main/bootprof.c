@@ -0,0 +1,125 @@
+/*
+ * Boot profile. See bootprof.h.
+ *
+ * The ring is only written during boot, but the menu may read it
+ * from another thread, so a spinlock covers it. That works before
+ * thread_bootstrap too, when there is no curcpu yet.
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <mainbus.h>
+#include <bootprof.h>
+
+#define BOOTPROF_SIZE	32
+
+struct bootstamp {
+	const char *bs_what;
+	unsigned bs_ticks;		/* clock_ticks() */
+	uint32_t bs_cycles;		/* cpu_getcycles() */
+	unsigned bs_cpu;
+};
+
+static struct spinlock bootprof_lock = SPINLOCK_INITIALIZER;
+static struct bootstamp bootprof_ring[BOOTPROF_SIZE];
+static unsigned bootprof_count;		/* stamps ever made */
+
+void
+bootprof_stamp(const char *what)
+{
+	struct bootstamp *bs;
+
+	spinlock_acquire(&bootprof_lock);
+	bs = &bootprof_ring[bootprof_count % BOOTPROF_SIZE];
+	bs->bs_what = what;
+	bs->bs_cpu = CURCPU_EXISTS() ? curcpu->c_number : 0;
+	bs->bs_ticks = clock_ticks();
+	bs->bs_cycles = cpu_getcycles();
+	bootprof_count++;
+	spinlock_release(&bootprof_lock);
+}
+
+/*
+ * Microseconds from stamp A to the later stamp B. With no hardclock
+ * in between and on the same cpu, the cycle counter is good;
+ * otherwise go by hardclocks.
+ */
+static
+unsigned
+bootprof_between(const struct bootstamp *a, const struct bootstamp *b)
+{
+	uint32_t percycle;
+
+	if (a->bs_ticks == b->bs_ticks && a->bs_cpu == b->bs_cpu &&
+	    b->bs_cycles >= a->bs_cycles) {
+		percycle = mainbus_cyclerate() / 1000000;
+		if (percycle == 0) {
+			percycle = 1;
+		}
+		return (b->bs_cycles - a->bs_cycles) / percycle;
+	}
+	return (b->bs_ticks - a->bs_ticks) * (1000000 / HZ);
+}
+
+unsigned
+bootprof_elapsed(void)
+{
+	unsigned first, i, total;
+
+	spinlock_acquire(&bootprof_lock);
+	first = bootprof_count > BOOTPROF_SIZE ?
+		bootprof_count - BOOTPROF_SIZE : 0;
+	total = 0;
+	for (i = first + 1; i < bootprof_count; i++) {
+		total += bootprof_between(
+			&bootprof_ring[(i - 1) % BOOTPROF_SIZE],
+			&bootprof_ring[i % BOOTPROF_SIZE]);
+	}
+	spinlock_release(&bootprof_lock);
+	return total;
+}
+
+void
+bootprof_print(void)
+{
+	struct bootstamp ring[BOOTPROF_SIZE];
+	unsigned count, first, i, us, total;
+	const struct bootstamp *bs;
+
+	/* Copy it out, so as not to print holding the spinlock */
+	spinlock_acquire(&bootprof_lock);
+	count = bootprof_count;
+	for (i=0; i<BOOTPROF_SIZE; i++) {
+		ring[i] = bootprof_ring[i];
+	}
+	spinlock_release(&bootprof_lock);
+
+	if (count == 0) {
+		kprintf("bootprof: nothing recorded\n");
+		return;
+	}
+	first = count > BOOTPROF_SIZE ? count - BOOTPROF_SIZE : 0;
+	if (first > 0) {
+		kprintf("bootprof: first %u steps lost\n", first);
+	}
+
+	kprintf("%-16s %3s %8s %10s %10s\n",
+		"step", "cpu", "ticks", "cycles", "us");
+	total = 0;
+	for (i=first; i<count; i++) {
+		bs = &ring[i % BOOTPROF_SIZE];
+		if (i == first) {
+			kprintf("%-16s %3u %8u %10u %10s\n", bs->bs_what,
+				bs->bs_cpu, bs->bs_ticks, bs->bs_cycles, "-");
+			continue;
+		}
+		us = bootprof_between(&ring[(i - 1) % BOOTPROF_SIZE], bs);
+		total += us;
+		kprintf("%-16s %3u %8u %10u %10u\n", bs->bs_what,
+			bs->bs_cpu, bs->bs_ticks, bs->bs_cycles, us);
+	}
+	kprintf("%-16s %34u\n", "total", total);
+}
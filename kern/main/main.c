@@ -43,13 +43,21 @@
 #include <current.h>
 #include <synch.h>
 #include <vm.h>
+#include <coremap.h>
 #include <mainbus.h>
 #include <vfs.h>
 #include <device.h>
 #include <syscall.h>
+#include <workqueue.h>
+#include <parallel.h>
+#include <rcu.h>
+#include <timepage.h>
+#include <net.h>
 #include <test.h>
 #include <version.h>
+#include <bootprof.h>
 #include "autoconf.h"  // for pseudoconfig
+#include "opt-net.h"
 
 
 /*
@@ -85,12 +93,12 @@ boot(void)
 	 *
 	 * Among other things, be aware that console output gets
 	 * buffered up at first and does not actually appear until
-	 * mainbus_bootstrap() attaches the console device. This can
+	 * mainbus_probe() attaches the console device. This can
 	 * be remarkably confusing if a bug occurs at this point. So
-	 * don't put new code before mainbus_bootstrap if you don't
+	 * don't put new code before mainbus_probe if you don't
 	 * absolutely have to.
 	 *
-	 * Also note that the buffer for this is only 1k. If you
+	 * Also note that the buffer for this is only 4k. If you
 	 * overflow it, the system will crash without printing
 	 * anything at all. You can make it larger though (it's in
 	 * dev/generic/console.c).
@@ -112,32 +120,81 @@ boot(void)
 	#endif
 
 	/* Early initialization. */
+	bootprof_stamp("start");
 	ram_bootstrap();
+	bootprof_stamp("ram");
 	proc_bootstrap();
+	bootprof_stamp("proc");
 	thread_bootstrap();
+	bootprof_stamp("thread");
 	hardclock_bootstrap();
+	futex_bootstrap();
+#if OPT_SHELL
+	aio_bootstrap();
+#endif
+	bootprof_stamp("clock/futex/aio");
 	vfs_bootstrap();
+	bootprof_stamp("vfs");
+	systrace_bootstrap();
+#if OPT_NET
+	/* Before the network cards attach */
+	net_bootstrap();
+#endif
 	kheap_nextgeneration();
+	bootprof_stamp("systrace/net");
 
-	/* Probe and initialize devices. Interrupts should come on. */
-	kprintf("Device probe...\n");
+	/* Bring up the bus and the other CPUs. Interrupts should come on. */
 	KASSERT(curthread->t_curspl > 0);
 	mainbus_bootstrap();
 	KASSERT(curthread->t_curspl == 0);
+	bootprof_stamp("mainbus");
+	/*
+	 * Take over physical memory now rather than in vm_bootstrap,
+	 * so that the threads and devices set up from here on come
+	 * from pages that can be freed again.
+	 */
+	coremap_bootstrap();
+	bootprof_stamp("coremap");
+	kprintf_bootstrap();
+	thread_start_cpus();
+	bootprof_stamp("cpus");
+	workqueue_bootstrap();
+	parallel_bootstrap();
+	rcu_bootstrap();
+#if OPT_SHELL
+	proc_reaper_bootstrap();
+#endif
+	bootprof_stamp("workqueue");
+
+	/*
+	 * Probe and initialize devices, with every CPU available to
+	 * do it; different kinds of device attach in parallel.
+	 */
+	kprintf("Device probe...\n");
+	mainbus_probe();
+	bootprof_stamp("device probe");
+	/* The clock is attached; time the cycle counter against it */
+	clock_calibrate();
+	/* and let user programs read it from now on */
+	timepage_bootstrap();
 	/* Now do pseudo-devices. */
 	pseudoconfig();
 	kprintf("\n");
 	kheap_nextgeneration();
+	bootprof_stamp("pseudo devices");
 
 	/* Late phase of initialization. */
 	vm_bootstrap();
-	kprintf_bootstrap();
-	thread_start_cpus();
+	bootprof_stamp("vm");
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
+	bootprof_stamp("bootfs");
 
 	kheap_nextgeneration();
+	kprintf("Boot took %u ms (bootprof for details)\n",
+		bootprof_elapsed() / 1000);
+
 	/*
 	 * Make sure various things aren't screwed up.
 	 */
@@ -160,6 +217,7 @@ shutdown(void)
 	vfs_unmountall();
 
 	thread_shutdown();
+	kprintf_shutdown();
 
 	splhigh();
 }
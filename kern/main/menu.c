@@ -40,13 +40,24 @@
 #include <thread.h>
 #include <proc.h>
 #include <vfs.h>
+#include <device.h>
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
 #include <current.h>
+#include <coremap.h>
+#include <kmem_cache.h>
+#include <vmalloc.h>
+#include <pageout.h>
+#include <vmstat.h>
+#include <iosched.h>
+#include <iostat.h>
+#include <bootprof.h>
+#include <kprof.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-shell.h"
+#include "opt-kprof.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -127,7 +138,7 @@ common_prog(int nargs, char **args)
 
 	#if OPT_SHELL
 		/*LINKING CHILD TO FATHER*/
-		proc->parent_pid=curproc->p_pid;
+		proc_addchild(curproc, proc);
 	#endif
 
 	result = thread_fork(args[0] /* thread name */,
@@ -136,6 +147,9 @@ common_prog(int nargs, char **args)
 			args /* thread arg */, nargs /* thread arg */);
 	if (result) {
 		kprintf("thread_fork failed: %s\n", strerror(result));
+	#if OPT_SHELL
+		proc_remchild(curproc, proc);
+	#endif
 		proc_destroy(proc);
 		return result;
 	}
@@ -260,6 +274,95 @@ cmd_sync(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_SFS
+/*
+ * Command for showing or setting the SFS write-back thresholds and
+ * the journal commit interval.
+ */
+static
+int
+cmd_syncer(int nargs, char **args)
+{
+	if (nargs > 4) {
+		kprintf("Usage: syncer [maxage-seconds [dirty-percent "
+			"[commit-seconds]]]\n");
+		return EINVAL;
+	}
+	if (nargs > 1) {
+		sfs_syncer_maxage = atoi(args[1]);
+	}
+	if (nargs > 2) {
+		sfs_syncer_dirtypct = atoi(args[2]);
+	}
+	if (nargs > 3) {
+		sfs_journal_interval = atoi(args[3]);
+	}
+	kprintf("sfs syncer: write back after %u seconds, "
+		"or when more than %u%% of the cache is dirty\n",
+		sfs_syncer_maxage, sfs_syncer_dirtypct);
+	kprintf("sfs journal: commit every %u seconds\n",
+		sfs_journal_interval);
+	return 0;
+}
+
+/*
+ * Command for showing the SFS vnode cache or setting its size.
+ */
+static
+int
+cmd_vncache(int nargs, char **args)
+{
+	if (nargs > 2) {
+		kprintf("Usage: vncache [max-vnodes]\n");
+		return EINVAL;
+	}
+	if (nargs > 1) {
+		sfs_vncache_max = atoi(args[1]);
+	}
+	sfs_vncache_printstats();
+	return 0;
+}
+#endif
+
+#if !OPT_DUMBVM
+/*
+ * Command for showing or setting the pageout thread's watermarks.
+ */
+static
+int
+cmd_pageout(int nargs, char **args)
+{
+	if (nargs > 6) {
+		kprintf("Usage: pageout [low-pages [high-pages [scan-pages "
+			"[pages-per-tick [hand-spread]]]]]\n");
+		return EINVAL;
+	}
+	if (nargs > 1) {
+		pageout_lowater = atoi(args[1]);
+	}
+	if (nargs > 2) {
+		pageout_hiwater = atoi(args[2]);
+	}
+	if (nargs > 3) {
+		pageout_scanwater = atoi(args[3]);
+	}
+	if (nargs > 4) {
+		pageout_fastscan = atoi(args[4]);
+	}
+	if (nargs > 5) {
+		coremap_sethandspread(atoi(args[5]));
+	}
+	if (pageout_hiwater < pageout_lowater) {
+		pageout_hiwater = pageout_lowater;
+	}
+	if (pageout_scanwater < pageout_hiwater) {
+		pageout_scanwater = pageout_hiwater;
+	}
+	pageout_printstats();
+	return 0;
+}
+#endif
+
 /*
  * Command for dropping to the debugger.
  */
@@ -445,6 +548,40 @@ cmd_unmount(int nargs, char **args)
 	return vfs_unmount(device);
 }
 
+/*
+ * Command for making a striped volume: stripe [-c chunk] disk disk...
+ * The chunk size is in blocks of the disks.
+ */
+#define STRIPE_DEFCHUNK	8
+
+static
+int
+cmd_stripe(int nargs, char **args)
+{
+	unsigned chunk = STRIPE_DEFCHUNK;
+	int first = 1, i;
+	size_t len;
+
+	if (nargs > 2 && !strcmp(args[1], "-c")) {
+		chunk = atoi(args[2]);
+		first = 3;
+	}
+	if (nargs - first < 2 || chunk == 0) {
+		kprintf("Usage: stripe [-c chunk-blocks] disk: disk: ...\n");
+		return EINVAL;
+	}
+
+	/* Allow (but do not require) colons after the disk names */
+	for (i=first; i<nargs; i++) {
+		len = strlen(args[i]);
+		if (len > 0 && args[i][len-1]==':') {
+			args[i][len-1] = 0;
+		}
+	}
+
+	return devstripe_create(nargs - first, args + first, chunk);
+}
+
 /*
  * Command to set the "boot fs".
  *
@@ -474,6 +611,215 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+/*
+ * Command for showing disk queue statistics, or choosing a device's
+ * I/O scheduler.
+ */
+static
+int
+cmd_iosched(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 1) {
+		iosched_printstats();
+		return 0;
+	}
+	if (nargs != 3) {
+		kprintf("Usage: iosched [device cscan|fifo]\n");
+		return EINVAL;
+	}
+	result = iosched_setpolicy(args[1], args[2]);
+	if (result) {
+		kprintf("iosched: %s\n", strerror(result));
+		return result;
+	}
+	return 0;
+}
+
+/*
+ * Command for showing per-device I/O statistics.
+ */
+static
+int
+cmd_iostat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	iostat_printstats();
+	return 0;
+}
+
+/*
+ * Command for showing scheduler statistics.
+ */
+static
+int
+cmd_schedstat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printstats();
+#if OPT_SHELL
+	proc_printstats();
+#endif
+
+	return 0;
+}
+
+/*
+ * Command for showing VM fault and paging statistics.
+ */
+static
+int
+cmd_vmstat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vmstat_printstats();
+	return 0;
+}
+
+/*
+ * Command for showing system call statistics.
+ */
+static
+int
+cmd_sysstat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		syscall_printstats();
+		return 0;
+	}
+	if (nargs != 2 || strcmp(args[1], "-h")) {
+		kprintf("Usage: sysstat [-h]\n");
+		return EINVAL;
+	}
+	syscall_printhist();
+	return 0;
+}
+
+/*
+ * Command for printing per-device interrupt statistics.
+ */
+static
+int
+cmd_intrstat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	mainbus_printintrstats();
+	return 0;
+}
+
+/*
+ * Command for turning system call tracing on (with or without paths)
+ * or off, or draining the trace.
+ */
+static
+int
+cmd_systrace(int nargs, char **args)
+{
+	if (nargs == 1) {
+		systrace_print();
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		systrace_setenabled(true, false);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "full")) {
+		systrace_setenabled(true, true);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		systrace_setenabled(false, false);
+		return 0;
+	}
+	kprintf("Usage: systrace [on|full|off]\n");
+	return EINVAL;
+}
+
+#if OPT_KPROF
+/*
+ * Command for the sampling profiler: start or stop it, or print and
+ * clear what it has.
+ */
+static
+int
+cmd_kprof(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 2 && !strcmp(args[1], "start")) {
+		result = kprof_start();
+		if (result) {
+			kprintf("kprof: %s\n", strerror(result));
+		}
+		return result;
+	}
+	if (nargs == 2 && !strcmp(args[1], "stop")) {
+		kprof_stop();
+		return 0;
+	}
+	if (nargs == 1 || (nargs == 2 && !strcmp(args[1], "dump"))) {
+		kprof_print();
+		return 0;
+	}
+	kprintf("Usage: kprof [start|stop|dump]\n");
+	return EINVAL;
+}
+#endif
+
+/*
+ * Command for reprinting recent kernel messages.
+ */
+static
+int
+cmd_dmesg(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kprintf_dmesg();
+
+	return 0;
+}
+
+/*
+ * Command for showing how long each step of boot took.
+ */
+static
+int
+cmd_bootprof(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	bootprof_print();
+
+	return 0;
+}
+
+/*
+ * Command for showing lock contention statistics.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	lockstat_print();
+
+	return 0;
+}
+
 static
 int
 cmd_kheapstats(int nargs, char **args)
@@ -482,6 +828,12 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+	coremap_printstats();
+	kmem_cache_printstats();
+#if !OPT_DUMBVM
+	vmalloc_printstats();
+	pageout_printstats();
+#endif
 
 	return 0;
 }
@@ -510,6 +862,29 @@ cmd_kheapdump(int nargs, char **args)
 	}
 	else {
 		kprintf("Usage: khdump [all]\n");
+		return 0;
+	}
+	coremap_printfrag();
+
+	return 0;
+}
+
+/*
+ * Command for the kernel heap's allocation sites; "reset" starts the
+ * rates and peaks over.
+ */
+static
+int
+cmd_kheapprof(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kheap_profile(false);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		kheap_profile(true);
+	}
+	else {
+		kprintf("Usage: khprof [reset]\n");
 	}
 
 	return 0;
@@ -549,11 +924,32 @@ static const char *opsmenu[] = {
 	"[p]       Other program             ",
 	"[mount]   Mount a filesystem        ",
 	"[unmount] Unmount a filesystem      ",
+	"[stripe]  Make a striped volume     ",
 	"[bootfs]  Set \"boot\" filesystem     ",
 	"[pf]      Print a file              ",
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+#if OPT_SFS
+	"[syncer]  Set SFS write-back limits ",
+	"[vncache] SFS vnode cache size/stats",
+#endif
+#if !OPT_DUMBVM
+	"[pageout] Set pageout watermarks    ",
+#endif
+	"[iosched] Disk queue stats/policy   ",
+	"[iostat]  Per-device I/O stats      ",
+	"[schedstat] Scheduler statistics    ",
+	"[vmstat]  VM fault/paging stats     ",
+	"[lockstat] Lock contention stats    ",
+	"[sysstat] System call stats         ",
+	"[systrace] System call trace        ",
+	"[intrstat] Device interrupt stats   ",
+#if OPT_KPROF
+	"[kprof]   Sampling CPU profiler     ",
+#endif
+	"[dmesg]   Recent kernel messages    ",
+	"[bootprof] Boot step timings        ",
 	"[debug]   Drop to debugger          ",
 	"[panic]   Intentional panic         ",
 	"[deadlock] Intentional deadlock     ",
@@ -575,15 +971,24 @@ cmd_opsmenu(int n, char **a)
 static const char *testmenu[] = {
 	"[at]  Array test                    ",
 	"[at2] Large array test              ",
+	"[at3] Array benchmark               ",
 	"[bt]  Bitmap test                   ",
+	"[bt2] Bitmap benchmark              ",
+	"[iot] I/O scheduler ordering test   ",
 	"[tlt] Threadlist test               ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
+	"[km5] kmem_cache test               ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[tmo] Timeout test                  ",
+	"[smc] Cross-cpu call test           ",
+	"[pft] parallel_for test             ",
+	"[lft] Lock-free stack/queue test    ",
+	"[fsb] False sharing benchmark       ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
@@ -591,6 +996,8 @@ static const char *testmenu[] = {
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
 	"[sy4] CV test #2            (1)     ",
+	"[sy5] Reader-writer lock test (1)   ",
+	"[sy6] Semaphore destroy test        ",
 	"[semu1-22] Semaphore unit tests     ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
@@ -598,6 +1005,7 @@ static const char *testmenu[] = {
 	"[fs4] FS write stress 2             ",
 	"[fs5] FS long stress                ",
 	"[fs6] FS create stress              ",
+	"[bench] Microbenchmarks            ",
 	NULL
 };
 
@@ -622,6 +1030,7 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[khprof] Kernel heap by call site   ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -657,11 +1066,32 @@ static struct {
 	{ "p",		cmd_prog },
 	{ "mount",	cmd_mount },
 	{ "unmount",	cmd_unmount },
+	{ "stripe",	cmd_stripe },
 	{ "bootfs",	cmd_bootfs },
 	{ "pf",		printfile },
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+#if OPT_SFS
+	{ "syncer",	cmd_syncer },
+	{ "vncache",	cmd_vncache },
+#endif
+#if !OPT_DUMBVM
+	{ "pageout",	cmd_pageout },
+#endif
+	{ "iosched",	cmd_iosched },
+	{ "iostat",	cmd_iostat },
+	{ "schedstat",	cmd_schedstat },
+	{ "vmstat",	cmd_vmstat },
+	{ "lockstat",	cmd_lockstat },
+	{ "sysstat",	cmd_sysstat },
+	{ "systrace",	cmd_systrace },
+	{ "intrstat",	cmd_intrstat },
+#if OPT_KPROF
+	{ "kprof",	cmd_kprof },
+#endif
+	{ "dmesg",	cmd_dmesg },
+	{ "bootprof",	cmd_bootprof },
 	{ "debug",	cmd_debug },
 	{ "panic",	cmd_panic },
 	{ "deadlock",	cmd_deadlock },
@@ -673,28 +1103,41 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "khprof",     cmd_kheapprof },
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "at2",	arraytest2 },
+	{ "at3",	arraytest3 },
 	{ "bt",		bitmaptest },
+	{ "bt2",	bitmaptest2 },
+	{ "iot",	ioschedtest },
 	{ "tlt",	threadlisttest },
 	{ "km1",	kmalloctest },
 	{ "km2",	kmallocstress },
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
+	{ "km5",	kmalloctest5 },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
+	{ "bench",	benchmark },
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "tmo",	timeouttest },
+	{ "smc",	smpcalltest },
+	{ "pft",	parallelfortest },
+	{ "lft",	lockfreetest },
+	{ "fsb",	falsesharetest },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	rwlocktest },
+	{ "sy6",	semdestroytest },
 
 	/* semaphore unit tests */
 	{ "semu1",	semu1 },
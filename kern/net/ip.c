@@ -0,0 +1,194 @@
+/*
+ * IPv4. See net.h.
+ *
+ * Just enough to carry UDP: no options are sent, no fragments are
+ * sent or accepted, and there is no routing beyond "10.0/16 goes out
+ * the first interface". Everything else that arrives is dropped
+ * without a word, as there's no ICMP either.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <endian.h>
+#include <lib.h>
+#include <net.h>
+
+struct ip_hdr {
+	uint8_t ih_vhl;			/* version 4, header length 5 */
+	uint8_t ih_tos;
+	uint16_t ih_len;		/* including the header */
+	uint16_t ih_id;
+	uint16_t ih_frag;		/* flags and fragment offset */
+	uint8_t ih_ttl;
+	uint8_t ih_proto;
+	uint16_t ih_sum;
+	uint32_t ih_src;
+	uint32_t ih_dst;
+};
+
+#define IP_VHL		0x45
+#define IP_TTL		64
+#define IP_DF		0x4000		/* don't fragment */
+#define IP_MF		0x2000		/* more fragments */
+#define IP_OFFMASK	0x1fff
+
+/* Not locked: a duplicate id only matters to fragment reassembly */
+static uint16_t ip_nextid;
+
+/*
+ * The Internet checksum of LEN bytes at DATA, starting from the
+ * partial sum SUM. Returns it in host byte order.
+ */
+uint16_t
+in_cksum(const void *data, unsigned len, uint32_t sum)
+{
+	const uint8_t *p = data;
+
+	while (len > 1) {
+		sum += ((uint32_t)p[0] << 8) | p[1];
+		p += 2;
+		len -= 2;
+	}
+	if (len > 0) {
+		sum += (uint32_t)p[0] << 8;
+	}
+	while (sum >> 16) {
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+	return ~sum & 0xffff;
+}
+
+/*
+ * Is ADDR one of ours?
+ */
+bool
+ip_islocal(uint32_t addr)
+{
+	struct netif *ni;
+
+	if ((addr >> 24) == 127) {
+		return true;
+	}
+	for (ni = netif_first(); ni != NULL; ni = ni->ni_next) {
+		if (ni->ni_addr == addr) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * The address to send from when sending to DST.
+ */
+uint32_t
+ip_srcaddr(uint32_t dst)
+{
+	struct netif *ni;
+
+	ni = netif_first();
+	if ((dst >> 24) == 127 || ni == NULL) {
+		return INADDR_LOOPBACK;
+	}
+	return ni->ni_addr;
+}
+
+/*
+ * Handle a packet that has arrived for us, from an interface or
+ * looped back.
+ */
+static
+void
+ip_input(struct pbuf *pb)
+{
+	struct ip_hdr *ih;
+	unsigned hlen, len;
+	uint32_t src, dst;
+
+	if (pb->pb_len < sizeof(*ih)) {
+		goto drop;
+	}
+	ih = pbuf_data(pb);
+	hlen = (ih->ih_vhl & 0xf) * 4;
+	len = ntohs(ih->ih_len);
+	if ((ih->ih_vhl >> 4) != 4 || hlen < sizeof(*ih) ||
+	    len < hlen || len > pb->pb_len) {
+		goto drop;
+	}
+	if (in_cksum(ih, hlen, 0) != 0) {
+		goto drop;
+	}
+	if (ntohs(ih->ih_frag) & (IP_MF | IP_OFFMASK)) {
+		goto drop;
+	}
+
+	src = ntohl(ih->ih_src);
+	dst = ntohl(ih->ih_dst);
+	if (dst != INADDR_BROADCAST && !ip_islocal(dst)) {
+		goto drop;
+	}
+
+	/* Drop any link-level padding along with the header */
+	pb->pb_len = len;
+	pbuf_pull(pb, hlen);
+
+	switch (ih->ih_proto) {
+	    case IPPROTO_UDP:
+		udp_input(pb, src, dst);
+		return;
+	}
+
+ drop:
+	pbuf_put(pb);
+}
+
+void
+net_input(struct netif *ni, struct pbuf *pb)
+{
+	ni->ni_ipackets++;
+	ip_input(pb);
+}
+
+/*
+ * Send the packet in PB, which holds the transport header and data,
+ * from SRC to DST with protocol PROTO. Takes over PB.
+ */
+int
+ip_output(struct pbuf *pb, uint32_t src, uint32_t dst, uint8_t proto)
+{
+	struct ip_hdr *ih;
+	struct netif *ni;
+
+	if (pb->pb_len + sizeof(*ih) > NET_MTU) {
+		pbuf_put(pb);
+		return EMSGSIZE;
+	}
+
+	ih = pbuf_push(pb, sizeof(*ih));
+	ih->ih_vhl = IP_VHL;
+	ih->ih_tos = 0;
+	ih->ih_len = htons(pb->pb_len);
+	ih->ih_id = htons(ip_nextid++);
+	ih->ih_frag = htons(IP_DF);
+	ih->ih_ttl = IP_TTL;
+	ih->ih_proto = proto;
+	ih->ih_sum = 0;
+	ih->ih_src = htonl(src);
+	ih->ih_dst = htonl(dst);
+	ih->ih_sum = htons(in_cksum(ih, sizeof(*ih), 0));
+
+	if (ip_islocal(dst)) {
+		/* Loopback: deliver it right here */
+		ip_input(pb);
+		return 0;
+	}
+
+	ni = netif_first();
+	if (ni == NULL) {
+		pbuf_put(pb);
+		return ENETUNREACH;
+	}
+	if (dst != INADDR_BROADCAST && !NET_ONLINK(dst)) {
+		pbuf_put(pb);
+		return EHOSTUNREACH;
+	}
+	return ni->ni_output(ni, pb, dst);
+}
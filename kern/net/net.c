@@ -0,0 +1,127 @@
+/*
+ * Network stack: packet buffer pool and interfaces. See net.h.
+ *
+ * The pool is one array of pbufs, allocated at boot, with the free
+ * ones on a list under a spinlock; drivers take buffers in their
+ * interrupt handlers, so nothing here sleeps.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <net.h>
+
+static struct pbuf *pbuf_pool;
+static struct pbuf *pbuf_free;
+static unsigned pbuf_nfree;
+static struct spinlock pbuf_lock = SPINLOCK_INITIALIZER;
+
+static struct netif *netif_list;
+static struct spinlock netif_lock = SPINLOCK_INITIALIZER;
+
+void
+pbuf_bootstrap(void)
+{
+	unsigned i;
+
+	pbuf_pool = kmalloc(PBUF_COUNT * sizeof(struct pbuf));
+	if (pbuf_pool == NULL) {
+		panic("pbuf_bootstrap: Out of memory\n");
+	}
+	for (i=0; i<PBUF_COUNT; i++) {
+		pbuf_pool[i].pb_next = pbuf_free;
+		pbuf_free = &pbuf_pool[i];
+	}
+	pbuf_nfree = PBUF_COUNT;
+}
+
+struct pbuf *
+pbuf_get(void)
+{
+	struct pbuf *pb;
+
+	spinlock_acquire(&pbuf_lock);
+	pb = pbuf_free;
+	if (pb != NULL) {
+		pbuf_free = pb->pb_next;
+		pbuf_nfree--;
+	}
+	spinlock_release(&pbuf_lock);
+
+	if (pb != NULL) {
+		pb->pb_next = NULL;
+		pb->pb_off = PBUF_HEADROOM;
+		pb->pb_len = 0;
+		pb->pb_srcaddr = 0;
+		pb->pb_srcport = 0;
+	}
+	return pb;
+}
+
+void
+pbuf_put(struct pbuf *pb)
+{
+	KASSERT(pb >= pbuf_pool && pb < pbuf_pool + PBUF_COUNT);
+
+	spinlock_acquire(&pbuf_lock);
+	pb->pb_next = pbuf_free;
+	pbuf_free = pb;
+	pbuf_nfree++;
+	spinlock_release(&pbuf_lock);
+}
+
+void *
+pbuf_push(struct pbuf *pb, unsigned len)
+{
+	KASSERT(len <= pb->pb_off);
+	pb->pb_off -= len;
+	pb->pb_len += len;
+	return pbuf_data(pb);
+}
+
+void
+pbuf_pull(struct pbuf *pb, unsigned len)
+{
+	KASSERT(len <= pb->pb_len);
+	pb->pb_off += len;
+	pb->pb_len -= len;
+}
+
+////////////////////////////////////////////////////////////
+// interfaces
+
+void
+netif_register(struct netif *ni)
+{
+	ni->ni_ipackets = ni->ni_opackets = 0;
+	ni->ni_idrops = ni->ni_odrops = 0;
+
+	spinlock_acquire(&netif_lock);
+	ni->ni_next = netif_list;
+	netif_list = ni;
+	spinlock_release(&netif_lock);
+
+	kprintf("%s: address %u.%u.%u.%u\n", ni->ni_name,
+		ni->ni_addr >> 24, (ni->ni_addr >> 16) & 0xff,
+		(ni->ni_addr >> 8) & 0xff, ni->ni_addr & 0xff);
+}
+
+/*
+ * Interfaces are never removed, so the list can be walked without
+ * the lock once the head has been read.
+ */
+struct netif *
+netif_first(void)
+{
+	struct netif *ni;
+
+	spinlock_acquire(&netif_lock);
+	ni = netif_list;
+	spinlock_release(&netif_lock);
+	return ni;
+}
+
+void
+net_bootstrap(void)
+{
+	pbuf_bootstrap();
+}
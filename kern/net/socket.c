@@ -0,0 +1,224 @@
+/*
+ * Sockets as vnodes, so they can sit in the file table next to files
+ * and pipes. Like a pipe, a socket has no filesystem and no name; the
+ * file handles sys_socket hands out are the only way to it.
+ *
+ * There's only one kind so far, UDP over IPv4. read() on a socket
+ * receives a datagram and forgets who sent it; write() has nowhere
+ * to send to, as there's no connect(), so it fails.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/socket.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <net.h>
+
+struct socket {
+	struct vnode so_vn;
+	struct udpsock *so_udp;
+};
+
+static
+int
+socket_eachopen(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+
+	/* Sockets have no name, so this can't happen. */
+	return EINVAL;
+}
+
+static
+int
+socket_reclaim(struct vnode *v)
+{
+	struct socket *so = v->vn_data;
+
+	spinlock_acquire(&v->vn_countlock);
+	if (v->vn_refcount > 1) {
+		v->vn_refcount--;
+		spinlock_release(&v->vn_countlock);
+		return EBUSY;
+	}
+	spinlock_release(&v->vn_countlock);
+
+	udp_destroy(so->so_udp);
+	vnode_cleanup(v);
+	kfree(so);
+	return 0;
+}
+
+static
+int
+socket_read(struct vnode *v, struct uio *uio)
+{
+	struct socket *so = v->vn_data;
+
+	return udp_recv(so->so_udp, uio, 0, NULL, NULL);
+}
+
+static
+int
+socket_write(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return ENOTCONN;
+}
+
+static
+int
+socket_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+socket_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFSOCK;
+	return 0;
+}
+
+static
+int
+socket_stat(struct vnode *v, struct stat *statbuf)
+{
+	(void)v;
+
+	bzero(statbuf, sizeof(struct stat));
+	statbuf->st_mode = S_IFSOCK | 0600;
+	statbuf->st_blksize = UDP_MAXDATA;
+	statbuf->st_nlink = 1;
+	return 0;
+}
+
+static
+bool
+socket_isseekable(struct vnode *v)
+{
+	(void)v;
+	return false;
+}
+
+static
+int
+socket_poll(struct vnode *v, int events, struct pollset *ps, int *result)
+{
+	struct socket *so = v->vn_data;
+
+	return udp_poll(so->so_udp, events, ps, result);
+}
+
+static
+int
+socket_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+static
+int
+socket_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+static
+int
+socket_namefile(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return ENOENT;
+}
+
+static const struct vnode_ops socket_ops = {
+	.vop_magic = VOP_MAGIC,
+	.vop_eachopen = socket_eachopen,
+	.vop_reclaim = socket_reclaim,
+	.vop_read = socket_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirplus = vopfail_uio_notdir,
+	.vop_getdents = vopfail_uio_notdir,
+	.vop_write = socket_write,
+	.vop_ioctl = socket_ioctl,
+	.vop_stat = socket_stat,
+	.vop_gettype = socket_gettype,
+	.vop_isseekable = socket_isseekable,
+	.vop_poll = socket_poll,
+	.vop_fsync = socket_fsync,
+	.vop_mmap = vopfail_mmap_nosys,
+	.vop_truncate = socket_truncate,
+	.vop_namefile = socket_namefile,
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+int
+socket_create(int domain, int type, int protocol, struct vnode **ret)
+{
+	struct socket *so;
+	int result;
+
+	if (domain != AF_INET) {
+		return EAFNOSUPPORT;
+	}
+	if (type != SOCK_DGRAM) {
+		return ESOCKTNOSUPPORT;
+	}
+	if (protocol != IPPROTO_IP && protocol != IPPROTO_UDP) {
+		return EPROTONOSUPPORT;
+	}
+
+	so = kmalloc(sizeof(*so));
+	if (so == NULL) {
+		return ENOMEM;
+	}
+	result = udp_create(&so->so_udp);
+	if (result) {
+		kfree(so);
+		return result;
+	}
+	result = vnode_init(&so->so_vn, &socket_ops, NULL, so);
+	if (result) {
+		udp_destroy(so->so_udp);
+		kfree(so);
+		return result;
+	}
+	*ret = &so->so_vn;
+	return 0;
+}
+
+struct udpsock *
+socket_get(struct vnode *v)
+{
+	struct socket *so;
+
+	if (v->vn_ops != &socket_ops) {
+		return NULL;
+	}
+	so = v->vn_data;
+	return so->so_udp;
+}
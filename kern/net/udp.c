@@ -0,0 +1,389 @@
+/*
+ * UDP. See net.h.
+ *
+ * All sockets are on one list, under udp_lock, which bind and input
+ * search by port. A received datagram goes on its socket's queue,
+ * header stripped and sender noted in the pbuf, and wakes anyone
+ * waiting in udp_recv or poll.
+ *
+ * Input finds the socket under udp_lock and takes its us_lock before
+ * letting go, so the socket can't be taken off the list and freed in
+ * between; it also takes a reference, because the poll wakeup has to
+ * happen after both spinlocks are released.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <endian.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <poll.h>
+#include <uio.h>
+#include <net.h>
+
+struct udp_hdr {
+	uint16_t uh_sport;
+	uint16_t uh_dport;
+	uint16_t uh_len;		/* including the header */
+	uint16_t uh_sum;
+};
+
+/* Ports handed out to sockets that don't pick one */
+#define UDP_EPHEMERAL_MIN	49152
+#define UDP_EPHEMERAL_MAX	65535
+
+struct udpsock {
+	struct udpsock *us_next;	/* on udp_socks */
+	unsigned us_refs;		/* under udp_lock */
+	uint32_t us_addr;		/* bound address, or INADDR_ANY */
+	uint16_t us_port;		/* bound port, or 0 if unbound */
+
+	struct spinlock us_lock;	/* for the below */
+	struct pbuf *us_head;		/* received datagrams */
+	struct pbuf **us_tail;
+	unsigned us_qlen;
+	unsigned us_drops;		/* dropped for want of room */
+	struct wchan *us_wchan;		/* udp_recv waits here */
+	struct pollhead us_poll;
+};
+
+static struct udpsock *udp_socks;
+static struct spinlock udp_lock = SPINLOCK_INITIALIZER;
+static uint16_t udp_nextport = UDP_EPHEMERAL_MIN;
+
+/*
+ * The checksum over the pseudo-header and LEN bytes of UDP header
+ * and data at UH.
+ */
+static
+uint16_t
+udp_cksum(const struct udp_hdr *uh, unsigned len, uint32_t src,
+	  uint32_t dst)
+{
+	uint32_t sum;
+
+	sum = (src >> 16) + (src & 0xffff) + (dst >> 16) + (dst & 0xffff);
+	sum += IPPROTO_UDP + len;
+	return in_cksum(uh, len, sum);
+}
+
+////////////////////////////////////////////////////////////
+// sockets
+
+static
+void
+udp_free(struct udpsock *us)
+{
+	struct pbuf *pb;
+
+	while ((pb = us->us_head) != NULL) {
+		us->us_head = pb->pb_next;
+		pbuf_put(pb);
+	}
+	pollhead_cleanup(&us->us_poll);
+	wchan_destroy(us->us_wchan);
+	spinlock_cleanup(&us->us_lock);
+	kfree(us);
+}
+
+static
+void
+udp_release(struct udpsock *us)
+{
+	bool last;
+
+	spinlock_acquire(&udp_lock);
+	KASSERT(us->us_refs > 0);
+	us->us_refs--;
+	last = us->us_refs == 0;
+	spinlock_release(&udp_lock);
+
+	if (last) {
+		udp_free(us);
+	}
+}
+
+int
+udp_create(struct udpsock **ret)
+{
+	struct udpsock *us;
+
+	us = kmalloc(sizeof(*us));
+	if (us == NULL) {
+		return ENOMEM;
+	}
+	us->us_wchan = wchan_create("udp");
+	if (us->us_wchan == NULL) {
+		kfree(us);
+		return ENOMEM;
+	}
+	us->us_next = NULL;
+	us->us_refs = 1;
+	us->us_addr = INADDR_ANY;
+	us->us_port = 0;
+	spinlock_init(&us->us_lock);
+	us->us_head = NULL;
+	us->us_tail = &us->us_head;
+	us->us_qlen = 0;
+	us->us_drops = 0;
+	pollhead_init(&us->us_poll);
+
+	*ret = us;
+	return 0;
+}
+
+void
+udp_destroy(struct udpsock *us)
+{
+	struct udpsock **pp;
+
+	spinlock_acquire(&udp_lock);
+	if (us->us_port != 0) {
+		for (pp = &udp_socks; *pp != us; pp = &(*pp)->us_next) {
+			KASSERT(*pp != NULL);
+		}
+		*pp = us->us_next;
+	}
+	spinlock_release(&udp_lock);
+
+	udp_release(us);
+}
+
+/*
+ * Is PORT taken for ADDR? Call with udp_lock held.
+ */
+static
+bool
+udp_inuse(uint32_t addr, uint16_t port)
+{
+	struct udpsock *us;
+
+	for (us = udp_socks; us != NULL; us = us->us_next) {
+		if (us->us_port == port &&
+		    (us->us_addr == INADDR_ANY || addr == INADDR_ANY ||
+		     us->us_addr == addr)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int
+udp_bind(struct udpsock *us, uint32_t addr, uint16_t port)
+{
+	unsigned tries;
+
+	if (addr != INADDR_ANY && !ip_islocal(addr)) {
+		return EADDRNOTAVAIL;
+	}
+
+	spinlock_acquire(&udp_lock);
+	if (us->us_port != 0) {
+		spinlock_release(&udp_lock);
+		return EINVAL;
+	}
+	if (port == 0) {
+		tries = UDP_EPHEMERAL_MAX - UDP_EPHEMERAL_MIN + 1;
+		do {
+			if (tries-- == 0) {
+				spinlock_release(&udp_lock);
+				return EADDRINUSE;
+			}
+			port = udp_nextport;
+			udp_nextport = port == UDP_EPHEMERAL_MAX ?
+				UDP_EPHEMERAL_MIN : port + 1;
+		} while (udp_inuse(addr, port));
+	}
+	else if (udp_inuse(addr, port)) {
+		spinlock_release(&udp_lock);
+		return EADDRINUSE;
+	}
+	us->us_addr = addr;
+	us->us_port = port;
+	us->us_next = udp_socks;
+	udp_socks = us;
+	spinlock_release(&udp_lock);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// data transfer
+
+int
+udp_send(struct udpsock *us, struct uio *uio,
+	 uint32_t dstaddr, uint16_t dstport)
+{
+	struct pbuf *pb;
+	struct udp_hdr *uh;
+	uint32_t src;
+	uint16_t sum;
+	size_t len;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+
+	len = uio->uio_resid;
+	if (len > UDP_MAXDATA) {
+		return EMSGSIZE;
+	}
+	if (dstport == 0 || dstaddr == INADDR_ANY) {
+		return EINVAL;
+	}
+	if (us->us_port == 0) {
+		result = udp_bind(us, INADDR_ANY, 0);
+		/* Someone else may have bound it meanwhile */
+		if (result && us->us_port == 0) {
+			return result;
+		}
+	}
+
+	pb = pbuf_get();
+	if (pb == NULL) {
+		return ENOMEM;
+	}
+	result = uiomove(pbuf_data(pb), len, uio);
+	if (result) {
+		pbuf_put(pb);
+		return result;
+	}
+	pb->pb_len = len;
+
+	src = us->us_addr != INADDR_ANY ? us->us_addr : ip_srcaddr(dstaddr);
+	uh = pbuf_push(pb, sizeof(*uh));
+	uh->uh_sport = htons(us->us_port);
+	uh->uh_dport = htons(dstport);
+	uh->uh_len = htons(pb->pb_len);
+	uh->uh_sum = 0;
+	sum = udp_cksum(uh, pb->pb_len, src, dstaddr);
+	/* 0 means "no checksum", so send all ones instead */
+	uh->uh_sum = htons(sum == 0 ? 0xffff : sum);
+
+	return ip_output(pb, src, dstaddr, IPPROTO_UDP);
+}
+
+void
+udp_input(struct pbuf *pb, uint32_t src, uint32_t dst)
+{
+	struct udp_hdr *uh;
+	struct udpsock *us;
+	unsigned len;
+	uint16_t port;
+	bool queued;
+
+	if (pb->pb_len < sizeof(*uh)) {
+		pbuf_put(pb);
+		return;
+	}
+	uh = pbuf_data(pb);
+	len = ntohs(uh->uh_len);
+	if (len < sizeof(*uh) || len > pb->pb_len) {
+		pbuf_put(pb);
+		return;
+	}
+	pb->pb_len = len;
+	if (uh->uh_sum != 0 && udp_cksum(uh, len, src, dst) != 0) {
+		pbuf_put(pb);
+		return;
+	}
+	port = ntohs(uh->uh_dport);
+	pb->pb_srcaddr = src;
+	pb->pb_srcport = ntohs(uh->uh_sport);
+	pbuf_pull(pb, sizeof(*uh));
+
+	spinlock_acquire(&udp_lock);
+	for (us = udp_socks; us != NULL; us = us->us_next) {
+		if (us->us_port == port &&
+		    (us->us_addr == INADDR_ANY || us->us_addr == dst ||
+		     dst == INADDR_BROADCAST)) {
+			break;
+		}
+	}
+	if (us == NULL) {
+		spinlock_release(&udp_lock);
+		pbuf_put(pb);
+		return;
+	}
+	us->us_refs++;
+	spinlock_acquire(&us->us_lock);
+	spinlock_release(&udp_lock);
+
+	queued = us->us_qlen < UDP_QLEN;
+	if (queued) {
+		pb->pb_next = NULL;
+		*us->us_tail = pb;
+		us->us_tail = &pb->pb_next;
+		us->us_qlen++;
+		wchan_wakeone(us->us_wchan, &us->us_lock);
+	}
+	else {
+		us->us_drops++;
+	}
+	spinlock_release(&us->us_lock);
+
+	if (queued) {
+		pollhead_wakeup(&us->us_poll);
+	}
+	else {
+		pbuf_put(pb);
+	}
+	udp_release(us);
+}
+
+int
+udp_recv(struct udpsock *us, struct uio *uio, unsigned timeout,
+	 uint32_t *srcaddr, uint16_t *srcport)
+{
+	struct pbuf *pb;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	spinlock_acquire(&us->us_lock);
+	while (us->us_head == NULL) {
+		if (timeout == 0) {
+			wchan_sleep(us->us_wchan, &us->us_lock);
+		}
+		else if (wchan_sleep_timeout(us->us_wchan, &us->us_lock,
+					     timeout) == ETIMEDOUT &&
+			 us->us_head == NULL) {
+			spinlock_release(&us->us_lock);
+			return ETIMEDOUT;
+		}
+	}
+	pb = us->us_head;
+	us->us_head = pb->pb_next;
+	if (us->us_head == NULL) {
+		us->us_tail = &us->us_head;
+	}
+	us->us_qlen--;
+	spinlock_release(&us->us_lock);
+
+	result = uiomove(pbuf_data(pb), pb->pb_len, uio);
+	if (result == 0) {
+		if (srcaddr != NULL) {
+			*srcaddr = pb->pb_srcaddr;
+		}
+		if (srcport != NULL) {
+			*srcport = pb->pb_srcport;
+		}
+	}
+	pbuf_put(pb);
+	return result;
+}
+
+int
+udp_poll(struct udpsock *us, int events, struct pollset *ps, int *result)
+{
+	int ret = 0;
+
+	if (events & POLLIN) {
+		pollset_register(ps, &us->us_poll);
+		if (us->us_head != NULL) {
+			ret |= POLLIN;
+		}
+	}
+	/* Sending never waits */
+	ret |= events & POLLOUT;
+	*result = ret;
+	return 0;
+}
@@ -43,15 +43,24 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <signal.h>
 #include <spl.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <limits.h>
+#include <clock.h>
 #include <vfs.h>
 #include <synch.h>
+#include <kmem_cache.h>
+#include <bitmap.h>
+#include <membar.h>
+#include <atomic.h>
+#include <workqueue.h>
 #include "openfile.h"
+#include <filetable.h>
 #include "opt-shell.h"
 #include <kern/unistd.h>
 #include <kern/fcntl.h>
@@ -61,97 +70,520 @@
  */
 struct proc *kproc;
 
+/*
+ * Proc structures come from an object cache. A free proc keeps its
+ * wait lock and CV, so fork gets them already built.
+ */
+static struct kmem_cache *proc_cache;
+
+static
+int
+proc_ctor(void *obj)
+{
+#if OPT_SHELL
+	struct proc *proc = obj;
+
+	proc->p_cv = cv_create("proc_cv");
+	if (proc->p_cv == NULL) {
+		return ENOMEM;
+	}
+	proc->p_locklock = lock_create("proc_locklock");
+	if (proc->p_locklock == NULL) {
+		cv_destroy(proc->p_cv);
+		return ENOMEM;
+	}
+	proc->p_threadcv = cv_create("proc_threadcv");
+	if (proc->p_threadcv == NULL) {
+		lock_destroy(proc->p_locklock);
+		cv_destroy(proc->p_cv);
+		return ENOMEM;
+	}
+#else
+	(void)obj;
+#endif
+	return 0;
+}
+
+static
+void
+proc_dtor(void *obj)
+{
+#if OPT_SHELL
+	struct proc *proc = obj;
+
+	cv_destroy(proc->p_threadcv);
+	cv_destroy(proc->p_cv);
+	lock_destroy(proc->p_locklock);
+#else
+	(void)obj;
+#endif
+}
+
 #if OPT_SHELL
 
 static struct process_table processTable;
 
+/* Parent/child links and exit status; see proc.h */
+static struct lock *proc_familylock;
+
+/*
+ * Add the next chunk of slots to the table and make its pids
+ * available. Called with the table lock held.
+ */
+static int proc_growtable(void) {
+    struct proc **chunk;
+    unsigned base, i;
+
+    if (processTable.nchunks == PROC_NCHUNKS) {
+        return ENPROC;
+    }
+
+    chunk = kmalloc(PROC_CHUNKSIZE * sizeof(struct proc *));
+    if (chunk == NULL) {
+        return ENOMEM;
+    }
+    bzero(chunk, PROC_CHUNKSIZE * sizeof(struct proc *));
+
+    /* proc_search may look at it as soon as it's in the table */
+    rcu_assign(processTable.chunks[processTable.nchunks], chunk);
+
+    base = processTable.nchunks * PROC_CHUNKSIZE;
+    for (i = base; i < base + PROC_CHUNKSIZE && i <= PID_MAX; i++) {
+        bitmap_unmark(processTable.pids, i);
+    }
+    processTable.nchunks++;
+    return 0;
+}
+
+/*
+ * Reserve a free PID, going on from the last one handed out so that
+ * pids aren't reused straight away. The table only grows when every
+ * pid it has room for is taken.
+ */
 static pid_t find_valid_pid(void) {
-    pid_t pid;
-    spinlock_acquire(&processTable.lock);
-
-    /* Circular PID allocation */
-    pid = (processTable.last_pid + 1 > PROC_MAX) ? 1 : processTable.last_pid + 1;
-    while (pid != processTable.last_pid) {
-        if (processTable.proc[pid] == NULL) {
-            processTable.last_pid = pid;
-            spinlock_release(&processTable.lock);
-            return pid;
+    unsigned pid;
+
+    rwlock_acquire_write(processTable.lock);
+    while (bitmap_alloc_from(processTable.pids,
+                             processTable.last_pid + 1, &pid) != 0) {
+        if (proc_growtable() != 0) {
+            rwlock_release_write(processTable.lock);
+            return -1;  /* No available PID */
         }
-        pid = (pid + 1 > PROC_MAX) ? 1 : pid + 1;
     }
-
-    spinlock_release(&processTable.lock);
-    return -1;  /* No available PID */
+    processTable.last_pid = pid;
+    rwlock_release_write(processTable.lock);
+    return pid;
 }
 
 /*
- * Initialize the process table.
+ * Initialize the process table. Called single-threaded at boot,
+ * so no locking is needed here.
  */
 void process_table_init(void) {
-    spinlock_init(&processTable.lock);
-    processTable.proc[0] = kproc;  /* Kernel process */
-	kproc->p_pid = 0;
-    for (int i = 1; i <= PROC_MAX; i++) {
-        processTable.proc[i] = NULL;
+    processTable.lock = rwlock_create("process_table");
+    if (processTable.lock == NULL) {
+        panic("process_table_init: rwlock_create failed\n");
+    }
+    proc_familylock = lock_create("proc_family");
+    if (proc_familylock == NULL) {
+        panic("process_table_init: lock_create failed\n");
     }
+
+    /* No pid is available until its chunk exists */
+    processTable.pids = bitmap_create(PID_MAX + 1);
+    if (processTable.pids == NULL) {
+        panic("process_table_init: bitmap_create failed\n");
+    }
+    for (int i = 0; i <= PID_MAX; i++) {
+        bitmap_mark(processTable.pids, i);
+    }
+    processTable.nchunks = 0;
+    processTable.nprocs = 0;
+    if (proc_growtable() != 0) {
+        panic("process_table_init: out of memory\n");
+    }
+
+    bitmap_mark(processTable.pids, 0);
+    processTable.chunks[0][0] = kproc;  /* Kernel process */
     processTable.last_pid = 0;
     processTable.active = true;
 }
 
 /*
- * Add a process to the process table.
+ * Add a process to the process table, in the slot for PID, which
+ * find_valid_pid has reserved.
  */
 int proc_add(pid_t pid, struct proc *proc) {
-    if (pid <= 0 || pid > PROC_MAX || proc == NULL) {
+    if (pid <= 0 || pid > PID_MAX || proc == NULL) {
         return -1;
     }
 
-    spinlock_acquire(&processTable.lock);
-    processTable.proc[pid] = proc;
-    spinlock_release(&processTable.lock);
+    proc->p_pid = pid;
+
 	/* PROCESS STATUS INITIALIZATION */
 	proc->p_exited = false;
 
-	/*SETTING FATHER PID AS -1*/
-	/*FOR THE FIRST PROCESS IT WILL NOT BE CHANGED*/
-	proc->parent_pid=-1;
+	/* No family until proc_addchild */
+	proc->p_parent = NULL;
+	proc->p_children = NULL;
+	proc->p_zombies = NULL;
+	proc->p_sibling = NULL;
 
-	/* PROCESS CV AND LOCK INITIALIZATION */
-	proc->p_cv = cv_create("proc_cv");
-  	proc->p_locklock = lock_create("proc_locklock");
-	if (proc->p_cv == NULL || proc->p_locklock == NULL) {
-		return -1;
-	}
+    rwlock_acquire_write(processTable.lock);
+    KASSERT(bitmap_isset(processTable.pids, pid));
+    /* Fill in the proc before proc_search can find it */
+    rcu_assign(processTable.chunks[pid >> PROC_CHUNKSHIFT][pid & (PROC_CHUNKSIZE - 1)],
+               proc);
+    processTable.nprocs++;
+    rwlock_release_write(processTable.lock);
 
 	/* TASK COMPLETED SUCCESSFULLY */
-	return proc->p_pid;
+	return 0;
 }
 
 /*
- * Remove a process from the process table.
+ * Remove a process from the process table, and free its pid.
  */
 void proc_remove(pid_t pid) {
-    if (pid <= 0 || pid > PROC_MAX) {
+    if (pid <= 0 || pid > PID_MAX) {
         return;
     }
 
-    spinlock_acquire(&processTable.lock);
-    processTable.proc[pid] = NULL;
-    spinlock_release(&processTable.lock);
+    rwlock_acquire_write(processTable.lock);
+    KASSERT((unsigned)pid >> PROC_CHUNKSHIFT < processTable.nchunks);
+    processTable.chunks[pid >> PROC_CHUNKSHIFT][pid & (PROC_CHUNKSIZE - 1)] = NULL;
+    bitmap_unmark(processTable.pids, pid);
+    KASSERT(processTable.nprocs > 0);
+    processTable.nprocs--;
+    rwlock_release_write(processTable.lock);
 }
 
 /*
  * Retrieve a process from the process table by PID.
+ *
+ * Takes no lock and writes nothing: chunks never go away, the loads
+ * pair with the barriers in proc_growtable and proc_add, and the
+ * caller's RCU read section keeps the proc from being freed.
  */
 struct proc *proc_search(pid_t pid) {
-    if (pid <= 0 || pid > PROC_MAX) {
+    struct proc **chunk;
+
+    KASSERT(rcu_read_held());
+
+    if (pid <= 0 || pid > PID_MAX) {
+        return NULL;
+    }
+
+    chunk = rcu_deref(processTable.chunks[pid >> PROC_CHUNKSHIFT]);
+    if (chunk == NULL) {
         return NULL;
     }
+    return rcu_deref(chunk[pid & (PROC_CHUNKSIZE - 1)]);
+}
+
+/*
+ * Unlink P from the list starting at *HEAD. Called with the family
+ * lock held.
+ */
+static void proc_unlink(struct proc **head, struct proc *p) {
+    struct proc **pp;
+
+    for (pp = head; *pp != p; pp = &(*pp)->p_sibling) {
+        KASSERT(*pp != NULL);
+    }
+    *pp = p->p_sibling;
+    p->p_sibling = NULL;
+}
+
+void proc_addchild(struct proc *parent, struct proc *child) {
+    lock_acquire(proc_familylock);
+    KASSERT(child->p_parent == NULL);
+    child->p_parent = parent;
+    child->p_sibling = parent->p_children;
+    parent->p_children = child;
+    lock_release(proc_familylock);
+}
+
+void proc_remchild(struct proc *parent, struct proc *child) {
+    lock_acquire(proc_familylock);
+    KASSERT(child->p_parent == parent);
+    proc_unlink(&parent->p_children, child);
+    child->p_parent = NULL;
+    lock_release(proc_familylock);
+}
+
+int proc_waitchild(pid_t pid, bool nohang, struct proc **ret) {
+    struct proc *parent = curproc;
+    struct proc *c;
+
+    lock_acquire(proc_familylock);
+    while (1) {
+        /* Anything to reap? */
+        for (c = parent->p_zombies; c != NULL; c = c->p_sibling) {
+            if (pid == -1 || c->p_pid == pid) {
+                break;
+            }
+        }
+        if (c != NULL) {
+            KASSERT(c->p_exited);
+            proc_unlink(&parent->p_zombies, c);
+            c->p_parent = NULL;
+            lock_release(proc_familylock);
+            *ret = c;
+            return 0;
+        }
+
+        /* No; is there anything to wait for? */
+        if (pid == -1) {
+            c = parent->p_children;
+        } else {
+            for (c = parent->p_children; c != NULL; c = c->p_sibling) {
+                if (c->p_pid == pid) {
+                    break;
+                }
+            }
+        }
+        if (c == NULL) {
+            lock_release(proc_familylock);
+            return ECHILD;
+        }
+        if (nohang) {
+            lock_release(proc_familylock);
+            *ret = NULL;
+            return 0;
+        }
+        cv_wait(parent->p_cv, proc_familylock);
+    }
+}
+
+/*
+ * Drop one of P's two holds (see proc_exit), freeing it with the last.
+ */
+static void proc_release(struct proc *p) {
+    if (atomic_fetchadd(&p->p_holds, -1) == 1) {
+        /* The wait lock and CV are kept with the cached proc structure. */
+        spinlock_cleanup(&p->p_lock);
+        proc_free(p);
+    }
+}
+
+/*
+ * Free a reaped proc, once no proc_search can still have it.
+ */
+static void proc_reapfree(void *arg) {
+    proc_release(arg);
+}
+
+void proc_reap(struct proc *p) {
+    KASSERT(p->p_exited);
+    KASSERT(p->p_numthreads == 0);
+
+    proc_remove(p->p_pid);
+    call_rcu(&p->p_rcu, proc_reapfree, p);
+}
+
+/*
+ * The reaper. Exit only publishes the status; what the process still
+ * owns (its address space, descriptors and cwd) is freed here, on a
+ * queue of its own, since closing the last reference to a file can
+ * mean disk I/O. Exits pile up on proc_reaplist while the reaper is
+ * busy, and each run takes everything there at once.
+ *
+ * proc_nreaping counts exited processes whose memory isn't back yet,
+ * so that the OOM killer waits for it rather than picking someone
+ * else.
+ */
+static struct spinlock proc_reaplock = SPINLOCK_INITIALIZER;
+static struct proc *proc_reaplist;
+static volatile unsigned proc_nreaping;
+static struct work proc_reapwork;
+static struct workqueue *proc_reapwq;
+
+/* Free what exited process P still holds, and drop the reaper's hold */
+static void proc_teardown(struct proc *p) {
+    KASSERT(p->p_exited);
+
+    if (p->p_cwd != NULL) {
+        VOP_DECREF(p->p_cwd);
+        p->p_cwd = NULL;
+    }
+    kfree(p->p_cwdpath);
+    p->p_cwdpath = NULL;
+    if (p->p_deadas != NULL) {
+        as_destroy(p->p_deadas);
+        p->p_deadas = NULL;
+    }
+    filetable_drop(p);
+    atomic_fetchadd(&proc_nreaping, -1);
+    proc_release(p);
+}
+
+static void proc_reaper(void *unused) {
+    struct proc *p, *next;
 
-    spinlock_acquire(&processTable.lock);
-    struct proc *proc = processTable.proc[pid];
-    spinlock_release(&processTable.lock);
-    return proc;
+    (void)unused;
+
+    while (1) {
+        spinlock_acquire(&proc_reaplock);
+        p = proc_reaplist;
+        proc_reaplist = NULL;
+        spinlock_release(&proc_reaplock);
+        if (p == NULL) {
+            break;
+        }
+        for (; p != NULL; p = next) {
+            next = p->p_reapnext;
+            p->p_reapnext = NULL;
+            proc_teardown(p);
+        }
+    }
+}
+
+/* Hand exited process P to the reaper; before it's running, free it now */
+static void proc_reaper_queue(struct proc *p) {
+    atomic_fetchadd(&proc_nreaping, 1);
+    if (proc_reapwq == NULL) {
+        proc_teardown(p);
+        return;
+    }
+    spinlock_acquire(&proc_reaplock);
+    p->p_reapnext = proc_reaplist;
+    proc_reaplist = p;
+    spinlock_release(&proc_reaplock);
+    workqueue_queue(proc_reapwq, &proc_reapwork);
+}
+
+bool proc_reaping(void) {
+    return proc_nreaping != 0;
+}
+
+void proc_reaper_bootstrap(void) {
+    work_init(&proc_reapwork, proc_reaper, NULL);
+    proc_reapwq = workqueue_create("reaper");
+    if (proc_reapwq == NULL) {
+        panic("proc_reaper_bootstrap: Out of memory\n");
+    }
+}
+
+void proc_exit(int waitcode) {
+    struct proc *p = curproc;
+    struct proc *parent, *zombies, *c, *next;
+
+    /*
+     * This thread is done with the address space; the reaper frees
+     * it, along with the rest. The proc is held by the reaper until
+     * that's done, and by the process table until proc_reap.
+     */
+    p->p_deadas = proc_setas(NULL);
+    as_deactivate();
+    p->p_holds = 2;
+
+    lock_acquire(proc_familylock);
+
+    /* Orphan the children; the ones already exited can go now */
+    for (c = p->p_children; c != NULL; c = next) {
+        next = c->p_sibling;
+        c->p_parent = NULL;
+        c->p_sibling = NULL;
+    }
+    p->p_children = NULL;
+    zombies = p->p_zombies;
+    p->p_zombies = NULL;
+
+    /*
+     * Leave the process before saying it has exited: once the lock
+     * is released the parent may free it, and this thread must not
+     * refer to it any more.
+     */
+    p->p_exitcode = waitcode;
+    proc_remthread(curthread);
+    p->p_exited = true;
+
+    parent = p->p_parent;
+    if (parent != NULL) {
+        proc_unlink(&parent->p_children, p);
+        p->p_sibling = parent->p_zombies;
+        parent->p_zombies = p;
+        cv_broadcast(parent->p_cv, proc_familylock);
+    }
+    lock_release(proc_familylock);
+
+    proc_reaper_queue(p);
+
+    for (c = zombies; c != NULL; c = next) {
+        next = c->p_sibling;
+        proc_reap(c);
+    }
+    if (parent == NULL) {
+        /* Nobody will wait for us */
+        proc_reap(p);
+    }
+}
+
+/*
+ * Print the scheduling statistics of every process in the table.
+ * Live threads are not included; a process's own totals only grow
+ * as its threads exit.
+ */
+void proc_printstats(void) {
+    struct proc *p;
+
+    kprintf("  pid      run     wait    sleep    nvcsw   nivcsw  name\n");
+    rwlock_acquire_read(processTable.lock);
+    for (unsigned i = 0; i < processTable.nchunks * PROC_CHUNKSIZE; i++) {
+        p = processTable.chunks[i >> PROC_CHUNKSHIFT][i & (PROC_CHUNKSIZE - 1)];
+        if (p == NULL) {
+            continue;
+        }
+        kprintf("%5u %8llu %8llu %8llu %8u %8u  %s\n", i,
+                (unsigned long long)p->p_stats.ss_runticks,
+                (unsigned long long)p->p_stats.ss_waitticks,
+                (unsigned long long)p->p_stats.ss_sleepticks,
+                p->p_stats.ss_nvcsw, p->p_stats.ss_nivcsw, p->p_name);
+    }
+    rwlock_release_read(processTable.lock);
+}
+
+void proc_foreach(void (*func)(struct proc *p, void *data), void *data) {
+    struct proc *p;
+
+    rwlock_acquire_read(processTable.lock);
+    for (unsigned i = 0; i < processTable.nchunks * PROC_CHUNKSIZE; i++) {
+        p = processTable.chunks[i >> PROC_CHUNKSHIFT][i & (PROC_CHUNKSIZE - 1)];
+        if (p != NULL) {
+            func(p, data);
+        }
+    }
+    rwlock_release_read(processTable.lock);
+}
+
+/*
+ * Read without the lock; the caller only compares it with a limit,
+ * and a fork racing with another can go one over at worst.
+ */
+unsigned proc_count(void) {
+    return processTable.nprocs;
+}
+
+void proc_cputick(struct proc *p) {
+    rlim_t soft, hard;
+
+    if (p == NULL || p == kproc) {
+        return;
+    }
+    p->p_cputicks++;
+
+    spinlock_acquire(&p->p_lock);
+    soft = p->p_rlimits[RLIMIT_CPU].rlim_cur;
+    hard = p->p_rlimits[RLIMIT_CPU].rlim_max;
+    if (hard != RLIM_INFINITY && p->p_cputicks >= hard * HZ) {
+        p->p_killsig = SIGKILL;
+    } else if (soft != RLIM_INFINITY && p->p_cputicks >= soft * HZ &&
+               p->p_killsig == 0) {
+        p->p_killsig = SIGXCPU;
+    }
+    spinlock_release(&p->p_lock);
 }
 
 #endif /* OPT_SHELL */
@@ -164,44 +596,86 @@ struct proc *
 proc_create(const char *name)
 {
 	struct proc *proc;
+	int i;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(proc_cache, proc);
 		return NULL;
 	}
 
 	proc->p_numthreads = 0;
 	spinlock_init(&proc->p_lock);
+	bzero(&proc->p_stats, sizeof(proc->p_stats));
+	bzero(&proc->p_childstats, sizeof(proc->p_childstats));
+	bzero(&proc->p_vmstats, sizeof(proc->p_vmstats));
+	bzero(&proc->p_childvm, sizeof(proc->p_childvm));
+	bzero(&proc->p_io, sizeof(proc->p_io));
+	bzero(&proc->p_childio, sizeof(proc->p_childio));
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
 
+	/* Resource limits; only these have a default */
+	for (i = 0; i < __RLIMIT_NUM; i++) {
+		proc->p_rlimits[i].rlim_cur = RLIM_INFINITY;
+		proc->p_rlimits[i].rlim_max = RLIM_INFINITY;
+	}
+	proc->p_rlimits[RLIMIT_STACK].rlim_cur = VM_STACKMAX;
+	proc->p_rlimits[RLIMIT_STACK].rlim_max = VM_STACKMAX;
+	proc->p_rlimits[RLIMIT_NOFILE].rlim_cur = OPEN_MAX;
+	proc->p_rlimits[RLIMIT_NOFILE].rlim_max = OPEN_MAX;
+
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
 #if OPT_SHELL
 
-	/**
-	 * @brief Zeroing out the block of memory used by the process fileTable (i.e.
-	 * 		  initializing the struct).
+	/* No descriptors until something is opened */
+	proc->p_files = NULL;
+
+	/* Just the first thread, tid 0 */
+	bzero(proc->p_uthreads, sizeof(proc->p_uthreads));
+	proc->p_uthreads[0].ut_inuse = true;
+	proc->p_exiting = false;
+	proc->p_killsig = 0;
+	proc->p_cputicks = 0;
+	proc->p_profbuf = NULL;
+	proc->p_profsize = 0;
+	proc->p_profoffset = 0;
+	proc->p_profscale = 0;
+	proc->p_aio = NULL;
+	proc->p_flocks = false;
+	proc->p_cwdpath = NULL;
+	proc->p_cwdlen = 0;
+	proc->p_deadas = NULL;
+	proc->p_reapnext = NULL;
+
+	/*
+	 * Add to the process table. The kernel process is made before
+	 * there are threads to take the table lock with; it becomes
+	 * pid 0 in process_table_init.
 	 */
-	bzero(proc->fileTable, OPEN_MAX * sizeof(struct openfile*));
+    if (kproc == NULL) {
+        proc->p_pid = 0;
+        proc->p_exited = false;
+        proc->p_parent = NULL;
+        proc->p_children = NULL;
+        proc->p_zombies = NULL;
+        proc->p_sibling = NULL;
+        return proc;
+    }
 
-	/* Add to the process table */
 	pid_t pid = find_valid_pid();
     if (pid < 0 || proc_add(pid, proc) == -1) {
-        kfree(proc->p_name);
-        kfree(proc);
+        proc_free(proc);
         return NULL;
     }
 
-    proc->p_pid = pid;
-
 #endif
 
 	return proc;
@@ -260,40 +734,25 @@ proc_destroy(struct proc *proc)
     #if OPT_SHELL
 
         /* Close all open files */
-        for(int i = 0; i < OPEN_MAX; i++) {
-            if (proc->fileTable[i] != NULL) {
-                struct openfile *of = proc->fileTable[i];
-                
-                lock_acquire(of->lock);
-                of->count--;
-
-                if (of->count == 0) {
-                    vfs_close(of->vn);
-                    lock_release(of->lock);
-                    lock_destroy(of->lock);
-                    kfree(of);
-                } else {
-                    lock_release(of->lock);
-                }
-
-                proc->fileTable[i] = NULL;
-            }
-        }
-
-        /* Destroy synchronization primitives */
-        if (proc->p_cv != NULL) {
-            cv_destroy(proc->p_cv);
-            proc->p_cv = NULL;
-        }
-        if (proc->p_locklock != NULL) {
-            lock_destroy(proc->p_locklock);
-            proc->p_locklock = NULL;
-        }
+        filetable_drop(proc);
+        kfree(proc->p_cwdpath);
+        proc->p_cwdpath = NULL;
 
     #endif
 
-    kfree(proc->p_name);
-    kfree(proc);
+    proc_free(proc);
+}
+
+/*
+ * Release the memory of a proc whose contents have already been torn
+ * down (by proc_destroy, or by waitpid after the process exited).
+ */
+void
+proc_free(struct proc *proc)
+{
+	kfree(proc->p_name);
+	proc->p_name = NULL;
+	kmem_cache_free(proc_cache, proc);
 }
 
 /*
@@ -302,6 +761,12 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+	proc_cache = kmem_cache_create("proc", sizeof(struct proc),
+				       proc_ctor, proc_dtor);
+	if (proc_cache == NULL) {
+		panic("Cannot create proc cache\n");
+	}
+
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
@@ -346,11 +811,20 @@ static int start_console(const char *lock_name, struct proc *proc, int fd, int f
 	}
 
 	/* SET THE REFERENCE COUNT AND MODE */
+	spinlock_init(&file->reflock);
 	file->count = 1;
 	file->mode = flag;
 
 	/* ASSIGN THE OPENFILE STRUCTURE TO THE PROCESS'S FILE TABLE */
-	proc->fileTable[fd] = file;
+	struct openfile *old;
+	if (filetable_set(proc, fd, file, &old)) {
+		spinlock_cleanup(&file->reflock);
+		lock_destroy(file->lock);
+		vfs_close(file->vn);
+		kfree(file);
+		return -1;
+	}
+	KASSERT(old == NULL);
 
 	return 0;
 }
@@ -360,6 +834,7 @@ static int start_console(const char *lock_name, struct proc *proc, int fd, int f
 /*
  * Create a fresh proc for use by fork.
  * Does NOT initialize console file descriptors - those are inherited from parent.
+ * The resource limits are inherited from the current process here.
  */
 struct proc *
 proc_create_fork(const char *name)
@@ -373,6 +848,10 @@ proc_create_fork(const char *name)
 
     /* VM fields */
     newproc->p_addrspace = NULL;
+    spinlock_acquire(&curproc->p_lock);
+    memcpy(newproc->p_rlimits, curproc->p_rlimits,
+           sizeof(newproc->p_rlimits));
+    spinlock_release(&curproc->p_lock);
 
     /* VFS fields */
     newproc->p_cwd = NULL;  /* Will be set by fork */
@@ -476,6 +955,7 @@ proc_remthread(struct thread *t)
 
 	spinlock_acquire(&proc->p_lock);
 	KASSERT(proc->p_numthreads > 0);
+	schedstats_add(&proc->p_stats, &t->t_stats);
 	proc->p_numthreads--;
 	spinlock_release(&proc->p_lock);
 
@@ -487,10 +967,10 @@ proc_remthread(struct thread *t)
 /*
  * Fetch the address space of (the current) process.
  *
- * Caution: address spaces aren't refcounted. If you implement
- * multithreaded processes, make sure to set up a refcount scheme or
- * some other method to make this safe. Otherwise the returned address
- * space might disappear under you.
+ * Caution: address spaces aren't refcounted. This is safe for
+ * multithreaded processes only because exit and exec get rid of the
+ * other threads (see thread_syscalls.c) before changing or destroying
+ * the address space.
  */
 struct addrspace *
 proc_getas(void)
@@ -526,3 +1006,16 @@ proc_setas(struct addrspace *newas)
 	spinlock_release(&proc->p_lock);
 	return oldas;
 }
+
+rlim_t
+proc_getrlimit(struct proc *p, int resource)
+{
+	rlim_t lim;
+
+	KASSERT(resource >= 0 && resource < __RLIMIT_NUM);
+
+	spinlock_acquire(&p->p_lock);
+	lim = p->p_rlimits[resource].rlim_cur;
+	spinlock_release(&p->p_lock);
+	return lim;
+}
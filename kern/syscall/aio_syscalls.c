@@ -0,0 +1,609 @@
+/*
+ * Asynchronous I/O through submission and completion rings in user
+ * memory. See kern/aioring.h for the interface.
+ *
+ * aio_enter copies requests off the submission ring and puts them on
+ * one work queue shared by every process, where a small pool of
+ * kernel threads runs them with VOP_READ and VOP_WRITE. Several
+ * workers means several requests in the disk queue at once, so the
+ * I/O scheduler has something to sort. When one finishes, the worker
+ * puts it on its process's done list, and the next aio_enter copies
+ * the results out onto the completion ring.
+ *
+ * The workers don't run in the process, so they never touch user
+ * memory: each request has a kernel buffer, filled from the user's
+ * buffer at submission for writes and copied out at completion for
+ * reads. That's also what makes it safe for the process to exit with
+ * requests still running; aio_exit just waits for them.
+ *
+ * Each request holds a reference to its open file. ac_enterlock
+ * serializes aio_enter calls within a process (it covers everything
+ * in the context but the done list); ac_lock covers the done list
+ * and ac_running.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/aioring.h>
+#include <lib.h>
+#include <membar.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <copyinout.h>
+#include <uio.h>
+#include <vnode.h>
+#include <openfile.h>
+#include <filetable.h>
+#include <syscall.h>
+
+#define AIO_NWORKERS	4
+
+struct aioreq {
+	struct aioreq *ar_next;		/* on the work queue or done list */
+	struct aioctx *ar_ctx;
+	struct openfile *ar_of;		/* NULL if failed at submission */
+	int ar_op;
+	char *ar_kbuf;
+	size_t ar_len;
+	off_t ar_offset;		/* -1 for the file's offset */
+	userptr_t ar_ubuf;
+	userptr_t ar_data;		/* user's cookie */
+	int ar_res;			/* bytes, or -errno */
+};
+
+struct aioctx {
+	unsigned ac_entries;
+	userptr_t ac_sq;
+	userptr_t ac_cq;
+	unsigned ac_sqhead;		/* our copy of sq_head */
+	unsigned ac_cqtail;		/* our copy of cq_tail */
+	unsigned ac_inflight;		/* submitted, not yet on the cq */
+
+	struct lock *ac_enterlock;
+	struct lock *ac_lock;
+	struct cv *ac_cv;		/* a request finished */
+	unsigned ac_running;		/* on the work queue or in a worker */
+	struct aioreq *ac_done;		/* finished, oldest first */
+	struct aioreq **ac_donetail;
+};
+
+/* The work queue */
+static struct lock *aioq_lock;
+static struct cv *aioq_cv;
+static struct aioreq *aioq_head;
+static struct aioreq **aioq_tail = &aioq_head;
+static unsigned aio_nworkers;
+
+/* Where things are in the rings (head, tail, then the entries) */
+#define RING_IDX(ac)	((ac)->ac_entries - 1)
+#define SQ_HEAD(ac)	((ac)->ac_sq)
+#define SQ_TAIL(ac)	((ac)->ac_sq + sizeof(unsigned))
+#define SQ_ENTRY(ac, i)	((ac)->ac_sq + sizeof(struct aio_sqring) + \
+			 ((i) & RING_IDX(ac)) * sizeof(struct aio_sqe))
+#define CQ_HEAD(ac)	((ac)->ac_cq)
+#define CQ_TAIL(ac)	((ac)->ac_cq + sizeof(unsigned))
+#define CQ_ENTRY(ac, i)	((ac)->ac_cq + sizeof(struct aio_cqring) + \
+			 ((i) & RING_IDX(ac)) * sizeof(struct aio_cqe))
+
+////////////////////////////////////////////////////////////
+// requests
+
+static
+void
+aioreq_destroy(struct aioreq *ar)
+{
+	if (ar->ar_of != NULL) {
+		openfile_decref(ar->ar_of);
+	}
+	kfree(ar->ar_kbuf);
+	kfree(ar);
+}
+
+/*
+ * Check a submission and make a request for it. If it's no good,
+ * the request comes back with ar_res set, to be completed without
+ * being run. Returns NULL only if out of memory.
+ */
+static
+struct aioreq *
+aioreq_create(struct aioctx *ac, const struct aio_sqe *sqe)
+{
+	struct aioreq *ar;
+	int accmode, result;
+
+	ar = kmalloc(sizeof(*ar));
+	if (ar == NULL) {
+		return NULL;
+	}
+	ar->ar_next = NULL;
+	ar->ar_ctx = ac;
+	ar->ar_of = NULL;
+	ar->ar_op = sqe->sqe_op;
+	ar->ar_kbuf = NULL;
+	ar->ar_len = sqe->sqe_len;
+	ar->ar_offset = sqe->sqe_offset;
+	ar->ar_ubuf = (userptr_t)sqe->sqe_buf;
+	ar->ar_data = (userptr_t)sqe->sqe_data;
+	ar->ar_res = 0;
+
+	if (ar->ar_op == AIO_OP_NOP) {
+		return ar;
+	}
+	if (ar->ar_op != AIO_OP_READ && ar->ar_op != AIO_OP_WRITE) {
+		ar->ar_res = -EINVAL;
+		return ar;
+	}
+	if (ar->ar_len > AIO_MAXLEN || ar->ar_offset < -1) {
+		ar->ar_res = -EINVAL;
+		return ar;
+	}
+
+	ar->ar_of = filetable_get(curproc, sqe->sqe_fd);
+	if (ar->ar_of == NULL) {
+		ar->ar_res = -EBADF;
+		return ar;
+	}
+	accmode = ar->ar_of->mode & O_ACCMODE;
+	if (accmode == (ar->ar_op == AIO_OP_READ ? O_WRONLY : O_RDONLY)) {
+		ar->ar_res = -EBADF;
+		return ar;
+	}
+	if (ar->ar_offset >= 0 && !VOP_ISSEEKABLE(ar->ar_of->vn)) {
+		ar->ar_res = -ESPIPE;
+		return ar;
+	}
+
+	ar->ar_kbuf = kmalloc(ar->ar_len + 1);
+	if (ar->ar_kbuf == NULL) {
+		ar->ar_res = -ENOMEM;
+		return ar;
+	}
+	if (ar->ar_op == AIO_OP_WRITE) {
+		result = copyin(ar->ar_ubuf, ar->ar_kbuf, ar->ar_len);
+		if (result) {
+			ar->ar_res = -result;
+		}
+	}
+	return ar;
+}
+
+/*
+ * Do the I/O. Called in a worker.
+ */
+static
+void
+aioreq_run(struct aioreq *ar)
+{
+	struct openfile *of = ar->ar_of;
+	struct iovec iov;
+	struct uio ku;
+	enum uio_rw rw;
+	off_t pos;
+	int result;
+
+	if (ar->ar_op == AIO_OP_NOP) {
+		return;
+	}
+
+	rw = ar->ar_op == AIO_OP_READ ? UIO_READ : UIO_WRITE;
+	if (ar->ar_offset < 0) {
+		lock_acquire(of->lock);
+		pos = of->offset;
+	}
+	else {
+		pos = ar->ar_offset;
+	}
+
+	uio_kinit(&iov, &ku, ar->ar_kbuf, ar->ar_len, pos, rw);
+	ku.uio_direct = (of->mode & O_DIRECT) != 0;
+	if (rw == UIO_READ) {
+		result = VOP_READ(of->vn, &ku);
+	}
+	else {
+		result = VOP_WRITE(of->vn, &ku);
+	}
+
+	if (ar->ar_offset < 0) {
+		if (result == 0) {
+			of->offset = ku.uio_offset;
+		}
+		lock_release(of->lock);
+	}
+	ar->ar_res = result ? -result : (int)(ar->ar_len - ku.uio_resid);
+}
+
+static
+void
+aioreq_finish(struct aioreq *ar)
+{
+	struct aioctx *ac = ar->ar_ctx;
+
+	lock_acquire(ac->ac_lock);
+	ar->ar_next = NULL;
+	*ac->ac_donetail = ar;
+	ac->ac_donetail = &ar->ar_next;
+	KASSERT(ac->ac_running > 0);
+	ac->ac_running--;
+	cv_broadcast(ac->ac_cv, ac->ac_lock);
+	lock_release(ac->ac_lock);
+}
+
+////////////////////////////////////////////////////////////
+// workers
+
+static
+void
+aio_worker(void *unused1, unsigned long unused2)
+{
+	struct aioreq *ar;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		lock_acquire(aioq_lock);
+		while (aioq_head == NULL) {
+			cv_wait(aioq_cv, aioq_lock);
+		}
+		ar = aioq_head;
+		aioq_head = ar->ar_next;
+		if (aioq_head == NULL) {
+			aioq_tail = &aioq_head;
+		}
+		lock_release(aioq_lock);
+
+		aioreq_run(ar);
+		aioreq_finish(ar);
+	}
+}
+
+/*
+ * Start the workers the first time anyone sets up a ring.
+ */
+static
+int
+aio_startworkers(void)
+{
+	int result = 0;
+
+	lock_acquire(aioq_lock);
+	while (aio_nworkers < AIO_NWORKERS) {
+		result = thread_fork("aio", kproc, aio_worker, NULL, 0);
+		if (result) {
+			break;
+		}
+		aio_nworkers++;
+	}
+	if (aio_nworkers > 0) {
+		/* Fewer than we wanted will do */
+		result = 0;
+	}
+	lock_release(aioq_lock);
+	return result;
+}
+
+/*
+ * Put a batch of requests (linked through ar_next) on the work
+ * queue, with one trip through the lock.
+ */
+static
+void
+aio_queue(struct aioreq *first, struct aioreq **lastnext)
+{
+	lock_acquire(aioq_lock);
+	*aioq_tail = first;
+	aioq_tail = lastnext;
+	cv_broadcast(aioq_cv, aioq_lock);
+	lock_release(aioq_lock);
+}
+
+void
+aio_bootstrap(void)
+{
+	aioq_lock = lock_create("aioq");
+	aioq_cv = cv_create("aioq");
+	if (aioq_lock == NULL || aioq_cv == NULL) {
+		panic("aio_bootstrap: Out of memory\n");
+	}
+}
+
+////////////////////////////////////////////////////////////
+// contexts
+
+static
+void
+aioctx_destroy(struct aioctx *ac)
+{
+	struct aioreq *ar;
+
+	KASSERT(ac->ac_running == 0);
+	while (ac->ac_done != NULL) {
+		ar = ac->ac_done;
+		ac->ac_done = ar->ar_next;
+		aioreq_destroy(ar);
+	}
+	cv_destroy(ac->ac_cv);
+	lock_destroy(ac->ac_lock);
+	lock_destroy(ac->ac_enterlock);
+	kfree(ac);
+}
+
+/*
+ * Drop the process's rings, waiting for anything still running.
+ * For exit and execv, once the process has a single thread.
+ */
+void
+aio_exit(struct proc *p)
+{
+	struct aioctx *ac = p->p_aio;
+
+	if (ac == NULL) {
+		return;
+	}
+	p->p_aio = NULL;
+
+	lock_acquire(ac->ac_lock);
+	while (ac->ac_running > 0) {
+		cv_wait(ac->ac_cv, ac->ac_lock);
+	}
+	lock_release(ac->ac_lock);
+	aioctx_destroy(ac);
+}
+
+/*
+ * Move finished requests onto the completion ring, as many as fit.
+ * Returns how many were posted.
+ */
+static
+unsigned
+aio_reap(struct aioctx *ac)
+{
+	struct aioreq *ar, *done;
+	struct aio_cqe cqe;
+	unsigned cqhead, posted;
+	int result;
+
+	lock_acquire(ac->ac_lock);
+	done = ac->ac_done;
+	ac->ac_done = NULL;
+	ac->ac_donetail = &ac->ac_done;
+	lock_release(ac->ac_lock);
+
+	if (done == NULL) {
+		return 0;
+	}
+
+	result = copyin(CQ_HEAD(ac), &cqhead, sizeof(cqhead));
+	posted = 0;
+	while (done != NULL && result == 0 &&
+	       ac->ac_cqtail - cqhead < ac->ac_entries) {
+		ar = done;
+		if (ar->ar_op == AIO_OP_READ && ar->ar_res > 0) {
+			if (copyout(ar->ar_kbuf, ar->ar_ubuf, ar->ar_res)) {
+				ar->ar_res = -EFAULT;
+			}
+		}
+		cqe.cqe_data = (void *)ar->ar_data;
+		cqe.cqe_res = ar->ar_res;
+		result = copyout(&cqe, CQ_ENTRY(ac, ac->ac_cqtail),
+				 sizeof(cqe));
+		if (result) {
+			break;
+		}
+		ac->ac_cqtail++;
+		posted++;
+		done = ar->ar_next;
+		aioreq_destroy(ar);
+		KASSERT(ac->ac_inflight > 0);
+		ac->ac_inflight--;
+	}
+
+	if (posted > 0) {
+		/* Entries before the index that covers them */
+		membar_store_store();
+		copyout(&ac->ac_cqtail, CQ_TAIL(ac), sizeof(ac->ac_cqtail));
+	}
+
+	if (done != NULL) {
+		/* No room (or a bad ring); keep the rest for next time */
+		lock_acquire(ac->ac_lock);
+		for (ar = done; ar->ar_next != NULL; ar = ar->ar_next) {
+			/* find the end */
+		}
+		ar->ar_next = ac->ac_done;
+		if (ac->ac_done == NULL) {
+			ac->ac_donetail = &ar->ar_next;
+		}
+		ac->ac_done = done;
+		lock_release(ac->ac_lock);
+	}
+	return posted;
+}
+
+/*
+ * aio_setup(params)
+ *
+ * Register the process's rings. Each process can have one set.
+ */
+int
+sys_aio_setup(userptr_t params)
+{
+	struct aio_params ap;
+	struct aioctx *ac;
+	unsigned idx[2];
+	int result;
+
+	if (curproc->p_aio != NULL) {
+		return EBUSY;
+	}
+
+	result = copyin(params, &ap, sizeof(ap));
+	if (result) {
+		return result;
+	}
+	if (ap.ap_entries == 0 || ap.ap_entries > AIO_MAXENTRIES ||
+	    (ap.ap_entries & (ap.ap_entries - 1)) != 0) {
+		return EINVAL;
+	}
+
+	/* Check the rings are there, and see where the process is */
+	result = copyin((userptr_t)ap.ap_sq, idx, sizeof(idx));
+	if (result) {
+		return result;
+	}
+	result = copyin((userptr_t)ap.ap_cq, idx, sizeof(idx));
+	if (result) {
+		return result;
+	}
+
+	result = aio_startworkers();
+	if (result) {
+		return result;
+	}
+
+	ac = kmalloc(sizeof(*ac));
+	if (ac == NULL) {
+		return ENOMEM;
+	}
+	ac->ac_entries = ap.ap_entries;
+	ac->ac_sq = (userptr_t)ap.ap_sq;
+	ac->ac_cq = (userptr_t)ap.ap_cq;
+	ac->ac_inflight = 0;
+	ac->ac_running = 0;
+	ac->ac_done = NULL;
+	ac->ac_donetail = &ac->ac_done;
+	ac->ac_enterlock = lock_create("aio-enter");
+	ac->ac_lock = lock_create("aio");
+	ac->ac_cv = cv_create("aio");
+	if (ac->ac_enterlock == NULL || ac->ac_lock == NULL ||
+	    ac->ac_cv == NULL) {
+		if (ac->ac_cv != NULL) {
+			cv_destroy(ac->ac_cv);
+		}
+		if (ac->ac_lock != NULL) {
+			lock_destroy(ac->ac_lock);
+		}
+		if (ac->ac_enterlock != NULL) {
+			lock_destroy(ac->ac_enterlock);
+		}
+		kfree(ac);
+		return ENOMEM;
+	}
+
+	/* Start from wherever the process's indices are */
+	copyin(SQ_HEAD(ac), &ac->ac_sqhead, sizeof(ac->ac_sqhead));
+	copyin(CQ_TAIL(ac), &ac->ac_cqtail, sizeof(ac->ac_cqtail));
+
+	curproc->p_aio = ac;
+	return 0;
+}
+
+/*
+ * aio_enter(to_submit, min_complete)
+ *
+ * Submit up to TO_SUBMIT requests from the submission ring, then
+ * post completions until at least MIN_COMPLETE have been posted by
+ * this call, or nothing more can be (nothing is running, or the
+ * completion ring is full). Returns how many were submitted.
+ *
+ * No more than ap_entries requests are ever in flight, counting ones
+ * finished but not yet posted, so the completion ring can't overflow
+ * if the process keeps it drained.
+ */
+int
+sys_aio_enter(unsigned to_submit, unsigned min_complete, int *retval)
+{
+	struct aioctx *ac = curproc->p_aio;
+	struct aioreq *ar, *batch, **batchtail, *bad, **badtail;
+	struct aio_sqe sqe;
+	unsigned sqtail, submitted, nbatch, posted, n;
+	int result;
+
+	if (ac == NULL) {
+		return EINVAL;
+	}
+
+	lock_acquire(ac->ac_enterlock);
+
+	/* Submit */
+	result = copyin(SQ_TAIL(ac), &sqtail, sizeof(sqtail));
+	if (result) {
+		lock_release(ac->ac_enterlock);
+		return result;
+	}
+	membar_load_load();
+
+	submitted = nbatch = 0;
+	batch = bad = NULL;
+	batchtail = &batch;
+	badtail = &bad;
+	while (submitted < to_submit && ac->ac_sqhead != sqtail &&
+	       ac->ac_inflight < ac->ac_entries) {
+		result = copyin(SQ_ENTRY(ac, ac->ac_sqhead), &sqe,
+				sizeof(sqe));
+		if (result) {
+			break;
+		}
+		ar = aioreq_create(ac, &sqe);
+		if (ar == NULL) {
+			result = ENOMEM;
+			break;
+		}
+		if (ar->ar_res != 0) {
+			/* Failed already; straight to the done list */
+			*badtail = ar;
+			badtail = &ar->ar_next;
+		}
+		else {
+			*batchtail = ar;
+			batchtail = &ar->ar_next;
+			nbatch++;
+		}
+		ac->ac_sqhead++;
+		ac->ac_inflight++;
+		submitted++;
+	}
+	if (submitted > 0) {
+		copyout(&ac->ac_sqhead, SQ_HEAD(ac), sizeof(ac->ac_sqhead));
+		/* Only report an error if we did nothing */
+		result = 0;
+	}
+	if (bad != NULL || batch != NULL) {
+		lock_acquire(ac->ac_lock);
+		if (bad != NULL) {
+			*ac->ac_donetail = bad;
+			ac->ac_donetail = badtail;
+		}
+		ac->ac_running += nbatch;
+		lock_release(ac->ac_lock);
+	}
+	if (batch != NULL) {
+		aio_queue(batch, batchtail);
+	}
+	if (result) {
+		lock_release(ac->ac_enterlock);
+		return result;
+	}
+
+	/* Complete */
+	posted = aio_reap(ac);
+	while (posted < min_complete && ac->ac_inflight > 0) {
+		lock_acquire(ac->ac_lock);
+		while (ac->ac_done == NULL) {
+			cv_wait(ac->ac_cv, ac->ac_lock);
+		}
+		lock_release(ac->ac_lock);
+		n = aio_reap(ac);
+		if (n == 0) {
+			/* Completion ring full */
+			break;
+		}
+		posted += n;
+	}
+
+	lock_release(ac->ac_enterlock);
+	*retval = submitted;
+	return 0;
+}
@@ -7,20 +7,27 @@
 #include <types.h>
 #include <kern/unistd.h>
 #include <kern/fcntl.h>
+#include <kern/ioctl.h>
 #include <kern/errno.h>
 #include <copyinout.h>
 #include <vfs.h>
 #include <current.h>
 #include <proc.h>
 #include <openfile.h>
+#include <filetable.h>
 #include <uio.h>
 #include <vnode.h>
+#include <fs.h>
+#include <vm.h>
 #include <syscall.h>
 #include <limits.h>
 #include <lib.h>
 #include <kern/seek.h>
+#include <kern/semop.h>
 #include <kern/stat.h>
+#include <stat.h>
 #include <synch.h>
+#include <membar.h>
 #include <kern/limits.h>
 
 #if OPT_SHELL
@@ -30,8 +37,7 @@
  */
 int sys_remove(const char *path) {
     int result;
-    char kbuffer[PATH_MAX];
-    size_t len;
+    char *kbuffer;
 
     /* Validate input path */
     if (path == NULL) {
@@ -39,13 +45,157 @@ int sys_remove(const char *path) {
     }
 
     /* Copy path from user space to kernel space */
-    result = copyinstr((const_userptr_t)path, kbuffer, PATH_MAX, &len);
+    result = copyin_path((const_userptr_t)path, &kbuffer);
     if (result) {
         return result;
     }
 
     /* Call VFS to remove the file */
     result = vfs_remove(kbuffer);
+    pathbuf_put(kbuffer);
+    return result;
+}
+
+/* Largest transfer one call can make; the count must fit in retval */
+#define FILE_RWMAX  0x7fffffff
+
+/* readv/writev vectors up to this long are copied in on the stack */
+#define FILE_SMALLIOV  8
+
+/*
+ * file_rw - Do the I/O described by UIO on the file descriptor fd
+ *
+ *   The uio says which direction and where in user memory. Ordinary
+ *   I/O starts at the open file's offset and moves it, under the
+ *   openfile's lock. Positional I/O starts at uio_offset instead and
+ *   leaves the file's offset alone, so it doesn't take the lock, and
+ *   threads reading one file at different places don't wait for each
+ *   other.
+ *
+ * Arguments:
+ *   fd         - File descriptor
+ *   uio        - User uio describing the transfer
+ *   positional - Use uio_offset, not the file's offset
+ *   retval     - Pointer to store the number of bytes moved
+ *
+ * Returns:
+ *   0 on success
+ *   EBADF   - fd is invalid, not open, or not open in the right mode
+ *   ESPIPE  - Positional I/O on a file that can't seek
+ *   EINVAL  - Positional I/O at a negative offset
+ *   Other error codes from VOP_READ / VOP_WRITE
+ */
+static int file_rw(int fd, struct uio *uio, bool positional, int32_t *retval)
+{
+    size_t len = uio->uio_resid;
+    int wrongmode = (uio->uio_rw == UIO_READ) ? O_WRONLY : O_RDONLY;
+    int result;
+
+    /* CHECKING FILE DESCRIPTOR VALIDITY AND MODE */
+    struct openfile *of = filetable_get(curproc, fd);
+    if (of == NULL)
+        return EBADF;
+    if ((of->mode & O_ACCMODE) == wrongmode)
+    {
+        openfile_decref(of);
+        return EBADF;
+    }
+    uio->uio_direct = (of->mode & O_DIRECT) != 0;
+
+    if (positional)
+    {
+        if (!VOP_ISSEEKABLE(of->vn))
+            result = ESPIPE;
+        else if (uio->uio_offset < 0)
+            result = EINVAL;
+        else if (uio->uio_rw == UIO_READ)
+            result = VOP_READ(of->vn, uio);
+        else
+            result = VOP_WRITE(of->vn, uio);
+    }
+    else
+    {
+        lock_acquire(of->lock);
+        uio->uio_offset = of->offset;
+        if (uio->uio_rw == UIO_READ)
+            result = VOP_READ(of->vn, uio);
+        else
+        {
+            /* THE FS PUTS AN APPEND AT EOF, AND SAYS WHERE IN uio_offset */
+            uio->uio_append = (of->mode & O_APPEND) != 0;
+            result = VOP_WRITE(of->vn, uio);
+        }
+        /* UPDATING OFFSET, UNLESS IT FAILED (ENOSPC, EIO, EFAULT...) */
+        if (!result)
+            of->offset = uio->uio_offset;
+        lock_release(of->lock);
+    }
+
+    if (!result)
+        *retval = (int32_t)(len - uio->uio_resid);
+
+    openfile_decref(of);
+    return result;
+}
+
+/*
+ * file_rwv - readv/writev: I/O on a vector of user buffers
+ *
+ *   Copies in the user's iovec array and hands the whole vector to the
+ *   file system as one uio, so the buffers are filled or drained in
+ *   order in one operation, at the file's offset.
+ *
+ * Arguments:
+ *   fd      - File descriptor
+ *   uiov    - User pointer to an array of struct iovec
+ *   iovcnt  - Number of elements
+ *   rw      - UIO_READ or UIO_WRITE
+ *   retval  - Pointer to store the number of bytes moved
+ *
+ * Returns:
+ *   0 on success
+ *   EINVAL  - iovcnt out of range, or the lengths add up to too much
+ *   EFAULT  - Invalid iovec array or buffer
+ *   ENOMEM  - Out of memory
+ *   Others as for file_rw
+ */
+static int file_rwv(int fd, userptr_t uiov, int iovcnt, enum uio_rw rw,
+                    int32_t *retval)
+{
+    struct iovec smalliov[FILE_SMALLIOV];
+    struct iovec *iov = smalliov;
+    struct uio uuio;
+    size_t total = 0;
+    int result;
+
+    if (iovcnt < 0 || iovcnt > IOV_MAX)
+        return EINVAL;
+
+    if (iovcnt > FILE_SMALLIOV)
+    {
+        iov = kmalloc(iovcnt * sizeof(*iov));
+        if (iov == NULL)
+            return ENOMEM;
+    }
+
+    /* THE USER'S struct iovec HAS THE SAME LAYOUT AS OURS */
+    result = copyin(uiov, iov, iovcnt * sizeof(*iov));
+    for (int i = 0; !result && i < iovcnt; i++)
+    {
+        if (iov[i].iov_len > FILE_RWMAX - total)
+            result = EINVAL;
+        else
+            total += iov[i].iov_len;
+    }
+
+    if (!result)
+    {
+        uio_uinitv(iov, iovcnt, &uuio, 0, rw);
+        result = file_rw(fd, &uuio, false, retval);
+    }
+
+    if (iov != smalliov)
+        kfree(iov);
     return result;
 }
 
@@ -54,6 +204,8 @@ int sys_remove(const char *path) {
  *
  *   Writes up to buflen bytes from the buffer buf to the file referenced 
  *   by the file descriptor fd. The file must be open for writing.
+ *   The data is moved by the filesystem directly from the user buffer,
+ *   without a kernel copy.
  *
  * Arguments:
  *   fd      - File descriptor to write to (must be valid and open for writing)
@@ -65,159 +217,923 @@ int sys_remove(const char *path) {
  *   0 on success
  *   EBADF   - fd is invalid, not open, or opened as read-only
  *   EFAULT  - buf is NULL or invalid user space pointer
- *   ENOMEM  - Insufficient kernel memory to allocate buffer
  *   ENOSPC  - No free space remaining on the filesystem
  *   EIO     - Hardware I/O error occurred during write operation
  *
  */
 ssize_t sys_write(int fd, const void *buf, size_t buflen, int32_t *retval)
 {
-    /* CHECKING FILE DESCRIPTOR */
-    if (fd < 0 || fd >= OPEN_MAX)
-        return EBADF;
+    struct iovec iov;
+    struct uio uuio;
+
+    if (buf == NULL)
+        return EFAULT; /* INVALID BUFFER POINTER */
+
+    /* WRITING DATA TO FILE, STRAIGHT FROM THE USER BUFFER */
+    uio_uinit(&iov, &uuio, (userptr_t)buf, buflen, 0, UIO_WRITE);
+    return file_rw(fd, &uuio, false, retval);
+}
+
+/*
+ * sys_read - Read data from a file descriptor
+ *
+ *   Reads up to buflen bytes from the file referenced by the file 
+ *   descriptor fd into the buffer buf. The file must be open for reading.
+ *   The data is moved by the filesystem directly into the user buffer.
+ *
+ * Arguments:
+ *   fd      - File descriptor to read from (must be valid and open for reading)
+ *   buf     - Pointer to user space buffer to store read data
+ *   buflen  - Maximum number of bytes to read into the buffer
+ *   retval  - Pointer to store the number of bytes actually read
+ *
+ * Returns:
+ *   0 on success
+ *   EBADF   - fd is invalid, not open, or opened as write-only
+ *   EFAULT  - buf is NULL or invalid user space pointer
+ *   EIO     - Hardware I/O error occurred during read operation
+ */
+ssize_t sys_read(int fd, const void *buf, size_t buflen, int32_t *retval) {
+    struct iovec iov;
+    struct uio uuio;
 
-    /* CHECKING CURPROC AND FILETABLE */
-    if (curproc == NULL || curproc->fileTable == NULL)
+    /* VALIDATE BUFFER */
+    if (buf == NULL) {
         return EFAULT;
+    }
 
-    /* CHECKING FILE DESCRIPTOR VALIDITY */
-    if (curproc->fileTable[fd] == NULL)
-        return EBADF;
+    /* READING STRAIGHT INTO THE USER BUFFER */
+    uio_uinit(&iov, &uuio, (userptr_t)buf, buflen, 0, UIO_READ);
+    return file_rw(fd, &uuio, false, retval);
+}
 
-    struct openfile *of = curproc->fileTable[fd];
+/*
+ * sys_pread - Read from a file descriptor at a given offset
+ *
+ *   Like sys_read, but reads at pos and doesn't use or change the
+ *   file's offset.
+ *
+ * Arguments:
+ *   fd      - File descriptor to read from
+ *   buf     - User buffer to read into
+ *   buflen  - Maximum number of bytes to read
+ *   pos     - Offset in the file to read at
+ *   retval  - Pointer to store the number of bytes actually read
+ *
+ * Returns:
+ *   0 on success
+ *   EBADF   - fd is invalid, not open, or opened as write-only
+ *   ESPIPE  - fd refers to something that can't seek, like the console
+ *   EINVAL  - pos is negative
+ *   EFAULT  - Invalid user buffer
+ *   EIO     - Hardware I/O error
+ */
+int sys_pread(int fd, userptr_t buf, size_t buflen, off_t pos,
+              int32_t *retval)
+{
+    struct iovec iov;
+    struct uio uuio;
 
-    /* ENSURE THE FILE IS NOT READ-ONLY */
-    if ((of->mode & O_ACCMODE) == O_RDONLY)
-        return EBADF; /* FILE IS NOT OPEN FOR WRITING */
+    uio_uinit(&iov, &uuio, buf, buflen, pos, UIO_READ);
+    return file_rw(fd, &uuio, true, retval);
+}
 
-    if (buf == NULL)
-        return EFAULT; /* INVALID BUFFER POINTER */
+/*
+ * sys_pwrite - Write to a file descriptor at a given offset
+ *
+ *   Like sys_write, but writes at pos and doesn't use or change the
+ *   file's offset.
+ *
+ * Arguments:
+ *   fd      - File descriptor to write to
+ *   buf     - User buffer to write from
+ *   buflen  - Number of bytes to write
+ *   pos     - Offset in the file to write at
+ *   retval  - Pointer to store the number of bytes actually written
+ *
+ * Returns:
+ *   0 on success
+ *   EBADF   - fd is invalid, not open, or opened as read-only
+ *   ESPIPE  - fd refers to something that can't seek, like the console
+ *   EINVAL  - pos is negative
+ *   EFAULT  - Invalid user buffer
+ *   ENOSPC  - No free space remaining on the filesystem
+ *   EIO     - Hardware I/O error
+ */
+int sys_pwrite(int fd, userptr_t buf, size_t buflen, off_t pos,
+               int32_t *retval)
+{
+    struct iovec iov;
+    struct uio uuio;
 
-    /* ALLOCATING KERNEL BUFFER */
-    char *kbuffer = (char *)kmalloc(buflen);
-    if (kbuffer == NULL)
-        return ENOMEM;
+    uio_uinit(&iov, &uuio, buf, buflen, pos, UIO_WRITE);
+    return file_rw(fd, &uuio, true, retval);
+}
 
-    /* COPYING DATA FROM USER SPACE TO KERNEL SPACE */
-    int err = copyin((const_userptr_t)buf, kbuffer, buflen);
-    if (err)
+/*
+ * sys_readv - Read from a file descriptor into several buffers
+ *
+ *   Fills the iovcnt buffers described by iov in order, as one read
+ *   at the file's offset.
+ *
+ * Arguments:
+ *   fd      - File descriptor to read from
+ *   iov     - User array of struct iovec
+ *   iovcnt  - Number of entries, at most IOV_MAX
+ *   retval  - Pointer to store the number of bytes actually read
+ *
+ * Returns:
+ *   0 on success
+ *   EBADF   - fd is invalid, not open, or opened as write-only
+ *   EINVAL  - iovcnt out of range, or the lengths total over 2GB
+ *   EFAULT  - Invalid iov array or buffer
+ *   ENOMEM  - Out of memory
+ *   EIO     - Hardware I/O error
+ */
+int sys_readv(int fd, userptr_t iov, int iovcnt, int32_t *retval)
+{
+    return file_rwv(fd, iov, iovcnt, UIO_READ, retval);
+}
+
+/*
+ * sys_writev - Write to a file descriptor from several buffers
+ *
+ *   Writes out the iovcnt buffers described by iov in order, as one
+ *   write at the file's offset.
+ *
+ * Arguments:
+ *   fd      - File descriptor to write to
+ *   iov     - User array of struct iovec
+ *   iovcnt  - Number of entries, at most IOV_MAX
+ *   retval  - Pointer to store the number of bytes actually written
+ *
+ * Returns:
+ *   0 on success
+ *   EBADF   - fd is invalid, not open, or opened as read-only
+ *   EINVAL  - iovcnt out of range, or the lengths total over 2GB
+ *   EFAULT  - Invalid iov array or buffer
+ *   ENOMEM  - Out of memory
+ *   ENOSPC  - No free space remaining on the filesystem
+ *   EIO     - Hardware I/O error
+ */
+int sys_writev(int fd, userptr_t iov, int iovcnt, int32_t *retval)
+{
+    return file_rwv(fd, iov, iovcnt, UIO_WRITE, retval);
+}
+
+/*
+ * file_getdir - Common code for sys_getdirentries_plus and sys_getdents
+ */
+static int file_getdir(int fd, userptr_t buf, size_t buflen, bool plus,
+                       int32_t *retval)
+{
+    struct iovec iov;
+    struct uio uuio;
+    int result;
+
+    struct openfile *of = filetable_get(curproc, fd);
+    if (of == NULL)
+        return EBADF;
+    if ((of->mode & O_ACCMODE) == O_WRONLY)
     {
-        kfree(kbuffer);
-        return EFAULT;
+        openfile_decref(of);
+        return EBADF;
     }
 
-    /* WRITING DATA TO FILE */
+    /* SAME OFFSET AS READ AND LSEEK; ITS MEANING IS UP TO THE FS */
+    lock_acquire(of->lock);
+    uio_uinit(&iov, &uuio, buf, buflen, of->offset, UIO_READ);
+    if (plus)
+        result = VOP_GETDIRPLUS(of->vn, &uuio);
+    else
+        result = VOP_GETDENTS(of->vn, &uuio);
+    if (!result)
+    {
+        of->offset = uuio.uio_offset;
+        *retval = (int32_t)(buflen - uuio.uio_resid);
+    }
+    lock_release(of->lock);
+
+    openfile_decref(of);
+    return result;
+}
+
+/*
+ * sys_getdirentries_plus - List a directory with stat information
+ *
+ *   Fills buf with as many struct dirent_plus records (kern/dirent.h)
+ *   as fit, each giving a name in the directory and what stat would
+ *   say about it, starting at the open directory's offset and moving
+ *   it past them. This saves ls -l a stat call per name, and lets the
+ *   file system fetch the inodes for the whole batch at once.
+ *
+ * Arguments:
+ *   fd      - File descriptor of a directory open for reading
+ *   buf     - User buffer to fill
+ *   buflen  - Size of the buffer
+ *   retval  - Pointer to store the number of bytes filled; 0 at the end
+ *
+ * Returns:
+ *   0 on success
+ *   EBADF   - fd is invalid, not open, or opened as write-only
+ *   ENOTDIR - fd is not a directory
+ *   EINVAL  - buflen is too small for the next record
+ *   ENOSYS  - The file system doesn't support it
+ *   EFAULT  - Invalid user buffer
+ *   EIO     - Hardware I/O error
+ */
+int sys_getdirentries_plus(int fd, userptr_t buf, size_t buflen,
+                           int32_t *retval)
+{
+    return file_getdir(fd, buf, buflen, true, retval);
+}
+
+/*
+ * sys_getdents - List a directory
+ *
+ *   Fills buf with as many struct dirent records (kern/dirent.h) as
+ *   fit, each giving a name in the directory, starting at the open
+ *   directory's offset and moving it past them. Each record's d_off
+ *   is the offset to lseek to to carry on after it. One call lists a
+ *   whole directory block or more, where getdirentry takes a call per
+ *   name.
+ *
+ * Arguments:
+ *   fd      - File descriptor of a directory open for reading
+ *   buf     - User buffer to fill
+ *   buflen  - Size of the buffer
+ *   retval  - Pointer to store the number of bytes filled; 0 at the end
+ *
+ * Returns:
+ *   0 on success
+ *   EBADF   - fd is invalid, not open, or opened as write-only
+ *   ENOTDIR - fd is not a directory
+ *   EINVAL  - buflen is too small for the next record
+ *   EFAULT  - Invalid user buffer
+ *   EIO     - Hardware I/O error
+ */
+int sys_getdents(int fd, userptr_t buf, size_t buflen, int32_t *retval)
+{
+    return file_getdir(fd, buf, buflen, false, retval);
+}
+
+/* Bytes copyfile and sendfile move per read/write pair */
+#define FILE_COPYCHUNK  (4 * PAGE_SIZE)
+
+/*
+ * file_isreg - Check that an open file is a regular file
+ */
+static bool file_isreg(struct openfile *of)
+{
+    mode_t type;
+
+    if (VOP_GETTYPE(of->vn, &type))
+        return false;
+    return (type & S_IFMT) == S_IFREG;
+}
+
+/*
+ * file_transfer - Move data from one open file to another
+ *
+ *   Reads up to len bytes from the regular file from at *pos and
+ *   writes them to to at its offset, through a kernel buffer a chunk
+ *   at a time, moving *pos and to's offset past what was moved. The
+ *   caller holds to's lock, and from's too if pos is its offset.
+ *
+ * Arguments:
+ *   from    - Open file to read
+ *   pos     - Where to read from it; updated
+ *   to      - Open file to write
+ *   len     - Most bytes to move
+ *   done    - Pointer to store the number of bytes moved
+ *
+ * Returns:
+ *   0 on success, including when an error stops the transfer after
+ *     some bytes were moved
+ *   ENOMEM  - Out of memory
+ *   Other error codes from VOP_READ / VOP_WRITE
+ */
+static int file_transfer(struct openfile *from, off_t *pos,
+                         struct openfile *to, size_t len, size_t *done)
+{
     struct iovec iov;
     struct uio kuio;
-    struct vnode *vn = of->vn;
+    size_t chunk, got, wrote;
+    char *buf;
+    int result = 0;
 
-    lock_acquire(of->lock);
+    KASSERT(lock_do_i_hold(to->lock));
 
-    uio_kinit(&iov, &kuio, kbuffer, buflen, of->offset, UIO_WRITE);
-    err = VOP_WRITE(vn, &kuio);
+    buf = kmalloc(FILE_COPYCHUNK);
+    if (buf == NULL)
+        return ENOMEM;
 
-    /* NO FREE SPACE REMAINING ON THE FILESYSTEM */
-    if (err == ENOSPC)
+    *done = 0;
+    while (*done < len)
     {
-        lock_release(of->lock);
-        kfree(kbuffer);
-        return ENOSPC;
+        chunk = len - *done < FILE_COPYCHUNK ? len - *done : FILE_COPYCHUNK;
+
+        uio_kinit(&iov, &kuio, buf, chunk, *pos, UIO_READ);
+        kuio.uio_direct = (from->mode & O_DIRECT) != 0;
+        result = VOP_READ(from->vn, &kuio);
+        if (result)
+            break;
+        got = chunk - kuio.uio_resid;
+        if (got == 0)
+            break; /* END OF FILE */
+
+        uio_kinit(&iov, &kuio, buf, got, to->offset, UIO_WRITE);
+        kuio.uio_append = (to->mode & O_APPEND) != 0;
+        kuio.uio_direct = (to->mode & O_DIRECT) != 0;
+        result = VOP_WRITE(to->vn, &kuio);
+        wrote = got - kuio.uio_resid;
+        to->offset = kuio.uio_offset;
+        *pos += wrote;
+        *done += wrote;
+        /* WHAT WASN'T WRITTEN IS LEFT UNREAD, SO A RETRY RESUMES THERE */
+        if (result || wrote < got)
+            break;
     }
-    /* HARDWARE I/O ERROR OCCURRED */
-    if (err == EIO)
+
+    kfree(buf);
+
+    /* A PARTIAL TRANSFER SUCCEEDS; THE ERROR SHOWS ON THE NEXT CALL */
+    if (*done > 0)
+        result = 0;
+    return result;
+}
+
+/*
+ * sys_copyfile - Copy data from one file to another inside the kernel
+ *
+ *   Reads up to len bytes at fromfd's offset and writes them at tofd's
+ *   offset, moving both offsets past what was copied. The data goes
+ *   through a kernel buffer a chunk at a time, so a copy costs one
+ *   system call rather than a read and a write per user buffer, and
+ *   never crosses to user space.
+ *
+ *   Both offsets are held for the whole call, like one big read and
+ *   one big write. The two openfile locks are taken in address order
+ *   so that copies in opposite directions can't deadlock.
+ *
+ * Arguments:
+ *   fromfd  - File descriptor to copy from, open for reading
+ *   tofd    - File descriptor to copy to, open for writing
+ *   len     - Most bytes to copy
+ *   retval  - Pointer to store the number of bytes copied; 0 at the
+ *             end of fromfd
+ *
+ * Returns:
+ *   0 on success, including when an error stops the copy after
+ *     some bytes were copied
+ *   EBADF   - Either fd is invalid or not open in the right mode
+ *   EINVAL  - Either file isn't a regular file, or both are the same
+ *             file
+ *   ENOMEM  - Out of memory
+ *   ENOSPC  - No free space remaining on the filesystem
+ *   EIO     - Hardware I/O error
+ */
+int sys_copyfile(int fromfd, int tofd, size_t len, int32_t *retval)
+{
+    struct openfile *from, *to;
+    struct lock *first, *second;
+    size_t done;
+    int result = 0;
+
+    if (len > FILE_RWMAX)
+        len = FILE_RWMAX;
+
+    from = filetable_get(curproc, fromfd);
+    if (from == NULL)
+        return EBADF;
+    to = filetable_get(curproc, tofd);
+    if (to == NULL)
     {
-        lock_release(of->lock);
-        kfree(kbuffer);
-        return EIO; 
+        openfile_decref(from);
+        return EBADF;
     }
-    if (err)
+
+    if ((from->mode & O_ACCMODE) == O_WRONLY ||
+        (to->mode & O_ACCMODE) == O_RDONLY)
+        result = EBADF;
+    else if (from->vn == to->vn || !file_isreg(from) || !file_isreg(to))
+        result = EINVAL;
+    if (result)
     {
-        lock_release(of->lock);
-        kfree(kbuffer);
-        return err; /* ERROR DURING FILE WRITE */
+        openfile_decref(to);
+        openfile_decref(from);
+        return result;
     }
 
-    /* UPDATING OFFSET AND RETURN VALUE */
-    off_t nbytes = kuio.uio_offset - of->offset;
-    *retval = (int32_t)nbytes;
-    of->offset = kuio.uio_offset;
+    /* THE VNODES DIFFER, SO THE OPENFILES AND THEIR LOCKS DO TOO */
+    first = from->lock < to->lock ? from->lock : to->lock;
+    second = from->lock < to->lock ? to->lock : from->lock;
+    lock_acquire(first);
+    lock_acquire(second);
+    result = file_transfer(from, &from->offset, to, len, &done);
+    lock_release(second);
+    lock_release(first);
 
-    /* RELEASE LOCK AND FREE KERNEL BUFFER */
-    lock_release(of->lock);
-    kfree(kbuffer);
+    openfile_decref(to);
+    openfile_decref(from);
+
+    if (!result)
+        *retval = (int32_t)done;
+    return result;
+}
+
+/*
+ * sys_sendfile - Send data from a file to any open file
+ *
+ *   Reads up to len bytes from the regular file infd and writes them
+ *   to outfd, which may be anything open for writing: a file, the
+ *   console, a pipe, or a socket. The data never goes through user
+ *   memory. If offset is NULL, reading starts at infd's offset and
+ *   moves it; otherwise it starts at *offset, which is updated, and
+ *   infd's offset is left alone, so several threads can send from one
+ *   file at once.
+ *
+ * Arguments:
+ *   outfd   - File descriptor to write to
+ *   infd    - File descriptor to read from; must be a regular file
+ *   offset  - User pointer to an off_t to read at, or NULL
+ *   len     - Most bytes to send
+ *   retval  - Pointer to store the number of bytes sent; 0 at the
+ *             end of infd
+ *
+ * Returns:
+ *   0 on success, including when an error stops the transfer after
+ *     some bytes were sent
+ *   EBADF   - Either fd is invalid or not open in the right mode
+ *   EINVAL  - infd isn't a regular file, both are the same file, or
+ *             *offset is negative
+ *   EFAULT  - Invalid offset pointer
+ *   ENOMEM  - Out of memory
+ *   EPIPE   - outfd is a pipe or socket with nobody reading
+ *   EIO     - Hardware I/O error
+ */
+int sys_sendfile(int outfd, int infd, userptr_t offset, size_t len,
+                 int32_t *retval)
+{
+    struct openfile *in, *out;
+    struct lock *first, *second;
+    off_t pos;
+    size_t done;
+    int result = 0;
+
+    if (len > FILE_RWMAX)
+        len = FILE_RWMAX;
+
+    out = filetable_get(curproc, outfd);
+    if (out == NULL)
+        return EBADF;
+    in = filetable_get(curproc, infd);
+    if (in == NULL)
+    {
+        openfile_decref(out);
+        return EBADF;
+    }
+
+    if ((in->mode & O_ACCMODE) == O_WRONLY ||
+        (out->mode & O_ACCMODE) == O_RDONLY)
+        result = EBADF;
+    else if (in->vn == out->vn || !file_isreg(in))
+        result = EINVAL;
+    else if (offset != NULL)
+    {
+        result = copyin(offset, &pos, sizeof(pos));
+        if (!result && pos < 0)
+            result = EINVAL;
+    }
+    if (result)
+    {
+        openfile_decref(in);
+        openfile_decref(out);
+        return result;
+    }
+
+    if (offset != NULL)
+    {
+        /* POSITIONAL ON THE INPUT SIDE: ONLY THE OUTPUT'S OFFSET MOVES */
+        lock_acquire(out->lock);
+        result = file_transfer(in, &pos, out, len, &done);
+        lock_release(out->lock);
+        if (!result)
+            result = copyout(&pos, offset, sizeof(pos));
+    }
+    else
+    {
+        first = in->lock < out->lock ? in->lock : out->lock;
+        second = in->lock < out->lock ? out->lock : in->lock;
+        lock_acquire(first);
+        lock_acquire(second);
+        result = file_transfer(in, &in->offset, out, len, &done);
+        lock_release(second);
+        lock_release(first);
+    }
+
+    openfile_decref(in);
+    openfile_decref(out);
+
+    if (!result)
+        *retval = (int32_t)done;
+    return result;
+}
+
+/*
+ * sys_fadvise - Tell the file system how a file is going to be used
+ *
+ *   Passes the advice on to the file's vnode, whose file system can
+ *   use it to steer read-ahead and caching:
+ *
+ *     FADV_SEQUENTIAL - read ahead as far as it will from the start
+ *     FADV_RANDOM     - don't read ahead at all (say, for a file read
+ *                       backwards or by lookup)
+ *     FADV_NOREUSE    - data is used once, so cache it only briefly
+ *                       and don't push other files' data out for it
+ *     FADV_NORMAL     - undo all of those and go back to guessing
+ *                       from the reads themselves
+ *     FADV_WILLNEED   - start reading the range in now
+ *     FADV_DONTNEED   - the range is done with; its cached data goes
+ *                       first when room is needed
+ *
+ *   The first four are about the whole file whatever the range, and
+ *   last until changed or until the file is no longer in use; they
+ *   belong to the file, not to this descriptor. The last two act on
+ *   the range once. It is all only a hint: a file system with no
+ *   cache to steer, or anything but a regular file, ignores it.
+ *
+ * Arguments:
+ *   fd      - File descriptor of the file
+ *   offset  - Start of the range
+ *   len     - Length of the range; 0 means to the end of the file
+ *   advice  - FADV_*
+ *
+ * Returns:
+ *   0 on success
+ *   EBADF   - fd is invalid
+ *   EINVAL  - Unknown advice, or negative offset or len
+ *   ESPIPE  - fd is a pipe, socket, or other unseekable object
+ */
+int sys_fadvise(int fd, off_t offset, off_t len, int advice)
+{
+    struct openfile *of;
+    struct vnode_advice va;
+    int result = 0;
+
+    if (advice < FADV_NORMAL || advice > FADV_NOREUSE ||
+        offset < 0 || len < 0)
+        return EINVAL;
+
+    of = filetable_get(curproc, fd);
+    if (of == NULL)
+        return EBADF;
+
+    if (!VOP_ISSEEKABLE(of->vn))
+        result = ESPIPE;
+    else if (file_isreg(of))
+    {
+        /* ONLY FILES: A DEVICE MIGHT MEAN SOMETHING ELSE BY THE CODE */
+        va.va_offset = offset;
+        va.va_len = len;
+        va.va_advice = advice;
+        result = VOP_IOCTL(of->vn, FIOADVISE, (userptr_t)&va);
+        /* NOTHING TO ADVISE ON THIS FILE SYSTEM */
+        if (result == EINVAL)
+            result = 0;
+    }
+
+    openfile_decref(of);
+    return result;
+}
 
+/*
+ * file_fsync - Common code for sys_fsync and sys_fdatasync
+ *
+ *   Only the one file is written, not the rest of the cache (compare
+ *   sync). Objects with nothing to write, such as pipes, succeed.
+ */
+static int file_fsync(int fd)
+{
+    struct openfile *of;
+    int result;
+
+    of = filetable_get(curproc, fd);
+    if (of == NULL)
+        return EBADF;
+
+    result = VOP_FSYNC(of->vn);
+
+    openfile_decref(of);
+    return result;
+}
+
+/*
+ * sys_fallocate - Allocate space for part of a file
+ *
+ *   Makes sure the len bytes from offset have space on disk, so that
+ *   writing them later can't fail for want of it and, on SFS, lands
+ *   in one contiguous run where the free space allows. The file grows
+ *   to cover the range if it is shorter, reading as zeros; data
+ *   already there is untouched. A file system that doesn't allocate
+ *   ahead of writing just has the size set.
+ *
+ * Arguments:
+ *   fd      - File descriptor of the file, open for writing
+ *   offset  - Start of the range
+ *   len     - Length of the range
+ *
+ * Returns:
+ *   0 on success
+ *   EBADF   - fd is invalid or not open for writing
+ *   EINVAL  - offset negative or len not positive
+ *   EFBIG   - The range goes past the largest possible file
+ *   ENODEV  - fd is not a regular file
+ *   ESPIPE  - fd is a pipe or other unseekable object
+ *   ENOSPC  - Not enough free space
+ */
+int sys_fallocate(int fd, off_t offset, off_t len)
+{
+    struct openfile *of;
+    struct vnode_range vr;
+    struct stat statbuf;
+    int result;
+
+    if (offset < 0 || len <= 0)
+        return EINVAL;
+    /* OFFSET + LEN MUST NOT WRAP */
+    if (len > (off_t)0x7fffffffffffffffLL - offset)
+        return EFBIG;
+
+    of = filetable_get(curproc, fd);
+    if (of == NULL)
+        return EBADF;
+
+    if ((of->mode & O_ACCMODE) == O_RDONLY)
+        result = EBADF;
+    else if (!VOP_ISSEEKABLE(of->vn))
+        result = ESPIPE;
+    else if (!file_isreg(of))
+        result = ENODEV;
+    else {
+        vr.vr_offset = offset;
+        vr.vr_len = len;
+        result = VOP_IOCTL(of->vn, FIOALLOCATE, (userptr_t)&vr);
+        if (result == EINVAL) {
+            /* NOTHING TO ALLOCATE ON THIS FILE SYSTEM */
+            result = VOP_STAT(of->vn, &statbuf);
+            if (!result && offset + len > statbuf.st_size)
+                result = VOP_TRUNCATE(of->vn, offset + len);
+        }
+    }
+
+    openfile_decref(of);
+    return result;
+}
+
+/*
+ * file_lockrange - Make a struct flock's range absolute, for fcntl
+ *
+ *   Resolves l_whence against the file's offset or size and turns a
+ *   negative l_len (the bytes before l_start) around, so the range
+ *   goes to the vnode as l_start, l_len >= 0 from SEEK_SET.
+ *
+ * Returns:
+ *   0 on success
+ *   EINVAL  - Bad l_whence, or the range starts before the file
+ *   EFBIG   - The range goes past the largest possible file
+ */
+static int file_lockrange(struct openfile *of, struct flock *fl)
+{
+    struct stat statbuf;
+    off_t base;
+    int result;
+
+    switch (fl->l_whence)
+    {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        lock_acquire(of->lock);
+        base = of->offset;
+        lock_release(of->lock);
+        break;
+    case SEEK_END:
+        result = VOP_STAT(of->vn, &statbuf);
+        if (result)
+            return result;
+        base = statbuf.st_size;
+        break;
+    default:
+        return EINVAL;
+    }
+
+    if (fl->l_start > (off_t)0x7fffffffffffffffLL - base)
+        return EFBIG;
+    fl->l_start += base;
+    if (fl->l_len < 0)
+    {
+        fl->l_start += fl->l_len;
+        fl->l_len = -fl->l_len;
+    }
+    if (fl->l_start < 0)
+        return EINVAL;
+    fl->l_whence = SEEK_SET;
     return 0;
 }
 
 /*
- * sys_read - Read data from a file descriptor
+ * sys_fcntl - File control: byte-range advisory locks
+ *
+ *   F_GETLK reports the first lock that would stop the caller taking
+ *   the lock described in arg, or sets its l_type to F_UNLCK if none
+ *   would. F_SETLK takes (F_RDLCK, F_WRLCK) or drops (F_UNLCK) the
+ *   caller's lock on the range, failing if another process holds a
+ *   conflicting one; F_SETLKW waits for it instead. The locks are
+ *   advisory: only other fcntl calls take any notice of them. They
+ *   belong to the process and go when it closes any descriptor for
+ *   the file, or exits. See vfsflock.c.
+ *
+ * Arguments:
+ *   fd      - File descriptor of the file
+ *   cmd     - F_GETLK, F_SETLK, or F_SETLKW
+ *   arg     - User pointer to a struct flock
+ *   retval  - Set to 0
+ *
+ * Returns:
+ *   0 on success
+ *   EBADF   - fd is invalid, or not open for reading for F_RDLCK or
+ *             for writing for F_WRLCK
+ *   EINVAL  - Unsupported cmd, bad l_type or l_whence, or a range
+ *             starting before the file
+ *   EFAULT  - Invalid arg pointer
+ *   EAGAIN  - F_SETLK, and another process holds a conflicting lock
+ *   ENOMEM  - Out of memory
+ */
+int sys_fcntl(int fd, int cmd, userptr_t arg, int32_t *retval)
+{
+    struct openfile *of;
+    struct flock fl;
+    int result;
+
+    *retval = 0;
+    if (cmd != F_GETLK && cmd != F_SETLK && cmd != F_SETLKW)
+        return EINVAL;
+
+    of = filetable_get(curproc, fd);
+    if (of == NULL)
+        return EBADF;
+
+    result = copyin(arg, &fl, sizeof(fl));
+    if (result)
+        goto out;
+    result = file_lockrange(of, &fl);
+    if (result)
+        goto out;
+
+    if (cmd == F_GETLK)
+    {
+        if (fl.l_type != F_RDLCK && fl.l_type != F_WRLCK)
+        {
+            result = EINVAL;
+            goto out;
+        }
+        result = vnode_getlk(of->vn, curproc->p_pid, &fl);
+        if (!result)
+            result = copyout(&fl, arg, sizeof(fl));
+        goto out;
+    }
+
+    switch (fl.l_type)
+    {
+    case F_RDLCK:
+        if ((of->mode & O_ACCMODE) == O_WRONLY)
+            result = EBADF;
+        break;
+    case F_WRLCK:
+        if ((of->mode & O_ACCMODE) == O_RDONLY)
+            result = EBADF;
+        break;
+    case F_UNLCK:
+        break;
+    default:
+        result = EINVAL;
+        break;
+    }
+    if (result)
+        goto out;
+
+    /* BEFORE TAKING ANY, SO THAT EXIT KNOWS TO LOOK */
+    if (fl.l_type != F_UNLCK)
+        curproc->p_flocks = true;
+    result = vnode_setlk(of->vn, curproc->p_pid, &fl, cmd == F_SETLKW);
+
+out:
+    openfile_decref(of);
+    return result;
+}
+
+/*
+ * sys_fsync - Write a file's data and metadata to disk
+ *
+ *   Returns once everything written to the file so far, and the
+ *   metadata needed to read it back, is on stable storage.
+ *
+ * Arguments:
+ *   fd      - File descriptor of the file
+ *
+ * Returns:
+ *   0 on success
+ *   EBADF   - fd is invalid
+ *   EIO     - A hardware error occurred writing the data
+ */
+int sys_fsync(int fd)
+{
+    return file_fsync(fd);
+}
+
+/*
+ * sys_fdatasync - Write a file's data to disk
  *
- *   Reads up to buflen bytes from the file referenced by the file 
- *   descriptor fd into the buffer buf. The file must be open for reading.
+ *   Like sys_fsync, but metadata not needed to read the data back
+ *   (such as timestamps) may be left in memory. Our file systems keep
+ *   no such metadata in the inode, so this is the same as fsync; it
+ *   exists for programs written to use it.
  *
  * Arguments:
- *   fd      - File descriptor to read from (must be valid and open for reading)
- *   buf     - Pointer to user space buffer to store read data
- *   buflen  - Maximum number of bytes to read into the buffer
- *   retval  - Pointer to store the number of bytes actually read
+ *   fd      - File descriptor of the file
  *
  * Returns:
  *   0 on success
- *   EBADF   - fd is invalid, not open, or opened as write-only
- *   EFAULT  - buf is NULL or invalid user space pointer
- *   ENOMEM  - Insufficient kernel memory to allocate buffer
- *   EIO     - Hardware I/O error occurred during read operation
+ *   EBADF   - fd is invalid
+ *   EIO     - A hardware error occurred writing the data
  */
-ssize_t sys_read(int fd, const void *buf, size_t buflen, int32_t *retval) {
-
-    /* VALIDATE FILE DESCRIPTOR */
-    if (fd < 0 || fd >= OPEN_MAX || curproc->fileTable[fd] == NULL || (curproc->fileTable[fd]->mode & O_ACCMODE) == O_WRONLY) {
-        return EBADF;
-    }
-
-    /* VALIDATE BUFFER */
-    if (buf == NULL) {
-        return EFAULT;
-    }
-
-    /* ALLOCATE KERNEL BUFFER */
-    char *kbuf = kmalloc(buflen);
-    if (kbuf == NULL) {
-        return ENOMEM;
-    }
-
-    /* PREPARE FOR READING */
-    struct openfile *of = curproc->fileTable[fd];
-    struct iovec iov;
-    struct uio kuio;
-    uio_kinit(&iov, &kuio, kbuf, buflen, of->offset, UIO_READ);
+int sys_fdatasync(int fd)
+{
+    return file_fsync(fd);
+}
 
-    /* PERFORM READ OPERATION */
-    lock_acquire(of->lock);
-    int result = VOP_READ(of->vn, &kuio);
-    if (result) {
-        lock_release(of->lock);
-        kfree(kbuf);
+/*
+ * sys_semop - P and V on several semfs semaphores at once
+ *
+ *   Applies each operation to the semaphore open on its fd, all at
+ *   once: if any P can't be satisfied, waits until they all can.
+ *   Unlike read and write on sem: files, there is no uio and the
+ *   openfile locks aren't taken, since semaphores have no offset.
+ *
+ * Arguments:
+ *   ops     - User pointer to an array of struct sembuf
+ *   nops    - How many; at most SEMOP_MAX
+ *
+ * Returns:
+ *   0 on success
+ *   EBADF   - An fd is invalid, or not open for reading (for P) or
+ *             writing (for V)
+ *   EINVAL  - nops is 0 or too big, or an fd isn't a semaphore
+ *   EFAULT  - Invalid ops pointer
+ *   EFBIG   - A V would overflow the count
+ */
+int sys_semop(const_userptr_t ops, unsigned nops)
+{
+    struct sembuf sb[SEMOP_MAX];
+    struct openfile *of[SEMOP_MAX];
+    struct vnode *vns[SEMOP_MAX];
+    int deltas[SEMOP_MAX];
+    unsigned i, got;
+    int wrongmode, result;
+
+    if (nops == 0 || nops > SEMOP_MAX)
+        return EINVAL;
+    result = copyin(ops, sb, nops * sizeof(sb[0]));
+    if (result)
         return result;
-    }
 
-    /* UPDATE OFFSET */
-    of->offset = kuio.uio_offset;
-    *retval = buflen - kuio.uio_resid;
-
-    /* COPY DATA TO USER BUFFER */
-    result = copyout(kbuf, (userptr_t)buf, *retval);
-    if (result) {
-        lock_release(of->lock);
-        kfree(kbuf);
-        return EFAULT;
+    for (got = 0; got < nops; got++)
+    {
+        of[got] = filetable_get(curproc, sb[got].sem_fd);
+        if (of[got] == NULL)
+        {
+            result = EBADF;
+            break;
+        }
+        wrongmode = sb[got].sem_op < 0 ? O_WRONLY : O_RDONLY;
+        if (sb[got].sem_op != 0 && (of[got]->mode & O_ACCMODE) == wrongmode)
+        {
+            openfile_decref(of[got]);
+            result = EBADF;
+            break;
+        }
+        vns[got] = of[got]->vn;
+        deltas[got] = sb[got].sem_op;
     }
 
-    /* CLEAN UP */
-    lock_release(of->lock);
-    kfree(kbuf);
+    if (!result)
+        result = semfs_semop(vns, deltas, nops);
 
-    return 0;
+    for (i = 0; i < got; i++)
+        openfile_decref(of[i]);
+    return result;
 }
 
 /*
@@ -236,6 +1152,7 @@ ssize_t sys_read(int fd, const void *buf, size_t buflen, int32_t *retval) {
  *   0 on success
  *   EFAULT  - filename is NULL or invalid user space pointer
  *   ENOMEM  - Insufficient kernel memory to allocate structures
+ *   ENAMETOOLONG - filename longer than PATH_MAX
  *   EMFILE  - Process has too many open files
  *   EINVAL  - Invalid flags provided
  *   Other error codes from vfs_open as applicable
@@ -246,46 +1163,37 @@ int sys_open(userptr_t filename, int flags, mode_t mode, int *retval)
     if (filename == NULL)
         return EFAULT;
 
-    /* COPYING PATHNAME FROM USER SPACE TO KERNEL SPACE */
-    char *kbuffer = (char *)kmalloc(PATH_MAX * sizeof(char));
-    if (kbuffer == NULL)
-        return ENOMEM;
-
-    size_t len;
-    int err = copyinstr((const_userptr_t)filename, kbuffer, PATH_MAX, &len);
+    /* COPYING PATHNAME INTO A PATH BUFFER */
+    char *kbuffer;
+    int err = copyin_path((const_userptr_t)filename, &kbuffer);
     if (err)
-    {
-        kfree(kbuffer);
-        return EFAULT;
-    }
+        return err;
+
+    err = file_open(kbuffer, flags, mode, retval);
+    pathbuf_put(kbuffer);
+    return err;
+}
+
+/*
+ * file_open - Open a file by kernel path into the current process
+ *
+ *   The work of sys_open, once the path is in the kernel. PATH may be
+ *   changed (by vfs_open).
+ *
+ * Returns:
+ *   As for sys_open, less EFAULT
+ */
+int file_open(char *path, int flags, mode_t mode, int *retval)
+{
+    int err;
 
     /* OPENING FILE */
     struct vnode *v;
-    err = vfs_open(kbuffer, flags, mode, &v);
+    err = vfs_open(path, flags, mode, &v);
     if (err)
     {
-        kfree(kbuffer);
         return err;
     }
-    kfree(kbuffer);
-
-    /* FIND A FREE FILE DESCRIPTOR (starting from 3, since 0-2 are std streams) */
-    int fd = -1;
-    for (int i = 3; i < OPEN_MAX; i++)
-    {
-        if (curproc->fileTable[i] == NULL)
-        {
-            fd = i;
-            break;
-        }
-    }
-
-    /* CHECK IF FILE TABLE IS FULL */
-    if (fd == -1)
-    {
-        vfs_close(v);
-        return EMFILE; /* TOO MANY OPEN FILES IN PROCESS */
-    }
 
     /* CREATE NEW OPENFILE STRUCTURE */
     struct openfile *of = (struct openfile *)kmalloc(sizeof(struct openfile));
@@ -297,12 +1205,14 @@ int sys_open(userptr_t filename, int flags, mode_t mode, int *retval)
 
     /* INITIALIZE THE OPENFILE STRUCTURE */
     of->vn = v;
+    spinlock_init(&of->reflock);
     of->count = 1;
 
     /* CREATE LOCK FOR THIS FILE */
     of->lock = lock_create("FILE_LOCK");
     if (of->lock == NULL)
     {
+        spinlock_cleanup(&of->reflock);
         vfs_close(v);
         kfree(of);
         return ENOMEM;
@@ -322,10 +1232,13 @@ int sys_open(userptr_t filename, int flags, mode_t mode, int *retval)
         break;
     default:
         lock_destroy(of->lock);
+        spinlock_cleanup(&of->reflock);
         vfs_close(v);
         kfree(of);
         return EINVAL;
     }
+    /* O_APPEND AND O_DIRECT APPLY TO EVERY READ OR WRITE THROUGH THIS OPEN */
+    of->mode |= flags & (O_APPEND | O_DIRECT);
 
     /* SET OFFSET BASED ON FLAGS */
     if (flags & O_APPEND)
@@ -336,6 +1249,7 @@ int sys_open(userptr_t filename, int flags, mode_t mode, int *retval)
         if (err)
         {
             lock_destroy(of->lock);
+            spinlock_cleanup(&of->reflock);
             vfs_close(v);
             kfree(of);
             return err;
@@ -348,11 +1262,18 @@ int sys_open(userptr_t filename, int flags, mode_t mode, int *retval)
         of->offset = 0;
     }
 
-    /* ADD TO PROCESS FILE TABLE */
-    curproc->fileTable[fd] = of;
+    /* ADD TO PROCESS FILE TABLE (starting from 3, since 0-2 are std streams) */
+    err = filetable_add(curproc, of, 3, retval);
+    if (err)
+    {
+        /* EMFILE: TOO MANY OPEN FILES IN PROCESS */
+        lock_destroy(of->lock);
+        spinlock_cleanup(&of->reflock);
+        vfs_close(v);
+        kfree(of);
+        return err;
+    }
 
-    /* RETURN FILE DESCRIPTOR */
-    *retval = fd;
     return 0;
 }
 
@@ -372,36 +1293,22 @@ int sys_open(userptr_t filename, int flags, mode_t mode, int *retval)
  */
 int sys_close(int fd)
 {
-    /* CHECK IF THE FILE DESCRIPTOR IS VALID */
-    if (fd < 0 || fd >= OPEN_MAX)
-        return EBADF;
+    /* REMOVE THE FILE DESCRIPTOR FROM THE PROCESS'S FILE TABLE */
+    struct openfile *of;
+    int err = filetable_set(curproc, fd, NULL, &of);
+    if (err)
+        return err;
 
-    /* CHECK IF THE FILE DESCRIPTOR IS IN USE */
-    if (curproc->fileTable[fd] == NULL)
+    /* CHECK IF THE FILE DESCRIPTOR WAS IN USE */
+    if (of == NULL)
         return EBADF;
 
-    /* RETRIEVE THE OPEN FILE STRUCTURE */
-    struct openfile *of = curproc->fileTable[fd];
-    lock_acquire(of->lock);
-
-    /* REMOVE THE FILE DESCRIPTOR FROM THE PROCESS'S FILE TABLE */
-    curproc->fileTable[fd] = NULL;
-
-    /* DECREMENT THE REFERENCE COUNT */
-    if (--of->count == 0)
-    {
-        /* IF NO MORE REFERENCES, CLOSE THE VNODE */
-        struct vnode *vn = of->vn;
-        of->vn = NULL;
-        vfs_close(vn);
-        
-        lock_release(of->lock);
-        lock_destroy(of->lock);
-        kfree(of);
-        return 0;
-    }
+    /* CLOSING ANY DESCRIPTOR FOR A FILE DROPS OUR fcntl LOCKS ON IT */
+    if (curproc->p_flocks)
+        vnode_unlockall(of->vn, curproc->p_pid);
 
-    lock_release(of->lock);
+    /* DROP ITS REFERENCE, CLOSING THE VNODE WITH THE LAST ONE */
+    openfile_decref(of);
     return 0;
 }
 
@@ -414,31 +1321,26 @@ int sys_close(int fd)
  * Arguments:
  *   fd      - File descriptor of the open file
  *   pos     - Offset to set
- *   whence  - Directive for setting the offset (SEEK_SET, SEEK_CUR, SEEK_END)
+ *   whence  - Directive for setting the offset (SEEK_SET, SEEK_CUR, SEEK_END,
+ *             SEEK_DATA, SEEK_HOLE)
  *   retval  - Pointer to store the new file offset
  *
+ *   SEEK_DATA and SEEK_HOLE go to the first byte at or after pos that
+ *   is data, or in a hole, as the file system's block map has it; the
+ *   end of the file counts as a hole. On a file system that doesn't
+ *   keep holes the whole file is data.
+ *
  * Returns:
  *   0 on success
  *   EBADF   - fd is invalid or not open
  *   ESPIPE  - fd refers to a pipe, socket, or FIFO
  *   EINVAL  - Invalid whence value or resulting offset is negative
+ *   ENXIO   - SEEK_DATA or SEEK_HOLE from the end of the file or past
+ *             it, or SEEK_DATA with no data after pos
  *   Other error codes from VOP_STAT as applicable
  */
-int sys_lseek(int fd, off_t pos, int whence, int32_t *retval_low, int32_t *retval_high){
-
-    /* Validate process */
-    KASSERT(curproc != NULL);
-
-    /* Validate file descriptor */
-    if (fd < 0 || fd >= OPEN_MAX) {
-        return EBADF;
-    }
-
-    /* Get openfile structure */
-    struct openfile *of = curproc->fileTable[fd];
-    if (of == NULL) {
-        return EBADF;
-    }
+static int file_lseek(struct openfile *of, off_t pos, int whence,
+                      int32_t *retval_low, int32_t *retval_high){
 
     /* Check if file is seekable */
     if (!VOP_ISSEEKABLE(of->vn)){
@@ -487,7 +1389,33 @@ int sys_lseek(int fd, off_t pos, int whence, int32_t *retval_low, int32_t *retva
                 lock_release(of->lock);
                 return EINVAL;
             }
-            new_offset = statbuf.st_size - pos;
+            new_offset = statbuf.st_size + pos;
+            break;
+
+        case SEEK_DATA:
+        case SEEK_HOLE:
+            if (pos < 0) {
+                lock_release(of->lock);
+                return EINVAL;
+            }
+            new_offset = pos;
+            result = EINVAL;
+            if (file_isreg(of))
+                result = VOP_IOCTL(of->vn, whence == SEEK_DATA ?
+                                   FIOSEEKDATA : FIOSEEKHOLE,
+                                   (userptr_t)&new_offset);
+            if (result == EINVAL) {
+                /* NO HOLES HERE: ALL DATA UP TO THE END */
+                result = VOP_STAT(of->vn, &statbuf);
+                if (!result && pos >= statbuf.st_size)
+                    result = ENXIO;
+                else if (!result && whence == SEEK_HOLE)
+                    new_offset = statbuf.st_size;
+            }
+            if (result) {
+                lock_release(of->lock);
+                return result;
+            }
             break;
 
         default:
@@ -516,6 +1444,22 @@ int sys_lseek(int fd, off_t pos, int whence, int32_t *retval_low, int32_t *retva
 
 }
 
+int sys_lseek(int fd, off_t pos, int whence, int32_t *retval_low, int32_t *retval_high){
+
+    /* Validate process */
+    KASSERT(curproc != NULL);
+
+    /* Get openfile structure */
+    struct openfile *of = filetable_get(curproc, fd);
+    if (of == NULL) {
+        return EBADF;
+    }
+
+    int result = file_lseek(of, pos, whence, retval_low, retval_high);
+    openfile_decref(of);
+    return result;
+}
+
 /*
  * sys_dup2 - Duplicate a file descriptor
  *
@@ -535,51 +1479,201 @@ int sys_lseek(int fd, off_t pos, int whence, int32_t *retval_low, int32_t *retva
 int sys_dup2(int oldfd, int newfd, int32_t *retval)
 {
     /* check validity of oldfd and newfd */
-    if (oldfd < 0 || oldfd >= OPEN_MAX || newfd < 0 || newfd >= OPEN_MAX)
+    if (newfd < 0 || newfd >= OPEN_MAX)
         return EBADF;
 
-    /* check if oldfd is open */
-    if (curproc->fileTable[oldfd] == NULL)
+    /* check if oldfd is open; this gets a reference for newfd */
+    struct openfile *of = filetable_get(curproc, oldfd);
+    if (of == NULL)
         return EBADF;
 
     /* special case:if oldfd is the same as newfd, do nothing */
     if (oldfd == newfd)
     {
+        openfile_decref(of);
         *retval = newfd;
         return 0;
     }
 
-    /* special case: newfd is already open, close it before reusing it */
-    if (curproc->fileTable[newfd] != NULL)
+    /* duplicate the fd: point newfd to the same file object as oldfd */
+    struct openfile *prev;
+    int err = filetable_set(curproc, newfd, of, &prev);
+    if (err)
     {
-        struct openfile *of = curproc->fileTable[newfd];
-        lock_acquire(of->lock);
-        curproc->fileTable[newfd] = NULL;
-        if (--of->count == 0)
-        {
-            struct vnode *vn = of->vn;
-            of->vn = NULL;
-            vfs_close(vn);
-            /* ADD THESE LINES: */
-            lock_release(of->lock);
-            lock_destroy(of->lock);
-            kfree(of);
-        } else {
-            lock_release(of->lock);
-        }
+        openfile_decref(of);
+        return err;
     }
 
-    /* duplicate the fd: point newfd to the same file object as oldfd
-    increase the reference count for the file object */
-    lock_acquire(curproc->fileTable[oldfd]->lock);
-    curproc->fileTable[newfd] = curproc->fileTable[oldfd];
-    curproc->fileTable[newfd]->count++;
-    lock_release(curproc->fileTable[oldfd]->lock);
+    /* special case: newfd was already open, close it */
+    if (prev != NULL)
+    {
+        /* as in sys_close */
+        if (curproc->p_flocks)
+            vnode_unlockall(prev->vn, curproc->p_pid);
+        openfile_decref(prev);
+    }
 
     *retval = newfd;
     return 0;
 }
 
+/*
+ * openfile_create - Wrap an unnamed vnode in an openfile
+ *
+ *   For vnodes that don't come from vfs_open: the ends of a pipe,
+ *   and sockets.
+ *
+ * Arguments:
+ *   vn      - The vnode; its reference passes to the openfile on success
+ *   mode    - O_RDONLY, O_WRONLY or O_RDWR
+ *   ret     - Where to put the openfile
+ *
+ * Returns:
+ *   0 on success
+ *   ENOMEM  - Out of kernel memory
+ */
+int openfile_create(struct vnode *vn, int mode, struct openfile **ret)
+{
+    struct openfile *of = kmalloc(sizeof(struct openfile));
+    if (of == NULL)
+        return ENOMEM;
+
+    of->lock = lock_create("FILE_LOCK");
+    if (of->lock == NULL)
+    {
+        kfree(of);
+        return ENOMEM;
+    }
+    of->vn = vn;
+    spinlock_init(&of->reflock);
+    of->count = 1;
+    of->mode = mode;
+    /* NONE OF THESE ARE SEEKABLE, SO THE OFFSET IS NEVER USED */
+    of->offset = 0;
+
+    *ret = of;
+    return 0;
+}
+
+/*
+ * sys_pipe - Create an anonymous pipe
+ *
+ *   Makes a pipe and opens both ends, storing the read end's file
+ *   descriptor in fds[0] and the write end's in fds[1]. The data
+ *   lives in a kernel ring buffer and never goes to disk.
+ *
+ * Arguments:
+ *   fds     - Pointer to user space array of two ints
+ *
+ * Returns:
+ *   0 on success
+ *   EFAULT  - fds is an invalid user space pointer
+ *   ENOMEM  - Insufficient kernel memory
+ *   EMFILE  - Process has too many open files
+ */
+int sys_pipe(userptr_t fds)
+{
+    struct vnode *rdvn, *wrvn;
+    struct openfile *rdof, *wrof, *old;
+    int kfds[2];
+    int err;
+
+    err = pipe_create(&rdvn, &wrvn);
+    if (err)
+        return err;
+
+    err = openfile_create(rdvn, O_RDONLY, &rdof);
+    if (err)
+    {
+        vfs_close(rdvn);
+        vfs_close(wrvn);
+        return err;
+    }
+    err = openfile_create(wrvn, O_WRONLY, &wrof);
+    if (err)
+    {
+        openfile_decref(rdof);
+        vfs_close(wrvn);
+        return err;
+    }
+
+    /* INSTALL BOTH ENDS; FROM HERE ON THE FILE TABLE OWNS THEM */
+    err = filetable_add(curproc, rdof, 0, &kfds[0]);
+    if (err)
+    {
+        openfile_decref(rdof);
+        openfile_decref(wrof);
+        return err;
+    }
+    err = filetable_add(curproc, wrof, 0, &kfds[1]);
+    if (err)
+    {
+        openfile_decref(wrof);
+        goto undo_rd;
+    }
+
+    err = copyout(kfds, fds, sizeof(kfds));
+    if (err)
+    {
+        filetable_set(curproc, kfds[1], NULL, &old);
+        if (old != NULL)
+            openfile_decref(old);
+        goto undo_rd;
+    }
+    return 0;
+
+undo_rd:
+    filetable_set(curproc, kfds[0], NULL, &old);
+    if (old != NULL)
+        openfile_decref(old);
+    return err;
+}
+
+/* cwd_forget - Drop P's cached getcwd name, after a chdir */
+static void cwd_forget(struct proc *p) {
+    char *old;
+
+    lock_acquire(p->p_locklock);
+    old = p->p_cwdpath;
+    p->p_cwdpath = NULL;
+    lock_release(p->p_locklock);
+    kfree(old);
+}
+
+/* cwd_remember - Cache NAME, LEN bytes, as P's getcwd name
+ *
+ *   GEN is vfs_namegen from before the name was looked up, so that a
+ *   rename while it was being looked up leaves the cache stale. CWD
+ *   is the directory it was looked up for; if P has moved on since,
+ *   nothing is cached.
+ */
+static void cwd_remember(struct proc *p, struct vnode *cwd, const char *name,
+                         size_t len, unsigned gen) {
+    char *path, *old;
+    bool same;
+
+    path = kmalloc(len + 1);
+    if (path == NULL) {
+        return;
+    }
+    memcpy(path, name, len);
+    path[len] = 0;
+
+    lock_acquire(p->p_locklock);
+    spinlock_acquire(&p->p_lock);
+    same = (p->p_cwd == cwd);
+    spinlock_release(&p->p_lock);
+    if (same) {
+        old = p->p_cwdpath;
+        p->p_cwdpath = path;
+        p->p_cwdlen = len;
+        p->p_cwdgen = gen;
+        path = old;
+    }
+    lock_release(p->p_locklock);
+    kfree(path);
+}
+
 /*
  * sys_chdir - Change the current working directory
  *
@@ -600,17 +1694,20 @@ int sys_chdir(const char *path){
         return EFAULT;
     }
 
-    char kbuffer[PATH_MAX];
-    size_t len;
+    char *kbuffer;
 
     /* copy path from user space */
-    int err = copyinstr((const_userptr_t)path, kbuffer, PATH_MAX, &len);
+    int err = copyin_path((const_userptr_t)path, &kbuffer);
     if (err) {
         return err;
     }
 
     /* let VFS handle the directory change */
     err = vfs_chdir(kbuffer);
+    pathbuf_put(kbuffer);
+    if (err == 0) {
+        cwd_forget(curproc);
+    }
     return err;
 }
 
@@ -633,6 +1730,11 @@ int sys_chdir(const char *path){
  *   Other error codes from vfs_getcwd as applicable
  */
 int sys___getcwd(char *buf, size_t buflen, int *retval){
+    struct proc *p = curproc;
+    struct vnode *cwd;
+    unsigned gen;
+    size_t len;
+    int result;
 
     if (buf == NULL) {
         return EFAULT;
@@ -643,6 +1745,20 @@ int sys___getcwd(char *buf, size_t buflen, int *retval){
         return EINVAL;
     }
 
+    /* the cached name, if nothing has been renamed since */
+    lock_acquire(p->p_locklock);
+    if (p->p_cwdpath != NULL && p->p_cwdgen == vfs_namegen) {
+        len = p->p_cwdlen < buflen ? p->p_cwdlen : buflen;
+        result = copyout(p->p_cwdpath, (userptr_t)buf, len);
+        lock_release(p->p_locklock);
+        if (result) {
+            return EFAULT;
+        }
+        *retval = (int)len;
+        return 0;
+    }
+    lock_release(p->p_locklock);
+
     /* allocate kernel buffer */
     char *kbuf = kmalloc(buflen);
     if (kbuf == NULL) {
@@ -655,15 +1771,31 @@ int sys___getcwd(char *buf, size_t buflen, int *retval){
     /* setup uio to write path to kernel buffer */
     uio_kinit(&iov, &u, kbuf, buflen, 0, UIO_READ);
 
+    /* note which directory, and when, for the cache */
+    gen = vfs_namegen;
+    membar_load_load();
+    result = vfs_getcurdir(&cwd);
+    if (result) {
+        kfree(kbuf);
+        return result;
+    }
+
     /* get current working directory from VFS */
-    int result = vfs_getcwd(&u);   
+    result = vfs_getcwd(&u);   
     if (result) {
+        VOP_DECREF(cwd);
         kfree(kbuf);
         return result;
     }
 
     /* calculate bytes written */
-    size_t len = buflen - u.uio_resid;
+    len = buflen - u.uio_resid;
+
+    /* cache it, unless it might not all have fit */
+    if (u.uio_resid > 0) {
+        cwd_remember(p, cwd, kbuf, len, gen);
+    }
+    VOP_DECREF(cwd);
 
     /* copy from kernel buffer to user buffer */
     result = copyout(kbuf, (userptr_t)buf, len);
@@ -0,0 +1,385 @@
+/*
+ * File descriptor tables, and references to open files. See
+ * filetable.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <proc.h>
+#include <openfile.h>
+#include <filetable.h>
+#include "opt-shell.h"
+
+#if OPT_SHELL
+
+/* openfile_incref - Add a reference to an open file */
+void openfile_incref(struct openfile *of) {
+    spinlock_acquire(&of->reflock);
+    KASSERT(of->count > 0);
+    of->count++;
+    spinlock_release(&of->reflock);
+}
+
+/* openfile_decref - Drop a reference, closing the file with the last one */
+void openfile_decref(struct openfile *of) {
+    bool last;
+
+    spinlock_acquire(&of->reflock);
+    KASSERT(of->count > 0);
+    last = (--of->count == 0);
+    spinlock_release(&of->reflock);
+
+    if (last) {
+        vfs_close(of->vn);
+        spinlock_cleanup(&of->reflock);
+        lock_destroy(of->lock);
+        kfree(of);
+    }
+}
+
+/* ft_create - Make an empty table with SIZE slots */
+static struct filetable *ft_create(unsigned size) {
+    struct filetable *ft;
+
+    COMPILE_ASSERT(OPEN_MAX % 32 == 0 && OPEN_MAX % FT_MINSIZE == 0);
+
+    ft = kmalloc(sizeof(*ft));
+    if (ft == NULL) {
+        return NULL;
+    }
+    ft->ft_files = kmalloc(size * sizeof(ft->ft_files[0]));
+    if (ft->ft_files == NULL) {
+        kfree(ft);
+        return NULL;
+    }
+    bzero(ft->ft_files, size * sizeof(ft->ft_files[0]));
+    bzero(ft->ft_used, sizeof(ft->ft_used));
+    spinlock_init(&ft->ft_reflock);
+    ft->ft_refcount = 1;
+    ft->ft_size = size;
+    ft->ft_nopen = 0;
+    return ft;
+}
+
+/* ft_nextused - Return the first slot in use at or after START, or -1 */
+static int ft_nextused(const struct filetable *ft, unsigned start) {
+    unsigned w, b;
+    uint32_t bits;
+
+    for (w = start / 32; w < ft->ft_size / 32; w++) {
+        bits = ft->ft_used[w];
+        if (w == start / 32) {
+            bits &= ~0U << (start % 32);
+        }
+        if (bits == 0) {
+            continue;
+        }
+        for (b = 0; (bits & (1U << b)) == 0; b++) {
+            /* find it */
+        }
+        return w * 32 + b;
+    }
+    return -1;
+}
+
+/* ft_findfree - Find the lowest free slot at or after START
+ *
+ *   Slots past the end of the table count as free; the table can grow.
+ */
+static int ft_findfree(const struct filetable *ft, unsigned start,
+                       unsigned *ret) {
+    unsigned w, b;
+    uint32_t bits;
+
+    for (w = start / 32; w < FT_MAPWORDS; w++) {
+        bits = ~ft->ft_used[w];
+        if (w == start / 32) {
+            bits &= ~0U << (start % 32);
+        }
+        if (bits == 0) {
+            continue;
+        }
+        for (b = 0; (bits & (1U << b)) == 0; b++) {
+            /* find it */
+        }
+        *ret = w * 32 + b;
+        return 0;
+    }
+    return EMFILE;
+}
+
+/* ft_release - Drop a reference to FT, closing its files with the last */
+static void ft_release(struct filetable *ft) {
+    bool last;
+    int fd;
+
+    spinlock_acquire(&ft->ft_reflock);
+    KASSERT(ft->ft_refcount > 0);
+    last = (--ft->ft_refcount == 0);
+    spinlock_release(&ft->ft_reflock);
+    if (!last) {
+        return;
+    }
+
+    for (fd = ft_nextused(ft, 0); fd >= 0; fd = ft_nextused(ft, fd + 1)) {
+        openfile_decref(ft->ft_files[fd]);
+    }
+    spinlock_cleanup(&ft->ft_reflock);
+    kfree(ft->ft_files);
+    kfree(ft);
+}
+
+/* ft_prepare - Get P's table ready for slot FD to change
+ *
+ *   Makes a table if P has none, copies it if it is shared, and grows
+ *   it to take FD. Caller holds p_locklock.
+ *
+ * Returns:
+ *   0 on success
+ *   ENOMEM  - Out of memory
+ */
+static int ft_prepare(struct proc *p, unsigned fd) {
+    struct filetable *ft = p->p_files, *newft;
+    struct openfile **files, **oldfiles;
+    unsigned size;
+    bool shared = false;
+    int i;
+
+    KASSERT(lock_do_i_hold(p->p_locklock));
+    KASSERT(fd < OPEN_MAX);
+
+    size = (ft != NULL) ? ft->ft_size : FT_MINSIZE;
+    while (size <= fd) {
+        size *= 2;
+    }
+    if (ft != NULL) {
+        spinlock_acquire(&ft->ft_reflock);
+        shared = ft->ft_refcount > 1;
+        spinlock_release(&ft->ft_reflock);
+    }
+
+    if (ft == NULL || shared) {
+        newft = ft_create(size);
+        if (newft == NULL) {
+            return ENOMEM;
+        }
+        if (ft != NULL) {
+            /* Nobody changes a shared table, so no lock is needed */
+            for (i = ft_nextused(ft, 0); i >= 0; i = ft_nextused(ft, i + 1)) {
+                openfile_incref(ft->ft_files[i]);
+                newft->ft_files[i] = ft->ft_files[i];
+            }
+            memcpy(newft->ft_used, ft->ft_used, sizeof(ft->ft_used));
+            newft->ft_nopen = ft->ft_nopen;
+        }
+        spinlock_acquire(&p->p_lock);
+        p->p_files = newft;
+        spinlock_release(&p->p_lock);
+        if (ft != NULL) {
+            ft_release(ft);
+        }
+        return 0;
+    }
+
+    if (size > ft->ft_size) {
+        files = kmalloc(size * sizeof(files[0]));
+        if (files == NULL) {
+            return ENOMEM;
+        }
+        bzero(files, size * sizeof(files[0]));
+        memcpy(files, ft->ft_files, ft->ft_size * sizeof(files[0]));
+        spinlock_acquire(&p->p_lock);
+        oldfiles = ft->ft_files;
+        ft->ft_files = files;
+        ft->ft_size = size;
+        spinlock_release(&p->p_lock);
+        kfree(oldfiles);
+    }
+    return 0;
+}
+
+/* ft_setslot - Put OF (or NULL) in slot FD of P's table; return the old one */
+static struct openfile *ft_setslot(struct proc *p, unsigned fd,
+                                   struct openfile *of) {
+    struct filetable *ft = p->p_files;
+    struct openfile *old;
+
+    KASSERT(fd < ft->ft_size);
+
+    spinlock_acquire(&p->p_lock);
+    old = ft->ft_files[fd];
+    ft->ft_files[fd] = of;
+    spinlock_release(&p->p_lock);
+
+    if (old != NULL) {
+        ft->ft_nopen--;
+    }
+    if (of != NULL) {
+        ft->ft_used[fd / 32] |= 1U << (fd % 32);
+        ft->ft_nopen++;
+    } else {
+        ft->ft_used[fd / 32] &= ~(1U << (fd % 32));
+    }
+    return old;
+}
+
+/* filetable_get - Return the open file for descriptor FD of P, or NULL
+ *
+ *   The caller gets a reference, so another thread closing FD can't
+ *   free the file under it, and must openfile_decref it when done.
+ */
+struct openfile *filetable_get(struct proc *p, int fd) {
+    struct filetable *ft;
+    struct openfile *of = NULL;
+
+    if (fd < 0 || fd >= OPEN_MAX) {
+        return NULL;
+    }
+    spinlock_acquire(&p->p_lock);
+    ft = p->p_files;
+    if (ft != NULL && (unsigned)fd < ft->ft_size) {
+        of = ft->ft_files[fd];
+    }
+    if (of != NULL) {
+        openfile_incref(of);
+    }
+    spinlock_release(&p->p_lock);
+    return of;
+}
+
+/* filetable_add - Give OF the lowest free descriptor of P from MINFD up
+ *
+ *   The table's reference to OF is the caller's, on success.
+ *
+ * Returns:
+ *   0 on success
+ *   EMFILE  - No free descriptor below OPEN_MAX and RLIMIT_NOFILE
+ *   ENOMEM  - Out of memory
+ */
+int filetable_add(struct proc *p, struct openfile *of, int minfd,
+                  int *retfd) {
+    unsigned fd;
+    int result;
+
+    KASSERT(minfd >= 0);
+
+    lock_acquire(p->p_locklock);
+    if (p->p_files == NULL) {
+        fd = minfd;
+        result = (fd < OPEN_MAX) ? 0 : EMFILE;
+    } else {
+        result = ft_findfree(p->p_files, minfd, &fd);
+    }
+    if (result == 0 && fd >= proc_getrlimit(p, RLIMIT_NOFILE)) {
+        result = EMFILE;
+    }
+    if (result == 0) {
+        result = ft_prepare(p, fd);
+    }
+    if (result == 0) {
+        ft_setslot(p, fd, of);
+        *retfd = fd;
+    }
+    lock_release(p->p_locklock);
+    return result;
+}
+
+/* filetable_set - Put OF in descriptor FD of P, or empty it if OF is NULL
+ *
+ *   As for filetable_add, the reference to OF is the caller's. The
+ *   reference to whatever was there before goes to the caller, in
+ *   OLDOF (NULL if the descriptor wasn't in use).
+ *
+ * Returns:
+ *   0 on success
+ *   EBADF   - FD is out of range, or (for a new OF) past RLIMIT_NOFILE
+ *   ENOMEM  - Out of memory
+ */
+int filetable_set(struct proc *p, int fd, struct openfile *of,
+                  struct openfile **oldof) {
+    int result;
+
+    if (fd < 0 || fd >= OPEN_MAX) {
+        return EBADF;
+    }
+    if (of != NULL && (unsigned)fd >= proc_getrlimit(p, RLIMIT_NOFILE)) {
+        return EBADF;
+    }
+
+    lock_acquire(p->p_locklock);
+    if (of == NULL && (p->p_files == NULL ||
+                       (unsigned)fd >= p->p_files->ft_size ||
+                       p->p_files->ft_files[fd] == NULL)) {
+        /* Nothing to do; don't copy a shared table for it */
+        lock_release(p->p_locklock);
+        *oldof = NULL;
+        return 0;
+    }
+    result = ft_prepare(p, fd);
+    if (result == 0) {
+        *oldof = ft_setslot(p, fd, of);
+    }
+    lock_release(p->p_locklock);
+    return result;
+}
+
+/* filetable_fork - Share PARENT's descriptors with the new process CHILD */
+void filetable_fork(struct proc *parent, struct proc *child) {
+    struct filetable *ft;
+
+    KASSERT(child->p_files == NULL);
+
+    lock_acquire(parent->p_locklock);
+    ft = parent->p_files;
+    if (ft != NULL) {
+        spinlock_acquire(&ft->ft_reflock);
+        ft->ft_refcount++;
+        spinlock_release(&ft->ft_reflock);
+    }
+    lock_release(parent->p_locklock);
+
+    child->p_files = ft;
+}
+
+/* filetable_unlockall - Drop P's fcntl locks on all its files, for exit
+ *
+ *   Locks belong to the process, not the descriptors, so they must go
+ *   at exit even if a shared table keeps the files open. A process
+ *   can only lock a file it has a descriptor for, and closing that
+ *   drops its locks, so its table has every file it holds locks on.
+ */
+void filetable_unlockall(struct proc *p) {
+    struct filetable *ft;
+    int fd;
+
+    if (!p->p_flocks) {
+        return;
+    }
+    lock_acquire(p->p_locklock);
+    ft = p->p_files;
+    for (fd = ft == NULL ? -1 : ft_nextused(ft, 0); fd >= 0;
+         fd = ft_nextused(ft, fd + 1)) {
+        vnode_unlockall(ft->ft_files[fd]->vn, p->p_pid);
+    }
+    lock_release(p->p_locklock);
+}
+
+/* filetable_drop - Close all of P's descriptors, for exit */
+void filetable_drop(struct proc *p) {
+    struct filetable *ft;
+
+    spinlock_acquire(&p->p_lock);
+    ft = p->p_files;
+    p->p_files = NULL;
+    spinlock_release(&p->p_lock);
+
+    if (ft != NULL) {
+        ft_release(ft);
+    }
+}
+
+#endif /* OPT_SHELL */
@@ -0,0 +1,285 @@
+/*
+ * futex: sleeping and waking on a word of user memory.
+ *
+ * User-level locks keep their state in an ordinary int and only call
+ * in here to wait for it to change (FUTEX_WAIT) or to tell waiters it
+ * has (FUTEX_WAKE), so an uncontended lock never enters the kernel.
+ *
+ * Nothing is set up in advance. Waiters are kept in a hash table
+ * keyed on their address space and the user address. Each bucket has
+ * a sleep lock, held while checking the user's word (which can fault)
+ * and while changing the bucket's waiter list, and a wchan that all
+ * its waiters sleep on. FUTEX_WAKE marks the waiters it picks and
+ * wakes the whole wchan; waiters that weren't picked go back to
+ * sleep.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/futex.h>
+#include <lib.h>
+#include <clock.h>
+#include <copyinout.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <wchan.h>
+#include <proc.h>
+#include <syscall.h>
+
+#define FUTEX_NBUCKETS	64
+
+struct futex_waiter {
+	struct futex_waiter *fw_next;
+	struct addrspace *fw_as;
+	vaddr_t fw_uaddr;
+	bool fw_woken;			/* taken off the list by a waker */
+};
+
+struct futex_bucket {
+	struct lock *fb_lock;		/* checking the word; the list */
+	struct spinlock fb_spinlock;	/* fw_woken; the list; the wchan */
+	struct wchan *fb_wchan;
+	struct futex_waiter *fb_waiters; /* oldest first */
+};
+
+static struct futex_bucket futex_table[FUTEX_NBUCKETS];
+
+void
+futex_bootstrap(void)
+{
+	struct futex_bucket *fb;
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		fb = &futex_table[i];
+		fb->fb_lock = lock_create("futex");
+		fb->fb_wchan = wchan_create("futex");
+		if (fb->fb_lock == NULL || fb->fb_wchan == NULL) {
+			panic("futex_bootstrap: out of memory\n");
+		}
+		spinlock_init(&fb->fb_spinlock);
+		fb->fb_waiters = NULL;
+	}
+}
+
+static
+struct futex_bucket *
+futex_hash(struct addrspace *as, vaddr_t uaddr)
+{
+	return &futex_table[((uaddr >> 2) ^ ((uintptr_t)as >> 6))
+			    % FUTEX_NBUCKETS];
+}
+
+/*
+ * Sleep until woken if *UADDR is VAL, for at most TICKS hardclocks
+ * unless TICKS is 0.
+ */
+static
+int
+futex_wait(struct addrspace *as, vaddr_t uaddr, int val, unsigned ticks)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter fw, **pp;
+	int cur, result;
+
+	fb = futex_hash(as, uaddr);
+
+	lock_acquire(fb->fb_lock);
+	result = copyin((const_userptr_t)uaddr, &cur, sizeof(cur));
+	if (result == 0 && cur != val) {
+		result = EAGAIN;
+	}
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+
+	fw.fw_next = NULL;
+	fw.fw_as = as;
+	fw.fw_uaddr = uaddr;
+	fw.fw_woken = false;
+
+	/*
+	 * Get on the list and take the spinlock before letting go of
+	 * the lock, so a waker can't slip in between checking the
+	 * word and going to sleep.
+	 */
+	spinlock_acquire(&fb->fb_spinlock);
+	for (pp = &fb->fb_waiters; *pp != NULL; pp = &(*pp)->fw_next) {
+		/* find the tail */
+	}
+	*pp = &fw;
+	lock_release(fb->fb_lock);
+
+	while (!fw.fw_woken) {
+		if (ticks == 0) {
+			wchan_sleep(fb->fb_wchan, &fb->fb_spinlock);
+		}
+		else if (wchan_sleep_timeout(fb->fb_wchan, &fb->fb_spinlock,
+					     ticks) == ETIMEDOUT) {
+			/*
+			 * (A wakeup meant for another waiter in the
+			 * bucket restarts the timeout. That's rare
+			 * enough not to be worth keeping a deadline.)
+			 */
+			break;
+		}
+	}
+	if (fw.fw_woken) {
+		spinlock_release(&fb->fb_spinlock);
+		return 0;
+	}
+
+	/* Timed out; get off the list, unless a waker beat us to it */
+	spinlock_release(&fb->fb_spinlock);
+	lock_acquire(fb->fb_lock);
+	spinlock_acquire(&fb->fb_spinlock);
+	if (!fw.fw_woken) {
+		for (pp = &fb->fb_waiters; *pp != &fw; pp = &(*pp)->fw_next) {
+			KASSERT(*pp != NULL);
+		}
+		*pp = fw.fw_next;
+		result = ETIMEDOUT;
+	}
+	spinlock_release(&fb->fb_spinlock);
+	lock_release(fb->fb_lock);
+	return result;
+}
+
+/*
+ * Wake up to MAX waiters on UADDR, oldest first. Returns how many.
+ */
+static
+int
+futex_wake(struct addrspace *as, vaddr_t uaddr, int max)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter *fw, **pp;
+	int woken;
+
+	fb = futex_hash(as, uaddr);
+
+	lock_acquire(fb->fb_lock);
+	spinlock_acquire(&fb->fb_spinlock);
+	woken = 0;
+	pp = &fb->fb_waiters;
+	while (*pp != NULL && woken < max) {
+		fw = *pp;
+		if (fw->fw_as == as && fw->fw_uaddr == uaddr) {
+			*pp = fw->fw_next;
+			fw->fw_next = NULL;
+			fw->fw_woken = true;
+			woken++;
+		}
+		else {
+			pp = &fw->fw_next;
+		}
+	}
+	if (woken > 0) {
+		wchan_wakeall(fb->fb_wchan, &fb->fb_spinlock);
+	}
+	spinlock_release(&fb->fb_spinlock);
+	lock_release(fb->fb_lock);
+	return woken;
+}
+
+/*
+ * Wake every waiter in address space AS, whatever it's waiting on.
+ * For when a multithreaded process is exiting.
+ */
+void
+futex_exit(struct addrspace *as)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter *fw, **pp;
+	unsigned i;
+	bool any;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		fb = &futex_table[i];
+		lock_acquire(fb->fb_lock);
+		spinlock_acquire(&fb->fb_spinlock);
+		any = false;
+		pp = &fb->fb_waiters;
+		while (*pp != NULL) {
+			fw = *pp;
+			if (fw->fw_as == as) {
+				*pp = fw->fw_next;
+				fw->fw_next = NULL;
+				fw->fw_woken = true;
+				any = true;
+			}
+			else {
+				pp = &fw->fw_next;
+			}
+		}
+		if (any) {
+			wchan_wakeall(fb->fb_wchan, &fb->fb_spinlock);
+		}
+		spinlock_release(&fb->fb_spinlock);
+		lock_release(fb->fb_lock);
+	}
+}
+
+/*
+ * futex(uaddr, op, val, timeout)
+ *
+ * FUTEX_WAIT sleeps until a FUTEX_WAKE on UADDR, if *UADDR is VAL
+ * when checked, and fails with EAGAIN otherwise. If TIMEOUT is not
+ * null it fails with ETIMEDOUT after that long. Returns 0.
+ *
+ * FUTEX_WAKE wakes up to VAL threads waiting on UADDR and returns
+ * how many it woke. TIMEOUT is ignored.
+ */
+int
+sys_futex(userptr_t uaddr, int op, int val, userptr_t timeout, int *retval)
+{
+	struct addrspace *as;
+	struct timespec ts;
+	uint64_t ticks;
+	int result;
+
+	if (((vaddr_t)uaddr & (sizeof(int) - 1)) != 0) {
+		return EINVAL;
+	}
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	switch (op) {
+	    case FUTEX_WAIT:
+		ticks = 0;
+		if (timeout != NULL) {
+			result = copyin(timeout, &ts, sizeof(ts));
+			if (result) {
+				return result;
+			}
+			if (ts.tv_sec < 0 || ts.tv_nsec < 0 ||
+			    ts.tv_nsec >= 1000000000) {
+				return EINVAL;
+			}
+			ticks = timespec_to_ticks(&ts);
+			if (ticks == 0) {
+				/* As short a wait as we can do */
+				ticks = 1;
+			}
+			else if (ticks > 0x7fffffff) {
+				ticks = 0x7fffffff;
+			}
+		}
+		result = futex_wait(as, (vaddr_t)uaddr, val, ticks);
+		if (result) {
+			return result;
+		}
+		*retval = 0;
+		return 0;
+	    case FUTEX_WAKE:
+		if (val <= 0) {
+			return EINVAL;
+		}
+		*retval = futex_wake(as, (vaddr_t)uaddr, val);
+		return 0;
+	}
+	return EINVAL;
+}
@@ -7,136 +7,246 @@
 #include <proc.h>
 #include <current.h>
 #include <syscall.h>
+#include <cpu.h>
+#include <spl.h>
+#include <vm.h>
+#include <vmalloc.h>
 #include "opt-shell.h"
 
 #if OPT_SHELL
 
 /*
- * copy_program_name - Copy program name from user space to kernel space
+ * Pathname buffers. Every syscall that takes a path copies it into a
+ * PATH_MAX buffer, which is too big to put on a kernel stack and too
+ * common to go to kmalloc for each time. Each cpu keeps a few spare
+ * buffers; like the exec arenas below, a buffer goes back to whichever
+ * cpu the thread is on when it is done, or is freed if that one
+ * already has enough.
+ */
+char *pathbuf_get(void) {
+    char *buf;
+    int spl;
+
+    buf = NULL;
+    spl = splhigh();
+    if (curcpu->c_npathbufs > 0) {
+        buf = curcpu->c_pathbufs[--curcpu->c_npathbufs];
+    }
+    splx(spl);
+
+    if (buf == NULL) {
+        buf = kmalloc(PATH_MAX);
+    }
+    return buf;
+}
+
+void pathbuf_put(char *buf) {
+    int spl;
+
+    spl = splhigh();
+    if (curcpu->c_npathbufs < PATHBUF_CACHE) {
+        curcpu->c_pathbufs[curcpu->c_npathbufs++] = buf;
+        buf = NULL;
+    }
+    splx(spl);
+
+    if (buf != NULL) {
+        vfree(buf);
+    }
+}
+
+/*
+ * copyin_path - Copy a pathname from user space into a path buffer
  *
  * Arguments:
- *   program         - User space pointer to program name string
- *   kernel_progname - Pointer to store allocated kernel copy
+ *   upath - User space pointer to the path string
+ *   kpath - Where to put the buffer; give it back with pathbuf_put
  *
  * Returns:
  *   0 on success
- *   ENOMEM - Out of memory
- *   EFAULT - Invalid user pointer
+ *   ENOMEM       - Out of memory
+ *   EFAULT       - Invalid user pointer
+ *   ENAMETOOLONG - Path longer than PATH_MAX
  */
-int copy_program_name(const char *program, char **kernel_progname) {
+int copyin_path(const_userptr_t upath, char **kpath) {
     int result;
-    size_t actual;
-    
-    *kernel_progname = kmalloc(PATH_MAX);
-    if (*kernel_progname == NULL) {
+
+    *kpath = pathbuf_get();
+    if (*kpath == NULL) {
         return ENOMEM;
     }
-    
-    result = copyinstr((const_userptr_t)program, *kernel_progname, PATH_MAX, &actual);
+
+    result = copyinstr(upath, *kpath, PATH_MAX, NULL);
     if (result) {
-        kfree(*kernel_progname);
-        *kernel_progname = NULL;
+        pathbuf_put(*kpath);
+        *kpath = NULL;
         return result;
     }
-    
+
     return 0;
 }
 
+/*
+ * copy_program_name - Copy program name from user space to kernel space
+ *
+ * Arguments:
+ *   program         - User space pointer to program name string
+ *   kernel_progname - Pointer to store the path buffer holding the copy;
+ *                     give it back with pathbuf_put
+ *
+ * Returns:
+ *   0 on success
+ *   ENOMEM - Out of memory
+ *   EFAULT - Invalid user pointer
+ */
+int copy_program_name(const char *program, char **kernel_progname) {
+    return copyin_path((const_userptr_t)program, kernel_progname);
+}
+
+/*
+ * Argument arenas. All of execv's arguments are packed into one
+ * ARG_MAX buffer, laid out as they will be on the new stack: the
+ * argv[] array, then the strings. Each cpu keeps a spare arena, so
+ * an exec normally doesn't have to allocate one. (A thread may move
+ * to another cpu in between; the arena just goes back to that one's
+ * spare slot, or is freed if it has one.) Arenas come from vmalloc,
+ * so that exec still works once physical memory is too fragmented
+ * for ARG_MAX of it in a row.
+ */
+static char *argbuf_get(void) {
+    char *buf;
+    int spl;
+
+    spl = splhigh();
+    buf = curcpu->c_argbuf;
+    curcpu->c_argbuf = NULL;
+    splx(spl);
+
+    if (buf == NULL) {
+        buf = vmalloc(ARG_MAX);
+    }
+    return buf;
+}
+
+static void argbuf_put(char *buf) {
+    int spl;
+
+    spl = splhigh();
+    if (curcpu->c_argbuf == NULL) {
+        curcpu->c_argbuf = buf;
+        buf = NULL;
+    }
+    splx(spl);
+
+    if (buf != NULL) {
+        kfree(buf);
+    }
+}
+
 /*
  * copy_arguments - Copy argument array from user space to kernel space
  *
+ * Reads the user's argv[] a page at a time straight into the start of
+ * an arena, then copies each string once, into place after it.
+ * argv[i] holds the offset of string i in the arena until
+ * copy_args_to_stack turns them into user pointers.
+ *
  * Arguments:
- *   args        - User space pointer to argument array
- *   kernel_args - Pointer to store allocated kernel copy
- *   argc        - Pointer to store argument count
+ *   args - User space pointer to argument array
+ *   ab   - Gets the arena; free it with cleanup_arguments on success
  *
  * Returns:
  *   0 on success
- *   E2BIG  - Too many arguments
+ *   E2BIG  - argv[] and the strings don't fit in ARG_MAX
  *   ENOMEM - Out of memory
  *   EFAULT - Invalid user pointer
  */
-int copy_arguments(char **args, char ***kernel_args, int *argc) {
-    int i, result;
-    size_t actual;
-    char *user_argptr;
-    
-    /* Count arguments by reading pointers from user space */
-    *argc = 0;
+int copy_arguments(char **args, struct argbuf *ab) {
+    vaddr_t *argv;
+    vaddr_t uaddr;
+    size_t n, len, pos;
+    int argc, i, result;
+
+    ab->ab_buf = argbuf_get();
+    if (ab->ab_buf == NULL) {
+        return ENOMEM;
+    }
+    ab->ab_len = 0;
+    ab->ab_argc = 0;
+    argv = (vaddr_t *)ab->ab_buf;
+
+    /*
+     * Pull in argv[] up to its NULL, never reading past the end of
+     * the page the last entry was on in case that's the end of it.
+     */
+    uaddr = (vaddr_t)args;
+    if (uaddr % sizeof(vaddr_t) != 0) {
+        result = EFAULT;
+        goto fail;
+    }
+    argc = 0;
     while (1) {
-        /* Read pointer from user space array */
-        result = copyin((const_userptr_t)(args + *argc), &user_argptr, sizeof(char *));
+        n = (PAGE_SIZE - (uaddr % PAGE_SIZE)) / sizeof(vaddr_t);
+        if ((argc + n) * sizeof(vaddr_t) > ARG_MAX) {
+            n = ARG_MAX / sizeof(vaddr_t) - argc;
+            if (n == 0) {
+                result = E2BIG;
+                goto fail;
+            }
+        }
+        result = copyin((const_userptr_t)uaddr, &argv[argc],
+                        n * sizeof(vaddr_t));
         if (result) {
-            return result;
+            goto fail;
         }
-        
-        /* NULL pointer marks end of array */
-        if (user_argptr == NULL) {
-            break;
+        for (i = 0; i < (int)n && argv[argc] != 0; i++) {
+            argc++;
         }
-        
-        (*argc)++;
-        if (*argc > ARG_MAX) {
-            return E2BIG;
+        if (i < (int)n) {
+            break;
         }
+        uaddr += n * sizeof(vaddr_t);
     }
-    
-    /* Allocate kernel array for argument pointers */
-    *kernel_args = kmalloc((*argc + 1) * sizeof(char *));
-    if (*kernel_args == NULL) {
-        return ENOMEM;
-    }
-    
-    /* Initialize all pointers to NULL for cleanup safety */
-    for (i = 0; i <= *argc; i++) {
-        (*kernel_args)[i] = NULL;
-    }
-    
-    /* Copy each argument string */
-    for (i = 0; i < *argc; i++) {
-        /* Read the pointer to the i-th argument */
-        result = copyin((const_userptr_t)(args + i), &user_argptr, sizeof(char *));
-        if (result) {
-            cleanup_arguments(*kernel_args, *argc);
-            *kernel_args = NULL;
-            return result;
+
+    /* The strings go after argv[], including its NULL */
+    pos = (argc + 1) * sizeof(vaddr_t);
+    for (i = 0; i < argc; i++) {
+        if (pos >= ARG_MAX) {
+            result = E2BIG;
+            goto fail;
         }
-        
-        /* Allocate space for the argument string */
-        (*kernel_args)[i] = kmalloc(PATH_MAX);
-        if ((*kernel_args)[i] == NULL) {
-            cleanup_arguments(*kernel_args, *argc);
-            *kernel_args = NULL;
-            return ENOMEM;
+        result = copyinstr((const_userptr_t)argv[i], ab->ab_buf + pos,
+                           ARG_MAX - pos, &len);
+        if (result == ENAMETOOLONG) {
+            result = E2BIG;
         }
-        
-        /* Copy the string from user space */
-        result = copyinstr((const_userptr_t)user_argptr, (*kernel_args)[i], PATH_MAX, &actual);
         if (result) {
-            cleanup_arguments(*kernel_args, *argc);
-            *kernel_args = NULL;
-            return result;
+            goto fail;
         }
+        argv[i] = pos;
+        pos = ROUNDUP(pos + len, sizeof(vaddr_t));
     }
-    
+    argv[argc] = 0;
+
+    ab->ab_len = pos;
+    ab->ab_argc = argc;
     return 0;
+
+ fail:
+    cleanup_arguments(ab);
+    return result;
 }
 
 /*
- * cleanup_arguments - Free kernel argument array
+ * cleanup_arguments - Free an argument arena
  *
  * Arguments:
- *   kernel_args - Kernel array of argument strings to free
- *   argc        - Number of arguments in the array
+ *   ab - Filled in by copy_arguments
  */
-void cleanup_arguments(char **kernel_args, int argc) {
-    if (kernel_args != NULL) {
-        for (int i = 0; i < argc; i++) {
-            if (kernel_args[i] != NULL) {
-                kfree(kernel_args[i]);
-            }
-        }
-        kfree(kernel_args);
+void cleanup_arguments(struct argbuf *ab) {
+    if (ab->ab_buf != NULL) {
+        argbuf_put(ab->ab_buf);
+        ab->ab_buf = NULL;
     }
 }
 
@@ -156,78 +266,38 @@ void restore_old_address_space(struct addrspace *old_as, struct addrspace *new_a
 /*
  * copy_args_to_stack - Copy arguments to user stack for execv
  *
- * Copies argument strings and pointers to the user stack in the format
- * expected by main(int argc, char **argv).
+ * Puts the arena on the user stack, in the format expected by
+ * main(int argc, char **argv), with one copyout.
  *
  * Stack layout (growing down):
- *   - Argument strings (null-terminated)
- *   - Padding for alignment
- *   - Array of pointers to strings
+ *   - Argument strings (null-terminated, each 4-byte aligned)
  *   - NULL pointer (argv[argc])
+ *   - Array of pointers to strings, 8-byte aligned; argv and the new
+ *     stack pointer both point here
  *
  * Arguments:
- *   kernel_args - Kernel array of argument strings
- *   argc        - Number of arguments
- *   stackptr    - Pointer to stack pointer, updated to new top of stack
+ *   ab       - Filled in by copy_arguments
+ *   stackptr - Pointer to stack pointer, updated to new top of stack
  *
  * Returns:
  *   0 on success
  *   EFAULT - Copy to user space failed
- *   ENOMEM - Out of memory
  */
-int copy_args_to_stack(char **kernel_args, int argc, vaddr_t *stackptr) {
-    vaddr_t *argv_ptrs;
-    int i, result;
-    size_t len;
-    
-    /* Allocate temporary space for argument pointers */
-    argv_ptrs = kmalloc((argc + 1) * sizeof(vaddr_t));
-    if (argv_ptrs == NULL) {
-        return ENOMEM;
-    }
-    
-    /*
-     * Copy argument strings to stack (in reverse order)
-     * Each string is null-terminated and aligned to 4-byte boundary
-     */
-    for (i = argc - 1; i >= 0; i--) {
-        len = strlen(kernel_args[i]) + 1;
-        
-        /* Move stack pointer down for string */
-        *stackptr -= len;
-        
-        /* Align to 4-byte boundary */
-        *stackptr -= (*stackptr % 4);
-        
-        /* Copy string to user stack */
-        result = copyoutstr(kernel_args[i], (userptr_t)*stackptr, len, NULL);
-        if (result) {
-            kfree(argv_ptrs);
-            return result;
-        }
-        
-        /* Save pointer for argv array */
-        argv_ptrs[i] = *stackptr;
-    }
-    
-    /* NULL terminator for argv array */
-    argv_ptrs[argc] = 0;
-    
-    /*
-     * Copy argv pointer array to stack
-     * Align to 8-byte boundary for MIPS ABI compatibility
-     */
-    *stackptr -= (argc + 1) * sizeof(vaddr_t);
-    *stackptr -= (*stackptr % 8);
-    
-    result = copyout(argv_ptrs, (userptr_t)*stackptr, (argc + 1) * sizeof(vaddr_t));
-    kfree(argv_ptrs);
-    
-    if (result) {
-        return result;
+int copy_args_to_stack(struct argbuf *ab, vaddr_t *stackptr) {
+    vaddr_t *argv = (vaddr_t *)ab->ab_buf;
+    vaddr_t base;
+    int i;
+
+    base = *stackptr - ab->ab_len;
+    base -= base % 8;
+
+    /* Offsets become user pointers */
+    for (i = 0; i < ab->ab_argc; i++) {
+        argv[i] += base;
     }
-    
-    return 0;
+
+    *stackptr = base;
+    return copyout(ab->ab_buf, (userptr_t)base, ab->ab_len);
 }
 
 #endif
@@ -42,8 +42,12 @@
  * circumstances, as_prepare_load and as_complete_load probably don't
  * need to do anything.
  *
- * If you wanted to support memory-mapped executables you would need
- * to rearrange this to map each segment.
+ * With the paging VM system, read-only segments are not loaded at
+ * all: as_map_file maps them from the executable, and vm_fault reads
+ * each page in (once, for everyone running the program) when it is
+ * first touched. Writable segments are still loaded here. The parsed
+ * headers are cached, so that programs run over and over only have
+ * their headers read and checked once.
  *
  * To support dynamically linked executables with shared libraries
  * you'd need to change this to load the "ELF interpreter" (dynamic
@@ -53,6 +57,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <spinlock.h>
 #include <uio.h>
 #include <proc.h>
 #include <current.h>
@@ -102,6 +107,9 @@ load_segment(struct addrspace *as, struct vnode *v,
 	u.uio_segflg = is_executable ? UIO_USERISPACE : UIO_USERSPACE;
 	u.uio_rw = UIO_READ;
 	u.uio_space = as;
+	u.uio_nocache = false;
+	u.uio_append = false;
+	u.uio_direct = false;
 
 	result = VOP_READ(v, &u);
 	if (result) {
@@ -146,21 +154,108 @@ load_segment(struct addrspace *as, struct vnode *v,
 }
 
 /*
- * Load an ELF executable user program into the current address space.
- *
- * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ * What load_elf needs from an executable's headers: the entry point
+ * and its PT_LOAD segments. Programs with more than ELF_MAXSEGS
+ * loadable segments are not supported.
+ */
+#define ELF_MAXSEGS	8
+
+struct elf_seg {
+	off_t es_offset;
+	vaddr_t es_vaddr;
+	size_t es_memsz;
+	size_t es_filesz;
+	int es_flags;			/* PF_* */
+};
+
+struct elf_image {
+	vaddr_t ei_entry;
+	unsigned ei_nsegs;
+	struct elf_seg ei_segs[ELF_MAXSEGS];
+};
+
+/*
+ * Cache of parsed images, so that running the same programs over and
+ * over doesn't read and check their headers every time. Entries are
+ * keyed on the vnode and its version (see vnode.h); writing to or
+ * truncating the file changes the version, and the entry is then
+ * never matched again. No vnode reference is held: since versions
+ * are never reused, an entry for a vnode that has since gone away
+ * can't match either. Old entries just get replaced, least recently
+ * used first.
+ */
+#define ELFCACHE_SIZE	8
+
+struct elfcache_entry {
+	struct vnode *ec_vnode;		/* NULL if unused */
+	unsigned ec_version;
+	unsigned ec_lastuse;
+	struct elf_image ec_image;
+};
+
+static struct spinlock elfcache_lock = SPINLOCK_INITIALIZER;
+static struct elfcache_entry elfcache[ELFCACHE_SIZE];
+static unsigned elfcache_clock;		/* for ec_lastuse */
+
+static
+bool
+elfcache_lookup(struct vnode *v, unsigned version, struct elf_image *img)
+{
+	unsigned i;
+
+	spinlock_acquire(&elfcache_lock);
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		if (elfcache[i].ec_vnode == v &&
+		    elfcache[i].ec_version == version) {
+			elfcache[i].ec_lastuse = ++elfcache_clock;
+			*img = elfcache[i].ec_image;
+			spinlock_release(&elfcache_lock);
+			return true;
+		}
+	}
+	spinlock_release(&elfcache_lock);
+	return false;
+}
+
+static
+void
+elfcache_insert(struct vnode *v, unsigned version,
+		const struct elf_image *img)
+{
+	unsigned i, victim;
+
+	spinlock_acquire(&elfcache_lock);
+	victim = 0;
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		if (elfcache[i].ec_vnode == v) {
+			/* An older version; replace it */
+			victim = i;
+			break;
+		}
+		if (elfcache[i].ec_lastuse < elfcache[victim].ec_lastuse) {
+			victim = i;
+		}
+	}
+	elfcache[victim].ec_vnode = v;
+	elfcache[victim].ec_version = version;
+	elfcache[victim].ec_lastuse = ++elfcache_clock;
+	elfcache[victim].ec_image = *img;
+	spinlock_release(&elfcache_lock);
+}
+
+/*
+ * Read and check the headers of the executable V.
  */
+static
 int
-load_elf(struct vnode *v, vaddr_t *entrypoint)
+elf_parse(struct vnode *v, struct elf_image *img)
 {
 	Elf_Ehdr eh;   /* Executable header */
 	Elf_Phdr ph;   /* "Program header" = segment header */
 	int result, i;
 	struct iovec iov;
 	struct uio ku;
-	struct addrspace *as;
-
-	as = proc_getas();
+	struct elf_seg *es;
 
 	/*
 	 * Read the executable header from offset 0 in the file.
@@ -203,7 +298,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	}
 
 	/*
-	 * Go through the list of segments and set up the address space.
+	 * Go through the list of segments and note the loadable ones.
 	 *
 	 * Ordinarily there will be one code segment, one read-only
 	 * data segment, and one data/bss segment, but there might
@@ -217,6 +312,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 * to find where the phdr starts.
 	 */
 
+	img->ei_nsegs = 0;
 	for (i=0; i<eh.e_phnum; i++) {
 		off_t offset = eh.e_phoff + i*eh.e_phentsize;
 		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
@@ -243,11 +339,63 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+		if (img->ei_nsegs == ELF_MAXSEGS) {
+			kprintf("loadelf: more than %d segments\n",
+				ELF_MAXSEGS);
+			return ENOEXEC;
+		}
+		es = &img->ei_segs[img->ei_nsegs++];
+		es->es_offset = ph.p_offset;
+		es->es_vaddr = ph.p_vaddr;
+		es->es_memsz = ph.p_memsz;
+		es->es_filesz = ph.p_filesz;
+		es->es_flags = ph.p_flags;
+	}
+
+	img->ei_entry = eh.e_entry;
+	return 0;
+}
+
+/*
+ * Load an ELF executable user program into the current address space.
+ *
+ * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ */
+int
+load_elf(struct vnode *v, vaddr_t *entrypoint)
+{
+	struct elf_image img;
+	struct elf_seg *es;
+	struct addrspace *as;
+	unsigned i, version;
+	int result;
+
+	as = proc_getas();
+
+	/*
+	 * Take the version before reading anything, so that a write
+	 * that races with the parse makes the cached copy stale.
+	 */
+	version = vnode_version(v);
+	if (!elfcache_lookup(v, version, &img)) {
+		result = elf_parse(v, &img);
+		if (result) {
+			return result;
+		}
+		elfcache_insert(v, version, &img);
+	}
+
+	/*
+	 * Set up the address space.
+	 */
+
+	for (i=0; i<img.ei_nsegs; i++) {
+		es = &img.ei_segs[i];
 		result = as_define_region(as,
-					  ph.p_vaddr, ph.p_memsz,
-					  ph.p_flags & PF_R,
-					  ph.p_flags & PF_W,
-					  ph.p_flags & PF_X);
+					  es->es_vaddr, es->es_memsz,
+					  es->es_flags & PF_R,
+					  es->es_flags & PF_W,
+					  es->es_flags & PF_X);
 		if (result) {
 			return result;
 		}
@@ -262,35 +410,27 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 * Now actually load each segment.
 	 */
 
-	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
-
-		result = VOP_READ(v, &ku);
-		if (result) {
-			return result;
-		}
-
-		if (ku.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
-		}
-
-		switch (ph.p_type) {
-		    case PT_NULL: /* skip */ continue;
-		    case PT_PHDR: /* skip */ continue;
-		    case PT_MIPS_REGINFO: /* skip */ continue;
-		    case PT_LOAD: break;
-		    default:
-			kprintf("loadelf: unknown segment type %d\n",
-				ph.p_type);
-			return ENOEXEC;
+	for (i=0; i<img.ei_nsegs; i++) {
+		es = &img.ei_segs[i];
+
+#if !OPT_DUMBVM
+		if ((es->es_flags & PF_W) == 0 && es->es_filesz > 0 &&
+		    es->es_filesz <= es->es_memsz) {
+			result = as_map_file(as, es->es_vaddr, es->es_filesz,
+					     v, es->es_offset);
+			if (result == 0) {
+				continue;
+			}
+			if (result != EINVAL) {
+				return result;
+			}
+			/* Can't be mapped; load it after all */
 		}
+#endif
 
-		result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
-				      ph.p_memsz, ph.p_filesz,
-				      ph.p_flags & PF_X);
+		result = load_segment(as, v, es->es_offset, es->es_vaddr,
+				      es->es_memsz, es->es_filesz,
+				      es->es_flags & PF_X);
 		if (result) {
 			return result;
 		}
@@ -301,7 +441,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		return result;
 	}
 
-	*entrypoint = eh.e_entry;
+	*entrypoint = img.ei_entry;
 
 	return 0;
 }
@@ -0,0 +1,383 @@
+/*
+ * Memory system calls: sbrk, memory-mapped files with mmap, munmap,
+ * msync and madvise, and locking memory with mlock, munlock,
+ * mlockall and munlockall.
+ *
+ * The address space does the work (as_mmap and friends in
+ * vm/addrspace.c): a mapping is a region whose pages vm_fault takes
+ * from the file cache on first touch, or, for anonymous shared memory,
+ * from a segment shared across fork (vm/shm.c). The calls here check
+ * the arguments against the open file. With dumbvm there is no file
+ * cache or heap, and they all fail with ENOSYS.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <vnode.h>
+#include <openfile.h>
+#include <filetable.h>
+#include <syscall.h>
+#include "opt-dumbvm.h"
+
+#if !OPT_DUMBVM
+/* mmap_populate - Fault in a new mapping now, if asked to */
+static void mmap_populate(vaddr_t va, size_t len, int flags) {
+    struct addrspace *as = proc_getas();
+
+    if ((flags & MAP_POPULATE) || as->as_lockfuture) {
+        as_populate(as, va, len);
+    }
+}
+#endif
+
+/* sys_mmap - Map a file into memory
+ *
+ *   Maps len bytes of the file open as fd, from offset on, at an
+ *   address of the kernel's choosing; addr is only a hint and is
+ *   ignored. Pages are read in when first touched. With MAP_SHARED
+ *   writes go back to the file; with MAP_PRIVATE they stay private.
+ *   Pages past the end of the file read as zeros.
+ *
+ *   With MAP_ANON there is no file: fd is ignored, offset must be 0,
+ *   and the pages start out zero. MAP_SHARED | MAP_ANON memory is
+ *   shared with children forked later, which see each other's writes.
+ *
+ *   With MAP_POPULATE, or after mlockall(MCL_FUTURE), the pages are
+ *   faulted in before returning (and locked, after MCL_FUTURE), as
+ *   far as memory allows, so the first touch doesn't wait.
+ *
+ * Arguments:
+ *   addr   - Hint (ignored)
+ *   len    - Bytes to map
+ *   prot   - PROT_* bits; only PROT_WRITE is enforced
+ *   flags  - MAP_SHARED or MAP_PRIVATE, maybe with MAP_ANON and
+ *            MAP_POPULATE
+ *   fd     - Open file to map (ignored with MAP_ANON)
+ *   offset - Offset in the file, a multiple of the page size
+ *   retval - Gets the mapping's address
+ *
+ * Returns:
+ *   0 on success
+ *   EBADF   - fd is invalid or not open
+ *   EACCES  - fd isn't open for reading, or is MAP_SHARED with
+ *             PROT_WRITE and isn't open for writing
+ *   EINVAL  - len is 0, offset is negative or unaligned (or not 0
+ *             with MAP_ANON), or bad flags
+ *   ENODEV  - The file can't be mapped (a device, say)
+ *   ENOMEM  - No room in the address space, or out of memory
+ *   ENOSYS  - Not supported by this VM system (dumbvm)
+ */
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+             off_t offset, int32_t *retval) {
+#if OPT_DUMBVM
+    (void)addr; (void)len; (void)prot; (void)flags; (void)fd;
+    (void)offset; (void)retval;
+    return ENOSYS;
+#else
+    struct openfile *of;
+    vaddr_t va;
+    bool anon = false;
+    int perm, type, result;
+
+    (void)addr;
+
+    type = flags & ~(MAP_ANON | MAP_POPULATE);
+    if (len == 0 || offset < 0 || offset % PAGE_SIZE != 0 ||
+        (type != MAP_SHARED && type != MAP_PRIVATE)) {
+        return EINVAL;
+    }
+
+    perm = VR_READ;
+    if (prot & PROT_WRITE) {
+        perm |= VR_WRITE;
+    }
+    if (prot & PROT_EXEC) {
+        perm |= VR_EXEC;
+    }
+    if (type == MAP_SHARED) {
+        perm |= VR_SHARED;
+    }
+
+    if (flags & MAP_ANON) {
+        /* No file: zero-fill pages, or a shared memory segment */
+        if (offset != 0) {
+            return EINVAL;
+        }
+        result = as_mmap(proc_getas(), len, perm, NULL, 0, &va);
+        if (result) {
+            return result;
+        }
+        mmap_populate(va, len, flags);
+        *retval = (int32_t)va;
+        return 0;
+    }
+
+    of = filetable_get(curproc, fd);
+    if (of == NULL) {
+        return EBADF;
+    }
+    if ((of->mode & O_ACCMODE) == O_WRONLY ||
+        (type == MAP_SHARED && (prot & PROT_WRITE) &&
+         (of->mode & O_ACCMODE) == O_RDONLY)) {
+        openfile_decref(of);
+        return EACCES;
+    }
+
+    /* Ask the file system whether this kind of file can be mapped */
+    result = VOP_MMAP(of->vn, &anon);
+    if (result) {
+        openfile_decref(of);
+        return result;
+    }
+
+    /*
+     * The mapping holds the vnode itself, not the open file; or, for
+     * a file that maps as zero-fill memory (zero:), nothing.
+     */
+    result = as_mmap(proc_getas(), len, perm, anon ? NULL : of->vn,
+                     anon ? 0 : offset, &va);
+    openfile_decref(of);
+    if (result) {
+        return result;
+    }
+
+    mmap_populate(va, len, flags);
+    *retval = (int32_t)va;
+    return 0;
+#endif
+}
+
+/* sys_munmap - Remove memory mappings
+ *
+ *   Removes the mappings in the len bytes from addr, writing back
+ *   changed pages of shared ones first. Only whole mappings made by
+ *   mmap can be removed. A range with no mappings in it is fine.
+ *
+ * Arguments:
+ *   addr - Start of the range, page-aligned
+ *   len  - Length of the range
+ *
+ * Returns:
+ *   0 on success
+ *   EINVAL  - Bad range, or it would split a mapping or take part of
+ *             the program or stack
+ *   ENOSYS  - Not supported by this VM system (dumbvm)
+ */
+int sys_munmap(userptr_t addr, size_t len) {
+#if OPT_DUMBVM
+    (void)addr; (void)len;
+    return ENOSYS;
+#else
+    return as_munmap(proc_getas(), (vaddr_t)addr, len);
+#endif
+}
+
+/* sys_msync - Write back changes to shared mappings
+ *
+ *   Writes the changed pages of the shared mappings in the len bytes
+ *   from addr back to their files. The write is always done before
+ *   returning, even with MS_ASYNC.
+ *
+ * Arguments:
+ *   addr  - Start of the range, page-aligned
+ *   len   - Length of the range
+ *   flags - MS_SYNC or MS_ASYNC, optionally with MS_INVALIDATE
+ *
+ * Returns:
+ *   0 on success
+ *   EINVAL  - Bad range or flags
+ *   EIO     - A write failed
+ *   ENOSYS  - Not supported by this VM system (dumbvm)
+ */
+int sys_msync(userptr_t addr, size_t len, int flags) {
+#if OPT_DUMBVM
+    (void)addr; (void)len; (void)flags;
+    return ENOSYS;
+#else
+    if ((flags & ~(MS_ASYNC | MS_SYNC | MS_INVALIDATE)) != 0 ||
+        (flags & (MS_ASYNC | MS_SYNC)) == (MS_ASYNC | MS_SYNC)) {
+        return EINVAL;
+    }
+    /* Mapped pages are the file cache's, so there is nothing to drop */
+    return as_msync(proc_getas(), (vaddr_t)addr, len);
+#endif
+}
+
+/* sys_madvise - Say how memory is going to be used
+ *
+ *   Advice about the len bytes from addr, for the VM system to plan
+ *   around. MADV_SEQUENTIAL has file pages mapped ahead of each fault
+ *   and the pages behind it evicted first; MADV_RANDOM and MADV_NORMAL
+ *   go back to mapping just the page touched. MADV_WILLNEED reads the
+ *   range's file pages in now; MADV_DONTNEED throws the range's pages
+ *   away (after writing back shared ones), so they come back from
+ *   the file, or as zeros if there is none. The first three apply to
+ *   whole mappings, wherever in them the range falls.
+ *
+ * Arguments:
+ *   addr   - Start of the range, page-aligned
+ *   len    - Length of the range
+ *   advice - MADV_*
+ *
+ * Returns:
+ *   0 on success
+ *   EINVAL  - Bad range or advice
+ *   ENOSYS  - Not supported by this VM system (dumbvm)
+ */
+int sys_madvise(userptr_t addr, size_t len, int advice) {
+#if OPT_DUMBVM
+    (void)addr; (void)len; (void)advice;
+    return ENOSYS;
+#else
+    if (advice < MADV_NORMAL || advice > MADV_DONTNEED) {
+        return EINVAL;
+    }
+    return as_madvise(proc_getas(), (vaddr_t)addr, len, advice);
+#endif
+}
+
+/* sys_sbrk - Move the end of the heap
+ *
+ *   The heap starts out empty, page-aligned, above the program. New
+ *   pages read as zeros and aren't allocated until touched (unless
+ *   mlockall(MCL_FUTURE) is in force, when they are faulted in and
+ *   locked at once); pages given back are freed.
+ *
+ * Arguments:
+ *   amount - Bytes to grow (or, negative, shrink) the heap by; a
+ *            multiple of the page size
+ *   retval - Gets the old end of the heap
+ *
+ * Returns:
+ *   0 on success
+ *   EINVAL  - amount isn't page-aligned, or would shrink the heap
+ *             below its start
+ *   ENOMEM  - No room for the heap to grow
+ *   ENOSYS  - Not supported by this VM system (dumbvm)
+ */
+int sys_sbrk(intptr_t amount, int32_t *retval) {
+#if OPT_DUMBVM
+    (void)amount; (void)retval;
+    return ENOSYS;
+#else
+    vaddr_t oldend;
+    int result;
+
+    result = as_sbrk(proc_getas(), amount, &oldend);
+    if (result) {
+        return result;
+    }
+    if (amount > 0 && proc_getas()->as_lockfuture) {
+        as_populate(proc_getas(), oldend, amount);
+    }
+    *retval = (int32_t)oldend;
+    return 0;
+#endif
+}
+
+/* sys_mlock - Lock memory
+ *
+ *   Faults in the pages in the len bytes from addr and locks them in
+ *   memory: they are never paged out, so touching them never waits
+ *   for the disk. Locks don't nest; one munlock undoes any number of
+ *   mlocks. A child made by fork doesn't inherit them, but gets its
+ *   own copy of each locked page at once.
+ *
+ * Arguments:
+ *   addr - Start of the range, page-aligned
+ *   len  - Length of the range
+ *
+ * Returns:
+ *   0 on success
+ *   EINVAL  - Bad range
+ *   ENOMEM  - Part of the range isn't mapped, it would pass
+ *             RLIMIT_MEMLOCK, or out of memory
+ *   EAGAIN  - Too much memory is locked already
+ *   ENOSYS  - Not supported by this VM system (dumbvm)
+ */
+int sys_mlock(userptr_t addr, size_t len) {
+#if OPT_DUMBVM
+    (void)addr; (void)len;
+    return ENOSYS;
+#else
+    return as_mlock(proc_getas(), (vaddr_t)addr, len, true);
+#endif
+}
+
+/* sys_munlock - Unlock memory
+ *
+ *   Lets the pages in the len bytes from addr be paged out again.
+ *
+ * Arguments:
+ *   addr - Start of the range, page-aligned
+ *   len  - Length of the range
+ *
+ * Returns:
+ *   0 on success
+ *   EINVAL  - Bad range
+ *   ENOMEM  - Part of the range isn't mapped
+ *   ENOSYS  - Not supported by this VM system (dumbvm)
+ */
+int sys_munlock(userptr_t addr, size_t len) {
+#if OPT_DUMBVM
+    (void)addr; (void)len;
+    return ENOSYS;
+#else
+    return as_mlock(proc_getas(), (vaddr_t)addr, len, false);
+#endif
+}
+
+/* sys_mlockall - Lock the whole address space
+ *
+ *   MCL_CURRENT locks everything mapped now, as mlock does. With
+ *   MCL_FUTURE, pages are locked as they come in from then on, and
+ *   new mmap mappings and heap are faulted in at once. MCL_ONEXEC
+ *   (ours) applies to the next program execv runs instead: it starts
+ *   with everything locked and MCL_FUTURE set, so a latency-sensitive
+ *   program can be started locked without changing it.
+ *
+ * Arguments:
+ *   flags - MCL_CURRENT, MCL_FUTURE and/or MCL_ONEXEC
+ *
+ * Returns:
+ *   0 on success
+ *   EINVAL  - flags is 0 or has unknown bits
+ *   ENOMEM  - It would pass RLIMIT_MEMLOCK, or out of memory
+ *   EAGAIN  - Too much memory is locked already
+ *   ENOSYS  - Not supported by this VM system (dumbvm)
+ */
+int sys_mlockall(int flags) {
+#if OPT_DUMBVM
+    (void)flags;
+    return ENOSYS;
+#else
+    if (flags == 0 ||
+        (flags & ~(MCL_CURRENT | MCL_FUTURE | MCL_ONEXEC)) != 0) {
+        return EINVAL;
+    }
+    return as_mlockall(proc_getas(), flags);
+#endif
+}
+
+/* sys_munlockall - Unlock the whole address space
+ *
+ *   Unlocks everything, and cancels MCL_FUTURE and MCL_ONEXEC.
+ *
+ * Returns:
+ *   0 on success
+ *   ENOSYS  - Not supported by this VM system (dumbvm)
+ */
+int sys_munlockall(void) {
+#if OPT_DUMBVM
+    return ENOSYS;
+#else
+    as_munlockall(proc_getas());
+    return 0;
+#endif
+}
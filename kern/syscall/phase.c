@@ -0,0 +1,145 @@
+/*
+ * Phase markers. See <kern/phase.h> and <phase.h>.
+ *
+ * The names live in a small table under a spinlock, each with counts
+ * of how many times it is open, with and without profiling. The
+ * ltrace writes are single stores to the device, so they're done with
+ * the lock held, which keeps the markers and the profiler switching in
+ * the order the calls took effect. Announcing a new name on the
+ * console can't be, so it's done between looking the name up and
+ * sending its first marker.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/phase.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <copyinout.h>
+#include <phase.h>
+#include <syscall.h>
+#include <lamebus/ltrace.h>
+
+struct phase {
+	char ph_name[PHASE_NAMELEN];
+	unsigned ph_open;		/* begun and not yet ended */
+	unsigned ph_profopen;		/* of those, begun with PHASE_PROF */
+};
+
+static struct spinlock phase_lock = SPINLOCK_INITIALIZER;
+static struct phase phases[PHASE_MAX];
+static unsigned phase_count;
+static unsigned phase_profdepth;	/* open PHASE_PROF phases */
+
+/*
+ * Find NAME's number, or give it the next one and set *ISNEW. Returns
+ * -1 if the table is full. Call with the lock held.
+ */
+static
+int
+phase_lookup(const char *name, bool *isnew)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&phase_lock));
+
+	for (i=0; i<phase_count; i++) {
+		if (!strcmp(phases[i].ph_name, name)) {
+			return i;
+		}
+	}
+	if (phase_count == PHASE_MAX) {
+		return -1;
+	}
+	strcpy(phases[phase_count].ph_name, name);
+	phases[phase_count].ph_open = 0;
+	phases[phase_count].ph_profopen = 0;
+	*isnew = true;
+	return phase_count++;
+}
+
+int
+phase_op(int op, const char *name)
+{
+	bool prof, isnew;
+	int id;
+
+	prof = (op & PHASE_PROF) != 0;
+	switch (op & ~PHASE_PROF) {
+	    case PHASE_MARK:
+		if (prof) {
+			return EINVAL;
+		}
+		break;
+	    case PHASE_BEGIN:
+	    case PHASE_END:
+		break;
+	    case PHASE_ERASEPROF:
+		if (prof) {
+			return EINVAL;
+		}
+		ltrace_eraseprof();
+		return 0;
+	    default:
+		return EINVAL;
+	}
+	if (strlen(name) >= PHASE_NAMELEN) {
+		return ENAMETOOLONG;
+	}
+
+	isnew = false;
+	spinlock_acquire(&phase_lock);
+	id = phase_lookup(name, &isnew);
+	spinlock_release(&phase_lock);
+	if (id < 0) {
+		return ENOSPC;
+	}
+	if (isnew) {
+		kprintf("phase %d: %s\n", id, name);
+	}
+
+	spinlock_acquire(&phase_lock);
+	if ((op & PHASE_OPMASK) == PHASE_END) {
+		if (phases[id].ph_open == 0 ||
+		    (prof && phases[id].ph_profopen == 0)) {
+			spinlock_release(&phase_lock);
+			return EINVAL;
+		}
+		phases[id].ph_open--;
+	}
+	else if ((op & PHASE_OPMASK) == PHASE_BEGIN) {
+		phases[id].ph_open++;
+	}
+	if (prof && (op & PHASE_OPMASK) == PHASE_BEGIN) {
+		phases[id].ph_profopen++;
+		if (phase_profdepth++ == 0) {
+			ltrace_setprof(1);
+		}
+	}
+	ltrace_debug(PHASE_CODE((unsigned)op, (unsigned)id));
+	if (prof && (op & PHASE_OPMASK) == PHASE_END) {
+		phases[id].ph_profopen--;
+		if (--phase_profdepth == 0) {
+			ltrace_setprof(0);
+		}
+	}
+	spinlock_release(&phase_lock);
+
+	return 0;
+}
+
+int
+sys_phase(int op, const_userptr_t name)
+{
+	char kname[PHASE_NAMELEN];
+	int result;
+
+	if ((op & PHASE_OPMASK) == PHASE_ERASEPROF) {
+		return phase_op(op, "");
+	}
+	result = copyinstr(name, kname, sizeof(kname), NULL);
+	if (result) {
+		return result;
+	}
+	return phase_op(op, kname);
+}
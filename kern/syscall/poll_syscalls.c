@@ -0,0 +1,159 @@
+/*
+ * poll: waiting for any of several file handles to become ready.
+ *
+ * Each pass asks every handle's vnode which of the wanted events are
+ * ready (VOP_POLL). If none are, the first pass has also left the
+ * pollset registered on the wait queue of everything that wasn't, so
+ * we sleep until one of them calls pollhead_wakeup, then look again.
+ * We hold a reference to each open file throughout, so nothing we're
+ * registered with can go away underneath us.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/limits.h>
+#include <lib.h>
+#include <clock.h>
+#include <copyinout.h>
+#include <current.h>
+#include <proc.h>
+#include <openfile.h>
+#include <filetable.h>
+#include <vnode.h>
+#include <poll.h>
+#include <syscall.h>
+
+/* Events that are reported whether asked for or not */
+#define POLL_ALWAYS	(POLLERR | POLLHUP | POLLNVAL)
+
+/*
+ * One pass over the handles. Returns how many have events.
+ */
+static
+unsigned
+poll_scan(struct pollfd *pfds, struct openfile **ofs, unsigned nfds,
+	  struct pollset *ps)
+{
+	unsigned i, n;
+	int revents;
+
+	n = 0;
+	for (i=0; i<nfds; i++) {
+		if (pfds[i].fd < 0) {
+			revents = 0;
+		}
+		else if (ofs[i] == NULL) {
+			revents = POLLNVAL;
+		}
+		else if (VOP_POLL(ofs[i]->vn,
+				  pfds[i].events & (POLLIN|POLLPRI|POLLOUT),
+				  ps, &revents)) {
+			revents = POLLERR;
+		}
+		pfds[i].revents = revents & (pfds[i].events | POLL_ALWAYS);
+		if (pfds[i].revents != 0) {
+			n++;
+		}
+	}
+	return n;
+}
+
+/*
+ * poll(fds, nfds, timeout)
+ *
+ * Fills in revents for each of the NFDS entries in FDS, waiting
+ * until at least one is nonzero or TIMEOUT milliseconds have passed.
+ * A negative TIMEOUT waits forever; 0 doesn't wait. Returns how many
+ * entries have events, so 0 on timeout.
+ */
+int
+sys_poll(userptr_t fds, unsigned nfds, int timeout, int *retval)
+{
+	struct pollfd *pfds;
+	struct openfile **ofs;
+	struct pollset *ps;
+	struct timespec now, deadline, left;
+	uint64_t ticks;
+	unsigned i, n;
+	int result;
+
+	if (nfds > __OPEN_MAX) {
+		return EINVAL;
+	}
+
+	pfds = kmalloc(nfds * sizeof(*pfds) + 1);
+	ofs = kmalloc(nfds * sizeof(*ofs) + 1);
+	if (pfds == NULL || ofs == NULL) {
+		kfree(pfds);
+		kfree(ofs);
+		return ENOMEM;
+	}
+	result = copyin(fds, pfds, nfds * sizeof(*pfds));
+	if (result) {
+		kfree(pfds);
+		kfree(ofs);
+		return result;
+	}
+
+	for (i=0; i<nfds; i++) {
+		ofs[i] = pfds[i].fd < 0 ? NULL
+			: filetable_get(curproc, pfds[i].fd);
+	}
+
+	ps = NULL;
+	if (timeout != 0) {
+		/* Two registrations at most per handle, in and out */
+		ps = pollset_create(2 * nfds);
+		if (ps == NULL) {
+			result = ENOMEM;
+			goto out;
+		}
+	}
+	if (timeout > 0) {
+		gettime(&now);
+		left.tv_sec = timeout / 1000;
+		left.tv_nsec = (timeout % 1000) * 1000000;
+		timespec_add(&now, &left, &deadline);
+	}
+
+	/* Only the first pass registers; the rest just look. */
+	n = poll_scan(pfds, ofs, nfds, ps);
+	while (n == 0 && timeout != 0) {
+		ticks = 0;
+		if (timeout > 0) {
+			gettime(&now);
+			timespec_sub(&deadline, &now, &left);
+			if (left.tv_sec < 0 ||
+			    (left.tv_sec == 0 && left.tv_nsec == 0)) {
+				break;
+			}
+			ticks = timespec_to_ticks(&left);
+			if (ticks == 0) {
+				ticks = 1;
+			}
+			else if (ticks > 0x7fffffff) {
+				ticks = 0x7fffffff;
+			}
+		}
+		/* A timeout just means one last look */
+		pollset_wait(ps, ticks);
+		n = poll_scan(pfds, ofs, nfds, NULL);
+	}
+
+	result = copyout(pfds, fds, nfds * sizeof(*pfds));
+	if (result == 0) {
+		*retval = n;
+	}
+
+ out:
+	if (ps != NULL) {
+		pollset_destroy(ps);
+	}
+	for (i=0; i<nfds; i++) {
+		if (ofs[i] != NULL) {
+			openfile_decref(ofs[i]);
+		}
+	}
+	kfree(ofs);
+	kfree(pfds);
+	return result;
+}
@@ -24,6 +24,10 @@
 #include <kern/stat.h>
 #include <kern/wait.h>
 #include <kern/limits.h>
+#include <kern/resource.h>
+#include <kern/spawn.h>
+#include <kern/mman.h>
+#include <filetable.h>
 
 #if OPT_SHELL
 
@@ -40,6 +44,25 @@ pid_t sys_getpid() {
   return result;
 }
 
+/* fork_copyfiles - Give CHILD the current process's cwd and open files */
+static void fork_copyfiles(struct proc *child) {
+    /* Duplicate current working directory */
+    spinlock_acquire(&curproc->p_lock);
+    if (curproc->p_cwd != NULL) {
+        VOP_INCREF(curproc->p_cwd);
+        child->p_cwd = curproc->p_cwd;
+    }
+    spinlock_release(&curproc->p_lock);
+
+    /* Share the file table; it is copied when either side changes it */
+    filetable_fork(curproc, child);
+}
+
+/* fork_dropfiles - Undo fork_copyfiles's file table, if CHILD never ran */
+static void fork_dropfiles(struct proc *child) {
+    filetable_drop(child);
+}
+
 /* sys_fork - Fork a new process
  *
  *   Creates a new process by duplicating the calling process.
@@ -52,6 +75,8 @@ pid_t sys_getpid() {
  *
  * Returns:
  *   0 on success
+ *   EMPROC  - RLIMIT_NPROC reached
+ *   ENPROC  - No process slot for the child
  *   ENOMEM  - Insufficient memory to create the new process
  */
 int sys_fork(struct trapframe *tf, pid_t *retval) {
@@ -62,15 +87,17 @@ int sys_fork(struct trapframe *tf, pid_t *retval) {
     /* ASSERTING CURRENT PROCESS TO ACTUALLY EXIST */
     KASSERT(curproc != NULL);
 
+    /* RLIMIT_NPROC: there is only one user, so everyone counts */
+    if (proc_count() >= proc_getrlimit(curproc, RLIMIT_NPROC)) {
+        return EMPROC;
+    }
+
     /* Create a new process */
     child_proc = proc_create_fork(curproc->p_name);
     if (child_proc == NULL) {
         return ENPROC;  /* No available PID */
     }
 
-    /* Set parent relationship */
-    child_proc->parent_pid = curproc->p_pid;
-
     /* Copy the address space */
     result = as_copy(curproc->p_addrspace, &child_proc->p_addrspace);
     if (result) {
@@ -79,43 +106,23 @@ int sys_fork(struct trapframe *tf, pid_t *retval) {
         return result; /* Address space copy failed */
     }
 
-    /* Duplicate current working directory */
-    spinlock_acquire(&curproc->p_lock);
-    if (curproc->p_cwd != NULL) {
-        VOP_INCREF(curproc->p_cwd);
-        child_proc->p_cwd = curproc->p_cwd;
-    }
-    spinlock_release(&curproc->p_lock);
-
-    /* Duplicate file table entries */
-    for (int i = 0; i < OPEN_MAX; i++) {
-        if (curproc->fileTable[i] != NULL) {
-            struct openfile *of = curproc->fileTable[i];
-            lock_acquire(of->lock);
-            of->count++;
-            lock_release(of->lock);
-            child_proc->fileTable[i] = of;
-        }
-    }
+    /* Duplicate cwd and file table */
+    fork_copyfiles(child_proc);
 
     /* Copy the trapframe for the child */
     child_tf = kmalloc(sizeof(struct trapframe));
     if (child_tf == NULL) {
         /* Cleanup file table */
-        for (int i = 0; i < OPEN_MAX; i++) {
-            if (child_proc->fileTable[i] != NULL) {
-                lock_acquire(child_proc->fileTable[i]->lock);
-                child_proc->fileTable[i]->count--;
-                lock_release(child_proc->fileTable[i]->lock);
-                child_proc->fileTable[i] = NULL;
-            }
-        }
+        fork_dropfiles(child_proc);
         proc_remove(child_proc->p_pid);
         proc_destroy(child_proc);
         return ENOMEM;
     }
     *child_tf = *tf;
 
+    /* Set parent relationship, before the child can exit */
+    proc_addchild(curproc, child_proc);
+
     /* Create a new thread for the child process */
     result = thread_fork(
         curthread->t_name,
@@ -126,15 +133,9 @@ int sys_fork(struct trapframe *tf, pid_t *retval) {
     );
     if (result) {
         kfree(child_tf);
+        proc_remchild(curproc, child_proc);
         /* Cleanup file table */
-        for (int i = 0; i < OPEN_MAX; i++) {
-            if (child_proc->fileTable[i] != NULL) {
-                lock_acquire(child_proc->fileTable[i]->lock);
-                child_proc->fileTable[i]->count--;
-                lock_release(child_proc->fileTable[i]->lock);
-                child_proc->fileTable[i] = NULL;
-            }
-        }
+        fork_dropfiles(child_proc);
         proc_remove(child_proc->p_pid);
         proc_destroy(child_proc);
         return result;
@@ -150,7 +151,9 @@ int sys_fork(struct trapframe *tf, pid_t *retval) {
  *
  *   Replaces the current process's address space with a new program
  *   loaded from the specified executable file, and sets up the user stack
- *   with the provided arguments.
+ *   with the provided arguments. After mlockall(MCL_ONEXEC), the new
+ *   program's memory is locked before it starts, as if it had called
+ *   mlockall(MCL_CURRENT | MCL_FUTURE) itself.
  *
  * Arguments:
  *   program - Pointer to the name of the executable file
@@ -161,14 +164,15 @@ int sys_fork(struct trapframe *tf, pid_t *retval) {
  *   EFAULT  - Invalid pointer provided
  *   ENOMEM  - Insufficient memory to load the program
  *   E2BIG   - Argument list too long
+ *   EAGAIN  - The new program can't be locked (MCL_ONEXEC)
  */
 int sys_execv(const char *program, char **args) {
     struct vnode *v;
     vaddr_t entrypoint, stackptr;
     struct addrspace *new_as, *old_as;
-    char **kernel_args = NULL;
+    struct argbuf kernel_args;
     char *kernel_progname = NULL;
-    int argc = 0, result;
+    int argc, result;
 
     /* Validate input arguments */
     if (!program || !args) {
@@ -180,26 +184,30 @@ int sys_execv(const char *program, char **args) {
     if (result) return result;
 
     /* Copy arguments from user space */
-    result = copy_arguments(args, &kernel_args, &argc);
+    result = copy_arguments(args, &kernel_args);
     if (result) {
-        kfree(kernel_progname);
+        pathbuf_put(kernel_progname);
         return result;
     }
 
     /* Open the executable file */
     result = vfs_open(kernel_progname, O_RDONLY, 0, &v);
     if (result) {
-        cleanup_arguments(kernel_args, argc);
-        kfree(kernel_progname);
+        cleanup_arguments(&kernel_args);
+        pathbuf_put(kernel_progname);
         return result;
     }
 
+    /* Only the calling thread survives, whether or not the rest works */
+    uthread_single(true);
+    aio_exit(curproc);
+
     /* Create new address space */
     new_as = as_create();
     if (!new_as) {
         vfs_close(v);
-        cleanup_arguments(kernel_args, argc);
-        kfree(kernel_progname);
+        cleanup_arguments(&kernel_args);
+        pathbuf_put(kernel_progname);
         return ENOMEM;
     }
 
@@ -212,8 +220,8 @@ int sys_execv(const char *program, char **args) {
     if (result) {
         restore_old_address_space(old_as, new_as);
         vfs_close(v);
-        cleanup_arguments(kernel_args, argc);
-        kfree(kernel_progname);
+        cleanup_arguments(&kernel_args);
+        pathbuf_put(kernel_progname);
         return result;
     }
     vfs_close(v);
@@ -222,23 +230,42 @@ int sys_execv(const char *program, char **args) {
     result = as_define_stack(new_as, &stackptr);
     if (result) {
         restore_old_address_space(old_as, new_as);
-        cleanup_arguments(kernel_args, argc);
-        kfree(kernel_progname);
+        cleanup_arguments(&kernel_args);
+        pathbuf_put(kernel_progname);
         return result;
     }
 
     /* Copy arguments to user stack */
-    result = copy_args_to_stack(kernel_args, argc, &stackptr);
+    result = copy_args_to_stack(&kernel_args, &stackptr);
     if (result) {
         restore_old_address_space(old_as, new_as);
-        cleanup_arguments(kernel_args, argc);
-        kfree(kernel_progname);
+        cleanup_arguments(&kernel_args);
+        pathbuf_put(kernel_progname);
         return result;
     }
 
+#if !OPT_DUMBVM
+    /* After mlockall(MCL_ONEXEC), the program starts out locked */
+    if (old_as->as_lockonexec) {
+        result = as_mlockall(new_as, MCL_CURRENT | MCL_FUTURE);
+        if (result) {
+            restore_old_address_space(old_as, new_as);
+            cleanup_arguments(&kernel_args);
+            pathbuf_put(kernel_progname);
+            return result;
+        }
+    }
+#endif
+
     /* Cleanup before executing */
-    cleanup_arguments(kernel_args, argc);
-    kfree(kernel_progname);
+    argc = kernel_args.ab_argc;
+    cleanup_arguments(&kernel_args);
+    pathbuf_put(kernel_progname);
+
+    /* The profil() histogram went with the old image */
+    spinlock_acquire(&curproc->p_lock);
+    curproc->p_profscale = 0;
+    spinlock_release(&curproc->p_lock);
 
     /* Execute new process */
     enter_new_process(argc, (userptr_t)stackptr, NULL, stackptr, entrypoint);
@@ -247,145 +274,382 @@ int sys_execv(const char *program, char **args) {
     return EINVAL;
 }
 
-/* sys_waitpid - Wait for a specific child process to exit
+/* What a spawned child needs from its parent, all in kernel memory */
+struct spawn_args {
+    char *progname;
+    struct argbuf args;
+    int nactions;
+    struct spawn_action actions[SPAWN_MAXACTIONS];
+    char *paths[SPAWN_MAXACTIONS];      /* For SPAWN_OPEN */
+    struct semaphore *done;             /* Child has loaded, or failed */
+    int result;
+};
+
+/* spawn_copyactions - Copy in and check the file actions for __spawn */
+static int spawn_copyactions(userptr_t actions, int nactions,
+                             struct spawn_args *sa) {
+    struct spawn_action *act;
+    int i, result;
+
+    if (nactions < 0 || nactions > SPAWN_MAXACTIONS) {
+        return EINVAL;
+    }
+    if (nactions == 0) {
+        return 0;
+    }
+    result = copyin(actions, sa->actions, nactions * sizeof(sa->actions[0]));
+    if (result) {
+        return result;
+    }
+    sa->nactions = nactions;
+
+    for (i = 0; i < nactions; i++) {
+        act = &sa->actions[i];
+        switch (act->sa_op) {
+        case SPAWN_OPEN:
+            result = copyin_path((const_userptr_t)act->sa_path,
+                                 &sa->paths[i]);
+            if (result) {
+                return result;
+            }
+            break;
+        case SPAWN_CLOSE:
+        case SPAWN_DUP2:
+            break;
+        default:
+            return EINVAL;
+        }
+    }
+    return 0;
+}
+
+/* spawn_free - Free a spawn_args and everything it points to */
+static void spawn_free(struct spawn_args *sa) {
+    int i;
+
+    for (i = 0; i < sa->nactions; i++) {
+        if (sa->paths[i] != NULL) {
+            pathbuf_put(sa->paths[i]);
+        }
+    }
+    if (sa->args.ab_buf != NULL) {
+        cleanup_arguments(&sa->args);
+    }
+    if (sa->progname != NULL) {
+        pathbuf_put(sa->progname);
+    }
+    if (sa->done != NULL) {
+        sem_destroy(sa->done);
+    }
+    kfree(sa);
+}
+
+/* spawn_fileactions - Do the file actions, in the child */
+static int spawn_fileactions(struct spawn_args *sa) {
+    struct spawn_action *act;
+    int i, fd, dummy, result;
+
+    for (i = 0; i < sa->nactions; i++) {
+        act = &sa->actions[i];
+        switch (act->sa_op) {
+        case SPAWN_OPEN:
+            if (act->sa_fd < 0 || act->sa_fd >= OPEN_MAX) {
+                return EBADF;
+            }
+            result = file_open(sa->paths[i], act->sa_flags, act->sa_mode,
+                               &fd);
+            if (result) {
+                return result;
+            }
+            /* It's wanted as sa_fd, which may be in use */
+            if (fd != act->sa_fd) {
+                result = sys_dup2(fd, act->sa_fd, &dummy);
+                sys_close(fd);
+            }
+            break;
+        case SPAWN_CLOSE:
+            result = sys_close(act->sa_fd);
+            break;
+        case SPAWN_DUP2:
+            result = sys_dup2(act->sa_fd, act->sa_newfd, &dummy);
+            break;
+        default:
+            /* spawn_copyactions checked */
+            panic("spawn_fileactions: bad op %d\n", act->sa_op);
+        }
+        if (result) {
+            return result;
+        }
+    }
+    return 0;
+}
+
+/* spawn_start - First function of a spawned child
+ *
+ *   Does the file actions and loads the program into a fresh address
+ *   space, then tells the parent how it went. On failure the child
+ *   just exits, and the parent reaps it.
+ */
+static void spawn_start(void *data, unsigned long unused) {
+    struct spawn_args *sa = data;
+    struct addrspace *as;
+    struct vnode *v;
+    vaddr_t entrypoint = 0, stackptr = 0;
+    int argc, result;
+
+    (void)unused;
+
+    result = spawn_fileactions(sa);
+    if (result) {
+        goto done;
+    }
+
+    result = vfs_open(sa->progname, O_RDONLY, 0, &v);
+    if (result) {
+        goto done;
+    }
+    as = as_create();
+    if (as == NULL) {
+        vfs_close(v);
+        result = ENOMEM;
+        goto done;
+    }
+    proc_setas(as);
+    as_activate();
+    result = load_elf(v, &entrypoint);
+    vfs_close(v);
+    if (result) {
+        goto done;
+    }
+    result = as_define_stack(as, &stackptr);
+    if (result) {
+        goto done;
+    }
+    result = copy_args_to_stack(&sa->args, &stackptr);
+
+ done:
+    argc = sa->args.ab_argc;
+    sa->result = result;
+    /* The parent frees SA once woken */
+    V(sa->done);
+
+    if (result) {
+        sys__exit(127);
+    }
+    enter_new_process(argc, (userptr_t)stackptr, NULL, stackptr, entrypoint);
+}
+
+/* sys___spawn - Start a program in a new child process
+ *
+ *   Like fork followed at once by execv in the child, without
+ *   copying the address space. The child shares the parent's open
+ *   files and cwd as after fork, then does the file actions in order,
+ *   then loads the program. The parent waits until the program has
+ *   loaded, so that failures are reported to it.
+ *
+ * Arguments:
+ *   program  - Pointer to the name of the executable file
+ *   args     - Pointer to an array of argument strings
+ *   actions  - User array of struct spawn_action
+ *   nactions - How many there are, up to SPAWN_MAXACTIONS
+ *   retval   - Pointer to store the child's process ID
+ *
+ * Returns:
+ *   0 on success
+ *   EFAULT  - Invalid pointer provided
+ *   EINVAL  - Too many or unknown file actions
+ *   EMPROC  - RLIMIT_NPROC reached
+ *   ENPROC  - No process slot for the child
+ *   ENOMEM  - Insufficient memory
+ *   E2BIG   - Argument list too long
+ *   Errors from the file actions and from loading the program
+ */
+int sys___spawn(const char *program, char **args, userptr_t actions,
+                int nactions, pid_t *retval) {
+    struct spawn_args *sa;
+    struct proc *child, *reaped;
+    pid_t pid;
+    int result;
+
+    if (!program || !args) {
+        return EFAULT;
+    }
+
+    sa = kmalloc(sizeof(*sa));
+    if (sa == NULL) {
+        return ENOMEM;
+    }
+    bzero(sa, sizeof(*sa));
+
+    result = copy_program_name(program, &sa->progname);
+    if (result) {
+        sa->progname = NULL;
+        goto out;
+    }
+    result = copy_arguments(args, &sa->args);
+    if (result) {
+        goto out;
+    }
+    result = spawn_copyactions(actions, nactions, sa);
+    if (result) {
+        goto out;
+    }
+    sa->done = sem_create("spawn", 0);
+    if (sa->done == NULL) {
+        result = ENOMEM;
+        goto out;
+    }
+
+    if (proc_count() >= proc_getrlimit(curproc, RLIMIT_NPROC)) {
+        result = EMPROC;
+        goto out;
+    }
+    child = proc_create_fork(sa->progname);
+    if (child == NULL) {
+        result = ENPROC;
+        goto out;
+    }
+    pid = child->p_pid;
+    fork_copyfiles(child);
+    proc_addchild(curproc, child);
+
+    result = thread_fork(sa->progname, child, spawn_start, sa, 0);
+    if (result) {
+        proc_remchild(curproc, child);
+        fork_dropfiles(child);
+        proc_remove(pid);
+        proc_destroy(child);
+        goto out;
+    }
+
+    P(sa->done);
+    result = sa->result;
+    if (result) {
+        /* It exits at once; reap it (unless a waitpid(-1) beat us) */
+        if (proc_waitchild(pid, false, &reaped) == 0) {
+            proc_reap(reaped);
+        }
+        goto out;
+    }
+    *retval = pid;
+
+ out:
+    spawn_free(sa);
+    return result;
+}
+
+/* sys_waitpid - Wait for a child process to exit
  *
- *   Waits for the child process with the specified PID to exit and retrieves
- *   its exit status.
+ *   Waits for the child process with the specified PID, or for any
+ *   child if PID is -1, to exit and retrieves its exit status. The
+ *   child is reaped even if the status can't be copied out.
  *
  * Arguments:
- *   pid     - Process ID of the child to wait for
+ *   pid     - Process ID of the child to wait for, or -1 for any
  *   status  - Pointer to store the exit status of the child
- *   options - Options for waiting (currently only WNOHANG is supported)
+ *   options - 0, or WNOHANG to return 0 at once if no child has exited
  *   retval  - Pointer to store the PID of the exited child
  *
  * Returns:
  *   0 on success
  *   EINVAL  - Invalid options provided
- *   ECHILD  - Specified PID is not a child of the calling process
+ *   ECHILD  - Specified PID is not a child of the calling process, or
+ *             there are no children to wait for
  *   ESRCH   - No such process with the specified PID
  *   EFAULT  - Invalid status pointer provided
  */
 int sys_waitpid(pid_t pid, int *status, int options, int *retval) {
-     /* 1. Check for invalid options */
-    if (options != 0)
-        return EINVAL;
+    struct proc *child;
+    int exitcode, result;
 
-    /* 2. Validate pid range */
-    if (pid <= 0 || pid > PROC_MAX)
-        return ESRCH;
+    /* 1. Check for invalid options */
+    if ((options & ~WNOHANG) != 0)
+        return EINVAL;
 
-    /* 3. Retrieve child process */
-    struct proc *child = proc_search(pid);
-    if (child == NULL)
+    /* 2. Validate pid range (no process groups) */
+    if (pid != -1 && (pid <= 0 || pid > PID_MAX))
         return ESRCH;
 
-    /* 4. Ensure the caller is the parent of this process */
-    if (child->parent_pid != curproc->p_pid)
-        return ECHILD;
-
-    /* 5. Wait until the child calls _exit() */
-    lock_acquire(child->p_locklock);
-    while (!child->p_exited) {
-        cv_wait(child->p_cv, child->p_locklock);
+    /* 3. Wait for a child that matches */
+    result = proc_waitchild(pid, (options & WNOHANG) != 0, &child);
+    if (result == ECHILD && pid != -1) {
+        rcu_read_lock();
+        if (proc_search(pid) == NULL)
+            result = ESRCH;
+        rcu_read_unlock();
     }
-    int exitcode = child->p_exitcode;
-    
-    /* 6. Wait until child thread count is 0 (child has fully exited) */
-    while (child->p_numthreads > 0) {
-        lock_release(child->p_locklock);
-        thread_yield(); /* Give child thread time to fully exit */
-        lock_acquire(child->p_locklock);
+    if (result)
+        return result;
+
+    /* 4. WNOHANG and nothing has exited yet */
+    if (child == NULL) {
+        *retval = 0;
+        return 0;
     }
-    lock_release(child->p_locklock);
+    exitcode = child->p_exitcode;
+    pid = child->p_pid;
+
+    /* 5. Charge the child's CPU usage, faults and I/O (and its children's) */
+    spinlock_acquire(&curproc->p_lock);
+    schedstats_add(&curproc->p_childstats, &child->p_stats);
+    schedstats_add(&curproc->p_childstats, &child->p_childstats);
+    vmstats_add(&curproc->p_childvm, &child->p_vmstats);
+    vmstats_add(&curproc->p_childvm, &child->p_childvm);
+    ioacct_add(&curproc->p_childio, &child->p_io);
+    ioacct_add(&curproc->p_childio, &child->p_childio);
+    spinlock_release(&curproc->p_lock);
+
+    /* 6. Nobody else can find it now; free it and its pid */
+    proc_reap(child);
 
     /* 7. Copy exit status to user space, if requested */
     if (status != NULL) {
-        int result = copyout(&exitcode, (userptr_t)status, sizeof(int));
+        result = copyout(&exitcode, (userptr_t)status, sizeof(int));
         if (result)
             return result;
     }
 
-    /* 8. Now safe to remove from process table and destroy */
-    proc_remove(pid);
-    
-    /* Destroy synchronization primitives */
-    if (child->p_cv != NULL) {
-        cv_destroy(child->p_cv);
-        child->p_cv = NULL;
-    }
-    if (child->p_locklock != NULL) {
-        lock_destroy(child->p_locklock);
-        child->p_locklock = NULL;
-    }
-    
-    spinlock_cleanup(&child->p_lock);
-    kfree(child->p_name);
-    kfree(child);
-
-    /* 9. Return child's pid */
+    /* 8. Return child's pid */
     *retval = pid;
     return 0;
 }
 
 /* sys__exit - Exit the current process
  *
- *   Terminates the calling process with the specified exit code.
- *   Cleans up resources and notifies the parent process if necessary.
+ *   Terminates the calling process with the specified exit code and
+ *   notifies the parent; its resources are freed in the background.
  *
  * Arguments:
  *   exitcode - Exit code of the process
  */
 void sys__exit(int exitcode) {
+    uproc_exit(_MKWAIT_EXIT(exitcode));
+}
+
+/* uproc_exit - Tear down the current process
+ *
+ *   What _exit does, with the wait status given whole, so that a
+ *   process killed by a fault or by the OOM killer can report the
+ *   signal.
+ *
+ * Arguments:
+ *   waitcode - Status for waitpid, made with _MKWAIT_EXIT or _MKWAIT_SIG
+ */
+void uproc_exit(int waitcode) {
     struct proc *p = curproc;
     
     KASSERT(p != NULL);
-    
-    /* Clean up process resources (address space, files, etc.) */
-    
-    /* VFS fields */
-    if (p->p_cwd) {
-        VOP_DECREF(p->p_cwd);
-        p->p_cwd = NULL;
-    }
-
-    /* VM fields - must happen before proc_remthread */
-    if (p->p_addrspace) {
-        struct addrspace *as;
-        as = proc_setas(NULL);
-        as_deactivate();
-        as_destroy(as);
-    }
-
-    /* Close all open files */
-    for(int i = 0; i < OPEN_MAX; i++) {
-        if (p->fileTable[i] != NULL) {
-            struct openfile *of = p->fileTable[i];
-            
-            lock_acquire(of->lock);
-            of->count--;
-
-            if (of->count == 0) {
-                vfs_close(of->vn);
-                lock_release(of->lock);
-                lock_destroy(of->lock);
-                kfree(of);
-            } else {
-                lock_release(of->lock);
-            }
 
-            p->fileTable[i] = NULL;
-        }
-    }
-    
-    /* Mark as exited and wake parent - BEFORE removing thread */
-    lock_acquire(p->p_locklock);
-    p->p_exitcode = _MKWAIT_EXIT(exitcode);
-    p->p_exited = true;
-    cv_signal(p->p_cv, p->p_locklock);
-    lock_release(p->p_locklock);
-    
-    /* Remove thread from process */
-    proc_remthread(curthread);
+    /* Other threads go first (or we go, if one of them is exiting) */
+    uthread_single(false);
+    aio_exit(p);
+    filetable_unlockall(p);
+
+    /*
+     * Publish the status and let the parent know; the address space,
+     * files and cwd are freed afterwards by the reaper (see proc.c).
+     */
+    proc_exit(waitcode);
     
     /* Thread exits */
     thread_exit();
@@ -393,4 +657,159 @@ void sys__exit(int exitcode) {
     panic("thread_exit returned (should not happen)\n");
 }
 
-#endif
\ No newline at end of file
+/* ticks_to_timeval - Convert a count of hardclocks to a timeval */
+static void ticks_to_timeval(uint64_t ticks, struct timeval *tv) {
+    tv->tv_sec = ticks / HZ;
+    tv->tv_usec = (ticks % HZ) * (1000000 / HZ);
+}
+
+/* sys_getrusage - Report CPU usage of the process or its children
+ *
+ *   RUSAGE_SELF covers the exited threads of the calling process plus
+ *   the calling thread; RUSAGE_CHILDREN covers every child reaped by
+ *   waitpid, and their reaped children in turn. User and system time
+ *   are split by where each clock tick found the thread (see
+ *   thread.h). Page faults that read from swap or a file are major
+ *   faults, the rest minor (see vmstat.h); block reads and writes are
+ *   file system blocks (see iostat.h).
+ *
+ * Arguments:
+ *   who   - RUSAGE_SELF or RUSAGE_CHILDREN
+ *   usage - User pointer to a struct rusage to fill in
+ *
+ * Returns:
+ *   0 on success
+ *   EINVAL  - Invalid who
+ *   EFAULT  - Invalid usage pointer
+ */
+int sys_getrusage(int who, userptr_t usage) {
+    struct proc *p = curproc;
+    struct schedstats ss;
+    struct vmstats vs;
+    struct ioacct io;
+    struct rusage ru;
+
+    spinlock_acquire(&p->p_lock);
+    if (who == RUSAGE_SELF) {
+        ss = p->p_stats;
+        schedstats_add(&ss, &curthread->t_stats);
+        vs = p->p_vmstats;
+        io = p->p_io;
+    } else if (who == RUSAGE_CHILDREN) {
+        ss = p->p_childstats;
+        vs = p->p_childvm;
+        io = p->p_childio;
+    } else {
+        spinlock_release(&p->p_lock);
+        return EINVAL;
+    }
+    spinlock_release(&p->p_lock);
+
+    bzero(&ru, sizeof(ru));
+    ticks_to_timeval(ss.ss_userticks, &ru.ru_utime);
+    ticks_to_timeval(ss.ss_runticks - ss.ss_userticks, &ru.ru_stime);
+    ru.ru_nvcsw = ss.ss_nvcsw;
+    ru.ru_nivcsw = ss.ss_nivcsw;
+    ru.ru_minflt = vmstats_minflt(&vs);
+    ru.ru_majflt = vmstats_majflt(&vs);
+    ru.ru_inblock = io.ia_inblock;
+    ru.ru_oublock = io.ia_oublock;
+
+    return copyout(&ru, usage, sizeof(ru));
+}
+
+/* rlimit_max - The most a limit can usefully be, or RLIM_INFINITY */
+static rlim_t rlimit_max(int resource) {
+    switch (resource) {
+    case RLIMIT_STACK:
+        return VM_STACKMAX;
+    case RLIMIT_NOFILE:
+        return OPEN_MAX;
+    default:
+        return RLIM_INFINITY;
+    }
+}
+
+/* sys_getrlimit - Report a resource limit
+ *
+ *   Enforced are RLIMIT_NPROC (counting every process, zombies too,
+ *   as there is only one user), RLIMIT_NOFILE, RLIMIT_CPU, RLIMIT_STACK,
+ *   RLIMIT_RTPRIO, and without dumbvm RLIMIT_AS and RLIMIT_DATA. The
+ *   others are only recorded.
+ *
+ * Arguments:
+ *   resource - RLIMIT_*
+ *   rlp      - User pointer to a struct rlimit to fill in
+ *
+ * Returns:
+ *   0 on success
+ *   EINVAL  - Invalid resource
+ *   EFAULT  - Invalid rlp pointer
+ */
+int sys_getrlimit(int resource, userptr_t rlp) {
+    struct proc *p = curproc;
+    struct rlimit rl;
+
+    if (resource < 0 || resource >= __RLIMIT_NUM) {
+        return EINVAL;
+    }
+    spinlock_acquire(&p->p_lock);
+    rl = p->p_rlimits[resource];
+    spinlock_release(&p->p_lock);
+    return copyout(&rl, rlp, sizeof(rl));
+}
+
+/* sys_setrlimit - Change a resource limit
+ *
+ *   For RLIMIT_STACK and RLIMIT_NOFILE, limits past what there is
+ *   room for (VM_STACKMAX, OPEN_MAX), RLIM_INFINITY included, mean
+ *   that much. A new limit applies from then on: a stack already
+ *   bigger isn't shrunk, and descriptors already open stay open. A
+ *   process over its RLIMIT_CPU soft limit gets SIGXCPU, and one over
+ *   the hard limit SIGKILL.
+ *
+ * Arguments:
+ *   resource - RLIMIT_*
+ *   rlp      - User pointer to the new struct rlimit
+ *
+ * Returns:
+ *   0 on success
+ *   EINVAL  - Invalid resource, or soft limit above hard limit
+ *   EPERM   - Raising the hard limit
+ *   EFAULT  - Invalid rlp pointer
+ */
+int sys_setrlimit(int resource, const_userptr_t rlp) {
+    struct proc *p = curproc;
+    struct rlimit rl;
+    rlim_t max;
+    int result;
+
+    if (resource < 0 || resource >= __RLIMIT_NUM) {
+        return EINVAL;
+    }
+    result = copyin(rlp, &rl, sizeof(rl));
+    if (result) {
+        return result;
+    }
+    if (rl.rlim_cur > rl.rlim_max) {
+        return EINVAL;
+    }
+
+    max = rlimit_max(resource);
+    if (rl.rlim_cur > max) {
+        rl.rlim_cur = max;
+    }
+    if (rl.rlim_max > max) {
+        rl.rlim_max = max;
+    }
+    spinlock_acquire(&p->p_lock);
+    if (rl.rlim_max > p->p_rlimits[resource].rlim_max) {
+        spinlock_release(&p->p_lock);
+        return EPERM;
+    }
+    p->p_rlimits[resource] = rl;
+    spinlock_release(&p->p_lock);
+    return 0;
+}
+
+#endif
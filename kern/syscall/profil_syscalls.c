@@ -0,0 +1,141 @@
+/*
+ * profil(): sampling the user pc into a histogram in user memory.
+ *
+ * A process that has called profil gets one of its 16-bit counters
+ * bumped for every hardclock that interrupts it in user mode: the
+ * counter for pc is the one at byte
+ *
+ *    ((pc - offset) * scale / 65536) rounded down to even
+ *
+ * of the buffer, so a scale of 0x10000 has a counter for every two
+ * bytes of text and 0x8000 one for every instruction. Samples that
+ * land past the end of the buffer are not counted. A scale of 0 or
+ * 1 turns profiling off, as does execv; a forked child starts off.
+ *
+ * The timer interrupt can't touch user memory, so profil_tick only
+ * notes the pc in the thread, and profil_flush adds it to the
+ * histogram on the way back to user mode with interrupts on again.
+ * If the buffer turns out not to be writable profiling is turned
+ * off. Threads of one process can lose each other's updates to the
+ * same counter; it's a sample.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <copyinout.h>
+#include <current.h>
+#include <thread.h>
+#include <proc.h>
+#include <syscall.h>
+
+/* profil_off - Stop profiling P */
+static void profil_off(struct proc *p) {
+    spinlock_acquire(&p->p_lock);
+    p->p_profscale = 0;
+    spinlock_release(&p->p_lock);
+}
+
+/* profil_tick - Note a hardclock that interrupted the user at PC
+ *
+ *   Called from the timer interrupt; TICKS is how many hardclocks
+ *   it stands for. The lock isn't taken: seeing profil turned on or
+ *   off a tick late does no harm.
+ */
+void profil_tick(vaddr_t pc, unsigned ticks) {
+    struct proc *p = curproc;
+
+    if (p == NULL || p == kproc || p->p_profscale == 0) {
+        return;
+    }
+    curthread->t_profpc = pc;
+    curthread->t_profticks += ticks;
+}
+
+/* profil_flush - Add the current thread's pending ticks to the histogram
+ *
+ *   Called before returning to user mode from an interrupt, with
+ *   interrupts on. Does nothing, cheaply, if there are none.
+ */
+void profil_flush(void) {
+    struct proc *p = curproc;
+    userptr_t buf;
+    size_t size;
+    vaddr_t offset, pc;
+    unsigned scale, ticks;
+    uint32_t pos;
+    uint16_t count;
+    int spl, result;
+
+    spl = splhigh();
+    pc = curthread->t_profpc;
+    ticks = curthread->t_profticks;
+    curthread->t_profticks = 0;
+    splx(spl);
+
+    if (ticks == 0) {
+        return;
+    }
+
+    spinlock_acquire(&p->p_lock);
+    buf = p->p_profbuf;
+    size = p->p_profsize;
+    offset = p->p_profoffset;
+    scale = p->p_profscale;
+    spinlock_release(&p->p_lock);
+
+    if (scale == 0 || pc < offset) {
+        return;
+    }
+    pos = (uint32_t)(((uint64_t)(pc - offset) * scale) >> 16) & ~1U;
+    if (pos >= size || size - pos < sizeof(count)) {
+        return;
+    }
+
+    result = copyin((const_userptr_t)(buf + pos), &count, sizeof(count));
+    if (result == 0) {
+        count += ticks;
+        result = copyout(&count, buf + pos, sizeof(count));
+    }
+    if (result) {
+        profil_off(p);
+    }
+}
+
+/* sys_profil - Start or stop sampling the user pc
+ *
+ *   See the top of the file for what the arguments mean. Calling
+ *   profil again replaces the old histogram; its counters are left
+ *   as they were.
+ *
+ * Arguments:
+ *   samples - User pointer to the histogram, 16-bit counters
+ *   size    - Size of the histogram in bytes
+ *   offset  - pc that the first counter covers
+ *   scale   - Counters per two bytes of text, as a fraction of 0x10000
+ *
+ * Returns:
+ *   0 on success
+ *   EINVAL  - scale more than 0x10000, or samples misaligned
+ */
+int sys_profil(userptr_t samples, size_t size, vaddr_t offset,
+               unsigned scale) {
+    struct proc *p = curproc;
+
+    if (scale <= 1) {
+        profil_off(p);
+        return 0;
+    }
+    if (scale > 0x10000 || ((vaddr_t)samples & 1) != 0) {
+        return EINVAL;
+    }
+
+    spinlock_acquire(&p->p_lock);
+    p->p_profbuf = samples;
+    p->p_profsize = size;
+    p->p_profoffset = offset;
+    p->p_profscale = scale;
+    spinlock_release(&p->p_lock);
+    return 0;
+}
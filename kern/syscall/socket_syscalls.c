@@ -0,0 +1,234 @@
+/*
+ * Socket system calls: socket, bind, sendto and recvfrom, for UDP
+ * over IPv4.
+ *
+ * A socket is an ordinary open file, so close, dup2, fork, read and
+ * poll all work on it as they do on a pipe; only these calls need to
+ * know it's a socket, and they fail with ENOTSOCK on anything else.
+ * Addresses cross in struct sockaddr_in, in network byte order;
+ * net.h wants host order, so they're converted here.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/socket.h>
+#include <kern/in.h>
+#include <endian.h>
+#include <lib.h>
+#include <current.h>
+#include <proc.h>
+#include <copyinout.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <openfile.h>
+#include <filetable.h>
+#include <net.h>
+#include <syscall.h>
+
+/*
+ * Get the socket open as FD, with a reference to the openfile.
+ */
+static
+int
+socket_fd(int fd, struct openfile **ofret, struct udpsock **usret)
+{
+	struct openfile *of;
+
+	of = filetable_get(curproc, fd);
+	if (of == NULL) {
+		return EBADF;
+	}
+	*usret = socket_get(of->vn);
+	if (*usret == NULL) {
+		openfile_decref(of);
+		return ENOTSOCK;
+	}
+	*ofret = of;
+	return 0;
+}
+
+/*
+ * Copy in a sockaddr_in of LEN bytes from ADDR.
+ */
+static
+int
+socket_getaddr(const_userptr_t addr, socklen_t len, uint32_t *ipaddr,
+	       uint16_t *port)
+{
+	struct sockaddr_in sin;
+	int result;
+
+	if (addr == NULL || len < (socklen_t)sizeof(sin)) {
+		return EINVAL;
+	}
+	result = copyin(addr, &sin, sizeof(sin));
+	if (result) {
+		return result;
+	}
+	if (sin.sin_family != AF_INET) {
+		return EAFNOSUPPORT;
+	}
+	*ipaddr = ntohl(sin.sin_addr.s_addr);
+	*port = ntohs(sin.sin_port);
+	return 0;
+}
+
+/*
+ * socket(domain, type, protocol)
+ *
+ * Only AF_INET, SOCK_DGRAM, and IPPROTO_UDP (or 0) so far.
+ */
+int
+sys_socket(int domain, int type, int protocol, int *retval)
+{
+	struct vnode *vn;
+	struct openfile *of;
+	int result;
+
+	result = socket_create(domain, type, protocol, &vn);
+	if (result) {
+		return result;
+	}
+	result = openfile_create(vn, O_RDWR, &of);
+	if (result) {
+		vfs_close(vn);
+		return result;
+	}
+	result = filetable_add(curproc, of, 0, retval);
+	if (result) {
+		openfile_decref(of);
+		return result;
+	}
+	return 0;
+}
+
+/*
+ * bind(fd, addr, addrlen)
+ */
+int
+sys_bind(int fd, const_userptr_t addr, socklen_t addrlen)
+{
+	struct openfile *of;
+	struct udpsock *us;
+	uint32_t ipaddr;
+	uint16_t port;
+	int result;
+
+	result = socket_fd(fd, &of, &us);
+	if (result) {
+		return result;
+	}
+	result = socket_getaddr(addr, addrlen, &ipaddr, &port);
+	if (result == 0) {
+		result = udp_bind(us, ipaddr, port);
+	}
+	openfile_decref(of);
+	return result;
+}
+
+/*
+ * sendto(fd, buf, len, flags, addr, addrlen)
+ *
+ * Sends LEN bytes from BUF as one datagram to ADDR. No flags are
+ * supported.
+ */
+int
+sys_sendto(int fd, const_userptr_t buf, size_t len, int flags,
+	   const_userptr_t addr, socklen_t addrlen, int32_t *retval)
+{
+	struct openfile *of;
+	struct udpsock *us;
+	struct iovec iov;
+	struct uio uio;
+	uint32_t ipaddr;
+	uint16_t port;
+	int result;
+
+	if (flags != 0) {
+		return EINVAL;
+	}
+	result = socket_fd(fd, &of, &us);
+	if (result) {
+		return result;
+	}
+	result = socket_getaddr(addr, addrlen, &ipaddr, &port);
+	if (result == 0) {
+		uio_uinit(&iov, &uio, (userptr_t)buf, len, 0, UIO_WRITE);
+		result = udp_send(us, &uio, ipaddr, port);
+	}
+	openfile_decref(of);
+	if (result == 0) {
+		*retval = len;
+	}
+	return result;
+}
+
+/*
+ * recvfrom(fd, buf, len, flags, addr, addrlen)
+ *
+ * Waits for a datagram and puts up to LEN bytes of it in BUF; the
+ * rest is lost. If ADDR isn't NULL, the sender's address goes there,
+ * cut to the size in *ADDRLEN, and *ADDRLEN is set to its real size.
+ * Returns the number of bytes put in BUF.
+ */
+int
+sys_recvfrom(int fd, userptr_t buf, size_t len, int flags,
+	     userptr_t addr, userptr_t addrlen, int32_t *retval)
+{
+	struct openfile *of;
+	struct udpsock *us;
+	struct sockaddr_in sin;
+	struct iovec iov;
+	struct uio uio;
+	socklen_t slen;
+	uint32_t ipaddr;
+	uint16_t port;
+	int result;
+
+	if (flags != 0) {
+		return EINVAL;
+	}
+	slen = 0;
+	if (addr != NULL) {
+		result = copyin(addrlen, &slen, sizeof(slen));
+		if (result) {
+			return result;
+		}
+		if (slen < 0) {
+			return EINVAL;
+		}
+	}
+
+	result = socket_fd(fd, &of, &us);
+	if (result) {
+		return result;
+	}
+	uio_uinit(&iov, &uio, buf, len, 0, UIO_READ);
+	result = udp_recv(us, &uio, 0, &ipaddr, &port);
+	openfile_decref(of);
+	if (result) {
+		return result;
+	}
+
+	if (addr != NULL) {
+		bzero(&sin, sizeof(sin));
+		sin.sin_len = sizeof(sin);
+		sin.sin_family = AF_INET;
+		sin.sin_port = htons(port);
+		sin.sin_addr.s_addr = htonl(ipaddr);
+		if ((size_t)slen > sizeof(sin)) {
+			slen = sizeof(sin);
+		}
+		result = copyout(&sin, addr, slen);
+		if (result == 0) {
+			slen = sizeof(sin);
+			result = copyout(&slen, addrlen, sizeof(slen));
+		}
+		if (result) {
+			return result;
+		}
+	}
+	*retval = len - uio.uio_resid;
+	return 0;
+}
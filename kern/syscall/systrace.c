@@ -0,0 +1,370 @@
+/*
+ * System call tracing, and the "systrace:" device that reads it out.
+ * See <kern/systrace.h>.
+ *
+ * Each cpu logs the calls that return on it into its own ring of
+ * records, made the first time it logs one; when the ring is full the
+ * oldest record is dropped and counted. The ring has a spinlock so
+ * that it can be drained from any cpu, but it is otherwise only ever
+ * taken by its own cpu, so logging doesn't contend. When tracing is
+ * off, the cost to each call is a test of systrace_paths and one of
+ * systrace_enabled.
+ *
+ * Draining takes records out a few at a time, each cpu's oldest first,
+ * and copies them out with no spinlock held.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/syscall.h>
+#include <kern/systrace.h>
+#include <lib.h>
+#include <spl.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <proc.h>
+#include <copyinout.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <syscall.h>
+#include <platform/maxcpus.h>
+#include "opt-shell.h"
+
+#define SYSTRACE_NRECS	256	/* records per cpu */
+#define SYSTRACE_CHUNK	8	/* records drained at a time */
+
+struct systrace_buf {
+	struct spinlock sb_lock;
+	unsigned sb_first;		/* oldest record */
+	unsigned sb_count;		/* records in the ring */
+	unsigned sb_lost;		/* dropped since last drained */
+	struct systrace_rec sb_recs[SYSTRACE_NRECS];
+};
+
+static struct systrace_buf *systrace_bufs[MAXCPUS];
+static volatile bool systrace_enabled;
+volatile bool systrace_paths;
+
+static
+uint64_t
+systrace_nsecs(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+/*
+ * Get the current cpu's ring, making it if need be. NULL if out of
+ * memory.
+ */
+static
+struct systrace_buf *
+systrace_getbuf(void)
+{
+	struct systrace_buf *sb;
+	int spl;
+
+	sb = systrace_bufs[curcpu->c_number];
+	if (sb != NULL) {
+		return sb;
+	}
+
+	sb = kmalloc(sizeof(*sb));
+	if (sb == NULL) {
+		return NULL;
+	}
+	spinlock_init(&sb->sb_lock);
+	sb->sb_first = 0;
+	sb->sb_count = 0;
+	sb->sb_lost = 0;
+
+	/* Only this cpu sets its slot */
+	spl = splhigh();
+	if (systrace_bufs[curcpu->c_number] == NULL) {
+		systrace_bufs[curcpu->c_number] = sb;
+		sb = NULL;
+	}
+	splx(spl);
+	if (sb != NULL) {
+		/* We moved to a cpu with one already */
+		spinlock_cleanup(&sb->sb_lock);
+		kfree(sb);
+	}
+	return systrace_bufs[curcpu->c_number];
+}
+
+void
+systrace_getpath(int callno, const uint32_t *args, char *path)
+{
+	size_t len;
+
+	switch (callno) {
+	    case SYS_open:
+	    case SYS_execv:
+	    case SYS_remove:
+	    case SYS_mkdir:
+	    case SYS_rmdir:
+	    case SYS_chdir:
+	    case SYS_stat:
+	    case SYS_lstat:
+		break;
+	    default:
+		return;
+	}
+	if (copyinstr((const_userptr_t)args[0], path, SYSTRACE_PATHLEN,
+		      &len)) {
+		/* Bad pointer, or too long to be any use for replay */
+		path[0] = '\0';
+	}
+}
+
+void
+systrace_record(int callno, int err, int32_t result,
+		const uint32_t *args, unsigned nargs, const char *path,
+		const struct timespec *before, const struct timespec *after)
+{
+	struct systrace_buf *sb;
+	struct systrace_rec *sr;
+	unsigned i;
+
+	if (!systrace_enabled) {
+		return;
+	}
+
+	sb = systrace_getbuf();
+	if (sb == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&sb->sb_lock);
+	if (sb->sb_count == SYSTRACE_NRECS) {
+		sb->sb_first = (sb->sb_first + 1) % SYSTRACE_NRECS;
+		sb->sb_count--;
+		sb->sb_lost++;
+	}
+	sr = &sb->sb_recs[(sb->sb_first + sb->sb_count) % SYSTRACE_NRECS];
+	sb->sb_count++;
+
+	sr->sr_enter = systrace_nsecs(before);
+	sr->sr_exit = systrace_nsecs(after);
+	sr->sr_callno = callno;
+#if OPT_SHELL
+	sr->sr_pid = curproc->p_pid;
+#else
+	sr->sr_pid = 0;
+#endif
+	sr->sr_err = err;
+	sr->sr_result = err ? 0 : result;
+	sr->sr_cpu = curcpu->c_number;
+	sr->sr_lost = 0;
+	for (i=0; i<SYSTRACE_NARGS; i++) {
+		sr->sr_args[i] = i < nargs ? args[i] : 0;
+	}
+	strcpy(sr->sr_path, path);
+	spinlock_release(&sb->sb_lock);
+}
+
+/*
+ * Take up to MAX of the oldest records out of the rings, into RECS.
+ * Returns how many there were.
+ */
+static
+unsigned
+systrace_drain(struct systrace_rec *recs, unsigned max)
+{
+	struct systrace_buf *sb;
+	unsigned c, n;
+
+	n = 0;
+	for (c=0; c<MAXCPUS && n < max; c++) {
+		sb = systrace_bufs[c];
+		if (sb == NULL) {
+			continue;
+		}
+		spinlock_acquire(&sb->sb_lock);
+		while (sb->sb_count > 0 && n < max) {
+			recs[n] = sb->sb_recs[sb->sb_first];
+			recs[n].sr_lost = sb->sb_lost;
+			sb->sb_lost = 0;
+			sb->sb_first = (sb->sb_first + 1) % SYSTRACE_NRECS;
+			sb->sb_count--;
+			n++;
+		}
+		spinlock_release(&sb->sb_lock);
+	}
+	return n;
+}
+
+void
+systrace_setenabled(bool on, bool paths)
+{
+	systrace_paths = on && paths;
+	systrace_enabled = on;
+}
+
+/*
+ * Drain the log to the console, for the systrace menu command.
+ */
+void
+systrace_print(void)
+{
+	struct systrace_rec recs[SYSTRACE_CHUNK];
+	const char *name;
+	unsigned i, n;
+
+	kprintf("Tracing is %s\n", !systrace_enabled ? "off" :
+		systrace_paths ? "on, with paths" : "on");
+	kprintf("%3s %5s %-16s %6s %11s %14s %10s\n", "cpu", "pid", "call",
+		"error", "result", "enter us", "latency us");
+	while ((n = systrace_drain(recs, SYSTRACE_CHUNK)) > 0) {
+		for (i=0; i<n; i++) {
+			if (recs[i].sr_lost > 0) {
+				kprintf("%3u (%u records lost)\n",
+					recs[i].sr_cpu, recs[i].sr_lost);
+			}
+			name = syscall_name(recs[i].sr_callno);
+			kprintf("%3u %5d %-16s %6d %11d %14llu %10llu\n",
+				recs[i].sr_cpu, recs[i].sr_pid,
+				name != NULL ? name : "?",
+				recs[i].sr_err, recs[i].sr_result,
+				(unsigned long long)(recs[i].sr_enter / 1000),
+				(unsigned long long)
+				((recs[i].sr_exit - recs[i].sr_enter) / 1000));
+		}
+	}
+}
+
+/* For open() */
+static
+int
+systrace_open(struct device *dev, int openflags)
+{
+	(void)dev;
+	(void)openflags;
+
+	return 0;
+}
+
+/*
+ * Write "on", "full" or "off" to turn tracing on, on with paths, or
+ * off.
+ */
+static
+int
+systrace_write(struct uio *uio)
+{
+	char buf[8];
+	size_t len;
+	int result;
+
+	len = uio->uio_resid;
+	if (len >= sizeof(buf)) {
+		return EINVAL;
+	}
+	result = uiomove(buf, len, uio);
+	if (result) {
+		return result;
+	}
+	buf[len] = 0;
+	if (len > 0 && buf[len-1] == '\n') {
+		buf[len-1] = 0;
+	}
+
+	if (!strcmp(buf, "on")) {
+		systrace_setenabled(true, false);
+	}
+	else if (!strcmp(buf, "full")) {
+		systrace_setenabled(true, true);
+	}
+	else if (!strcmp(buf, "off")) {
+		systrace_setenabled(false, false);
+	}
+	else {
+		return EINVAL;
+	}
+	return 0;
+}
+
+/* For d_io() */
+static
+int
+systrace_io(struct device *dev, struct uio *uio)
+{
+	struct systrace_rec recs[SYSTRACE_CHUNK];
+	unsigned max, n;
+	int result;
+
+	(void)dev;
+
+	if (uio->uio_rw == UIO_WRITE) {
+		return systrace_write(uio);
+	}
+
+	/*
+	 * Read as many whole records as fit. Records drained are gone
+	 * even if copying them out fails.
+	 */
+	while (uio->uio_resid >= sizeof(struct systrace_rec)) {
+		max = uio->uio_resid / sizeof(struct systrace_rec);
+		if (max > SYSTRACE_CHUNK) {
+			max = SYSTRACE_CHUNK;
+		}
+		n = systrace_drain(recs, max);
+		if (n == 0) {
+			break;
+		}
+		result = uiomove(recs, n * sizeof(struct systrace_rec), uio);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/* For ioctl() */
+static
+int
+systrace_ioctl(struct device *dev, int op, userptr_t data)
+{
+	(void)dev;
+	(void)op;
+	(void)data;
+
+	return EINVAL;
+}
+
+static const struct device_ops systrace_devops = {
+	.devop_eachopen = systrace_open,
+	.devop_io = systrace_io,
+	.devop_ioctl = systrace_ioctl,
+};
+
+/*
+ * Create and attach systrace:. Tracing starts off.
+ */
+void
+systrace_bootstrap(void)
+{
+	struct device *dev;
+	int result;
+
+	systrace_setenabled(false, false);
+
+	dev = kmalloc(sizeof(*dev));
+	if (dev == NULL) {
+		panic("Could not add systrace device: out of memory\n");
+	}
+	dev->d_ops = &systrace_devops;
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+	dev->d_devnumber = 0; /* assigned by vfs_adddev */
+	dev->d_data = NULL;
+
+	result = vfs_adddev("systrace", dev, 0);
+	if (result) {
+		panic("Could not add systrace device: %s\n",
+		      strerror(result));
+	}
+}
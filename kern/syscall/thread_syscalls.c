@@ -0,0 +1,559 @@
+/*
+ * Multithreaded user processes.
+ *
+ * __thread_create starts another kernel thread in the calling
+ * process, on a stack of its own in the same address space; it shares
+ * the file table and everything else. Each thread has a small id
+ * within its process, the first being 0, and thread_join collects the
+ * value a thread passed to thread_exit. The C library wraps
+ * __thread_create so that returning from the thread function calls
+ * thread_exit.
+ *
+ * When one thread calls _exit or execv, the others have to go first.
+ * The process is marked p_exiting and each other thread exits the
+ * next time it is about to return to user mode (uthread_checkexit),
+ * including from timer interrupts, so busy threads go promptly too.
+ * Threads asleep in futex or thread_join are woken for it; threads
+ * blocked elsewhere in the kernel hold things up until they return.
+ *
+ * A process killed by the OOM killer has p_killsig set instead; the
+ * first of its threads to get to uthread_checkexit exits the process
+ * as _exit would, with that signal as the status.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/wait.h>
+#include <kern/sched.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <synch.h>
+#include <current.h>
+#include <thread.h>
+#include <addrspace.h>
+#include <proc.h>
+#include <syscall.h>
+#include "opt-dumbvm.h"
+
+/* What a new thread needs to get to user mode */
+struct uthread_start {
+    vaddr_t us_entry;       /* libc trampoline */
+    vaddr_t us_func;        /* user's thread function... */
+    vaddr_t us_arg;         /* ...and its argument */
+    vaddr_t us_stack;
+    int us_tid;
+};
+
+/* uthread_die - Leave the process and exit the current thread. */
+static __DEAD void uthread_die(void) {
+    struct proc *p = curproc;
+
+    lock_acquire(p->p_locklock);
+    proc_remthread(curthread);
+    cv_broadcast(p->p_threadcv, p->p_locklock);
+    lock_release(p->p_locklock);
+
+    thread_exit();
+}
+
+/* uthread_checkexit - Exit the current thread if its process is exiting
+ *
+ *   Called before returning to user mode. Does nothing, cheaply, in
+ *   the usual case. If the process has been killed, exits it.
+ */
+void uthread_checkexit(void) {
+    struct proc *p = curproc;
+
+    if (p == NULL || p == kproc) {
+        return;
+    }
+    if (p->p_exiting) {
+        uthread_die();
+    }
+    if (p->p_killsig != 0) {
+        uproc_exit(_MKWAIT_SIG(p->p_killsig));
+    }
+}
+
+/* uthread_single - Get rid of all the other threads of the process
+ *
+ *   For _exit and execv. Marks the process exiting and waits until the
+ *   calling thread is the only one left. If another thread got there
+ *   first the caller is one of those that must go, and it exits here.
+ *   With RESUME set, p_exiting is cleared again afterwards and the
+ *   caller becomes thread 0.
+ */
+void uthread_single(bool resume) {
+    struct proc *p = curproc;
+    int i;
+
+    lock_acquire(p->p_locklock);
+    if (p->p_exiting) {
+        lock_release(p->p_locklock);
+        uthread_die();
+    }
+    if (p->p_numthreads == 1) {
+        /* Common case. Nobody else can appear without us. */
+        lock_release(p->p_locklock);
+    } else {
+        p->p_exiting = true;
+        /* Wake joiners; they notice p_exiting. */
+        cv_broadcast(p->p_threadcv, p->p_locklock);
+        lock_release(p->p_locklock);
+
+        futex_exit(proc_getas());
+
+        lock_acquire(p->p_locklock);
+        while (p->p_numthreads > 1) {
+            cv_wait(p->p_threadcv, p->p_locklock);
+        }
+        lock_release(p->p_locklock);
+    }
+
+    if (resume) {
+        lock_acquire(p->p_locklock);
+        p->p_exiting = false;
+        for (i = 0; i < PROC_UTHREAD_MAX; i++) {
+            p->p_uthreads[i].ut_inuse = false;
+        }
+        p->p_uthreads[0].ut_inuse = true;
+        p->p_uthreads[0].ut_exited = false;
+        curthread->t_tid = 0;
+        lock_release(p->p_locklock);
+    }
+}
+
+/* uthread_start - First function of a new user thread */
+static void uthread_start(void *data, unsigned long unused) {
+    struct uthread_start us;
+
+    (void)unused;
+
+    us = *(struct uthread_start *)data;
+    kfree(data);
+
+    curthread->t_tid = us.us_tid;
+    as_activate();
+
+    /* We may have been created just as the process started exiting */
+    uthread_checkexit();
+
+    /*
+     * The trampoline gets (func, arg) in a0 and a1, where main gets
+     * (argc, argv).
+     */
+    enter_new_process((int)us.us_func, (userptr_t)us.us_arg, NULL,
+                      us.us_stack, us.us_entry);
+}
+
+/* sys___thread_create - Start a new thread in the current process
+ *
+ *   The thread starts at ENTRY in user mode, with FUNC and ARG as the
+ *   first two arguments and a stack of its own.
+ *
+ * Arguments:
+ *   entry  - User address to start at
+ *   func   - First argument for it
+ *   arg    - Second argument for it
+ *   retval - Gets the new thread's id
+ *
+ * Returns:
+ *   0 on success
+ *   EAGAIN  - The process has PROC_UTHREAD_MAX threads already
+ *   ENOSYS  - The VM system can't make more stacks (dumbvm)
+ *   ENOMEM  - Out of memory
+ */
+int sys___thread_create(userptr_t entry, userptr_t func, userptr_t arg,
+                        int *retval) {
+    struct proc *p = curproc;
+    struct uthread_start *us;
+    vaddr_t stack;
+    int tid, result;
+
+#if !OPT_DUMBVM
+    /* Thread tid > 0 uses stack slot tid - 1 */
+    COMPILE_ASSERT(PROC_UTHREAD_MAX - 1 <= VM_THREADSTACKS);
+#endif
+
+    /* Find a free thread id */
+    lock_acquire(p->p_locklock);
+    for (tid = 1; tid < PROC_UTHREAD_MAX; tid++) {
+        if (!p->p_uthreads[tid].ut_inuse) {
+            break;
+        }
+    }
+    if (tid == PROC_UTHREAD_MAX) {
+        lock_release(p->p_locklock);
+        return EAGAIN;
+    }
+    p->p_uthreads[tid].ut_inuse = true;
+    p->p_uthreads[tid].ut_exited = false;
+    lock_release(p->p_locklock);
+
+    result = as_define_threadstack(proc_getas(), tid - 1, &stack);
+    if (result) {
+        goto fail;
+    }
+
+    us = kmalloc(sizeof(*us));
+    if (us == NULL) {
+        result = ENOMEM;
+        goto fail;
+    }
+    us->us_entry = (vaddr_t)entry;
+    us->us_func = (vaddr_t)func;
+    us->us_arg = (vaddr_t)arg;
+    us->us_stack = stack;
+    us->us_tid = tid;
+
+    result = thread_fork(curthread->t_name, p, uthread_start, us, 0);
+    if (result) {
+        kfree(us);
+        goto fail;
+    }
+
+    *retval = tid;
+    return 0;
+
+ fail:
+    lock_acquire(p->p_locklock);
+    p->p_uthreads[tid].ut_inuse = false;
+    lock_release(p->p_locklock);
+    return result;
+}
+
+/* sys_thread_join - Wait for a thread of the current process to exit
+ *
+ *   Frees the thread's id for reuse. Each thread can be joined once.
+ *
+ * Arguments:
+ *   tid    - Thread to wait for
+ *   status - User pointer for the thread's exit value, or NULL
+ *
+ * Returns:
+ *   0 on success
+ *   EINVAL  - Invalid thread id, or the calling thread's own
+ *   ESRCH   - No such thread, or it has already been joined
+ *   EFAULT  - Invalid status pointer
+ */
+int sys_thread_join(int tid, userptr_t status) {
+    struct proc *p = curproc;
+    struct uthread *ut;
+    int exitval;
+
+    if (tid < 0 || tid >= PROC_UTHREAD_MAX || tid == curthread->t_tid) {
+        return EINVAL;
+    }
+
+    ut = &p->p_uthreads[tid];
+    lock_acquire(p->p_locklock);
+    while (ut->ut_inuse && !ut->ut_exited && !p->p_exiting) {
+        cv_wait(p->p_threadcv, p->p_locklock);
+    }
+    if (!ut->ut_inuse || !ut->ut_exited) {
+        /* Gone already, or we're exiting ourselves (any error will do) */
+        lock_release(p->p_locklock);
+        return ESRCH;
+    }
+    exitval = ut->ut_exitval;
+    ut->ut_inuse = false;
+    lock_release(p->p_locklock);
+
+    if (status != NULL) {
+        return copyout(&exitval, status, sizeof(exitval));
+    }
+    return 0;
+}
+
+/* sys_thread_exit - Exit the calling thread
+ *
+ *   EXITVAL is kept for thread_join. If this is the last thread, the
+ *   whole process exits, with status 0.
+ *
+ * Arguments:
+ *   exitval - Value for thread_join
+ */
+void sys_thread_exit(int exitval) {
+    struct proc *p = curproc;
+    struct uthread *ut;
+
+    lock_acquire(p->p_locklock);
+    if (p->p_exiting) {
+        lock_release(p->p_locklock);
+        uthread_die();
+    }
+    if (p->p_numthreads == 1) {
+        lock_release(p->p_locklock);
+        sys__exit(0);
+    }
+    ut = &p->p_uthreads[curthread->t_tid];
+    ut->ut_exited = true;
+    ut->ut_exitval = exitval;
+    proc_remthread(curthread);
+    cv_broadcast(p->p_threadcv, p->p_locklock);
+    lock_release(p->p_locklock);
+
+    thread_exit();
+}
+
+/* sys_sched_setaffinity - Choose the cpus the calling thread may run on
+ *
+ *   MASK is an array of 32-bit words, cpu N being bit N%32 of word
+ *   N/32. Cpus the machine doesn't have are ignored. The mask is the
+ *   calling thread's; threads and processes it creates later start
+ *   with it, but others already running are left alone, so PID can
+ *   only be 0 or the caller's own. Returns once the thread is on one
+ *   of the new cpus.
+ *
+ * Arguments:
+ *   pid  - 0 or the caller's pid
+ *   size - Size of MASK in bytes
+ *   mask - User pointer to the cpu mask
+ *
+ * Returns:
+ *   0 on success
+ *   ESRCH  - pid is some other process
+ *   EINVAL - size less than a word, or no cpu in mask exists
+ */
+int sys_sched_setaffinity(pid_t pid, size_t size, const_userptr_t mask) {
+    uint32_t bits;
+    int result;
+
+    if (pid != 0 && pid != curproc->p_pid) {
+        return ESRCH;
+    }
+    if (size < sizeof(bits)) {
+        return EINVAL;
+    }
+    /* Words past the first are all cpus we can't have */
+    result = copyin(mask, &bits, sizeof(bits));
+    if (result) {
+        return result;
+    }
+    return thread_setaffinity(bits);
+}
+
+/* sys_sched_getaffinity - Get the cpus the calling thread may run on
+ *
+ *   Fills each whole word of MASK, in the form sched_setaffinity
+ *   takes.
+ *
+ * Arguments:
+ *   pid  - 0 or the caller's pid
+ *   size - Size of MASK in bytes
+ *   mask - User pointer to fill in
+ *
+ * Returns:
+ *   0 on success
+ *   ESRCH  - pid is some other process
+ *   EINVAL - size less than a word
+ */
+int sys_sched_getaffinity(pid_t pid, size_t size, userptr_t mask) {
+    uint32_t bits;
+    size_t pos;
+    int result;
+
+    if (pid != 0 && pid != curproc->p_pid) {
+        return ESRCH;
+    }
+    if (size < sizeof(bits)) {
+        return EINVAL;
+    }
+    bits = thread_getaffinity();
+    for (pos = 0; pos + sizeof(bits) <= size; pos += sizeof(bits)) {
+        result = copyout(&bits, mask + pos, sizeof(bits));
+        if (result) {
+            return result;
+        }
+        bits = 0;
+    }
+    return 0;
+}
+
+/* sys_sched_setscheduler - Set the calling thread's scheduling class
+ *
+ *   SCHED_FIFO and SCHED_RR threads run ahead of every time-sharing
+ *   one, most important first; see thread.c. Like the cpu mask, the
+ *   class is the calling thread's and is passed on to threads and
+ *   processes it creates, so PID can only be 0 or the caller's own.
+ *   Going real-time needs a priority within RLIMIT_RTPRIO, which is
+ *   unlimited to begin with; a process can lower it to keep its
+ *   children from doing so. Lowering one's own priority is always
+ *   allowed.
+ *
+ * Arguments:
+ *   pid    - 0 or the caller's pid
+ *   policy - SCHED_OTHER, SCHED_FIFO or SCHED_RR
+ *   param  - User pointer to a struct sched_param: the priority, 0
+ *            for SCHED_OTHER or SCHED_PRIO_MIN to SCHED_PRIO_MAX
+ *
+ * Returns:
+ *   0 on success
+ *   ESRCH  - pid is some other process
+ *   EINVAL - bad policy, or priority out of range for it
+ *   EPERM  - priority above RLIMIT_RTPRIO
+ */
+int sys_sched_setscheduler(pid_t pid, int policy, const_userptr_t param) {
+    struct sched_param sp;
+    rlim_t limit;
+    int result;
+
+    if (pid != 0 && pid != curproc->p_pid) {
+        return ESRCH;
+    }
+    result = copyin(param, &sp, sizeof(sp));
+    if (result) {
+        return result;
+    }
+
+    switch (policy) {
+    case SCHED_OTHER:
+        if (sp.sched_priority != 0) {
+            return EINVAL;
+        }
+        break;
+    case SCHED_FIFO:
+    case SCHED_RR:
+        if (sp.sched_priority < SCHED_PRIO_MIN ||
+            sp.sched_priority > SCHED_PRIO_MAX) {
+            return EINVAL;
+        }
+        limit = proc_getrlimit(curproc, RLIMIT_RTPRIO);
+        if ((rlim_t)sp.sched_priority > limit &&
+            (unsigned)sp.sched_priority > curthread->t_rtprio) {
+            return EPERM;
+        }
+        break;
+    default:
+        return EINVAL;
+    }
+
+    thread_setsched(policy, sp.sched_priority);
+    return 0;
+}
+
+/* sys_sched_getscheduler - Get the calling thread's scheduling policy
+ *
+ * Arguments:
+ *   pid    - 0 or the caller's pid
+ *   retval - Pointer to store the policy
+ *
+ * Returns:
+ *   0 on success
+ *   ESRCH  - pid is some other process
+ */
+int sys_sched_getscheduler(pid_t pid, int *retval) {
+    if (pid != 0 && pid != curproc->p_pid) {
+        return ESRCH;
+    }
+    *retval = curthread->t_policy;
+    return 0;
+}
+
+/* sys_sched_getparam - Get the calling thread's real-time priority
+ *
+ * Arguments:
+ *   pid   - 0 or the caller's pid
+ *   param - User pointer to a struct sched_param to fill in
+ *
+ * Returns:
+ *   0 on success
+ *   ESRCH  - pid is some other process
+ */
+int sys_sched_getparam(pid_t pid, userptr_t param) {
+    struct sched_param sp;
+
+    if (pid != 0 && pid != curproc->p_pid) {
+        return ESRCH;
+    }
+    sp.sched_priority = curthread->t_rtprio;
+    return copyout(&sp, param, sizeof(sp));
+}
+
+/* sys_sched_setgroup - Move the calling thread into a scheduling group
+ *
+ *   Time-sharing threads share the cpus between groups in proportion
+ *   to the groups' tickets, rather than one share per thread; see
+ *   thread.c. Everything starts in group 0, and threads and processes
+ *   start in their creator's group. Only group 0 is trusted: a thread
+ *   there can join any group, but one in another group can't leave
+ *   it, so a tenant put in a group stays there.
+ *
+ * Arguments:
+ *   group - 0 to SCHED_NGROUPS - 1
+ *
+ * Returns:
+ *   0 on success
+ *   EINVAL - no such group
+ *   EPERM  - caller is in another group already
+ */
+int sys_sched_setgroup(int group) {
+    unsigned cur;
+
+    if (group < 0 || group >= SCHED_NGROUPS) {
+        return EINVAL;
+    }
+    cur = thread_getgroup();
+    if (cur != 0 && cur != (unsigned)group) {
+        return EPERM;
+    }
+    thread_setgroup(group);
+    return 0;
+}
+
+/* sys_sched_getgroup - Get the calling thread's scheduling group
+ *
+ * Arguments:
+ *   retval - Pointer to store the group
+ *
+ * Returns:
+ *   0
+ */
+int sys_sched_getgroup(int *retval) {
+    *retval = thread_getgroup();
+    return 0;
+}
+
+/* sys_sched_settickets - Set a scheduling group's share of the cpus
+ *
+ *   Each group starts with SCHED_TICKETS_DEFAULT. Only threads in
+ *   group 0 may change them.
+ *
+ * Arguments:
+ *   group   - 0 to SCHED_NGROUPS - 1
+ *   tickets - 1 to SCHED_TICKETS_MAX
+ *
+ * Returns:
+ *   0 on success
+ *   EINVAL - no such group, or tickets out of range
+ *   EPERM  - caller is not in group 0
+ */
+int sys_sched_settickets(int group, unsigned tickets) {
+    if (group < 0 || group >= SCHED_NGROUPS ||
+        tickets == 0 || tickets > SCHED_TICKETS_MAX) {
+        return EINVAL;
+    }
+    if (thread_getgroup() != 0) {
+        return EPERM;
+    }
+    thread_settickets(group, tickets);
+    return 0;
+}
+
+/* sys_sched_gettickets - Get a scheduling group's tickets
+ *
+ * Arguments:
+ *   group  - 0 to SCHED_NGROUPS - 1
+ *   retval - Pointer to store the tickets
+ *
+ * Returns:
+ *   0 on success
+ *   EINVAL - no such group
+ */
+int sys_sched_gettickets(int group, int *retval) {
+    if (group < 0 || group >= SCHED_NGROUPS) {
+        return EINVAL;
+    }
+    *retval = thread_gettickets(group);
+    return 0;
+}
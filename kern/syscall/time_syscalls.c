@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -39,20 +40,80 @@ int
 sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 {
 	struct timespec ts;
-	int result;
+	struct copyvec cv[2];
 
 	gettime(&ts);
 
-	result = copyout(&ts.tv_sec, user_seconds_ptr, sizeof(ts.tv_sec));
-	if (result) {
-		return result;
+	cv[0].cv_user = user_seconds_ptr;
+	cv[0].cv_kern = &ts.tv_sec;
+	cv[0].cv_len = sizeof(ts.tv_sec);
+	cv[1].cv_user = user_nanoseconds_ptr;
+	cv[1].cv_kern = &ts.tv_nsec;
+	cv[1].cv_len = sizeof(ts.tv_nsec);
+	return copyout_bulk(cv, 2);
+}
+
+/*
+ * Read clock CLOCK into *USER_TS. Monotonic time comes from the
+ * cycle counter (clock_monotonic_ns); the coarse clocks are the same
+ * as the fine ones here, since the system call costs the same.
+ */
+int
+sys___clock_gettime(int clock, userptr_t user_ts)
+{
+	struct timespec ts;
+	uint64_t ns;
+
+	switch (clock) {
+	    case CLOCK_REALTIME:
+	    case CLOCK_REALTIME_COARSE:
+		gettime(&ts);
+		break;
+	    case CLOCK_MONOTONIC:
+	    case CLOCK_MONOTONIC_COARSE:
+		ns = clock_monotonic_ns();
+		ts.tv_sec = ns / 1000000000;
+		ts.tv_nsec = ns % 1000000000;
+		break;
+	    default:
+		return EINVAL;
 	}
+	return copyout(&ts, user_ts, sizeof(ts));
+}
 
-	result = copyout(&ts.tv_nsec, user_nanoseconds_ptr,
-			 sizeof(ts.tv_nsec));
+/*
+ * Sleep for the time in *USER_REQ, rounded up to whole hardclocks.
+ * There are no signals, so the sleep is never cut short and the
+ * remaining time is not reported; USER_REM is accepted and ignored.
+ */
+int
+sys_nanosleep(userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec ts;
+	uint64_t ticks;
+	int result;
+
+	(void)user_rem;
+
+	result = copyin(user_req, &ts, sizeof(ts));
 	if (result) {
 		return result;
 	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
 
+	ticks = timespec_to_ticks(&ts);
+	while (ticks > 0) {
+		/* clocksleep_ticks takes an unsigned; go in chunks */
+		if (ticks > 0x7fffffff) {
+			clocksleep_ticks(0x7fffffff);
+			ticks -= 0x7fffffff;
+		}
+		else {
+			clocksleep_ticks(ticks);
+			ticks = 0;
+		}
+	}
 	return 0;
 }
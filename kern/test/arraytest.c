@@ -29,6 +29,7 @@
 
 #include <types.h>
 #include <lib.h>
+#include <clock.h>
 #include <array.h>
 #include <test.h>
 
@@ -218,3 +219,111 @@ arraytest2(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Array benchmark: times growing an array one add at a time and in
+ * one addmany, and emptying it from the front with remove and with
+ * remove_unordered, checking the results along the way.
+ */
+
+static
+uint64_t
+arraytest_now(void)
+{
+	struct timespec ts;
+
+	gettime(&ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static
+void
+arraytest_report(const char *name, unsigned ops, uint64_t start)
+{
+	uint64_t ns;
+
+	ns = arraytest_now() - start;
+	kprintf("array %-16s ops=%u ns=%llu ns/op=%llu\n", name, ops,
+		(unsigned long long)ns, (unsigned long long)(ns / ops));
+}
+
+int
+arraytest3(int nargs, char **args)
+{
+	struct array *a;
+	void **vals;
+	uint64_t start;
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Beginning array benchmark...\n");
+	vals = kmalloc(BIGTESTSIZE * sizeof(*vals));
+	KASSERT(vals != NULL);
+	for (i=0; i<BIGTESTSIZE; i++) {
+		vals[i] = NTH(i);
+	}
+	a = array_create();
+	KASSERT(a != NULL);
+
+	/* 1. One at a time */
+	start = arraytest_now();
+	for (i=0; i<BIGTESTSIZE; i++) {
+		result = array_add(a, vals[i], NULL);
+		KASSERT(result == 0);
+	}
+	arraytest_report("add", BIGTESTSIZE, start);
+	KASSERT(a->max < BIGTESTSIZE * 2);
+
+	/* 2. Empty it from the front, keeping the order */
+	start = arraytest_now();
+	for (i=0; i<BIGTESTSIZE; i++) {
+		KASSERT(array_get(a, 0) == NTH(i));
+		array_remove(a, 0);
+	}
+	arraytest_report("remove", BIGTESTSIZE, start);
+	KASSERT(array_num(a) == 0);
+
+	/* 3. Shrink gives the space back */
+	array_shrink(a);
+	KASSERT(a->max == 0 && a->v == NULL);
+
+	/* 4. All at once */
+	start = arraytest_now();
+	result = array_addmany(a, vals, BIGTESTSIZE);
+	KASSERT(result == 0);
+	arraytest_report("addmany", BIGTESTSIZE, start);
+	KASSERT(array_num(a) == BIGTESTSIZE);
+	for (i=0; i<BIGTESTSIZE; i++) {
+		KASSERT(array_get(a, i) == NTH(i));
+	}
+
+	/* 5. Empty it from the front, in any order */
+	start = arraytest_now();
+	for (i=0; i<BIGTESTSIZE; i++) {
+		KASSERT(array_get(a, 0) ==
+			(i == 0 ? NTH(0) : NTH(BIGTESTSIZE - i)));
+		array_remove_unordered(a, 0);
+	}
+	arraytest_report("remove_unordered", BIGTESTSIZE, start);
+	KASSERT(array_num(a) == 0);
+
+	/* 6. Shrink to fit something left in it */
+	result = array_addmany(a, vals, TESTSIZE);
+	KASSERT(result == 0);
+	array_shrink(a);
+	KASSERT(a->max == TESTSIZE);
+	for (i=0; i<TESTSIZE; i++) {
+		KASSERT(array_get(a, i) == NTH(i));
+	}
+
+	result = array_setsize(a, 0);
+	KASSERT(result == 0);
+	array_destroy(a);
+	kfree(vals);
+
+	kprintf("Done.\n");
+	return 0;
+}
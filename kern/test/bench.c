@@ -0,0 +1,649 @@
+/*
+ * bench - kernel microbenchmarks.
+ *
+ * Usage: bench [-f fsname] [name ...]
+ *
+ * Runs the named benchmarks, or all of them, and prints one line for
+ * each in the form
+ *
+ *    bench NAME ops=N ns=TOTAL ns/op=AVG [bytes/op=B MB/s=R]
+ *
+ * so that runs on different kernels can be compared by script. The
+ * file system ones only run given -f, and use a scratch file there.
+ *
+ * Times come from clock_monotonic_ns.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/wait.h>
+#include <lib.h>
+#include <clock.h>
+#include <uio.h>
+#include <current.h>
+#include <thread.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <proc.h>
+#include <syscall.h>
+#include <test.h>
+#include "opt-shell.h"
+
+#define BENCH_SWITCHES	2000	/* yield and ping-pong rounds */
+#define BENCH_ALLOCS	1000	/* kmalloc/kfree pairs per size */
+#define BENCH_COPIES	1000	/* uiomove calls */
+#define BENCH_COPYSIZE	4096
+#define BENCH_STRINGS	1000	/* calls per string function */
+#define BENCH_BLOCKS	256	/* file system blocks */
+#define BENCH_BLOCKSIZE	512
+#define BENCH_FORKS	50
+#define BENCH_FILENAME	"bench.tmp"
+
+static
+uint64_t
+bench_now(void)
+{
+	return clock_monotonic_ns();
+}
+
+/*
+ * Print the result for NAME: OPS operations, of BYTES bytes each if
+ * that means anything, from START until now.
+ */
+static
+void
+bench_report(const char *name, unsigned ops, size_t bytes, uint64_t start)
+{
+	uint64_t ns;
+
+	ns = bench_now();
+	/* we may have moved to a cpu whose clock is a little behind */
+	ns = ns > start ? ns - start : 1;
+	kprintf("bench %s ops=%u ns=%llu ns/op=%llu", name, ops,
+		(unsigned long long)ns, (unsigned long long)(ns / ops));
+	if (bytes > 0) {
+		kprintf(" bytes/op=%u MB/s=%llu", (unsigned)bytes,
+			(unsigned long long)((uint64_t)bytes * ops * 1000 / ns));
+	}
+	kprintf("\n");
+}
+
+////////////////////////////////////////////////////////////
+// Threads
+
+/*
+ * Two threads take turns: each waits on its own semaphore and then
+ * signals the other's. With yields, they just run side by side.
+ */
+struct bench_pair {
+	struct semaphore *bp_sem[2];
+	struct semaphore *bp_done;
+	struct lock *bp_lock;
+	struct cv *bp_cv;
+	volatile unsigned bp_turn;
+};
+
+static
+void
+bench_yieldthread(void *vbp, unsigned long num)
+{
+	struct bench_pair *bp = vbp;
+	unsigned i;
+
+	(void)num;
+	for (i=0; i<BENCH_SWITCHES; i++) {
+		thread_yield();
+	}
+	V(bp->bp_done);
+}
+
+static
+void
+bench_semthread(void *vbp, unsigned long num)
+{
+	struct bench_pair *bp = vbp;
+	unsigned i;
+
+	for (i=0; i<BENCH_SWITCHES; i++) {
+		P(bp->bp_sem[num]);
+		V(bp->bp_sem[1 - num]);
+	}
+	V(bp->bp_done);
+}
+
+static
+void
+bench_cvthread(void *vbp, unsigned long num)
+{
+	struct bench_pair *bp = vbp;
+	unsigned i;
+
+	lock_acquire(bp->bp_lock);
+	for (i=0; i<BENCH_SWITCHES; i++) {
+		while (bp->bp_turn != num) {
+			cv_wait(bp->bp_cv, bp->bp_lock);
+		}
+		bp->bp_turn = 1 - num;
+		cv_signal(bp->bp_cv, bp->bp_lock);
+	}
+	lock_release(bp->bp_lock);
+	V(bp->bp_done);
+}
+
+/*
+ * Run FUNC in two threads and time them, counting one operation per
+ * round per thread.
+ */
+static
+int
+bench_pair(const char *name,
+	   void (*func)(void *, unsigned long))
+{
+	struct bench_pair bp;
+	uint64_t start;
+	int result, i, started;
+
+	bp.bp_sem[0] = sem_create("bench", 1);
+	bp.bp_sem[1] = sem_create("bench", 0);
+	bp.bp_done = sem_create("bench", 0);
+	bp.bp_lock = lock_create("bench");
+	bp.bp_cv = cv_create("bench");
+	bp.bp_turn = 0;
+	result = 0;
+	if (bp.bp_sem[0] == NULL || bp.bp_sem[1] == NULL ||
+	    bp.bp_done == NULL || bp.bp_lock == NULL || bp.bp_cv == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+
+	start = bench_now();
+	started = 0;
+	for (i=0; i<2; i++) {
+		result = thread_fork(name, NULL, func, &bp, i);
+		if (result) {
+			break;
+		}
+		started++;
+	}
+	if (result) {
+		/* Let the one that started finish by itself */
+		kprintf("bench %s: thread_fork: %s\n", name,
+			strerror(result));
+		V(bp.bp_sem[1]);
+		bp.bp_turn = 1;
+		lock_acquire(bp.bp_lock);
+		cv_broadcast(bp.bp_cv, bp.bp_lock);
+		lock_release(bp.bp_lock);
+	}
+	for (i=0; i<started; i++) {
+		P(bp.bp_done);
+	}
+	if (!result) {
+		bench_report(name, 2 * BENCH_SWITCHES, 0, start);
+	}
+
+ out:
+	if (bp.bp_cv != NULL) {
+		cv_destroy(bp.bp_cv);
+	}
+	if (bp.bp_lock != NULL) {
+		lock_destroy(bp.bp_lock);
+	}
+	for (i=0; i<2; i++) {
+		if (bp.bp_sem[i] != NULL) {
+			sem_destroy(bp.bp_sem[i]);
+		}
+	}
+	if (bp.bp_done != NULL) {
+		sem_destroy(bp.bp_done);
+	}
+	return result;
+}
+
+static
+int
+bench_yield(const char *fs)
+{
+	(void)fs;
+	return bench_pair("yield", bench_yieldthread);
+}
+
+static
+int
+bench_semping(const char *fs)
+{
+	(void)fs;
+	return bench_pair("semping", bench_semthread);
+}
+
+static
+int
+bench_cvping(const char *fs)
+{
+	(void)fs;
+	return bench_pair("cvping", bench_cvthread);
+}
+
+////////////////////////////////////////////////////////////
+// Memory
+
+static
+int
+bench_kmalloc(const char *fs)
+{
+	static const size_t sizes[] = {
+		16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 16384
+	};
+	char name[32];
+	uint64_t start;
+	unsigned i, j;
+	void *p;
+
+	(void)fs;
+	for (i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++) {
+		snprintf(name, sizeof(name), "kmalloc_%u",
+			 (unsigned)sizes[i]);
+		start = bench_now();
+		for (j=0; j<BENCH_ALLOCS; j++) {
+			p = kmalloc(sizes[i]);
+			if (p == NULL) {
+				kprintf("bench %s: out of memory\n", name);
+				return ENOMEM;
+			}
+			kfree(p);
+		}
+		bench_report(name, BENCH_ALLOCS, 0, start);
+	}
+	return 0;
+}
+
+static
+int
+bench_uiomove(const char *fs)
+{
+	struct iovec iov;
+	struct uio ku;
+	char *src, *dst;
+	uint64_t start;
+	unsigned i;
+	int result;
+
+	(void)fs;
+	src = kmalloc(BENCH_COPYSIZE);
+	dst = kmalloc(BENCH_COPYSIZE);
+	if (src == NULL || dst == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+	memset(src, 'x', BENCH_COPYSIZE);
+
+	result = 0;
+	start = bench_now();
+	for (i=0; i<BENCH_COPIES && result == 0; i++) {
+		uio_kinit(&iov, &ku, dst, BENCH_COPYSIZE, 0, UIO_READ);
+		result = uiomove(src, BENCH_COPYSIZE, &ku);
+	}
+	if (result) {
+		kprintf("bench uiomove: %s\n", strerror(result));
+	}
+	else {
+		bench_report("uiomove", BENCH_COPIES, BENCH_COPYSIZE, start);
+	}
+
+ out:
+	if (src != NULL) {
+		kfree(src);
+	}
+	if (dst != NULL) {
+		kfree(dst);
+	}
+	return result;
+}
+
+/*
+ * Byte-at-a-time versions of the string functions, to compare the
+ * library's against. The volatile keeps the compiler from turning
+ * them back into library calls or word loops.
+ */
+static
+void
+bench_bytecopy(char *dst, const char *src, size_t len)
+{
+	volatile char *d = dst;
+
+	while (len-- > 0) {
+		*d++ = *src++;
+	}
+}
+
+static
+void
+bench_bytezero(char *dst, size_t len)
+{
+	volatile char *d = dst;
+
+	while (len-- > 0) {
+		*d++ = 0;
+	}
+}
+
+static
+size_t
+bench_bytestrlen(const char *str)
+{
+	const volatile char *s = str;
+
+	while (*s != 0) {
+		s++;
+	}
+	return s - str;
+}
+
+/*
+ * memcpy, bzero, and strlen against byte loops, on page-sized
+ * buffers. memcpy_unaligned has source and destination misaligned
+ * by the same amount; memcpy_skewed, by different amounts.
+ */
+static
+int
+bench_string(const char *fs)
+{
+	char *src, *dst;
+	uint64_t start;
+	unsigned i;
+	size_t n;
+
+	(void)fs;
+	src = kmalloc(BENCH_COPYSIZE + 8);
+	dst = kmalloc(BENCH_COPYSIZE + 8);
+	if (src == NULL || dst == NULL) {
+		kfree(src);
+		kfree(dst);
+		return ENOMEM;
+	}
+	memset(src, 'x', BENCH_COPYSIZE + 8);
+	src[BENCH_COPYSIZE] = 0;
+
+	start = bench_now();
+	for (i=0; i<BENCH_STRINGS; i++) {
+		bench_bytecopy(dst, src, BENCH_COPYSIZE);
+	}
+	bench_report("memcpy_byte", BENCH_STRINGS, BENCH_COPYSIZE, start);
+
+	start = bench_now();
+	for (i=0; i<BENCH_STRINGS; i++) {
+		memcpy(dst, src, BENCH_COPYSIZE);
+	}
+	bench_report("memcpy", BENCH_STRINGS, BENCH_COPYSIZE, start);
+
+	start = bench_now();
+	for (i=0; i<BENCH_STRINGS; i++) {
+		memcpy(dst + 3, src + 3, BENCH_COPYSIZE);
+	}
+	bench_report("memcpy_unaligned", BENCH_STRINGS, BENCH_COPYSIZE,
+		     start);
+
+	start = bench_now();
+	for (i=0; i<BENCH_STRINGS; i++) {
+		memcpy(dst + 1, src + 2, BENCH_COPYSIZE);
+	}
+	bench_report("memcpy_skewed", BENCH_STRINGS, BENCH_COPYSIZE, start);
+
+	start = bench_now();
+	for (i=0; i<BENCH_STRINGS; i++) {
+		bench_bytezero(dst, BENCH_COPYSIZE);
+	}
+	bench_report("bzero_byte", BENCH_STRINGS, BENCH_COPYSIZE, start);
+
+	start = bench_now();
+	for (i=0; i<BENCH_STRINGS; i++) {
+		bzero(dst, BENCH_COPYSIZE);
+	}
+	bench_report("bzero", BENCH_STRINGS, BENCH_COPYSIZE, start);
+
+	n = 0;
+	start = bench_now();
+	for (i=0; i<BENCH_STRINGS; i++) {
+		n += bench_bytestrlen(src);
+	}
+	bench_report("strlen_byte", BENCH_STRINGS, BENCH_COPYSIZE, start);
+
+	start = bench_now();
+	for (i=0; i<BENCH_STRINGS; i++) {
+		n += strlen(src);
+	}
+	bench_report("strlen", BENCH_STRINGS, BENCH_COPYSIZE, start);
+	KASSERT(n == 2 * BENCH_STRINGS * BENCH_COPYSIZE);
+
+	kfree(src);
+	kfree(dst);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// File system
+
+/*
+ * Do BENCH_BLOCKS block-sized writes (WRITE) or reads to the scratch
+ * file on FS. Writes include syncing the file at the end.
+ */
+static
+int
+bench_blockio(const char *fs, bool write)
+{
+	const char *name = write ? "fs_write" : "fs_read";
+	char path[64];
+	struct vnode *vn;
+	struct iovec iov;
+	struct uio ku;
+	char *buf;
+	uint64_t start;
+	unsigned i;
+	int result;
+
+	if (fs == NULL) {
+		kprintf("bench %s skipped: no -f\n", name);
+		return 0;
+	}
+
+	buf = kmalloc(BENCH_BLOCKSIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+	memset(buf, 'b', BENCH_BLOCKSIZE);
+
+	/* vfs_open destroys the string it's passed */
+	snprintf(path, sizeof(path), "%s:%s", fs, BENCH_FILENAME);
+	result = vfs_open(path, write ? O_WRONLY|O_CREAT|O_TRUNC : O_RDONLY,
+			  0664, &vn);
+	if (result) {
+		kprintf("bench %s: %s:%s: %s\n", name, fs, BENCH_FILENAME,
+			strerror(result));
+		kfree(buf);
+		return result;
+	}
+
+	start = bench_now();
+	for (i=0; i<BENCH_BLOCKS; i++) {
+		uio_kinit(&iov, &ku, buf, BENCH_BLOCKSIZE,
+			  (off_t)i * BENCH_BLOCKSIZE,
+			  write ? UIO_WRITE : UIO_READ);
+		result = write ? VOP_WRITE(vn, &ku) : VOP_READ(vn, &ku);
+		if (result == 0 && ku.uio_resid != 0) {
+			result = write ? ENOSPC : EIO;
+		}
+		if (result) {
+			break;
+		}
+	}
+	if (result == 0 && write) {
+		result = VOP_FSYNC(vn);
+	}
+	if (result) {
+		kprintf("bench %s: %s\n", name, strerror(result));
+	}
+	else {
+		bench_report(name, BENCH_BLOCKS, BENCH_BLOCKSIZE, start);
+	}
+
+	vfs_close(vn);
+	kfree(buf);
+	return result;
+}
+
+static
+int
+bench_fs(const char *fs)
+{
+	char path[64];
+	int result;
+
+	result = bench_blockio(fs, true);
+	if (result || fs == NULL) {
+		return result;
+	}
+	/* Straight after writing, so mostly from the buffer cache */
+	result = bench_blockio(fs, false);
+
+	snprintf(path, sizeof(path), "%s:%s", fs, BENCH_FILENAME);
+	vfs_remove(path);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// Processes
+
+#if OPT_SHELL
+static
+void
+bench_forkchild(void *junk, unsigned long junk2)
+{
+	(void)junk;
+	(void)junk2;
+
+	sys__exit(0);
+}
+
+/*
+ * Create a process, run a thread in it that exits at once, and wait
+ * for it, as a kernel-side fork and waitpid without the address space
+ * copy.
+ */
+static
+int
+bench_fork(const char *fs)
+{
+	struct proc *child;
+	uint64_t start;
+	unsigned i;
+	pid_t pid;
+	int ret;
+	int result;
+
+	(void)fs;
+	start = bench_now();
+	for (i=0; i<BENCH_FORKS; i++) {
+		child = proc_create_fork("bench");
+		if (child == NULL) {
+			kprintf("bench fork: out of memory\n");
+			return ENOMEM;
+		}
+		pid = child->p_pid;
+		proc_addchild(curproc, child);
+		result = thread_fork("bench", child, bench_forkchild,
+				     NULL, 0);
+		if (result) {
+			kprintf("bench fork: thread_fork: %s\n",
+				strerror(result));
+			proc_remchild(curproc, child);
+			proc_destroy(child);
+			return result;
+		}
+		result = sys_waitpid(pid, NULL, 0, &ret);
+		if (result) {
+			kprintf("bench fork: waitpid: %s\n",
+				strerror(result));
+			return result;
+		}
+	}
+	bench_report("fork", BENCH_FORKS, 0, start);
+	return 0;
+}
+#endif
+
+////////////////////////////////////////////////////////////
+
+static const struct {
+	const char *name;
+	int (*func)(const char *fs);
+} benches[] = {
+	{ "yield",	bench_yield },
+	{ "semping",	bench_semping },
+	{ "cvping",	bench_cvping },
+	{ "kmalloc",	bench_kmalloc },
+	{ "uiomove",	bench_uiomove },
+	{ "string",	bench_string },
+	{ "fs",		bench_fs },
+#if OPT_SHELL
+	{ "fork",	bench_fork },
+#endif
+	{ NULL, NULL }
+};
+
+static
+void
+bench_usage(void)
+{
+	unsigned i;
+
+	kprintf("Usage: bench [-f fsname] [name ...]\n");
+	kprintf("Names:");
+	for (i=0; benches[i].name != NULL; i++) {
+		kprintf(" %s", benches[i].name);
+	}
+	kprintf("\n");
+}
+
+int
+benchmark(int nargs, char **args)
+{
+	const char *fs = NULL;
+	int i, j, first, result;
+
+	first = 1;
+	if (nargs >= 3 && !strcmp(args[1], "-f")) {
+		fs = args[2];
+		first = 3;
+	}
+	for (i=first; i<nargs; i++) {
+		for (j=0; benches[j].name != NULL; j++) {
+			if (!strcmp(args[i], benches[j].name)) {
+				break;
+			}
+		}
+		if (benches[j].name == NULL) {
+			bench_usage();
+			return EINVAL;
+		}
+	}
+
+	for (j=0; benches[j].name != NULL; j++) {
+		if (first < nargs) {
+			for (i=first; i<nargs; i++) {
+				if (!strcmp(args[i], benches[j].name)) {
+					break;
+				}
+			}
+			if (i == nargs) {
+				continue;
+			}
+		}
+		result = benches[j].func(fs);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
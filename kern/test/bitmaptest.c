@@ -28,11 +28,17 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <bitmap.h>
 #include <test.h>
 
 #define TESTSIZE 533
+#define BENCHSIZE 32768
+#define BENCHGAP 1000		/* one free bit in this many */
+#define BENCHRUN 8
+#define BENCHOPS 1000
 
 int
 bitmaptest(int nargs, char **args)
@@ -101,6 +107,124 @@ bitmaptest(int nargs, char **args)
 		KASSERT(data[i]==0);
 	}
 
+	/* Rotating allocation: free a few bits, take them back in order */
+	bitmap_unmark(b, 3);
+	bitmap_unmark(b, TESTSIZE/2);
+	bitmap_unmark(b, TESTSIZE/2 + 1);
+	KASSERT(bitmap_alloc_from(b, TESTSIZE/2 + 1, &x)==0);
+	KASSERT(x == TESTSIZE/2 + 1);
+	KASSERT(bitmap_alloc_from(b, x + 1, &x)==0);
+	KASSERT(x == 3);
+	KASSERT(bitmap_alloc_from(b, x + 1, &x)==0);
+	KASSERT(x == TESTSIZE/2);
+	KASSERT(bitmap_alloc_from(b, x + 1, &x)==ENOSPC);
+
+	/* Ranges and counting */
+	KASSERT(bitmap_count(b) == TESTSIZE);
+	bitmap_unmark_range(b, 100, 20);
+	bitmap_unmark(b, 50);
+	KASSERT(bitmap_count(b) == TESTSIZE - 21);
+	KASSERT(bitmap_alloc_range(b, 21, &x)==ENOSPC);
+	KASSERT(bitmap_alloc_range(b, 20, &x)==0);
+	KASSERT(x == 100);
+	KASSERT(bitmap_alloc_range(b, 1, &x)==0);
+	KASSERT(x == 50);
+	KASSERT(bitmap_count(b) == TESTSIZE);
+
+	bitmap_destroy(b);
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
+
+/*
+ * Bitmap benchmark: time allocation from a nearly full bitmap, which
+ * is the case that matters for disk blocks, swap slots and pids.
+ */
+
+static
+uint64_t
+bitmaptest_now(void)
+{
+	struct timespec ts;
+
+	gettime(&ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static
+void
+bitmaptest_report(const char *name, unsigned ops, uint64_t start)
+{
+	uint64_t ns;
+
+	ns = bitmaptest_now() - start;
+	kprintf("bitmap %-12s ops=%u ns=%llu ns/op=%llu\n", name, ops,
+		(unsigned long long)ns, (unsigned long long)(ns / ops));
+}
+
+int
+bitmaptest2(int nargs, char **args)
+{
+	struct bitmap *b;
+	uint64_t start;
+	unsigned i, x, nfree;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting bitmap benchmark...\n");
+
+	b = bitmap_create(BENCHSIZE);
+	KASSERT(b != NULL);
+
+	/* Fill it, then leave one bit in BENCHGAP free */
+	KASSERT(bitmap_alloc_range(b, BENCHSIZE, &x)==0);
+	KASSERT(x == 0);
+	KASSERT(bitmap_count(b) == BENCHSIZE);
+	nfree = 0;
+	for (i=BENCHGAP/2; i<BENCHSIZE; i+=BENCHGAP) {
+		bitmap_unmark(b, i);
+		nfree++;
+	}
+	KASSERT(bitmap_count(b) == BENCHSIZE - nfree);
+
+	/* Take a bit and give it back: the hint moves on to the next */
+	start = bitmaptest_now();
+	for (i=0; i<BENCHOPS; i++) {
+		KASSERT(bitmap_alloc(b, &x)==0);
+		KASSERT(x % BENCHGAP == BENCHGAP/2);
+		bitmap_unmark(b, x);
+	}
+	bitmaptest_report("alloc", BENCHOPS, start);
+
+	/* Same, always searching from the start */
+	start = bitmaptest_now();
+	for (i=0; i<BENCHOPS; i++) {
+		KASSERT(bitmap_alloc_from(b, 0, &x)==0);
+		KASSERT(x == BENCHGAP/2);
+		bitmap_unmark(b, x);
+	}
+	bitmaptest_report("alloc_from 0", BENCHOPS, start);
+
+	/* A run that only fits at the very end */
+	bitmap_unmark_range(b, BENCHSIZE - BENCHRUN, BENCHRUN);
+	start = bitmaptest_now();
+	for (i=0; i<BENCHOPS; i++) {
+		KASSERT(bitmap_alloc_range(b, BENCHRUN, &x)==0);
+		KASSERT(x == BENCHSIZE - BENCHRUN);
+		bitmap_unmark_range(b, x, BENCHRUN);
+	}
+	bitmaptest_report("alloc_range", BENCHOPS, start);
+
+	start = bitmaptest_now();
+	for (i=0; i<BENCHOPS; i++) {
+		KASSERT(bitmap_count(b) == BENCHSIZE - nfree - BENCHRUN);
+	}
+	bitmaptest_report("count", BENCHOPS, start);
+
+	bitmap_destroy(b);
+
+	kprintf("Bitmap benchmark complete\n");
+	return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * False sharing benchmark.
+ *
+ * fsb [ncpus] runs a thread on each of the first NCPUS cpus (all of
+ * them by default; try 4 and 8) and times two workloads, each with
+ * the per-cpu words packed side by side and then each on a cache line
+ * of its own (__cacheline_aligned, as struct cpu now does):
+ *
+ *  - every thread incrementing its own counter;
+ *  - cpu 0 reading its word, as a cpu reads its own struct cpu, while
+ *    the others write theirs, as remote cpus write run queue and IPI
+ *    fields.
+ *
+ * System/161 doesn't model caches, so there the two layouts should
+ * time the same; the numbers mean something on hardware, or on a
+ * simulator that charges for coherence traffic.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <synch.h>
+#include <thread.h>
+#include <test.h>
+#include <platform/maxcpus.h>
+
+#define FSB_LOOPS	200000
+
+struct fsb_padded {
+	volatile unsigned fp_word;
+} __cacheline_aligned;
+
+static volatile unsigned fsb_packed[MAXCPUS];
+static struct fsb_padded fsb_padded[MAXCPUS];
+
+static struct semaphore *fsb_donesem;
+static volatile bool fsb_usepadded;
+static volatile bool fsb_readers;	/* cpu 0 reads, not writes */
+static volatile unsigned fsb_sink;
+
+static
+volatile unsigned *
+fsb_word(unsigned num)
+{
+	return fsb_usepadded ? &fsb_padded[num].fp_word : &fsb_packed[num];
+}
+
+static
+void
+fsb_thread(void *unused, unsigned long num)
+{
+	volatile unsigned *w;
+	unsigned i, sum;
+
+	(void)unused;
+
+	w = fsb_word(num);
+	if (fsb_readers && num == 0) {
+		sum = 0;
+		for (i=0; i<FSB_LOOPS; i++) {
+			sum += *w;
+		}
+		fsb_sink = sum;
+	}
+	else {
+		for (i=0; i<FSB_LOOPS; i++) {
+			(*w)++;
+		}
+	}
+	V(fsb_donesem);
+}
+
+/*
+ * Run the current workload on NCPUS cpus and print how long it took.
+ */
+static
+void
+fsb_run(const char *what, unsigned ncpus)
+{
+	struct timespec before, after, diff;
+	unsigned i;
+	int result;
+
+	for (i=0; i<ncpus; i++) {
+		fsb_packed[i] = 0;
+		fsb_padded[i].fp_word = 0;
+	}
+	gettime(&before);
+	for (i=0; i<ncpus; i++) {
+		result = thread_fork_bound("fsb", i, fsb_thread, NULL, i);
+		if (result) {
+			panic("fsb: thread_fork_bound: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<ncpus; i++) {
+		P(fsb_donesem);
+	}
+	gettime(&after);
+	timespec_sub(&after, &before, &diff);
+	kprintf("%-24s %s: %llu.%09lu seconds\n", what,
+		fsb_usepadded ? "padded" : "packed",
+		(unsigned long long)diff.tv_sec, (unsigned long)diff.tv_nsec);
+}
+
+int
+falsesharetest(int nargs, char **args)
+{
+	unsigned ncpus;
+
+	ncpus = thread_numcpus();
+	if (nargs > 1) {
+		ncpus = atoi(args[1]);
+		if (ncpus < 2 || ncpus > thread_numcpus()) {
+			kprintf("Usage: fsb [ncpus], with 2 to %u cpus\n",
+				thread_numcpus());
+			return EINVAL;
+		}
+	}
+	kprintf("False sharing benchmark on %u cpus, %u loops each, "
+		"%u-byte lines\n", ncpus, FSB_LOOPS, CACHELINE_SIZE);
+
+	fsb_donesem = sem_create("fsb", 0);
+	if (fsb_donesem == NULL) {
+		panic("fsb: sem_create failed\n");
+	}
+
+	fsb_readers = false;
+	fsb_usepadded = false;
+	fsb_run("all writing", ncpus);
+	fsb_usepadded = true;
+	fsb_run("all writing", ncpus);
+
+	fsb_readers = true;
+	fsb_usepadded = false;
+	fsb_run("cpu 0 reading", ncpus);
+	fsb_usepadded = true;
+	fsb_run("cpu 0 reading", ncpus);
+
+	sem_destroy(fsb_donesem);
+	return 0;
+}
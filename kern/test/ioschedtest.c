@@ -0,0 +1,133 @@
+/*
+ * I/O scheduler ordering test (iosched.h, DR_ORDERED and DR_BARRIER
+ * in device.h).
+ *
+ * iot plays driver to a scheduler of its own, with requests that are
+ * never sent to a disk, and checks which ones iosched_next hands out
+ * as others are reported done:
+ *
+ *  - a DR_ORDERED commit waits for the earlier requests with its tag,
+ *    while untagged and other-tagged requests queued after it go
+ *    ahead, and a later request with its tag waits for it in turn;
+ *  - a DR_BARRIER, and a flush (a barrier with no blocks), waits for
+ *    everything before it and holds up everything after it.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <device.h>
+#include <iosched.h>
+#include <test.h>
+
+#define NREQS	8
+
+static struct devreq reqs[NREQS];
+
+/*
+ * Set up request N.
+ */
+static
+struct devreq *
+iot_req(unsigned n, uint32_t block, uint32_t nblocks, unsigned flags,
+	unsigned tag)
+{
+	struct devreq *req = &reqs[n];
+
+	KASSERT(n < NREQS);
+	req->dr_block = block;
+	req->dr_nblocks = nblocks;
+	req->dr_data = NULL;
+	req->dr_write = true;
+	req->dr_flags = flags;
+	req->dr_tag = tag;
+	req->dr_result = 0;
+	req->dr_done = NULL;
+	req->dr_donedata = NULL;
+	return req;
+}
+
+/*
+ * Take everything the scheduler will hand out now, and check that it
+ * is exactly the requests in mask WANT.
+ */
+static
+void
+iot_expect(struct iosched *ios, uint32_t want)
+{
+	struct devreq *req;
+	uint32_t got = 0, bit;
+
+	while ((req = iosched_next(ios)) != NULL) {
+		bit = (uint32_t)1 << (req - reqs);
+		KASSERT((got & bit) == 0);
+		got |= bit;
+	}
+	if (got != want) {
+		panic("iot: got requests 0x%x, expected 0x%x\n", got, want);
+	}
+}
+
+#define R(n)	((uint32_t)1 << (n))
+
+int
+ioschedtest(int nargs, char **args)
+{
+	struct iosched *ios;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting iosched ordering test...\n");
+
+	ios = iosched_create("iot");
+	if (ios == NULL) {
+		panic("iot: iosched_create failed\n");
+	}
+
+	/* Two log blocks, their commit, and others that don't care */
+	iosched_add(ios, iot_req(0, 100, 1, 0, 1));
+	iosched_add(ios, iot_req(1, 101, 1, 0, 1));
+	iosched_add(ios, iot_req(2, 102, 1, DR_ORDERED, 1));
+	iosched_add(ios, iot_req(3, 500, 4, 0, 0));
+	iosched_add(ios, iot_req(4, 600, 4, 0, 2));
+	iot_expect(ios, R(0) | R(1) | R(3) | R(4));
+	iosched_done(ios, &reqs[3]);
+	iosched_done(ios, &reqs[0]);
+	iot_expect(ios, 0);
+	iosched_done(ios, &reqs[1]);
+	iot_expect(ios, R(2));
+
+	/* The next log block waits for the commit; others don't */
+	iosched_add(ios, iot_req(5, 103, 1, 0, 1));
+	iosched_add(ios, iot_req(6, 700, 1, 0, 0));
+	iot_expect(ios, R(6));
+	iosched_done(ios, &reqs[2]);
+	iot_expect(ios, R(5));
+	iosched_done(ios, &reqs[4]);
+	iosched_done(ios, &reqs[5]);
+	iosched_done(ios, &reqs[6]);
+	kprintf("iot: ordered requests ok\n");
+
+	/* A barrier, then a flush, each holding up what follows */
+	iosched_add(ios, iot_req(0, 10, 1, 0, 0));
+	iot_expect(ios, R(0));
+	iosched_add(ios, iot_req(1, 20, 1, DR_BARRIER, 0));
+	iosched_add(ios, iot_req(2, 5, 1, 0, 3));
+	iosched_add(ios, iot_req(3, 0, 0, DR_BARRIER, 0));
+	iosched_add(ios, iot_req(4, 30, 1, 0, 0));
+	iot_expect(ios, 0);
+	iosched_done(ios, &reqs[0]);
+	iot_expect(ios, R(1));
+	iosched_done(ios, &reqs[1]);
+	iot_expect(ios, R(2));
+	iosched_done(ios, &reqs[2]);
+	iot_expect(ios, R(3));
+	iosched_done(ios, &reqs[3]);
+	iot_expect(ios, R(4));
+	iosched_done(ios, &reqs[4]);
+	kprintf("iot: barriers ok\n");
+
+	iosched_destroy(ios);
+	kprintf("iosched ordering test done\n");
+	return 0;
+}
@@ -34,8 +34,10 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <thread.h>
+#include <spinlock.h>
 #include <synch.h>
 #include <vm.h> /* for PAGE_SIZE */
+#include <kmem_cache.h>
 #include <test.h>
 
 #include "opt-dumbvm.h"
@@ -378,3 +380,132 @@ kmalloctest4(int nargs, char **args)
 	kprintf("Multipage kmalloc test done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// km5 - kmem_cache
+
+#define KM5_MAGIC     0xfeedbeef
+#define KM5_NOBJS     100
+#define KM5_ROUNDS    20
+
+struct km5obj {
+	uint32_t magic;
+	unsigned long owner;
+	char pad[52];
+};
+
+static struct spinlock km5_lock = SPINLOCK_INITIALIZER;
+static unsigned km5_nctor, km5_ndtor;
+static struct semaphore *km5_sem;
+
+static
+int
+km5_ctor(void *obj)
+{
+	struct km5obj *k = obj;
+
+	k->magic = KM5_MAGIC;
+	k->owner = (unsigned long)-1;
+	spinlock_acquire(&km5_lock);
+	km5_nctor++;
+	spinlock_release(&km5_lock);
+	return 0;
+}
+
+static
+void
+km5_dtor(void *obj)
+{
+	struct km5obj *k = obj;
+
+	KASSERT(k->magic == KM5_MAGIC);
+	k->magic = 0;
+	spinlock_acquire(&km5_lock);
+	km5_ndtor++;
+	spinlock_release(&km5_lock);
+}
+
+static
+void
+kmalloctest5thread(void *kc, unsigned long num)
+{
+	struct km5obj *objs[KM5_NOBJS];
+	unsigned round, i;
+
+	for (round=0; round<KM5_ROUNDS; round++) {
+		for (i=0; i<KM5_NOBJS; i++) {
+			objs[i] = kmem_cache_alloc(kc);
+			if (objs[i] == NULL) {
+				panic("kmalloctest5: thread %lu: "
+				      "kmem_cache_alloc failed\n", num);
+			}
+			if (objs[i]->magic != KM5_MAGIC ||
+			    objs[i]->owner != (unsigned long)-1) {
+				panic("kmalloctest5: thread %lu: "
+				      "object %p not in constructed state\n",
+				      num, objs[i]);
+			}
+			objs[i]->owner = num;
+		}
+		for (i=0; i<KM5_NOBJS; i++) {
+			if (objs[i]->owner != num) {
+				panic("kmalloctest5: thread %lu: "
+				      "object %p clobbered by thread %lu\n",
+				      num, objs[i], objs[i]->owner);
+			}
+			/* free objects must be back in constructed state */
+			objs[i]->owner = (unsigned long)-1;
+			kmem_cache_free(kc, objs[i]);
+		}
+	}
+	V(km5_sem);
+}
+
+int
+kmalloctest5(int nargs, char **args)
+{
+	struct kmem_cache *kc;
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting kmem_cache test...\n");
+
+	km5_sem = sem_create("kmalloctest5", 0);
+	if (km5_sem == NULL) {
+		panic("kmalloctest5: sem_create failed\n");
+	}
+	km5_nctor = km5_ndtor = 0;
+	kc = kmem_cache_create("km5", sizeof(struct km5obj),
+			       km5_ctor, km5_dtor);
+	if (kc == NULL) {
+		panic("kmalloctest5: kmem_cache_create failed\n");
+	}
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("kmalloctest5", NULL,
+				     kmalloctest5thread, kc, i);
+		if (result) {
+			panic("kmalloctest5: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(km5_sem);
+	}
+
+	kmem_cache_printstats();
+	kmem_cache_destroy(kc);
+	sem_destroy(km5_sem);
+
+	if (km5_nctor != km5_ndtor) {
+		panic("kmalloctest5: %u objects constructed, %u destroyed\n",
+		      km5_nctor, km5_ndtor);
+	}
+	kprintf("%u objects constructed over %u allocations\n",
+		km5_nctor, NTHREADS * KM5_NOBJS * KM5_ROUNDS);
+	kprintf("kmem_cache test done\n");
+	return 0;
+}
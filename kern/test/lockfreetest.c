@@ -0,0 +1,317 @@
+/*
+ * Lock-free stack and queue test and benchmark (lockfree.h).
+ *
+ * lft runs a thread on every cpu:
+ *
+ *  - popping and pushing back nodes of one lfstack, each time marking
+ *    the node it has, spinning a little, and checking nobody else got
+ *    it too; at the end every node must be on the stack once;
+ *  - pushing numbered nodes onto one mpscq that this thread consumes,
+ *    checking each producer's nodes come out in order and none are
+ *    lost.
+ *
+ * Then it times pop-and-push pairs on an lfstack against the same on
+ * a spinlocked stack, with every cpu at it at once.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <lockfree.h>
+#include <test.h>
+#include <platform/maxcpus.h>
+
+#define NNODES		64
+#define STACKLOOPS	20000
+#define QITEMS		5000
+#define BENCHLOOPS	50000
+
+static struct semaphore *lft_donesem;
+static struct lfstack lft_stack;
+static volatile unsigned lft_links[NNODES];
+static volatile unsigned lft_owner[NNODES];
+static volatile unsigned lft_clashes;
+
+struct lftitem {
+	struct mpscq_node li_node;	/* first, to convert back */
+	unsigned li_producer;
+	unsigned li_seq;
+};
+
+static struct mpscq lft_queue;
+static struct lftitem *lft_items;
+
+static struct spinlock lft_benchlock = SPINLOCK_INITIALIZER;
+static unsigned lft_lockedtop;
+
+/*
+ * Run FUNC(NUM) on every cpu and wait for them all.
+ */
+static
+void
+lft_everycpu(const char *name, void (*func)(void *, unsigned long),
+	     unsigned ncpus)
+{
+	unsigned i;
+	int result;
+
+	for (i=0; i<ncpus; i++) {
+		result = thread_fork_bound(name, i, func, NULL, i);
+		if (result) {
+			panic("lft: thread_fork_bound: %s\n", strerror(result));
+		}
+	}
+	for (i=0; i<ncpus; i++) {
+		P(lft_donesem);
+	}
+}
+
+static
+void
+lft_stackthread(void *unused, unsigned long num)
+{
+	unsigned i, j, index;
+
+	(void)unused;
+
+	for (i=0; i<STACKLOOPS; i++) {
+		index = lfstack_pop(&lft_stack);
+		if (index == LFSTACK_NONE) {
+			continue;
+		}
+		if (lft_owner[index] != 0) {
+			lft_clashes++;
+		}
+		lft_owner[index] = num + 1;
+		for (j=0; j<i % 16; j++) {
+			/* hold it a moment */
+		}
+		if (lft_owner[index] != num + 1) {
+			lft_clashes++;
+		}
+		lft_owner[index] = 0;
+		lfstack_push(&lft_stack, index);
+	}
+	V(lft_donesem);
+}
+
+static
+bool
+lft_stacktest(unsigned ncpus)
+{
+	bool seen[NNODES];
+	unsigned i, index, count;
+	bool ok = true;
+
+	lfstack_init(&lft_stack, lft_links);
+	for (i=0; i<NNODES; i++) {
+		lft_owner[i] = 0;
+		seen[i] = false;
+		lfstack_push(&lft_stack, i);
+	}
+	lft_clashes = 0;
+
+	lft_everycpu("lft stack", lft_stackthread, ncpus);
+
+	if (lft_clashes > 0) {
+		kprintf("lfstack: %u nodes popped twice\n", lft_clashes);
+		ok = false;
+	}
+	count = 0;
+	while ((index = lfstack_pop(&lft_stack)) != LFSTACK_NONE) {
+		if (index >= NNODES || seen[index]) {
+			kprintf("lfstack: bad or repeated index %u\n", index);
+			ok = false;
+			break;
+		}
+		seen[index] = true;
+		count++;
+	}
+	if (count != NNODES) {
+		kprintf("lfstack: %u nodes at the end, not %u\n", count,
+			NNODES);
+		ok = false;
+	}
+	return ok;
+}
+
+static
+void
+lft_producer(void *unused, unsigned long num)
+{
+	struct lftitem *li;
+	unsigned i;
+
+	(void)unused;
+
+	for (i=0; i<QITEMS; i++) {
+		li = &lft_items[num * QITEMS + i];
+		li->li_producer = num;
+		li->li_seq = i;
+		mpscq_push(&lft_queue, &li->li_node);
+	}
+	V(lft_donesem);
+}
+
+static
+bool
+lft_queuetest(unsigned ncpus)
+{
+	unsigned next[MAXCPUS];
+	struct mpscq_node *n;
+	struct lftitem *li;
+	unsigned i, got;
+	int result;
+	bool ok = true;
+
+	lft_items = kmalloc(ncpus * QITEMS * sizeof(*lft_items));
+	if (lft_items == NULL) {
+		kprintf("mpscq: out of memory\n");
+		return false;
+	}
+	mpscq_init(&lft_queue);
+	for (i=0; i<ncpus; i++) {
+		next[i] = 0;
+		result = thread_fork_bound("lft producer", i, lft_producer,
+					   NULL, i);
+		if (result) {
+			panic("lft: thread_fork_bound: %s\n", strerror(result));
+		}
+	}
+
+	got = 0;
+	while (got < ncpus * QITEMS) {
+		n = mpscq_pop(&lft_queue);
+		if (n == NULL) {
+			thread_yield();
+			continue;
+		}
+		li = (struct lftitem *)n;
+		if (li->li_producer >= ncpus ||
+		    li->li_seq != next[li->li_producer]) {
+			kprintf("mpscq: got %u/%u, expected %u\n",
+				li->li_producer, li->li_seq,
+				li->li_producer < ncpus ?
+				next[li->li_producer] : 0);
+			ok = false;
+			break;
+		}
+		next[li->li_producer]++;
+		got++;
+	}
+	for (i=0; i<ncpus; i++) {
+		P(lft_donesem);
+	}
+	if (ok && mpscq_pop(&lft_queue) != NULL) {
+		kprintf("mpscq: extra items\n");
+		ok = false;
+	}
+	kfree(lft_items);
+	return ok;
+}
+
+static
+void
+lft_benchlf(void *unused, unsigned long num)
+{
+	unsigned i, index;
+
+	(void)unused;
+	(void)num;
+
+	for (i=0; i<BENCHLOOPS; i++) {
+		index = lfstack_pop(&lft_stack);
+		if (index != LFSTACK_NONE) {
+			lfstack_push(&lft_stack, index);
+		}
+	}
+	V(lft_donesem);
+}
+
+static
+void
+lft_benchlocked(void *unused, unsigned long num)
+{
+	unsigned i, index;
+
+	(void)unused;
+	(void)num;
+
+	for (i=0; i<BENCHLOOPS; i++) {
+		spinlock_acquire(&lft_benchlock);
+		index = lft_lockedtop;
+		if (index != LFSTACK_NONE) {
+			lft_lockedtop = lft_links[index];
+		}
+		spinlock_release(&lft_benchlock);
+		if (index != LFSTACK_NONE) {
+			spinlock_acquire(&lft_benchlock);
+			lft_links[index] = lft_lockedtop;
+			lft_lockedtop = index;
+			spinlock_release(&lft_benchlock);
+		}
+	}
+	V(lft_donesem);
+}
+
+/*
+ * Time FUNC on every cpu and print nanoseconds per pop and push.
+ */
+static
+void
+lft_bench(const char *what, void (*func)(void *, unsigned long),
+	  unsigned ncpus)
+{
+	struct timespec before, after, diff;
+	uint64_t ns;
+
+	gettime(&before);
+	lft_everycpu(what, func, ncpus);
+	gettime(&after);
+	timespec_sub(&after, &before, &diff);
+	ns = diff.tv_sec * 1000000000ULL + diff.tv_nsec;
+	kprintf("%s: %llu ns per pop and push (%u cpus)\n", what,
+		ns / BENCHLOOPS, ncpus);
+}
+
+int
+lockfreetest(int nargs, char **args)
+{
+	unsigned ncpus, i;
+	bool ok = true;
+
+	(void)nargs;
+	(void)args;
+
+	ncpus = thread_numcpus();
+	kprintf("Starting lock-free stack and queue test on %u cpus...\n",
+		ncpus);
+
+	lft_donesem = sem_create("lft", 0);
+	if (lft_donesem == NULL) {
+		panic("lft: sem_create failed\n");
+	}
+
+	ok = lft_stacktest(ncpus) && ok;
+	ok = lft_queuetest(ncpus) && ok;
+
+	lfstack_init(&lft_stack, lft_links);
+	for (i=0; i<NNODES; i++) {
+		lfstack_push(&lft_stack, i);
+	}
+	lft_bench("lfstack", lft_benchlf, ncpus);
+	lft_lockedtop = LFSTACK_NONE;
+	for (i=0; i<NNODES; i++) {
+		lft_links[i] = lft_lockedtop;
+		lft_lockedtop = i;
+	}
+	lft_bench("spinlocked stack", lft_benchlocked, ncpus);
+
+	sem_destroy(lft_donesem);
+	kprintf("Lock-free test %s\n", ok ? "done" : "FAILED");
+	return 0;
+}
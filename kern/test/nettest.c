@@ -29,16 +29,303 @@
 
 /*
  * Network test code.
+ *
+ *    net echo [port]                   - start a UDP echo server, in a
+ *                                        kernel thread, on PORT (7).
+ *    net ping addr [count [size [port]]]
+ *                                      - send COUNT (100) datagrams of
+ *                                        SIZE (64) bytes to an echo
+ *                                        server at ADDR, one at a time,
+ *                                        and report packets per second
+ *                                        and round-trip latency.
+ *    net stat                          - interface counters.
+ *
+ * With no network card, "net echo" and "net ping 127.0.0.1" exercise
+ * everything but the driver over loopback.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <uio.h>
+#include <net.h>
 #include <test.h>
 
+#define NET_ECHOPORT	7
+#define NET_PINGWAIT	HZ	/* one second */
+
+static
+void
+nettest_echo(void *data1, unsigned long data2)
+{
+	struct udpsock *us = data1;
+	char *buf;
+	struct iovec iov;
+	struct uio ku;
+	uint32_t addr;
+	uint16_t port;
+	size_t len;
+	int result;
+
+	(void)data2;
+
+	buf = kmalloc(UDP_MAXDATA);
+	if (buf == NULL) {
+		kprintf("net echo: Out of memory\n");
+		udp_destroy(us);
+		return;
+	}
+	while (1) {
+		uio_kinit(&iov, &ku, buf, UDP_MAXDATA, 0, UIO_READ);
+		result = udp_recv(us, &ku, 0, &addr, &port);
+		if (result) {
+			kprintf("net echo: recv: %s\n", strerror(result));
+			continue;
+		}
+		len = UDP_MAXDATA - ku.uio_resid;
+		uio_kinit(&iov, &ku, buf, len, 0, UIO_WRITE);
+		result = udp_send(us, &ku, addr, port);
+		if (result) {
+			kprintf("net echo: send: %s\n", strerror(result));
+		}
+	}
+}
+
+static
+int
+nettest_startecho(uint16_t port)
+{
+	struct udpsock *us;
+	int result;
+
+	result = udp_create(&us);
+	if (result) {
+		return result;
+	}
+	result = udp_bind(us, INADDR_ANY, port);
+	if (result) {
+		udp_destroy(us);
+		return result;
+	}
+	result = thread_fork("net echo", NULL, nettest_echo, us, 0);
+	if (result) {
+		udp_destroy(us);
+		return result;
+	}
+	kprintf("net echo: Listening on port %u\n", port);
+	return 0;
+}
+
+/*
+ * Parse a dotted quad.
+ */
+static
+int
+nettest_parseaddr(const char *s, uint32_t *ret)
+{
+	uint32_t addr = 0;
+	unsigned i, val;
+
+	for (i=0; i<4; i++) {
+		if (*s < '0' || *s > '9') {
+			return EINVAL;
+		}
+		val = 0;
+		while (*s >= '0' && *s <= '9') {
+			val = val * 10 + (*s++ - '0');
+		}
+		if (val > 255 || *s != (i < 3 ? '.' : '\0')) {
+			return EINVAL;
+		}
+		s++;
+		addr = (addr << 8) | val;
+	}
+	*ret = addr;
+	return 0;
+}
+
+static
+bool
+nettest_same(const char *a, const char *b, size_t len)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		if (a[i] != b[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static
+uint32_t
+nettest_usec(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+}
+
+static
+int
+nettest_ping(uint32_t addr, unsigned count, unsigned size, uint16_t port)
+{
+	struct udpsock *us;
+	char *sbuf, *rbuf;
+	struct iovec iov;
+	struct uio ku;
+	struct timespec start, sent, now, diff;
+	uint32_t rtt, min, max, total;
+	uint32_t raddr;
+	uint16_t rport;
+	unsigned i, got, lost, bad;
+	int result;
+
+	if (size > UDP_MAXDATA) {
+		return EMSGSIZE;
+	}
+	sbuf = kmalloc(size + 1);
+	rbuf = kmalloc(size + 1);
+	if (sbuf == NULL || rbuf == NULL) {
+		kfree(sbuf);
+		kfree(rbuf);
+		return ENOMEM;
+	}
+	result = udp_create(&us);
+	if (result) {
+		kfree(sbuf);
+		kfree(rbuf);
+		return result;
+	}
+
+	min = 0xffffffff;
+	max = total = 0;
+	got = lost = bad = 0;
+	gettime(&start);
+	for (i=0; i<count; i++) {
+		memset(sbuf, i & 0xff, size);
+		gettime(&sent);
+		uio_kinit(&iov, &ku, sbuf, size, 0, UIO_WRITE);
+		result = udp_send(us, &ku, addr, port);
+		if (result) {
+			kprintf("net ping: send: %s\n", strerror(result));
+			break;
+		}
+
+		uio_kinit(&iov, &ku, rbuf, size, 0, UIO_READ);
+		result = udp_recv(us, &ku, NET_PINGWAIT, &raddr, &rport);
+		if (result == ETIMEDOUT) {
+			lost++;
+			continue;
+		}
+		if (result) {
+			kprintf("net ping: recv: %s\n", strerror(result));
+			break;
+		}
+		gettime(&now);
+		if (ku.uio_resid != 0 || !nettest_same(sbuf, rbuf, size)) {
+			/* Probably a late reply to an earlier one */
+			bad++;
+			continue;
+		}
+		timespec_sub(&now, &sent, &diff);
+		rtt = nettest_usec(&diff);
+		if (rtt < min) {
+			min = rtt;
+		}
+		if (rtt > max) {
+			max = rtt;
+		}
+		total += rtt;
+		got++;
+	}
+	gettime(&now);
+	timespec_sub(&now, &start, &diff);
+
+	udp_destroy(us);
+	kfree(sbuf);
+	kfree(rbuf);
+
+	kprintf("net ping: %u sent, %u received, %u lost, %u bad "
+		"in %llu.%03lu s\n", i, got, lost, bad,
+		(unsigned long long)diff.tv_sec,
+		(unsigned long)(diff.tv_nsec / 1000000));
+	if (nettest_usec(&diff) > 0) {
+		kprintf("net ping: %u packets/s round trip\n",
+			(unsigned)((uint64_t)got * 1000000 /
+				   nettest_usec(&diff)));
+	}
+	if (got > 0) {
+		kprintf("net ping: latency min %u avg %u max %u us\n",
+			min, total / got, max);
+	}
+	return result;
+}
+
+static
+void
+nettest_stat(void)
+{
+	struct netif *ni;
+
+	ni = netif_first();
+	if (ni == NULL) {
+		kprintf("No network interfaces (loopback only)\n");
+	}
+	for (; ni != NULL; ni = ni->ni_next) {
+		kprintf("%s: in %u (dropped %u), out %u (dropped %u)\n",
+			ni->ni_name, ni->ni_ipackets, ni->ni_idrops,
+			ni->ni_opackets, ni->ni_odrops);
+	}
+}
+
+static
+void
+nettest_usage(void)
+{
+	kprintf("Usage: net echo [port]\n");
+	kprintf("       net ping addr [count [size [port]]]\n");
+	kprintf("       net stat\n");
+}
+
 int
 nettest(int nargs, char **args)
 {
-	(void)nargs;
-	(void)args;
-	kprintf("No network support available\n");
-	return 1;
+	uint32_t addr;
+	unsigned count, size, port;
+	int result;
+
+	if (nargs < 2) {
+		nettest_usage();
+		return EINVAL;
+	}
+
+	if (!strcmp(args[1], "echo") && nargs <= 3) {
+		port = nargs > 2 ? atoi(args[2]) : NET_ECHOPORT;
+		result = nettest_startecho(port);
+	}
+	else if (!strcmp(args[1], "ping") && nargs >= 3 && nargs <= 6) {
+		result = nettest_parseaddr(args[2], &addr);
+		if (result) {
+			kprintf("net ping: Bad address %s\n", args[2]);
+			return result;
+		}
+		count = nargs > 3 ? atoi(args[3]) : 100;
+		size = nargs > 4 ? atoi(args[4]) : 64;
+		port = nargs > 5 ? atoi(args[5]) : NET_ECHOPORT;
+		result = nettest_ping(addr, count, size, port);
+	}
+	else if (!strcmp(args[1], "stat") && nargs == 2) {
+		nettest_stat();
+		result = 0;
+	}
+	else {
+		nettest_usage();
+		return EINVAL;
+	}
+
+	if (result) {
+		kprintf("net: %s\n", strerror(result));
+	}
+	return result;
 }
@@ -0,0 +1,159 @@
+/*
+ * parallel_for test.
+ *
+ * Runs ranges of various sizes and chunk sizes through parallel_for
+ * and checks that every index was done exactly once, counting how
+ * many chunks each cpu did. Then does the same from inside a chunk,
+ * to check that nesting finishes, and with a spinlock held, where
+ * everything has to happen on this cpu.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <parallel.h>
+#include <test.h>
+#include <platform/maxcpus.h>
+
+#define NMAX	1000
+
+struct pftest {
+	unsigned pf_n;
+	unsigned pf_chunk;
+	unsigned pf_nested;		/* chunk size of a nested run, or 0 */
+	volatile unsigned pf_done[NMAX];
+	volatile unsigned pf_chunks[MAXCPUS];
+	volatile unsigned pf_bad;	/* ranges that weren't chunks */
+};
+
+static struct pftest pft, pft_nested;
+static struct spinlock pft_lock = SPINLOCK_INITIALIZER;
+
+static
+void
+parallelfortest_func(void *arg, unsigned start, unsigned end)
+{
+	struct pftest *pf = arg;
+	unsigned i;
+
+	if (start % pf->pf_chunk != 0 || end <= start || end > pf->pf_n ||
+	    (end - start != pf->pf_chunk && end != pf->pf_n)) {
+		pf->pf_bad++;
+		return;
+	}
+	for (i=start; i<end; i++) {
+		pf->pf_done[i]++;
+	}
+	pf->pf_chunks[curcpu->c_number]++;
+
+	if (pf->pf_nested != 0 && start == 0) {
+		parallel_for(pft_nested.pf_n, pft_nested.pf_chunk,
+			     parallelfortest_func, &pft_nested);
+	}
+}
+
+static
+void
+parallelfortest_setup(struct pftest *pf, unsigned n, unsigned chunk)
+{
+	unsigned i;
+
+	pf->pf_n = n;
+	pf->pf_chunk = chunk;
+	pf->pf_nested = 0;
+	pf->pf_bad = 0;
+	for (i=0; i<NMAX; i++) {
+		pf->pf_done[i] = 0;
+	}
+	for (i=0; i<MAXCPUS; i++) {
+		pf->pf_chunks[i] = 0;
+	}
+}
+
+/*
+ * Check that PF came out right; print how it was spread if VERBOSE.
+ */
+static
+bool
+parallelfortest_check(struct pftest *pf, const char *what, bool verbose)
+{
+	unsigned i, ncpus, nused;
+	bool ok = true;
+
+	if (pf->pf_bad > 0) {
+		kprintf("%s: %u bad ranges\n", what, pf->pf_bad);
+		ok = false;
+	}
+	for (i=0; i<pf->pf_n; i++) {
+		if (pf->pf_done[i] != 1) {
+			kprintf("%s: index %u done %u times\n", what, i,
+				pf->pf_done[i]);
+			ok = false;
+			break;
+		}
+	}
+	ncpus = thread_numcpus();
+	nused = 0;
+	for (i=0; i<ncpus; i++) {
+		if (pf->pf_chunks[i] > 0) {
+			nused++;
+		}
+	}
+	if (verbose) {
+		kprintf("%s: %u chunks on %u cpus\n", what,
+			DIVROUNDUP(pf->pf_n, pf->pf_chunk), nused);
+	}
+	return ok;
+}
+
+int
+parallelfortest(int nargs, char **args)
+{
+	static const unsigned sizes[][2] = {
+		{ 1, 1 }, { 10, 1 }, { 10, 3 }, { 100, 7 },
+		{ NMAX, 1 }, { NMAX, 64 }, { NMAX, NMAX },
+	};
+	char what[32];
+	unsigned i, cpu;
+	bool ok = true;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting parallel_for test on %u cpus...\n",
+		thread_numcpus());
+
+	for (i=0; i<sizeof(sizes) / sizeof(sizes[0]); i++) {
+		parallelfortest_setup(&pft, sizes[i][0], sizes[i][1]);
+		parallel_for(pft.pf_n, pft.pf_chunk, parallelfortest_func,
+			     &pft);
+		snprintf(what, sizeof(what), "%u by %u", sizes[i][0],
+			 sizes[i][1]);
+		ok = parallelfortest_check(&pft, what, true) && ok;
+	}
+
+	parallelfortest_setup(&pft, NMAX, 10);
+	parallelfortest_setup(&pft_nested, NMAX, 5);
+	pft.pf_nested = 1;
+	parallel_for(pft.pf_n, pft.pf_chunk, parallelfortest_func, &pft);
+	ok = parallelfortest_check(&pft, "outer", false) && ok;
+	ok = parallelfortest_check(&pft_nested, "nested", true) && ok;
+
+	parallelfortest_setup(&pft, NMAX, 10);
+	spinlock_acquire(&pft_lock);
+	cpu = curcpu->c_number;
+	parallel_for(pft.pf_n, pft.pf_chunk, parallelfortest_func, &pft);
+	spinlock_release(&pft_lock);
+	ok = parallelfortest_check(&pft, "spinlock held", false) && ok;
+	if (pft.pf_chunks[cpu] != DIVROUNDUP(NMAX, 10)) {
+		kprintf("spinlock held: only %u chunks on this cpu\n",
+			pft.pf_chunks[cpu]);
+		ok = false;
+	}
+
+	kprintf("parallel_for test %s\n", ok ? "done" : "FAILED");
+	return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * Cross-cpu call test.
+ *
+ * Calls a function on every other cpu and checks that each ran it
+ * once, on the right cpu. Then queues more calls on one cpu than its
+ * queue holds, without waiting in between, so that some have to wait
+ * for room and the rest are batched, and checks they all get made.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <test.h>
+#include <platform/maxcpus.h>
+
+#define NBATCH		(3 * SMP_CALL_MAX)
+
+static struct spinlock count_lock = SPINLOCK_INITIALIZER;
+static unsigned percpu_calls[MAXCPUS];
+static unsigned wrongcpu;
+
+static
+void
+smpcalltest_func(void *arg)
+{
+	struct cpu *want = arg;
+
+	spinlock_acquire(&count_lock);
+	percpu_calls[curcpu->c_number]++;
+	if (want != NULL && want != curcpu->c_self) {
+		wrongcpu++;
+	}
+	spinlock_release(&count_lock);
+}
+
+int
+smpcalltest(int nargs, char **args)
+{
+	static struct smp_call calls[NBATCH];
+	struct cpu *target;
+	unsigned i, n, total;
+	bool ok = true;
+
+	(void)nargs;
+	(void)args;
+
+	n = thread_numcpus();
+	kprintf("Starting cross-cpu call test on %u cpus...\n", n);
+
+	for (i=0; i<n; i++) {
+		percpu_calls[i] = 0;
+	}
+	wrongcpu = 0;
+
+	/* One to each cpu in turn, including this one */
+	for (i=0; i<n; i++) {
+		target = thread_getcpu(i);
+		smp_call_function(target, smpcalltest_func, target);
+	}
+	/* And one to all the others at once: one cpu (ours) has 1 */
+	smp_call_function_others(smpcalltest_func, NULL);
+	total = 0;
+	for (i=0; i<n; i++) {
+		if (percpu_calls[i] != 1 && percpu_calls[i] != 2) {
+			kprintf("cpu %u made %u calls\n", i, percpu_calls[i]);
+			ok = false;
+		}
+		total += percpu_calls[i];
+	}
+	if (total != 2 * n - 1) {
+		kprintf("%u calls made, not %u\n", total, 2 * n - 1);
+		ok = false;
+	}
+	if (wrongcpu > 0) {
+		kprintf("%u calls ran on the wrong cpu\n", wrongcpu);
+		ok = false;
+	}
+
+	/* A batch bigger than one cpu's queue, to the last cpu */
+	target = thread_getcpu(n - 1);
+	for (i=0; i<n; i++) {
+		percpu_calls[i] = 0;
+	}
+	for (i=0; i<NBATCH; i++) {
+		smp_call_init(&calls[i], smpcalltest_func, target);
+		smp_call(target, &calls[i]);
+	}
+	for (i=0; i<NBATCH; i++) {
+		smp_call_wait(&calls[i]);
+	}
+	if (percpu_calls[n - 1] != NBATCH || wrongcpu > 0) {
+		kprintf("batch: %u of %u calls made on cpu %u\n",
+			percpu_calls[n - 1], NBATCH, n - 1);
+		ok = false;
+	}
+
+	kprintf("Cross-cpu call test %s\n", ok ? "done" : "FAILED");
+	return 0;
+}
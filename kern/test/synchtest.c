@@ -399,3 +399,194 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Reader-writer lock test.
+ *
+ * Writers update testval1/testval2 with a yield in between, so a
+ * reader that got in alongside a writer would see them disagree.
+ * Readers yield while holding the lock too, so that with several
+ * cpus (or just preemption) more than one is inside at once; we
+ * report the most seen together.
+ */
+
+#define NRWREADERS	24
+#define NRWWRITERS	8
+#define NRWLOOPS	40
+
+static struct rwlock *testrwlock;
+static struct spinlock rwcount_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned rwreaders_in, rwreaders_max;
+static volatile bool rwwriter_in;
+static volatile bool rwfailed;
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	rwfailed = true;
+}
+
+static
+void
+rwreaderthread(void *junk, unsigned long num)
+{
+	int i;
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		rwlock_acquire_read(testrwlock);
+
+		spinlock_acquire(&rwcount_lock);
+		if (rwwriter_in) {
+			rwfail(num, "reader got in with a writer");
+		}
+		rwreaders_in++;
+		if (rwreaders_in > rwreaders_max) {
+			rwreaders_max = rwreaders_in;
+		}
+		spinlock_release(&rwcount_lock);
+
+		if (testval2 != testval1*testval1) {
+			rwfail(num, "reader saw a partial write");
+		}
+		thread_yield();
+		if (testval2 != testval1*testval1) {
+			rwfail(num, "value changed under a reader");
+		}
+
+		spinlock_acquire(&rwcount_lock);
+		rwreaders_in--;
+		spinlock_release(&rwcount_lock);
+
+		rwlock_release_read(testrwlock);
+	}
+	V(donesem);
+}
+
+static
+void
+rwwriterthread(void *junk, unsigned long num)
+{
+	int i;
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		rwlock_acquire_write(testrwlock);
+		KASSERT(rwlock_do_i_hold_write(testrwlock));
+
+		spinlock_acquire(&rwcount_lock);
+		if (rwwriter_in || rwreaders_in > 0) {
+			rwfail(num, "writer got in with someone else");
+		}
+		rwwriter_in = true;
+		spinlock_release(&rwcount_lock);
+
+		testval1 = num;
+		thread_yield();
+		testval2 = num*num;
+
+		spinlock_acquire(&rwcount_lock);
+		rwwriter_in = false;
+		spinlock_release(&rwcount_lock);
+
+		rwlock_release_write(testrwlock);
+	}
+	V(donesem);
+}
+
+int
+rwlocktest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	testrwlock = rwlock_create("testrwlock");
+	if (testrwlock == NULL) {
+		panic("rwlocktest: rwlock_create failed\n");
+	}
+	testval1 = testval2 = 0;
+	rwreaders_in = rwreaders_max = 0;
+	rwwriter_in = false;
+	rwfailed = false;
+
+	kprintf("Starting rwlock test...\n");
+
+	for (i=0; i<NRWREADERS + NRWWRITERS; i++) {
+		result = thread_fork("rwlocktest", NULL,
+				     i < NRWREADERS ? rwreaderthread :
+				     rwwriterthread, NULL, i);
+		if (result) {
+			panic("rwlocktest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NRWREADERS + NRWWRITERS; i++) {
+		P(donesem);
+	}
+
+	rwlock_destroy(testrwlock);
+	testrwlock = NULL;
+
+	kprintf("Most readers at once: %u\n", rwreaders_max);
+	kprintf("Rwlock test %s\n", rwfailed ? "FAILED" : "done");
+	return 0;
+}
+
+/*
+ * Semaphore destroy test: P and then sem_destroy, racing a V on
+ * another thread, over and over, as with cpu_startup_sem in
+ * thread.c. V must be done with the semaphore as soon as P can
+ * return, whether P had to wait for it or not; if it isn't, this
+ * ends up locking or waking on a freed (and likely reused)
+ * semaphore.
+ */
+#define NDESTROYLOOPS	500
+
+static
+void
+destroyvthread(void *semv, unsigned long junk)
+{
+	struct semaphore *sem = semv;
+
+	(void)junk;
+	V(sem);
+}
+
+int
+semdestroytest(int nargs, char **args)
+{
+	struct semaphore *sem;
+	volatile unsigned spin;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting semaphore destroy test...\n");
+	for (i=0; i<NDESTROYLOOPS; i++) {
+		sem = sem_create("destroysem", 0);
+		if (sem == NULL) {
+			panic("semdestroytest: sem_create failed\n");
+		}
+		result = thread_fork("semdestroytest", NULL,
+				     destroyvthread, sem, 0);
+		if (result) {
+			panic("semdestroytest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+		/* Vary who gets there first */
+		for (spin = 0; spin < (unsigned)(i % 8) * 100; spin++) {
+		}
+		P(sem);
+		sem_destroy(sem);
+	}
+	kprintf("Semaphore destroy test done.\n");
+	return 0;
+}
@@ -29,6 +29,7 @@
 
 #include <types.h>
 #include <lib.h>
+#include <cpu.h>
 #include <thread.h>
 #include <threadlist.h>
 #include <test.h>
@@ -309,6 +310,45 @@ threadlisttest_f(void)
 	KASSERT(tl.tl_count == 0);
 }
 
+/*
+ * Priority order: by level, then in the order added. The odd threads
+ * are at the lowest level, but one of them has been lent the highest.
+ */
+static
+void
+threadlisttest_g(void)
+{
+	static const unsigned order[NUMNAMES] = { 0, 2, 4, 5, 6, 1, 3 };
+	struct threadlist tl;
+	struct thread *t;
+	unsigned i;
+
+	threadlist_init(&tl);
+
+	for (i=0; i<NUMNAMES; i++) {
+		fakethreads[i]->t_prio = (i % 2) ? RUNQUEUE_LEVELS - 1 : 0;
+		fakethreads[i]->t_inherit = RUNQUEUE_LEVELS;
+	}
+	fakethreads[5]->t_inherit = 0;
+
+	for (i=0; i<NUMNAMES; i++) {
+		threadlist_addbylevel(&tl, fakethreads[i]);
+	}
+	KASSERT(tl.tl_count == NUMNAMES);
+
+	for (i=0; i<NUMNAMES; i++) {
+		t = threadlist_remhead(&tl);
+		KASSERT(t == fakethreads[order[i]]);
+	}
+	KASSERT(tl.tl_count == 0);
+
+	for (i=0; i<NUMNAMES; i++) {
+		fakethreads[i]->t_prio = 0;
+		fakethreads[i]->t_inherit = 0;
+	}
+	threadlist_cleanup(&tl);
+}
+
 ////////////////////////////////////////////////////////////
 // external interface
 
@@ -332,6 +372,7 @@ threadlisttest(int nargs, char **args)
 	threadlisttest_d();
 	threadlisttest_e();
 	threadlisttest_f();
+	threadlisttest_g();
 
 	for (i=0; i<NUMNAMES; i++) {
 		fakethread_destroy(fakethreads[i]);
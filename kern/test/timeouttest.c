@@ -0,0 +1,129 @@
+/*
+ * Timeout (timer wheel) test.
+ *
+ * Arms a batch of timeouts with delays on both sides of the level 0
+ * wheel size, cancels every other one straight away, and checks that
+ * exactly the others fire, in order of their delays. Then checks
+ * that wchan_sleep_timeout sleeps about as long as it was asked to.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <test.h>
+
+#define NTIMEOUTS	16
+
+/* Increasing, and crossing the 256-tick level 0 boundary */
+static const unsigned delays[NTIMEOUTS] = {
+	1, 2, 3, 5, 8, 13, 40, 100, 200, 255, 256, 257, 300, 511, 512, 700
+};
+
+static struct timeout timeouts[NTIMEOUTS];
+static volatile unsigned firedseq[NTIMEOUTS];
+static struct spinlock seq_lock = SPINLOCK_INITIALIZER;
+static unsigned nextseq;
+
+static
+void
+timeouttest_fire(void *arg)
+{
+	unsigned i = (unsigned)(uintptr_t)arg;
+
+	spinlock_acquire(&seq_lock);
+	firedseq[i] = ++nextseq;
+	spinlock_release(&seq_lock);
+}
+
+int
+timeouttest(int nargs, char **args)
+{
+	struct timespec before, after, diff;
+	struct wchan *wc;
+	struct spinlock lk;
+	unsigned i, last, ms;
+	bool ok = true;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting timeout test (about %u seconds)...\n",
+		delays[NTIMEOUTS - 1] / HZ + 2);
+
+	nextseq = 0;
+	for (i=0; i<NTIMEOUTS; i++) {
+		firedseq[i] = 0;
+		timeout_init(&timeouts[i], timeouttest_fire,
+			     (void *)(uintptr_t)i);
+	}
+	/* Arm in reverse, so the wheel can't just be a FIFO */
+	for (i=NTIMEOUTS; i-- > 0; ) {
+		timeout_arm(&timeouts[i], delays[i]);
+	}
+	for (i=1; i<NTIMEOUTS; i+=2) {
+		if (!timeout_cancel(&timeouts[i])) {
+			kprintf("timeout %u (%u ticks) fired before cancel\n",
+				i, delays[i]);
+			ok = false;
+		}
+	}
+
+	clocksleep_ticks(delays[NTIMEOUTS - 1] + 10);
+
+	last = 0;
+	for (i=0; i<NTIMEOUTS; i++) {
+		if (i % 2 == 1) {
+			if (firedseq[i] != 0) {
+				kprintf("cancelled timeout %u fired\n", i);
+				ok = false;
+			}
+			continue;
+		}
+		if (firedseq[i] == 0) {
+			kprintf("timeout %u (%u ticks) never fired\n",
+				i, delays[i]);
+			ok = false;
+		}
+		else if (firedseq[i] < last) {
+			kprintf("timeout %u (%u ticks) fired out of order\n",
+				i, delays[i]);
+			ok = false;
+		}
+		last = firedseq[i];
+	}
+	for (i=0; i<NTIMEOUTS; i++) {
+		/* These must all be idle again */
+		KASSERT(!timeout_cancel(&timeouts[i]));
+	}
+
+	/* Nobody wakes WC, so this must time out after 50 ticks */
+	wc = wchan_create("timeouttest");
+	if (wc == NULL) {
+		panic("timeouttest: wchan_create failed\n");
+	}
+	spinlock_init(&lk);
+	gettime(&before);
+	spinlock_acquire(&lk);
+	result = wchan_sleep_timeout(wc, &lk, 50);
+	spinlock_release(&lk);
+	gettime(&after);
+	timespec_sub(&after, &before, &diff);
+	ms = diff.tv_sec * 1000 + diff.tv_nsec / 1000000;
+	if (result != ETIMEDOUT) {
+		kprintf("wchan_sleep_timeout returned %d\n", result);
+		ok = false;
+	}
+	if (ms < 480 || ms > 600) {
+		kprintf("wchan_sleep_timeout(50) slept %u ms\n", ms);
+		ok = false;
+	}
+	spinlock_cleanup(&lk);
+	wchan_destroy(wc);
+
+	kprintf("Timeout test %s\n", ok ? "done" : "FAILED");
+	return 0;
+}
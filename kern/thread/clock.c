@@ -29,11 +29,16 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spl.h>
+#include <membar.h>
 #include <cpu.h>
 #include <wchan.h>
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <proc.h>
+#include <mainbus.h>
+#include <timepage.h>
 
 /*
  * Time handling.
@@ -51,13 +56,16 @@
  * the scheduler.
  */
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * Timed sleeps. Nothing ever wakes clocksleep_wchan except the
+ * timeouts in wchan_sleep_timeout, so each sleeper wakes once, when
+ * its own time is up. (This used to be a wchan everyone slept on
+ * that was woken once a second, so every sleeper woke every second
+ * to check whether it was done.)
  */
-static struct wchan *lbolt;
-static struct spinlock lbolt_lock;
+static struct wchan *clocksleep_wchan;
+static struct spinlock clocksleep_lock;
 
 /*
  * Setup.
@@ -65,29 +73,353 @@ static struct spinlock lbolt_lock;
 void
 hardclock_bootstrap(void)
 {
-	spinlock_init(&lbolt_lock);
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	spinlock_init(&clocksleep_lock);
+	clocksleep_wchan = wchan_create("clocksleep");
+	if (clocksleep_wchan == NULL) {
+		panic("Couldn't create clocksleep wchan\n");
 	}
 }
 
 /*
  * This is called once per second, on one processor, by the timer
- * code.
+ * code. Timed operations now use the timeouts below instead.
  */
 void
 timerclock(void)
 {
-	/* Just broadcast on lbolt */
-	spinlock_acquire(&lbolt_lock);
-	wchan_wakeall(lbolt, &lbolt_lock);
-	spinlock_release(&lbolt_lock);
 }
 
 /*
- * This is called HZ times a second (on each processor) by the timer
- * code.
+ * Timer wheel.
+ *
+ * There are three levels. Level 0 has one slot per tick for the next
+ * TW_L0SIZE ticks; each level above has TW_LNSIZE slots, each slot
+ * covering a whole turn of the level below. A timeout goes in the
+ * lowest level whose range covers it. Whenever a level wraps around,
+ * the next slot of the level above is emptied and its timeouts are
+ * put back in, which moves them down (the "cascade"). Timeouts
+ * further off than the top level can cover wait in its furthest slot
+ * and are re-filed when it cascades.
+ *
+ * tw_now counts ticks. It is advanced by the hardclock of cpu 0 only,
+ * so there is exactly one clock for timeouts however many cpus there
+ * are. Everything here is protected by tw_lock; timeout functions
+ * are called with it released.
+ */
+#define TW_L0BITS	8
+#define TW_LNBITS	6
+#define TW_L0SIZE	(1U << TW_L0BITS)
+#define TW_LNSIZE	(1U << TW_LNBITS)
+#define TW_LEVELS	3
+
+/* First tick of level LEV and beyond (level 0 starts at 0) */
+#define TW_LEVELSTART(lev)	(1U << (TW_L0BITS + ((lev)-1) * TW_LNBITS))
+/* Slot in level LEV >= 1 for tick T */
+#define TW_LNSLOT(lev, t) \
+	(((t) >> (TW_L0BITS + ((lev)-1) * TW_LNBITS)) & (TW_LNSIZE - 1))
+
+/* to_state values */
+#define TO_IDLE		0
+#define TO_PENDING	1
+#define TO_FIRING	2
+
+static struct spinlock tw_lock = SPINLOCK_INITIALIZER;
+static unsigned tw_now;
+static struct cpu *tw_idlecpu;		/* cpu 0, while its timer is off */
+static unsigned tw_idleuntil;		/* tick it will next look at */
+static struct timeout *tw_level0[TW_L0SIZE];
+static struct timeout *tw_levels[TW_LEVELS - 1][TW_LNSIZE];
+
+void
+timeout_init(struct timeout *to, void (*func)(void *), void *arg)
+{
+	to->to_next = NULL;
+	to->to_pprev = NULL;
+	to->to_expires = 0;
+	to->to_func = func;
+	to->to_arg = arg;
+	to->to_state = TO_IDLE;
+}
+
+/*
+ * Put TO in the right slot for its expiry time. Call with tw_lock.
+ */
+static
+void
+tw_insert(struct timeout *to)
+{
+	struct timeout **slot;
+	unsigned delta, t;
+	unsigned lev;
+
+	KASSERT(spinlock_do_i_hold(&tw_lock));
+
+	delta = to->to_expires - tw_now;
+	if ((int)delta <= 0) {
+		/* Due now; only while cascading, before the slot is run */
+		slot = &tw_level0[tw_now & (TW_L0SIZE - 1)];
+	}
+	else if (delta < TW_L0SIZE) {
+		slot = &tw_level0[to->to_expires & (TW_L0SIZE - 1)];
+	}
+	else {
+		t = to->to_expires;
+		for (lev = 1; lev < TW_LEVELS - 1; lev++) {
+			if (delta < TW_LEVELSTART(lev + 1)) {
+				break;
+			}
+		}
+		if (lev == TW_LEVELS - 1 && delta >= TW_LEVELSTART(TW_LEVELS)) {
+			/* Too far off; park in the furthest slot */
+			t = tw_now + TW_LEVELSTART(TW_LEVELS) - 1;
+		}
+		slot = &tw_levels[lev - 1][TW_LNSLOT(lev, t)];
+	}
+
+	to->to_next = *slot;
+	if (*slot != NULL) {
+		(*slot)->to_pprev = &to->to_next;
+	}
+	to->to_pprev = slot;
+	*slot = to;
+}
+
+static
+void
+tw_remove(struct timeout *to)
+{
+	KASSERT(spinlock_do_i_hold(&tw_lock));
+
+	*to->to_pprev = to->to_next;
+	if (to->to_next != NULL) {
+		to->to_next->to_pprev = to->to_pprev;
+	}
+	to->to_next = NULL;
+	to->to_pprev = NULL;
+}
+
+/*
+ * Empty a slot of level LEV and re-file its timeouts.
+ */
+static
+void
+tw_cascade(unsigned lev)
+{
+	struct timeout *to, *next;
+	struct timeout **slot;
+
+	slot = &tw_levels[lev - 1][TW_LNSLOT(lev, tw_now)];
+	to = *slot;
+	*slot = NULL;
+	while (to != NULL) {
+		next = to->to_next;
+		tw_insert(to);
+		to = next;
+	}
+}
+
+void
+timeout_arm(struct timeout *to, unsigned ticks)
+{
+	struct cpu *kick = NULL;
+
+	KASSERT(ticks > 0);
+
+	spinlock_acquire(&tw_lock);
+	KASSERT(to->to_state == TO_IDLE);
+	to->to_expires = tw_now + ticks;
+	to->to_state = TO_PENDING;
+	tw_insert(to);
+	if (tw_idlecpu != NULL && tw_idlecpu != curcpu->c_self &&
+	    (int)(to->to_expires - tw_idleuntil) < 0) {
+		/* Cpu 0 is idle and would sleep through this one */
+		kick = tw_idlecpu;
+		tw_idlecpu = NULL;
+	}
+	spinlock_release(&tw_lock);
+
+	if (kick != NULL) {
+		ipi_send(kick, IPI_UNIDLE);
+	}
+}
+
+bool
+timeout_cancel(struct timeout *to)
+{
+	bool stopped;
+
+	spinlock_acquire(&tw_lock);
+	stopped = (to->to_state == TO_PENDING);
+	if (stopped) {
+		tw_remove(to);
+		to->to_state = TO_IDLE;
+	}
+	spinlock_release(&tw_lock);
+
+	/* Firing on cpu 0 right now; it will finish without us */
+	while (to->to_state == TO_FIRING) {
+		/* spin */
+	}
+	return stopped;
+}
+
+unsigned
+clock_ticks(void)
+{
+	unsigned now;
+
+	spinlock_acquire(&tw_lock);
+	now = tw_now;
+	spinlock_release(&tw_lock);
+	return now;
+}
+
+/*
+ * Advance the wheel by one tick and run whatever is due.
+ */
+static
+void
+tw_tick(void)
+{
+	struct timeout *due, *to;
+	struct timeout **slot;
+	unsigned lev;
+
+	spinlock_acquire(&tw_lock);
+	tw_now++;
+
+	/* Cascade from the top down, so timeouts can fall several levels */
+	if ((tw_now & (TW_L0SIZE - 1)) == 0) {
+		for (lev = TW_LEVELS - 1; lev >= 1; lev--) {
+			if (lev == 1 ||
+			    (tw_now & (TW_LEVELSTART(lev) - 1)) == 0) {
+				tw_cascade(lev);
+			}
+		}
+	}
+
+	slot = &tw_level0[tw_now & (TW_L0SIZE - 1)];
+	due = *slot;
+	*slot = NULL;
+	for (to = due; to != NULL; to = to->to_next) {
+		KASSERT(to->to_state == TO_PENDING);
+		to->to_state = TO_FIRING;
+		to->to_pprev = NULL;
+	}
+	spinlock_release(&tw_lock);
+
+	while (due != NULL) {
+		to = due;
+		due = to->to_next;
+		to->to_next = NULL;
+		to->to_func(to->to_arg);
+
+		spinlock_acquire(&tw_lock);
+		to->to_state = TO_IDLE;
+		spinlock_release(&tw_lock);
+	}
+}
+
+/*
+ * Number of ticks, at most MAX, until the wheel next has something to
+ * do: a timeout in level 0 or a cascade. Call with tw_lock.
+ */
+static
+unsigned
+tw_nextdue(unsigned max)
+{
+	unsigned i, t;
+
+	KASSERT(spinlock_do_i_hold(&tw_lock));
+
+	for (i=1; i<max; i++) {
+		t = tw_now + i;
+		if ((t & (TW_L0SIZE - 1)) == 0 ||
+		    tw_level0[t & (TW_L0SIZE - 1)] != NULL) {
+			break;
+		}
+	}
+	return i;
+}
+
+/*
+ * Idle cpus don't need hardclocks; all they would do is count them.
+ * So before idling, a cpu turns off its periodic timer and asks for
+ * one interrupt when it next has something to do instead: after
+ * HARDCLOCK_IDLEMAX, to look for work to steal now and then, or for
+ * cpu 0 sooner if the timer wheel needs it. Whatever wakes it up, it
+ * then catches up on the hardclocks it missed all at once.
+ */
+#define HARDCLOCK_IDLEMAX	(HZ / 4)
+
+/*
+ * Account for NTICKS hardclocks that went by without hardclock()
+ * being called.
+ */
+void
+hardclock_catchup(unsigned nticks)
+{
+	unsigned i;
+
+	curcpu->c_hardclocks += nticks;
+	if (curcpu->c_isidle) {
+		curcpu->c_idleticks += nticks;
+		curcpu->c_skippedticks += nticks;
+	}
+	else {
+		curcpu->c_runticks += nticks;
+		curthread->t_stats.ss_runticks += nticks;
+	}
+	if (curcpu->c_number == 0) {
+		for (i=0; i<nticks; i++) {
+			tw_tick();
+		}
+	}
+	timepage_update();
+}
+
+/*
+ * Called by the idle loop, with interrupts off, just before and just
+ * after cpu_idle().
+ */
+void
+hardclock_idle(void)
+{
+	unsigned ticks;
+
+	KASSERT(curcpu->c_isidle);
+
+	if (curcpu->c_number == 0) {
+		spinlock_acquire(&tw_lock);
+		ticks = tw_nextdue(HARDCLOCK_IDLEMAX);
+		if (ticks > 1) {
+			tw_idlecpu = curcpu->c_self;
+			tw_idleuntil = tw_now + ticks;
+		}
+		spinlock_release(&tw_lock);
+	}
+	else {
+		ticks = HARDCLOCK_IDLEMAX;
+	}
+	if (ticks > 1) {
+		mainbus_timer_stop(ticks);
+	}
+}
+
+void
+hardclock_unidle(void)
+{
+	if (curcpu->c_number == 0) {
+		spinlock_acquire(&tw_lock);
+		tw_idlecpu = NULL;
+		spinlock_release(&tw_lock);
+	}
+	hardclock_catchup(mainbus_timer_restart());
+}
+
+/*
+ * This is called HZ times a second (on each processor, unless it's
+ * idle) by the timer code.
  */
 void
 hardclock(void)
@@ -97,13 +429,146 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
-		thread_consider_migration();
+	if (curcpu->c_number == 0) {
+		tw_tick();
+	}
+	timepage_update();
+#if OPT_SHELL
+	if (!curcpu->c_isidle) {
+		/* RLIMIT_CPU */
+		proc_cputick(curthread->t_proc);
 	}
+#endif
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	kprintf_tick();
+	thread_timeslice();
+}
+
+/*
+ * High-resolution monotonic clock.
+ *
+ * Nanoseconds are worked out from mainbus_cycles with a fixed-point
+ * multiplier, clock_mult, which clock_calibrate measures against the
+ * time-of-day clock rather than trusting the nominal cpu speed. Each
+ * cpu counts cycles from its own start, so each keeps its own base:
+ * the first time a cpu is asked, it reads the time-of-day clock and
+ * pairs it with its cycle count, and counts on from there.
+ */
+#define CLOCK_SHIFT	20
+
+static uint64_t clock_mult;		/* ns per cycle << CLOCK_SHIFT */
+static uint32_t clock_rate;		/* measured cycles per second */
+static struct timespec clock_epoch;	/* time of day at 0 */
+
+uint64_t
+clock_cycles_to_ns(uint64_t cycles)
+{
+	/* In two halves, so the product can't overflow */
+	return (((cycles >> 32) * clock_mult) << (32 - CLOCK_SHIFT)) +
+		(((cycles & 0xffffffff) * clock_mult) >> CLOCK_SHIFT);
+}
+
+uint64_t
+clock_cycles(void)
+{
+	return mainbus_cycles();
+}
+
+/*
+ * Set this cpu's base. Call with interrupts off.
+ */
+static
+void
+clock_sync(void)
+{
+	struct timespec now, since;
+
+	gettime(&now);
+	timespec_sub(&now, &clock_epoch, &since);
+	curcpu->c_clockbase_ns = (uint64_t)since.tv_sec * 1000000000 +
+		since.tv_nsec;
+	curcpu->c_clockbase_cyc = mainbus_cycles();
+	curcpu->c_clocksynced = true;
+}
+
+uint64_t
+clock_monotonic_ns(void)
+{
+	uint64_t ns;
+	int spl;
+
+	if (clock_mult == 0) {
+		return 0;
+	}
+	/* Stay on this cpu */
+	spl = splhigh();
+	if (!curcpu->c_clocksynced) {
+		clock_sync();
+	}
+	ns = curcpu->c_clockbase_ns +
+		clock_cycles_to_ns(mainbus_cycles() - curcpu->c_clockbase_cyc);
+	splx(spl);
+	return ns;
+}
+
+void
+clock_boottime(struct timespec *ret)
+{
+	*ret = clock_epoch;
+}
+
+void
+clock_calibrate(void)
+{
+	struct timespec start, now, since;
+	uint64_t c0, c1, ns;
+	int spl;
+
+	KASSERT(clock_mult == 0);
+
+	/* With interrupts off, so both readings are of this cpu */
+	spl = splhigh();
+	gettime(&start);
+	c0 = mainbus_cycles();
+	do {
+		gettime(&now);
+		timespec_sub(&now, &start, &since);
+	} while (since.tv_sec == 0 && since.tv_nsec < CLOCK_CALNS);
+	c1 = mainbus_cycles();
+	splx(spl);
+
+	ns = (uint64_t)since.tv_sec * 1000000000 + since.tv_nsec;
+	clock_rate = (c1 - c0) * 1000000000 / ns;
+	if (clock_rate < 1000000) {
+		/* Implausible; go by the book */
+		clock_rate = mainbus_cyclerate();
+	}
+	clock_epoch = start;
+	membar_store_store();
+	clock_mult = ((uint64_t)1000000000 << CLOCK_SHIFT) / clock_rate;
+
+	kprintf("clock: cycle counter runs at %u.%03u MHz (nominal %u)\n",
+		clock_rate / 1000000, clock_rate / 1000 % 1000,
+		mainbus_cyclerate() / 1000000);
+}
+
+/*
+ * Suspend execution for TICKS hardclocks.
+ */
+void
+clocksleep_ticks(unsigned ticks)
+{
+	if (ticks == 0) {
+		return;
+	}
+	spinlock_acquire(&clocksleep_lock);
+	while (wchan_sleep_timeout(clocksleep_wchan, &clocksleep_lock,
+				   ticks) == 0) {
+		/* Spurious; nobody should wake us. Go round again. */
+	}
+	spinlock_release(&clocksleep_lock);
 }
 
 /*
@@ -112,10 +577,7 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-	spinlock_acquire(&lbolt_lock);
-	while (num_secs > 0) {
-		wchan_sleep(lbolt, &lbolt_lock);
-		num_secs--;
+	if (num_secs > 0) {
+		clocksleep_ticks((unsigned)num_secs * HZ);
 	}
-	spinlock_release(&lbolt_lock);
 }
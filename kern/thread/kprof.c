@@ -0,0 +1,267 @@
+/*
+ * Sampling CPU profiler. See kprof.h.
+ *
+ * The rings are made for every cpu when sampling starts, so the
+ * interrupt handler never allocates; like systrace's, each has a
+ * spinlock so it can be drained from any cpu, but only its own cpu
+ * ever adds to it. When the profiler is off, the cost to each tick
+ * is one test of kprof_enabled.
+ *
+ * Printing drains the rings a few samples at a time into a table of
+ * distinct stacks, which is what keeps a long profile printable; any
+ * stacks past the table's size are lumped together as "other".
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <mips/specialreg.h>
+#include <mips/trapframe.h>
+#include <kprof.h>
+#include <platform/maxcpus.h>
+#include "opt-shell.h"
+
+#define KPROF_NRECS	1024	/* samples per cpu */
+#define KPROF_CHUNK	16	/* samples drained at a time */
+#define KPROF_NSTACKS	512	/* distinct stacks printed */
+#define KPROF_NAMELEN	16	/* thread name, with the NUL */
+
+struct kprof_rec {
+	uint32_t kr_pc;			/* interrupted pc */
+	uint32_t kr_ra;			/* its return address; 0 for user */
+	int32_t kr_pid;			/* current process, or 0 */
+	char kr_name[KPROF_NAMELEN];	/* current thread */
+};
+
+struct kprof_buf {
+	struct spinlock kb_lock;
+	unsigned kb_first;		/* oldest sample */
+	unsigned kb_count;		/* samples in the ring */
+	unsigned kb_lost;		/* dropped since started */
+	struct kprof_rec kb_recs[KPROF_NRECS];
+};
+
+struct kprof_stack {
+	struct kprof_rec ks_rec;
+	unsigned ks_count;
+};
+
+static struct kprof_buf *kprof_bufs[MAXCPUS];
+static volatile bool kprof_enabled;
+
+void
+kprof_sample(const struct trapframe *tf)
+{
+	struct kprof_buf *kb;
+	struct kprof_rec *kr;
+	const char *name;
+	unsigned i;
+
+	if (!kprof_enabled) {
+		return;
+	}
+	kb = kprof_bufs[curcpu->c_number];
+	if (kb == NULL) {
+		/* cpu came up after kprof_start */
+		return;
+	}
+
+	spinlock_acquire(&kb->kb_lock);
+	if (kb->kb_count == KPROF_NRECS) {
+		kb->kb_first = (kb->kb_first + 1) % KPROF_NRECS;
+		kb->kb_count--;
+		kb->kb_lost++;
+	}
+	kr = &kb->kb_recs[(kb->kb_first + kb->kb_count) % KPROF_NRECS];
+	kb->kb_count++;
+
+	kr->kr_pc = tf->tf_epc;
+	/* The user's ra means nothing against the kernel binary */
+	kr->kr_ra = (tf->tf_status & CST_KUp) ? 0 : tf->tf_ra;
+#if OPT_SHELL
+	kr->kr_pid = curproc != NULL ? curproc->p_pid : 0;
+#else
+	kr->kr_pid = 0;
+#endif
+	name = curthread->t_name != NULL ? curthread->t_name : "?";
+	for (i=0; i<KPROF_NAMELEN-1 && name[i] != 0; i++) {
+		kr->kr_name[i] = name[i];
+	}
+	kr->kr_name[i] = 0;
+	spinlock_release(&kb->kb_lock);
+}
+
+/*
+ * Make a ring for every cpu that doesn't have one, and empty them all.
+ */
+int
+kprof_start(void)
+{
+	struct kprof_buf *kb;
+	unsigned i, n;
+
+	kprof_enabled = false;
+
+	n = thread_numcpus();
+	for (i=0; i<n; i++) {
+		kb = kprof_bufs[i];
+		if (kb == NULL) {
+			kb = kmalloc(sizeof(*kb));
+			if (kb == NULL) {
+				return ENOMEM;
+			}
+			spinlock_init(&kb->kb_lock);
+		}
+		spinlock_acquire(&kb->kb_lock);
+		kb->kb_first = 0;
+		kb->kb_count = 0;
+		kb->kb_lost = 0;
+		spinlock_release(&kb->kb_lock);
+		kprof_bufs[i] = kb;
+	}
+
+	kprof_enabled = true;
+	return 0;
+}
+
+void
+kprof_stop(void)
+{
+	kprof_enabled = false;
+}
+
+/*
+ * Take up to MAX of the oldest samples out of the rings, into RECS.
+ * Returns how many there were.
+ */
+static
+unsigned
+kprof_drain(struct kprof_rec *recs, unsigned max)
+{
+	struct kprof_buf *kb;
+	unsigned c, n;
+
+	n = 0;
+	for (c=0; c<MAXCPUS && n < max; c++) {
+		kb = kprof_bufs[c];
+		if (kb == NULL) {
+			continue;
+		}
+		spinlock_acquire(&kb->kb_lock);
+		while (kb->kb_count > 0 && n < max) {
+			recs[n++] = kb->kb_recs[kb->kb_first];
+			kb->kb_first = (kb->kb_first + 1) % KPROF_NRECS;
+			kb->kb_count--;
+		}
+		spinlock_release(&kb->kb_lock);
+	}
+	return n;
+}
+
+static
+bool
+kprof_samestack(const struct kprof_rec *a, const struct kprof_rec *b)
+{
+	return a->kr_pc == b->kr_pc && a->kr_ra == b->kr_ra &&
+		a->kr_pid == b->kr_pid && !strcmp(a->kr_name, b->kr_name);
+}
+
+/*
+ * Find KR's stack in the table of NSTACKS, adding it if it isn't
+ * there and there's room. NULL if the table is full.
+ */
+static
+struct kprof_stack *
+kprof_findstack(struct kprof_stack *stacks, unsigned *nstacks,
+		const struct kprof_rec *kr)
+{
+	unsigned h, i, j;
+
+	h = (kr->kr_pc ^ (kr->kr_ra >> 2) ^ (unsigned)kr->kr_pid) >> 2;
+	for (i=0; i<KPROF_NSTACKS; i++) {
+		j = (h + i) % KPROF_NSTACKS;
+		if (stacks[j].ks_count == 0) {
+			if (*nstacks == KPROF_NSTACKS * 3 / 4) {
+				/* Keep the probes short */
+				return NULL;
+			}
+			stacks[j].ks_rec = *kr;
+			(*nstacks)++;
+			return &stacks[j];
+		}
+		if (kprof_samestack(&stacks[j].ks_rec, kr)) {
+			return &stacks[j];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Drain the samples to the console as folded stacks, for the kprof
+ * menu command.
+ */
+void
+kprof_print(void)
+{
+	struct kprof_rec recs[KPROF_CHUNK];
+	struct kprof_stack *stacks, *ks;
+	unsigned i, n, nstacks, total, other, lost;
+
+	stacks = kmalloc(KPROF_NSTACKS * sizeof(*stacks));
+	if (stacks == NULL) {
+		kprintf("kprof: Out of memory\n");
+		return;
+	}
+	for (i=0; i<KPROF_NSTACKS; i++) {
+		stacks[i].ks_count = 0;
+	}
+
+	lost = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		if (kprof_bufs[i] != NULL) {
+			lost += kprof_bufs[i]->kb_lost;
+		}
+	}
+
+	nstacks = total = other = 0;
+	while ((n = kprof_drain(recs, KPROF_CHUNK)) > 0) {
+		for (i=0; i<n; i++) {
+			ks = kprof_findstack(stacks, &nstacks, &recs[i]);
+			if (ks == NULL) {
+				other++;
+			}
+			else {
+				ks->ks_count++;
+			}
+			total++;
+		}
+	}
+
+	kprintf("# kprof is %s; %u samples, %u older ones dropped\n",
+		kprof_enabled ? "running" : "stopped", total, lost);
+	for (i=0; i<KPROF_NSTACKS; i++) {
+		ks = &stacks[i];
+		if (ks->ks_count == 0) {
+			continue;
+		}
+		if (ks->ks_rec.kr_ra == 0) {
+			kprintf("%d:%s;user;0x%x %u\n", ks->ks_rec.kr_pid,
+				ks->ks_rec.kr_name, ks->ks_rec.kr_pc,
+				ks->ks_count);
+		}
+		else {
+			kprintf("%d:%s;0x%x;0x%x %u\n", ks->ks_rec.kr_pid,
+				ks->ks_rec.kr_name, ks->ks_rec.kr_ra,
+				ks->ks_rec.kr_pc, ks->ks_count);
+		}
+	}
+	if (other > 0) {
+		kprintf("other %u\n", other);
+	}
+	kfree(stacks);
+}
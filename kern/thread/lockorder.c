@@ -0,0 +1,191 @@
+/*
+ * Lock order checking. See lockorder.h.
+ *
+ * Classes are found by hashing the name into a fixed table, once per
+ * lock at creation. Bits in lockorder_after are only ever set, and
+ * only under lockorder_lock; they are read without it, since seeing
+ * a bit clear that was just set only means a trip through the slow
+ * path, which looks again.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <lockorder.h>
+
+#define LOCKORDER_NCLASSES	128	/* power of 2 */
+#define LOCKORDER_NAMELEN	24
+#define LOCKORDER_NOCLASS	LOCKORDER_NCLASSES
+
+static struct spinlock lockorder_lock = SPINLOCK_INITIALIZER;
+static char lockorder_names[LOCKORDER_NCLASSES][LOCKORDER_NAMELEN];
+
+/* Bit B of lockorder_after[A]: B has been taken while holding A */
+static volatile uint32_t
+	lockorder_after[LOCKORDER_NCLASSES][LOCKORDER_NCLASSES / 32];
+
+/* For lockorder_search; protected by lockorder_lock */
+static unsigned lockorder_parent[LOCKORDER_NCLASSES];
+static unsigned lockorder_stack[LOCKORDER_NCLASSES];
+
+unsigned
+lockorder_class(const char *name)
+{
+	char key[LOCKORDER_NAMELEN];
+	unsigned hash, i, slot;
+	size_t len;
+
+	len = strlen(name);
+	if (len == 0) {
+		return LOCKORDER_NOCLASS;
+	}
+	if (len >= LOCKORDER_NAMELEN) {
+		len = LOCKORDER_NAMELEN - 1;
+	}
+	memcpy(key, name, len);
+	key[len] = 0;
+
+	hash = 5381;
+	for (i=0; i<len; i++) {
+		hash = hash * 33 + (unsigned char)key[i];
+	}
+
+	spinlock_acquire(&lockorder_lock);
+	for (i=0; i<LOCKORDER_NCLASSES; i++) {
+		slot = (hash + i) & (LOCKORDER_NCLASSES - 1);
+		if (lockorder_names[slot][0] == 0) {
+			strcpy(lockorder_names[slot], key);
+			break;
+		}
+		if (!strcmp(lockorder_names[slot], key)) {
+			break;
+		}
+	}
+	spinlock_release(&lockorder_lock);
+
+	/* With the table full, the lock just isn't checked */
+	return i < LOCKORDER_NCLASSES ? slot : LOCKORDER_NOCLASS;
+}
+
+static
+bool
+lockorder_edge(unsigned a, unsigned b)
+{
+	return (lockorder_after[a][b / 32] & (1U << (b % 32))) != 0;
+}
+
+/*
+ * Depth-first search for a path from FROM to TO. On success,
+ * lockorder_parent leads back from TO to FROM.
+ */
+static
+bool
+lockorder_search(unsigned from, unsigned to)
+{
+	uint32_t seen[LOCKORDER_NCLASSES / 32];
+	unsigned sp, cur, next;
+
+	KASSERT(spinlock_do_i_hold(&lockorder_lock));
+
+	bzero(seen, sizeof(seen));
+	seen[from / 32] |= 1U << (from % 32);
+	sp = 0;
+	lockorder_stack[sp++] = from;
+	while (sp > 0) {
+		cur = lockorder_stack[--sp];
+		for (next = 0; next < LOCKORDER_NCLASSES; next++) {
+			if (!lockorder_edge(cur, next) ||
+			    (seen[next / 32] & (1U << (next % 32)))) {
+				continue;
+			}
+			seen[next / 32] |= 1U << (next % 32);
+			lockorder_parent[next] = cur;
+			if (next == to) {
+				return true;
+			}
+			KASSERT(sp < LOCKORDER_NCLASSES);
+			lockorder_stack[sp++] = next;
+		}
+	}
+	return false;
+}
+
+/*
+ * First time B has been taken holding A: check there's no path back
+ * from B to A, and record the edge.
+ */
+static
+void
+lockorder_learn(unsigned a, unsigned b)
+{
+	unsigned cur;
+
+	spinlock_acquire(&lockorder_lock);
+	if (lockorder_edge(a, b)) {
+		/* Someone else got here first */
+		spinlock_release(&lockorder_lock);
+		return;
+	}
+	if (!lockorder_search(b, a)) {
+		lockorder_after[a][b / 32] |= 1U << (b % 32);
+		spinlock_release(&lockorder_lock);
+		return;
+	}
+
+	/* As in hangman: print at splhigh without our spinlock */
+	splhigh();
+	spinlock_release(&lockorder_lock);
+
+	kprintf("lockorder: %s taking %s while holding %s, but before:\n",
+		curthread->t_name, lockorder_names[b], lockorder_names[a]);
+	for (cur = a; cur != b; cur = lockorder_parent[cur]) {
+		kprintf("   %s was taken holding %s\n", lockorder_names[cur],
+			lockorder_names[lockorder_parent[cur]]);
+	}
+	panic("Lock order reversal.\n");
+}
+
+void
+lockorder_acquire(const struct lock *lock)
+{
+	struct lockorder_held *h = &curthread->t_lockorder;
+	unsigned top;
+
+	if (h->lh_num > 0 && lock->lk_class != LOCKORDER_NOCLASS) {
+		top = h->lh_locks[h->lh_num - 1]->lk_class;
+		if (top != LOCKORDER_NOCLASS && top != lock->lk_class &&
+		    !lockorder_edge(top, lock->lk_class)) {
+			lockorder_learn(top, lock->lk_class);
+		}
+	}
+
+	if (h->lh_num < LOCKORDER_DEPTH) {
+		h->lh_locks[h->lh_num++] = lock;
+	}
+	else {
+		h->lh_untracked++;
+	}
+}
+
+void
+lockorder_release(const struct lock *lock)
+{
+	struct lockorder_held *h = &curthread->t_lockorder;
+	unsigned i;
+
+	/* Usually the last one taken */
+	for (i = h->lh_num; i-- > 0; ) {
+		if (h->lh_locks[i] == lock) {
+			h->lh_num--;
+			for (; i < h->lh_num; i++) {
+				h->lh_locks[i] = h->lh_locks[i + 1];
+			}
+			return;
+		}
+	}
+	KASSERT(h->lh_untracked > 0);
+	h->lh_untracked--;
+}
@@ -0,0 +1,150 @@
+/*
+ * parallel_for. See parallel.h.
+ *
+ * A job lives on the caller's stack. Chunks are handed out by an
+ * atomic add on the job's next index, so the caller and its helpers
+ * only meet when a helper finishes. Helpers are work on a queue of
+ * their own, one per other cpu, and that queue's workers run nothing
+ * else, so a helper never waits behind unrelated work.
+ *
+ * When the chunks run out the caller cancels the helpers that haven't
+ * started (their cpus were busy) and waits for the rest to finish
+ * the chunks they took. A helper that is itself waiting in a nested
+ * parallel_for never waits for a helper that hasn't started, so
+ * nesting can't deadlock; a helper queued behind it is cancelled.
+ *
+ * One spinlock and wait channel serve every job; they are only taken
+ * when a helper finishes and when the caller waits.
+ */
+#include <types.h>
+#include <lib.h>
+#include <atomic.h>
+#include <cpu.h>
+#include <current.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <workqueue.h>
+#include <parallel.h>
+
+struct pjob {
+	void (*pj_func)(void *arg, unsigned start, unsigned end);
+	void *pj_arg;
+	unsigned pj_n;
+	unsigned pj_chunk;
+	volatile unsigned pj_next;	/* start of the next chunk */
+	unsigned pj_finished;		/* helpers finished */
+	struct work pj_helpers[PARALLEL_MAXHELPERS];
+};
+
+static struct workqueue *parallel_wq;
+static struct spinlock parallel_lock = SPINLOCK_INITIALIZER;
+static struct wchan *parallel_wchan;
+
+/*
+ * Do chunks of PJ until there are none left.
+ */
+static
+void
+parallel_run(struct pjob *pj)
+{
+	unsigned start, end;
+
+	while (1) {
+		start = atomic_fetchadd(&pj->pj_next, pj->pj_chunk);
+		if (start >= pj->pj_n) {
+			break;
+		}
+		end = start + pj->pj_chunk;
+		if (end > pj->pj_n || end < start) {
+			end = pj->pj_n;
+		}
+		pj->pj_func(pj->pj_arg, start, end);
+	}
+}
+
+static
+void
+parallel_helper(void *arg)
+{
+	struct pjob *pj = arg;
+
+	parallel_run(pj);
+
+	spinlock_acquire(&parallel_lock);
+	pj->pj_finished++;
+	wchan_wakeall(parallel_wchan, &parallel_lock);
+	spinlock_release(&parallel_lock);
+}
+
+void
+parallel_for(unsigned n, unsigned chunk,
+	     void (*func)(void *arg, unsigned start, unsigned end),
+	     void *arg)
+{
+	struct pjob pj;
+	unsigned nchunks, nhelpers, ncpus, me, cpu, i, started;
+
+	KASSERT(chunk > 0);
+	if (n == 0) {
+		return;
+	}
+	nchunks = DIVROUNDUP(n, chunk);
+	ncpus = thread_numcpus();
+	if (nchunks == 1 || ncpus == 1 || parallel_wq == NULL ||
+	    curthread->t_in_interrupt || curcpu->c_spinlocks > 0) {
+		func(arg, 0, n);
+		return;
+	}
+
+	pj.pj_func = func;
+	pj.pj_arg = arg;
+	pj.pj_n = n;
+	pj.pj_chunk = chunk;
+	pj.pj_next = 0;
+	pj.pj_finished = 0;
+
+	nhelpers = nchunks - 1;
+	if (nhelpers > ncpus - 1) {
+		nhelpers = ncpus - 1;
+	}
+	if (nhelpers > PARALLEL_MAXHELPERS) {
+		nhelpers = PARALLEL_MAXHELPERS;
+	}
+	/* The other cpus, starting after this one */
+	me = curcpu->c_number;
+	for (i=0; i<nhelpers; i++) {
+		cpu = (me + 1 + i) % ncpus;
+		work_init(&pj.pj_helpers[i], parallel_helper, &pj);
+		workqueue_queueon(parallel_wq, &pj.pj_helpers[i], cpu);
+	}
+
+	parallel_run(&pj);
+
+	started = 0;
+	for (i=0; i<nhelpers; i++) {
+		if (!workqueue_cancel(parallel_wq, &pj.pj_helpers[i])) {
+			started++;
+		}
+	}
+	spinlock_acquire(&parallel_lock);
+	while (pj.pj_finished < started) {
+		wchan_sleep(parallel_wchan, &parallel_lock);
+	}
+	spinlock_release(&parallel_lock);
+}
+
+void
+parallel_bootstrap(void)
+{
+	parallel_wchan = wchan_create("parallel");
+	if (parallel_wchan == NULL) {
+		panic("parallel_bootstrap: Out of memory\n");
+	}
+	if (thread_numcpus() > 1) {
+		parallel_wq = workqueue_create("parallel");
+		if (parallel_wq == NULL) {
+			panic("parallel_bootstrap: Out of memory\n");
+		}
+	}
+}
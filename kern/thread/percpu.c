@@ -0,0 +1,86 @@
+/*
+ * Per-cpu event counters. See percpu.h.
+ *
+ * The counters are 64 bits wide, so on a 32-bit machine another cpu
+ * can catch one halfway through being updated; readers read each
+ * copy until they get the same value twice.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <percpu.h>
+
+static const char *const percpu_names[PCPU_NCOUNTERS] = {
+	[PCPU_SYSCALLS] = "syscalls",
+	[PCPU_FAULTS] = "faults",
+	[PCPU_SWITCHES] = "switches",
+	[PCPU_INTERRUPTS] = "interrupts",
+	[PCPU_BLKREQS] = "blkreqs",
+	[PCPU_BLKSECTS] = "blksects",
+	[PCPU_VMTLBMISS] = "vm_tlbmisses",
+	[PCPU_VMREADONLY] = "vm_rofaults",
+	[PCPU_VMZEROFILL] = "vm_zerofills",
+	[PCPU_VMFILE] = "vm_filefaults",
+	[PCPU_VMCOW] = "vm_cowcopies",
+	[PCPU_VMPAGEIN] = "vm_pageins",
+	[PCPU_VMPAGEOUT] = "vm_pageouts",
+	[PCPU_VMEVICT] = "vm_evictions",
+};
+
+void
+percpu_add(enum percpu_counter which, uint64_t n)
+{
+	int spl;
+
+	KASSERT(which < PCPU_NCOUNTERS);
+
+	/* Stay on this cpu, and keep interrupt handlers out */
+	spl = splhigh();
+	curcpu->c_counters[which] += n;
+	splx(spl);
+}
+
+void
+percpu_inc(enum percpu_counter which)
+{
+	percpu_add(which, 1);
+}
+
+uint64_t
+percpu_readcpu(struct cpu *c, enum percpu_counter which)
+{
+	uint64_t a, b;
+
+	KASSERT(which < PCPU_NCOUNTERS);
+
+	b = c->c_counters[which];
+	do {
+		a = b;
+		b = c->c_counters[which];
+	} while (a != b);
+	return a;
+}
+
+uint64_t
+percpu_read(enum percpu_counter which)
+{
+	unsigned i, n;
+	uint64_t total;
+
+	total = 0;
+	n = thread_numcpus();
+	for (i=0; i<n; i++) {
+		total += percpu_readcpu(thread_getcpu(i), which);
+	}
+	return total;
+}
+
+const char *
+percpu_name(enum percpu_counter which)
+{
+	KASSERT(which < PCPU_NCOUNTERS);
+	return percpu_names[which];
+}
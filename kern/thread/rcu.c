@@ -0,0 +1,150 @@
+/*
+ * Read-copy-update. See rcu.h.
+ *
+ * Each cpu counts its quiescent states in c_rcu_qs, bumped on every
+ * entry to thread_switch; thread_switch asserts the outgoing thread
+ * isn't in a read section, and thread_timeslice won't preempt one
+ * that is. A grace period is over once every other cpu's count has
+ * moved on from a snapshot, or the cpu has been seen idle.
+ *
+ * call_rcu requests go on a pending list; one work item on a queue
+ * of our own takes the whole list, waits out one grace period for
+ * all of it, and runs the callbacks. (Not sysworkq: waiting for the
+ * grace period sleeps.)
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <thread.h>
+#include <workqueue.h>
+#include <rcu.h>
+#include <platform/maxcpus.h>
+
+static struct spinlock rcu_lock = SPINLOCK_INITIALIZER;
+static struct rcu_head *rcu_pending;
+static struct workqueue *rcu_wq;
+static struct work rcu_work;
+
+void
+rcu_read_lock(void)
+{
+	curthread->t_rcu_nesting++;
+	/* Keep the compiler from hoisting reads above this */
+	membar_load_load();
+}
+
+void
+rcu_read_unlock(void)
+{
+	KASSERT(curthread->t_rcu_nesting > 0);
+	membar_load_load();
+	curthread->t_rcu_nesting--;
+	/* The hardclock may have put off a switch until now */
+	if (curthread->t_rcu_nesting == 0 && curcpu->c_preempt) {
+		thread_preemptpoint();
+	}
+}
+
+bool
+rcu_read_held(void)
+{
+	return curthread->t_rcu_nesting > 0;
+}
+
+void
+synchronize_rcu(void)
+{
+	unsigned snap[MAXCPUS];
+	bool done[MAXCPUS];
+	unsigned i, n, left;
+	struct cpu *c;
+
+	KASSERT(curthread->t_rcu_nesting == 0);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	n = thread_numcpus();
+	KASSERT(n <= MAXCPUS);
+	for (i=0; i<n; i++) {
+		snap[i] = thread_getcpu(i)->c_rcu_qs;
+		done[i] = false;
+	}
+	membar_load_load();
+
+	while (1) {
+		left = 0;
+		for (i=0; i<n; i++) {
+			if (done[i]) {
+				continue;
+			}
+			c = thread_getcpu(i);
+			if (c == curcpu->c_self || c->c_isidle ||
+			    c->c_rcu_qs != snap[i]) {
+				done[i] = true;
+				continue;
+			}
+			left++;
+		}
+		if (left == 0) {
+			break;
+		}
+		/* Give the others a tick to get round to a switch */
+		clocksleep_ticks(1);
+	}
+	membar_any_any();
+}
+
+/*
+ * Work function: run everything pending after a grace period.
+ */
+static
+void
+rcu_run(void *junk)
+{
+	struct rcu_head *list, *rh;
+
+	(void)junk;
+
+	spinlock_acquire(&rcu_lock);
+	list = rcu_pending;
+	rcu_pending = NULL;
+	spinlock_release(&rcu_lock);
+
+	if (list == NULL) {
+		return;
+	}
+	synchronize_rcu();
+
+	while (list != NULL) {
+		rh = list;
+		list = rh->rh_next;
+		rh->rh_func(rh->rh_arg);
+	}
+}
+
+void
+call_rcu(struct rcu_head *head, void (*func)(void *), void *arg)
+{
+	KASSERT(rcu_wq != NULL);
+
+	head->rh_func = func;
+	head->rh_arg = arg;
+	spinlock_acquire(&rcu_lock);
+	head->rh_next = rcu_pending;
+	rcu_pending = head;
+	spinlock_release(&rcu_lock);
+
+	workqueue_queue(rcu_wq, &rcu_work);
+}
+
+void
+rcu_bootstrap(void)
+{
+	work_init(&rcu_work, rcu_run, NULL);
+	rcu_wq = workqueue_create("rcu");
+	if (rcu_wq == NULL) {
+		panic("rcu_bootstrap: Out of memory\n");
+	}
+}
@@ -30,6 +30,7 @@
 /* Make sure to build out-of-line versions of inline functions */
 #define SPINLOCK_INLINE   /* empty */
 #define MEMBAR_INLINE     /* empty */
+#define ATOMIC_INLINE     /* empty */
 
 #include <types.h>
 #include <lib.h>
@@ -37,6 +38,7 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <membar.h>
+#include <atomic.h>
 #include <current.h>	/* for curcpu */
 
 /*
@@ -50,8 +52,12 @@
 void
 spinlock_init(struct spinlock *splk)
 {
-	spinlock_data_set(&splk->splk_lock, 0);
+	spinlock_data_set(&splk->splk_next, 0);
+	spinlock_data_set(&splk->splk_serving, 0);
 	splk->splk_holder = NULL;
+#if OPT_SPINLOCKPROF
+	splk->splk_acquiredat = 0;
+#endif
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
 }
 
@@ -62,20 +68,25 @@ void
 spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
-	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	KASSERT(spinlock_data_get(&splk->splk_next) ==
+		spinlock_data_get(&splk->splk_serving));
 }
 
 /*
  * Get the lock.
  *
  * First disable interrupts (otherwise, if we get a timer interrupt we
- * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * might come back to this lock and deadlock), then take a ticket and
+ * wait for our turn.
  */
 void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket;
+#if OPT_SPINLOCKPROF
+	unsigned spins = 0;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -93,29 +104,34 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
-	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
-		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
-			continue;
-		}
-		break;
+	/*
+	 * Only the holder writes splk_serving, so waiting is just
+	 * reading it; no atomic operation until the next acquire.
+	 */
+	ticket = spinlock_data_fetchinc(&splk->splk_next);
+	while (spinlock_data_get(&splk->splk_serving) != ticket) {
+#if OPT_SPINLOCKPROF
+		spins++;
+#endif
 	}
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
 
+#if OPT_SPINLOCKPROF
+	if (mycpu != NULL) {
+		mycpu->c_splk_acquires++;
+		if (spins > 0) {
+			mycpu->c_splk_contended++;
+			mycpu->c_splk_spins += spins;
+			if (spins > mycpu->c_splk_maxspins) {
+				mycpu->c_splk_maxspins = spins;
+			}
+		}
+		splk->splk_acquiredat = cpu_getcycles();
+	}
+#endif
+
 	if (CURCPU_EXISTS()) {
 		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
 	}
@@ -127,17 +143,30 @@ spinlock_acquire(struct spinlock *splk)
 void
 spinlock_release(struct spinlock *splk)
 {
+#if OPT_SPINLOCKPROF
+	uint32_t held;
+#endif
+
 	/* this must work before curcpu initialization */
 	if (CURCPU_EXISTS()) {
 		KASSERT(splk->splk_holder == curcpu->c_self);
 		KASSERT(curcpu->c_spinlocks > 0);
 		curcpu->c_spinlocks--;
 		HANGMAN_RELEASE(&curcpu->c_hangman, &splk->splk_hangman);
+#if OPT_SPINLOCKPROF
+		held = cpu_getcycles() - splk->splk_acquiredat;
+		if (held > curcpu->c_splk_maxhold) {
+			curcpu->c_splk_maxhold = held;
+			curcpu->c_splk_maxholder = splk;
+		}
+#endif
 	}
 
 	splk->splk_holder = NULL;
 	membar_any_store();
-	spinlock_data_set(&splk->splk_lock, 0);
+	/* We're the only writer, so a plain increment is safe */
+	spinlock_data_set(&splk->splk_serving,
+			  spinlock_data_get(&splk->splk_serving) + 1);
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -154,3 +183,15 @@ spinlock_do_i_hold(struct spinlock *splk)
 	/* Assume we can read splk_holder atomically enough for this to work */
 	return (splk->splk_holder == curcpu->c_self);
 }
+
+/*
+ * Check if anyone holds the lock or has a ticket for it. The last
+ * thing spinlock_release writes is splk_serving, so once it has
+ * caught up with splk_next, whoever had the lock is done with it.
+ */
+bool
+spinlock_in_use(struct spinlock *splk)
+{
+	return spinlock_data_get(&splk->splk_next) !=
+		spinlock_data_get(&splk->splk_serving);
+}
@@ -120,6 +120,10 @@ spllower(int oldspl, int newspl)
 	cur->t_iplhigh_count--;
 	if (cur->t_iplhigh_count == 0) {
 		cpu_irqon();
+		/* Interrupts are back on: a preemption point */
+		if (curcpu->c_preempt) {
+			thread_preemptpoint();
+		}
 	}
 }
 
@@ -35,9 +35,12 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <membar.h>
+#include <atomic.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <clock.h>
 #include <synch.h>
 
 ////////////////////////////////////////////////////////////
@@ -69,6 +72,7 @@ sem_create(const char *name, unsigned initial_count)
 
 	spinlock_init(&sem->sem_lock);
         sem->sem_count = initial_count;
+	sem->sem_waiters = 0;
 
         return sem;
 }
@@ -85,6 +89,48 @@ sem_destroy(struct semaphore *sem)
         kfree(sem);
 }
 
+/*
+ * Semaphores keep the count in sem_count, changed with atomic
+ * operations, and take sem_lock only when that isn't enough:
+ *
+ *  - V adds to a nonzero count with one atomic op. Nobody sleeps
+ *    while the count is nonzero without a wakeup already on its way
+ *    (see below), so there's no one to wake.
+ *  - V on a zero count takes sem_lock, then adds to the count and
+ *    wakes a waiter if sem_waiters says there are any.
+ *  - P takes from a nonzero count with one atomic op; otherwise it
+ *    takes sem_lock, counts itself in sem_waiters, and sleeps until
+ *    it gets one. Leaving, it passes the wakeup on if there's count
+ *    left and others waiting, since a V that found a nonzero count
+ *    didn't wake anyone.
+ *
+ * Once its count is visible, a V mustn't touch the semaphore again
+ * unless something stops a P from taking that count and destroying
+ * the semaphore, as in "P(sem); sem_destroy(sem);". A lock-free V
+ * only writes the count. A V with sem_lock still holds it when its
+ * count becomes visible, so a lock-free P that finds sem_lock in use
+ * after taking from the count waits for it to be released before
+ * returning.
+ */
+
+/*
+ * Take one from the count if it isn't 0.
+ */
+static
+bool
+sem_trydown(struct semaphore *sem)
+{
+	unsigned count;
+
+	while ((count = sem->sem_count) > 0) {
+		if (atomic_cas(&sem->sem_count, count, count - 1) == count) {
+			membar_store_any();
+			return true;
+		}
+	}
+	return false;
+}
+
 void
 P(struct semaphore *sem)
 {
@@ -98,9 +144,25 @@ P(struct semaphore *sem)
          */
         KASSERT(curthread->t_in_interrupt == false);
 
-	/* Use the semaphore spinlock to protect the wchan as well. */
+	if (sem_trydown(sem)) {
+		/* The count may be from a V still holding sem_lock */
+		membar_any_any();
+		if (spinlock_in_use(&sem->sem_lock)) {
+			spinlock_acquire(&sem->sem_lock);
+			spinlock_release(&sem->sem_lock);
+		}
+		return;
+	}
+
+	/*
+	 * Use the semaphore spinlock to protect the wchan as well. A V
+	 * that finds the count zero takes it too, so the count can't
+	 * go from zero to nonzero while we hold it without a V seeing
+	 * us in sem_waiters.
+	 */
 	spinlock_acquire(&sem->sem_lock);
-        while (sem->sem_count == 0) {
+	sem->sem_waiters++;
+        while (!sem_trydown(sem)) {
 		/*
 		 *
 		 * Note that we don't maintain strict FIFO ordering of
@@ -115,22 +177,34 @@ P(struct semaphore *sem)
 		 */
 		wchan_sleep(sem->sem_wchan, &sem->sem_lock);
         }
-        KASSERT(sem->sem_count > 0);
-        sem->sem_count--;
+	sem->sem_waiters--;
+	if (sem->sem_waiters > 0 && sem->sem_count > 0) {
+		wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
+	}
 	spinlock_release(&sem->sem_lock);
 }
 
 void
 V(struct semaphore *sem)
 {
-        KASSERT(sem != NULL);
+	unsigned count, old;
 
-	spinlock_acquire(&sem->sem_lock);
+        KASSERT(sem != NULL);
 
-        sem->sem_count++;
-        KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
+	membar_any_store();
+	while ((count = sem->sem_count) > 0) {
+		KASSERT(count + 1 > 0);
+		if (atomic_cas(&sem->sem_count, count, count + 1) == count) {
+			return;
+		}
+	}
 
+	spinlock_acquire(&sem->sem_lock);
+	old = atomic_fetchadd(&sem->sem_count, 1);
+        KASSERT(old + 1 > 0);
+	if (sem->sem_waiters > 0) {
+		wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
+	}
 	spinlock_release(&sem->sem_lock);
 }
 
@@ -138,6 +212,296 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+#if OPT_SHELL
+/*
+ * A contended lock_acquire spins for up to this many reads of
+ * the lock word as long as the owner is running (which means on another
+ * cpu); failing that, or once the owner stops running, it sleeps.
+ */
+#define LOCK_SPIN_MAX	1000
+
+/*
+ * The lock word; see struct lock. Threads are word aligned, so the
+ * low bit of the owner pointer is free for LK_WAITERS.
+ */
+#define LK_WAITERS	1U
+#define LK_OWNER(w)	((struct thread *)(uintptr_t)((w) & ~LK_WAITERS))
+#define LK_ME		((unsigned)(uintptr_t)curthread)
+
+/*
+ * Priority inheritance.
+ *
+ * A thread about to sleep on a lock lends the owner its run queue
+ * level if that's higher than the owner's (thread_inherit), and if
+ * the owner is asleep on a lock in turn, that lock's owner too, and
+ * so on, LOCK_PI_DEPTH deep at most. lk_donated marks a lock whose
+ * owner was lent a level through it; when the owner lets go of the
+ * last such lock it holds, it drops back to its own level. So one
+ * holding two contended locks keeps the higher level it was lent
+ * until it has let go of both. Sleepers are kept in priority order
+ * (wchan_setordered), so a release wakes the most important waiter.
+ *
+ * All of this is under lock_pilock, taken after lk_lock and before
+ * any runqueue lock. Levels are only lent through locks with
+ * LK_WAITERS set, whose owners can only let go by the slow path in
+ * lock_release, which holds lock_pilock while changing the word; so
+ * an owner found here really does hold the lock until we're done.
+ *
+ * Locks built on a semaphore (USE_SEMAPHORE_FOR_LOCK) don't do this.
+ */
+#define LOCK_PI_DEPTH	8
+
+#if OPT_SHELL && !USE_SEMAPHORE_FOR_LOCK
+static struct spinlock lock_pilock = SPINLOCK_INITIALIZER;
+#endif
+
+/*
+ * Contention statistics, one entry per lock name. Entries are never
+ * freed and their names never change, so they can be read without
+ * lockstat_lock once ls_name is set. The counters are updated under
+ * the lk_lock of whichever lock is involved, so when several locks
+ * share a name they may undercount slightly.
+ *
+ * With lockprof, CVs get entries too, kept apart from the locks'
+ * by ls_cv and updated under their cv_lock. For a CV, ls_acquires
+ * counts cv_wait calls and the wait times are the time asleep. Times
+ * are in nanoseconds, from clock_monotonic_ns.
+ */
+#if OPT_LOCKPROF
+#define LOCKSTAT_MAX		128
+#else
+#define LOCKSTAT_MAX		64
+#endif
+#define LOCKSTAT_NAMELEN	24
+
+struct lockstat {
+	char ls_name[LOCKSTAT_NAMELEN];
+	bool ls_cv;			/* a CV, not a lock */
+	unsigned ls_acquires;		/* all acquisitions */
+	unsigned ls_contended;		/* lock was held on arrival */
+	unsigned ls_spinwins;		/* got it by spinning, no sleep */
+	unsigned ls_sleeps;		/* wchan_sleep calls */
+#if OPT_LOCKPROF
+	uint64_t ls_waitns;		/* total contended wait */
+	uint32_t ls_maxwaitns;		/* longest wait */
+	uint32_t ls_maxholdns;		/* longest hold */
+#endif
+};
+
+static struct lockstat lockstats[LOCKSTAT_MAX + 1];	/* last: overflow */
+static unsigned lockstat_count;
+static struct spinlock lockstat_lock = SPINLOCK_INITIALIZER;
+
+#if OPT_LOCKPROF
+/*
+ * Current time in nanoseconds, or 0 before the clock is calibrated.
+ */
+static
+uint64_t
+lockprof_now(void)
+{
+	return clock_monotonic_ns();
+}
+
+/*
+ * Nanoseconds since START. A thread that waited or held a lock may
+ * finish on another cpu, whose clock can be slightly behind; call
+ * that no time rather than wrapping.
+ */
+static
+uint64_t
+lockprof_since(uint64_t start)
+{
+	uint64_t now;
+
+	now = lockprof_now();
+	return now > start ? now - start : 0;
+}
+
+/*
+ * Add a wait that began at START (0 if unknown) to LS.
+ */
+static
+void
+lockprof_waited(struct lockstat *ls, uint64_t start)
+{
+	uint64_t ns;
+
+	if (start == 0) {
+		return;
+	}
+	ns = lockprof_since(start);
+	ls->ls_waitns += ns;
+	if (ns > ls->ls_maxwaitns) {
+		ls->ls_maxwaitns = ns > 0xffffffff ? 0xffffffff : ns;
+	}
+}
+#endif
+
+/*
+ * Find or make the statistics entry for NAME; a CV's if ISCV.
+ */
+static
+struct lockstat *
+lockstat_get(const char *name, bool iscv)
+{
+	struct lockstat *ls;
+	char key[LOCKSTAT_NAMELEN];
+	size_t len;
+	unsigned i;
+
+	len = strlen(name);
+	if (len >= LOCKSTAT_NAMELEN) {
+		len = LOCKSTAT_NAMELEN - 1;
+	}
+	memcpy(key, name, len);
+	key[len] = 0;
+
+	spinlock_acquire(&lockstat_lock);
+	for (i=0; i<lockstat_count; i++) {
+		ls = &lockstats[i];
+		if (ls->ls_cv == iscv && !strcmp(ls->ls_name, key)) {
+			spinlock_release(&lockstat_lock);
+			return ls;
+		}
+	}
+	if (lockstat_count == LOCKSTAT_MAX) {
+		ls = &lockstats[LOCKSTAT_MAX];
+		if (ls->ls_name[0] == 0) {
+			strcpy(ls->ls_name, "(other)");
+		}
+	}
+	else {
+		ls = &lockstats[lockstat_count];
+		strcpy(ls->ls_name, key);
+		ls->ls_cv = iscv;
+		lockstat_count++;
+	}
+	spinlock_release(&lockstat_lock);
+	return ls;
+}
+
+void
+lockstat_print(void)
+{
+	struct lockstat *ls;
+	unsigned i, n;
+
+	spinlock_acquire(&lockstat_lock);
+	n = lockstat_count;
+	spinlock_release(&lockstat_lock);
+
+#if OPT_LOCKPROF
+	kprintf("%-24s %9s %9s %9s %9s %10s %10s %10s\n", "lock",
+		"acquires", "contended", "spinwins", "sleeps", "wait ms",
+		"maxwait us", "maxhold us");
+#else
+	kprintf("%-24s %9s %9s %9s %9s\n", "lock", "acquires",
+		"contended", "spinwins", "sleeps");
+#endif
+	for (i=0; i<=LOCKSTAT_MAX; i++) {
+		if (i == n) {
+			/* skip the unused entries, but not the overflow */
+			i = LOCKSTAT_MAX;
+		}
+		ls = &lockstats[i];
+		if (ls->ls_name[0] == 0 || ls->ls_cv ||
+		    ls->ls_contended == 0) {
+			continue;
+		}
+#if OPT_LOCKPROF
+		kprintf("%-24s %9u %9u %9u %9u %10llu %10u %10u\n",
+			ls->ls_name, ls->ls_acquires, ls->ls_contended,
+			ls->ls_spinwins, ls->ls_sleeps,
+			(unsigned long long)(ls->ls_waitns / 1000000),
+			ls->ls_maxwaitns / 1000, ls->ls_maxholdns / 1000);
+#else
+		kprintf("%-24s %9u %9u %9u %9u\n", ls->ls_name,
+			ls->ls_acquires, ls->ls_contended, ls->ls_spinwins,
+			ls->ls_sleeps);
+#endif
+	}
+
+#if OPT_LOCKPROF
+	kprintf("\n%-24s %9s %10s %10s\n", "cv", "waits", "wait ms",
+		"maxwait us");
+	for (i=0; i<=LOCKSTAT_MAX; i++) {
+		if (i == n) {
+			i = LOCKSTAT_MAX;
+		}
+		ls = &lockstats[i];
+		if (ls->ls_name[0] == 0 || !ls->ls_cv ||
+		    ls->ls_acquires == 0) {
+			continue;
+		}
+		kprintf("%-24s %9u %10llu %10u\n", ls->ls_name,
+			ls->ls_acquires,
+			(unsigned long long)(ls->ls_waitns / 1000000),
+			ls->ls_maxwaitns / 1000);
+	}
+#endif
+}
+#else
+void
+lockstat_print(void)
+{
+	kprintf("Lock statistics need the shell option\n");
+}
+#endif
+
+#if OPT_SHELL && !USE_SEMAPHORE_FOR_LOCK
+/*
+ * Lend our level down the chain of owners from LOCK, which we are
+ * about to sleep on. Call with LOCK's lk_lock held.
+ */
+static
+void
+lock_lend(struct lock *lock)
+{
+	struct thread *owner;
+	unsigned word, level, depth;
+
+	level = thread_level(curthread);
+	spinlock_acquire(&lock_pilock);
+	curthread->t_waitlock = lock;
+	for (depth = 0; lock != NULL && depth < LOCK_PI_DEPTH; depth++) {
+		word = lock->lk_word;
+		owner = LK_OWNER(word);
+		if (owner == NULL || (word & LK_WAITERS) == 0 ||
+		    thread_level(owner) <= level) {
+			break;
+		}
+		if (!lock->lk_donated) {
+			lock->lk_donated = true;
+			owner->t_pilocks++;
+		}
+		thread_inherit(owner, level);
+		lock = owner->t_waitlock;
+	}
+	spinlock_release(&lock_pilock);
+}
+
+/*
+ * We're letting go of LOCK; give back whatever we were lent through
+ * it. Call with lock_pilock held.
+ */
+static
+void
+lock_unlend(struct lock *lock)
+{
+	KASSERT(spinlock_do_i_hold(&lock_pilock));
+
+	if (lock->lk_donated) {
+		lock->lk_donated = false;
+		KASSERT(curthread->t_pilocks > 0);
+		curthread->t_pilocks--;
+		if (curthread->t_pilocks == 0) {
+			thread_uninherit();
+		}
+	}
+}
+#endif
+
 struct lock *
 lock_create(const char *name)
 {
@@ -168,8 +532,19 @@ lock_create(const char *name)
 	  kfree(lock);
 	  return NULL;
 	}
-	lock->lk_owner = NULL;
+	lock->lk_word = 0;
+	lock->lk_donated = false;
 	spinlock_init(&lock->lk_lock);
+#if !USE_SEMAPHORE_FOR_LOCK
+	wchan_setordered(lock->lk_wchan);
+#endif
+	lock->lk_stat = lockstat_get(lock->lk_name, false);
+#if OPT_LOCKORDER
+	lock->lk_class = lockorder_class(lock->lk_name);
+#endif
+#if OPT_LOCKPROF
+	lock->lk_acquiredat = 0;
+#endif
 #endif	
         return lock;
 }
@@ -197,6 +572,16 @@ lock_acquire(struct lock *lock)
 {
         // Write this
 #if OPT_SHELL
+#if !USE_SEMAPHORE_FOR_LOCK
+	unsigned word, new;
+	struct thread *owner;
+	unsigned spins;
+	bool slept;
+#endif
+#if OPT_LOCKPROF
+	uint64_t start;
+#endif
+
         KASSERT(lock != NULL);
 	if (lock_do_i_hold(lock)) {
 	  kprintf("AAACKK!\n");
@@ -204,6 +589,9 @@ lock_acquire(struct lock *lock)
 	KASSERT(!(lock_do_i_hold(lock)));
 
         KASSERT(curthread->t_in_interrupt == false);
+#if OPT_LOCKORDER
+	lockorder_acquire(lock);
+#endif
 
 #if USE_SEMAPHORE_FOR_LOCK
 /*
@@ -215,15 +603,92 @@ lock_acquire(struct lock *lock)
  */
         P(lock->lk_sem);
 	spinlock_acquire(&lock->lk_lock);        
+	lock->lk_stat->ls_acquires++;
+        KASSERT(lock->lk_word == 0);
+        lock->lk_word = LK_ME;
+#if OPT_LOCKPROF
+	lock->lk_acquiredat = lockprof_now();
+#endif
+	spinlock_release(&lock->lk_lock);
 #else
+	/* Uncontended: one atomic op, no spinlock */
+	if (atomic_cas(&lock->lk_word, 0, LK_ME) == 0) {
+		membar_store_any();
+		lock->lk_stat->ls_acquires++;
+#if OPT_LOCKPROF
+		lock->lk_acquiredat = lockprof_now();
+#endif
+		return;
+	}
+
 	spinlock_acquire(&lock->lk_lock);        
-	while (lock->lk_owner != NULL) {
-	  wchan_sleep(lock->lk_wchan, &lock->lk_lock);
-        }
+	lock->lk_stat->ls_contended++;
+#if OPT_LOCKPROF
+	start = lockprof_now();
+#endif
+	spins = 0;
+	slept = false;
+	while (1) {
+		word = lock->lk_word;
+		owner = LK_OWNER(word);
+		if (owner == NULL) {
+			/* Keep LK_WAITERS if anyone else is still asleep */
+			new = LK_ME;
+			if (!wchan_isempty(lock->lk_wchan, &lock->lk_lock)) {
+				new |= LK_WAITERS;
+			}
+			if (atomic_cas(&lock->lk_word, word, new) == word) {
+				break;
+			}
+			continue;
+		}
+		/*
+		 * If the owner is running it's on another cpu and will
+		 * likely release soon; spin without lk_lock so it can.
+		 * The owner can give the lock back and even exit
+		 * without lk_lock, so this look at it is only a hint;
+		 * thread structures are in directly mapped memory, so
+		 * the worst a stale look costs is a spin or a trip
+		 * round the loop, as the atomic_cas below fails.
+		 */
+		if (spins < LOCK_SPIN_MAX && owner->t_state == S_RUN) {
+			spinlock_release(&lock->lk_lock);
+			while (lock->lk_word == word &&
+			       spins < LOCK_SPIN_MAX) {
+				spins++;
+			}
+			spinlock_acquire(&lock->lk_lock);
+			continue;
+		}
+		/* Make sure the owner's release will come and wake us */
+		if ((word & LK_WAITERS) == 0 &&
+		    atomic_cas(&lock->lk_word, word,
+			       word | LK_WAITERS) != word) {
+			continue;
+		}
+		lock->lk_stat->ls_sleeps++;
+		slept = true;
+		lock_lend(lock);
+		wchan_sleep(lock->lk_wchan, &lock->lk_lock);
+	}
+	membar_store_any();
+	if (slept) {
+		spinlock_acquire(&lock_pilock);
+		curthread->t_waitlock = NULL;
+		spinlock_release(&lock_pilock);
+	}
+	if (!slept) {
+		lock->lk_stat->ls_spinwins++;
+	}
+#if OPT_LOCKPROF
+	lockprof_waited(lock->lk_stat, start);
+#endif
+	lock->lk_stat->ls_acquires++;
+#if OPT_LOCKPROF
+	lock->lk_acquiredat = lockprof_now();
 #endif
-        KASSERT(lock->lk_owner == NULL);
-        lock->lk_owner=curthread;
 	spinlock_release(&lock->lk_lock);
+#endif
 #endif
         (void)lock;  // suppress warning until code gets written
 }
@@ -233,18 +698,54 @@ lock_release(struct lock *lock)
 {
         // Write this
 #if OPT_SHELL
+#if OPT_LOCKPROF
+	uint64_t held;
+#endif
+
 	KASSERT(lock != NULL);
 	KASSERT(lock_do_i_hold(lock));
+#if OPT_LOCKORDER
+	lockorder_release(lock);
+#endif
+#if OPT_LOCKPROF
+	if (lock->lk_acquiredat != 0) {
+		held = lockprof_since(lock->lk_acquiredat);
+		if (held > lock->lk_stat->ls_maxholdns) {
+			lock->lk_stat->ls_maxholdns =
+				held > 0xffffffff ? 0xffffffff : held;
+		}
+	}
+	lock->lk_acquiredat = 0;
+#endif
+#if USE_SEMAPHORE_FOR_LOCK
 	spinlock_acquire(&lock->lk_lock);
-        lock->lk_owner=NULL;
+        lock->lk_word = 0;
 	/*  G.Cabodi - 2019: no problem here owning a spinlock, as V/wchan_wakeone 
 	    do not lead to wait state */
-#if USE_SEMAPHORE_FOR_LOCK
         V(lock->lk_sem);
+	spinlock_release(&lock->lk_lock);
 #else
+	membar_any_store();
+	/* Nobody waiting: one atomic op, no spinlock */
+	if (atomic_cas(&lock->lk_word, LK_ME, 0) == LK_ME) {
+		return;
+	}
+
+	/*
+	 * LK_WAITERS is set, and nobody else changes the word now
+	 * without lk_lock. Wake one, and leave LK_WAITERS set if
+	 * there are more, so the next owner's release comes this way.
+	 */
+	spinlock_acquire(&lock->lk_lock);
+	KASSERT(lock->lk_word == (LK_ME | LK_WAITERS));
+	spinlock_acquire(&lock_pilock);
+	lock_unlend(lock);
         wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
-#endif
+	lock->lk_word = wchan_isempty(lock->lk_wchan, &lock->lk_lock) ?
+		0 : LK_WAITERS;
+	spinlock_release(&lock_pilock);
 	spinlock_release(&lock->lk_lock);
+#endif
 #endif
 
         (void)lock;  // suppress warning until code gets written
@@ -255,7 +756,6 @@ lock_do_i_hold(struct lock *lock)
 {
         // Write this
 #if OPT_SHELL
-        bool res;
 	/*  G.Cabodi - 2019: this could possibly work without spinlock for mutual 
 	    exclusion, which could simplify the semaphore-based solution, by 
 	    removing the spinlock. 
@@ -264,10 +764,10 @@ lock_do_i_hold(struct lock *lock)
 	    If NOT the owner, a wrong verdict could happen (very low chance!!!)
             by wrongly reading a pointer == curthread. However, using the spinlock 
 	    is good practice for shared data. */
-	spinlock_acquire(&lock->lk_lock);
-	res = lock->lk_owner == curthread;
-	spinlock_release(&lock->lk_lock);
-	return res;
+	/* lk_word is one word and the fast paths don't take lk_lock
+	   either, so read it directly. Only our own thread can make it
+	   say we're the owner, so the answer is exact. */
+	return LK_OWNER(lock->lk_word) == curthread;
 #endif
 
         (void)lock;  // suppress warning until code gets written
@@ -305,6 +805,9 @@ cv_create(const char *name)
 		return NULL;
 	}
         spinlock_init(&cv->cv_lock);
+#if OPT_LOCKPROF
+	cv->cv_stat = lockstat_get(cv->cv_name, true);
+#endif
 #endif
         return cv;
 }
@@ -328,6 +831,10 @@ cv_wait(struct cv *cv, struct lock *lock)
 {
         // Write this
 #if OPT_SHELL
+#if OPT_LOCKPROF
+	uint64_t start;
+#endif
+
         KASSERT(lock != NULL);
 	KASSERT(cv != NULL);
 	KASSERT(lock_do_i_hold(lock));
@@ -336,7 +843,14 @@ cv_wait(struct cv *cv, struct lock *lock)
 	/* G.Cabodi - 2019: spinlock already owned as atomic lock_release+wchan_sleep
 	   needed */
 	lock_release(lock);
+#if OPT_LOCKPROF
+	cv->cv_stat->ls_acquires++;
+	start = lockprof_now();
+#endif
 	wchan_sleep(cv->cv_wchan,&cv->cv_lock);
+#if OPT_LOCKPROF
+	lockprof_waited(cv->cv_stat, start);
+#endif
 	spinlock_release(&cv->cv_lock);
 	/* G.Cabodi - 2019: spinlock already  released to avoid ownership while
 	   (possibly) going to wait state in lock_acquire. 
@@ -376,9 +890,159 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	KASSERT(lock_do_i_hold(lock));
 	/* G.Cabodi - 2019: see comment on spinlocks in cv_signal */
 	spinlock_acquire(&cv->cv_lock);
+#if USE_SEMAPHORE_FOR_LOCK
 	wchan_wakeall(cv->cv_wchan,&cv->cv_lock);
+#else
+	/*
+	 * Wait morphing: we hold LOCK, so everyone we woke would only
+	 * queue up for it in lock_acquire. Move them straight onto the
+	 * lock's wchan instead; each lock_release then wakes the next
+	 * one. (cv_lock before lk_lock, as in cv_wait.)
+	 *
+	 * Setting LK_WAITERS sends our release down the slow path to
+	 * wake them. We own the lock and hold lk_lock, so nobody else
+	 * can be changing the word.
+	 */
+	spinlock_acquire(&lock->lk_lock);
+	wchan_requeue(cv->cv_wchan, &cv->cv_lock,
+		      lock->lk_wchan, &lock->lk_lock);
+	if (!wchan_isempty(lock->lk_wchan, &lock->lk_lock)) {
+		lock->lk_word |= LK_WAITERS;
+	}
+	spinlock_release(&lock->lk_lock);
+#endif
 	spinlock_release(&cv->cv_lock);
 #endif
 	(void)cv;    // suppress warning until code gets written
 	(void)lock;  // suppress warning until code gets written
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rwlock_name = kstrdup(name);
+	if (rw->rwlock_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_readwchan = wchan_create(rw->rwlock_name);
+	if (rw->rw_readwchan == NULL) {
+		kfree(rw->rwlock_name);
+		kfree(rw);
+		return NULL;
+	}
+	rw->rw_writewchan = wchan_create(rw->rwlock_name);
+	if (rw->rw_writewchan == NULL) {
+		wchan_destroy(rw->rw_readwchan);
+		kfree(rw->rwlock_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rw_lock);
+	rw->rw_readers = 0;
+	rw->rw_writerswaiting = 0;
+	rw->rw_writer = NULL;
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rw->rw_writerswaiting == 0);
+
+	/* wchan_destroy asserts that nobody is still waiting */
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_writewchan);
+	wchan_destroy(rw->rw_readwchan);
+	kfree(rw->rwlock_name);
+	kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rw->rw_writer != curthread);
+
+	spinlock_acquire(&rw->rw_lock);
+	while (rw->rw_writer != NULL || rw->rw_writerswaiting > 0) {
+		wchan_sleep(rw->rw_readwchan, &rw->rw_lock);
+	}
+	rw->rw_readers++;
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_readers > 0);
+	rw->rw_readers--;
+	if (rw->rw_readers == 0) {
+		/* Readers only ever wait for writers, so wake a writer */
+		wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rw->rw_writer != curthread);
+
+	spinlock_acquire(&rw->rw_lock);
+	rw->rw_writerswaiting++;
+	while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+		wchan_sleep(rw->rw_writewchan, &rw->rw_lock);
+	}
+	rw->rw_writerswaiting--;
+	rw->rw_writer = curthread;
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer == curthread);
+	rw->rw_writer = NULL;
+	/* Hand off to the next writer if there is one; else let readers in */
+	if (rw->rw_writerswaiting > 0) {
+		wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+	}
+	else {
+		wchan_wakeall(rw->rw_readwchan, &rw->rw_lock);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	/* If we are the writer, nobody else can change this under us */
+	return rw->rw_writer == curthread;
+}
@@ -37,6 +37,8 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <array.h>
+#include <atomic.h>
+#include <membar.h>
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
@@ -47,9 +49,12 @@
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
+#include <clock.h>
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <workqueue.h>
+#include <kmem_cache.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -59,6 +64,7 @@
 struct wchan {
 	const char *wc_name;		/* name for this channel */
 	struct threadlist wc_threads;	/* list of waiting threads */
+	bool wc_ordered;		/* kept in priority order */
 };
 
 /* Master array of CPUs. */
@@ -69,6 +75,8 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+static void wchan_timeout(void *vthread);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -108,6 +116,54 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Thread structures come from an object cache, and each cpu keeps a
+ * few spare stacks (which are too big for one), so that in the steady
+ * state creating and destroying threads doesn't go to the page
+ * allocator. A spare stack goes back to whichever cpu the thread is
+ * destroyed on; the current cpu's are only touched with interrupts
+ * off, as the thread could otherwise be moved in the middle.
+ */
+static struct kmem_cache *thread_cache;
+
+static
+void *
+thread_stack_get(void)
+{
+	void *stack;
+	int spl;
+
+	stack = NULL;
+	spl = splhigh();
+	if (curcpu->c_nstacks > 0) {
+		stack = curcpu->c_stacks[--curcpu->c_nstacks];
+	}
+	splx(spl);
+
+	if (stack == NULL) {
+		stack = kmalloc(STACK_SIZE);
+	}
+	return stack;
+}
+
+static
+void
+thread_stack_put(void *stack)
+{
+	int spl;
+
+	spl = splhigh();
+	if (curcpu->c_nstacks < THREAD_STACKCACHE) {
+		curcpu->c_stacks[curcpu->c_nstacks++] = stack;
+		stack = NULL;
+	}
+	splx(spl);
+
+	if (stack != NULL) {
+		kfree(stack);
+	}
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -120,14 +176,14 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kmem_cache_alloc(thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
+		kmem_cache_free(thread_cache, thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -136,17 +192,42 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
+	thread->t_inboxnext = NULL;
 	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_tid = 0;
+	thread->t_prio = 0;
+	thread->t_ticks = 0;
+	thread->t_lastrun = 0;
+	thread->t_statesince = 0;
+	thread->t_bound = false;
+	thread->t_affinity = ~(uint32_t)0;
+	thread->t_inherit = RUNQUEUE_LEVELS;
+	thread->t_pilocks = 0;
+	thread->t_waitlock = NULL;
+	thread->t_policy = SCHED_OTHER;
+	thread->t_rtprio = 0;
+	thread->t_group = 0;
+	timeout_init(&thread->t_timeout, wchan_timeout, thread);
+	thread->t_timedwc = NULL;
+	thread->t_timedlk = NULL;
+	thread->t_timedout = false;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
+	thread->t_rcu_nesting = 0;
+	LOCKORDER_HELDINIT(&thread->t_lockorder);
 
 	/* If you add to struct thread, be sure to initialize here */
+	bzero(&thread->t_stats, sizeof(thread->t_stats));
+	thread->t_copiedin = 0;
+	thread->t_copiedout = 0;
+	thread->t_profpc = 0;
+	thread->t_profticks = 0;
 
 	return thread;
 }
@@ -165,11 +246,14 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
 		panic("cpu_create: Out of memory\n");
 	}
+	/* kmalloc's blocks are aligned to their power-of-two size */
+	KASSERT((vaddr_t)c % CACHELINE_SIZE == 0);
 
 	c->c_self = c;
 	c->c_hardware_number = hardware_number;
@@ -178,19 +262,57 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_asidgen = 0;
+	c->c_lastboost = 0;
+	c->c_runticks = 0;
+	c->c_idleticks = 0;
+	c->c_skippedticks = 0;
+	c->c_clocksynced = false;
+	c->c_clockbase_ns = 0;
+	c->c_clockbase_cyc = 0;
+	for (i=0; i<PCPU_NCOUNTERS; i++) {
+		c->c_counters[i] = 0;
+	}
+	c->c_nsteals = 0;
+	c->c_argbuf = NULL;
+	c->c_nstacks = 0;
+	c->c_npathbufs = 0;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	c->c_rcu_qs = 0;
+	for (i=0; i<RUNQUEUE_LEVELS; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	for (i=0; i<SCHED_PRIO_MAX; i++) {
+		threadlist_init(&c->c_rtqueue[i]);
+	}
+	c->c_runcount = 0;
+	c->c_preempt = false;
 	spinlock_init(&c->c_runqueue_lock);
+	c->c_inbox = NULL;
 
 	c->c_ipi_pending = 0;
-	c->c_numshootdown = 0;
+	c->c_ncalls = 0;
+	spinlock_init(&c->c_pagecache_lock);
+	c->c_pagecache_num = 0;
+	c->c_pagecache_registered = false;
+	c->c_pagecache_hits = 0;
+	c->c_pagecache_misses = 0;
+#if OPT_SPINLOCKPROF
+	c->c_splk_acquires = 0;
+	c->c_splk_contended = 0;
+	c->c_splk_spins = 0;
+	c->c_splk_maxspins = 0;
+	c->c_splk_maxhold = 0;
+	c->c_splk_maxholder = NULL;
+#endif
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+	kprintf_cpuinit(c->c_number);
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -272,7 +394,9 @@ thread_destroy(struct thread *thread)
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
 	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
+		/* Make sure nothing ran off the end before reusing it */
+		thread_checkstack(thread);
+		thread_stack_put(thread->t_stack);
 	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
@@ -281,14 +405,47 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	kmem_cache_free(thread_cache, thread);
+}
+
+/*
+ * Zombies waiting for thread_reap. The list has its own lock because
+ * the reaper can run on any cpu.
+ */
+static struct threadlist thread_deadlist;
+static struct spinlock thread_deadlock;
+static struct work thread_reapwork;
+
+/*
+ * Destroy the zombies exorcise handed over. Runs on sysworkq.
+ */
+static
+void
+thread_reap(void *unused)
+{
+	struct thread *z;
+
+	(void)unused;
+
+	while (1) {
+		spinlock_acquire(&thread_deadlock);
+		z = threadlist_remhead(&thread_deadlist);
+		spinlock_release(&thread_deadlock);
+		if (z == NULL) {
+			break;
+		}
+		thread_destroy(z);
+	}
 }
 
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
  * need to have thread_destroy called on them.)
  *
- * The list of zombies is per-cpu.
+ * The list of zombies is per-cpu. This is called on every context
+ * switch, so once sysworkq is there the actual freeing is left to it,
+ * rather than done here with interrupts off on the way into whatever
+ * thread is waking up.
  */
 static
 void
@@ -296,11 +453,26 @@ exorcise(void)
 {
 	struct thread *z;
 
+	if (sysworkq == NULL) {
+		while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
+			KASSERT(z != curthread);
+			KASSERT(z->t_state == S_ZOMBIE);
+			thread_destroy(z);
+		}
+		return;
+	}
+
+	if (threadlist_isempty(&curcpu->c_zombies)) {
+		return;
+	}
+	spinlock_acquire(&thread_deadlock);
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		threadlist_addtail(&thread_deadlist, z);
 	}
+	spinlock_release(&thread_deadlock);
+	workqueue_queue(sysworkq, &thread_reapwork);
 }
 
 /*
@@ -311,6 +483,9 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	struct threadlist *rq;
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -325,9 +500,20 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<RUNQUEUE_LEVELS; i++) {
+		rq = &curcpu->c_runqueue[i];
+		rq->tl_count = 0;
+		rq->tl_head.tln_next = &rq->tl_tail;
+		rq->tl_tail.tln_prev = &rq->tl_head;
+	}
+	for (i=0; i<SCHED_PRIO_MAX; i++) {
+		rq = &curcpu->c_rtqueue[i];
+		rq->tl_count = 0;
+		rq->tl_head.tln_next = &rq->tl_tail;
+		rq->tl_tail.tln_prev = &rq->tl_head;
+	}
+	curcpu->c_runcount = 0;
+	curcpu->c_inbox = NULL;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -368,7 +554,20 @@ thread_shutdown(void)
 void
 thread_bootstrap(void)
 {
+	unsigned i;
+
 	cpuarray_init(&allcpus);
+	thread_cache = kmem_cache_create("thread", sizeof(struct thread),
+					 NULL, NULL);
+	if (thread_cache == NULL) {
+		panic("Cannot create thread cache\n");
+	}
+	threadlist_init(&thread_deadlist);
+	spinlock_init(&thread_deadlock);
+	work_init(&thread_reapwork, thread_reap, NULL);
+	for (i=0; i<SCHED_NGROUPS; i++) {
+		thread_settickets(i, SCHED_TICKETS_DEFAULT);
+	}
 
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
@@ -440,152 +639,849 @@ thread_start_cpus(void)
 }
 
 /*
- * Make a thread runnable.
- *
- * targetcpu might be curcpu; it might not be, too.
+ * Number of threads on all of C's run queues. Call with C's runqueue
+ * lock held.
  */
 static
-void
-thread_make_runnable(struct thread *target, bool already_have_lock)
+unsigned
+thread_runqueue_count(struct cpu *c)
 {
-	struct cpu *targetcpu;
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	return c->c_runcount;
+}
 
-	/* Lock the run queue of the target thread's cpu. */
-	targetcpu = target->t_cpu;
+/* Run queue for a real-time thread: c_rtqueue[0] is the highest */
+#define THREAD_RTQUEUE(c, t)	(&(c)->c_rtqueue[SCHED_PRIO_MAX - (t)->t_rtprio])
 
-	if (already_have_lock) {
-		/* The target thread's cpu should be already locked. */
-		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
-	}
-	else {
-		spinlock_acquire(&targetcpu->c_runqueue_lock);
+/*
+ * Whether A should run in preference to B, so that waking A ought to
+ * preempt B: A is real-time and B either isn't or is less important.
+ */
+static
+bool
+thread_outranks(const struct thread *a, const struct thread *b)
+{
+	if (a->t_policy == SCHED_OTHER) {
+		return false;
 	}
+	return b->t_policy == SCHED_OTHER || a->t_rtprio > b->t_rtprio;
+}
 
-	/* Target thread is now ready to run; put it on the run queue. */
-	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+/*
+ * Scheduling groups: stride scheduling between groups of threads.
+ *
+ * Each group has a pass, a virtual time that goes up by its stride,
+ * STRIDE1 / tickets, for every hardclock one of its time-sharing
+ * threads spends on any cpu (thread_timeslice). Whenever a cpu picks
+ * a time-sharing thread it takes one from the group with the lowest
+ * pass, so over time each group gets cpu in proportion to its
+ * tickets, however many threads it has. Because the pass is shared
+ * by all cpus, a group that is getting a lot on one cpu loses out on
+ * the others; and an idle cpu steals from the group furthest behind.
+ * Within a group the levels work as below.
+ *
+ * The pass changes on every hardclock anywhere, so rather than keep
+ * the run queues sorted by it, picking scans them; they are short.
+ * Until some thread leaves group 0 (schedgroups_used), none of this
+ * happens and picking is as it always was.
+ *
+ * A group that had nothing to run, or couldn't use its share (one
+ * thread can only use one cpu), would otherwise come back with a pass
+ * far behind the rest and take over until it caught up. So a group's
+ * pass is never let fall more than SCHEDGROUP_LAG behind
+ * schedgroup_vtime, the latest pass any cpu has picked. Passes are
+ * compared as differences, so they can wrap.
+ */
+#define STRIDE1			(1U << 16)
+#define SCHEDGROUP_LAG		(STRIDE1 / 8)	/* 12 ticks at default */
+
+struct schedgroup {
+	volatile unsigned sg_pass;	/* virtual time used */
+	unsigned sg_stride;		/* STRIDE1 / sg_tickets */
+	unsigned sg_tickets;		/* share of the cpus */
+	volatile unsigned sg_ticks;	/* hardclocks charged, for stats */
+};
 
-	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
-		/*
-		 * Other processor is idle; send interrupt to make
-		 * sure it unidles.
-		 */
-		ipi_send(targetcpu, IPI_UNIDLE);
-	}
+static struct schedgroup schedgroups[SCHED_NGROUPS];
+static volatile unsigned schedgroup_vtime;
+static volatile bool schedgroups_used;
 
-	if (!already_have_lock) {
-		spinlock_release(&targetcpu->c_runqueue_lock);
-	}
+/* Whether pass A is behind pass B */
+#define PASS_BEFORE(a, b)	((int)((a) - (b)) < 0)
+
+/* Whether time-sharing thread A's group is behind B's */
+static
+bool
+schedgroup_before(const struct thread *a, const struct thread *b)
+{
+	return PASS_BEFORE(schedgroups[a->t_group].sg_pass,
+			   schedgroups[b->t_group].sg_pass);
 }
 
 /*
- * Create a new thread based on an existing one.
- *
- * The new thread has name NAME, and starts executing in function
- * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
- *
- * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * Bring group G up to within SCHEDGROUP_LAG of the others. If the cas
+ * loses, the group is running somewhere and will be charged anyway.
  */
-int
-thread_fork(const char *name,
-	    struct proc *proc,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2)
+static
+void
+schedgroup_catchup(struct schedgroup *g)
 {
-	struct thread *newthread;
-	int result;
+	unsigned pass, floor;
 
-	newthread = thread_create(name);
-	if (newthread == NULL) {
-		return ENOMEM;
+	pass = g->sg_pass;
+	floor = schedgroup_vtime - SCHEDGROUP_LAG;
+	if (PASS_BEFORE(pass, floor)) {
+		atomic_cas(&g->sg_pass, pass, floor);
 	}
+}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+/*
+ * Take the highest-level thread of the group with the lowest pass off
+ * C's time-sharing run queues. Ties go to the higher level, and then
+ * to the one that has waited longest.
+ */
+static
+struct thread *
+schedgroup_next(struct cpu *c)
+{
+	struct threadlistnode *tln;
+	struct thread *t, *best;
+	unsigned i, besti;
+
+	best = NULL;
+	besti = 0;
+	for (i=0; i<RUNQUEUE_LEVELS; i++) {
+		for (tln = c->c_runqueue[i].tl_head.tln_next;
+		     tln != &c->c_runqueue[i].tl_tail; tln = tln->tln_next) {
+			t = tln->tln_self;
+			if (best == NULL || schedgroup_before(t, best)) {
+				best = t;
+				besti = i;
+			}
+		}
 	}
-	thread_checkstack_init(newthread);
-
-	/*
-	 * Now we clone various fields from the parent thread.
-	 */
+	if (best != NULL) {
+		threadlist_remove(&c->c_runqueue[besti], best);
+		if (PASS_BEFORE(schedgroup_vtime,
+				schedgroups[best->t_group].sg_pass)) {
+			/* Unlocked; only ever a hint */
+			schedgroup_vtime = schedgroups[best->t_group].sg_pass;
+		}
+	}
+	return best;
+}
 
-	/* Thread subsystem fields */
-	newthread->t_cpu = curthread->t_cpu;
+/*
+ * Take the next thread to run off C's run queues: the first one at
+ * the highest real-time priority, or failing that the highest level,
+ * that has any (or by group; see above). Call with C's runqueue lock
+ * held.
+ */
+static
+struct thread *
+thread_runqueue_next(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
 
-	/* Attach the new thread to its process */
-	if (proc == NULL) {
-		proc = curthread->t_proc;
+	for (i=0; i<SCHED_PRIO_MAX; i++) {
+		t = threadlist_remhead(&c->c_rtqueue[i]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
 	}
-	result = proc_addthread(proc, newthread);
-	if (result) {
-		/* thread_destroy will clean up the stack */
-		thread_destroy(newthread);
-		return result;
+	if (schedgroups_used) {
+		t = schedgroup_next(c);
+		if (t != NULL) {
+			c->c_runcount--;
+		}
+		return t;
+	}
+	for (i=0; i<RUNQUEUE_LEVELS; i++) {
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
 	}
+	return NULL;
+}
 
-	/*
-	 * Because new threads come out holding the cpu runqueue lock
-	 * (see notes at bottom of thread_switch), we need to account
-	 * for the spllower() that will be done releasing it.
-	 */
-	newthread->t_iplhigh_count++;
+/*
+ * CPU affinity.
+ *
+ * A thread only goes on the run queue of a cpu in its t_affinity.
+ * Stealing passes over threads that may not run on the thief, and a
+ * thread made runnable while its t_cpu is one it may no longer use
+ * (its mask changed while it was on it) moves to the least loaded cpu
+ * it may use. The one exception is a thread woken so soon that it is
+ * still its old cpu's curthread, which can't be moved yet; it runs
+ * there once more and moves the next time it wakes up.
+ */
+static
+bool
+thread_mayrun(struct thread *t, struct cpu *c)
+{
+	return (t->t_affinity & ((uint32_t)1 << c->c_number)) != 0;
+}
 
-	/* Set up the switchframe so entrypoint() gets called */
-	switchframe_init(newthread, entrypoint, data1, data2);
+/*
+ * Whether real-time thread T would have to wait behind what C is
+ * running now: another real-time thread at least as important. An
+ * unlocked peek (thread structures are directly mapped), so only a
+ * hint. Always false for time-sharing threads.
+ */
+static
+bool
+thread_cpubusy(struct thread *t, struct cpu *c)
+{
+	return t->t_policy != SCHED_OTHER && !c->c_isidle &&
+		!thread_outranks(t, c->c_curthread);
+}
 
-	/* Lock the current cpu's run queue and make the new thread runnable */
-	thread_make_runnable(newthread, false);
+/*
+ * The best cpu for T, which is not running, to go on: the least
+ * loaded one it may run on, and for a real-time thread, preferably one
+ * not busy with another at least as important. Unlocked peeks, as in
+ * thread_steal.
+ */
+static
+struct cpu *
+thread_bestcpu(struct thread *t)
+{
+	struct cpu *c, *best;
+	unsigned i, numcpus;
+	bool busy, bestbusy;
 
-	return 0;
+	best = NULL;
+	bestbusy = true;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (!thread_mayrun(t, c)) {
+			continue;
+		}
+		busy = thread_cpubusy(t, c);
+		if (best == NULL || (bestbusy && !busy) ||
+		    (busy == bestbusy && c->c_runcount < best->c_runcount)) {
+			best = c;
+			bestbusy = busy;
+		}
+	}
+	/* thread_setaffinity never leaves a thread no cpus */
+	KASSERT(best != NULL);
+	return best;
 }
 
 /*
- * High level, machine-independent context switch code.
+ * Work stealing.
  *
- * The current thread is queued appropriately and its state is changed
- * to NEWSTATE; another thread to run is selected and switched to.
+ * A cpu that runs out of threads takes one from the busiest other
+ * cpu before going idle; apart from affinity changes (above), that's
+ * the only way threads move between cpus. Finding the busiest one
+ * only peeks at the c_runcount of each without locking anything, so
+ * an idle cpu costs the others nothing unless there is something to
+ * steal. The answer may be stale by the time the victim is locked,
+ * which just means stealing nothing.
  *
- * If NEWSTATE is S_SLEEP, the thread is queued on the wait channel
- * WC, protected by the spinlock LK. Otherwise WC and Lk should be
- * NULL.
+ * Moving a thread loses whatever it had in the victim's cache, so
+ * threads that ran there within the last THREAD_HOT_HARDCLOCKS are
+ * left alone, unless the victim has others waiting behind them. The
+ * lowest levels are looked at first, from the tail: those threads
+ * would be the last to run on the victim anyway.
+ */
+#define THREAD_HOT_HARDCLOCKS	1
+
+/*
+ * Pick a thread to steal from VICTIM, whose runqueue lock is held,
+ * and take it off its run queue. If COLDONLY is set, only threads
+ * that haven't run there recently qualify.
  */
 static
-void
-thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
+struct thread *
+thread_steal_pick(struct cpu *victim, bool coldonly)
 {
-	struct thread *cur, *next;
-	int spl;
-
-	DEBUGASSERT(curcpu->c_curthread == curthread);
-	DEBUGASSERT(curthread->t_cpu == curcpu->c_self);
-
-	/* Explicitly disable interrupts on this processor */
-	spl = splhigh();
+	struct threadlist *rq, *bestrq;
+	struct threadlistnode *tln;
+	struct thread *t, *best;
+	unsigned i;
 
-	cur = curthread;
+	KASSERT(spinlock_do_i_hold(&victim->c_runqueue_lock));
 
 	/*
-	 * If we're idle, return without doing anything. This happens
-	 * when the timer interrupt interrupts the idle loop.
+	 * Time-sharing levels, lowest first, then real-time ones. With
+	 * scheduling groups, look at every time-sharing thread and take
+	 * the one whose group is furthest behind.
 	 */
-	if (curcpu->c_isidle) {
-		splx(spl);
-		return;
+	best = NULL;
+	bestrq = NULL;
+	for (i=RUNQUEUE_LEVELS + SCHED_PRIO_MAX; i-- > 0; ) {
+		rq = i < SCHED_PRIO_MAX ? &victim->c_rtqueue[i] :
+			&victim->c_runqueue[i - SCHED_PRIO_MAX];
+		for (tln = rq->tl_tail.tln_prev; tln != &rq->tl_head;
+		     tln = tln->tln_prev) {
+			t = tln->tln_self;
+			/*
+			 * The victim's curthread can be on its run
+			 * queue while it is becoming idle or unidle
+			 * (went to sleep, cpu idled, got woken up);
+			 * it must not be moved.
+			 */
+			if (t == victim->c_curthread || t->t_bound ||
+			    !thread_mayrun(t, curcpu->c_self)) {
+				continue;
+			}
+			if (coldonly && victim->c_hardclocks - t->t_lastrun
+			    < THREAD_HOT_HARDCLOCKS) {
+				continue;
+			}
+			if (best == NULL || (i >= SCHED_PRIO_MAX &&
+					     schedgroup_before(t, best))) {
+				best = t;
+				bestrq = rq;
+			}
+			if (!schedgroups_used) {
+				break;
+			}
+		}
+		/* Stop at the first queue, or the last time-sharing one */
+		if (best != NULL &&
+		    (!schedgroups_used || i <= SCHED_PRIO_MAX)) {
+			break;
+		}
+	}
+	if (best != NULL) {
+		threadlist_remove(bestrq, best);
+		victim->c_runcount--;
 	}
+	return best;
+}
 
-	/* Check the stack guard band. */
-	thread_checkstack(cur);
+/*
+ * Steal a thread for the current cpu, which has none. Called from
+ * thread_switch with interrupts off and no runqueue locks held.
+ * Returns the thread, now belonging to this cpu and on no list, or
+ * NULL.
+ */
+static
+struct thread *
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, numcpus, load, best;
 
-	/* Lock the run queue. */
-	spinlock_acquire(&curcpu->c_runqueue_lock);
+	victim = NULL;
+	best = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		/* Unlocked peek; see above */
+		load = c->c_runcount;
+		if (load > best) {
+			best = load;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	t = thread_steal_pick(victim, true);
+	if (t == NULL && victim->c_runcount > 1) {
+		t = thread_steal_pick(victim, false);
+	}
+	if (t != NULL) {
+		t->t_cpu = curcpu->c_self;
+		curcpu->c_nsteals++;
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+		      t->t_name, victim->c_number, curcpu->c_number);
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+	return t;
+}
+
+/*
+ * Wake up some idle cpu other than BUSY and ourselves, if there is
+ * one, so it can steal work.
+ */
+static
+void
+thread_kickidle(struct cpu *busy)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		/* Unlocked peek; at worst we kick one for nothing */
+		if (c->c_isidle && c != busy && c != curcpu->c_self) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
+/*
+ * Hardclocks elapsed since T entered its current state. Threads move
+ * between cpus whose clocks are not quite in step, so never go
+ * backwards.
+ */
+static
+unsigned
+thread_statetime(struct thread *t)
+{
+	int delta;
+
+	delta = (int)(curcpu->c_hardclocks - t->t_statesince);
+	return delta < 0 ? 0 : delta;
+}
+
+/*
+ * Put a thread on its cpu's run queue, whose lock the caller holds.
+ * The cpu isn't told; see thread_notify.
+ */
+static
+void
+thread_enqueue(struct thread *target)
+{
+	struct cpu *targetcpu = target->t_cpu;
+
+	KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+
+	if (target->t_state == S_SLEEP) {
+		target->t_stats.ss_sleepticks += thread_statetime(target);
+	}
+	target->t_state = S_READY;
+	target->t_statesince = curcpu->c_hardclocks;
+	if (target->t_policy != SCHED_OTHER) {
+		threadlist_addtail(THREAD_RTQUEUE(targetcpu, target), target);
+		if (!targetcpu->c_isidle &&
+		    thread_outranks(target, targetcpu->c_curthread)) {
+			targetcpu->c_preempt = true;
+		}
+	}
+	else {
+		KASSERT(target->t_prio < RUNQUEUE_LEVELS);
+		threadlist_addtail(&targetcpu->c_runqueue[thread_level(target)],
+				   target);
+		if (schedgroups_used) {
+			schedgroup_catchup(&schedgroups[target->t_group]);
+		}
+	}
+	targetcpu->c_runcount++;
+}
+
+/*
+ * Let TARGETCPU, whose run queue lock the caller holds, know that
+ * threads have been put on its run queue.
+ */
+static
+void
+thread_notify(struct cpu *targetcpu)
+{
+	KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+
+	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
+		/*
+		 * Other processor is idle; send interrupt to make
+		 * sure it unidles.
+		 */
+		ipi_send(targetcpu, IPI_UNIDLE);
+	}
+	else if (targetcpu->c_preempt && targetcpu != curcpu->c_self) {
+		/*
+		 * A real-time thread should take over there now, not
+		 * at the next hardclock. (On this cpu it happens on
+		 * the way out of the interrupt or system call.)
+		 */
+		ipi_send(targetcpu, IPI_RESCHED);
+	}
+	else if (targetcpu->c_runcount > 1) {
+		/*
+		 * A queue is building up. Idle cpus have their timers
+		 * off and won't come looking for it by themselves any
+		 * time soon, so wake one up to steal some.
+		 */
+		thread_kickidle(targetcpu);
+	}
+}
+
+/*
+ * Wakeup inboxes.
+ *
+ * A thread woken by a cpu other than its t_cpu isn't put on that
+ * cpu's run queue directly, which would mean taking its runqueue lock
+ * and in a wakeup storm every cpu fighting over every other's.
+ * Instead it is pushed onto the cpu's c_inbox with a compare-and-swap,
+ * and the cpu moves it onto its run queue itself: whenever it goes
+ * through thread_switch, on the hardclock, and on the IPI_UNIDLE that
+ * the push that found the inbox empty sent it. Further pushes before
+ * the inbox is drained send nothing. The inbox is only ever emptied
+ * as a whole, so the pushes have no ABA problem.
+ *
+ * It also takes care of a thread woken while still switching off its
+ * cpu: only that cpu drains its inbox, and it can't do that until it
+ * is done switching (or is in the same thread_switch, and finds it
+ * is taking its own curthread back). So a thread in an inbox is
+ * always all the way off the cpu when the drain looks at it, and can
+ * then be passed on to another cpu if it may not or should not run
+ * on this one (affinity, or a busy cpu for a real-time thread).
+ */
+
+/*
+ * Push T, which is not running, onto C's inbox, and send C an IPI if
+ * it was empty. C is not the current cpu.
+ */
+static
+void
+thread_inbox_push(struct cpu *c, struct thread *t)
+{
+	struct thread *old;
+
+	KASSERT(c != curcpu->c_self);
+
+	/* Everything about T must be visible before T is */
+	membar_any_store();
+	do {
+		old = c->c_inbox;
+		t->t_inboxnext = old;
+	} while ((struct thread *)atomic_cas((volatile unsigned *)&c->c_inbox,
+		(unsigned)old, (unsigned)t) != old);
+
+	if (old == NULL) {
+		ipi_send(c, IPI_UNIDLE);
+	}
+}
+
+/*
+ * Queue T, whose t_cpu is C, on C, whose runqueue lock is held, or on
+ * a better cpu if it may not run on C or would have to wait there; see
+ * above. The one exception is a thread that is still C's curthread,
+ * which can't move yet; it runs on C once more and moves the next
+ * time it wakes up.
+ */
+static
+void
+thread_place(struct cpu *c, struct thread *t)
+{
+	struct cpu *best;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	KASSERT(t->t_cpu == c);
+
+	if (t != c->c_curthread &&
+	    (!thread_mayrun(t, c) || thread_cpubusy(t, c))) {
+		best = thread_bestcpu(t);
+		if (best != c) {
+			t->t_cpu = best;
+			thread_inbox_push(best, t);
+			return;
+		}
+	}
+	thread_enqueue(t);
+}
+
+/*
+ * Move the current cpu's inbox onto its run queues, oldest first.
+ * Call with the runqueue lock held. Cheap if it's empty.
+ */
+static
+void
+thread_inbox_drain(void)
+{
+	struct cpu *c = curcpu->c_self;
+	struct thread *list, *t, *prev;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	if (c->c_inbox == NULL) {
+		return;
+	}
+	do {
+		list = c->c_inbox;
+	} while ((struct thread *)atomic_cas((volatile unsigned *)&c->c_inbox,
+		(unsigned)list, 0) != list);
+	membar_load_load();
+
+	/* Pushes go on the front; reverse for first come, first served */
+	prev = NULL;
+	while (list != NULL) {
+		t = list;
+		list = t->t_inboxnext;
+		t->t_inboxnext = prev;
+		prev = t;
+	}
+	while (prev != NULL) {
+		t = prev;
+		prev = t->t_inboxnext;
+		t->t_inboxnext = NULL;
+		thread_place(c, t);
+	}
+	thread_notify(c);
+}
+
+/*
+ * Make a thread runnable.
+ *
+ * targetcpu might be curcpu; it might not be, too. If it's another
+ * cpu, the thread goes to its inbox.
+ */
+static
+void
+thread_make_runnable(struct thread *target, bool already_have_lock)
+{
+	struct cpu *targetcpu;
+	int spl;
+
+	targetcpu = target->t_cpu;
+	if (already_have_lock) {
+		/* The target thread's cpu should be already locked. */
+		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+		thread_enqueue(target);
+		thread_notify(targetcpu);
+		return;
+	}
+
+	/* Stay on this cpu while deciding */
+	spl = splhigh();
+	if (targetcpu != curcpu->c_self) {
+		thread_inbox_push(targetcpu, target);
+	}
+	else {
+		spinlock_acquire(&targetcpu->c_runqueue_lock);
+		thread_place(targetcpu, target);
+		thread_notify(targetcpu);
+		spinlock_release(&targetcpu->c_runqueue_lock);
+	}
+	splx(spl);
+}
+
+/*
+ * Create a new thread based on an existing one.
+ *
+ * The new thread has name NAME, and starts executing in function
+ * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
+ *
+ * The new thread is created in the process P. If P is null, the
+ * process is inherited from the caller. It will start on CPU, or if
+ * that's null on the same CPU as the caller, unless the scheduler
+ * intervenes first. If BOUND is set the scheduler never intervenes.
+ */
+static
+int
+thread_fork_common(const char *name,
+		   struct proc *proc, struct cpu *cpu, bool bound,
+		   void (*entrypoint)(void *data1, unsigned long data2),
+		   void *data1, unsigned long data2)
+{
+	struct thread *newthread;
+	int result;
+
+	newthread = thread_create(name);
+	if (newthread == NULL) {
+		return ENOMEM;
+	}
+
+	/* Allocate a stack */
+	newthread->t_stack = thread_stack_get();
+	if (newthread->t_stack == NULL) {
+		thread_destroy(newthread);
+		return ENOMEM;
+	}
+	thread_checkstack_init(newthread);
+
+	/*
+	 * Now we clone various fields from the parent thread.
+	 */
+
+	/* Thread subsystem fields */
+	newthread->t_cpu = cpu != NULL ? cpu : curthread->t_cpu;
+	newthread->t_bound = bound;
+
+	/* Attach the new thread to its process */
+	if (proc == NULL) {
+		proc = curthread->t_proc;
+	}
+
+	/* User threads keep their creator's cpus; see thread_setaffinity */
+	if (bound) {
+		newthread->t_affinity = (uint32_t)1 << newthread->t_cpu->c_number;
+	}
+	else if (proc != kproc) {
+		newthread->t_affinity = curthread->t_affinity;
+		newthread->t_policy = curthread->t_policy;
+		newthread->t_rtprio = curthread->t_rtprio;
+		newthread->t_group = curthread->t_group;
+	}
+	result = proc_addthread(proc, newthread);
+	if (result) {
+		/* thread_destroy will clean up the stack */
+		thread_destroy(newthread);
+		return result;
+	}
+
+	/*
+	 * Because new threads come out holding the cpu runqueue lock
+	 * (see notes at bottom of thread_switch), we need to account
+	 * for the spllower() that will be done releasing it.
+	 */
+	newthread->t_iplhigh_count++;
+
+	/* Set up the switchframe so entrypoint() gets called */
+	switchframe_init(newthread, entrypoint, data1, data2);
+
+	/* Lock the new thread's cpu's run queue and make it runnable */
+	thread_make_runnable(newthread, false);
+
+	return 0;
+}
+
+int
+thread_fork(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2)
+{
+	return thread_fork_common(name, proc, NULL, false,
+				  entrypoint, data1, data2);
+}
+
+/*
+ * Create a kernel thread that runs only on cpu number CPUNUM.
+ */
+int
+thread_fork_bound(const char *name, unsigned cpunum,
+		  void (*entrypoint)(void *data1, unsigned long data2),
+		  void *data1, unsigned long data2)
+{
+	if (cpunum >= cpuarray_num(&allcpus)) {
+		return EINVAL;
+	}
+	return thread_fork_common(name, kproc, cpuarray_get(&allcpus, cpunum),
+				  true, entrypoint, data1, data2);
+}
+
+/*
+ * Number of cpus. Only final once thread_start_cpus has run.
+ */
+unsigned
+thread_numcpus(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+/*
+ * Cpu number N.
+ */
+struct cpu *
+thread_getcpu(unsigned n)
+{
+	return cpuarray_get(&allcpus, n);
+}
+
+/*
+ * The current thread's cpu mask.
+ */
+uint32_t
+thread_getaffinity(void)
+{
+	uint32_t mask;
+	unsigned numcpus;
+
+	mask = curthread->t_affinity;
+	numcpus = cpuarray_num(&allcpus);
+	if (numcpus < 32) {
+		mask &= ((uint32_t)1 << numcpus) - 1;
+	}
+	return mask;
+}
+
+/*
+ * Set the current thread's cpu mask. Bits for cpus that don't exist
+ * are dropped. If this cpu is no longer in the mask, sleep for a
+ * tick: waking up puts us on one that is (see thread_place).
+ */
+int
+thread_setaffinity(uint32_t mask)
+{
+	unsigned numcpus;
+
+	KASSERT(!curthread->t_bound);
+
+	numcpus = cpuarray_num(&allcpus);
+	if (numcpus < 32) {
+		mask &= ((uint32_t)1 << numcpus) - 1;
+	}
+	if (mask == 0) {
+		return EINVAL;
+	}
+
+	curthread->t_affinity = mask;
+	while (!thread_mayrun(curthread, curcpu->c_self)) {
+		clocksleep_ticks(1);
+	}
+	return 0;
+}
+
+/*
+ * High level, machine-independent context switch code.
+ *
+ * The current thread is queued appropriately and its state is changed
+ * to NEWSTATE; another thread to run is selected and switched to.
+ *
+ * If NEWSTATE is S_SLEEP, the thread is queued on the wait channel
+ * WC, protected by the spinlock LK. Otherwise WC and Lk should be
+ * NULL.
+ */
+static
+void
+thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
+{
+	struct thread *cur, *next;
+	int spl;
+
+	DEBUGASSERT(curcpu->c_curthread == curthread);
+	DEBUGASSERT(curthread->t_cpu == curcpu->c_self);
+
+	/* No switching, or sleeping, inside an RCU read section */
+	KASSERT(curthread->t_rcu_nesting == 0);
+
+	/* Explicitly disable interrupts on this processor */
+	spl = splhigh();
+
+	cur = curthread;
+
+	/* Whether or not we switch, this cpu holds no RCU references */
+	curcpu->c_rcu_qs++;
+
+	/*
+	 * If we're idle, return without doing anything. This happens
+	 * when the timer interrupt interrupts the idle loop.
+	 */
+	if (curcpu->c_isidle) {
+		splx(spl);
+		return;
+	}
+
+	/* Check the stack guard band. */
+	thread_checkstack(cur);
+
+	/* Lock the run queue. */
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+
+	/* Whatever wanted us to switch is about to be looked at */
+	curcpu->c_preempt = false;
+	thread_inbox_drain();
 
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && thread_runqueue_count(curcpu->c_self) == 0) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -596,9 +1492,17 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
+		/* Preempted from hardclock, or yielded by choice */
+		if (cur->t_in_interrupt) {
+			cur->t_stats.ss_nivcsw++;
+		}
+		else {
+			cur->t_stats.ss_nvcsw++;
+		}
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
+		cur->t_stats.ss_nvcsw++;
 		cur->t_wchan_name = wc->wc_name;
 		/*
 		 * Add the thread to the list in the wait channel, and
@@ -608,7 +1512,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		 * caller of wchan_sleep locked it until the thread is
 		 * on the list.
 		 */
-		threadlist_addtail(&wc->wc_threads, cur);
+		if (wc->wc_ordered) {
+			threadlist_addbylevel(&wc->wc_threads, cur);
+		}
+		else {
+			threadlist_addtail(&wc->wc_threads, cur);
+		}
 		spinlock_release(lk);
 		break;
 	    case S_ZOMBIE:
@@ -617,6 +1526,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		break;
 	}
 	cur->t_state = newstate;
+	cur->t_lastrun = curcpu->c_hardclocks;
+	cur->t_statesince = curcpu->c_hardclocks;
 
 	/*
 	 * Get the next thread. While there isn't one, call cpu_idle().
@@ -633,20 +1544,32 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
+	 *
+	 * Before idling, try to steal something from another cpu.
 	 */
 
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		/* Including ourselves, if we've just been woken */
+		thread_inbox_drain();
+		next = thread_runqueue_next(curcpu->c_self);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			next = thread_steal();
+			if (next == NULL) {
+				hardclock_idle();
+				cpu_idle();
+				hardclock_unidle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	next->t_stats.ss_waitticks += thread_statetime(next);
+	percpu_inc(PCPU_SWITCHES);
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -764,188 +1687,406 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 }
 
 /*
- * Cause the current thread to exit.
- *
- * The parts of the thread structure we don't actually need to run
- * should be cleaned up right away. The rest has to wait until
- * thread_destroy is called from exorcise().
- *
- * Does not return.
+ * Cause the current thread to exit.
+ *
+ * The parts of the thread structure we don't actually need to run
+ * should be cleaned up right away. The rest has to wait until
+ * thread_destroy is called from exorcise().
+ *
+ * Does not return.
+ */
+void
+thread_exit(void)
+{
+	struct thread *cur;
+
+	cur = curthread;
+
+	/*
+	 * Detach from our process. You might need to move this action
+	 * around, depending on how your wait/exit works.
+	 */
+	if (cur->t_proc != NULL) {
+        proc_remthread(cur);
+    }
+
+	/* Make sure we *are* detached (move this only if you're sure!) */
+	KASSERT(cur->t_proc == NULL);
+
+	/* Check the stack guard band. */
+	thread_checkstack(cur);
+
+	/* Interrupts off on this processor */
+        splhigh();
+	thread_switch(S_ZOMBIE, NULL, NULL);
+	panic("braaaaaaaiiiiiiiiiiinssssss\n");
+}
+
+/*
+ * Yield the cpu to another process, but stay runnable.
+ */
+void
+thread_yield(void)
+{
+	thread_switch(S_READY, NULL, NULL);
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Scheduler.
+ *
+ * This is a multi-level feedback queue. Each cpu has RUNQUEUE_LEVELS
+ * run queues, and always runs the first thread on the highest-level
+ * (lowest-numbered) queue that has any. A thread at level N gets a
+ * quantum of THREAD_QUANTUM(N) hardclocks; when it uses all of it, it
+ * drops a level (thread_timeslice). When it goes to sleep, it rises a
+ * level (wchan_sleep). So CPU-bound threads sink, and threads that
+ * mostly wait, like the shell waiting for input, stay on top and get
+ * to run as soon as they wake up, preempting the sinkers at the next
+ * hardclock.
+ *
+ * So that the sinkers don't starve if there's always something above
+ * them, every THREAD_BOOST_HARDCLOCKS everything is put back on the
+ * top level (schedule).
+ *
+ * A sinker holding a lock that a higher thread is waiting for runs at
+ * the waiter's level until it lets go (thread_inherit); otherwise the
+ * threads in between would keep both of them off the cpu.
+ *
+ * Real-time threads (SCHED_FIFO and SCHED_RR) have run queues of their
+ * own, one per priority, ahead of all the levels. They never sink or
+ * get boosted. A FIFO thread runs until it sleeps or yields, an RR one
+ * for THREAD_RR_QUANTUM hardclocks at a time. Queueing one on a cpu
+ * running something less important sets that cpu's c_preempt, and an
+ * IPI if it's another cpu, so it takes over as soon as the interrupt
+ * or system call in progress is done rather than at the next
+ * hardclock (thread_preemptcheck).
+ *
+ * Kernel code is preemptible wherever interrupts are on, since the
+ * hardclock can switch away from it. Where they come back on (the last
+ * spinlock or splhigh let go, in spllower) and at the end of an RCU
+ * read section is also a preemption point (thread_preemptpoint), so
+ * a real-time thread woken on this cpu from a long system call takes
+ * over at once rather than at the next hardclock or on the way out.
+ * The hardclock can't switch inside an RCU read section; it leaves
+ * c_preempt set for rcu_read_unlock instead.
+ *
+ * Time-sharing threads in more than one scheduling group are first
+ * chosen between by group, in proportion to the groups' tickets, and
+ * only then by level; see schedgroup_next.
+ */
+#define THREAD_QUANTUM(level)	(1U << (level))
+#define THREAD_BOOST_HARDCLOCKS	100	/* once a second */
+#define THREAD_RR_QUANTUM	10	/* hardclocks */
+
+/*
+ * Switch away from the current thread from the hardclock, or if it's
+ * in an RCU read section, as soon as it leaves it.
+ */
+static
+void
+thread_preempt(void)
+{
+	if (curthread->t_rcu_nesting > 0) {
+		curcpu->c_preempt = true;
+		return;
+	}
+	thread_yield();
+}
+
+/*
+ * Called on every hardclock.
+ */
+void
+thread_timeslice(void)
+{
+	struct thread *cur = curthread;
+	struct schedgroup *g;
+	bool preempt;
+	unsigned i;
+
+	if (curcpu->c_isidle) {
+		/* We interrupted the idle loop; nobody to charge */
+		curcpu->c_idleticks++;
+		return;
+	}
+
+	cur->t_stats.ss_runticks++;
+	curcpu->c_runticks++;
+	cur->t_ticks++;
+	if (cur->t_policy == SCHED_OTHER && schedgroups_used) {
+		g = &schedgroups[cur->t_group];
+		atomic_fetchadd(&g->sg_pass, g->sg_stride);
+		atomic_fetchadd(&g->sg_ticks, 1);
+	}
+	if (cur->t_policy != SCHED_OTHER) {
+		/* Anything more important comes by c_preempt */
+		if (cur->t_policy == SCHED_RR &&
+		    cur->t_ticks >= THREAD_RR_QUANTUM) {
+			cur->t_ticks = 0;
+			thread_preempt();
+		}
+		return;
+	}
+	if (cur->t_ticks >= THREAD_QUANTUM(cur->t_prio)) {
+		if (cur->t_prio < RUNQUEUE_LEVELS - 1) {
+			cur->t_prio++;
+		}
+		cur->t_ticks = 0;
+		thread_preempt();
+		return;
+	}
+
+	/* Still within its quantum; only make way for higher levels */
+	preempt = false;
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	thread_inbox_drain();
+	for (i=0; i<SCHED_PRIO_MAX; i++) {
+		if (!threadlist_isempty(&curcpu->c_rtqueue[i])) {
+			preempt = true;
+			break;
+		}
+	}
+	for (i=0; i<thread_level(cur) && !preempt; i++) {
+		if (!threadlist_isempty(&curcpu->c_runqueue[i])) {
+			preempt = true;
+		}
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+	if (preempt) {
+		thread_preempt();
+	}
+}
+
+/*
+ * This is called periodically from hardclock(). It should reshuffle
+ * the current CPU's run queue by job priority.
+ *
+ * All it needs to do here is the periodic boost.
+ */
+void
+schedule(void)
+{
+	struct thread *t;
+	unsigned i;
+
+	if (curcpu->c_hardclocks - curcpu->c_lastboost <
+	    THREAD_BOOST_HARDCLOCKS) {
+		return;
+	}
+	curcpu->c_lastboost = curcpu->c_hardclocks;
+
+	/* Keep idle groups' passes from drifting out of range */
+	if (schedgroups_used) {
+		for (i=0; i<SCHED_NGROUPS; i++) {
+			schedgroup_catchup(&schedgroups[i]);
+		}
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=1; i<RUNQUEUE_LEVELS; i++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i]))
+		       != NULL) {
+			t->t_prio = 0;
+			t->t_ticks = 0;
+			threadlist_addtail(&curcpu->c_runqueue[0], t);
+		}
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (!curcpu->c_isidle) {
+		curthread->t_prio = 0;
+		curthread->t_ticks = 0;
+	}
+}
+
+/*
+ * Change the current thread's class, and let anything that now
+ * outranks it run.
+ */
+void
+thread_setsched(int policy, unsigned rtprio)
+{
+	KASSERT(policy == SCHED_OTHER ? rtprio == 0 :
+		rtprio >= SCHED_PRIO_MIN && rtprio <= SCHED_PRIO_MAX);
+
+	curthread->t_policy = policy;
+	curthread->t_rtprio = rtprio;
+	curthread->t_ticks = 0;
+	thread_yield();
+}
+
+void
+thread_preemptcheck(void)
+{
+	if (curcpu->c_preempt && !curcpu->c_isidle &&
+	    curthread->t_rcu_nesting == 0) {
+		thread_yield();
+	}
+}
+
+void
+thread_preemptpoint(void)
+{
+	struct thread *cur = curthread;
+
+	if (cur->t_iplhigh_count == 0 && !cur->t_in_interrupt) {
+		thread_preemptcheck();
+	}
+}
+
+unsigned
+thread_level(const struct thread *t)
+{
+	if (t->t_policy != SCHED_OTHER) {
+		return 0;
+	}
+	return t->t_inherit < t->t_prio ? t->t_inherit : t->t_prio;
+}
+
+/*
+ * Lend T the run queue level LEVEL, if that's higher than it has. If
+ * T is waiting on a run queue, it moves up to the new level's there.
  */
 void
-thread_exit(void)
+thread_inherit(struct thread *t, unsigned level)
 {
-	struct thread *cur;
+	struct cpu *c;
+	unsigned old;
 
-	cur = curthread;
+	KASSERT(level < RUNQUEUE_LEVELS);
 
+	c = t->t_cpu;
+	spinlock_acquire(&c->c_runqueue_lock);
+	old = thread_level(t);
+	if (level < t->t_inherit) {
+		t->t_inherit = level;
+	}
 	/*
-	 * Detach from our process. You might need to move this action
-	 * around, depending on how your wait/exit works.
+	 * It's on C's run queue if it's ready, still C's, and on a
+	 * list (one being stolen is off the list, or no longer C's).
 	 */
-	if (cur->t_proc != NULL) {
-        proc_remthread(cur);
-    }
-
-	/* Make sure we *are* detached (move this only if you're sure!) */
-	KASSERT(cur->t_proc == NULL);
+	if (t->t_state == S_READY && t->t_cpu == c &&
+	    t->t_listnode.tln_prev != NULL && t->t_policy == SCHED_OTHER &&
+	    thread_level(t) < old) {
+		threadlist_remove(&c->c_runqueue[old], t);
+		threadlist_addtail(&c->c_runqueue[thread_level(t)], t);
+	}
+	spinlock_release(&c->c_runqueue_lock);
+}
 
-	/* Check the stack guard band. */
-	thread_checkstack(cur);
+/*
+ * Go back to the current thread's own level.
+ */
+void
+thread_uninherit(void)
+{
+	curthread->t_inherit = RUNQUEUE_LEVELS;
+}
 
-	/* Interrupts off on this processor */
-        splhigh();
-	thread_switch(S_ZOMBIE, NULL, NULL);
-	panic("braaaaaaaiiiiiiiiiiinssssss\n");
+unsigned
+thread_getgroup(void)
+{
+	return curthread->t_group;
 }
 
 /*
- * Yield the cpu to another process, but stay runnable.
+ * Move the current thread into GROUP. It is charged there from the
+ * next hardclock on; the first move out of group 0 turns on picking
+ * by group.
  */
 void
-thread_yield(void)
+thread_setgroup(unsigned group)
 {
-	thread_switch(S_READY, NULL, NULL);
+	KASSERT(group < SCHED_NGROUPS);
+
+	if (group != 0 && !schedgroups_used) {
+		schedgroups_used = true;
+	}
+	curthread->t_group = group;
 }
 
-////////////////////////////////////////////////////////////
+unsigned
+thread_gettickets(unsigned group)
+{
+	KASSERT(group < SCHED_NGROUPS);
+	return schedgroups[group].sg_tickets;
+}
 
 /*
- * Scheduler.
- *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * Give GROUP TICKETS tickets. Unlocked: a hardclock charging the old
+ * stride while this changes it does no harm.
  */
+void
+thread_settickets(unsigned group, unsigned tickets)
+{
+	KASSERT(group < SCHED_NGROUPS);
+	KASSERT(tickets > 0 && tickets <= SCHED_TICKETS_MAX);
+
+	schedgroups[group].sg_tickets = tickets;
+	schedgroups[group].sg_stride = STRIDE1 / tickets;
+}
 
 void
-schedule(void)
+schedstats_add(struct schedstats *to, const struct schedstats *from)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	to->ss_runticks += from->ss_runticks;
+	to->ss_userticks += from->ss_userticks;
+	to->ss_waitticks += from->ss_waitticks;
+	to->ss_sleepticks += from->ss_sleepticks;
+	to->ss_nvcsw += from->ss_nvcsw;
+	to->ss_nivcsw += from->ss_nivcsw;
 }
 
 /*
- * Thread migration.
- *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
- *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
- *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * Print the per-cpu counters. These are read without locking, so
+ * they may be a tick or two stale.
  */
 void
-thread_consider_migration(void)
+thread_printstats(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
 	struct cpu *c;
-	struct threadlist victims;
-	struct thread *t;
+	unsigned i, numcpus;
 
-	my_count = total_count = 0;
+	kprintf("cpu      run     idle  skipped  switches  steals  queued\n");
 	numcpus = cpuarray_num(&allcpus);
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
-		}
-		spinlock_release(&c->c_runqueue_lock);
+		kprintf("%3u %8llu %8llu %8llu %9llu %7u %7u\n", c->c_number,
+			(unsigned long long)c->c_runticks,
+			(unsigned long long)c->c_idleticks,
+			(unsigned long long)c->c_skippedticks,
+			(unsigned long long)percpu_readcpu(c, PCPU_SWITCHES),
+			c->c_nsteals, c->c_runcount);
 	}
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
-		return;
-	}
-
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
-	}
-	spinlock_release(&curcpu->c_runqueue_lock);
-
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
+	if (schedgroups_used) {
+		kprintf("group  tickets     ticks       pass\n");
+		for (i=0; i<SCHED_NGROUPS; i++) {
+			if (schedgroups[i].sg_ticks == 0 &&
+			    schedgroups[i].sg_tickets == SCHED_TICKETS_DEFAULT) {
 				continue;
 			}
-
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
+			kprintf("%5u %8u %9u %10u\n", i,
+				schedgroups[i].sg_tickets,
+				schedgroups[i].sg_ticks,
+				schedgroups[i].sg_pass);
 		}
-		spinlock_release(&c->c_runqueue_lock);
 	}
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
-		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+#if OPT_SPINLOCKPROF
+	kprintf("cpu spinlocks  contended      spins  maxspins  maxhold"
+		"  (lock)\n");
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf("%3u %10u %10u %10llu %9u %8u  (%p)\n", c->c_number,
+			c->c_splk_acquires, c->c_splk_contended,
+			(unsigned long long)c->c_splk_spins,
+			c->c_splk_maxspins, c->c_splk_maxhold,
+			c->c_splk_maxholder);
 	}
-
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+#endif
 }
 
 ////////////////////////////////////////////////////////////
@@ -973,6 +2114,7 @@ wchan_create(const char *name)
 	}
 	threadlist_init(&wc->wc_threads);
 	wc->wc_name = name;
+	wc->wc_ordered = false;
 
 	return wc;
 }
@@ -988,6 +2130,16 @@ wchan_destroy(struct wchan *wc)
 	kfree(wc);
 }
 
+/*
+ * Keep WC's sleepers in priority order.
+ */
+void
+wchan_setordered(struct wchan *wc)
+{
+	KASSERT(threadlist_isempty(&wc->wc_threads));
+	wc->wc_ordered = true;
+}
+
 /*
  * Yield the cpu to another process, and go to sleep, on the specified
  * wait channel WC, whose associated spinlock is LK. Calling wakeup on
@@ -1007,10 +2159,70 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 	/* must not hold other spinlocks */
 	KASSERT(curcpu->c_spinlocks == 1);
 
+	/* Giving up the cpu earns a level; see schedule() */
+	if (curthread->t_prio > 0) {
+		curthread->t_prio--;
+		curthread->t_ticks = 0;
+	}
+
 	thread_switch(S_SLEEP, wc, lk);
 	spinlock_acquire(lk);
 }
 
+/*
+ * Timeout function for wchan_sleep_timeout; runs from hardclock.
+ * If the thread is still on the wchan, take it off and wake it.
+ * The thread can't leave wchan_sleep_timeout (and so t_timedlk
+ * can't change) until this returns; see timeout_cancel.
+ */
+static
+void
+wchan_timeout(void *vthread)
+{
+	struct thread *t = vthread;
+	struct spinlock *lk = t->t_timedlk;
+
+	spinlock_acquire(lk);
+	if (t->t_timedwc != NULL) {
+		threadlist_remove(&t->t_timedwc->wc_threads, t);
+		t->t_timedwc = NULL;
+		t->t_timedout = true;
+		thread_make_runnable(t, false);
+	}
+	spinlock_release(lk);
+}
+
+int
+wchan_sleep_timeout(struct wchan *wc, struct spinlock *lk, unsigned ticks)
+{
+	struct thread *cur = curthread;
+	bool timedout;
+
+	KASSERT(spinlock_do_i_hold(lk));
+	KASSERT(ticks > 0);
+
+	cur->t_timedwc = wc;
+	cur->t_timedlk = lk;
+	cur->t_timedout = false;
+	timeout_arm(&cur->t_timeout, ticks);
+
+	wchan_sleep(wc, lk);
+
+	/*
+	 * The timeout may be firing right now and need LK; let go of
+	 * it while we make sure it's finished.
+	 */
+	spinlock_release(lk);
+	timeout_cancel(&cur->t_timeout);
+	spinlock_acquire(lk);
+
+	KASSERT(cur->t_timedwc == NULL);
+	timedout = cur->t_timedout;
+	cur->t_timedlk = NULL;
+	cur->t_timedout = false;
+	return timedout ? ETIMEDOUT : 0;
+}
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
@@ -1028,6 +2240,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 		/* Nobody was sleeping. */
 		return;
 	}
+	target->t_timedwc = NULL;
 
 	/*
 	 * Note that thread_make_runnable acquires a runqueue lock
@@ -1048,31 +2261,70 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *target;
 	struct threadlist list;
+	struct cpu *mycpu;
 
 	KASSERT(spinlock_do_i_hold(lk));
 
 	threadlist_init(&list);
 
 	/*
-	 * Grab all the threads from the channel, moving them to a
-	 * private list.
+	 * Threads bound for other cpus go to their inboxes, which
+	 * costs no locks and at most one IPI per cpu. The ones for
+	 * this cpu are queued with its runqueue lock taken once.
 	 */
+	mycpu = curcpu->c_self;
 	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
-		threadlist_addtail(&list, target);
+		target->t_timedwc = NULL;
+		if (target->t_cpu != mycpu) {
+			thread_inbox_push(target->t_cpu, target);
+		}
+		else {
+			threadlist_addtail(&list, target);
+		}
 	}
 
-	/*
-	 * We could conceivably sort by cpu first to cause fewer lock
-	 * ops and fewer IPIs, but for now at least don't bother. Just
-	 * make each thread runnable.
-	 */
-	while ((target = threadlist_remhead(&list)) != NULL) {
-		thread_make_runnable(target, false);
+	if (!threadlist_isempty(&list)) {
+		spinlock_acquire(&mycpu->c_runqueue_lock);
+		while ((target = threadlist_remhead(&list)) != NULL) {
+			thread_place(mycpu, target);
+		}
+		thread_notify(mycpu);
+		spinlock_release(&mycpu->c_runqueue_lock);
 	}
 
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Move the threads sleeping on WC to TOWC without waking them. Timed
+ * sleepers are woken instead, as their timeouts know only WC.
+ */
+void
+wchan_requeue(struct wchan *wc, struct spinlock *lk,
+	      struct wchan *towc, struct spinlock *tolk)
+{
+	struct thread *target;
+
+	KASSERT(spinlock_do_i_hold(lk));
+	KASSERT(spinlock_do_i_hold(tolk));
+	KASSERT(wc != towc);
+
+	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
+		if (target->t_timedwc != NULL) {
+			target->t_timedwc = NULL;
+			thread_make_runnable(target, false);
+			continue;
+		}
+		target->t_wchan_name = towc->wc_name;
+		if (towc->wc_ordered) {
+			threadlist_addbylevel(&towc->wc_threads, target);
+		}
+		else {
+			threadlist_addtail(&towc->wc_threads, target);
+		}
+	}
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1095,16 +2347,31 @@ wchan_isempty(struct wchan *wc, struct spinlock *lk)
  */
 
 /*
- * Send an IPI (inter-processor interrupt) to the specified CPU.
+ * Post IPI number CODE to TARGET, whose IPI lock is held, interrupting
+ * it only if nothing was pending already: if something was, the
+ * interrupt for that hasn't been taken yet and will see this too.
  */
+static
 void
-ipi_send(struct cpu *target, int code)
+ipi_post(struct cpu *target, int code)
 {
 	KASSERT(code >= 0 && code < 32);
+	KASSERT(spinlock_do_i_hold(&target->c_ipi_lock));
 
-	spinlock_acquire(&target->c_ipi_lock);
+	if (target->c_ipi_pending == 0) {
+		mainbus_send_ipi(target);
+	}
 	target->c_ipi_pending |= (uint32_t)1 << code;
-	mainbus_send_ipi(target);
+}
+
+/*
+ * Send an IPI (inter-processor interrupt) to the specified CPU.
+ */
+void
+ipi_send(struct cpu *target, int code)
+{
+	spinlock_acquire(&target->c_ipi_lock);
+	ipi_post(target, code);
 	spinlock_release(&target->c_ipi_lock);
 }
 
@@ -1126,37 +2393,194 @@ ipi_broadcast(int code)
 }
 
 /*
- * Send a TLB shootdown IPI to the specified CPU.
+ * Cross-cpu calls.
+ *
+ * Each cpu has a small array of calls waiting for it, under its IPI
+ * lock, and they ride on IPI_CALL like any other IPI number, so any
+ * number of them, plus whatever else is pending, cost the target one
+ * interrupt. The target takes the whole batch at once and makes the
+ * calls after letting go of the lock. If the array is full the sender
+ * spins until there's room, making any calls queued for its own cpu
+ * meanwhile so that two cpus filling each other's can't deadlock.
  */
+
 void
-ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+smp_call_init(struct smp_call *call, void (*func)(void *), void *arg)
 {
-	unsigned n;
+	call->sc_func = func;
+	call->sc_arg = arg;
+	call->sc_left = 0;
+}
 
-	spinlock_acquire(&target->c_ipi_lock);
+/*
+ * Make the calls queued for the current cpu. Called with interrupts
+ * off and no IPI lock held.
+ */
+static
+void
+smp_call_run(void)
+{
+	struct smp_call *calls[SMP_CALL_MAX];
+	struct smp_call *call;
+	unsigned i, n;
 
-	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
-		/*
-		 * If you have problems with this panic going off,
-		 * consider: (1) increasing the maximum, (2) putting
-		 * logic here to sleep until space appears (may
-		 * interact awkwardly with VM system locking), (3)
-		 * putting logic here to coalesce requests together,
-		 * and/or (4) improving VM system state tracking to
-		 * reduce the number of unnecessary shootdowns.
-		 */
-		panic("ipi_tlbshootdown: Too many shootdowns queued\n");
+	spinlock_acquire(&curcpu->c_ipi_lock);
+	n = curcpu->c_ncalls;
+	for (i=0; i<n; i++) {
+		calls[i] = curcpu->c_calls[i];
 	}
-	else {
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n+1;
+	curcpu->c_ncalls = 0;
+	spinlock_release(&curcpu->c_ipi_lock);
+
+	for (i=0; i<n; i++) {
+		call = calls[i];
+		call->sc_func(call->sc_arg);
+		/* Our effects are visible before the caller sees us done */
+		membar_any_store();
+		atomic_fetchadd(&call->sc_left, -1);
 	}
+}
+
+void
+smp_call(struct cpu *target, struct smp_call *call)
+{
+	int spl;
 
-	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
-	mainbus_send_ipi(target);
+	atomic_fetchadd(&call->sc_left, 1);
+
+	spl = splhigh();
+	if (target == curcpu->c_self) {
+		call->sc_func(call->sc_arg);
+		membar_any_store();
+		atomic_fetchadd(&call->sc_left, -1);
+		splx(spl);
+		return;
+	}
 
+	/* Everything CALL points to must be visible before it is */
+	membar_any_store();
+	spinlock_acquire(&target->c_ipi_lock);
+	while (target->c_ncalls == SMP_CALL_MAX) {
+		spinlock_release(&target->c_ipi_lock);
+		smp_call_run();
+		spinlock_acquire(&target->c_ipi_lock);
+	}
+	target->c_calls[target->c_ncalls++] = call;
+	ipi_post(target, IPI_CALL);
 	spinlock_release(&target->c_ipi_lock);
+	splx(spl);
+}
+
+bool
+smp_call_done(const struct smp_call *call)
+{
+	return call->sc_left == 0;
+}
+
+/*
+ * Wait for CALL to have been made everywhere it was queued. Spin
+ * rather than sleep: each cpu answers within one interrupt. We must
+ * be able to take IPIs ourselves meanwhile.
+ */
+void
+smp_call_wait(struct smp_call *call)
+{
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(curcpu->c_spinlocks == 0);
+
+	while (!smp_call_done(call)) {
+		/* spin */
+	}
+	membar_load_load();
+}
+
+void
+smp_call_function(struct cpu *target, void (*func)(void *), void *arg)
+{
+	struct smp_call call;
+
+	smp_call_init(&call, func, arg);
+	smp_call(target, &call);
+	smp_call_wait(&call);
+}
+
+/*
+ * Call FUNC(ARG) on every cpu but this one, and wait. One call
+ * structure does for all of them.
+ */
+void
+smp_call_function_others(void (*func)(void *), void *arg)
+{
+	struct smp_call call;
+	struct cpu *c;
+	unsigned i;
+	int spl;
+
+	smp_call_init(&call, func, arg);
+	/* Stay put, so "this one" means the same cpu throughout */
+	spl = splhigh();
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self) {
+			smp_call(c, &call);
+		}
+	}
+	splx(spl);
+	smp_call_wait(&call);
+}
+
+/*
+ * TLB shootdowns are cross-cpu calls.
+ */
+struct shootdown_req {
+	const struct tlbshootdown *sr_mappings;
+	unsigned sr_n;
+};
+
+static
+void
+ipi_shootdown_call(void *vreq)
+{
+	struct shootdown_req *req = vreq;
+	unsigned i;
+
+	if (req->sr_n > TLBSHOOTDOWN_MAX) {
+		/* Too many to be worth doing one by one */
+		vm_tlbshootdown_all();
+		return;
+	}
+	for (i=0; i<req->sr_n; i++) {
+		vm_tlbshootdown(&req->sr_mappings[i]);
+	}
+}
+
+/*
+ * Carry out a TLB shootdown on the specified CPU.
+ */
+void
+ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+{
+	struct shootdown_req req;
+
+	req.sr_mappings = mapping;
+	req.sr_n = 1;
+	smp_call_function(target, ipi_shootdown_call, &req);
+}
+
+/*
+ * Send N shootdowns to every other CPU and wait for them to finish.
+ */
+void
+ipi_tlbshootdown_broadcast(const struct tlbshootdown *mappings, unsigned n)
+{
+	struct shootdown_req req;
+
+	if (n == 0) {
+		return;
+	}
+	req.sr_mappings = mappings;
+	req.sr_n = n;
+	smp_call_function_others(ipi_shootdown_call, &req);
 }
 
 /*
@@ -1166,7 +2590,6 @@ void
 interprocessor_interrupt(void)
 {
 	uint32_t bits;
-	unsigned i;
 
 	spinlock_acquire(&curcpu->c_ipi_lock);
 	bits = curcpu->c_ipi_pending;
@@ -1191,21 +2614,26 @@ interprocessor_interrupt(void)
 	if (bits & (1U << IPI_UNIDLE)) {
 		/*
 		 * The cpu has already unidled itself to take the
-		 * interrupt; don't need to do anything else.
+		 * interrupt; there may be threads in the inbox, which
+		 * are drained below, after letting go of the ipi lock
+		 * (thread_notify takes it the other way round).
 		 */
 	}
-	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
+	if (bits & (1U << IPI_RESCHED)) {
 		/*
-		 * Note: depending on your VM system locking you might
-		 * need to release the ipi lock while calling
-		 * vm_tlbshootdown.
+		 * The sender set c_preempt; thread_preemptcheck acts on
+		 * it once the interrupt is over.
 		 */
-		for (i=0; i<curcpu->c_numshootdown; i++) {
-			vm_tlbshootdown(&curcpu->c_shootdown[i]);
-		}
-		curcpu->c_numshootdown = 0;
 	}
-
 	curcpu->c_ipi_pending = 0;
 	spinlock_release(&curcpu->c_ipi_lock);
+
+	if (bits & (1U << IPI_UNIDLE)) {
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+		thread_inbox_drain();
+		spinlock_release(&curcpu->c_runqueue_lock);
+	}
+	if (bits & (1U << IPI_CALL)) {
+		smp_call_run();
+	}
 }
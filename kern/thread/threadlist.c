@@ -238,3 +238,24 @@ threadlist_remove(struct threadlist *tl, struct thread *t)
 	DEBUGASSERT(tl->tl_count > 0);
 	tl->tl_count--;
 }
+
+void
+threadlist_addbylevel(struct threadlist *tl, struct thread *t)
+{
+	struct threadlistnode *tln;
+	unsigned level;
+
+	DEBUGASSERT(tl != NULL);
+	DEBUGASSERT(t != NULL);
+
+	/* Search from the tail: usually everyone is at the same level */
+	level = thread_level(t);
+	for (tln = tl->tl_tail.tln_prev; tln != &tl->tl_head;
+	     tln = tln->tln_prev) {
+		if (thread_level(tln->tln_self) <= level) {
+			break;
+		}
+	}
+	threadlist_insertafternode(tln, t);
+	tl->tl_count++;
+}
@@ -0,0 +1,74 @@
+/*
+ * The time page. See timepage.h.
+ *
+ * Every ticking cpu updates the page from its hardclock, so one cpu
+ * being idle (with its timer off) doesn't leave it stale for the
+ * others; tp_lock keeps the writers in line, and readers never take
+ * it. Monotonic time is time of day less clock_boottime, since
+ * nothing sets the clock back, so it agrees with clock_monotonic_ns
+ * to within a tick.
+ */
+#include <types.h>
+#include <lib.h>
+#include <membar.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <vm.h>
+#include <timepage.h>
+
+static struct spinlock tp_lock = SPINLOCK_INITIALIZER;
+static struct timepage *tp_page;
+
+void
+timepage_update(void)
+{
+	struct timespec now, boot, mono;
+	struct timepage *tp;
+
+	tp = tp_page;
+	if (tp == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&tp_lock);
+	gettime(&now);
+	clock_boottime(&boot);
+	timespec_sub(&now, &boot, &mono);
+
+	tp->tp_seq++;
+	membar_store_store();
+	tp->tp_realsec = now.tv_sec;
+	tp->tp_realnsec = now.tv_nsec;
+	tp->tp_monosec = mono.tv_sec;
+	tp->tp_mononsec = mono.tv_nsec;
+	membar_store_store();
+	tp->tp_seq++;
+	spinlock_release(&tp_lock);
+}
+
+paddr_t
+timepage_paddr(void)
+{
+	KASSERT(tp_page != NULL);
+	return KVADDR_TO_PADDR((vaddr_t)tp_page);
+}
+
+void
+timepage_bootstrap(void)
+{
+	struct timepage *tp;
+	vaddr_t va;
+
+	COMPILE_ASSERT(sizeof(struct timepage) <= PAGE_SIZE);
+
+	va = alloc_kpages(1);
+	if (va == 0) {
+		panic("timepage_bootstrap: Out of memory\n");
+	}
+	tp = (struct timepage *)va;
+	bzero(tp, PAGE_SIZE);
+
+	membar_store_store();
+	tp_page = tp;
+	timepage_update();
+}
@@ -0,0 +1,312 @@
+/*
+ * Work queues. See workqueue.h.
+ *
+ * Each cpu has its own list of queued work and its own worker, which
+ * sleeps on the cpu's wchan while the list is empty. A single
+ * spinlock per queue covers all the lists; work functions run with it
+ * released.
+ *
+ * Flushing queues a barrier on each cpu's list in turn and waits for
+ * it to run. Lists are run in order, so by then everything ahead of
+ * it has finished.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <workqueue.h>
+
+struct wqcpu {
+	struct work *wc_head;		/* queued work, oldest first */
+	struct work **wc_tail;
+	struct wchan *wc_wchan;		/* worker sleeps here */
+	bool wc_haveworker;
+};
+
+struct workqueue {
+	char *wq_name;
+	struct spinlock wq_lock;
+	struct wchan *wq_waitwchan;	/* flush and destroy wait here */
+	bool wq_dying;
+	unsigned wq_nworkers;
+	unsigned wq_ncpus;
+	struct wqcpu wq_cpus[];
+};
+
+/* A flush marker; see workqueue_flush. */
+struct wqbarrier {
+	struct work wb_work;
+	struct workqueue *wb_wq;
+	bool wb_done;
+};
+
+struct workqueue *sysworkq;
+
+void
+work_init(struct work *w, void (*func)(void *), void *arg)
+{
+	w->w_next = NULL;
+	w->w_func = func;
+	w->w_arg = arg;
+	w->w_queued = false;
+	w->w_cpu = 0;
+}
+
+/*
+ * Put W on cpu CPU's list. Call with the lock held.
+ */
+static
+void
+workqueue_add(struct workqueue *wq, unsigned cpu, struct work *w)
+{
+	struct wqcpu *wc = &wq->wq_cpus[cpu];
+	bool wasempty;
+
+	KASSERT(spinlock_do_i_hold(&wq->wq_lock));
+	KASSERT(wc->wc_haveworker);
+
+	wasempty = wc->wc_head == NULL;
+	w->w_next = NULL;
+	*wc->wc_tail = w;
+	wc->wc_tail = &w->w_next;
+	w->w_queued = true;
+	w->w_cpu = cpu;
+	if (wasempty) {
+		wchan_wakeone(wc->wc_wchan, &wq->wq_lock);
+	}
+}
+
+/*
+ * A worker. DATA2 is its cpu number.
+ */
+static
+void
+workqueue_worker(void *data1, unsigned long data2)
+{
+	struct workqueue *wq = data1;
+	struct wqcpu *wc = &wq->wq_cpus[data2];
+	struct work *w;
+
+	spinlock_acquire(&wq->wq_lock);
+	while (1) {
+		while (wc->wc_head == NULL && !wq->wq_dying) {
+			wchan_sleep(wc->wc_wchan, &wq->wq_lock);
+		}
+		w = wc->wc_head;
+		if (w == NULL) {
+			/* Dying, and nothing left */
+			break;
+		}
+		wc->wc_head = w->w_next;
+		if (wc->wc_head == NULL) {
+			wc->wc_tail = &wc->wc_head;
+		}
+		/* From here on it can be queued again */
+		w->w_queued = false;
+		spinlock_release(&wq->wq_lock);
+
+		w->w_func(w->w_arg);
+
+		spinlock_acquire(&wq->wq_lock);
+	}
+
+	KASSERT(wq->wq_nworkers > 0);
+	wq->wq_nworkers--;
+	wchan_wakeall(wq->wq_waitwchan, &wq->wq_lock);
+	spinlock_release(&wq->wq_lock);
+}
+
+static
+void
+workqueue_free(struct workqueue *wq)
+{
+	unsigned i;
+
+	for (i=0; i<wq->wq_ncpus; i++) {
+		if (wq->wq_cpus[i].wc_wchan != NULL) {
+			wchan_destroy(wq->wq_cpus[i].wc_wchan);
+		}
+	}
+	if (wq->wq_waitwchan != NULL) {
+		wchan_destroy(wq->wq_waitwchan);
+	}
+	spinlock_cleanup(&wq->wq_lock);
+	kfree(wq->wq_name);
+	kfree(wq);
+}
+
+struct workqueue *
+workqueue_create(const char *name)
+{
+	struct workqueue *wq;
+	struct wqcpu *wc;
+	unsigned i, ncpus;
+	int result;
+
+	ncpus = thread_numcpus();
+	wq = kmalloc(sizeof(*wq) + ncpus * sizeof(struct wqcpu));
+	if (wq == NULL) {
+		return NULL;
+	}
+	spinlock_init(&wq->wq_lock);
+	wq->wq_dying = false;
+	wq->wq_nworkers = 0;
+	wq->wq_ncpus = ncpus;
+	wq->wq_name = kstrdup(name);
+	wq->wq_waitwchan = wchan_create(name);
+	for (i=0; i<ncpus; i++) {
+		wc = &wq->wq_cpus[i];
+		wc->wc_head = NULL;
+		wc->wc_tail = &wc->wc_head;
+		wc->wc_wchan = wchan_create(name);
+		wc->wc_haveworker = false;
+	}
+	if (wq->wq_name == NULL || wq->wq_waitwchan == NULL) {
+		workqueue_free(wq);
+		return NULL;
+	}
+
+	for (i=0; i<ncpus; i++) {
+		wc = &wq->wq_cpus[i];
+		if (wc->wc_wchan == NULL) {
+			continue;
+		}
+		result = thread_fork_bound(name, i, workqueue_worker, wq, i);
+		if (result) {
+			continue;
+		}
+		spinlock_acquire(&wq->wq_lock);
+		wc->wc_haveworker = true;
+		wq->wq_nworkers++;
+		spinlock_release(&wq->wq_lock);
+	}
+
+	/* Work for cpus without a worker goes to another cpu. */
+	if (wq->wq_nworkers == 0) {
+		workqueue_free(wq);
+		return NULL;
+	}
+	return wq;
+}
+
+void
+workqueue_destroy(struct workqueue *wq)
+{
+	unsigned i;
+
+	workqueue_flush(wq);
+
+	spinlock_acquire(&wq->wq_lock);
+	wq->wq_dying = true;
+	for (i=0; i<wq->wq_ncpus; i++) {
+		wchan_wakeall(wq->wq_cpus[i].wc_wchan, &wq->wq_lock);
+	}
+	while (wq->wq_nworkers > 0) {
+		wchan_sleep(wq->wq_waitwchan, &wq->wq_lock);
+	}
+	spinlock_release(&wq->wq_lock);
+
+	workqueue_free(wq);
+}
+
+bool
+workqueue_queue(struct workqueue *wq, struct work *w)
+{
+	return workqueue_queueon(wq, w, curcpu->c_number);
+}
+
+bool
+workqueue_queueon(struct workqueue *wq, struct work *w, unsigned cpu)
+{
+	spinlock_acquire(&wq->wq_lock);
+	KASSERT(!wq->wq_dying);
+	if (w->w_queued) {
+		spinlock_release(&wq->wq_lock);
+		return false;
+	}
+	if (cpu >= wq->wq_ncpus || !wq->wq_cpus[cpu].wc_haveworker) {
+		for (cpu = 0; !wq->wq_cpus[cpu].wc_haveworker; cpu++) {
+			/* the first one that has a worker */
+		}
+	}
+	workqueue_add(wq, cpu, w);
+	spinlock_release(&wq->wq_lock);
+	return true;
+}
+
+bool
+workqueue_cancel(struct workqueue *wq, struct work *w)
+{
+	struct wqcpu *wc;
+	struct work **pp, *prev;
+
+	spinlock_acquire(&wq->wq_lock);
+	if (!w->w_queued) {
+		spinlock_release(&wq->wq_lock);
+		return false;
+	}
+	wc = &wq->wq_cpus[w->w_cpu];
+	prev = NULL;
+	for (pp = &wc->wc_head; *pp != w; pp = &(*pp)->w_next) {
+		KASSERT(*pp != NULL);
+		prev = *pp;
+	}
+	*pp = w->w_next;
+	if (wc->wc_tail == &w->w_next) {
+		wc->wc_tail = prev != NULL ? &prev->w_next : &wc->wc_head;
+	}
+	w->w_queued = false;
+	spinlock_release(&wq->wq_lock);
+	return true;
+}
+
+static
+void
+workqueue_barrier(void *arg)
+{
+	struct wqbarrier *wb = arg;
+	struct workqueue *wq = wb->wb_wq;
+
+	spinlock_acquire(&wq->wq_lock);
+	wb->wb_done = true;
+	wchan_wakeall(wq->wq_waitwchan, &wq->wq_lock);
+	spinlock_release(&wq->wq_lock);
+}
+
+void
+workqueue_flush(struct workqueue *wq)
+{
+	struct wqbarrier wb;
+	unsigned i;
+
+	KASSERT(curthread->t_in_interrupt == false);
+
+	work_init(&wb.wb_work, workqueue_barrier, &wb);
+	wb.wb_wq = wq;
+
+	spinlock_acquire(&wq->wq_lock);
+	for (i=0; i<wq->wq_ncpus; i++) {
+		if (!wq->wq_cpus[i].wc_haveworker) {
+			continue;
+		}
+		wb.wb_done = false;
+		workqueue_add(wq, i, &wb.wb_work);
+		while (!wb.wb_done) {
+			wchan_sleep(wq->wq_waitwchan, &wq->wq_lock);
+		}
+	}
+	spinlock_release(&wq->wq_lock);
+}
+
+void
+workqueue_bootstrap(void)
+{
+	sysworkq = workqueue_create("sysworkq");
+	if (sysworkq == NULL) {
+		panic("workqueue_bootstrap: Out of memory\n");
+	}
+}
@@ -225,6 +225,22 @@ dev_isseekable(struct vnode *v)
 	return true;
 }
 
+/*
+ * Check for readiness, if the device can block.
+ */
+static
+int
+dev_poll(struct vnode *v, int events, struct pollset *ps, int *result)
+{
+	struct device *d = v->vn_data;
+
+	if (d->d_ops->devop_poll == NULL) {
+		return vop_poll_ready(v, events, ps, result);
+	}
+	*result = DEVOP_POLL(d, events, ps);
+	return 0;
+}
+
 /*
  * For fsync() - meaningless, do nothing.
  */
@@ -237,15 +253,18 @@ null_fsync(struct vnode *v)
 }
 
 /*
- * For mmap. If you want this to do anything, you have to write it
- * yourself. Some devices may not make sense to map. Others do.
+ * For mmap. Only devices that say how can be mapped.
  */
 static
 int
-dev_mmap(struct vnode *v  /* add stuff as needed */)
+dev_mmap(struct vnode *v, bool *anon)
 {
-	(void)v;
-	return ENOSYS;
+	struct device *d = v->vn_data;
+
+	if (d->d_ops->devop_mmap == NULL) {
+		return ENODEV;
+	}
+	return DEVOP_MMAP(d, anon);
 }
 
 /*
@@ -330,11 +349,14 @@ static const struct vnode_ops dev_vnode_ops = {
 	.vop_read = dev_read,
 	.vop_readlink = vopfail_uio_inval,
 	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirplus = vopfail_uio_notdir,
+	.vop_getdents = vopfail_uio_notdir,
 	.vop_write = dev_write,
 	.vop_ioctl = dev_ioctl,
 	.vop_stat = dev_stat,
 	.vop_gettype = dev_gettype,
 	.vop_isseekable = dev_isseekable,
+	.vop_poll = dev_poll,
 	.vop_fsync = null_fsync,
 	.vop_mmap = dev_mmap,
 	.vop_truncate = dev_truncate,
@@ -0,0 +1,133 @@
+/*
+ * The stats device, "stats:", which reads as a text table of the
+ * per-cpu event counters (see percpu.h), one counter per line:
+ *
+ *    name total cpu0 cpu1 ...
+ *
+ * The table is made afresh on every read, so a reader that wants a
+ * consistent snapshot should read it in one go. Nothing is counted
+ * or locked on behalf of the reader, so watching the counters costs
+ * the code being watched nothing.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <uio.h>
+#include <thread.h>
+#include <percpu.h>
+#include <vfs.h>
+#include <device.h>
+
+/* Room for one number and the space before it */
+#define STATS_NUMLEN	21
+/* Room for a counter's name */
+#define STATS_NAMELEN	16
+
+/* For open() */
+static
+int
+statsopen(struct device *dev, int openflags)
+{
+	(void)dev;
+
+	if ((openflags & O_ACCMODE) != O_RDONLY) {
+		return EINVAL;
+	}
+	return 0;
+}
+
+/* For d_io() */
+static
+int
+statsio(struct device *dev, struct uio *uio)
+{
+	enum percpu_counter which;
+	unsigned i, ncpus;
+	size_t size, len;
+	char *buf;
+	int result;
+
+	(void)dev;
+
+	if (uio->uio_rw == UIO_WRITE) {
+		return EINVAL;
+	}
+
+	ncpus = thread_numcpus();
+	size = PCPU_NCOUNTERS * (STATS_NAMELEN + (ncpus + 1) * STATS_NUMLEN
+				 + 1) + 1;
+	buf = kmalloc(size);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	len = 0;
+	for (which = 0; which < PCPU_NCOUNTERS; which++) {
+		len += snprintf(buf + len, size - len, "%-*s %llu",
+				STATS_NAMELEN - 1, percpu_name(which),
+				(unsigned long long)percpu_read(which));
+		for (i=0; i<ncpus; i++) {
+			len += snprintf(buf + len, size - len, " %llu",
+				(unsigned long long)
+				percpu_readcpu(thread_getcpu(i), which));
+		}
+		len += snprintf(buf + len, size - len, "\n");
+	}
+	KASSERT(len < size);
+
+	result = 0;
+	if (uio->uio_offset < (off_t)len) {
+		result = uiomove(buf + uio->uio_offset,
+				 len - uio->uio_offset, uio);
+	}
+	kfree(buf);
+	return result;
+}
+
+/* For ioctl() */
+static
+int
+statsioctl(struct device *dev, int op, userptr_t data)
+{
+	(void)dev;
+	(void)op;
+	(void)data;
+
+	return EINVAL;
+}
+
+static const struct device_ops stats_devops = {
+	.devop_eachopen = statsopen,
+	.devop_io = statsio,
+	.devop_ioctl = statsioctl,
+};
+
+/*
+ * Function to create and attach stats:
+ */
+void
+devstats_create(void)
+{
+	int result;
+	struct device *dev;
+
+	dev = kmalloc(sizeof(*dev));
+	if (dev==NULL) {
+		panic("Could not add stats device: out of memory\n");
+	}
+
+	dev->d_ops = &stats_devops;
+
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+
+	dev->d_devnumber = 0; /* assigned by vfs_adddev */
+
+	dev->d_data = NULL;
+
+	result = vfs_adddev("stats", dev, 0);
+	if (result) {
+		panic("Could not add stats device: %s\n", strerror(result));
+	}
+}
@@ -0,0 +1,535 @@
+/*
+ * Striped volumes, "stripe0", "stripe1", ..., made from several disks
+ * with the same block size, and mountable like a disk.
+ *
+ * The volume is cut into chunks of st_chunk blocks dealt round the
+ * members in turn: chunk C is chunk C / ndevs of member C % ndevs. A
+ * request is split at chunk boundaries and all the pieces are queued
+ * on the members at once with devop_strategy, so a transfer of
+ * several chunks keeps every disk busy, and requests for different
+ * chunks that are in flight together (read-ahead, write-back) tend to
+ * land on different disks.
+ *
+ * Ordering (DR_ORDERED, DR_BARRIER) has to hold across the members,
+ * which each only know their own queue, so it's kept here: requests
+ * pass through an iosched of the stripe's own, which holds back any
+ * whose turn hasn't come, and the pieces go to the members unordered.
+ *
+ * The members are taken with vfs_claimdev so that nothing else can
+ * mount them or swap on them. A stripe lasts until shutdown; it keeps
+ * no label on the disks, so it has to be made again, with the same
+ * disks in the same order and the same chunk size, after a reboot.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <vfs.h>
+#include <device.h>
+#include <iosched.h>
+#include <iostat.h>
+
+/* Transfers from user memory go through a bounce buffer this big */
+#define STRIPE_BOUNCESIZE	32768
+
+struct stripe_softc {
+	struct device st_dev;
+	unsigned st_ndevs;
+	struct device **st_devs;	/* the members, in order */
+	uint32_t st_chunk;		/* blocks per chunk */
+	struct spinlock st_lock;	/* for the pieces and st_wchan */
+	struct wchan *st_wchan;		/* for synchronous I/O */
+	struct iosched *st_sched;	/* holds requests for ordering */
+	struct iostat *st_stats;
+};
+
+/* The part of a request that goes to one member */
+struct stripe_piece {
+	struct devreq sp_req;
+	struct device *sp_dev;
+};
+
+/*
+ * One request in flight: the caller's, and the pieces it was split
+ * into. si_gate stands in for the caller's request in st_sched.
+ * si_left counts pieces not yet done.
+ */
+struct stripe_io {
+	struct devreq si_gate;
+	struct stripe_softc *si_st;
+	struct devreq *si_req;
+	unsigned si_npieces;
+	unsigned si_left;
+	int si_result;
+	struct stripe_piece si_pieces[];
+};
+
+/* Names handed out so far; stripes are only made from the menu */
+static unsigned stripe_count;
+
+/* For open() */
+static
+int
+stripe_eachopen(struct device *d, int openflags)
+{
+	(void)d;
+	(void)openflags;
+
+	return 0;
+}
+
+/* For ioctl() */
+static
+int
+stripe_ioctl(struct device *d, int op, userptr_t data)
+{
+	(void)d;
+	(void)op;
+	(void)data;
+
+	return EIOCTL;
+}
+
+static void stripe_kick(struct stripe_softc *st);
+
+/*
+ * Finish the caller's request, and start anything that was waiting
+ * for it. (kfree only takes spinlocks, so is all right in an
+ * interrupt handler.)
+ */
+static
+void
+stripe_finish(struct stripe_io *si)
+{
+	struct stripe_softc *st = si->si_st;
+	struct devreq *req = si->si_req;
+
+	req->dr_result = si->si_result;
+	if (req->dr_nblocks > 0) {
+		iostat_done(st->st_stats, req->dr_write,
+			    req->dr_nblocks * st->st_dev.d_blocksize,
+			    req->dr_started);
+	}
+	iosched_done(st->st_sched, &si->si_gate);
+	kfree(si);
+	req->dr_done(req);
+	stripe_kick(st);
+}
+
+/*
+ * Called when a piece is done, probably in a member's interrupt
+ * handler. The last one finishes the caller's request.
+ */
+static
+void
+stripe_piecedone(struct devreq *preq)
+{
+	struct stripe_io *si = preq->dr_donedata;
+	struct stripe_softc *st = si->si_st;
+	bool last;
+
+	spinlock_acquire(&st->st_lock);
+	if (preq->dr_result != 0 && si->si_result == 0) {
+		si->si_result = preq->dr_result;
+	}
+	KASSERT(si->si_left > 0);
+	si->si_left--;
+	last = si->si_left == 0;
+	spinlock_release(&st->st_lock);
+
+	if (last) {
+		stripe_finish(si);
+	}
+}
+
+/*
+ * Queue the pieces of a request on the members.
+ *
+ * Once they're going, an error from a member is reported through
+ * dr_done like an I/O error, since the caller's request is partly
+ * under way.
+ */
+static
+void
+stripe_dispatch(struct stripe_io *si)
+{
+	struct stripe_piece *sp;
+	unsigned i, npieces = si->si_npieces;
+	int result;
+
+	if (npieces == 0) {
+		/* A flush; its turn coming is all it needed */
+		stripe_finish(si);
+		return;
+	}
+
+	/*
+	 * Nothing of SI may be touched once the last piece is queued;
+	 * it may already be done and freed.
+	 */
+	for (i = 0; i < npieces; i++) {
+		sp = &si->si_pieces[i];
+		result = DEVOP_STRATEGY(sp->sp_dev, &sp->sp_req);
+		if (result) {
+			sp->sp_req.dr_result = result;
+			stripe_piecedone(&sp->sp_req);
+		}
+	}
+}
+
+/*
+ * Send off every request st_sched will let go.
+ */
+static
+void
+stripe_kick(struct stripe_softc *st)
+{
+	struct devreq *gate;
+
+	while ((gate = iosched_next(st->st_sched)) != NULL) {
+		stripe_dispatch(gate->dr_donedata);
+	}
+}
+
+/*
+ * Queue a request: split it into pieces, and send them off as soon as
+ * its ordering allows, which is usually at once.
+ */
+static
+int
+stripe_strategy(struct device *d, struct devreq *req)
+{
+	struct stripe_softc *st = d->d_data;
+	struct stripe_io *si;
+	struct stripe_piece *sp;
+	uint32_t block, left, chunk, n;
+	unsigned npieces, i;
+	char *data;
+
+	/* Don't allow I/O past the end of the volume. */
+	if (req->dr_block > st->st_dev.d_blocks ||
+	    req->dr_nblocks > st->st_dev.d_blocks - req->dr_block) {
+		return EINVAL;
+	}
+
+	if (req->dr_nblocks == 0) {
+		if (req->dr_flags == 0) {
+			req->dr_result = 0;
+			req->dr_done(req);
+			return 0;
+		}
+		/* A flush; it has to wait its turn */
+		npieces = 0;
+	}
+	else {
+		npieces = (req->dr_block + req->dr_nblocks - 1) /
+			st->st_chunk - req->dr_block / st->st_chunk + 1;
+	}
+	si = kmalloc(sizeof(*si) + npieces * sizeof(si->si_pieces[0]));
+	if (si == NULL) {
+		return ENOMEM;
+	}
+	si->si_gate.dr_block = req->dr_block;
+	si->si_gate.dr_nblocks = req->dr_nblocks;
+	si->si_gate.dr_data = NULL;
+	si->si_gate.dr_write = req->dr_write;
+	si->si_gate.dr_flags = req->dr_flags;
+	si->si_gate.dr_tag = req->dr_tag;
+	si->si_gate.dr_done = NULL;
+	si->si_gate.dr_donedata = si;
+	si->si_st = st;
+	si->si_req = req;
+	si->si_npieces = npieces;
+	si->si_left = npieces;
+	si->si_result = 0;
+	if (npieces > 0) {
+		req->dr_started = iostat_start(st->st_stats);
+	}
+
+	block = req->dr_block;
+	left = req->dr_nblocks;
+	data = req->dr_data;
+	for (i = 0; i < npieces; i++) {
+		chunk = block / st->st_chunk;
+		n = st->st_chunk - block % st->st_chunk;
+		if (n > left) {
+			n = left;
+		}
+
+		sp = &si->si_pieces[i];
+		sp->sp_dev = st->st_devs[chunk % st->st_ndevs];
+		sp->sp_req.dr_block = (chunk / st->st_ndevs) * st->st_chunk
+			+ block % st->st_chunk;
+		sp->sp_req.dr_nblocks = n;
+		sp->sp_req.dr_data = data;
+		sp->sp_req.dr_write = req->dr_write;
+		sp->sp_req.dr_flags = 0;
+		sp->sp_req.dr_tag = 0;
+		sp->sp_req.dr_done = stripe_piecedone;
+		sp->sp_req.dr_donedata = si;
+
+		block += n;
+		left -= n;
+		data += n * st->st_dev.d_blocksize;
+	}
+	KASSERT(left == 0);
+
+	iosched_add(st->st_sched, &si->si_gate);
+	stripe_kick(st);
+	return 0;
+}
+
+/*
+ * Synchronous I/O, on top of stripe_strategy.
+ */
+struct stripe_syncreq {
+	struct devreq sr_req;
+	struct stripe_softc *sr_st;
+	bool sr_done;
+};
+
+static
+void
+stripe_syncdone(struct devreq *req)
+{
+	struct stripe_syncreq *sr = req->dr_donedata;
+	struct stripe_softc *st = sr->sr_st;
+
+	spinlock_acquire(&st->st_lock);
+	sr->sr_done = true;
+	wchan_wakeall(st->st_wchan, &st->st_lock);
+	spinlock_release(&st->st_lock);
+}
+
+static
+int
+stripe_syncio(struct stripe_softc *st, uint32_t block, uint32_t nblocks,
+	      void *data, bool write)
+{
+	struct stripe_syncreq sr;
+	int result;
+
+	sr.sr_req.dr_block = block;
+	sr.sr_req.dr_nblocks = nblocks;
+	sr.sr_req.dr_data = data;
+	sr.sr_req.dr_write = write;
+	sr.sr_req.dr_flags = 0;
+	sr.sr_req.dr_tag = 0;
+	sr.sr_req.dr_done = stripe_syncdone;
+	sr.sr_req.dr_donedata = &sr;
+	sr.sr_st = st;
+	sr.sr_done = false;
+
+	result = stripe_strategy(&st->st_dev, &sr.sr_req);
+	if (result) {
+		return result;
+	}
+
+	spinlock_acquire(&st->st_lock);
+	while (!sr.sr_done) {
+		wchan_sleep(st->st_wchan, &st->st_lock);
+	}
+	spinlock_release(&st->st_lock);
+
+	return sr.sr_req.dr_result;
+}
+
+/*
+ * I/O function (for both reads and writes), as for lhd: a kernel
+ * buffer is handed down directly, anything else is bounced.
+ */
+static
+int
+stripe_io(struct device *d, struct uio *uio)
+{
+	struct stripe_softc *st = d->d_data;
+	blksize_t bsize = st->st_dev.d_blocksize;
+	uint32_t block = uio->uio_offset / bsize;
+	bool write = uio->uio_rw == UIO_WRITE;
+	struct iovec *iov;
+	size_t len, bouncesize;
+	char *buf;
+	int result;
+
+	/* Don't allow I/O that isn't block-aligned. */
+	if (uio->uio_offset % bsize != 0 || uio->uio_resid % bsize != 0) {
+		return EINVAL;
+	}
+
+	if (uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1 &&
+	    uio->uio_iov->iov_len == uio->uio_resid) {
+		iov = uio->uio_iov;
+		len = uio->uio_resid;
+		result = stripe_syncio(st, block, len / bsize,
+				       iov->iov_kbase, write);
+		if (result) {
+			return result;
+		}
+		iov->iov_kbase = (char *)iov->iov_kbase + len;
+		iov->iov_len = 0;
+		uio->uio_offset += len;
+		uio->uio_resid = 0;
+		return 0;
+	}
+
+	bouncesize = STRIPE_BOUNCESIZE - STRIPE_BOUNCESIZE % bsize;
+	if (bouncesize == 0) {
+		bouncesize = bsize;
+	}
+	buf = kmalloc(bouncesize);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	result = 0;
+	while (uio->uio_resid > 0) {
+		len = uio->uio_resid;
+		if (len > bouncesize) {
+			len = bouncesize;
+		}
+		if (write) {
+			result = uiomove(buf, len, uio);
+			if (result) {
+				break;
+			}
+		}
+		result = stripe_syncio(st, block, len / bsize, buf, write);
+		if (result) {
+			break;
+		}
+		if (!write) {
+			result = uiomove(buf, len, uio);
+			if (result) {
+				break;
+			}
+		}
+		block += len / bsize;
+	}
+
+	kfree(buf);
+	return result;
+}
+
+static const struct device_ops stripe_devops = {
+	.devop_eachopen = stripe_eachopen,
+	.devop_io = stripe_io,
+	.devop_ioctl = stripe_ioctl,
+	.devop_strategy = stripe_strategy,
+};
+
+/*
+ * Make a stripe of the NDEVS disks named in DEVNAMES, CHUNK blocks
+ * at a time, and attach it as the next stripeN.
+ */
+int
+devstripe_create(unsigned ndevs, char **devnames, uint32_t chunk)
+{
+	struct stripe_softc *st;
+	struct device *dev;
+	char name[16];
+	blkcnt_t memblocks;
+	unsigned i, nclaimed;
+	int result;
+
+	if (ndevs < 2 || chunk == 0) {
+		return EINVAL;
+	}
+
+	st = kmalloc(sizeof(*st));
+	if (st == NULL) {
+		return ENOMEM;
+	}
+	st->st_devs = kmalloc(ndevs * sizeof(st->st_devs[0]));
+	if (st->st_devs == NULL) {
+		kfree(st);
+		return ENOMEM;
+	}
+	st->st_ndevs = ndevs;
+	st->st_chunk = chunk;
+	snprintf(name, sizeof(name), "stripe%u", stripe_count);
+
+	/* Take the members, checking that they go together. */
+	memblocks = 0;
+	for (nclaimed = 0; nclaimed < ndevs; nclaimed++) {
+		result = vfs_claimdev(devnames[nclaimed], &dev);
+		if (result) {
+			kprintf("%s: %s: %s\n", name, devnames[nclaimed],
+				strerror(result));
+			goto fail;
+		}
+		st->st_devs[nclaimed] = dev;
+		if (dev->d_ops->devop_strategy == NULL ||
+		    dev->d_blocksize != st->st_devs[0]->d_blocksize) {
+			kprintf("%s: %s: %s\n", name, devnames[nclaimed],
+				dev->d_ops->devop_strategy == NULL ?
+				"can't queue I/O" : "different block size");
+			nclaimed++;
+			result = EINVAL;
+			goto fail;
+		}
+		if (nclaimed == 0 || dev->d_blocks < memblocks) {
+			memblocks = dev->d_blocks;
+		}
+	}
+
+	/* Each member holds only whole chunks */
+	memblocks -= memblocks % chunk;
+	if (memblocks == 0) {
+		kprintf("%s: disks smaller than one chunk\n", name);
+		result = EINVAL;
+		goto fail;
+	}
+
+	spinlock_init(&st->st_lock);
+	st->st_wchan = wchan_create(name);
+	if (st->st_wchan == NULL) {
+		spinlock_cleanup(&st->st_lock);
+		result = ENOMEM;
+		goto fail;
+	}
+	st->st_sched = iosched_create(name);
+	if (st->st_sched == NULL) {
+		wchan_destroy(st->st_wchan);
+		spinlock_cleanup(&st->st_lock);
+		result = ENOMEM;
+		goto fail;
+	}
+	st->st_stats = iostat_create(name);
+	if (st->st_stats == NULL) {
+		iosched_destroy(st->st_sched);
+		wchan_destroy(st->st_wchan);
+		spinlock_cleanup(&st->st_lock);
+		result = ENOMEM;
+		goto fail;
+	}
+
+	st->st_dev.d_ops = &stripe_devops;
+	st->st_dev.d_blocks = memblocks * ndevs;
+	st->st_dev.d_blocksize = st->st_devs[0]->d_blocksize;
+	st->st_dev.d_devnumber = 0; /* assigned by vfs_adddev */
+	st->st_dev.d_data = st;
+
+	result = vfs_adddev(name, &st->st_dev, 1);
+	if (result) {
+		iostat_destroy(st->st_stats);
+		iosched_destroy(st->st_sched);
+		wchan_destroy(st->st_wchan);
+		spinlock_cleanup(&st->st_lock);
+		goto fail;
+	}
+	stripe_count++;
+
+	kprintf("%s: %u disks, %u blocks per chunk, %llu blocks\n", name,
+		ndevs, chunk, (unsigned long long)st->st_dev.d_blocks);
+	return 0;
+
+ fail:
+	for (i = 0; i < nclaimed; i++) {
+		vfs_releasedev(devnames[i]);
+	}
+	kfree(st->st_devs);
+	kfree(st);
+	return result;
+}
@@ -0,0 +1,99 @@
+/*
+ * The zero device, "zero:", which reads as an endless run of zero
+ * bytes and throws away anything written to it.
+ *
+ * Mapping it gives plain zero-filled memory, the same as MAP_ANON,
+ * so it costs nothing until touched and the pages come from the VM
+ * system's ordinary zero-fill path rather than from reads.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+
+/* For open() */
+static
+int
+zeroopen(struct device *dev, int openflags)
+{
+	(void)dev;
+	(void)openflags;
+
+	return 0;
+}
+
+/* For d_io() */
+static
+int
+zeroio(struct device *dev, struct uio *uio)
+{
+	(void)dev;
+
+	/* As with null:, writes go nowhere */
+	if (uio->uio_rw == UIO_WRITE) {
+		uio->uio_resid = 0;
+		return 0;
+	}
+	return uiomovezeros(uio->uio_resid, uio);
+}
+
+/* For ioctl() */
+static
+int
+zeroioctl(struct device *dev, int op, userptr_t data)
+{
+	(void)dev;
+	(void)op;
+	(void)data;
+
+	return EINVAL;
+}
+
+/* For mmap() */
+static
+int
+zerommap(struct device *dev, bool *anon)
+{
+	(void)dev;
+
+	*anon = true;
+	return 0;
+}
+
+static const struct device_ops zero_devops = {
+	.devop_eachopen = zeroopen,
+	.devop_io = zeroio,
+	.devop_ioctl = zeroioctl,
+	.devop_mmap = zerommap,
+};
+
+/*
+ * Function to create and attach zero:
+ */
+void
+devzero_create(void)
+{
+	int result;
+	struct device *dev;
+
+	dev = kmalloc(sizeof(*dev));
+	if (dev==NULL) {
+		panic("Could not add zero device: out of memory\n");
+	}
+
+	dev->d_ops = &zero_devops;
+
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+
+	dev->d_devnumber = 0; /* assigned by vfs_adddev */
+
+	dev->d_data = NULL;
+
+	result = vfs_adddev("zero", dev, 0);
+	if (result) {
+		panic("Could not add zero device: %s\n", strerror(result));
+	}
+}
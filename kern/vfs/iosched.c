@@ -0,0 +1,422 @@
+/*
+ * I/O schedulers. See iosched.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <device.h>
+#include <iosched.h>
+
+struct iosched_policy {
+	const char *ip_name;
+	/* Put REQ on the queue */
+	void (*ip_add)(struct iosched *ios, struct devreq *req);
+	/* Take the next request off the queue */
+	struct devreq *(*ip_next)(struct iosched *ios);
+};
+
+/* Tags share this many slots; see DR_ORDERED in device.h */
+#define IOSCHED_NTAGS	32
+#define IOSCHED_TAGSLOT(tag)	((tag) % IOSCHED_NTAGS)
+
+
+struct iosched {
+	char ios_name[16];
+	struct spinlock ios_lock;
+	const struct iosched_policy *ios_policy;
+	struct devreq *ios_head;	/* queue, linked through dr_next */
+	unsigned ios_depth;		/* requests on the queue */
+	uint32_t ios_pos;		/* block after the last dispatched */
+	struct iosched *ios_next;	/* on ioscheds */
+
+	/* ordering (DR_ORDERED, DR_BARRIER) */
+	struct devreq *ios_hold;	/* waiting their turn, in order */
+	unsigned ios_busy;		/* let onto the queue, not done */
+	unsigned ios_tagbusy[IOSCHED_NTAGS]; /* ...by tag slot */
+	uint32_t ios_fences;		/* slots with a DR_ORDERED out */
+	bool ios_barrier;		/* a DR_BARRIER is out */
+
+	/* statistics */
+	unsigned ios_nreqs;		/* requests added */
+	unsigned ios_nmerged;		/* ...adjacent to a queued one */
+	unsigned ios_depthsum;		/* queue depth seen on each add */
+	unsigned ios_maxdepth;
+	uint64_t ios_seekdist;		/* blocks moved between requests */
+	unsigned ios_nheld;		/* had to wait for ordering */
+};
+
+static struct spinlock ioscheds_lock = SPINLOCK_INITIALIZER;
+static struct iosched *ioscheds;
+
+/*
+ * True if B follows straight on from A.
+ */
+static
+bool
+iosched_adjacent(struct devreq *a, struct devreq *b)
+{
+	return a->dr_write == b->dr_write &&
+		a->dr_block + a->dr_nblocks == b->dr_block;
+}
+
+////////////////////////////////////////////////////////////
+// fifo
+
+static
+void
+fifo_add(struct iosched *ios, struct devreq *req)
+{
+	struct devreq **rp;
+	struct devreq *prev = NULL;
+
+	for (rp = &ios->ios_head; *rp != NULL; rp = &(*rp)->dr_next) {
+		prev = *rp;
+	}
+	if (prev != NULL && iosched_adjacent(prev, req)) {
+		ios->ios_nmerged++;
+	}
+	req->dr_next = NULL;
+	*rp = req;
+}
+
+static
+struct devreq *
+fifo_next(struct iosched *ios)
+{
+	struct devreq *req = ios->ios_head;
+
+	if (req != NULL) {
+		ios->ios_head = req->dr_next;
+	}
+	return req;
+}
+
+////////////////////////////////////////////////////////////
+// cscan
+
+/*
+ * The queue is kept sorted by block number. A request is merged with
+ * the one before it (or after it) if it continues it; being next to
+ * each other on the queue, they are then dispatched back to back.
+ */
+static
+void
+cscan_add(struct iosched *ios, struct devreq *req)
+{
+	struct devreq **rp;
+	struct devreq *prev = NULL;
+
+	for (rp = &ios->ios_head; *rp != NULL; rp = &(*rp)->dr_next) {
+		if ((*rp)->dr_block > req->dr_block) {
+			break;
+		}
+		prev = *rp;
+	}
+	if ((prev != NULL && iosched_adjacent(prev, req)) ||
+	    (*rp != NULL && iosched_adjacent(req, *rp))) {
+		ios->ios_nmerged++;
+	}
+	req->dr_next = *rp;
+	*rp = req;
+}
+
+static
+struct devreq *
+cscan_next(struct iosched *ios)
+{
+	struct devreq **rp;
+	struct devreq *req;
+
+	/* First request at or past the head... */
+	for (rp = &ios->ios_head; *rp != NULL; rp = &(*rp)->dr_next) {
+		if ((*rp)->dr_block >= ios->ios_pos) {
+			break;
+		}
+	}
+	/* ...or, if there isn't one, back to the start of the disk. */
+	if (*rp == NULL) {
+		rp = &ios->ios_head;
+	}
+	req = *rp;
+	if (req != NULL) {
+		*rp = req->dr_next;
+	}
+	return req;
+}
+
+////////////////////////////////////////////////////////////
+// ordering
+
+/*
+ * Requests don't go to the policy until their ordering allows; until
+ * then they wait on ios_hold in arrival order. Once let on, a request
+ * counts as busy until the driver calls iosched_done.
+ */
+static
+void
+iosched_letin(struct iosched *ios, struct devreq *req)
+{
+	ios->ios_busy++;
+	if (req->dr_tag != 0) {
+		ios->ios_tagbusy[IOSCHED_TAGSLOT(req->dr_tag)]++;
+	}
+	if (req->dr_flags & DR_ORDERED) {
+		ios->ios_fences |= (uint32_t)1 << IOSCHED_TAGSLOT(req->dr_tag);
+	}
+	if (req->dr_flags & DR_BARRIER) {
+		ios->ios_barrier = true;
+	}
+	ios->ios_policy->ip_add(ios, req);
+}
+
+/*
+ * Let on whatever held requests may go now. A request held back
+ * holds back everything later with its tag (BLOCKED), and a held
+ * barrier everything later at all.
+ */
+static
+void
+iosched_release(struct iosched *ios)
+{
+	struct devreq **rp, *req;
+	uint32_t blocked = 0, bit;
+	bool held = false;
+
+	KASSERT(spinlock_do_i_hold(&ios->ios_lock));
+
+	rp = &ios->ios_hold;
+	while ((req = *rp) != NULL && !ios->ios_barrier) {
+		if (req->dr_flags & DR_BARRIER) {
+			if (!held && ios->ios_busy == 0) {
+				*rp = req->dr_next;
+				iosched_letin(ios, req);
+			}
+			break;
+		}
+		bit = req->dr_tag == 0 ? 0 :
+			(uint32_t)1 << IOSCHED_TAGSLOT(req->dr_tag);
+		if ((bit & (blocked | ios->ios_fences)) != 0 ||
+		    ((req->dr_flags & DR_ORDERED) &&
+		     ios->ios_tagbusy[IOSCHED_TAGSLOT(req->dr_tag)] > 0)) {
+			blocked |= bit;
+			held = true;
+			rp = &req->dr_next;
+			continue;
+		}
+		*rp = req->dr_next;
+		iosched_letin(ios, req);
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+static const struct iosched_policy iosched_policies[] = {
+	{ "cscan", cscan_add, cscan_next },
+	{ "fifo", fifo_add, fifo_next },
+};
+
+struct iosched *
+iosched_create(const char *name)
+{
+	struct iosched *ios;
+
+	ios = kmalloc(sizeof(*ios));
+	if (ios == NULL) {
+		return NULL;
+	}
+	snprintf(ios->ios_name, sizeof(ios->ios_name), "%s", name);
+	spinlock_init(&ios->ios_lock);
+	ios->ios_policy = &iosched_policies[0];
+	ios->ios_head = NULL;
+	ios->ios_depth = 0;
+	ios->ios_pos = 0;
+	ios->ios_hold = NULL;
+	ios->ios_busy = 0;
+	bzero(ios->ios_tagbusy, sizeof(ios->ios_tagbusy));
+	ios->ios_fences = 0;
+	ios->ios_barrier = false;
+	ios->ios_nreqs = 0;
+	ios->ios_nmerged = 0;
+	ios->ios_depthsum = 0;
+	ios->ios_maxdepth = 0;
+	ios->ios_seekdist = 0;
+	ios->ios_nheld = 0;
+
+	spinlock_acquire(&ioscheds_lock);
+	ios->ios_next = ioscheds;
+	ioscheds = ios;
+	spinlock_release(&ioscheds_lock);
+
+	return ios;
+}
+
+void
+iosched_destroy(struct iosched *ios)
+{
+	struct iosched **iosp;
+
+	KASSERT(ios->ios_head == NULL);
+	KASSERT(ios->ios_hold == NULL);
+	KASSERT(ios->ios_busy == 0);
+
+	spinlock_acquire(&ioscheds_lock);
+	for (iosp = &ioscheds; *iosp != ios; iosp = &(*iosp)->ios_next) {
+		KASSERT(*iosp != NULL);
+	}
+	*iosp = ios->ios_next;
+	spinlock_release(&ioscheds_lock);
+
+	spinlock_cleanup(&ios->ios_lock);
+	kfree(ios);
+}
+
+void
+iosched_add(struct iosched *ios, struct devreq *req)
+{
+	struct devreq **rp;
+
+	KASSERT(req->dr_tag != 0 || (req->dr_flags & DR_ORDERED) == 0);
+
+	spinlock_acquire(&ios->ios_lock);
+	ios->ios_nreqs++;
+	ios->ios_depthsum += ios->ios_depth;
+	ios->ios_depth++;
+	if (ios->ios_depth > ios->ios_maxdepth) {
+		ios->ios_maxdepth = ios->ios_depth;
+	}
+	if (ios->ios_hold == NULL && !ios->ios_barrier &&
+	    req->dr_flags == 0 && (req->dr_tag == 0 ||
+	    (ios->ios_fences & ((uint32_t)1 <<
+				IOSCHED_TAGSLOT(req->dr_tag))) == 0)) {
+		/* Nothing to wait for */
+		iosched_letin(ios, req);
+	}
+	else {
+		req->dr_next = NULL;
+		for (rp = &ios->ios_hold; *rp != NULL; rp = &(*rp)->dr_next) {
+			/* nothing */
+		}
+		*rp = req;
+		iosched_release(ios);
+		if (*rp == req) {
+			ios->ios_nheld++;
+		}
+	}
+	spinlock_release(&ios->ios_lock);
+}
+
+struct devreq *
+iosched_next(struct iosched *ios)
+{
+	struct devreq *req;
+
+	spinlock_acquire(&ios->ios_lock);
+	req = ios->ios_policy->ip_next(ios);
+	if (req != NULL) {
+		KASSERT(ios->ios_depth > 0);
+		ios->ios_depth--;
+	}
+	if (req != NULL && req->dr_nblocks > 0) {
+		if (req->dr_block >= ios->ios_pos) {
+			ios->ios_seekdist += req->dr_block - ios->ios_pos;
+		}
+		else {
+			ios->ios_seekdist += ios->ios_pos - req->dr_block;
+		}
+		ios->ios_pos = req->dr_block + req->dr_nblocks;
+	}
+	spinlock_release(&ios->ios_lock);
+	return req;
+}
+
+void
+iosched_done(struct iosched *ios, struct devreq *req)
+{
+	spinlock_acquire(&ios->ios_lock);
+	KASSERT(ios->ios_busy > 0);
+	ios->ios_busy--;
+	if (req->dr_tag != 0) {
+		KASSERT(ios->ios_tagbusy[IOSCHED_TAGSLOT(req->dr_tag)] > 0);
+		ios->ios_tagbusy[IOSCHED_TAGSLOT(req->dr_tag)]--;
+	}
+	if (req->dr_flags & DR_ORDERED) {
+		ios->ios_fences &= ~((uint32_t)1 << IOSCHED_TAGSLOT(req->dr_tag));
+	}
+	if (req->dr_flags & DR_BARRIER) {
+		ios->ios_barrier = false;
+	}
+	if (ios->ios_hold != NULL) {
+		iosched_release(ios);
+	}
+	spinlock_release(&ios->ios_lock);
+}
+
+int
+iosched_setpolicy(const char *devname, const char *policy)
+{
+	const struct iosched_policy *ip = NULL;
+	struct iosched *ios;
+	struct devreq *queue, *req;
+	unsigned i;
+
+	for (i=0; i<ARRAYCOUNT(iosched_policies); i++) {
+		if (!strcmp(iosched_policies[i].ip_name, policy)) {
+			ip = &iosched_policies[i];
+		}
+	}
+	if (ip == NULL) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&ioscheds_lock);
+	for (ios = ioscheds; ios != NULL; ios = ios->ios_next) {
+		if (!strcmp(ios->ios_name, devname)) {
+			break;
+		}
+	}
+	if (ios == NULL) {
+		spinlock_release(&ioscheds_lock);
+		return ENODEV;
+	}
+
+	/* Requeue anything pending in the new policy's order. */
+	spinlock_acquire(&ios->ios_lock);
+	queue = ios->ios_head;
+	ios->ios_head = NULL;
+	ios->ios_policy = ip;
+	while (queue != NULL) {
+		req = queue;
+		queue = req->dr_next;
+		ip->ip_add(ios, req);
+	}
+	spinlock_release(&ios->ios_lock);
+
+	spinlock_release(&ioscheds_lock);
+	return 0;
+}
+
+void
+iosched_printstats(void)
+{
+	struct iosched *ios;
+
+	spinlock_acquire(&ioscheds_lock);
+	for (ios = ioscheds; ios != NULL; ios = ios->ios_next) {
+		kprintf("%s: %s, %u requests (%u merged, %u held "
+			"for ordering), queue depth avg %u.%02u max %u, "
+			"seek distance %llu blocks (%llu/request)\n",
+			ios->ios_name, ios->ios_policy->ip_name,
+			ios->ios_nreqs, ios->ios_nmerged, ios->ios_nheld,
+			ios->ios_nreqs ?
+			ios->ios_depthsum / ios->ios_nreqs : 0,
+			ios->ios_nreqs ?
+			(ios->ios_depthsum * 100 / ios->ios_nreqs) % 100 : 0,
+			ios->ios_maxdepth,
+			(unsigned long long)ios->ios_seekdist,
+			ios->ios_nreqs ? (unsigned long long)
+			(ios->ios_seekdist / ios->ios_nreqs) : 0ULL);
+	}
+	spinlock_release(&ioscheds_lock);
+}
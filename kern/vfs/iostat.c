@@ -0,0 +1,373 @@
+/*
+ * Per-device I/O statistics, and the iostat: device that shows them.
+ * See iostat.h.
+ *
+ * The counters are 64 bits wide, so as in percpu.c readers read each
+ * copy until they get the same value twice.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <uio.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <proc.h>
+#include <vfs.h>
+#include <device.h>
+#include <iostat.h>
+
+/* Bytes per sector, for counting */
+#define IOSTAT_SECTSIZE	512
+
+/* Room for one device's line of iostat: */
+#define IOSTAT_LINELEN	(16 + 7 * 21 + 1)
+
+/* One cpu's counts for one device */
+struct iostat_cpu {
+	volatile uint64_t ic_started;	/* transfers started */
+	volatile uint64_t ic_ops[2];	/* reads, writes finished */
+	volatile uint64_t ic_sects[2];	/* sectors read, written */
+	volatile uint64_t ic_totalns;	/* time from start to finish */
+	volatile uint64_t ic_maxns;
+};
+
+struct iostat {
+	char is_name[16];
+	unsigned is_ncpus;
+	struct iostat_cpu *is_cpus;	/* is_ncpus of them */
+	struct iostat *is_next;		/* on iostats */
+};
+
+/* Totals for one device, as shown */
+struct iostat_totals {
+	uint64_t it_ops[2];
+	uint64_t it_sects[2];
+	uint64_t it_inflight;
+	uint64_t it_totalns;
+	uint64_t it_maxns;
+};
+
+static struct spinlock iostats_lock = SPINLOCK_INITIALIZER;
+static struct iostat *iostats;
+
+struct iostat *
+iostat_create(const char *name)
+{
+	struct iostat *is;
+
+	is = kmalloc(sizeof(*is));
+	if (is == NULL) {
+		return NULL;
+	}
+	snprintf(is->is_name, sizeof(is->is_name), "%s", name);
+	is->is_ncpus = thread_numcpus();
+	is->is_cpus = kmalloc(is->is_ncpus * sizeof(is->is_cpus[0]));
+	if (is->is_cpus == NULL) {
+		kfree(is);
+		return NULL;
+	}
+	bzero(is->is_cpus, is->is_ncpus * sizeof(is->is_cpus[0]));
+
+	spinlock_acquire(&iostats_lock);
+	is->is_next = iostats;
+	iostats = is;
+	spinlock_release(&iostats_lock);
+
+	return is;
+}
+
+void
+iostat_destroy(struct iostat *is)
+{
+	struct iostat **isp;
+
+	spinlock_acquire(&iostats_lock);
+	for (isp = &iostats; *isp != is; isp = &(*isp)->is_next) {
+		KASSERT(*isp != NULL);
+	}
+	*isp = is->is_next;
+	spinlock_release(&iostats_lock);
+
+	kfree(is->is_cpus);
+	kfree(is);
+}
+
+/*
+ * This cpu's counts. Call at splhigh, to stay on the cpu and keep
+ * interrupt handlers out.
+ */
+static
+struct iostat_cpu *
+iostat_mycpu(struct iostat *is)
+{
+	KASSERT(curcpu->c_number < is->is_ncpus);
+	return &is->is_cpus[curcpu->c_number];
+}
+
+uint64_t
+iostat_start(struct iostat *is)
+{
+	int spl;
+
+	spl = splhigh();
+	iostat_mycpu(is)->ic_started++;
+	splx(spl);
+
+	return clock_monotonic_ns();
+}
+
+void
+iostat_done(struct iostat *is, bool write, size_t nbytes, uint64_t started)
+{
+	struct iostat_cpu *ic;
+	uint64_t now, ns;
+	int spl;
+
+	/* Another cpu's clock may be a little ahead of ours */
+	now = clock_monotonic_ns();
+	ns = now > started ? now - started : 0;
+
+	spl = splhigh();
+	ic = iostat_mycpu(is);
+	ic->ic_ops[write]++;
+	ic->ic_sects[write] += (nbytes + IOSTAT_SECTSIZE - 1) / IOSTAT_SECTSIZE;
+	ic->ic_totalns += ns;
+	if (ns > ic->ic_maxns) {
+		ic->ic_maxns = ns;
+	}
+	splx(spl);
+}
+
+void
+ioacct_count(bool write)
+{
+	struct proc *p = curproc;
+
+	if (p == NULL) {
+		return;
+	}
+	spinlock_acquire(&p->p_lock);
+	if (write) {
+		p->p_io.ia_oublock++;
+	}
+	else {
+		p->p_io.ia_inblock++;
+	}
+	spinlock_release(&p->p_lock);
+}
+
+void
+ioacct_add(struct ioacct *to, const struct ioacct *from)
+{
+	to->ia_inblock += from->ia_inblock;
+	to->ia_oublock += from->ia_oublock;
+}
+
+/* Read a counter that another cpu may be updating */
+static
+uint64_t
+iostat_read(volatile uint64_t *p)
+{
+	uint64_t a, b;
+
+	b = *p;
+	do {
+		a = b;
+		b = *p;
+	} while (a != b);
+	return a;
+}
+
+/*
+ * Add up the cpus' counts for IS. Finished transfers are read before
+ * started ones, so a transfer that finishes meanwhile can't make
+ * inflight negative.
+ */
+static
+void
+iostat_total(struct iostat *is, struct iostat_totals *it)
+{
+	struct iostat_cpu *ic;
+	uint64_t ns, started;
+	unsigned i;
+	int rw;
+
+	bzero(it, sizeof(*it));
+	started = 0;
+	for (i=0; i<is->is_ncpus; i++) {
+		ic = &is->is_cpus[i];
+		for (rw = 0; rw < 2; rw++) {
+			it->it_ops[rw] += iostat_read(&ic->ic_ops[rw]);
+			it->it_sects[rw] += iostat_read(&ic->ic_sects[rw]);
+		}
+		it->it_totalns += iostat_read(&ic->ic_totalns);
+		ns = iostat_read(&ic->ic_maxns);
+		if (ns > it->it_maxns) {
+			it->it_maxns = ns;
+		}
+	}
+	for (i=0; i<is->is_ncpus; i++) {
+		started += iostat_read(&is->is_cpus[i].ic_started);
+	}
+	it->it_inflight = started - it->it_ops[0] - it->it_ops[1];
+}
+
+void
+iostat_printstats(void)
+{
+	struct iostat_totals it;
+	struct iostat *is;
+	uint64_t ops;
+
+	spinlock_acquire(&iostats_lock);
+	for (is = iostats; is != NULL; is = is->is_next) {
+		iostat_total(is, &it);
+		ops = it.it_ops[0] + it.it_ops[1];
+		kprintf("%s: %llu reads (%llu sectors), "
+			"%llu writes (%llu sectors), %llu in flight, "
+			"latency avg %llu us max %llu us\n",
+			is->is_name,
+			(unsigned long long)it.it_ops[0],
+			(unsigned long long)it.it_sects[0],
+			(unsigned long long)it.it_ops[1],
+			(unsigned long long)it.it_sects[1],
+			(unsigned long long)it.it_inflight,
+			ops ? (unsigned long long)
+			(it.it_totalns / ops / 1000) : 0ULL,
+			(unsigned long long)it.it_maxns / 1000);
+	}
+	spinlock_release(&iostats_lock);
+}
+
+////////////////////////////////////////////////////////////
+// iostat:
+
+/* For open() */
+static
+int
+iostatopen(struct device *dev, int openflags)
+{
+	(void)dev;
+
+	if ((openflags & O_ACCMODE) != O_RDONLY) {
+		return EINVAL;
+	}
+	return 0;
+}
+
+/* For d_io() */
+static
+int
+iostatio(struct device *dev, struct uio *uio)
+{
+	struct iostat_totals it;
+	struct iostat *is;
+	unsigned n;
+	size_t size, len;
+	char *buf;
+	int result;
+
+	(void)dev;
+
+	if (uio->uio_rw == UIO_WRITE) {
+		return EINVAL;
+	}
+
+	/*
+	 * Devices may come and go between counting and formatting;
+	 * leave room for a few more, and stop if that's not enough.
+	 */
+	spinlock_acquire(&iostats_lock);
+	n = 0;
+	for (is = iostats; is != NULL; is = is->is_next) {
+		n++;
+	}
+	spinlock_release(&iostats_lock);
+
+	size = (n + 4) * IOSTAT_LINELEN + 1;
+	buf = kmalloc(size);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	len = 0;
+	spinlock_acquire(&iostats_lock);
+	for (is = iostats; is != NULL; is = is->is_next) {
+		if (size - len <= IOSTAT_LINELEN) {
+			break;
+		}
+		iostat_total(is, &it);
+		len += snprintf(buf + len, size - len,
+				"%s %llu %llu %llu %llu %llu %llu %llu\n",
+				is->is_name,
+				(unsigned long long)it.it_ops[0],
+				(unsigned long long)it.it_ops[1],
+				(unsigned long long)it.it_sects[0],
+				(unsigned long long)it.it_sects[1],
+				(unsigned long long)it.it_inflight,
+				(unsigned long long)it.it_totalns,
+				(unsigned long long)it.it_maxns);
+	}
+	spinlock_release(&iostats_lock);
+	KASSERT(len < size);
+
+	result = 0;
+	if (uio->uio_offset < (off_t)len) {
+		result = uiomove(buf + uio->uio_offset,
+				 len - uio->uio_offset, uio);
+	}
+	kfree(buf);
+	return result;
+}
+
+/* For ioctl() */
+static
+int
+iostatioctl(struct device *dev, int op, userptr_t data)
+{
+	(void)dev;
+	(void)op;
+	(void)data;
+
+	return EINVAL;
+}
+
+static const struct device_ops iostat_devops = {
+	.devop_eachopen = iostatopen,
+	.devop_io = iostatio,
+	.devop_ioctl = iostatioctl,
+};
+
+/*
+ * Function to create and attach iostat:
+ */
+void
+deviostat_create(void)
+{
+	int result;
+	struct device *dev;
+
+	dev = kmalloc(sizeof(*dev));
+	if (dev==NULL) {
+		panic("Could not add iostat device: out of memory\n");
+	}
+
+	dev->d_ops = &iostat_devops;
+
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+
+	dev->d_devnumber = 0; /* assigned by vfs_adddev */
+
+	dev->d_data = NULL;
+
+	result = vfs_adddev("iostat", dev, 0);
+	if (result) {
+		panic("Could not add iostat device: %s\n", strerror(result));
+	}
+}
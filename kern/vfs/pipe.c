@@ -0,0 +1,517 @@
+/*
+ * Anonymous pipes.
+ *
+ * A pipe is a page-sized ring buffer with two vnodes, one for each
+ * end. The vnodes have no filesystem and no name; the only way to
+ * get at them is through the file handles sys_pipe hands out, so
+ * their reference counts are the only thing keeping each end open.
+ * Nothing written to a pipe goes anywhere near a disk: data is
+ * copied straight from the writer's buffer into the ring and from
+ * the ring into the reader's buffer.
+ *
+ * Synchronization: p_rdlock serializes readers and p_wrlock
+ * serializes writers, which also makes each write() atomic with
+ * respect to other writers. With that, the ring itself has exactly
+ * one producer and one consumer, and they don't lock against each
+ * other: the reader owns p_head, the writer owns p_tail, and each
+ * only publishes its index after the data it covers has been copied
+ * (with memory barriers in between). The spinlock is taken only on
+ * the slow path, to go to sleep when the ring is empty or full and
+ * to wake the other side up again; the waiting flags let the fast
+ * path skip it when nobody is asleep. poll() waits on a separate
+ * pollhead for each end.
+ *
+ * The indices count bytes transferred since the pipe was created
+ * and are reduced modulo the buffer size only to address the ring,
+ * so head == tail means empty and tail - head == PIPE_SIZE means
+ * full, even after they wrap.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stat.h>
+#include <lib.h>
+#include <membar.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <wchan.h>
+#include <poll.h>
+#include <uio.h>
+#include <vm.h>
+#include <vfs.h>
+#include <vnode.h>
+
+#define PIPE_SIZE	PAGE_SIZE
+
+struct pipe {
+	char *p_buf;			/* the ring, PIPE_SIZE bytes */
+	volatile unsigned p_head;	/* bytes read so far (reader's) */
+	volatile unsigned p_tail;	/* bytes written so far (writer's) */
+
+	struct lock *p_rdlock;		/* one reader at a time */
+	struct lock *p_wrlock;		/* one writer at a time */
+
+	struct spinlock p_lock;		/* for sleeping, and the below */
+	struct wchan *p_rdwchan;	/* readers waiting for data */
+	struct wchan *p_wrwchan;	/* writers waiting for room */
+	volatile bool p_rdwaiting;	/* someone is on p_rdwchan */
+	volatile bool p_wrwaiting;	/* someone is on p_wrwchan */
+	volatile bool p_rdclosed;	/* read end is gone */
+	volatile bool p_wrclosed;	/* write end is gone */
+	struct pollhead p_rdpoll;	/* pollers waiting to read */
+	struct pollhead p_wrpoll;	/* pollers waiting to write */
+
+	struct vnode p_rdvn;		/* the read end */
+	struct vnode p_wrvn;		/* the write end */
+};
+
+static
+void
+pipe_destroy(struct pipe *p)
+{
+	if (p->p_wrwchan != NULL) {
+		wchan_destroy(p->p_wrwchan);
+	}
+	if (p->p_rdwchan != NULL) {
+		wchan_destroy(p->p_rdwchan);
+	}
+	pollhead_cleanup(&p->p_wrpoll);
+	pollhead_cleanup(&p->p_rdpoll);
+	spinlock_cleanup(&p->p_lock);
+	if (p->p_wrlock != NULL) {
+		lock_destroy(p->p_wrlock);
+	}
+	if (p->p_rdlock != NULL) {
+		lock_destroy(p->p_rdlock);
+	}
+	if (p->p_buf != NULL) {
+		kfree(p->p_buf);
+	}
+	kfree(p);
+}
+
+////////////////////////////////////////////////////////////
+// data transfer
+
+/*
+ * Wake up the other side, if it's asleep. The caller has just
+ * published a new index; the barrier makes sure that's visible
+ * before we look at the flag, pairing with the one in the sleep
+ * paths below, so that either we see the flag or the sleeper sees
+ * the new index.
+ */
+static
+void
+pipe_wakeup(struct pipe *p, volatile bool *waiting, struct wchan *wc)
+{
+	membar_any_any();
+	if (*waiting) {
+		spinlock_acquire(&p->p_lock);
+		wchan_wakeall(wc, &p->p_lock);
+		spinlock_release(&p->p_lock);
+	}
+}
+
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	unsigned head, tail, off, len;
+	int result = 0;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	lock_acquire(p->p_rdlock);
+	head = p->p_head;
+
+	/* Wait until there's something to read, or no writers. */
+	while ((tail = p->p_tail) == head) {
+		spinlock_acquire(&p->p_lock);
+		p->p_rdwaiting = true;
+		membar_any_any();
+		if (p->p_tail == head) {
+			if (p->p_wrclosed) {
+				/* EOF */
+				p->p_rdwaiting = false;
+				spinlock_release(&p->p_lock);
+				lock_release(p->p_rdlock);
+				return 0;
+			}
+			wchan_sleep(p->p_rdwchan, &p->p_lock);
+		}
+		p->p_rdwaiting = false;
+		spinlock_release(&p->p_lock);
+	}
+	/* Don't read the data until after we've seen the index. */
+	membar_load_load();
+
+	/*
+	 * Take what's there, in at most two pieces if it wraps; don't
+	 * wait for more.
+	 */
+	while (tail != head && uio->uio_resid > 0) {
+		off = head % PIPE_SIZE;
+		len = tail - head;
+		if (len > PIPE_SIZE - off) {
+			len = PIPE_SIZE - off;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(p->p_buf + off, len, uio);
+		if (result) {
+			break;
+		}
+		head += len;
+	}
+
+	/* Finish reading the data before handing the space back. */
+	membar_any_store();
+	p->p_head = head;
+	pipe_wakeup(p, &p->p_wrwaiting, p->p_wrwchan);
+	pollhead_wakeup(&p->p_wrpoll);
+
+	lock_release(p->p_rdlock);
+	return result;
+}
+
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	unsigned head, tail, off, len;
+	size_t origresid;
+	int result = 0;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+
+	origresid = uio->uio_resid;
+
+	lock_acquire(p->p_wrlock);
+	tail = p->p_tail;
+	while (uio->uio_resid > 0) {
+		if (p->p_rdclosed) {
+			result = EPIPE;
+			break;
+		}
+
+		head = p->p_head;
+		if (tail - head == PIPE_SIZE) {
+			/* Full; wait for the reader to make room. */
+			spinlock_acquire(&p->p_lock);
+			p->p_wrwaiting = true;
+			membar_any_any();
+			if (tail - p->p_head == PIPE_SIZE &&
+			    !p->p_rdclosed) {
+				wchan_sleep(p->p_wrwchan, &p->p_lock);
+			}
+			p->p_wrwaiting = false;
+			spinlock_release(&p->p_lock);
+			continue;
+		}
+		/* Don't overwrite the space until the reader is done. */
+		membar_any_store();
+
+		off = tail % PIPE_SIZE;
+		len = PIPE_SIZE - (tail - head);
+		if (len > PIPE_SIZE - off) {
+			len = PIPE_SIZE - off;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(p->p_buf + off, len, uio);
+		if (result) {
+			break;
+		}
+		tail += len;
+
+		/* Publish the data only after it's been written. */
+		membar_store_store();
+		p->p_tail = tail;
+		pipe_wakeup(p, &p->p_rdwaiting, p->p_rdwchan);
+		pollhead_wakeup(&p->p_rdpoll);
+	}
+	lock_release(p->p_wrlock);
+
+	/* A partial write is a short count, not an error. */
+	if (result && uio->uio_resid < origresid) {
+		result = 0;
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// other vnode operations
+
+static
+int
+pipe_eachopen(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+
+	/* Pipes have no name, so this can't happen. */
+	return EINVAL;
+}
+
+/*
+ * Close one end. Wake anyone on the other end, so they see EOF or
+ * EPIPE, and free the pipe once both ends are gone.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+	bool last;
+
+	spinlock_acquire(&v->vn_countlock);
+	if (v->vn_refcount > 1) {
+		v->vn_refcount--;
+		spinlock_release(&v->vn_countlock);
+		return EBUSY;
+	}
+	spinlock_release(&v->vn_countlock);
+
+	spinlock_acquire(&p->p_lock);
+	if (v == &p->p_rdvn) {
+		p->p_rdclosed = true;
+		wchan_wakeall(p->p_wrwchan, &p->p_lock);
+	}
+	else {
+		p->p_wrclosed = true;
+		wchan_wakeall(p->p_rdwchan, &p->p_lock);
+	}
+	last = p->p_rdclosed && p->p_wrclosed;
+	spinlock_release(&p->p_lock);
+
+	pollhead_wakeup(v == &p->p_rdvn ? &p->p_wrpoll : &p->p_rdpoll);
+
+	vnode_cleanup(v);
+	if (last) {
+		pipe_destroy(p);
+	}
+	return 0;
+}
+
+/*
+ * The read end is ready when there's data or there are no writers
+ * (so read returns EOF); the write end when there's room, or no
+ * readers (so write fails at once).
+ */
+static
+int
+pipe_poll(struct vnode *v, int events, struct pollset *ps, int *result)
+{
+	struct pipe *p = v->vn_data;
+	int ret = 0;
+
+	if (v == &p->p_rdvn) {
+		if (events & POLLIN) {
+			pollset_register(ps, &p->p_rdpoll);
+		}
+		if (p->p_wrclosed) {
+			ret |= POLLHUP;
+		}
+		if ((events & POLLIN) &&
+		    (p->p_tail != p->p_head || p->p_wrclosed)) {
+			ret |= POLLIN;
+		}
+	}
+	else {
+		if (events & POLLOUT) {
+			pollset_register(ps, &p->p_wrpoll);
+		}
+		if (p->p_rdclosed) {
+			ret |= POLLERR;
+		}
+		else if ((events & POLLOUT) &&
+			 p->p_tail - p->p_head < PIPE_SIZE) {
+			ret |= POLLOUT;
+		}
+	}
+	*result = ret;
+	return 0;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *p = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+	statbuf->st_mode = S_IFIFO | (v == &p->p_rdvn ? 0400 : 0200);
+	statbuf->st_size = p->p_tail - p->p_head;
+	statbuf->st_blksize = PIPE_SIZE;
+	statbuf->st_nlink = 1;
+	return 0;
+}
+
+static
+bool
+pipe_isseekable(struct vnode *v)
+{
+	(void)v;
+	return false;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+static
+int
+pipe_namefile(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return ENOENT;
+}
+
+static
+int
+pipe_lookup(struct vnode *v, char *path, struct vnode **result)
+{
+	(void)v;
+	(void)path;
+	(void)result;
+	return ENOTDIR;
+}
+
+/*
+ * The two ends share everything but which direction works; each
+ * fails the other with EBADF, as if it weren't open for it.
+ */
+#define PIPE_OPS(readfn, writefn)					\
+	{								\
+		.vop_magic = VOP_MAGIC,					\
+		.vop_eachopen = pipe_eachopen,				\
+		.vop_reclaim = pipe_reclaim,				\
+		.vop_read = readfn,					\
+		.vop_readlink = vopfail_uio_inval,			\
+		.vop_getdirentry = vopfail_uio_notdir,			\
+		.vop_getdirplus = vopfail_uio_notdir,			\
+		.vop_getdents = vopfail_uio_notdir,			\
+		.vop_write = writefn,					\
+		.vop_ioctl = pipe_ioctl,				\
+		.vop_stat = pipe_stat,					\
+		.vop_gettype = pipe_gettype,				\
+		.vop_isseekable = pipe_isseekable,			\
+		.vop_poll = pipe_poll,					\
+		.vop_fsync = pipe_fsync,				\
+		.vop_mmap = vopfail_mmap_nosys,				\
+		.vop_truncate = pipe_truncate,				\
+		.vop_namefile = pipe_namefile,				\
+		.vop_creat = vopfail_creat_notdir,			\
+		.vop_symlink = vopfail_symlink_notdir,			\
+		.vop_mkdir = vopfail_mkdir_notdir,			\
+		.vop_link = vopfail_link_notdir,			\
+		.vop_remove = vopfail_string_notdir,			\
+		.vop_rmdir = vopfail_string_notdir,			\
+		.vop_rename = vopfail_rename_notdir,			\
+		.vop_lookup = pipe_lookup,				\
+		.vop_lookparent = vopfail_lookparent_notdir,		\
+	}
+
+static
+int
+pipe_badf(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EBADF;
+}
+
+static const struct vnode_ops pipe_rdops = PIPE_OPS(pipe_read, pipe_badf);
+static const struct vnode_ops pipe_wrops = PIPE_OPS(pipe_badf, pipe_write);
+
+////////////////////////////////////////////////////////////
+// creation
+
+/*
+ * Make a new pipe, returning a vnode for each end, each with one
+ * reference.
+ */
+int
+pipe_create(struct vnode **rdret, struct vnode **wrret)
+{
+	struct pipe *p;
+	int result;
+
+	p = kmalloc(sizeof(*p));
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	p->p_buf = NULL;
+	p->p_head = p->p_tail = 0;
+	p->p_rdlock = p->p_wrlock = NULL;
+	spinlock_init(&p->p_lock);
+	p->p_rdwchan = p->p_wrwchan = NULL;
+	p->p_rdwaiting = p->p_wrwaiting = false;
+	p->p_rdclosed = p->p_wrclosed = false;
+	pollhead_init(&p->p_rdpoll);
+	pollhead_init(&p->p_wrpoll);
+
+	p->p_buf = kmalloc(PIPE_SIZE);
+	p->p_rdlock = lock_create("pipe-rd");
+	p->p_wrlock = lock_create("pipe-wr");
+	p->p_rdwchan = wchan_create("pipe-rd");
+	p->p_wrwchan = wchan_create("pipe-wr");
+	if (p->p_buf == NULL || p->p_rdlock == NULL || p->p_wrlock == NULL ||
+	    p->p_rdwchan == NULL || p->p_wrwchan == NULL) {
+		pipe_destroy(p);
+		return ENOMEM;
+	}
+
+	result = vnode_init(&p->p_rdvn, &pipe_rdops, NULL, p);
+	if (result) {
+		pipe_destroy(p);
+		return result;
+	}
+	result = vnode_init(&p->p_wrvn, &pipe_wrops, NULL, p);
+	if (result) {
+		vnode_cleanup(&p->p_rdvn);
+		pipe_destroy(p);
+		return result;
+	}
+
+	*rdret = &p->p_rdvn;
+	*wrret = &p->p_wrvn;
+	return 0;
+}
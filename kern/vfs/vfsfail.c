@@ -83,23 +83,26 @@ vopfail_uio_nosys(struct vnode *vn, struct uio *uio)
 // mmap
 
 int
-vopfail_mmap_isdir(struct vnode *vn /*add stuff */)
+vopfail_mmap_isdir(struct vnode *vn, bool *anon)
 {
 	(void)vn;
+	(void)anon;
 	return EISDIR;
 }
 
 int
-vopfail_mmap_perm(struct vnode *vn /*add stuff */)
+vopfail_mmap_perm(struct vnode *vn, bool *anon)
 {
 	(void)vn;
+	(void)anon;
 	return EPERM;
 }
 
 int
-vopfail_mmap_nosys(struct vnode *vn /*add stuff */)
+vopfail_mmap_nosys(struct vnode *vn, bool *anon)
 {
 	(void)vn;
+	(void)anon;
 	return ENOSYS;
 }
 
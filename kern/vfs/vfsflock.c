@@ -0,0 +1,598 @@
+/*
+ * Byte-range advisory locks, for fcntl F_GETLK, F_SETLK and F_SETLKW.
+ * See vnode.h.
+ *
+ * A vnode that has ever been locked gets a vnode_locks, which keeps
+ * the locks held on it in an interval tree: a treap ordered by start
+ * offset, in which each node also records the largest end offset in
+ * its subtree, so that looking for locks that overlap a range skips
+ * every subtree that ends before the range begins. One owner's locks
+ * on a file never overlap each other; a new lock over some of them
+ * replaces, splits, or merges with them, as POSIX says.
+ *
+ * An owner that has to wait for a lock hangs a waiter, with the range
+ * it wants, on the vnode's list and sleeps on the waiter's own wchan.
+ * Dropping a lock, or turning a write lock into a read lock, wakes
+ * only the waiters whose ranges overlap what was given up, and they
+ * look again; so processes working on different parts of a file
+ * never wake each other, and none of them polls.
+ *
+ * Locks belong to processes, by pid. The system call layer drops a
+ * process's locks on a file when it closes any descriptor for it,
+ * and all of them when it exits. There is no deadlock detection: two
+ * processes each waiting for the other's lock wait for good.
+ *
+ * Locking: the vnode_locks spinlock covers the tree and the waiters.
+ * Nodes are allocated before taking it and freed after.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/seek.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <vnode.h>
+
+/* End offset of a lock that goes on for ever (l_len 0) */
+#define FL_EOF		((off_t)0x7fffffffffffffffLL)
+
+/* Most nodes one vnode_setlk can add: the lock, and two pieces of one */
+#define FL_MAXNEW	3
+
+struct flnode {
+	off_t fn_start;			/* first byte */
+	off_t fn_end;			/* byte after the last */
+	off_t fn_maxend;		/* largest fn_end in this subtree */
+	pid_t fn_owner;
+	int fn_type;			/* F_RDLCK or F_WRLCK */
+	unsigned fn_prio;		/* treap priority */
+	struct flnode *fn_left;
+	struct flnode *fn_right;
+};
+
+struct flwaiter {
+	struct flwaiter *fw_next;
+	off_t fw_start;			/* range being waited for */
+	off_t fw_end;
+	struct wchan *fw_wchan;
+	bool fw_woken;
+};
+
+struct vnode_locks {
+	struct spinlock vl_lock;
+	struct flnode *vl_root;		/* interval tree of locks */
+	struct flwaiter *vl_waiters;
+};
+
+////////////////////////////////////////////////////////////
+// Interval tree
+
+/*
+ * Recompute N's fn_maxend from its own end and its children's.
+ */
+static
+void
+fl_fix(struct flnode *n)
+{
+	n->fn_maxend = n->fn_end;
+	if (n->fn_left != NULL && n->fn_left->fn_maxend > n->fn_maxend) {
+		n->fn_maxend = n->fn_left->fn_maxend;
+	}
+	if (n->fn_right != NULL && n->fn_right->fn_maxend > n->fn_maxend) {
+		n->fn_maxend = n->fn_right->fn_maxend;
+	}
+}
+
+static
+struct flnode *
+fl_rotright(struct flnode *n)
+{
+	struct flnode *l = n->fn_left;
+
+	n->fn_left = l->fn_right;
+	l->fn_right = n;
+	fl_fix(n);
+	fl_fix(l);
+	return l;
+}
+
+static
+struct flnode *
+fl_rotleft(struct flnode *n)
+{
+	struct flnode *r = n->fn_right;
+
+	n->fn_right = r->fn_left;
+	r->fn_left = n;
+	fl_fix(n);
+	fl_fix(r);
+	return r;
+}
+
+/*
+ * Tree order: by start, and locks that start at the same place by
+ * address, so that every node has a place of its own.
+ */
+static
+bool
+fl_before(const struct flnode *a, const struct flnode *b)
+{
+	if (a->fn_start != b->fn_start) {
+		return a->fn_start < b->fn_start;
+	}
+	return (uintptr_t)a < (uintptr_t)b;
+}
+
+/*
+ * Add N to the subtree ROOT; return the new root.
+ */
+static
+struct flnode *
+fl_insert(struct flnode *root, struct flnode *n)
+{
+	if (root == NULL) {
+		n->fn_left = n->fn_right = NULL;
+		fl_fix(n);
+		return n;
+	}
+	if (fl_before(n, root)) {
+		root->fn_left = fl_insert(root->fn_left, n);
+		if (root->fn_left->fn_prio > root->fn_prio) {
+			return fl_rotright(root);
+		}
+	}
+	else {
+		root->fn_right = fl_insert(root->fn_right, n);
+		if (root->fn_right->fn_prio > root->fn_prio) {
+			return fl_rotleft(root);
+		}
+	}
+	fl_fix(root);
+	return root;
+}
+
+/*
+ * Put together two subtrees, everything in A coming before B.
+ */
+static
+struct flnode *
+fl_join(struct flnode *a, struct flnode *b)
+{
+	if (a == NULL) {
+		return b;
+	}
+	if (b == NULL) {
+		return a;
+	}
+	if (a->fn_prio > b->fn_prio) {
+		a->fn_right = fl_join(a->fn_right, b);
+		fl_fix(a);
+		return a;
+	}
+	b->fn_left = fl_join(a, b->fn_left);
+	fl_fix(b);
+	return b;
+}
+
+/*
+ * Take N, which must be there, out of the subtree ROOT; return the
+ * new root.
+ */
+static
+struct flnode *
+fl_remove(struct flnode *root, struct flnode *n)
+{
+	KASSERT(root != NULL);
+
+	if (root == n) {
+		return fl_join(n->fn_left, n->fn_right);
+	}
+	if (fl_before(n, root)) {
+		root->fn_left = fl_remove(root->fn_left, n);
+	}
+	else {
+		root->fn_right = fl_remove(root->fn_right, n);
+	}
+	fl_fix(root);
+	return root;
+}
+
+/*
+ * Does N count, for fl_find? With MINE, if OWNER holds it; otherwise
+ * if it would stop OWNER taking a lock of TYPE.
+ */
+static
+bool
+fl_match(const struct flnode *n, pid_t owner, int type, bool mine)
+{
+	if (mine) {
+		return n->fn_owner == owner;
+	}
+	return n->fn_owner != owner &&
+		(n->fn_type == F_WRLCK || type == F_WRLCK);
+}
+
+/*
+ * Find the first lock in the subtree N that overlaps [START, END) and
+ * that fl_match accepts, or NULL.
+ */
+static
+struct flnode *
+fl_find(struct flnode *n, off_t start, off_t end, pid_t owner, int type,
+	bool mine)
+{
+	struct flnode *found;
+
+	if (n == NULL || n->fn_maxend <= start) {
+		/* Everything here ends before the range */
+		return NULL;
+	}
+	found = fl_find(n->fn_left, start, end, owner, type, mine);
+	if (found != NULL) {
+		return found;
+	}
+	if (n->fn_start >= end) {
+		/* This and everything to the right start after it */
+		return NULL;
+	}
+	if (start < n->fn_end && fl_match(n, owner, type, mine)) {
+		return n;
+	}
+	return fl_find(n->fn_right, start, end, owner, type, mine);
+}
+
+/*
+ * Free the whole subtree N.
+ */
+static
+void
+fl_freeall(struct flnode *n)
+{
+	if (n != NULL) {
+		fl_freeall(n->fn_left);
+		fl_freeall(n->fn_right);
+		kfree(n);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Locks
+
+/*
+ * Get V's vnode_locks, making it if it hasn't got one. NULL if out of
+ * memory.
+ */
+static
+struct vnode_locks *
+fl_getlocks(struct vnode *v)
+{
+	struct vnode_locks *vl;
+
+	spinlock_acquire(&v->vn_countlock);
+	vl = v->vn_locks;
+	spinlock_release(&v->vn_countlock);
+	if (vl != NULL) {
+		return vl;
+	}
+
+	vl = kmalloc(sizeof(*vl));
+	if (vl == NULL) {
+		return NULL;
+	}
+	spinlock_init(&vl->vl_lock);
+	vl->vl_root = NULL;
+	vl->vl_waiters = NULL;
+
+	spinlock_acquire(&v->vn_countlock);
+	if (v->vn_locks == NULL) {
+		v->vn_locks = vl;
+		vl = NULL;
+	}
+	spinlock_release(&v->vn_countlock);
+
+	if (vl != NULL) {
+		/* Someone else got there first */
+		spinlock_cleanup(&vl->vl_lock);
+		kfree(vl);
+	}
+	return v->vn_locks;
+}
+
+/*
+ * Make a node for a lock of OWNER's on [START, END), from the spares
+ * in NEW.
+ */
+static
+struct flnode *
+fl_mknode(struct flnode **new, unsigned *nnew, pid_t owner, int type,
+	  off_t start, off_t end)
+{
+	struct flnode *n;
+
+	KASSERT(*nnew > 0);
+	n = new[--*nnew];
+	n->fn_start = start;
+	n->fn_end = end;
+	n->fn_owner = owner;
+	n->fn_type = type;
+	/* Fibonacci hashing of the address makes a fine random number */
+	n->fn_prio = (unsigned)((uintptr_t)n >> 4) * 2654435761U;
+	return n;
+}
+
+/*
+ * Wake everyone waiting for a range overlapping [START, END).
+ */
+static
+void
+fl_wakeup(struct vnode_locks *vl, off_t start, off_t end)
+{
+	struct flwaiter *w;
+
+	KASSERT(spinlock_do_i_hold(&vl->vl_lock));
+
+	for (w = vl->vl_waiters; w != NULL; w = w->fw_next) {
+		if (w->fw_start < end && start < w->fw_end && !w->fw_woken) {
+			w->fw_woken = true;
+			wchan_wakeall(w->fw_wchan, &vl->vl_lock);
+		}
+	}
+}
+
+/*
+ * Sleep until a range overlapping [START, END) is given up.
+ */
+static
+void
+fl_wait(struct vnode_locks *vl, struct wchan *wc, off_t start, off_t end)
+{
+	struct flwaiter w, **wp;
+
+	KASSERT(spinlock_do_i_hold(&vl->vl_lock));
+
+	w.fw_start = start;
+	w.fw_end = end;
+	w.fw_wchan = wc;
+	w.fw_woken = false;
+	w.fw_next = vl->vl_waiters;
+	vl->vl_waiters = &w;
+
+	while (!w.fw_woken) {
+		wchan_sleep(wc, &vl->vl_lock);
+	}
+
+	for (wp = &vl->vl_waiters; *wp != &w; wp = &(*wp)->fw_next) {
+		KASSERT(*wp != NULL);
+	}
+	*wp = w.fw_next;
+}
+
+/*
+ * Turn FL's range into [*START, *END).
+ */
+static
+void
+fl_range(const struct flock *fl, off_t *start, off_t *end)
+{
+	KASSERT(fl->l_whence == SEEK_SET);
+	KASSERT(fl->l_start >= 0 && fl->l_len >= 0);
+
+	*start = fl->l_start;
+	if (fl->l_len == 0 || fl->l_len > FL_EOF - fl->l_start) {
+		*end = FL_EOF;
+	}
+	else {
+		*end = fl->l_start + fl->l_len;
+	}
+}
+
+int
+vnode_getlk(struct vnode *v, pid_t owner, struct flock *fl)
+{
+	struct vnode_locks *vl;
+	struct flnode *n = NULL;
+	off_t start, end;
+
+	KASSERT(fl->l_type == F_RDLCK || fl->l_type == F_WRLCK);
+	fl_range(fl, &start, &end);
+
+	spinlock_acquire(&v->vn_countlock);
+	vl = v->vn_locks;
+	spinlock_release(&v->vn_countlock);
+
+	if (vl != NULL) {
+		spinlock_acquire(&vl->vl_lock);
+		n = fl_find(vl->vl_root, start, end, owner, fl->l_type,
+			    false);
+		if (n != NULL) {
+			fl->l_type = n->fn_type;
+			fl->l_start = n->fn_start;
+			fl->l_len = n->fn_end == FL_EOF ?
+				0 : n->fn_end - n->fn_start;
+			fl->l_pid = n->fn_owner;
+		}
+		spinlock_release(&vl->vl_lock);
+	}
+	if (n == NULL) {
+		fl->l_type = F_UNLCK;
+	}
+	return 0;
+}
+
+int
+vnode_setlk(struct vnode *v, pid_t owner, const struct flock *fl, bool wait)
+{
+	struct vnode_locks *vl;
+	struct flnode *new[FL_MAXNEW];
+	struct flnode *n, *dead = NULL;
+	struct wchan *wc = NULL;
+	unsigned nnew;
+	off_t start, end, ls, le;
+	int type = fl->l_type;
+	bool released = false;
+	int result = 0;
+
+	KASSERT(type == F_RDLCK || type == F_WRLCK || type == F_UNLCK);
+	fl_range(fl, &start, &end);
+
+	vl = fl_getlocks(v);
+	if (vl == NULL) {
+		return ENOMEM;
+	}
+	for (nnew = 0; nnew < FL_MAXNEW; nnew++) {
+		new[nnew] = kmalloc(sizeof(struct flnode));
+		if (new[nnew] == NULL) {
+			result = ENOMEM;
+			goto out;
+		}
+	}
+
+	spinlock_acquire(&vl->vl_lock);
+
+	/* Wait for anyone else's locks in the way to go */
+	while (type != F_UNLCK &&
+	       fl_find(vl->vl_root, start, end, owner, type, false) != NULL) {
+		if (!wait) {
+			spinlock_release(&vl->vl_lock);
+			result = EAGAIN;
+			goto out;
+		}
+		if (wc == NULL) {
+			spinlock_release(&vl->vl_lock);
+			wc = wchan_create("flock");
+			if (wc == NULL) {
+				result = ENOMEM;
+				goto out;
+			}
+			spinlock_acquire(&vl->vl_lock);
+			continue;
+		}
+		fl_wait(vl, wc, start, end);
+	}
+
+	/*
+	 * Take our own locks out of the range. Those of the same type
+	 * are merged into the new lock; the parts of the others that
+	 * stick out either side stay.
+	 */
+	ls = start;
+	le = end;
+	while ((n = fl_find(vl->vl_root, start, end, owner, 0, true)) != NULL) {
+		vl->vl_root = fl_remove(vl->vl_root, n);
+		if (n->fn_type == type) {
+			ls = n->fn_start < ls ? n->fn_start : ls;
+			le = n->fn_end > le ? n->fn_end : le;
+		}
+		else {
+			if (n->fn_start < start) {
+				vl->vl_root = fl_insert(vl->vl_root,
+					fl_mknode(new, &nnew, owner,
+						  n->fn_type, n->fn_start,
+						  start));
+			}
+			if (n->fn_end > end) {
+				vl->vl_root = fl_insert(vl->vl_root,
+					fl_mknode(new, &nnew, owner,
+						  n->fn_type, end,
+						  n->fn_end));
+			}
+			released = released || n->fn_type == F_WRLCK;
+		}
+		n->fn_left = dead;
+		dead = n;
+	}
+	if (type == F_UNLCK) {
+		released = true;
+	}
+
+	/* Merge with locks of the same type just either side */
+	if (type != F_UNLCK && ls > 0) {
+		n = fl_find(vl->vl_root, ls - 1, ls, owner, 0, true);
+		if (n != NULL && n->fn_type == type) {
+			KASSERT(n->fn_end == ls);
+			vl->vl_root = fl_remove(vl->vl_root, n);
+			ls = n->fn_start;
+			n->fn_left = dead;
+			dead = n;
+		}
+	}
+	if (type != F_UNLCK && le < FL_EOF) {
+		n = fl_find(vl->vl_root, le, le + 1, owner, 0, true);
+		if (n != NULL && n->fn_type == type) {
+			KASSERT(n->fn_start == le);
+			vl->vl_root = fl_remove(vl->vl_root, n);
+			le = n->fn_end;
+			n->fn_left = dead;
+			dead = n;
+		}
+	}
+
+	if (type != F_UNLCK) {
+		vl->vl_root = fl_insert(vl->vl_root,
+			fl_mknode(new, &nnew, owner, type, ls, le));
+	}
+	if (released) {
+		fl_wakeup(vl, start, end);
+	}
+	spinlock_release(&vl->vl_lock);
+
+ out:
+	while (nnew > 0) {
+		kfree(new[--nnew]);
+	}
+	while (dead != NULL) {
+		n = dead;
+		dead = n->fn_left;
+		kfree(n);
+	}
+	if (wc != NULL) {
+		wchan_destroy(wc);
+	}
+	return result;
+}
+
+void
+vnode_unlockall(struct vnode *v, pid_t owner)
+{
+	struct vnode_locks *vl;
+	struct flnode *n, *dead = NULL;
+
+	spinlock_acquire(&v->vn_countlock);
+	vl = v->vn_locks;
+	spinlock_release(&v->vn_countlock);
+	if (vl == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&vl->vl_lock);
+	while ((n = fl_find(vl->vl_root, 0, FL_EOF, owner, 0, true)) != NULL) {
+		vl->vl_root = fl_remove(vl->vl_root, n);
+		fl_wakeup(vl, n->fn_start, n->fn_end);
+		n->fn_left = dead;
+		dead = n;
+	}
+	spinlock_release(&vl->vl_lock);
+
+	while (dead != NULL) {
+		n = dead;
+		dead = n->fn_left;
+		kfree(n);
+	}
+}
+
+void
+vnode_locks_destroy(struct vnode *v)
+{
+	struct vnode_locks *vl = v->vn_locks;
+
+	if (vl == NULL) {
+		return;
+	}
+	/* Nobody can be waiting on a vnode nobody has open */
+	KASSERT(vl->vl_waiters == NULL);
+	fl_freeall(vl->vl_root);
+	spinlock_cleanup(&vl->vl_lock);
+	kfree(vl);
+	v->vn_locks = NULL;
+}
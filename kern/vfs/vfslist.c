@@ -72,24 +72,60 @@
  * returns ENXIO. Referencing kd_name on a device that is not
  * mountable and has no filesystem, or kd_rawname on a mountable
  * device, returns the device itself.
+ *
+ * Each of those names is also in a hash table, kd_buckets, so that
+ * looking up the device in a "dev:path" doesn't mean going through
+ * every device comparing names. kd_hname and kd_hraw are hashed when
+ * the device is added, and kd_hvol while a filesystem is mounted.
  */
 
+struct kdname {
+	const char *kn_name;		/* NULL if not hashed */
+	struct knowndev *kn_kd;
+	struct kdname *kn_next;		/* hash chain */
+};
+
 struct knowndev {
 	char *kd_name;
 	char *kd_rawname;
 	struct device *kd_device;
 	struct vnode *kd_vnode;
 	struct fs *kd_fs;
+	struct kdname kd_hname;		/* kd_name */
+	struct kdname kd_hraw;		/* kd_rawname */
+	struct kdname kd_hvol;		/* kd_fs's volume name */
 };
 
-/* A placeholder for kd_fs for devices used as swap */
-#define SWAP_FS	((struct fs *)-1)
+#define KD_NBUCKETS	32		/* hash chains; power of 2 */
+
+/*
+ * Placeholders for kd_fs for devices that are in use but have no
+ * filesystem: used as swap, or claimed as part of another device
+ * (see vfs_claimdev).
+ */
+#define SWAP_FS		((struct fs *)-1)
+#define CLAIMED_FS	((struct fs *)-2)
+
+/* Whether KD has a real filesystem mounted on it */
+#define KD_HASFS(kd) \
+	((kd)->kd_fs != NULL && (kd)->kd_fs != SWAP_FS && \
+	 (kd)->kd_fs != CLAIMED_FS)
 
 DECLARRAY(knowndev, static __UNUSED inline);
 DEFARRAY(knowndev, static __UNUSED inline);
 
 static struct knowndevarray *knowndevs;
 
+static struct kdname *kd_buckets[KD_NBUCKETS];
+
+/*
+ * Protects knowndevs, kd_buckets and the kd_fs fields. Everything
+ * that changes them also holds vfs_biglock, so holding the biglock
+ * is enough to read them; this lock lets readers that don't need the
+ * biglock run in parallel. Always take it after the biglock.
+ */
+static struct rwlock *knowndevs_lock;
+
 /* The big lock for all FS ops. Remove for filesystem assignment. */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
@@ -105,6 +141,10 @@ vfs_bootstrap(void)
 	if (knowndevs==NULL) {
 		panic("vfs: Could not create knowndevs array\n");
 	}
+	knowndevs_lock = rwlock_create("knowndevs");
+	if (knowndevs_lock==NULL) {
+		panic("vfs: Could not create knowndevs lock\n");
+	}
 
 	vfs_biglock = lock_create("vfs_biglock");
 	if (vfs_biglock==NULL) {
@@ -112,7 +152,12 @@ vfs_bootstrap(void)
 	}
 	vfs_biglock_depth = 0;
 
+	vfs_ncache_bootstrap();
+
 	devnull_create();
+	devstats_create();
+	deviostat_create();
+	devzero_create();
 	semfs_bootstrap();
 }
 
@@ -180,7 +225,7 @@ vfs_sync(void)
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		dev = knowndevarray_get(knowndevs, i);
-		if (dev->kd_fs != NULL && dev->kd_fs != SWAP_FS) {
+		if (KD_HASFS(dev)) {
 			/*result =*/ FSOP_SYNC(dev->kd_fs);
 		}
 	}
@@ -191,83 +236,127 @@ vfs_sync(void)
 }
 
 /*
- * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
- * back an appropriate vnode.
+ * The name hash. Called with knowndevs_lock, for writing to change it.
  */
-int
-vfs_getroot(const char *devname, struct vnode **ret)
+static
+unsigned
+kd_hash(const char *name)
 {
-	struct knowndev *kd;
-	unsigned i, num;
+	unsigned h = 2166136261U;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	while (*name) {
+		h = (h * 16777619) ^ (unsigned char)*name++;
+	}
+	return h & (KD_NBUCKETS - 1);
+}
 
-	num = knowndevarray_num(knowndevs);
-	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
+/* Hash KN under NAME, for device KD; nothing if NAME is NULL */
+static
+void
+kd_hashadd(struct kdname *kn, const char *name, struct knowndev *kd)
+{
+	unsigned h;
 
-		/*
-		 * If this device has a mounted filesystem, and
-		 * DEVNAME names either the filesystem or the device,
-		 * return the root of the filesystem.
-		 *
-		 * If it has no mounted filesystem, it's mountable,
-		 * and DEVNAME names the device, return ENXIO.
-		 */
+	KASSERT(kn->kn_name == NULL);
+	if (name == NULL) {
+		return;
+	}
+	h = kd_hash(name);
+	kn->kn_name = name;
+	kn->kn_kd = kd;
+	kn->kn_next = kd_buckets[h];
+	kd_buckets[h] = kn;
+}
 
-		if (kd->kd_fs != NULL && kd->kd_fs != SWAP_FS) {
-			const char *volname;
-			volname = FSOP_GETVOLNAME(kd->kd_fs);
+/* Take KN out of the hash, if it's there */
+static
+void
+kd_hashremove(struct kdname *kn)
+{
+	struct kdname **knp;
 
-			if (!strcmp(kd->kd_name, devname) ||
-			    (volname!=NULL && !strcmp(volname, devname))) {
-				return FSOP_GETROOT(kd->kd_fs, ret);
-			}
-		}
-		else {
-			if (kd->kd_rawname!=NULL &&
-			    !strcmp(kd->kd_name, devname)) {
-				return ENXIO;
-			}
-		}
+	if (kn->kn_name == NULL) {
+		return;
+	}
+	for (knp = &kd_buckets[kd_hash(kn->kn_name)]; *knp != kn;
+	     knp = &(*knp)->kn_next) {
+		KASSERT(*knp != NULL);
+	}
+	*knp = kn->kn_next;
+	kn->kn_name = NULL;
+	kn->kn_next = NULL;
+}
 
-		/*
-		 * If DEVNAME names the device, and we get here, it
-		 * must have no fs and not be mountable. In this case,
-		 * we return the device itself.
-		 */
-		if (!strcmp(kd->kd_name, devname)) {
-			KASSERT(kd->kd_fs==NULL);
-			KASSERT(kd->kd_rawname==NULL);
-			KASSERT(kd->kd_device != NULL);
-			VOP_INCREF(kd->kd_vnode);
-			*ret = kd->kd_vnode;
-			return 0;
-		}
+/* Find NAME, or return NULL */
+static
+struct kdname *
+kd_hashfind(const char *name)
+{
+	struct kdname *kn;
 
-		/*
-		 * If the device has a rawname and DEVNAME names that,
-		 * return the device itself.
-		 */
-		if (kd->kd_rawname!=NULL && !strcmp(kd->kd_rawname, devname)) {
-			KASSERT(kd->kd_device != NULL);
-			VOP_INCREF(kd->kd_vnode);
-			*ret = kd->kd_vnode;
-			return 0;
+	for (kn = kd_buckets[kd_hash(name)]; kn != NULL; kn = kn->kn_next) {
+		if (!strcmp(kn->kn_name, name)) {
+			return kn;
 		}
+	}
+	return NULL;
+}
 
-		/*
-		 * If none of the above tests matched, we didn't name
-		 * any of the names of this device, so go on to the
-		 * next one.
-		 */
+/* Hash the volume name of KD's newly mounted filesystem */
+static
+void
+kd_hashvol(struct knowndev *kd)
+{
+	if (KD_HASFS(kd)) {
+		kd_hashadd(&kd->kd_hvol, FSOP_GETVOLNAME(kd->kd_fs), kd);
 	}
+}
 
-	/*
-	 * If we got here, the device specified by devname doesn't exist.
-	 */
+/*
+ * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
+ * back an appropriate vnode.
+ */
+int
+vfs_getroot(const char *devname, struct vnode **ret)
+{
+	struct knowndev *kd;
+	struct kdname *kn;
+	int result;
+
+	rwlock_acquire_read(knowndevs_lock);
+	kn = kd_hashfind(devname);
+	if (kn == NULL) {
+		/* The device specified by devname doesn't exist. */
+		rwlock_release_read(knowndevs_lock);
+		return ENODEV;
+	}
+	kd = kn->kn_kd;
 
-	return ENODEV;
+	if (kn == &kd->kd_hvol) {
+		/* Only hashed while mounted */
+		result = FSOP_GETROOT(kd->kd_fs, ret);
+	}
+	else if (kn == &kd->kd_hname && KD_HASFS(kd)) {
+		/* The device, with a filesystem mounted: its root */
+		result = FSOP_GETROOT(kd->kd_fs, ret);
+	}
+	else if (kn == &kd->kd_hname && kd->kd_rawname != NULL) {
+		/* A mountable device with nothing mounted */
+		result = ENXIO;
+	}
+	else {
+		/*
+		 * The raw device, or a device with no fs that isn't
+		 * mountable: the device itself.
+		 */
+		KASSERT(kn == &kd->kd_hraw || kd->kd_fs == NULL);
+		KASSERT(kd->kd_device != NULL);
+		VOP_INCREF(kd->kd_vnode);
+		*ret = kd->kd_vnode;
+		result = 0;
+	}
+	rwlock_release_read(knowndevs_lock);
+	return result;
 }
 
 /*
@@ -281,8 +370,7 @@ vfs_getdevname(struct fs *fs)
 
 	KASSERT(fs != NULL);
 
-	KASSERT(vfs_biglock_do_i_hold());
-
+	rwlock_acquire_read(knowndevs_lock);
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -294,9 +382,11 @@ vfs_getdevname(struct fs *fs)
 			 * the fs cannot go away, and the device can't
 			 * go away until the fs goes away.
 			 */
+			rwlock_release_read(knowndevs_lock);
 			return kd->kd_name;
 		}
 	}
+	rwlock_release_read(knowndevs_lock);
 
 	return NULL;
 }
@@ -319,65 +409,18 @@ mkrawname(const char *name)
 
 
 /*
- * Check if the two strings passed in are the same, if they're both
- * not NULL (the latter part being significant).
- */
-static
-inline
-int
-samestring(const char *a, const char *b)
-{
-	if (a==NULL || b==NULL) {
-		return 0;
-	}
-	return !strcmp(a, b);
-}
-
-/*
- * Check if the first string passed is the same as any of the three others,
- * if they're not NULL.
- */
-static
-inline
-int
-samestring3(const char *a, const char *b, const char *c, const char *d)
-{
-	return samestring(a,b) || samestring(a,c) || samestring(a,d);
-}
-
-/*
- * Check if any of the three names passed in already exists as a device
- * name.
+ * Check if any of the three names passed in (which may be NULL)
+ * already exists as a device name.
  */
-
 static
 int
 badnames(const char *n1, const char *n2, const char *n3)
 {
-	const char *volname;
-	unsigned i, num;
-	struct knowndev *kd;
-
 	KASSERT(vfs_biglock_do_i_hold());
 
-	num = knowndevarray_num(knowndevs);
-	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
-
-		if (kd->kd_fs != NULL && kd->kd_fs != SWAP_FS) {
-			volname = FSOP_GETVOLNAME(kd->kd_fs);
-			if (samestring3(volname, n1, n2, n3)) {
-				return 1;
-			}
-		}
-
-		if (samestring3(kd->kd_rawname, n1, n2, n3) ||
-		    samestring3(kd->kd_name, n1, n2, n3)) {
-			return 1;
-		}
-	}
-
-	return 0;
+	return (n1 != NULL && kd_hashfind(n1) != NULL) ||
+		(n2 != NULL && kd_hashfind(n2) != NULL) ||
+		(n3 != NULL && kd_hashfind(n3) != NULL);
 }
 
 /*
@@ -433,20 +476,30 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	kd->kd_device = dev;
 	kd->kd_vnode = vnode;
 	kd->kd_fs = fs;
+	kd->kd_hname.kn_name = NULL;
+	kd->kd_hraw.kn_name = NULL;
+	kd->kd_hvol.kn_name = NULL;
 
 	if (fs!=NULL) {
 		volname = FSOP_GETVOLNAME(fs);
 	}
 
+	rwlock_acquire_write(knowndevs_lock);
 	if (badnames(name, rawname, volname)) {
+		rwlock_release_write(knowndevs_lock);
 		result = EEXIST;
 		goto fail;
 	}
 
 	result = knowndevarray_add(knowndevs, kd, &index);
 	if (result) {
+		rwlock_release_write(knowndevs_lock);
 		goto fail;
 	}
+	kd_hashadd(&kd->kd_hname, name, kd);
+	kd_hashadd(&kd->kd_hraw, rawname, kd);
+	kd_hashvol(kd);
+	rwlock_release_write(knowndevs_lock);
 
 	if (dev != NULL) {
 		/* use index+1 as the device number, so 0 is reserved */
@@ -499,33 +552,24 @@ vfs_addfs(const char *devname, struct fs *fs)
 
 /*
  * Look for a mountable device named DEVNAME.
- * Should already hold knowndevs_lock.
+ * Should already hold vfs_biglock.
  */
 static
 int
 findmount(const char *devname, struct knowndev **result)
 {
-	struct knowndev *dev;
-	unsigned i, num;
-	bool found = false;
+	struct kdname *kn;
 
 	KASSERT(vfs_biglock_do_i_hold());
 
-	num = knowndevarray_num(knowndevs);
-	for (i=0; !found && i<num; i++) {
-		dev = knowndevarray_get(knowndevs, i);
-		if (dev->kd_rawname==NULL) {
-			/* not mountable/unmountable */
-			continue;
-		}
-
-		if (!strcmp(devname, dev->kd_name)) {
-			*result = dev;
-			found = true;
-		}
+	kn = kd_hashfind(devname);
+	if (kn == NULL || kn != &kn->kn_kd->kd_hname ||
+	    kn->kn_kd->kd_rawname == NULL) {
+		/* not there, or not mountable/unmountable */
+		return ENODEV;
 	}
-
-	return found ? 0 : ENODEV;
+	*result = kn->kn_kd;
+	return 0;
 }
 
 /*
@@ -565,11 +609,17 @@ vfs_mount(const char *devname, void *data,
 	}
 
 	KASSERT(fs != NULL);
-	KASSERT(fs != SWAP_FS); 
+	KASSERT(fs != SWAP_FS && fs != CLAIMED_FS);
 
+	/* A volume name that's taken just isn't hashed */
+	volname = FSOP_GETVOLNAME(fs);
+	rwlock_acquire_write(knowndevs_lock);
 	kd->kd_fs = fs;
+	if (volname == NULL || kd_hashfind(volname) == NULL) {
+		kd_hashvol(kd);
+	}
+	rwlock_release_write(knowndevs_lock);
 
-	volname = FSOP_GETVOLNAME(fs);
 	kprintf("vfs: Mounted %s: on %s\n",
 		volname ? volname : kd->kd_name, kd->kd_name);
 
@@ -583,7 +633,7 @@ vfs_mount(const char *devname, void *data,
  * to avoid student-facing confusion.
  */
 int
-vfs_swapon(const char *devname, struct vnode **ret)
+vfs_swapon(const char *devname, struct vnode **ret, struct device **retdev)
 {
 	char *myname = NULL;
 	size_t len;
@@ -617,9 +667,12 @@ vfs_swapon(const char *devname, struct vnode **ret)
 
 	kprintf("vfs: Swap attached to %s\n", kd->kd_name);
 
+	rwlock_acquire_write(knowndevs_lock);
 	kd->kd_fs = SWAP_FS;
+	rwlock_release_write(knowndevs_lock);
 	VOP_INCREF(kd->kd_vnode);
 	*ret = kd->kd_vnode;
+	*retdev = kd->kd_device;
 
  out:
 	vfs_biglock_release();
@@ -647,13 +700,16 @@ vfs_unmount(const char *devname)
 		goto fail;
 	}
 
-	if (kd->kd_fs == NULL || kd->kd_fs == SWAP_FS) {
+	if (!KD_HASFS(kd)) {
 		result = EINVAL;
 		goto fail;
 	}
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+	/* let go of any vnodes the name cache is holding */
+	vfs_ncache_purgefs(kd->kd_fs);
+
 	/* sync the fs */
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
@@ -668,7 +724,10 @@ vfs_unmount(const char *devname)
 	kprintf("vfs: Unmounted %s:\n", kd->kd_name);
 
 	/* now drop the filesystem */
+	rwlock_acquire_write(knowndevs_lock);
+	kd_hashremove(&kd->kd_hvol);
 	kd->kd_fs = NULL;
+	rwlock_release_write(knowndevs_lock);
 
 	KASSERT(result==0);
 
@@ -705,7 +764,9 @@ vfs_swapoff(const char *devname)
 	kprintf("vfs: Swap detached from %s:\n", kd->kd_name);
 
 	/* drop it */
+	rwlock_acquire_write(knowndevs_lock);
 	kd->kd_fs = NULL;
+	rwlock_release_write(knowndevs_lock);
 
 	KASSERT(result==0);
 
@@ -714,6 +775,70 @@ vfs_swapoff(const char *devname)
 	return result;
 }
 
+/*
+ * Claim a device for use as part of another device, such as a
+ * stripe: like swapon, it can't then be mounted or swapped on. Hands
+ * back the device.
+ */
+int
+vfs_claimdev(const char *devname, struct device **retdev)
+{
+	struct knowndev *kd;
+	int result;
+
+	vfs_biglock_acquire();
+
+	result = findmount(devname, &kd);
+	if (result) {
+		goto out;
+	}
+
+	if (kd->kd_fs != NULL) {
+		result = EBUSY;
+		goto out;
+	}
+	KASSERT(kd->kd_device != NULL);
+
+	rwlock_acquire_write(knowndevs_lock);
+	kd->kd_fs = CLAIMED_FS;
+	rwlock_release_write(knowndevs_lock);
+	*retdev = kd->kd_device;
+
+ out:
+	vfs_biglock_release();
+	return result;
+}
+
+/*
+ * Give back a device taken with vfs_claimdev.
+ */
+int
+vfs_releasedev(const char *devname)
+{
+	struct knowndev *kd;
+	int result;
+
+	vfs_biglock_acquire();
+
+	result = findmount(devname, &kd);
+	if (result) {
+		goto out;
+	}
+
+	if (kd->kd_fs != CLAIMED_FS) {
+		result = EINVAL;
+		goto out;
+	}
+
+	rwlock_acquire_write(knowndevs_lock);
+	kd->kd_fs = NULL;
+	rwlock_release_write(knowndevs_lock);
+
+ out:
+	vfs_biglock_release();
+	return result;
+}
+
 /*
  * Global unmount function.
  */
@@ -726,6 +851,9 @@ vfs_unmountall(void)
 
 	vfs_biglock_acquire();
 
+	/* let go of any vnodes the name cache is holding */
+	vfs_ncache_purgefs(NULL);
+
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		dev = knowndevarray_get(knowndevs, i);
@@ -739,7 +867,13 @@ vfs_unmountall(void)
 		}
 		if (dev->kd_fs == SWAP_FS) {
 			/* just drop it */
+			rwlock_acquire_write(knowndevs_lock);
 			dev->kd_fs = NULL;
+			rwlock_release_write(knowndevs_lock);
+			continue;
+		}
+		if (dev->kd_fs == CLAIMED_FS) {
+			/* belongs to another device; leave it be */
 			continue;
 		}
 
@@ -777,7 +911,10 @@ vfs_unmountall(void)
 		}
 
 		/* now drop the filesystem */
+		rwlock_acquire_write(knowndevs_lock);
+		kd_hashremove(&dev->kd_hvol);
 		dev->kd_fs = NULL;
+		rwlock_release_write(knowndevs_lock);
 	}
 
 	vfs_biglock_release();
@@ -234,6 +234,76 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	return 0;
 }
 
+/*
+ * Walk PATH from STARTVN one component at a time, going through the
+ * name cache, and hand back the vnode at the end. Both successful
+ * lookups and ENOENT are remembered, so a path that's been resolved
+ * before resolves again without calling the filesystem.
+ *
+ * Destroys PATH.
+ */
+static
+int
+lookup_walk(struct vnode *startvn, char *path, struct vnode **retval)
+{
+	char name[NAME_MAX+1];
+	struct vnode *dir, *vn;
+	char *next;
+	bool cached;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	VOP_INCREF(startvn);
+	dir = startvn;
+
+	while (1) {
+		while (*path == '/') {
+			path++;
+		}
+		if (*path == 0) {
+			break;
+		}
+		next = strchr(path, '/');
+		if (next != NULL) {
+			*next++ = 0;
+		}
+		else {
+			next = path + strlen(path);
+		}
+		if (strlen(path) > NAME_MAX) {
+			VOP_DECREF(dir);
+			return ENAMETOOLONG;
+		}
+		/* VOP_LOOKUP may destroy its argument; keep the name. */
+		strcpy(name, path);
+
+		cached = vfs_ncache_lookup(dir, name, &vn);
+		if (cached) {
+			result = vn != NULL ? 0 : ENOENT;
+		}
+		else {
+			result = VOP_LOOKUP(dir, path, &vn);
+			if (result == 0) {
+				vfs_ncache_enter(dir, name, vn);
+			}
+			else if (result == ENOENT) {
+				vfs_ncache_enter(dir, name, NULL);
+			}
+		}
+
+		VOP_DECREF(dir);
+		if (result) {
+			return result;
+		}
+		dir = vn;
+		path = next;
+	}
+
+	*retval = dir;
+	return 0;
+}
+
 /*
  * Name-to-vnode translation.
  * (In BSD, both of these are subsumed by namei().)
@@ -243,7 +313,8 @@ int
 vfs_lookparent(char *path, struct vnode **retval,
 	       char *buf, size_t buflen)
 {
-	struct vnode *startvn;
+	struct vnode *startvn, *dir;
+	char *lastslash;
 	int result;
 
 	vfs_biglock_acquire();
@@ -262,9 +333,21 @@ vfs_lookparent(char *path, struct vnode **retval,
 		 */
 		result = EINVAL;
 	}
-	else {
+	else if ((lastslash = strrchr(path, '/')) == NULL ||
+		 lastslash[1] == 0) {
+		/* Single component, or trailing slash; let the fs decide */
 		result = VOP_LOOKPARENT(startvn, path, retval, buf, buflen);
 	}
+	else {
+		/* Walk to the directory, then split off the last name */
+		*lastslash = 0;
+		result = lookup_walk(startvn, path, &dir);
+		if (result == 0) {
+			result = VOP_LOOKPARENT(dir, lastslash + 1, retval,
+						buf, buflen);
+			VOP_DECREF(dir);
+		}
+	}
 
 	VOP_DECREF(startvn);
 
@@ -292,7 +375,7 @@ vfs_lookup(char *path, struct vnode **retval)
 		return 0;
 	}
 
-	result = VOP_LOOKUP(startvn, path, retval);
+	result = lookup_walk(startvn, path, retval);
 
 	VOP_DECREF(startvn);
 	vfs_biglock_release();
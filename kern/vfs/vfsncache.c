@@ -0,0 +1,285 @@
+/*
+ * VFS name cache.
+ *
+ * Maps (directory vnode, name) to the vnode the name refers to, or
+ * records that the name doesn't exist (a negative entry), so path
+ * lookup can walk already-seen components without calling into the
+ * filesystem at all.
+ *
+ * Each entry holds a reference to its directory and, if positive, to
+ * the target vnode, so neither can be reclaimed (and its memory
+ * reused for some other vnode) while the entry exists. The cost is
+ * that cached files stay loaded; the cache is small and LRU, entries
+ * are purged as names are removed or renamed, and everything on a
+ * filesystem is purged before it is unmounted.
+ *
+ * Names of NC_NAMELEN characters or more, and "." and "..", are not
+ * cached.
+ *
+ * All of this is protected by vfs_biglock.
+ * vfs_ncache_purgename takes it; the rest expect it held.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <vfs.h>
+#include <vnode.h>
+
+#define NC_SIZE		128	/* entries */
+#define NC_NBUCKETS	64	/* hash chains; power of 2 */
+#define NC_NAMELEN	32
+
+struct ncentry {
+	struct vnode *nc_dir;		/* NULL if the entry is free */
+	struct vnode *nc_vn;		/* NULL for a negative entry */
+	char nc_name[NC_NAMELEN];
+	struct ncentry *nc_hashnext;
+	struct ncentry *nc_lruprev;	/* most recently used at head */
+	struct ncentry *nc_lrunext;
+};
+
+static struct ncentry nc_entries[NC_SIZE];
+static struct ncentry *nc_buckets[NC_NBUCKETS];
+static struct ncentry *nc_lruhead, *nc_lrutail;
+
+static
+unsigned
+nc_hash(struct vnode *dir, const char *name)
+{
+	unsigned h = (unsigned)(uintptr_t)dir >> 4;
+
+	while (*name) {
+		h = (h * 16777619) ^ (unsigned char)*name++;
+	}
+	return h & (NC_NBUCKETS - 1);
+}
+
+static
+void
+nc_lru_remove(struct ncentry *nc)
+{
+	if (nc->nc_lruprev != NULL) {
+		nc->nc_lruprev->nc_lrunext = nc->nc_lrunext;
+	}
+	else {
+		nc_lruhead = nc->nc_lrunext;
+	}
+	if (nc->nc_lrunext != NULL) {
+		nc->nc_lrunext->nc_lruprev = nc->nc_lruprev;
+	}
+	else {
+		nc_lrutail = nc->nc_lruprev;
+	}
+}
+
+static
+void
+nc_lru_addhead(struct ncentry *nc)
+{
+	nc->nc_lruprev = NULL;
+	nc->nc_lrunext = nc_lruhead;
+	if (nc_lruhead != NULL) {
+		nc_lruhead->nc_lruprev = nc;
+	}
+	else {
+		nc_lrutail = nc;
+	}
+	nc_lruhead = nc;
+}
+
+static
+void
+nc_lru_addtail(struct ncentry *nc)
+{
+	nc->nc_lrunext = NULL;
+	nc->nc_lruprev = nc_lrutail;
+	if (nc_lrutail != NULL) {
+		nc_lrutail->nc_lrunext = nc;
+	}
+	else {
+		nc_lruhead = nc;
+	}
+	nc_lrutail = nc;
+}
+
+/*
+ * Return true if NAME is one we cache.
+ */
+static
+bool
+nc_cacheable(const char *name)
+{
+	return strlen(name) < NC_NAMELEN &&
+		strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
+
+static
+struct ncentry *
+nc_find(struct vnode *dir, const char *name)
+{
+	struct ncentry *nc;
+
+	for (nc = nc_buckets[nc_hash(dir, name)]; nc != NULL;
+	     nc = nc->nc_hashnext) {
+		if (nc->nc_dir == dir && !strcmp(nc->nc_name, name)) {
+			return nc;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Empty out an entry and move it to the LRU tail, to be reused first.
+ */
+static
+void
+nc_drop(struct ncentry *nc)
+{
+	struct ncentry **ncp;
+	struct vnode *dir, *vn;
+
+	KASSERT(nc->nc_dir != NULL);
+
+	ncp = &nc_buckets[nc_hash(nc->nc_dir, nc->nc_name)];
+	while (*ncp != nc) {
+		KASSERT(*ncp != NULL);
+		ncp = &(*ncp)->nc_hashnext;
+	}
+	*ncp = nc->nc_hashnext;
+
+	dir = nc->nc_dir;
+	vn = nc->nc_vn;
+	nc->nc_dir = NULL;
+	nc->nc_vn = NULL;
+	nc_lru_remove(nc);
+	nc_lru_addtail(nc);
+
+	/* These may reclaim, which is why the entry is unhooked first. */
+	if (vn != NULL) {
+		VOP_DECREF(vn);
+	}
+	VOP_DECREF(dir);
+}
+
+void
+vfs_ncache_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<NC_SIZE; i++) {
+		nc_entries[i].nc_dir = NULL;
+		nc_entries[i].nc_vn = NULL;
+		nc_lru_addtail(&nc_entries[i]);
+	}
+}
+
+bool
+vfs_ncache_lookup(struct vnode *dir, const char *name, struct vnode **ret)
+{
+	struct ncentry *nc;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!nc_cacheable(name)) {
+		return false;
+	}
+	nc = nc_find(dir, name);
+	if (nc == NULL) {
+		return false;
+	}
+	nc_lru_remove(nc);
+	nc_lru_addhead(nc);
+	if (nc->nc_vn != NULL) {
+		VOP_INCREF(nc->nc_vn);
+	}
+	*ret = nc->nc_vn;
+	return true;
+}
+
+void
+vfs_ncache_enter(struct vnode *dir, const char *name, struct vnode *vn)
+{
+	struct ncentry *nc;
+	unsigned h;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!nc_cacheable(name)) {
+		return;
+	}
+	nc = nc_find(dir, name);
+	if (nc != NULL) {
+		nc_drop(nc);
+	}
+
+	nc = nc_lrutail;
+	if (nc->nc_dir != NULL) {
+		nc_drop(nc);
+		/* dropping may reclaim, but never adds entries */
+		nc = nc_lrutail;
+		KASSERT(nc->nc_dir == NULL);
+	}
+
+	VOP_INCREF(dir);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	nc->nc_dir = dir;
+	nc->nc_vn = vn;
+	strcpy(nc->nc_name, name);
+	h = nc_hash(dir, name);
+	nc->nc_hashnext = nc_buckets[h];
+	nc_buckets[h] = nc;
+	nc_lru_remove(nc);
+	nc_lru_addhead(nc);
+}
+
+void
+vfs_ncache_purgename(struct vnode *dir, const char *name)
+{
+	struct ncentry *nc;
+	struct vnode *vn;
+	unsigned i;
+
+	if (!nc_cacheable(name)) {
+		return;
+	}
+
+	vfs_biglock_acquire();
+	nc = nc_find(dir, name);
+	if (nc == NULL) {
+		vfs_biglock_release();
+		return;
+	}
+
+	/* If it was a directory that's gone, so are names in it. */
+	vn = nc->nc_vn;
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	nc_drop(nc);
+	if (vn != NULL) {
+		for (i=0; i<NC_SIZE; i++) {
+			if (nc_entries[i].nc_dir == vn) {
+				nc_drop(&nc_entries[i]);
+			}
+		}
+		VOP_DECREF(vn);
+	}
+	vfs_biglock_release();
+}
+
+void
+vfs_ncache_purgefs(struct fs *fs)
+{
+	unsigned i;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	for (i=0; i<NC_SIZE; i++) {
+		if (nc_entries[i].nc_dir != NULL &&
+		    (fs == NULL || nc_entries[i].nc_dir->vn_fs == fs)) {
+			nc_drop(&nc_entries[i]);
+		}
+	}
+}
@@ -74,6 +74,7 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 		}
 
 		result = VOP_CREAT(dir, name, excl, mode, &vn);
+		vfs_ncache_purgename(dir, name);
 
 		VOP_DECREF(dir);
 	}
@@ -146,11 +147,15 @@ vfs_remove(char *path)
 	}
 
 	result = VOP_REMOVE(dir, name);
+	vfs_ncache_purgename(dir, name);
 	VOP_DECREF(dir);
 
 	return result;
 }
 
+/* See vfs.h */
+volatile unsigned vfs_namegen;
+
 /* Does most of the work for rename(). */
 int
 vfs_rename(char *oldpath, char *newpath)
@@ -179,6 +184,9 @@ vfs_rename(char *oldpath, char *newpath)
 	}
 
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
+	vfs_ncache_purgename(olddir, oldname);
+	vfs_ncache_purgename(newdir, newname);
+	vfs_namegen++;
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
@@ -213,6 +221,7 @@ vfs_link(char *oldpath, char *newpath)
 	}
 
 	result = VOP_LINK(newdir, newname, oldfile);
+	vfs_ncache_purgename(newdir, newname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
@@ -240,6 +249,7 @@ vfs_symlink(const char *contents, char *path)
 	}
 
 	result = VOP_SYMLINK(newdir, newname, contents);
+	vfs_ncache_purgename(newdir, newname);
 	VOP_DECREF(newdir);
 
 	return result;
@@ -286,6 +296,7 @@ vfs_mkdir(char *path, mode_t mode)
 	}
 
 	result = VOP_MKDIR(parent, name, mode);
+	vfs_ncache_purgename(parent, name);
 
 	VOP_DECREF(parent);
 
@@ -308,6 +319,8 @@ vfs_rmdir(char *path)
 	}
 
 	result = VOP_RMDIR(parent, name);
+	vfs_ncache_purgename(parent, name);
+	vfs_namegen++;
 
 	VOP_DECREF(parent);
 
@@ -0,0 +1,197 @@
+/*
+ * Poll wait queues. See poll.h.
+ *
+ * A pollset is one sys_poll call. On its first pass over the file
+ * handles each object that isn't ready hangs an entry for the
+ * pollset on its pollhead(s); then the poller sleeps on the
+ * pollset's own wchan, and any pollhead_wakeup on any of those
+ * objects wakes it to look again. The entries come out of an array
+ * sized up front, so registering can't fail; if it runs out anyway
+ * the pollset is marked woken, which makes the poller rescan rather
+ * than sleep.
+ *
+ * Locking: a pollhead's lock covers its list of entries; a pollset's
+ * lock covers its woken flag and wchan. The pollhead lock comes
+ * first.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <membar.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <vnode.h>
+#include <poll.h>
+
+struct pollentry {
+	struct pollentry *pe_next;	/* on pe_head's list */
+	struct pollhead *pe_head;
+	struct pollset *pe_set;
+};
+
+struct pollset {
+	struct spinlock ps_lock;
+	struct wchan *ps_wchan;
+	bool ps_woken;			/* a pollhead woke us */
+	unsigned ps_nentries;
+	unsigned ps_maxentries;
+	struct pollentry ps_entries[];
+};
+
+////////////////////////////////////////////////////////////
+// pollheads
+
+void
+pollhead_init(struct pollhead *ph)
+{
+	spinlock_init(&ph->ph_lock);
+	ph->ph_entries = NULL;
+}
+
+void
+pollhead_cleanup(struct pollhead *ph)
+{
+	/* A pollset holds a reference to what it's polling */
+	KASSERT(ph->ph_entries == NULL);
+	spinlock_cleanup(&ph->ph_lock);
+}
+
+void
+pollhead_wakeup(struct pollhead *ph)
+{
+	struct pollentry *pe;
+	struct pollset *ps;
+
+	/*
+	 * Pairs with the barrier in pollset_register: either we see
+	 * the entry, or the poller sees whatever our caller changed.
+	 */
+	membar_any_any();
+	if (ph->ph_entries == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&ph->ph_lock);
+	for (pe = ph->ph_entries; pe != NULL; pe = pe->pe_next) {
+		ps = pe->pe_set;
+		spinlock_acquire(&ps->ps_lock);
+		ps->ps_woken = true;
+		wchan_wakeall(ps->ps_wchan, &ps->ps_lock);
+		spinlock_release(&ps->ps_lock);
+	}
+	spinlock_release(&ph->ph_lock);
+}
+
+void
+pollset_register(struct pollset *ps, struct pollhead *ph)
+{
+	struct pollentry *pe;
+
+	if (ps == NULL) {
+		return;
+	}
+	if (ps->ps_nentries == ps->ps_maxentries) {
+		/* Can't wait on this; make sure we don't wait at all */
+		spinlock_acquire(&ps->ps_lock);
+		ps->ps_woken = true;
+		spinlock_release(&ps->ps_lock);
+		return;
+	}
+
+	pe = &ps->ps_entries[ps->ps_nentries++];
+	pe->pe_head = ph;
+	pe->pe_set = ps;
+
+	spinlock_acquire(&ph->ph_lock);
+	pe->pe_next = ph->ph_entries;
+	ph->ph_entries = pe;
+	spinlock_release(&ph->ph_lock);
+
+	/* Be on the list before the caller checks the object. */
+	membar_any_any();
+}
+
+////////////////////////////////////////////////////////////
+// pollsets
+
+struct pollset *
+pollset_create(unsigned maxreg)
+{
+	struct pollset *ps;
+
+	ps = kmalloc(sizeof(*ps) + maxreg * sizeof(struct pollentry));
+	if (ps == NULL) {
+		return NULL;
+	}
+	ps->ps_wchan = wchan_create("poll");
+	if (ps->ps_wchan == NULL) {
+		kfree(ps);
+		return NULL;
+	}
+	spinlock_init(&ps->ps_lock);
+	ps->ps_woken = false;
+	ps->ps_nentries = 0;
+	ps->ps_maxentries = maxreg;
+	return ps;
+}
+
+void
+pollset_destroy(struct pollset *ps)
+{
+	struct pollentry *pe, **pp;
+	struct pollhead *ph;
+	unsigned i;
+
+	for (i=0; i<ps->ps_nentries; i++) {
+		pe = &ps->ps_entries[i];
+		ph = pe->pe_head;
+		spinlock_acquire(&ph->ph_lock);
+		for (pp = &ph->ph_entries; *pp != pe; pp = &(*pp)->pe_next) {
+			KASSERT(*pp != NULL);
+		}
+		*pp = pe->pe_next;
+		spinlock_release(&ph->ph_lock);
+	}
+
+	wchan_destroy(ps->ps_wchan);
+	spinlock_cleanup(&ps->ps_lock);
+	kfree(ps);
+}
+
+int
+pollset_wait(struct pollset *ps, unsigned ticks)
+{
+	int result = 0;
+
+	spinlock_acquire(&ps->ps_lock);
+	if (!ps->ps_woken) {
+		if (ticks == 0) {
+			wchan_sleep(ps->ps_wchan, &ps->ps_lock);
+		}
+		else {
+			result = wchan_sleep_timeout(ps->ps_wchan,
+						     &ps->ps_lock, ticks);
+		}
+	}
+	ps->ps_woken = false;
+	spinlock_release(&ps->ps_lock);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// vnodes
+
+/*
+ * vop_poll for objects that never block: whatever was asked about
+ * is ready now.
+ */
+int
+vop_poll_ready(struct vnode *vn, int events, struct pollset *ps,
+	       int *result)
+{
+	(void)vn;
+	(void)ps;
+
+	*result = events & (POLLIN | POLLOUT);
+	return 0;
+}
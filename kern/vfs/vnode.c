@@ -32,11 +32,31 @@
  */
 #include <types.h>
 #include <kern/errno.h>
+#include <stat.h>
+#include <kern/dirent.h>
+#include <limits.h>
 #include <lib.h>
 #include <synch.h>
+#include <uio.h>
 #include <vfs.h>
 #include <vnode.h>
 
+/* Source of vn_version values */
+static struct spinlock vnode_versionlock = SPINLOCK_INITIALIZER;
+static unsigned vnode_nextversion;
+
+static
+unsigned
+vnode_newversion(void)
+{
+	unsigned v;
+
+	spinlock_acquire(&vnode_versionlock);
+	v = ++vnode_nextversion;
+	spinlock_release(&vnode_versionlock);
+	return v;
+}
+
 /*
  * Initialize an abstract vnode.
  */
@@ -50,6 +70,9 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	vn->vn_ops = ops;
 	vn->vn_refcount = 1;
 	spinlock_init(&vn->vn_countlock);
+	vn->vn_version = vnode_newversion();
+	vn->vn_filecache = NULL;
+	vn->vn_locks = NULL;
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
 	return 0;
@@ -62,7 +85,10 @@ void
 vnode_cleanup(struct vnode *vn)
 {
 	KASSERT(vn->vn_refcount == 1);
+	/* The file cache holds a reference */
+	KASSERT(vn->vn_filecache == NULL);
 
+	vnode_locks_destroy(vn);
 	spinlock_cleanup(&vn->vn_countlock);
 
 	vn->vn_ops = NULL;
@@ -122,6 +148,133 @@ vnode_decref(struct vnode *vn)
 	}
 }
 
+/*
+ * Return the current version of the contents.
+ */
+unsigned
+vnode_version(struct vnode *vn)
+{
+	unsigned v;
+
+	spinlock_acquire(&vn->vn_countlock);
+	v = vn->vn_version;
+	spinlock_release(&vn->vn_countlock);
+	return v;
+}
+
+/*
+ * Write, and give the vnode a new version. Called by VOP_WRITE.
+ *
+ * The version changes after the write, so that anyone who looked at
+ * the version before reading something the write touches will see
+ * that it changed.
+ */
+int
+vnode_write(struct vnode *vn, struct uio *uio)
+{
+	unsigned v;
+	int result;
+
+	result = __VOP(vn, write)(vn, uio);
+	v = vnode_newversion();
+	spinlock_acquire(&vn->vn_countlock);
+	vn->vn_version = v;
+	spinlock_release(&vn->vn_countlock);
+	return result;
+}
+
+/*
+ * Write on behalf of a cache of the file's contents at version
+ * *VERSION, which already holds the data being written. If nothing
+ * else has changed the file since, the cache still matches it, so
+ * *VERSION is moved on to the new version too.
+ */
+int
+vnode_writeback(struct vnode *vn, struct uio *uio, unsigned *version)
+{
+	unsigned v;
+	int result;
+
+	result = __VOP(vn, write)(vn, uio);
+	v = vnode_newversion();
+	spinlock_acquire(&vn->vn_countlock);
+	if (vn->vn_version == *version) {
+		*version = v;
+	}
+	vn->vn_version = v;
+	spinlock_release(&vn->vn_countlock);
+	return result;
+}
+
+/*
+ * Likewise for truncate. Called by VOP_TRUNCATE.
+ */
+int
+vnode_truncate(struct vnode *vn, off_t len)
+{
+	unsigned v;
+	int result;
+
+	result = __VOP(vn, truncate)(vn, len);
+	v = vnode_newversion();
+	spinlock_acquire(&vn->vn_countlock);
+	vn->vn_version = v;
+	spinlock_release(&vn->vn_countlock);
+	return result;
+}
+
+/*
+ * vop_getdents for file systems that only have vop_getdirentry: get
+ * names one at a time, each into its own record, until the next one
+ * doesn't fit. Inode numbers aren't known.
+ */
+int
+vop_getdents_byentry(struct vnode *dir, struct uio *uio)
+{
+	union {
+		struct dirent d;
+		char buf[DIRENT_RECLEN(NAME_MAX)];
+	} rec;
+	struct iovec iov;
+	struct uio ku;
+	size_t namelen, reclen;
+	bool any;
+	int result;
+
+	any = false;
+	while (1) {
+		/* zeroed so the padding doesn't hand out stack contents */
+		bzero(&rec, sizeof(rec));
+		uio_kinit(&iov, &ku, rec.d.d_name, NAME_MAX, uio->uio_offset,
+			  UIO_READ);
+		result = VOP_GETDIRENTRY(dir, &ku);
+		if (result) {
+			return result;
+		}
+		namelen = NAME_MAX - ku.uio_resid;
+		if (namelen == 0) {
+			/* end of directory */
+			return 0;
+		}
+		reclen = DIRENT_RECLEN(namelen);
+		if (reclen > uio->uio_resid) {
+			/* Leave it for next time */
+			return any ? 0 : EINVAL;
+		}
+		rec.d.d_off = ku.uio_offset;
+		rec.d.d_ino = 0;
+		rec.d.d_reclen = reclen;
+		rec.d.d_namelen = namelen;
+		result = uiomove(&rec, reclen, uio);
+		if (result) {
+			return result;
+		}
+		/* uiomove counted bytes; the offset is the directory's */
+		uio->uio_offset = ku.uio_offset;
+		any = true;
+	}
+}
+
 /*
  * Check for various things being valid.
  * Called before all VOP_* calls.
@@ -29,15 +29,33 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <lib.h>
+#include <membar.h>
+#include <synch.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <filecache.h>
+#include <shm.h>
 #include <proc.h>
+#include <current.h>
+#include <vnode.h>
+#include <kern/stat.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
  * assignment, this file is not compiled or linked or in any way
  * used. The cheesy hack versions in dumbvm.c are used instead.
+ *
+ * An address space here is a list of regions plus a page table.
+ * Defining a region allocates nothing; pages are created zero-filled
+ * by vm_fault() the first time they are touched, so a program only
+ * pays for the memory it actually uses. Read-only parts of the
+ * program itself are mapped from the executable the same way, by
+ * as_map_file(), instead of being read in by load_elf(); so are
+ * files the program maps with mmap, by as_mmap().
  */
 
 struct addrspace *
@@ -50,40 +68,230 @@ as_create(void)
 		return NULL;
 	}
 
-	/*
-	 * Initialize as needed.
-	 */
-
+	as->as_regions = NULL;
+	as->as_loading = false;
+	as->as_asid = 0;
+	as->as_asidgen = 0;
+	as->as_threadstacks = 0;
+	as->as_heap = NULL;
+	as->as_stack = NULL;
+	as->as_lockfuture = false;
+	as->as_lockonexec = false;
+	as->as_maplock = lock_create("as_map");
+	if (as->as_maplock == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	as->as_pt = pt_create(as);
+	if (as->as_pt == NULL) {
+		lock_destroy(as->as_maplock);
+		kfree(as);
+		return NULL;
+	}
 	return as;
 }
 
+static
+int
+as_addregion(struct addrspace *as, vaddr_t base, size_t npages, int perm)
+{
+	struct vm_region *vr;
+
+	vr = kmalloc(sizeof(*vr));
+	if (vr == NULL) {
+		return ENOMEM;
+	}
+	vr->vr_base = base;
+	vr->vr_npages = npages;
+	vr->vr_perm = perm;
+	vr->vr_file = NULL;
+	vr->vr_fileoff = 0;
+	vr->vr_filestart = vr->vr_fileend = 0;
+	vr->vr_shm = NULL;
+	vr->vr_advice = MADV_NORMAL;
+	vr->vr_next = as->as_regions;
+	/* as_msync walks the list without vm_lock; link in last */
+	membar_store_store();
+	as->as_regions = vr;
+	return 0;
+}
+
+/*
+ * Would adding NPAGES to AS take it past the current process's
+ * RLIMIT_AS? Growth is checked against it; as_copy isn't, since the
+ * copy is no bigger than what the process already has.
+ */
+static
+bool
+as_overlimit(struct addrspace *as, size_t npages)
+{
+	struct vm_region *vr;
+	rlim_t lim;
+	rlim_t total;
+
+	lim = proc_getrlimit(curproc, RLIMIT_AS);
+	if (lim == RLIM_INFINITY) {
+		return false;
+	}
+	total = npages;
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		total += vr->vr_npages;
+	}
+	return total * PAGE_SIZE > lim;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	struct vm_region *vr, *newvr;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
 		return ENOMEM;
 	}
 
+	for (vr = old->as_regions; vr != NULL; vr = vr->vr_next) {
+		result = as_addregion(newas, vr->vr_base, vr->vr_npages,
+				      vr->vr_perm);
+		if (result) {
+			as_destroy(newas);
+			return result;
+		}
+		/* as_addregion put the copy at the head */
+		newvr = newas->as_regions;
+		newvr->vr_advice = vr->vr_advice;
+		if (vr == old->as_heap) {
+			newas->as_heap = newvr;
+		}
+		if (vr == old->as_stack) {
+			newas->as_stack = newvr;
+		}
+		if (vr->vr_file != NULL) {
+			filecache_incref(vr->vr_file);
+			newvr->vr_file = vr->vr_file;
+			newvr->vr_fileoff = vr->vr_fileoff;
+			newvr->vr_filestart = vr->vr_filestart;
+			newvr->vr_fileend = vr->vr_fileend;
+		}
+		if (vr->vr_shm != NULL) {
+			shm_incref(vr->vr_shm);
+			newvr->vr_shm = vr->vr_shm;
+		}
+	}
+	newas->as_threadstacks = old->as_threadstacks;
+
 	/*
-	 * Write this.
+	 * Share the pages copy-on-write. Since the old address space
+	 * is now read-only too, its writable TLB entries must go on
+	 * every CPU it has run on; retiring its ASID does that.
 	 */
-
-	(void)old;
+	lock_acquire(vm_lock);
+	result = pt_copy(old->as_pt, newas->as_pt);
+	vmtlb_newasid(old);
+	lock_release(vm_lock);
+	if (result) {
+		as_destroy(newas);
+		return result;
+	}
 
 	*ret = newas;
 	return 0;
 }
 
+/*
+ * Write back the pages from START to END of the shared mmap region VR
+ * that have been written since they were last written back. With
+ * LIVE set, the process may still be running, so each page's
+ * writable TLB entries have to go, for the next write to mark it
+ * again.
+ */
+static
+int
+as_syncregion(struct addrspace *as, struct vm_region *vr,
+	      vaddr_t start, vaddr_t end, bool live)
+{
+	vaddr_t va, fstart, fend;
+	pte_t *pte;
+	paddr_t pa;
+	int result, err;
+
+	if ((vr->vr_perm & VR_SHARED) == 0 || vr->vr_file == NULL) {
+		return 0;
+	}
+
+	err = 0;
+	pte = NULL;
+	for (va = start; va < end; va += PAGE_SIZE) {
+		/* Find the next page to write */
+		lock_acquire(vm_lock);
+		for (; va < end; va += PAGE_SIZE) {
+			pte = pt_lookup(as->as_pt, va, false);
+			if (pte == NULL) {
+				/* Skip the rest of this 4M */
+				va |= (PT_NENTRIES - 1) * PAGE_SIZE;
+				continue;
+			}
+			if (*pte & PTE_DIRTY) {
+				break;
+			}
+		}
+		if (va >= end) {
+			lock_release(vm_lock);
+			break;
+		}
+		KASSERT((*pte & (PTE_PRESENT | PTE_SHARED)) ==
+			(PTE_PRESENT | PTE_SHARED));
+		*pte &= ~(pte_t)(PTE_DIRTY | PTE_WRITABLE);
+		if (live) {
+			vmtlb_shootdown(as, va);
+		}
+		pa = *pte & PTE_FRAME;
+		coremap_incref(pa);
+		lock_release(vm_lock);
+
+		/* Same arithmetic as vm_mapfile */
+		fstart = vr->vr_filestart > va ? vr->vr_filestart : va;
+		fend = vr->vr_fileend < va + PAGE_SIZE ?
+			vr->vr_fileend : va + PAGE_SIZE;
+		KASSERT(fstart < fend);
+		result = filecache_putpage(vr->vr_file,
+					   vr->vr_fileoff + (va - vr->vr_base),
+					   fstart - va, fend - va, pa);
+		if (result && err == 0) {
+			err = result;
+		}
+		coremap_freepages(pa);
+	}
+	return err;
+}
+
 void
 as_destroy(struct addrspace *as)
 {
-	/*
-	 * Clean up as needed.
-	 */
+	struct vm_region *vr;
 
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		/* Nowhere to report a failure to */
+		as_syncregion(as, vr, vr->vr_base,
+			      vr->vr_base + vr->vr_npages * PAGE_SIZE, false);
+	}
+	while (as->as_regions != NULL) {
+		vr = as->as_regions;
+		as->as_regions = vr->vr_next;
+		if (vr->vr_file != NULL) {
+			filecache_close(vr->vr_file);
+		}
+		if (vr->vr_shm != NULL) {
+			shm_close(vr->vr_shm);
+		}
+		kfree(vr);
+	}
+	lock_acquire(vm_lock);
+	pt_destroy(as->as_pt);
+	lock_release(vm_lock);
+	lock_destroy(as->as_maplock);
 	kfree(as);
 }
 
@@ -96,24 +304,664 @@ as_activate(void)
 	if (as == NULL) {
 		/*
 		 * Kernel thread without an address space; leave the
-		 * prior address space in place.
+		 * prior ASID in place, but not its page table, which
+		 * may be destroyed while we run.
 		 */
+		vmtlb_deactivate();
 		return;
 	}
 
-	/*
-	 * Write this.
-	 */
+	/* Switch ASIDs; entries for other address spaces can stay. */
+	vmtlb_activate(as);
 }
 
 void
 as_deactivate(void)
 {
+	vmtlb_deactivate();
+}
+
+/*
+ * Return the region containing VADDR, or NULL if there is none.
+ */
+struct vm_region *
+as_findregion(struct addrspace *as, vaddr_t vaddr)
+{
+	struct vm_region *vr;
+
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		if (vaddr >= vr->vr_base &&
+		    vaddr - vr->vr_base < vr->vr_npages * PAGE_SIZE) {
+			return vr;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Grow the main stack down to cover VADDR, if VADDR is within LIMIT
+ * bytes of the top of the stack (and never further than VM_STACKMAX,
+ * so that the guard page below stays unmapped). Returns the stack
+ * region, or NULL if VADDR isn't the stack's to have.
+ */
+struct vm_region *
+as_growstack(struct addrspace *as, vaddr_t vaddr, size_t limit)
+{
+	struct vm_region *vr;
+	vaddr_t bottom;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	vr = as->as_stack;
+	if (vr == NULL || vaddr >= vr->vr_base) {
+		return NULL;
+	}
+	if (limit > VM_STACKMAX) {
+		limit = VM_STACKMAX;
+	}
+	bottom = USERSTACK - (limit & PAGE_FRAME);
+	vaddr &= PAGE_FRAME;
+	if (vaddr < bottom ||
+	    as_overlimit(as, (vr->vr_base - vaddr) / PAGE_SIZE)) {
+		return NULL;
+	}
+	/* Its pages come zero-filled on first touch, like any other */
+	vr->vr_npages += (vr->vr_base - vaddr) / PAGE_SIZE;
+	vr->vr_base = vaddr;
+	return vr;
+}
+
+/*
+ * Map the file V, from OFFSET on, at VADDR for FILESIZE bytes, in the
+ * read-only region containing VADDR. Pages of the region past the end
+ * of the file part stay zero-filled.
+ */
+int
+as_map_file(struct addrspace *as, vaddr_t vaddr, size_t filesize,
+	    struct vnode *v, off_t offset)
+{
+	struct vm_region *vr, *other;
+	vaddr_t end;
+
+	vr = as_findregion(as, vaddr);
+	if (vr == NULL || (vr->vr_perm & VR_WRITE) || vr->vr_file != NULL) {
+		return EINVAL;
+	}
+	end = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+	if (filesize > end - vaddr ||
+	    offset % PAGE_SIZE != vaddr % PAGE_SIZE) {
+		return EINVAL;
+	}
+
 	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
+	 * A page of another region in the same place would be mapped
+	 * from the file too, or be loaded into a shared frame.
 	 */
+	for (other = as->as_regions; other != NULL; other = other->vr_next) {
+		if (other != vr && other->vr_base < end &&
+		    vr->vr_base < other->vr_base +
+				  other->vr_npages * PAGE_SIZE) {
+			return EINVAL;
+		}
+	}
+
+	vr->vr_file = filecache_open(v);
+	if (vr->vr_file == NULL) {
+		return ENOMEM;
+	}
+	vr->vr_fileoff = offset - (vaddr - vr->vr_base);
+	vr->vr_filestart = vaddr;
+	vr->vr_fileend = vaddr + filesize;
+	return 0;
+}
+
+/*
+ * Find NPAGES of free address space for mmap, as high as possible.
+ * Returns 0 if there isn't room. Caller holds vm_lock.
+ */
+static
+vaddr_t
+as_findgap(struct addrspace *as, size_t npages)
+{
+	struct vm_region *vr;
+	vaddr_t top, base;
+	size_t size;
+
+	size = npages * PAGE_SIZE;
+	top = VM_MMAPTOP;
+ again:
+	if (top < VM_MMAPBASE || top - VM_MMAPBASE < size) {
+		return 0;
+	}
+	base = top - size;
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		if (vr->vr_base < top &&
+		    base < vr->vr_base + vr->vr_npages * PAGE_SIZE) {
+			top = vr->vr_base;
+			goto again;
+		}
+	}
+	return base;
+}
+
+/*
+ * Map LEN bytes of V from OFFSET. Pages of the region past the end of
+ * the file are zero-filled and never written back. With V NULL, the
+ * region is anonymous: zero-filled throughout, and if shared, backed
+ * by a new shared memory segment.
+ */
+int
+as_mmap(struct addrspace *as, size_t len, int perm, struct vnode *v,
+	off_t offset, vaddr_t *ret)
+{
+	struct filecache_file *f;
+	struct shm_segment *seg;
+	struct vm_region *vr;
+	struct stat st;
+	size_t npages, filepart;
+	vaddr_t base;
+	int result;
+
+	KASSERT(len > 0);
+	KASSERT(offset >= 0 && offset % PAGE_SIZE == 0);
+
+	if (len > VM_MMAPTOP - VM_MMAPBASE) {
+		return ENOMEM;
+	}
+	npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	f = NULL;
+	seg = NULL;
+	filepart = 0;
+	if (v != NULL) {
+		result = VOP_STAT(v, &st);
+		if (result) {
+			return result;
+		}
+		/*
+		 * Map whole pages of the file, even past LEN, so that
+		 * every mapping of the file shares the same cache pages.
+		 */
+		if (st.st_size > offset) {
+			filepart = npages * PAGE_SIZE;
+			if (st.st_size - offset < (off_t)filepart) {
+				filepart = st.st_size - offset;
+			}
+		}
+
+		f = filecache_open(v);
+		if (f == NULL) {
+			return ENOMEM;
+		}
+	}
+	else if (perm & VR_SHARED) {
+		seg = shm_create(npages);
+		if (seg == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	lock_acquire(as->as_maplock);
+	lock_acquire(vm_lock);
+	base = as_findgap(as, npages);
+	if (base == 0 || as_overlimit(as, npages)) {
+		result = ENOMEM;
+	}
+	else {
+		result = as_addregion(as, base, npages, perm | VR_MMAP);
+	}
+	if (result) {
+		lock_release(vm_lock);
+		lock_release(as->as_maplock);
+		if (f != NULL) {
+			filecache_close(f);
+		}
+		if (seg != NULL) {
+			shm_close(seg);
+		}
+		return result;
+	}
+	/* as_addregion put it at the head; nobody looks without vm_lock */
+	vr = as->as_regions;
+	vr->vr_file = f;
+	vr->vr_fileoff = offset;
+	vr->vr_filestart = base;
+	vr->vr_fileend = base + filepart;
+	vr->vr_shm = seg;
+	lock_release(vm_lock);
+	lock_release(as->as_maplock);
+
+	*ret = base;
+	return 0;
+}
+
+/*
+ * Check the range [VADDR, VADDR + LEN) for munmap and msync: VADDR
+ * must be page-aligned and the range must be in user space.
+ */
+static
+int
+as_checkrange(vaddr_t vaddr, size_t len, vaddr_t *end)
+{
+	if (vaddr % PAGE_SIZE != 0 || len == 0 || vaddr >= USERSTACK ||
+	    len > USERSTACK - vaddr) {
+		return EINVAL;
+	}
+	/* USERSTACK is page-aligned, so this can't overflow */
+	*end = (vaddr + len + PAGE_SIZE - 1) & PAGE_FRAME;
+	return 0;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct vm_region *vr, **vrp;
+	vaddr_t end, vrend;
+	int result;
+
+	result = as_checkrange(vaddr, len, &end);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(as->as_maplock);
+
+	/* Check first, so as to do all or nothing */
+	lock_acquire(vm_lock);
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		vrend = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+		if (vr->vr_base < end && vaddr < vrend &&
+		    ((vr->vr_perm & VR_MMAP) == 0 ||
+		     vr->vr_base < vaddr || vrend > end)) {
+			lock_release(vm_lock);
+			lock_release(as->as_maplock);
+			return EINVAL;
+		}
+	}
+
+	while (1) {
+		for (vrp = &as->as_regions; *vrp != NULL;
+		     vrp = &(*vrp)->vr_next) {
+			if ((*vrp)->vr_base >= vaddr &&
+			    (*vrp)->vr_base < end) {
+				break;
+			}
+		}
+		vr = *vrp;
+		if (vr == NULL) {
+			break;
+		}
+		/* Faults in the region fail from here on */
+		*vrp = vr->vr_next;
+		lock_release(vm_lock);
+
+		vrend = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+		as_syncregion(as, vr, vr->vr_base, vrend, true);
+
+		/* The TLB entries go before the frames do */
+		lock_acquire(vm_lock);
+		vmtlb_newasid(as);
+		pt_unmap(as->as_pt, vr->vr_base, vr->vr_npages);
+		lock_release(vm_lock);
+
+		if (vr->vr_file != NULL) {
+			filecache_close(vr->vr_file);
+		}
+		if (vr->vr_shm != NULL) {
+			shm_close(vr->vr_shm);
+		}
+		kfree(vr);
+		lock_acquire(vm_lock);
+	}
+	lock_release(vm_lock);
+
+	lock_release(as->as_maplock);
+	return 0;
+}
+
+int
+as_msync(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct vm_region *vr;
+	vaddr_t end, vrend, start, stop;
+	int result, err;
+
+	result = as_checkrange(vaddr, len, &end);
+	if (result) {
+		return result;
+	}
+
+	/* Regions only go away with as_maplock held */
+	err = 0;
+	lock_acquire(as->as_maplock);
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		vrend = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+		if (vr->vr_base >= end || vaddr >= vrend) {
+			continue;
+		}
+		start = vr->vr_base > vaddr ? vr->vr_base : vaddr;
+		stop = vrend < end ? vrend : end;
+		result = as_syncregion(as, vr, start, stop, true);
+		if (result && err == 0) {
+			err = result;
+		}
+	}
+	lock_release(as->as_maplock);
+	return err;
+}
+
+/*
+ * MADV_WILLNEED: bring the file pages from START to END of VR into
+ * the file cache, unmapped, so that touching them later doesn't wait
+ * for the disk. Caller holds as_maplock, so VR stays put.
+ */
+static
+void
+as_willneed(struct vm_region *vr, vaddr_t start, vaddr_t end)
+{
+	vaddr_t va, fstart, fend;
+	paddr_t pa;
+	unsigned n;
+
+	if (vr->vr_file == NULL) {
+		return;
+	}
+	n = 0;
+	for (va = start; va < end && n < AS_WILLNEEDPAGES; va += PAGE_SIZE) {
+		/* Same arithmetic as vm_mapfile */
+		fstart = vr->vr_filestart > va ? vr->vr_filestart : va;
+		fend = vr->vr_fileend < va + PAGE_SIZE ?
+			vr->vr_fileend : va + PAGE_SIZE;
+		if (fstart >= fend) {
+			continue;
+		}
+		if (filecache_getpage(vr->vr_file,
+				      vr->vr_fileoff + (va - vr->vr_base),
+				      fstart - va, fend - va, &pa)) {
+			/* Only a hint; the fault will report it */
+			break;
+		}
+		/* The cache keeps its own reference */
+		coremap_freepages(pa);
+		n++;
+	}
+}
+
+/*
+ * MADV_DONTNEED: drop the pages from START to END of VR, so the next
+ * touch gets them afresh. Written shared file pages are written back
+ * first; one written again before it can be dropped is kept, since
+ * dropping it would lose the write. Caller holds as_maplock.
+ */
+static
+void
+as_dontneed(struct addrspace *as, struct vm_region *vr,
+	    vaddr_t start, vaddr_t end)
+{
+	vaddr_t va;
+	pte_t *pte;
+	bool shared;
+
+	as_syncregion(as, vr, start, end, true);
+	shared = (vr->vr_perm & VR_SHARED) != 0 && vr->vr_file != NULL;
+
+	/* The TLB entries go before the frames do */
+	lock_acquire(vm_lock);
+	vmtlb_newasid(as);
+	for (va = start; va < end; va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL) {
+			/* Skip the rest of this 4M */
+			va |= (PT_NENTRIES - 1) * PAGE_SIZE;
+			continue;
+		}
+		if (shared && (*pte & PTE_DIRTY)) {
+			continue;
+		}
+		pt_unmap(as->as_pt, va, 1);
+	}
+	lock_release(vm_lock);
+}
+
+int
+as_madvise(struct addrspace *as, vaddr_t vaddr, size_t len, int advice)
+{
+	struct vm_region *vr;
+	vaddr_t end, vrend, start, stop;
+	int result;
+
+	result = as_checkrange(vaddr, len, &end);
+	if (result) {
+		return result;
+	}
+
+	/* Regions only go away with as_maplock held */
+	lock_acquire(as->as_maplock);
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		vrend = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+		if (vr->vr_base >= end || vaddr >= vrend) {
+			continue;
+		}
+		start = vr->vr_base > vaddr ? vr->vr_base : vaddr;
+		stop = vrend < end ? vrend : end;
+		switch (advice) {
+		    case MADV_WILLNEED:
+			as_willneed(vr, start, stop);
+			break;
+		    case MADV_DONTNEED:
+			as_dontneed(as, vr, start, stop);
+			break;
+		    default:
+			/* vm_fault looks at it with vm_lock held */
+			lock_acquire(vm_lock);
+			vr->vr_advice = advice;
+			lock_release(vm_lock);
+			break;
+		}
+	}
+	lock_release(as->as_maplock);
+	return 0;
+}
+
+/*
+ * Grow or shrink the heap by AMOUNT bytes. Growing only makes the
+ * region bigger; the new pages are zero-filled when first touched.
+ * Shrinking frees the pages cut off, so they come back zeroed if the
+ * heap grows again.
+ */
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *ret)
+{
+	struct vm_region *vr;
+	vaddr_t end;
+	size_t npages;
+
+	if (amount % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+
+	lock_acquire(vm_lock);
+	vr = as->as_heap;
+	if (vr == NULL) {
+		/* Not loaded by load_elf */
+		lock_release(vm_lock);
+		return ENOMEM;
+	}
+	end = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+	if (amount >= 0) {
+		npages = amount / PAGE_SIZE;
+		if (end > VM_MMAPBASE ||
+		    npages > (VM_MMAPBASE - end) / PAGE_SIZE ||
+		    (rlim_t)(vr->vr_npages + npages) * PAGE_SIZE >
+		    proc_getrlimit(curproc, RLIMIT_DATA) ||
+		    as_overlimit(as, npages)) {
+			lock_release(vm_lock);
+			return ENOMEM;
+		}
+		vr->vr_npages += npages;
+	}
+	else {
+		npages = -(amount / PAGE_SIZE);
+		if (npages > vr->vr_npages) {
+			lock_release(vm_lock);
+			return EINVAL;
+		}
+		/* Faults there fail from here on */
+		vr->vr_npages -= npages;
+		vmtlb_newasid(as);
+		pt_unmap(as->as_pt, end - npages * PAGE_SIZE, npages);
+	}
+	lock_release(vm_lock);
+
+	*ret = end;
+	return 0;
+}
+
+/*
+ * Would locking NPAGES more pages leave too little memory to page
+ * everything else through? Locked memory is capped at half of it.
+ */
+static
+bool
+as_toomanylocked(size_t npages)
+{
+	return coremap_numpinned() + npages > coremap_numpages() / 2;
+}
+
+/*
+ * Lock (LOCK set) or unlock the pages in the LEN bytes from VADDR.
+ * Locking faults them all in now and pins them, so touching them
+ * never waits for the disk.
+ */
+int
+as_mlock(struct addrspace *as, vaddr_t vaddr, size_t len, bool lock)
+{
+	struct vm_region *vr;
+	vaddr_t end, vrend, start, stop;
+	size_t npages;
+	int result;
+
+	result = as_checkrange(vaddr, len, &end);
+	if (result) {
+		return result;
+	}
+
+	/* Regions only go away with as_maplock held */
+	lock_acquire(as->as_maplock);
+
+	/* Every page of the range must be mapped */
+	npages = 0;
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		vrend = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+		if (vr->vr_base < end && vaddr < vrend) {
+			start = vr->vr_base > vaddr ? vr->vr_base : vaddr;
+			stop = vrend < end ? vrend : end;
+			npages += (stop - start) / PAGE_SIZE;
+		}
+	}
+	if (npages != (end - vaddr) / PAGE_SIZE) {
+		lock_release(as->as_maplock);
+		return ENOMEM;
+	}
+
+	if (!lock) {
+		lock_acquire(vm_lock);
+		pt_unlock(as->as_pt, vaddr, npages);
+		lock_release(vm_lock);
+		lock_release(as->as_maplock);
+		return 0;
+	}
+
+	if (as_toomanylocked(npages)) {
+		lock_release(as->as_maplock);
+		return EAGAIN;
+	}
+	result = vm_populate(as, vaddr, end, true);
+	lock_release(as->as_maplock);
+	return result;
+}
+
+/*
+ * mlockall: MCL_CURRENT locks every page mapped now; MCL_FUTURE has
+ * vm_fault lock new pages as they come in, and mmap and sbrk fault
+ * new mappings in at once; MCL_ONEXEC has execv lock the next
+ * program, current and future, before it starts.
+ */
+int
+as_mlockall(struct addrspace *as, int flags)
+{
+	struct vm_region *vr;
+	size_t npages;
+	int result;
+
+	if (flags & MCL_ONEXEC) {
+		as->as_lockonexec = true;
+	}
+	if (flags & MCL_FUTURE) {
+		lock_acquire(vm_lock);
+		as->as_lockfuture = true;
+		lock_release(vm_lock);
+	}
+	if ((flags & MCL_CURRENT) == 0) {
+		return 0;
+	}
+
+	lock_acquire(as->as_maplock);
+	npages = 0;
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		npages += vr->vr_npages;
+	}
+	if (as_toomanylocked(npages)) {
+		lock_release(as->as_maplock);
+		return EAGAIN;
+	}
+	result = 0;
+	for (vr = as->as_regions; vr != NULL && result == 0;
+	     vr = vr->vr_next) {
+		result = vm_populate(as, vr->vr_base,
+				     vr->vr_base + vr->vr_npages * PAGE_SIZE,
+				     true);
+	}
+	lock_release(as->as_maplock);
+	return result;
+}
+
+/*
+ * munlockall: unlock everything, and forget MCL_FUTURE and
+ * MCL_ONEXEC.
+ */
+void
+as_munlockall(struct addrspace *as)
+{
+	struct vm_region *vr;
+
+	as->as_lockonexec = false;
+	lock_acquire(as->as_maplock);
+	lock_acquire(vm_lock);
+	as->as_lockfuture = false;
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		pt_unlock(as->as_pt, vr->vr_base, vr->vr_npages);
+	}
+	lock_release(vm_lock);
+	lock_release(as->as_maplock);
+}
+
+/*
+ * Fault in the pages in the LEN bytes from VADDR now, for
+ * MAP_POPULATE. Only a head start: pages that can't be had now are
+ * left for vm_fault, so errors are dropped.
+ */
+void
+as_populate(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	vaddr_t end;
+
+	if (as_checkrange(vaddr, len, &end)) {
+		return;
+	}
+	lock_acquire(as->as_maplock);
+	(void)vm_populate(as, vaddr, end, false);
+	lock_release(as->as_maplock);
 }
 
 /*
@@ -122,57 +970,93 @@ as_deactivate(void)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. Only
+ * write permission is enforced, since the MIPS TLB cannot express
+ * the others.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 		 int readable, int writeable, int executable)
 {
-	/*
-	 * Write this.
-	 */
+	size_t npages;
+	int perm;
+
+	/* Align the region. First, the base... */
+	memsize += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	memsize = (memsize + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	npages = memsize / PAGE_SIZE;
+	if (vaddr + memsize > USERSTACK - VM_STACKAREAPAGES * PAGE_SIZE ||
+	    vaddr + memsize < vaddr) {
+		return EFAULT;
+	}
 
-	(void)as;
-	(void)vaddr;
-	(void)memsize;
-	(void)readable;
-	(void)writeable;
-	(void)executable;
-	return ENOSYS;
+	if (as_overlimit(as, npages)) {
+		return ENOMEM;
+	}
+
+	perm = (readable ? VR_READ : 0) | (writeable ? VR_WRITE : 0) |
+		(executable ? VR_EXEC : 0);
+	return as_addregion(as, vaddr, npages, perm);
 }
 
 int
 as_prepare_load(struct addrspace *as)
 {
 	/*
-	 * Write this.
+	 * load_elf writes the segments through ordinary user
+	 * addresses, so read-only regions must be writable until
+	 * as_complete_load.
 	 */
-
-	(void)as;
+	as->as_loading = true;
 	return 0;
 }
 
 int
 as_complete_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
+	struct vm_region *vr;
+	vaddr_t top, end;
+	int result;
+
+	as->as_loading = false;
+
+	/* Drop any writable mappings made during the load. */
+	vmtlb_newasid(as);
 
-	(void)as;
+	/* The heap starts out empty, above everything loaded */
+	top = 0;
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		end = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+		if (end > top) {
+			top = end;
+		}
+	}
+	result = as_addregion(as, top, 0, VR_READ | VR_WRITE);
+	if (result) {
+		return result;
+	}
+	as->as_heap = as->as_regions;
 	return 0;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
+	int result;
 
-	(void)as;
+	if (as_overlimit(as, VM_STACKINITPAGES)) {
+		return ENOMEM;
+	}
+	result = as_addregion(as, USERSTACK - VM_STACKINITPAGES * PAGE_SIZE,
+			      VM_STACKINITPAGES, VR_READ | VR_WRITE);
+	if (result) {
+		return result;
+	}
+	as->as_stack = as->as_regions;
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
@@ -180,3 +1064,35 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_define_threadstack(struct addrspace *as, unsigned slot,
+		      vaddr_t *stackptr)
+{
+	vaddr_t top;
+	int result;
+
+	KASSERT(slot < VM_THREADSTACKS);
+
+	top = USERSTACK - (VM_STACKPAGES +
+			   slot * (VM_THREADSTACKPAGES + 1)) * PAGE_SIZE;
+
+	lock_acquire(vm_lock);
+	if ((as->as_threadstacks & (1U << slot)) == 0) {
+		if (as_overlimit(as, VM_THREADSTACKPAGES)) {
+			lock_release(vm_lock);
+			return ENOMEM;
+		}
+		result = as_addregion(as, top - VM_THREADSTACKPAGES * PAGE_SIZE,
+				      VM_THREADSTACKPAGES,
+				      VR_READ | VR_WRITE);
+		if (result) {
+			lock_release(vm_lock);
+			return result;
+		}
+		as->as_threadstacks |= 1U << slot;
+	}
+	lock_release(vm_lock);
+
+	*stackptr = top;
+	return 0;
+}
@@ -142,6 +142,36 @@ copycheck(const_userptr_t userptr, size_t len, size_t *stoplen)
 	return 0;
 }
 
+/*
+ * Copy LEN bytes between user and kernel, once copycheck has passed
+ * and the fault handler is set. Arguments and results of system
+ * calls are mostly a word or two, for which calling memcpy costs
+ * more than the copy, so do those in line.
+ */
+#define COPY_SMALL	16
+
+static inline
+void
+copybytes(void *dst, const void *src, size_t len)
+{
+	size_t i;
+
+	if (len > COPY_SMALL) {
+		memcpy(dst, src, len);
+	}
+	else if (((uintptr_t)dst | (uintptr_t)src | len)
+		 % sizeof(uint32_t) == 0) {
+		for (i=0; i<len/sizeof(uint32_t); i++) {
+			((uint32_t *)dst)[i] = ((const uint32_t *)src)[i];
+		}
+	}
+	else {
+		for (i=0; i<len; i++) {
+			((char *)dst)[i] = ((const char *)src)[i];
+		}
+	}
+}
+
 /*
  * copyin
  *
@@ -172,9 +202,10 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy(dest, (const void *)usersrc, len);
+	copybytes(dest, (const void *)usersrc, len);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
+	curthread->t_copiedin += len;
 	return 0;
 }
 
@@ -208,9 +239,109 @@ copyout(const void *src, userptr_t userdest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy((void *)userdest, src, len);
+	copybytes((void *)userdest, src, len);
+
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	curthread->t_copiedout += len;
+	return 0;
+}
+
+/*
+ * Check every block in VEC before copying any of it.
+ */
+static
+int
+copycheckvec(const struct copyvec *vec, unsigned n)
+{
+	size_t stoplen;
+	unsigned i;
+	int result;
+
+	for (i=0; i<n; i++) {
+		result = copycheck(vec[i].cv_user, vec[i].cv_len, &stoplen);
+		if (result) {
+			return result;
+		}
+		if (stoplen != vec[i].cv_len) {
+			return EFAULT;
+		}
+	}
+	return 0;
+}
+
+/*
+ * copyin_bulk
+ *
+ * Copy each of the N blocks in VEC from user to kernel, with one
+ * setup of the fault handler for all of them.
+ */
+int
+copyin_bulk(const struct copyvec *vec, unsigned n)
+{
+	unsigned i;
+	size_t total;
+	int result;
+
+	result = copycheckvec(vec, n);
+	if (result) {
+		return result;
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = copyfail;
+
+	result = setjmp(curthread->t_machdep.tm_copyjmp);
+	if (result) {
+		curthread->t_machdep.tm_badfaultfunc = NULL;
+		return EFAULT;
+	}
+
+	total = 0;
+	for (i=0; i<n; i++) {
+		copybytes(vec[i].cv_kern, (const void *)vec[i].cv_user,
+			  vec[i].cv_len);
+		total += vec[i].cv_len;
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	curthread->t_copiedin += total;
+	return 0;
+}
+
+/*
+ * copyout_bulk
+ *
+ * Copy each of the N blocks in VEC from kernel to user, with one
+ * setup of the fault handler for all of them.
+ */
+int
+copyout_bulk(const struct copyvec *vec, unsigned n)
+{
+	unsigned i;
+	size_t total;
+	int result;
+
+	result = copycheckvec(vec, n);
+	if (result) {
+		return result;
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = copyfail;
+
+	result = setjmp(curthread->t_machdep.tm_copyjmp);
+	if (result) {
+		curthread->t_machdep.tm_badfaultfunc = NULL;
+		return EFAULT;
+	}
+
+	total = 0;
+	for (i=0; i<n; i++) {
+		copybytes((void *)vec[i].cv_user, vec[i].cv_kern,
+			  vec[i].cv_len);
+		total += vec[i].cv_len;
+	}
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
+	curthread->t_copiedout += total;
 	return 0;
 }
 
@@ -266,7 +397,7 @@ int
 copyinstr(const_userptr_t usersrc, char *dest, size_t len, size_t *actual)
 {
 	int result;
-	size_t stoplen;
+	size_t stoplen, got;
 
 	result = copycheck(usersrc, len, &stoplen);
 	if (result) {
@@ -281,9 +412,15 @@ copyinstr(const_userptr_t usersrc, char *dest, size_t len, size_t *actual)
 		return EFAULT;
 	}
 
-	result = copystr(dest, (const char *)usersrc, len, stoplen, actual);
+	result = copystr(dest, (const char *)usersrc, len, stoplen, &got);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
+	if (result == 0) {
+		curthread->t_copiedin += got;
+		if (actual != NULL) {
+			*actual = got;
+		}
+	}
 	return result;
 }
 
@@ -299,7 +436,7 @@ int
 copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *actual)
 {
 	int result;
-	size_t stoplen;
+	size_t stoplen, got;
 
 	result = copycheck(userdest, len, &stoplen);
 	if (result) {
@@ -314,8 +451,14 @@ copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *actual)
 		return EFAULT;
 	}
 
-	result = copystr((char *)userdest, src, len, stoplen, actual);
+	result = copystr((char *)userdest, src, len, stoplen, &got);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
+	if (result == 0) {
+		curthread->t_copiedout += got;
+		if (actual != NULL) {
+			*actual = got;
+		}
+	}
 	return result;
 }
@@ -0,0 +1,1202 @@
+/*
+ * Coremap (physical page allocator).
+ *
+ * The coremap is an array with one entry for every physical page,
+ * indexed by page number (paddr / PAGE_SIZE). Free memory is managed
+ * as a binary buddy system: it is divided into blocks of 2^k pages,
+ * each aligned to its own size, and there is one doubly linked free
+ * list per order k, threaded through the entries of the blocks' first
+ * pages. An allocation takes a block of the smallest sufficient order,
+ * splitting larger blocks as needed; when a block is freed it is
+ * merged with its buddy (the other half of the block of order k+1)
+ * for as long as the buddy is free too. Single pages thus still cost
+ * O(1) in the common case and multi-page allocations (kernel stacks,
+ * large kmallocs) no longer scan the coremap, and freed runs coalesce
+ * back into large blocks instead of leaving memory fragmented.
+ * Requests that are not a power of two take a block of the next order
+ * up and give the unused tail straight back.
+ *
+ * The coremap array itself is taken from ram_stealmem() and so lives
+ * below the first free page; everything below that is fixed.
+ *
+ * In front of the free list, each CPU keeps a small cache of free
+ * pages (struct cpu's c_pagecache), refilled from and drained to the
+ * free list CM_BATCH pages at a time. Single-page allocations and
+ * frees normally touch only the local cache and its CPU-private lock,
+ * and hold coremap_lock just long enough to flip the page's entry,
+ * rather than for a walk of the buddy lists. Pages sitting in a
+ * cache are marked CME_CACHED. If the free list
+ * runs dry, all the caches are emptied back into it before giving up.
+ *
+ * Allocated blocks carry a reference count so that user pages can be
+ * shared copy-on-write between address spaces after fork. A block is
+ * returned to the free list when its last reference is dropped.
+ *
+ * Zero-fill page faults want a cleared page, and clearing one on the
+ * faulting thread is a whole page of stores on the latency path. So a
+ * kernel thread, the zeroer, keeps a list of pages it has already
+ * cleared (CME_ZEROED, linked through cme_next), topping it up to
+ * cm_zerotarget whenever coremap_getzeroed takes it below half. The
+ * zeroer clears one page at a time and yields in between, so being
+ * CPU-bound it sinks to the bottom run queue and mostly runs when
+ * nothing else wants the cpu. It leaves the last free pages alone,
+ * and the zeroed list is emptied back into the free list along with
+ * the cpu caches when memory runs out.
+ *
+ * User pages also record the page table and virtual address that map
+ * them, so the swap code can find the PTE to update when it evicts
+ * the page. Victims are chosen by a two-handed clock. The MIPS TLB
+ * has no referenced bit, so cme_referenced is kept by software: the
+ * front hand clears it and hands the page back to the caller, which
+ * shoots down the page's TLB entry, so the next use of the page
+ * misses in the TLB and the fault sets the bit again (pt_getpage).
+ * The back hand follows at least cm_handspread pages behind and
+ * takes the first page not used since the front hand went by. The
+ * spread is the time a page has to prove it is in the working set;
+ * the pageout thread also moves the front hand on its own, faster
+ * the shorter memory is (see pageout.c), which shortens it under
+ * pressure. The front hand never laps the back one.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <synch.h>
+#include <thread.h>
+#include <vm.h>
+#include <coremap.h>
+
+/* Page states */
+#define CME_FIXED	0	/* kernel image / stolen early; never freed */
+#define CME_FREE	1	/* on the free list */
+#define CME_INUSE	2	/* allocated */
+#define CME_CACHED	3	/* free, in a per-cpu cache */
+#define CME_ZEROED	4	/* free and cleared, on the zeroed list */
+
+/* Null link for the free list */
+#define CM_NOPAGE	((uint32_t)0xffffffff)
+
+/* Pages moved between a per-cpu cache and the free list at once */
+#define CM_BATCH	(PAGECACHE_MAX / 2)
+
+/* Most cpus System/161 supports */
+#define CM_MAXCPUS	32
+
+/* Most pages kept zeroed in advance */
+#define CM_ZEROMAX	64
+
+/* Largest buddy block is 2^CM_MAXORDER pages (4M) */
+#define CM_MAXORDER	10
+
+struct coremap_entry {
+	uint32_t cme_next;	/* free list links (page numbers) */
+	uint32_t cme_prev;
+	uint32_t cme_npages;	/* block length, if head of a block
+				   (allocated or free) */
+	struct pagetable *cme_pt;	/* owning page table (user pages) */
+	vaddr_t cme_vaddr;	/* user address within cme_pt */
+	uint16_t cme_refcount;	/* references, if head of a block */
+	uint8_t cme_state;	/* CME_* */
+	uint8_t cme_referenced;	/* used since the clock last passed */
+	uint16_t cme_pincount;	/* page tables that have it locked */
+};
+
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+static struct coremap_entry *coremap;
+static bool coremap_ready;
+
+static uint32_t cm_firstpage;	/* first managed page number */
+static uint32_t cm_numpages;	/* total pages, including fixed ones */
+static uint32_t cm_freelist[CM_MAXORDER + 1];	/* heads, by order */
+static uint32_t cm_numfree;	/* pages on the free lists */
+static uint32_t cm_backhand;	/* next page the evictor looks at */
+static uint32_t cm_fronthand;	/* next page the clock ages */
+static uint32_t cm_handgap;	/* pages the front hand is ahead */
+static uint32_t cm_handspread;	/* least gap the evictor keeps */
+static unsigned cm_aged;	/* references taken by the front hand */
+static uint32_t cm_numpinned;	/* pages with a nonzero pin count */
+static unsigned cm_locktrips;	/* times coremap_lock was taken */
+static unsigned cm_fragfails;	/* runs refused with enough pages free */
+
+/* Pre-zeroed pages, and the thread that keeps them topped up */
+static uint32_t cm_zerolist = CM_NOPAGE;	/* head (singly linked) */
+static uint32_t cm_numzeroed;	/* pages on it */
+static uint32_t cm_zerotarget;	/* how many the zeroer aims for */
+static bool cm_zerowanted;	/* zeroer has been woken */
+static struct semaphore *cm_zerosem;
+static unsigned cm_zerohits;	/* coremap_getzeroed found one ready */
+static unsigned cm_zeromisses;	/* ... or had to clear one itself */
+
+/* CPUs whose page caches may hold pages (append-only) */
+static struct cpu *cm_cpus[CM_MAXCPUS];
+static unsigned cm_ncpus;
+
+static
+void
+cm_lock(void)
+{
+	spinlock_acquire(&coremap_lock);
+	cm_locktrips++;
+}
+
+/*
+ * Buddy free list manipulation. Caller holds coremap_lock.
+ *
+ * Every page of a free block is CME_FREE; only the first is on a list
+ * and has cme_npages set (to 2^order), which is how a free buddy is
+ * recognized.
+ */
+static
+void
+cm_freelist_add(uint32_t pg, unsigned order)
+{
+	struct coremap_entry *e = &coremap[pg];
+
+	e->cme_state = CME_FREE;
+	e->cme_npages = (uint32_t)1 << order;
+	e->cme_refcount = 0;
+	e->cme_pt = NULL;
+	e->cme_vaddr = 0;
+	e->cme_referenced = 0;
+	e->cme_prev = CM_NOPAGE;
+	e->cme_next = cm_freelist[order];
+	if (cm_freelist[order] != CM_NOPAGE) {
+		coremap[cm_freelist[order]].cme_prev = pg;
+	}
+	cm_freelist[order] = pg;
+	cm_numfree += e->cme_npages;
+}
+
+static
+void
+cm_freelist_remove(uint32_t pg, unsigned order)
+{
+	struct coremap_entry *e = &coremap[pg];
+
+	KASSERT(e->cme_state == CME_FREE);
+	KASSERT(e->cme_npages == (uint32_t)1 << order);
+	if (e->cme_prev != CM_NOPAGE) {
+		coremap[e->cme_prev].cme_next = e->cme_next;
+	}
+	else {
+		KASSERT(cm_freelist[order] == pg);
+		cm_freelist[order] = e->cme_next;
+	}
+	if (e->cme_next != CM_NOPAGE) {
+		coremap[e->cme_next].cme_prev = e->cme_prev;
+	}
+	e->cme_next = e->cme_prev = CM_NOPAGE;
+	e->cme_npages = 0;
+	KASSERT(cm_numfree >= (uint32_t)1 << order);
+	cm_numfree -= (uint32_t)1 << order;
+}
+
+/*
+ * Free the aligned block of 2^ORDER pages at PG, merging it with its
+ * buddies as far as they are free.
+ */
+static
+void
+cm_buddy_free(uint32_t pg, unsigned order)
+{
+	uint32_t i, buddy, size;
+
+	for (i=pg; i<pg + ((uint32_t)1 << order); i++) {
+		coremap[i].cme_state = CME_FREE;
+		coremap[i].cme_npages = 0;
+	}
+
+	while (order < CM_MAXORDER) {
+		size = (uint32_t)1 << order;
+		buddy = pg ^ size;
+		if (buddy < cm_firstpage || buddy + size > cm_numpages ||
+		    coremap[buddy].cme_state != CME_FREE ||
+		    coremap[buddy].cme_npages != size) {
+			break;
+		}
+		cm_freelist_remove(buddy, order);
+		if (buddy < pg) {
+			pg = buddy;
+		}
+		order++;
+	}
+	cm_freelist_add(pg, order);
+}
+
+/*
+ * Free the pages [PG, END), which need not be a buddy block, by
+ * cutting them into the largest aligned blocks that fit.
+ */
+static
+void
+cm_freerange(uint32_t pg, uint32_t end)
+{
+	unsigned order;
+
+	while (pg < end) {
+		order = 0;
+		while (order < CM_MAXORDER &&
+		       (pg & (((uint32_t)2 << order) - 1)) == 0 &&
+		       pg + ((uint32_t)2 << order) <= end) {
+			order++;
+		}
+		cm_buddy_free(pg, order);
+		pg += (uint32_t)1 << order;
+	}
+}
+
+/*
+ * Take NPAGES contiguous pages off the free lists and mark them
+ * CME_INUSE. Returns the first page number or CM_NOPAGE.
+ */
+static
+uint32_t
+cm_buddy_alloc(unsigned long npages)
+{
+	unsigned order, o;
+	uint32_t pg, i;
+
+	order = 0;
+	while (((unsigned long)1 << order) < npages) {
+		order++;
+		if (order > CM_MAXORDER) {
+			return CM_NOPAGE;
+		}
+	}
+	for (o = order; o <= CM_MAXORDER; o++) {
+		if (cm_freelist[o] != CM_NOPAGE) {
+			break;
+		}
+	}
+	if (o > CM_MAXORDER) {
+		return CM_NOPAGE;
+	}
+
+	pg = cm_freelist[o];
+	cm_freelist_remove(pg, o);
+	/* Split, returning the upper halves. */
+	while (o > order) {
+		o--;
+		cm_freelist_add(pg + ((uint32_t)1 << o), o);
+	}
+	for (i=pg; i<pg+npages; i++) {
+		coremap[i].cme_state = CME_INUSE;
+	}
+	/* Give back what we don't need of a rounded-up block. */
+	cm_freerange(pg + npages, pg + ((uint32_t)1 << order));
+	return pg;
+}
+
+/*
+ * Set up the coremap. This steals the memory for the coremap array
+ * itself and then hands the rest of RAM to the free list.
+ */
+void
+coremap_bootstrap(void)
+{
+	paddr_t lastpaddr, firstpaddr, cmpaddr;
+	size_t cmsize;
+	uint32_t i;
+
+	/* ram_getsize must come first: ram_getfirstfree clears it. */
+	lastpaddr = ram_getsize();
+	cm_numpages = lastpaddr / PAGE_SIZE;
+
+	cmsize = cm_numpages * sizeof(struct coremap_entry);
+	cm_lock();
+	cmpaddr = ram_stealmem(DIVROUNDUP(cmsize, PAGE_SIZE));
+	spinlock_release(&coremap_lock);
+	if (cmpaddr == 0) {
+		panic("coremap: cannot allocate the coremap\n");
+	}
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(cmpaddr);
+
+	firstpaddr = ram_getfirstfree();
+	KASSERT(firstpaddr % PAGE_SIZE == 0);
+	cm_firstpage = firstpaddr / PAGE_SIZE;
+
+	for (i=0; i<=CM_MAXORDER; i++) {
+		cm_freelist[i] = CM_NOPAGE;
+	}
+	cm_numfree = 0;
+	for (i=0; i<cm_firstpage; i++) {
+		coremap[i].cme_state = CME_FIXED;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_pt = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_referenced = 0;
+		coremap[i].cme_pincount = 0;
+		coremap[i].cme_next = coremap[i].cme_prev = CM_NOPAGE;
+	}
+	cm_freerange(cm_firstpage, cm_numpages);
+	cm_backhand = cm_fronthand = cm_firstpage;
+	cm_handgap = 0;
+	cm_handspread = (cm_numpages - cm_firstpage) / 4;
+	cm_zerotarget = (cm_numpages - cm_firstpage) / 16;
+	if (cm_zerotarget > CM_ZEROMAX) {
+		cm_zerotarget = CM_ZEROMAX;
+	}
+
+	cm_lock();
+	coremap_ready = true;
+	spinlock_release(&coremap_lock);
+
+	kprintf("coremap: %u pages managed, %u fixed\n",
+		cm_numpages - cm_firstpage, cm_firstpage);
+}
+
+/*
+ * Make page PG, just taken off the free list or out of a cache, an
+ * allocated one-reference block of NPAGES.
+ */
+static
+void
+cm_setinuse(uint32_t pg, unsigned long npages)
+{
+	coremap[pg].cme_npages = npages;
+	coremap[pg].cme_refcount = 1;
+	coremap[pg].cme_pt = NULL;
+	coremap[pg].cme_referenced = 0;
+	coremap[pg].cme_pincount = 0;
+	coremap[pg].cme_state = CME_INUSE;
+}
+
+/*
+ * Move up to CM_BATCH pages from the free list into C's cache. Caller
+ * holds C's cache lock.
+ */
+static
+void
+cm_cache_refill(struct cpu *c)
+{
+	uint32_t pg;
+	unsigned i;
+
+	cm_lock();
+	if (!c->c_pagecache_registered && cm_ncpus < CM_MAXCPUS) {
+		cm_cpus[cm_ncpus++] = c;
+		c->c_pagecache_registered = true;
+	}
+	for (i=0; i<CM_BATCH; i++) {
+		pg = cm_buddy_alloc(1);
+		if (pg == CM_NOPAGE) {
+			break;
+		}
+		coremap[pg].cme_state = CME_CACHED;
+		c->c_pagecache[c->c_pagecache_num++] = (paddr_t)pg * PAGE_SIZE;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Return up to N pages from C's cache to the free list. Caller holds
+ * C's cache lock.
+ */
+static
+void
+cm_cache_drain(struct cpu *c, unsigned n)
+{
+	uint32_t pg;
+
+	cm_lock();
+	while (n > 0 && c->c_pagecache_num > 0) {
+		pg = c->c_pagecache[--c->c_pagecache_num] / PAGE_SIZE;
+		KASSERT(coremap[pg].cme_state == CME_CACHED);
+		cm_buddy_free(pg, 0);
+		n--;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Empty every cpu's cache, and the zeroed list, back into the free
+ * list, so that memory stranded in other cpus' caches (or breaking
+ * up a contiguous run) can be used.
+ */
+static
+void
+cm_cache_reclaim(void)
+{
+	struct cpu *c;
+	unsigned i, n;
+	uint32_t pg;
+
+	cm_lock();
+	n = cm_ncpus;
+	while (cm_zerolist != CM_NOPAGE) {
+		pg = cm_zerolist;
+		KASSERT(coremap[pg].cme_state == CME_ZEROED);
+		cm_zerolist = coremap[pg].cme_next;
+		coremap[pg].cme_next = CM_NOPAGE;
+		cm_numzeroed--;
+		cm_buddy_free(pg, 0);
+	}
+	spinlock_release(&coremap_lock);
+
+	for (i=0; i<n; i++) {
+		c = cm_cpus[i];
+		spinlock_acquire(&c->c_pagecache_lock);
+		cm_cache_drain(c, PAGECACHE_MAX);
+		spinlock_release(&c->c_pagecache_lock);
+	}
+}
+
+/*
+ * Allocate one page from the current cpu's cache.
+ */
+static
+paddr_t
+cm_cache_get(void)
+{
+	struct cpu *c;
+	paddr_t pa;
+
+	c = curcpu->c_self;
+	spinlock_acquire(&c->c_pagecache_lock);
+	if (c->c_pagecache_num == 0) {
+		c->c_pagecache_misses++;
+		cm_cache_refill(c);
+		if (c->c_pagecache_num == 0) {
+			spinlock_release(&c->c_pagecache_lock);
+			return 0;
+		}
+	}
+	else {
+		c->c_pagecache_hits++;
+	}
+	pa = c->c_pagecache[--c->c_pagecache_num];
+	spinlock_release(&c->c_pagecache_lock);
+
+	/* The entry itself changes under coremap_lock; see freepages. */
+	cm_lock();
+	KASSERT(coremap[pa / PAGE_SIZE].cme_state == CME_CACHED);
+	cm_setinuse(pa / PAGE_SIZE, 1);
+	spinlock_release(&coremap_lock);
+
+	return pa;
+}
+
+/*
+ * Allocate from the free list itself.
+ */
+static
+paddr_t
+cm_getpages_global(unsigned long npages)
+{
+	paddr_t pa;
+	uint32_t pg;
+
+	cm_lock();
+
+	if (!coremap_ready) {
+		pa = ram_stealmem(npages);
+		spinlock_release(&coremap_lock);
+		return pa;
+	}
+
+	if (npages > cm_numfree) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	pg = cm_buddy_alloc(npages);
+	if (pg == CM_NOPAGE) {
+		cm_fragfails++;
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+	cm_setinuse(pg, npages);
+
+	spinlock_release(&coremap_lock);
+
+	return (paddr_t)pg * PAGE_SIZE;
+}
+
+/*
+ * Allocate NPAGES physically contiguous pages.
+ */
+paddr_t
+coremap_getpages(unsigned long npages)
+{
+	paddr_t pa;
+
+	KASSERT(npages > 0);
+
+	if (npages == 1 && coremap_ready && CURCPU_EXISTS()) {
+		pa = cm_cache_get();
+		if (pa != 0) {
+			return pa;
+		}
+	}
+
+	pa = cm_getpages_global(npages);
+	if (pa == 0 && coremap_ready) {
+		cm_cache_reclaim();
+		pa = cm_getpages_global(npages);
+	}
+	return pa;
+}
+
+/*
+ * Allocate one page, cleared. Takes it off the zeroed list if there
+ * is one there, waking the zeroer if the list is getting short, and
+ * otherwise clears a fresh page here.
+ */
+paddr_t
+coremap_getzeroed(void)
+{
+	uint32_t pg;
+	paddr_t pa;
+	bool wake;
+
+	wake = false;
+	cm_lock();
+	pg = cm_zerolist;
+	if (pg != CM_NOPAGE) {
+		KASSERT(coremap[pg].cme_state == CME_ZEROED);
+		cm_zerolist = coremap[pg].cme_next;
+		coremap[pg].cme_next = CM_NOPAGE;
+		cm_numzeroed--;
+		cm_setinuse(pg, 1);
+		cm_zerohits++;
+	}
+	else {
+		cm_zeromisses++;
+	}
+	if (cm_zerosem != NULL && !cm_zerowanted &&
+	    cm_numzeroed < cm_zerotarget / 2) {
+		cm_zerowanted = true;
+		wake = true;
+	}
+	spinlock_release(&coremap_lock);
+
+	if (wake) {
+		V(cm_zerosem);
+	}
+	if (pg != CM_NOPAGE) {
+		return (paddr_t)pg * PAGE_SIZE;
+	}
+
+	pa = coremap_getpages(1);
+	if (pa != 0) {
+		bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+	}
+	return pa;
+}
+
+/*
+ * The zeroer thread. Sleeps until coremap_getzeroed says the zeroed
+ * list is short, then fills it up again a page at a time.
+ */
+static
+void
+cm_zeroer(void *unused1, unsigned long unused2)
+{
+	paddr_t pa;
+	uint32_t pg;
+	bool more;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		P(cm_zerosem);
+
+		cm_lock();
+		cm_zerowanted = false;
+		/* Leave the free list enough that nobody goes short */
+		more = cm_numzeroed < cm_zerotarget &&
+			cm_numfree > cm_zerotarget;
+		spinlock_release(&coremap_lock);
+
+		while (more) {
+			pa = coremap_getpages(1);
+			if (pa == 0) {
+				break;
+			}
+			bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+
+			pg = pa / PAGE_SIZE;
+			cm_lock();
+			KASSERT(coremap[pg].cme_state == CME_INUSE);
+			KASSERT(coremap[pg].cme_refcount == 1);
+			coremap[pg].cme_refcount = 0;
+			coremap[pg].cme_npages = 0;
+			coremap[pg].cme_state = CME_ZEROED;
+			coremap[pg].cme_next = cm_zerolist;
+			cm_zerolist = pg;
+			cm_numzeroed++;
+			more = cm_numzeroed < cm_zerotarget &&
+				cm_numfree > cm_zerotarget;
+			spinlock_release(&coremap_lock);
+
+			thread_yield();
+		}
+	}
+}
+
+/*
+ * Start the zeroer and fill the zeroed list. Until this runs,
+ * coremap_getzeroed clears every page itself.
+ */
+void
+coremap_zero_bootstrap(void)
+{
+	int result;
+
+	KASSERT(coremap_ready);
+
+	cm_zerosem = sem_create("zeroer", 0);
+	if (cm_zerosem == NULL) {
+		panic("coremap: cannot create zeroer semaphore\n");
+	}
+	result = thread_fork("zeroer", NULL, cm_zeroer, NULL, 0);
+	if (result) {
+		/* Not fatal; faults just clear their own pages. */
+		kprintf("coremap: cannot start zeroer: %s\n",
+			strerror(result));
+		sem_destroy(cm_zerosem);
+		cm_zerosem = NULL;
+		return;
+	}
+	cm_lock();
+	cm_zerowanted = true;
+	spinlock_release(&coremap_lock);
+	V(cm_zerosem);
+}
+
+/*
+ * Drop a reference to a block allocated with coremap_getpages,
+ * freeing it if that was the last one.
+ */
+void
+coremap_freepages(paddr_t paddr)
+{
+	struct coremap_entry *e;
+	struct cpu *c;
+	uint32_t pg, npages, i;
+
+	KASSERT(paddr % PAGE_SIZE == 0);
+	pg = paddr / PAGE_SIZE;
+
+	/*
+	 * Fast path: the last reference to a single page goes into
+	 * this cpu's cache. The clock reads entries under coremap_lock
+	 * and would take an unshared user page for a victim, so the
+	 * entry is checked and changed under it too; only the push
+	 * onto the cache skips it.
+	 */
+	if (coremap_ready && CURCPU_EXISTS()) {
+		KASSERT(pg < cm_numpages);
+		e = &coremap[pg];
+		c = curcpu->c_self;
+		spinlock_acquire(&c->c_pagecache_lock);
+		cm_lock();
+		if (e->cme_state == CME_INUSE && e->cme_npages == 1 &&
+		    e->cme_refcount == 1) {
+			KASSERT(e->cme_pincount == 0);
+			e->cme_refcount = 0;
+			e->cme_npages = 0;
+			e->cme_pt = NULL;
+			e->cme_vaddr = 0;
+			e->cme_referenced = 0;
+			e->cme_state = CME_CACHED;
+			spinlock_release(&coremap_lock);
+			if (c->c_pagecache_num == PAGECACHE_MAX) {
+				cm_cache_drain(c, CM_BATCH);
+			}
+			c->c_pagecache[c->c_pagecache_num++] = paddr;
+			spinlock_release(&c->c_pagecache_lock);
+			return;
+		}
+		spinlock_release(&coremap_lock);
+		spinlock_release(&c->c_pagecache_lock);
+	}
+
+	cm_lock();
+
+	if (!coremap_ready) {
+		/* Stolen before the coremap existed; leak it. */
+		spinlock_release(&coremap_lock);
+		return;
+	}
+	KASSERT(pg < cm_numpages);
+	if (coremap[pg].cme_state == CME_FIXED) {
+		/* Likewise */
+		spinlock_release(&coremap_lock);
+		return;
+	}
+
+	KASSERT(coremap[pg].cme_state == CME_INUSE);
+	npages = coremap[pg].cme_npages;
+	KASSERT(npages > 0);
+	KASSERT(pg + npages <= cm_numpages);
+
+	KASSERT(coremap[pg].cme_refcount > 0);
+	coremap[pg].cme_refcount--;
+	if (coremap[pg].cme_refcount > 0) {
+		spinlock_release(&coremap_lock);
+		return;
+	}
+
+	for (i=pg; i<pg+npages; i++) {
+		KASSERT(coremap[i].cme_state == CME_INUSE);
+	}
+	KASSERT(coremap[pg].cme_pincount == 0);
+	cm_freerange(pg, pg + npages);
+
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Add a reference to an allocated block.
+ */
+void
+coremap_incref(paddr_t paddr)
+{
+	uint32_t pg;
+
+	KASSERT(paddr % PAGE_SIZE == 0);
+	pg = paddr / PAGE_SIZE;
+
+	cm_lock();
+	KASSERT(coremap_ready);
+	KASSERT(pg < cm_numpages);
+	KASSERT(coremap[pg].cme_state == CME_INUSE);
+	KASSERT(coremap[pg].cme_refcount > 0);
+	KASSERT(coremap[pg].cme_refcount < 0xffff);
+	coremap[pg].cme_refcount++;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Return the number of references to an allocated block.
+ */
+unsigned
+coremap_refcount(paddr_t paddr)
+{
+	uint32_t pg;
+	unsigned ret;
+
+	KASSERT(paddr % PAGE_SIZE == 0);
+	pg = paddr / PAGE_SIZE;
+
+	cm_lock();
+	KASSERT(coremap_ready);
+	KASSERT(pg < cm_numpages);
+	ret = coremap[pg].cme_refcount;
+	spinlock_release(&coremap_lock);
+
+	return ret;
+}
+
+/*
+ * Record that PADDR is the user page VADDR in page table PT, or
+ * (with PT NULL) that it no longer belongs to any page table and may
+ * not be evicted.
+ */
+void
+coremap_setowner(paddr_t paddr, struct pagetable *pt, vaddr_t vaddr)
+{
+	uint32_t pg;
+
+	pg = paddr / PAGE_SIZE;
+
+	cm_lock();
+	KASSERT(coremap_ready);
+	KASSERT(pg < cm_numpages);
+	KASSERT(coremap[pg].cme_state == CME_INUSE);
+	coremap[pg].cme_pt = pt;
+	coremap[pg].cme_vaddr = vaddr;
+	coremap[pg].cme_referenced = 1;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Clear the owner of PADDR if it is PT. Used when PT stops mapping a
+ * page that other page tables still share.
+ */
+void
+coremap_disown(paddr_t paddr, struct pagetable *pt)
+{
+	uint32_t pg;
+
+	pg = paddr / PAGE_SIZE;
+
+	cm_lock();
+	KASSERT(coremap_ready);
+	KASSERT(pg < cm_numpages);
+	if (coremap[pg].cme_pt == pt) {
+		coremap[pg].cme_pt = NULL;
+		coremap[pg].cme_vaddr = 0;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Note that PADDR was just used, so the clock passes over it once.
+ */
+void
+coremap_touch(paddr_t paddr)
+{
+	uint32_t pg;
+
+	pg = paddr / PAGE_SIZE;
+
+	cm_lock();
+	KASSERT(pg < cm_numpages);
+	coremap[pg].cme_referenced = 1;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Note that PADDR won't be used again soon (MADV_SEQUENTIAL), so the
+ * clock needn't give it another pass. Also the file cache's second
+ * chance: returns whether it had been used since the last time.
+ */
+bool
+coremap_untouch(paddr_t paddr)
+{
+	uint32_t pg;
+	bool ret;
+
+	pg = paddr / PAGE_SIZE;
+
+	cm_lock();
+	KASSERT(pg < cm_numpages);
+	ret = coremap[pg].cme_referenced != 0;
+	coremap[pg].cme_referenced = 0;
+	spinlock_release(&coremap_lock);
+	return ret;
+}
+
+/*
+ * True if E is a page the clock may evict: an unshared user page
+ * that isn't locked in memory.
+ */
+static
+bool
+cm_evictable(struct coremap_entry *e)
+{
+	return e->cme_state == CME_INUSE && e->cme_pt != NULL &&
+		e->cme_refcount == 1 && e->cme_pincount == 0;
+}
+
+/*
+ * True if PADDR may be paged out along with a neighbour in PT (see
+ * swap.c): an unshared page of PT's, not used since the front hand
+ * last went by.
+ */
+bool
+coremap_clusterable(paddr_t paddr, struct pagetable *pt)
+{
+	struct coremap_entry *e;
+	bool ret;
+
+	cm_lock();
+	KASSERT(paddr / PAGE_SIZE < cm_numpages);
+	e = &coremap[paddr / PAGE_SIZE];
+	ret = cm_evictable(e) && e->cme_pt == pt && !e->cme_referenced;
+	spinlock_release(&coremap_lock);
+	return ret;
+}
+
+/*
+ * Move the front hand on one page, taking away its reference. If it
+ * had one, fill in REF so the caller can shoot down the TLB entry,
+ * and return true.
+ */
+static
+bool
+cm_ageone(struct coremap_ref *ref)
+{
+	struct coremap_entry *e;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	if (cm_handgap + 1 >= cm_numpages - cm_firstpage) {
+		/* Would lap the back hand */
+		return false;
+	}
+	e = &coremap[cm_fronthand++];
+	if (cm_fronthand >= cm_numpages) {
+		cm_fronthand = cm_firstpage;
+	}
+	cm_handgap++;
+	if (!cm_evictable(e) || !e->cme_referenced) {
+		return false;
+	}
+	e->cme_referenced = 0;
+	ref->cr_pt = e->cme_pt;
+	ref->cr_vaddr = e->cme_vaddr;
+	cm_aged++;
+	return true;
+}
+
+/*
+ * Run the front hand over up to *NPAGES pages, or until MAX pages
+ * have lost their references; those go in REFS. Takes off *NPAGES
+ * what was looked at, and returns how many went in REFS.
+ */
+unsigned
+coremap_clockage(unsigned *npages, struct coremap_ref *refs, unsigned max)
+{
+	unsigned n;
+
+	n = 0;
+	cm_lock();
+	if (!coremap_ready) {
+		spinlock_release(&coremap_lock);
+		*npages = 0;
+		return 0;
+	}
+	while (*npages > 0 && n < max) {
+		(*npages)--;
+		if (cm_ageone(&refs[n])) {
+			n++;
+		}
+	}
+	spinlock_release(&coremap_lock);
+	return n;
+}
+
+/*
+ * Run the clock to pick a page to evict, moving the front hand along
+ * to keep it cm_handspread ahead. Pages that lose their references go
+ * in REFS, *NREFS of them, at most CM_MAXREFS.
+ *
+ * Returns 0 if REFS fills up first; the caller shoots those down and
+ * calls again. Also returns 0 (with REFS not full) if two full sweeps
+ * turn up nothing, which means every candidate was used in the
+ * meantime, or there are none. The page stays allocated; the caller
+ * (holding the VM lock, so that the owner cannot change, and so that
+ * nothing can fault a reference back in) pages it out.
+ */
+paddr_t
+coremap_clockvictim(struct pagetable **pt, vaddr_t *vaddr,
+		    struct coremap_ref *refs, unsigned *nrefs)
+{
+	struct coremap_entry *e;
+	uint32_t n, pg;
+
+	*nrefs = 0;
+	cm_lock();
+	if (!coremap_ready) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+	for (n=0; n < 2 * (cm_numpages - cm_firstpage); n++) {
+		while (cm_handgap < cm_handspread && *nrefs < CM_MAXREFS) {
+			if (cm_ageone(&refs[*nrefs])) {
+				(*nrefs)++;
+			}
+		}
+		if (cm_handgap < cm_handspread) {
+			break;
+		}
+		pg = cm_backhand++;
+		if (cm_backhand >= cm_numpages) {
+			cm_backhand = cm_firstpage;
+		}
+		cm_handgap--;
+		e = &coremap[pg];
+		if (!cm_evictable(e) || e->cme_referenced) {
+			continue;
+		}
+		*pt = e->cme_pt;
+		*vaddr = e->cme_vaddr;
+		spinlock_release(&coremap_lock);
+		return (paddr_t)pg * PAGE_SIZE;
+	}
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+
+/*
+ * Pin PADDR in memory, or drop a pin, for mlock; a pinned page is
+ * never evicted. Each page table that locks the page holds a pin.
+ */
+void
+coremap_pin(paddr_t paddr)
+{
+	struct coremap_entry *e;
+
+	cm_lock();
+	KASSERT(paddr / PAGE_SIZE < cm_numpages);
+	e = &coremap[paddr / PAGE_SIZE];
+	KASSERT(e->cme_state == CME_INUSE);
+	if (e->cme_pincount++ == 0) {
+		cm_numpinned++;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_unpin(paddr_t paddr)
+{
+	struct coremap_entry *e;
+
+	cm_lock();
+	KASSERT(paddr / PAGE_SIZE < cm_numpages);
+	e = &coremap[paddr / PAGE_SIZE];
+	KASSERT(e->cme_pincount > 0);
+	if (--e->cme_pincount == 0) {
+		KASSERT(cm_numpinned > 0);
+		cm_numpinned--;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Pages pinned. Read without the lock, like coremap_numfree.
+ */
+unsigned
+coremap_numpinned(void)
+{
+	return cm_numpinned;
+}
+
+/*
+ * Set the least distance between the clock hands, in pages.
+ */
+void
+coremap_sethandspread(unsigned npages)
+{
+	cm_lock();
+	if (npages >= cm_numpages - cm_firstpage) {
+		npages = cm_numpages - cm_firstpage - 1;
+	}
+	cm_handspread = npages;
+	spinlock_release(&coremap_lock);
+}
+
+unsigned
+coremap_gethandspread(void)
+{
+	return cm_handspread;
+}
+
+/*
+ * Free and managed page counts. Read without the lock: the answer
+ * is stale as soon as it is returned anyway, and the pageout thread
+ * only uses it as a hint. (Pages in the per-cpu caches aren't
+ * counted; there are few of them.)
+ */
+unsigned
+coremap_numfree(void)
+{
+	return cm_numfree + cm_numzeroed;
+}
+
+unsigned
+coremap_numpages(void)
+{
+	return cm_numpages - cm_firstpage;
+}
+
+/*
+ * Print physical memory usage.
+ */
+void
+coremap_printstats(void)
+{
+	uint32_t total, nfree, ncached, nzeroed, gap, spread, pinned;
+	unsigned i, ncpus, trips, zhits, zmisses, aged;
+	struct cpu *c;
+
+	cm_lock();
+	if (!coremap_ready) {
+		spinlock_release(&coremap_lock);
+		kprintf("coremap: not initialized\n");
+		return;
+	}
+	total = cm_numpages - cm_firstpage;
+	nfree = cm_numfree;
+	ncpus = cm_ncpus;
+	trips = cm_locktrips;
+	nzeroed = cm_numzeroed;
+	zhits = cm_zerohits;
+	zmisses = cm_zeromisses;
+	gap = cm_handgap;
+	spread = cm_handspread;
+	aged = cm_aged;
+	pinned = cm_numpinned;
+	spinlock_release(&coremap_lock);
+
+	/* The per-cpu numbers are read unlocked; they're only stats. */
+	ncached = 0;
+	for (i=0; i<ncpus; i++) {
+		ncached += cm_cpus[i]->c_pagecache_num;
+	}
+	nfree += ncached + nzeroed;
+
+	kprintf("coremap: %u/%u pages free (%uk used), %u in cpu caches, "
+		"%u zeroed\n", nfree, total,
+		(total - nfree) * PAGE_SIZE / 1024, ncached, nzeroed);
+	kprintf("coremap: zeroed pages: %u hits, %u misses\n",
+		zhits, zmisses);
+	kprintf("coremap: %u pages locked in memory\n", pinned);
+	kprintf("coremap: clock hands %u pages apart (spread %u), "
+		"%u references taken\n", gap, spread, aged);
+	kprintf("coremap: coremap_lock taken %u times\n", trips);
+	for (i=0; i<ncpus; i++) {
+		c = cm_cpus[i];
+		kprintf("coremap: cpu%u cache: %u hits, %u misses\n",
+			c->c_number, c->c_pagecache_hits,
+			c->c_pagecache_misses);
+	}
+}
+
+/*
+ * Print the state of the buddy free lists, to watch external
+ * fragmentation: how free memory is split up by block size, the
+ * largest contiguous run still available, and how many multi-page
+ * requests have failed despite there being enough pages free.
+ */
+void
+coremap_printfrag(void)
+{
+	unsigned nblocks[CM_MAXORDER + 1];
+	uint32_t pg, nfree, largest;
+	unsigned order, fails;
+
+	cm_lock();
+	if (!coremap_ready) {
+		spinlock_release(&coremap_lock);
+		kprintf("coremap: not initialized\n");
+		return;
+	}
+	largest = 0;
+	for (order=0; order<=CM_MAXORDER; order++) {
+		nblocks[order] = 0;
+		for (pg = cm_freelist[order]; pg != CM_NOPAGE;
+		     pg = coremap[pg].cme_next) {
+			nblocks[order]++;
+		}
+		if (nblocks[order] > 0) {
+			largest = (uint32_t)1 << order;
+		}
+	}
+	nfree = cm_numfree;
+	fails = cm_fragfails;
+	spinlock_release(&coremap_lock);
+
+	kprintf("coremap: free blocks by size (not counting cpu caches):\n");
+	for (order=0; order<=CM_MAXORDER; order++) {
+		if (nblocks[order] > 0) {
+			kprintf("  %5u pages: %u\n",
+				1U << order, nblocks[order]);
+		}
+	}
+	kprintf("coremap: %u pages free, largest run %u pages", nfree,
+		largest);
+	if (nfree > 0) {
+		/* share of free memory outside the largest block */
+		kprintf(", fragmentation %u%%", 100 - largest * 100 / nfree);
+	}
+	kprintf("\n");
+	kprintf("coremap: %u allocations failed for lack of a run\n", fails);
+}
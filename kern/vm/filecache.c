@@ -0,0 +1,503 @@
+/*
+ * File page cache. See filecache.h.
+ *
+ * Pages are kept in one hash table keyed on the file and offset, and
+ * each vnode points at its current cache (vn_filecache). Everything,
+ * vn_filecache included, is under fc_lock, which
+ * is never held while allocating memory or doing I/O: a page being
+ * read in is entered with fp_paddr 0, and anyone else who wants it
+ * waits on fc_cv. That way the file can be read without holding
+ * vm_lock or fc_lock, which matters because the file system may be
+ * holding the vnode's lock while it copies to a user page that is
+ * faulting.
+ *
+ * If the file has been written to since its cache was made, the next
+ * filecache_open takes the old cache off the vnode and starts a new
+ * one. Address spaces already using the old one keep it (a program
+ * whose file is rewritten while it runs may see some of each).
+ * Writing back the cache's own pages doesn't count, as long as
+ * nothing else wrote to the file meanwhile, so that later mappings
+ * of the file go on sharing pages with earlier ones.
+ *
+ * The file system goes through here too (filecache_read and
+ * filecache_write, from sfs_io), so the data of a mapped file is
+ * cached once: a read() of a page the cache has comes from the
+ * cache's frame, a write() updates the frame as well as the buffer
+ * cache, and the cache's own reads and writebacks are marked
+ * uio_nocache so SFS doesn't keep a second copy of the blocks in its
+ * buffers. A write still changes the vnode's version, after which
+ * the cache is no longer current and filecache_read passes; but
+ * everyone mapping it already has the new bytes.
+ *
+ * filecache_reclaim gives each page a second chance on the coremap's
+ * referenced bit, which mapping a page and reading it with read()
+ * both set, so the pageout thread takes the file pages nobody has
+ * used lately and goes on to anonymous memory while there are none.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vm.h>
+#include <coremap.h>
+#include <filecache.h>
+#include <vmstat.h>
+
+#define FC_NBUCKETS	64
+
+struct filecache_page {
+	struct filecache_file *fp_file;
+	off_t fp_offset;
+	unsigned fp_start;		/* bytes [fp_start, fp_end) are */
+	unsigned fp_end;		/* from the file; the rest zero */
+	paddr_t fp_paddr;		/* 0 while being read in */
+	struct filecache_page *fp_next;
+};
+
+struct filecache_file {
+	struct vnode *ff_vnode;
+	unsigned ff_version;		/* vnode version the pages are of */
+	bool ff_stale;			/* off the vnode; file has changed */
+	unsigned ff_refcount;
+};
+
+static struct lock *fc_lock;
+static struct cv *fc_cv;		/* a page has been read in */
+static struct filecache_page *fc_table[FC_NBUCKETS];
+static unsigned fc_hand;		/* next bucket to reclaim from */
+
+void
+filecache_bootstrap(void)
+{
+	unsigned i;
+
+	fc_lock = lock_create("filecache");
+	fc_cv = cv_create("filecache");
+	if (fc_lock == NULL || fc_cv == NULL) {
+		panic("filecache_bootstrap: out of memory\n");
+	}
+	for (i=0; i<FC_NBUCKETS; i++) {
+		fc_table[i] = NULL;
+	}
+	fc_hand = 0;
+}
+
+static
+unsigned
+fc_hash(struct filecache_file *f, off_t offset)
+{
+	return (((uintptr_t)f >> 4) ^ (unsigned)(offset / PAGE_SIZE))
+		% FC_NBUCKETS;
+}
+
+struct filecache_file *
+filecache_open(struct vnode *v)
+{
+	struct filecache_file *f, *newf;
+	unsigned version;
+
+	/* Allocate first, in case; fc_lock can't be held for it */
+	newf = kmalloc(sizeof(*newf));
+	version = vnode_version(v);
+
+	lock_acquire(fc_lock);
+	f = v->vn_filecache;
+	if (f != NULL && f->ff_version != version) {
+		v->vn_filecache = NULL;
+		f->ff_stale = true;
+		f = NULL;
+	}
+	if (f != NULL) {
+		f->ff_refcount++;
+	}
+	else if (newf != NULL) {
+		VOP_INCREF(v);
+		newf->ff_vnode = v;
+		newf->ff_version = version;
+		newf->ff_stale = false;
+		newf->ff_refcount = 1;
+		v->vn_filecache = newf;
+		f = newf;
+		newf = NULL;
+	}
+	lock_release(fc_lock);
+
+	if (newf != NULL) {
+		kfree(newf);
+	}
+	return f;
+}
+
+void
+filecache_incref(struct filecache_file *f)
+{
+	lock_acquire(fc_lock);
+	KASSERT(f->ff_refcount > 0);
+	f->ff_refcount++;
+	lock_release(fc_lock);
+}
+
+void
+filecache_close(struct filecache_file *f)
+{
+	struct filecache_page *fp, **pp, *dead;
+	unsigned i;
+
+	lock_acquire(fc_lock);
+	KASSERT(f->ff_refcount > 0);
+	f->ff_refcount--;
+	if (f->ff_refcount > 0) {
+		lock_release(fc_lock);
+		return;
+	}
+
+	if (!f->ff_stale) {
+		KASSERT(f->ff_vnode->vn_filecache == f);
+		f->ff_vnode->vn_filecache = NULL;
+	}
+
+	/* Nobody can be reading a page in; they'd hold a reference */
+	dead = NULL;
+	for (i=0; i<FC_NBUCKETS; i++) {
+		pp = &fc_table[i];
+		while (*pp != NULL) {
+			fp = *pp;
+			if (fp->fp_file == f) {
+				KASSERT(fp->fp_paddr != 0);
+				*pp = fp->fp_next;
+				fp->fp_next = dead;
+				dead = fp;
+			}
+			else {
+				pp = &fp->fp_next;
+			}
+		}
+	}
+	lock_release(fc_lock);
+
+	while (dead != NULL) {
+		fp = dead;
+		dead = fp->fp_next;
+		coremap_freepages(fp->fp_paddr);
+		kfree(fp);
+	}
+	VOP_DECREF(f->ff_vnode);
+	kfree(f);
+}
+
+/*
+ * Find F's page at OFFSET with the file contents in [START, END).
+ * Caller holds fc_lock.
+ */
+static
+struct filecache_page *
+fc_lookup(struct filecache_file *f, off_t offset,
+	  unsigned start, unsigned end)
+{
+	struct filecache_page *fp;
+
+	for (fp = fc_table[fc_hash(f, offset)]; fp != NULL;
+	     fp = fp->fp_next) {
+		if (fp->fp_file == f && fp->fp_offset == offset &&
+		    fp->fp_start == start && fp->fp_end == end) {
+			return fp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Fill the page at KVA from file V.
+ */
+static
+int
+fc_read(struct vnode *v, off_t offset, unsigned start, unsigned end,
+	vaddr_t kva)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	bzero((void *)kva, PAGE_SIZE);
+	uio_kinit(&iov, &ku, (void *)(kva + start), end - start,
+		  offset + start, UIO_READ);
+	ku.uio_nocache = true;
+	result = VOP_READ(v, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		kprintf("filecache: short read - file truncated?\n");
+		return ENOEXEC;
+	}
+	return 0;
+}
+
+int
+filecache_getpage(struct filecache_file *f, off_t offset,
+		  unsigned start, unsigned end, paddr_t *ret)
+{
+	struct filecache_page *fp, *newfp, **pp;
+	vaddr_t kva;
+	paddr_t pa = 0;
+	int result;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+	KASSERT(start < end && end <= PAGE_SIZE);
+	KASSERT(!lock_do_i_hold(vm_lock));
+
+	newfp = NULL;
+	lock_acquire(fc_lock);
+	while (1) {
+		fp = fc_lookup(f, offset, start, end);
+		if (fp != NULL && fp->fp_paddr == 0) {
+			/* Someone else is reading it */
+			cv_wait(fc_cv, fc_lock);
+			continue;
+		}
+		if (fp != NULL || newfp != NULL) {
+			break;
+		}
+		lock_release(fc_lock);
+		newfp = kmalloc(sizeof(*newfp));
+		if (newfp == NULL) {
+			return ENOMEM;
+		}
+		lock_acquire(fc_lock);
+	}
+
+	if (fp != NULL) {
+		pa = fp->fp_paddr;
+		coremap_incref(pa);
+		lock_release(fc_lock);
+		if (newfp != NULL) {
+			kfree(newfp);
+		}
+		*ret = pa;
+		return 0;
+	}
+
+	/* Claim the page and read it in */
+	newfp->fp_file = f;
+	newfp->fp_offset = offset;
+	newfp->fp_start = start;
+	newfp->fp_end = end;
+	newfp->fp_paddr = 0;
+	pp = &fc_table[fc_hash(f, offset)];
+	newfp->fp_next = *pp;
+	*pp = newfp;
+	lock_release(fc_lock);
+
+	kva = alloc_kpages(1);
+	if (kva == 0) {
+		result = ENOMEM;
+	}
+	else {
+		result = fc_read(f->ff_vnode, offset, start, end, kva);
+		if (result) {
+			free_kpages(kva);
+		}
+	}
+
+	lock_acquire(fc_lock);
+	if (result) {
+		for (pp = &fc_table[fc_hash(f, offset)]; *pp != newfp;
+		     pp = &(*pp)->fp_next) {
+			KASSERT(*pp != NULL);
+		}
+		*pp = newfp->fp_next;
+	}
+	else {
+		pa = KVADDR_TO_PADDR(kva);
+		newfp->fp_paddr = pa;
+		/* One reference for the cache, one for the caller */
+		coremap_incref(pa);
+	}
+	cv_broadcast(fc_cv, fc_lock);
+	lock_release(fc_lock);
+
+	if (result) {
+		kfree(newfp);
+		return result;
+	}
+	*ret = pa;
+	return 0;
+}
+
+int
+filecache_putpage(struct filecache_file *f, off_t offset,
+		  unsigned start, unsigned end, paddr_t pa)
+{
+	struct iovec iov;
+	struct uio ku;
+	unsigned oldversion, version;
+	int result;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+	KASSERT(start < end && end <= PAGE_SIZE);
+	KASSERT(!lock_do_i_hold(vm_lock));
+
+	lock_acquire(fc_lock);
+	oldversion = version = f->ff_version;
+	lock_release(fc_lock);
+
+	uio_kinit(&iov, &ku, (void *)(PADDR_TO_KVADDR(pa) + start),
+		  end - start, offset + start, UIO_WRITE);
+	ku.uio_nocache = true;
+	result = vnode_writeback(f->ff_vnode, &ku, &version);
+
+	lock_acquire(fc_lock);
+	if (version != oldversion && f->ff_version == oldversion) {
+		f->ff_version = version;
+	}
+	lock_release(fc_lock);
+
+	if (result == 0 && ku.uio_resid != 0) {
+		result = ENOSPC;
+	}
+	return result;
+}
+
+/*
+ * Find a page of V's current cache at OFFSET (page-aligned) with the
+ * file's bytes [START, END) in it. Caller holds fc_lock.
+ */
+static
+struct filecache_page *
+fc_lookupcurrent(struct vnode *v, off_t offset, unsigned start, unsigned end)
+{
+	struct filecache_file *f;
+	struct filecache_page *fp;
+
+	f = v->vn_filecache;
+	if (f == NULL || f->ff_version != vnode_version(v)) {
+		return NULL;
+	}
+	for (fp = fc_table[fc_hash(f, offset)]; fp != NULL;
+	     fp = fp->fp_next) {
+		if (fp->fp_file == f && fp->fp_offset == offset &&
+		    fp->fp_paddr != 0 &&
+		    fp->fp_start <= start && end <= fp->fp_end) {
+			return fp;
+		}
+	}
+	return NULL;
+}
+
+int
+filecache_read(struct vnode *v, struct uio *uio, size_t len)
+{
+	struct filecache_page *fp;
+	off_t offset;
+	unsigned start;
+	paddr_t pa;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	/* Unlocked peek, so files nobody maps don't pay for fc_lock */
+	if (v->vn_filecache == NULL) {
+		return ENOENT;
+	}
+
+	start = uio->uio_offset % PAGE_SIZE;
+	offset = uio->uio_offset - start;
+	KASSERT(start + len <= PAGE_SIZE);
+
+	lock_acquire(fc_lock);
+	fp = fc_lookupcurrent(v, offset, start, start + len);
+	if (fp == NULL) {
+		lock_release(fc_lock);
+		return ENOENT;
+	}
+	/* Our reference keeps filecache_reclaim off it while we copy */
+	pa = fp->fp_paddr;
+	coremap_incref(pa);
+	lock_release(fc_lock);
+
+	coremap_touch(pa);
+	result = uiomove((void *)(PADDR_TO_KVADDR(pa) + start), len, uio);
+	coremap_freepages(pa);
+	return result;
+}
+
+void
+filecache_write(struct vnode *v, off_t pos, const void *data, size_t len)
+{
+	struct filecache_file *f;
+	struct filecache_page *fp;
+	off_t offset;
+	unsigned start, end, s, e;
+	size_t n;
+
+	if (v->vn_filecache == NULL) {
+		return;
+	}
+
+	lock_acquire(fc_lock);
+	f = v->vn_filecache;
+	while (f != NULL && len > 0) {
+		start = pos % PAGE_SIZE;
+		offset = pos - start;
+		n = PAGE_SIZE - start;
+		if (n > len) {
+			n = len;
+		}
+		end = start + n;
+
+		/* Every page of this offset, whatever part of it it has */
+		for (fp = fc_table[fc_hash(f, offset)]; fp != NULL;
+		     fp = fp->fp_next) {
+			if (fp->fp_file != f || fp->fp_offset != offset ||
+			    fp->fp_paddr == 0) {
+				continue;
+			}
+			s = start > fp->fp_start ? start : fp->fp_start;
+			e = end < fp->fp_end ? end : fp->fp_end;
+			if (s < e) {
+				memcpy((void *)(PADDR_TO_KVADDR(fp->fp_paddr)
+						+ s),
+				       (const char *)data + (s - start),
+				       e - s);
+			}
+		}
+		pos += n;
+		data = (const char *)data + n;
+		len -= n;
+	}
+	lock_release(fc_lock);
+}
+
+bool
+filecache_reclaim(void)
+{
+	struct filecache_page *fp, **pp;
+	unsigned n;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	/* Twice round, in case the first only clears referenced bits */
+	lock_acquire(fc_lock);
+	for (n=0; n<2*FC_NBUCKETS; n++) {
+		pp = &fc_table[fc_hand];
+		fc_hand = (fc_hand + 1) % FC_NBUCKETS;
+		for (; *pp != NULL; pp = &(*pp)->fp_next) {
+			fp = *pp;
+			if (fp->fp_paddr != 0 &&
+			    coremap_refcount(fp->fp_paddr) == 1 &&
+			    !coremap_untouch(fp->fp_paddr)) {
+				*pp = fp->fp_next;
+				lock_release(fc_lock);
+				coremap_freepages(fp->fp_paddr);
+				kfree(fp);
+				vmstat_count(VMS_EVICT);
+				return true;
+			}
+		}
+	}
+	lock_release(fc_lock);
+	return false;
+}
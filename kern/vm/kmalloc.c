@@ -29,8 +29,13 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spl.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
 #include <vm.h>
+#include <clock.h>
+#include <platform/maxcpus.h>
 
 /*
  * Kernel malloc.
@@ -100,7 +105,9 @@ fill_deadbeef(void *vptr, size_t len)
  * malloc-related bugs to manifest differently.
  *
  * LABELS records the allocation site and a generation number for each
- * allocation and is useful for tracking down memory leaks.
+ * allocation and is useful for tracking down memory leaks. It also
+ * keeps a running total for each site of what it has outstanding
+ * and how fast it allocates, for kheap_profile (the khprof command).
  *
  * On top of these one can enable the following:
  *
@@ -160,14 +167,48 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * One spinlock protects the pages, pagerefs, and lists. In front of
+ * it, each cpu has a magazine of free blocks for each size, touched
+ * only by its own cpu with interrupts off, so most kmalloc and kfree
+ * calls take no lock at all. When a magazine runs dry or overflows,
+ * half a magazine's worth moves between it and the pages in one trip
+ * under the spinlock. (This is the same scheme as kmem_cache.c.)
+ *
+ * Blocks sitting in magazines still count as allocated as far as the
+ * pages are concerned, so a page can't be given back until they have
+ * drained out of the magazines.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
 
+#define KMALLOC_MAGSIZE 8	/* blocks per magazine */
+
+struct kmalloc_mag {
+	unsigned km_num;
+	vaddr_t km_blocks[KMALLOC_MAGSIZE];
+};
+
+/* Each cpu's magazines, on cache lines of their own */
+struct kmalloc_cpumags {
+	struct kmalloc_mag kc_mags[NSIZES];
+} __cacheline_aligned;
+
+static struct kmalloc_cpumags kmalloc_mags[MAXCPUS];
+
+/*
+ * Return the current cpu's magazine for blocks of type BLKTYPE, or
+ * NULL if there is none (early in boot). Interrupts must be off.
+ */
+static
+struct kmalloc_mag *
+getmag(unsigned blktype)
+{
+	if (!CURCPU_EXISTS() || curcpu->c_number >= MAXCPUS) {
+		return NULL;
+	}
+	return &kmalloc_mags[curcpu->c_number].kc_mags[blktype];
+}
+
 ////////////////////////////////////////
 
 /*
@@ -345,6 +386,31 @@ freepageref(struct pageref *p)
 static struct pageref *sizebases[NSIZES];
 static struct pageref *allbase;
 
+/*
+ * And each heap page can be found from its address, without walking
+ * the lists, in this table indexed by physical page number. The table
+ * covers the same 16M as the pagerefs (see NUM_PAGEREFPAGES); a page
+ * from above that is never used for the subpage heap. Entries are
+ * only changed under the spinlock.
+ */
+#define KHEAP_MAXPAGES (TOTAL_PAGEREFS)
+#define KHEAP_PAGEINDEX(va) (KVADDR_TO_PADDR(va) / PAGE_SIZE)
+
+static struct pageref *pagerefs_bypage[KHEAP_MAXPAGES];
+
+static
+struct pageref *
+findpageref(vaddr_t addr)
+{
+	vaddr_t index;
+
+	index = KHEAP_PAGEINDEX(addr);
+	if (index >= KHEAP_MAXPAGES) {
+		return NULL;
+	}
+	return pagerefs_bypage[index];
+}
+
 ////////////////////////////////////////
 
 #ifdef GUARDS
@@ -691,6 +757,147 @@ dump_subpages(unsigned generation)
 	}
 }
 
+/*
+ * Allocation sites. Each caller of kmalloc gets an entry the first
+ * time it allocates, in an open hash on its label; once the table is
+ * full, further sites are all counted together in kheap_other.
+ * Whole-page allocations have no room for a label, so the pages of
+ * each are remembered in kheap_bigs, as far as that goes.
+ */
+#define KHEAP_NSITES	256
+#define KHEAP_NBIGS	512
+
+struct kheap_site {
+	vaddr_t ks_label;	/* allocation site; 0 if unused */
+	unsigned ks_count;	/* blocks outstanding */
+	size_t ks_bytes;	/* bytes outstanding */
+	size_t ks_peak;		/* most bytes outstanding since reset */
+	unsigned ks_allocs;	/* allocations since reset */
+};
+
+struct kheap_big {
+	vaddr_t kb_addr;	/* 0 if the slot is free */
+	vaddr_t kb_label;
+	size_t kb_bytes;
+};
+
+static struct spinlock kheap_sitelock = SPINLOCK_INITIALIZER;
+static struct kheap_site kheap_sites[KHEAP_NSITES];
+static struct kheap_site kheap_other;	/* sites past the table */
+static struct kheap_big kheap_bigs[KHEAP_NBIGS];
+static unsigned kheap_lostbigs;		/* big ones not remembered */
+static uint64_t kheap_profstart;	/* clock_monotonic_ns at reset */
+
+static
+struct kheap_site *
+kheap_findsite(vaddr_t label)
+{
+	struct kheap_site *ks;
+	unsigned i, h;
+
+	KASSERT(spinlock_do_i_hold(&kheap_sitelock));
+
+	h = (label >> 2) % KHEAP_NSITES;
+	for (i=0; i<KHEAP_NSITES; i++) {
+		ks = &kheap_sites[(h + i) % KHEAP_NSITES];
+		if (ks->ks_label == label) {
+			return ks;
+		}
+		if (ks->ks_label == 0) {
+			ks->ks_label = label;
+			return ks;
+		}
+	}
+	return &kheap_other;
+}
+
+static
+void
+kheap_sitealloc(vaddr_t label, size_t bytes)
+{
+	struct kheap_site *ks;
+
+	spinlock_acquire(&kheap_sitelock);
+	ks = kheap_findsite(label);
+	ks->ks_count++;
+	ks->ks_bytes += bytes;
+	ks->ks_allocs++;
+	if (ks->ks_bytes > ks->ks_peak) {
+		ks->ks_peak = ks->ks_bytes;
+	}
+	spinlock_release(&kheap_sitelock);
+}
+
+static
+void
+kheap_sitefree(vaddr_t label, size_t bytes)
+{
+	struct kheap_site *ks;
+
+	spinlock_acquire(&kheap_sitelock);
+	ks = kheap_findsite(label);
+	if (ks->ks_count > 0) {
+		ks->ks_count--;
+		ks->ks_bytes -= bytes;
+	}
+	spinlock_release(&kheap_sitelock);
+}
+
+/*
+ * Remember whole-page allocation ADDR, from LABEL.
+ */
+static
+void
+kheap_bigalloc(vaddr_t addr, vaddr_t label, size_t bytes)
+{
+	unsigned i;
+
+	spinlock_acquire(&kheap_sitelock);
+	for (i=0; i<KHEAP_NBIGS; i++) {
+		if (kheap_bigs[i].kb_addr == 0) {
+			kheap_bigs[i].kb_addr = addr;
+			kheap_bigs[i].kb_label = label;
+			kheap_bigs[i].kb_bytes = bytes;
+			break;
+		}
+	}
+	if (i == KHEAP_NBIGS) {
+		kheap_lostbigs++;
+	}
+	spinlock_release(&kheap_sitelock);
+
+	if (i < KHEAP_NBIGS) {
+		kheap_sitealloc(label, bytes);
+	}
+}
+
+static
+void
+kheap_bigfree(vaddr_t addr)
+{
+	vaddr_t label;
+	size_t bytes;
+	unsigned i;
+
+	spinlock_acquire(&kheap_sitelock);
+	for (i=0; i<KHEAP_NBIGS; i++) {
+		if (kheap_bigs[i].kb_addr == addr) {
+			break;
+		}
+	}
+	if (i == KHEAP_NBIGS) {
+		/* One we couldn't remember */
+		spinlock_release(&kheap_sitelock);
+		return;
+	}
+	label = kheap_bigs[i].kb_label;
+	bytes = kheap_bigs[i].kb_bytes;
+	kheap_bigs[i].kb_addr = 0;
+	spinlock_release(&kheap_sitelock);
+
+	kheap_sitefree(label, bytes);
+}
+
 #else
 
 #define LABEL_OVERHEAD 0
@@ -720,6 +927,80 @@ kheap_dump(void)
 #endif
 }
 
+/*
+ * Print the allocation sites, most bytes outstanding first, and with
+ * RESET start counting allocations and peaks afresh from now.
+ */
+void
+kheap_profile(bool reset)
+{
+#ifdef LABELS
+	struct kheap_site *sites, *ks, tmp;
+	unsigned i, j, n, lost;
+	uint64_t now, ms;
+
+	sites = kmalloc(sizeof(kheap_sites) + sizeof(kheap_other));
+	if (sites == NULL) {
+		kprintf("khprof: Out of memory\n");
+		return;
+	}
+
+	now = clock_monotonic_ns();
+	spinlock_acquire(&kheap_sitelock);
+	n = 0;
+	for (i=0; i<=KHEAP_NSITES; i++) {
+		ks = i < KHEAP_NSITES ? &kheap_sites[i] : &kheap_other;
+		if (ks->ks_count > 0 || ks->ks_allocs > 0) {
+			sites[n++] = *ks;
+		}
+		if (reset) {
+			ks->ks_allocs = 0;
+			ks->ks_peak = ks->ks_bytes;
+		}
+	}
+	lost = kheap_lostbigs;
+	ms = (now - kheap_profstart) / 1000000;
+	if (reset) {
+		kheap_profstart = now;
+	}
+	spinlock_release(&kheap_sitelock);
+
+	/* Most bytes first; there aren't many */
+	for (i=1; i<n; i++) {
+		tmp = sites[i];
+		for (j=i; j>0 && sites[j-1].ks_bytes < tmp.ks_bytes; j--) {
+			sites[j] = sites[j-1];
+		}
+		sites[j] = tmp;
+	}
+
+	kprintf("Allocation sites over the last %llu ms:\n",
+		(unsigned long long)ms);
+	kprintf("%10s %8s %10s %8s %8s  %s\n", "bytes", "blocks",
+		"peak", "allocs", "per sec", "site");
+	for (i=0; i<n; i++) {
+		kprintf("%10zu %8u %10zu %8u %8llu  ", sites[i].ks_bytes,
+			sites[i].ks_count, sites[i].ks_peak,
+			sites[i].ks_allocs,
+			ms == 0 ? 0ULL :
+			(unsigned long long)sites[i].ks_allocs * 1000 / ms);
+		if (sites[i].ks_label == 0) {
+			kprintf("(the rest)\n");
+		}
+		else {
+			kprintf("%p\n", (void *)sites[i].ks_label);
+		}
+	}
+	if (lost > 0) {
+		kprintf("%u whole-page allocations weren't counted\n", lost);
+	}
+	kfree(sites);
+#else
+	(void)reset;
+	kprintf("Enable LABELS in kmalloc.c to use this functionality.\n");
+#endif
+}
+
 void
 kheap_dumpall(void)
 {
@@ -801,6 +1082,7 @@ void
 kheap_printstats(void)
 {
 	struct pageref *pr;
+	unsigned i, j, nmag;
 
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
@@ -811,6 +1093,15 @@ kheap_printstats(void)
 		subpage_stats(pr);
 	}
 
+	/* other cpus' magazines may be changing; near enough */
+	nmag = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		for (j=0; j<NSIZES; j++) {
+			nmag += kmalloc_mags[i].kc_mags[j].km_num;
+		}
+	}
+	kprintf("%u blocks shown in use are in per-cpu magazines\n", nmag);
+
 	spinlock_release(&kmalloc_spinlock);
 }
 
@@ -867,97 +1158,113 @@ int blocktype(size_t clientsz)
 }
 
 /*
- * Allocate a block of size SZ, where SZ is not large enough to
- * warrant a whole-page allocation.
+ * Take a block off PR's freelist. PR must have one.
  */
 static
-void *
-subpage_kmalloc(size_t sz
-#ifdef LABELS
-		, vaddr_t label
-#endif
-	)
+vaddr_t
+subpage_popblock(struct pageref *pr)
 {
-	unsigned blktype;	// index into sizes[] that we're using
-	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
-	struct freelist *volatile fl;	// free list entry
-	void *retptr;		// our result
-
-	volatile int i;
-
-#ifdef GUARDS
-	size_t clientsz;
-#endif
+	struct freelist *fl;	// free list entry
+	vaddr_t block;		// our result
 
-#ifdef GUARDS
-	clientsz = sz;
-	sz += GUARD_OVERHEAD;
-#endif
-#ifdef LABELS
-#ifdef GUARDS
-	/* Include the label in what GUARDS considers the client data. */
-	clientsz += LABEL_PTROFFSET;
-#endif
-	sz += LABEL_PTROFFSET;
-#endif
-	blktype = blocktype(sz);
-#ifdef GUARDS
-	sz = sizes[blktype];
-#endif
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(pr->nfree > 0);
+	KASSERT(pr->freelist_offset < PAGE_SIZE);
 
-	spinlock_acquire(&kmalloc_spinlock);
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
 
-	checksubpages();
+	block = fla;
+	fl = fl->next;
+	pr->nfree--;
 
-	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
+	if (fl != NULL) {
+		KASSERT(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		KASSERT(fla - prpage < PAGE_SIZE);
+		pr->freelist_offset = fla - prpage;
+	}
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+	}
+	return block;
+}
 
-		/* check for corruption */
-		KASSERT(PR_BLOCKTYPE(pr) == blktype);
-		checksubpage(pr);
+/*
+ * Put BLOCK back on the freelist of PR, the page it's on. If that
+ * frees the whole page, drop the page from the heap and return true;
+ * the caller should give the page back with free_kpages once it has
+ * let go of the spinlock.
+ */
+static
+bool
+subpage_putblock(struct pageref *pr, vaddr_t block)
+{
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	struct freelist *fl;	// free list entry
+	int blktype;		// index into sizes[] that we're using
 
-		if (pr->nfree > 0) {
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
-		doalloc: /* comes here after getting a whole fresh page */
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	checksubpage(pr);
 
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
+	fl = (struct freelist *)block;
+	if (pr->freelist_offset == INVALID_OFFSET) {
+		fl->next = NULL;
+	} else {
+		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
 
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
+		/* this block should not already be on the free list! */
+#ifdef SLOW
+		{
+			struct freelist *fl2;
 
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
+			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
+				KASSERT(fl2 != fl);
 			}
-#ifdef GUARDS
-			retptr = establishguardband(retptr, clientsz, sz);
-#endif
-#ifdef LABELS
-			retptr = establishlabel(retptr, label);
+		}
+#else
+		/* check just the head */
+		KASSERT(fl != fl->next);
 #endif
+	}
+	pr->freelist_offset = block - prpage;
+	pr->nfree++;
 
-			checksubpages();
-
-			spinlock_release(&kmalloc_spinlock);
-			return retptr;
-		}
+	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
+	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
+		/* Whole page is free. */
+		remove_lists(pr, blktype);
+		pagerefs_bypage[KHEAP_PAGEINDEX(prpage)] = NULL;
+		freepageref(pr);
+		return true;
 	}
+	return false;
+}
+
+/*
+ * Get a fresh page for blocks of type BLKTYPE and put it on the
+ * lists. Called with the spinlock held; drops it while getting the
+ * page.
+ */
+static
+struct pageref *
+subpage_newpage(unsigned blktype)
+{
+	struct pageref *pr;	// pageref for the new page
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *volatile fl;	// free list entry
+
+	volatile int i;
 
 	/*
-	 * No page of the right size available.
-	 * Make a new one.
-	 *
 	 * We release the spinlock while calling alloc_kpages. This
 	 * avoids deadlock if alloc_kpages needs to come back here.
 	 * Note that this means things can change behind our back...
@@ -968,6 +1275,7 @@ subpage_kmalloc(size_t sz
 	if (prpage==0) {
 		/* Out of memory. */
 		kprintf("kmalloc: Subpage allocator couldn't get a page\n");
+		spinlock_acquire(&kmalloc_spinlock);
 		return NULL;
 	}
 	KASSERT(prpage % PAGE_SIZE == 0);
@@ -977,12 +1285,16 @@ subpage_kmalloc(size_t sz
 #endif
 	spinlock_acquire(&kmalloc_spinlock);
 
-	pr = allocpageref();
+	pr = NULL;
+	if (KHEAP_PAGEINDEX(prpage) < KHEAP_MAXPAGES) {
+		pr = allocpageref();
+	}
 	if (pr==NULL) {
 		/* Couldn't allocate accounting space for the new page. */
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 		kprintf("kmalloc: Subpage allocator couldn't get pageref\n");
+		spinlock_acquire(&kmalloc_spinlock);
 		return NULL;
 	}
 
@@ -1013,8 +1325,110 @@ subpage_kmalloc(size_t sz
 	pr->next_all = allbase;
 	allbase = pr;
 
-	/* This is kind of cheesy, but avoids duplicating the alloc code. */
-	goto doalloc;
+	pagerefs_bypage[KHEAP_PAGEINDEX(prpage)] = pr;
+
+	return pr;
+}
+
+/*
+ * Allocate a block of size SZ, where SZ is not large enough to
+ * warrant a whole-page allocation.
+ */
+static
+void *
+subpage_kmalloc(size_t sz
+#ifdef LABELS
+		, vaddr_t label
+#endif
+	)
+{
+	unsigned blktype;	// index into sizes[] that we're using
+	struct pageref *pr;	// pageref for page we're allocating from
+	struct kmalloc_mag *mag;	// this cpu's magazine
+	vaddr_t block;		// the block we got
+	void *retptr;		// our result
+	int spl;
+
+#ifdef GUARDS
+	size_t clientsz;
+#endif
+
+#ifdef GUARDS
+	clientsz = sz;
+	sz += GUARD_OVERHEAD;
+#endif
+#ifdef LABELS
+#ifdef GUARDS
+	/* Include the label in what GUARDS considers the client data. */
+	clientsz += LABEL_PTROFFSET;
+#endif
+	sz += LABEL_PTROFFSET;
+#endif
+	blktype = blocktype(sz);
+#ifdef GUARDS
+	sz = sizes[blktype];
+#endif
+
+	/* Try this cpu's magazine first; no lock needed. */
+	block = 0;
+	spl = splhigh();
+	mag = getmag(blktype);
+	if (mag != NULL && mag->km_num > 0) {
+		block = mag->km_blocks[--mag->km_num];
+	}
+	splx(spl);
+
+	if (block == 0) {
+		spinlock_acquire(&kmalloc_spinlock);
+
+		checksubpages();
+
+		for (pr = sizebases[blktype]; pr != NULL;
+		     pr = pr->next_samesize) {
+
+			/* check for corruption */
+			KASSERT(PR_BLOCKTYPE(pr) == blktype);
+			checksubpage(pr);
+
+			if (pr->nfree > 0) {
+				break;
+			}
+		}
+		if (pr == NULL) {
+			/* No page of the right size available. */
+			pr = subpage_newpage(blktype);
+			if (pr == NULL) {
+				spinlock_release(&kmalloc_spinlock);
+				return NULL;
+			}
+		}
+		block = subpage_popblock(pr);
+
+		/* Refill the magazine halfway while we have the lock. */
+		mag = getmag(blktype);
+		while (pr != NULL && mag != NULL &&
+		       mag->km_num < KMALLOC_MAGSIZE / 2) {
+			if (pr->nfree == 0) {
+				pr = pr->next_samesize;
+				continue;
+			}
+			mag->km_blocks[mag->km_num++] = subpage_popblock(pr);
+		}
+
+		checksubpages();
+
+		spinlock_release(&kmalloc_spinlock);
+	}
+
+	retptr = (void *)block;
+#ifdef GUARDS
+	retptr = establishguardband(retptr, clientsz, sz);
+#endif
+#ifdef LABELS
+	retptr = establishlabel(retptr, label);
+	kheap_sitealloc(label, sizes[blktype]);
+#endif
+	return retptr;
 }
 
 /*
@@ -1029,9 +1443,12 @@ subpage_kfree(void *ptr)
 	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
+	struct kmalloc_mag *mag;	// this cpu's magazine
+	vaddr_t block;		// block going back from the magazine
+	vaddr_t dead[KMALLOC_MAGSIZE / 2 + 1];	// pages to give back
+	unsigned ndead, i;
+	int spl;
 #ifdef GUARDS
 	size_t blocksize, smallerblocksize;
 #endif
@@ -1061,33 +1478,18 @@ subpage_kfree(void *ptr)
 	ptraddr -= LABEL_PTROFFSET;
 #endif
 
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
-
-	/* Silence warnings with gcc 4.8 -Og (but not -O2) */
-	prpage = 0;
-	blktype = 0;
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	/*
+	 * No lock needed to look: if PTR is a live block its page
+	 * can't leave the heap under us.
+	 */
+	pr = findpageref(ptraddr);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(blktype >= 0 && blktype < NSIZES);
 
 	offset = ptraddr - prpage;
 
@@ -1101,6 +1503,10 @@ subpage_kfree(void *ptr)
 	smallerblocksize = blktype > 0 ? sizes[blktype - 1] : 0;
 	checkguardband(ptraddr, smallerblocksize, blocksize);
 #endif
+#ifdef LABELS
+	kheap_sitefree(((struct malloclabel *)ptraddr)->label,
+		       sizes[blktype]);
+#endif
 
 	/*
 	 * Clear the block to 0xdeadbeef to make it easier to detect
@@ -1108,46 +1514,40 @@ subpage_kfree(void *ptr)
 	 */
 	fill_deadbeef((void *)ptraddr, sizes[blktype]);
 
-	/*
-	 * We probably ought to check for free twice by seeing if the block
-	 * is already on the free list. But that's expensive, so we don't.
-	 */
+	/* Into this cpu's magazine if there's room. */
+	spl = splhigh();
+	mag = getmag(blktype);
+	if (mag != NULL && mag->km_num < KMALLOC_MAGSIZE) {
+		mag->km_blocks[mag->km_num++] = ptraddr;
+		splx(spl);
+		return 0;
+	}
+	splx(spl);
 
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
-	if (pr->freelist_offset == INVALID_OFFSET) {
-		fl->next = NULL;
-	} else {
-		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+	/* Magazine full (or none): give back the block and half of it. */
+	ndead = 0;
+	spinlock_acquire(&kmalloc_spinlock);
 
-		/* this block should not already be on the free list! */
-#ifdef SLOW
-		{
-			struct freelist *fl2;
+	checksubpages();
 
-			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
-				KASSERT(fl2 != fl);
-			}
+	if (subpage_putblock(pr, ptraddr)) {
+		dead[ndead++] = prpage;
+	}
+	mag = getmag(blktype);
+	while (mag != NULL && mag->km_num > KMALLOC_MAGSIZE / 2) {
+		block = mag->km_blocks[--mag->km_num];
+		if (subpage_putblock(findpageref(block), block)) {
+			dead[ndead++] = block & PAGE_FRAME;
 		}
-#else
-		/* check just the head */
-		KASSERT(fl != fl->next);
-#endif
 	}
-	pr->freelist_offset = offset;
-	pr->nfree++;
 
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
+	checksubpages();
+
+	spinlock_release(&kmalloc_spinlock);
+
+	/* Call free_kpages without kmalloc_spinlock. */
+	for (i=0; i<ndead; i++) {
+		free_kpages(dead[i]);
 	}
 
 #ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
@@ -1194,6 +1594,9 @@ kmalloc(size_t sz)
 			return NULL;
 		}
 		KASSERT(address % PAGE_SIZE == 0);
+#ifdef LABELS
+		kheap_bigalloc(address, label, npages * PAGE_SIZE);
+#endif
 
 		return (void *)address;
 	}
@@ -1218,6 +1621,9 @@ kfree(void *ptr)
 		return;
 	} else if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
+#ifdef LABELS
+		kheap_bigfree((vaddr_t)ptr);
+#endif
 		free_kpages((vaddr_t)ptr);
 	}
 }
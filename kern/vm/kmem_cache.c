@@ -0,0 +1,416 @@
+/*
+ * Slab-based object caches. See kmem_cache.h.
+ *
+ * Each slab is one page obtained from alloc_kpages. The page starts
+ * with a struct kmem_slab followed by a stack of the indices of its
+ * free objects; the objects themselves fill the rest of the page.
+ * Since slabs are page-aligned, the slab owning an object is found by
+ * masking the object's address.
+ *
+ * Free indices are kept outside the objects rather than threaded
+ * through them, because free objects must stay constructed.
+ *
+ * Per-cpu magazines hold up to KMEM_MAGSIZE free objects each and are
+ * only touched by their own cpu with interrupts off. On a miss or
+ * overflow, half a magazine moves to or from the slabs under the
+ * cache's spinlock. Slabs are never created or given back with the
+ * spinlock held, since constructors may sleep.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <kmem_cache.h>
+
+#define KMEM_MAXCPUS	32	/* most cpus System/161 supports */
+#define KMEM_MAGSIZE	8	/* objects per magazine */
+#define KMEM_NAMELEN	24
+#define KMEM_ALIGN	8
+
+struct kmem_slab {
+	struct kmem_slab *ks_next;	/* on kc_slabs */
+	unsigned ks_nfree;		/* entries on ks_free[] */
+	uint16_t ks_free[];		/* indices of free objects */
+};
+
+struct kmem_magazine {
+	unsigned km_num;
+	void *km_objs[KMEM_MAGSIZE];
+};
+
+struct kmem_cache {
+	char kc_name[KMEM_NAMELEN];
+	size_t kc_size;			/* object size, aligned */
+	size_t kc_offset;		/* of object 0 within a slab */
+	unsigned kc_perslab;		/* objects per slab */
+	int (*kc_ctor)(void *);
+	void (*kc_dtor)(void *);
+
+	struct spinlock kc_lock;	/* protects everything below */
+	struct kmem_slab *kc_slabs;
+	unsigned kc_nslabs;
+	unsigned kc_nempty;		/* wholly free slabs */
+	unsigned kc_inuse;		/* objects handed out */
+	unsigned kc_allocs;		/* total allocations... */
+	unsigned kc_maghits;		/* ...served from a magazine */
+
+	struct kmem_cache *kc_next;	/* on kmem_caches */
+
+	struct kmem_magazine kc_mag[KMEM_MAXCPUS];
+};
+
+static struct spinlock kmem_caches_lock = SPINLOCK_INITIALIZER;
+static struct kmem_cache *kmem_caches;
+
+/*
+ * Return the current cpu's magazine, or NULL if there is none (early
+ * in boot). Interrupts must be off.
+ */
+static
+struct kmem_magazine *
+kmem_getmag(struct kmem_cache *kc)
+{
+	if (!CURCPU_EXISTS() || curcpu->c_number >= KMEM_MAXCPUS) {
+		return NULL;
+	}
+	return &kc->kc_mag[curcpu->c_number];
+}
+
+static
+void *
+kmem_slab_obj(struct kmem_cache *kc, struct kmem_slab *ks, unsigned ix)
+{
+	return (char *)ks + kc->kc_offset + ix * kc->kc_size;
+}
+
+/*
+ * Find the slab holding OBJ and OBJ's index within it.
+ */
+static
+struct kmem_slab *
+kmem_slab_find(struct kmem_cache *kc, void *obj, unsigned *ix)
+{
+	struct kmem_slab *ks;
+
+	ks = (struct kmem_slab *)((vaddr_t)obj & PAGE_FRAME);
+	*ix = ((char *)obj - (char *)ks - kc->kc_offset) / kc->kc_size;
+	KASSERT(*ix < kc->kc_perslab);
+	KASSERT(kmem_slab_obj(kc, ks, *ix) == obj);
+	return ks;
+}
+
+/*
+ * Run the destructor over every object of KS and release the page.
+ */
+static
+void
+kmem_slab_release(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	unsigned i;
+
+	if (kc->kc_dtor != NULL) {
+		for (i=0; i<kc->kc_perslab; i++) {
+			kc->kc_dtor(kmem_slab_obj(kc, ks, i));
+		}
+	}
+	free_kpages((vaddr_t)ks);
+}
+
+/*
+ * Make a new slab with all objects constructed.
+ */
+static
+struct kmem_slab *
+kmem_slab_create(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	vaddr_t page;
+	unsigned i, j;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return NULL;
+	}
+	ks = (struct kmem_slab *)page;
+	ks->ks_next = NULL;
+	ks->ks_nfree = kc->kc_perslab;
+	for (i=0; i<kc->kc_perslab; i++) {
+		/* hand out low addresses first */
+		ks->ks_free[i] = kc->kc_perslab - 1 - i;
+	}
+	if (kc->kc_ctor != NULL) {
+		for (i=0; i<kc->kc_perslab; i++) {
+			if (kc->kc_ctor(kmem_slab_obj(kc, ks, i))) {
+				for (j=0; j<i; j++) {
+					kc->kc_dtor(kmem_slab_obj(kc, ks, j));
+				}
+				free_kpages(page);
+				return NULL;
+			}
+		}
+	}
+	return ks;
+}
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+	size_t hdr;
+	unsigned n, i;
+
+	KASSERT(size > 0 && size <= PAGE_SIZE / 4);
+	KASSERT((ctor == NULL) == (dtor == NULL));
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	snprintf(kc->kc_name, sizeof(kc->kc_name), "%s", name);
+	kc->kc_size = ROUNDUP(size, KMEM_ALIGN);
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+
+	/* Fit as many objects as we can after the header. */
+	n = PAGE_SIZE / kc->kc_size;
+	while (1) {
+		hdr = sizeof(struct kmem_slab) + n * sizeof(uint16_t);
+		hdr = ROUNDUP(hdr, KMEM_ALIGN);
+		if (hdr + n * kc->kc_size <= PAGE_SIZE) {
+			break;
+		}
+		n--;
+	}
+	KASSERT(n > 0);
+	kc->kc_perslab = n;
+	kc->kc_offset = hdr;
+
+	spinlock_init(&kc->kc_lock);
+	kc->kc_slabs = NULL;
+	kc->kc_nslabs = 0;
+	kc->kc_nempty = 0;
+	kc->kc_inuse = 0;
+	kc->kc_allocs = 0;
+	kc->kc_maghits = 0;
+	for (i=0; i<KMEM_MAXCPUS; i++) {
+		kc->kc_mag[i].km_num = 0;
+	}
+
+	spinlock_acquire(&kmem_caches_lock);
+	kc->kc_next = kmem_caches;
+	kmem_caches = kc;
+	spinlock_release(&kmem_caches_lock);
+
+	return kc;
+}
+
+/*
+ * Take a free object from some slab. Caller holds kc_lock. Returns
+ * NULL if every slab is full.
+ */
+static
+void *
+kmem_slab_get(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+
+	for (ks = kc->kc_slabs; ks != NULL; ks = ks->ks_next) {
+		if (ks->ks_nfree > 0) {
+			if (ks->ks_nfree == kc->kc_perslab) {
+				kc->kc_nempty--;
+			}
+			ks->ks_nfree--;
+			return kmem_slab_obj(kc, ks, ks->ks_free[ks->ks_nfree]);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Give OBJ back to its slab. Caller holds kc_lock. If that leaves a
+ * second wholly free slab, unlink it and return it so the caller can
+ * release it once the lock is dropped.
+ */
+static
+struct kmem_slab *
+kmem_slab_put(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_slab *ks, **ksp;
+	unsigned ix;
+
+	ks = kmem_slab_find(kc, obj, &ix);
+	KASSERT(ks->ks_nfree < kc->kc_perslab);
+
+	ks->ks_free[ks->ks_nfree++] = ix;
+	if (ks->ks_nfree < kc->kc_perslab) {
+		return NULL;
+	}
+	if (kc->kc_nempty == 0) {
+		/* keep one empty slab around */
+		kc->kc_nempty++;
+		return NULL;
+	}
+	for (ksp = &kc->kc_slabs; *ksp != ks; ksp = &(*ksp)->ks_next) {
+		KASSERT(*ksp != NULL);
+	}
+	*ksp = ks->ks_next;
+	kc->kc_nslabs--;
+	return ks;
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_magazine *mag;
+	struct kmem_slab *ks;
+	void *obj;
+	int spl;
+
+	spl = splhigh();
+	mag = kmem_getmag(kc);
+	if (mag != NULL && mag->km_num > 0) {
+		obj = mag->km_objs[--mag->km_num];
+		splx(spl);
+		/* stats: unlocked, may lose the odd count */
+		kc->kc_allocs++;
+		kc->kc_maghits++;
+		return obj;
+	}
+	splx(spl);
+
+	while (1) {
+		spinlock_acquire(&kc->kc_lock);
+		obj = kmem_slab_get(kc);
+		if (obj != NULL) {
+			kc->kc_inuse++;
+			kc->kc_allocs++;
+			/* Refill our magazine while we're here. */
+			mag = kmem_getmag(kc);
+			while (mag != NULL && mag->km_num < KMEM_MAGSIZE / 2) {
+				void *extra = kmem_slab_get(kc);
+				if (extra == NULL) {
+					break;
+				}
+				kc->kc_inuse++;
+				mag->km_objs[mag->km_num++] = extra;
+			}
+			spinlock_release(&kc->kc_lock);
+			return obj;
+		}
+		spinlock_release(&kc->kc_lock);
+
+		ks = kmem_slab_create(kc);
+		if (ks == NULL) {
+			return NULL;
+		}
+		spinlock_acquire(&kc->kc_lock);
+		ks->ks_next = kc->kc_slabs;
+		kc->kc_slabs = ks;
+		kc->kc_nslabs++;
+		kc->kc_nempty++;
+		spinlock_release(&kc->kc_lock);
+	}
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_magazine *mag;
+	struct kmem_slab *ks, *dead[KMEM_MAGSIZE / 2 + 1];
+	unsigned ndead, i;
+	int spl;
+
+	KASSERT(obj != NULL);
+
+	spl = splhigh();
+	mag = kmem_getmag(kc);
+	if (mag != NULL && mag->km_num < KMEM_MAGSIZE) {
+		mag->km_objs[mag->km_num++] = obj;
+		splx(spl);
+		return;
+	}
+	splx(spl);
+
+	/* Magazine full (or none): return OBJ and half the magazine. */
+	ndead = 0;
+	spinlock_acquire(&kc->kc_lock);
+	ks = kmem_slab_put(kc, obj);
+	kc->kc_inuse--;
+	if (ks != NULL) {
+		dead[ndead++] = ks;
+	}
+	mag = kmem_getmag(kc);
+	while (mag != NULL && mag->km_num > KMEM_MAGSIZE / 2) {
+		ks = kmem_slab_put(kc, mag->km_objs[--mag->km_num]);
+		kc->kc_inuse--;
+		if (ks != NULL) {
+			dead[ndead++] = ks;
+		}
+	}
+	spinlock_release(&kc->kc_lock);
+
+	for (i=0; i<ndead; i++) {
+		kmem_slab_release(kc, dead[i]);
+	}
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **kcp;
+	struct kmem_magazine *mag;
+	struct kmem_slab *ks;
+	unsigned i, ix;
+
+	spinlock_acquire(&kmem_caches_lock);
+	for (kcp = &kmem_caches; *kcp != kc; kcp = &(*kcp)->kc_next) {
+		KASSERT(*kcp != NULL);
+	}
+	*kcp = kc->kc_next;
+	spinlock_release(&kmem_caches_lock);
+
+	/* Nobody is using the cache, so the magazines are quiescent. */
+	spinlock_acquire(&kc->kc_lock);
+	for (i=0; i<KMEM_MAXCPUS; i++) {
+		mag = &kc->kc_mag[i];
+		while (mag->km_num > 0) {
+			ks = kmem_slab_find(kc, mag->km_objs[--mag->km_num],
+					    &ix);
+			ks->ks_free[ks->ks_nfree++] = ix;
+			kc->kc_inuse--;
+		}
+	}
+	KASSERT(kc->kc_inuse == 0);
+	spinlock_release(&kc->kc_lock);
+
+	while (kc->kc_slabs != NULL) {
+		ks = kc->kc_slabs;
+		kc->kc_slabs = ks->ks_next;
+		KASSERT(ks->ks_nfree == kc->kc_perslab);
+		kmem_slab_release(kc, ks);
+	}
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc);
+}
+
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+
+	spinlock_acquire(&kmem_caches_lock);
+	for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+		kprintf("kmem_cache %s: %u bytes, %u/slab, %u slabs, "
+			"%u in use, %u allocs (%u from magazines)\n",
+			kc->kc_name, (unsigned)kc->kc_size, kc->kc_perslab,
+			kc->kc_nslabs, kc->kc_inuse, kc->kc_allocs,
+			kc->kc_maghits);
+	}
+	spinlock_release(&kmem_caches_lock);
+}
@@ -0,0 +1,206 @@
+/*
+ * The pageout thread. See pageout.h.
+ *
+ * Pages are freed a cluster at a time (swap_evictcluster), each in a
+ * separate trip through vm_lock, so that faults can get in between.
+ * The lock is only held while the pages are copied out; the write to
+ * swap goes on behind the thread's back, and it only waits for one
+ * when every cluster buffer is still being written, and then without
+ * the lock.
+ *
+ * Between the watermarks and pageout_scanwater, the thread wakes once
+ * a tick and moves the clock's front hand along (see coremap.c), at
+ * a rate that goes up from pageout_fastscan / PAGEOUT_SLOWDIV pages a
+ * tick as free memory falls to pageout_fastscan as it runs out. With
+ * plenty free, nobody pays for finding out which pages are in use;
+ * as memory runs short, the references are sampled more and more
+ * often, so that when it comes to evicting the clock picks pages
+ * that really have gone unused.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <clock.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <filecache.h>
+#include <pageout.h>
+#include <sfs.h>
+#include "opt-sfs.h"
+
+/* The slowest scan is this fraction of the fastest */
+#define PAGEOUT_SLOWDIV	16
+
+unsigned pageout_lowater;
+unsigned pageout_hiwater;
+unsigned pageout_scanwater;
+unsigned pageout_fastscan;
+
+static struct spinlock pageout_lock = SPINLOCK_INITIALIZER;
+static bool pageout_wanted;		/* thread has been woken */
+static struct semaphore *pageout_sem;
+
+static unsigned pageout_wakeups;	/* times woken */
+static unsigned pageout_dropped;	/* file cache pages dropped */
+static unsigned pageout_evicted;	/* user pages paged out */
+static unsigned pageout_clusters;	/* swap writes they took */
+static unsigned pageout_scanned;	/* pages aged between evictions */
+
+/*
+ * Free some memory: an unused file cache page if there is one, else
+ * a cluster of user pages sent to swap. Returns false if nothing
+ * could be freed.
+ */
+static
+bool
+pageout_one(void)
+{
+	unsigned n;
+
+	lock_acquire(vm_lock);
+	if (filecache_reclaim()) {
+		lock_release(vm_lock);
+		pageout_dropped++;
+		return true;
+	}
+	lock_release(vm_lock);
+
+	swap_waitcluster();
+	lock_acquire(vm_lock);
+	n = swap_evictcluster();
+	lock_release(vm_lock);
+	if (n == 0) {
+		return false;
+	}
+	pageout_evicted += n;
+	pageout_clusters++;
+	return true;
+}
+
+/*
+ * Age the pages for one tick, at the rate NFREE pages free calls for.
+ */
+static
+void
+pageout_scan(unsigned nfree)
+{
+	unsigned slow, npages;
+
+	slow = pageout_fastscan / PAGEOUT_SLOWDIV;
+	if (slow == 0) {
+		slow = 1;
+	}
+	npages = slow;
+	if (pageout_fastscan > slow && nfree < pageout_scanwater) {
+		npages += (pageout_fastscan - slow) *
+			(pageout_scanwater - nfree) / pageout_scanwater;
+	}
+
+	lock_acquire(vm_lock);
+	swap_age(npages);
+	lock_release(vm_lock);
+	pageout_scanned += npages;
+}
+
+static
+void
+pageout_thread(void *unused1, unsigned long unused2)
+{
+	unsigned nfree;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		P(pageout_sem);
+		pageout_wakeups++;
+
+		while (1) {
+			nfree = coremap_numfree();
+			if (nfree < pageout_lowater) {
+#if OPT_SFS
+				/* Closed files needn't stay in memory */
+				sfs_vncache_shrink();
+#endif
+				/* Free up to the high watermark */
+				while (coremap_numfree() < pageout_hiwater) {
+					if (!pageout_one()) {
+						break;
+					}
+				}
+				if (coremap_numfree() < pageout_lowater) {
+					/* Nothing more to free */
+					break;
+				}
+				continue;
+			}
+			if (nfree >= pageout_scanwater) {
+				break;
+			}
+			pageout_scan(nfree);
+			clocksleep_ticks(1);
+		}
+
+		spinlock_acquire(&pageout_lock);
+		pageout_wanted = false;
+		spinlock_release(&pageout_lock);
+	}
+}
+
+void
+pageout_kick(void)
+{
+	bool wake;
+
+	if (pageout_sem == NULL || pageout_lowater == 0 ||
+	    coremap_numfree() >= pageout_scanwater) {
+		return;
+	}
+	spinlock_acquire(&pageout_lock);
+	wake = !pageout_wanted;
+	pageout_wanted = true;
+	spinlock_release(&pageout_lock);
+	if (wake) {
+		V(pageout_sem);
+	}
+}
+
+void
+pageout_bootstrap(void)
+{
+	int result;
+
+	pageout_lowater = coremap_numpages() / 32;
+	pageout_hiwater = coremap_numpages() / 16;
+	pageout_scanwater = coremap_numpages() / 8;
+	pageout_fastscan = coremap_numpages() / 8;
+
+	pageout_sem = sem_create("pageout", 0);
+	if (pageout_sem == NULL) {
+		panic("pageout: cannot create semaphore\n");
+	}
+	result = thread_fork("pageout", NULL, pageout_thread, NULL, 0);
+	if (result) {
+		/* Not fatal; faults just reclaim for themselves. */
+		kprintf("pageout: cannot start thread: %s\n",
+			strerror(result));
+		sem_destroy(pageout_sem);
+		pageout_sem = NULL;
+	}
+}
+
+void
+pageout_printstats(void)
+{
+	kprintf("pageout: low %u, high %u, scan %u pages; %u wakeups, "
+		"%u file pages dropped, %u pages evicted in %u writes\n",
+		pageout_lowater, pageout_hiwater, pageout_scanwater,
+		pageout_wakeups, pageout_dropped, pageout_evicted,
+		pageout_clusters);
+	kprintf("pageout: fastest scan %u pages/tick, hand spread %u pages, "
+		"%u pages scanned\n", pageout_fastscan,
+		coremap_gethandspread(), pageout_scanned);
+}
@@ -0,0 +1,565 @@
+/*
+ * Two-level page tables. See pagetable.h for the layout.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+#include <filecache.h>
+#include <pageout.h>
+#include <vmstat.h>
+#include <parallel.h>
+
+/*
+ * pt_copy spreads the copying over the cpus for address spaces with
+ * at least PT_COPY_PARALLEL second-level tables (4M each), in chunks
+ * of PT_COPY_CHUNK tables.
+ */
+#define PT_COPY_PARALLEL	4
+#define PT_COPY_CHUNK		2
+
+struct pagetable *
+pt_create(struct addrspace *as)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(*pt));
+	if (pt == NULL) {
+		return NULL;
+	}
+	pt->pt_as = as;
+	pt->pt_nresident = 0;
+	/* The first level and the counts */
+	pt->pt_npages = DIVROUNDUP(sizeof(*pt), PAGE_SIZE);
+	pt->pt_nlocked = 0;
+	for (i=0; i<PT_NENTRIES; i++) {
+		pt->pt_l2[i] = NULL;
+		pt->pt_l2count[i] = 0;
+	}
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i, j;
+	pte_t *l2;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	for (i=0; i<PT_NENTRIES; i++) {
+		l2 = pt->pt_l2[i];
+		if (l2 == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_NENTRIES; j++) {
+			if (l2[j] & PTE_PRESENT) {
+				if (l2[j] & PTE_LOCKED) {
+					coremap_unpin(l2[j] & PTE_FRAME);
+				}
+				coremap_disown(l2[j] & PTE_FRAME, pt);
+				coremap_freepages(l2[j] & PTE_FRAME);
+			}
+			else if (l2[j] & PTE_SWAPPED) {
+				swap_free(PTE_SLOT(l2[j]));
+			}
+		}
+		kfree(l2);
+	}
+	kfree(pt);
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+	pte_t *l2;
+	unsigned i;
+
+	l2 = pt->pt_l2[PT_L1INDEX(vaddr)];
+	if (l2 == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		l2 = kmalloc(PT_NENTRIES * sizeof(pte_t));
+		if (l2 == NULL) {
+			return NULL;
+		}
+		for (i=0; i<PT_NENTRIES; i++) {
+			l2[i] = 0;
+		}
+		pt->pt_l2[PT_L1INDEX(vaddr)] = l2;
+		pt->pt_l2count[PT_L1INDEX(vaddr)] = 0;
+		pt->pt_npages++;
+	}
+	return &l2[PT_L2INDEX(vaddr)];
+}
+
+/*
+ * Get a frame to hold the user page VADDR of PT, dropping an unused
+ * file page or paging something else out if memory is full. With
+ * ZERO, the frame comes cleared (from the zeroer's pool if it can);
+ * otherwise the contents are undefined.
+ *
+ * Returns 0 only when there is nothing left to page out either; the
+ * fault handler then goes to the OOM killer.
+ */
+static
+paddr_t
+pt_allocframe(struct pagetable *pt, vaddr_t vaddr, bool zero)
+{
+	paddr_t pa;
+
+	pageout_kick();
+	pa = zero ? coremap_getzeroed() : coremap_getpages(1);
+	if (pa == 0 && filecache_reclaim()) {
+		pa = zero ? coremap_getzeroed() : coremap_getpages(1);
+	}
+	if (pa == 0) {
+		pa = swap_evict();
+		if (pa == 0) {
+			return 0;
+		}
+		if (zero) {
+			bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+		}
+	}
+	coremap_setowner(pa, pt, vaddr);
+	return pa;
+}
+
+/*
+ * Bring the swapped-out page at PTE back in.
+ *
+ * Pages that went out in the same cluster as this one are in the
+ * slots that follow, if they haven't come back since; while memory
+ * isn't short, read them in with it, in the same request. They are
+ * marked unreferenced, so if they turn out not to be wanted the
+ * clock takes them back first.
+ */
+static
+int
+pt_swapin(struct pagetable *pt, vaddr_t vaddr, pte_t *pte)
+{
+	paddr_t pa[SWAP_CLUSTER];
+	pte_t *ptes[SWAP_CLUSTER];
+	unsigned slot, n, i;
+	vaddr_t va;
+	int result;
+
+	KASSERT(*pte & PTE_SWAPPED);
+
+	pa[0] = pt_allocframe(pt, vaddr, false);
+	if (pa[0] == 0) {
+		return ENOMEM;
+	}
+	ptes[0] = pte;
+	slot = PTE_SLOT(*pte);
+
+	for (n=1; n<SWAP_CLUSTER; n++) {
+		if (coremap_numfree() <= pageout_hiwater) {
+			break;
+		}
+		va = vaddr + n * PAGE_SIZE;
+		ptes[n] = pt_lookup(pt, va, false);
+		if (ptes[n] == NULL || (*ptes[n] & PTE_SWAPPED) == 0 ||
+		    PTE_SLOT(*ptes[n]) != slot + n) {
+			break;
+		}
+		pa[n] = coremap_getpages(1);
+		if (pa[n] == 0) {
+			break;
+		}
+		coremap_setowner(pa[n], pt, va);
+	}
+
+	result = swap_pagein(slot, pa, n);
+	if (result) {
+		for (i=0; i<n; i++) {
+			coremap_freepages(pa[i]);
+		}
+		return result;
+	}
+	for (i=0; i<n; i++) {
+		*ptes[i] = pa[i] | PTE_PRESENT;
+		pt->pt_nresident++;
+		vmstat_count(VMS_PAGEIN);
+		if (i > 0) {
+			coremap_untouch(pa[i]);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Give PTE a private copy of its frame.
+ */
+static
+int
+pt_cowbreak(struct pagetable *pt, vaddr_t vaddr, pte_t *pte)
+{
+	paddr_t oldpa, pa;
+	pte_t locked;
+
+	oldpa = *pte & PTE_FRAME;
+	locked = *pte & PTE_LOCKED;
+
+	/*
+	 * If we hold the only reference, nobody else can gain one
+	 * behind our back (that would take a fork of this address
+	 * space, which needs the lock we hold), so just take it over.
+	 */
+	if (coremap_refcount(oldpa) == 1) {
+		*pte &= ~(pte_t)PTE_COW;
+		coremap_setowner(oldpa, pt, vaddr);
+		return 0;
+	}
+
+	pa = pt_allocframe(pt, vaddr, false);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+	memmove((void *)PADDR_TO_KVADDR(pa),
+		(const void *)PADDR_TO_KVADDR(oldpa), PAGE_SIZE);
+	*pte = pa | PTE_PRESENT | locked;
+	/* Other CPUs may still map the shared frame for us. */
+	vmtlb_shootdown(pt->pt_as, vaddr);
+	if (locked) {
+		/* The pin goes with the lock */
+		coremap_pin(pa);
+		coremap_unpin(oldpa);
+	}
+	coremap_disown(oldpa, pt);
+	coremap_freepages(oldpa);
+	vmstat_count(VMS_COW);
+	return 0;
+}
+
+int
+pt_getpage(struct pagetable *pt, vaddr_t vaddr, bool write, pte_t *ret)
+{
+	pte_t *pte;
+	paddr_t pa;
+	int result;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	pte = pt_lookup(pt, vaddr, true);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+	if (*pte & PTE_SWAPPED) {
+		result = pt_swapin(pt, vaddr, pte);
+		if (result) {
+			return result;
+		}
+	}
+	else if ((*pte & PTE_PRESENT) == 0) {
+		pa = pt_allocframe(pt, vaddr, true);
+		if (pa == 0) {
+			return ENOMEM;
+		}
+		*pte = pa | PTE_PRESENT;
+		PT_FILLED(pt, vaddr);
+		pt->pt_nresident++;
+		vmstat_count(VMS_ZEROFILL);
+	}
+	else if (*pte & PTE_COW) {
+		/*
+		 * Break sharing on writes; on reads, only if no one
+		 * else is left sharing, which costs nothing and makes
+		 * the page evictable again.
+		 */
+		if (write || coremap_refcount(*pte & PTE_FRAME) == 1) {
+			result = pt_cowbreak(pt, vaddr, pte);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	else {
+		/*
+		 * Resident and yet not in the TLB: the clock may have
+		 * taken its entry away to see if it was still in use.
+		 */
+		coremap_touch(*pte & PTE_FRAME);
+	}
+	*ret = *pte;
+	return 0;
+}
+
+/*
+ * Share the resident page at OLDPTE with NEWPTE: copy-on-write, unless
+ * it's a PTE_SHARED page.
+ */
+static
+void
+pt_share(pte_t *oldpte, pte_t *newpte)
+{
+	coremap_incref(*oldpte & PTE_FRAME);
+	if (*oldpte & PTE_SHARED) {
+		/* The child hasn't written it (yet) */
+		*newpte = *oldpte &
+			~(pte_t)(PTE_DIRTY | PTE_LOCKED | PTE_WRITABLE);
+		return;
+	}
+	*oldpte = (*oldpte | PTE_COW) & ~(pte_t)PTE_WRITABLE;
+	*newpte = *oldpte;
+}
+
+/* Whether pt_share can do the entry OLDPTE */
+#define PT_SHAREABLE(oldpte) \
+	(((oldpte) & (PTE_PRESENT | PTE_SWAPPED)) == PTE_PRESENT && \
+	 ((oldpte) & (PTE_LOCKED | PTE_SHARED)) != PTE_LOCKED)
+
+/*
+ * Copy OLD's entry for VA, whose second-level table is OLDL2, into
+ * NEW, the slow way: this may allocate, and so page things out.
+ */
+static
+int
+pt_copyentry(struct pagetable *old, struct pagetable *new, pte_t *oldl2,
+	     vaddr_t va)
+{
+	unsigned j = PT_L2INDEX(va);
+	pte_t *newpte;
+	paddr_t pa;
+	int result;
+
+	/*
+	 * Allocate the new table entry first: doing so may page out
+	 * the very page we are looking at.
+	 */
+	newpte = pt_lookup(new, va, true);
+	if (newpte == NULL) {
+		return ENOMEM;
+	}
+	/* Swap slots aren't shared; bring the page in. */
+	if (oldl2[j] & PTE_SWAPPED) {
+		result = pt_swapin(old, va, &oldl2[j]);
+		if (result) {
+			return result;
+		}
+	}
+	if ((oldl2[j] & (PTE_LOCKED | PTE_SHARED)) == PTE_LOCKED) {
+		/*
+		 * Sharing it would make the parent's next write fault;
+		 * the child gets a copy now.
+		 */
+		pa = pt_allocframe(new, va, false);
+		if (pa == 0) {
+			return ENOMEM;
+		}
+		memmove((void *)PADDR_TO_KVADDR(pa),
+			(const void *)PADDR_TO_KVADDR(oldl2[j] & PTE_FRAME),
+			PAGE_SIZE);
+		*newpte = pa | PTE_PRESENT;
+		PT_FILLED(new, va);
+		new->pt_nresident++;
+		return 0;
+	}
+	pt_share(&oldl2[j], newpte);
+	PT_FILLED(new, va);
+	new->pt_nresident++;
+	return 0;
+}
+
+struct pt_copyargs {
+	struct pagetable *pc_old;
+	struct pagetable *pc_new;
+};
+
+/*
+ * parallel_for function for pt_copy: share the plain resident pages
+ * of the second-level tables START to END-1, which already exist in
+ * the new table. This neither allocates nor sleeps.
+ */
+static
+void
+pt_copyshared(void *arg, unsigned start, unsigned end)
+{
+	struct pt_copyargs *pc = arg;
+	pte_t *oldl2, *newl2;
+	unsigned i, j;
+
+	for (i=start; i<end; i++) {
+		oldl2 = pc->pc_old->pt_l2[i];
+		newl2 = pc->pc_new->pt_l2[i];
+		if (oldl2 == NULL) {
+			continue;
+		}
+		KASSERT(newl2 != NULL);
+		for (j=0; j<PT_NENTRIES; j++) {
+			if (newl2[j] == 0 && PT_SHAREABLE(oldl2[j])) {
+				pt_share(&oldl2[j], &newl2[j]);
+				pc->pc_new->pt_l2count[i]++;
+			}
+		}
+	}
+}
+
+/*
+ * Copying a big address space goes in three passes. The first, here,
+ * makes every second-level table NEW will need and deals with the
+ * entries that need memory: swapped-out pages and locked ones. The
+ * second shares all the rest, which is just bookkeeping and so can be
+ * spread over the cpus, with vm_lock (held by the caller) keeping
+ * everyone else off both tables. The first pass may have paged out
+ * some of the pages it went past, so the third, here again, copies
+ * whatever the second had to leave.
+ */
+int
+pt_copy(struct pagetable *old, struct pagetable *new)
+{
+	struct pt_copyargs pc;
+	unsigned i, j, ntables;
+	pte_t *oldl2;
+	vaddr_t va;
+	int result;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	ntables = 0;
+	for (i=0; i<PT_NENTRIES; i++) {
+		if (old->pt_l2[i] != NULL) {
+			ntables++;
+		}
+	}
+
+	for (i=0; i<PT_NENTRIES; i++) {
+		oldl2 = old->pt_l2[i];
+		if (oldl2 == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_NENTRIES; j++) {
+			if ((oldl2[j] & (PTE_PRESENT | PTE_SWAPPED)) == 0) {
+				continue;
+			}
+			if (ntables >= PT_COPY_PARALLEL &&
+			    PT_SHAREABLE(oldl2[j])) {
+				/* Make the table; the second pass shares */
+				va = ((vaddr_t)i << 22) | ((vaddr_t)j << 12);
+				if (pt_lookup(new, va, true) == NULL) {
+					return ENOMEM;
+				}
+				continue;
+			}
+			va = ((vaddr_t)i << 22) | ((vaddr_t)j << 12);
+			result = pt_copyentry(old, new, oldl2, va);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	if (ntables < PT_COPY_PARALLEL) {
+		return 0;
+	}
+
+	pc.pc_old = old;
+	pc.pc_new = new;
+	parallel_for(PT_NENTRIES, PT_COPY_CHUNK, pt_copyshared, &pc);
+	/* Everything in a fresh copy is resident */
+	new->pt_nresident = 0;
+	for (i=0; i<PT_NENTRIES; i++) {
+		new->pt_nresident += new->pt_l2count[i];
+	}
+
+	for (i=0; i<PT_NENTRIES; i++) {
+		oldl2 = old->pt_l2[i];
+		if (oldl2 == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_NENTRIES; j++) {
+			if ((oldl2[j] & (PTE_PRESENT | PTE_SWAPPED)) == 0 ||
+			    new->pt_l2[i][j] != 0) {
+				continue;
+			}
+			va = ((vaddr_t)i << 22) | ((vaddr_t)j << 12);
+			result = pt_copyentry(old, new, oldl2, va);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	return 0;
+}
+
+void
+pt_unmap(struct pagetable *pt, vaddr_t vaddr, unsigned npages)
+{
+	pte_t *pte;
+	unsigned i, l1;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	for (i=0; i<npages; i++, vaddr += PAGE_SIZE) {
+		pte = pt_lookup(pt, vaddr, false);
+		if (pte == NULL || *pte == 0) {
+			continue;
+		}
+		if (*pte & PTE_PRESENT) {
+			if (*pte & PTE_LOCKED) {
+				coremap_unpin(*pte & PTE_FRAME);
+				pt->pt_nlocked--;
+			}
+			coremap_disown(*pte & PTE_FRAME, pt);
+			coremap_freepages(*pte & PTE_FRAME);
+			KASSERT(pt->pt_nresident > 0);
+			pt->pt_nresident--;
+		}
+		else if (*pte & PTE_SWAPPED) {
+			swap_free(PTE_SLOT(*pte));
+		}
+		*pte = 0;
+
+		l1 = PT_L1INDEX(vaddr);
+		KASSERT(pt->pt_l2count[l1] > 0);
+		if (--pt->pt_l2count[l1] == 0) {
+			kfree(pt->pt_l2[l1]);
+			pt->pt_l2[l1] = NULL;
+			pt->pt_npages--;
+		}
+	}
+}
+
+void
+pt_lock(struct pagetable *pt, vaddr_t vaddr)
+{
+	pte_t *pte;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	pte = pt_lookup(pt, vaddr, false);
+	if (pte == NULL || (*pte & PTE_PRESENT) == 0 ||
+	    (*pte & PTE_LOCKED) != 0) {
+		return;
+	}
+	coremap_pin(*pte & PTE_FRAME);
+	*pte |= PTE_LOCKED;
+	pt->pt_nlocked++;
+}
+
+void
+pt_unlock(struct pagetable *pt, vaddr_t vaddr, unsigned npages)
+{
+	pte_t *pte;
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	for (i=0; i<npages; i++, vaddr += PAGE_SIZE) {
+		pte = pt_lookup(pt, vaddr, false);
+		if (pte == NULL || (*pte & PTE_LOCKED) == 0) {
+			continue;
+		}
+		coremap_unpin(*pte & PTE_FRAME);
+		*pte &= ~(pte_t)PTE_LOCKED;
+		KASSERT(pt->pt_nlocked > 0);
+		pt->pt_nlocked--;
+	}
+}
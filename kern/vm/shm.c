@@ -0,0 +1,101 @@
+/*
+ * Anonymous shared memory segments. See shm.h.
+ *
+ * Everything about a segment, its reference count included, is
+ * covered by vm_lock, since its frames are found and mapped by
+ * vm_fault, which holds that anyway.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <filecache.h>
+#include <shm.h>
+
+struct shm_segment {
+	unsigned ss_refcount;
+	unsigned ss_npages;
+	paddr_t ss_frames[];		/* 0 until first touched */
+};
+
+struct shm_segment *
+shm_create(unsigned npages)
+{
+	struct shm_segment *seg;
+	unsigned i;
+
+	seg = kmalloc(sizeof(*seg) + npages * sizeof(paddr_t));
+	if (seg == NULL) {
+		return NULL;
+	}
+	seg->ss_refcount = 1;
+	seg->ss_npages = npages;
+	for (i=0; i<npages; i++) {
+		seg->ss_frames[i] = 0;
+	}
+	return seg;
+}
+
+void
+shm_incref(struct shm_segment *seg)
+{
+	lock_acquire(vm_lock);
+	KASSERT(seg->ss_refcount > 0);
+	seg->ss_refcount++;
+	lock_release(vm_lock);
+}
+
+void
+shm_close(struct shm_segment *seg)
+{
+	unsigned i;
+
+	lock_acquire(vm_lock);
+	KASSERT(seg->ss_refcount > 0);
+	seg->ss_refcount--;
+	if (seg->ss_refcount > 0) {
+		lock_release(vm_lock);
+		return;
+	}
+	/* Page tables that still map a frame keep it until they're done */
+	for (i=0; i<seg->ss_npages; i++) {
+		if (seg->ss_frames[i] != 0) {
+			coremap_freepages(seg->ss_frames[i]);
+		}
+	}
+	lock_release(vm_lock);
+	kfree(seg);
+}
+
+int
+shm_getpage(struct shm_segment *seg, unsigned pageno, paddr_t *ret)
+{
+	paddr_t pa;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+	KASSERT(pageno < seg->ss_npages);
+
+	pa = seg->ss_frames[pageno];
+	if (pa == 0) {
+		/* As pt_allocframe, but nobody owns it */
+		pa = coremap_getzeroed();
+		if (pa == 0 && filecache_reclaim()) {
+			pa = coremap_getzeroed();
+		}
+		if (pa == 0) {
+			pa = swap_evict();
+			if (pa == 0) {
+				return ENOMEM;
+			}
+			bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+		}
+		seg->ss_frames[pageno] = pa;
+	}
+	coremap_incref(pa);
+	*ret = pa;
+	return 0;
+}
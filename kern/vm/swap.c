@@ -0,0 +1,574 @@
+/*
+ * Swap space management and page-out. See swap.h.
+ *
+ * The pageout thread sends pages out in clusters: it takes up to
+ * SWAP_CLUSTER pages, the clock's victim and the unused pages after
+ * it in the same address space, gives them a run of slots, copies
+ * them into one of SWAP_NCLUSTERS cluster buffers, and frees their
+ * frames at once. The buffer then goes to the disk as one request,
+ * through the device's strategy routine, and the thread carries on
+ * (and vm_lock is free) while it is being written. A page whose slot
+ * is still being written is read back from the buffer; a slot that is
+ * freed meanwhile is only released once the write is over (by
+ * swap_reap), so that no other write can go to it at the same time.
+ * If a cluster write fails, its buffer stays where it is, still
+ * standing in for the slots, until every page in it has been read
+ * back or thrown away.
+ *
+ * Because the pages of a cluster are neighbours in an address space
+ * and in swap, a fault that reads one back reads the next few with
+ * it, in the same request (see pt_swapin).
+ *
+ * Faults that find memory empty still page out one page at a time,
+ * synchronously, with swap_evict.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <synch.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <device.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+#include <vmstat.h>
+
+/* Cluster buffers; while one is being written, the next is filled */
+#define SWAP_NCLUSTERS	2
+
+struct swap_cluster {
+	struct devreq sc_req;		/* the write */
+	char *sc_buf;			/* SWAP_CLUSTER pages */
+	unsigned sc_slot;		/* first slot */
+	unsigned sc_npages;		/* pages in it; 0 if idle */
+	bool sc_done;			/* write finished (swap_donelock) */
+	bool sc_failed;			/* ... and failed */
+	bool sc_dropped[SWAP_CLUSTER];	/* slot no longer used */
+};
+
+static struct vnode *swap_vnode;
+static struct device *swap_dev;
+static struct bitmap *swap_map;
+static unsigned swap_nslots;
+
+static struct swap_cluster swap_clusters[SWAP_NCLUSTERS];
+static char *swap_readbuf;		/* for reading clusters back */
+static struct spinlock swap_donelock = SPINLOCK_INITIALIZER;
+static struct wchan *swap_wchan;	/* waiting for a cluster */
+
+void
+swap_bootstrap(void)
+{
+	struct stat st;
+	unsigned i;
+	int result;
+
+	result = vfs_swapon(SWAP_DEVICE, &swap_vnode, &swap_dev);
+	if (result) {
+		kprintf("swap: %s: %s; paging disabled\n", SWAP_DEVICE,
+			strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: stat of %s failed: %s\n", SWAP_DEVICE,
+		      strerror(result));
+	}
+
+	swap_nslots = st.st_size / PAGE_SIZE;
+	/* The slot number has to fit in the frame field of a PTE. */
+	if (swap_nslots > PTE_FRAME >> 12) {
+		swap_nslots = PTE_FRAME >> 12;
+	}
+	if (swap_nslots == 0) {
+		kprintf("swap: %s is empty; paging disabled\n", SWAP_DEVICE);
+		return;
+	}
+
+	swap_map = bitmap_create(swap_nslots);
+	if (swap_map == NULL) {
+		panic("swap: cannot allocate the swap map\n");
+	}
+
+	swap_wchan = wchan_create("swap");
+	swap_readbuf = kmalloc(SWAP_CLUSTER * PAGE_SIZE);
+	if (swap_wchan == NULL || swap_readbuf == NULL) {
+		panic("swap: cannot allocate cluster buffers\n");
+	}
+	for (i=0; i<SWAP_NCLUSTERS; i++) {
+		swap_clusters[i].sc_buf = kmalloc(SWAP_CLUSTER * PAGE_SIZE);
+		if (swap_clusters[i].sc_buf == NULL) {
+			panic("swap: cannot allocate cluster buffers\n");
+		}
+		swap_clusters[i].sc_npages = 0;
+	}
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+}
+
+/*
+ * Transfer NPAGES pages between BUF and the slots from SLOT on.
+ */
+static
+int
+swap_io(unsigned slot, void *buf, unsigned npages, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(slot + npages <= swap_nslots);
+
+	uio_kinit(&iov, &ku, buf, npages * PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &ku);
+	}
+	if (result == 0 && ku.uio_resid != 0) {
+		result = EIO;
+	}
+	return result;
+}
+
+/*
+ * Completion of a cluster write. May be called in an interrupt.
+ */
+static
+void
+swap_writedone(struct devreq *req)
+{
+	struct swap_cluster *sc = req->dr_donedata;
+
+	spinlock_acquire(&swap_donelock);
+	sc->sc_done = true;
+	wchan_wakeall(swap_wchan, &swap_donelock);
+	spinlock_release(&swap_donelock);
+}
+
+/*
+ * Find SLOT in a cluster buffer that still holds it. Returns the
+ * cluster, and the page's index in it in *INDEX, or NULL.
+ */
+static
+struct swap_cluster *
+swap_transit(unsigned slot, unsigned *index)
+{
+	struct swap_cluster *sc;
+	unsigned i;
+
+	for (i=0; i<SWAP_NCLUSTERS; i++) {
+		sc = &swap_clusters[i];
+		if (sc->sc_npages == 0 || slot < sc->sc_slot ||
+		    slot >= sc->sc_slot + sc->sc_npages ||
+		    sc->sc_dropped[slot - sc->sc_slot]) {
+			continue;
+		}
+		*index = slot - sc->sc_slot;
+		return sc;
+	}
+	return NULL;
+}
+
+/*
+ * Retire the clusters whose writes have finished, releasing the slots
+ * that were freed while they were in flight.
+ */
+static
+void
+swap_reap(void)
+{
+	struct swap_cluster *sc;
+	unsigned i, j;
+	bool done;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	for (i=0; i<SWAP_NCLUSTERS; i++) {
+		sc = &swap_clusters[i];
+		if (sc->sc_npages == 0) {
+			continue;
+		}
+		spinlock_acquire(&swap_donelock);
+		done = sc->sc_done;
+		spinlock_release(&swap_donelock);
+		if (!done) {
+			continue;
+		}
+		if (sc->sc_req.dr_result != 0) {
+			if (!sc->sc_failed) {
+				kprintf("swap: write of slots %u-%u failed: "
+					"%s\n", sc->sc_slot,
+					sc->sc_slot + sc->sc_npages - 1,
+					strerror(sc->sc_req.dr_result));
+				sc->sc_failed = true;
+			}
+			/* Keep the buffer until nobody needs it */
+			for (j=0; j<sc->sc_npages; j++) {
+				if (!sc->sc_dropped[j]) {
+					break;
+				}
+			}
+			if (j < sc->sc_npages) {
+				continue;
+			}
+		}
+		for (j=0; j<sc->sc_npages; j++) {
+			if (sc->sc_dropped[j]) {
+				bitmap_unmark(swap_map, sc->sc_slot + j);
+			}
+		}
+		sc->sc_npages = 0;
+	}
+}
+
+/*
+ * Drop the TLB entries of pages whose references the clock just took,
+ * so that the next use of each faults and marks it referenced again.
+ */
+static
+void
+swap_unreference(struct coremap_ref *refs, unsigned n)
+{
+	pte_t *pte;
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		/* Or the refill handler would quietly load it again */
+		pte = pt_lookup(refs[i].cr_pt, refs[i].cr_vaddr, false);
+		if (pte != NULL) {
+			*pte &= ~(pte_t)(PTE_REFILL | PTE_WRITABLE);
+		}
+		vmtlb_shootdown(refs[i].cr_pt->pt_as, refs[i].cr_vaddr);
+	}
+}
+
+void
+swap_age(unsigned npages)
+{
+	struct coremap_ref refs[CM_MAXREFS];
+	unsigned n;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	if (swap_map == NULL) {
+		return;
+	}
+	while (npages > 0) {
+		n = coremap_clockage(&npages, refs, CM_MAXREFS);
+		swap_unreference(refs, n);
+	}
+}
+
+paddr_t
+swap_evict(void)
+{
+	struct coremap_ref refs[CM_MAXREFS];
+	struct pagetable *pt;
+	vaddr_t vaddr;
+	paddr_t paddr;
+	pte_t *pte;
+	unsigned slot, nrefs;
+	int result;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	if (swap_map == NULL) {
+		return 0;
+	}
+	swap_reap();
+
+	do {
+		paddr = coremap_clockvictim(&pt, &vaddr, refs, &nrefs);
+		swap_unreference(refs, nrefs);
+	} while (paddr == 0 && nrefs == CM_MAXREFS);
+	if (paddr == 0) {
+		return 0;
+	}
+	pte = pt_lookup(pt, vaddr, false);
+	KASSERT(pte != NULL);
+	KASSERT((*pte & PTE_PRESENT) && (*pte & PTE_FRAME) == paddr);
+
+	if (bitmap_alloc(swap_map, &slot)) {
+		/* out of swap */
+		return 0;
+	}
+
+	/*
+	 * Unmap the page before writing it out, so that a write to it
+	 * during the I/O faults (and waits for vm_lock) instead of
+	 * being lost.
+	 */
+	*pte = ((pte_t)slot << 12) | PTE_SWAPPED;
+	vmtlb_shootdown(pt->pt_as, vaddr);
+
+	result = swap_io(slot, (void *)PADDR_TO_KVADDR(paddr), 1, UIO_WRITE);
+	if (result) {
+		kprintf("swap: write of slot %u failed: %s\n", slot,
+			strerror(result));
+		*pte = paddr | PTE_PRESENT;
+		bitmap_unmark(swap_map, slot);
+		return 0;
+	}
+
+	KASSERT(pt->pt_nresident > 0);
+	pt->pt_nresident--;
+	coremap_setowner(paddr, NULL, 0);
+	vmstat_count(VMS_PAGEOUT);
+	vmstat_count(VMS_EVICT);
+	return paddr;
+}
+
+/*
+ * The frame of the page VADDR of PT, if it can join a cluster: an
+ * unshared anonymous page, not used since the clock last looked.
+ */
+static
+paddr_t
+swap_neighbour(struct pagetable *pt, vaddr_t vaddr)
+{
+	pte_t *pte;
+
+	pte = pt_lookup(pt, vaddr, false);
+	if (pte == NULL || (*pte & PTE_PRESENT) == 0 ||
+	    (*pte & (PTE_COW | PTE_SHARED)) != 0) {
+		return 0;
+	}
+	if (!coremap_clusterable(*pte & PTE_FRAME, pt)) {
+		return 0;
+	}
+	return *pte & PTE_FRAME;
+}
+
+/*
+ * Move the page VADDR of PT, in frame PADDR, into SC as its page
+ * INDEX, bound for SLOT, and free the frame.
+ */
+static
+void
+swap_clusterpage(struct swap_cluster *sc, unsigned index, unsigned slot,
+		 struct pagetable *pt, vaddr_t vaddr, paddr_t paddr)
+{
+	pte_t *pte;
+
+	pte = pt_lookup(pt, vaddr, false);
+	KASSERT(pte != NULL);
+	KASSERT((*pte & PTE_PRESENT) && (*pte & PTE_FRAME) == paddr);
+
+	/* As in swap_evict, unmap before copying */
+	*pte = ((pte_t)slot << 12) | PTE_SWAPPED;
+	vmtlb_shootdown(pt->pt_as, vaddr);
+	memcpy(sc->sc_buf + index * PAGE_SIZE,
+	       (const void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+	sc->sc_dropped[index] = false;
+
+	KASSERT(pt->pt_nresident > 0);
+	pt->pt_nresident--;
+	coremap_setowner(paddr, NULL, 0);
+	coremap_freepages(paddr);
+	vmstat_count(VMS_PAGEOUT);
+	vmstat_count(VMS_EVICT);
+}
+
+unsigned
+swap_evictcluster(void)
+{
+	struct coremap_ref refs[CM_MAXREFS];
+	struct swap_cluster *sc;
+	struct pagetable *pt;
+	vaddr_t vaddr;
+	paddr_t paddr;
+	unsigned i, n, count, slot, nrefs, bsize;
+	int result;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	if (swap_map == NULL) {
+		return 0;
+	}
+	swap_reap();
+
+	sc = NULL;
+	for (i=0; i<SWAP_NCLUSTERS; i++) {
+		if (swap_clusters[i].sc_npages == 0) {
+			sc = &swap_clusters[i];
+			break;
+		}
+	}
+	if (sc == NULL) {
+		return 0;
+	}
+
+	/* A run of slots; settle for a shorter one if swap is cut up */
+	for (n = SWAP_CLUSTER; n > 0; n /= 2) {
+		if (bitmap_alloc_range(swap_map, n, &slot) == 0) {
+			break;
+		}
+	}
+	if (n == 0) {
+		/* out of swap */
+		return 0;
+	}
+
+	/* Each victim of the clock, and what follows it, while it lasts */
+	count = 0;
+	while (count < n) {
+		paddr = coremap_clockvictim(&pt, &vaddr, refs, &nrefs);
+		swap_unreference(refs, nrefs);
+		if (paddr == 0) {
+			if (nrefs == CM_MAXREFS) {
+				continue;
+			}
+			break;
+		}
+		do {
+			swap_clusterpage(sc, count, slot + count, pt, vaddr,
+					 paddr);
+			count++;
+			vaddr += PAGE_SIZE;
+		} while (count < n && (paddr = swap_neighbour(pt, vaddr)) != 0);
+	}
+	if (count < n) {
+		bitmap_unmark_range(swap_map, slot + count, n - count);
+	}
+	if (count == 0) {
+		return 0;
+	}
+
+	sc->sc_slot = slot;
+	sc->sc_npages = count;
+	sc->sc_done = false;
+	sc->sc_failed = false;
+	if (swap_dev->d_ops->devop_strategy == NULL) {
+		/* Can't queue; write it now */
+		sc->sc_req.dr_result = swap_io(slot, sc->sc_buf, count,
+					       UIO_WRITE);
+		sc->sc_done = true;
+		return count;
+	}
+
+	bsize = swap_dev->d_blocksize;
+	sc->sc_req.dr_block = slot * (PAGE_SIZE / bsize);
+	sc->sc_req.dr_nblocks = count * (PAGE_SIZE / bsize);
+	sc->sc_req.dr_data = sc->sc_buf;
+	sc->sc_req.dr_write = true;
+	sc->sc_req.dr_flags = 0;
+	sc->sc_req.dr_tag = 0;
+	sc->sc_req.dr_done = swap_writedone;
+	sc->sc_req.dr_donedata = sc;
+	result = DEVOP_STRATEGY(swap_dev, &sc->sc_req);
+	if (result) {
+		/* swap_reap reports it */
+		sc->sc_req.dr_result = result;
+		sc->sc_done = true;
+	}
+	return count;
+}
+
+void
+swap_waitcluster(void)
+{
+	unsigned i;
+
+	KASSERT(!lock_do_i_hold(vm_lock));
+
+	spinlock_acquire(&swap_donelock);
+	while (1) {
+		for (i=0; i<SWAP_NCLUSTERS; i++) {
+			/* sc_npages is only a hint here */
+			if (swap_clusters[i].sc_npages == 0 ||
+			    swap_clusters[i].sc_done) {
+				break;
+			}
+		}
+		if (i < SWAP_NCLUSTERS) {
+			break;
+		}
+		wchan_sleep(swap_wchan, &swap_donelock);
+	}
+	spinlock_release(&swap_donelock);
+}
+
+int
+swap_pagein(unsigned slot, const paddr_t *paddrs, unsigned npages)
+{
+	struct swap_cluster *sc;
+	unsigned i, index;
+	bool ondisk;
+	int result;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+	KASSERT(swap_map != NULL);
+	KASSERT(npages > 0 && npages <= SWAP_CLUSTER);
+
+	swap_reap();
+
+	/* Go to the disk unless every page is still in a buffer */
+	ondisk = false;
+	for (i=0; i<npages; i++) {
+		if (swap_transit(slot + i, &index) == NULL) {
+			ondisk = true;
+		}
+	}
+	if (ondisk) {
+		if (npages == 1) {
+			result = swap_io(slot,
+					 (void *)PADDR_TO_KVADDR(paddrs[0]),
+					 1, UIO_READ);
+		}
+		else {
+			result = swap_io(slot, swap_readbuf, npages,
+					 UIO_READ);
+		}
+		if (result) {
+			return result;
+		}
+	}
+
+	for (i=0; i<npages; i++) {
+		sc = swap_transit(slot + i, &index);
+		if (sc != NULL) {
+			memcpy((void *)PADDR_TO_KVADDR(paddrs[i]),
+			       sc->sc_buf + index * PAGE_SIZE, PAGE_SIZE);
+			sc->sc_dropped[index] = true;
+			continue;
+		}
+		if (npages > 1) {
+			memcpy((void *)PADDR_TO_KVADDR(paddrs[i]),
+			       swap_readbuf + i * PAGE_SIZE, PAGE_SIZE);
+		}
+		bitmap_unmark(swap_map, slot + i);
+	}
+	return 0;
+}
+
+void
+swap_free(unsigned slot)
+{
+	struct swap_cluster *sc;
+	unsigned index;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+	KASSERT(swap_map != NULL);
+	KASSERT(bitmap_isset(swap_map, slot));
+
+	sc = swap_transit(slot, &index);
+	if (sc != NULL) {
+		/* swap_reap releases it once the write is done */
+		sc->sc_dropped[index] = true;
+		return;
+	}
+	bitmap_unmark(swap_map, slot);
+}
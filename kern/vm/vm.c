@@ -0,0 +1,591 @@
+/*
+ * Machine-independent part of the paging VM system: kernel page
+ * allocation and the page fault handler. The address space and page
+ * table code is in addrspace.c and pagetable.c, paging to disk is in
+ * swap.c, and TLB handling is in arch/mips/vm/vmtlb.c.
+ *
+ * vm_lock covers every change to a page table and every page-in or
+ * page-out. Holding it across swap I/O stalls other faults, but it
+ * means the evictor can update any process's page table without
+ * worrying about lock ordering between address spaces. Pages mapped
+ * from files are the exception: the file is read or written without
+ * vm_lock (see filecache.c).
+ *
+ * vm_lock also keeps the region list still while vm_fault uses a
+ * region, since munmap can remove one from under another thread.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <signal.h>
+#include <lib.h>
+#include <synch.h>
+#include <clock.h>
+#include <rcu.h>
+#include <cpu.h>
+#include <percpu.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+#include <filecache.h>
+#include <shm.h>
+#include <vmalloc.h>
+#include <pageout.h>
+#include <vmstat.h>
+#include <timepage.h>
+#include "opt-shell.h"
+
+/* Ticks a fault waits for the OOM killer's victim to free memory */
+#define VM_OOMTRIES	20
+
+struct lock *vm_lock;
+
+void
+vm_bootstrap(void)
+{
+	/* The time page sits between the mmap area and the stacks */
+	COMPILE_ASSERT(TIMEPAGE_VADDR >= VM_MMAPBASE);
+	COMPILE_ASSERT(TIMEPAGE_VADDR + PAGE_SIZE <=
+		       USERSTACK - VM_STACKAREAPAGES * PAGE_SIZE);
+
+	/* boot() has already set up the coremap */
+	vm_lock = lock_create("vm");
+	if (vm_lock == NULL) {
+		panic("vm_bootstrap: cannot create vm_lock\n");
+	}
+
+	vmalloc_bootstrap();
+	swap_bootstrap();
+	filecache_bootstrap();
+	coremap_zero_bootstrap();
+	pageout_bootstrap();
+}
+
+/*
+ * Assert that we're in a context that can sleep: vm_fault takes the
+ * address space lock and page allocation may eventually block.
+ */
+static
+void
+vm_can_sleep(void)
+{
+	if (CURCPU_EXISTS()) {
+		/* must not hold spinlocks */
+		KASSERT(curcpu->c_spinlocks == 0);
+
+		/* must not be in an interrupt handler */
+		KASSERT(curthread->t_in_interrupt == 0);
+	}
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(unsigned npages)
+{
+	paddr_t pa;
+
+	vm_can_sleep();
+	pa = coremap_getpages(npages);
+	if (pa == 0 && npages == 1 && vm_lock != NULL) {
+		/*
+		 * Page something out. We may already hold vm_lock if
+		 * this is a page table allocation from vm_fault.
+		 */
+		if (lock_do_i_hold(vm_lock)) {
+			pa = swap_evict();
+		}
+		else {
+			lock_acquire(vm_lock);
+			pa = swap_evict();
+			lock_release(vm_lock);
+		}
+	}
+	if (pa==0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	coremap_freepages(KVADDR_TO_PADDR(addr));
+}
+
+/*
+ * If the page at VADDR of the file-mapped region *VRP has never been
+ * touched, map it shared from the file cache: PTE_SHARED for a
+ * shared mapping, otherwise PTE_COW. Called with vm_lock held, which
+ * is dropped to get the page. The usual fault handling then finds it
+ * in the page table.
+ *
+ * If the region was unmapped or replaced meanwhile, sets *VRP to
+ * NULL; the caller should return and let the access fault again.
+ */
+static
+int
+vm_mapfile(struct addrspace *as, struct vm_region **vrp, vaddr_t vaddr)
+{
+	struct vm_region *vr = *vrp;
+	struct filecache_file *f;
+	pte_t *pte;
+	vaddr_t start, end;
+	off_t offset;
+	paddr_t pa;
+	pte_t flags;
+	int result;
+
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	if (pte != NULL && *pte != 0) {
+		return 0;
+	}
+	start = vr->vr_filestart > vaddr ? vr->vr_filestart : vaddr;
+	end = vr->vr_fileend < vaddr + PAGE_SIZE ?
+		vr->vr_fileend : vaddr + PAGE_SIZE;
+	if (start >= end) {
+		/* Nothing from the file here; plain zero fill */
+		return 0;
+	}
+
+	f = vr->vr_file;
+	offset = vr->vr_fileoff + (vaddr - vr->vr_base);
+	flags = (vr->vr_perm & VR_SHARED) ? PTE_SHARED : PTE_COW;
+
+	/* Keep the file while it's read, in case of munmap */
+	filecache_incref(f);
+	lock_release(vm_lock);
+	result = filecache_getpage(f, offset, start - vaddr, end - vaddr, &pa);
+	lock_acquire(vm_lock);
+
+	vr = as_findregion(as, vaddr);
+	if (vr == NULL || vr->vr_file != f ||
+	    vr->vr_fileoff + (vaddr - vr->vr_base) != offset) {
+		/* Ours may be the last reference; don't close with vm_lock */
+		lock_release(vm_lock);
+		if (result == 0) {
+			coremap_freepages(pa);
+		}
+		filecache_close(f);
+		lock_acquire(vm_lock);
+		*vrp = NULL;
+		return 0;
+	}
+	/* The region still holds the file, so this is cheap */
+	filecache_close(f);
+	if (result) {
+		return result;
+	}
+
+	pte = pt_lookup(as->as_pt, vaddr, true);
+	if (pte == NULL) {
+		coremap_freepages(pa);
+		return ENOMEM;
+	}
+	if (*pte != 0) {
+		/* Another thread got here first */
+		coremap_freepages(pa);
+		return 0;
+	}
+	*pte = pa | PTE_PRESENT | flags;
+	PT_FILLED(as->as_pt, vaddr);
+	as->as_pt->pt_nresident++;
+	vmstat_count(VMS_FILE);
+	return 0;
+}
+
+/*
+ * If the page at VADDR of the shared memory region VR has never been
+ * touched in this address space, map it from the segment, allocating
+ * the frame if no one else has touched it either. Called with
+ * vm_lock held, which is all the segment needs.
+ */
+static
+int
+vm_mapshm(struct addrspace *as, struct vm_region *vr, vaddr_t vaddr)
+{
+	pte_t *pte;
+	paddr_t pa;
+	int result;
+
+	pte = pt_lookup(as->as_pt, vaddr, true);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+	if (*pte != 0) {
+		return 0;
+	}
+	result = shm_getpage(vr->vr_shm, (vaddr - vr->vr_base) / PAGE_SIZE,
+			     &pa);
+	if (result) {
+		return result;
+	}
+	*pte = pa | PTE_PRESENT | PTE_SHARED;
+	PT_FILLED(as->as_pt, vaddr);
+	as->as_pt->pt_nresident++;
+	return 0;
+}
+
+/*
+ * Fault handling for a region advised MADV_SEQUENTIAL, after the
+ * fault at VADDR has been dealt with: map the file pages up to
+ * VM_FAULTAHEAD pages ahead, so the reader's next faults find them
+ * in the page table, and tell the clock it can have the page as far
+ * behind first, since the reader is done with it. Called with vm_lock
+ * held, which vm_mapfile drops for each page it reads; any trouble
+ * just stops the mapping ahead, and is left for the reader to run
+ * into when it gets there.
+ */
+static
+void
+vm_sequential(struct addrspace *as, struct vm_region *vr, vaddr_t vaddr)
+{
+	vaddr_t va, end;
+	pte_t *pte;
+	unsigned i;
+
+	if (vaddr >= vr->vr_base + VM_FAULTAHEAD * PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, vaddr - VM_FAULTAHEAD * PAGE_SIZE,
+				false);
+		if (pte != NULL && (*pte & PTE_PRESENT)) {
+			coremap_untouch(*pte & PTE_FRAME);
+		}
+	}
+
+	if (vr->vr_file == NULL) {
+		return;
+	}
+	end = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+	for (i=1; i<=VM_FAULTAHEAD; i++) {
+		va = vaddr + i * PAGE_SIZE;
+		if (va >= end || va >= vr->vr_fileend) {
+			break;
+		}
+		if (vm_mapfile(as, &vr, va) != 0 || vr == NULL) {
+			break;
+		}
+	}
+}
+
+#if OPT_SHELL
+struct vm_oomscan {
+	pid_t victim;
+	unsigned npages;	/* victim's pages, with page tables */
+	bool pending;		/* a victim is still on its way out */
+};
+
+static
+void
+vm_oomscan(struct proc *p, void *data)
+{
+	struct vm_oomscan *scan = data;
+	struct addrspace *as;
+
+	if (p == kproc || p->p_exited) {
+		return;
+	}
+	if (p->p_killsig != 0) {
+		scan->pending = true;
+		return;
+	}
+	spinlock_acquire(&p->p_lock);
+	as = p->p_addrspace;
+	spinlock_release(&p->p_lock);
+	/*
+	 * The process may be tearing the address space down as we
+	 * look, but as_destroy has to get vm_lock to free the page
+	 * table, and we have it.
+	 */
+	if (as != NULL &&
+	    as->as_pt->pt_nresident + as->as_pt->pt_npages > scan->npages) {
+		scan->victim = p->p_pid;
+		scan->npages = as->as_pt->pt_nresident + as->as_pt->pt_npages;
+	}
+}
+#endif
+
+/*
+ * Out of memory, with nothing left to page out: the OOM killer. Kill
+ * the user process with the most pages resident, counting its page
+ * tables, by setting
+ * p_killsig; it exits the next time one of its threads heads for
+ * user mode, and its memory comes free. Only one victim at a time:
+ * while one is still exiting, or the reaper is still freeing what an
+ * exited process had, nobody else is chosen.
+ *
+ * Returns true if the faulting thread should wait a tick and try
+ * again, false if it should give up (it is the victim itself, or
+ * there was no one to kill). Called with vm_lock held.
+ */
+static
+bool
+vm_oom(void)
+{
+#if OPT_SHELL
+	struct vm_oomscan scan;
+	struct proc *p;
+	bool killed;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	if (curproc->p_killsig != 0) {
+		return false;
+	}
+	scan.victim = 0;
+	scan.npages = 0;
+	scan.pending = false;
+	proc_foreach(vm_oomscan, &scan);
+	if (scan.pending || proc_reaping()) {
+		return true;
+	}
+	if (scan.victim == 0) {
+		return false;
+	}
+
+	killed = false;
+	rcu_read_lock();
+	p = proc_search(scan.victim);
+	if (p != NULL && !p->p_exited) {
+		spinlock_acquire(&p->p_lock);
+		p->p_killsig = SIGKILL;
+		spinlock_release(&p->p_lock);
+		killed = true;
+	}
+	rcu_read_unlock();
+	if (killed) {
+		kprintf("vm: out of memory: killed pid %d "
+			"(%u pages in use)\n", scan.victim, scan.npages);
+	}
+	return curproc->p_killsig == 0;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Would locking one more page take AS past curproc's RLIMIT_MEMLOCK?
+ */
+static
+bool
+vm_lockoverlimit(struct addrspace *as)
+{
+	return (rlim_t)(as->as_pt->pt_nlocked + 1) * PAGE_SIZE >
+		proc_getrlimit(curproc, RLIMIT_MEMLOCK);
+}
+
+/*
+ * The body of vm_fault, with vm_lock held. POPULATE is set when the
+ * page is being brought in ahead of use (vm_populate) rather than
+ * for an access, so nothing goes in the TLB.
+ */
+static
+int
+vm_handlefault(struct addrspace *as, int faulttype, vaddr_t faultaddress,
+	       bool populate)
+{
+	struct vm_region *vr;
+	pte_t pte;
+	bool writeable;
+	int result;
+
+	vr = as_findregion(as, faultaddress);
+	if (vr == NULL) {
+		/* Below the stack, perhaps, and the stack may grow to it */
+		vr = as_growstack(as, faultaddress,
+				  proc_getrlimit(curproc, RLIMIT_STACK));
+	}
+	if (vr == NULL) {
+		return EFAULT;
+	}
+	writeable = (vr->vr_perm & VR_WRITE) != 0 || as->as_loading;
+	if (faulttype != VM_FAULT_READ && !writeable) {
+		return EFAULT;
+	}
+
+	if (vr->vr_file != NULL) {
+		result = vm_mapfile(as, &vr, faultaddress);
+		if (result || vr == NULL) {
+			return result;
+		}
+	}
+	else if (vr->vr_shm != NULL) {
+		result = vm_mapshm(as, vr, faultaddress);
+		if (result) {
+			return result;
+		}
+	}
+	result = pt_getpage(as->as_pt, faultaddress,
+			    faulttype != VM_FAULT_READ, &pte);
+	if (result) {
+		return result;
+	}
+	/* Map shared pages read-only so the first write faults. */
+	if (pte & PTE_COW) {
+		writeable = false;
+	}
+	/*
+	 * A shared file page becomes writable when it is first written.
+	 * So does a shared memory page; its PTE_DIRTY means nothing more.
+	 */
+	if (pte & PTE_SHARED) {
+		if (faulttype != VM_FAULT_READ) {
+			pte_t *ptep = pt_lookup(as->as_pt, faultaddress, false);
+			*ptep |= PTE_DIRTY;
+			pte = *ptep;
+		}
+		if ((pte & PTE_DIRTY) == 0) {
+			writeable = false;
+		}
+	}
+	/* After mlockall(MCL_FUTURE), new pages are locked as they come */
+	if (as->as_lockfuture && !vm_lockoverlimit(as)) {
+		pt_lock(as->as_pt, faultaddress);
+	}
+	if (populate) {
+		return 0;
+	}
+	/*
+	 * Let the refill handler load it from now on, unless this is
+	 * a load's temporary write access.
+	 */
+	if (!as->as_loading) {
+		pte_t *ptep = pt_lookup(as->as_pt, faultaddress, false);
+		*ptep |= PTE_REFILL | (writeable ? PTE_WRITABLE : 0);
+	}
+	vmtlb_load(faultaddress, pte & PTE_FRAME, writeable);
+	if (vr->vr_advice == MADV_SEQUENTIAL) {
+		vm_sequential(as, vr, faultaddress);
+	}
+	return 0;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	unsigned tries;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+	percpu_inc(PCPU_FAULTS);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (faultaddress >= KVMAP_BASE &&
+	    faultaddress - KVMAP_BASE < KVMAP_PAGES * PAGE_SIZE) {
+		/* vmalloc memory; may be any context, so don't sleep */
+		return vmalloc_fault(faultaddress);
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	vmstat_count(faulttype == VM_FAULT_READONLY ?
+		     VMS_READONLY : VMS_TLBMISS);
+
+	if (faultaddress == TIMEPAGE_VADDR) {
+		/* Not in any region or page table; read-only to all */
+		if (faulttype != VM_FAULT_READ) {
+			return EFAULT;
+		}
+		vmtlb_load(TIMEPAGE_VADDR, timepage_paddr(), false);
+		return 0;
+	}
+
+	vm_can_sleep();
+	for (tries = 0; ; tries++) {
+		lock_acquire(vm_lock);
+		result = vm_handlefault(as, faulttype, faultaddress, false);
+		if (result != ENOMEM || tries == VM_OOMTRIES || !vm_oom()) {
+			lock_release(vm_lock);
+			return result;
+		}
+		lock_release(vm_lock);
+		/* Give the victim a moment to exit */
+		clocksleep_ticks(1);
+	}
+}
+
+/*
+ * Bring in every page of AS from START to END now, as if each had
+ * been touched, and if LOCK is set lock them in memory too. Pages of
+ * private writable regions are faulted for writing, so they are the
+ * process's own and a later write doesn't fault again; shared file
+ * pages are only read, so populating doesn't make them dirty. Stops
+ * at the first page that can't be had (ENOMEM, or EFAULT outside
+ * any region), or with ENOMEM at the first that would take the
+ * locked pages past RLIMIT_MEMLOCK.
+ *
+ * Call without vm_lock; it is taken a page at a time, so faults from
+ * other threads get in between.
+ */
+int
+vm_populate(struct addrspace *as, vaddr_t start, vaddr_t end, bool lock)
+{
+	struct vm_region *vr;
+	vaddr_t va;
+	pte_t *pte;
+	int faulttype, result;
+
+	KASSERT(start % PAGE_SIZE == 0);
+	vm_can_sleep();
+
+	result = 0;
+	for (va = start; va < end && result == 0; va += PAGE_SIZE) {
+		lock_acquire(vm_lock);
+		vr = as_findregion(as, va);
+		if (vr == NULL) {
+			lock_release(vm_lock);
+			return EFAULT;
+		}
+		faulttype = VM_FAULT_READ;
+		if ((vr->vr_perm & (VR_WRITE | VR_SHARED)) == VR_WRITE) {
+			faulttype = VM_FAULT_WRITE;
+		}
+		result = vm_handlefault(as, faulttype, va, true);
+		if (result == 0 && lock) {
+			/* Not there if the region went while we slept */
+			pte = pt_lookup(as->as_pt, va, false);
+			if (pte != NULL && (*pte & PTE_PRESENT) != 0 &&
+			    (*pte & PTE_LOCKED) == 0) {
+				if (vm_lockoverlimit(as)) {
+					result = ENOMEM;
+				}
+				else {
+					pt_lock(as->as_pt, va);
+				}
+			}
+		}
+		lock_release(vm_lock);
+	}
+	return result;
+}
@@ -0,0 +1,189 @@
+/*
+ * vmalloc: big kernel buffers from scattered pages. See vmalloc.h.
+ *
+ * The vmalloc area is the first KVMAP_PAGES pages of kseg2, which,
+ * unlike kseg0, the processor translates through the TLB. An
+ * allocation reserves a run of addresses there (in vmalloc_map), takes
+ * a page from alloc_kpages for each one wherever it happens to be, and
+ * records it in vmalloc_frames. Nothing goes in the TLB yet: a miss in
+ * the area reaches vm_fault like any other, which hands it to
+ * vmalloc_fault to load a global entry from vmalloc_frames. Freeing
+ * shoots the entries down on every cpu before the pages go back.
+ *
+ * Every allocation has an unmapped guard page after it, so running
+ * off the end faults (and panics) instead of landing in the next one.
+ *
+ * A kseg2 miss goes through the general exception handler, which
+ * saves its state on the current kernel stack; so a kernel stack
+ * can't live here, and neither can anything the trap path uses.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <bitmap.h>
+#include <vm.h>
+#include <vmalloc.h>
+
+static struct spinlock vmalloc_lock = SPINLOCK_INITIALIZER;
+static struct bitmap *vmalloc_map;	/* addresses in use, guards too */
+static paddr_t *vmalloc_frames;		/* frame of each page, or 0 */
+static unsigned *vmalloc_sizes;		/* pages, at an allocation's head */
+static unsigned vmalloc_npages;		/* pages mapped */
+static unsigned vmalloc_fails;		/* no run of addresses */
+
+void
+vmalloc_bootstrap(void)
+{
+	unsigned i;
+
+	vmalloc_map = bitmap_create(KVMAP_PAGES);
+	vmalloc_frames = kmalloc(KVMAP_PAGES * sizeof(paddr_t));
+	vmalloc_sizes = kmalloc(KVMAP_PAGES * sizeof(unsigned));
+	if (vmalloc_map == NULL || vmalloc_frames == NULL ||
+	    vmalloc_sizes == NULL) {
+		panic("vmalloc_bootstrap: Out of memory\n");
+	}
+	for (i=0; i<KVMAP_PAGES; i++) {
+		vmalloc_frames[i] = 0;
+		vmalloc_sizes[i] = 0;
+	}
+}
+
+/*
+ * Give back the first NMAPPED frames of the allocation at page FIRST
+ * of NPAGES, and its addresses.
+ */
+static
+void
+vmalloc_release(unsigned first, unsigned nmapped, unsigned npages)
+{
+	unsigned i;
+	paddr_t pa;
+
+	for (i=0; i<nmapped; i++) {
+		pa = vmalloc_frames[first + i];
+		vmalloc_frames[first + i] = 0;
+		free_kpages(PADDR_TO_KVADDR(pa));
+	}
+
+	spinlock_acquire(&vmalloc_lock);
+	vmalloc_npages -= nmapped;
+	vmalloc_sizes[first] = 0;
+	/* The guard page too */
+	bitmap_unmark_range(vmalloc_map, first, npages + 1);
+	spinlock_release(&vmalloc_lock);
+}
+
+void *
+vmalloc(size_t size)
+{
+	unsigned npages, first, i;
+	vaddr_t kva;
+	int result;
+
+	KASSERT(vmalloc_map != NULL);
+
+	if (size == 0) {
+		return NULL;
+	}
+	npages = DIVROUNDUP(size, PAGE_SIZE);
+	if (npages >= KVMAP_PAGES) {
+		return NULL;
+	}
+
+	spinlock_acquire(&vmalloc_lock);
+	result = bitmap_alloc_range(vmalloc_map, npages + 1, &first);
+	if (result) {
+		vmalloc_fails++;
+		spinlock_release(&vmalloc_lock);
+		return NULL;
+	}
+	vmalloc_sizes[first] = npages;
+	spinlock_release(&vmalloc_lock);
+
+	/*
+	 * Nobody else looks at these frames until we hand out the
+	 * address, so they can be filled in without the lock.
+	 */
+	for (i=0; i<npages; i++) {
+		kva = alloc_kpages(1);
+		if (kva == 0) {
+			vmalloc_release(first, i, npages);
+			return NULL;
+		}
+		vmalloc_frames[first + i] = KVADDR_TO_PADDR(kva);
+	}
+
+	spinlock_acquire(&vmalloc_lock);
+	vmalloc_npages += npages;
+	spinlock_release(&vmalloc_lock);
+
+	return (void *)(KVMAP_BASE + first * PAGE_SIZE);
+}
+
+void
+vfree(void *ptr)
+{
+	vaddr_t va;
+	unsigned first, npages;
+
+	if (ptr == NULL) {
+		return;
+	}
+	va = (vaddr_t)ptr;
+	KASSERT(va % PAGE_SIZE == 0);
+	KASSERT(va >= KVMAP_BASE);
+	first = (va - KVMAP_BASE) / PAGE_SIZE;
+	KASSERT(first < KVMAP_PAGES);
+
+	spinlock_acquire(&vmalloc_lock);
+	npages = vmalloc_sizes[first];
+	spinlock_release(&vmalloc_lock);
+	KASSERT(npages > 0);
+
+	/* No cpu may still have the pages mapped when they're reused */
+	vmtlb_kernshootdown(va, npages);
+	vmalloc_release(first, npages, npages);
+}
+
+int
+vmalloc_fault(vaddr_t vaddr)
+{
+	unsigned pg;
+	paddr_t pa;
+
+	KASSERT(vaddr >= KVMAP_BASE);
+	pg = (vaddr - KVMAP_BASE) / PAGE_SIZE;
+	KASSERT(pg < KVMAP_PAGES);
+
+	if (vmalloc_frames == NULL) {
+		return EFAULT;
+	}
+	spinlock_acquire(&vmalloc_lock);
+	pa = vmalloc_frames[pg];
+	spinlock_release(&vmalloc_lock);
+	if (pa == 0) {
+		/* A guard page, or not allocated */
+		return EFAULT;
+	}
+	vmtlb_loadkernel(vaddr & PAGE_FRAME, pa);
+	return 0;
+}
+
+void
+vmalloc_printstats(void)
+{
+	unsigned npages, fails, used;
+
+	spinlock_acquire(&vmalloc_lock);
+	npages = vmalloc_npages;
+	fails = vmalloc_fails;
+	used = bitmap_count(vmalloc_map);
+	spinlock_release(&vmalloc_lock);
+
+	kprintf("vmalloc: %u pages mapped (%uk), %u/%u addresses in use\n",
+		npages, npages * PAGE_SIZE / 1024, used, KVMAP_PAGES);
+	kprintf("vmalloc: %u allocations failed for lack of addresses\n",
+		fails);
+}
@@ -0,0 +1,117 @@
+/*
+ * VM fault and paging statistics. See vmstat.h.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <current.h>
+#include <proc.h>
+#include <percpu.h>
+#include <vmstat.h>
+#include "opt-dumbvm.h"
+#if !OPT_DUMBVM
+#include <vm.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#endif
+
+void
+vmstat_count(enum vmstat_event which)
+{
+	struct proc *p = curproc;
+
+	KASSERT(which < VMS_NEVENTS);
+
+	percpu_inc(PCPU_VMTLBMISS + which);
+	if (which < VMS_NPROC && p != NULL) {
+		spinlock_acquire(&p->p_lock);
+		p->p_vmstats.vs_count[which]++;
+		spinlock_release(&p->p_lock);
+	}
+}
+
+void
+vmstats_add(struct vmstats *to, const struct vmstats *from)
+{
+	unsigned i;
+
+	for (i=0; i<VMS_NPROC; i++) {
+		to->vs_count[i] += from->vs_count[i];
+	}
+}
+
+unsigned
+vmstats_majflt(const struct vmstats *vs)
+{
+	return vs->vs_count[VMS_PAGEIN] + vs->vs_count[VMS_FILE];
+}
+
+unsigned
+vmstats_minflt(const struct vmstats *vs)
+{
+	unsigned faults;
+
+	faults = vs->vs_count[VMS_TLBMISS] + vs->vs_count[VMS_READONLY];
+	/* A fault can be counted a moment before its page-in */
+	return faults > vmstats_majflt(vs) ? faults - vmstats_majflt(vs) : 0;
+}
+
+#if OPT_SHELL
+static
+void
+vmstat_printproc(struct proc *p, void *data)
+{
+	struct vmstats vs;
+	struct addrspace *as;
+	unsigned resident, ptpages;
+
+	(void)data;
+
+	if (p->p_exited) {
+		return;
+	}
+	spinlock_acquire(&p->p_lock);
+	vs = p->p_vmstats;
+	as = p->p_addrspace;
+	spinlock_release(&p->p_lock);
+
+	resident = ptpages = 0;
+#if !OPT_DUMBVM
+	/* vm_lock keeps the page table from going away; see vm_oom */
+	if (as != NULL) {
+		resident = as->as_pt->pt_nresident;
+		ptpages = as->as_pt->pt_npages;
+	}
+#else
+	(void)as;
+#endif
+	kprintf("%5d %8u %7u %8u %8u %8u %8u %8u %8u  %s\n", p->p_pid,
+		resident, ptpages, vs.vs_count[VMS_TLBMISS],
+		vs.vs_count[VMS_READONLY], vs.vs_count[VMS_ZEROFILL], vs.vs_count[VMS_FILE],
+		vs.vs_count[VMS_COW], vs.vs_count[VMS_PAGEIN], p->p_name);
+}
+#endif
+
+void
+vmstat_printstats(void)
+{
+	unsigned i;
+
+	for (i=0; i<VMS_NEVENTS; i++) {
+		kprintf("%-15s %llu\n", percpu_name(PCPU_VMTLBMISS + i),
+			(unsigned long long)percpu_read(PCPU_VMTLBMISS + i));
+	}
+
+#if OPT_SHELL
+	kprintf("\n  pid resident ptpages  tlbmiss rofaults zerofill    files"
+		"  cowcopy   pagein  name\n");
+#if !OPT_DUMBVM
+	lock_acquire(vm_lock);
+#endif
+	proc_foreach(vmstat_printproc, NULL);
+#if !OPT_DUMBVM
+	lock_release(vm_lock);
+#endif
+#endif
+}
@@ -81,7 +81,20 @@ TAGS_HEADERS=\
 #
 
 # Default rule: link the kernel.
-all: includelinks .WAIT $(KERNEL)
+all: includelinks systab.h .WAIT $(KERNEL)
+
+#
+# The system call table used by syscall.c is generated from the call
+# numbers in kern/syscall.h and the sys_* prototypes in syscall.h.
+#
+SYSTAB_SRCS=$(KTOP)/include/kern/syscall.h $(KTOP)/include/syscall.h
+GENSYSTAB=$(KTOP)/arch/$(MACHINE)/syscall/gensystab.sh
+
+systab.h: $(SYSTAB_SRCS) $(GENSYSTAB)
+	$(GENSYSTAB) $(SYSTAB_SRCS) > systab.h.tmp
+	mv -f systab.h.tmp systab.h
+
+syscall.o: systab.h
 
 #
 # Here's how we link the kernel.
@@ -118,7 +131,7 @@ $(KERNEL):
 # kernel build.
 #
 depend:
-	$(MAKE) includelinks
+	$(MAKE) includelinks systab.h
 	rm -f .depend.* || true
 	$(MAKE) realdepend
 
@@ -161,7 +174,7 @@ includelinks:
 # blow away the whole compile directory.)
 #
 clean:
-	rm -f *.o *.a tags $(KERNEL)
+	rm -f *.o *.a tags $(KERNEL) systab.h
 	rm -rf includelinks
 
 distclean cleandir: clean
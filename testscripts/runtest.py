@@ -71,7 +71,65 @@
 # Depends on pexpect, which you may need to install specifically
 # depending on your OS.
 #
+#
+# Performance mode:
+#   import runtest
+#   results = runtest.perf(outputfile, tests=None, <same keyword args>)
+#
+# Boots the kernel once per test program, runs it from the shell on a
+# mounted lhd1: (which must already hold an SFS volume; see
+# hostbin/mksfs), shuts down, and parses the statistics System/161
+# prints on exit. Booting separately for each program means the
+# counters belong to that program alone (plus a fixed boot and
+# shutdown cost that is the same for every run of the same kernel).
+#
+# The tests argument is a list of names from perftests below; None
+# means all of them, in order. The return value is a list with one
+# dict per test, suitable for handing to json.dump:
+#    "test", "command"	which test was run and how
+#    "status"		None on success, otherwise a runtest message
+#    "cycles"		total simulated cycles
+#    "run", "idle"	cycles with some cpu busy / all cpus idle
+#    "kern", "user"	cycles executed in kernel / user mode, summed
+#			over cpus; System/161 retires one instruction
+#			per non-idle cycle, so kern + user is also the
+#			instruction count ("instructions")
+#    "irqs", "exns"	interrupts and exceptions taken; with a
+#			software-refilled TLB, exns is dominated by
+#			TLB faults and system calls
+#    "diskreads", "diskwrites"	disk sectors transferred
+#    "realsecs", "virtsecs"	elapsed host and simulated time
+# Statistics that could not be found in the output (e.g. because the
+# test panicked) are left out.
+#
+# With timed=True, each program is run under the shell's time builtin,
+# and what it reports about the program from inside the kernel is
+# added too:
+#    "ksecs"		elapsed time as the kernel saw it
+#    "usersecs", "syssecs"	cpu time in user and kernel mode
+#    "minflt", "majflt"	page faults without and with a disk read
+#    "nvcsw", "nivcsw"	voluntary and involuntary context switches
+#    "inblock", "oublock"	file system blocks read and written
+#
+#
+# Sweep mode:
+#   import runtest
+#   results = runtest.sweep(outputfile, tests=None, cpulist=[1, 2, 4, 8],
+#                           ramlist=[None], <same keyword args>)
+#   runtest.writecsv(results, csvfile)
+#   runtest.summarize(results, outputfile)
+#
+# Runs perf (timed) for every combination of cpu count and RAM size,
+# and returns all the results, each with "cpus" and "ram" added. None
+# in ramlist means the sys161 config's size. writecsv writes them one
+# row per run. summarize prints, for each test and RAM size, the
+# speedup of each cpu count over the smallest one in simulated time
+# (virtsecs), and the efficiency, which is the speedup divided by the
+# ratio of cpu counts. Flat speedup or falling efficiency where it
+# used to scale points at lock contention or a serialized VM path.
+#
 
+import re
 import time
 import pexpect
 
@@ -200,3 +258,192 @@ def run(testcommands, outputfile,
 
 	return None
 # end run
+
+#
+# Tests for performance mode. Each one exercises something we want to
+# watch across changes: file system throughput (bigfile, psort,
+# dirconc), VM faults (matmult, parallelvm), and fork latency
+# (forktest). Arguments are fixed so runs are comparable; dirconc
+# gets a fixed random seed for the same reason.
+#
+perftests = [
+	("bigfile", "/testbin/bigfile perf.dat 1048576/4096"),
+	("psort", "/testbin/psort"),
+	("matmult", "/testbin/matmult"),
+	("forktest", "/testbin/forktest"),
+	("dirconc", "/testbin/dirconc lhd1: 1"),
+	("parallelvm", "/testbin/parallelvm -w"),
+]
+
+#
+# Pass output through to the caller's file while keeping a copy we
+# can parse afterwards.
+#
+class tee:
+	def __init__(self, outputfile):
+		self.outputfile = outputfile
+		self.text = []
+	def write(self, s):
+		self.text.append(s)
+		self.outputfile.write(s)
+	def flush(self):
+		self.outputfile.flush()
+	def getvalue(self):
+		return "".join(self.text)
+# end tee
+
+#
+# Patterns for the statistics sys161 prints on shutdown.
+#
+statpatterns = [
+	(r"sys161: (\d+) cycles \((\d+) run, (\d+) global-idle\)",
+		["cycles", "run", "idle"]),
+	(r"sys161: (\d+) irqs (\d+) exns (\d+)r/(\d+)w disk",
+		["irqs", "exns", "diskreads", "diskwrites"]),
+	(r"sys161: Elapsed real time: (\d+\.\d+) seconds",
+		["realsecs"]),
+	(r"sys161: Elapsed virtual time: (\d+\.\d+) seconds",
+		["virtsecs"]),
+]
+cpupattern = r"sys161:\s+cpu\d+: (\d+) kern, (\d+) user, (\d+) idle"
+
+def parsestats(text):
+	stats = {}
+	for (pattern, names) in statpatterns:
+		m = re.search(pattern, text)
+		if m is None:
+			continue
+		for (name, val) in zip(names, m.groups()):
+			if "." in val:
+				stats[name] = float(val)
+			else:
+				stats[name] = int(val)
+	cpus = re.findall(cpupattern, text)
+	if len(cpus) > 0:
+		stats["kern"] = sum([int(c[0]) for c in cpus])
+		stats["user"] = sum([int(c[1]) for c in cpus])
+		stats["instructions"] = stats["kern"] + stats["user"]
+	return stats
+# end parsestats
+
+#
+# performance mode
+#
+def perf(outputfile, tests=None, timed=False, **kwargs):
+	known = dict(perftests)
+	if tests is None:
+		tests = [name for (name, cmd) in perftests]
+
+	results = []
+	for name in tests:
+		if name not in known:
+			results.append({ "test": name, "status": "unknown test" })
+			continue
+		cmd = known[name]
+		if timed:
+			cmd = "time " + cmd
+		log = tee(outputfile)
+		msg = run("MOUNT; s; %s; exit; UNMOUNT" % cmd, log, **kwargs)
+		result = { "test": name, "command": cmd, "status": msg }
+		result.update(parsestats(log.getvalue()))
+		if timed:
+			result.update(parsetime(log.getvalue()))
+		results.append(result)
+	return results
+# end perf
+
+#
+# Patterns for what sh's time builtin prints.
+#
+timepatterns = [
+	(r"(\d+\.\d+) real +(\d+\.\d+) user +(\d+\.\d+) sys",
+		["ksecs", "usersecs", "syssecs"]),
+	(r"(\d+) minor faults +(\d+) major faults",
+		["minflt", "majflt"]),
+	(r"(\d+) voluntary +(\d+) involuntary context switches",
+		["nvcsw", "nivcsw"]),
+	(r"(\d+) blocks read +(\d+) blocks written",
+		["inblock", "oublock"]),
+]
+
+def parsetime(text):
+	stats = {}
+	for (pattern, names) in timepatterns:
+		m = re.search(pattern, text)
+		if m is None:
+			continue
+		for (name, val) in zip(names, m.groups()):
+			if "." in val:
+				stats[name] = float(val)
+			else:
+				stats[name] = int(val)
+	return stats
+# end parsetime
+
+#
+# sweep mode
+#
+def sweep(outputfile, tests=None, cpulist=[1, 2, 4, 8], ramlist=[None],
+		**kwargs):
+	results = []
+	for ram in ramlist:
+		for cpus in cpulist:
+			for result in perf(outputfile, tests=tests, timed=True,
+					cpus=cpus, ram=ram, **kwargs):
+				result["cpus"] = cpus
+				result["ram"] = ram
+				results.append(result)
+	return results
+# end sweep
+
+csvcolumns = [
+	"test", "cpus", "ram", "status",
+	"virtsecs", "realsecs", "cycles", "run", "idle", "kern", "user",
+	"instructions", "irqs", "exns", "diskreads", "diskwrites",
+	"ksecs", "usersecs", "syssecs", "minflt", "majflt",
+	"nvcsw", "nivcsw", "inblock", "oublock",
+]
+
+def writecsv(results, csvfile):
+	csvfile.write(",".join(csvcolumns) + "\n")
+	for result in results:
+		row = []
+		for col in csvcolumns:
+			val = result.get(col)
+			if val is None:
+				row.append("")
+			else:
+				# (statuses have no commas; make sure)
+				row.append(str(val).replace(",", ";"))
+		csvfile.write(",".join(row) + "\n")
+# end writecsv
+
+def summarize(results, outputfile):
+	groups = {}
+	order = []
+	for result in results:
+		key = (result["test"], result.get("ram"))
+		if key not in groups:
+			groups[key] = []
+			order.append(key)
+		groups[key].append(result)
+
+	outputfile.write("%-12s %-8s %5s %10s %8s %6s\n" %
+		("test", "ram", "cpus", "virtsecs", "speedup", "eff"))
+	for key in order:
+		(test, ram) = key
+		runs = [r for r in groups[key]
+			if r.get("status") is None and r.get("virtsecs")]
+		runs.sort(key=lambda r: r["cpus"])
+		if len(runs) == 0:
+			outputfile.write("%-12s %-8s   (no successful runs)\n" %
+				(test, ram or "-"))
+			continue
+		base = runs[0]
+		for r in runs:
+			speedup = base["virtsecs"] / r["virtsecs"]
+			eff = speedup / (float(r["cpus"]) / base["cpus"])
+			outputfile.write("%-12s %-8s %5d %10.3f %8.2f %6.2f\n" %
+				(test, ram or "-", r["cpus"], r["virtsecs"],
+				speedup, eff))
+# end summarize
@@ -1,6 +1,8 @@
 #!/usr/pkg/bin/python2.7
 # test.py - run some test material
 # usage: auto/test.py [options] test-commands
+#    or: auto/test.py [options] --perf [perf-tests]
+#    or: auto/test.py [options] --sweep [perf-tests]
 # options:
 #    --menuprompt=STR	Change menu prompt string
 #    --shellprompt=STR	Change shell prompt string
@@ -12,7 +14,19 @@
 #    --no-progress	Disable progress monitoring
 #    --timeout=N	Global timeout, in seconds (default 300)
 #    --kernel=KERNEL	Choose kernel to run (default "kernel")
+#    --perf		Run performance tests and print JSON results
+#    --sweep		Run performance tests over a grid and print CSV
+#    --sweep-cpus=LIST	Cpu counts for --sweep (default 1,2,4,8)
+#    --sweep-ram=LIST	RAM sizes for --sweep (default from sys161 config)
 #
+# With --perf, the System/161 output goes to stderr and stdout gets
+# only the JSON. Any arguments name the perf tests to run (default
+# all; see perftests in runtest.py).
+#
+# With --sweep, the perf tests are run once for every combination of
+# the comma-separated cpu counts and RAM sizes, which override --cpus
+# and --ram. stdout gets a CSV line per run, and a table of speedup
+# and efficiency against the fewest cpus goes to stderr at the end.
 #
 # This is a directly executable wrapper around runtest.py. You can use
 # it from the host OS shell to run more or less arbitrary scripts, or
@@ -22,6 +36,7 @@
 #
 
 import sys
+import json
 from optparse import OptionParser
 
 import runtest
@@ -34,9 +49,13 @@ g_conf = None
 g_cpus = None
 g_kernel = None
 g_menuprompt = None
+g_perf = False
 g_progress = 30
 g_ram = None
 g_shellprompt = None
+g_sweep = False
+g_sweepcpus = [1, 2, 4, 8]
+g_sweepram = [None]
 g_timeout = 300
 
 ############################################################
@@ -52,6 +71,10 @@ def getargs():
 	global g_progress
 	global g_timeout
 	global g_kernel
+	global g_perf
+	global g_sweep
+	global g_sweepcpus
+	global g_sweepram
 
 	# XXX is there no better scheme for this?
 	p = OptionParser()
@@ -62,8 +85,12 @@ def getargs():
 	p.add_option("-j", "--cpus", dest="cpus")
 	p.add_option("-k", "--kernel", dest="kernel")
 	p.add_option("-m", "--menuprompt", dest="menuprompt")
+	p.add_option("-P", "--perf", dest="perf", action="store_true")
 	p.add_option("-r", "--ram", dest="ram")
 	p.add_option("-s", "--shellprompt", dest="shellprompt")
+	p.add_option("-S", "--sweep", dest="sweep", action="store_true")
+	p.add_option("--sweep-cpus", dest="sweepcpus")
+	p.add_option("--sweep-ram", dest="sweepram")
 	p.add_option("-t", "--timeout", dest="timeout")
 	p.add_option("-z", "--no-progress", dest="no_progress")
 	p.add_option("-Z", "--progress", dest="progress")
@@ -89,7 +116,19 @@ def getargs():
 		g_timeout = int(options.timeout)
 	if options.kernel is not None:
 		g_kernel = options.kernel
+	if options.perf is not None:
+		g_perf = True
+	if options.sweep is not None:
+		g_sweep = True
+	if options.sweepcpus is not None:
+		g_sweepcpus = [int(n) for n in options.sweepcpus.split(",")]
+	if options.sweepram is not None:
+		g_sweepram = options.sweepram.split(",")
 
+	if g_perf or g_sweep:
+		if len(args) == 0:
+			return None
+		return args
 	if len(args) != 1:
 		sys.stderr.write("Usage: test.py [options] test-commands\n")
 		exit(1)
@@ -97,6 +136,38 @@ def getargs():
 # end getargs
 
 testcommands = getargs()
+if g_sweep:
+	results = runtest.sweep(sys.stderr,
+		tests=testcommands,
+		cpulist=g_sweepcpus,
+		ramlist=g_sweepram,
+		menuprompt=g_menuprompt,
+		shellprompt=g_shellprompt,
+		conf=g_conf,
+		doom=g_doom,
+		progress=g_progress,
+		timeout=g_timeout,
+		kernel=g_kernel)
+	runtest.writecsv(results, sys.stdout)
+	sys.stderr.write("\n")
+	runtest.summarize(results, sys.stderr)
+	exit(0)
+if g_perf:
+	results = runtest.perf(sys.stderr,
+		tests=testcommands,
+		menuprompt=g_menuprompt,
+		shellprompt=g_shellprompt,
+		conf=g_conf,
+		ram=g_ram,
+		cpus=g_cpus,
+		doom=g_doom,
+		progress=g_progress,
+		timeout=g_timeout,
+		kernel=g_kernel)
+	json.dump(results, sys.stdout, indent=1, sort_keys=True)
+	sys.stdout.write("\n")
+	exit(0)
+
 msg = runtest.run(testcommands,
 	sys.stdout,
 	menuprompt=g_menuprompt,
@@ -28,6 +28,7 @@
  */
 
 #include <unistd.h>
+#include <errno.h>
 #include <err.h>
 
 /*
@@ -36,6 +37,54 @@
  */
 
 
+/* Most bytes to ask copyfile for at once */
+#define COPYCHUNK (1024*1024)
+
+/*
+ * Copy a regular file with copyfile, one run of data at a time, going
+ * from each to the next with lseek SEEK_DATA and SEEK_HOLE so that
+ * the holes aren't read or written and the copy comes out as sparse
+ * as the original. Then set the size, for a hole at the end. Returns
+ * 0, or -1 with errno set; if it's EINVAL, ENOSYS or ESPIPE, nothing
+ * has been copied and it should be done by hand.
+ */
+static
+int
+copy_sparse(int fromfd, int tofd)
+{
+	off_t size, data, hole;
+	int len;
+
+	size = lseek(fromfd, 0, SEEK_END);
+	if (size < 0) {
+		return -1;
+	}
+	data = 0;
+	while ((data = lseek(fromfd, data, SEEK_DATA)) >= 0) {
+		hole = lseek(fromfd, data, SEEK_HOLE);
+		if (hole < 0 || lseek(fromfd, data, SEEK_SET) < 0 ||
+		    lseek(tofd, data, SEEK_SET) < 0) {
+			return -1;
+		}
+		while (data < hole) {
+			len = copyfile(fromfd, tofd, hole - data < COPYCHUNK ?
+				       hole - data : COPYCHUNK);
+			if (len < 0) {
+				return -1;
+			}
+			if (len == 0) {
+				/* Cut short under us; that's the end */
+				return 0;
+			}
+			data += len;
+		}
+	}
+	if (errno != ENXIO) {
+		return -1;
+	}
+	return ftruncate(tofd, size);
+}
+
 /* Copy one file to another. */
 static
 void
@@ -58,6 +107,21 @@ copy(const char *from, const char *to)
 		err(1, "%s", to);
 	}
 
+	/*
+	 * Between regular files, let the kernel do the copying, a
+	 * big chunk per call, skipping holes. It refuses (EINVAL)
+	 * anything else, such as the console or a pipe, and then we
+	 * do it by hand.
+	 */
+	if (copy_sparse(fromfd, tofd) == 0) {
+		goto done;
+	}
+	if (errno != EINVAL && errno != ENOSYS && errno != ESPIPE) {
+		err(1, "%s to %s", from, to);
+	}
+	/* Back to the start, if looking for data moved us along */
+	(void)lseek(fromfd, 0, SEEK_SET);
+
 	/*
 	 * As long as we get more than zero bytes, we haven't hit EOF.
 	 * Zero means EOF. Less than zero means an error occurred.
@@ -85,6 +149,7 @@ copy(const char *from, const char *to)
 		err(1, "%s", from);
 	}
 
+ done:
 	if (close(fromfd) < 0) {
 		err(1, "%s: close", from);
 	}
@@ -29,11 +29,13 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 #include <err.h>
+#include <forkserver.h>
 
 /*
  * ls - list files.
@@ -132,45 +134,28 @@ printheader(const char *file)
  */
 static
 void
-print(const char *path)
+printstat(const char *file, const struct stat *sb)
 {
-	struct stat statbuf;
-	const char *file;
 	int typech;
 
-	if (lopt || sopt) {
-		int fd;
-
-		fd = open(path, O_RDONLY);
-		if (fd<0) {
-			err(1, "%s", path);
-		}
-		if (fstat(fd, &statbuf)<0) {
-			err(1, "%s: fstat", path);
-		}
-		close(fd);
-	}
-
-	file = basename(path);
-
 	if (sopt) {
-		printf("%3d ", statbuf.st_blocks);
+		printf("%3d ", sb->st_blocks);
 	}
 
 	if (lopt) {
-		if (S_ISREG(statbuf.st_mode)) {
+		if (S_ISREG(sb->st_mode)) {
 			typech = '-';
 		}
-		else if (S_ISDIR(statbuf.st_mode)) {
+		else if (S_ISDIR(sb->st_mode)) {
 			typech = 'd';
 		}
-		else if (S_ISLNK(statbuf.st_mode)) {
+		else if (S_ISLNK(sb->st_mode)) {
 			typech = 'l';
 		}
-		else if (S_ISCHR(statbuf.st_mode)) {
+		else if (S_ISCHR(sb->st_mode)) {
 			typech = 'c';
 		}
-		else if (S_ISBLK(statbuf.st_mode)) {
+		else if (S_ISBLK(sb->st_mode)) {
 			typech = 'b';
 		}
 		else {
@@ -179,12 +164,62 @@ print(const char *path)
 
 		printf("%crwx------ %2d root  %-7llu ",
 		       typech,
-		       statbuf.st_nlink,
-		       statbuf.st_size);
+		       sb->st_nlink,
+		       sb->st_size);
 	}
 	printf("%s\n", file);
 }
 
+/*
+ * Show a single file, given its path.
+ */
+static
+void
+print(const char *path)
+{
+	struct stat statbuf;
+
+	if (lopt || sopt) {
+		int fd;
+
+		fd = open(path, O_RDONLY);
+		if (fd<0) {
+			err(1, "%s", path);
+		}
+		if (fstat(fd, &statbuf)<0) {
+			err(1, "%s: fstat", path);
+		}
+		close(fd);
+	}
+
+	printstat(basename(path), &statbuf);
+}
+
+/*
+ * List an open directory with getdirentries_plus, which hands back
+ * the stat information with the names. Returns -1 with errno ENOSYS
+ * if the file system doesn't support that.
+ */
+static
+int
+listdirplus(int fd)
+{
+	/* The records contain off_t; keep the buffer aligned */
+	off_t buf[4096/sizeof(off_t)];
+	struct dirent_plus *dp;
+	ssize_t len, pos;
+
+	while ((len = getdirentries_plus(fd, buf, sizeof(buf))) > 0) {
+		for (pos = 0; pos < len; pos += dp->dp_reclen) {
+			dp = (struct dirent_plus *)((char *)buf + pos);
+			if (aopt || dp->dp_name[0]!='.') {
+				printstat(dp->dp_name, &dp->dp_stat);
+			}
+		}
+	}
+	return len < 0 ? -1 : 0;
+}
+
 /*
  * List a directory.
  */
@@ -193,9 +228,11 @@ void
 listdir(const char *path, int showheader)
 {
 	int fd;
-	char buf[1024];
+	/* The records contain off_t; keep the buffer aligned */
+	off_t buf[1024/sizeof(off_t)];
 	char newpath[1024];
-	ssize_t len;
+	struct dirent *d;
+	ssize_t len, pos;
 
 	if (showheader) {
 		printheader(path);
@@ -210,21 +247,34 @@ listdir(const char *path, int showheader)
 	}
 
 	/*
-	 * List the directory.
+	 * List the directory. For a long listing, get the stat
+	 * information along with the names if we can.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
+	if (lopt || sopt) {
+		if (listdirplus(fd) == 0) {
+			close(fd);
+			return;
+		}
+		if (errno != ENOSYS) {
+			err(1, "%s: getdirentries_plus", path);
+		}
+	}
+	while ((len = getdents(fd, buf, sizeof(buf))) > 0) {
+		for (pos = 0; pos < len; pos += d->d_reclen) {
+			d = (struct dirent *)((char *)buf + pos);
 
-		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+			/* Assemble the full name of the new item */
+			snprintf(newpath, sizeof(newpath), "%s/%s",
+				 path, d->d_name);
 
-		if (aopt || buf[0]!='.') {
-			/* Print it */
-			print(newpath);
+			if (aopt || d->d_name[0]!='.') {
+				/* Print it */
+				print(newpath);
+			}
 		}
 	}
 	if (len<0) {
-		err(1, "%s: getdirentry", path);
+		err(1, "%s: getdents", path);
 	}
 
 	/* Done */
@@ -236,9 +286,10 @@ void
 recursedir(const char *path)
 {
 	int fd;
-	char buf[1024];
+	off_t buf[1024/sizeof(off_t)];
 	char newpath[1024];
-	int len;
+	struct dirent *d;
+	ssize_t len, pos;
 
 	/*
 	 * Open it.
@@ -251,29 +302,33 @@ recursedir(const char *path)
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
+	while ((len = getdents(fd, buf, sizeof(buf))) > 0) {
+		for (pos = 0; pos < len; pos += d->d_reclen) {
+			d = (struct dirent *)((char *)buf + pos);
 
-		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+			/* Assemble the full name of the new item */
+			snprintf(newpath, sizeof(newpath), "%s/%s",
+				 path, d->d_name);
 
-		if (!aopt && buf[0]=='.') {
-			/* skip this one */
-			continue;
-		}
+			if (!aopt && d->d_name[0]=='.') {
+				/* skip this one */
+				continue;
+			}
 
-		if (!strcmp(buf, ".") || !strcmp(buf, "..")) {
-			/* always skip these */
-			continue;
-		}
+			if (!strcmp(d->d_name, ".") ||
+			    !strcmp(d->d_name, "..")) {
+				/* always skip these */
+				continue;
+			}
 
-		if (!isdir(newpath)) {
-			continue;
-		}
+			if (!isdir(newpath)) {
+				continue;
+			}
 
-		listdir(newpath, 1 /*showheader*/);
-		if (Ropt) {
-			recursedir(newpath);
+			listdir(newpath, 1 /*showheader*/);
+			if (Ropt) {
+				recursedir(newpath);
+			}
 		}
 	}
 	if (len<0) {
@@ -303,6 +358,9 @@ main(int argc, char *argv[])
 {
 	int i,j, items=0;
 
+	/* sh may keep us as a helper; see forkserver.h */
+	forkserver_serve(&argc, &argv);
+
 	/*
 	 * Go through the arguments and count how many non-option args.
 	 */
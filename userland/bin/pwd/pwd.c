@@ -32,6 +32,7 @@
 #include <string.h>
 #include <err.h>
 #include <limits.h>
+#include <forkserver.h>
 
 /*
  * pwd - print working directory.
@@ -42,10 +43,13 @@
  */
 
 int
-main(void)
+main(int argc, char *argv[])
 {
 	char buf[PATH_MAX+1], *p;
 
+	/* sh may keep us as a helper; see forkserver.h */
+	forkserver_serve(&argc, &argv);
+
 	p = getcwd(buf, sizeof(buf));
 	if (p == NULL) {
 		err(1, ".");
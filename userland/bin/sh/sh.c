@@ -31,12 +31,15 @@
  * sh - shell
  *
  * Usage:
- *     sh
- *     sh -c command
+ *     sh [-p]
+ *     sh [-p] -c command
+ *
+ * -p starts helpers for the most common commands; see "pool" below.
  */
 
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <assert.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -45,9 +48,13 @@
 #include <limits.h>
 #include <errno.h>
 #include <err.h>
+#include <spawn.h>
 
 #ifdef HOST
+#include <sys/resource.h>
 #include "hostcompat.h"
+#else
+#include <forkserver.h>
 #endif
 
 #ifndef NARG_MAX
@@ -58,6 +65,9 @@
 /* avoid making this unreasonably large; causes problems under dumbvm */
 #define CMDLINE_MAX 4096
 
+/* most commands in one pipeline */
+#define MAXPIPE 16
+
 /* struct to (portably) hold exit info */
 struct exitinfo {
 	unsigned val:8,
@@ -75,16 +85,16 @@ static pid_t bgpids[MAXBG];
 
 /*
  * can_bg
- * just checks for an open slot.
+ * just checks for N open slots.
  */
 static
 int
-can_bg(void)
+can_bg(int n)
 {
 	int i;
 
 	for (i = 0; i < MAXBG; i++) {
-		if (bgpids[i] == 0) {
+		if (bgpids[i] == 0 && --n == 0) {
 			return 1;
 		}
 	}
@@ -340,6 +350,433 @@ cmd_exit(int ac, char *av[], struct exitinfo *ei)
 	exit(code);
 }
 
+/*
+ * command hashing
+ * remembers where each command was found on $PATH, so that running it
+ * again is one spawn rather than a failed try per directory before it.
+ * filled in as commands are run; an entry is dropped if spawning from
+ * it fails, and "rehash" (or "hash -r") drops them all, for when
+ * programs have been added or moved.
+ */
+#define NHASH 64
+
+struct cmdhash {
+	char *name;
+	char *path;
+	struct cmdhash *next;
+};
+
+static struct cmdhash *cmdhashtab[NHASH];
+
+/* libc has no strdup */
+static
+char *
+copystring(const char *str)
+{
+	char *ret;
+
+	ret = malloc(strlen(str) + 1);
+	if (ret != NULL) {
+		strcpy(ret, str);
+	}
+	return ret;
+}
+
+static
+unsigned
+cmdhash_bucket(const char *name)
+{
+	unsigned h = 0;
+
+	while (*name) {
+		h = h*31 + (unsigned char)*name++;
+	}
+	return h % NHASH;
+}
+
+/*
+ * look for NAME along $PATH the way posix_spawnp would, but with stat
+ * rather than by trying to run it. returns the path (in the hash
+ * table), or NULL if there's nothing runnable-looking or we're out of
+ * memory, in which case let posix_spawnp sort it out.
+ */
+static
+const char *
+cmdhash_lookup(const char *name)
+{
+	struct cmdhash *ch;
+	const char *searchpath, *s, *t;
+	char progpath[PATH_MAX];
+	struct stat st;
+	unsigned b;
+	size_t len;
+
+	b = cmdhash_bucket(name);
+	for (ch = cmdhashtab[b]; ch != NULL; ch = ch->next) {
+		if (!strcmp(ch->name, name)) {
+			return ch->path;
+		}
+	}
+
+	searchpath = getenv("PATH");
+	if (searchpath == NULL) {
+		return NULL;
+	}
+	for (s = searchpath; s != NULL; s = t) {
+		t = strchr(s, ':');
+		if (t != NULL) {
+			len = t - s;
+			t++;
+		}
+		else {
+			len = strlen(s);
+		}
+		if (len == 0 || len >= sizeof(progpath)) {
+			continue;
+		}
+		memcpy(progpath, s, len);
+		snprintf(progpath + len, sizeof(progpath) - len, "/%s", name);
+		if (stat(progpath, &st) == 0 && S_ISREG(st.st_mode)) {
+			break;
+		}
+	}
+	if (s == NULL) {
+		return NULL;
+	}
+
+	ch = malloc(sizeof(*ch));
+	if (ch == NULL) {
+		return NULL;
+	}
+	ch->name = copystring(name);
+	ch->path = copystring(progpath);
+	if (ch->name == NULL || ch->path == NULL) {
+		free(ch->name);
+		free(ch->path);
+		free(ch);
+		return NULL;
+	}
+	ch->next = cmdhashtab[b];
+	cmdhashtab[b] = ch;
+	return ch->path;
+}
+
+/* drop NAME's entry, if any */
+static
+void
+cmdhash_forget(const char *name)
+{
+	struct cmdhash **chp, *ch;
+
+	for (chp = &cmdhashtab[cmdhash_bucket(name)]; *chp != NULL;
+	     chp = &(*chp)->next) {
+		ch = *chp;
+		if (!strcmp(ch->name, name)) {
+			*chp = ch->next;
+			free(ch->name);
+			free(ch->path);
+			free(ch);
+			return;
+		}
+	}
+}
+
+/* drop every entry */
+static
+void
+cmdhash_clear(void)
+{
+	struct cmdhash *ch;
+	unsigned i;
+
+	for (i=0; i<NHASH; i++) {
+		while (cmdhashtab[i] != NULL) {
+			ch = cmdhashtab[i];
+			cmdhashtab[i] = ch->next;
+			free(ch->name);
+			free(ch->path);
+			free(ch);
+		}
+	}
+}
+
+/*
+ * hash, rehash
+ * "hash" lists the remembered commands; "hash -r" and "rehash" forget
+ * them all.
+ */
+static
+void
+cmd_hash(int ac, char *av[], struct exitinfo *ei)
+{
+	struct cmdhash *ch;
+	unsigned i;
+
+	if (ac == 1 && !strcmp(av[0], "rehash")) {
+		cmdhash_clear();
+		exitinfo_exit(ei, 0);
+		return;
+	}
+	if (ac == 2 && !strcmp(av[1], "-r")) {
+		cmdhash_clear();
+		exitinfo_exit(ei, 0);
+		return;
+	}
+	if (ac == 1) {
+		for (i=0; i<NHASH; i++) {
+			for (ch = cmdhashtab[i]; ch != NULL; ch = ch->next) {
+				printf("%s\t%s\n", ch->name, ch->path);
+			}
+		}
+		exitinfo_exit(ei, 0);
+		return;
+	}
+	printf("Usage: hash [-r]\n");
+	exitinfo_exit(ei, 1);
+}
+
+#ifndef HOST
+/*
+ * helper pool
+ * the shell can keep a helper process (see forkserver.h) for each of
+ * a few commands, and run a plain foreground command that has one
+ * through it instead of spawning it: the program is loaded once, and
+ * each run after that is only a fork of it. pipelines and background
+ * jobs are still spawned, since a helper can only give the command
+ * the shell's own stdin and stdout. "sh -p" starts helpers for
+ * pool_defaults.
+ *
+ * nothing else we start may hold the pool's pipe ends, or a helper
+ * wouldn't see EOF when we close them; there's no close-on-exec, so
+ * pool_closefds adds closes for them to each spawn's file actions.
+ */
+#define POOLMAX 4
+
+struct poolent {
+	char *name;
+	struct forkserver fs;
+};
+
+static struct poolent pool[POOLMAX];
+static int npool;
+
+static const char *const pool_defaults[] = { "ls", "cat", "pwd", NULL };
+
+static
+int
+pool_closefds(posix_spawn_file_actions_t *fa)
+{
+	int i, result;
+
+	for (i=0; i<npool; i++) {
+		result = posix_spawn_file_actions_addclose(fa,
+							   pool[i].fs.fs_reqfd);
+		if (result) {
+			return result;
+		}
+		result = posix_spawn_file_actions_addclose(fa,
+							   pool[i].fs.fs_replyfd);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+static
+struct poolent *
+pool_find(const char *name)
+{
+	int i;
+
+	for (i=0; i<npool; i++) {
+		if (!strcmp(pool[i].name, name)) {
+			return &pool[i];
+		}
+	}
+	return NULL;
+}
+
+/* start a helper for NAME; returns 0 or an error number */
+static
+int
+pool_start(const char *name)
+{
+	posix_spawn_file_actions_t fa;
+	struct poolent *pe;
+	const char *path;
+	int result;
+
+	if (pool_find(name) != NULL) {
+		return 0;
+	}
+	if (npool >= POOLMAX) {
+		return ENOSPC;
+	}
+	path = strchr(name, '/') != NULL ? name : cmdhash_lookup(name);
+	if (path == NULL) {
+		return ENOENT;
+	}
+
+	pe = &pool[npool];
+	pe->name = copystring(name);
+	if (pe->name == NULL) {
+		return ENOMEM;
+	}
+	posix_spawn_file_actions_init(&fa);
+	result = pool_closefds(&fa);
+	if (result == 0) {
+		result = forkserver_start(&pe->fs, path, &fa);
+	}
+	posix_spawn_file_actions_destroy(&fa);
+	if (result) {
+		free(pe->name);
+		return result;
+	}
+	npool++;
+	return 0;
+}
+
+/* stop PE's helper and drop it */
+static
+void
+pool_stop(struct poolent *pe)
+{
+	forkserver_stop(&pe->fs);
+	free(pe->name);
+	*pe = pool[--npool];
+}
+
+/*
+ * run ARGV with its helper, if it has one, and return true; or
+ * return false to have it spawned instead. a helper that fails is
+ * dropped.
+ */
+static
+int
+pool_run(char **argv, struct exitinfo *ei)
+{
+	struct poolent *pe;
+	int status, result;
+
+	pe = pool_find(argv[0]);
+	if (pe == NULL) {
+		return 0;
+	}
+	result = forkserver_run(&pe->fs, argv, &status);
+	if (result) {
+		errno = result;
+		warn("%s: helper", argv[0]);
+		pool_stop(pe);
+		return 0;
+	}
+	readstatus(status, ei);
+	return 1;
+}
+
+/*
+ * pool
+ * "pool" lists the helpers, "pool cmd..." starts helpers for the
+ * commands, and "pool -r" stops them all.
+ */
+static
+void
+cmd_pool(int ac, char *av[], struct exitinfo *ei)
+{
+	int i, result;
+
+	if (ac == 1) {
+		for (i=0; i<npool; i++) {
+			printf("%s\tpid %d\n", pool[i].name,
+			       pool[i].fs.fs_pid);
+		}
+		exitinfo_exit(ei, 0);
+		return;
+	}
+	if (ac == 2 && !strcmp(av[1], "-r")) {
+		while (npool > 0) {
+			pool_stop(&pool[npool-1]);
+		}
+		exitinfo_exit(ei, 0);
+		return;
+	}
+	exitinfo_exit(ei, 0);
+	for (i=1; i<ac; i++) {
+		result = pool_start(av[i]);
+		if (result) {
+			errno = result;
+			warn("pool: %s", av[i]);
+			exitinfo_exit(ei, 1);
+		}
+	}
+}
+#endif /* HOST */
+
+static void runcommand(int nargs, char **args, struct exitinfo *ei);
+
+/* milliseconds from A to B */
+static
+unsigned long
+tvdiff(const struct timeval *a, const struct timeval *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1000UL +
+		(b->tv_usec - a->tv_usec) / 1000L;
+}
+
+/*
+ * time
+ * runs the rest of the line as a command, then reports the wall clock
+ * time it took and, from getrusage, the cpu time, page faults, context
+ * switches and file system blocks of the processes waited for.
+ */
+static
+void
+cmd_time(int ac, char *av[], struct exitinfo *ei)
+{
+	struct rusage before, after;
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs, real, user, sys;
+
+	if (ac < 2) {
+		printf("Usage: time command [args...]\n");
+		exitinfo_exit(ei, 1);
+		return;
+	}
+	if (!strcmp(av[ac-1], "&")) {
+		printf("time: Cannot time a background job\n");
+		exitinfo_exit(ei, 1);
+		return;
+	}
+	if (getrusage(RUSAGE_CHILDREN, &before) < 0 ||
+	    __time(&startsecs, &startnsecs) < 0) {
+		warn("time");
+		exitinfo_exit(ei, 1);
+		return;
+	}
+
+	runcommand(ac-1, av+1, ei);
+
+	__time(&endsecs, &endnsecs);
+	getrusage(RUSAGE_CHILDREN, &after);
+
+	real = (endsecs - startsecs) * 1000UL +
+		((long)endnsecs - (long)startnsecs) / 1000000L;
+	user = tvdiff(&before.ru_utime, &after.ru_utime);
+	sys = tvdiff(&before.ru_stime, &after.ru_stime);
+	fprintf(stderr, "%8lu.%03lu real %8lu.%03lu user %8lu.%03lu sys\n",
+		real / 1000, real % 1000, user / 1000, user % 1000,
+		sys / 1000, sys % 1000);
+	fprintf(stderr, "%12lu minor faults %8lu major faults\n",
+		(unsigned long)(after.ru_minflt - before.ru_minflt),
+		(unsigned long)(after.ru_majflt - before.ru_majflt));
+	fprintf(stderr, "%12lu voluntary %11lu involuntary context switches\n",
+		(unsigned long)(after.ru_nvcsw - before.ru_nvcsw),
+		(unsigned long)(after.ru_nivcsw - before.ru_nivcsw));
+	fprintf(stderr, "%12lu blocks read %9lu blocks written\n",
+		(unsigned long)(after.ru_inblock - before.ru_inblock),
+		(unsigned long)(after.ru_oublock - before.ru_oublock));
+}
+
 /*
  * a struct of the builtins associates the builtin name with the function that
  * executes it.  they must all take an argc and argv.
@@ -351,48 +788,129 @@ static struct {
 	{ "cd",    cmd_chdir },
 	{ "chdir", cmd_chdir },
 	{ "exit",  cmd_exit },
+	{ "hash",  cmd_hash },
+#ifndef HOST
+	{ "pool",  cmd_pool },
+#endif
+	{ "rehash", cmd_hash },
+	{ "time",  cmd_time },
 	{ "wait",  cmd_wait },
 	{ NULL, NULL }
 };
 
 /*
- * docommand
- * tokenizes the command line using strtok.  if there aren't any commands,
- * simply returns.  checks to see if it's a builtin, running it if it is.
- * otherwise, it's a standard command.  check for the '&', try to background
- * the job if possible, otherwise just run it and wait on it.
+ * spawncmd
+ * spawns ARGV with file actions FA, from where the hash table says
+ * if it knows, and otherwise by searching $PATH. if the remembered
+ * place no longer works, forgets it and searches.
  */
 static
-void
-docommand(char *buf, struct exitinfo *ei)
+int
+spawncmd(pid_t *pid, char **argv, const posix_spawn_file_actions_t *fa)
 {
-	char *args[NARG_MAX + 1];
-	int nargs, i;
-	char *s;
-	pid_t pid;
-	int status;
-	int bg=0;
-	time_t startsecs, endsecs;
-	unsigned long startnsecs, endnsecs;
+	const char *path;
+	int result;
 
-	nargs = 0;
-	for (s = strtok(buf, " \t\r\n"); s; s = strtok(NULL, " \t\r\n")) {
-		if (nargs >= NARG_MAX) {
-			printf("%s: Too many arguments "
-			       "(exceeds system limit)\n",
-			       args[0]);
-			exitinfo_exit(ei, 1);
-			return;
+	if (strchr(argv[0], '/') == NULL) {
+		path = cmdhash_lookup(argv[0]);
+		if (path != NULL) {
+			result = posix_spawn(pid, path, fa, NULL, argv, NULL);
+			switch (result) {
+			    case ENOENT:
+			    case ENOTDIR:
+			    case ENOEXEC:
+				/* stale; look again */
+				cmdhash_forget(argv[0]);
+				break;
+			    default:
+				return result;
+			}
 		}
-		args[nargs++] = s;
 	}
-	args[nargs] = NULL;
+	return posix_spawnp(pid, argv[0], fa, NULL, argv, NULL);
+}
 
-	if (nargs==0) {
-		/* empty line */
-		exitinfo_exit(ei, 0);
-		return;
+/*
+ * spawnpipeline
+ * starts each of the NCMDS commands in CMDS, connecting the output of
+ * each to the input of the next with a pipe, and puts their pids in
+ * PIDS.  returns how many were started; if that's short, the ones
+ * that did start have lost their neighbours' ends of the pipes and
+ * will see EOF or EPIPE.
+ */
+static
+int
+spawnpipeline(char **cmds[], int ncmds, pid_t pids[])
+{
+	posix_spawn_file_actions_t fa;
+	int fds[2], infd, n, result;
+
+	infd = -1;
+	for (n = 0; n < ncmds; n++) {
+		fds[0] = fds[1] = -1;
+		if (n < ncmds - 1 && pipe(fds) < 0) {
+			warn("pipe");
+			break;
+		}
+
+		/* in the child, move the pipe ends into place */
+		posix_spawn_file_actions_init(&fa);
+#ifndef HOST
+		pool_closefds(&fa);
+#endif
+		if (infd >= 0) {
+			posix_spawn_file_actions_adddup2(&fa, infd,
+							 STDIN_FILENO);
+			posix_spawn_file_actions_addclose(&fa, infd);
+		}
+		if (fds[1] >= 0) {
+			posix_spawn_file_actions_adddup2(&fa, fds[1],
+							 STDOUT_FILENO);
+			posix_spawn_file_actions_addclose(&fa, fds[1]);
+			posix_spawn_file_actions_addclose(&fa, fds[0]);
+		}
+		result = spawncmd(&pids[n], cmds[n], &fa);
+		posix_spawn_file_actions_destroy(&fa);
+
+		/* the children have these now */
+		if (infd >= 0) {
+			close(infd);
+		}
+		if (fds[1] >= 0) {
+			close(fds[1]);
+		}
+		infd = fds[0];
+
+		if (result) {
+			errno = result;
+			warn("%s", cmds[n][0]);
+			break;
+		}
+	}
+	if (infd >= 0) {
+		close(infd);
 	}
+	return n;
+}
+
+/*
+ * runcommand
+ * runs the command in ARGS.  checks to see if it's a builtin, running it
+ * if it is.  otherwise, it's a standard command.  check for the '&', try
+ * to background the job if possible, split it at any '|' into a pipeline,
+ * otherwise just run it and wait on it.
+ */
+static
+void
+runcommand(int nargs, char **args, struct exitinfo *ei)
+{
+	char **cmds[MAXPIPE];
+	pid_t pids[MAXPIPE];
+	int ncmds, nstarted, i;
+	int status;
+	int bg=0;
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs;
 
 	for (i=0; builtins[i].name; i++) {
 		if (!strcmp(builtins[i].name, args[0])) {
@@ -405,62 +923,88 @@ docommand(char *buf, struct exitinfo *ei)
 
 	if (nargs > 0 && !strcmp(args[nargs-1], "&")) {
 		/* background */
-		if (!can_bg()) {
-			printf("%s: Too many background jobs; wait for "
-			       "some to finish before starting more\n",
-			       args[0]);
-			exitinfo_exit(ei, 1);
-			return;
-		}
 		nargs--;
 		args[nargs] = NULL;
 		bg = 1;
 	}
 
+	/* split into a pipeline */
+	ncmds = 0;
+	cmds[ncmds++] = args;
+	for (i=0; i<nargs; i++) {
+		if (!strcmp(args[i], "|")) {
+			if (ncmds >= MAXPIPE) {
+				printf("%s: Too many commands in pipeline\n",
+				       args[0]);
+				exitinfo_exit(ei, 1);
+				return;
+			}
+			args[i] = NULL;
+			cmds[ncmds++] = &args[i+1];
+		}
+	}
+	for (i=0; i<ncmds; i++) {
+		if (cmds[i][0] == NULL) {
+			printf("%s: Missing command in pipeline\n", args[0]);
+			exitinfo_exit(ei, 1);
+			return;
+		}
+	}
+
+	if (bg && !can_bg(ncmds)) {
+		printf("%s: Too many background jobs; wait for "
+		       "some to finish before starting more\n",
+		       args[0]);
+		exitinfo_exit(ei, 1);
+		return;
+	}
+
 	if (timing) {
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			exitinfo_exit(ei, 255);
-			return;
-		case 0:
-			/* child */
-			execvp(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
-			break;
+#ifndef HOST
+	if (ncmds == 1 && !bg && pool_run(args, ei)) {
+		goto done;
 	}
+#endif
+
+	/*
+	 * Spawn rather than fork and exec, so as not to copy our
+	 * address space only for the child to throw it away.
+	 */
+	nstarted = spawnpipeline(cmds, ncmds, pids);
 
 	/* parent */
 	if (bg) {
-		/* background this command */
-		remember_bg(pid);
-		printf("[%d] %s ... &\n", pid, args[0]);
+		/* background this job */
+		for (i=0; i<nstarted; i++) {
+			remember_bg(pids[i]);
+		}
+		if (nstarted < ncmds) {
+			exitinfo_exit(ei, 1);
+			return;
+		}
+		printf("[%d] %s ... &\n", pids[ncmds-1], args[0]);
 		exitinfo_exit(ei, 0);
 		return;
 	}
 
-	if (waitpid(pid, &status, 0) < 0) {
-		warn("waitpid");
-		exitinfo_exit(ei, 255);
-	}
-	else {
-		readstatus(status, ei);
+	/* the pipeline's status is that of its last command */
+	exitinfo_exit(ei, 1);
+	for (i=0; i<nstarted; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			warn("waitpid");
+			exitinfo_exit(ei, 255);
+		}
+		else if (i == ncmds-1) {
+			readstatus(status, ei);
+		}
 	}
 
+#ifndef HOST
+ done:
+#endif
 	if (timing) {
 		__time(&endsecs, &endnsecs);
 		if (endnsecs < startnsecs) {
@@ -474,6 +1018,41 @@ docommand(char *buf, struct exitinfo *ei)
 	}
 }
 
+/*
+ * docommand
+ * tokenizes the command line using strtok.  if there aren't any commands,
+ * simply returns; otherwise runs it.
+ */
+static
+void
+docommand(char *buf, struct exitinfo *ei)
+{
+	char *args[NARG_MAX + 1];
+	int nargs;
+	char *s;
+
+	nargs = 0;
+	for (s = strtok(buf, " \t\r\n"); s; s = strtok(NULL, " \t\r\n")) {
+		if (nargs >= NARG_MAX) {
+			printf("%s: Too many arguments "
+			       "(exceeds system limit)\n",
+			       args[0]);
+			exitinfo_exit(ei, 1);
+			return;
+		}
+		args[nargs++] = s;
+	}
+	args[nargs] = NULL;
+
+	if (nargs==0) {
+		/* empty line */
+		exitinfo_exit(ei, 0);
+		return;
+	}
+
+	runcommand(nargs, args, ei);
+}
+
 /*
  * getcmd
  * pulls valid characters off the console, filling the buffer.
@@ -559,16 +1138,33 @@ check_timing(void)
 /*
  * main
  * if there are no arguments, run interactively, otherwise, run a program
- * from within the shell, but immediately exit.
+ * from within the shell, but immediately exit. -p first starts the
+ * default helper pool.
  */
 int
 main(int argc, char *argv[])
 {
+#ifndef HOST
+	int i;
+#endif
+
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 	check_timing();
 
+	if (argc > 1 && !strcmp(argv[1], "-p")) {
+#ifndef HOST
+		for (i=0; pool_defaults[i] != NULL; i++) {
+			if (pool_start(pool_defaults[i]) != 0) {
+				warnx("pool: %s: not started", pool_defaults[i]);
+			}
+		}
+#endif
+		argc--;
+		argv++;
+	}
+
 	/*
 	 * Allow argc to be 0 in case we're running on a broken kernel,
 	 * or one that doesn't set argv when starting the first shell.
@@ -585,7 +1181,7 @@ main(int argc, char *argv[])
 		}
 	}
 	else {
-		errx(1, "Usage: sh [-c command]");
+		errx(1, "Usage: sh [-p] [-c command]");
 	}
 	return 0;
 }
@@ -31,10 +31,14 @@
  * tac - print file backwards line by line (reverse cat)
  * usage: tac [files]
  *
- * This implementation copies the input to a scratch file, using a
- * second scratch file to keep notes, and then prints the scratch file
- * backwards. This is inefficient, but has the side effect of testing
- * the behavior of scratch files that have been unlinked.
+ * A single input that can be seeked on is read straight from its end
+ * with revread (see <test/revread.h>), a chunk at a time backwards.
+ *
+ * Anything else (several files, or a pipe) is copied to a scratch
+ * file, using a second scratch file to keep notes, and then the
+ * scratch file is printed backwards. This is inefficient, but has the
+ * side effect of testing the behavior of scratch files that have been
+ * unlinked.
  *
  * Note that if the remove system call isn't implemented, unlinking
  * the scratch files will fail and the scratch files will get left
@@ -42,9 +46,10 @@
  * complain about this.
  *
  * This program uses these system calls:
- *    getpid open read write lseek close remove _exit
+ *    getpid open read pread write lseek fadvise close remove _exit
  */
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -52,6 +57,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <err.h>
+#include <test/revread.h>
 
 struct indexentry {
 	off_t pos;
@@ -63,26 +69,6 @@ static char dataname[64], indexname[64];
 
 static char buf[4096];
 
-////////////////////////////////////////////////////////////
-// string ops
-
-/* this is standard and should go into libc */
-static
-void *
-memchr(const void *buf, int ch, size_t buflen)
-{
-	const unsigned char *ubuf = buf;
-	size_t i;
-
-	for (i=0; i<buflen; i++) {
-		if (ubuf[i] == ch) {
-			/* this must launder const */
-			return (void *)(ubuf + i);
-		}
-	}
-	return NULL;
-}
-
 ////////////////////////////////////////////////////////////
 // syscall wrappers
 
@@ -224,6 +210,71 @@ dumpdata(void)
 	}
 }
 
+////////////////////////////////////////////////////////////
+// reading backwards in place
+
+/*
+ * Print the file backwards without copying it, if it can be read
+ * backwards at all; returns false, having read nothing, if not.
+ */
+static
+bool
+reversefile(const char *name)
+{
+	struct revread rr;
+	const char *line;
+	ssize_t len;
+	size_t outlen;
+	int fd;
+
+	if (name == NULL || !strcmp(name, "-")) {
+		name = "stdin";
+		fd = STDIN_FILENO;
+	}
+	else {
+		fd = open(name, O_RDONLY);
+		if (fd < 0) {
+			err(1, "%s", name);
+		}
+	}
+
+	if (revread_init(&rr, fd) < 0) {
+		if (errno != ESPIPE) {
+			err(1, "%s", name);
+		}
+		if (fd != STDIN_FILENO) {
+			close(fd);
+		}
+		return false;
+	}
+
+	/* collect lines in buf so short ones don't each cost a write */
+	outlen = 0;
+	while ((len = revread_line(&rr, &line)) > 0) {
+		if (outlen + len > sizeof(buf)) {
+			dowrite(STDOUT_FILENO, "stdout", buf, outlen);
+			outlen = 0;
+		}
+		if ((size_t)len > sizeof(buf)) {
+			dowrite(STDOUT_FILENO, "stdout", line, len);
+		}
+		else {
+			memcpy(buf + outlen, line, len);
+			outlen += len;
+		}
+	}
+	if (len < 0) {
+		err(1, "%s", name);
+	}
+	dowrite(STDOUT_FILENO, "stdout", buf, outlen);
+
+	revread_fini(&rr);
+	if (fd != STDIN_FILENO) {
+		close(fd);
+	}
+	return true;
+}
+
 ////////////////////////////////////////////////////////////
 // main
 
@@ -274,6 +325,10 @@ main(int argc, char *argv[])
 {
 	int i;
 
+	if (argc <= 2 && reversefile(argc > 1 ? argv[1] : NULL)) {
+		return 0;
+	}
+
 	openfiles();
 
 	if (argc > 1) {
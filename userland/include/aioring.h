@@ -0,0 +1,20 @@
+/*
+ * Asynchronous I/O rings; see <kern/aioring.h> for how they work.
+ *
+ * aio_setup registers the rings described by PARAMS; a process has at
+ * most one pair. aio_enter submits up to TO_SUBMIT requests from the
+ * submission ring, then waits until at least MIN_COMPLETE completions
+ * have been posted (or nothing is left running). Returns how many
+ * requests were submitted, or -1 and sets errno.
+ */
+
+#ifndef _AIORING_H_
+#define _AIORING_H_
+
+#include <sys/types.h>
+#include <kern/aioring.h>
+
+int aio_setup(struct aio_params *params);
+int aio_enter(unsigned to_submit, unsigned min_complete);
+
+#endif /* _AIORING_H_ */
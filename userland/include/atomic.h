@@ -0,0 +1,71 @@
+/*
+ * Atomic operations, spinlocks and seqlocks for threads sharing
+ * memory, whether threads of one process or processes sharing a
+ * mapping.
+ *
+ *    atomic_add  - add N to *P; returns the new value.
+ *    atomic_cas  - if *P is OLD, make it NEW; returns what *P was,
+ *                  so it worked if that is OLD.
+ *    atomic_swap - make *P NEW; returns what it was.
+ *
+ * These are done with LL/SC (arch/mips/atomic-mips.S). Memory is
+ * sequentially consistent on our machine, so the only reordering to
+ * worry about is the compiler's; each of these is a function call,
+ * which it can't move memory accesses across, and atomic_barrier
+ * is there for code in between.
+ *
+ * A spinlock (struct spin) is a test-and-set lock that backs off,
+ * spinning twice as long each time it finds the lock held, up to a
+ * limit. Use it only where the lock is held briefly; anything longer
+ * wants a futex. spin_trylock returns true if it got the lock.
+ *
+ * A seqlock (struct seqlock) lets readers go without locking, for
+ * data that is read much more than written. A writer brackets its
+ * update with seq_writebegin and seq_writeend, which hold off other
+ * writers. A reader does
+ *
+ *    do {
+ *        seq = seq_readbegin(sq);
+ *        ...copy the data...
+ *    } while (seq_readretry(sq, seq));
+ *
+ * and must be prepared for the copy to be inconsistent (but not
+ * to act on it) until seq_readretry says it is fine.
+ */
+
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+#include <stdbool.h>
+
+#define atomic_barrier()	__asm volatile("" ::: "memory")
+
+int atomic_add(volatile int *p, int n);
+int atomic_cas(volatile int *p, int old, int new);
+int atomic_swap(volatile int *p, int new);
+
+struct spin {
+	volatile int s_held;
+};
+
+#define SPIN_INITIALIZER	{ 0 }
+
+void spin_init(struct spin *s);
+void spin_lock(struct spin *s);
+bool spin_trylock(struct spin *s);
+void spin_unlock(struct spin *s);
+
+struct seqlock {
+	volatile unsigned sq_seq;	/* odd while being written */
+	struct spin sq_lock;		/* for writers */
+};
+
+#define SEQLOCK_INITIALIZER	{ 0, SPIN_INITIALIZER }
+
+void seq_init(struct seqlock *sq);
+unsigned seq_readbegin(struct seqlock *sq);
+bool seq_readretry(struct seqlock *sq, unsigned seq);
+void seq_writebegin(struct seqlock *sq);
+void seq_writeend(struct seqlock *sq);
+
+#endif /* _ATOMIC_H_ */
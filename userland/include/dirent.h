@@ -0,0 +1,22 @@
+/*
+ * Listing directories.
+ *
+ * getdents fills BUF with struct dirent records (see kern/dirent.h),
+ * one per name in the open directory FILEHANDLE starting at its
+ * current offset, and returns the number of bytes used (0 at the end
+ * of the directory). Walk the records by d_reclen; the d_off of each
+ * is the offset to lseek to to carry on after it. This lists a
+ * directory a block or more per call, where getdirentry takes a call
+ * per name. Records hold an off_t, so BUF should be aligned for one.
+ */
+
+#ifndef _DIRENT_H_
+#define _DIRENT_H_
+
+#include <sys/types.h>
+#include <kern/stat.h>
+#include <kern/dirent.h>
+
+ssize_t getdents(int filehandle, void *buf, size_t buflen);
+
+#endif /* _DIRENT_H_ */
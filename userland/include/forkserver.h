@@ -0,0 +1,58 @@
+/*
+ * Fork servers: helper processes that run a program over and over
+ * without loading it again each time.
+ *
+ * A helper is the program itself, started with FORKSERVER_ARG and
+ * two pipes. It keeps a child forked and waiting for a request: an
+ * argv and the directory to run in. The child takes the request and
+ * goes on into main with it; when it exits, the helper sends back
+ * its wait status and forks the next one. So running the program is
+ * a pipe write and a fork of a process that is already loaded,
+ * instead of an exec.
+ *
+ * The child has the helper's stdin, stdout and stderr, which are the
+ * client's as they were when the helper was started; there is no way
+ * to hand it others. Nor is its usage counted in the client's
+ * RUSAGE_CHILDREN.
+ *
+ * A program can serve as a helper if the first thing its main does is
+ *
+ *	forkserver_serve(&argc, &argv);
+ *
+ * which returns at once unless the program was started as a helper,
+ * and otherwise returns only in a child, with the request's argv.
+ *
+ *    forkserver_start - start PATH as a helper, doing the file actions
+ *                       FA (which may be NULL) in it first.
+ *    forkserver_run   - run ARGV with the helper and wait for it,
+ *                       returning its wait status in STATUS.
+ *    forkserver_stop  - make the helper exit, and wait for it.
+ *
+ * Like posix_spawn, these return an error number rather than setting
+ * errno. If forkserver_run fails the helper is no good any more and
+ * should be stopped.
+ */
+
+#ifndef _FORKSERVER_H_
+#define _FORKSERVER_H_
+
+#include <sys/types.h>
+#include <spawn.h>
+
+/* argv[1] of a program started as a helper */
+#define FORKSERVER_ARG	"--forkserver-helper"
+
+struct forkserver {
+	pid_t fs_pid;		/* the helper */
+	int fs_reqfd;		/* we write requests here */
+	int fs_replyfd;		/* and read statuses here */
+};
+
+void forkserver_serve(int *argcp, char ***argvp);
+
+int forkserver_start(struct forkserver *fs, const char *path,
+		     const posix_spawn_file_actions_t *fa);
+int forkserver_run(struct forkserver *fs, char *const argv[], int *status);
+void forkserver_stop(struct forkserver *fs);
+
+#endif /* _FORKSERVER_H_ */
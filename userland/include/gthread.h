@@ -0,0 +1,51 @@
+/*
+ * Green threads: many lightweight threads of control ("gthreads")
+ * run on a few kernel threads ("workers"), switching between each
+ * other in user mode without a system call.
+ *
+ * gthread_run starts FUNC(ARG) as the first gthread, on NWORKERS
+ * workers: the calling thread and NWORKERS - 1 made with
+ * thread_create. It returns FUNC's value once every gthread has
+ * finished, or -1 and sets errno if it couldn't start (EINVAL for a
+ * bad NWORKERS, or already running).
+ *
+ * The rest may only be called from a gthread:
+ *
+ *    gthread_create - start FUNC(ARG) as a new gthread. Returns it,
+ *                     or NULL and sets errno (ENOMEM).
+ *    gthread_join   - wait for T to finish and return what its
+ *                     function returned. Every gthread must be joined
+ *                     once, which frees it.
+ *    gthread_exit   - finish the calling gthread, as if its function
+ *                     had returned STATUS.
+ *    gthread_yield  - let other gthreads run.
+ *    gthread_self   - the calling gthread.
+ *
+ * Each worker has its own run queue; new and yielding gthreads go on
+ * the current worker's, and a worker with nothing to do takes work
+ * from the others, then sleeps on a futex until there is some. A
+ * gthread that blocks in the kernel blocks its worker, so leave at
+ * least one worker per gthread that may do so.
+ *
+ * Each gthread has a stack of GTHREAD_STACKSIZE, which it must not
+ * overflow; the pages are only allocated as they are touched.
+ */
+
+#ifndef _GTHREAD_H_
+#define _GTHREAD_H_
+
+#include <sys/cdefs.h>
+
+#define GTHREAD_STACKSIZE	16384	/* a power of 2 */
+#define GTHREAD_MAXWORKERS	16
+
+struct gthread;
+
+int gthread_run(unsigned nworkers, int (*func)(void *), void *arg);
+struct gthread *gthread_create(int (*func)(void *), void *arg);
+int gthread_join(struct gthread *t);
+__DEAD void gthread_exit(int status);
+void gthread_yield(void);
+struct gthread *gthread_self(void);
+
+#endif /* _GTHREAD_H_ */
@@ -0,0 +1,28 @@
+/*
+ * Internet addresses, and converting to and from network byte order
+ * (big-endian).
+ */
+
+#ifndef _NETINET_IN_H_
+#define _NETINET_IN_H_
+
+#include <sys/types.h>
+#include <sys/endian.h>
+#include <kern/in.h>
+
+#if _BYTE_ORDER == _BIG_ENDIAN
+#define htons(x)	((__u16)(x))
+#define ntohs(x)	((__u16)(x))
+#define htonl(x)	((__u32)(x))
+#define ntohl(x)	((__u32)(x))
+#else
+#define htons(x)	((__u16)((((x) & 0xff) << 8) | (((x) >> 8) & 0xff)))
+#define ntohs(x)	htons(x)
+#define htonl(x)	((__u32)((((x) & 0xff) << 24) | \
+				    (((x) & 0xff00) << 8) | \
+				    (((x) >> 8) & 0xff00) | \
+				    (((x) >> 24) & 0xff)))
+#define ntohl(x)	htonl(x)
+#endif
+
+#endif /* _NETINET_IN_H_ */
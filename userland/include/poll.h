@@ -0,0 +1,20 @@
+/*
+ * Waiting on several file handles at once.
+ *
+ * poll checks each of the NFDS entries in FDS for the events asked
+ * for, and if none is ready sleeps until one is or until TIMEOUT
+ * milliseconds pass (forever if TIMEOUT is negative; not at all if
+ * it's 0). Returns how many entries have nonzero revents, 0 on
+ * timeout, or -1 and sets errno.
+ */
+
+#ifndef _POLL_H_
+#define _POLL_H_
+
+#include <kern/poll.h>
+
+typedef unsigned int nfds_t;
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout);
+
+#endif /* _POLL_H_ */
@@ -0,0 +1,59 @@
+/*
+ * Scheduling classes, CPU affinity and scheduling groups.
+ *
+ * sched_setscheduler puts the calling thread in a scheduling class:
+ * SCHED_OTHER (time-sharing, priority 0), or real-time SCHED_FIFO or
+ * SCHED_RR with a priority from SCHED_PRIO_MIN to SCHED_PRIO_MAX
+ * (highest). Real-time threads always run ahead of time-sharing ones.
+ * Raising a real-time priority past RLIMIT_RTPRIO is EPERM.
+ * sched_getscheduler returns the policy and sched_getparam the
+ * priority. Like the affinity calls, PID must be 0 or the caller's
+ * own, and the class is passed on to new threads and processes.
+ *
+ * sched_setaffinity restricts the calling thread to the cpus in MASK;
+ * threads and processes it creates afterwards start with the same
+ * mask. PID must be 0 or the caller's own pid. Cpus the machine
+ * doesn't have are ignored, but at least one cpu in MASK must exist.
+ * sched_getaffinity fills in MASK with the calling thread's cpus.
+ * SIZE is the size of MASK in bytes. Both return 0, or -1 and set
+ * errno.
+ *
+ * Time-sharing threads share the cpus between scheduling groups in
+ * proportion to each group's tickets, however many threads a group
+ * has. sched_setgroup moves the calling thread into GROUP, from 0 to
+ * SCHED_NGROUPS - 1; new threads and processes start in their
+ * creator's. Everything starts in group 0, which is the only one that
+ * may join another group or call sched_settickets (EPERM otherwise);
+ * a thread in another group can't leave it. sched_getgroup returns
+ * the caller's group and sched_gettickets a group's tickets, which
+ * start at SCHED_TICKETS_DEFAULT.
+ */
+
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include <sys/types.h>
+#include <kern/sched.h>
+
+#define CPU_SETSIZE	32	/* the most cpus the kernel supports */
+
+typedef struct {
+	unsigned int __bits[CPU_SETSIZE / 32];
+} cpu_set_t;
+
+#define CPU_ZERO(set)	 ((set)->__bits[0] = 0)
+#define CPU_SET(n, set)	 ((set)->__bits[(n) / 32] |= 1U << ((n) % 32))
+#define CPU_CLR(n, set)	 ((set)->__bits[(n) / 32] &= ~(1U << ((n) % 32)))
+#define CPU_ISSET(n, set) (((set)->__bits[(n) / 32] & (1U << ((n) % 32))) != 0)
+
+int sched_setaffinity(pid_t pid, size_t size, const cpu_set_t *mask);
+int sched_getaffinity(pid_t pid, size_t size, cpu_set_t *mask);
+int sched_setscheduler(pid_t pid, int policy, const struct sched_param *param);
+int sched_getscheduler(pid_t pid);
+int sched_getparam(pid_t pid, struct sched_param *param);
+int sched_setgroup(int group);
+int sched_getgroup(void);
+int sched_settickets(int group, unsigned tickets);
+int sched_gettickets(int group);
+
+#endif /* _SCHED_H_ */
@@ -0,0 +1,46 @@
+/*
+ * posix_spawn: start a program in a new process without fork.
+ *
+ * The file actions are done in the child, in order, before the
+ * program is loaded; errors in them or in loading are returned from
+ * posix_spawn itself. Spawn attributes aren't supported and
+ * attrp must be NULL; nor is the environment, so envp is ignored.
+ * Like the standard version, these return an error number rather
+ * than setting errno.
+ */
+
+#ifndef _SPAWN_H_
+#define _SPAWN_H_
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <kern/spawn.h>
+
+typedef struct {
+	int fa_count;
+	struct spawn_action fa_actions[SPAWN_MAXACTIONS];
+} posix_spawn_file_actions_t;
+
+typedef struct {
+	int sa_unused;
+} posix_spawnattr_t;
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t *fa);
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *fa);
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t *fa, int fd,
+				     const char *path, int oflag, mode_t mode);
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *fa, int fd);
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *fa, int fd,
+				     int newfd);
+
+int posix_spawn(pid_t *pid, const char *path,
+		const posix_spawn_file_actions_t *fa,
+		const posix_spawnattr_t *attrp,
+		char *const argv[], char *const envp[]);
+/* Same, but search PATH like execvp */
+int posix_spawnp(pid_t *pid, const char *file,
+		 const posix_spawn_file_actions_t *fa,
+		 const posix_spawnattr_t *attrp,
+		 char *const argv[], char *const envp[]);
+
+#endif /* _SPAWN_H_ */
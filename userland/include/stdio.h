@@ -50,9 +50,28 @@ int __vprintf(void (*sendfunc)(void *clientdata, const char *, size_t len),
 	      const char *fmt,
 	      __va_list ap);
 
+/*
+ * Output streams. There are only the two; stdout is line buffered
+ * on a terminal and fully buffered otherwise, and stderr is line
+ * buffered. Both are flushed by exit(), fork(), and posix_spawn().
+ */
+typedef struct __file FILE;
+extern FILE *stdout;
+extern FILE *stderr;
+
+size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *f);
+int fflush(FILE *f);		/* NULL means all streams */
+int fputc(int, FILE *f);
+int fputs(const char *, FILE *f);
+
+/* Turn off buffering, for threads (libc internal use only) */
+void __stdio_unbuffer(void);
+
 /* Printf calls for user programs */
 int printf(const char *fmt, ...);
 int vprintf(const char *fmt, __va_list ap);
+int fprintf(FILE *f, const char *fmt, ...);
+int vfprintf(FILE *f, const char *fmt, __va_list ap);
 int snprintf(char *buf, size_t len, const char *fmt, ...);
 int vsnprintf(char *buf, size_t len, const char *fmt, __va_list ap);
 
@@ -46,6 +46,7 @@ size_t strlen(const char *);
 char *strtok_r(char *, const char *, char **);
 char *strtok(char *, const char *);
 
+void *memchr(const void *, int, size_t);
 void *memset(void *, int c, size_t);
 void *memcpy(void *, const void *, size_t);
 void *memmove(void *, const void *, size_t);
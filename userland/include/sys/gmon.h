@@ -0,0 +1,37 @@
+/*
+ * gprof-lite: a pc histogram of the whole program, from profil().
+ *
+ * A program that calls monstartup has every hardclock it spends in
+ * user mode counted against the instruction it was at, and exit()
+ * writes the counts to GMON_OUT in the current directory as text:
+ *
+ *    # lowpc highpc scale
+ *    0xPC count
+ *    ...
+ *
+ * with one line per instruction that was seen, for addr2line -f
+ * against the program binary. Each count is one tick (1/HZ second).
+ * Profiling is for the process that asked; forked children and
+ * programs it execs aren't profiled.
+ *
+ *    monstartup - start profiling pcs from LOWPC up to HIGHPC;
+ *                 MONSTARTUP_ALL() covers the whole program text.
+ *    moncontrol - stop (0) or restart (1) counting.
+ *    _mcleanup  - stop and write the counts; called by exit().
+ */
+
+#ifndef _SYS_GMON_H_
+#define _SYS_GMON_H_
+
+#define GMON_OUT	"prof.out"
+
+/* Text runs from crt0's entry point to the linker's etext */
+extern char __start[], etext[];
+#define MONSTARTUP_ALL() \
+	monstartup((unsigned long)__start, (unsigned long)etext)
+
+int monstartup(unsigned long lowpc, unsigned long highpc);
+void moncontrol(int on);
+void _mcleanup(void);
+
+#endif /* _SYS_GMON_H_ */
@@ -0,0 +1,31 @@
+/*
+ * Memory-mapped files.
+ *
+ * mmap maps part of an open file at an address the kernel picks (the
+ * first argument is ignored) and returns it, or MAP_FAILED. The
+ * offset must be a multiple of the page size. munmap can only remove
+ * whole mappings. madvise says how a range of memory is going to be
+ * used (MADV_*). mlock and mlockall fault memory in and keep it in,
+ * so touching it never waits for the disk; MAP_POPULATE faults a
+ * new mapping in without locking it. These need the paging VM
+ * system; with dumbvm they fail with ENOSYS.
+ */
+
+#ifndef _SYS_MMAN_H_
+#define _SYS_MMAN_H_
+
+#include <sys/types.h>
+#include <kern/mman.h>
+
+#define MAP_FAILED	((void *)-1)
+
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+int munmap(void *addr, size_t len);
+int msync(void *addr, size_t len, int flags);
+int madvise(void *addr, size_t len, int advice);
+int mlock(const void *addr, size_t len);
+int munlock(const void *addr, size_t len);
+int mlockall(int flags);
+int munlockall(void);
+
+#endif /* _SYS_MMAN_H_ */
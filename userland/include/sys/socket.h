@@ -0,0 +1,25 @@
+/*
+ * Sockets. So far only UDP over IPv4 (AF_INET, SOCK_DGRAM); see
+ * <netinet/in.h> for the addresses.
+ *
+ * socket returns a file handle, which read, close, dup2 and poll
+ * work on as usual. bind gives it a local address and port; one
+ * that sends first gets a free port. sendto sends one datagram;
+ * recvfrom waits for one, and anything past LEN bytes of it is lost.
+ * FLAGS must be 0. All return -1 and set errno on error.
+ */
+
+#ifndef _SYS_SOCKET_H_
+#define _SYS_SOCKET_H_
+
+#include <sys/types.h>
+#include <kern/socket.h>
+
+int socket(int domain, int type, int protocol);
+int bind(int fd, const struct sockaddr *addr, socklen_t addrlen);
+ssize_t sendto(int fd, const void *buf, size_t len, int flags,
+	       const struct sockaddr *addr, socklen_t addrlen);
+ssize_t recvfrom(int fd, void *buf, size_t len, int flags,
+		 struct sockaddr *addr, socklen_t *addrlen);
+
+#endif /* _SYS_SOCKET_H_ */
@@ -35,6 +35,7 @@
  */
 #include <kern/stat.h>
 #include <kern/stattypes.h>
+#include <kern/dirent.h>
 
 /*
  * Test macros for object types.
@@ -72,6 +73,16 @@ int fstat(int filehandle, struct stat *buf);
 int stat(const char *path, struct stat *buf);
 int lstat(const char *path, struct stat *buf);
 
+/*
+ * getdirentries_plus fills BUF with struct dirent_plus records (see
+ * kern/dirent.h), each a name in the open directory FILEHANDLE along
+ * with its stat information, and returns the number of bytes used
+ * (0 at the end of the directory). Walk the records by dp_reclen.
+ * This is not standard; it exists so listing a directory with sizes
+ * doesn't need a stat call per name.
+ */
+ssize_t getdirentries_plus(int filehandle, void *buf, size_t buflen);
+
 /*
  * The second argument to mkdir is the mode for the new directory.
  * Unless you're implementing security and permissions, you can
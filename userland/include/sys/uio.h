@@ -0,0 +1,16 @@
+/*
+ * Scatter/gather I/O. The buffers are filled (or written out) in
+ * order, as one read or write at the file's offset. iovcnt may be at
+ * most IOV_MAX, from <limits.h>.
+ */
+
+#ifndef _SYS_UIO_H_
+#define _SYS_UIO_H_
+
+#include <sys/types.h>
+#include <kern/iovec.h>
+
+ssize_t readv(int filehandle, const struct iovec *iov, int iovcnt);
+ssize_t writev(int filehandle, const struct iovec *iov, int iovcnt);
+
+#endif /* _SYS_UIO_H_ */
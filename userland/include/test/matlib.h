@@ -0,0 +1,50 @@
+/*
+ * matlib - multiplying square matrices of ints for the VM tests (in
+ * libtest), in several ways that touch memory very differently.
+ *
+ *    matlib_mul     - set C to A times B, all N by N and row-major,
+ *                     using METHOD. C mustn't overlap A or B. Returns
+ *                     0, or -1 with errno set (ENOMEM if METHOD needs
+ *                     scratch space it can't get).
+ *    matlib_lookup  - the method called NAME, or -1 with errno set to
+ *                     EINVAL.
+ *    matlib_name    - the name of METHOD.
+ *
+ * The methods:
+ *
+ *    naive   - the textbook i, j, k loop. Walks down a column of B
+ *              for every element of C, which on anything bigger than
+ *              a page is a TLB miss per multiply.
+ *    tiled   - the same sum in MATLIB_TILE-square tiles, k outside j
+ *              so that B and C are read along rows, with the inner
+ *              loop unrolled by four.
+ *    blocked - tiled, but each tile of A and B is first copied into a
+ *              page of its own, so the inner loops touch three pages
+ *              plus one row of C at a time however big N gets.
+ *
+ * System/161 doesn't model a cache, so the tile size is chosen for
+ * the TLB: a tile of ints is exactly one 4K page, and the blocked
+ * kernel's working set is a few pages against 64 TLB entries. The
+ * same size also fits a real MIPS L1 data cache.
+ *
+ * Overflow wraps as for unsigned ints, whatever the method.
+ */
+
+#ifndef _TEST_MATLIB_H_
+#define _TEST_MATLIB_H_
+
+/* Tile side, in ints; MATLIB_TILE squared ints make one page */
+#define MATLIB_TILE	32
+
+enum matlib_method {
+	MATLIB_NAIVE,
+	MATLIB_TILED,
+	MATLIB_BLOCKED,
+};
+
+int matlib_mul(enum matlib_method method, int *c, const int *a,
+	       const int *b, unsigned n);
+int matlib_lookup(const char *name);
+const char *matlib_name(enum matlib_method method);
+
+#endif /* _TEST_MATLIB_H_ */
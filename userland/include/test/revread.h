@@ -0,0 +1,46 @@
+/*
+ * revread - reading a file backwards, a line at a time, from its end
+ * (in libtest). For tac and tail.
+ *
+ * The file is read in REVREAD_CHUNK-aligned pieces, starting with the
+ * one holding the end of the file and working back, so each block is
+ * read whole and once, and nothing before the last line asked for is
+ * read at all. The file is also given FADV_RANDOM, so the file system
+ * doesn't read ahead into blocks already finished with.
+ *
+ *    revread_init - set up RR to read FD, which must be seekable,
+ *                   backwards from its end.
+ *    revread_line - step back over the line before the current place,
+ *                   setting *LINEP to it (newline included, if it has
+ *                   one) and returning its length, or 0 at the start
+ *                   of the file. The line stays put until the next
+ *                   call.
+ *    revread_tell - the current place: where the last line stepped
+ *                   over begins, or the end of the file to start with.
+ *    revread_fini - free RR's buffer and put the file's advice back
+ *                   to FADV_NORMAL. Doesn't close FD.
+ *
+ * revread_init and revread_line return -1 with errno set on error.
+ */
+
+#ifndef _TEST_REVREAD_H_
+#define _TEST_REVREAD_H_
+
+/* Alignment and size of the reads; a multiple of the block size */
+#define REVREAD_CHUNK 4096
+
+struct revread {
+	int fd;
+	char *buf;
+	size_t size;	/* size of buf, at least 2 chunks */
+	size_t off;	/* where in buf the unread-over data starts */
+	size_t len;	/* how much of it there is */
+	off_t pos;	/* file offset of buf[off] */
+};
+
+int revread_init(struct revread *rr, int fd);
+ssize_t revread_line(struct revread *rr, const char **linep);
+off_t revread_tell(const struct revread *rr);
+void revread_fini(struct revread *rr);
+
+#endif /* _TEST_REVREAD_H_ */
@@ -0,0 +1,49 @@
+/*
+ * sortlib - sorting integers, in memory and through files, for the
+ * sort tests (in libtest).
+ *
+ *    sortlib_sort        - sort NUM ints in place (quicksort).
+ *    sortlib_mergesort   - sort NUM ints, using TMP (also NUM ints)
+ *                          as scratch space.
+ *
+ * For sorts bigger than memory, runs are written out sorted and then
+ * merged:
+ *
+ *    sortlib_writer_init - set up W to write ints to FD, buffering
+ *                          up to MAX of them in BUF.
+ *    sortlib_writer_put  - add VAL.
+ *    sortlib_writer_flush - write out whatever is buffered.
+ *    sortlib_merge       - merge the K sorted files open on INFDS
+ *                          into OUTFD, reading and writing through
+ *                          BUF (BUFNUM ints, at least K + 1). Takes
+ *                          the smallest head with a loser tree, so
+ *                          each int costs log K comparisons.
+ *
+ * The file functions return 0, or -1 with errno set. A file whose
+ * size isn't a whole number of ints gets EINVAL.
+ */
+
+#ifndef _TEST_SORTLIB_H_
+#define _TEST_SORTLIB_H_
+
+/* Most files sortlib_merge can take at once */
+#define SORTLIB_MAXWAY 64
+
+struct sortlib_writer {
+	int fd;
+	int *buf;
+	unsigned num, max;
+};
+
+void sortlib_sort(int *v, unsigned num);
+void sortlib_mergesort(int *v, unsigned num, int *tmp);
+
+void sortlib_writer_init(struct sortlib_writer *w, int fd,
+			 int *buf, unsigned max);
+int sortlib_writer_put(struct sortlib_writer *w, int val);
+int sortlib_writer_flush(struct sortlib_writer *w);
+
+int sortlib_merge(const int *infds, unsigned k, int outfd,
+		  int *buf, unsigned bufnum);
+
+#endif /* _TEST_SORTLIB_H_ */
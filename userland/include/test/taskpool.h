@@ -0,0 +1,73 @@
+/*
+ * taskpool - running work in parallel on a pool of workers, threads
+ * if there are any and processes if not (in libtest). For the
+ * parallel test programs, so their times can be compared across
+ * worker counts and across kernels.
+ *
+ *    taskpool_init     - start a pool of NWORKERS workers: the calling
+ *                        thread, which should be the main one, and
+ *                        NWORKERS - 1 more. With TASKPOOL_FORK, or if
+ *                        threads can't be had, the workers are child
+ *                        processes instead (see below). Returns 0, or
+ *                        -1 with errno set (EINVAL for a bad NWORKERS
+ *                        or a pool already running).
+ *    taskpool_fini     - stop the workers.
+ *    taskpool_threaded - true if the workers are threads.
+ *    taskpool_nworkers - how many workers there are, which with
+ *                        threads may be fewer than asked for.
+ *
+ *    parallel_for      - call FUNC(I, ARG) for each I from 0 to N-1,
+ *                        spread over the workers, and return how many
+ *                        of the calls returned nonzero.
+ *    task_spawn        - start FUNC(ARG) as task T, which some other
+ *                        worker may take and run. T must stay put
+ *                        until task_sync.
+ *    task_sync         - wait for T to finish, running other tasks
+ *                        meanwhile. Tasks must be synced in the
+ *                        opposite order to how they were spawned.
+ *
+ * With threads, each worker has a Chase-Lev deque of tasks: it pushes
+ * and pops its own at the bottom without locking, and a worker with
+ * nothing to do steals from the top of the others' with a
+ * compare-and-swap, and sleeps on a futex once there is nothing
+ * anywhere. parallel_for halves its range, spawning one half and
+ * going on with the other, so the work spreads from whichever worker
+ * starts it.
+ *
+ * With processes, parallel_for forks a child for each I, up to
+ * NWORKERS at a time, whose exit status is what FUNC returned; and
+ * task_spawn just runs the task there and then. What the children
+ * write to memory is lost, so results have to go through files.
+ *
+ * So the same code works either way, FUNC should return failure
+ * rather than call exit, which with threads ends the whole program.
+ */
+
+#ifndef _TEST_TASKPOOL_H_
+#define _TEST_TASKPOOL_H_
+
+#include <stdbool.h>
+
+#define TASKPOOL_MAXWORKERS	32
+#define TASKPOOL_DEQUESIZE	256	/* tasks per deque; a power of 2 */
+
+/* Flags for taskpool_init */
+#define TASKPOOL_FORK		1	/* use processes, even with threads */
+
+struct task {
+	void (*t_func)(void *);
+	void *t_arg;
+	volatile int t_done;
+};
+
+int taskpool_init(unsigned nworkers, int flags);
+void taskpool_fini(void);
+bool taskpool_threaded(void);
+unsigned taskpool_nworkers(void);
+
+unsigned parallel_for(unsigned n, int (*func)(unsigned i, void *arg),
+		      void *arg);
+void task_spawn(struct task *t, void (*func)(void *), void *arg);
+void task_sync(struct task *t);
+
+#endif /* _TEST_TASKPOOL_H_ */
@@ -27,4 +27,8 @@
  * SUCH DAMAGE.
  */
 
+/* triplev passes up to this many more arguments to each copy */
+#define TRIPLE_MAXARGS 8
+
 void triple(const char *prog);
+void triplev(const char *prog, char *const *extra);
@@ -39,10 +39,16 @@
  * about the kern/ headers.
  */
 #include <kern/fcntl.h>
+#include <kern/futex.h>
 #include <kern/ioctl.h>
+#include <kern/phase.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
+#include <kern/semop.h>
+#include <kern/spawn.h>
+#include <kern/sysbatch.h>
 #include <kern/time.h>
+#include <kern/resource.h>	/* after kern/time.h */
 #include <kern/unistd.h>
 #include <kern/wait.h>
 
@@ -145,9 +151,36 @@ ssize_t getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
 ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
+ssize_t pread(int filehandle, void *buf, size_t size, off_t pos);
+ssize_t pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+ssize_t copyfile(int fromhandle, int tohandle, size_t size);
+ssize_t sendfile(int outhandle, int inhandle, off_t *pos, size_t size);
+int fadvise(int filehandle, off_t pos, off_t len, int advice);
+int fallocate(int filehandle, off_t pos, off_t len);
+int fcntl(int filehandle, int cmd, ...);
+int fdatasync(int filehandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+int __clock_gettime(int clock, struct timespec *ts);
+int nanosleep(const struct timespec *req, struct timespec *rem);
+int getrusage(int who, struct rusage *usage);
+int profil(unsigned short *samples, size_t size, unsigned long offset,
+	   unsigned scale);
+int getrlimit(int resource, struct rlimit *rlp);
+int setrlimit(int resource, const struct rlimit *rlp);
+int futex(volatile int *uaddr, int op, int val,
+	  const struct timespec *timeout);
+int semop(const struct sembuf *ops, unsigned nops);
+int syscall_batch(struct sysbatch *calls, unsigned ncalls);
+int phase(int op, const char *name);
+int __spawn(const char *path, char *const *args,
+	    const struct spawn_action *actions, int nactions);
+int __thread_create(void (*entry)(int (*)(void *), void *),
+		    int (*func)(void *), void *arg);
+int thread_join(int tid, int *status);
+__DEAD void thread_exit(int status);
 ssize_t __getcwd(char *buf, size_t buflen);
+pid_t __fork(void);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -157,6 +190,9 @@ ssize_t __getcwd(char *buf, size_t buflen);
 
 int execvp(const char *prog, char *const *args); /* calls execv */
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
-time_t time(time_t *seconds);			/* calls __time */
+time_t time(time_t *seconds);			/* reads the time page */
+int clock_gettime(int clock, struct timespec *ts); /* ditto, or __clock_gettime */
+int thread_create(int (*func)(void *), void *arg); /* calls __thread_create */
+/* fork, above, is also one; it flushes stdio and calls __fork */
 
 #endif /* _UNISTD_H_ */
@@ -29,7 +29,6 @@
 
 #include <stdio.h>
 #include <string.h>
-#include <unistd.h>
 
 /*
  * Nonstandard (hence the __) version of puts that doesn't append
@@ -42,11 +41,9 @@ int
 __puts(const char *str)
 {
 	size_t len;
-	ssize_t ret;
 
 	len = strlen(str);
-	ret = write(STDOUT_FILENO, str, len);
-	if (ret == -1) {
+	if (len > 0 && fwrite(str, len, 1, stdout) != 1) {
 		return EOF;
 	}
 	return len;
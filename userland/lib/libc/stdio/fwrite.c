@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+/*
+ * Buffered output.
+ *
+ * There are only two streams, stdout and stderr. stdout is line
+ * buffered if it's a terminal (a character device) and fully
+ * buffered otherwise; which is decided on first use. stderr is line
+ * buffered, so a warn() message goes out in one write, and writing
+ * to it flushes stdout first so the two come out in order.
+ *
+ * Both are flushed by exit(), fork(), and posix_spawn(), and stdout
+ * is flushed by getchar() so prompts appear before we wait for
+ * input. Once a process creates a thread the streams become
+ * unbuffered, because there's no userlevel lock to protect them.
+ */
+
+#define STREAM_UNKNOWN	0	/* not yet decided */
+#define STREAM_NBF	1	/* unbuffered */
+#define STREAM_LBF	2	/* line buffered */
+#define STREAM_FBF	3	/* fully buffered */
+
+struct __file {
+	int f_fd;
+	int f_mode;		/* STREAM_* */
+	char *f_buf;
+	size_t f_size;		/* size of f_buf */
+	size_t f_len;		/* bytes waiting in f_buf */
+};
+
+static char stdoutbuf[4096];
+static char stderrbuf[256];
+
+static FILE stdoutfile = {
+	STDOUT_FILENO, STREAM_UNKNOWN, stdoutbuf, sizeof(stdoutbuf), 0
+};
+static FILE stderrfile = {
+	STDERR_FILENO, STREAM_LBF, stderrbuf, sizeof(stderrbuf), 0
+};
+
+FILE *stdout = &stdoutfile;
+FILE *stderr = &stderrfile;
+
+/*
+ * Write all of a buffer, retrying short writes.
+ */
+static
+int
+writeall(int fd, const char *data, size_t len)
+{
+	ssize_t r;
+
+	while (len > 0) {
+		r = write(fd, data, len);
+		if (r < 0) {
+			return -1;
+		}
+		if (r == 0) {
+			errno = EIO;
+			return -1;
+		}
+		data += r;
+		len -= r;
+	}
+	return 0;
+}
+
+/*
+ * Push out whatever's in the buffer. On error the data is dropped,
+ * so a stream to a closed file doesn't wedge.
+ */
+static
+int
+flushbuf(FILE *f)
+{
+	int result;
+
+	if (f->f_len == 0) {
+		return 0;
+	}
+	result = writeall(f->f_fd, f->f_buf, f->f_len);
+	f->f_len = 0;
+	return result;
+}
+
+static
+void
+setmode(FILE *f)
+{
+	struct stat st;
+
+	if (fstat(f->f_fd, &st) == 0 && S_ISCHR(st.st_mode)) {
+		f->f_mode = STREAM_LBF;
+	}
+	else {
+		f->f_mode = STREAM_FBF;
+	}
+}
+
+/*
+ * Put LEN bytes out on F. This is what everything else calls.
+ */
+static
+int
+stream_write(FILE *f, const char *data, size_t len)
+{
+	size_t n, i;
+	int sawnewline = 0;
+
+	if (f == stderr) {
+		if (flushbuf(stdout)) {
+			return -1;
+		}
+	}
+	if (f->f_mode == STREAM_UNKNOWN) {
+		setmode(f);
+	}
+	if (f->f_mode == STREAM_NBF) {
+		return writeall(f->f_fd, data, len);
+	}
+
+	while (len > 0) {
+		if (f->f_len == 0 && len >= f->f_size) {
+			/* Big enough to not be worth copying. */
+			return writeall(f->f_fd, data, len);
+		}
+		n = f->f_size - f->f_len;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(f->f_buf + f->f_len, data, n);
+		if (f->f_mode == STREAM_LBF) {
+			for (i=0; i<n; i++) {
+				if (data[i] == '\n') {
+					sawnewline = 1;
+					break;
+				}
+			}
+		}
+		f->f_len += n;
+		data += n;
+		len -= n;
+
+		if (f->f_len == f->f_size) {
+			if (flushbuf(f)) {
+				return -1;
+			}
+		}
+	}
+	if (sawnewline) {
+		return flushbuf(f);
+	}
+	return 0;
+}
+
+/*
+ * C standard I/O function - write NMEMB items of SIZE bytes each.
+ * Returns the number of items written.
+ */
+size_t
+fwrite(const void *ptr, size_t size, size_t nmemb, FILE *f)
+{
+	if (size == 0 || nmemb == 0) {
+		return 0;
+	}
+	if (stream_write(f, ptr, size * nmemb)) {
+		return 0;
+	}
+	return nmemb;
+}
+
+/*
+ * C standard I/O function - write out buffered output on F, or on
+ * all streams if F is NULL. Returns 0 or EOF on error.
+ */
+int
+fflush(FILE *f)
+{
+	int result = 0;
+
+	if (f == NULL) {
+		if (flushbuf(stdout)) {
+			result = EOF;
+		}
+		if (flushbuf(stderr)) {
+			result = EOF;
+		}
+		return result;
+	}
+	return flushbuf(f) ? EOF : 0;
+}
+
+/*
+ * Flush everything and stop buffering, for when the process becomes
+ * multithreaded. (libc internal)
+ */
+void
+__stdio_unbuffer(void)
+{
+	fflush(NULL);
+	stdout->f_mode = STREAM_NBF;
+	stderr->f_mode = STREAM_NBF;
+}
@@ -41,6 +41,9 @@ getchar(void)
 	char ch;
 	int len;
 
+	/* Don't wait for input with a prompt still in the buffer. */
+	fflush(stdout);
+
 	len = read(STDIN_FILENO, &ch, 1);
 	if (len<=0) {
 		/* end of file or error */
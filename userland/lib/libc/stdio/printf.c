@@ -29,13 +29,16 @@
 
 #include <stdio.h>
 #include <stdarg.h>
-#include <unistd.h>
 #include <errno.h>
 
 /*
  * printf - C standard I/O function.
  */
 
+struct printfdata {
+	FILE *f;
+	int err;
+};
 
 /*
  * Function passed to __vprintf to do the actual output.
@@ -44,11 +47,11 @@ static
 void
 __printf_send(void *mydata, const char *data, size_t len)
 {
-	ssize_t ret;
-	int *err = mydata;
+	struct printfdata *pd = mydata;
 
-	ret = write(STDOUT_FILENO, data, len);
-	*err = (ret == -1) ? errno : 0;
+	if (pd->err == 0 && fwrite(data, 1, len, pd->f) != len) {
+		pd->err = errno;
+	}
 }
 
 /* printf: hand off to vprintf */
@@ -64,14 +67,38 @@ printf(const char *fmt, ...)
 	return chars;
 }
 
-/* vprintf: call __vprintf to do the work. */
+/* vprintf: print to stdout */
 int
 vprintf(const char *fmt, va_list ap)
 {
-	int chars, err;
-	chars = __vprintf(__printf_send, &err, fmt, ap);
-	if (err) {
-		errno = err;
+	return vfprintf(stdout, fmt, ap);
+}
+
+/* fprintf: hand off to vfprintf */
+int
+fprintf(FILE *f, const char *fmt, ...)
+{
+	int chars;
+	va_list ap;
+
+	va_start(ap, fmt);
+	chars = vfprintf(f, fmt, ap);
+	va_end(ap);
+	return chars;
+}
+
+/* vfprintf: call __vprintf to do the work. */
+int
+vfprintf(FILE *f, const char *fmt, va_list ap)
+{
+	struct printfdata pd;
+	int chars;
+
+	pd.f = f;
+	pd.err = 0;
+	chars = __vprintf(__printf_send, &pd, fmt, ap);
+	if (pd.err) {
+		errno = pd.err;
 		return -1;
 	}
 	return chars;
@@ -28,23 +28,24 @@
  */
 
 #include <stdio.h>
-#include <unistd.h>
 
 /*
- * C standard function - print a single character.
- *
- * Properly, stdio is supposed to be buffered, but for present purposes
- * writing that code is not really worthwhile.
+ * C standard functions - print a single character.
  */
 
 int
-putchar(int ch)
+fputc(int ch, FILE *f)
 {
 	char c = ch;
-	int len;
-	len = write(STDOUT_FILENO, &c, 1);
-	if (len<=0) {
+
+	if (fwrite(&c, 1, 1, f) != 1) {
 		return EOF;
 	}
-	return ch;
+	return (int)(unsigned char)c;
+}
+
+int
+putchar(int ch)
+{
+	return fputc(ch, stdout);
 }
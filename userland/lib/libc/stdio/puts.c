@@ -28,6 +28,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 /*
  * C standard I/O function - print a string and a newline.
@@ -40,3 +41,19 @@ puts(const char *s)
 	putchar('\n');
 	return 0;
 }
+
+/*
+ * C standard I/O function - print a string to a stream.
+ */
+
+int
+fputs(const char *s, FILE *f)
+{
+	size_t len;
+
+	len = strlen(s);
+	if (len > 0 && fwrite(s, len, 1, f) != 1) {
+		return EOF;
+	}
+	return 0;
+}
@@ -27,8 +27,10 @@
  * SUCH DAMAGE.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/gmon.h>
 
 /*
  * C standard function: exit process.
@@ -41,6 +43,8 @@ exit(int code)
 	 * In a more complicated libc, this would call functions registered
 	 * with atexit() before calling the syscall to actually exit.
 	 */
+	_mcleanup();
+	fflush(NULL);
 
 #ifdef __mips__
 	/*
@@ -30,17 +30,48 @@
 /*
  * User-level malloc and free implementation.
  *
- * This is a basic first-fit allocator. It's intended to be simple and
- * easy to follow. It performs abysmally if the heap becomes larger than
- * physical memory. To get (much) better out-of-core performance, port
- * the kernel's malloc. :-)
+ * Every block, in use or free, has a one-word header giving the
+ * offsets to its neighbours, so adjacent free blocks can be found and
+ * merged in constant time (boundary tags). Free blocks are kept on
+ * doubly linked lists ("bins") by size, one per power of two; the
+ * links live in the free block's data area. A request is served from
+ * the first block in its own bin that fits, or else the first block
+ * of any larger nonempty bin, which always fits.
+ *
+ * Small blocks (up to MSMALLMAX bytes) get a second chance: freeing
+ * one just pushes it on a list for its exact size, still marked in
+ * use so nobody merges it, and the next malloc of that size pops it
+ * again. Both are O(1). The cached blocks are given back to the bins
+ * (merging as they go) before a large request is served, and before
+ * the heap is grown, so they can't starve larger requests.
+ *
+ * The heap is grown with sbrk at least MSBRKMIN at a time, so that a
+ * run of small mallocs doesn't call sbrk for every page.
+ *
+ * So that threads don't all queue up on one lock, there are several
+ * heaps ("arenas"), each with its own spinlock, bins and size-class
+ * lists, and each thread keeps to one (__malloc_myarena). The first
+ * arena is the sbrk heap above; the others are made of MSEGSIZE
+ * segments from mmap, aligned so that any block's segment, and so its
+ * arena, is found by masking its address. A block bigger than a
+ * segment gets a mapping to itself. A thread freeing a block from
+ * another thread's arena doesn't lock that arena but pushes the block
+ * on a lock-free list; the owner takes the whole list back with one
+ * atomic swap on its next malloc, so blocks passed from producer to
+ * consumer go home in batches.
+ *
+ * With MALLOCDEBUG defined, the whole heap is checked and dumped on
+ * every call and freed memory is filled with 0xdeadbeef; otherwise
+ * only the header of each block handed to free is checked.
  */
 
 #include <stdlib.h>
 #include <stdint.h>  // for uintptr_t on non-OS/161 platforms
 #include <unistd.h>
+#include <sys/mman.h>
 #include <err.h>
 #include <assert.h>
+#include <atomic.h>
 
 #undef MALLOCDEBUG
 
@@ -60,8 +91,8 @@
  *
  * mh_nextblock is the upwards offset to the next header.
  *
- * mh_pad is unused.
- * mh_inuse is 1 if the block is in use, 0 if it is free.
+ * mh_cached is 1 if the block is free but held on a size-class list.
+ * mh_inuse is 1 if the block is in use (or cached), 0 if it is free.
  * mh_magic* should always be a fixed value.
  *
  * MBLOCKSIZE should equal sizeof(struct mheader) and be a power of 2.
@@ -79,7 +110,7 @@ struct mheader {
 	 * Block size is 8 bytes.
 	 */
 	unsigned mh_prevblock:29;
-	unsigned mh_pad:1;
+	unsigned mh_cached:1;
 	unsigned mh_magic1:2;
 
 	unsigned mh_nextblock:29;
@@ -95,7 +126,7 @@ struct mheader {
 	 * Block size is 16 bytes.
 	 */
 	unsigned mh_prevblock:60;
-	unsigned mh_pad:1;
+	unsigned mh_cached:1;
 	unsigned mh_magic1:3;
 
 	unsigned mh_nextblock:60;
@@ -107,6 +138,16 @@ struct mheader {
 #endif
 };
 
+/*
+ * List links, kept in the data area of a free or cached block. They
+ * fit in MBLOCKSIZE, the smallest data area there is. Cached blocks
+ * only use mf_next.
+ */
+struct mfree {
+	struct mheader *mf_next;
+	struct mheader *mf_prev;
+};
+
 /*
  * Operator macros on struct mheader.
  *
@@ -115,6 +156,7 @@ struct mheader {
  *
  * M_DATA:		return data pointer of a header
  * M_SIZE:		return data size of a header
+ * M_LINKS:		return the list links of a free block
  *
  * M_OK:		true if the magic values are correct
  *
@@ -129,11 +171,27 @@ struct mheader {
 
 #define M_DATA(mh)	((void *)((mh)+1))
 #define M_SIZE(mh)	(M_NEXTOFF(mh)-MBLOCKSIZE)
+#define M_LINKS(mh)	((struct mfree *)M_DATA(mh))
 
 #define M_OK(mh)	((mh)->mh_magic1==MMAGIC && (mh)->mh_magic2==MMAGIC)
 
 #define M_MKFIELD(off)	((off)>>MBLOCKSHIFT)
 
+/*
+ * Free list sizes.
+ *
+ * MSMALLMAX:		largest block kept on a size-class list
+ * MNCLASSES:		size classes, one per multiple of MBLOCKSIZE
+ * MNBINS:		bins; bin b holds sizes [2^b, 2^(b+1))
+ * MSIZEMAX:		largest request, so sizes fit in the header fields
+ */
+#define MSMALLMAX	512
+#define MNCLASSES	(MSMALLMAX / MBLOCKSIZE)
+#define MNBINS		(sizeof(size_t) * 8)
+#define MSIZEMAX	((size_t)1 << (sizeof(size_t) * 8 - 2))
+
+#define M_CLASS(size)	((size) / MBLOCKSIZE - 1)
+
 /*
  * System page size. In POSIX you're supposed to call
  * sysconf(_SC_PAGESIZE). If _SC_PAGESIZE isn't defined, as on OS/161,
@@ -147,15 +205,89 @@ static size_t __malloc_pagesize;
 #define PAGE_SIZE 4096
 #endif
 
+/* Least to grow the heap by at once */
+#define MSBRKMIN	(16 * PAGE_SIZE)
+
+/*
+ * Arenas.
+ *
+ * MNARENAS:		arenas, counting the sbrk heap's
+ * MTHREADSHIFT:	threads' stacks are at least 1 << MTHREADSHIFT apart
+ * MSEGSIZE:		size and alignment of a segment (a power of 2)
+ * MSEGMAGIC:		value for ms_magic
+ */
+#define MNARENAS	8
+#define MTHREADSHIFT	18
+#define MSEGSIZE	((size_t)1024 * 1024)
+#define MSEGMAGIC	0x5e6a11c0
+
+/*
+ * Header at the bottom of a segment. ms_arena is the arena it
+ * belongs to, or NULL if the segment holds just one block too big
+ * for a segment of its own; ms_map and ms_maplen are the mapping it
+ * sits in, for munmap.
+ *
+ * MSEGHDR is the header's size rounded up to a whole block, and
+ * MSEGMAX the biggest block a segment holds, leaving room for the
+ * fence at the top.
+ *
+ * M_SEG:		return the segment an address in one is in
+ */
+struct mseg {
+	struct marena *ms_arena;
+	struct mseg *ms_next;		/* the arena's next segment */
+	void *ms_map;
+	size_t ms_maplen;
+	unsigned ms_magic;
+};
+
+#define MSEGHDR		((sizeof(struct mseg) + MBLOCKSIZE - 1) & \
+			 ~(size_t)(MBLOCKSIZE-1))
+#define MSEGMAX		(MSEGSIZE - MSEGHDR - 2*MBLOCKSIZE)
+
+#define M_SEG(p)	((struct mseg *)((uintptr_t)(p) & ~(uintptr_t)(MSEGSIZE-1)))
+
+/*
+ * An arena: a heap with its own lock, free lists and memory.
+ *
+ * Arena 0 has the sbrk heap, and ma_top is the header of its topmost
+ * block (NULL while the heap is empty). The others have segments
+ * (ma_segs), and ma_top stays NULL.
+ *
+ * The bins have a bit set in ma_binmap for each one that isn't
+ * empty, and ma_ncached counts the blocks on the size-class lists.
+ *
+ * ma_key is the thread using the arena, or 0 (see __malloc_myarena).
+ * ma_remote is a list of blocks other threads have freed, linked
+ * through mf_next; the arena's own thread takes them all back at once
+ * the next time it mallocs. It is the only part of an arena touched
+ * without holding ma_lock.
+ */
+struct marena {
+	struct spin ma_lock;
+	volatile int ma_key;
+	struct mheader *ma_top;
+	struct mseg *ma_segs;
+	struct mheader *ma_bins[MNBINS];
+	size_t ma_binmap;
+	struct mheader *ma_classes[MNCLASSES];
+	size_t ma_ncached;
+	struct mheader *volatile ma_remote;
+};
+
 ////////////////////////////////////////////////////////////
 
 /*
- * Static variables - the bottom and top addresses of the heap.
+ * Static variables - the bottom and top addresses of the sbrk heap,
+ * and the arenas.
  */
 static uintptr_t __heapbase, __heaptop;
+static struct marena __malloc_arenas[MNARENAS];
+
+#define M_HEAP		(&__malloc_arenas[0])
 
 /*
- * Setup function.
+ * Setup function, for the sbrk heap. Called with arena 0 locked.
  */
 static
 void
@@ -175,6 +307,13 @@ __malloc_init(void)
 	if (1<<MBLOCKSHIFT != MBLOCKSIZE) {
 		errx(1, "malloc: Internal error - MBLOCKSHIFT wrong");
 	}
+	if (sizeof(struct mfree) > MBLOCKSIZE) {
+		errx(1, "malloc: Internal error - free links don't fit");
+	}
+	if (sizeof(void *) != sizeof(int)) {
+		errx(1, "malloc: Internal error - "
+		     "pointers don't fit atomic operations");
+	}
 
 	/* init should only be called once. */
 	if (__heapbase!=0 || __heaptop!=0) {
@@ -226,20 +365,18 @@ __malloc_init(void)
 #ifdef MALLOCDEBUG
 
 /*
- * Debugging print function to iterate and dump the entire heap.
+ * Debugging print function to iterate and dump the blocks from i up
+ * to top, or to a segment's fence.
  */
 static
 void
-__malloc_dump(void)
+__malloc_dumprange(uintptr_t i, uintptr_t top)
 {
 	struct mheader *mh;
-	uintptr_t i;
 	size_t rightprevblock;
 
-	warnx("heap: ************************************************");
-
 	rightprevblock = 0;
-	for (i=__heapbase; i<__heaptop; i += M_NEXTOFF(mh)) {
+	for (; i<top; i += M_NEXTOFF(mh)) {
 		mh = (struct mheader *) i;
 		if (!M_OK(mh)) {
 			errx(1, "malloc: Heap corrupt; header at 0x%lx"
@@ -256,23 +393,260 @@ __malloc_dump(void)
 		}
 		rightprevblock = mh->mh_nextblock;
 
+		if (mh->mh_nextblock == 0) {
+			warnx("heap: 0x%lx fence", (unsigned long) i);
+			return;
+		}
 		warnx("heap: 0x%lx 0x%-6lx (next: 0x%lx) %s",
 		      (unsigned long) i + MBLOCKSIZE,
 		      (unsigned long) M_SIZE(mh),
 		      (unsigned long) (i+M_NEXTOFF(mh)),
+		      mh->mh_cached ? "CACHED" :
 		      mh->mh_inuse ? "INUSE" : "FREE");
 	}
-	if (i!=__heaptop) {
+	if (i!=top) {
 		errx(1, "malloc: Heap corrupt; ran off end");
 	}
+}
+
+/*
+ * Dump an arena: the sbrk heap for arena 0, and each segment.
+ */
+static
+void
+__malloc_dump(struct marena *a)
+{
+	struct mseg *ms;
+
+	warnx("heap: ************************************************");
+
+	if (a == M_HEAP) {
+		__malloc_dumprange(__heapbase, __heaptop);
+		if (__heaptop!=__heapbase &&
+		    M_NEXT(a->ma_top)!=(struct mheader *)__heaptop) {
+			errx(1, "malloc: Heap corrupt; top block is wrong");
+		}
+	}
+	for (ms = a->ma_segs; ms != NULL; ms = ms->ms_next) {
+		__malloc_dumprange((uintptr_t)ms + MSEGHDR,
+				   (uintptr_t)ms + MSEGSIZE);
+	}
 
 	warnx("heap: ************************************************");
 }
 
+/*
+ * Clear a range of memory with 0xdeadbeef.
+ * ptr must be suitably aligned.
+ */
+static
+void
+__malloc_deadbeef(void *ptr, size_t size)
+{
+	uint32_t *x = ptr;
+	size_t i, n = size/sizeof(uint32_t);
+	for (i=0; i<n; i++) {
+		x[i] = 0xdeadbeef;
+	}
+}
+
 #endif /* MALLOCDEBUG */
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Return the bin for blocks of SIZE bytes: log base 2 of SIZE.
+ */
+static
+unsigned
+__malloc_binof(size_t size)
+{
+	unsigned b;
+
+	for (b = 0; size > 1; b++) {
+		size >>= 1;
+	}
+	return b;
+}
+
+/*
+ * Put the free block mh on its bin.
+ */
+static
+void
+__malloc_binadd(struct marena *a, struct mheader *mh)
+{
+	struct mfree *mf;
+	unsigned b;
+
+	b = __malloc_binof(M_SIZE(mh));
+	mf = M_LINKS(mh);
+	mf->mf_prev = NULL;
+	mf->mf_next = a->ma_bins[b];
+	if (mf->mf_next != NULL) {
+		M_LINKS(mf->mf_next)->mf_prev = mh;
+	}
+	a->ma_bins[b] = mh;
+	a->ma_binmap |= (size_t)1 << b;
+}
+
+/*
+ * Take the free block mh off its bin.
+ */
+static
+void
+__malloc_binremove(struct marena *a, struct mheader *mh)
+{
+	struct mfree *mf;
+	unsigned b;
+
+	b = __malloc_binof(M_SIZE(mh));
+	mf = M_LINKS(mh);
+	if (mf->mf_prev != NULL) {
+		M_LINKS(mf->mf_prev)->mf_next = mf->mf_next;
+	}
+	else {
+		if (a->ma_bins[b] != mh) {
+			errx(1, "malloc: Heap corrupt; free block %p "
+			     "not on its list", M_DATA(mh));
+		}
+		a->ma_bins[b] = mf->mf_next;
+		if (mf->mf_next == NULL) {
+			a->ma_binmap &= ~((size_t)1 << b);
+		}
+	}
+	if (mf->mf_next != NULL) {
+		M_LINKS(mf->mf_next)->mf_prev = mf->mf_prev;
+	}
+}
+
+/*
+ * Merge two adjacent free blocks (mh below mhnext), neither on a bin.
+ */
+static
+void
+__malloc_merge(struct marena *a, struct mheader *mh, struct mheader *mhnext)
+{
+	struct mheader *mhnextnext;
+
+	if (mh->mh_nextblock != mhnext->mh_prevblock) {
+		errx(1, "free: Heap corrupt (%p and %p inconsistent)",
+		     mh, mhnext);
+	}
+
+	mh->mh_nextblock = M_MKFIELD(MBLOCKSIZE + M_SIZE(mh) +
+				     MBLOCKSIZE + M_SIZE(mhnext));
+
+	if (mhnext == a->ma_top) {
+		a->ma_top = mh;
+	}
+	else {
+		mhnextnext = M_NEXT(mh);
+		mhnextnext->mh_prevblock = mh->mh_nextblock;
+	}
+
+#ifdef MALLOCDEBUG
+	/* Deadbeef out the memory used by the now-obsolete header */
+	__malloc_deadbeef(mhnext, sizeof(struct mheader));
+#endif
+}
+
+/*
+ * Make mh free: merge it with its free neighbours and put the result
+ * on a bin.
+ */
+static
+void
+__malloc_release(struct marena *a, struct mheader *mh)
+{
+	struct mheader *mhnext, *mhprev;
+
+	mh->mh_inuse = 0;
+	mh->mh_cached = 0;
+
+	/*
+	 * Merge with the block above (but not if we're at the top of
+	 * the heap; a segment's fence is always in use)
+	 */
+	if (mh != a->ma_top) {
+		mhnext = M_NEXT(mh);
+		if (!mhnext->mh_inuse) {
+			__malloc_binremove(a, mhnext);
+			__malloc_merge(a, mh, mhnext);
+		}
+	}
+
+	/* Merge with the block below (but not if we're at the bottom) */
+	if (mh->mh_prevblock != 0) {
+		mhprev = M_PREV(mh);
+		if (!mhprev->mh_inuse) {
+			__malloc_binremove(a, mhprev);
+			__malloc_merge(a, mhprev, mh);
+			mh = mhprev;
+		}
+	}
+
+	__malloc_binadd(a, mh);
+}
+
+/*
+ * Give all the blocks on the size-class lists back to the bins.
+ */
+static
+void
+__malloc_consolidate(struct marena *a)
+{
+	struct mheader *mh;
+	unsigned c;
+
+	for (c=0; c<MNCLASSES && a->ma_ncached > 0; c++) {
+		while (a->ma_classes[c] != NULL) {
+			mh = a->ma_classes[c];
+			a->ma_classes[c] = M_LINKS(mh)->mf_next;
+			a->ma_ncached--;
+			__malloc_release(a, mh);
+		}
+	}
+}
+
+/*
+ * Take a free block of at least size bytes off the bins, or return
+ * NULL if there isn't one.
+ */
+static
+struct mheader *
+__malloc_findfree(struct marena *a, size_t size)
+{
+	struct mheader *mh;
+	size_t map;
+	unsigned b;
+
+	/* First fit within the bin sizes like ours belong to... */
+	b = __malloc_binof(size);
+	for (mh = a->ma_bins[b]; mh != NULL; mh = M_LINKS(mh)->mf_next) {
+		if (M_SIZE(mh) >= size) {
+			__malloc_binremove(a, mh);
+			return mh;
+		}
+	}
+
+	/* ...else anything in a bigger bin fits. */
+	if (b + 1 >= MNBINS) {
+		return NULL;
+	}
+	map = a->ma_binmap >> (b + 1);
+	for (b++; map != 0; b++, map >>= 1) {
+		if (map & 1) {
+			mh = a->ma_bins[b];
+			__malloc_binremove(a, mh);
+			return mh;
+		}
+	}
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Get more memory (at the top of the heap) using sbrk, and
  * return a pointer to it.
@@ -298,6 +672,190 @@ __malloc_sbrk(size_t size)
 	return x;
 }
 
+/*
+ * Grow the sbrk heap so that there is a free block of at least size
+ * bytes at the top, and return it (not on a bin). If the top block
+ * is free it is extended; otherwise a new block is made.
+ */
+static
+struct mheader *
+__malloc_growheap(struct marena *a, size_t size)
+{
+	struct mheader *mh;
+	size_t morespace, roundup;
+	void *p;
+
+	if (__heapbase==0) {
+		__malloc_init();
+	}
+	if (__heapbase==0 || __heaptop==0 || __heapbase > __heaptop) {
+		warnx("malloc: Internal error - local data corrupt");
+		errx(1, "malloc: heapbase 0x%lx; heaptop 0x%lx",
+		     (unsigned long) __heapbase, (unsigned long) __heaptop);
+	}
+
+	mh = a->ma_top;
+	if (mh != NULL && !mh->mh_inuse) {
+		assert(size > M_SIZE(mh));
+		morespace = size - M_SIZE(mh);
+	}
+	else {
+		mh = NULL;
+		morespace = MBLOCKSIZE + size;
+	}
+
+	/*
+	 * Round the amount of space we ask for up to a whole page, and
+	 * ask for at least MSBRKMIN if we can get it.
+	 */
+	roundup = PAGE_SIZE * ((morespace + PAGE_SIZE - 1) / PAGE_SIZE);
+	morespace = roundup < MSBRKMIN ? MSBRKMIN : roundup;
+	p = __malloc_sbrk(morespace);
+	if (p == NULL && morespace != roundup) {
+		morespace = roundup;
+		p = __malloc_sbrk(morespace);
+	}
+	if (p == NULL) {
+		return NULL;
+	}
+
+	if (mh != NULL) {
+		/* update old header */
+		__malloc_binremove(a, mh);
+		mh->mh_nextblock = M_MKFIELD(M_NEXTOFF(mh) + morespace);
+	}
+	else {
+		/* fill out new header */
+		mh = p;
+		mh->mh_prevblock = a->ma_top == NULL ? 0 :
+			a->ma_top->mh_nextblock;
+		mh->mh_magic1 = MMAGIC;
+		mh->mh_magic2 = MMAGIC;
+		mh->mh_cached = 0;
+		mh->mh_inuse = 0;
+		mh->mh_nextblock = M_MKFIELD(morespace);
+		a->ma_top = mh;
+	}
+	return mh;
+}
+
+/*
+ * Map len bytes (a multiple of the page size) for a segment, aligned
+ * to MSEGSIZE, and fill in its header but for ms_arena and ms_next.
+ *
+ * munmap only takes whole mappings, so the slack can't be trimmed
+ * off; but mmap hands out space from the top down, so after one
+ * misaligned try, asking for that much more usually lines the next
+ * one up, and the ones after it too. Failing that, MSEGSIZE extra
+ * always has room.
+ */
+static
+struct mseg *
+__malloc_mapseg(size_t len)
+{
+	struct mseg *ms;
+	size_t maplen, extra;
+	uintptr_t base;
+	void *p;
+
+	extra = 0;
+	for (;;) {
+		maplen = len + extra;
+		p = mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANON, -1, 0);
+		if (p == MAP_FAILED) {
+			return NULL;
+		}
+		base = ((uintptr_t)p + MSEGSIZE - 1) &
+			~(uintptr_t)(MSEGSIZE - 1);
+		if (base + len <= (uintptr_t)p + maplen) {
+			break;
+		}
+		munmap(p, maplen);
+		extra = extra == 0 ? (uintptr_t)p % MSEGSIZE : MSEGSIZE;
+	}
+
+	ms = (struct mseg *)base;
+	ms->ms_arena = NULL;
+	ms->ms_next = NULL;
+	ms->ms_map = p;
+	ms->ms_maplen = maplen;
+	ms->ms_magic = MSEGMAGIC;
+	return ms;
+}
+
+/*
+ * Give arena a another segment, and return the free block that fills
+ * it (not on a bin). The top of a segment is a fence: the header of
+ * an empty block that is always in use, so nothing merges past it.
+ */
+static
+struct mheader *
+__malloc_newseg(struct marena *a)
+{
+	struct mseg *ms;
+	struct mheader *mh, *fence;
+
+	ms = __malloc_mapseg(MSEGSIZE);
+	if (ms == NULL) {
+		return NULL;
+	}
+	ms->ms_arena = a;
+	ms->ms_next = a->ma_segs;
+	a->ma_segs = ms;
+
+	mh = (struct mheader *)((uintptr_t)ms + MSEGHDR);
+	mh->mh_prevblock = 0;
+	mh->mh_magic1 = MMAGIC;
+	mh->mh_magic2 = MMAGIC;
+	mh->mh_cached = 0;
+	mh->mh_inuse = 0;
+	mh->mh_nextblock = M_MKFIELD(MBLOCKSIZE + MSEGMAX);
+
+	fence = M_NEXT(mh);
+	fence->mh_prevblock = mh->mh_nextblock;
+	fence->mh_magic1 = MMAGIC;
+	fence->mh_magic2 = MMAGIC;
+	fence->mh_cached = 0;
+	fence->mh_inuse = 1;
+	fence->mh_nextblock = 0;
+	return mh;
+}
+
+/*
+ * Allocate a block of size bytes, too big for a segment, in a
+ * segment of its own that belongs to no arena. free unmaps it.
+ */
+static
+struct mheader *
+__malloc_huge(size_t size)
+{
+	struct mseg *ms;
+	struct mheader *mh;
+	size_t len;
+
+#ifdef _SC_PAGESIZE
+	if (__malloc_pagesize == 0) {
+		__malloc_pagesize = sysconf(_SC_PAGESIZE);
+	}
+#endif
+	len = MSEGHDR + MBLOCKSIZE + size;
+	len = PAGE_SIZE * ((len + PAGE_SIZE - 1) / PAGE_SIZE);
+	ms = __malloc_mapseg(len);
+	if (ms == NULL) {
+		return NULL;
+	}
+
+	mh = (struct mheader *)((uintptr_t)ms + MSEGHDR);
+	mh->mh_prevblock = 0;
+	mh->mh_magic1 = MMAGIC;
+	mh->mh_magic2 = MMAGIC;
+	mh->mh_cached = 0;
+	mh->mh_inuse = 1;
+	mh->mh_nextblock = M_MKFIELD(MBLOCKSIZE + size);
+	return mh;
+}
+
 /*
  * Make a new (free) block from the block passed in, leaving size
  * bytes for data in the current block. size must be a multiple of
@@ -308,10 +866,11 @@ __malloc_sbrk(size_t size)
  */
 static
 void
-__malloc_split(struct mheader *mh, size_t size)
+__malloc_split(struct marena *a, struct mheader *mh, size_t size)
 {
 	struct mheader *mhnext, *mhnew;
 	size_t oldsize;
+	int wastop;
 
 	if (size % MBLOCKSIZE != 0) {
 		errx(1, "malloc: Internal error (size %lu passed to split)",
@@ -323,6 +882,7 @@ __malloc_split(struct mheader *mh, size_t size)
 		return;
 	}
 
+	wastop = (mh == a->ma_top);
 	mhnext = M_NEXT(mh);
 
 	oldsize = M_SIZE(mh);
@@ -334,258 +894,295 @@ __malloc_split(struct mheader *mh, size_t size)
 	}
 
 	mhnew->mh_prevblock = M_MKFIELD(size + MBLOCKSIZE);
-	mhnew->mh_pad = 0;
+	mhnew->mh_cached = 0;
 	mhnew->mh_magic1 = MMAGIC;
 	mhnew->mh_nextblock = M_MKFIELD(oldsize - size);
-	mhnew->mh_inuse = 0;
+	mhnew->mh_inuse = 1;
 	mhnew->mh_magic2 = MMAGIC;
 
-	if (mhnext != (struct mheader *) __heaptop) {
+	if (wastop) {
+		a->ma_top = mhnew;
+	}
+	else {
 		mhnext->mh_prevblock = mhnew->mh_nextblock;
 	}
+
+	/* The block above mh can't have been free; this just files it */
+	__malloc_release(a, mhnew);
 }
 
+////////////////////////////////////////////////////////////
+
 /*
- * malloc itself.
+ * The arena for the calling thread.
+ *
+ * Each thread has its own stack, well away from the others', so the
+ * stack pointer shifted down by MTHREADSHIFT tells threads apart.
+ * The first time a thread turns up it claims a free arena; once they
+ * are all taken, threads share them. The first thread to malloc,
+ * normally the main thread before there are any others, gets arena 0
+ * and the sbrk heap. A later thread on the same stack (the kernel
+ * hands them out again) gets the same arena back, blocks and all. A
+ * green thread (gthread.h) passes for whoever's stack is nearest; it
+ * can share an arena with a thread on another worker, which costs
+ * only waiting for the lock.
  */
-void *
-malloc(size_t size)
+static
+struct marena *
+__malloc_myarena(void)
 {
-	struct mheader *mh;
-	uintptr_t i;
-	size_t rightprevblock;
-	size_t morespace;
-	void *p;
-
-	if (__heapbase==0) {
-		__malloc_init();
-	}
-	if (__heapbase==0 || __heaptop==0 || __heapbase > __heaptop) {
-		warnx("malloc: Internal error - local data corrupt");
-		errx(1, "malloc: heapbase 0x%lx; heaptop 0x%lx",
-		     (unsigned long) __heapbase, (unsigned long) __heaptop);
-	}
-
-#ifdef MALLOCDEBUG
-	warnx("malloc: about to allocate %lu (0x%lx) bytes",
-	      (unsigned long) size, (unsigned long) size);
-	__malloc_dump();
-#endif
-
-	/* Round size up to an integral number of blocks. */
-	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
-
-	/*
-	 * First-fit search algorithm for available blocks.
-	 * Check to make sure the next/previous sizes all agree.
-	 */
-	rightprevblock = 0;
-	mh = NULL;
-	for (i=__heapbase; i<__heaptop; i += M_NEXTOFF(mh)) {
-		mh = (struct mheader *) i;
-		if (!M_OK(mh)) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad magic bits",
-			     (unsigned long) i);
-		}
-		if (mh->mh_prevblock != rightprevblock) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad previous-block size %lu "
-			     "(should be %lu)",
-			     (unsigned long) i,
-			     (unsigned long) mh->mh_prevblock << MBLOCKSHIFT,
-			     (unsigned long) rightprevblock << MBLOCKSHIFT);
-		}
-		rightprevblock = mh->mh_nextblock;
-
-		/* Can't allocate a block that's in use. */
-		if (mh->mh_inuse) {
-			continue;
+	struct marena *a;
+	char here;
+	int key, old;
+	unsigned i;
+
+	key = (int)((uintptr_t)&here >> MTHREADSHIFT);
+	for (i=0; i<MNARENAS; i++) {
+		a = &__malloc_arenas[i];
+		old = a->ma_key;
+		if (old == 0) {
+			old = atomic_cas(&a->ma_key, 0, key);
+			if (old == 0) {
+				return a;
+			}
 		}
-
-		/* Can't allocate a block that isn't big enough. */
-		if (M_SIZE(mh) < size) {
-			continue;
+		if (old == key) {
+			return a;
 		}
-
-		/* Try splitting block. */
-		__malloc_split(mh, size);
-
-		/*
-		 * Now, allocate.
-		 */
-		mh->mh_inuse = 1;
-
-#ifdef MALLOCDEBUG
-		warnx("malloc: allocating at %p", M_DATA(mh));
-		__malloc_dump();
-#endif
-		return M_DATA(mh);
-	}
-	if (i!=__heaptop) {
-		errx(1, "malloc: Heap corrupt; ran off end");
 	}
+	return &__malloc_arenas[key % MNARENAS];
+}
 
-	/*
-	 * Didn't find anything. Expand the heap.
-	 *
-	 * If the heap is nonempty and the top block (the one mh is
-	 * left pointing to after the above loop) is free, we can
-	 * expand it. Otherwise we need a new block.
-	 */
-	if (mh != NULL && !mh->mh_inuse) {
-		assert(size > M_SIZE(mh));
-		morespace = size - M_SIZE(mh);
-	}
-	else {
-		morespace = MBLOCKSIZE + size;
-	}
-
-	/* Round the amount of space we ask for up to a whole page. */
-	morespace = PAGE_SIZE * ((morespace + PAGE_SIZE - 1) / PAGE_SIZE);
-
-	p = __malloc_sbrk(morespace);
-	if (p == NULL) {
-		return NULL;
-	}
+/*
+ * Put a block freed by some other thread on arena a's ma_remote list.
+ * Nothing but pushes and __malloc_drain's take-everything touch the
+ * list, so a compare-and-swap on the head is enough.
+ */
+static
+void
+__malloc_push(struct marena *a, struct mheader *mh)
+{
+	struct mheader *old;
+
+	do {
+		old = a->ma_remote;
+		M_LINKS(mh)->mf_next = old;
+	} while (atomic_cas((volatile int *)&a->ma_remote,
+			    (int)(uintptr_t)old, (int)(uintptr_t)mh)
+		 != (int)(uintptr_t)old);
+}
 
-	if (mh != NULL && !mh->mh_inuse) {
-		/* update old header */
-		mh->mh_nextblock = M_MKFIELD(M_NEXTOFF(mh) + morespace);
-		mh->mh_inuse = 1;
+/*
+ * Free a block belonging to arena a, which is locked.
+ */
+static
+void
+__malloc_dofree(struct marena *a, struct mheader *mh)
+{
+	size_t size;
+
+	size = M_SIZE(mh);
+	if (size <= MSMALLMAX) {
+		/* Keep it for the next malloc of this size. */
+		mh->mh_cached = 1;
+		M_LINKS(mh)->mf_next = a->ma_classes[M_CLASS(size)];
+		a->ma_classes[M_CLASS(size)] = mh;
+		a->ma_ncached++;
 	}
 	else {
-		/* fill out new header */
-		mh = p;
-		mh->mh_prevblock = rightprevblock;
-		mh->mh_magic1 = MMAGIC;
-		mh->mh_magic2 = MMAGIC;
-		mh->mh_pad = 0;
-		mh->mh_inuse = 1;
-		mh->mh_nextblock = M_MKFIELD(morespace);
+		__malloc_release(a, mh);
 	}
-
-	/*
-	 * Either way, try splitting the block we got as because of
-	 * the page rounding it might be quite a bit bigger than we
-	 * needed.
-	 */
-	__malloc_split(mh, size);
-
-#ifdef MALLOCDEBUG
-	warnx("malloc: allocating at %p", M_DATA(mh));
-	__malloc_dump();
-#endif
-	return M_DATA(mh);
 }
 
-////////////////////////////////////////////////////////////
-
 /*
- * Clear a range of memory with 0xdeadbeef.
- * ptr must be suitably aligned.
+ * Take back all the blocks other threads have freed to arena a,
+ * which is locked.
  */
 static
 void
-__malloc_deadbeef(void *ptr, size_t size)
+__malloc_drain(struct marena *a)
 {
-	uint32_t *x = ptr;
-	size_t i, n = size/sizeof(uint32_t);
-	for (i=0; i<n; i++) {
-		x[i] = 0xdeadbeef;
+	struct mheader *mh, *next;
+
+	mh = (struct mheader *)(uintptr_t)
+		atomic_swap((volatile int *)&a->ma_remote, 0);
+	for (; mh != NULL; mh = next) {
+		next = M_LINKS(mh)->mf_next;
+		__malloc_dofree(a, mh);
 	}
 }
 
 /*
- * Attempt to merge two adjacent blocks (mh below mhnext).
+ * Allocate size bytes (rounded already) from arena a, which is
+ * locked.
  */
 static
-void
-__malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
+struct mheader *
+__malloc_alloc(struct marena *a, size_t size)
 {
-	struct mheader *mhnextnext;
+	struct mheader *mh;
 
-	if (mh->mh_nextblock != mhnext->mh_prevblock) {
-		errx(1, "free: Heap corrupt (%p and %p inconsistent)",
-		     mh, mhnext);
+	if (size <= MSMALLMAX) {
+		/* Reuse a block of exactly this size if there is one. */
+		mh = a->ma_classes[M_CLASS(size)];
+		if (mh != NULL) {
+			if (!M_OK(mh) || !mh->mh_cached) {
+				errx(1, "malloc: Heap corrupt; cached block "
+				     "at %p is bad", M_DATA(mh));
+			}
+			a->ma_classes[M_CLASS(size)] = M_LINKS(mh)->mf_next;
+			a->ma_ncached--;
+			mh->mh_cached = 0;
+			return mh;
+		}
 	}
-	if (mh->mh_inuse || mhnext->mh_inuse) {
-		/* can't merge */
-		return;
+	else if (a->ma_ncached > 0) {
+		/* Large requests see the cached blocks merged first. */
+		__malloc_consolidate(a);
 	}
 
-	mhnextnext = M_NEXT(mhnext);
+	mh = __malloc_findfree(a, size);
+	if (mh == NULL && a->ma_ncached > 0) {
+		__malloc_consolidate(a);
+		mh = __malloc_findfree(a, size);
+	}
+	if (mh == NULL) {
+		mh = a == M_HEAP ? __malloc_growheap(a, size) :
+			__malloc_newseg(a);
+		if (mh == NULL) {
+			return NULL;
+		}
+	}
 
-	mh->mh_nextblock = M_MKFIELD(MBLOCKSIZE + M_SIZE(mh) +
-				     MBLOCKSIZE + M_SIZE(mhnext));
+	/*
+	 * The block may be much bigger than we need (a bigger bin, or
+	 * because of rounding up the sbrk); give back the rest.
+	 */
+	mh->mh_inuse = 1;
+	__malloc_split(a, mh, size);
+	return mh;
+}
 
-	if (mhnextnext != (struct mheader *)__heaptop) {
-		mhnextnext->mh_prevblock = mh->mh_nextblock;
+/*
+ * malloc itself.
+ */
+void *
+malloc(size_t size)
+{
+	struct marena *a;
+	struct mheader *mh;
+
+#ifdef MALLOCDEBUG
+	warnx("malloc: about to allocate %lu (0x%lx) bytes",
+	      (unsigned long) size, (unsigned long) size);
+#endif
+
+	if (size > MSIZEMAX) {
+		return NULL;
 	}
 
-	/* Deadbeef out the memory used by the now-obsolete header */
-	__malloc_deadbeef(mhnext, sizeof(struct mheader));
+	/*
+	 * Round size up to an integral number of blocks, at least one
+	 * so a free block has room for its links.
+	 */
+	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
+	if (size == 0) {
+		size = MBLOCKSIZE;
+	}
+
+	a = __malloc_myarena();
+	if (a != M_HEAP && size > MSEGMAX) {
+		mh = __malloc_huge(size);
+		return mh == NULL ? NULL : M_DATA(mh);
+	}
+
+	spin_lock(&a->ma_lock);
+	if (a->ma_remote != NULL) {
+		__malloc_drain(a);
+	}
+#ifdef MALLOCDEBUG
+	__malloc_dump(a);
+#endif
+
+	mh = __malloc_alloc(a, size);
+
+#ifdef MALLOCDEBUG
+	if (mh != NULL) {
+		warnx("malloc: allocating at %p", M_DATA(mh));
+	}
+	__malloc_dump(a);
+#endif
+	spin_unlock(&a->ma_lock);
+	return mh == NULL ? NULL : M_DATA(mh);
 }
 
+////////////////////////////////////////////////////////////
+
 /*
  * The actual free() implementation.
  */
 void
 free(void *x)
 {
-	struct mheader *mh, *mhnext, *mhprev;
+	struct marena *a;
+	struct mseg *ms;
+	struct mheader *mh;
 
 	if (x==NULL) {
 		/* safest practice */
 		return;
 	}
 
-	/* Consistency check. */
-	if (__heapbase==0 || __heaptop==0 || __heapbase > __heaptop) {
-		warnx("free: Internal error - local data corrupt");
-		errx(1, "free: heapbase 0x%lx; heaptop 0x%lx",
-		     (unsigned long) __heapbase, (unsigned long) __heaptop);
+	/*
+	 * Find the arena it belongs to: the sbrk heap's, or the
+	 * segment's. Don't allow freeing pointers that are in neither.
+	 */
+	if ((uintptr_t)x >= __heapbase && (uintptr_t)x < __heaptop) {
+		a = M_HEAP;
+		ms = NULL;
 	}
-
-	/* Don't allow freeing pointers that aren't on the heap. */
-	if ((uintptr_t)x < __heapbase || (uintptr_t)x >= __heaptop) {
-		errx(1, "free: Invalid pointer %p freed (out of range)", x);
+	else {
+		ms = M_SEG(x);
+		if ((uintptr_t)x < (uintptr_t)ms + MSEGHDR + MBLOCKSIZE ||
+		    ms->ms_magic != MSEGMAGIC) {
+			errx(1, "free: Invalid pointer %p freed "
+			     "(out of range)", x);
+		}
+		a = ms->ms_arena;
 	}
 
-#ifdef MALLOCDEBUG
-	warnx("free: about to free %p", x);
-	__malloc_dump();
-#endif
-
 	mh = ((struct mheader *)x)-1;
 	if (!M_OK(mh)) {
 		errx(1, "free: Invalid pointer %p freed (corrupt header)", x);
 	}
 
-	if (!mh->mh_inuse) {
+	if (!mh->mh_inuse || mh->mh_cached) {
 		errx(1, "free: Invalid pointer %p freed (already free)", x);
 	}
 
-	/* mark it free */
-	mh->mh_inuse = 0;
+	if (a == NULL) {
+		/* A huge block; its segment goes with it */
+		munmap(ms->ms_map, ms->ms_maplen);
+		return;
+	}
 
+#ifdef MALLOCDEBUG
+	warnx("free: about to free %p", x);
 	/* wipe it */
 	__malloc_deadbeef(M_DATA(mh), M_SIZE(mh));
+#endif
 
-	/* Try merging with the block above (but not if we're at the top) */
-	mhnext = M_NEXT(mh);
-	if (mhnext != (struct mheader *)__heaptop) {
-		__malloc_trymerge(mh, mhnext);
-	}
-
-	/* Try merging with the block below (but not if we're at the bottom) */
-	if (mh != (struct mheader *)__heapbase) {
-		mhprev = M_PREV(mh);
-		__malloc_trymerge(mhprev, mh);
+	if (a != __malloc_myarena()) {
+		/* Another thread's; it takes the block back later */
+		__malloc_push(a, mh);
+		return;
 	}
 
+	spin_lock(&a->ma_lock);
+	__malloc_dofree(a, mh);
 #ifdef MALLOCDEBUG
 	warnx("free: freed %p", x);
-	__malloc_dump();
+	__malloc_dump(a);
 #endif
+	spin_unlock(&a->ma_lock);
 }
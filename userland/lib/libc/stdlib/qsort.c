@@ -28,118 +28,225 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
-#include <assert.h>
 
 /*
  * qsort() for OS/161, where it isn't in libc.
+ *
+ * This is an introsort: quicksort with a median-of-three pivot,
+ * insertion sort once a partition gets small, and heapsort for any
+ * partition the quicksort has split too unevenly too many times
+ * (more than 2 log2 n levels), so the worst case is O(n log n).
+ * Partitioning stops on keys equal to the pivot, so arrays full of
+ * duplicates split down the middle rather than lopsidedly.
+ *
+ * Elements that are whole aligned words are swapped a word at a
+ * time, and single words with one load and store each, rather than
+ * a byte at a time.
  */
-void
-qsort(void *vdata, unsigned num, size_t size,
-      int (*f)(const void *, const void *))
-{
-	unsigned pivot, head, tail;
-	char *data = vdata;
-	char tmp[size];
 
-#define COMPARE(aa, bb) \
-		((aa) == (bb) ? 0 : f(data + (aa) * size, data + (bb) * size))
-#define EXCHANGE(aa, bb) \
-		memcpy(tmp, data + (aa) * size, size);			\
-		memcpy(data + (aa) * size, data + (bb) * size, size);	\
-		memcpy(data + (bb) * size, tmp, size)
+/* Partitions this small or smaller get insertion sort */
+#define QSORT_SMALL 12
 
+/* How to swap elements: see qsort_swaptype */
+#define SWAP_WORD   0
+#define SWAP_WORDS  1
+#define SWAP_BYTES  2
 
-	if (num <= 1) {
-		return;
+struct qsort_args {
+	size_t size;
+	int swaptype;
+	int (*f)(const void *, const void *);
+};
+
+static
+int
+qsort_swaptype(const void *data, size_t size)
+{
+	if ((uintptr_t)data % sizeof(long) != 0 || size % sizeof(long) != 0) {
+		return SWAP_BYTES;
 	}
-	if (num == 2) {
-		if (COMPARE(0, 1) > 0) {
-			EXCHANGE(0, 1);
-			return;
+	return size == sizeof(long) ? SWAP_WORD : SWAP_WORDS;
+}
+
+static
+void
+qsort_swap(const struct qsort_args *qa, char *a, char *b)
+{
+	size_t i;
+	long lt;
+	char ct;
+
+	switch (qa->swaptype) {
+	    case SWAP_WORD:
+		lt = *(long *)a;
+		*(long *)a = *(long *)b;
+		*(long *)b = lt;
+		break;
+	    case SWAP_WORDS:
+		for (i=0; i<qa->size; i += sizeof(long)) {
+			lt = *(long *)(a + i);
+			*(long *)(a + i) = *(long *)(b + i);
+			*(long *)(b + i) = lt;
+		}
+		break;
+	    default:
+		for (i=0; i<qa->size; i++) {
+			ct = a[i];
+			a[i] = b[i];
+			b[i] = ct;
 		}
+		break;
 	}
+}
 
-	/*
-	 * 1. Pick a pivot value. For simplicity, always use the
-	 * middle of the array.
-	 */
-	pivot = num / 2;
-
-	/*
-	 * 2. Shift all values less than or equal to the pivot value
-	 * to the front of the array.
-	 */
-	head = 0;
-	tail = num - 1;
-
-	while (head < tail) {
-		if (COMPARE(head, pivot) <= 0) {
-			head++;
+#define ELEM(i) (data + (size_t)(i) * qa->size)
+#define COMPARE(aa, bb) (qa->f(ELEM(aa), ELEM(bb)))
+#define EXCHANGE(aa, bb) qsort_swap(qa, ELEM(aa), ELEM(bb))
+
+static
+void
+qsort_insertion(const struct qsort_args *qa, char *data, unsigned num)
+{
+	unsigned i, j;
+
+	for (i=1; i<num; i++) {
+		for (j=i; j>0 && COMPARE(j - 1, j) > 0; j--) {
+			EXCHANGE(j - 1, j);
 		}
-		else if (COMPARE(tail, pivot) > 0) {
-			tail--;
+	}
+}
+
+/*
+ * Sift element I down the heap of NUM elements at DATA.
+ */
+static
+void
+qsort_siftdown(const struct qsort_args *qa, char *data, unsigned i,
+	       unsigned num)
+{
+	unsigned child;
+
+	while ((child = 2*i + 1) < num) {
+		if (child + 1 < num && COMPARE(child, child + 1) < 0) {
+			child++;
 		}
-		else {
-			EXCHANGE(head, tail);
-			if (pivot == head) {
-				pivot = tail;
-			}
-			else if (pivot == tail) {
-				pivot = head;
-			}
-			head++;
-			tail--;
+		if (COMPARE(i, child) >= 0) {
+			break;
 		}
+		EXCHANGE(i, child);
+		i = child;
 	}
+}
 
-	/*
-	 * 3. If there's an even number of elements and we swapped the
-	 * last two, the head and tail indexes will cross. In this
-	 * case the first entry on the tail side is tail+1. If there's
-	 * an odd number of elements, we stop with head == tail, and
-	 * the first entry on the tail side is this value (hence,
-	 * tail) if it's is greater than the pivot value, and the next
-	 * element (hence, tail+1) if it's less than or equal to the
-	 * pivot value.
-	 *
-	 * Henceforth use "tail" to hold the index of the first entry
-	 * of the back portion of the array.
-	 */
-	if (head > tail || COMPARE(head, pivot) <= 0) {
-		tail++;
+static
+void
+qsort_heap(const struct qsort_args *qa, char *data, unsigned num)
+{
+	unsigned i;
+
+	for (i = num/2; i-- > 0; ) {
+		qsort_siftdown(qa, data, i, num);
+	}
+	for (i = num; i-- > 1; ) {
+		EXCHANGE(0, i);
+		qsort_siftdown(qa, data, 0, i);
 	}
+}
+
+static
+void
+qsort_intro(const struct qsort_args *qa, char *data, unsigned num,
+	    unsigned depth)
+{
+	unsigned mid, head, tail;
+
+	while (num > QSORT_SMALL) {
+		if (depth == 0) {
+			qsort_heap(qa, data, num);
+			return;
+		}
+		depth--;
 
-	/*
-	 * 4. If we got a bad pivot that gave us only one partition,
-	 * because of the order of the advances in the loop above it
-	 * will always put everything in the front portion of the
-	 * array (so tail == num). This happens if we picked the
-	 * largest value. Move the pivot to the end, if necessary, lop
-	 * off all values equal to it, and recurse on the rest.  (If
-	 * there is no rest, the array is already sorted and we're
-	 * done.)
-	 */
-	if (tail == num) {
-		if (pivot < num - 1) {
-			if (COMPARE(pivot, num - 1) > 0) {
-				EXCHANGE(pivot, num - 1);
+		/*
+		 * 1. Order the first, middle, and last elements, then
+		 * move the median (the middle one) to the front as the
+		 * pivot. The first element is then no bigger than the
+		 * pivot and the last no smaller, so neither scan below
+		 * can run off the end.
+		 */
+		mid = num / 2;
+		if (COMPARE(mid, 0) < 0) {
+			EXCHANGE(mid, 0);
+		}
+		if (COMPARE(num - 1, mid) < 0) {
+			EXCHANGE(num - 1, mid);
+			if (COMPARE(mid, 0) < 0) {
+				EXCHANGE(mid, 0);
 			}
 		}
+		EXCHANGE(0, mid);
+
+		/*
+		 * 2. Partition the rest around it, stopping on keys
+		 * equal to the pivot from both sides.
+		 */
+		head = 1;
 		tail = num - 1;
-		while (tail > 0 && COMPARE(tail - 1, tail) == 0) {
+		while (1) {
+			while (COMPARE(head, 0) < 0) {
+				head++;
+			}
+			while (COMPARE(0, tail) < 0) {
+				tail--;
+			}
+			if (head >= tail) {
+				break;
+			}
+			EXCHANGE(head, tail);
+			head++;
 			tail--;
 		}
-		if (tail > 0) {
-			qsort(vdata, tail, size, f);
+
+		/* 3. Put the pivot between the two parts. */
+		EXCHANGE(0, tail);
+
+		/*
+		 * 4. Recurse on the smaller part and loop on the bigger,
+		 * so the stack stays O(log n) deep.
+		 */
+		if (tail < num - tail - 1) {
+			qsort_intro(qa, data, tail, depth);
+			data = ELEM(tail + 1);
+			num = num - tail - 1;
 		}
+		else {
+			qsort_intro(qa, ELEM(tail + 1), num - tail - 1, depth);
+			num = tail;
+		}
+	}
+	qsort_insertion(qa, data, num);
+}
+
+void
+qsort(void *vdata, unsigned num, size_t size,
+      int (*f)(const void *, const void *))
+{
+	struct qsort_args qa;
+	unsigned depth, n;
+
+	if (num <= 1 || size == 0) {
 		return;
 	}
-	assert(tail > 0 && tail < num);
 
-	/*
-	 * 5. Recurse on each subpart of the array.
-	 */
-	qsort(vdata, tail, size, f);
-	qsort((char *)vdata + tail * size, num - tail, size, f);
+	qa.size = size;
+	qa.swaptype = qsort_swaptype(vdata, size);
+	qa.f = f;
+
+	depth = 0;
+	for (n = num; n > 1; n >>= 1) {
+		depth += 2;
+	}
+	qsort_intro(&qa, vdata, num, depth);
 }
@@ -30,6 +30,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <spawn.h>
 #include <string.h>
 
 /*
@@ -54,7 +55,7 @@ system(const char *cmd)
 	char *argv[MAXARGS+1];
 	int nargs=0;
 	char *s;
-	int pid, status;
+	int pid, status, result;
 
 	if (strlen(cmd) >= sizeof(tmp)) {
 		errno = E2BIG;
@@ -74,18 +75,13 @@ system(const char *cmd)
 
 	argv[nargs] = NULL;
 
-	pid = fork();
-	switch (pid) {
-	    case -1:
-		return -1;
-	    case 0:
-		/* child */
-		execv(argv[0], argv);
-		/* exec only returns if it fails */
-		_exit(255);
-	    default:
-		/* parent */
-		waitpid(pid, &status, 0);
-		return status;
+	/* No need to fork a copy of ourselves just to exec */
+	result = posix_spawn(&pid, argv[0], NULL, NULL, argv, NULL);
+	if (result) {
+		/* Look like a child whose exec failed, as before */
+		errno = result;
+		return _MKWAIT_EXIT(255);
 	}
+	waitpid(pid, &status, 0);
+	return status;
 }
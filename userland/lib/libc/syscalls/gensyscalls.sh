@@ -20,6 +20,11 @@ awk '
 	print $2, $3;
     }
 ' | awk '{
+	# Calls wrapped by C code in libc (see unix/fork.c) get a __ prefix.
+	name = $1;
+	if (name == "fork") {
+		name = "__fork";
+	}
 	# output something simple that will work in syscalls.S.
-	printf "SYSCALL(%s, %s)\n", $1, $2;
+	printf "SYSCALL(%s, %s)\n", name, $2;
 }'
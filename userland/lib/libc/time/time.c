@@ -28,15 +28,73 @@
  */
 
 #include <unistd.h>
+#include <kern/timepage.h>
+
+/* The kernel's time page; see <kern/timepage.h> */
+#define TIMEPAGE ((const struct timepage *)TIMEPAGE_VADDR)
+
+/*
+ * Read the time page (as of the last hardclock) without a system
+ * call: take the sequence count, read, and go round again if the
+ * kernel was updating it meanwhile.
+ */
+static
+void
+timepage_read(int clock, struct timespec *ts)
+{
+	const struct timepage *tp = TIMEPAGE;
+	unsigned seq;
+
+	do {
+		seq = tp->tp_seq;
+		__asm volatile("" ::: "memory");
+		if (clock == CLOCK_MONOTONIC_COARSE) {
+			ts->tv_sec = tp->tp_monosec;
+			ts->tv_nsec = tp->tp_mononsec;
+		}
+		else {
+			ts->tv_sec = tp->tp_realsec;
+			ts->tv_nsec = tp->tp_realnsec;
+		}
+		/* Keep the compiler from moving the reads past the checks */
+		__asm volatile("" ::: "memory");
+	} while ((seq & 1) != 0 || seq != tp->tp_seq);
+}
 
 /*
  * POSIX C function: retrieve time in seconds since the epoch.
- * Uses the OS/161 system call __time, which does the same thing
- * but also returns nanoseconds.
+ * Read from the time page, so there is no trap into the kernel; the
+ * system call __time does the same with the clock itself, and also
+ * returns nanoseconds.
  */
 
 time_t
 time(time_t *t)
 {
-	return __time(t, NULL);
+	struct timespec ts;
+
+	timepage_read(CLOCK_REALTIME_COARSE, &ts);
+	if (t != NULL) {
+		*t = ts.tv_sec;
+	}
+	return ts.tv_sec;
+}
+
+/*
+ * POSIX C function: read a clock. The coarse clocks come from the
+ * time page, good to one hardclock; the others from the system call
+ * __clock_gettime, which reads the cycle counter.
+ */
+
+int
+clock_gettime(int clock, struct timespec *ts)
+{
+	switch (clock) {
+	    case CLOCK_REALTIME_COARSE:
+	    case CLOCK_MONOTONIC_COARSE:
+		timepage_read(clock, ts);
+		return 0;
+	    default:
+		return __clock_gettime(clock, ts);
+	}
 }
@@ -45,6 +45,6 @@ __bad_assert(const char *file, int line, const char *expr)
 	snprintf(buf, sizeof(buf), "Assertion failed: %s (%s line %d)\n",
 		 expr, file, line);
 
-	write(STDERR_FILENO, buf, strlen(buf));
+	fputs(buf, stderr);
 	abort();
 }
@@ -53,7 +53,7 @@ __senderr(void *junk, const char *data, size_t len)
 {
 	(void)junk;  /* not needed or used */
 
-	write(STDERR_FILENO, data, len);
+	fwrite(data, 1, len, stderr);
 }
 
 /*
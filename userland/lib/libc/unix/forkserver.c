@@ -0,0 +1,307 @@
+/*
+ * Fork servers; see forkserver.h.
+ *
+ * The helper first sends a hello, so that the client can tell it's
+ * talking to a program that knows the protocol. After that, each
+ * request is a struct fs_req followed by FQ_LEN bytes of strings:
+ * the directory to run in, then the FQ_ARGC arguments, each with its
+ * terminating null. Each reply is a struct fs_reply. The helper stops
+ * when the client closes its ends of the pipes.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <err.h>
+#include <forkserver.h>
+
+#define FS_MAGIC	0x666b7376	/* "fksv" */
+#define FS_MAXREQ	(ARG_MAX + PATH_MAX)
+
+struct fs_req {
+	uint32_t fq_magic;
+	uint32_t fq_argc;
+	uint32_t fq_len;
+};
+
+struct fs_reply {
+	uint32_t fp_magic;
+	int32_t fp_status;		/* from waitpid; 0 in the hello */
+};
+
+/* for err and warn; see crt0 */
+extern char **__argv;
+
+/*
+ * Read or write all of LEN bytes, returning 0 or an error number;
+ * EOF counts as EPIPE.
+ */
+static
+int
+fs_read(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t r;
+
+	while (len > 0) {
+		r = read(fd, p, len);
+		if (r < 0) {
+			return errno;
+		}
+		if (r == 0) {
+			return EPIPE;
+		}
+		p += r;
+		len -= r;
+	}
+	return 0;
+}
+
+static
+int
+fs_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t r;
+
+	while (len > 0) {
+		r = write(fd, p, len);
+		if (r < 0) {
+			return errno;
+		}
+		p += r;
+		len -= r;
+	}
+	return 0;
+}
+
+/*
+ * In a helper's child: wait for a request, and set up to run it. If
+ * the client has gone away, just exit.
+ */
+static
+void
+fs_takereq(int reqfd, int *argcp, char ***argvp)
+{
+	struct fs_req req;
+	char *buf, *p, *cwd, **argv;
+	uint32_t i;
+
+	if (fs_read(reqfd, &req, sizeof(req)) != 0) {
+		_exit(0);
+	}
+	if (req.fq_magic != FS_MAGIC || req.fq_argc == 0 ||
+	    req.fq_len == 0 || req.fq_len > FS_MAXREQ) {
+		_exit(1);
+	}
+	buf = malloc(req.fq_len);
+	argv = malloc((req.fq_argc + 1) * sizeof(argv[0]));
+	if (buf == NULL || argv == NULL) {
+		_exit(1);
+	}
+	if (fs_read(reqfd, buf, req.fq_len) != 0 ||
+	    buf[req.fq_len - 1] != '\0') {
+		_exit(1);
+	}
+
+	p = buf;
+	cwd = p;
+	p += strlen(p) + 1;
+	for (i = 0; i < req.fq_argc; i++) {
+		if (p >= buf + req.fq_len) {
+			_exit(1);
+		}
+		argv[i] = p;
+		p += strlen(p) + 1;
+	}
+	argv[i] = NULL;
+
+	__argv = argv;
+	if (chdir(cwd) < 0) {
+		warn("%s", cwd);
+		_exit(1);
+	}
+	*argcp = req.fq_argc;
+	*argvp = argv;
+}
+
+void
+forkserver_serve(int *argcp, char ***argvp)
+{
+	struct fs_reply rep;
+	int reqfd, replyfd, status;
+	pid_t pid;
+
+	if (*argcp != 4 || strcmp((*argvp)[1], FORKSERVER_ARG) != 0) {
+		return;
+	}
+	reqfd = atoi((*argvp)[2]);
+	replyfd = atoi((*argvp)[3]);
+
+	rep.fp_magic = FS_MAGIC;
+	rep.fp_status = 0;
+	if (fs_write(replyfd, &rep, sizeof(rep)) != 0) {
+		_exit(1);
+	}
+
+	while (1) {
+		/* Fork the next one now, so it's ready before it's wanted */
+		pid = fork();
+		if (pid < 0) {
+			_exit(1);
+		}
+		if (pid == 0) {
+			close(replyfd);
+			fs_takereq(reqfd, argcp, argvp);
+			close(reqfd);
+			return;
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			_exit(1);
+		}
+		rep.fp_status = status;
+		if (fs_write(replyfd, &rep, sizeof(rep)) != 0) {
+			/* The client has gone away */
+			_exit(0);
+		}
+	}
+}
+
+int
+forkserver_start(struct forkserver *fs, const char *path,
+		 const posix_spawn_file_actions_t *fa)
+{
+	posix_spawn_file_actions_t myfa;
+	struct fs_reply rep;
+	char reqstr[16], replystr[16];
+	char *argv[5];
+	int req[2], reply[2], result;
+
+	if (pipe(req) < 0) {
+		return errno;
+	}
+	if (pipe(reply) < 0) {
+		result = errno;
+		close(req[0]);
+		close(req[1]);
+		return result;
+	}
+
+	/* The helper mustn't hold our ends, or it would never see EOF */
+	if (fa != NULL) {
+		myfa = *fa;
+	}
+	else {
+		posix_spawn_file_actions_init(&myfa);
+	}
+	result = posix_spawn_file_actions_addclose(&myfa, req[1]);
+	if (result == 0) {
+		result = posix_spawn_file_actions_addclose(&myfa, reply[0]);
+	}
+
+	if (result == 0) {
+		snprintf(reqstr, sizeof(reqstr), "%d", req[0]);
+		snprintf(replystr, sizeof(replystr), "%d", reply[1]);
+		argv[0] = (char *)path;
+		argv[1] = (char *)FORKSERVER_ARG;
+		argv[2] = reqstr;
+		argv[3] = replystr;
+		argv[4] = NULL;
+		result = posix_spawn(&fs->fs_pid, path, &myfa, NULL, argv,
+				     NULL);
+	}
+	posix_spawn_file_actions_destroy(&myfa);
+	close(req[0]);
+	close(reply[1]);
+	if (result) {
+		close(req[1]);
+		close(reply[0]);
+		return result;
+	}
+	fs->fs_reqfd = req[1];
+	fs->fs_replyfd = reply[0];
+
+	/* A program that isn't built to be a helper won't say hello */
+	result = fs_read(fs->fs_replyfd, &rep, sizeof(rep));
+	if (result == EPIPE || (result == 0 && rep.fp_magic != FS_MAGIC)) {
+		result = ENOEXEC;
+	}
+	if (result) {
+		forkserver_stop(fs);
+		return result;
+	}
+	return 0;
+}
+
+int
+forkserver_run(struct forkserver *fs, char *const argv[], int *status)
+{
+	char cwd[PATH_MAX];
+	struct fs_req *req;
+	struct fs_reply rep;
+	size_t len, n;
+	char *p;
+	int argc, result;
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL) {
+		return errno;
+	}
+	len = strlen(cwd) + 1;
+	for (argc = 0; argv[argc] != NULL; argc++) {
+		len += strlen(argv[argc]) + 1;
+	}
+	if (argc == 0) {
+		return EINVAL;
+	}
+	if (len > FS_MAXREQ) {
+		return E2BIG;
+	}
+
+	req = malloc(sizeof(*req) + len);
+	if (req == NULL) {
+		return ENOMEM;
+	}
+	req->fq_magic = FS_MAGIC;
+	req->fq_argc = argc;
+	req->fq_len = len;
+	p = (char *)(req + 1);
+	n = strlen(cwd) + 1;
+	memcpy(p, cwd, n);
+	p += n;
+	for (argc = 0; argv[argc] != NULL; argc++) {
+		n = strlen(argv[argc]) + 1;
+		memcpy(p, argv[argc], n);
+		p += n;
+	}
+	result = fs_write(fs->fs_reqfd, req, sizeof(*req) + len);
+	free(req);
+	if (result) {
+		return result;
+	}
+
+	result = fs_read(fs->fs_replyfd, &rep, sizeof(rep));
+	if (result) {
+		return result;
+	}
+	if (rep.fp_magic != FS_MAGIC) {
+		return EIO;
+	}
+	*status = rep.fp_status;
+	return 0;
+}
+
+void
+forkserver_stop(struct forkserver *fs)
+{
+	int status;
+
+	close(fs->fs_reqfd);
+	close(fs->fs_replyfd);
+	waitpid(fs->fs_pid, &status, 0);
+}
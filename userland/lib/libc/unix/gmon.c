@@ -0,0 +1,103 @@
+/*
+ * gprof-lite, on top of the profil system call. See <sys/gmon.h>.
+ *
+ * The histogram has one 16-bit counter per instruction (scale
+ * 0x8000, a counter for every four bytes of text) and lives in
+ * memory from malloc, which is why the program has to ask for it.
+ */
+
+#include <sys/types.h>
+#include <sys/gmon.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define GMON_SCALE	0x8000
+
+static unsigned short *gmon_buf;
+static size_t gmon_size;
+static unsigned long gmon_lowpc, gmon_highpc;
+static pid_t gmon_pid;		/* a forked child isn't profiled */
+
+int
+monstartup(unsigned long lowpc, unsigned long highpc)
+{
+	lowpc &= ~3UL;
+	highpc = (highpc + 3) & ~3UL;
+	if (highpc <= lowpc || gmon_buf != NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	gmon_size = (highpc - lowpc) / 4 * sizeof(unsigned short);
+	gmon_buf = malloc(gmon_size);
+	if (gmon_buf == NULL) {
+		return -1;
+	}
+	bzero(gmon_buf, gmon_size);
+	gmon_lowpc = lowpc;
+	gmon_highpc = highpc;
+	gmon_pid = getpid();
+
+	if (profil(gmon_buf, gmon_size, lowpc, GMON_SCALE) < 0) {
+		free(gmon_buf);
+		gmon_buf = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+void
+moncontrol(int on)
+{
+	if (gmon_buf == NULL || getpid() != gmon_pid) {
+		return;
+	}
+	profil(gmon_buf, gmon_size, gmon_lowpc, on ? GMON_SCALE : 0);
+}
+
+void
+_mcleanup(void)
+{
+	char line[64];
+	size_t i, len;
+	int fd;
+
+	if (gmon_buf == NULL) {
+		return;
+	}
+	if (getpid() != gmon_pid) {
+		/* The counts are the parent's */
+		free(gmon_buf);
+		gmon_buf = NULL;
+		return;
+	}
+	profil(NULL, 0, 0, 0);
+
+	fd = open(GMON_OUT, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		/* Nothing else to be done about it on the way out */
+		printf("%s: %s\n", GMON_OUT, strerror(errno));
+	}
+	else {
+		len = snprintf(line, sizeof(line), "# 0x%lx 0x%lx 0x%x\n",
+			       gmon_lowpc, gmon_highpc, GMON_SCALE);
+		write(fd, line, len);
+		for (i=0; i < gmon_size / sizeof(gmon_buf[0]); i++) {
+			if (gmon_buf[i] == 0) {
+				continue;
+			}
+			len = snprintf(line, sizeof(line), "0x%lx %u\n",
+				       gmon_lowpc + i * 4,
+				       (unsigned)gmon_buf[i]);
+			write(fd, line, len);
+		}
+		close(fd);
+	}
+
+	free(gmon_buf);
+	gmon_buf = NULL;
+}
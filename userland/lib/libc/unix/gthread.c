@@ -0,0 +1,465 @@
+/*
+ * Green threads; see gthread.h.
+ *
+ * A gthread's struct sits at the bottom of its stack, and stacks are
+ * GTHREAD_STACKSIZE-aligned, so gthread_self is just a mask of the
+ * stack pointer. Each worker runs gt_work on its own stack and
+ * switches to a gthread to run it (__gthread_switch, in
+ * arch/mips/gthread-mips.S). The gthread gives the worker up by
+ * switching back, having left in w_after what to do with it once it
+ * is off its stack: put it back on the run queue, let go of the
+ * gthread it is joining, or finish it. That way no other worker can
+ * pick it up while it is still running here.
+ *
+ * The locks (atomic.h) are only held for a few instructions.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <atomic.h>
+#include <gthread.h>
+
+/* Stacks are made this many at a time, and never given back */
+#define GT_CHUNK	16
+
+/* Saved registers: sp, ra, s0-s8; see gthread-mips.S */
+#define GT_NREGS	11
+
+struct gthread {
+	uint32_t gt_regs[GT_NREGS];
+	struct spin gt_lock;		/* for gt_done and gt_joiner */
+	int (*gt_func)(void *);
+	void *gt_arg;
+	int gt_status;
+	bool gt_done;			/* finished, and off its stack */
+	bool gt_detached;		/* nobody will join it */
+	struct gthread *gt_joiner;	/* waiting in gthread_join */
+	struct gthread *gt_next;	/* on a run queue or the free list */
+	struct gworker *gt_worker;	/* running on */
+};
+
+/* What a worker does with the gthread that just switched back to it */
+enum gt_after {
+	GT_REQUEUE,			/* run it again later */
+	GT_UNLOCK,			/* it's waiting; release w_unlock */
+	GT_EXITED,			/* it's finished */
+};
+
+struct gworker {
+	uint32_t w_regs[GT_NREGS];	/* gt_work's */
+	struct spin w_lock;		/* for the run queue */
+	struct gthread *volatile w_head;
+	struct gthread *w_tail;
+	enum gt_after w_after;
+	struct spin *w_unlock;		/* for GT_UNLOCK */
+	int w_tid;			/* kernel thread, or -1 */
+};
+
+static struct gworker gt_workers[GTHREAD_MAXWORKERS];
+static unsigned gt_nworkers;
+static bool gt_running;
+static volatile int gt_ntasks;		/* gthreads not yet finished */
+static volatile int gt_nidle;		/* workers asleep, or nearly */
+static volatile int gt_seq;		/* bumped when there's new work */
+static struct gthread *gt_root;		/* gthread_run's */
+static int gt_rootstatus;
+
+static struct spin gt_freelock = SPIN_INITIALIZER;
+static struct gthread *gt_freelist;
+
+void __gthread_switch(uint32_t *from, const uint32_t *to);
+
+////////////////////////////////////////////////////////////
+// stacks
+
+/*
+ * Get a stack, with its struct gthread at the bottom.
+ */
+static
+struct gthread *
+gt_alloc(void)
+{
+	struct gthread *t;
+	uintptr_t base;
+	void *p;
+	unsigned i;
+
+	for (;;) {
+		spin_lock(&gt_freelock);
+		t = gt_freelist;
+		if (t != NULL) {
+			gt_freelist = t->gt_next;
+			spin_unlock(&gt_freelock);
+			return t;
+		}
+		spin_unlock(&gt_freelock);
+
+		/* One more than we need, to line them up */
+		p = mmap(NULL, (GT_CHUNK + 1) * GTHREAD_STACKSIZE,
+			 PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON,
+			 -1, 0);
+		if (p == MAP_FAILED) {
+			return NULL;
+		}
+		base = ((uintptr_t)p + GTHREAD_STACKSIZE - 1) &
+			~(uintptr_t)(GTHREAD_STACKSIZE - 1);
+
+		spin_lock(&gt_freelock);
+		for (i=0; i<GT_CHUNK; i++) {
+			t = (struct gthread *)(base + i * GTHREAD_STACKSIZE);
+			t->gt_next = gt_freelist;
+			gt_freelist = t;
+		}
+		spin_unlock(&gt_freelock);
+	}
+}
+
+static
+void
+gt_free(struct gthread *t)
+{
+	spin_lock(&gt_freelock);
+	t->gt_next = gt_freelist;
+	gt_freelist = t;
+	spin_unlock(&gt_freelock);
+}
+
+////////////////////////////////////////////////////////////
+// run queues
+
+/*
+ * Put T on W's run queue, and wake a sleeping worker to take it.
+ */
+static
+void
+gt_enqueue(struct gworker *w, struct gthread *t)
+{
+	t->gt_next = NULL;
+	spin_lock(&w->w_lock);
+	if (w->w_tail == NULL) {
+		w->w_head = t;
+	}
+	else {
+		w->w_tail->gt_next = t;
+	}
+	w->w_tail = t;
+	spin_unlock(&w->w_lock);
+
+	/* See gt_idle for why this order */
+	atomic_add(&gt_seq, 1);
+	if (gt_nidle > 0) {
+		futex(&gt_seq, FUTEX_WAKE, 1, NULL);
+	}
+}
+
+static
+struct gthread *
+gt_dequeue(struct gworker *w)
+{
+	struct gthread *t;
+
+	if (w->w_head == NULL) {
+		/* Don't bother locking an empty queue */
+		return NULL;
+	}
+	spin_lock(&w->w_lock);
+	t = w->w_head;
+	if (t != NULL) {
+		w->w_head = t->gt_next;
+		if (w->w_head == NULL) {
+			w->w_tail = NULL;
+		}
+	}
+	spin_unlock(&w->w_lock);
+	return t;
+}
+
+/*
+ * The next gthread for W to run: from its own queue if it can, or
+ * else from the others'.
+ */
+static
+struct gthread *
+gt_next(struct gworker *w)
+{
+	struct gthread *t;
+	unsigned i, me;
+
+	me = w - gt_workers;
+	for (i=0; i<gt_nworkers; i++) {
+		t = gt_dequeue(&gt_workers[(me + i) % gt_nworkers]);
+		if (t != NULL) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Sleep until there might be work. We count ourselves idle before
+ * looking at gt_seq and the queues one last time, and gt_enqueue
+ * bumps gt_seq before looking at gt_nidle, so either it sees us and
+ * wakes us or we see its gthread (or the futex sees the new gt_seq).
+ */
+static
+void
+gt_idle(void)
+{
+	unsigned i;
+	int seq;
+
+	atomic_add(&gt_nidle, 1);
+	seq = gt_seq;
+	for (i=0; i<gt_nworkers; i++) {
+		if (gt_workers[i].w_head != NULL) {
+			break;
+		}
+	}
+	if (i == gt_nworkers && gt_ntasks > 0) {
+		futex(&gt_seq, FUTEX_WAIT, seq, NULL);
+	}
+	atomic_add(&gt_nidle, -1);
+}
+
+////////////////////////////////////////////////////////////
+// workers
+
+/*
+ * T has switched away for the last time. Tell its joiner, if any.
+ */
+static
+void
+gt_finish(struct gworker *w, struct gthread *t)
+{
+	struct gthread *joiner;
+	bool detached;
+
+	if (t == gt_root) {
+		gt_rootstatus = t->gt_status;
+	}
+
+	spin_lock(&t->gt_lock);
+	t->gt_done = true;
+	joiner = t->gt_joiner;
+	detached = t->gt_detached;
+	spin_unlock(&t->gt_lock);
+
+	if (joiner != NULL) {
+		gt_enqueue(w, joiner);
+	}
+	if (detached) {
+		gt_free(t);
+	}
+	if (atomic_add(&gt_ntasks, -1) == 0) {
+		/* All done; get everyone out of gt_idle */
+		atomic_add(&gt_seq, 1);
+		futex(&gt_seq, FUTEX_WAKE, gt_nworkers, NULL);
+	}
+}
+
+/*
+ * A worker: run gthreads until there are none left.
+ */
+static
+void
+gt_work(struct gworker *w)
+{
+	struct gthread *t;
+
+	while (gt_ntasks > 0) {
+		t = gt_next(w);
+		if (t == NULL) {
+			gt_idle();
+			continue;
+		}
+		t->gt_worker = w;
+		__gthread_switch(w->w_regs, t->gt_regs);
+
+		switch (w->w_after) {
+		    case GT_REQUEUE:
+			gt_enqueue(w, t);
+			break;
+		    case GT_UNLOCK:
+			spin_unlock(w->w_unlock);
+			break;
+		    case GT_EXITED:
+			gt_finish(w, t);
+			break;
+		}
+	}
+}
+
+/* thread_create function for the other workers */
+static
+int
+gt_helper(void *arg)
+{
+	gt_work(arg);
+	return 0;
+}
+
+/*
+ * Give T's worker back, which does AFTER with it (and UNLOCK).
+ */
+static
+void
+gt_switchout(struct gthread *t, enum gt_after after, struct spin *unlock)
+{
+	struct gworker *w;
+
+	w = t->gt_worker;
+	w->w_after = after;
+	w->w_unlock = unlock;
+	__gthread_switch(t->gt_regs, w->w_regs);
+}
+
+/* Where a new gthread starts */
+static
+void
+gt_start(void)
+{
+	struct gthread *t;
+
+	t = gthread_self();
+	gthread_exit(t->gt_func(t->gt_arg));
+}
+
+/*
+ * Make a gthread to run FUNC(ARG); it starts out in gt_start, with
+ * its stack just above its struct gthread, less the argument slots
+ * the calling convention asks for.
+ */
+static
+struct gthread *
+gt_make(int (*func)(void *), void *arg)
+{
+	struct gthread *t;
+
+	t = gt_alloc();
+	if (t == NULL) {
+		return NULL;
+	}
+	bzero(t, sizeof(*t));
+	t->gt_func = func;
+	t->gt_arg = arg;
+	t->gt_regs[0] = (uintptr_t)t + GTHREAD_STACKSIZE - 16;
+	t->gt_regs[1] = (uintptr_t)gt_start;
+	atomic_add(&gt_ntasks, 1);
+	return t;
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+int
+gthread_run(unsigned nworkers, int (*func)(void *), void *arg)
+{
+	struct gworker *w;
+	unsigned i;
+	int status;
+
+	if (nworkers == 0 || nworkers > GTHREAD_MAXWORKERS || gt_running) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	bzero(gt_workers, sizeof(gt_workers));
+	gt_nworkers = nworkers;
+	gt_root = gt_make(func, arg);
+	if (gt_root == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	gt_root->gt_detached = true;
+	gt_running = true;
+	gt_enqueue(&gt_workers[0], gt_root);
+
+	/* If we can't have as many workers as asked, make do */
+	gt_workers[0].w_tid = -1;
+	for (i=1; i<nworkers; i++) {
+		w = &gt_workers[i];
+		w->w_tid = thread_create(gt_helper, w);
+	}
+
+	gt_work(&gt_workers[0]);
+
+	for (i=1; i<nworkers; i++) {
+		if (gt_workers[i].w_tid >= 0) {
+			thread_join(gt_workers[i].w_tid, &status);
+		}
+	}
+	gt_running = false;
+	return gt_rootstatus;
+}
+
+struct gthread *
+gthread_create(int (*func)(void *), void *arg)
+{
+	struct gthread *t;
+
+	t = gt_make(func, arg);
+	if (t == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	gt_enqueue(gthread_self()->gt_worker, t);
+	return t;
+}
+
+int
+gthread_join(struct gthread *t)
+{
+	struct gthread *self;
+	int status;
+
+	self = gthread_self();
+	spin_lock(&t->gt_lock);
+	if (t->gt_done) {
+		spin_unlock(&t->gt_lock);
+	}
+	else {
+		/* gt_finish puts us back on a run queue */
+		t->gt_joiner = self;
+		gt_switchout(self, GT_UNLOCK, &t->gt_lock);
+	}
+	status = t->gt_status;
+	gt_free(t);
+	return status;
+}
+
+void
+gthread_exit(int status)
+{
+	struct gthread *t;
+
+	t = gthread_self();
+	t->gt_status = status;
+	gt_switchout(t, GT_EXITED, NULL);
+	/* not reached */
+	abort();
+	for (;;);
+}
+
+void
+gthread_yield(void)
+{
+	struct gthread *t;
+
+	t = gthread_self();
+	gt_switchout(t, GT_REQUEUE, NULL);
+}
+
+struct gthread *
+gthread_self(void)
+{
+	char here;
+
+	return (struct gthread *)((uintptr_t)&here &
+				  ~(uintptr_t)(GTHREAD_STACKSIZE - 1));
+}
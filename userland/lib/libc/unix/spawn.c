@@ -0,0 +1,177 @@
+/*
+ * posix_spawn and its file actions, on top of the __spawn system
+ * call, which does the work.
+ */
+
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+
+int
+posix_spawn_file_actions_init(posix_spawn_file_actions_t *fa)
+{
+	fa->fa_count = 0;
+	return 0;
+}
+
+int
+posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *fa)
+{
+	fa->fa_count = 0;
+	return 0;
+}
+
+static
+struct spawn_action *
+spawn_newaction(posix_spawn_file_actions_t *fa, int op, int fd)
+{
+	struct spawn_action *act;
+
+	if (fa->fa_count >= SPAWN_MAXACTIONS) {
+		return NULL;
+	}
+	act = &fa->fa_actions[fa->fa_count++];
+	bzero(act, sizeof(*act));
+	act->sa_op = op;
+	act->sa_fd = fd;
+	return act;
+}
+
+int
+posix_spawn_file_actions_addopen(posix_spawn_file_actions_t *fa, int fd,
+				 const char *path, int oflag, mode_t mode)
+{
+	struct spawn_action *act;
+
+	if (fd < 0) {
+		return EBADF;
+	}
+	act = spawn_newaction(fa, SPAWN_OPEN, fd);
+	if (act == NULL) {
+		return ENOMEM;
+	}
+	/* The path is read when spawning, so it must stay valid */
+	act->sa_path = path;
+	act->sa_flags = oflag;
+	act->sa_mode = mode;
+	return 0;
+}
+
+int
+posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *fa, int fd)
+{
+	if (fd < 0) {
+		return EBADF;
+	}
+	if (spawn_newaction(fa, SPAWN_CLOSE, fd) == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+int
+posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *fa, int fd,
+				 int newfd)
+{
+	struct spawn_action *act;
+
+	if (fd < 0 || newfd < 0) {
+		return EBADF;
+	}
+	act = spawn_newaction(fa, SPAWN_DUP2, fd);
+	if (act == NULL) {
+		return ENOMEM;
+	}
+	act->sa_newfd = newfd;
+	return 0;
+}
+
+int
+posix_spawn(pid_t *pid, const char *path,
+	    const posix_spawn_file_actions_t *fa,
+	    const posix_spawnattr_t *attrp,
+	    char *const argv[], char *const envp[])
+{
+	pid_t p;
+
+	(void)envp;
+
+	if (attrp != NULL) {
+		return ENOSYS;
+	}
+
+	/* keep our buffered output ahead of the child's */
+	fflush(NULL);
+
+	p = __spawn(path, argv,
+		    fa != NULL ? fa->fa_actions : NULL,
+		    fa != NULL ? fa->fa_count : 0);
+	if (p < 0) {
+		return errno;
+	}
+	if (pid != NULL) {
+		*pid = p;
+	}
+	return 0;
+}
+
+/*
+ * Like execvp, try each directory on the search path until one of
+ * them has the program.
+ */
+int
+posix_spawnp(pid_t *pid, const char *file,
+	     const posix_spawn_file_actions_t *fa,
+	     const posix_spawnattr_t *attrp,
+	     char *const argv[], char *const envp[])
+{
+	const char *searchpath, *s, *t;
+	char progpath[PATH_MAX];
+	size_t len;
+	int result;
+
+	if (strchr(file, '/') != NULL) {
+		return posix_spawn(pid, file, fa, attrp, argv, envp);
+	}
+
+	searchpath = getenv("PATH");
+	if (searchpath == NULL) {
+		return ENOENT;
+	}
+
+	for (s = searchpath; s != NULL; s = t) {
+		t = strchr(s, ':');
+		if (t != NULL) {
+			len = t - s;
+			/* advance past the colon */
+			t++;
+		}
+		else {
+			len = strlen(s);
+		}
+		if (len == 0) {
+			continue;
+		}
+		if (len >= sizeof(progpath)) {
+			continue;
+		}
+		memcpy(progpath, s, len);
+		snprintf(progpath + len, sizeof(progpath) - len, "/%s", file);
+		result = posix_spawn(pid, progpath, fa, attrp, argv, envp);
+		switch (result) {
+		    case ENOENT:
+		    case ENOTDIR:
+		    case ENOEXEC:
+			/* routine errors, try next dir */
+			break;
+		    default:
+			/* worked, or failed for real */
+			return result;
+		}
+	}
+	return ENOENT;
+}
@@ -0,0 +1,94 @@
+/*
+ * Spinlocks and seqlocks; see atomic.h.
+ */
+
+#include <stdbool.h>
+#include <atomic.h>
+
+/* Longest a spinlock waits between looks at the lock, in loops */
+#define SPIN_MAXBACKOFF	1024
+
+void
+spin_init(struct spin *s)
+{
+	s->s_held = 0;
+}
+
+bool
+spin_trylock(struct spin *s)
+{
+	return s->s_held == 0 && atomic_swap(&s->s_held, 1) == 0;
+}
+
+/*
+ * Spin until the lock looks free, and only then try for it, so that
+ * waiters mostly read the word instead of fighting over it; and wait
+ * longer each time we lose, so they don't all try at once.
+ */
+void
+spin_lock(struct spin *s)
+{
+	volatile unsigned i;
+	unsigned backoff;
+
+	backoff = 1;
+	while (!spin_trylock(s)) {
+		for (i=0; i<backoff; i++) {
+			/* nothing */
+		}
+		if (backoff < SPIN_MAXBACKOFF) {
+			backoff *= 2;
+		}
+	}
+}
+
+void
+spin_unlock(struct spin *s)
+{
+	/* Nothing from inside the lock may move past this */
+	atomic_barrier();
+	s->s_held = 0;
+}
+
+void
+seq_init(struct seqlock *sq)
+{
+	sq->sq_seq = 0;
+	spin_init(&sq->sq_lock);
+}
+
+unsigned
+seq_readbegin(struct seqlock *sq)
+{
+	unsigned seq;
+
+	/* Wait out a writer */
+	while ((seq = sq->sq_seq) & 1) {
+		/* nothing */
+	}
+	atomic_barrier();
+	return seq;
+}
+
+bool
+seq_readretry(struct seqlock *sq, unsigned seq)
+{
+	atomic_barrier();
+	return sq->sq_seq != seq;
+}
+
+void
+seq_writebegin(struct seqlock *sq)
+{
+	spin_lock(&sq->sq_lock);
+	sq->sq_seq++;
+	atomic_barrier();
+}
+
+void
+seq_writeend(struct seqlock *sq)
+{
+	atomic_barrier();
+	sq->sq_seq++;
+	spin_unlock(&sq->sq_lock);
+}
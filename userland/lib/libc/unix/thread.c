@@ -0,0 +1,26 @@
+/*
+ * User threads: thread_create, on top of the __thread_create system
+ * call.
+ *
+ * The kernel starts the new thread at __thread_start with the
+ * function and argument, so that a thread that returns from its
+ * function exits cleanly with the value returned, for thread_join.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+static
+void
+__thread_start(int (*func)(void *), void *arg)
+{
+	thread_exit(func(arg));
+}
+
+int
+thread_create(int (*func)(void *), void *arg)
+{
+	/* stdio has no locking; stop buffering before it's shared */
+	__stdio_unbuffer();
+	return __thread_create(__thread_start, func, arg);
+}
@@ -0,0 +1,202 @@
+/*
+ * matlib.c
+ *
+ *	Matrix multiplication for the VM tests. See <test/matlib.h>.
+ *
+ * The arithmetic is done on unsigned ints (through the same storage)
+ * so overflow is defined and all three methods agree bit for bit.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <test/matlib.h>
+
+#define T		MATLIB_TILE
+#define TILEBYTES	(T * T * sizeof(unsigned))
+
+static const char *const matlib_names[] = {
+	[MATLIB_NAIVE] = "naive",
+	[MATLIB_TILED] = "tiled",
+	[MATLIB_BLOCKED] = "blocked",
+};
+
+#define NMETHODS (sizeof(matlib_names) / sizeof(matlib_names[0]))
+
+static
+unsigned
+min(unsigned a, unsigned b)
+{
+	return a < b ? a : b;
+}
+
+/*
+ * CROW[j] += AIK * BROW[j] for the LEN values of j, four at a time.
+ */
+static
+void
+matlib_rowkern(unsigned *crow, unsigned aik, const unsigned *brow,
+	       unsigned len)
+{
+	unsigned j;
+
+	for (j=0; j+4 <= len; j+=4) {
+		crow[j] += aik * brow[j];
+		crow[j+1] += aik * brow[j+1];
+		crow[j+2] += aik * brow[j+2];
+		crow[j+3] += aik * brow[j+3];
+	}
+	for (; j<len; j++) {
+		crow[j] += aik * brow[j];
+	}
+}
+
+static
+void
+matlib_naive(unsigned *c, const unsigned *a, const unsigned *b, unsigned n)
+{
+	unsigned i, j, k, sum;
+
+	for (i=0; i<n; i++) {
+		for (j=0; j<n; j++) {
+			sum = 0;
+			for (k=0; k<n; k++) {
+				sum += a[i*n + k] * b[k*n + j];
+			}
+			c[i*n + j] = sum;
+		}
+	}
+}
+
+static
+void
+matlib_tiled(unsigned *c, const unsigned *a, const unsigned *b, unsigned n)
+{
+	unsigned ii, jj, kk, ie, je, ke, i, k;
+
+	memset(c, 0, n * n * sizeof(unsigned));
+	for (ii=0; ii<n; ii+=T) {
+		ie = min(ii + T, n);
+		for (kk=0; kk<n; kk+=T) {
+			ke = min(kk + T, n);
+			for (jj=0; jj<n; jj+=T) {
+				je = min(jj + T, n);
+				for (i=ii; i<ie; i++) {
+					for (k=kk; k<ke; k++) {
+						matlib_rowkern(&c[i*n + jj],
+							       a[i*n + k],
+							       &b[k*n + jj],
+							       je - jj);
+					}
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Copy the ROWS by COLS tile of M (N wide) at ROW, COL into BUF, T
+ * wide.
+ */
+static
+void
+matlib_pack(unsigned *buf, const unsigned *m, unsigned n,
+	    unsigned row, unsigned col, unsigned rows, unsigned cols)
+{
+	unsigned i;
+
+	for (i=0; i<rows; i++) {
+		memcpy(&buf[i*T], &m[(row + i)*n + col],
+		       cols * sizeof(unsigned));
+	}
+}
+
+static
+int
+matlib_blocked(unsigned *c, const unsigned *a, const unsigned *b, unsigned n)
+{
+	void *mem;
+	unsigned *abuf, *bbuf;
+	unsigned ii, jj, kk, ih, jw, kh, i, k;
+
+	/* Two tiles, each on a page of its own */
+	mem = malloc(3 * TILEBYTES);
+	if (mem == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	abuf = (unsigned *)(((uintptr_t)mem + TILEBYTES - 1) &
+			    ~(uintptr_t)(TILEBYTES - 1));
+	bbuf = abuf + T * T;
+
+	memset(c, 0, n * n * sizeof(unsigned));
+	for (kk=0; kk<n; kk+=T) {
+		kh = min(T, n - kk);
+		for (jj=0; jj<n; jj+=T) {
+			jw = min(T, n - jj);
+			matlib_pack(bbuf, b, n, kk, jj, kh, jw);
+			for (ii=0; ii<n; ii+=T) {
+				ih = min(T, n - ii);
+				matlib_pack(abuf, a, n, ii, kk, ih, kh);
+				for (i=0; i<ih; i++) {
+					for (k=0; k<kh; k++) {
+						matlib_rowkern(
+						    &c[(ii + i)*n + jj],
+						    abuf[i*T + k],
+						    &bbuf[k*T], jw);
+					}
+				}
+			}
+		}
+	}
+
+	free(mem);
+	return 0;
+}
+
+int
+matlib_mul(enum matlib_method method, int *c, const int *a, const int *b,
+	   unsigned n)
+{
+	unsigned *uc = (unsigned *)c;
+	const unsigned *ua = (const unsigned *)a;
+	const unsigned *ub = (const unsigned *)b;
+
+	switch (method) {
+	    case MATLIB_NAIVE:
+		matlib_naive(uc, ua, ub, n);
+		return 0;
+	    case MATLIB_TILED:
+		matlib_tiled(uc, ua, ub, n);
+		return 0;
+	    case MATLIB_BLOCKED:
+		return matlib_blocked(uc, ua, ub, n);
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+int
+matlib_lookup(const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<NMETHODS; i++) {
+		if (!strcmp(name, matlib_names[i])) {
+			return i;
+		}
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+const char *
+matlib_name(enum matlib_method method)
+{
+	if ((unsigned)method >= NMETHODS) {
+		return "?";
+	}
+	return matlib_names[method];
+}
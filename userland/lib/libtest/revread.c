@@ -0,0 +1,144 @@
+/*
+ * revread.c
+ *
+ *	Reading files backwards. See <test/revread.h>.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <test/revread.h>
+
+int
+revread_init(struct revread *rr, int fd)
+{
+	off_t end;
+
+	end = lseek(fd, 0, SEEK_END);
+	if (end < 0) {
+		return -1;
+	}
+
+	rr->size = 2 * REVREAD_CHUNK;
+	rr->buf = malloc(rr->size);
+	if (rr->buf == NULL) {
+		return -1;
+	}
+	rr->fd = fd;
+	rr->off = rr->size;
+	rr->len = 0;
+	rr->pos = end;
+
+	/* only a hint; going without is slower, not wrong */
+	(void)fadvise(fd, 0, 0, FADV_RANDOM);
+	return 0;
+}
+
+/*
+ * Read the piece of the file before what's in the buffer, moving
+ * that to the end of the buffer to make room. Reads start on a chunk
+ * boundary, so after the first (which ends at EOF) every read is
+ * whole chunks. If a line is too long to leave room for a chunk, the
+ * buffer doubles.
+ */
+static
+int
+revread_fill(struct revread *rr)
+{
+	size_t room, newsize, n;
+	off_t start;
+	ssize_t r;
+	char *newbuf;
+
+	if (rr->size - rr->len < REVREAD_CHUNK) {
+		/* libc has no realloc; this also moves the data to the end */
+		newsize = rr->size * 2;
+		newbuf = malloc(newsize);
+		if (newbuf == NULL) {
+			return -1;
+		}
+		memcpy(newbuf + newsize - rr->len, rr->buf + rr->off, rr->len);
+		free(rr->buf);
+		rr->buf = newbuf;
+		rr->size = newsize;
+		rr->off = newsize - rr->len;
+	}
+	memmove(rr->buf + rr->size - rr->len, rr->buf + rr->off, rr->len);
+	rr->off = rr->size - rr->len;
+
+	/* round the start up to a chunk, so it's at most ROOM back */
+	room = rr->off;
+	start = rr->pos - (off_t)room;
+	if (start < 0) {
+		start = 0;
+	}
+	start = (start + REVREAD_CHUNK - 1) / REVREAD_CHUNK * REVREAD_CHUNK;
+	n = rr->pos - start;
+
+	r = pread(rr->fd, rr->buf + rr->off - n, n, start);
+	if (r < 0) {
+		return -1;
+	}
+	if ((size_t)r != n) {
+		/* the file got shorter under us */
+		errno = EIO;
+		return -1;
+	}
+	rr->off -= n;
+	rr->len += n;
+	rr->pos = start;
+	return 0;
+}
+
+ssize_t
+revread_line(struct revread *rr, const char **linep)
+{
+	size_t skip, i, linelen;
+	char *data;
+
+	/* don't take the line's own newline for the end of the one before */
+	skip = 1;
+	while (1) {
+		data = rr->buf + rr->off;
+		for (i = rr->len; i > skip; i--) {
+			if (data[i - skip - 1] == '\n') {
+				break;
+			}
+		}
+		if (i > skip || rr->pos == 0) {
+			/* found the newline before, or the start of the file */
+			i = i > skip ? i - skip : 0;
+			break;
+		}
+		/* everything here is in the line; get the piece before */
+		if (rr->len > skip) {
+			skip = rr->len;
+		}
+		if (revread_fill(rr) < 0) {
+			return -1;
+		}
+	}
+
+	linelen = rr->len - i;
+	*linep = data + i;
+	rr->len = i;
+	return linelen;
+}
+
+off_t
+revread_tell(const struct revread *rr)
+{
+	return rr->pos + rr->len;
+}
+
+void
+revread_fini(struct revread *rr)
+{
+	/* the advice stays with the file, so don't leave it behind */
+	(void)fadvise(rr->fd, 0, 0, FADV_NORMAL);
+	free(rr->buf);
+	rr->buf = NULL;
+}
@@ -0,0 +1,273 @@
+/*
+ * sortlib.c
+ *
+ *	Sorting for the sort tests. See <test/sortlib.h>.
+ */
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <test/sortlib.h>
+
+/*
+ * Quicksort, partitioning three ways so runs of equal keys don't
+ * go quadratic.
+ */
+void
+sortlib_sort(int *v, unsigned num)
+{
+	unsigned frontpos, readpos, endpos, i, j;
+	int pivotval, tmp;
+
+	while (num >= 2) {
+		pivotval = v[num/2];
+
+		/* [0,front) < pivot, [front,read) == pivot, [end,num) > */
+		frontpos = 0;
+		readpos = 0;
+		endpos = num;
+		while (readpos < endpos) {
+			if (v[readpos] < pivotval) {
+				tmp = v[frontpos];
+				v[frontpos++] = v[readpos];
+				v[readpos++] = tmp;
+			}
+			else if (v[readpos] == pivotval) {
+				readpos++;
+			}
+			else {
+				tmp = v[--endpos];
+				v[endpos] = v[readpos];
+				v[readpos] = tmp;
+			}
+		}
+
+		/* recurse on the smaller side, loop on the bigger */
+		i = frontpos;
+		j = num - endpos;
+		if (i < j) {
+			sortlib_sort(v, i);
+			v += endpos;
+			num = j;
+		}
+		else {
+			sortlib_sort(v + endpos, j);
+			num = i;
+		}
+	}
+}
+
+void
+sortlib_mergesort(int *v, unsigned num, int *tmp)
+{
+	unsigned pivot, i, j, k;
+
+	if (num < 2) {
+		return;
+	}
+
+	pivot = num/2;
+	sortlib_mergesort(v, pivot, tmp);
+	sortlib_mergesort(&v[pivot], num-pivot, tmp);
+
+	i = 0;
+	j = pivot;
+	k = 0;
+	while (i<pivot && j<num) {
+		if (v[i] < v[j]) {
+			tmp[k++] = v[i++];
+		}
+		else {
+			tmp[k++] = v[j++];
+		}
+	}
+	while (i<pivot) {
+		tmp[k++] = v[i++];
+	}
+	while (j<num) {
+		tmp[k++] = v[j++];
+	}
+
+	memcpy(v, tmp, num*sizeof(int));
+}
+
+////////////////////////////////////////////////////////////
+
+void
+sortlib_writer_init(struct sortlib_writer *w, int fd, int *buf, unsigned max)
+{
+	w->fd = fd;
+	w->buf = buf;
+	w->num = 0;
+	w->max = max;
+}
+
+int
+sortlib_writer_flush(struct sortlib_writer *w)
+{
+	size_t len, done;
+	ssize_t r;
+
+	len = w->num * sizeof(int);
+	for (done = 0; done < len; done += r) {
+		r = write(w->fd, (char *)w->buf + done, len - done);
+		if (r < 0) {
+			return -1;
+		}
+	}
+	w->num = 0;
+	return 0;
+}
+
+int
+sortlib_writer_put(struct sortlib_writer *w, int val)
+{
+	if (w->num == w->max && sortlib_writer_flush(w) < 0) {
+		return -1;
+	}
+	w->buf[w->num++] = val;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * One input to a merge: a buffer's worth of its ints, the next of
+ * which is buf[pos].
+ */
+struct run {
+	int fd;
+	int *buf;
+	unsigned pos, num, max;
+	bool done;
+};
+
+/*
+ * Read the next bufferful of R. Returns 0, or -1 with errno set.
+ */
+static
+int
+run_fill(struct run *r)
+{
+	size_t got;
+	ssize_t n;
+
+	got = 0;
+	do {
+		n = read(r->fd, (char *)r->buf + got,
+			 r->max * sizeof(int) - got);
+		if (n < 0) {
+			return -1;
+		}
+		got += n;
+		/* a read may stop partway through an int; finish it */
+	} while (n > 0 && got % sizeof(int) != 0);
+
+	if (got % sizeof(int) != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	r->pos = 0;
+	r->num = got / sizeof(int);
+	r->done = (r->num == 0);
+	return 0;
+}
+
+/*
+ * Does run A's next int go before run B's? Finished runs go last,
+ * and ties go to the lower-numbered run.
+ */
+static
+bool
+run_before(const struct run *runs, unsigned a, unsigned b)
+{
+	if (runs[a].done || runs[b].done) {
+		return !runs[a].done && (runs[b].done || a < b);
+	}
+	if (runs[a].buf[runs[a].pos] != runs[b].buf[runs[b].pos]) {
+		return runs[a].buf[runs[a].pos] < runs[b].buf[runs[b].pos];
+	}
+	return a < b;
+}
+
+/*
+ * Loser tree over K runs: tree[1..K-1] each hold the run that lost
+ * the match at that node, and tree[0] the overall winner. Run S's
+ * leaf sits below node (S + K) / 2. After run S's head changes, one
+ * replay from its leaf to the root restores the tree.
+ */
+#define NOBODY ((unsigned)-1)
+
+static
+void
+tree_replay(unsigned *tree, const struct run *runs, unsigned k, unsigned s)
+{
+	unsigned t, tmp;
+
+	for (t = (s + k) / 2; t > 0; t /= 2) {
+		if (tree[t] == NOBODY) {
+			/* building: first to get here waits for a match */
+			tree[t] = s;
+			return;
+		}
+		if (run_before(runs, tree[t], s)) {
+			tmp = tree[t];
+			tree[t] = s;
+			s = tmp;
+		}
+	}
+	tree[0] = s;
+}
+
+int
+sortlib_merge(const int *infds, unsigned k, int outfd,
+	      int *buf, unsigned bufnum)
+{
+	struct run runs[SORTLIB_MAXWAY];
+	unsigned tree[SORTLIB_MAXWAY];
+	struct sortlib_writer w;
+	unsigned per, i, win;
+
+	if (k == 0 || k > SORTLIB_MAXWAY || bufnum < k + 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* an equal share of the buffer for each input; the rest is output */
+	per = bufnum / (k + 1);
+	for (i=0; i<k; i++) {
+		runs[i].fd = infds[i];
+		runs[i].buf = buf + i * per;
+		runs[i].max = per;
+		if (run_fill(&runs[i]) < 0) {
+			return -1;
+		}
+	}
+	sortlib_writer_init(&w, outfd, buf + k * per, bufnum - k * per);
+
+	for (i=0; i<k; i++) {
+		tree[i] = NOBODY;
+	}
+	for (i=0; i<k; i++) {
+		tree_replay(tree, runs, k, i);
+	}
+
+	while (1) {
+		win = tree[0];
+		if (runs[win].done) {
+			/* the best is finished, so they all are */
+			break;
+		}
+		if (sortlib_writer_put(&w, runs[win].buf[runs[win].pos]) < 0) {
+			return -1;
+		}
+		if (++runs[win].pos == runs[win].num &&
+		    run_fill(&runs[win]) < 0) {
+			return -1;
+		}
+		tree_replay(tree, runs, k, win);
+	}
+	return sortlib_writer_flush(&w);
+}
@@ -0,0 +1,516 @@
+/*
+ * taskpool - parallel_for and spawn/sync on a pool of worker threads,
+ * or child processes; see test/taskpool.h.
+ *
+ * The deques are the Chase-Lev kind: w_bottom is only written by the
+ * owner and w_top only moved up, by a compare-and-swap, by whoever
+ * takes the task there. Owner and thieves only race for the last
+ * task, and the compare-and-swap settles that too. Memory is
+ * sequentially consistent on our machine (see atomic.h), so none of
+ * this needs fences beyond keeping the compiler in order.
+ *
+ * A worker is told apart from the others by its stack (tp_self); the
+ * host build, without threads, always uses processes.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#ifndef HOST
+#include <atomic.h>
+#endif
+#include <test/taskpool.h>
+
+static unsigned tp_nworkers;
+static bool tp_running;
+static bool tp_threaded;
+
+/* Run T and mark it done */
+static
+void
+tp_run(struct task *t)
+{
+	t->t_func(t->t_arg);
+#ifndef HOST
+	atomic_barrier();
+#endif
+	t->t_done = 1;
+}
+
+#ifndef HOST
+
+////////////////////////////////////////////////////////////
+// threads
+
+struct tp_worker {
+	volatile int w_top;		/* thieves take from here */
+	volatile int w_bottom;		/* the owner works down here */
+	struct task *volatile w_tasks[TASKPOOL_DEQUESIZE];
+	uintptr_t w_stacktop;		/* for tp_self */
+	int w_tid;
+};
+
+#define TP_SLOT(i)	((unsigned)(i) % TASKPOOL_DEQUESIZE)
+
+/* Times an idle worker looks for work before it sleeps */
+#define TP_SPINS	64
+
+static struct tp_worker tp_workers[TASKPOOL_MAXWORKERS];
+static volatile int tp_stop;		/* taskpool_fini was called */
+static volatile int tp_nidle;		/* workers asleep, or nearly */
+static volatile int tp_seq;		/* bumped when there's new work */
+
+/*
+ * The calling worker: the one whose stack top is the lowest at or
+ * above our stack pointer, since every task runs further down the
+ * stack of the worker running it. Worker 0, the main thread, counts
+ * as being at the top of memory; the others' stacks are below its.
+ */
+static
+struct tp_worker *
+tp_self(void)
+{
+	struct tp_worker *w, *best;
+	unsigned i;
+	char here;
+
+	best = &tp_workers[0];
+	for (i=1; i<tp_nworkers; i++) {
+		w = &tp_workers[i];
+		if (w->w_stacktop >= (uintptr_t)&here &&
+		    w->w_stacktop < best->w_stacktop) {
+			best = w;
+		}
+	}
+	return best;
+}
+
+/*
+ * Push T on the bottom of W's deque, which must be ours. Returns
+ * false if the deque is full.
+ */
+static
+bool
+tp_push(struct tp_worker *w, struct task *t)
+{
+	int b;
+
+	b = w->w_bottom;
+	if (b - w->w_top >= TASKPOOL_DEQUESIZE) {
+		return false;
+	}
+	w->w_tasks[TP_SLOT(b)] = t;
+	atomic_barrier();
+	w->w_bottom = b + 1;
+	return true;
+}
+
+/*
+ * Pop a task off the bottom of W's deque, which must be ours, or
+ * return NULL. Moving w_bottom first keeps thieves off the task;
+ * only if it's the last one might one have got there first.
+ */
+static
+struct task *
+tp_pop(struct tp_worker *w)
+{
+	struct task *t;
+	int b, top;
+
+	b = w->w_bottom - 1;
+	w->w_bottom = b;
+	atomic_barrier();
+	top = w->w_top;
+	if (top > b) {
+		/* empty */
+		w->w_bottom = b + 1;
+		return NULL;
+	}
+	t = w->w_tasks[TP_SLOT(b)];
+	if (top == b) {
+		/* the last one; race any thieves for it */
+		if (atomic_cas(&w->w_top, top, top + 1) != top) {
+			t = NULL;
+		}
+		w->w_bottom = b + 1;
+	}
+	return t;
+}
+
+/*
+ * Take a task off the top of W's deque, or return NULL if it is
+ * empty or someone else got it first.
+ */
+static
+struct task *
+tp_steal(struct tp_worker *w)
+{
+	struct task *t;
+	int top;
+
+	top = w->w_top;
+	atomic_barrier();
+	if (top >= w->w_bottom) {
+		return NULL;
+	}
+	t = w->w_tasks[TP_SLOT(top)];
+	if (atomic_cas(&w->w_top, top, top + 1) != top) {
+		return NULL;
+	}
+	return t;
+}
+
+/* Steal a task from any worker but W, or return NULL */
+static
+struct task *
+tp_stealany(struct tp_worker *w)
+{
+	struct task *t;
+	unsigned i, me;
+
+	me = w - tp_workers;
+	for (i=1; i<tp_nworkers; i++) {
+		t = tp_steal(&tp_workers[(me + i) % tp_nworkers]);
+		if (t != NULL) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Sleep until there might be work. As in gthread.c: we count
+ * ourselves idle before looking at tp_seq and the deques one last
+ * time, and task_spawn bumps tp_seq before looking at tp_nidle, so
+ * either it wakes us or we see its task (or the futex sees the new
+ * tp_seq).
+ */
+static
+void
+tp_idle(void)
+{
+	struct tp_worker *w;
+	unsigned i;
+	int seq;
+
+	atomic_add(&tp_nidle, 1);
+	seq = tp_seq;
+	for (i=0; i<tp_nworkers; i++) {
+		w = &tp_workers[i];
+		if (w->w_top < w->w_bottom) {
+			break;
+		}
+	}
+	if (i == tp_nworkers && !tp_stop) {
+		futex(&tp_seq, FUTEX_WAIT, seq, NULL);
+	}
+	atomic_add(&tp_nidle, -1);
+}
+
+/* Worker threads: run other workers' tasks until taskpool_fini */
+static
+int
+tp_work(void *arg)
+{
+	struct tp_worker *w = arg;
+	struct task *t;
+	unsigned spins;
+	char here;
+
+	w->w_stacktop = (uintptr_t)&here;
+	spins = 0;
+	while (!tp_stop) {
+		t = tp_stealany(w);
+		if (t != NULL) {
+			tp_run(t);
+			spins = 0;
+		}
+		else if (++spins >= TP_SPINS) {
+			tp_idle();
+			spins = 0;
+		}
+	}
+	return 0;
+}
+
+/*
+ * parallel_for with threads: run FUNC on [lo, hi) by spawning the
+ * top half and doing the bottom half ourselves, down to a range of
+ * pf_grain.
+ */
+struct tp_for {
+	int (*pf_func)(unsigned, void *);
+	void *pf_arg;
+	unsigned pf_grain;
+	volatile int pf_failed;
+};
+
+struct tp_range {
+	struct tp_for *r_for;
+	unsigned r_lo, r_hi;
+};
+
+static void tp_forrange(struct tp_for *pf, unsigned lo, unsigned hi);
+
+static
+void
+tp_fortask(void *arg)
+{
+	struct tp_range *r = arg;
+
+	tp_forrange(r->r_for, r->r_lo, r->r_hi);
+}
+
+static
+void
+tp_forrange(struct tp_for *pf, unsigned lo, unsigned hi)
+{
+	struct tp_range r;
+	struct task t;
+	unsigned i;
+
+	if (hi - lo <= pf->pf_grain) {
+		for (i=lo; i<hi; i++) {
+			if (pf->pf_func(i, pf->pf_arg) != 0) {
+				atomic_add(&pf->pf_failed, 1);
+			}
+		}
+		return;
+	}
+	r.r_for = pf;
+	r.r_lo = lo + (hi - lo) / 2;
+	r.r_hi = hi;
+	task_spawn(&t, tp_fortask, &r);
+	tp_forrange(pf, lo, r.r_lo);
+	task_sync(&t);
+}
+
+#endif /* HOST */
+
+////////////////////////////////////////////////////////////
+// processes
+
+/*
+ * Wait for the child running iteration I; return 1 if it failed.
+ */
+static
+unsigned
+tp_wait(unsigned i, pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		warn("waitpid for task %u (pid %d)", i, (int)pid);
+		return 1;
+	}
+	if (WIFSIGNALED(status)) {
+		warnx("task %u (pid %d): signal %d", i, (int)pid,
+		      WTERMSIG(status));
+		return 1;
+	}
+	if (WEXITSTATUS(status) != 0) {
+		warnx("task %u (pid %d): exit %d", i, (int)pid,
+		      WEXITSTATUS(status));
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * parallel_for with processes: a child for each I, waiting for the
+ * oldest whenever there are tp_nworkers going.
+ */
+static
+unsigned
+tp_forkfor(unsigned n, int (*func)(unsigned, void *), void *arg)
+{
+	pid_t pids[TASKPOOL_MAXWORKERS];
+	unsigned i, first, failed;
+	pid_t pid;
+
+	failed = 0;
+	first = 0;
+	for (i=0; i<n; i++) {
+		if (i - first == tp_nworkers) {
+			if (pids[first % tp_nworkers] > 0) {
+				failed += tp_wait(first,
+						  pids[first % tp_nworkers]);
+			}
+			first++;
+		}
+		pid = fork();
+		if (pid < 0) {
+			warn("fork (task %u)", i);
+			failed++;
+		}
+		else if (pid == 0) {
+			exit(func(i, arg));
+		}
+		pids[i % tp_nworkers] = pid;
+	}
+	for (; first < n; first++) {
+		if (pids[first % tp_nworkers] > 0) {
+			failed += tp_wait(first, pids[first % tp_nworkers]);
+		}
+	}
+	return failed;
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+int
+taskpool_init(unsigned nworkers, int flags)
+{
+#ifndef HOST
+	unsigned i;
+	int tid;
+#endif
+
+	if (nworkers == 0 || nworkers > TASKPOOL_MAXWORKERS || tp_running) {
+		errno = EINVAL;
+		return -1;
+	}
+	tp_nworkers = nworkers;
+	tp_running = true;
+	tp_threaded = false;
+
+#ifndef HOST
+	if (flags & TASKPOOL_FORK) {
+		return 0;
+	}
+
+	bzero(tp_workers, sizeof(tp_workers));
+	tp_workers[0].w_stacktop = (uintptr_t)-1;
+	tp_workers[0].w_tid = -1;
+	tp_stop = 0;
+	for (i=1; i<nworkers; i++) {
+		tid = thread_create(tp_work, &tp_workers[i]);
+		if (tid < 0) {
+			break;
+		}
+		tp_workers[i].w_tid = tid;
+	}
+	if (i > 1 || nworkers == 1) {
+		/* If we can't have as many threads as asked, make do */
+		tp_nworkers = i;
+		tp_threaded = true;
+	}
+#else
+	(void)flags;
+#endif
+	return 0;
+}
+
+void
+taskpool_fini(void)
+{
+#ifndef HOST
+	unsigned i;
+	int status;
+
+	if (tp_threaded) {
+		tp_stop = 1;
+		atomic_add(&tp_seq, 1);
+		futex(&tp_seq, FUTEX_WAKE, tp_nworkers, NULL);
+		for (i=1; i<tp_nworkers; i++) {
+			thread_join(tp_workers[i].w_tid, &status);
+		}
+	}
+#endif
+	tp_running = false;
+}
+
+bool
+taskpool_threaded(void)
+{
+	return tp_threaded;
+}
+
+unsigned
+taskpool_nworkers(void)
+{
+	return tp_nworkers;
+}
+
+unsigned
+parallel_for(unsigned n, int (*func)(unsigned i, void *arg), void *arg)
+{
+#ifndef HOST
+	struct tp_for pf;
+
+	if (tp_threaded) {
+		pf.pf_func = func;
+		pf.pf_arg = arg;
+		/* A few pieces each, so they can even out */
+		pf.pf_grain = n / (4 * tp_nworkers);
+		if (pf.pf_grain == 0) {
+			pf.pf_grain = 1;
+		}
+		pf.pf_failed = 0;
+		if (n > 0) {
+			tp_forrange(&pf, 0, n);
+		}
+		return pf.pf_failed;
+	}
+#endif
+	return tp_forkfor(n, func, arg);
+}
+
+void
+task_spawn(struct task *t, void (*func)(void *), void *arg)
+{
+	t->t_func = func;
+	t->t_arg = arg;
+	t->t_done = 0;
+
+#ifndef HOST
+	if (tp_threaded && tp_push(tp_self(), t)) {
+		/* See tp_idle for why this order */
+		atomic_add(&tp_seq, 1);
+		if (tp_nidle > 0) {
+			futex(&tp_seq, FUTEX_WAKE, 1, NULL);
+		}
+		return;
+	}
+#endif
+	/* No threads, or no room; just do it */
+	tp_run(t);
+}
+
+void
+task_sync(struct task *t)
+{
+#ifndef HOST
+	struct tp_worker *w;
+	struct task *other;
+
+	if (t->t_done) {
+		return;
+	}
+	/*
+	 * Everything we spawned since T has been synced, so T is at
+	 * the bottom of our deque, unless it was stolen; then help out
+	 * until the thief is done with it.
+	 */
+	w = tp_self();
+	while (!t->t_done) {
+		other = tp_pop(w);
+		if (other == NULL) {
+			other = tp_stealany(w);
+		}
+		if (other != NULL) {
+			tp_run(other);
+		}
+	}
+	atomic_barrier();
+#else
+	(void)t;
+#endif
+}
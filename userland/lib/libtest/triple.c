@@ -82,14 +82,28 @@ dowait(int index, int pid)
 
 void
 triple(const char *prog)
+{
+	triplev(prog, NULL);
+}
+
+void
+triplev(const char *prog, char *const *extra)
 {
 	pid_t pids[3];
-	int i, failures = 0;
-	char *args[2];
+	int i, n, failures = 0;
+	char *args[TRIPLE_MAXARGS + 2];
 
 	/* set up the argv */
 	args[0]=(char *)prog;
-	args[1]=NULL;
+	n = 1;
+	while (extra != NULL && extra[n-1] != NULL) {
+		if (n > TRIPLE_MAXARGS) {
+			errx(1, "Too many arguments for %s", prog);
+		}
+		args[n] = extra[n-1];
+		n++;
+	}
+	args[n]=NULL;
 
 	warnx("Starting: running three copies of %s...", prog);
 
@@ -108,4 +122,3 @@ triple(const char *prog)
 		warnx("Congratulations! You passed.");
 	}
 }
-
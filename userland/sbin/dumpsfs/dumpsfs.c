@@ -137,11 +137,20 @@ uint32_t
 readsb(void)
 {
 	struct sfs_superblock sb;
+	uint32_t blocksize;
 
 	diskread(&sb, SFS_SUPER_BLOCK);
 	if (SWAP32(sb.sb_magic) != SFS_MAGIC) {
 		errx(1, "Not an sfs filesystem");
 	}
+	blocksize = SWAP32(sb.sb_blocksize);
+	if (blocksize == 0) {
+		blocksize = SFS_OLDBLOCKSIZE;
+	}
+	if (blocksize != SFS_BLOCKSIZE) {
+		errx(1, "Volume has %u-byte blocks; dumpsfs was built for %u",
+		     blocksize, SFS_BLOCKSIZE);
+	}
 	return SWAP32(sb.sb_nblocks);
 }
 
@@ -161,8 +170,18 @@ dumpsb(void)
 	dumpvalf("Size", "%u blocks", SWAP32(sb.sb_nblocks));
 	dumpvalf("Freemap size", "%u blocks",
 		 SFS_FREEMAPBLOCKS(SWAP32(sb.sb_nblocks)));
-	dumpvalf("Block size", "%u bytes", SFS_BLOCKSIZE);
+	dumpvalf("Block size", "%u bytes%s",
+		 SWAP32(sb.sb_blocksize) ? SWAP32(sb.sb_blocksize) :
+		 SFS_OLDBLOCKSIZE, SWAP32(sb.sb_blocksize) ? "" : " (old)");
 	dumplval("Volume name", sb.sb_volname);
+	if (SWAP32(sb.sb_journalblocks) > 0) {
+		dumpvalf("Journal", "%u blocks at %u",
+			 SWAP32(sb.sb_journalblocks),
+			 SWAP32(sb.sb_journalstart));
+	}
+	else {
+		dumplval("Journal", "none");
+	}
 
 	for (i=0; i<ARRAYCOUNT(sb.reserved); i++) {
 		if (sb.reserved[i] != 0) {
@@ -255,10 +274,14 @@ dumpindirect(uint32_t block)
 	}
 }
 
+/*
+ * Go through the blocks under indirect block BLOCK, which has
+ * indirection level LEVEL (1 for singly indirect).
+ */
 static
 uint32_t
 traverse_ib(uint32_t fileblock, uint32_t numblocks, uint32_t block,
-	    void (*doblock)(uint32_t, uint32_t))
+	    unsigned level, void (*doblock)(uint32_t, uint32_t))
 {
 	uint32_t ib[SFS_BLOCKSIZE/sizeof(uint32_t)];
 	unsigned i;
@@ -270,7 +293,14 @@ traverse_ib(uint32_t fileblock, uint32_t numblocks, uint32_t block,
 		diskread(ib, block);
 	}
 	for (i=0; i<ARRAYCOUNT(ib) && fileblock < numblocks; i++) {
-		doblock(fileblock++, SWAP32(ib[i]));
+		if (level > 1) {
+			fileblock = traverse_ib(fileblock, numblocks,
+						SWAP32(ib[i]), level - 1,
+						doblock);
+		}
+		else {
+			doblock(fileblock++, SWAP32(ib[i]));
+		}
 	}
 	return fileblock;
 }
@@ -291,7 +321,15 @@ traverse(const struct sfs_dinode *sfi, void (*doblock)(uint32_t, uint32_t))
 	}
 	if (fileblock < numblocks) {
 		fileblock = traverse_ib(fileblock, numblocks,
-					SWAP32(sfi->sfi_indirect), doblock);
+					SWAP32(sfi->sfi_indirect), 1, doblock);
+	}
+	if (fileblock < numblocks) {
+		fileblock = traverse_ib(fileblock, numblocks,
+					SWAP32(sfi->sfi_dindirect), 2, doblock);
+	}
+	if (fileblock < numblocks) {
+		fileblock = traverse_ib(fileblock, numblocks,
+					SWAP32(sfi->sfi_tindirect), 3, doblock);
 	}
 	assert(fileblock == numblocks);
 }
@@ -374,23 +412,19 @@ recursedir(uint32_t ino, const struct sfs_dinode *sfi)
 	printf("Done with directory %u\n", ino);
 }
 
+/*
+ * Hex dump LEN bytes of file data that start at offset POS.
+ */
 static
-void dumpfileblock(uint32_t fileblock, uint32_t diskblock)
+void
+dumpbytes(const uint8_t *data, unsigned len, uint32_t pos)
 {
-	uint8_t data[SFS_BLOCKSIZE];
 	unsigned i, j;
 	char tmp[128];
 
-	if (diskblock == 0) {
-		printf("    0x%6x  [sparse]\n", fileblock * SFS_BLOCKSIZE);
-		return;
-	}
-
-	diskread(data, diskblock);
-	for (i=0; i<SFS_BLOCKSIZE; i++) {
+	for (i=0; i<len; i++) {
 		if (i % 16 == 0) {
-			snprintf(tmp, sizeof(tmp), "0x%x",
-				 fileblock * SFS_BLOCKSIZE + i);
+			snprintf(tmp, sizeof(tmp), "0x%x", pos + i);
 			printf("%8s", tmp);
 		}
 		if (i % 8 == 0) {
@@ -400,9 +434,13 @@ void dumpfileblock(uint32_t fileblock, uint32_t diskblock)
 			printf(" ");
 		}
 		printf("%02x", data[i]);
-		if (i % 16 == 15) {
+		if (i % 16 == 15 || i == len-1) {
+			/* Line up a short last line */
+			for (j = i+1; j % 16 != 0; j++) {
+				printf(j % 8 == 0 ? "    " : "   ");
+			}
 			printf("  ");
-			for (j = i-15; j<=i; j++) {
+			for (j = i - i%16; j<=i; j++) {
 				if (data[j] < 32 || data[j] > 126) {
 					putchar('.');
 				}
@@ -415,11 +453,36 @@ void dumpfileblock(uint32_t fileblock, uint32_t diskblock)
 	}
 }
 
+static
+void
+dumpfileblock(uint32_t fileblock, uint32_t diskblock)
+{
+	uint8_t data[SFS_BLOCKSIZE];
+
+	if (diskblock == 0) {
+		printf("    0x%6x  [sparse]\n", fileblock * SFS_BLOCKSIZE);
+		return;
+	}
+
+	diskread(data, diskblock);
+	dumpbytes(data, SFS_BLOCKSIZE, fileblock * SFS_BLOCKSIZE);
+}
+
 static
 void
 dumpfile(uint32_t ino, const struct sfs_dinode *sfi)
 {
+	uint32_t size;
+
 	printf("File contents for inode %u:\n", ino);
+	if (SWAP32(sfi->sfi_flags) & SFS_IFLAG_INLINE) {
+		size = SWAP32(sfi->sfi_size);
+		if (size > SFS_INLINESIZE) {
+			size = SFS_INLINESIZE;
+		}
+		dumpbytes((const uint8_t *)sfi->sfi_inline, size, 0);
+		return;
+	}
 	traverse(sfi, dumpfileblock);
 }
 
@@ -449,6 +512,8 @@ dumpinode(uint32_t ino, const char *name)
 	dumpvalf("Type", "%u (%s)", SWAP16(sfi.sfi_type), typename);
 	dumpvalf("Size", "%u", SWAP32(sfi.sfi_size));
 	dumpvalf("Link count", "%u", SWAP16(sfi.sfi_linkcount));
+	dumpvalf("Flags", "0x%x%s", SWAP32(sfi.sfi_flags),
+		 (SWAP32(sfi.sfi_flags) & SFS_IFLAG_INLINE) ? " (inline)" : "");
 	printf("\n");
 
         printf("    Direct blocks:\n");
@@ -476,15 +541,23 @@ dumpinode(uint32_t ino, const char *name)
 	}
 	printf("    Indirect block: %u (0x%x)\n",
 	       SWAP32(sfi.sfi_indirect), SWAP32(sfi.sfi_indirect));
-	for (i=0; i<ARRAYCOUNT(sfi.sfi_waste); i++) {
-		if (sfi.sfi_waste[i] != 0) {
-			printf("    Word %u in waste area: 0x%x\n",
-			       i, SWAP32(sfi.sfi_waste[i]));
+	printf("    Double indirect block: %u (0x%x)\n",
+	       SWAP32(sfi.sfi_dindirect), SWAP32(sfi.sfi_dindirect));
+	printf("    Triple indirect block: %u (0x%x)\n",
+	       SWAP32(sfi.sfi_tindirect), SWAP32(sfi.sfi_tindirect));
+	if (!(SWAP32(sfi.sfi_flags) & SFS_IFLAG_INLINE)) {
+		for (i=0; i<SFS_INLINESIZE; i++) {
+			if (sfi.sfi_inline[i] != 0) {
+				printf("    Byte %u in inline area: 0x%x\n",
+				       i, (uint8_t)sfi.sfi_inline[i]);
+			}
 		}
 	}
 
 	if (doindirect) {
 		dumpindirect(SWAP32(sfi.sfi_indirect));
+		dumpindirect(SWAP32(sfi.sfi_dindirect));
+		dumpindirect(SWAP32(sfi.sfi_tindirect));
 	}
 
 	if (SWAP16(sfi.sfi_type) == SFS_TYPE_DIR && dodirs) {
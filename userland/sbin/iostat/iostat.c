@@ -0,0 +1,229 @@
+/*
+ * iostat - print the kernel's per-device I/O statistics.
+ * Usage: iostat
+ *        iostat interval [count]
+ *
+ * With no arguments, prints the totals since boot for each device,
+ * from iostat:. Otherwise prints, every INTERVAL seconds (COUNT
+ * times, or forever), what each device did meanwhile: transfers and
+ * kilobytes per second, the average time a transfer took, and the
+ * average number in flight. An average queue well over 1 means the
+ * device is saturated.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <err.h>
+
+#define DEVICE		"iostat:"
+#define MAXDEVS		32
+#define NAMELEN		16
+#define NFIELDS		7
+
+/* Fields of a line of iostat:, after the name */
+enum { READS, WRITES, RSECTS, WSECTS, INFLIGHT, TOTALNS, MAXNS };
+
+struct devstat {
+	char name[NAMELEN];
+	unsigned long long f[NFIELDS];
+};
+
+static char buf[8192];
+
+/*
+ * Read iostat: into D, returning how many devices there are.
+ */
+static
+unsigned
+readstats(struct devstat *d)
+{
+	ssize_t len, got;
+	unsigned n, i, j;
+	char *line, *next, *s;
+	int fd;
+
+	fd = open(DEVICE, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", DEVICE);
+	}
+	/* Read it in one go, for a consistent snapshot */
+	len = 0;
+	do {
+		got = read(fd, buf + len, sizeof(buf) - 1 - len);
+		if (got < 0) {
+			err(1, "%s: read", DEVICE);
+		}
+		len += got;
+	} while (got > 0 && len < (ssize_t)sizeof(buf) - 1);
+	close(fd);
+	buf[len] = 0;
+
+	n = 0;
+	for (line = buf; line != NULL && *line != 0 && n < MAXDEVS;
+	     line = next) {
+		next = strchr(line, '\n');
+		if (next != NULL) {
+			*next++ = 0;
+		}
+		for (i=0; line[i] != ' ' && line[i] != 0 && i < NAMELEN-1;
+		     i++) {
+			d[n].name[i] = line[i];
+		}
+		d[n].name[i] = 0;
+		s = line + i;
+		for (j=0; j<NFIELDS; j++) {
+			while (*s == ' ') {
+				s++;
+			}
+			d[n].f[j] = 0;
+			while (*s >= '0' && *s <= '9') {
+				d[n].f[j] = d[n].f[j] * 10 + (*s - '0');
+				s++;
+			}
+		}
+		n++;
+	}
+	return n;
+}
+
+/* Find NAME in D, or NULL if it's new */
+static
+const struct devstat *
+findstat(const struct devstat *d, unsigned n, const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		if (!strcmp(d[i].name, name)) {
+			return &d[i];
+		}
+	}
+	return NULL;
+}
+
+static
+unsigned long long
+now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		err(1, "clock_gettime");
+	}
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static
+void
+printtotals(void)
+{
+	struct devstat d[MAXDEVS];
+	unsigned long long ops;
+	unsigned i, n;
+
+	n = readstats(d);
+	printf("%-10s %10s %10s %10s %10s %5s %9s %9s\n", "device",
+	       "reads", "writes", "read-kB", "write-kB", "inflt",
+	       "avg-us", "max-us");
+	for (i=0; i<n; i++) {
+		ops = d[i].f[READS] + d[i].f[WRITES];
+		printf("%-10s %10llu %10llu %10llu %10llu %5llu %9llu %9llu\n",
+		       d[i].name, d[i].f[READS], d[i].f[WRITES],
+		       d[i].f[RSECTS] / 2, d[i].f[WSECTS] / 2,
+		       d[i].f[INFLIGHT],
+		       ops ? d[i].f[TOTALNS] / ops / 1000 : 0,
+		       d[i].f[MAXNS] / 1000);
+	}
+}
+
+/*
+ * Print what happened between OLD and NEW, ELAPSED nanoseconds
+ * apart. The average queue is the time spent in flight over the
+ * elapsed time, shown to two decimals.
+ */
+static
+void
+printdelta(const struct devstat *old, unsigned nold,
+	   const struct devstat *new, unsigned nnew,
+	   unsigned long long elapsed)
+{
+	static const struct devstat zero;
+	const struct devstat *o;
+	unsigned long long delta[NFIELDS], ops, ms;
+	unsigned i, j;
+
+	ms = elapsed / 1000000;
+	if (ms == 0) {
+		ms = 1;
+	}
+	printf("%-10s %8s %8s %9s %9s %9s %6s\n", "device", "r/s", "w/s",
+	       "rkB/s", "wkB/s", "avg-us", "queue");
+	for (i=0; i<nnew; i++) {
+		o = findstat(old, nold, new[i].name);
+		if (o == NULL) {
+			o = &zero;
+		}
+		for (j=0; j<NFIELDS; j++) {
+			delta[j] = new[i].f[j] - o->f[j];
+		}
+		ops = delta[READS] + delta[WRITES];
+		printf("%-10s %8llu %8llu %9llu %9llu %9llu %3llu.%02llu\n",
+		       new[i].name,
+		       delta[READS] * 1000 / ms, delta[WRITES] * 1000 / ms,
+		       delta[RSECTS] * 500 / ms, delta[WSECTS] * 500 / ms,
+		       ops ? delta[TOTALNS] / ops / 1000 : 0,
+		       delta[TOTALNS] / 1000000 / ms,
+		       delta[TOTALNS] / 10000 / ms % 100);
+	}
+	printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct devstat a[MAXDEVS], b[MAXDEVS];
+	struct devstat *old = a, *new = b, *t;
+	unsigned nold, nnew;
+	unsigned long long then, now;
+	struct timespec ts;
+	int interval, count;
+
+	if (argc == 1) {
+		printtotals();
+		return 0;
+	}
+	if (argc > 3) {
+		errx(1, "Usage: iostat [interval [count]]");
+	}
+	interval = atoi(argv[1]);
+	count = argc > 2 ? atoi(argv[2]) : -1;
+	if (interval <= 0) {
+		errx(1, "Usage: iostat [interval [count]]");
+	}
+
+	ts.tv_sec = interval;
+	ts.tv_nsec = 0;
+	then = now_ns();
+	nold = readstats(old);
+	while (count != 0) {
+		nanosleep(&ts, NULL);
+		now = now_ns();
+		nnew = readstats(new);
+		printdelta(old, nold, new, nnew, now - then);
+
+		t = old;
+		old = new;
+		new = t;
+		nold = nnew;
+		then = now;
+		if (count > 0) {
+			count--;
+		}
+	}
+	return 0;
+}
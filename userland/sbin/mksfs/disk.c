@@ -38,10 +38,18 @@
 #include <err.h>
 
 #include "support.h"
+#include "kern/sfs.h"
 #include "disk.h"
 
 #define HOSTSTRING "System/161 Disk Image"
-#define BLOCKSIZE  512
+#define SECTORSIZE 512			/* of the disk, and its header */
+#define BLOCKSIZE  SFS_BLOCKSIZE	/* unit of the calls below */
+
+#ifdef HOST
+#define HEADERSIZE SECTORSIZE
+#else
+#define HEADERSIZE 0
+#endif
 
 #ifndef EINTR
 #define EINTR 0
@@ -68,11 +76,9 @@ opendisk(const char *path)
 		err(1, "%s: fstat", path);
 	}
 
-	nblocks = statbuf.st_size / BLOCKSIZE;
+	nblocks = (statbuf.st_size - HEADERSIZE) / BLOCKSIZE;
 
 #ifdef HOST
-	nblocks--;
-
 	{
 		char buf[64];
 		int len;
@@ -95,13 +101,15 @@ opendisk(const char *path)
 }
 
 /*
- * Return the block size. (This is fixed, but still...)
+ * Return the disk's sector size. (This is fixed, but still...) The
+ * blocks read and written below are SFS_BLOCKSIZE, which must be a
+ * multiple of it.
  */
 uint32_t
 diskblocksize(void)
 {
 	assert(fd>=0);
-	return BLOCKSIZE;
+	return SECTORSIZE;
 }
 
 /*
@@ -119,6 +127,15 @@ diskblocks(void)
  */
 void
 diskwrite(const void *data, uint32_t block)
+{
+	diskwritemany(data, block, 1);
+}
+
+/*
+ * Write N consecutive blocks starting at BLOCK, with a single seek.
+ */
+void
+diskwritemany(const void *data, uint32_t block, uint32_t n)
 {
 	const char *cdata = data;
 	uint32_t tot=0;
@@ -126,17 +143,13 @@ diskwrite(const void *data, uint32_t block)
 
 	assert(fd>=0);
 
-#ifdef HOST
-	// skip over disk file header
-	block++;
-#endif
-
-	if (lseek(fd, block*BLOCKSIZE, SEEK_SET)<0) {
+	/* (skipping over the disk file header, if any) */
+	if (lseek(fd, (off_t)block*BLOCKSIZE + HEADERSIZE, SEEK_SET)<0) {
 		err(1, "lseek");
 	}
 
-	while (tot < BLOCKSIZE) {
-		len = write(fd, cdata + tot, BLOCKSIZE - tot);
+	while (tot < n*BLOCKSIZE) {
+		len = write(fd, cdata + tot, n*BLOCKSIZE - tot);
 		if (len < 0) {
 			if (errno==EINTR || errno==EAGAIN) {
 				continue;
@@ -155,6 +168,15 @@ diskwrite(const void *data, uint32_t block)
  */
 void
 diskread(void *data, uint32_t block)
+{
+	diskreadmany(data, block, 1);
+}
+
+/*
+ * Read N consecutive blocks starting at BLOCK, with a single seek.
+ */
+void
+diskreadmany(void *data, uint32_t block, uint32_t n)
 {
 	char *cdata = data;
 	uint32_t tot=0;
@@ -162,17 +184,13 @@ diskread(void *data, uint32_t block)
 
 	assert(fd>=0);
 
-#ifdef HOST
-	// skip over disk file header
-	block++;
-#endif
-
-	if (lseek(fd, block*BLOCKSIZE, SEEK_SET)<0) {
+	/* (skipping over the disk file header, if any) */
+	if (lseek(fd, (off_t)block*BLOCKSIZE + HEADERSIZE, SEEK_SET)<0) {
 		err(1, "lseek");
 	}
 
-	while (tot < BLOCKSIZE) {
-		len = read(fd, cdata + tot, BLOCKSIZE - tot);
+	while (tot < n*BLOCKSIZE) {
+		len = read(fd, cdata + tot, n*BLOCKSIZE - tot);
 		if (len < 0) {
 			if (errno==EINTR || errno==EAGAIN) {
 				continue;
@@ -33,6 +33,8 @@ uint32_t diskblocksize(void);
 uint32_t diskblocks(void);
 
 void diskwrite(const void *data, uint32_t block);
+void diskwritemany(const void *data, uint32_t block, uint32_t n);
 void diskread(void *data, uint32_t block);
+void diskreadmany(void *data, uint32_t block, uint32_t n);
 
 void closedisk(void);
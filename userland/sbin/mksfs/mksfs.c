@@ -40,6 +40,13 @@
 
 #ifdef HOST
 
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
 #include <netinet/in.h> // for arpa/inet.h
 #include <arpa/inet.h>  // for ntohl
 #include "hostcompat.h"
@@ -60,9 +67,23 @@
 /* Maximum size of freemap we support */
 #define MAXFREEMAPBLOCKS 32
 
+/* Journal size: 1/16 of the volume, within these limits */
+#define MINJOURNALBLOCKS 256
+#define MAXJOURNALBLOCKS 1024
+
+/* Most blocks gathered into one disk write */
+#define STAGEBLOCKS 64
+
 /* Free block bitmap */
 static char freemapbuf[MAXFREEMAPBLOCKS * SFS_BLOCKSIZE];
 
+/* Blocks waiting to be written: STAGECOUNT of them from STAGESTART */
+static char stagebuf[STAGEBLOCKS * SFS_BLOCKSIZE];
+static uint32_t stagestart, stagecount;
+
+/* Where the journal goes (no journal if journalblocks is 0) */
+static uint32_t journalstart, journalblocks;
+
 /*
  * Assert that the on-disk data structures are correctly sized.
  */
@@ -73,6 +94,41 @@ check(void)
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	assert(sizeof(struct sfs_jheader)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_jdesc)==SFS_BLOCKSIZE);
+}
+
+/*
+ * Write out the blocks gathered by putblock.
+ */
+static
+void
+flushblocks(void)
+{
+	if (stagecount > 0) {
+		diskwritemany(stagebuf, stagestart, stagecount);
+		stagecount = 0;
+	}
+}
+
+/*
+ * Write a block. Consecutive blocks are gathered up and written
+ * together, so laying out the volume in block order costs one write
+ * per STAGEBLOCKS blocks rather than one per block.
+ */
+static
+void
+putblock(const void *data, uint32_t block)
+{
+	if (stagecount > 0 &&
+	    (block != stagestart + stagecount || stagecount == STAGEBLOCKS)) {
+		flushblocks();
+	}
+	if (stagecount == 0) {
+		stagestart = block;
+	}
+	memcpy(stagebuf + stagecount * SFS_BLOCKSIZE, data, SFS_BLOCKSIZE);
+	stagecount++;
 }
 
 /*
@@ -114,6 +170,25 @@ initfreemap(uint32_t fsblocks)
 		allocblock(SFS_FREEMAP_START + i);
 	}
 
+	/*
+	 * The journal goes right after the freemap. Volumes too small
+	 * to spare the minimum journal don't get one.
+	 */
+	journalstart = SFS_FREEMAP_START + freemapblocks;
+	journalblocks = fsblocks / 16;
+	if (journalblocks > MAXJOURNALBLOCKS) {
+		journalblocks = MAXJOURNALBLOCKS;
+	}
+	if (journalblocks < MINJOURNALBLOCKS) {
+		journalblocks = MINJOURNALBLOCKS;
+	}
+	if (journalstart + journalblocks > fsblocks / 2) {
+		journalblocks = 0;
+	}
+	for (i=0; i<journalblocks; i++) {
+		allocblock(journalstart + i);
+	}
+
 	/* all blocks in the freemap but past the volume end are "in use" */
 	for (i=fsblocks; i<freemapbits; i++) {
 		allocblock(i);
@@ -140,9 +215,12 @@ writesuper(const char *volname, uint32_t nblocks)
 	sb.sb_magic = SWAP32(SFS_MAGIC);
 	sb.sb_nblocks = SWAP32(nblocks);
 	strcpy(sb.sb_volname, volname);
+	sb.sb_journalstart = SWAP32(journalblocks > 0 ? journalstart : 0);
+	sb.sb_journalblocks = SWAP32(journalblocks);
+	sb.sb_blocksize = SWAP32(SFS_BLOCKSIZE);
 
 	/* and write it out. */
-	diskwrite(&sb, SFS_SUPER_BLOCK);
+	putblock(&sb, SFS_SUPER_BLOCK);
 }
 
 /*
@@ -160,8 +238,32 @@ writefreemap(uint32_t fsblocks)
 	freemapblocks = SFS_FREEMAPBLOCKS(fsblocks);
 	for (i=0; i<freemapblocks; i++) {
 		ptr = freemapbuf + i*SFS_BLOCKSIZE;
-		diskwrite(ptr, SFS_FREEMAP_START+i);
+		putblock(ptr, SFS_FREEMAP_START+i);
+	}
+}
+
+/*
+ * Write out an empty journal: a header, and a zeroed first log block
+ * so nothing left on the disk from before looks like a transaction.
+ */
+static
+void
+writejournal(void)
+{
+	struct sfs_jheader jh;
+	struct sfs_jdesc jd;
+
+	if (journalblocks == 0) {
+		return;
 	}
+
+	bzero((void *)&jh, sizeof(jh));
+	jh.jh_magic = SWAP32(SFS_JMAGIC);
+	jh.jh_seq = SWAP32(1);
+	putblock(&jh, journalstart);
+
+	bzero((void *)&jd, sizeof(jd));
+	putblock(&jd, journalstart + 1);
 }
 
 /*
@@ -180,9 +282,410 @@ writerootdir(void)
 	sfi.sfi_linkcount = SWAP16(1);
 
 	/* Write it out */
-	diskwrite(&sfi, SFS_ROOTDIR_INO);
+	putblock(&sfi, SFS_ROOTDIR_INO);
+}
+
+#ifdef HOST
+
+/*
+ * Building a volume from a host directory tree.
+ *
+ * The tree is read into memory first, then every inode, directory
+ * and file gets its blocks, handed out in order from just past the
+ * journal: each object's inode, then its indirect blocks, then all
+ * its data in one contiguous run, going through the tree depth
+ * first. Then everything is written in that same order, so the whole
+ * volume goes out in one sequential pass and each file ends up in
+ * one piece.
+ *
+ * Only regular files and directories are copied; anything else, and
+ * names too long for SFS, are skipped with a warning. Hard links on
+ * the host become separate files. Files small enough are stored
+ * inline in their inodes, as the kernel would.
+ */
+
+struct node {
+	char name[SFS_NAMELEN];
+	char *path;			/* on the host */
+	int isdir;
+	int isinline;			/* data kept in the inode */
+	uint32_t size;			/* bytes; for dirs, of entries */
+	uint32_t ino;			/* inode block */
+	uint32_t ibstart, nib;		/* indirect blocks */
+	uint32_t datastart, ndata;	/* data blocks */
+	struct node *parent;
+	struct node **children;
+	unsigned nchildren, nsubdirs;
+};
+
+/* Next block to hand out */
+static uint32_t cursor;
+
+static
+void *
+xmalloc(size_t len)
+{
+	void *p;
+
+	p = malloc(len);
+	if (p == NULL) {
+		err(1, "malloc");
+	}
+	return p;
+}
+
+static
+int
+nodecmp(const void *a, const void *b)
+{
+	const struct node *x = *(struct node *const *)a;
+	const struct node *y = *(struct node *const *)b;
+
+	return strcmp(x->name, y->name);
+}
+
+/*
+ * Read the host object at PATH, and everything under it if it's a
+ * directory. Returns NULL if it isn't something we can copy.
+ */
+static
+struct node *
+scantree(const char *path, const char *name, struct node *parent)
+{
+	struct stat st;
+	struct node *n;
+	struct dirent *de;
+	DIR *dir;
+	char *subpath;
+	struct node *sub;
+	unsigned max;
+
+	if (lstat(path, &st) < 0) {
+		err(1, "%s", path);
+	}
+	if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) {
+		warnx("%s: Not a file or directory (skipped)", path);
+		return NULL;
+	}
+	if (strlen(name) >= SFS_NAMELEN) {
+		warnx("%s: Name too long (skipped)", path);
+		return NULL;
+	}
+	if (S_ISREG(st.st_mode) && st.st_size > (off_t)UINT32_MAX) {
+		warnx("%s: Too large (skipped)", path);
+		return NULL;
+	}
+
+	n = xmalloc(sizeof(*n));
+	bzero(n, sizeof(*n));
+	strcpy(n->name, name);
+	n->path = xmalloc(strlen(path) + 1);
+	strcpy(n->path, path);
+	n->isdir = S_ISDIR(st.st_mode);
+	n->parent = parent;
+
+	if (!n->isdir) {
+		n->size = st.st_size;
+		return n;
+	}
+
+	dir = opendir(path);
+	if (dir == NULL) {
+		err(1, "%s", path);
+	}
+	max = 16;
+	n->children = xmalloc(max * sizeof(struct node *));
+	while ((de = readdir(dir)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+			continue;
+		}
+		subpath = xmalloc(strlen(path) + strlen(de->d_name) + 2);
+		sprintf(subpath, "%s/%s", path, de->d_name);
+		sub = scantree(subpath, de->d_name, n);
+		free(subpath);
+		if (sub == NULL) {
+			continue;
+		}
+		if (n->nchildren == max) {
+			max *= 2;
+			n->children = realloc(n->children,
+					      max * sizeof(struct node *));
+			if (n->children == NULL) {
+				err(1, "realloc");
+			}
+		}
+		n->children[n->nchildren++] = sub;
+		if (sub->isdir) {
+			n->nsubdirs++;
+		}
+	}
+	closedir(dir);
+
+	/* Same volume for the same tree, whatever order readdir gave */
+	qsort(n->children, n->nchildren, sizeof(struct node *), nodecmp);
+
+	/* Entries for . and .. as well as the contents */
+	n->size = (n->nchildren + 2) * sizeof(struct sfs_direntry);
+	return n;
+}
+
+/*
+ * Lay out the indirect block of level LEVEL (1 for single) mapping
+ * the COUNT data blocks starting at file block FIRST, and the ones
+ * under it. They get the next of the indirect blocks starting at
+ * IBSTART, in the order they're written; *NEXTIB counts them. If IBS
+ * is not NULL it holds the indirect blocks' contents, which are
+ * filled in. Returns the block used.
+ */
+static
+uint32_t
+layout_ib(uint32_t (*ibs)[SFS_DBPERIDB], uint32_t *nextib,
+	  uint32_t ibstart, uint32_t datastart, unsigned level,
+	  uint32_t first, uint32_t count)
+{
+	uint32_t me, range, j, sub;
+	unsigned i;
+
+	me = (*nextib)++;
+	for (range = 1, i = 1; i < level; i++) {
+		range *= SFS_DBPERIDB;
+	}
+	for (j = 0; j * range < count; j++) {
+		if (level == 1) {
+			sub = datastart + first + j;
+		}
+		else {
+			sub = layout_ib(ibs, nextib, ibstart, datastart,
+					level - 1, first + j * range,
+					count - j * range < range ?
+					count - j * range : range);
+		}
+		if (ibs != NULL) {
+			ibs[me][j] = SWAP32(sub);
+		}
+	}
+	return ibstart + me;
+}
+
+/*
+ * Lay out all the indirect blocks for a file of NDATA blocks, filling
+ * in the inode SFI if not NULL. Returns how many there are.
+ */
+static
+uint32_t
+layout_file(struct sfs_dinode *sfi, uint32_t (*ibs)[SFS_DBPERIDB],
+	    uint32_t ibstart, uint32_t datastart, uint32_t ndata)
+{
+	uint32_t nextib = 0, first, count, range, root;
+	unsigned level;
+
+	for (first = 0; first < ndata && first < SFS_NDIRECT; first++) {
+		if (sfi != NULL) {
+			sfi->sfi_direct[first] = SWAP32(datastart + first);
+		}
+	}
+	for (level = 1, range = SFS_DBPERIDB; level <= 3 && first < ndata;
+	     level++, range *= SFS_DBPERIDB) {
+		count = ndata - first < range ? ndata - first : range;
+		root = layout_ib(ibs, &nextib, ibstart, datastart,
+				 level, first, count);
+		if (sfi != NULL) {
+			switch (level) {
+			    case 1: sfi->sfi_indirect = SWAP32(root); break;
+			    case 2: sfi->sfi_dindirect = SWAP32(root); break;
+			    case 3: sfi->sfi_tindirect = SWAP32(root); break;
+			}
+		}
+		first += count;
+	}
+	if (first < ndata) {
+		errx(1, "File too large for SFS");
+	}
+	return nextib;
+}
+
+/*
+ * Hand out N blocks from the cursor.
+ */
+static
+uint32_t
+takeblocks(uint32_t n, uint32_t fsblocks)
+{
+	uint32_t first, i;
+
+	if (n > fsblocks - cursor) {
+		errx(1, "Source tree doesn't fit on the volume");
+	}
+	first = cursor;
+	for (i=0; i<n; i++) {
+		allocblock(cursor++);
+	}
+	return first;
+}
+
+/*
+ * Give N and everything under it their blocks.
+ */
+static
+void
+assigntree(struct node *n, uint32_t fsblocks)
+{
+	unsigned i;
+
+	if (n->parent == NULL) {
+		/* already allocated by initfreemap */
+		n->ino = SFS_ROOTDIR_INO;
+	}
+	else {
+		n->ino = takeblocks(1, fsblocks);
+	}
+	n->isinline = !n->isdir && n->size > 0 && n->size <= SFS_INLINESIZE;
+	n->ndata = n->isinline ? 0 :
+		SFS_ROUNDUP(n->size, SFS_BLOCKSIZE) / SFS_BLOCKSIZE;
+	n->nib = layout_file(NULL, NULL, 0, 0, n->ndata);
+	n->ibstart = takeblocks(n->nib, fsblocks);
+	n->datastart = takeblocks(n->ndata, fsblocks);
+
+	for (i=0; i<n->nchildren; i++) {
+		assigntree(n->children[i], fsblocks);
+	}
+}
+
+/*
+ * Copy the data of small host file N into its inode.
+ */
+static
+void
+readinline(struct node *n, struct sfs_dinode *sfi)
+{
+	ssize_t len;
+	int fd;
+
+	fd = open(n->path, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", n->path);
+	}
+	len = read(fd, sfi->sfi_inline, n->size);
+	if (len < 0) {
+		err(1, "%s", n->path);
+	}
+	if (len < (ssize_t)n->size) {
+		warnx("%s: Shrank while being copied", n->path);
+	}
+	close(fd);
+	sfi->sfi_flags = SWAP32(SFS_IFLAG_INLINE);
+}
+
+/*
+ * Write out the data of host file N.
+ */
+static
+void
+writefiledata(struct node *n)
+{
+	char buf[SFS_BLOCKSIZE];
+	uint32_t i;
+	ssize_t len;
+	int fd;
+
+	if (n->isinline) {
+		return;
+	}
+	fd = open(n->path, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", n->path);
+	}
+	for (i=0; i<n->ndata; i++) {
+		bzero(buf, sizeof(buf));
+		len = read(fd, buf, sizeof(buf));
+		if (len < 0) {
+			err(1, "%s", n->path);
+		}
+		if (len < (ssize_t)sizeof(buf) && i + 1 < n->ndata) {
+			warnx("%s: Shrank while being copied", n->path);
+		}
+		putblock(buf, n->datastart + i);
+	}
+	close(fd);
+}
+
+/*
+ * Write out the entries of directory N.
+ */
+static
+void
+writedirdata(struct node *n)
+{
+	struct sfs_direntry *d;
+	size_t len;
+	unsigned i;
+
+	len = n->ndata * SFS_BLOCKSIZE;
+	d = xmalloc(len);
+	bzero(d, len);
+
+	d[0].sfd_ino = SWAP32(n->ino);
+	strcpy(d[0].sfd_name, ".");
+	d[1].sfd_ino = SWAP32(n->parent != NULL ? n->parent->ino : n->ino);
+	strcpy(d[1].sfd_name, "..");
+	for (i=0; i<n->nchildren; i++) {
+		d[i+2].sfd_ino = SWAP32(n->children[i]->ino);
+		strcpy(d[i+2].sfd_name, n->children[i]->name);
+	}
+
+	for (i=0; i<n->ndata; i++) {
+		putblock((char *)d + i * SFS_BLOCKSIZE, n->datastart + i);
+	}
+	free(d);
+}
+
+/*
+ * Write out N and everything under it, in the order assigntree gave
+ * out the blocks.
+ */
+static
+void
+writetree(struct node *n)
+{
+	struct sfs_dinode sfi;
+	uint32_t (*ibs)[SFS_DBPERIDB];
+	uint32_t i;
+
+	ibs = NULL;
+	if (n->nib > 0) {
+		ibs = xmalloc(n->nib * sizeof(*ibs));
+		bzero(ibs, n->nib * sizeof(*ibs));
+	}
+
+	bzero((void *)&sfi, sizeof(sfi));
+	sfi.sfi_size = SWAP32(n->size);
+	sfi.sfi_type = SWAP16(n->isdir ? SFS_TYPE_DIR : SFS_TYPE_FILE);
+	/* A directory is named by its parent, its ., and its subdirs' .. */
+	sfi.sfi_linkcount = SWAP16(n->isdir ? 2 + n->nsubdirs : 1);
+	layout_file(&sfi, ibs, n->ibstart, n->datastart, n->ndata);
+	if (n->isinline) {
+		readinline(n, &sfi);
+	}
+	putblock(&sfi, n->ino);
+
+	for (i=0; i<n->nib; i++) {
+		putblock(ibs[i], n->ibstart + i);
+	}
+	free(ibs);
+
+	if (n->isdir) {
+		writedirdata(n);
+		for (i=0; i<n->nchildren; i++) {
+			writetree(n->children[i]);
+		}
+	}
+	else {
+		writefiledata(n);
+	}
 }
 
+#endif /* HOST */
+
 /*
  * Main.
  */
@@ -191,14 +694,24 @@ main(int argc, char **argv)
 {
 	uint32_t size, blocksize;
 	char *volname, *s;
+#ifdef HOST
+	struct node *root = NULL;
+#endif
 
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
-	if (argc!=3) {
-		errx(1, "Usage: mksfs device/diskfile volume-name");
+	if (argc!=3 && argc!=4) {
+		errx(1, "Usage: mksfs device/diskfile volume-name "
+		     "[source-dir]");
 	}
+#ifndef HOST
+	if (argc==4) {
+		errx(1, "Copying in a source tree needs the host build "
+		     "of mksfs");
+	}
+#endif
 
 	check();
 
@@ -222,18 +735,42 @@ main(int argc, char **argv)
 	opendisk(argv[1]);
 	blocksize = diskblocksize();
 
-	if (blocksize!=SFS_BLOCKSIZE) {
-		errx(1, "Device has wrong blocksize %u (should be %u)\n",
+	if (blocksize > SFS_BLOCKSIZE || SFS_BLOCKSIZE % blocksize != 0) {
+		errx(1, "Device blocksize %u doesn't divide %u\n",
 		     blocksize, SFS_BLOCKSIZE);
 	}
 	size = diskblocks();
 
-	/* Write out the on-disk structures */
+	/* Work out the on-disk structures */
 	initfreemap(size);
+#ifdef HOST
+	if (argc==4) {
+		root = scantree(argv[3], "", NULL);
+		if (root == NULL || !root->isdir) {
+			errx(1, "%s: Not a directory", argv[3]);
+		}
+		cursor = journalblocks > 0 ? journalstart + journalblocks :
+			SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(size);
+		assigntree(root, size);
+	}
+#endif
+
+	/* Write them out */
 	writesuper(volname, size);
 	writefreemap(size);
+	writejournal();
+#ifdef HOST
+	if (root != NULL) {
+		writetree(root);
+	}
+	else {
+		writerootdir();
+	}
+#else
 	writerootdir();
+#endif
 
+	flushblocks();
 	closedisk();
 
 	return 0;
@@ -0,0 +1,448 @@
+/*
+ * replay - play back a system call trace made with systrace -r.
+ * Usage: replay [-t] [-x] tracefile
+ *
+ * Each traced process is played back by a process of its own: the
+ * first process in the trace by replay itself, and each one it forked
+ * or spawned by a fork of the replay process at the same point. Each
+ * makes the same file system calls its original made, in the same
+ * order: open, close, read, write, pread, pwrite, lseek, dup2, stat,
+ * lstat, remove, mkdir, rmdir and chdir, with the same paths, flags,
+ * offsets and sizes, and waitpid for the same children. Reads and
+ * writes go through a scratch buffer, so only the sizes are the same,
+ * not the data; and what went to the console goes to null: instead.
+ * Other calls are skipped.
+ *
+ * By default the calls are made as fast as they can be; with -t each
+ * is held back until as long after the start as it was made in the
+ * trace. An execv in the trace is normally skipped, as the calls the
+ * new program made are in the trace too; with -x the process really
+ * does exec the program (with no arguments), and what it does is up
+ * to it.
+ *
+ * The calls write and remove files just as the traced programs did,
+ * so replay in a scratch directory, or on a scratch volume.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <kern/syscall.h>
+#include <kern/systrace.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <err.h>
+
+/* Recorded fds we follow, and recorded children we can wait for */
+#define MAXFDS		128
+#define MAXKIDS		64
+
+/* Largest read or write played back */
+#define MAXIO		(1024*1024)
+
+static struct systrace_rec *recs;
+static unsigned nrecs;
+
+static bool timed;
+static bool doexec;
+static struct timespec start;
+
+static void *scratch;
+static size_t scratchsize;
+
+/* State of the process doing the replaying */
+static int mypid;			/* the traced pid we're playing */
+static int fdmap[MAXFDS];		/* traced fd -> ours, or -1 */
+static int kidpids[MAXKIDS];		/* traced child pids... */
+static pid_t kidreal[MAXKIDS];		/* ...and ours */
+static unsigned nkids;
+static int nullfd;			/* stands in for the console */
+static unsigned ncalls, nchanged;
+
+static
+void
+usage(void)
+{
+	errx(1, "Usage: replay [-t] [-x] tracefile");
+}
+
+static
+void
+load(const char *name)
+{
+	struct stat st;
+	unsigned i;
+	size_t size;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	if (fstat(fd, &st) < 0) {
+		err(1, "%s: fstat", name);
+	}
+	nrecs = st.st_size / sizeof(*recs);
+	if (nrecs == 0) {
+		errx(1, "%s: Empty trace", name);
+	}
+	recs = malloc(nrecs * sizeof(*recs));
+	if (recs == NULL) {
+		errx(1, "Out of memory for %u records", nrecs);
+	}
+	if (read(fd, recs, nrecs * sizeof(*recs)) !=
+	    (ssize_t)(nrecs * sizeof(*recs))) {
+		err(1, "%s: read", name);
+	}
+	/* Don't leave the fd open to throw the numbering off */
+	close(fd);
+
+	scratchsize = 1;
+	for (i=0; i<nrecs; i++) {
+		switch (recs[i].sr_callno) {
+		    case SYS_read:
+		    case SYS_write:
+		    case SYS_pread:
+		    case SYS_pwrite:
+			size = recs[i].sr_args[2];
+			if (size > MAXIO) {
+				size = MAXIO;
+			}
+			if (size > scratchsize) {
+				scratchsize = size;
+			}
+			break;
+		}
+	}
+	scratch = malloc(scratchsize);
+	if (scratch == NULL) {
+		errx(1, "Out of memory for a %lu-byte buffer",
+		     (unsigned long)scratchsize);
+	}
+	memset(scratch, 'x', scratchsize);
+}
+
+/*
+ * Our fd for traced fd FD, or -1.
+ */
+static
+int
+getfd(uint32_t fd)
+{
+	if (fd >= MAXFDS) {
+		return -1;
+	}
+	return fdmap[fd];
+}
+
+static
+void
+setfd(int32_t fd, int ours)
+{
+	if (fd >= 0 && fd < MAXFDS) {
+		fdmap[fd] = ours;
+	}
+}
+
+static
+size_t
+iosize(uint32_t size)
+{
+	return size > MAXIO ? MAXIO : size;
+}
+
+/* 64-bit argument in words I and I+1 */
+static
+off_t
+dword(const struct systrace_rec *r, unsigned i)
+{
+	return (off_t)(((uint64_t)r->sr_args[i] << 32) | r->sr_args[i+1]);
+}
+
+/*
+ * Hold off until R's time comes round, for -t.
+ */
+static
+void
+waitfor(const struct systrace_rec *r)
+{
+	struct timespec now, when, delay;
+	uint64_t ns;
+
+	ns = r->sr_enter - recs[0].sr_enter;
+	when.tv_sec = start.tv_sec + ns / 1000000000;
+	when.tv_nsec = start.tv_nsec + ns % 1000000000;
+	if (when.tv_nsec >= 1000000000) {
+		when.tv_sec++;
+		when.tv_nsec -= 1000000000;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec > when.tv_sec ||
+	    (now.tv_sec == when.tv_sec && now.tv_nsec >= when.tv_nsec)) {
+		return;
+	}
+	delay.tv_sec = when.tv_sec - now.tv_sec;
+	if (when.tv_nsec >= now.tv_nsec) {
+		delay.tv_nsec = when.tv_nsec - now.tv_nsec;
+	}
+	else {
+		delay.tv_sec--;
+		delay.tv_nsec = when.tv_nsec + 1000000000 - now.tv_nsec;
+	}
+	nanosleep(&delay, NULL);
+}
+
+/*
+ * Make the call in R again. Returns its result, or -1 with errno set;
+ * or -2 if it's not one we play back.
+ */
+static
+int
+playone(const struct systrace_rec *r)
+{
+	const uint32_t *a = r->sr_args;
+	struct stat st;
+	char *args[2];
+	int fd, result;
+
+	switch (r->sr_callno) {
+	    case SYS_open:
+		if (r->sr_path[0] == '\0') {
+			return -2;
+		}
+		result = open(r->sr_path, a[1], a[2]);
+		if (result >= 0 && r->sr_err == 0) {
+			setfd(r->sr_result, result);
+		}
+		return result;
+	    case SYS_close:
+		fd = getfd(a[0]);
+		setfd(a[0], -1);
+		if (fd == nullfd) {
+			/* Other fds may still be using it */
+			return 0;
+		}
+		return fd < 0 ? -2 : close(fd);
+	    case SYS_read:
+		fd = getfd(a[0]);
+		return fd < 0 ? -2 : read(fd, scratch, iosize(a[2]));
+	    case SYS_write:
+		fd = getfd(a[0]);
+		return fd < 0 ? -2 : write(fd, scratch, iosize(a[2]));
+	    case SYS_pread:
+		fd = getfd(a[0]);
+		return fd < 0 ? -2 :
+			pread(fd, scratch, iosize(a[2]), dword(r, 4));
+	    case SYS_pwrite:
+		fd = getfd(a[0]);
+		return fd < 0 ? -2 :
+			pwrite(fd, scratch, iosize(a[2]), dword(r, 4));
+	    case SYS_lseek:
+		fd = getfd(a[0]);
+		return fd < 0 ? -2 :
+			(lseek(fd, dword(r, 2), a[4]) < 0 ? -1 : 0);
+	    case SYS_dup2:
+		fd = getfd(a[0]);
+		if (fd < 0 || a[1] >= MAXFDS) {
+			return -2;
+		}
+		/* Use the traced number, so long as it isn't in use */
+		for (result = 0; result < MAXFDS; result++) {
+			if (fdmap[result] == (int)a[1] &&
+			    result != (int)a[1]) {
+				return -2;
+			}
+		}
+		result = dup2(fd, a[1]);
+		if (result >= 0) {
+			setfd(a[1], result);
+		}
+		return result;
+	    case SYS_stat:
+	    case SYS_lstat:
+		if (r->sr_path[0] == '\0') {
+			return -2;
+		}
+		return r->sr_callno == SYS_stat ?
+			stat(r->sr_path, &st) : lstat(r->sr_path, &st);
+	    case SYS_remove:
+		return r->sr_path[0] == '\0' ? -2 : remove(r->sr_path);
+	    case SYS_mkdir:
+		return r->sr_path[0] == '\0' ? -2 : mkdir(r->sr_path, a[1]);
+	    case SYS_rmdir:
+		return r->sr_path[0] == '\0' ? -2 : rmdir(r->sr_path);
+	    case SYS_chdir:
+		return r->sr_path[0] == '\0' ? -2 : chdir(r->sr_path);
+	    case SYS_execv:
+		if (!doexec || r->sr_path[0] == '\0') {
+			return -2;
+		}
+		args[0] = (char *)r->sr_path;
+		args[1] = NULL;
+		execv(r->sr_path, args);
+		return -1;
+	}
+	return -2;
+}
+
+/*
+ * Wait for the child traced as PID, if we made it.
+ */
+static
+void
+playwait(int pid)
+{
+	unsigned i;
+	int status;
+
+	for (i=0; i<nkids; i++) {
+		if (kidpids[i] == pid) {
+			waitpid(kidreal[i], &status, 0);
+			kidpids[i] = kidpids[--nkids];
+			kidreal[i] = kidreal[nkids];
+			ncalls++;
+			return;
+		}
+	}
+}
+
+/*
+ * Play back the records of traced process PID, from record FIRST on.
+ * Doesn't return.
+ */
+static
+void
+play(int pid, unsigned first)
+{
+	const struct systrace_rec *r;
+	unsigned i;
+	pid_t kid;
+	int result, status;
+
+	mypid = pid;
+	nkids = 0;
+	ncalls = nchanged = 0;
+
+	for (i=first; i<nrecs; i++) {
+		r = &recs[i];
+		if (r->sr_pid != mypid) {
+			continue;
+		}
+		if (timed) {
+			waitfor(r);
+		}
+
+		if (r->sr_callno == SYS_fork || r->sr_callno == SYS_vfork ||
+		    r->sr_callno == SYS___spawn) {
+			if (r->sr_err != 0 || r->sr_result <= 0) {
+				continue;
+			}
+			kid = fork();
+			if (kid < 0) {
+				warn("fork for pid %d", r->sr_result);
+				nchanged++;
+				continue;
+			}
+			if (kid == 0) {
+				play(r->sr_result, i + 1);
+			}
+			if (nkids < MAXKIDS) {
+				kidpids[nkids] = r->sr_result;
+				kidreal[nkids] = kid;
+				nkids++;
+			}
+			ncalls++;
+			continue;
+		}
+		if (r->sr_callno == SYS_waitpid) {
+			playwait(r->sr_err == 0 ? r->sr_result : -1);
+			continue;
+		}
+
+		result = playone(r);
+		if (result == -2) {
+			continue;
+		}
+		ncalls++;
+		if ((result < 0) != (r->sr_err != 0)) {
+			nchanged++;
+		}
+	}
+
+	/* Reap whatever the trace didn't wait for */
+	while (waitpid(-1, &status, 0) > 0) {
+		/* nothing */
+	}
+	if (nchanged > 0) {
+		warnx("pid %d: %u of %u calls succeeded or failed "
+		      "differently from the trace", mypid, nchanged, ncalls);
+	}
+	exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct timespec end;
+	unsigned long ms;
+	const char *file = NULL;
+	int i, status;
+	pid_t pid;
+
+	for (i=1; i<argc; i++) {
+		if (!strcmp(argv[i], "-t")) {
+			timed = true;
+		}
+		else if (!strcmp(argv[i], "-x")) {
+			doexec = true;
+		}
+		else if (file == NULL && argv[i][0] != '-') {
+			file = argv[i];
+		}
+		else {
+			usage();
+		}
+	}
+	if (file == NULL) {
+		usage();
+	}
+	load(file);
+
+	/* The console fds the trace started with go to null: */
+	nullfd = open("null:", O_RDWR);
+	if (nullfd < 0) {
+		err(1, "null:");
+	}
+	for (i=0; i<MAXFDS; i++) {
+		fdmap[i] = i <= STDERR_FILENO ? nullfd : -1;
+	}
+
+	printf("replay: %u calls, %s\n", nrecs,
+	       timed ? "at the traced times" : "as fast as possible");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* Play from a child, so we can time the whole tree */
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		play(recs[0].sr_pid, 0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ms = (end.tv_sec - start.tv_sec) * 1000UL +
+		(end.tv_nsec - start.tv_nsec) / 1000000L;
+	printf("replay: done in %lu.%03lu seconds\n", ms / 1000, ms % 1000);
+	return 0;
+}
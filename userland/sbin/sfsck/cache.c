@@ -0,0 +1,191 @@
+/*
+ * Metadata block cache for sfsck. See cache.h.
+ *
+ * The cache is direct-mapped: block B can only live in slot
+ * B % CACHE_NSLOTS. Metadata of one file tends to be close together
+ * on disk, so this keeps it from evicting itself, and it makes the
+ * lookup free.
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "compat.h"
+#include <kern/sfs.h>
+
+#include "disk.h"
+#include "utils.h"
+#include "sb.h"
+#include "cache.h"
+
+#define CACHE_NSLOTS	4096	/* 2M of blocks */
+#define CACHE_MAXRUN	32	/* most blocks per disk read */
+
+struct cacheslot {
+	uint32_t cs_block;	/* block held, or 0 for none */
+	char cs_data[SFS_BLOCKSIZE];
+};
+
+static struct cacheslot *slots;
+
+/* Statistics, for cache_report */
+static unsigned long stat_reads;	/* blocks read from disk */
+static unsigned long stat_readops;	/* disk read requests */
+static unsigned long stat_writes;	/* blocks written */
+static unsigned long stat_hits;		/* cache_read calls that hit */
+static time_t start_secs;
+static unsigned long start_nsecs;
+
+void
+cache_setup(void)
+{
+	unsigned i;
+
+	slots = domalloc(CACHE_NSLOTS * sizeof(struct cacheslot));
+	for (i=0; i<CACHE_NSLOTS; i++) {
+		/* block 0 is the superblock, which is read only once */
+		slots[i].cs_block = 0;
+	}
+	__time(&start_secs, &start_nsecs);
+}
+
+static
+struct cacheslot *
+cache_slot(uint32_t block)
+{
+	return &slots[block % CACHE_NSLOTS];
+}
+
+void
+cache_read(void *data, uint32_t block)
+{
+	struct cacheslot *cs;
+
+	cs = cache_slot(block);
+	if (block != 0 && cs->cs_block == block) {
+		stat_hits++;
+		memcpy(data, cs->cs_data, SFS_BLOCKSIZE);
+		return;
+	}
+	diskread(data, block);
+	stat_reads++;
+	stat_readops++;
+	if (block != 0) {
+		cs->cs_block = block;
+		memcpy(cs->cs_data, data, SFS_BLOCKSIZE);
+	}
+}
+
+void
+cache_write(const void *data, uint32_t block)
+{
+	struct cacheslot *cs;
+
+	diskwrite(data, block);
+	stat_writes++;
+	if (block != 0) {
+		cs = cache_slot(block);
+		cs->cs_block = block;
+		memcpy(cs->cs_data, data, SFS_BLOCKSIZE);
+	}
+}
+
+static
+int
+blockcmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/*
+ * Read the NUM consecutive blocks from BLOCK into the cache.
+ */
+static
+void
+cache_readrun(uint32_t block, unsigned num)
+{
+	static char buf[CACHE_MAXRUN * SFS_BLOCKSIZE];
+	struct cacheslot *cs;
+	unsigned i;
+
+	assert(num > 0 && num <= CACHE_MAXRUN);
+	diskreadmany(buf, block, num);
+	stat_reads += num;
+	stat_readops++;
+	for (i=0; i<num; i++) {
+		cs = cache_slot(block + i);
+		cs->cs_block = block + i;
+		memcpy(cs->cs_data, buf + i*SFS_BLOCKSIZE, SFS_BLOCKSIZE);
+	}
+}
+
+void
+cache_prefetch(uint32_t *blocks, unsigned num)
+{
+	uint32_t volblocks, runstart;
+	unsigned i, runlen;
+
+	volblocks = sb_totalblocks();
+
+	/* More than this would just evict itself */
+	if (num > CACHE_NSLOTS / 2) {
+		num = CACHE_NSLOTS / 2;
+	}
+	qsort(blocks, num, sizeof(blocks[0]), blockcmp);
+
+	runstart = runlen = 0;
+	for (i=0; i<num; i++) {
+		if (blocks[i] == 0 || blocks[i] >= volblocks ||
+		    cache_slot(blocks[i])->cs_block == blocks[i]) {
+			continue;
+		}
+		if (runlen > 0 && blocks[i] < runstart + runlen) {
+			/* duplicate */
+			continue;
+		}
+		if (runlen > 0 && blocks[i] == runstart + runlen &&
+		    runlen < CACHE_MAXRUN) {
+			runlen++;
+			continue;
+		}
+		if (runlen > 0) {
+			cache_readrun(runstart, runlen);
+		}
+		runstart = blocks[i];
+		runlen = 1;
+	}
+	if (runlen > 0) {
+		cache_readrun(runstart, runlen);
+	}
+}
+
+void
+cache_report(void)
+{
+	time_t secs;
+	unsigned long nsecs, msecs, kbps;
+
+	__time(&secs, &nsecs);
+	if (nsecs < start_nsecs) {
+		secs--;
+		nsecs += 1000000000;
+	}
+	msecs = (secs - start_secs) * 1000 + (nsecs - start_nsecs) / 1000000;
+	/* bytes per millisecond is kB/s */
+	kbps = msecs == 0 ? 0 :
+		(stat_reads + stat_writes) * SFS_BLOCKSIZE / msecs;
+
+	printf("%lu blocks read in %lu requests, %lu cache hits, "
+	       "%lu blocks written\n",
+	       stat_reads, stat_readops, stat_hits, stat_writes);
+	printf("%lu.%03lu seconds, %lu kB/s\n",
+	       msecs / 1000, msecs % 1000, kbps);
+}
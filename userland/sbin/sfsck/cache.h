@@ -0,0 +1,35 @@
+/*
+ * Metadata block cache for sfsck.
+ *
+ * All of sfsck's reads of filesystem structures (inodes, indirect
+ * blocks, directories, the freemap) go through here instead of
+ * straight to disk.c. Pass 2 walks the same tree pass 1 did, so most
+ * of its reads are hits; and the passes ask for blocks they are about
+ * to need in batches with cache_prefetch, which reads them in block
+ * order, several adjacent blocks per request, instead of seeking back
+ * and forth for one block at a time.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+
+/* Call this before anything else in this module */
+void cache_setup(void);
+
+/* Read or write one block. Writes go straight through to the disk. */
+void cache_read(void *data, uint32_t block);
+void cache_write(const void *data, uint32_t block);
+
+/*
+ * Bring the NUM blocks listed in BLOCKS into the cache, if they
+ * aren't there. Zero entries and entries off the end of the volume
+ * are ignored. The array is sorted in place.
+ */
+void cache_prefetch(uint32_t *blocks, unsigned num);
+
+/* Print how much was read, and how fast, since cache_setup. */
+void cache_report(void);
+
+#endif /* CACHE_H */
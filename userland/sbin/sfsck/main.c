@@ -35,6 +35,7 @@
 #include "compat.h"
 
 #include "disk.h"
+#include "cache.h"
 #include "sfs.h"
 #include "sb.h"
 #include "freemap.h"
@@ -74,6 +75,7 @@ main(int argc, char **argv)
 	}
 
 	opendisk(argv[1]);
+	cache_setup();
 
 	sfs_setup();
 	sb_load();
@@ -93,6 +95,7 @@ main(int argc, char **argv)
 
 	closedisk();
 
+	cache_report();
 	warnx("%lu blocks used (of %lu); %lu directories; %lu files",
 	      freemap_blocksused(), (unsigned long)sb_totalblocks(),
 	      pass1_founddirs(), pass1_foundfiles());
@@ -37,7 +37,7 @@
 #include "compat.h"
 #include <kern/sfs.h>
 
-#include "disk.h"
+#include "cache.h"
 #include "utils.h"
 #include "ibmacros.h"
 #include "sfs.h"
@@ -112,6 +112,11 @@ check_indirect_block(struct ibstate *ibs, uint32_t *ientry, int *iechangedp,
 	}
 
 	if (indirection > 1) {
+		/* Read the blocks under this one in disk order */
+		uint32_t sorted[SFS_DBPERIDB];
+
+		memcpy(sorted, entries, sizeof(sorted));
+		cache_prefetch(sorted, SFS_DBPERIDB);
 		for (i=0; i<SFS_DBPERIDB; i++) {
 			check_indirect_block(ibs, &entries[i], &localchanged,
 					     indirection-1);
@@ -186,10 +191,18 @@ check_inode_blocks(uint32_t ino, struct sfs_dinode *sfi, int isdir)
 {
 	struct ibstate ibs;
 	uint32_t size, datablock;
+	uint32_t ibroots[NUM_I + NUM_II + NUM_III];
+	unsigned nroots = 0;
 	int changed;
 	int i;
 
-	size = SFS_ROUNDUP(sfi->sfi_size, SFS_BLOCKSIZE);
+	/* An inline file has no blocks; any it points to are past EOF */
+	if (sfi->sfi_flags & SFS_IFLAG_INLINE) {
+		size = 0;
+	}
+	else {
+		size = SFS_ROUNDUP(sfi->sfi_size, SFS_BLOCKSIZE);
+	}
 
 	ibs.ino = ino;
 	/*ibs.curfileblock = 0;*/
@@ -228,6 +241,17 @@ check_inode_blocks(uint32_t ino, struct sfs_dinode *sfi, int isdir)
 		}
 	}
 
+	for (i=0; i<NUM_I; i++) {
+		ibroots[nroots++] = GET_I(sfi, i);
+	}
+	for (i=0; i<NUM_II; i++) {
+		ibroots[nroots++] = GET_II(sfi, i);
+	}
+	for (i=0; i<NUM_III; i++) {
+		ibroots[nroots++] = GET_III(sfi, i);
+	}
+	cache_prefetch(ibroots, nroots);
+
 	for (i=0; i<NUM_I; i++) {
 		check_indirect_block(&ibs, &SET_I(sfi, i), &changed, 1);
 	}
@@ -270,8 +294,42 @@ pass1_inode(uint32_t ino, struct sfs_dinode *sfi, int alreadychanged)
 
 	freemap_blockinuse(ino, B_INODE, ino);
 
-	if (checkzeroed(sfi->sfi_waste, sizeof(sfi->sfi_waste))) {
-		warnx("Inode %lu: sfi_waste section not zeroed (fixed)",
+	if (sfi->sfi_flags & ~(uint32_t)SFS_IFLAG_INLINE) {
+		warnx("Inode %lu: unknown flags 0x%lx (cleared)",
+		      (unsigned long) ino, (unsigned long) sfi->sfi_flags);
+		sfi->sfi_flags &= SFS_IFLAG_INLINE;
+		setbadness(EXIT_RECOV);
+		changed = 1;
+	}
+
+	if ((sfi->sfi_flags & SFS_IFLAG_INLINE) && isdir) {
+		/* The kernel never does this; the entries are in blocks */
+		warnx("Inode %lu: inline directory (made block-mapped)",
+		      (unsigned long) ino);
+		sfi->sfi_flags &= ~SFS_IFLAG_INLINE;
+		setbadness(EXIT_RECOV);
+		changed = 1;
+	}
+
+	if (sfi->sfi_flags & SFS_IFLAG_INLINE) {
+		if (sfi->sfi_size > SFS_INLINESIZE) {
+			warnx("Inode %lu: inline file with size %lu "
+			      "(truncated)", (unsigned long) ino,
+			      (unsigned long) sfi->sfi_size);
+			sfi->sfi_size = SFS_INLINESIZE;
+			setbadness(EXIT_RECOV);
+			changed = 1;
+		}
+		if (checkzeroed(sfi->sfi_inline + sfi->sfi_size,
+				SFS_INLINESIZE - sfi->sfi_size)) {
+			warnx("Inode %lu: inline data past EOF not "
+			      "zeroed (fixed)", (unsigned long) ino);
+			setbadness(EXIT_RECOV);
+			changed = 1;
+		}
+	}
+	else if (checkzeroed(sfi->sfi_inline, sizeof(sfi->sfi_inline))) {
+		warnx("Inode %lu: sfi_inline section not zeroed (fixed)",
 		      (unsigned long) ino);
 		setbadness(EXIT_RECOV);
 		changed = 1;
@@ -392,6 +450,8 @@ pass1_dir(uint32_t ino, const char *pathsofar)
 		}
 	}
 
+	sfsdir_prefetch(direntries, ndirentries);
+
 	for (i=0; i<ndirentries; i++) {
 		if (direntries[i].sfd_ino == SFS_NOINO) {
 			/* nothing */
@@ -37,7 +37,7 @@
 #include "compat.h"
 #include <kern/sfs.h>
 
-#include "disk.h"
+#include "cache.h"
 #include "utils.h"
 #include "ibmacros.h"
 #include "sfs.h"
@@ -91,6 +91,7 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 	sortvector = domalloc(ndirentries * sizeof(int));
 
 	sfs_readdir(&sfi, direntries, ndirentries);
+	sfsdir_prefetch(direntries, ndirentries);
 	for (i=ndirentries; i<maxdirentries; i++) {
 		direntries[i].sfd_ino = SFS_NOINO;
 		bzero(direntries[i].sfd_name, sizeof(direntries[i].sfd_name));
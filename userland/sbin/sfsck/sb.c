@@ -54,6 +54,12 @@ sb_load(void)
 	if (sb.sb_magic != SFS_MAGIC) {
 		errx(EXIT_FATAL, "Not an sfs filesystem");
 	}
+	if ((sb.sb_blocksize ? sb.sb_blocksize : SFS_OLDBLOCKSIZE) !=
+	    SFS_BLOCKSIZE) {
+		errx(EXIT_FATAL, "Volume has %u-byte blocks; sfsck was built "
+		     "for %u", sb.sb_blocksize ? sb.sb_blocksize :
+		     SFS_OLDBLOCKSIZE, SFS_BLOCKSIZE);
+	}
 
 	assert(sb.sb_nblocks > 0);
 	assert(SFS_FREEMAPBLOCKS(sb.sb_nblocks) > 0);
@@ -83,6 +89,17 @@ sb_check(void)
 		setbadness(EXIT_RECOV);
 		schanged = 1;
 	}
+	if (sb.sb_journalblocks > 0 &&
+	    (sb.sb_journalstart < SFS_FREEMAP_START +
+	     SFS_FREEMAPBLOCKS(sb.sb_nblocks) ||
+	     sb.sb_journalstart >= sb.sb_nblocks ||
+	     sb.sb_journalblocks > sb.sb_nblocks - sb.sb_journalstart)) {
+		warnx("Journal is not within the volume (removed)");
+		setbadness(EXIT_RECOV);
+		sb.sb_journalstart = 0;
+		sb.sb_journalblocks = 0;
+		schanged = 1;
+	}
 	if (checkzeroed(sb.reserved, sizeof(sb.reserved))) {
 		warnx("Reserved section of superblock not zeroed (fixed)");
 		setbadness(EXIT_RECOV);
@@ -114,6 +131,21 @@ sb_freemapblocks(void)
 	return SFS_FREEMAPBLOCKS(sb.sb_nblocks);
 }
 
+/*
+ * Return the location and size of the journal (0 blocks if none).
+ */
+uint32_t
+sb_journalstart(void)
+{
+	return sb.sb_journalstart;
+}
+
+uint32_t
+sb_journalblocks(void)
+{
+	return sb.sb_journalblocks;
+}
+
 /*
  * Return the volume name.
  */
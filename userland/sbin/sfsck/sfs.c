@@ -36,7 +36,7 @@
 #include "compat.h"
 #include <kern/sfs.h>
 
-#include "disk.h"
+#include "cache.h"
 #include "utils.h"
 #include "ibmacros.h"
 #include "sfs.h"
@@ -62,6 +62,9 @@ swapsb(struct sfs_superblock *sb)
 {
 	sb->sb_magic = SWAP32(sb->sb_magic);
 	sb->sb_nblocks = SWAP32(sb->sb_nblocks);
+	sb->sb_journalstart = SWAP32(sb->sb_journalstart);
+	sb->sb_journalblocks = SWAP32(sb->sb_journalblocks);
+	sb->sb_blocksize = SWAP32(sb->sb_blocksize);
 }
 
 static
@@ -81,6 +84,7 @@ swapinode(struct sfs_dinode *sfi)
 	sfi->sfi_size = SWAP32(sfi->sfi_size);
 	sfi->sfi_type = SWAP16(sfi->sfi_type);
 	sfi->sfi_linkcount = SWAP16(sfi->sfi_linkcount);
+	sfi->sfi_flags = SWAP32(sfi->sfi_flags);
 
 	for (i=0; i<NUM_D; i++) {
 		SET_D(sfi, i) = SWAP32(GET_D(sfi, i));
@@ -138,7 +142,7 @@ ibmap(uint32_t iblock, uint32_t offset, uint32_t entrysize)
 		return 0;
 	}
 
-	diskread(entries, iblock);
+	cache_read(entries, iblock);
 	swapindir(entries);
 
 	if (entrysize > 1) {
@@ -194,7 +198,7 @@ bmap(const struct sfs_dinode *sfi, uint32_t fileblock)
 void
 sfs_readsb(uint32_t blocknum, struct sfs_superblock *sb)
 {
-	diskread(sb, blocknum);
+	cache_read(sb, blocknum);
 	swapsb(sb);
 }
 
@@ -202,7 +206,7 @@ void
 sfs_writesb(uint32_t blocknum, struct sfs_superblock *sb)
 {
 	swapsb(sb);
-	diskwrite(sb, blocknum);
+	cache_write(sb, blocknum);
 	swapsb(sb);
 }
 
@@ -214,7 +218,7 @@ sfs_writesb(uint32_t blocknum, struct sfs_superblock *sb)
 void
 sfs_readfreemapblock(uint32_t whichblock, uint8_t *bits)
 {
-	diskread(bits, SFS_FREEMAP_START + whichblock);
+	cache_read(bits, SFS_FREEMAP_START + whichblock);
 	swapbits(bits);
 }
 
@@ -222,7 +226,7 @@ void
 sfs_writefreemapblock(uint32_t whichblock, uint8_t *bits)
 {
 	swapbits(bits);
-	diskwrite(bits, SFS_FREEMAP_START + whichblock);
+	cache_write(bits, SFS_FREEMAP_START + whichblock);
 	swapbits(bits);
 }
 
@@ -233,7 +237,7 @@ sfs_writefreemapblock(uint32_t whichblock, uint8_t *bits)
 void
 sfs_readinode(uint32_t ino, struct sfs_dinode *sfi)
 {
-	diskread(sfi, ino);
+	cache_read(sfi, ino);
 	swapinode(sfi);
 }
 
@@ -241,7 +245,7 @@ void
 sfs_writeinode(uint32_t ino, struct sfs_dinode *sfi)
 {
 	swapinode(sfi);
-	diskwrite(sfi, ino);
+	cache_write(sfi, ino);
 	swapinode(sfi);
 }
 
@@ -252,7 +256,7 @@ sfs_writeinode(uint32_t ino, struct sfs_dinode *sfi)
 void
 sfs_readindirect(uint32_t blocknum, uint32_t *entries)
 {
-	diskread(entries, blocknum);
+	cache_read(entries, blocknum);
 	swapindir(entries);
 }
 
@@ -260,7 +264,7 @@ void
 sfs_writeindirect(uint32_t blocknum, uint32_t *entries)
 {
 	swapindir(entries);
-	diskwrite(entries, blocknum);
+	cache_write(entries, blocknum);
 	swapindir(entries);
 }
 
@@ -278,7 +282,7 @@ sfs_readdirblock(struct sfs_direntry *d, uint32_t diskblock)
 	unsigned j;
 
 	if (diskblock != 0) {
-		diskread(d, diskblock);
+		cache_read(d, diskblock);
 		for (j=0; j<atonce; j++) {
 			swapdir(&d[j]);
 		}
@@ -303,6 +307,13 @@ sfs_readdir(struct sfs_dinode *sfi, struct sfs_direntry *d, unsigned nd)
 	unsigned left, thismany;
 	struct sfs_direntry buffer[atonce];
 	uint32_t diskblock;
+	uint32_t direct[NUM_D];
+
+	/* Get the blocks the inode points to directly in one go */
+	for (i=0; i<NUM_D && i<nblocks; i++) {
+		direct[i] = GET_D(sfi, i);
+	}
+	cache_prefetch(direct, i);
 
 	left = nd;
 	for (i=0; i<nblocks; i++) {
@@ -337,7 +348,7 @@ sfs_writedirblock(struct sfs_direntry *d, uint32_t diskblock)
 		for (j=0; j<atonce; j++) {
 			swapdir(&d[j]);
 		}
-		diskwrite(d, diskblock);
+		cache_write(d, diskblock);
 	}
 	else {
 		for (j=bad=0; j<atonce; j++) {
@@ -424,6 +435,26 @@ dirsortfunc(const void *aa, const void *bb)
 	return strcmp(ad->sfd_name, bd->sfd_name);
 }
 
+/*
+ * Bring the inodes of the ND entries in D into the cache before the
+ * caller goes through them one by one.
+ */
+void
+sfsdir_prefetch(const struct sfs_direntry *d, unsigned nd)
+{
+	uint32_t *inos;
+	unsigned i, n;
+
+	inos = domalloc(nd * sizeof(uint32_t) + 1);
+	for (i=n=0; i<nd; i++) {
+		if (d[i].sfd_ino != SFS_NOINO) {
+			inos[n++] = d[i].sfd_ino;
+		}
+	}
+	cache_prefetch(inos, n);
+	free(inos);
+}
+
 /*
  * Sort the directory contents in D (with ND entries) by producing a
  * permutation vector into VECTOR, which should be allocated to hold
@@ -74,6 +74,9 @@ void sfs_writedir(const struct sfs_dinode *sfi,
 int sfsdir_tryadd(struct sfs_direntry *d, int nd,
 		  const char *name, uint32_t ino);
 
+/* Read ahead the inodes named in a directory, in disk order. */
+void sfsdir_prefetch(const struct sfs_direntry *d, unsigned nd);
+
 /* Sort a directory by creating a permutation vector. */
 void sfsdir_sort(struct sfs_direntry *d, unsigned nd, int *vector);
 
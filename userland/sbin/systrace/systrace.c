@@ -0,0 +1,378 @@
+/*
+ * systrace - control and read the kernel's system call trace.
+ * Usage: systrace on | full | off
+ *        systrace [-h]
+ *        systrace -r tracefile command [args...]
+ *
+ * "on", "full" and "off" turn tracing on, on with pathnames, and off.
+ * Otherwise the records logged so far are drained from systrace: and
+ * printed, one per call, or with -h summed up as a log2 latency
+ * histogram for each call. Calls are given by number; see
+ * <kern/syscall.h>.
+ *
+ * -r runs COMMAND with full tracing on, draining the log into
+ * TRACEFILE as it goes so the rings don't overflow, and at the end
+ * keeps only the records of COMMAND and the processes it forked or
+ * spawned, sorted by time. /sbin/replay can then play them back.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <kern/syscall.h>
+#include <kern/systrace.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <err.h>
+
+#define DEVICE		"systrace:"
+#define MAXCALLS	256
+#define NBUCKETS	20
+
+/* Records read at a time */
+#define NRECS		32
+
+/* Most processes -r follows */
+#define MAXPIDS		256
+
+/* How often -r drains the log, in nanoseconds */
+#define DRAINNS		10000000
+
+static unsigned hist[MAXCALLS][NBUCKETS];
+
+static
+void
+usage(void)
+{
+	errx(1, "Usage: systrace on | full | off | [-h] | "
+	     "-r tracefile command [args...]");
+}
+
+static
+void
+setenabled(const char *how)
+{
+	int fd;
+
+	fd = open(DEVICE, O_WRONLY);
+	if (fd < 0) {
+		err(1, "%s", DEVICE);
+	}
+	if (write(fd, how, strlen(how)) < 0) {
+		err(1, "%s: write", DEVICE);
+	}
+	close(fd);
+}
+
+/* Bucket for a latency of NSECS: log2 of it in microseconds. */
+static
+unsigned
+bucket(__u64 nsecs)
+{
+	__u64 usecs;
+	unsigned b;
+
+	usecs = nsecs / 1000;
+	for (b=0; usecs > 1 && b < NBUCKETS - 1; b++) {
+		usecs >>= 1;
+	}
+	return b;
+}
+
+static
+void
+printrec(const struct systrace_rec *sr)
+{
+	if (sr->sr_lost > 0) {
+		printf("%3u (%u records lost)\n", sr->sr_cpu, sr->sr_lost);
+	}
+	printf("%3u %5d %4d %6d %11d %14llu %10llu\n",
+	       sr->sr_cpu, sr->sr_pid, sr->sr_callno, sr->sr_err,
+	       sr->sr_result,
+	       (unsigned long long)(sr->sr_enter / 1000),
+	       (unsigned long long)((sr->sr_exit - sr->sr_enter) / 1000));
+}
+
+static
+void
+printhist(void)
+{
+	unsigned i, b, calls;
+	char upper[16];
+
+	for (i=0; i<MAXCALLS; i++) {
+		calls = 0;
+		for (b=0; b<NBUCKETS; b++) {
+			calls += hist[i][b];
+		}
+		if (calls == 0) {
+			continue;
+		}
+		printf("call %u: %u calls\n", i, calls);
+		for (b=0; b<NBUCKETS; b++) {
+			if (hist[i][b] == 0) {
+				continue;
+			}
+			snprintf(upper, sizeof(upper), "%u", 1U << (b + 1));
+			printf("    %8u - %-8s us %9u\n", b == 0 ? 0 : 1U << b,
+			       b == NBUCKETS - 1 ? "" : upper, hist[i][b]);
+		}
+	}
+}
+
+static
+void
+drain(int dohist)
+{
+	struct systrace_rec recs[NRECS];
+	ssize_t len;
+	unsigned i, n;
+	int fd;
+
+	fd = open(DEVICE, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", DEVICE);
+	}
+
+	if (!dohist) {
+		printf("%3s %5s %4s %6s %11s %14s %10s\n", "cpu", "pid",
+		       "call", "error", "result", "enter us", "latency us");
+	}
+	/*
+	 * Stop at the first short read; otherwise, with tracing on, each
+	 * read would find the record of the one before it.
+	 */
+	do {
+		len = read(fd, recs, sizeof(recs));
+		if (len < 0) {
+			err(1, "%s: read", DEVICE);
+		}
+		n = len / sizeof(recs[0]);
+		for (i=0; i<n; i++) {
+			if (!dohist) {
+				printrec(&recs[i]);
+			}
+			else if (recs[i].sr_callno >= 0 &&
+				 recs[i].sr_callno < MAXCALLS) {
+				hist[recs[i].sr_callno]
+				    [bucket(recs[i].sr_exit -
+					    recs[i].sr_enter)]++;
+			}
+		}
+	} while (len == sizeof(recs));
+	close(fd);
+
+	if (dohist) {
+		printhist();
+	}
+}
+
+/*
+ * Drain whatever is in the log from DEVFD onto OUTFD. Returns the
+ * number of records, and adds the records lost to *LOST.
+ */
+static
+unsigned
+drainto(int devfd, int outfd, const char *outname, unsigned *lost)
+{
+	struct systrace_rec recs[NRECS];
+	ssize_t len;
+	unsigned i, n, total;
+
+	total = 0;
+	do {
+		len = read(devfd, recs, sizeof(recs));
+		if (len < 0) {
+			err(1, "%s: read", DEVICE);
+		}
+		n = len / sizeof(recs[0]);
+		for (i=0; i<n; i++) {
+			*lost += recs[i].sr_lost;
+		}
+		if (n > 0 && write(outfd, recs, n * sizeof(recs[0])) < 0) {
+			err(1, "%s: write", outname);
+		}
+		total += n;
+	} while (len == sizeof(recs));
+	return total;
+}
+
+static
+int
+byenter(const void *av, const void *bv)
+{
+	const struct systrace_rec *a = av, *b = bv;
+
+	if (a->sr_enter != b->sr_enter) {
+		return a->sr_enter < b->sr_enter ? -1 : 1;
+	}
+	return 0;
+}
+
+static
+bool
+ispid(const int *pids, unsigned npids, int pid)
+{
+	unsigned i;
+
+	for (i=0; i<npids; i++) {
+		if (pids[i] == pid) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Cut the trace in FD down to ROOT and its descendants, in order.
+ */
+static
+void
+filter(int fd, const char *name, int root)
+{
+	struct systrace_rec *recs, *r;
+	int pids[MAXPIDS];
+	unsigned npids, i, n, kept;
+	off_t size;
+
+	size = lseek(fd, 0, SEEK_END);
+	if (size < 0) {
+		err(1, "%s: lseek", name);
+	}
+	n = size / sizeof(*recs);
+	recs = malloc(n * sizeof(*recs) + 1);
+	if (recs == NULL) {
+		errx(1, "Out of memory for %u records", n);
+	}
+	if (pread(fd, recs, n * sizeof(*recs), 0) !=
+	    (ssize_t)(n * sizeof(*recs))) {
+		err(1, "%s: read", name);
+	}
+	qsort(recs, n, sizeof(*recs), byenter);
+
+	pids[0] = root;
+	npids = 1;
+	kept = 0;
+	for (i=0; i<n; i++) {
+		r = &recs[i];
+		if (!ispid(pids, npids, r->sr_pid)) {
+			continue;
+		}
+		if ((r->sr_callno == SYS_fork || r->sr_callno == SYS_vfork ||
+		     r->sr_callno == SYS___spawn) &&
+		    r->sr_err == 0 && r->sr_result > 0) {
+			if (npids == MAXPIDS) {
+				errx(1, "More than %d processes", MAXPIDS);
+			}
+			pids[npids++] = r->sr_result;
+		}
+		recs[kept++] = *r;
+	}
+
+	if (pwrite(fd, recs, kept * sizeof(*recs), 0) < 0) {
+		err(1, "%s: write", name);
+	}
+	if (ftruncate(fd, kept * sizeof(*recs)) < 0) {
+		err(1, "%s: ftruncate", name);
+	}
+	printf("systrace: %u calls by %u processes\n", kept, npids);
+	free(recs);
+}
+
+/*
+ * Run ARGS with full tracing, and keep its part of the trace in FILE.
+ */
+static
+void
+record(const char *file, char **args)
+{
+	struct timespec pause;
+	unsigned lost;
+	int devfd, outfd, status;
+	pid_t pid, done;
+
+	devfd = open(DEVICE, O_RDONLY);
+	if (devfd < 0) {
+		err(1, "%s", DEVICE);
+	}
+	outfd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (outfd < 0) {
+		err(1, "%s", file);
+	}
+
+	/* Throw away anything logged before */
+	setenabled("off");
+	lost = 0;
+	drainto(devfd, outfd, file, &lost);
+	if (ftruncate(outfd, 0) < 0 || lseek(outfd, 0, SEEK_SET) < 0) {
+		err(1, "%s", file);
+	}
+	lost = 0;
+
+	setenabled("full");
+	pid = fork();
+	if (pid < 0) {
+		setenabled("off");
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(devfd);
+		close(outfd);
+		execvp(args[0], args);
+		err(1, "%s", args[0]);
+	}
+
+	pause.tv_sec = 0;
+	pause.tv_nsec = DRAINNS;
+	while ((done = waitpid(pid, &status, WNOHANG)) == 0) {
+		if (drainto(devfd, outfd, file, &lost) == 0) {
+			nanosleep(&pause, NULL);
+		}
+	}
+	setenabled("off");
+	if (done < 0) {
+		err(1, "waitpid");
+	}
+	drainto(devfd, outfd, file, &lost);
+	close(devfd);
+
+	if (lost > 0) {
+		warnx("%u records were lost; the trace is incomplete", lost);
+	}
+	filter(outfd, file, pid);
+	close(outfd);
+
+	if (WIFSIGNALED(status)) {
+		warnx("%s: signal %d", args[0], WTERMSIG(status));
+	}
+	else if (WEXITSTATUS(status) != 0) {
+		warnx("%s: exit %d", args[0], WEXITSTATUS(status));
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc == 1) {
+		drain(0);
+	}
+	else if (argc == 2 && !strcmp(argv[1], "-h")) {
+		drain(1);
+	}
+	else if (argc == 2 && (!strcmp(argv[1], "on") ||
+			       !strcmp(argv[1], "full") ||
+			       !strcmp(argv[1], "off"))) {
+		setenabled(argv[1]);
+	}
+	else if (argc >= 4 && !strcmp(argv[1], "-r")) {
+		record(argv[2], &argv[3]);
+	}
+	else {
+		usage();
+	}
+	return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * vmstat - print the kernel's VM fault and paging counters.
+ * Usage: vmstat
+ *        vmstat program [args...]
+ *
+ * With no arguments, prints the system-wide totals, the vm_* lines
+ * of stats:. Otherwise runs the program, waits for it, and prints
+ * how much each total went up meanwhile (which includes anything
+ * else that ran at the same time) and the program's own minor and
+ * major faults, from getrusage.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define DEVICE		"stats:"
+#define MAXVM		16
+#define NAMELEN		16
+
+struct counter {
+	char name[NAMELEN];
+	unsigned long long value;
+};
+
+static char buf[8192];
+
+/*
+ * Read the vm_* totals from stats: into C, returning how many there
+ * are. Each line is a name, the total, and a number per cpu.
+ */
+static
+unsigned
+readvm(struct counter *c)
+{
+	ssize_t len, got;
+	unsigned n, i;
+	char *line, *next, *s;
+	int fd;
+
+	fd = open(DEVICE, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", DEVICE);
+	}
+	/* Read it in one go, for a consistent snapshot */
+	len = 0;
+	do {
+		got = read(fd, buf + len, sizeof(buf) - 1 - len);
+		if (got < 0) {
+			err(1, "%s: read", DEVICE);
+		}
+		len += got;
+	} while (got > 0 && len < (ssize_t)sizeof(buf) - 1);
+	close(fd);
+	buf[len] = 0;
+
+	n = 0;
+	for (line = buf; line != NULL && *line != 0; line = next) {
+		next = strchr(line, '\n');
+		if (next != NULL) {
+			*next++ = 0;
+		}
+		if (memcmp(line, "vm_", 3) != 0 || n == MAXVM) {
+			continue;
+		}
+		for (i=0; line[i] != ' ' && line[i] != 0 && i < NAMELEN-1;
+		     i++) {
+			c[n].name[i] = line[i];
+		}
+		c[n].name[i] = 0;
+		s = line + i;
+		while (*s == ' ') {
+			s++;
+		}
+		c[n].value = 0;
+		while (*s >= '0' && *s <= '9') {
+			c[n].value = c[n].value * 10 + (*s - '0');
+			s++;
+		}
+		n++;
+	}
+	return n;
+}
+
+static
+void
+run(char **args)
+{
+	struct counter before[MAXVM], after[MAXVM];
+	struct rusage ru0, ru1;
+	unsigned i, n;
+	pid_t pid;
+	int status;
+
+	if (getrusage(RUSAGE_CHILDREN, &ru0) < 0) {
+		err(1, "getrusage");
+	}
+	readvm(before);
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		execv(args[0], args);
+		err(1, "%s", args[0]);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+
+	n = readvm(after);
+	if (getrusage(RUSAGE_CHILDREN, &ru1) < 0) {
+		err(1, "getrusage");
+	}
+
+	for (i=0; i<n; i++) {
+		printf("%-15s %llu\n", after[i].name,
+		       after[i].value - before[i].value);
+	}
+	printf("%s: %lu minor faults, %lu major faults\n", args[0],
+	       (unsigned long)(ru1.ru_minflt - ru0.ru_minflt),
+	       (unsigned long)(ru1.ru_majflt - ru0.ru_majflt));
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct counter c[MAXVM];
+	unsigned i, n;
+
+	if (argc > 1) {
+		run(argv + 1);
+		return 0;
+	}
+	n = readvm(c);
+	for (i=0; i<n; i++) {
+		printf("%-15s %llu\n", c[i].name, c[i].value);
+	}
+	return 0;
+}
@@ -209,6 +209,36 @@ try_seeking(int fd, off_t pos, off_t cursize)
 	dolseek(fd, pos, SEEK_SET, "SEEK_SET", pos);
 }
 
+/*
+ * SEEK_DATA and SEEK_HOLE. The file starts with data and ends with
+ * data, whatever is in between, and past the end there is nothing to
+ * find, however far past (which would be found if the position were
+ * cut down to 32 bits).
+ */
+static
+void
+try_holes(int fd, off_t cursize)
+{
+	off_t pos;
+
+	printf("Looking for data and holes\n");
+	dolseek(fd, 0, SEEK_DATA, "SEEK_DATA", 0);
+	dolseek(fd, cursize - 1, SEEK_HOLE, "SEEK_HOLE", cursize);
+	pos = lseek(fd, 0, SEEK_HOLE);
+	if (pos == -1) {
+		err(1, "lseek(fd, 0, SEEK_HOLE)");
+	}
+	printf("First hole at 0x%llx\n", pos);
+
+	if (lseek(fd, (off_t)0x100000000LL, SEEK_DATA) != -1) {
+		errx(1, "lseek(fd, 0x100000000, SEEK_DATA): "
+		     "Found data past EOF");
+	}
+	if (errno != ENXIO) {
+		err(1, "lseek(fd, 0x100000000, SEEK_DATA): Wrong error");
+	}
+}
+
 int
 main(void)
 {
@@ -241,6 +271,8 @@ main(void)
 	printf("Checking the other thing we wrote\n");
 	check_slogan(fd, 1);
 
+	try_holes(fd, cursize);
+
 	try_seeking(fd, (off_t)0x20LL, cursize);
 	try_seeking(fd, (off_t)0x7fffffffLL, cursize);
 	try_seeking(fd, (off_t)0x80000000LL, cursize);
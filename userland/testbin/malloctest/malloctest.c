@@ -46,7 +46,9 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 #include <assert.h>
+#include <atomic.h>
 #include <err.h>
 
 
@@ -629,6 +631,166 @@ test7(void)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Test 8
+ *
+ * Like test 5, but in MTHREADS threads at once, each with its own
+ * blocks, and with about half of each thread's blocks handed to the
+ * next thread to free, so they go back across arenas. Then the same
+ * amount of work is done in one thread, for comparison: with an
+ * arena per thread, the threads shouldn't wait on each other, and on
+ * more than one CPU should get done sooner.
+ */
+
+#define MTHREADS	4
+#define MTBLOCKS	32
+#define MTITERS		50000	/* per thread */
+
+/* Blocks handed to each thread to free */
+static void *volatile mthandoff[MTHREADS][MTBLOCKS];
+static unsigned mtnthreads;
+static volatile int mtfailed;
+
+/* Free whatever has been handed to thread me */
+static
+void
+mttakeback(unsigned me)
+{
+	unsigned i;
+
+	for (i=0; i<MTBLOCKS; i++) {
+		if (mthandoff[me][i] != NULL) {
+			free((void *)atomic_swap((volatile int *)
+						 &mthandoff[me][i], 0));
+		}
+	}
+}
+
+static
+int
+mtthread(void *arg)
+{
+	static const int sizes[8] = { 13, 17, 69, 176, 433, 871, 1150, 6060 };
+
+	unsigned me = (uintptr_t)arg;
+	void *ptrs[MTBLOCKS];
+	int psizes[MTBLOCKS];
+	unsigned long seed, i;
+	unsigned n, next, bias;
+	int size;
+
+	/* random() isn't thread-safe; use our own */
+	seed = me + 1;
+	next = (me + 1) % mtnthreads;
+	for (n=0; n<MTBLOCKS; n++) {
+		ptrs[n] = NULL;
+		psizes[n] = 0;
+	}
+
+	for (i=0; i<MTITERS * MTHREADS / mtnthreads && !mtfailed; i++) {
+		seed = seed * 1103515245 + 12345;
+		n = (seed >> 8) % MTBLOCKS;
+		bias = me * MTBLOCKS + n;
+		if (ptrs[n] == NULL) {
+			size = sizes[(seed >> 16) % 8];
+			ptrs[n] = malloc(size);
+			psizes[n] = size;
+			if (ptrs[n] == NULL) {
+				printf("\nthread %u: malloc %u failed\n",
+				       me, size);
+				mtfailed = 1;
+				break;
+			}
+			markblock(ptrs[n], size, bias, 0);
+		}
+		else {
+			if (checkblock(ptrs[n], psizes[n], bias, 0)) {
+				mtfailed = 1;
+				break;
+			}
+			if (next != me && (seed >> 24) % 2 == 0) {
+				free((void *)atomic_swap((volatile int *)
+							 &mthandoff[next][n],
+							 (int)ptrs[n]));
+			}
+			else {
+				free(ptrs[n]);
+			}
+			ptrs[n] = NULL;
+		}
+		if (i % 64 == 0) {
+			mttakeback(me);
+		}
+	}
+
+	for (n=0; n<MTBLOCKS; n++) {
+		free(ptrs[n]);
+	}
+	return 0;
+}
+
+/*
+ * Run mtthread in nthreads threads (this one and nthreads - 1 more),
+ * and return how long it took in milliseconds.
+ */
+static
+unsigned long
+mtrun(unsigned nthreads)
+{
+	int tids[MTHREADS];
+	struct timespec start, end;
+	unsigned i;
+	int status;
+
+	mtnthreads = nthreads;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i=1; i<nthreads; i++) {
+		tids[i] = thread_create(mtthread, (void *)(uintptr_t)i);
+		if (tids[i] < 0) {
+			err(1, "thread_create");
+		}
+	}
+	mtthread((void *)0);
+	for (i=1; i<nthreads; i++) {
+		thread_join(tids[i], &status);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	for (i=0; i<nthreads; i++) {
+		mttakeback(i);
+	}
+	return (end.tv_sec - start.tv_sec) * 1000UL +
+		(end.tv_nsec - start.tv_nsec) / 1000000L;
+}
+
+static
+void
+test8(void)
+{
+	unsigned long many, one;
+
+	printf("Beginning malloc test 8\n");
+
+	mtfailed = 0;
+	many = mtrun(MTHREADS);
+	printf("%d threads: %lu ms\n", MTHREADS, many);
+	one = mtrun(1);
+	printf("1 thread: %lu ms\n", one);
+	if (many > 0) {
+		printf("Speedup: %lu.%02lu\n", one / many,
+		       one * 100 / many % 100);
+	}
+
+	if (mtfailed) {
+		printf("FAILED malloc test 8\n");
+	}
+	else {
+		printf("Passed malloc test 8\n");
+	}
+}
+
+////////////////////////////////////////////////////////////
+
 static struct {
 	int num;
 	const char *desc;
@@ -641,6 +803,7 @@ static struct {
 	{ 5, "Stress test", test5 },
 	{ 6, "Randomized stress test", test6 },
 	{ 7, "Stress test with particular seed", test7 },
+	{ 8, "Multithreaded stress test", test8 },
 	{ -1, NULL, NULL }
 };
 
@@ -37,10 +37,21 @@
  *
  *    Once the VM system assignment is complete your system should be
  *    able to survive this.
+ *
+ *    With -m, it instead does an ordinary multiply of two -n by -n
+ *    matrices with one of the libtest methods (see test/matlib.h), so
+ *    the same VM system can be timed under naive and under cache- and
+ *    TLB-friendly access patterns.
  */
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <time.h>
+#include <err.h>
+#include <test/matlib.h>
 
 #define Dim 	72	/* sum total of the arrays doesn't fit in
 			 * physical memory
@@ -48,13 +59,16 @@
 
 #define RIGHT  8772192		/* correct answer */
 
+#define MDim	360	/* default for -m; about as much memory as above */
+
 int A[Dim][Dim];
 int B[Dim][Dim];
 int C[Dim][Dim];
 int T[Dim][Dim][Dim];
 
+static
 int
-main(void)
+storage_inefficient(void)
 {
     int i, j, k, r;
 
@@ -88,3 +102,96 @@ main(void)
     printf("Passed.\n");
     return 0;
 }
+
+/*
+ * C = A * B with matlib, A[i][j] = i and B[i][j] = j as above, so
+ * C[i][j] = n*i*j and the trace is n times the sum of the squares.
+ */
+static
+int
+withmatlib(enum matlib_method method, unsigned n)
+{
+    int *a, *b, *c;
+    unsigned i, j, r, right;
+    struct timespec start, end;
+    unsigned long ms;
+
+    a = malloc(n * n * sizeof(int));
+    b = malloc(n * n * sizeof(int));
+    c = malloc(n * n * sizeof(int));
+    if (a == NULL || b == NULL || c == NULL) {
+	    errx(1, "Out of memory for %u by %u matrices", n, n);
+    }
+    for (i = 0; i < n; i++)
+	for (j = 0; j < n; j++) {
+	     a[i*n + j] = i;
+	     b[i*n + j] = j;
+	}
+
+    phase(PHASE_BEGIN | PHASE_PROF, matlib_name(method));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (matlib_mul(method, c, a, b, n) < 0) {
+	    err(1, "matlib_mul");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    phase(PHASE_END | PHASE_PROF, matlib_name(method));
+
+    r = 0;
+    right = 0;
+    for (i = 0; i < n; i++) {
+	    r += (unsigned)c[i*n + i];
+	    right += n * i * i;
+    }
+    free(a);
+    free(b);
+    free(c);
+
+    ms = (end.tv_sec - start.tv_sec) * 1000UL +
+	    (end.tv_nsec - start.tv_nsec) / 1000000L;
+    printf("matmult (%s, %u by %u) finished in %lu.%03lu seconds.\n",
+	   matlib_name(method), n, n, ms / 1000, ms % 1000);
+    printf("answer is: %u (should be %u)\n", r, right);
+    if (r != right) {
+	    printf("FAILED\n");
+	    return 1;
+    }
+    printf("Passed.\n");
+    return 0;
+}
+
+static
+void
+usage(void)
+{
+    errx(1, "Usage: matmult [-m naive|tiled|blocked] [-n dim]");
+}
+
+int
+main(int argc, char *argv[])
+{
+    int i, method = -1;
+    unsigned n = MDim;
+
+    for (i = 1; i < argc; i++) {
+	    if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+		    method = matlib_lookup(argv[++i]);
+		    if (method < 0) {
+			    usage();
+		    }
+	    }
+	    else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+		    n = atoi(argv[++i]);
+	    }
+	    else {
+		    usage();
+	    }
+    }
+
+    if (method < 0) {
+	    return storage_inefficient();
+    }
+    if (n < 1 || n > 4096) {
+	    usage();
+    }
+    return withmatlib(method, n);
+}
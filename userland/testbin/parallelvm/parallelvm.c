@@ -32,19 +32,26 @@
  *
  * This test probably won't run with only 512k of physical memory
  * (unless maybe if you have a *really* gonzo VM system) because each
- * of its processes needs to allocate a kernel stack, and those add up
+ * of its jobs needs to allocate a kernel stack, and those add up
  * quickly.
+ *
+ * The jobs run on a task pool (test/taskpool.h), as threads if the
+ * kernel has them and processes otherwise, or with -f. By default
+ * they all run at once; -j runs only so many at a time, which with
+ * the time printed at the end makes it a scaling benchmark.
  */
 
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
 #include <err.h>
+#include <test/taskpool.h>
 
 #define NJOBS    24
 
@@ -147,11 +154,9 @@ trace(const struct matrix *m1)
 
 ////////////////////////////////////////////////////////////
 
-static struct matrix mats[NMATS];
-
 static
 void
-populate_initial_matrixes(int mynum)
+populate_initial_matrixes(struct matrix *mats, int mynum)
 {
 	int i,j;
 	struct matrix *m = &mats[0];
@@ -166,7 +171,7 @@ populate_initial_matrixes(int mynum)
 
 static
 void
-compute(int n)
+compute(struct matrix *mats, int n)
 {
 	struct matrix tmp;
 	int i, j;
@@ -179,48 +184,60 @@ compute(int n)
 
 static
 void
-computeall(int mynum)
+computeall(struct matrix *mats, int mynum)
 {
 	int i;
-	populate_initial_matrixes(mynum);
+	populate_initial_matrixes(mats, mynum);
 	for (i=2; i<NMATS; i++) {
-		compute(i);
+		compute(mats, i);
 	}
 }
 
 static
 int
-answer(void)
+answer(struct matrix *mats)
 {
 	return trace(&mats[NMATS-1]);
 }
 
+/*
+ * One job, with matrices of its own. Returns 0 if it got the right
+ * answer.
+ */
 static
-void
+int
 go(int mynum)
 {
+	struct matrix *mats;
 	int r;
 
-	say("Process %d (pid %d) starting computation...\n", mynum,
+	say("Job %d (pid %d) starting computation...\n", mynum,
 	    (int) getpid());
 
-	computeall(mynum);
-	r = answer();
+	mats = malloc(NMATS * sizeof(*mats));
+	if (mats == NULL) {
+		say("Job %d: out of memory\n", mynum);
+		return 1;
+	}
+	memset(mats, 0, NMATS * sizeof(*mats));
+	computeall(mats, mynum);
+	r = answer(mats);
+	free(mats);
 
 	if (r != right_answers[mynum]) {
-		say("Process %d answer %d: FAILED, should be %d\n",
+		say("Job %d answer %d: FAILED, should be %d\n",
 		    mynum, r, right_answers[mynum]);
-		exit(1);
+		return 1;
 	}
-	say("Process %d answer %d: passed\n", mynum, r);
-	exit(0);
+	say("Job %d answer %d: passed\n", mynum, r);
+	return 0;
 }
 
 ////////////////////////////////////////////////////////////
 // semaphores
 
 /*
- * We open the semaphore separately in each process to avoid
+ * We open the semaphore separately in each job to avoid
  * filehandle-level locking problems. If you can't be "reading" and
  * "writing" the semaphore concurrently because of the open file
  * object lock, then using the same file handle for P and V will
@@ -308,118 +325,120 @@ semV(struct usem *sem, size_t num)
 ////////////////////////////////////////////////////////////
 // driver
 
+static bool dowait;
+static struct usem s1, s2;
+
+/*
+ * Job I for parallel_for. With -w, the jobs all wait on s2 until
+ * every one has checked in on s1, and the extra one, NJOBS, is the
+ * starter that lets them go.
+ */
 static
 int
-status_is_failure(int status)
+job(unsigned i, void *arg)
 {
-	/* Proper interpretation of Unix exit status */
-	if (WIFSIGNALED(status)) {
-		return 1;
+	(void)arg;
+
+	if (!dowait) {
+		return go(i);
 	}
-	if (!WIFEXITED(status)) {
-		/* ? */
-		return 1;
+	semopen(&s1);
+	semopen(&s2);
+	if (i == NJOBS) {
+		say("Waiting for jobs...\n");
+		semP(&s1, NJOBS);
+		say("Starting computation.\n");
+		semV(&s2, NJOBS);
+		semclose(&s1);
+		semclose(&s2);
+		return 0;
 	}
-	status = WEXITSTATUS(status);
-	return status != 0;
+	say("Job %u ready\n", i);
+	semV(&s1, 1);
+	semP(&s2, 1);
+	semclose(&s1);
+	semclose(&s2);
+	return go(i);
 }
 
 static
 void
-makeprocs(bool dowait)
+makejobs(unsigned nworkers, int flags)
 {
-	int i, status, failcount;
-	struct usem s1, s2;
-	pid_t pids[NJOBS];
+	struct timespec start, end;
+	unsigned long ms;
+	unsigned failcount;
 
 	if (dowait) {
+		/* Everyone, and the starter, must run at once */
+		nworkers = NJOBS + 1;
 		semcreate("1", &s1);
 		semcreate("2", &s2);
 	}
+	if (taskpool_init(nworkers, flags) < 0) {
+		err(1, "taskpool_init");
+	}
+	if (dowait && taskpool_nworkers() < NJOBS + 1) {
+		errx(1, "-w: could only get %u threads of %d",
+		     taskpool_nworkers(), NJOBS + 1);
+	}
 
 	printf("Job size approximately %lu bytes\n", (unsigned long) JOBSIZE);
-	printf("Forking %d jobs; total load %luk\n", NJOBS,
+	printf("Running %d jobs on %u %s; total load %luk\n", NJOBS,
+	       taskpool_nworkers(),
+	       taskpool_threaded() ? "threads" : "processes",
 	       (unsigned long) (NJOBS * JOBSIZE)/1024);
 
-	for (i=0; i<NJOBS; i++) {
-		pids[i] = fork();
-		if (pids[i]<0) {
-			warn("fork (process %d)", i);
-			if (dowait) {
-				semopen(&s1);
-				semV(&s1, 1);
-				semclose(&s1);
-			}
-		}
-		if (pids[i]==0) {
-			/* child */
-			if (dowait) {
-				say("Process %d forked\n", i);
-				semopen(&s1);
-				semopen(&s2);
-				semV(&s1, 1);
-				semP(&s2, 1);
-				semclose(&s1);
-				semclose(&s2);
-			}
-			go(i);
-		}
-	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	failcount = parallel_for(dowait ? NJOBS + 1 : NJOBS, job, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	taskpool_fini();
 
 	if (dowait) {
-		semopen(&s1);
-		semopen(&s2);
-		say("Waiting for fork...\n");
-		semP(&s1, NJOBS);
-		say("Starting computation.\n");
-		semV(&s2, NJOBS);
-	}
-
-	failcount=0;
-	for (i=0; i<NJOBS; i++) {
-		if (pids[i]<0) {
-			failcount++;
-		}
-		else {
-			if (waitpid(pids[i], &status, 0)<0) {
-				err(1, "waitpid");
-			}
-			if (status_is_failure(status)) {
-				failcount++;
-			}
-		}
+		semdestroy(&s1);
+		semdestroy(&s2);
 	}
-
 	if (failcount>0) {
-		printf("%d subprocesses failed\n", failcount);
+		printf("%u jobs failed\n", failcount);
 		exit(1);
 	}
-	printf("Test complete\n");
+	ms = (end.tv_sec - start.tv_sec) * 1000UL +
+		(end.tv_nsec - start.tv_nsec) / 1000000L;
+	printf("Test complete in %lu.%03lu seconds\n", ms / 1000, ms % 1000);
+}
 
-	semclose(&s1);
-	semclose(&s2);
-	semdestroy(&s1);
-	semdestroy(&s2);
+static
+void
+usage(void)
+{
+	printf("Usage: parallelvm [-w] [-f] [-j jobs-at-once]\n");
+	exit(1);
 }
 
 int
 main(int argc, char *argv[])
 {
-	bool dowait = false;
+	unsigned nworkers = NJOBS;
+	int i, flags = 0;
 
-	if (argc == 0) {
-		/* broken/unimplemented argv handling; do nothing */
-	}
-	else if (argc == 1) {
-		/* nothing */
-	}
-	else if (argc == 2 && !strcmp(argv[1], "-w")) {
-		dowait = true;
+	/* (argc == 0 means broken/unimplemented argv handling) */
+	for (i=1; i<argc; i++) {
+		if (!strcmp(argv[i], "-w")) {
+			dowait = true;
+		}
+		else if (!strcmp(argv[i], "-f")) {
+			flags |= TASKPOOL_FORK;
+		}
+		else if (!strcmp(argv[i], "-j") && i+1 < argc) {
+			nworkers = atoi(argv[++i]);
+		}
+		else {
+			usage();
+		}
 	}
-	else {
-		printf("Usage: parallelvm [-w]\n");
-		return 1;
+	if (nworkers < 1 || nworkers > NJOBS) {
+		usage();
 	}
-	makeprocs(dowait);
+	makejobs(nworkers, flags);
 	return 0;
 }
@@ -34,11 +34,17 @@
  * because of various limitations of OS/161 it is massively
  * inefficient. But that's ok; the goal is to stress the VM and buffer
  * cache.
+ *
+ * The work of each phase is split numprocs ways and spread over a
+ * task pool (test/taskpool.h): threads, if the kernel has them, or
+ * else (or with -f) processes, as it always used to be. The time the
+ * whole thing took is printed at the end, so that runs can be
+ * compared.
  */
 
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -47,6 +53,9 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <time.h>
+#include <test/sortlib.h>
+#include <test/taskpool.h>
 
 #ifndef RANDOM_MAX
 /* Note: this is correct for OS/161 but not for some Unix C libraries */
@@ -61,7 +70,7 @@
 /*
  * Workload sizing.
  *
- * We fork numprocs processes. Each one works on WORKNUM integers at a
+ * We run numprocs workers. Each one works on WORKNUM integers at a
  * time, so the total VM load is WORKNUM * sizeof(int) * numprocs. For
  * the best stress testing, this should be substantially larger than
  * your available RAM.
@@ -91,18 +100,12 @@
  * time to run it, in either 1M or 2M of RAM and with 4 CPUs; this
  * currently corresponds to about 13-14 minutes of real time.
  *
- * Note that the parent psort process serves as a director and doesn't
- * itself compute; it has a workspace (because it's a static buffer)
- * but doesn't use it. A VM system that doesn't do zerofill
- * optimization will be a lot slower because it has to copy this space
- * for every batch of forks.
+ * Each worker mallocs its workspace at the start of each phase and
+ * frees it at the end, so with threads the workspaces come and go
+ * with the phases, and with processes the parent has none to copy.
  *
  * Also note that you can set numprocs and numkeys on the command
  * line, but not WORKNUM.
- *
- * FUTURE: maybe make a build option to malloc the work space instead
- * of using a static buffer, which would allow choosing WORKNUM on the
- * command line too, at the cost of depending on malloc working.
  */
 
 /* Set the workload size. */
@@ -110,72 +113,22 @@
 static int numprocs = 4;
 static int numkeys = 128*1024;
 
-/* Per-process work buffer */
-static int workspace[WORKNUM];
-
 /* Random seed for generating the data */
 static long randomseed = 15432753;
 
+/* Use processes even if there are threads */
+static bool usefork;
+
 /* other state */
 static off_t correctsize;
 static unsigned long checksum;
 
-#define NOBODY (-1)
-static int me = NOBODY;
-
 static const char *progname;
 
-////////////////////////////////////////////////////////////
-
-static
-void
-sortints(int *v, int num)
-{
-	int pivotval, pivotpoint, pivotcount;
-	int frontpos, readpos, endpos, i, j;
-	int tmp;
-
-	if (num < 2) {
-		return;
-	}
-
-	pivotpoint = num/2;
-	pivotval = v[pivotpoint];
-	pivotcount = 0;
-
-	frontpos = 0;
-	readpos = 0;
-	endpos = num;
-	while (readpos < endpos) {
-		if (v[readpos] < pivotval) {
-			v[frontpos++] = v[readpos++];
-		}
-		else if (v[readpos] == pivotval) {
-			readpos++;
-			pivotcount++;
-		}
-		else {
-			tmp = v[--endpos];
-			v[endpos] = v[readpos];
-			v[readpos] = tmp;
-		}
-	}
-	assert(readpos == endpos);
-	assert(frontpos + pivotcount == readpos);
+/* Room for the name of a bin or other temporary file */
+#define NAMESIZE 32
 
-	for (i=frontpos; i<endpos; i++) {
-		v[i] = pivotval;
-	}
-
-	for (i=endpos, j=num-1; i<j; i++,j--) {
-		tmp = v[i];
-		v[i] = v[j];
-		v[j] = tmp;
-	}
-
-	sortints(v, frontpos);
-	sortints(&v[endpos], num-endpos);
-}
+////////////////////////////////////////////////////////////
 
 ////////////////////////////////////////////////////////////
 
@@ -203,12 +156,7 @@ vscomplain(char *buf, size_t len, const char *fmt, va_list ap, int err)
 {
 	size_t pos;
 
-	if (me >= 0) {
-		snprintf(buf, len, "%s: proc %d: ", progname, me);
-	}
-	else {
-		snprintf(buf, len, "%s: ", progname);
-	}
+	snprintf(buf, len, "%s: ", progname);
 	pos = strlen(buf);
 
 	vsnprintf(buf+pos, len-pos, fmt, ap);
@@ -444,82 +392,59 @@ domkdir(const char *path, int mode)
 }
 #endif /* 0 */
 
-static
-pid_t
-dofork(void)
-{
-	pid_t pid;
-
-	pid = fork();
-	if (pid < 0) {
-		complain("fork");
-		/* but don't exit */
-	}
-
-	return pid;
-}
-
-////////////////////////////////////////////////////////////
+/*
+ * Run a phase: FUNC for each of the numprocs parts, in parallel, each
+ * with a workspace of its own. A worker in trouble complains and
+ * exits, which ends just its process; with threads, it ends the
+ * whole program, as the phase failing would anyway.
+ */
+struct phase {
+	void (*func)(int me, int *workspace);
+};
 
 static
 int
-dowait(int guy, pid_t pid)
+runphase(unsigned me, void *arg)
 {
-	int status, result;
+	struct phase *ph = arg;
+	int *workspace;
 
-	result = waitpid(pid, &status, 0);
-	if (result < 0) {
-		complain("waitpid");
-		return -1;
-	}
-	if (WIFSIGNALED(status)) {
-		complainx("proc %d: signal %d", guy, WTERMSIG(status));
-		return -1;
-	}
-	assert(WIFEXITED(status));
-	status = WEXITSTATUS(status);
-	if (status) {
-		complainx("proc %d: exit %d", guy, status);
-		return -1;
+	workspace = malloc(WORKNUM * sizeof(int));
+	if (workspace == NULL) {
+		complainx("proc %u: out of memory", me);
+		return 1;
 	}
+	ph->func(me, workspace);
+	free(workspace);
 	return 0;
 }
 
 static
 void
-doforkall(const char *phasename, void (*func)(void))
+doall(const char *phasename, void (*func)(int me, int *workspace))
 {
-	int i, bad = 0;
-	pid_t pids[numprocs];
-
-	for (i=0; i<numprocs; i++) {
-		pids[i] = dofork();
-		if (pids[i] < 0) {
-			bad = 1;
-		}
-		else if (pids[i] == 0) {
-			/* child */
-			me = i;
-			func();
-			exit(0);
-		}
-	}
-
-	for (i=0; i<numprocs; i++) {
-		if (pids[i] > 0 && dowait(i, pids[i])) {
-			bad = 1;
-		}
-	}
+	struct phase ph;
 
-	if (bad) {
+	ph.func = func;
+	phase(PHASE_BEGIN | PHASE_PROF, phasename);
+	if (parallel_for(numprocs, runphase, &ph) > 0) {
 		complainx("%s failed.", phasename);
 		exit(1);
 	}
+	phase(PHASE_END | PHASE_PROF, phasename);
+}
+
+/* What the workers are, for messages */
+static
+const char *
+workers(void)
+{
+	return taskpool_threaded() ? "threads" : "procs";
 }
 
 static
 void
-seekmyplace(const char *name, int fd)
+seekmyplace(const char *name, int fd, int me)
 {
 	int keys_per, myfirst;
 	off_t offset;
@@ -533,7 +458,7 @@ seekmyplace(const char *name, int fd)
 
 static
 int
-getmykeys(void)
+getmykeys(int me)
 {
 	int keys_per, myfirst, mykeys;
 
@@ -572,18 +497,33 @@ checksum_file(const char *path)
 
 static long *seeds;
 
+/*
+ * The minimal standard random number generator (Park and Miller),
+ * one per worker, as random() isn't thread-safe. Gives numbers from
+ * 1 to 2^31 - 2.
+ */
+static
+int
+nextrandom(unsigned long *state)
+{
+	*state = (unsigned long)
+		((unsigned long long)*state * 16807 % 2147483647);
+	return (int)*state;
+}
+
 static
 void
-genkeys_sub(void)
+genkeys_sub(int me, int *workspace)
 {
 	int fd, i, mykeys, keys_done, keys_to_do, value;
+	unsigned long state;
 
 	fd = doopen(PATH_KEYS, O_WRONLY, 0);
 
-	mykeys = getmykeys();
-	seekmyplace(PATH_KEYS, fd);
+	mykeys = getmykeys(me);
+	seekmyplace(PATH_KEYS, fd, me);
 
-	srandom(seeds[me]);
+	state = seeds[me] % 2147483646 + 1;
 	keys_done = 0;
 	while (keys_done < mykeys) {
 		keys_to_do = mykeys - keys_done;
@@ -592,7 +532,7 @@ genkeys_sub(void)
 		}
 
 		for (i=0; i<keys_to_do; i++) {
-			value = random();
+			value = nextrandom(&state);
 
 			// check bounds of value
 			assert(value >= 0);
@@ -600,7 +540,7 @@ genkeys_sub(void)
 
 			// do not allow the value to be zero or RANDOM_MAX
 			while (value == 0 || value == RANDOM_MAX) {
-				value = random();
+				value = nextrandom(&state);
 			}
 
 			workspace[i] = value;
@@ -630,9 +570,10 @@ genkeys(void)
 	}
 
 	/* Do it. */
-	complainx("Generating %d integers using %d procs", numkeys, numprocs);
+	complainx("Generating %d integers using %d %s", numkeys, numprocs,
+		  workers());
 	seeds = seedspace;
-	doforkall("Initialization", genkeys_sub);
+	doall("Initialization", genkeys_sub);
 	seeds = NULL;
 
 	/* Cross-check the size of the output. */
@@ -651,39 +592,48 @@ genkeys(void)
 
 static
 const char *
-binname(int a, int b)
+binname(char *rv, int a, int b)
 {
-	static char rv[32];
-	snprintf(rv, sizeof(rv), "bin-%d-%d", a, b);
+	snprintf(rv, NAMESIZE, "bin-%d-%d", a, b);
 	return rv;
 }
 
 static
 const char *
-mergedname(int a)
+mergedname(char *rv, int a)
 {
-	static char rv[32];
-	snprintf(rv, sizeof(rv), "merged-%d", a);
+	snprintf(rv, NAMESIZE, "merged-%d", a);
 	return rv;
 }
 
 static
 void
-bin(void)
+bin(int me, int *workspace)
 {
 	int infd, outfds[numprocs];
-	const char *name;
+	struct sortlib_writer outs[numprocs];
+	char name[NAMESIZE];
 	int i, mykeys, keys_done, keys_to_do;
 	int key, pivot, binnum;
+	unsigned perbin;
 
 	infd = doopen(PATH_KEYS, O_RDONLY, 0);
 
-	mykeys = getmykeys();
-	seekmyplace(PATH_KEYS, infd);
+	mykeys = getmykeys(me);
+	seekmyplace(PATH_KEYS, infd, me);
 
+	/*
+	 * Read into the first half of the workspace; the second half
+	 * is split up as output buffers, one per bin.
+	 */
+	perbin = (WORKNUM / 2) / numprocs;
+	assert(perbin > 0);
 	for (i=0; i<numprocs; i++) {
-		name = binname(me, i);
+		binname(name, me, i);
 		outfds[i] = doopen(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+		sortlib_writer_init(&outs[i], outfds[i],
+				    workspace + WORKNUM/2 + i * perbin,
+				    perbin);
 	}
 
 	pivot = (RANDOM_MAX / numprocs);
@@ -691,8 +641,8 @@ bin(void)
 	keys_done = 0;
 	while (keys_done < mykeys) {
 		keys_to_do = mykeys - keys_done;
-		if (keys_to_do > WORKNUM) {
-			keys_to_do = WORKNUM;
+		if (keys_to_do > WORKNUM/2) {
+			keys_to_do = WORKNUM/2;
 		}
 
 		doexactread(PATH_KEYS, infd, workspace,
@@ -708,7 +658,11 @@ bin(void)
 			}
 			assert(binnum >= 0);
 			assert(binnum < numprocs);
-			dowrite("bin", outfds[binnum], &key, sizeof(key));
+			if (sortlib_writer_put(&outs[binnum], key) < 0) {
+				complain("%s: write",
+					 binname(name, me, binnum));
+				exit(1);
+			}
 		}
 
 		keys_done += keys_to_do;
@@ -716,27 +670,32 @@ bin(void)
 	doclose(PATH_KEYS, infd);
 
 	for (i=0; i<numprocs; i++) {
-		doclose(binname(me, i), outfds[i]);
+		binname(name, me, i);
+		if (sortlib_writer_flush(&outs[i]) < 0) {
+			complain("%s: write", name);
+			exit(1);
+		}
+		doclose(name, outfds[i]);
 	}
 }
 
 static
 void
-sortbins(void)
+sortbins(int me, int *workspace)
 {
-	const char *name;
+	char name[NAMESIZE];
 	int i, fd;
 	off_t binsize;
 
 	for (i=0; i<numprocs; i++) {
-		name = binname(me, i);
+		binname(name, me, i);
 		binsize = getsize(name);
 		if (binsize % sizeof(int) != 0) {
 			complainx("%s: bin size %ld no good", name,
 				  (long) binsize);
 			exit(1);
 		}
-		if (binsize > (off_t) sizeof(workspace)) {
+		if (binsize > (off_t) (WORKNUM * sizeof(int))) {
 			complainx("proc %d: %s: bin too large", me, name);
 			exit(1);
 		}
@@ -744,7 +703,7 @@ sortbins(void)
 		fd = doopen(name, O_RDWR, 0);
 		doexactread(name, fd, workspace, binsize);
 
-		sortints(workspace, binsize/sizeof(int));
+		sortlib_sort(workspace, binsize/sizeof(int));
 
 		dolseek(name, fd, 0, SEEK_SET);
 		dowrite(name, fd, workspace, binsize);
@@ -754,128 +713,74 @@ sortbins(void)
 
 static
 void
-mergebins(void)
+mergebins(int me, int *workspace)
 {
 	int infds[numprocs], outfd;
-	int values[numprocs], ready[numprocs];
-	const char *name, *outname;
-	int i, result;
-	int numready, place, val, worknum;
+	char outname[NAMESIZE], name[NAMESIZE];
+	int i;
 
-	outname = mergedname(me);
+	mergedname(outname, me);
 	outfd = doopen(outname, O_WRONLY|O_CREAT|O_TRUNC, 0664);
 
 	for (i=0; i<numprocs; i++) {
-		name = binname(i, me);
-		infds[i] = doopen(name, O_RDONLY, 0);
-		values[i] = 0;
-		ready[i] = 0;
+		infds[i] = doopen(binname(name, i, me), O_RDONLY, 0);
 	}
 
-	worknum = 0;
-
-	while (1) {
-		numready = 0;
-		for (i=0; i<numprocs; i++) {
-			if (infds[i] < 0) {
-				continue;
-			}
-
-			if (!ready[i]) {
-				result = doread("bin", infds[i],
-						&val, sizeof(int));
-				if (result == 0) {
-					doclose("bin", infds[i]);
-					infds[i] = -1;
-					continue;
-				}
-				if ((size_t) result != sizeof(int)) {
-					complainx("%s: read: short count",
-						  binname(i, me));
-					exit(1);
-				}
-				values[i] = val;
-				ready[i] = 1;
-			}
-			numready++;
-		}
-		if (numready == 0) {
-			break;
-		}
-
-		/* find the smallest */
-		place = -1;
-		for (i=0; i<numprocs; i++) {
-			if (!ready[i]) {
-				continue;
-			}
-			if (place < 0 || values[i] < val) {
-				val = values[i];
-				place = i;
-			}
-		}
-		assert(place >= 0);
-
-		workspace[worknum++] = val;
-		if (worknum >= WORKNUM) {
-			assert(worknum == WORKNUM);
-			dowrite(outname, outfd, workspace,
-				worknum * sizeof(int));
-			worknum = 0;
-		}
-		ready[place] = 0;
+	/* the workspace is the merge's input and output buffers */
+	if (sortlib_merge(infds, numprocs, outfd, workspace, WORKNUM) < 0) {
+		complain("%s: merge", outname);
+		exit(1);
 	}
 
-	dowrite(outname, outfd, workspace, worknum * sizeof(int));
 	doclose(outname, outfd);
-
 	for (i=0; i<numprocs; i++) {
-		assert(infds[i] < 0);
+		doclose(binname(name, i, me), infds[i]);
 	}
 }
 
+/*
+ * Copy our merged bin into its place in the output. (This used to
+ * exec cat, which a thread can't do.)
+ */
 static
 void
-assemble(void)
+assemble(int me, int *workspace)
 {
+	char name[NAMESIZE];
 	off_t mypos;
-	int i, fd;
-	const char *args[3];
+	size_t len;
+	int i, infd, outfd;
 
 	mypos = 0;
 	for (i=0; i<me; i++) {
-		mypos += getsize(mergedname(i));
+		mypos += getsize(mergedname(name, i));
 	}
 
-	fd = doopen(PATH_SORTED, O_WRONLY, 0);
-	dolseek(PATH_SORTED, fd, mypos, SEEK_SET);
+	outfd = doopen(PATH_SORTED, O_WRONLY, 0);
+	dolseek(PATH_SORTED, outfd, mypos, SEEK_SET);
 
-	if (dup2(fd, STDOUT_FILENO) < 0) {
-		complain("dup2");
-		exit(1);
+	mergedname(name, me);
+	infd = doopen(name, O_RDONLY, 0);
+	while ((len = doread(name, infd, workspace,
+			     WORKNUM * sizeof(int))) > 0) {
+		dowrite(PATH_SORTED, outfd, workspace, len);
 	}
-
-	doclose(PATH_SORTED, fd);
-
-	args[0] = "cat";
-	args[1] = mergedname(me);
-	args[2] = NULL;
-	execv("/bin/cat", (char **) args);
-	complain("/bin/cat: exec");
-	exit(1);
+	doclose(name, infd);
+	doclose(PATH_SORTED, outfd);
 }
 
 static
 void
 checksize_bins(void)
 {
+	char name[NAMESIZE];
 	off_t totsize;
 	int i, j;
 
 	totsize = 0;
 	for (i=0; i<numprocs; i++) {
 		for (j=0; j<numprocs; j++) {
-			totsize += getsize(binname(i, j));
+			totsize += getsize(binname(name, i, j));
 		}
 	}
 	if (totsize != correctsize) {
@@ -889,12 +794,13 @@ static
 void
 checksize_merge(void)
 {
+	char name[NAMESIZE];
 	off_t totsize;
 	int i;
 
 	totsize = 0;
 	for (i=0; i<numprocs; i++) {
-		totsize += getsize(mergedname(i));
+		totsize += getsize(mergedname(name, i));
 	}
 	if (totsize != correctsize) {
 		complain("Sum of merged sizes is wrong (%ld, should be %ld)",
@@ -907,41 +813,43 @@ static
 void
 sort(void)
 {
+	char name[NAMESIZE];
 	unsigned long sortedsum;
 	int i, j;
 
 	/* Step 1. Toss into bins. */
-	complainx("Tossing into %d bins using %d procs",
-		  numprocs*numprocs, numprocs);
-	doforkall("Tossing", bin);
+	complainx("Tossing into %d bins using %d %s",
+		  numprocs*numprocs, numprocs, workers());
+	doall("Tossing", bin);
 	checksize_bins();
 	complainx("Done tossing into bins.");
 
 	/* Step 2: Sort the bins. */
-	complainx("Sorting %d bins using %d procs",
-		  numprocs*numprocs, numprocs);
-	doforkall("Sorting", sortbins);
+	complainx("Sorting %d bins using %d %s",
+		  numprocs*numprocs, numprocs, workers());
+	doall("Sorting", sortbins);
 	checksize_bins();
 	complainx("Done sorting the bins.");
 
 	/* Step 3: Merge corresponding bins. */
-	complainx("Merging %d bins using %d procs",
-		  numprocs*numprocs, numprocs);
-	doforkall("Merging", mergebins);
+	complainx("Merging %d bins using %d %s",
+		  numprocs*numprocs, numprocs, workers());
+	doall("Merging", mergebins);
 	checksize_merge();
 	complainx("Done merging the bins.");
 
 	/* Step 3a: delete the bins */
 	for (i=0; i<numprocs; i++) {
 		for (j=0; j<numprocs; j++) {
-			doremove(binname(i, j));
+			doremove(binname(name, i, j));
 		}
 	}
 
 	/* Step 4: assemble output file */
-	complainx("Assembling output file using %d procs", numprocs);
+	complainx("Assembling output file using %d %s", numprocs,
+		  workers());
 	docreate(PATH_SORTED);
-	doforkall("Final assembly", assemble);
+	doall("Final assembly", assemble);
 	if (getsize(PATH_SORTED) != correctsize) {
 		complainx("%s: file is wrong size", PATH_SORTED);
 		exit(1);
@@ -949,7 +857,7 @@ sort(void)
 
 	/* Step 4a: delete the merged bins */
 	for (i=0; i<numprocs; i++) {
-		doremove(mergedname(i));
+		doremove(mergedname(name, i));
 	}
 
 	/* Step 5: Checksum the result. */
@@ -967,10 +875,9 @@ sort(void)
 
 static
 const char *
-validname(int a)
+validname(char *rv, int a)
 {
-	static char rv[32];
-	snprintf(rv, sizeof(rv), "valid-%d", a);
+	snprintf(rv, NAMESIZE, "valid-%d", a);
 	return rv;
 }
 
@@ -978,6 +885,7 @@ static
 void
 checksize_valid(void)
 {
+	char name[NAMESIZE];
 	off_t totvsize, correctvsize;
 	int i;
 
@@ -985,7 +893,7 @@ checksize_valid(void)
 
 	totvsize = 0;
 	for (i=0; i<numprocs; i++) {
-		totvsize += getsize(validname(i));
+		totvsize += getsize(validname(name, i));
 	}
 	if (totvsize != correctvsize) {
 		complainx("Sum of validation sizes is wrong "
@@ -997,8 +905,9 @@ checksize_valid(void)
 
 static
 void
-dovalidate(void)
+dovalidate(int me, int *workspace)
 {
+	char vname[NAMESIZE];
 	const char *name;
 	int fd, i, mykeys, keys_done, keys_to_do;
 	int key, smallest, largest;
@@ -1006,8 +915,8 @@ dovalidate(void)
 	name = PATH_SORTED;
 	fd = doopen(name, O_RDONLY, 0);
 
-	mykeys = getmykeys();
-	seekmyplace(name, fd);
+	mykeys = getmykeys(me);
+	seekmyplace(name, fd, me);
 
 	smallest = RANDOM_MAX;
 	largest = 0;
@@ -1049,7 +958,7 @@ dovalidate(void)
 	}
 	doclose(name, fd);
 
-	name = validname(me);
+	name = validname(vname, me);
 	fd = doopen(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
 	dowrite(name, fd, &smallest, sizeof(smallest));
 	dowrite(name, fd, &largest, sizeof(largest));
@@ -1060,18 +969,20 @@ static
 void
 validate(void)
 {
+	char vname[NAMESIZE];
 	int smallest, largest, prev_largest;
 	int i, fd;
 	const char *name;
 
-	complainx("Validating the sorted data using %d procs", numprocs);
-	doforkall("Validation", dovalidate);
+	complainx("Validating the sorted data using %d %s", numprocs,
+		  workers());
+	doall("Validation", dovalidate);
 	checksize_valid();
 
 	prev_largest = 1;
 
 	for (i=0; i<numprocs; i++) {
-		name = validname(i);
+		name = validname(vname, i);
 		fd = doopen(name, O_RDONLY, 0);
 
 		doexactread(name, fd, &smallest, sizeof(int));
@@ -1103,7 +1014,7 @@ validate(void)
 
 
 	for (i=0; i<numprocs; i++) {
-		doremove(validname(i));
+		doremove(validname(vname, i));
 	}
 }
 
@@ -1152,7 +1063,8 @@ static
 void
 usage(void)
 {
-	complain("Usage: %s [-p procs] [-k keys] [-s seed] [-r]", progname);
+	complain("Usage: %s [-p procs] [-k keys] [-s seed] [-r] [-f]",
+		 progname);
 	exit(1);
 }
 
@@ -1173,6 +1085,7 @@ doargs(int argc, char *argv[])
 		    case 'k': arg = 1; break;
 		    case 's': arg = 1; break;
 		    case 'r': arg = 0; break;
+		    case 'f': arg = 0; break;
 		    default: usage(); return;
 		}
 		if (arg) {
@@ -1198,6 +1111,7 @@ doargs(int argc, char *argv[])
 		else {
 			switch (ch) {
 			    case 'r': randomize(); break;
+			    case 'f': usefork = true; break;
 			    default: assert(0); break;
 			}
 		}
@@ -1207,19 +1121,36 @@ doargs(int argc, char *argv[])
 int
 main(int argc, char *argv[])
 {
+	struct timespec start, end;
+	unsigned long ms;
+
 	initprogname(argc > 0 ? argv[0] : NULL);
 
 	doargs(argc, argv);
+	if (numprocs < 1 || numprocs > TASKPOOL_MAXWORKERS) {
+		complainx("Can use 1 to %d procs", TASKPOOL_MAXWORKERS);
+		exit(1);
+	}
+	if (taskpool_init(numprocs, usefork ? TASKPOOL_FORK : 0) < 0) {
+		complain("taskpool_init");
+		exit(1);
+	}
 	correctsize = (off_t) (numkeys*sizeof(int));
 
 	setdir();
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	genkeys();
 	sort();
 	validate();
-	complainx("Succeeded.");
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ms = (end.tv_sec - start.tv_sec) * 1000UL +
+		(end.tv_nsec - start.tv_nsec) / 1000000L;
+	complainx("Succeeded in %lu.%03lu seconds using %d %s.",
+		  ms / 1000, ms % 1000, numprocs, workers());
 
 	unsetdir();
+	taskpool_fini();
 
 	return 0;
 }
@@ -0,0 +1,284 @@
+/*
+ * rtlat - wakeup latency benchmark for the real-time scheduling class.
+ *
+ * Usage: rtlat [-n samples] [-h hogs] [-p period-ms]
+ *
+ * Starts HOGS processes that do nothing but use cpu, and then measures
+ * how late a thread that sleeps in a loop gets back to running, first
+ * as an ordinary time-sharing thread and then as SCHED_FIFO at the top
+ * priority. Two kinds of wakeup are timed:
+ *
+ *    timer - nanosleep for PERIOD; the latency is how long after the
+ *            end of the sleep (rounded up to the next hardclock, which
+ *            is when it can end) we're running again.
+ *    pipe  - block reading a pipe that another process writes to every
+ *            PERIOD; the latency is from the write to the read
+ *            returning.
+ *
+ * Each line of output is
+ *
+ *    rtlat KIND POLICY samples=N min=US avg=US max=US
+ *
+ * in microseconds. The hogs and the writer are time-sharing, so with
+ * SCHED_FIFO the maximum ought to be small and not depend on HOGS.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <sched.h>
+
+#define DEF_SAMPLES	50
+#define DEF_HOGS	4
+#define DEF_PERIOD_MS	20
+#define HZ_NS		10000000ULL	/* one hardclock */
+
+static unsigned samples = DEF_SAMPLES;
+static unsigned nhogs = DEF_HOGS;
+static unsigned period_ms = DEF_PERIOD_MS;
+
+static
+uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		err(1, "clock_gettime");
+	}
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Spin until END. Checking the clock only every so often keeps the
+ * hogs in user mode nearly all the time.
+ */
+static
+void
+spin_until(uint64_t end)
+{
+	volatile unsigned x = 0;
+	unsigned i;
+
+	while (now_ns() < end) {
+		for (i = 0; i < 100000; i++) {
+			x += i;
+		}
+	}
+}
+
+static
+pid_t
+start_hog(uint64_t end)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		spin_until(end);
+		_exit(0);
+	}
+	return pid;
+}
+
+static
+void
+set_policy(int policy)
+{
+	struct sched_param sp;
+
+	sp.sched_priority = policy == SCHED_OTHER ? 0 : SCHED_PRIO_MAX;
+	if (sched_setscheduler(0, policy, &sp) < 0) {
+		err(1, "sched_setscheduler");
+	}
+}
+
+struct stats {
+	unsigned n;
+	uint64_t min, max, total;
+};
+
+static
+void
+stats_add(struct stats *st, uint64_t ns)
+{
+	if (st->n == 0 || ns < st->min) {
+		st->min = ns;
+	}
+	if (ns > st->max) {
+		st->max = ns;
+	}
+	st->total += ns;
+	st->n++;
+}
+
+static
+void
+stats_print(const char *kind, int policy, const struct stats *st)
+{
+	printf("rtlat %s %s samples=%u min=%llu avg=%llu max=%llu\n",
+	       kind, policy == SCHED_OTHER ? "other" : "fifo", st->n,
+	       st->min / 1000, st->n ? st->total / st->n / 1000 : 0,
+	       st->max / 1000);
+}
+
+/*
+ * Timer wakeups: nanosleep can only end on a hardclock, so measure
+ * from the first hardclock boundary at or after the requested time.
+ * The boundaries are estimated from the clock, so a few microseconds
+ * either way are noise.
+ */
+static
+void
+bench_timer(int policy)
+{
+	struct timespec ts;
+	struct stats st;
+	uint64_t due, woke;
+	unsigned i;
+
+	bzero(&st, sizeof(st));
+	ts.tv_sec = period_ms / 1000;
+	ts.tv_nsec = (period_ms % 1000) * 1000000;
+	for (i = 0; i < samples; i++) {
+		due = now_ns() + (uint64_t)period_ms * 1000000;
+		due = (due + HZ_NS - 1) / HZ_NS * HZ_NS;
+		if (nanosleep(&ts, NULL) < 0) {
+			err(1, "nanosleep");
+		}
+		woke = now_ns();
+		stats_add(&st, woke > due ? woke - due : 0);
+	}
+	stats_print("timer", policy, &st);
+}
+
+/*
+ * Pipe wakeups: a time-sharing child writes the time into a pipe
+ * every period; we block reading it.
+ */
+static
+void
+bench_pipe(int policy)
+{
+	struct timespec ts;
+	struct stats st;
+	uint64_t sent, got;
+	unsigned i;
+	int fds[2], status;
+	pid_t pid;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		set_policy(SCHED_OTHER);
+		ts.tv_sec = period_ms / 1000;
+		ts.tv_nsec = (period_ms % 1000) * 1000000;
+		for (i = 0; i < samples; i++) {
+			nanosleep(&ts, NULL);
+			sent = now_ns();
+			if (write(fds[1], &sent, sizeof(sent)) != sizeof(sent)) {
+				_exit(1);
+			}
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+
+	bzero(&st, sizeof(st));
+	while (read(fds[0], &sent, sizeof(sent)) == sizeof(sent)) {
+		got = now_ns();
+		stats_add(&st, got > sent ? got - sent : 0);
+	}
+	close(fds[0]);
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	stats_print("pipe", policy, &st);
+}
+
+static
+void
+usage(void)
+{
+	errx(1, "Usage: rtlat [-n samples] [-h hogs] [-p period-ms]");
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const int policies[2] = { SCHED_OTHER, SCHED_FIFO };
+	uint64_t end;
+	pid_t *hogs;
+	unsigned i;
+	int j, status;
+
+	for (j = 1; j < argc; j++) {
+		if (j + 1 >= argc) {
+			usage();
+		}
+		if (!strcmp(argv[j], "-n")) {
+			samples = atoi(argv[++j]);
+		}
+		else if (!strcmp(argv[j], "-h")) {
+			nhogs = atoi(argv[++j]);
+		}
+		else if (!strcmp(argv[j], "-p")) {
+			period_ms = atoi(argv[++j]);
+		}
+		else {
+			usage();
+		}
+	}
+	if (samples == 0 || period_ms == 0) {
+		usage();
+	}
+
+	hogs = malloc(nhogs * sizeof(hogs[0]) + 1);
+	if (hogs == NULL) {
+		errx(1, "Out of memory");
+	}
+
+	/*
+	 * Two kinds by two policies, each SAMPLES periods long; give
+	 * the hogs twice that, plus a second, to be sure they're still
+	 * going at the end.
+	 */
+	end = now_ns() + 2 * 4 * (uint64_t)samples * period_ms * 1000000 +
+		1000000000ULL;
+	set_policy(SCHED_OTHER);
+	for (i = 0; i < nhogs; i++) {
+		hogs[i] = start_hog(end);
+	}
+	printf("rtlat: %u hogs, %u samples every %u ms\n",
+	       nhogs, samples, period_ms);
+
+	for (j = 0; j < 2; j++) {
+		set_policy(policies[j]);
+		bench_timer(policies[j]);
+		bench_pipe(policies[j]);
+	}
+	set_policy(SCHED_OTHER);
+
+	for (i = 0; i < nhogs; i++) {
+		if (waitpid(hogs[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+	}
+	free(hogs);
+	return 0;
+}
@@ -39,56 +39,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <err.h>
+#include <test/sortlib.h>
 
 /* Larger than physical memory */
 #define SIZE  (144*1024)
 
 
 /*
- * Quicksort.
- *
- * This used to be a bubble sort, which was ok but slow in nachos with
- * 4k of memory and SIZE of 1024. However, with SIZE of 147,456 bubble
- * sort is completely unacceptable.
- *
- * Also, quicksort has somewhat more interesting memory usage patterns.
+ * Merge sort, through a scratch array as big as the data, which
+ * makes for somewhat more interesting memory usage patterns. (The
+ * comment here used to say quicksort, and before that it was a bubble
+ * sort, which with SIZE of 147,456 is completely unacceptable.)
  */
-
-static
-void
-sort(int *arr, int size)
-{
-	static int tmp[SIZE];
-	int pivot, i, j, k;
-
-	if (size<2) {
-		return;
-	}
-
-	pivot = size/2;
-	sort(arr, pivot);
-	sort(&arr[pivot], size-pivot);
-
-	i = 0;
-	j = pivot;
-	k = 0;
-	while (i<pivot && j<size) {
-		if (arr[i] < arr[j]) {
-			tmp[k++] = arr[i++];
-		}
-		else {
-			tmp[k++] = arr[j++];
-		}
-	}
-	while (i<pivot) {
-		tmp[k++] = arr[i++];
-	}
-	while (j<size) {
-		tmp[k++] = arr[j++];
-	}
-
-	memcpy(arr, tmp, size*sizeof(int));
-}
+static int tmp[SIZE];
 
 ////////////////////////////////////////////////////////////
 
@@ -129,7 +92,7 @@ int
 main(void)
 {
 	initarray();
-	sort(A, SIZE);
+	sortlib_mergesort(A, SIZE, tmp);
 	check();
 	return 0;
 }
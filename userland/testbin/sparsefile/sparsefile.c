@@ -50,6 +50,7 @@ main(int argc, char *argv[])
 	int fd;
 	int r;
 	char byte;
+	off_t data, hole;
 
 	if (argc != 3) {
 		errx(1, "Usage: sparsefile <filename> <size>");
@@ -81,6 +82,24 @@ main(int argc, char *argv[])
 		errx(1, "%s: write: Unexpected result count %d", filename, r);
 	}
 
+	/*
+	 * Where the data is. The byte at the end must be; everything
+	 * before it may be a hole, if the file system keeps them.
+	 */
+	data = lseek(fd, 0, SEEK_DATA);
+	if (data == -1) {
+		err(1, "%s: lseek SEEK_DATA", filename);
+	}
+	hole = lseek(fd, data, SEEK_HOLE);
+	if (hole == -1) {
+		err(1, "%s: lseek SEEK_HOLE", filename);
+	}
+	if (data > size - 1 || hole != size) {
+		errx(1, "%s: Data found at %d to %d, expected up to %d",
+		     filename, (int)data, (int)hole, size);
+	}
+	printf("Data from %d to the end\n", (int)data);
+
 	close(fd);
 
 	return 0;
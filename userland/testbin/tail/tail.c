@@ -33,14 +33,21 @@
  * 	Outputs a file beginning at a specific location.
  *	Usage: tail <file> <location>
  *
+ *	A negative location, -N, means the last N lines instead. These
+ *	are found by reading backwards from the end of the file (see
+ *	<test/revread.h>), so only the blocks they're in are read.
+ *
  * This may be useful for testing during the file system assignment.
  */
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <fcntl.h>
 #include <err.h>
+#include <test/revread.h>
 
-#define BUFSIZE 1000
+/* A multiple of the block size, so reads can be whole blocks */
+#define BUFSIZE 4096
 
 /* Put buffer in data space.  We know that the program should allocate as */
 /* much data space as required, but stack space is tight. */
@@ -51,21 +58,57 @@ static
 void
 tail(int file, off_t where, const char *filename)
 {
-	int len;
+	size_t amount;
+	ssize_t len;
 
 	if (lseek(file, where, SEEK_SET)<0) {
 		err(1, "%s", filename);
 	}
+	/* A one-off pass: read ahead, and don't crowd out the cache */
+	(void)fadvise(file, 0, 0, FADV_SEQUENTIAL);
+	(void)fadvise(file, 0, 0, FADV_NOREUSE);
 
-	while ((len = read(file, buffer, sizeof(buffer))) > 0) {
+	/* Read up to a block boundary first; after that, whole blocks */
+	amount = BUFSIZE - where % BUFSIZE;
+	while ((len = read(file, buffer, amount)) > 0) {
 		write(STDOUT_FILENO, buffer, len);
+		amount = BUFSIZE;
+	}
+	(void)fadvise(file, 0, 0, FADV_NORMAL);
+}
+
+/*
+ * Find where the last N lines of the file start.
+ */
+static
+off_t
+lastlines(int file, unsigned n, const char *filename)
+{
+	struct revread rr;
+	const char *line;
+	ssize_t len;
+	off_t where;
+
+	if (revread_init(&rr, file) < 0) {
+		err(1, "%s", filename);
+	}
+	len = 0;
+	while (n > 0 && (len = revread_line(&rr, &line)) > 0) {
+		n--;
+	}
+	if (len < 0) {
+		err(1, "%s", filename);
 	}
+	where = revread_tell(&rr);
+	revread_fini(&rr);
+	return where;
 }
 
 int
 main(int argc, char **argv)
 {
-	int file;
+	int file, location;
+	off_t where;
 
 	if (argc < 3) {
 		errx(1, "Usage: tail <file> <location>");
@@ -74,8 +117,14 @@ main(int argc, char **argv)
 	if (file < 0) {
 		err(1, "%s", argv[1]);
 	}
-	tail(file, atoi(argv[2]), argv[1]);
+	location = atoi(argv[2]);
+	if (location < 0) {
+		where = lastlines(file, -location, argv[1]);
+	}
+	else {
+		where = location;
+	}
+	tail(file, where, argv[1]);
 	close(file);
 	return 0;
 }
-
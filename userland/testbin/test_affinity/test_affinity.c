@@ -0,0 +1,190 @@
+/*
+ * Tests for sched_setaffinity and sched_getaffinity.
+ *
+ * There is no way to ask which cpu we're on, so these check the mask
+ * itself, that it's inherited, and that bad masks are refused; they
+ * pass on a single-cpu machine too.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/wait.h>
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+/* The mask we started with, which has every cpu in it */
+static cpu_set_t all_cpus;
+
+/* Highest cpu in all_cpus */
+static int
+last_cpu(void)
+{
+    int i, last = 0;
+
+    for (i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, &all_cpus)) {
+            last = i;
+        }
+    }
+    return last;
+}
+
+/*
+ * Test 1: we start on every cpu, and can pin ourselves to one and
+ * read it back.
+ */
+static void
+test_affinity_pin(void)
+{
+    const char *test_name = "pin";
+    cpu_set_t set;
+    int cpu;
+
+    if (sched_getaffinity(0, sizeof(all_cpus), &all_cpus) < 0) {
+        printf("  Error: sched_getaffinity failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    if (!CPU_ISSET(0, &all_cpus)) {
+        printf("  Error: cpu 0 not in the initial mask\n");
+        print_result(test_name, 0);
+        return;
+    }
+
+    cpu = last_cpu();
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(getpid(), sizeof(set), &set) < 0) {
+        printf("  Error: sched_setaffinity failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) < 0 ||
+        set.__bits[0] != 1U << cpu) {
+        printf("  Error: mask is 0x%x, not cpu %d\n", set.__bits[0], cpu);
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 2: a forked child starts with its parent's mask.
+ */
+static void
+test_affinity_fork(void)
+{
+    const char *test_name = "fork";
+    cpu_set_t set;
+    pid_t pid;
+    int status;
+
+    CPU_ZERO(&set);
+    CPU_SET(0, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        printf("  Error: sched_setaffinity failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        printf("  Error: fork failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    if (pid == 0) {
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+            _exit(2);
+        }
+        _exit(set.__bits[0] == 1U ? 0 : 1);
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        printf("  Error: child didn't inherit the mask\n");
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 3: masks with no cpus, other processes, and short sizes are
+ * refused, and leave the mask alone.
+ */
+static void
+test_affinity_bad(void)
+{
+    const char *test_name = "bad";
+    cpu_set_t set;
+    int ok = 1;
+
+    CPU_ZERO(&set);
+    if (sched_setaffinity(0, sizeof(set), &set) == 0 || errno != EINVAL) {
+        printf("  Error: empty mask wasn't EINVAL\n");
+        ok = 0;
+    }
+    if (last_cpu() < CPU_SETSIZE - 1) {
+        CPU_SET(CPU_SETSIZE - 1, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) == 0 || errno != EINVAL) {
+            printf("  Error: mask of a missing cpu wasn't EINVAL\n");
+            ok = 0;
+        }
+    }
+    if (sched_setaffinity(0, 2, &all_cpus) == 0 || errno != EINVAL) {
+        printf("  Error: 2-byte mask wasn't EINVAL\n");
+        ok = 0;
+    }
+    if (sched_getaffinity(getpid() + 1, sizeof(set), &set) == 0 ||
+        errno != ESRCH) {
+        printf("  Error: another pid wasn't ESRCH\n");
+        ok = 0;
+    }
+    if (sched_getaffinity(0, sizeof(set), &set) < 0 ||
+        set.__bits[0] != 1U) {
+        printf("  Error: a refused mask changed the mask\n");
+        ok = 0;
+    }
+
+    /* Put things back */
+    if (sched_setaffinity(0, sizeof(all_cpus), &all_cpus) < 0) {
+        printf("  Error: can't restore the mask (errno %d)\n", errno);
+        ok = 0;
+    }
+    print_result(test_name, ok);
+}
+
+int
+main(void)
+{
+    printf("affinity Tests\n");
+
+    test_affinity_pin();
+    test_affinity_fork();
+    test_affinity_bad();
+
+    printf("affinity Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
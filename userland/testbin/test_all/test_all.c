@@ -12,6 +12,25 @@ static const char *tests[] = {
     "test_fork",
     "test_execv",
     "test_waitpid",
+    "test_futex",
+    "test_spawn",
+    "test_forkserver",
+    "test_pread",
+    "test_fcntl",
+    "test_getdents",
+    "test_mmap",
+    "test_stack",
+    "test_rlimit",
+    "test_time",
+    "test_profil",
+    "test_affinity",
+    "test_sched",
+    "test_schedgroup",
+    "test_semop",
+    "test_sysbatch",
+    "test_phase",
+    "test_gthread",
+    "test_atomic",
     /* Add more tests here as you create them */
     NULL  /* Sentinel */
 };
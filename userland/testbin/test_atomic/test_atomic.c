@@ -0,0 +1,254 @@
+/*
+ * Tests for atomic operations, spinlocks and seqlocks (atomic.h).
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <atomic.h>
+
+#define NTHREADS	4
+#define NLOOPS		20000
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+/* Run FUNC in NTHREADS threads and wait for them; true if all did */
+static int
+run_threads(int (*func)(void *))
+{
+    int tids[NTHREADS];
+    int i, status, ok = 1;
+
+    for (i=0; i<NTHREADS; i++) {
+        tids[i] = thread_create(func, NULL);
+        if (tids[i] < 0) {
+            printf("  Error: thread_create failed (errno %d)\n", errno);
+            ok = 0;
+        }
+    }
+    for (i=0; i<NTHREADS; i++) {
+        if (tids[i] >= 0 &&
+            (thread_join(tids[i], &status) < 0 || status != 0)) {
+            ok = 0;
+        }
+    }
+    return ok;
+}
+
+/*
+ * Test 1: each operation does what it says, in one thread.
+ */
+static void
+test_atomic_ops(void)
+{
+    const char *test_name = "ops";
+    volatile int x = 5;
+    int ok = 1;
+
+    if (atomic_add(&x, 3) != 8 || x != 8 ||
+        atomic_add(&x, -10) != -2 || x != -2) {
+        printf("  Error: atomic_add\n");
+        ok = 0;
+    }
+    if (atomic_cas(&x, 7, 1) != -2 || x != -2 ||
+        atomic_cas(&x, -2, 1) != -2 || x != 1) {
+        printf("  Error: atomic_cas\n");
+        ok = 0;
+    }
+    if (atomic_swap(&x, 9) != 1 || x != 9) {
+        printf("  Error: atomic_swap\n");
+        ok = 0;
+    }
+    print_result(test_name, ok);
+}
+
+static volatile int counter;
+
+static int
+add_thread(void *arg)
+{
+    int i;
+
+    (void)arg;
+    for (i=0; i<NLOOPS; i++) {
+        atomic_add(&counter, 1);
+    }
+    return 0;
+}
+
+static int
+cas_thread(void *arg)
+{
+    int i, old;
+
+    (void)arg;
+    for (i=0; i<NLOOPS; i++) {
+        do {
+            old = counter;
+        } while (atomic_cas(&counter, old, old + 1) != old);
+    }
+    return 0;
+}
+
+/*
+ * Test 2: no increments are lost, with add or with a CAS loop.
+ */
+static void
+test_atomic_threads(void)
+{
+    const char *test_name = "threads";
+    int ok = 1;
+
+    counter = 0;
+    if (!run_threads(add_thread) || counter != NTHREADS * NLOOPS) {
+        printf("  Error: atomic_add count was %d\n", counter);
+        ok = 0;
+    }
+    counter = 0;
+    if (!run_threads(cas_thread) || counter != NTHREADS * NLOOPS) {
+        printf("  Error: atomic_cas count was %d\n", counter);
+        ok = 0;
+    }
+    print_result(test_name, ok);
+}
+
+static struct spin lock = SPIN_INITIALIZER;
+static int plain;
+
+static int
+spin_thread(void *arg)
+{
+    int i;
+
+    (void)arg;
+    for (i=0; i<NLOOPS; i++) {
+        spin_lock(&lock);
+        plain++;
+        spin_unlock(&lock);
+    }
+    return 0;
+}
+
+/*
+ * Test 3: a spinlock protects an ordinary variable, and trylock
+ * fails while it's held.
+ */
+static void
+test_atomic_spin(void)
+{
+    const char *test_name = "spin";
+    int ok = 1;
+
+    plain = 0;
+    if (!run_threads(spin_thread) || plain != NTHREADS * NLOOPS) {
+        printf("  Error: count was %d\n", plain);
+        ok = 0;
+    }
+    if (!spin_trylock(&lock) || spin_trylock(&lock)) {
+        printf("  Error: trylock got a held lock\n");
+        ok = 0;
+    }
+    spin_unlock(&lock);
+    print_result(test_name, ok);
+}
+
+static struct seqlock sq = SEQLOCK_INITIALIZER;
+static volatile int pair[2];
+static volatile int writing;
+
+static int
+seq_writer(void *arg)
+{
+    int i;
+
+    (void)arg;
+    for (i=0; i<NLOOPS; i++) {
+        seq_writebegin(&sq);
+        pair[0] = i;
+        pair[1] = i;
+        seq_writeend(&sq);
+    }
+    writing = 0;
+    return 0;
+}
+
+/* Readers never see the two halves differ */
+static int
+seq_reader(void *arg)
+{
+    unsigned seq;
+    int a, b;
+
+    (void)arg;
+    while (writing) {
+        do {
+            seq = seq_readbegin(&sq);
+            a = pair[0];
+            b = pair[1];
+        } while (seq_readretry(&sq, seq));
+        if (a != b) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Test 4: seqlock readers get consistent copies.
+ */
+static void
+test_atomic_seq(void)
+{
+    const char *test_name = "seqlock";
+    int tids[NTHREADS];
+    int i, status, ok = 1;
+
+    writing = 1;
+    tids[0] = thread_create(seq_writer, NULL);
+    if (tids[0] < 0) {
+        /* Or the readers would never stop */
+        writing = 0;
+    }
+    for (i=1; i<NTHREADS; i++) {
+        tids[i] = thread_create(seq_reader, NULL);
+    }
+    for (i=0; i<NTHREADS; i++) {
+        if (tids[i] < 0 || thread_join(tids[i], &status) < 0 ||
+            status != 0) {
+            printf("  Error: thread %d failed\n", i);
+            ok = 0;
+        }
+    }
+    print_result(test_name, ok);
+}
+
+int
+main(void)
+{
+    printf("atomic Tests\n");
+
+    test_atomic_ops();
+    test_atomic_threads();
+    test_atomic_spin();
+    test_atomic_seq();
+
+    printf("atomic Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,319 @@
+/*
+ * Tests for fcntl byte-range locks: F_GETLK, F_SETLK, and F_SETLKW.
+ *
+ * Locks belong to a process, so every conflict is checked from a
+ * forked child against locks the parent holds.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <kern/seek.h>
+#include <sys/wait.h>
+
+#define TEST_FILE "fcntl_test.txt"
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+/* Issue a lock command on [start, start+len); len 0 means "to EOF" */
+static int
+lockop(int fd, int cmd, int type, off_t start, off_t len)
+{
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = start;
+    fl.l_len = len;
+    return fcntl(fd, cmd, &fl);
+}
+
+/* Nonblocking lock attempt expected to fail with EAGAIN */
+static int
+conflicts(int fd, int type, off_t start, off_t len)
+{
+    return lockop(fd, F_SETLK, type, start, len) < 0 && errno == EAGAIN;
+}
+
+/*
+ * Run fn(fd) in a forked child and return nonzero if it exited 0.
+ * The child inherits fd but takes its locks as itself.
+ */
+static int
+in_child(int (*fn)(int), int fd)
+{
+    pid_t pid;
+    int status;
+
+    pid = fork();
+    if (pid < 0) {
+        printf("  Error: fork failed\n");
+        return 0;
+    }
+    if (pid == 0) {
+        _exit(fn(fd) ? 0 : 1);
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+        return 0;
+    }
+    return WEXITSTATUS(status) == 0;
+}
+
+static int
+child_conflict(int fd)
+{
+    struct flock fl;
+
+    if (!conflicts(fd, F_WRLCK, 50, 10) || !conflicts(fd, F_RDLCK, 20, 5)) {
+        return 0;
+    }
+    /* a disjoint range is free */
+    if (lockop(fd, F_SETLK, F_WRLCK, 100, 100) < 0) {
+        return 0;
+    }
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = 0;
+    fl.l_len = 10;
+    if (fcntl(fd, F_GETLK, &fl) < 0) {
+        return 0;
+    }
+    return fl.l_type == F_WRLCK && fl.l_start == 0 && fl.l_len == 100 &&
+        fl.l_pid != getpid();
+}
+
+/*
+ * Test 1: a write lock blocks overlapping locks of either kind from
+ * another process, F_GETLK reports it, and disjoint ranges are free.
+ */
+static void
+test_conflict(int fd)
+{
+    const char *test_name = "write lock conflicts and F_GETLK";
+    int ok;
+
+    if (lockop(fd, F_SETLK, F_WRLCK, 0, 100) < 0) {
+        printf("  Error: Could not take write lock\n");
+        print_result(test_name, 0);
+        return;
+    }
+    ok = in_child(child_conflict, fd);
+    lockop(fd, F_SETLK, F_UNLCK, 0, 0);
+    print_result(test_name, ok);
+}
+
+static int
+child_shared(int fd)
+{
+    return lockop(fd, F_SETLK, F_RDLCK, 0, 100) == 0 &&
+        conflicts(fd, F_WRLCK, 99, 1);
+}
+
+/*
+ * Test 2: read locks are shared, but still exclude writers.
+ */
+static void
+test_shared(int fd)
+{
+    const char *test_name = "read locks are shared";
+    int ok;
+
+    if (lockop(fd, F_SETLK, F_RDLCK, 0, 100) < 0) {
+        printf("  Error: Could not take read lock\n");
+        print_result(test_name, 0);
+        return;
+    }
+    ok = in_child(child_shared, fd);
+    lockop(fd, F_SETLK, F_UNLCK, 0, 0);
+    print_result(test_name, ok);
+}
+
+static int
+child_split(int fd)
+{
+    return lockop(fd, F_SETLK, F_WRLCK, 45, 10) == 0 &&
+        conflicts(fd, F_WRLCK, 30, 5) && conflicts(fd, F_WRLCK, 70, 5);
+}
+
+/*
+ * Test 3: unlocking the middle of a lock splits it, leaving both
+ * ends held.
+ */
+static void
+test_split(int fd)
+{
+    const char *test_name = "unlocking a middle range splits a lock";
+    int ok;
+
+    if (lockop(fd, F_SETLK, F_WRLCK, 0, 100) < 0 ||
+        lockop(fd, F_SETLK, F_UNLCK, 40, 20) < 0) {
+        printf("  Error: Could not lock and unlock\n");
+        print_result(test_name, 0);
+        return;
+    }
+    ok = in_child(child_split, fd);
+    lockop(fd, F_SETLK, F_UNLCK, 0, 0);
+    print_result(test_name, ok);
+}
+
+/*
+ * Test 4: F_SETLKW sleeps until the conflicting lock goes away. The
+ * child marks the file once it has the lock.
+ */
+static void
+test_wait(int fd)
+{
+    const char *test_name = "F_SETLKW waits for unlock";
+    struct timespec ts;
+    int status, ok;
+    pid_t pid;
+    char ch;
+
+    if (lockop(fd, F_SETLK, F_WRLCK, 0, 100) < 0) {
+        printf("  Error: Could not take write lock\n");
+        print_result(test_name, 0);
+        return;
+    }
+    pid = fork();
+    if (pid < 0) {
+        printf("  Error: fork failed\n");
+        lockop(fd, F_SETLK, F_UNLCK, 0, 0);
+        print_result(test_name, 0);
+        return;
+    }
+    if (pid == 0) {
+        if (lockop(fd, F_SETLKW, F_WRLCK, 10, 10) < 0 ||
+            pwrite(fd, "x", 1, 10) != 1) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+
+    /* give the child time to block; it must not have the lock yet */
+    ts.tv_sec = 0;
+    ts.tv_nsec = 200000000;
+    nanosleep(&ts, NULL);
+    ok = (pread(fd, &ch, 1, 10) == 0);
+    if (!ok) {
+        printf("  Error: child got the lock while it was held\n");
+    }
+
+    lockop(fd, F_SETLK, F_UNLCK, 0, 0);
+    ok = waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+        WEXITSTATUS(status) == 0 && ok;
+    ok = ok && pread(fd, &ch, 1, 10) == 1 && ch == 'x';
+    print_result(test_name, ok);
+}
+
+static int
+child_free(int fd)
+{
+    return lockop(fd, F_SETLK, F_WRLCK, 0, 0) == 0;
+}
+
+/*
+ * Test 5: closing any descriptor for the file drops the process's
+ * locks on it, POSIX style.
+ */
+static void
+test_close(int fd)
+{
+    const char *test_name = "close releases locks";
+    int fd2;
+
+    if (lockop(fd, F_SETLK, F_WRLCK, 0, 100) < 0) {
+        printf("  Error: Could not take write lock\n");
+        print_result(test_name, 0);
+        return;
+    }
+    fd2 = open(TEST_FILE, O_RDONLY);
+    if (fd2 < 0) {
+        printf("  Error: Could not reopen test file\n");
+        lockop(fd, F_SETLK, F_UNLCK, 0, 0);
+        print_result(test_name, 0);
+        return;
+    }
+    close(fd2);
+    print_result(test_name, in_child(child_free, fd));
+}
+
+/*
+ * Test 6: bad arguments.
+ */
+static void
+test_errors(int fd)
+{
+    const char *test_name = "fcntl error cases";
+    struct flock fl;
+    int rfd, ok = 1;
+
+    if (lockop(-1, F_SETLK, F_WRLCK, 0, 1) != -1 || errno != EBADF) {
+        printf("  Error: bad fd not rejected\n");
+        ok = 0;
+    }
+    if (lockop(fd, F_SETLK, F_WRLCK, -1, 1) != -1 || errno != EINVAL) {
+        printf("  Error: negative start not rejected\n");
+        ok = 0;
+    }
+    memset(&fl, 0, sizeof(fl));
+    if (fcntl(fd, 12345, &fl) != -1 || errno != EINVAL) {
+        printf("  Error: unknown command not rejected\n");
+        ok = 0;
+    }
+    rfd = open(TEST_FILE, O_RDONLY);
+    if (rfd >= 0) {
+        if (lockop(rfd, F_SETLK, F_WRLCK, 0, 1) != -1 || errno != EBADF) {
+            printf("  Error: write lock on read-only fd not rejected\n");
+            ok = 0;
+        }
+        close(rfd);
+    }
+    print_result(test_name, ok);
+}
+
+int
+main(void)
+{
+    int fd;
+
+    printf("fcntl Lock Tests\n");
+
+    fd = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("  Error: Could not create test file\n");
+        return 1;
+    }
+    test_conflict(fd);
+    test_shared(fd);
+    test_split(fd);
+    test_wait(fd);
+    test_close(fd);
+    test_errors(fd);
+    close(fd);
+    remove(TEST_FILE);
+
+    printf("fcntl Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,204 @@
+/*
+ * Tests for fork servers (forkserver.h).
+ *
+ * This program is its own helper: started with no arguments it runs
+ * the tests, which start another copy of it as a helper and send it
+ * requests; each request comes back into main below as one of the
+ * commands in run_request.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <forkserver.h>
+#include <sys/wait.h>
+
+#define SELF "/testbin/test_forkserver/test_forkserver"
+#define RUNS 50
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+/*
+ * In a helper's child: do what the request says.
+ *   exit N          - exit with N
+ *   cwd DIR         - exit 0 if we're running in DIR
+ *   args A B ...    - exit 0 if we got exactly "args", "a", "bb", ""
+ */
+static int
+run_request(int argc, char *argv[])
+{
+    char buf[PATH_MAX];
+
+    if (argc == 3 && !strcmp(argv[1], "exit")) {
+        return atoi(argv[2]);
+    }
+    if (argc == 3 && !strcmp(argv[1], "cwd")) {
+        if (getcwd(buf, sizeof(buf)) == NULL) {
+            return 2;
+        }
+        return strcmp(buf, argv[2]) == 0 ? 0 : 1;
+    }
+    if (!strcmp(argv[1], "args")) {
+        return (argc == 5 && !strcmp(argv[2], "a") &&
+                !strcmp(argv[3], "bb") && argv[4][0] == '\0' &&
+                argv[5] == NULL) ? 0 : 1;
+    }
+    return 100;
+}
+
+/* Run ARGV with FS; true if it exited with CODE */
+static int
+run_expect(struct forkserver *fs, char **argv, int code)
+{
+    int status, r;
+
+    r = forkserver_run(fs, argv, &status);
+    if (r) {
+        printf("  Error: forkserver_run: %s\n", strerror(r));
+        return 0;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != code) {
+        printf("  Error: %s %s: status %d, expected exit %d\n",
+               argv[0], argv[1], status, code);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Test 1: the helper runs requests and reports their exit codes,
+ * again and again.
+ */
+static void
+test_run(struct forkserver *fs)
+{
+    const char *test_name = "helper runs requests repeatedly";
+    char *args[4];
+    char num[16];
+    int i, ok = 1;
+
+    args[0] = (char *)"x";
+    args[1] = (char *)"exit";
+    args[2] = num;
+    args[3] = NULL;
+    for (i = 0; i < RUNS && ok; i++) {
+        snprintf(num, sizeof(num), "%d", i % 7);
+        ok = run_expect(fs, args, i % 7);
+    }
+    print_result(test_name, ok);
+}
+
+/*
+ * Test 2: arguments arrive intact, empty ones included.
+ */
+static void
+test_args(struct forkserver *fs)
+{
+    const char *test_name = "arguments are passed through";
+    char *args[6];
+
+    args[0] = (char *)"x";
+    args[1] = (char *)"args";
+    args[2] = (char *)"a";
+    args[3] = (char *)"bb";
+    args[4] = (char *)"";
+    args[5] = NULL;
+    print_result(test_name, run_expect(fs, args, 0));
+}
+
+/*
+ * Test 3: a request runs in the client's current directory, not the
+ * one the helper was started in.
+ */
+static void
+test_cwd(struct forkserver *fs)
+{
+    const char *test_name = "request runs in the client's directory";
+    char before[PATH_MAX], here[PATH_MAX];
+    char *args[4];
+    int ok;
+
+    if (getcwd(before, sizeof(before)) == NULL || chdir("/testbin") < 0 ||
+        getcwd(here, sizeof(here)) == NULL) {
+        printf("  Error: Could not change directory\n");
+        print_result(test_name, 0);
+        return;
+    }
+    args[0] = (char *)"x";
+    args[1] = (char *)"cwd";
+    args[2] = here;
+    args[3] = NULL;
+    ok = run_expect(fs, args, 0);
+    chdir(before);
+    print_result(test_name, ok);
+}
+
+/*
+ * Test 4: a program that can't be a helper is refused.
+ */
+static void
+test_notahelper(void)
+{
+    const char *test_name = "non-helper program is refused";
+    struct forkserver fs;
+    int r;
+
+    r = forkserver_start(&fs, "/bin/true", NULL);
+    if (r == 0) {
+        forkserver_stop(&fs);
+    }
+    if (r != ENOEXEC) {
+        printf("  Error: got %s, expected ENOEXEC\n", strerror(r));
+    }
+    print_result(test_name, r == ENOEXEC);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct forkserver fs;
+    int r;
+
+    forkserver_serve(&argc, &argv);
+    if (argc > 1) {
+        return run_request(argc, argv);
+    }
+
+    printf("Fork Server Tests\n");
+
+    r = forkserver_start(&fs, SELF, NULL);
+    if (r) {
+        printf("  Error: forkserver_start: %s\n", strerror(r));
+        print_result("helper starts", 0);
+    } else {
+        print_result("helper starts", 1);
+        test_run(&fs);
+        test_args(&fs);
+        test_cwd(&fs);
+        forkserver_stop(&fs);
+    }
+    test_notahelper();
+
+    printf("Fork Server Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/types.h>
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static volatile int word;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+/*
+ * Test 1: FUTEX_WAIT on a changed word
+ * If the word isn't the expected value, wait must return at once
+ * with EAGAIN instead of sleeping.
+ */
+static void
+test_futex_wait_mismatch(void)
+{
+    const char *test_name = "FUTEX_WAIT with a stale value";
+    int r;
+
+    word = 1;
+    r = futex(&word, FUTEX_WAIT, 0, NULL);
+    if (r != -1 || errno != EAGAIN) {
+        printf("  Error: returned %d (errno %d), expected EAGAIN\n", r, errno);
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 2: FUTEX_WAIT timeout
+ * Nobody wakes the word, so a 200ms wait must time out, and not
+ * much earlier.
+ */
+static void
+test_futex_wait_timeout(void)
+{
+    const char *test_name = "FUTEX_WAIT times out";
+    struct timespec ts;
+    time_t s1, s2;
+    unsigned long ns1, ns2;
+    long ms;
+    int r;
+
+    word = 0;
+    ts.tv_sec = 0;
+    ts.tv_nsec = 200000000;
+    __time(&s1, &ns1);
+    r = futex(&word, FUTEX_WAIT, 0, &ts);
+    __time(&s2, &ns2);
+    ms = (long)(s2 - s1) * 1000 + ((long)ns2 - (long)ns1) / 1000000;
+
+    if (r != -1 || errno != ETIMEDOUT) {
+        printf("  Error: returned %d (errno %d), expected ETIMEDOUT\n",
+               r, errno);
+        print_result(test_name, 0);
+        return;
+    }
+    if (ms < 190) {
+        printf("  Error: woke after only %ld ms\n", ms);
+        print_result(test_name, 0);
+        return;
+    }
+    printf("  Timed out after %ld ms\n", ms);
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 3: FUTEX_WAKE with nobody waiting
+ * Should succeed and report that it woke no one.
+ */
+static void
+test_futex_wake_none(void)
+{
+    const char *test_name = "FUTEX_WAKE with no waiters";
+    int r;
+
+    r = futex(&word, FUTEX_WAKE, 1, NULL);
+    if (r != 0) {
+        printf("  Error: returned %d, expected 0\n", r);
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 4: bad arguments
+ * Misaligned addresses, unknown operations and wake counts below 1
+ * are rejected with EINVAL.
+ */
+static void
+test_futex_einval(void)
+{
+    const char *test_name = "futex rejects bad arguments";
+    char *p = (char *)&word;
+    int ok = 1;
+
+    if (futex((volatile int *)(p + 1), FUTEX_WAKE, 1, NULL) != -1 ||
+        errno != EINVAL) {
+        printf("  Error: misaligned address accepted\n");
+        ok = 0;
+    }
+    if (futex(&word, 42, 1, NULL) != -1 || errno != EINVAL) {
+        printf("  Error: unknown operation accepted\n");
+        ok = 0;
+    }
+    if (futex(&word, FUTEX_WAKE, 0, NULL) != -1 || errno != EINVAL) {
+        printf("  Error: wake count 0 accepted\n");
+        ok = 0;
+    }
+    print_result(test_name, ok);
+}
+
+int
+main(void)
+{
+    printf("futex System Call Tests\n");
+
+    test_futex_wait_mismatch();
+    test_futex_wait_timeout();
+    test_futex_wake_none();
+    test_futex_einval();
+
+    printf("futex Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
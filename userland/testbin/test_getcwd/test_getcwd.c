@@ -9,17 +9,24 @@
  * Usage: pwd
  *
  * Just uses the getcwd library call (which in turn uses the __getcwd
- * system call.)
+ * system call.) Asks twice, since the second answer comes from the
+ * kernel's cached copy, and it had better be the same.
  */
 
 int
 main(void)
 {
-	char buf[PATH_MAX+1], *p;
+	char buf[PATH_MAX+1], again[PATH_MAX+1], *p;
 	p = getcwd(buf, sizeof(buf));
 	if (p == NULL) {
 		err(1, ".");
 	}
+	if (getcwd(again, sizeof(again)) == NULL) {
+		err(1, ".");
+	}
+	if (strcmp(buf, again) != 0) {
+		errx(1, "getcwd said %s, then %s", buf, again);
+	}
 	printf("getcwd Test Summary:\n");
     printf("P: %c\n", *p);
 	printf("CWD: %s\n", buf);
@@ -0,0 +1,372 @@
+/*
+ * Tests for getdents: listing a directory many names per call.
+ *
+ * Each listing is checked record by record: d_reclen and d_namelen
+ * must describe a record that fits, and names must come back once
+ * each, the same as getdirentry gives them.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <kern/seek.h>
+
+#define TEST_DIR "getdents_dir"
+#define NFILES 40		/* several directory blocks' worth */
+#define NAMELEN 16
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+/* The records contain off_t; keep the buffer aligned */
+static off_t dbuf[4096/sizeof(off_t)];
+
+/* A full listing, in the order getdents gave it */
+static char names[NFILES + 2][NAMELEN];
+static off_t offs[NFILES + 2];
+static int nnames;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+static void
+filename(char *buf, int i)
+{
+    snprintf(buf, NAMELEN, "f%02d", i);
+}
+
+/* Make TEST_DIR with NFILES empty files in it */
+static int
+setup(void)
+{
+    char path[64], name[NAMELEN];
+    int i, fd;
+
+    if (mkdir(TEST_DIR, 0755) < 0) {
+        return 0;
+    }
+    for (i = 0; i < NFILES; i++) {
+        filename(name, i);
+        snprintf(path, sizeof(path), "%s/%s", TEST_DIR, name);
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return 0;
+        }
+        close(fd);
+    }
+    return 1;
+}
+
+static void
+cleanup(void)
+{
+    char path[64], name[NAMELEN];
+    int i;
+
+    for (i = 0; i < NFILES; i++) {
+        filename(name, i);
+        snprintf(path, sizeof(path), "%s/%s", TEST_DIR, name);
+        remove(path);
+    }
+    rmdir(TEST_DIR);
+}
+
+/*
+ * Return the record at POS of the LEN bytes getdents put in BUF, or
+ * NULL if it doesn't make sense.
+ */
+static struct dirent *
+getrecord(void *buf, ssize_t pos, ssize_t len)
+{
+    struct dirent *d;
+
+    d = (struct dirent *)((char *)buf + pos);
+    if (pos + (ssize_t)DIRENT_RECLEN(0) > len ||
+        d->d_reclen < DIRENT_RECLEN(d->d_namelen) ||
+        pos + d->d_reclen > len ||
+        strlen(d->d_name) != d->d_namelen) {
+        printf("  Error: bad record at %ld\n", (long)pos);
+        return NULL;
+    }
+    return d;
+}
+
+/*
+ * Test 1: a big buffer gets every name once, along with . and ..,
+ * and the offset after each call is where its last record ends.
+ */
+static void
+test_list(void)
+{
+    const char *test_name = "getdents lists every name once";
+    char name[NAMELEN];
+    struct dirent *d;
+    ssize_t len, pos;
+    off_t end = 0, here;
+    int seen[NFILES];
+    int fd, i, ok = 1;
+
+    memset(seen, 0, sizeof(seen));
+    nnames = 0;
+    fd = open(TEST_DIR, O_RDONLY);
+    if (fd < 0) {
+        printf("  Error: Could not open test directory\n");
+        print_result(test_name, 0);
+        return;
+    }
+    while (ok && (len = getdents(fd, dbuf, sizeof(dbuf))) > 0) {
+        for (pos = 0; ok && pos < len; pos += d->d_reclen) {
+            d = getrecord(dbuf, pos, len);
+            if (d == NULL || nnames == NFILES + 2) {
+                ok = 0;
+                break;
+            }
+            strcpy(names[nnames], d->d_name);
+            offs[nnames++] = d->d_off;
+            end = d->d_off;
+            if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, "..")) {
+                continue;
+            }
+            for (i = 0; i < NFILES; i++) {
+                filename(name, i);
+                if (!strcmp(d->d_name, name)) {
+                    break;
+                }
+            }
+            if (i == NFILES || seen[i]++) {
+                printf("  Error: unexpected or repeated name %s\n",
+                       d->d_name);
+                ok = 0;
+            }
+        }
+        here = lseek(fd, 0, SEEK_CUR);
+        if (ok && here != end) {
+            printf("  Error: at %ld after getdents, last entry ends "
+                   "at %ld\n", (long)here, (long)end);
+            ok = 0;
+        }
+    }
+    if (ok && len < 0) {
+        printf("  Error: getdents failed (errno %d)\n", errno);
+        ok = 0;
+    }
+    for (i = 0; ok && i < NFILES; i++) {
+        if (!seen[i]) {
+            printf("  Error: f%02d missing\n", i);
+            ok = 0;
+        }
+    }
+    close(fd);
+    print_result(test_name, ok);
+}
+
+/*
+ * Test 2: with room for only one record per call, getdents gives
+ * the same names in the same order; and seeking to a record's d_off
+ * carries on from the record after it.
+ */
+static void
+test_small(void)
+{
+    const char *test_name = "one record per call, and seeking to d_off";
+    off_t small[48/sizeof(off_t)];	/* one short name, not two */
+    struct dirent *d;
+    ssize_t len;
+    int fd, n, ok = 1;
+
+    fd = open(TEST_DIR, O_RDONLY);
+    if (fd < 0) {
+        printf("  Error: Could not open test directory\n");
+        print_result(test_name, 0);
+        return;
+    }
+    for (n = 0; ok; n++) {
+        len = getdents(fd, small, sizeof(small) - 1);
+        if (len <= 0) {
+            break;
+        }
+        d = getrecord(small, 0, len);
+        if (d == NULL || d->d_reclen != len || n >= nnames ||
+            strcmp(d->d_name, names[n])) {
+            printf("  Error: call %d disagrees with the full listing\n", n);
+            ok = 0;
+        }
+    }
+    if (ok && (len < 0 || n != nnames)) {
+        printf("  Error: got %d names, expected %d\n", n, nnames);
+        ok = 0;
+    }
+
+    /* Resume after the middle one */
+    n = nnames / 2;
+    if (ok && lseek(fd, offs[n], SEEK_SET) != offs[n]) {
+        printf("  Error: lseek to d_off failed\n");
+        ok = 0;
+    }
+    if (ok) {
+        len = getdents(fd, small, sizeof(small) - 1);
+        d = len > 0 ? getrecord(small, 0, len) : NULL;
+        if (d == NULL || strcmp(d->d_name, names[n + 1])) {
+            printf("  Error: didn't resume after %s\n", names[n]);
+            ok = 0;
+        }
+    }
+    close(fd);
+    print_result(test_name, ok);
+}
+
+/*
+ * Test 3: getdirentry, a name per call, lists the same names in the
+ * same order.
+ */
+static void
+test_getdirentry(void)
+{
+    const char *test_name = "getdents agrees with getdirentry";
+    char buf[NAMELEN + 1];
+    ssize_t len;
+    int fd, n, ok = 1;
+
+    fd = open(TEST_DIR, O_RDONLY);
+    if (fd < 0) {
+        printf("  Error: Could not open test directory\n");
+        print_result(test_name, 0);
+        return;
+    }
+    for (n = 0; ok && (len = getdirentry(fd, buf, sizeof(buf) - 1)) > 0;
+         n++) {
+        buf[len] = '\0';
+        if (n >= nnames || strcmp(buf, names[n])) {
+            printf("  Error: getdirentry gave %s as name %d\n", buf, n);
+            ok = 0;
+        }
+    }
+    if (ok && (len < 0 || n != nnames)) {
+        printf("  Error: getdirentry gave %d names, getdents %d\n",
+               n, nnames);
+        ok = 0;
+    }
+    close(fd);
+    print_result(test_name, ok);
+}
+
+/*
+ * Test 4: bad arguments.
+ */
+static void
+test_errors(void)
+{
+    const char *test_name = "getdents error cases";
+    off_t tiny[1];
+    int fd, ok = 1;
+
+    if (getdents(-1, dbuf, sizeof(dbuf)) != -1 || errno != EBADF) {
+        printf("  Error: bad fd not rejected\n");
+        ok = 0;
+    }
+    fd = open(TEST_DIR, O_RDONLY);
+    if (fd >= 0) {
+        if (getdents(fd, tiny, sizeof(tiny)) != -1 || errno != EINVAL) {
+            printf("  Error: buffer too small for a record not "
+                   "rejected\n");
+            ok = 0;
+        }
+        close(fd);
+    }
+    fd = open(TEST_DIR "/f00", O_RDONLY);
+    if (fd >= 0) {
+        if (getdents(fd, dbuf, sizeof(dbuf)) != -1 || errno != ENOTDIR) {
+            printf("  Error: plain file not rejected\n");
+            ok = 0;
+        }
+        close(fd);
+    }
+    print_result(test_name, ok);
+}
+
+/*
+ * Test 5: a directory removed while open lists as empty, or at most
+ * . and .., or fails cleanly.
+ */
+static void
+test_removed(void)
+{
+    const char *test_name = "listing a removed directory";
+    struct dirent *d;
+    ssize_t len, pos;
+    int fd, ok = 1;
+
+    if (mkdir(TEST_DIR "/gone", 0755) < 0) {
+        printf("  Error: Could not make directory\n");
+        print_result(test_name, 0);
+        return;
+    }
+    fd = open(TEST_DIR "/gone", O_RDONLY);
+    if (fd < 0 || rmdir(TEST_DIR "/gone") < 0) {
+        printf("  Error: Could not open and remove directory\n");
+        if (fd >= 0) {
+            close(fd);
+        }
+        rmdir(TEST_DIR "/gone");
+        print_result(test_name, 0);
+        return;
+    }
+    while (ok && (len = getdents(fd, dbuf, sizeof(dbuf))) > 0) {
+        for (pos = 0; ok && pos < len; pos += d->d_reclen) {
+            d = getrecord(dbuf, pos, len);
+            if (d == NULL) {
+                ok = 0;
+                break;
+            }
+            if (strcmp(d->d_name, ".") && strcmp(d->d_name, "..")) {
+                printf("  Error: unexpected name %s\n", d->d_name);
+                ok = 0;
+            }
+        }
+    }
+    if (ok && len < 0 && errno != EINVAL && errno != EIO) {
+        printf("  Error: getdents failed (errno %d)\n", errno);
+        ok = 0;
+    }
+    close(fd);
+    print_result(test_name, ok);
+}
+
+int
+main(void)
+{
+    printf("getdents Tests\n");
+
+    if (!setup()) {
+        printf("  Error: Could not set up test directory\n");
+        cleanup();
+        return 1;
+    }
+    test_list();
+    test_small();
+    test_getdirentry();
+    test_errors();
+    test_removed();
+    cleanup();
+
+    printf("getdents Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
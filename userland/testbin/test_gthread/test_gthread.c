@@ -0,0 +1,221 @@
+/*
+ * Tests for green threads (gthread.h).
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <gthread.h>
+
+#define NMANY	1000
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+static int
+square(void *arg)
+{
+    int n = (int)arg;
+
+    return n * n;
+}
+
+/*
+ * Test 1: gthread_run returns what the first gthread does.
+ */
+static void
+test_gthread_run(void)
+{
+    print_result("run", gthread_run(1, square, (void *)7) == 49);
+}
+
+static int
+join_root(void *arg)
+{
+    struct gthread *t[10];
+    int i, sum;
+
+    (void)arg;
+    for (i=0; i<10; i++) {
+        t[i] = gthread_create(square, (void *)i);
+        if (t[i] == NULL) {
+            return -1;
+        }
+    }
+    sum = 0;
+    for (i=0; i<10; i++) {
+        sum += gthread_join(t[i]);
+    }
+    return sum;
+}
+
+/*
+ * Test 2: gthreads can make others and get their results.
+ */
+static void
+test_gthread_join(void)
+{
+    /* 0 + 1 + 4 + ... + 81 */
+    print_result("join", gthread_run(2, join_root, NULL) == 285);
+}
+
+static char trace[16];
+static int ntrace;
+static char a_name[] = "a";
+static char b_name[] = "b";
+
+static int
+pingpong(void *arg)
+{
+    int i;
+
+    for (i=0; i<3; i++) {
+        trace[ntrace++] = *(const char *)arg;
+        gthread_yield();
+    }
+    return 0;
+}
+
+static int
+yield_root(void *arg)
+{
+    struct gthread *a, *b;
+
+    (void)arg;
+    a = gthread_create(pingpong, a_name);
+    b = gthread_create(pingpong, b_name);
+    if (a == NULL || b == NULL) {
+        return -1;
+    }
+    gthread_join(a);
+    gthread_join(b);
+    return 0;
+}
+
+/*
+ * Test 3: on one worker, yielding takes turns.
+ */
+static void
+test_gthread_yield(void)
+{
+    const char *test_name = "yield";
+    int ok = 1;
+
+    ntrace = 0;
+    if (gthread_run(1, yield_root, NULL) != 0) {
+        printf("  Error: couldn't make the gthreads\n");
+        ok = 0;
+    }
+    trace[ntrace] = 0;
+    if (ntrace != 6 || trace[0] != 'a' || trace[1] != 'b' ||
+        trace[2] != 'a' || trace[3] != 'b') {
+        printf("  Error: ran in the order %s\n", trace);
+        ok = 0;
+    }
+    print_result(test_name, ok);
+}
+
+static int
+yielder(void *arg)
+{
+    int i;
+
+    for (i=0; i<5; i++) {
+        gthread_yield();
+    }
+    return (int)arg;
+}
+
+static int
+many_root(void *arg)
+{
+    static struct gthread *t[NMANY];
+    int i, sum;
+
+    (void)arg;
+    for (i=0; i<NMANY; i++) {
+        t[i] = gthread_create(yielder, (void *)i);
+        if (t[i] == NULL) {
+            return -1;
+        }
+    }
+    sum = 0;
+    for (i=0; i<NMANY; i++) {
+        sum += gthread_join(t[i]);
+    }
+    return sum;
+}
+
+/*
+ * Test 4: lots of gthreads, switching a lot, on several workers.
+ */
+static void
+test_gthread_many(void)
+{
+    print_result("many",
+                 gthread_run(4, many_root, NULL) == NMANY * (NMANY - 1) / 2);
+}
+
+static int
+nested_root(void *arg)
+{
+    (void)arg;
+    if (gthread_run(1, square, (void *)2) != -1 || errno != EINVAL) {
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Test 5: bad worker counts, and running gthread_run twice at once,
+ * are EINVAL.
+ */
+static void
+test_gthread_bad(void)
+{
+    const char *test_name = "bad";
+    int ok = 1;
+
+    if (gthread_run(0, square, NULL) != -1 || errno != EINVAL ||
+        gthread_run(GTHREAD_MAXWORKERS + 1, square, NULL) != -1 ||
+        errno != EINVAL) {
+        printf("  Error: bad worker count wasn't EINVAL\n");
+        ok = 0;
+    }
+    if (gthread_run(1, nested_root, NULL) != 0) {
+        printf("  Error: nested gthread_run wasn't EINVAL\n");
+        ok = 0;
+    }
+    print_result(test_name, ok);
+}
+
+int
+main(void)
+{
+    printf("gthread Tests\n");
+
+    test_gthread_run();
+    test_gthread_join();
+    test_gthread_yield();
+    test_gthread_many();
+    test_gthread_bad();
+
+    printf("gthread Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
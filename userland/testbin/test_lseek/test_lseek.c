@@ -9,6 +9,11 @@
 #define TEST_DATA "Hello, OS/161 lseek test!\n"
 #define TEST_DATA_LEN 27
 
+/* A sparse file: the test data, a hole, and a byte at the end */
+#define SPARSE_BLOCK 512
+#define SPARSE_HOLE SPARSE_BLOCK
+#define SPARSE_END (128 * SPARSE_BLOCK)
+
 int 
 main(void) 
 {
@@ -89,7 +94,60 @@ main(void)
     }
     printf("[PASS] Seek relative to current (+5) successful (position=%ld)\n", (long)pos);
 
+    /*
+     * Test 5: SEEK_DATA and SEEK_HOLE on a sparse file. A file system
+     * that keeps holes finds the one between the two writes; one that
+     * doesn't says the whole file is data.
+     */
+    if (pwrite(fd, "x", 1, SPARSE_END - 1) != 1) {
+        printf("[FAIL] Could not write at %d\n", SPARSE_END - 1);
+        close(fd);
+        return 1;
+    }
+    pos = lseek(fd, 0, SEEK_HOLE);
+    if (pos != SPARSE_HOLE && pos != SPARSE_END) {
+        printf("[FAIL] SEEK_HOLE from 0: got %ld\n", (long)pos);
+        close(fd);
+        return 1;
+    }
+    pos = lseek(fd, SPARSE_HOLE + 100, SEEK_DATA);
+    if (pos != SPARSE_END - SPARSE_BLOCK && pos != SPARSE_HOLE + 100) {
+        printf("[FAIL] SEEK_DATA in the hole: got %ld\n", (long)pos);
+        close(fd);
+        return 1;
+    }
+    if (lseek(fd, SPARSE_END, SEEK_DATA) != -1 ||
+        lseek(fd, SPARSE_END, SEEK_HOLE) != -1) {
+        printf("[FAIL] SEEK_DATA/SEEK_HOLE at EOF didn't fail\n");
+        close(fd);
+        return 1;
+    }
+    printf("[PASS] SEEK_DATA/SEEK_HOLE (hole at %ld)\n",
+           (long)lseek(fd, 0, SEEK_HOLE));
+
+    /* Test 6: fallocate grows the file, and the new part is data */
+    if (fallocate(fd, SPARSE_END, 8192) < 0) {
+        printf("[FAIL] fallocate failed\n");
+        close(fd);
+        return 1;
+    }
+    pos = lseek(fd, 0, SEEK_END);
+    if (pos != SPARSE_END + 8192) {
+        printf("[FAIL] size after fallocate: expected %d, got %ld\n",
+               SPARSE_END + 8192, (long)pos);
+        close(fd);
+        return 1;
+    }
+    pos = lseek(fd, SPARSE_END, SEEK_HOLE);
+    if (pos != SPARSE_END + 8192) {
+        printf("[FAIL] hole after fallocate at %ld\n", (long)pos);
+        close(fd);
+        return 1;
+    }
+    printf("[PASS] fallocate\n");
+
     close(fd);
+    remove(TEST_FILE);
     printf("\nAll lseek tests passed!\n");
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,625 @@
+/*
+ * Tests for mmap, munmap, msync, madvise and mlock on files, and for
+ * mapping zero:.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define TEST_FILE "mmap_test.txt"
+#define TEST_PAGE 4096
+/* Two pages and a bit, so the last page is partly past the end */
+#define TEST_SIZE (2 * TEST_PAGE + 100)
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+/* The byte at offset I of the test file */
+static char
+pattern(int i)
+{
+    return 'a' + (i % 26);
+}
+
+/* Create the test file; returns an O_RDWR fd */
+static int
+make_file(void)
+{
+    char buf[TEST_SIZE];
+    int fd, i;
+
+    for (i = 0; i < TEST_SIZE; i++) {
+        buf[i] = pattern(i);
+    }
+    fd = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("  Error: Could not create test file\n");
+        return -1;
+    }
+    if (write(fd, buf, TEST_SIZE) != TEST_SIZE) {
+        printf("  Error: Could not write test file\n");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Test 1: a private read-only mapping shows the file, and zeros past
+ * its end.
+ */
+static void
+test_mmap_read(void)
+{
+    const char *test_name = "Read a file through mmap";
+    char *p;
+    int fd, i;
+
+    fd = make_file();
+    if (fd < 0) {
+        print_result(test_name, 0);
+        return;
+    }
+    p = mmap(NULL, 3 * TEST_PAGE, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        printf("  Error: mmap failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+
+    for (i = 0; i < TEST_SIZE; i++) {
+        if (p[i] != pattern(i)) {
+            printf("  Error: byte %d is '%c'\n", i, p[i]);
+            munmap(p, 3 * TEST_PAGE);
+            print_result(test_name, 0);
+            return;
+        }
+    }
+    for (; i < 3 * TEST_PAGE; i++) {
+        if (p[i] != 0) {
+            printf("  Error: byte %d past the end isn't zero\n", i);
+            munmap(p, 3 * TEST_PAGE);
+            print_result(test_name, 0);
+            return;
+        }
+    }
+    munmap(p, 3 * TEST_PAGE);
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 2: writes to a shared mapping reach the file, with msync and
+ * with munmap.
+ */
+static void
+test_mmap_shared(void)
+{
+    const char *test_name = "Write a file through a shared mapping";
+    char buf[8];
+    char *p;
+    int fd;
+
+    fd = make_file();
+    if (fd < 0) {
+        print_result(test_name, 0);
+        return;
+    }
+    p = mmap(NULL, TEST_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        printf("  Error: mmap failed (errno %d)\n", errno);
+        close(fd);
+        print_result(test_name, 0);
+        return;
+    }
+
+    memcpy(p + 10, "SYNC", 4);
+    if (msync(p, TEST_SIZE, MS_SYNC) < 0) {
+        printf("  Error: msync failed (errno %d)\n", errno);
+    }
+    memset(buf, 0, sizeof(buf));
+    pread(fd, buf, 4, 10);
+    if (memcmp(buf, "SYNC", 4) != 0) {
+        printf("  Error: file has '%s' after msync\n", buf);
+        munmap(p, TEST_SIZE);
+        close(fd);
+        print_result(test_name, 0);
+        return;
+    }
+
+    memcpy(p + TEST_PAGE + 5, "UNMAP", 5);
+    munmap(p, TEST_SIZE);
+    memset(buf, 0, sizeof(buf));
+    pread(fd, buf, 5, TEST_PAGE + 5);
+    close(fd);
+    if (memcmp(buf, "UNMAP", 5) != 0) {
+        printf("  Error: file has '%s' after munmap\n", buf);
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 3: writes to a private mapping don't reach the file.
+ */
+static void
+test_mmap_private(void)
+{
+    const char *test_name = "Private mapping writes stay private";
+    char buf[4];
+    char *p;
+    int fd;
+
+    fd = make_file();
+    if (fd < 0) {
+        print_result(test_name, 0);
+        return;
+    }
+    p = mmap(NULL, TEST_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+        printf("  Error: mmap failed (errno %d)\n", errno);
+        close(fd);
+        print_result(test_name, 0);
+        return;
+    }
+    memcpy(p, "XXXX", 4);
+    munmap(p, TEST_SIZE);
+
+    pread(fd, buf, 4, 0);
+    close(fd);
+    if (memcmp(buf, "abcd", 4) != 0) {
+        printf("  Error: private write reached the file\n");
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 4: a shared mapping stays shared across fork.
+ */
+static void
+test_mmap_fork(void)
+{
+    const char *test_name = "Shared mapping is shared with a child";
+    char *p;
+    pid_t pid;
+    int fd, status;
+
+    fd = make_file();
+    if (fd < 0) {
+        print_result(test_name, 0);
+        return;
+    }
+    p = mmap(NULL, TEST_PAGE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        printf("  Error: mmap failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    p[0] = 'P';
+
+    pid = fork();
+    if (pid < 0) {
+        printf("  Error: fork failed\n");
+        munmap(p, TEST_PAGE);
+        print_result(test_name, 0);
+        return;
+    }
+    if (pid == 0) {
+        _exit(p[0] == 'P' ? (p[1] = 'C', 0) : 1);
+    }
+    waitpid(pid, &status, 0);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || p[1] != 'C') {
+        printf("  Error: parent and child don't share the page\n");
+        munmap(p, TEST_PAGE);
+        print_result(test_name, 0);
+        return;
+    }
+    munmap(p, TEST_PAGE);
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 5: the errors.
+ */
+static void
+test_mmap_errors(void)
+{
+    const char *test_name = "mmap and munmap errors";
+    char *p;
+    int fd;
+
+    fd = make_file();
+    if (fd < 0) {
+        print_result(test_name, 0);
+        return;
+    }
+
+    p = mmap(NULL, TEST_PAGE, PROT_READ, MAP_PRIVATE, fd, 100);
+    if (p != MAP_FAILED || errno != EINVAL) {
+        printf("  Error: unaligned offset wasn't EINVAL\n");
+        close(fd);
+        print_result(test_name, 0);
+        return;
+    }
+
+    p = mmap(NULL, TEST_PAGE, PROT_READ, MAP_PRIVATE, STDOUT_FILENO, 0);
+    if (p != MAP_FAILED) {
+        printf("  Error: mapped the console\n");
+        close(fd);
+        print_result(test_name, 0);
+        return;
+    }
+
+    p = mmap(NULL, 2 * TEST_PAGE, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        printf("  Error: mmap failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    if (munmap(p + TEST_PAGE, TEST_PAGE) == 0 || errno != EINVAL) {
+        printf("  Error: half a mapping was unmapped\n");
+        print_result(test_name, 0);
+        return;
+    }
+    munmap(p, 2 * TEST_PAGE);
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 6: madvise. MADV_DONTNEED throws away private changes, and a
+ * mapping read with MADV_SEQUENTIAL or MADV_WILLNEED still reads
+ * right.
+ */
+static void
+test_mmap_madvise(void)
+{
+    const char *test_name = "madvise";
+    char *p;
+    int fd, i;
+
+    fd = make_file();
+    if (fd < 0) {
+        print_result(test_name, 0);
+        return;
+    }
+    p = mmap(NULL, 3 * TEST_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+             fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        printf("  Error: mmap failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+
+    if (madvise(p, 3 * TEST_PAGE, MADV_SEQUENTIAL) < 0 ||
+        madvise(p, 3 * TEST_PAGE, MADV_WILLNEED) < 0) {
+        printf("  Error: madvise failed (errno %d)\n", errno);
+        munmap(p, 3 * TEST_PAGE);
+        print_result(test_name, 0);
+        return;
+    }
+    for (i = 0; i < TEST_SIZE; i++) {
+        if (p[i] != pattern(i)) {
+            printf("  Error: byte %d is '%c'\n", i, p[i]);
+            munmap(p, 3 * TEST_PAGE);
+            print_result(test_name, 0);
+            return;
+        }
+    }
+
+    p[0] = 'X';
+    p[2 * TEST_PAGE + 200] = 'Y';
+    if (madvise(p, 3 * TEST_PAGE, MADV_DONTNEED) < 0) {
+        printf("  Error: MADV_DONTNEED failed (errno %d)\n", errno);
+        munmap(p, 3 * TEST_PAGE);
+        print_result(test_name, 0);
+        return;
+    }
+    if (p[0] != pattern(0) || p[2 * TEST_PAGE + 200] != 0) {
+        printf("  Error: private changes survived MADV_DONTNEED\n");
+        munmap(p, 3 * TEST_PAGE);
+        print_result(test_name, 0);
+        return;
+    }
+
+    if (madvise(p, TEST_PAGE, 99) == 0 || errno != EINVAL) {
+        printf("  Error: bad advice wasn't EINVAL\n");
+        munmap(p, 3 * TEST_PAGE);
+        print_result(test_name, 0);
+        return;
+    }
+    munmap(p, 3 * TEST_PAGE);
+    print_result(test_name, 1);
+}
+
+/* Major faults (pages read in) taken so far, or -1 */
+static long
+majflt(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) < 0) {
+        return -1;
+    }
+    return ru.ru_majflt;
+}
+
+/* Read and write every page of P, checking it holds the file */
+static int
+touch_file(char *p)
+{
+    int i;
+
+    for (i = 0; i < TEST_SIZE; i++) {
+        if (p[i] != pattern(i)) {
+            printf("  Error: byte %d is '%c'\n", i, p[i]);
+            return 0;
+        }
+    }
+    for (i = 0; i < TEST_SIZE; i += TEST_PAGE) {
+        p[i] = pattern(i);
+    }
+    return 1;
+}
+
+/*
+ * Test 7: mlock. A locked private mapping is all read in by mlock,
+ * so touching it takes no major faults. Ranges that aren't mapped
+ * and bad mlockall flags are refused.
+ */
+static void
+test_mmap_mlock(void)
+{
+    const char *test_name = "mlock";
+    char *p;
+    long before;
+    int fd;
+
+    fd = make_file();
+    if (fd < 0) {
+        print_result(test_name, 0);
+        return;
+    }
+    p = mmap(NULL, 3 * TEST_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+             fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        printf("  Error: mmap failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+
+    if (mlock(p, 3 * TEST_PAGE) < 0) {
+        printf("  Error: mlock failed (errno %d)\n", errno);
+        munmap(p, 3 * TEST_PAGE);
+        print_result(test_name, 0);
+        return;
+    }
+    before = majflt();
+    if (!touch_file(p)) {
+        munmap(p, 3 * TEST_PAGE);
+        print_result(test_name, 0);
+        return;
+    }
+    if (majflt() != before) {
+        printf("  Error: %ld major faults on locked pages\n",
+               majflt() - before);
+        munmap(p, 3 * TEST_PAGE);
+        print_result(test_name, 0);
+        return;
+    }
+    if (munlock(p, 3 * TEST_PAGE) < 0) {
+        printf("  Error: munlock failed (errno %d)\n", errno);
+        munmap(p, 3 * TEST_PAGE);
+        print_result(test_name, 0);
+        return;
+    }
+    munmap(p, 3 * TEST_PAGE);
+
+    if (mlock(p, 3 * TEST_PAGE) == 0 || errno != ENOMEM) {
+        printf("  Error: mlock of unmapped pages wasn't ENOMEM\n");
+        print_result(test_name, 0);
+        return;
+    }
+
+    if (mlockall(0) == 0 || errno != EINVAL) {
+        printf("  Error: mlockall(0) wasn't EINVAL\n");
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 8: MAP_POPULATE reads the mapping in before mmap returns.
+ */
+static void
+test_mmap_populate(void)
+{
+    const char *test_name = "MAP_POPULATE";
+    char *p;
+    long before;
+    int fd, ok;
+
+    fd = make_file();
+    if (fd < 0) {
+        print_result(test_name, 0);
+        return;
+    }
+    p = mmap(NULL, 3 * TEST_PAGE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        printf("  Error: mmap failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    before = majflt();
+    ok = touch_file(p);
+    if (ok && majflt() != before) {
+        printf("  Error: %ld major faults on populated pages\n",
+               majflt() - before);
+        ok = 0;
+    }
+    munmap(p, 3 * TEST_PAGE);
+    print_result(test_name, ok);
+}
+
+/*
+ * Test 9: zero: reads as zeros, and maps as private zero-fill memory.
+ */
+static void
+test_mmap_zero(void)
+{
+    const char *test_name = "zero:";
+    static char buf[3 * TEST_PAGE];
+    char *p;
+    int fd, i, ok = 1;
+
+    fd = open("zero:", O_RDWR);
+    if (fd < 0) {
+        printf("  Error: open zero: failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    memset(buf, 'x', sizeof(buf));
+    if (read(fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+        printf("  Error: short read of zero:\n");
+        ok = 0;
+    }
+    for (i = 0; ok && i < (int)sizeof(buf); i++) {
+        if (buf[i] != 0) {
+            printf("  Error: byte %d read from zero: isn't zero\n", i);
+            ok = 0;
+        }
+    }
+
+    p = mmap(NULL, 3 * TEST_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+             fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        printf("  Error: mmap of zero: failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    for (i = 0; ok && i < 3 * TEST_PAGE; i++) {
+        if (p[i] != 0) {
+            printf("  Error: mapped byte %d isn't zero\n", i);
+            ok = 0;
+        }
+    }
+    p[TEST_PAGE] = 'z';
+    if (p[TEST_PAGE] != 'z') {
+        printf("  Error: couldn't write the mapping\n");
+        ok = 0;
+    }
+    munmap(p, 3 * TEST_PAGE);
+    print_result(test_name, ok);
+}
+
+/*
+ * Test 10: a shared mapping and read/write see each other's changes
+ * straight away, without msync.
+ */
+static void
+test_mmap_coherent(void)
+{
+    const char *test_name = "Shared mapping and read/write agree";
+    char buf[8];
+    char *p;
+    int fd, ok = 1;
+
+    fd = make_file();
+    if (fd < 0) {
+        print_result(test_name, 0);
+        return;
+    }
+    p = mmap(NULL, TEST_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        printf("  Error: mmap failed (errno %d)\n", errno);
+        close(fd);
+        print_result(test_name, 0);
+        return;
+    }
+
+    /* Fault the pages in first, so both are in the cache */
+    if (p[20] != pattern(20) || p[TEST_PAGE + 20] != pattern(TEST_PAGE + 20)) {
+        printf("  Error: mapping doesn't match the file\n");
+        ok = 0;
+    }
+
+    memcpy(p + 20, "MAPW", 4);
+    memset(buf, 0, sizeof(buf));
+    pread(fd, buf, 4, 20);
+    if (memcmp(buf, "MAPW", 4) != 0) {
+        printf("  Error: read() got '%s' after a store\n", buf);
+        ok = 0;
+    }
+
+    if (pwrite(fd, "FILEW", 5, TEST_PAGE + 20) != 5) {
+        printf("  Error: pwrite failed (errno %d)\n", errno);
+        ok = 0;
+    }
+    else if (memcmp(p + TEST_PAGE + 20, "FILEW", 5) != 0) {
+        printf("  Error: mapping doesn't show write()\n");
+        ok = 0;
+    }
+
+    munmap(p, TEST_SIZE);
+    memset(buf, 0, sizeof(buf));
+    pread(fd, buf, 5, TEST_PAGE + 20);
+    if (memcmp(buf, "FILEW", 5) != 0) {
+        printf("  Error: file has '%s' after munmap\n", buf);
+        ok = 0;
+    }
+    close(fd);
+    print_result(test_name, ok);
+}
+
+int
+main(void)
+{
+    printf("mmap Tests\n");
+
+    test_mmap_read();
+    test_mmap_shared();
+    test_mmap_private();
+    test_mmap_fork();
+    test_mmap_errors();
+    test_mmap_madvise();
+    test_mmap_mlock();
+    test_mmap_populate();
+    test_mmap_zero();
+    test_mmap_coherent();
+    remove(TEST_FILE);
+
+    printf("mmap Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
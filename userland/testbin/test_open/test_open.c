@@ -340,6 +340,125 @@ test_fd_allocation_order(void)
     print_result(test_name, success);
 }
 
+/*
+ * Test 13: Writes a file, closes it, and reopens it several times,
+ * which on SFS finds it kept in memory after the close. Then removes
+ * and recreates it. Expects the data to be there each time, and the
+ * recreated file to be empty.
+ */
+static void
+test_open_reopen_after_remove(void)
+{
+    const char *test_name = "Reopen after close and remove";
+    char buf[16];
+    int fd, i;
+
+    fd = open(NEW_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write(fd, "cached\n", 7) != 7) {
+        printf("  Error creating %s\n", NEW_FILE);
+        if (fd >= 0) close(fd);
+        print_result(test_name, 0);
+        return;
+    }
+    close(fd);
+
+    for (i = 0; i < 5; i++) {
+        fd = open(NEW_FILE, O_RDONLY);
+        if (fd < 0 || read(fd, buf, sizeof(buf)) != 7 ||
+            memcmp(buf, "cached\n", 7) != 0) {
+            printf("  Error: reopen %d didn't read the data back\n", i);
+            if (fd >= 0) close(fd);
+            print_result(test_name, 0);
+            return;
+        }
+        close(fd);
+    }
+
+    if (remove(NEW_FILE) < 0 || open(NEW_FILE, O_RDONLY) >= 0) {
+        printf("  Error: %s still there after remove\n", NEW_FILE);
+        print_result(test_name, 0);
+        return;
+    }
+    fd = open(NEW_FILE, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || read(fd, buf, sizeof(buf)) != 0) {
+        printf("  Error: recreated %s isn't empty\n", NEW_FILE);
+        if (fd >= 0) close(fd);
+        print_result(test_name, 0);
+        return;
+    }
+    close(fd);
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 14: names survive the directory being compacted under them.
+ * Removing the first files leaves holes for the later ones to be
+ * moved down into.
+ */
+#define CHURN_FILES 24
+#define CHURN_KEEP 8
+
+static void
+churn_name(char *buf, size_t len, int i)
+{
+    snprintf(buf, len, "churn%02d.txt", i);
+}
+
+static void
+test_open_dir_churn(void)
+{
+    const char *test_name = "Open after directory churn";
+    char name[32], buf[32];
+    int fd, i, len, ok = 1;
+
+    for (i = 0; i < CHURN_FILES; i++) {
+        churn_name(name, sizeof(name), i);
+        fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        len = strlen(name);
+        if (fd < 0 || write(fd, name, len) != len) {
+            printf("  Error creating %s\n", name);
+            if (fd >= 0) close(fd);
+            ok = 0;
+            break;
+        }
+        close(fd);
+    }
+    for (i = 0; ok && i < CHURN_FILES - CHURN_KEEP; i++) {
+        churn_name(name, sizeof(name), i);
+        if (remove(name) < 0) {
+            printf("  Error removing %s\n", name);
+            ok = 0;
+        }
+    }
+
+    /* The survivors still open, each with its own contents */
+    for (i = 0; ok && i < CHURN_FILES; i++) {
+        churn_name(name, sizeof(name), i);
+        fd = open(name, O_RDONLY);
+        if (i < CHURN_FILES - CHURN_KEEP) {
+            if (fd >= 0) {
+                printf("  Error: removed %s still opens\n", name);
+                close(fd);
+                ok = 0;
+            }
+            continue;
+        }
+        len = strlen(name);
+        if (fd < 0 || read(fd, buf, sizeof(buf)) != len ||
+            memcmp(buf, name, len) != 0) {
+            printf("  Error: %s lost or mixed up\n", name);
+            ok = 0;
+        }
+        if (fd >= 0) close(fd);
+    }
+
+    for (i = 0; i < CHURN_FILES; i++) {
+        churn_name(name, sizeof(name), i);
+        remove(name);
+    }
+    print_result(test_name, ok);
+}
+
 int
 main(void)
 {
@@ -366,6 +485,8 @@ main(void)
     test_open_append();
     test_open_trunc();
     test_fd_allocation_order();
+    test_open_reopen_after_remove();
+    test_open_dir_churn();
     
     printf("open Test Summary:\n");
     printf("Passed: %d\n", tests_passed);
@@ -0,0 +1,149 @@
+/*
+ * Tests for phase(). Whether the markers reach sys161 can only be
+ * seen in its output, so this checks the bookkeeping and the errors.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+/* Returns 0 or errno */
+static int
+op1(int op, const char *name)
+{
+    return phase(op, name) < 0 ? errno : 0;
+}
+
+/*
+ * Test 1: marks, and begins and ends that match, nested and not.
+ */
+static void
+test_phase_basic(void)
+{
+    const char *test_name = "basic";
+    int ok = 1;
+
+    if (op1(PHASE_MARK, "test_phase.mark") != 0 ||
+        op1(PHASE_MARK, "test_phase.mark") != 0) {
+        printf("  Error: mark failed (errno %d)\n", errno);
+        ok = 0;
+    }
+    if (op1(PHASE_BEGIN, "test_phase.a") != 0 ||
+        op1(PHASE_BEGIN, "test_phase.a") != 0 ||
+        op1(PHASE_END, "test_phase.a") != 0 ||
+        op1(PHASE_END, "test_phase.a") != 0) {
+        printf("  Error: nested begin and end failed (errno %d)\n", errno);
+        ok = 0;
+    }
+    if (op1(PHASE_BEGIN | PHASE_PROF, "test_phase.a") != 0 ||
+        op1(PHASE_BEGIN | PHASE_PROF, "test_phase.b") != 0 ||
+        op1(PHASE_END | PHASE_PROF, "test_phase.a") != 0 ||
+        op1(PHASE_END | PHASE_PROF, "test_phase.b") != 0) {
+        printf("  Error: overlapping profiled phases failed (errno %d)\n",
+               errno);
+        ok = 0;
+    }
+    if (op1(PHASE_ERASEPROF, NULL) != 0) {
+        printf("  Error: eraseprof failed (errno %d)\n", errno);
+        ok = 0;
+    }
+    print_result(test_name, ok);
+}
+
+/*
+ * Test 2: ends that don't match a begin.
+ */
+static void
+test_phase_unmatched(void)
+{
+    const char *test_name = "unmatched";
+    int ok = 1;
+
+    if (op1(PHASE_END, "test_phase.never") != EINVAL) {
+        printf("  Error: end of a phase never begun wasn't EINVAL\n");
+        ok = 0;
+    }
+    if (op1(PHASE_BEGIN, "test_phase.c") != 0) {
+        printf("  Error: begin failed (errno %d)\n", errno);
+        ok = 0;
+    }
+    if (op1(PHASE_END | PHASE_PROF, "test_phase.c") != EINVAL) {
+        printf("  Error: profiled end of an unprofiled phase "
+               "wasn't EINVAL\n");
+        ok = 0;
+    }
+    if (op1(PHASE_END, "test_phase.c") != 0 ||
+        op1(PHASE_END, "test_phase.c") != EINVAL) {
+        printf("  Error: a second end wasn't EINVAL\n");
+        ok = 0;
+    }
+    print_result(test_name, ok);
+}
+
+/*
+ * Test 3: bad arguments.
+ */
+static void
+test_phase_errors(void)
+{
+    const char *test_name = "errors";
+    char longname[PHASE_NAMELEN + 1];
+    int ok = 1;
+
+    if (op1(7, "test_phase.mark") != EINVAL ||
+        op1(PHASE_MARK | PHASE_PROF, "test_phase.mark") != EINVAL ||
+        op1(PHASE_ERASEPROF | PHASE_PROF, NULL) != EINVAL) {
+        printf("  Error: a bad op wasn't EINVAL\n");
+        ok = 0;
+    }
+    if (op1(PHASE_MARK, NULL) != EFAULT) {
+        printf("  Error: a NULL name wasn't EFAULT\n");
+        ok = 0;
+    }
+    memset(longname, 'x', sizeof(longname) - 1);
+    longname[sizeof(longname) - 1] = '\0';
+    if (op1(PHASE_MARK, longname) != ENAMETOOLONG) {
+        printf("  Error: a long name wasn't ENAMETOOLONG\n");
+        ok = 0;
+    }
+    longname[PHASE_NAMELEN - 1] = '\0';
+    if (op1(PHASE_MARK, longname) != 0) {
+        printf("  Error: a name of the longest length failed "
+               "(errno %d)\n", errno);
+        ok = 0;
+    }
+    print_result(test_name, ok);
+}
+
+int
+main(void)
+{
+    printf("phase Tests\n");
+
+    test_phase_basic();
+    test_phase_unmatched();
+    test_phase_errors();
+
+    printf("phase Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
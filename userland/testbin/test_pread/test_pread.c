@@ -0,0 +1,325 @@
+/*
+ * Tests for positional and vectored I/O: pread, pwrite, readv, writev;
+ * and O_DIRECT, which they go through here.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+
+#define TEST_FILE "pread_test.txt"
+#define TEST_DATA "0123456789abcdefghij"
+#define TEST_DATA_LEN 20
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+/* Create the test file with known contents; returns an O_RDWR fd */
+static int
+make_file(void)
+{
+    int fd;
+
+    fd = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("  Error: Could not create test file\n");
+        return -1;
+    }
+    if (write(fd, TEST_DATA, TEST_DATA_LEN) != TEST_DATA_LEN) {
+        printf("  Error: Could not write test file\n");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Test 1: pread reads at the given offset and leaves the file's
+ * offset where it was.
+ */
+static void
+test_pread_offset(void)
+{
+    const char *test_name = "pread at an offset";
+    char buf[8];
+    int fd, r;
+    off_t pos;
+
+    fd = make_file();
+    if (fd < 0) {
+        print_result(test_name, 0);
+        return;
+    }
+    lseek(fd, 2, SEEK_SET);
+
+    memset(buf, 0, sizeof(buf));
+    r = pread(fd, buf, 5, 10);
+    pos = lseek(fd, 0, SEEK_CUR);
+    close(fd);
+
+    if (r != 5 || memcmp(buf, "abcde", 5) != 0) {
+        printf("  Error: pread returned %d, '%s'\n", r, buf);
+        print_result(test_name, 0);
+        return;
+    }
+    if (pos != 2) {
+        printf("  Error: file offset moved to %d\n", (int)pos);
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 2: pwrite writes at the given offset without moving the
+ * file's offset; the next plain write goes where it would have.
+ */
+static void
+test_pwrite_offset(void)
+{
+    const char *test_name = "pwrite at an offset";
+    char buf[TEST_DATA_LEN + 1];
+    int fd, r;
+
+    fd = make_file();
+    if (fd < 0) {
+        print_result(test_name, 0);
+        return;
+    }
+    lseek(fd, 0, SEEK_SET);
+
+    r = pwrite(fd, "XYZ", 3, 15);
+    if (r != 3) {
+        printf("  Error: pwrite returned %d\n", r);
+        close(fd);
+        print_result(test_name, 0);
+        return;
+    }
+    write(fd, "AB", 2);
+
+    memset(buf, 0, sizeof(buf));
+    r = pread(fd, buf, TEST_DATA_LEN, 0);
+    close(fd);
+
+    if (r != TEST_DATA_LEN ||
+        memcmp(buf, "AB23456789abcdeXYZij", TEST_DATA_LEN) != 0) {
+        printf("  Error: file holds '%s'\n", buf);
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 3: readv fills the buffers in order from the file's offset
+ * and moves it by the total.
+ */
+static void
+test_readv(void)
+{
+    const char *test_name = "readv into three buffers";
+    char a[3], b[5], c[4];
+    struct iovec iov[3];
+    int fd, r;
+    off_t pos;
+
+    fd = make_file();
+    if (fd < 0) {
+        print_result(test_name, 0);
+        return;
+    }
+    lseek(fd, 1, SEEK_SET);
+
+    iov[0].iov_base = a;
+    iov[0].iov_len = sizeof(a);
+    iov[1].iov_base = b;
+    iov[1].iov_len = sizeof(b);
+    iov[2].iov_base = c;
+    iov[2].iov_len = sizeof(c);
+    r = readv(fd, iov, 3);
+    pos = lseek(fd, 0, SEEK_CUR);
+    close(fd);
+
+    if (r != 12 || memcmp(a, "123", 3) != 0 ||
+        memcmp(b, "45678", 5) != 0 || memcmp(c, "9abc", 4) != 0) {
+        printf("  Error: readv returned %d\n", r);
+        print_result(test_name, 0);
+        return;
+    }
+    if (pos != 13) {
+        printf("  Error: file offset is %d, expected 13\n", (int)pos);
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 4: writev writes the buffers out in order as one write.
+ */
+static void
+test_writev(void)
+{
+    const char *test_name = "writev from three buffers";
+    char buf[16];
+    struct iovec iov[3];
+    int fd, r;
+
+    fd = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("  Error: Could not create test file\n");
+        print_result(test_name, 0);
+        return;
+    }
+
+    iov[0].iov_base = (void *)"Hello";
+    iov[0].iov_len = 5;
+    iov[1].iov_base = (void *)", ";
+    iov[1].iov_len = 2;
+    iov[2].iov_base = (void *)"world";
+    iov[2].iov_len = 5;
+    r = writev(fd, iov, 3);
+
+    memset(buf, 0, sizeof(buf));
+    pread(fd, buf, sizeof(buf) - 1, 0);
+    close(fd);
+
+    if (r != 12 || strcmp(buf, "Hello, world") != 0) {
+        printf("  Error: writev returned %d, file holds '%s'\n", r, buf);
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 5: the errors. pread on the console can't seek, and readv
+ * takes at most IOV_MAX buffers.
+ */
+static void
+test_errors(void)
+{
+    const char *test_name = "pread on the console, readv with too many buffers";
+    struct iovec iov[1];
+    char buf[4];
+    int fd, r;
+
+    r = pread(STDIN_FILENO, buf, sizeof(buf), 0);
+    if (r >= 0 || errno != ESPIPE) {
+        printf("  Error: pread on stdin returned %d, expected ESPIPE\n", r);
+        print_result(test_name, 0);
+        return;
+    }
+
+    fd = make_file();
+    if (fd < 0) {
+        print_result(test_name, 0);
+        return;
+    }
+    iov[0].iov_base = buf;
+    iov[0].iov_len = sizeof(buf);
+    r = readv(fd, iov, IOV_MAX + 1);
+    close(fd);
+    if (r >= 0 || errno != EINVAL) {
+        printf("  Error: readv returned %d, expected EINVAL\n", r);
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 6: O_DIRECT. Data written through the cache is read back the
+ * same through an O_DIRECT handle, and what an O_DIRECT handle writes,
+ * in whole blocks, in pieces, and past the end, is what a cached read
+ * sees afterwards.
+ */
+#define DIRECT_LEN 4096
+
+static char direct_want[DIRECT_LEN + 1024];
+static char direct_got[DIRECT_LEN + 1024];
+
+static void
+test_direct(void)
+{
+    const char *test_name = "O_DIRECT reads and writes agree with the cache";
+    int fd, dfd, i, r1, r2, r3, r4;
+
+    for (i = 0; i < DIRECT_LEN; i++) {
+        direct_want[i] = 'a' + i % 26;
+    }
+    fd = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    dfd = open(TEST_FILE, O_RDWR | O_DIRECT);
+    if (fd < 0 || dfd < 0) {
+        printf("  Error: Could not open test file\n");
+        print_result(test_name, 0);
+        return;
+    }
+    write(fd, direct_want, DIRECT_LEN);
+
+    r1 = pread(dfd, direct_got, DIRECT_LEN, 0);
+    if (r1 != DIRECT_LEN || memcmp(direct_got, direct_want, DIRECT_LEN)) {
+        printf("  Error: O_DIRECT read returned %d, or the wrong data\n", r1);
+        close(fd);
+        close(dfd);
+        print_result(test_name, 0);
+        return;
+    }
+
+    memset(direct_want + 1024, 'B', 2048);
+    memset(direct_want + 100, 'u', 10);
+    memset(direct_want + DIRECT_LEN, 'C', 1024);
+    r1 = pwrite(dfd, direct_want + 1024, 2048, 1024);
+    r2 = pwrite(dfd, direct_want + 100, 10, 100);
+    r3 = pwrite(dfd, direct_want + DIRECT_LEN, 1024, DIRECT_LEN);
+    close(dfd);
+
+    r4 = pread(fd, direct_got, sizeof(direct_got), 0);
+    close(fd);
+    if (r1 != 2048 || r2 != 10 || r3 != 1024 ||
+        r4 != (int)sizeof(direct_got) ||
+        memcmp(direct_got, direct_want, sizeof(direct_got)) != 0) {
+        printf("  Error: O_DIRECT writes returned %d, %d, %d; "
+               "cached read returned %d, or the wrong data\n", r1, r2, r3, r4);
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+int
+main(void)
+{
+    printf("pread/pwrite/readv/writev Tests\n");
+
+    test_pread_offset();
+    test_pwrite_offset();
+    test_readv();
+    test_writev();
+    test_errors();
+    test_direct();
+    remove(TEST_FILE);
+
+    printf("pread/pwrite/readv/writev Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,250 @@
+/*
+ * Tests for profil() and the gprof-lite wrapper around it.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/gmon.h>
+
+/* How long to spin for, long enough for a good few ticks */
+#define SPIN_MS 500
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+/*
+ * Burn user time for MS milliseconds, reading the clock from the time
+ * page so that nearly all of it is spent in this function.
+ */
+static volatile unsigned spin_sink;
+
+static void
+hot_loop(unsigned ms)
+{
+    struct timespec start, now;
+    unsigned i, x;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &start);
+    x = 1;
+    do {
+        for (i = 0; i < 10000; i++) {
+            x = x * 31 + i;
+        }
+        spin_sink = x;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    } while ((now.tv_sec - start.tv_sec) * 1000 +
+             (now.tv_nsec - start.tv_nsec) / 1000000 < (long)ms);
+}
+
+/* Sum of all the counters */
+static unsigned long
+hist_total(const unsigned short *hist, size_t n)
+{
+    unsigned long total = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        total += hist[i];
+    }
+    return total;
+}
+
+/*
+ * Test 1: with a counter per instruction over the whole program,
+ * spinning puts the most ticks inside hot_loop.
+ */
+static void
+test_profil_hotspot(void)
+{
+    const char *test_name = "hotspot";
+    unsigned long lowpc, highpc, hot, total;
+    unsigned short *hist;
+    size_t n, i, max;
+
+    lowpc = (unsigned long)__start & ~3UL;
+    highpc = ((unsigned long)etext + 3) & ~3UL;
+    n = (highpc - lowpc) / 4;
+    hist = malloc(n * sizeof(hist[0]));
+    if (hist == NULL) {
+        printf("  Error: out of memory\n");
+        print_result(test_name, 0);
+        return;
+    }
+    bzero(hist, n * sizeof(hist[0]));
+
+    if (profil(hist, n * sizeof(hist[0]), lowpc, 0x8000) < 0) {
+        printf("  Error: profil failed (errno %d)\n", errno);
+        free(hist);
+        print_result(test_name, 0);
+        return;
+    }
+    hot_loop(SPIN_MS);
+    profil(NULL, 0, 0, 0);
+
+    total = hist_total(hist, n);
+    max = 0;
+    for (i = 1; i < n; i++) {
+        if (hist[i] > hist[max]) {
+            max = i;
+        }
+    }
+    free(hist);
+
+    if (total < 5) {
+        printf("  Error: only %lu ticks counted\n", total);
+        print_result(test_name, 0);
+        return;
+    }
+    /* hot_loop is small; the busiest instruction should be in it */
+    hot = (unsigned long)hot_loop;
+    if (lowpc + max * 4 < hot || lowpc + max * 4 >= hot + 256) {
+        printf("  Error: busiest pc 0x%lx is not in hot_loop (0x%lx)\n",
+               lowpc + max * 4, hot);
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 2: nothing is counted once profiling is turned off, and bad
+ * arguments are EINVAL.
+ */
+static void
+test_profil_off(void)
+{
+    const char *test_name = "off";
+    static unsigned short hist[64];
+    unsigned long lowpc;
+
+    lowpc = (unsigned long)hot_loop;
+    if (profil(hist, sizeof(hist), lowpc, 0x8000) < 0) {
+        printf("  Error: profil failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    if (profil(hist, sizeof(hist), lowpc, 0) < 0) {
+        printf("  Error: turning profil off failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    hot_loop(SPIN_MS / 5);
+    if (hist_total(hist, 64) != 0) {
+        printf("  Error: ticks counted with profiling off\n");
+        print_result(test_name, 0);
+        return;
+    }
+
+    if (profil(hist, sizeof(hist), lowpc, 0x20000) == 0 || errno != EINVAL) {
+        printf("  Error: scale 0x20000 wasn't EINVAL\n");
+        print_result(test_name, 0);
+        return;
+    }
+    if (profil((unsigned short *)((char *)hist + 1), sizeof(hist) - 2,
+               lowpc, 0x8000) == 0 || errno != EINVAL) {
+        printf("  Error: misaligned buffer wasn't EINVAL\n");
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 3: a histogram the process can't write just stops profiling;
+ * the process goes on.
+ */
+static void
+test_profil_badbuf(void)
+{
+    const char *test_name = "badbuf";
+
+    if (profil((unsigned short *)0x80000000, 0x10000,
+               (unsigned long)hot_loop, 0x8000) < 0) {
+        printf("  Error: profil failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    hot_loop(SPIN_MS / 5);
+    profil(NULL, 0, 0, 0);
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 4: monstartup and _mcleanup write the histogram out.
+ */
+static void
+test_profil_gmon(void)
+{
+    const char *test_name = "gmon";
+    char buf[128];
+    ssize_t len;
+    int fd;
+
+    remove(GMON_OUT);
+    if (MONSTARTUP_ALL() < 0) {
+        printf("  Error: monstartup failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    hot_loop(SPIN_MS / 2);
+    _mcleanup();
+
+    fd = open(GMON_OUT, O_RDONLY);
+    if (fd < 0) {
+        printf("  Error: %s wasn't written (errno %d)\n", GMON_OUT, errno);
+        print_result(test_name, 0);
+        return;
+    }
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    remove(GMON_OUT);
+    if (len <= 0) {
+        printf("  Error: %s is empty\n", GMON_OUT);
+        print_result(test_name, 0);
+        return;
+    }
+    buf[len] = 0;
+    /* A header, and at least one pc after it */
+    if (buf[0] != '#' || strchr(buf, '\n') == NULL ||
+        strchr(buf, '\n')[1] != '0') {
+        printf("  Error: %s doesn't look right\n", GMON_OUT);
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+int
+main(void)
+{
+    printf("profil Tests\n");
+
+    test_profil_hotspot();
+    test_profil_off();
+    test_profil_badbuf();
+    test_profil_gmon();
+
+    printf("profil Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,233 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+/* Set both limits on RESOURCE to LIM, or exit with status 100 */
+static void
+setlimit(int resource, rlim_t lim)
+{
+    struct rlimit rl;
+
+    rl.rlim_cur = rl.rlim_max = lim;
+    if (setrlimit(resource, &rl) < 0) {
+        _exit(100);
+    }
+}
+
+/*
+ * Run FUNC in a child, since limits can't be raised again once
+ * lowered, and return its wait status (or -1)
+ */
+static int
+run_child(void (*func)(void))
+{
+    pid_t pid;
+    int status;
+
+    pid = fork();
+    if (pid < 0) {
+        printf("  Error: fork failed (errno %d)\n", errno);
+        return -1;
+    }
+    if (pid == 0) {
+        func();
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) != pid) {
+        printf("  Error: waitpid failed (errno %d)\n", errno);
+        return -1;
+    }
+    return status;
+}
+
+/* Report a child that should have exited 0 */
+static void
+check_exit(const char *test_name, int status)
+{
+    if (status == -1) {
+        print_result(test_name, 0);
+        return;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("  Error: child failed (status 0x%x)\n", status);
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 1: RLIMIT_NOFILE
+ * With 4 descriptors and 0-2 open, one more open works and the next
+ * fails with EMFILE; dup2 past the limit fails with EBADF
+ */
+static void
+nofile_child(void)
+{
+    setlimit(RLIMIT_NOFILE, 4);
+    if (open("null:", O_RDONLY) != 3) {
+        _exit(1);
+    }
+    if (open("null:", O_RDONLY) >= 0 || errno != EMFILE) {
+        _exit(2);
+    }
+    if (dup2(0, 10) >= 0 || errno != EBADF) {
+        _exit(3);
+    }
+}
+
+static void
+test_rlimit_nofile(void)
+{
+    check_exit("RLIMIT_NOFILE limits descriptors", run_child(nofile_child));
+}
+
+/*
+ * Test 2: RLIMIT_NPROC
+ * With a limit of one process, this one, fork must fail with EMPROC
+ */
+static void
+nproc_child(void)
+{
+    pid_t pid;
+
+    setlimit(RLIMIT_NPROC, 1);
+    pid = fork();
+    if (pid == 0) {
+        _exit(0);
+    }
+    if (pid > 0 || errno != EMPROC) {
+        _exit(1);
+    }
+}
+
+static void
+test_rlimit_nproc(void)
+{
+    check_exit("RLIMIT_NPROC limits fork", run_child(nproc_child));
+}
+
+/*
+ * Test 3: RLIMIT_DATA and RLIMIT_AS
+ * Growing the heap past either must fail with ENOMEM
+ */
+static void
+mem_child(void)
+{
+    setlimit(RLIMIT_DATA, 64 * 1024);
+    if (sbrk(128 * 1024) != (void *)-1 || errno != ENOMEM) {
+        _exit(1);
+    }
+    setlimit(RLIMIT_DATA, RLIM_INFINITY);
+    setlimit(RLIMIT_AS, 4 * 1024 * 1024);
+    if (sbrk(8 * 1024 * 1024) != (void *)-1 || errno != ENOMEM) {
+        _exit(2);
+    }
+}
+
+static void
+test_rlimit_mem(void)
+{
+    check_exit("RLIMIT_DATA and RLIMIT_AS limit sbrk", run_child(mem_child));
+}
+
+/*
+ * Test 4: RLIMIT_CPU
+ * A child spinning past a one second limit must die with SIGXCPU
+ */
+static void
+cpu_child(void)
+{
+    volatile unsigned n = 0;
+    struct rlimit rl;
+
+    rl.rlim_cur = 1;
+    rl.rlim_max = 10;
+    if (setrlimit(RLIMIT_CPU, &rl) < 0) {
+        _exit(100);
+    }
+    while (1) {
+        n++;
+    }
+}
+
+static void
+test_rlimit_cpu(void)
+{
+    const char *test_name = "RLIMIT_CPU kills a spinning process";
+    int status;
+
+    status = run_child(cpu_child);
+    if (status == -1 || !WIFSIGNALED(status) ||
+        WTERMSIG(status) != SIGXCPU) {
+        printf("  Error: child was not killed by SIGXCPU\n");
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 5: Raising limits
+ * A lowered hard limit can't be raised again
+ */
+static void
+raise_child(void)
+{
+    struct rlimit rl;
+
+    setlimit(RLIMIT_NPROC, 64);
+    rl.rlim_cur = 64;
+    rl.rlim_max = 128;
+    if (setrlimit(RLIMIT_NPROC, &rl) == 0 || errno != EPERM) {
+        _exit(1);
+    }
+    if (getrlimit(RLIMIT_NPROC, &rl) < 0 || rl.rlim_max != 64) {
+        _exit(2);
+    }
+}
+
+static void
+test_rlimit_raise(void)
+{
+    check_exit("hard limits can't be raised", run_child(raise_child));
+}
+
+int
+main(void)
+{
+    printf("Resource Limit Tests\n");
+
+    test_rlimit_nofile();
+    test_rlimit_nproc();
+    test_rlimit_mem();
+    test_rlimit_cpu();
+    test_rlimit_raise();
+
+    printf("Resource Limit Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,216 @@
+/*
+ * Tests for sched_setscheduler and friends.
+ *
+ * These check the calls themselves; how much the real-time class
+ * helps is measured by testbin/rtlat.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/wait.h>
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+/* Set the policy; returns 0 or errno */
+static int
+setsched(int policy, int prio)
+{
+    struct sched_param sp;
+
+    sp.sched_priority = prio;
+    return sched_setscheduler(0, policy, &sp) < 0 ? errno : 0;
+}
+
+/* Whether the current policy and priority are POLICY and PRIO */
+static int
+issched(int policy, int prio)
+{
+    struct sched_param sp;
+
+    if (sched_getscheduler(0) != policy) {
+        return 0;
+    }
+    if (sched_getparam(0, &sp) < 0 || sp.sched_priority != prio) {
+        return 0;
+    }
+    return 1;
+}
+
+/* Run FUNC in a child; true if it exited 0 */
+static int
+run_child(int (*func)(void))
+{
+    pid_t pid;
+    int status;
+
+    pid = fork();
+    if (pid < 0) {
+        printf("  Error: fork failed (errno %d)\n", errno);
+        return 0;
+    }
+    if (pid == 0) {
+        _exit(func());
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+        return 0;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/*
+ * Test 1: we start time-sharing, can go real-time and back, and the
+ * calls say so.
+ */
+static void
+test_sched_set(void)
+{
+    const char *test_name = "set";
+    int ok = 1;
+
+    if (!issched(SCHED_OTHER, 0)) {
+        printf("  Error: didn't start as SCHED_OTHER\n");
+        ok = 0;
+    }
+    if (setsched(SCHED_FIFO, SCHED_PRIO_MAX) != 0 ||
+        !issched(SCHED_FIFO, SCHED_PRIO_MAX)) {
+        printf("  Error: couldn't go SCHED_FIFO\n");
+        ok = 0;
+    }
+    if (setsched(SCHED_RR, SCHED_PRIO_MIN) != 0 ||
+        !issched(SCHED_RR, SCHED_PRIO_MIN)) {
+        printf("  Error: couldn't go SCHED_RR\n");
+        ok = 0;
+    }
+    if (setsched(SCHED_OTHER, 0) != 0 || !issched(SCHED_OTHER, 0)) {
+        printf("  Error: couldn't go back to SCHED_OTHER\n");
+        ok = 0;
+    }
+    print_result(test_name, ok);
+}
+
+/*
+ * Test 2: bad policies, priorities and pids are refused.
+ */
+static void
+test_sched_bad(void)
+{
+    const char *test_name = "bad";
+    struct sched_param sp;
+    int ok = 1;
+
+    if (setsched(SCHED_FIFO, 0) != EINVAL ||
+        setsched(SCHED_RR, SCHED_PRIO_MAX + 1) != EINVAL) {
+        printf("  Error: out of range priority wasn't EINVAL\n");
+        ok = 0;
+    }
+    if (setsched(SCHED_OTHER, 1) != EINVAL) {
+        printf("  Error: SCHED_OTHER priority 1 wasn't EINVAL\n");
+        ok = 0;
+    }
+    if (setsched(42, 1) != EINVAL) {
+        printf("  Error: policy 42 wasn't EINVAL\n");
+        ok = 0;
+    }
+    sp.sched_priority = 0;
+    if (sched_setscheduler(getpid() + 1, SCHED_OTHER, &sp) == 0 ||
+        errno != ESRCH || sched_getscheduler(getpid() + 1) >= 0 ||
+        errno != ESRCH) {
+        printf("  Error: another pid wasn't ESRCH\n");
+        ok = 0;
+    }
+    if (!issched(SCHED_OTHER, 0)) {
+        printf("  Error: a refused call changed the policy\n");
+        ok = 0;
+    }
+    print_result(test_name, ok);
+}
+
+static int
+rlimit_child(void)
+{
+    struct rlimit rl;
+
+    rl.rlim_cur = rl.rlim_max = 2;
+    if (setrlimit(RLIMIT_RTPRIO, &rl) < 0) {
+        return 1;
+    }
+    if (setsched(SCHED_FIFO, 3) != EPERM) {
+        return 2;
+    }
+    if (setsched(SCHED_FIFO, 2) != 0) {
+        return 3;
+    }
+    /* Lower is always fine, and back up to the limit */
+    if (setsched(SCHED_FIFO, 1) != 0 || setsched(SCHED_RR, 2) != 0) {
+        return 4;
+    }
+    return issched(SCHED_RR, 2) ? 0 : 5;
+}
+
+/*
+ * Test 3: RLIMIT_RTPRIO caps the priority.
+ */
+static void
+test_sched_rlimit(void)
+{
+    print_result("rlimit", run_child(rlimit_child));
+}
+
+static int
+fork_child(void)
+{
+    return issched(SCHED_RR, 3) ? 0 : 1;
+}
+
+/*
+ * Test 4: a forked child is in its parent's class.
+ */
+static void
+test_sched_fork(void)
+{
+    const char *test_name = "fork";
+    int ok;
+
+    if (setsched(SCHED_RR, 3) != 0) {
+        printf("  Error: couldn't go SCHED_RR\n");
+        print_result(test_name, 0);
+        return;
+    }
+    ok = run_child(fork_child);
+    setsched(SCHED_OTHER, 0);
+    print_result(test_name, ok);
+}
+
+int
+main(void)
+{
+    printf("sched Tests\n");
+
+    test_sched_set();
+    test_sched_bad();
+    test_sched_rlimit();
+    test_sched_fork();
+
+    printf("sched Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
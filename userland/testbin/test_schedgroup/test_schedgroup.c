@@ -0,0 +1,307 @@
+/*
+ * Tests for scheduling groups: sched_setgroup, sched_settickets and
+ * friends.
+ *
+ * The share test puts everything on cpu 0 so that the groups have to
+ * split one cpu; it works the same on a machine with more.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/wait.h>
+
+/* How long the share test's spinners run for */
+#define SPIN_MS 2000
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+/* Run FUNC in a child; true if it exited 0 */
+static int
+run_child(int (*func)(void))
+{
+    pid_t pid;
+    int status;
+
+    pid = fork();
+    if (pid < 0) {
+        printf("  Error: fork failed (errno %d)\n", errno);
+        return 0;
+    }
+    if (pid == 0) {
+        _exit(func());
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+        return 0;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/*
+ * Test 1: we start in group 0 and every group starts with the default
+ * tickets, which group 0 can change.
+ */
+static void
+test_schedgroup_get(void)
+{
+    const char *test_name = "get";
+    int i, ok = 1;
+
+    if (sched_getgroup() != 0) {
+        printf("  Error: didn't start in group 0\n");
+        ok = 0;
+    }
+    for (i = 0; i < SCHED_NGROUPS; i++) {
+        if (sched_gettickets(i) != SCHED_TICKETS_DEFAULT) {
+            printf("  Error: group %d has %d tickets\n", i,
+                   sched_gettickets(i));
+            ok = 0;
+        }
+    }
+    if (sched_settickets(3, 250) < 0 || sched_gettickets(3) != 250) {
+        printf("  Error: couldn't set group 3's tickets\n");
+        ok = 0;
+    }
+    sched_settickets(3, SCHED_TICKETS_DEFAULT);
+    print_result(test_name, ok);
+}
+
+static int
+bad_child(void)
+{
+    if (sched_setgroup(1) < 0 || sched_getgroup() != 1) {
+        return 1;
+    }
+    /* Staying put is fine; leaving isn't, nor are tickets */
+    if (sched_setgroup(1) < 0) {
+        return 2;
+    }
+    if (sched_setgroup(2) == 0 || errno != EPERM ||
+        sched_setgroup(0) == 0 || errno != EPERM) {
+        return 3;
+    }
+    if (sched_settickets(1, 1000) == 0 || errno != EPERM) {
+        return 4;
+    }
+    return sched_getgroup() == 1 &&
+        sched_gettickets(1) == SCHED_TICKETS_DEFAULT ? 0 : 5;
+}
+
+/*
+ * Test 2: bad groups and tickets are refused, and a thread outside
+ * group 0 can neither leave its group nor set tickets.
+ */
+static void
+test_schedgroup_bad(void)
+{
+    const char *test_name = "bad";
+    int ok = 1;
+
+    if (sched_setgroup(-1) == 0 || errno != EINVAL ||
+        sched_setgroup(SCHED_NGROUPS) == 0 || errno != EINVAL) {
+        printf("  Error: bad group wasn't EINVAL\n");
+        ok = 0;
+    }
+    if (sched_settickets(1, 0) == 0 || errno != EINVAL ||
+        sched_settickets(1, SCHED_TICKETS_MAX + 1) == 0 || errno != EINVAL ||
+        sched_gettickets(SCHED_NGROUPS) >= 0 || errno != EINVAL) {
+        printf("  Error: bad tickets weren't EINVAL\n");
+        ok = 0;
+    }
+    if (!run_child(bad_child)) {
+        printf("  Error: group rules not enforced\n");
+        ok = 0;
+    }
+    if (sched_getgroup() != 0) {
+        printf("  Error: the child's group leaked to the parent\n");
+        ok = 0;
+    }
+    print_result(test_name, ok);
+}
+
+static int
+grandchild(void)
+{
+    return sched_getgroup() == 2 ? 0 : 1;
+}
+
+static int
+fork_child(void)
+{
+    if (sched_setgroup(2) < 0) {
+        return 1;
+    }
+    return run_child(grandchild) ? 0 : 2;
+}
+
+/*
+ * Test 3: a forked child is in its parent's group.
+ */
+static void
+test_schedgroup_fork(void)
+{
+    print_result("fork", run_child(fork_child));
+}
+
+/* Milliseconds of user and system time we've used */
+static unsigned
+cpu_ms(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) < 0) {
+        return 0;
+    }
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000 +
+        (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000;
+}
+
+static unsigned
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Join GROUP, spin until END, and write our cpu time to FD */
+static void
+spinner(int group, unsigned end, int fd)
+{
+    volatile unsigned x = 0;
+    unsigned i, ms;
+
+    if (sched_setgroup(group) < 0) {
+        _exit(1);
+    }
+    while (now_ms() < end) {
+        for (i = 0; i < 10000; i++) {
+            x += i;
+        }
+    }
+    ms = cpu_ms();
+    write(fd, &group, sizeof(group));
+    write(fd, &ms, sizeof(ms));
+    _exit(0);
+}
+
+/*
+ * Test 4: one spinner in group 1 against four in group 2, with equal
+ * tickets, get about half the cpu each; per thread, group 1's would
+ * get a fifth. Then with group 1 at three times group 2's tickets it
+ * should get about three quarters.
+ */
+static int
+share_run(unsigned tickets1, unsigned *share)
+{
+    unsigned used[2], end, ms;
+    int fds[2], group, i, status;
+    pid_t pids[5];
+
+    if (sched_settickets(1, tickets1) < 0 ||
+        sched_settickets(2, SCHED_TICKETS_DEFAULT) < 0 || pipe(fds) < 0) {
+        return -1;
+    }
+    end = now_ms() + SPIN_MS;
+    for (i = 0; i < 5; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            return -1;
+        }
+        if (pids[i] == 0) {
+            close(fds[0]);
+            spinner(i == 0 ? 1 : 2, end, fds[1]);
+        }
+    }
+    close(fds[1]);
+
+    used[0] = used[1] = 0;
+    while (read(fds[0], &group, sizeof(group)) == sizeof(group) &&
+           read(fds[0], &ms, sizeof(ms)) == sizeof(ms)) {
+        used[group - 1] += ms;
+    }
+    close(fds[0]);
+    for (i = 0; i < 5; i++) {
+        waitpid(pids[i], &status, 0);
+    }
+    if (used[0] + used[1] == 0) {
+        return -1;
+    }
+    *share = used[0] * 100 / (used[0] + used[1]);
+    return 0;
+}
+
+static void
+test_schedgroup_share(void)
+{
+    const char *test_name = "share";
+    cpu_set_t set, old;
+    unsigned even, weighted;
+    int ok = 1;
+
+    if (sched_getaffinity(0, sizeof(old), &old) < 0) {
+        printf("  Error: sched_getaffinity failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(0, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+
+    if (share_run(SCHED_TICKETS_DEFAULT, &even) < 0 ||
+        share_run(3 * SCHED_TICKETS_DEFAULT, &weighted) < 0) {
+        printf("  Error: couldn't run the spinners\n");
+        ok = 0;
+    }
+    else {
+        printf("  group 1 got %u%% with equal tickets, %u%% with 3x\n",
+               even, weighted);
+        if (even < 35 || even > 65) {
+            printf("  Error: equal tickets should be about 50%%\n");
+            ok = 0;
+        }
+        if (weighted < 60 || weighted > 90) {
+            printf("  Error: 3x tickets should be about 75%%\n");
+            ok = 0;
+        }
+    }
+
+    sched_settickets(1, SCHED_TICKETS_DEFAULT);
+    sched_setaffinity(0, sizeof(old), &old);
+    print_result(test_name, ok);
+}
+
+int
+main(void)
+{
+    printf("schedgroup Tests\n");
+
+    test_schedgroup_get();
+    test_schedgroup_bad();
+    test_schedgroup_fork();
+    test_schedgroup_share();
+
+    printf("schedgroup Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
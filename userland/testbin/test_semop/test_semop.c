@@ -0,0 +1,227 @@
+/*
+ * Tests for semop on semfs (sem:) semaphores.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define SEM_A "sem:test_semop.a"
+#define SEM_B "sem:test_semop.b"
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+/* Make a semaphore with count 0 and open it read-write */
+static int
+make_sem(const char *name)
+{
+    int fd;
+
+    fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0664);
+    if (fd < 0) {
+        printf("  Error: create %s failed (errno %d)\n", name, errno);
+    }
+    return fd;
+}
+
+/* The count, from fstat */
+static long
+sem_count(int fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) < 0) {
+        return -1;
+    }
+    return (long)st.st_size;
+}
+
+/* One operation; returns 0 or errno */
+static int
+op1(int fd, int delta)
+{
+    struct sembuf sb;
+
+    sb.sem_fd = fd;
+    sb.sem_op = delta;
+    return semop(&sb, 1) < 0 ? errno : 0;
+}
+
+/*
+ * Test 1: V and P change the count, and agree with read and write.
+ */
+static void
+test_semop_basic(void)
+{
+    const char *test_name = "basic";
+    char c = 0;
+    int fd, ok = 1;
+
+    fd = make_sem(SEM_A);
+    if (fd < 0) {
+        print_result(test_name, 0);
+        return;
+    }
+    if (op1(fd, 5) != 0 || sem_count(fd) != 5) {
+        printf("  Error: V of 5 didn't make the count 5\n");
+        ok = 0;
+    }
+    if (op1(fd, -3) != 0 || sem_count(fd) != 2) {
+        printf("  Error: P of 3 didn't leave 2\n");
+        ok = 0;
+    }
+    if (read(fd, &c, 1) != 1 || write(fd, &c, 1) != 1 ||
+        op1(fd, -2) != 0 || sem_count(fd) != 0) {
+        printf("  Error: read and write didn't mix with semop\n");
+        ok = 0;
+    }
+    close(fd);
+    print_result(test_name, ok);
+}
+
+/*
+ * Test 2: a batch waits until all of it can go, and then takes it
+ * all; a V on the same semaphore in the batch counts.
+ */
+static void
+test_semop_batch(void)
+{
+    const char *test_name = "batch";
+    struct sembuf sb[3];
+    struct timespec ts;
+    pid_t pid;
+    int a, b, status, ok = 1;
+
+    a = make_sem(SEM_A);
+    b = make_sem(SEM_B);
+    if (a < 0 || b < 0) {
+        print_result(test_name, 0);
+        return;
+    }
+    op1(a, 2);
+
+    pid = fork();
+    if (pid < 0) {
+        printf("  Error: fork failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    if (pid == 0) {
+        /* Needs 2 of a and 1 of b; b has none yet */
+        sb[0].sem_fd = a;
+        sb[0].sem_op = -2;
+        sb[1].sem_fd = b;
+        sb[1].sem_op = -2;
+        sb[2].sem_fd = b;
+        sb[2].sem_op = 1;
+        _exit(semop(sb, 3) < 0 ? 1 : 0);
+    }
+
+    /* Until b is posted, the child must take nothing from a */
+    ts.tv_sec = 1;
+    ts.tv_nsec = 0;
+    nanosleep(&ts, NULL);
+    if (sem_count(a) != 2) {
+        printf("  Error: a partly satisfied batch took from a\n");
+        ok = 0;
+    }
+    op1(b, 1);
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        printf("  Error: the batch didn't complete\n");
+        ok = 0;
+    }
+    if (sem_count(a) != 0 || sem_count(b) != 0) {
+        printf("  Error: counts are %ld and %ld, not 0 and 0\n",
+               sem_count(a), sem_count(b));
+        ok = 0;
+    }
+    close(a);
+    close(b);
+    print_result(test_name, ok);
+}
+
+/*
+ * Test 3: bad arguments are refused, and change nothing.
+ */
+static void
+test_semop_errors(void)
+{
+    const char *test_name = "errors";
+    struct sembuf sb[SEMOP_MAX + 1];
+    int fd, rfd, ok = 1;
+
+    fd = make_sem(SEM_A);
+    rfd = open(SEM_A, O_RDONLY);
+    if (fd < 0 || rfd < 0) {
+        print_result(test_name, 0);
+        return;
+    }
+    if (op1(-1, 1) != EBADF || op1(100, 1) != EBADF) {
+        printf("  Error: a bad fd wasn't EBADF\n");
+        ok = 0;
+    }
+    if (op1(rfd, 1) != EBADF) {
+        printf("  Error: V on a read-only fd wasn't EBADF\n");
+        ok = 0;
+    }
+    if (op1(STDOUT_FILENO, 1) != EINVAL) {
+        printf("  Error: V on the console wasn't EINVAL\n");
+        ok = 0;
+    }
+    if (semop(sb, 0) == 0 || errno != EINVAL ||
+        semop(sb, SEMOP_MAX + 1) == 0 || errno != EINVAL) {
+        printf("  Error: a bad count wasn't EINVAL\n");
+        ok = 0;
+    }
+    if (semop(NULL, 1) == 0 || errno != EFAULT) {
+        printf("  Error: a NULL pointer wasn't EFAULT\n");
+        ok = 0;
+    }
+    sb[0].sem_fd = fd;
+    sb[0].sem_op = 1;
+    sb[1].sem_fd = STDOUT_FILENO;
+    sb[1].sem_op = 1;
+    if (semop(sb, 2) == 0 || sem_count(fd) != 0) {
+        printf("  Error: a failed batch changed the count\n");
+        ok = 0;
+    }
+    close(rfd);
+    close(fd);
+    print_result(test_name, ok);
+}
+
+int
+main(void)
+{
+    printf("semop Tests\n");
+
+    test_semop_basic();
+    test_semop_batch();
+    test_semop_errors();
+    remove(SEM_A);
+    remove(SEM_B);
+
+    printf("semop Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define TEST_FILE "spawn_test.txt"
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+/*
+ * Test 1: Basic posix_spawn
+ * Spawns /bin/true and /bin/false and checks their exit codes
+ */
+static void
+test_spawn_basic(void)
+{
+    const char *test_name = "posix_spawn runs a program";
+    char *args[2];
+    pid_t pid;
+    int status, r;
+
+    args[0] = (char *)"true";
+    args[1] = NULL;
+    r = posix_spawn(&pid, "/bin/true", NULL, NULL, args, NULL);
+    if (r != 0 || waitpid(pid, &status, 0) != pid ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("  Error: /bin/true failed (error %d)\n", r);
+        print_result(test_name, 0);
+        return;
+    }
+
+    args[0] = (char *)"false";
+    r = posix_spawn(&pid, "/bin/false", NULL, NULL, args, NULL);
+    if (r != 0 || waitpid(pid, &status, 0) != pid ||
+        !WIFEXITED(status) || WEXITSTATUS(status) == 0) {
+        printf("  Error: /bin/false did not fail (error %d)\n", r);
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 2: Spawning a missing program
+ * Must fail with ENOENT in the parent, leaving no child behind
+ */
+static void
+test_spawn_missing(void)
+{
+    const char *test_name = "posix_spawn of a missing program fails";
+    char *args[2];
+    pid_t pid;
+    int status, r;
+
+    args[0] = (char *)"nonexistent";
+    args[1] = NULL;
+    r = posix_spawn(&pid, "/bin/nonexistent", NULL, NULL, args, NULL);
+    if (r != ENOENT) {
+        printf("  Error: returned %d, expected ENOENT\n", r);
+        print_result(test_name, 0);
+        return;
+    }
+    if (waitpid(-1, &status, WNOHANG) >= 0) {
+        printf("  Error: a child was left behind\n");
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 3: File actions
+ * Redirects the child's stdout into a file, then checks that the
+ * file got the output and that our own stdout was left alone
+ */
+static void
+test_spawn_redirect(void)
+{
+    const char *test_name = "posix_spawn with redirected stdout";
+    posix_spawn_file_actions_t fa;
+    char *args[2];
+    char buf[64];
+    pid_t pid;
+    int status, r, fd;
+    ssize_t len;
+
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, TEST_FILE,
+                                     O_WRONLY | O_CREAT | O_TRUNC, 0664);
+
+    args[0] = (char *)"pwd";
+    args[1] = NULL;
+    r = posix_spawn(&pid, "/bin/pwd", &fa, NULL, args, NULL);
+    posix_spawn_file_actions_destroy(&fa);
+    if (r != 0) {
+        printf("  Error: posix_spawn failed (error %d)\n", r);
+        print_result(test_name, 0);
+        return;
+    }
+    waitpid(pid, &status, 0);
+
+    fd = open(TEST_FILE, O_RDONLY);
+    if (fd < 0) {
+        printf("  Error: output file missing\n");
+        print_result(test_name, 0);
+        return;
+    }
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    remove(TEST_FILE);
+
+    if (len <= 0) {
+        printf("  Error: no output was redirected\n");
+        print_result(test_name, 0);
+        return;
+    }
+    buf[len] = 0;
+    printf("  Child wrote: %s", buf);
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 4: Failing file action
+ * Closing a descriptor that isn't open must fail the spawn
+ */
+static void
+test_spawn_badaction(void)
+{
+    const char *test_name = "posix_spawn with a bad file action fails";
+    posix_spawn_file_actions_t fa;
+    char *args[2];
+    pid_t pid;
+    int r;
+
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addclose(&fa, 50);
+
+    args[0] = (char *)"true";
+    args[1] = NULL;
+    r = posix_spawn(&pid, "/bin/true", &fa, NULL, args, NULL);
+    posix_spawn_file_actions_destroy(&fa);
+    if (r != EBADF) {
+        printf("  Error: returned %d, expected EBADF\n", r);
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+int
+main(void)
+{
+    printf("posix_spawn Tests\n");
+
+    test_spawn_basic();
+    test_spawn_missing();
+    test_spawn_redirect();
+    test_spawn_badaction();
+
+    printf("posix_spawn Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,199 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* Stack used by each level of recurse() */
+#define FRAMESIZE 1024
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+/*
+ * Use about DEPTH * FRAMESIZE bytes of stack, touching all of it, and
+ * return a checksum that depends on every frame.
+ */
+static unsigned
+recurse(unsigned depth)
+{
+    volatile char frame[FRAMESIZE];
+    unsigned sum;
+
+    memset((char *)frame, depth & 0xff, sizeof(frame));
+    if (depth == 0) {
+        return frame[0];
+    }
+    sum = recurse(depth - 1);
+    return sum + frame[FRAMESIZE - 1];
+}
+
+/* The checksum recurse(DEPTH) should come up with */
+static unsigned
+expected(unsigned depth)
+{
+    unsigned i, sum;
+
+    sum = 0;
+    for (i = 0; i <= depth; i++) {
+        sum += i & 0xff;
+    }
+    return sum;
+}
+
+/*
+ * Test 1: The default limit
+ * Must be set, and no more than the hard limit
+ */
+static void
+test_stack_getlimit(void)
+{
+    const char *test_name = "getrlimit reports a stack limit";
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_STACK, &rl) < 0) {
+        printf("  Error: getrlimit failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    if (rl.rlim_cur == 0 || rl.rlim_cur > rl.rlim_max) {
+        printf("  Error: bad limits %llu/%llu\n",
+               (unsigned long long)rl.rlim_cur,
+               (unsigned long long)rl.rlim_max);
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 2: Deep recursion
+ * Uses 512K of stack, far more than the stack starts out with
+ */
+static void
+test_stack_grow(void)
+{
+    const char *test_name = "stack grows for deep recursion";
+
+    if (recurse(512) != expected(512)) {
+        printf("  Error: wrong checksum\n");
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 3: Bad limits
+ * Soft above hard must fail with EINVAL, and a lowered hard limit
+ * can't be raised again (in a child, so as to keep ours)
+ */
+static void
+test_stack_badlimit(void)
+{
+    const char *test_name = "setrlimit rejects bad limits";
+    struct rlimit rl;
+    pid_t pid;
+    int status;
+
+    rl.rlim_cur = 128 * 1024;
+    rl.rlim_max = 64 * 1024;
+    if (setrlimit(RLIMIT_STACK, &rl) == 0 || errno != EINVAL) {
+        printf("  Error: soft above hard was allowed\n");
+        print_result(test_name, 0);
+        return;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        printf("  Error: fork failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    if (pid == 0) {
+        rl.rlim_cur = rl.rlim_max = 64 * 1024;
+        if (setrlimit(RLIMIT_STACK, &rl) < 0) {
+            _exit(1);
+        }
+        rl.rlim_max = 128 * 1024;
+        if (setrlimit(RLIMIT_STACK, &rl) == 0 || errno != EPERM) {
+            _exit(2);
+        }
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        printf("  Error: child reported failure\n");
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 4: Running into the limit
+ * With a 64K limit, recursing through 256K must kill the child with
+ * SIGSEGV instead of running into whatever lies below the stack
+ */
+static void
+test_stack_overflow(void)
+{
+    const char *test_name = "stack overflow past the limit faults";
+    struct rlimit rl;
+    pid_t pid;
+    int status;
+
+    pid = fork();
+    if (pid < 0) {
+        printf("  Error: fork failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    if (pid == 0) {
+        rl.rlim_cur = rl.rlim_max = 64 * 1024;
+        if (setrlimit(RLIMIT_STACK, &rl) < 0) {
+            _exit(1);
+        }
+        recurse(256);
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) != pid || !WIFSIGNALED(status) ||
+        WTERMSIG(status) != SIGSEGV) {
+        printf("  Error: child was not killed by SIGSEGV\n");
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+int
+main(void)
+{
+    printf("Stack Growth Tests\n");
+
+    test_stack_getlimit();
+    test_stack_grow();
+    test_stack_badlimit();
+    test_stack_overflow();
+
+    printf("Stack Growth Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
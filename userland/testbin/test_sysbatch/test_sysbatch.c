@@ -0,0 +1,221 @@
+/*
+ * Tests for syscall_batch.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <kern/syscall.h>
+
+#define TESTFILE "test_sysbatch.tmp"
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+/* Fill in SBC as a call to CALLNO with up to three arguments */
+static void
+setcall(struct sysbatch *sbc, int callno, uint32_t a0, uint32_t a1,
+        uint32_t a2)
+{
+    memset(sbc, 0, sizeof(*sbc));
+    sbc->sbc_callno = callno;
+    sbc->sbc_args[0] = a0;
+    sbc->sbc_args[1] = a1;
+    sbc->sbc_args[2] = a2;
+    sbc->sbc_error = -1;
+}
+
+/* Take argument 0 of SBC from the result of call FROM */
+static void
+usefd(struct sysbatch *sbc, unsigned from)
+{
+    sbc->sbc_useret = 1;
+    sbc->sbc_retfrom = from;
+}
+
+/*
+ * Test 1: independent calls all run, each with its own result.
+ */
+static void
+test_sysbatch_basic(void)
+{
+    const char *test_name = "basic";
+    struct sysbatch b[3];
+    char buf[8];
+    int fds[2];
+    int ok = 1;
+
+    if (pipe(fds) < 0) {
+        printf("  Error: pipe failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    setcall(&b[0], SYS_getpid, 0, 0, 0);
+    setcall(&b[1], SYS_write, fds[1], (uint32_t)"hello", 5);
+    setcall(&b[2], SYS_read, fds[0], (uint32_t)buf, sizeof(buf));
+    if (syscall_batch(b, 3) != 3) {
+        printf("  Error: didn't make 3 calls (errno %d)\n", errno);
+        ok = 0;
+    }
+    else if (b[0].sbc_error != 0 || b[0].sbc_retval[0] != getpid()) {
+        printf("  Error: getpid gave %d (error %d)\n",
+               b[0].sbc_retval[0], b[0].sbc_error);
+        ok = 0;
+    }
+    else if (b[1].sbc_error != 0 || b[1].sbc_retval[0] != 5 ||
+             b[2].sbc_error != 0 || b[2].sbc_retval[0] != 5 ||
+             memcmp(buf, "hello", 5) != 0) {
+        printf("  Error: write/read through the pipe went wrong\n");
+        ok = 0;
+    }
+    close(fds[0]);
+    close(fds[1]);
+    print_result(test_name, ok);
+}
+
+/*
+ * Test 2: open, use and close a file in one batch each way, passing
+ * the descriptor along with sbc_useret.
+ */
+static void
+test_sysbatch_chain(void)
+{
+    const char *test_name = "chain";
+    struct sysbatch b[3];
+    char buf[16];
+    int ok = 1;
+
+    setcall(&b[0], SYS_open, (uint32_t)TESTFILE,
+            O_WRONLY | O_CREAT | O_TRUNC, 0664);
+    setcall(&b[1], SYS_write, 0, (uint32_t)"batched", 7);
+    usefd(&b[1], 0);
+    setcall(&b[2], SYS_close, 0, 0, 0);
+    usefd(&b[2], 0);
+    if (syscall_batch(b, 3) != 3 || b[2].sbc_error != 0 ||
+        b[1].sbc_retval[0] != 7) {
+        printf("  Error: open/write/close batch failed\n");
+        ok = 0;
+    }
+
+    memset(buf, 0, sizeof(buf));
+    setcall(&b[0], SYS_open, (uint32_t)TESTFILE, O_RDONLY, 0);
+    setcall(&b[1], SYS_read, 0, (uint32_t)buf, sizeof(buf));
+    usefd(&b[1], 0);
+    setcall(&b[2], SYS_close, 0, 0, 0);
+    usefd(&b[2], 0);
+    if (syscall_batch(b, 3) != 3 || b[2].sbc_error != 0 ||
+        b[1].sbc_retval[0] != 7 || memcmp(buf, "batched", 7) != 0) {
+        printf("  Error: open/read/close batch failed\n");
+        ok = 0;
+    }
+    remove(TESTFILE);
+    print_result(test_name, ok);
+}
+
+/*
+ * Test 3: the first failure stops the batch.
+ */
+static void
+test_sysbatch_stop(void)
+{
+    const char *test_name = "stop";
+    struct sysbatch b[3];
+    int ok = 1;
+
+    setcall(&b[0], SYS_getpid, 0, 0, 0);
+    setcall(&b[1], SYS_close, (uint32_t)-1, 0, 0);
+    setcall(&b[2], SYS_getpid, 0, 0, 0);
+    if (syscall_batch(b, 3) != 2) {
+        printf("  Error: didn't stop after the second call\n");
+        ok = 0;
+    }
+    if (b[0].sbc_error != 0 || b[1].sbc_error != EBADF) {
+        printf("  Error: results were %d, %d\n",
+               b[0].sbc_error, b[1].sbc_error);
+        ok = 0;
+    }
+    if (b[2].sbc_error != -1) {
+        printf("  Error: the third call was touched\n");
+        ok = 0;
+    }
+    print_result(test_name, ok);
+}
+
+/*
+ * Test 4: bad batches and calls that can't be batched are refused.
+ */
+static void
+test_sysbatch_bad(void)
+{
+    const char *test_name = "bad";
+    struct sysbatch b[SYSBATCH_MAX + 1];
+    int ok = 1;
+
+    setcall(&b[0], SYS_getpid, 0, 0, 0);
+    if (syscall_batch(b, 0) >= 0 || errno != EINVAL ||
+        syscall_batch(b, SYSBATCH_MAX + 1) >= 0 || errno != EINVAL) {
+        printf("  Error: bad count wasn't EINVAL\n");
+        ok = 0;
+    }
+    if (syscall_batch(NULL, 1) >= 0 || errno != EFAULT) {
+        printf("  Error: NULL batch wasn't EFAULT\n");
+        ok = 0;
+    }
+
+    setcall(&b[0], SYS_fork, 0, 0, 0);
+    if (syscall_batch(b, 1) != 1 || b[0].sbc_error != EINVAL) {
+        printf("  Error: fork in a batch wasn't EINVAL\n");
+        ok = 0;
+    }
+    setcall(&b[0], SYS_syscall_batch, (uint32_t)&b[1], 1, 0);
+    setcall(&b[1], SYS_getpid, 0, 0, 0);
+    if (syscall_batch(b, 1) != 1 || b[0].sbc_error != EINVAL) {
+        printf("  Error: nested batch wasn't EINVAL\n");
+        ok = 0;
+    }
+    setcall(&b[0], SYS_close, 0, 0, 0);
+    usefd(&b[0], 0);
+    if (syscall_batch(b, 1) != 1 || b[0].sbc_error != EINVAL) {
+        printf("  Error: result of a later call wasn't EINVAL\n");
+        ok = 0;
+    }
+    setcall(&b[0], -1, 0, 0, 0);
+    if (syscall_batch(b, 1) != 1 || b[0].sbc_error != ENOSYS) {
+        printf("  Error: unknown call wasn't ENOSYS\n");
+        ok = 0;
+    }
+    print_result(test_name, ok);
+}
+
+int
+main(void)
+{
+    printf("sysbatch Tests\n");
+
+    test_sysbatch_basic();
+    test_sysbatch_chain();
+    test_sysbatch_stop();
+    test_sysbatch_bad();
+
+    printf("sysbatch Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
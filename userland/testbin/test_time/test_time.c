@@ -0,0 +1,203 @@
+/*
+ * Tests for time() and clock_gettime(), which read the kernel's time
+ * page instead of making a system call.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <kern/timepage.h>
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+static void
+print_result(const char *test_name, int passed)
+{
+    if (passed) {
+        printf("[PASS] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[FAIL] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+/* Nanoseconds from A to B */
+static long long
+diff_ns(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1000000000LL +
+        (b->tv_nsec - a->tv_nsec);
+}
+
+/*
+ * Test 1: time() agrees with __time to within a second, and
+ * CLOCK_REALTIME_COARSE with it to within a tick or so.
+ */
+static void
+test_time_realtime(void)
+{
+    const char *test_name = "realtime";
+    struct timespec ts, sys;
+    unsigned long nsec;
+    time_t t, t2, secs;
+
+    t = time(&t2);
+    if (t != t2) {
+        printf("  Error: time() returned %lld but stored %lld\n",
+               (long long)t, (long long)t2);
+        print_result(test_name, 0);
+        return;
+    }
+    /* Page first: it can only be behind the clock read after it */
+    if (clock_gettime(CLOCK_REALTIME_COARSE, &ts) < 0 ||
+        __time(&secs, &nsec) < 0) {
+        printf("  Error: reading the clock failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    sys.tv_sec = secs;
+    sys.tv_nsec = nsec;
+    if (secs - t > 1 || t > secs) {
+        printf("  Error: time() is %lld, __time %lld\n",
+               (long long)t, (long long)secs);
+        print_result(test_name, 0);
+        return;
+    }
+    /* The page is up to a tick behind; allow plenty */
+    if (diff_ns(&ts, &sys) > 100000000LL || diff_ns(&sys, &ts) > 0) {
+        printf("  Error: CLOCK_REALTIME_COARSE is %lldns from __time\n",
+               diff_ns(&sys, &ts));
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 2: CLOCK_MONOTONIC never goes back, and moves on across a
+ * sleep by about as long as the sleep.
+ */
+static void
+test_time_monotonic(void)
+{
+    const char *test_name = "monotonic";
+    struct timespec a, b, nap;
+    int i;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &a) < 0) {
+        printf("  Error: clock_gettime failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    for (i = 0; i < 10000; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &b);
+        if (diff_ns(&a, &b) < 0) {
+            printf("  Error: monotonic clock went back\n");
+            print_result(test_name, 0);
+            return;
+        }
+        a = b;
+    }
+
+    nap.tv_sec = 0;
+    nap.tv_nsec = 200000000;
+    nanosleep(&nap, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    if (diff_ns(&a, &b) < 150000000LL) {
+        printf("  Error: only %lldns passed in a 200ms sleep\n",
+               diff_ns(&a, &b));
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 3: the coarse monotonic clock, from the time page, trails the
+ * fine one by no more than a tick or so.
+ */
+static void
+test_time_coarse(void)
+{
+    const char *test_name = "coarse";
+    struct timespec coarse, fine;
+    long long lag;
+
+    if (clock_gettime(CLOCK_MONOTONIC_COARSE, &coarse) < 0 ||
+        clock_gettime(CLOCK_MONOTONIC, &fine) < 0) {
+        printf("  Error: clock_gettime failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    /* A millisecond's grace either way for cpus' differing bases */
+    lag = diff_ns(&coarse, &fine);
+    if (lag < -1000000LL || lag > 100000000LL) {
+        printf("  Error: coarse clock is %lldns behind\n", lag);
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 4: an unknown clock is EINVAL, and the time page can't be
+ * written.
+ */
+static void
+test_time_errors(void)
+{
+    const char *test_name = "errors";
+    struct timespec ts;
+    pid_t pid;
+    int status;
+
+    if (clock_gettime(99, &ts) == 0 || errno != EINVAL) {
+        printf("  Error: clock 99 wasn't EINVAL\n");
+        print_result(test_name, 0);
+        return;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        printf("  Error: fork failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    if (pid == 0) {
+        *(volatile unsigned *)TIMEPAGE_VADDR = 0;
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) != pid) {
+        printf("  Error: waitpid failed (errno %d)\n", errno);
+        print_result(test_name, 0);
+        return;
+    }
+    if (!WIFSIGNALED(status)) {
+        printf("  Error: writing the time page didn't fault\n");
+        print_result(test_name, 0);
+        return;
+    }
+    print_result(test_name, 1);
+}
+
+int
+main(void)
+{
+    printf("time Tests\n");
+
+    test_time_realtime();
+    test_time_monotonic();
+    test_time_coarse();
+    test_time_errors();
+
+    printf("time Test Summary:\n");
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Total:  %d\n", tests_passed + tests_failed);
+
+    return (tests_failed == 0) ? 0 : 1;
+}
@@ -88,17 +88,17 @@ test_waitpid_invalid_pid(void)
 }
 
 /*
- * Test 3: waitpid with negative PID (should fail)
- * Tests error handling for invalid PID value
+ * Test 3: waitpid for any child with no children (should fail)
+ * PID -1 means any child, but there are none left to wait for
  */
 static void
 test_waitpid_negative_pid(void)
 {
-    const char *test_name = "waitpid with negative PID (should fail)";
+    const char *test_name = "waitpid(-1) with no children (should fail)";
     int status;
     pid_t result;
     
-    /* Try to wait for negative PID */
+    /* Try to wait for any child */
     result = waitpid(-1, &status, 0);
     
     if (result >= 0) {
@@ -107,7 +107,7 @@ test_waitpid_negative_pid(void)
         return;
     }
     
-    printf("  Correctly failed with negative PID (result=%d)\n", (int)result);
+    printf("  Correctly failed with no children (result=%d)\n", (int)result);
     print_result(test_name, 1);
 }
 
@@ -377,6 +377,124 @@ test_waitpid_double_wait(void)
     }
 }
 
+/*
+ * Test 10: WNOHANG
+ * Returns 0 while the child is still running, and the child's PID
+ * once it has exited
+ */
+static void
+test_waitpid_wnohang(void)
+{
+    const char *test_name = "waitpid with WNOHANG";
+    struct timespec ts;
+    pid_t pid, result;
+    int status, tries;
+
+    pid = fork();
+
+    if (pid < 0) {
+        printf("  Error: fork failed\n");
+        print_result(test_name, 0);
+        return;
+    }
+
+    if (pid == 0) {
+        /* Child takes a while */
+        ts.tv_sec = 0;
+        ts.tv_nsec = 300000000;
+        nanosleep(&ts, NULL);
+        _exit(3);
+    }
+
+    result = waitpid(pid, &status, WNOHANG);
+    if (result != 0) {
+        printf("  Error: WNOHANG returned %d for a running child\n",
+               (int)result);
+        waitpid(pid, &status, 0);
+        print_result(test_name, 0);
+        return;
+    }
+
+    /* Poll until it's gone */
+    ts.tv_sec = 0;
+    ts.tv_nsec = 50000000;
+    for (tries = 0; tries < 100; tries++) {
+        result = waitpid(pid, &status, WNOHANG);
+        if (result != 0) {
+            break;
+        }
+        nanosleep(&ts, NULL);
+    }
+
+    if (result != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 3) {
+        printf("  Error: WNOHANG poll returned %d\n", (int)result);
+        print_result(test_name, 0);
+        return;
+    }
+
+    printf("  Child %d reaped after %d polls\n", (int)pid, tries);
+    print_result(test_name, 1);
+}
+
+/*
+ * Test 11: wait for any child
+ * With pid -1 the child that exits first is reaped first, whatever
+ * order the children were created in
+ */
+static void
+test_waitpid_any(void)
+{
+    const char *test_name = "waitpid(-1) reaps the first child to exit";
+    struct timespec ts;
+    pid_t slow, fast, result1, result2;
+    int status;
+
+    slow = fork();
+    if (slow < 0) {
+        printf("  Error: first fork failed\n");
+        print_result(test_name, 0);
+        return;
+    }
+    if (slow == 0) {
+        ts.tv_sec = 0;
+        ts.tv_nsec = 500000000;
+        nanosleep(&ts, NULL);
+        _exit(1);
+    }
+
+    fast = fork();
+    if (fast < 0) {
+        printf("  Error: second fork failed\n");
+        waitpid(slow, &status, 0);
+        print_result(test_name, 0);
+        return;
+    }
+    if (fast == 0) {
+        _exit(2);
+    }
+
+    result1 = waitpid(-1, &status, 0);
+    result2 = waitpid(-1, &status, 0);
+
+    if (result1 != fast || result2 != slow) {
+        printf("  Error: reaped %d then %d, expected %d then %d\n",
+               (int)result1, (int)result2, (int)fast, (int)slow);
+        print_result(test_name, 0);
+        return;
+    }
+
+    result1 = waitpid(-1, &status, WNOHANG);
+    if (result1 >= 0) {
+        printf("  Error: waitpid(-1) with no children returned %d\n",
+               (int)result1);
+        print_result(test_name, 0);
+        return;
+    }
+
+    printf("  Reaped %d, then %d\n", (int)fast, (int)slow);
+    print_result(test_name, 1);
+}
+
 int
 main(void)
 {
@@ -392,6 +510,8 @@ main(void)
     test_waitpid_multiple_children();
     test_waitpid_invalid_options();
     test_waitpid_double_wait();
+    test_waitpid_wnohang();
+    test_waitpid_any();
     
     printf("waitpid Test Summary:\n");
     printf("=============\n");
@@ -2,11 +2,16 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/wait.h>
 
 #define TEST_FILE "write_test.txt"
 #define TEST_DATA "Hello, OS/161 write test!\n"
 #define TEST_DATA_LEN 27
 
+#define APPEND_WRITERS 4
+#define APPEND_RECS 64
+#define APPEND_RECLEN 32
+
 static int tests_passed = 0;
 static int tests_failed = 0;
 
@@ -186,6 +191,154 @@ test_multiple_writes(void)
     print_result(test_name, 1);
 }
 
+/*
+ * Test 7: Write with O_APPEND after a seek. It opens a file for append, seeks
+ * back to the start, writes, and checks that the data went at the end anyway
+ * and that the offset was left after it.
+ */
+static void
+test_write_append(void)
+{
+    const char *test_name = "O_APPEND write goes at end of file";
+    char buf[16];
+    int fd;
+    off_t pos;
+    int result;
+
+    fd = open(TEST_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write(fd, "First ", 6) != 6) {
+        printf("  Error: Could not set up file\n");
+        print_result(test_name, 0);
+        return;
+    }
+    close(fd);
+
+    fd = open(TEST_FILE, O_WRONLY | O_APPEND);
+    if (fd < 0) {
+        printf("  Error: Could not open file\n");
+        print_result(test_name, 0);
+        return;
+    }
+    lseek(fd, 0, SEEK_SET);
+    result = write(fd, "Second", 6);
+    pos = lseek(fd, 0, SEEK_CUR);
+    close(fd);
+    if (result != 6 || pos != 12) {
+        printf("  Error: result=%d, offset after=%ld\n", result, (long)pos);
+        print_result(test_name, 0);
+        return;
+    }
+
+    fd = open(TEST_FILE, O_RDONLY);
+    result = read(fd, buf, sizeof(buf));
+    close(fd);
+    if (result != 12 || memcmp(buf, "First Second", 12) != 0) {
+        printf("  Error: file holds %d bytes, not \"First Second\"\n", result);
+        print_result(test_name, 0);
+        return;
+    }
+
+    print_result(test_name, 1);
+}
+
+/*
+ * Fill in record N of writer W: "wW nNNN " then W's letter to the end.
+ */
+static void
+append_record(char *rec, int w, int n)
+{
+    snprintf(rec, APPEND_RECLEN, "w%d n%03d ", w, n);
+    memset(rec + 9, 'a' + w, APPEND_RECLEN - 10);
+    rec[APPEND_RECLEN - 1] = '\n';
+}
+
+/*
+ * Test 8: Concurrent appenders. Several processes each open the file with
+ * O_APPEND on their own and write fixed-size records. Every record must be
+ * there exactly once, whole, and each writer's in its own order.
+ */
+static void
+test_write_append_concurrent(void)
+{
+    const char *test_name = "Concurrent O_APPEND writers lose nothing";
+    char rec[APPEND_RECLEN], want[APPEND_RECLEN];
+    int next[APPEND_WRITERS];
+    pid_t pids[APPEND_WRITERS];
+    int fd, w, n, status;
+    int bad = 0, total = 0;
+
+    fd = open(TEST_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("  Error: Could not create file\n");
+        print_result(test_name, 0);
+        return;
+    }
+    close(fd);
+
+    for (w = 0; w < APPEND_WRITERS; w++) {
+        pids[w] = fork();
+        if (pids[w] < 0) {
+            printf("  Error: fork failed\n");
+            bad = 1;
+            break;
+        }
+        if (pids[w] == 0) {
+            fd = open(TEST_FILE, O_WRONLY | O_APPEND);
+            if (fd < 0) {
+                _exit(1);
+            }
+            for (n = 0; n < APPEND_RECS; n++) {
+                append_record(rec, w, n);
+                if (write(fd, rec, APPEND_RECLEN) != APPEND_RECLEN) {
+                    _exit(1);
+                }
+            }
+            close(fd);
+            _exit(0);
+        }
+    }
+    while (--w >= 0) {
+        if (waitpid(pids[w], &status, 0) < 0 || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0) {
+            printf("  Error: writer %d failed\n", w);
+            bad = 1;
+        }
+    }
+    if (bad) {
+        print_result(test_name, 0);
+        return;
+    }
+
+    for (w = 0; w < APPEND_WRITERS; w++) {
+        next[w] = 0;
+    }
+    fd = open(TEST_FILE, O_RDONLY);
+    while (!bad && read(fd, rec, APPEND_RECLEN) == APPEND_RECLEN) {
+        w = rec[1] - '0';
+        if (rec[0] != 'w' || w < 0 || w >= APPEND_WRITERS) {
+            bad = 1;
+            break;
+        }
+        append_record(want, w, next[w]);
+        if (memcmp(rec, want, APPEND_RECLEN) != 0) {
+            bad = 1;
+            break;
+        }
+        next[w]++;
+        total++;
+    }
+    close(fd);
+
+    if (bad || total != APPEND_WRITERS * APPEND_RECS) {
+        printf("  Error: record %d is torn, missing or out of order\n", total);
+        print_result(test_name, 0);
+        return;
+    }
+
+    printf("  %d records from %d writers, all intact\n", total, APPEND_WRITERS);
+    print_result(test_name, 1);
+}
+
 int
 main(void)
 {
@@ -197,6 +350,8 @@ main(void)
     test_write_closed_fd();
     test_write_readonly_file();
     test_multiple_writes();
+    test_write_append();
+    test_write_append_concurrent();
     
     printf("write Test Summary:\n");
     printf("Passed: %d\n", tests_passed);
@@ -30,16 +30,18 @@
 /*
  * triplemat.c
  *
- * 	Calls three matmult programs.
+ * 	Calls three matmult programs, passing on any arguments (so
+ *	triplemat -m blocked runs three blocked matmults).
  *
  * When the VM assignment is complete, your system should survive this.
  */
 
+#include <stdlib.h>
 #include <test/triple.h>
 
 int
-main(void)
+main(int argc, char *argv[])
 {
-	triple("/testbin/matmult");
+	triplev("/testbin/matmult", argc > 1 ? argv + 1 : NULL);
 	return 0;
 }